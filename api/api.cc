@@ -29,10 +29,12 @@
 #include "failure_detector.hh"
 #include "column_family.hh"
 #include "lsa.hh"
+#include "memory.hh"
 #include "messaging_service.hh"
 #include "storage_proxy.hh"
 #include "cache_service.hh"
 #include "collectd.hh"
+#include "prometheus.hh"
 #include "endpoint_snitch.hh"
 #include "compaction_manager.hh"
 #include "hinted_handoff.hh"
@@ -134,6 +136,8 @@ future<> set_server_done(http_context& ctx) {
         set_compaction_manager(ctx, r);
         rb->register_function(r, "lsa", "Log-structured allocator API");
         set_lsa(ctx, r);
+        rb->register_function(r, "memory", "The memory usage API");
+        set_memory(ctx, r);
 
         rb->register_function(r, "commitlog",
                 "The commit log API");
@@ -144,6 +148,7 @@ future<> set_server_done(http_context& ctx) {
         rb->register_function(r, "collectd",
                 "The collectd API");
         set_collectd(ctx, r);
+        set_prometheus(ctx, r);
     });
 }
 
@@ -27,6 +27,7 @@
 #include <boost/algorithm/string/classification.hpp>
 #include "api/api-doc/utils.json.hh"
 #include "utils/histogram.hh"
+#include "utils/hdr_histogram.hh"
 #include "http/exception.hh"
 #include "api_init.hh"
 
@@ -134,6 +135,22 @@ httpd::utils_json::rate_moving_average_and_histogram timer_to_json(const utils::
     return h;
 }
 
+inline
+httpd::utils_json::latency_percentiles to_json(const utils::hdr_histogram& val) {
+    httpd::utils_json::latency_percentiles p;
+    p.count = val.count();
+    p.min = val.min();
+    p.max = val.max();
+    p.mean = val.mean();
+    p.p50 = val.percentile(50);
+    p.p75 = val.percentile(75);
+    p.p95 = val.percentile(95);
+    p.p98 = val.percentile(98);
+    p.p99 = val.percentile(99);
+    p.p999 = val.percentile(99.9);
+    return p;
+}
+
 template<class T, class F>
 future<json::json_return_type>  sum_histogram_stats(distributed<T>& d, utils::timed_rate_moving_average_and_histogram F::*f) {
 
@@ -22,16 +22,47 @@
 #include "cache_service.hh"
 #include "api/api-doc/cache_service.json.hh"
 #include "column_family.hh"
+#include "sstables/key_cache.hh"
+#include "sstables/chunk_cache.hh"
+#include "db/cache_saver.hh"
+#include "db/counter_cache.hh"
+#include "db/config.hh"
 
 namespace api {
 using namespace json;
 namespace cs = httpd::cache_service_json;
 
+template <typename Func>
+static future<json::json_return_type> map_reduce_key_cache(http_context& ctx, Func&& f) {
+    return ctx.db.map_reduce0([f = std::forward<Func>(f)] (database&) {
+        return f(sstables::global_key_cache());
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
+template <typename Func>
+static future<json::json_return_type> map_reduce_chunk_cache(http_context& ctx, Func&& f) {
+    return ctx.db.map_reduce0([f = std::forward<Func>(f)] (database&) {
+        return f(sstables::global_chunk_cache());
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
+template <typename Func>
+static future<json::json_return_type> map_reduce_counter_cache(http_context& ctx, Func&& f) {
+    return ctx.db.map_reduce0([f = std::forward<Func>(f)] (database&) {
+        return f(db::global_counter_cache());
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
 void set_cache_service(http_context& ctx, routes& r) {
-    cs::get_row_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
-        // We never save the cache
+    cs::get_row_cache_save_period_in_seconds.set(r, [&ctx](std::unique_ptr<request> req) {
         // Origin uses 0 for never
-        return make_ready_future<json::json_return_type>(0);
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_config().row_cache_save_period());
     });
 
     cs::set_row_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
@@ -67,10 +98,8 @@ void set_cache_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    cs::get_row_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_row_cache_keys_to_save.set(r, [&ctx](std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_config().row_cache_keys_to_save());
     });
 
     cs::set_row_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
@@ -106,16 +135,20 @@ void set_cache_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    cs::invalidate_key_cache.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::invalidate_key_cache.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.invoke_on_all([] (database&) {
+            sstables::global_key_cache().clear();
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    cs::invalidate_counter_cache.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::invalidate_counter_cache.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.invoke_on_all([] (database&) {
+            db::global_counter_cache().clear();
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     cs::set_row_cache_capacity_in_mb.set(r, [](std::unique_ptr<request> req) {
@@ -125,72 +158,132 @@ void set_cache_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    cs::set_key_cache_capacity_in_mb.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto period = req->get_query_param("period");
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::set_key_cache_capacity_in_mb.set(r, [&ctx](std::unique_ptr<request> req) {
+        uint64_t capacity;
+        try {
+            capacity = boost::lexical_cast<uint64_t>(std::string(req->get_query_param("capacity")));
+        } catch (boost::bad_lexical_cast& e) {
+            throw bad_param_exception("Invalid key cache capacity " + req->get_query_param("capacity"));
+        }
+        return ctx.db.invoke_on_all([capacity] (database&) {
+            sstables::global_key_cache().set_capacity((capacity << 20) / smp::count);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    cs::set_counter_cache_capacity_in_mb.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto capacity = req->get_query_param("capacity");
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::set_chunk_cache_capacity_in_mb.set(r, [&ctx](std::unique_ptr<request> req) {
+        uint64_t capacity;
+        try {
+            capacity = boost::lexical_cast<uint64_t>(std::string(req->get_query_param("capacity")));
+        } catch (boost::bad_lexical_cast& e) {
+            throw bad_param_exception("Invalid chunk cache capacity " + req->get_query_param("capacity"));
+        }
+        return ctx.db.invoke_on_all([capacity] (database&) {
+            sstables::global_chunk_cache().set_capacity((capacity << 20) / smp::count);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    cs::set_counter_cache_capacity_in_mb.set(r, [&ctx](std::unique_ptr<request> req) {
+        uint64_t capacity;
+        try {
+            capacity = boost::lexical_cast<uint64_t>(std::string(req->get_query_param("capacity")));
+        } catch (boost::bad_lexical_cast& e) {
+            throw bad_param_exception("Invalid counter cache capacity " + req->get_query_param("capacity"));
+        }
+        return ctx.db.invoke_on_all([capacity] (database&) {
+            db::global_counter_cache().set_capacity((capacity << 20) / smp::count);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     cs::save_caches.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(json_void());
+        return db::get_cache_saver().invoke_on_all([] (db::cache_saver& cs) {
+            return cs.save();
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    cs::get_key_capacity.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for capacity is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return uint64_t(kc.capacity());
+        });
     });
 
-    cs::get_key_hits.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for hits is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_hits.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().hits;
+        });
     });
 
-    cs::get_key_requests.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for request is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_requests.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().hits + kc.get_stats().misses;
+        });
     });
 
-    cs::get_key_hit_rate.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for rate is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_hit_rate.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            auto& stats = sstables::global_key_cache().get_stats();
+            return ratio_holder(stats.hits + stats.misses, stats.hits);
+        }, ratio_holder(), std::plus<ratio_holder>()).then([] (const ratio_holder& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
-    cs::get_key_size.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for size is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_size.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return uint64_t(kc.region().occupancy().used_space());
+        });
     });
 
-    cs::get_key_entries.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for key entries is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_entries.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().entries;
+        });
+    });
+
+    cs::get_chunk_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_chunk_cache(ctx, [] (const sstables::chunk_cache& cc) {
+            return uint64_t(cc.capacity());
+        });
+    });
+
+    cs::get_chunk_hits.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_chunk_cache(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().hits;
+        });
+    });
+
+    cs::get_chunk_requests.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_chunk_cache(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().hits + cc.get_stats().misses;
+        });
+    });
+
+    cs::get_chunk_hit_rate.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            auto& stats = sstables::global_chunk_cache().get_stats();
+            return ratio_holder(stats.hits + stats.misses, stats.hits);
+        }, ratio_holder(), std::plus<ratio_holder>()).then([] (const ratio_holder& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    cs::get_chunk_size.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_chunk_cache(ctx, [] (const sstables::chunk_cache& cc) {
+            return uint64_t(cc.region().occupancy().used_space());
+        });
+    });
+
+    cs::get_chunk_entries.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_chunk_cache(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().entries;
+        });
     });
 
     cs::get_row_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
@@ -248,52 +341,43 @@ void set_cache_service(http_context& ctx, routes& r) {
         }, std::plus<uint64_t>());
     });
 
-    cs::get_counter_capacity.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for rate is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_counter_cache(ctx, [] (const db::counter_cache& cc) {
+            return uint64_t(cc.capacity());
+        });
     });
 
-    cs::get_counter_hits.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for hits is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_hits.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_counter_cache(ctx, [] (const db::counter_cache& cc) {
+            return cc.get_stats().hits;
+        });
     });
 
-    cs::get_counter_requests.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for hits is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_requests.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_counter_cache(ctx, [] (const db::counter_cache& cc) {
+            return cc.get_stats().hits + cc.get_stats().misses;
+        });
     });
 
-    cs::get_counter_hit_rate.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for rate is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_hit_rate.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            auto& stats = db::global_counter_cache().get_stats();
+            return ratio_holder(stats.hits + stats.misses, stats.hits);
+        }, ratio_holder(), std::plus<ratio_holder>()).then([] (const ratio_holder& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
-    cs::get_counter_size.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for size is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_size.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_counter_cache(ctx, [] (const db::counter_cache& cc) {
+            return uint64_t(cc.region().occupancy().used_space());
+        });
     });
 
-    cs::get_counter_entries.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support counter cache,
-        // so currently returning a 0 for entries is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_counter_entries.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_counter_cache(ctx, [] (const db::counter_cache& cc) {
+            return cc.get_stats().entries;
+        });
     });
 }
 
@@ -25,7 +25,10 @@
 #include "http/exception.hh"
 #include "sstables/sstables.hh"
 #include "sstables/estimated_histogram.hh"
+#include "db/top_partitions_sampler.hh"
 #include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <seastar/core/sleep.hh>
 
 namespace api {
 using namespace httpd;
@@ -62,6 +65,30 @@ future<> foreach_column_family(http_context& ctx, const sstring& name, function<
     });
 }
 
+static uint64_t get_uint_query_param(const request& req, const sstring& name, uint64_t default_value) {
+    auto value = req.get_query_param(name);
+    if (value.empty()) {
+        return default_value;
+    }
+    try {
+        return boost::lexical_cast<uint64_t>(std::string(value));
+    } catch (boost::bad_lexical_cast& e) {
+        throw bad_param_exception("Invalid " + name + " " + value);
+    }
+}
+
+static void set_toppartitions(const std::vector<db::top_partitions_sampler::sampled_partition>& partitions,
+        json::json_list<cf::toppartitions_record>& to) {
+    for (auto&& p : partitions) {
+        cf::toppartitions_record r;
+        r.partition = p.key;
+        r.count = p.count;
+        r.error = p.error;
+        r.bytes = p.bytes;
+        to.push(r);
+    }
+}
+
 future<json::json_return_type>  get_cf_stats(http_context& ctx, const sstring& name,
         int64_t column_family::stats::*f) {
     return map_reduce_cf(ctx, name, int64_t(0), [f](const column_family& cf) {
@@ -191,6 +218,11 @@ static double update_ratio(double acc, double f, double total) {
     return acc;
 }
 
+static ratio_holder write_amplification(column_family& cf) {
+    auto& stats = cf.get_stats();
+    return ratio_holder(stats.bytes_flushed, stats.bytes_flushed + stats.compaction_bytes_written);
+}
+
 static ratio_holder mean_row_size(column_family& cf) {
     ratio_holder res;
     for (auto i: *cf.get_sstables() ) {
@@ -394,6 +426,38 @@ void set_column_family(http_context& ctx, routes& r) {
         return get_cf_stats(ctx, &column_family::stats::memtable_switch_count);
     });
 
+    cf::get_bytes_flushed.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, req->param["name"], &column_family::stats::bytes_flushed);
+    });
+
+    cf::get_all_bytes_flushed.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, &column_family::stats::bytes_flushed);
+    });
+
+    cf::get_compaction_bytes_read.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, req->param["name"], &column_family::stats::compaction_bytes_read);
+    });
+
+    cf::get_all_compaction_bytes_read.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, &column_family::stats::compaction_bytes_read);
+    });
+
+    cf::get_compaction_bytes_written.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, req->param["name"], &column_family::stats::compaction_bytes_written);
+    });
+
+    cf::get_all_compaction_bytes_written.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, &column_family::stats::compaction_bytes_written);
+    });
+
+    cf::get_write_amplification.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], ratio_holder(), write_amplification, std::plus<ratio_holder>());
+    });
+
+    cf::get_all_write_amplification.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, ratio_holder(), write_amplification, std::plus<ratio_holder>());
+    });
+
     cf::get_estimated_row_size_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
         return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
             sstables::estimated_histogram res(0);
@@ -648,7 +712,7 @@ void set_column_family(http_context& ctx, routes& r) {
     cf::get_bloom_filter_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
         return map_reduce_cf(ctx, req->param["name"], uint64_t(0), [] (column_family& cf) {
             return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
-                return sst->filter_memory_size();
+                return s + sst->filter_memory_size();
             });
         }, std::plus<uint64_t>());
     });
@@ -656,7 +720,7 @@ void set_column_family(http_context& ctx, routes& r) {
     cf::get_all_bloom_filter_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
         return map_reduce_cf(ctx, uint64_t(0), [] (column_family& cf) {
             return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
-                return sst->filter_memory_size();
+                return s + sst->filter_memory_size();
             });
         }, std::plus<uint64_t>());
     });
@@ -664,7 +728,7 @@ void set_column_family(http_context& ctx, routes& r) {
     cf::get_index_summary_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
         return map_reduce_cf(ctx, req->param["name"], uint64_t(0), [] (column_family& cf) {
             return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
-                return sst->get_summary().memory_footprint();
+                return s + sst->get_summary().memory_footprint();
             });
         }, std::plus<uint64_t>());
     });
@@ -672,25 +736,25 @@ void set_column_family(http_context& ctx, routes& r) {
     cf::get_all_index_summary_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
         return map_reduce_cf(ctx, uint64_t(0), [] (column_family& cf) {
             return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
-                return sst->get_summary().memory_footprint();
+                return s + sst->get_summary().memory_footprint();
             });
         }, std::plus<uint64_t>());
     });
 
-    cf::get_compression_metadata_off_heap_memory_used.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        // FIXME
-        // We are missing the off heap memory calculation
-        // Return 0 is the wrong value. It's a work around
-        // until the memory calculation will be available
-        //auto id = get_uuid(req->param["name"], ctx.db.local());
-        return make_ready_future<json::json_return_type>(0);
+    cf::get_compression_metadata_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], uint64_t(0), [] (column_family& cf) {
+            return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
+                return s + sst->compression_memory_size();
+            });
+        }, std::plus<uint64_t>());
     });
 
-    cf::get_all_compression_metadata_off_heap_memory_used.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    cf::get_all_compression_metadata_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, uint64_t(0), [] (column_family& cf) {
+            return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
+                return s + sst->compression_memory_size();
+            });
+        }, std::plus<uint64_t>());
     });
 
     cf::get_speculative_retries.set(r, [] (std::unique_ptr<request> req) {
@@ -805,6 +869,34 @@ void set_column_family(http_context& ctx, routes& r) {
         sstables::merge, utils_json::estimated_histogram());
     });
 
+    cf::get_sstables_checked_per_read_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
+            return cf.get_stats().sstables_checked_per_read;
+        },
+        sstables::merge, utils_json::estimated_histogram());
+    });
+
+    cf::get_false_positives_per_read_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
+            return cf.get_stats().false_positives_per_read;
+        },
+        sstables::merge, utils_json::estimated_histogram());
+    });
+
+    cf::get_index_reads_per_read_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
+            return cf.get_stats().index_reads_per_read;
+        },
+        sstables::merge, utils_json::estimated_histogram());
+    });
+
+    cf::get_data_bytes_per_read_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
+            return cf.get_stats().data_bytes_per_read;
+        },
+        sstables::merge, utils_json::estimated_histogram());
+    });
+
     cf::get_tombstone_scanned_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
         return get_cf_histogram(ctx, req->param["name"], &column_family::stats::tombstone_scanned);
     });
@@ -874,6 +966,30 @@ void set_column_family(http_context& ctx, routes& r) {
         sstables::merge, utils_json::estimated_histogram());
     });
 
+    cf::get_read_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return map_reduce_cf_raw(ctx, req->param["name"], utils::hdr_histogram(), [](column_family& cf) {
+            return cf.get_stats().read_latency;
+        }, std::plus<utils::hdr_histogram>()).then([](const utils::hdr_histogram& res) {
+            return make_ready_future<json::json_return_type>(to_json(res));
+        });
+    });
+
+    cf::get_range_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return map_reduce_cf_raw(ctx, req->param["name"], utils::hdr_histogram(), [](column_family& cf) {
+            return cf.get_stats().range_latency;
+        }, std::plus<utils::hdr_histogram>()).then([](const utils::hdr_histogram& res) {
+            return make_ready_future<json::json_return_type>(to_json(res));
+        });
+    });
+
+    cf::get_write_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return map_reduce_cf_raw(ctx, req->param["name"], utils::hdr_histogram(), [](column_family& cf) {
+            return cf.get_stats().write_latency;
+        }, std::plus<utils::hdr_histogram>()).then([](const utils::hdr_histogram& res) {
+            return make_ready_future<json::json_return_type>(to_json(res));
+        });
+    });
+
     cf::set_compaction_strategy_class.set(r, [&ctx](std::unique_ptr<request> req) {
         sstring strategy = req->get_query_param("class_name");
         return foreach_column_family(ctx, req->param["name"], [strategy](column_family& cf) {
@@ -899,6 +1015,39 @@ void set_column_family(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
+    cf::toppartitions.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto uuid = get_uuid(req->param["name"], ctx.db.local());
+        auto duration = std::chrono::milliseconds(get_uint_query_param(*req, "duration", 0));
+        auto capacity = get_uint_query_param(*req, "capacity", 256);
+        auto list_size = get_uint_query_param(*req, "list_size", 10);
+        // Sampling sessions are started and stopped on all shards together,
+        // so the state of this shard stands for all of them.
+        if (!ctx.db.local().find_column_family(uuid).start_top_partitions_sampling(capacity)) {
+            throw bad_param_exception("Partitions of " + req->param["name"] + " are already being sampled");
+        }
+        auto origin = engine().cpu_id();
+        return ctx.db.invoke_on_all([uuid, capacity, origin] (database& db) {
+            if (engine().cpu_id() != origin) {
+                db.find_column_family(uuid).start_top_partitions_sampling(capacity);
+            }
+        }).then([duration] {
+            return sleep(duration);
+        }).then_wrapped([&ctx, uuid, list_size] (future<> f) {
+            // Stop sampling everywhere, even if starting it failed somewhere.
+            return ctx.db.map_reduce0([uuid] (database& db) {
+                return db.find_column_family(uuid).stop_top_partitions_sampling();
+            }, db::top_partitions_sampler::results(), [list_size] (auto a, auto b) {
+                return db::top_partitions_sampler::merge(std::move(a), std::move(b), list_size);
+            }).then([f = std::move(f)] (db::top_partitions_sampler::results res) mutable {
+                f.get();
+                cf::toppartitions_result r;
+                set_toppartitions(res.reads, r.read);
+                set_toppartitions(res.writes, r.write);
+                return make_ready_future<json::json_return_type>(r);
+            });
+        });
+    });
+
     cf::get_sstable_count_per_level.set(r, [&ctx](std::unique_ptr<request> req) {
         // TBD
         // FIXME
@@ -40,6 +40,18 @@ static auto acquire_cl_metric(http_context& ctx, Func&& func) {
     });
 }
 
+template<typename Func>
+static future<json::json_return_type> acquire_cl_histogram(http_context& ctx, Func&& func) {
+    return ctx.db.map_reduce0([func = std::forward<Func>(func)](database& db) {
+        if (db.commitlog() == nullptr) {
+            return utils::ihistogram();
+        }
+        return func(db.commitlog());
+    }, utils::ihistogram(), std::plus<utils::ihistogram>()).then([](const utils::ihistogram& res) {
+        return make_ready_future<json::json_return_type>(to_json(res));
+    });
+}
+
 void set_commitlog(http_context& ctx, routes& r) {
     httpd::commitlog_json::get_active_segment_names.set(r,
             [&ctx](std::unique_ptr<request> req) {
@@ -73,6 +85,14 @@ void set_commitlog(http_context& ctx, routes& r) {
     httpd::commitlog_json::get_total_commit_log_size.set(r, [&ctx](std::unique_ptr<request> req) {
         return acquire_cl_metric(ctx, std::bind(&db::commitlog::get_total_size, std::placeholders::_1));
     });
+
+    httpd::commitlog_json::get_group_commit_size.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_histogram(ctx, std::bind(&db::commitlog::get_group_commit_size_histogram, std::placeholders::_1));
+    });
+
+    httpd::commitlog_json::get_group_commit_latency.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_histogram(ctx, std::bind(&db::commitlog::get_group_commit_latency_histogram, std::placeholders::_1));
+    });
 }
 
 }
@@ -20,6 +20,7 @@
  */
 
 #include "compaction_manager.hh"
+#include "column_family.hh"
 #include "api/api-doc/compaction_manager.json.hh"
 #include "db/system_keyspace.hh"
 
@@ -85,18 +86,12 @@ void set_compaction_manager(http_context& ctx, routes& r) {
         return get_cm_stats(ctx, &compaction_manager::stats::completed_tasks);
     });
 
-    cm::get_total_compactions_completed.set(r, [] (std::unique_ptr<request> req) {
-        // FIXME
-        // We are currently dont have an API for compaction
-        // so returning a 0 as the number of total compaction is ok
-        return make_ready_future<json::json_return_type>(0);
+    cm::get_total_compactions_completed.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, &column_family::stats::compactions_completed);
     });
 
-    cm::get_bytes_compacted.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        // FIXME
-        warn(unimplemented::cause::API);
-        return make_ready_future<json::json_return_type>(0);
+    cm::get_bytes_compacted.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, &column_family::stats::compaction_bytes_read);
     });
 
     cm::get_compaction_history.set(r, [] (std::unique_ptr<request> req) {
@@ -118,6 +113,15 @@ void set_compaction_manager(http_context& ctx, routes& r) {
                     e.value = it.second;
                     h.rows_merged.push(std::move(e));
                 }
+                h.sstables_in = entry.sstables_in;
+                h.sstables_out = entry.sstables_out;
+                h.partitions_in = entry.partitions_in;
+                h.partitions_out = entry.partitions_out;
+                h.tombstones_expired = entry.tombstones_expired;
+                h.tombstones_purged = entry.tombstones_purged;
+                h.duration_ms = entry.duration_ms;
+                h.throughput = entry.duration_ms ? double(entry.bytes_out) * 1000 / entry.duration_ms : 0;
+                h.compaction_strategy = std::move(entry.compaction_strategy);
                 res.push_back(std::move(h));
             }
 
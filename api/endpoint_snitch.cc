@@ -20,6 +20,7 @@
  */
 
 #include "locator/snitch_base.hh"
+#include "locator/dynamic_snitch.hh"
 #include "endpoint_snitch.hh"
 #include "api/api-doc/endpoint_snitch_info.json.hh"
 
@@ -37,6 +38,36 @@ void set_endpoint_snitch(http_context& ctx, routes& r) {
     httpd::endpoint_snitch_info_json::get_snitch_name.set(r, [] (const_req req) {
         return locator::i_endpoint_snitch::get_local_snitch_ptr()->get_name();
     });
+
+    httpd::endpoint_snitch_info_json::get_scores.set(r, [] (std::unique_ptr<request> req) {
+        using scores_type = std::unordered_map<gms::inet_address, std::pair<double, unsigned>>;
+        if (!locator::get_dynamic_snitch().local_is_initialized()) {
+            return make_ready_future<json::json_return_type>(std::vector<httpd::endpoint_snitch_info_json::map_string_double>());
+        }
+        return locator::get_dynamic_snitch().map_reduce0([] (locator::dynamic_snitch& ds) {
+            scores_type scores;
+            for (auto&& s : ds.get_scores()) {
+                scores.emplace(s.first, std::make_pair(s.second, 1u));
+            }
+            return scores;
+        }, scores_type(), [] (scores_type a, const scores_type& b) {
+            for (auto&& s : b) {
+                auto& e = a[s.first];
+                e.first += s.second.first;
+                e.second += s.second.second;
+            }
+            return a;
+        }).then([] (scores_type scores) {
+            std::vector<httpd::endpoint_snitch_info_json::map_string_double> res;
+            for (auto&& s : scores) {
+                httpd::endpoint_snitch_info_json::map_string_double val;
+                val.key = boost::lexical_cast<std::string>(s.first);
+                val.value = s.second.first / s.second.second;
+                res.push_back(val);
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
 }
 
 }
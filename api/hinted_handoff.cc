@@ -21,6 +21,7 @@
 
 #include "hinted_handoff.hh"
 #include "api/api-doc/hinted_handoff.json.hh"
+#include "db/hints_manager.hh"
 
 namespace api {
 
@@ -30,45 +31,63 @@ namespace hh = httpd::hinted_handoff_json;
 
 void set_hinted_handoff(http_context& ctx, routes& r) {
     hh::list_endpoints_pending_hints.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        std::vector<sstring> res;
-        return make_ready_future<json::json_return_type>(res);
+        return db::get_hints_manager().map_reduce0([] (db::hints_manager& hm) {
+            return hm.endpoints_pending_hints();
+        }, std::set<gms::inet_address>(), [] (std::set<gms::inet_address> a, std::vector<gms::inet_address> b) {
+            a.insert(b.begin(), b.end());
+            return a;
+        }).then([] (std::set<gms::inet_address> eps) {
+            std::vector<sstring> res;
+            for (auto&& ep : eps) {
+                res.push_back(ep.to_sstring());
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
     hh::truncate_all_hints.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
         sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(json_void());
+        return db::get_hints_manager().invoke_on_all([host] (db::hints_manager& hm) {
+            return host.empty() ? hm.truncate_all() : hm.truncate(gms::inet_address(host));
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     hh::schedule_hint_delivery.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(json_void());
+        gms::inet_address host(req->get_query_param("host"));
+        return db::get_hints_manager().invoke_on_all([host] (db::hints_manager& hm) {
+            return hm.schedule_delivery(host);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     hh::pause_hints_delivery.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring pause = req->get_query_param("pause");
-        return make_ready_future<json::json_return_type>(json_void());
+        bool pause = strcasecmp(req->get_query_param("pause").c_str(), "true") == 0;
+        return db::get_hints_manager().invoke_on_all([pause] (db::hints_manager& hm) {
+            hm.pause_delivery(pause);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     hh::get_create_hint_count.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(0);
+        gms::inet_address addr(req->param["addr"]);
+        return db::get_hints_manager().map_reduce0([addr] (db::hints_manager& hm) {
+            return hm.created_hints(addr);
+        }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t count) {
+            return make_ready_future<json::json_return_type>(count);
+        });
     });
 
     hh::get_not_stored_hints_count.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(0);
+        gms::inet_address addr(req->param["addr"]);
+        return db::get_hints_manager().map_reduce0([addr] (db::hints_manager& hm) {
+            return hm.not_stored_hints(addr);
+        }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t count) {
+            return make_ready_future<json::json_return_type>(count);
+        });
     });
 }
 
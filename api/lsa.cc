@@ -40,6 +40,28 @@ void set_lsa(http_context& ctx, routes& r) {
             return json::json_return_type(json::json_void());
         });
     });
+
+    httpd::lsa_json::get_lsa_occupancy.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            return logalloc::shard_tracker().region_occupancy_by_size_class();
+        }, logalloc::size_class_occupancy(), [] (logalloc::size_class_occupancy a, const logalloc::size_class_occupancy& b) {
+            a += b;
+            return a;
+        }).then([] (const logalloc::size_class_occupancy& occ) {
+            std::vector<httpd::lsa_json::size_class_occupancy> res;
+            auto add = [&res] (const char* name, const logalloc::occupancy_stats& s) {
+                httpd::lsa_json::size_class_occupancy o;
+                o.size_class = name;
+                o.used = s.used_space();
+                o.total = s.total_space();
+                res.push_back(std::move(o));
+            };
+            add("small", occ.small);
+            add("large", occ.large);
+            add("non_lsa", occ.non_lsa);
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
 }
 
 }
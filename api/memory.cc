@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "api/api-doc/memory.json.hh"
+#include "api/memory.hh"
+#include "api/api.hh"
+
+#include "database.hh"
+#include "row_cache.hh"
+#include "cql3/query_processor.hh"
+#include "db/counter_cache.hh"
+#include "sstables/chunk_cache.hh"
+#include "sstables/key_cache.hh"
+#include "utils/logalloc.hh"
+#include <boost/range/adaptor/map.hpp>
+
+namespace api {
+
+namespace mj = httpd::memory_json;
+
+// Filled on the shard being described, and converted to json on the
+// shard serving the request.
+struct shard_memory {
+    unsigned shard = 0;
+    uint64_t total = 0;
+    uint64_t free = 0;
+    uint64_t allocated = 0;
+    uint64_t lsa_total = 0;
+    uint64_t lsa_used = 0;
+    uint64_t row_cache = 0;
+    uint64_t memtables = 0;
+    uint64_t system_memtables = 0;
+    uint64_t streaming_memtables = 0;
+    uint64_t key_cache = 0;
+    uint64_t chunk_cache = 0;
+    uint64_t counter_cache = 0;
+    uint64_t bloom_filters = 0;
+    uint64_t index_summaries = 0;
+    uint64_t compression_metadata = 0;
+    uint64_t prepared_statements = 0;
+    uint64_t read_buffers = 0;
+};
+
+struct sstable_memory {
+    unsigned shard;
+    sstring keyspace;
+    sstring table;
+    sstring filename;
+    uint64_t bloom_filter;
+    uint64_t index_summary;
+    uint64_t compression_metadata;
+};
+
+static shard_memory get_local_shard_memory(database& db) {
+    shard_memory m;
+    auto stats = memory::stats();
+    m.shard = engine().cpu_id();
+    m.total = stats.total_memory();
+    m.free = stats.free_memory();
+    m.allocated = stats.allocated_memory();
+    auto lsa = logalloc::shard_tracker().occupancy();
+    m.lsa_total = lsa.total_space();
+    m.lsa_used = lsa.used_space();
+    m.row_cache = global_cache_tracker().region().occupancy().total_space();
+    // Region groups include the memory of their subgroups.
+    m.memtables = db.dirty_memory_region_group().memory_used();
+    m.system_memtables = db.system_dirty_memory_region_group().memory_used() - m.memtables;
+    m.streaming_memtables = db.streaming_dirty_memory_region_group().memory_used();
+    m.key_cache = sstables::global_key_cache().region().occupancy().total_space();
+    m.chunk_cache = sstables::global_chunk_cache().region().occupancy().total_space();
+    m.counter_cache = db::global_counter_cache().region().occupancy().total_space();
+    for (auto& cf : db.get_column_families() | boost::adaptors::map_values) {
+        for (auto& sst : *cf->get_sstables()) {
+            m.bloom_filters += sst->filter_memory_size();
+            m.index_summaries += sst->get_summary().memory_footprint();
+            m.compression_metadata += sst->compression_memory_size();
+        }
+    }
+    if (cql3::get_query_processor().local_is_initialized()) {
+        m.prepared_statements = cql3::get_local_query_processor().prepared_statements_memory_footprint();
+    }
+    m.read_buffers = db.sstable_reads_memory_in_use();
+    return m;
+}
+
+static std::vector<sstable_memory> get_local_sstable_memory(database& db) {
+    std::vector<sstable_memory> res;
+    for (auto& cf : db.get_column_families() | boost::adaptors::map_values) {
+        for (auto& sst : *cf->get_sstables()) {
+            res.push_back(sstable_memory{engine().cpu_id(), cf->schema()->ks_name(), cf->schema()->cf_name(),
+                    sst->get_filename(), sst->filter_memory_size(), sst->get_summary().memory_footprint(),
+                    sst->compression_memory_size()});
+        }
+    }
+    return res;
+}
+
+template <typename T>
+static std::vector<T> concat(std::vector<T> a, std::vector<T> b) {
+    std::move(b.begin(), b.end(), std::back_inserter(a));
+    return a;
+}
+
+void set_memory(http_context& ctx, routes& r) {
+    mj::get_shard_memory.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database& db) {
+            return std::vector<shard_memory>{get_local_shard_memory(db)};
+        }, std::vector<shard_memory>(), concat<shard_memory>).then([] (std::vector<shard_memory> shards) {
+            std::sort(shards.begin(), shards.end(), [] (auto& a, auto& b) { return a.shard < b.shard; });
+            std::vector<mj::shard_memory> res;
+            for (auto& m : shards) {
+                mj::shard_memory s;
+                s.shard = m.shard;
+                s.total = m.total;
+                s.free = m.free;
+                s.allocated = m.allocated;
+                s.lsa_total = m.lsa_total;
+                s.lsa_used = m.lsa_used;
+                s.non_lsa = m.allocated - std::min(m.allocated, m.lsa_total);
+                s.row_cache = m.row_cache;
+                s.memtables = m.memtables;
+                s.system_memtables = m.system_memtables;
+                s.streaming_memtables = m.streaming_memtables;
+                s.key_cache = m.key_cache;
+                s.chunk_cache = m.chunk_cache;
+                s.counter_cache = m.counter_cache;
+                s.bloom_filters = m.bloom_filters;
+                s.index_summaries = m.index_summaries;
+                s.compression_metadata = m.compression_metadata;
+                s.prepared_statements = m.prepared_statements;
+                s.read_buffers = m.read_buffers;
+                res.push_back(std::move(s));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    mj::get_sstable_memory.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database& db) {
+            return get_local_sstable_memory(db);
+        }, std::vector<sstable_memory>(), concat<sstable_memory>).then([] (std::vector<sstable_memory> sstables) {
+            std::vector<mj::sstable_memory> res;
+            res.reserve(sstables.size());
+            for (auto& m : sstables) {
+                mj::sstable_memory s;
+                s.shard = m.shard;
+                s.keyspace = m.keyspace;
+                s.table = m.table;
+                s.filename = m.filename;
+                s.bloom_filter = m.bloom_filter;
+                s.index_summary = m.index_summary;
+                s.compression_metadata = m.compression_metadata;
+                res.push_back(std::move(s));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+}
+
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prometheus.hh"
+#include "http/function_handlers.hh"
+#include "core/scollectd.hh"
+#include "core/scollectd_api.hh"
+#include "database.hh"
+#include <boost/range/irange.hpp>
+#include <map>
+#include <string>
+#include <cinttypes>
+
+namespace api {
+
+using namespace scollectd;
+using namespace httpd;
+
+// Values of the enabled scollectd metrics of a shard.
+using shard_values = std::vector<std::pair<type_instance_id, std::vector<collectd_value>>>;
+
+// Latency percentiles of a column family on a shard, in microseconds.
+struct cf_latencies {
+    sstring ks;
+    sstring cf;
+    struct summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t p50;
+        uint64_t p95;
+        uint64_t p99;
+        uint64_t p999;
+    };
+    summary read;
+    summary range;
+    summary write;
+};
+
+struct shard_metrics {
+    shard_values values;
+    std::vector<cf_latencies> latencies;
+};
+
+// The text of a metric family which doesn't depend on its values. It is
+// rendered when a metric is first seen and reused by later scrapes.
+struct metric_family {
+    std::string name;
+    // The TYPE line.
+    std::string header;
+    // Labels common to all samples, each followed by a comma.
+    std::string labels;
+};
+
+static thread_local std::map<type_instance_id, metric_family> rendered_families;
+
+static std::string sanitize_name(std::string name) {
+    auto res = std::move(name);
+    for (auto& c : res) {
+        if (!isalnum(c) && c != '_' && c != ':') {
+            c = '_';
+        }
+    }
+    return res;
+}
+
+static void append_label_value(std::string& out, const sstring& value) {
+    out += "\"";
+    for (auto c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += "\"";
+}
+
+static const metric_family& get_family(const type_instance_id& id, data_type type) {
+    auto i = rendered_families.find(id);
+    if (i != rendered_families.end()) {
+        return i->second;
+    }
+    metric_family f;
+    f.name = sanitize_name("scylla_" + std::string(id.plugin()) + "_" + std::string(id.type()) + "_" + std::string(id.type_instance()));
+    f.header = "# TYPE " + f.name + (type == data_type::GAUGE ? " gauge\n" : " counter\n");
+    if (id.plugin_instance() != per_cpu_plugin_instance) {
+        f.labels = "instance=";
+        append_label_value(f.labels, id.plugin_instance());
+        f.labels += ",";
+    }
+    return rendered_families.emplace(id, std::move(f)).first->second;
+}
+
+static void append_value(std::string& out, const collectd_value& v) {
+    char buf[32];
+    switch (v._type) {
+    case data_type::GAUGE:
+        snprintf(buf, sizeof(buf), "%.17g", v.u._d);
+        break;
+    case data_type::DERIVE:
+        snprintf(buf, sizeof(buf), "%" PRId64, v.u._i);
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "%" PRIu64, v.u._ui);
+        break;
+    }
+    out += buf;
+}
+
+static void append_collectd_metrics(std::string& out, const std::vector<shard_metrics>& shards) {
+    struct sample {
+        unsigned shard;
+        const metric_family* family;
+        const std::vector<collectd_value>* values;
+    };
+    // Prometheus wants all samples of a family together, but metrics are
+    // collected per shard, and instances of a plugin map to the same family.
+    std::map<std::string, std::vector<sample>> families;
+    size_t ids = 0;
+    for (unsigned shard = 0; shard < shards.size(); ++shard) {
+        ids = std::max(ids, shards[shard].values.size());
+        for (auto&& m : shards[shard].values) {
+            if (!m.second.empty()) {
+                auto& f = get_family(m.first, m.second.front()._type);
+                families[f.name].push_back(sample{shard, &f, &m.second});
+            }
+        }
+    }
+    for (auto&& f : families) {
+        out += f.second.front().family->header;
+        for (auto&& s : f.second) {
+            auto& values = *s.values;
+            for (size_t i = 0; i < values.size(); ++i) {
+                out += f.first;
+                out += "{";
+                out += s.family->labels;
+                if (values.size() > 1) {
+                    out += "value=\"" + std::to_string(i) + "\",";
+                }
+                out += "shard=\"" + std::to_string(s.shard) + "\"} ";
+                append_value(out, values[i]);
+                out += "\n";
+            }
+        }
+    }
+    // Forget the families of metrics which went away, e.g. with dropped tables.
+    if (rendered_families.size() > 2 * ids) {
+        rendered_families.clear();
+    }
+}
+
+static void append_latency_summary(std::string& out, const std::string& name, const std::vector<shard_metrics>& shards,
+        cf_latencies::summary cf_latencies::*s) {
+    out += "# TYPE " + name + " summary\n";
+    for (unsigned shard = 0; shard < shards.size(); ++shard) {
+        for (auto&& l : shards[shard].latencies) {
+            std::string labels = "ks=";
+            append_label_value(labels, l.ks);
+            labels += ",cf=";
+            append_label_value(labels, l.cf);
+            labels += ",shard=\"" + std::to_string(shard) + "\"";
+            auto& summary = l.*s;
+            for (auto&& q : { std::make_pair("0.5", summary.p50), std::make_pair("0.95", summary.p95),
+                              std::make_pair("0.99", summary.p99), std::make_pair("0.999", summary.p999) }) {
+                out += name + "{" + labels + ",quantile=\"" + q.first + "\"} " + std::to_string(q.second) + "\n";
+            }
+            out += name + "_sum{" + labels + "} " + std::to_string(summary.sum) + "\n";
+            out += name + "_count{" + labels + "} " + std::to_string(summary.count) + "\n";
+        }
+    }
+}
+
+static cf_latencies::summary make_summary(const utils::hdr_histogram& h) {
+    return { h.count(), h.sum(), h.percentile(50), h.percentile(95), h.percentile(99), h.percentile(99.9) };
+}
+
+static future<std::vector<shard_metrics>> collect(http_context& ctx) {
+    return do_with(std::vector<shard_metrics>(smp::count), [&ctx] (auto& shards) {
+        return parallel_for_each(boost::irange(0u, smp::count), [&ctx, &shards] (unsigned cpu) {
+            return ctx.db.invoke_on(cpu, [] (database& db) {
+                shard_metrics res;
+                for (auto&& id : get_collectd_ids()) {
+                    if (is_enabled(id)) {
+                        res.values.emplace_back(id, get_collectd_value(id));
+                    }
+                }
+                for (auto&& i : db.get_column_families()) {
+                    auto& cf = *i.second;
+                    auto& stats = cf.get_stats();
+                    res.latencies.push_back(cf_latencies{cf.schema()->ks_name(), cf.schema()->cf_name(),
+                            make_summary(stats.read_latency), make_summary(stats.range_latency), make_summary(stats.write_latency)});
+                }
+                return res;
+            }).then([&shards, cpu] (shard_metrics m) {
+                shards[cpu] = std::move(m);
+            });
+        }).then([&shards] {
+            return std::move(shards);
+        });
+    });
+}
+
+void set_prometheus(http_context& ctx, routes& r) {
+    r.put(GET, "/metrics", new function_handler([&ctx] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        return collect(ctx).then([rep = std::move(rep)] (std::vector<shard_metrics> shards) mutable {
+            std::string out;
+            append_collectd_metrics(out, shards);
+            append_latency_summary(out, "scylla_column_family_read_latency_microseconds", shards, &cf_latencies::read);
+            append_latency_summary(out, "scylla_column_family_range_latency_microseconds", shards, &cf_latencies::range);
+            append_latency_summary(out, "scylla_column_family_write_latency_microseconds", shards, &cf_latencies::write);
+            rep->_content = sstring(out.data(), out.size());
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }, "txt"));
+}
+
+}
@@ -61,6 +61,13 @@ static future<json::json_return_type>  sum_estimated_histogram(http_context& ctx
     });
 }
 
+static future<json::json_return_type>  latency_percentiles(http_context& ctx, utils::hdr_histogram proxy::stats::*f) {
+    return ctx.sp.map_reduce0([f](const proxy& p) {return p.get_stats().*f;}, utils::hdr_histogram(),
+            std::plus<utils::hdr_histogram>()).then([](const utils::hdr_histogram& val) {
+        return make_ready_future<json::json_return_type>(to_json(val));
+    });
+}
+
 static future<json::json_return_type>  total_latency(http_context& ctx, utils::timed_rate_moving_average_and_histogram proxy::stats::*f) {
     return ctx.sp.map_reduce0([f](const proxy& p) {return (p.get_stats().*f).hist.mean * (p.get_stats().*f).hist.count;}, 0.0,
             std::plus<double>()).then([](double val) {
@@ -403,6 +410,18 @@ void set_storage_proxy(http_context& ctx, routes& r) {
     sp::get_range_latency.set(r, [&ctx](std::unique_ptr<request> req) {
         return total_latency(ctx, &proxy::stats::range);
     });
+
+    sp::get_read_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return latency_percentiles(ctx, &proxy::stats::read_latency);
+    });
+
+    sp::get_write_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return latency_percentiles(ctx, &proxy::stats::write_latency);
+    });
+
+    sp::get_range_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return latency_percentiles(ctx, &proxy::stats::range_latency);
+    });
 }
 
 }
@@ -22,6 +22,7 @@
 #include "storage_service.hh"
 #include "api/api-doc/storage_service.json.hh"
 #include "db/config.hh"
+#include "db/bulk_export.hh"
 #include <service/storage_service.hh>
 #include <db/commitlog/commitlog.hh>
 #include <gms/gossiper.hh>
@@ -32,6 +33,7 @@
 #include "column_family.hh"
 #include "log.hh"
 #include "release.hh"
+#include "streaming/stream_manager.hh"
 
 namespace api {
 
@@ -224,17 +226,19 @@ void set_storage_service(http_context& ctx, routes& r) {
     ss::take_snapshot.set(r, [](std::unique_ptr<request> req) {
         auto tag = req->get_query_param("tag");
         auto column_family = req->get_query_param("cf");
+        auto sf = req->get_query_param("sf");
+        bool skip_flush = (sf == "True") || (sf == "true") || (sf == "1");
 
         std::vector<sstring> keynames = split(req->get_query_param("kn"), ",");
 
         auto resp = make_ready_future<>();
         if (column_family.empty()) {
-            resp = service::get_local_storage_service().take_snapshot(tag, keynames);
+            resp = service::get_local_storage_service().take_snapshot(tag, keynames, skip_flush);
         } else {
             if (keynames.size() > 1) {
                 throw httpd::bad_param_exception("Only one keyspace allowed when specifying a column family");
             }
-            resp = service::get_local_storage_service().take_column_family_snapshot(keynames[0], column_family, tag);
+            resp = service::get_local_storage_service().take_column_family_snapshot(keynames[0], column_family, tag, skip_flush);
         }
         return resp.then([] {
             return make_ready_future<json::json_return_type>(json_void());
@@ -250,6 +254,16 @@ void set_storage_service(http_context& ctx, routes& r) {
         });
     });
 
+    ss::export_table.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto tag = req->get_query_param("tag");
+        if (tag.empty()) {
+            throw httpd::bad_param_exception("An export name must be specified");
+        }
+        return db::export_primary_ranges(ctx.db, req->get_query_param("kn"), req->get_query_param("cf"), tag).then([] (uint64_t partitions) {
+            return make_ready_future<json::json_return_type>(partitions);
+        });
+    });
+
     ss::true_snapshots_size.set(r, [](std::unique_ptr<request> req) {
         return service::get_local_storage_service().true_snapshots_size().then([] (int64_t size) {
             return make_ready_future<json::json_return_type>(size);
@@ -548,28 +562,45 @@ void set_storage_service(http_context& ctx, routes& r) {
     });
 
     ss::set_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto value = req->get_query_param("value");
-        return make_ready_future<json::json_return_type>(json_void());
+        auto value = std::stoul(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_stream_throughput(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::get_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+        int value = streaming::get_local_stream_manager().get_stream_throughput();
+        return make_ready_future<json::json_return_type>(value);
+    });
+
+    ss::set_inter_dc_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
+        auto value = std::stoul(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_inter_dc_stream_throughput(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    ss::get_inter_dc_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
+        int value = streaming::get_local_stream_manager().get_inter_dc_stream_throughput();
+        return make_ready_future<json::json_return_type>(value);
     });
 
     ss::get_compaction_throughput_mb_per_sec.set(r, [&ctx](std::unique_ptr<request> req) {
-        int value = ctx.db.local().get_config().compaction_throughput_mb_per_sec();
+        int value = (ctx.db.local().get_compaction_manager().base_throughput() * smp::count) >> 20;
         return make_ready_future<json::json_return_type>(value);
     });
 
-    ss::set_compaction_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto value = req->get_query_param("value");
-        return make_ready_future<json::json_return_type>(json_void());
+    ss::set_compaction_throughput_mb_per_sec.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto value = std::stoul(req->get_query_param("value"));
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.get_compaction_manager().set_base_throughput((uint64_t(value) << 20) / smp::count);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::is_incremental_backups_enabled.set(r, [](std::unique_ptr<request> req) {
@@ -664,21 +695,39 @@ void set_storage_service(http_context& ctx, routes& r) {
 
     ss::set_trace_probability.set(r, [](std::unique_ptr<request> req) {
         auto probability = req->get_query_param("probability");
+        auto keyspace = req->get_query_param("keyspace");
+        auto table = req->get_query_param("table");
+        if (keyspace.empty() != table.empty()) {
+            throw httpd::bad_param_exception("keyspace and table must be given together");
+        }
+        double real_prob;
         try {
-            double real_prob = std::stod(probability.c_str());
-            return tracing::tracing::tracing_instance().invoke_on_all([real_prob] (auto& local_tracing) {
-                local_tracing.set_trace_probability(real_prob);
-            }).then([] {
-                return make_ready_future<json::json_return_type>(json_void());
-            });
+            real_prob = std::stod(probability.c_str());
         } catch (...) {
             throw httpd::bad_param_exception(sprint("Bad format of a probability value: \"%s\"", probability.c_str()));
         }
-
+        if (real_prob < 0 || real_prob > 1) {
+            throw httpd::bad_param_exception(sprint("Probability must be in a [0,1] range, was %s", probability.c_str()));
+        }
+        return tracing::tracing::tracing_instance().invoke_on_all([real_prob, keyspace, table] (auto& local_tracing) {
+            if (keyspace.empty()) {
+                local_tracing.set_trace_probability(real_prob);
+            } else {
+                local_tracing.set_table_trace_probability(keyspace, table, real_prob);
+            }
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::get_trace_probability.set(r, [](std::unique_ptr<request> req) {
-        return make_ready_future<json::json_return_type>(tracing::tracing::get_local_tracing_instance().get_trace_probability());
+        auto keyspace = req->get_query_param("keyspace");
+        auto table = req->get_query_param("table");
+        auto& local_tracing = tracing::tracing::get_local_tracing_instance();
+        if (!keyspace.empty()) {
+            return make_ready_future<json::json_return_type>(local_tracing.get_table_trace_probability(keyspace, table));
+        }
+        return make_ready_future<json::json_return_type>(local_tracing.get_trace_probability());
     });
 
     ss::enable_auto_compaction.set(r, [&ctx](std::unique_ptr<request> req) {
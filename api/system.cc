@@ -24,6 +24,9 @@
 
 #include "http/exception.hh"
 #include "log.hh"
+#include "utils/stall_detector.hh"
+#include "utils/alloc_tracker.hh"
+#include <boost/range/irange.hpp>
 
 namespace api {
 
@@ -65,6 +68,57 @@ void set_system(http_context& ctx, routes& r) {
         }
         return json::json_void();
     });
+
+    hs::get_stalls.set(r, [](std::unique_ptr<request> req) {
+        using stats_type = utils::stall_detector::stats_type;
+        return map_reduce(boost::irange<unsigned>(0, smp::count), [] (unsigned shard) {
+            return smp::submit_to(shard, [] {
+                return utils::local_stall_detector().get_stats();
+            });
+        }, stats_type(), [] (stats_type a, const stats_type& b) {
+            for (unsigned i = 0; i < utils::stall_subsystem_count; ++i) {
+                a[i] += b[i];
+            }
+            return a;
+        }).then([] (const stats_type& stats) {
+            std::vector<hs::stall_stats> res;
+            for (unsigned i = 0; i < utils::stall_subsystem_count; ++i) {
+                hs::stall_stats s;
+                s.subsystem = utils::to_string(utils::stall_subsystem(i));
+                s.count = stats[i].count;
+                s.total_us = stats[i].total.count();
+                s.max_us = stats[i].max.count();
+                res.push_back(std::move(s));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    hs::get_allocations.set(r, [](std::unique_ptr<request> req) {
+        using stats_type = utils::alloc_tracker::stats_type;
+        return map_reduce(boost::irange<unsigned>(0, smp::count), [] (unsigned shard) {
+            return smp::submit_to(shard, [] {
+                return utils::local_alloc_tracker().get_stats();
+            });
+        }, stats_type(), [] (stats_type a, const stats_type& b) {
+            for (unsigned i = 0; i < utils::alloc_scope_count; ++i) {
+                a[i] += b[i];
+            }
+            return a;
+        }).then([] (const stats_type& stats) {
+            std::vector<hs::alloc_stats> res;
+            for (unsigned i = 0; i < utils::alloc_scope_count; ++i) {
+                hs::alloc_stats s;
+                s.scope = utils::to_string(utils::alloc_scope_id(i));
+                s.enabled = utils::alloc_tracker::enabled();
+                s.operations = stats[i].operations;
+                s.allocations = stats[i].allocations;
+                s.retained_bytes = stats[i].retained_bytes;
+                res.push_back(std::move(s));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
 }
 
 }
@@ -51,12 +51,15 @@ class atomic_cell_or_collection;
  *
  *  <live>  := <int8_t:flags><int64_t:timestamp>(<int32_t:expiry><int32_t:ttl>)?<value>
  *  <dead>  := <int8_t:    0><int64_t:timestamp><int32_t:deletion_time>
+ *
+ * When COMPRESSED_FLAG is set, <value> is compressed, see cell_compression.hh.
  */
 class atomic_cell_type final {
 private:
     static constexpr int8_t LIVE_FLAG = 0x01;
     static constexpr int8_t EXPIRY_FLAG = 0x02; // When present, expiry field is present. Set only for live cells
     static constexpr int8_t REVERT_FLAG = 0x04; // transient flag used to efficiently implement ReversiblyMergeable for atomic cells.
+    static constexpr int8_t COMPRESSED_FLAG = 0x08; // Set only for live cells kept in row cache.
     static constexpr unsigned flags_size = 1;
     static constexpr unsigned timestamp_offset = flags_size;
     static constexpr unsigned timestamp_size = 8;
@@ -74,6 +77,13 @@ class atomic_cell_type final {
     static void set_revert(BytesContainer& cell, bool revert) {
         cell[0] = (cell[0] & ~REVERT_FLAG) | (revert * REVERT_FLAG);
     }
+    static bool is_value_compressed(bytes_view cell) {
+        return cell[0] & COMPRESSED_FLAG;
+    }
+    template<typename BytesContainer>
+    static void set_value_compressed(BytesContainer& cell, bool compressed) {
+        cell[0] = (cell[0] & ~COMPRESSED_FLAG) | (compressed * COMPRESSED_FLAG);
+    }
     static bool is_live(const bytes_view& cell) {
         return cell[0] & LIVE_FLAG;
     }
@@ -155,6 +165,10 @@ class atomic_cell_base {
     bool is_live() const {
         return atomic_cell_type::is_live(_data);
     }
+    // When true, value() is compressed, see cell_compression.hh.
+    bool is_value_compressed() const {
+        return atomic_cell_type::is_value_compressed(_data);
+    }
     bool is_live(tombstone t) const {
         return is_live() && !is_covered_by(t);
     }
@@ -200,6 +214,9 @@ class atomic_cell_base {
     void set_revert(bool revert) {
         atomic_cell_type::set_revert(_data, revert);
     }
+    void set_value_compressed(bool compressed) {
+        atomic_cell_type::set_value_compressed(_data, compressed);
+    }
 };
 
 class atomic_cell_view final : public atomic_cell_base<bytes_view> {
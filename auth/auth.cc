@@ -120,16 +120,17 @@ class auth::auth::permissions_cache {
     }
 
     permissions_cache(const db::config& cfg)
-                    : _cache(cfg.permissions_cache_max_entries(), expiry(cfg),
-                                    std::chrono::milliseconds(
-                                                    cfg.permissions_validity_in_ms()),
+                    : _cache(cfg.permissions_cache_max_entries(),
+                                    std::chrono::milliseconds(cfg.permissions_validity_in_ms()),
+                                    refresh(cfg),
                                     [](const key_type& k) {
                                         logger.debug("Refreshing permissions for {}", k.first.name());
                                         return authorizer::get().authorize(::make_shared<authenticated_user>(k.first), k.second);
                                     }) {
+        _cache.setup_collectd("permissions_cache");
     }
 
-    static std::chrono::milliseconds expiry(const db::config& cfg) {
+    static std::chrono::milliseconds refresh(const db::config& cfg) {
         auto exp = cfg.permissions_update_interval_in_ms();
         if (exp == 0 || exp == std::numeric_limits<uint32_t>::max()) {
             exp = cfg.permissions_validity_in_ms();
@@ -138,7 +139,7 @@ class auth::auth::permissions_cache {
     }
 
     future<> stop() {
-        return make_ready_future<>();
+        return _cache.stop();
     }
 
     future<permission_set> get(::shared_ptr<authenticated_user> user, data_resource resource) {
@@ -284,6 +285,8 @@ future<> auth::auth::shutdown() {
     // db-env-shutdown != process shutdown
     return smp::invoke_on_all([] {
         thread_waiters().clear();
+    }).then([] {
+        return authenticator::get().stop();
     }).then([] {
         return perm_cache.stop();
     });
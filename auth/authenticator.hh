@@ -102,6 +102,14 @@ class authenticator {
     virtual ~authenticator()
     {}
 
+    /**
+     * Called on shutdown, from the main thread, to release whatever
+     * setup() acquired.
+     */
+    virtual future<> stop() {
+        return make_ready_future<>();
+    }
+
     virtual const sstring& class_name() const = 0;
 
     /**
@@ -45,12 +45,16 @@
 #include <chrono>
 
 #include <seastar/core/reactor.hh>
+#include <seastar/core/distributed.hh>
 
 #include "auth.hh"
 #include "password_authenticator.hh"
 #include "authenticated_user.hh"
 #include "cql3/query_processor.hh"
+#include "db/config.hh"
 #include "log.hh"
+#include "md5_hasher.hh"
+#include "utils/loading_cache.hh"
 
 const sstring auth::password_authenticator::PASSWORD_AUTHENTICATOR_NAME("org.apache.cassandra.auth.PasswordAuthenticator");
 
@@ -144,9 +148,146 @@ static sstring hashpw(const sstring& pass) {
     return hashpw(pass, gensalt());
 }
 
+/**
+ * Per-shard cache of the salted hashes of system_auth.credentials, and of
+ * the logins which were recently verified against them.
+ *
+ * Hashing a password is deliberately expensive, so a reconnect storm would
+ * otherwise burn the accepting shards on it, on top of reading the hash. A
+ * verified login is remembered as a digest of the password, salted with a
+ * random per-shard key; a login with the same password is accepted as long
+ * as the cached salted hash it was verified against doesn't change.
+ */
+class credentials_cache {
+    typedef utils::loading_cache<sstring, sstring> cache_type;
+
+    struct verified_login {
+        sstring salted_hash;
+        bytes digest;
+    };
+
+    cache_type _cache;
+    std::unordered_map<sstring, verified_login> _verified;
+    size_t _max_entries;
+    bool _enabled;
+    sstring _key;
+public:
+    credentials_cache()
+                    : credentials_cache(cql3::get_local_query_processor().db().local().get_config()) {
+    }
+
+    credentials_cache(const db::config& cfg)
+                    : _cache(cfg.credentials_cache_max_entries(),
+                                    std::chrono::milliseconds(cfg.credentials_validity_in_ms()),
+                                    refresh(cfg),
+                                    [](const sstring& username) {
+                                        logger.debug("Refreshing credentials for {}", username);
+                                        return load(username);
+                                    })
+                    , _max_entries(cfg.credentials_cache_max_entries())
+                    , _enabled(cfg.credentials_validity_in_ms() != 0)
+                    , _key(rand_bytes, 0) {
+        std::random_device rd;
+        std::default_random_engine e1(rd());
+        std::uniform_int_distribution<char> dist;
+        for (char& c : _key) {
+            c = dist(e1);
+        }
+        _cache.setup_collectd("credentials_cache");
+    }
+
+    static std::chrono::milliseconds refresh(const db::config& cfg) {
+        auto exp = cfg.credentials_update_interval_in_ms();
+        if (exp == 0 || exp == std::numeric_limits<uint32_t>::max()) {
+            exp = cfg.credentials_validity_in_ms();
+        }
+        return std::chrono::milliseconds(exp);
+    }
+
+    // Returns an empty string if the user doesn't exist.
+    future<sstring> get_salted_hash(const sstring& username) {
+        return _cache.get(username);
+    }
+
+    bool check(const sstring& username, const sstring& password, const sstring& salted_hash) {
+        if (!_enabled) {
+            return checkpw(password, salted_hash);
+        }
+        auto d = digest(password);
+        auto i = _verified.find(username);
+        if (i != _verified.end() && i->second.salted_hash == salted_hash && i->second.digest == d) {
+            return true;
+        }
+        if (!checkpw(password, salted_hash)) {
+            return false;
+        }
+        if (_verified.size() >= _max_entries) {
+            _verified.clear();
+        }
+        _verified[username] = verified_login{salted_hash, std::move(d)};
+        return true;
+    }
+
+    void invalidate(const sstring& username) {
+        _cache.remove(username);
+        _verified.erase(username);
+    }
+
+    future<> stop() {
+        return _cache.stop();
+    }
+private:
+    bytes digest(const sstring& password) const {
+        md5_hasher h;
+        h.update(_key.data(), _key.size());
+        h.update(password.data(), password.size());
+        return h.finalize();
+    }
+
+    static future<sstring> load(const sstring& username);
+};
+
+static distributed<credentials_cache> cred_cache;
+
+future<sstring> credentials_cache::load(const sstring& username) {
+    // Here was a thread local, explicit cache of prepared statement. In normal execution this is
+    // fine, but since we in testing set up and tear down system over and over, we'd start using
+    // obsolete prepared statements pretty quickly.
+    // Rely on query processing caching statements instead, and lets assume
+    // that a map lookup string->statement is not gonna kill us much.
+    auto& qp = cql3::get_local_query_processor();
+    return qp.process(
+                    sprint("SELECT %s FROM %s.%s WHERE %s = ?", SALTED_HASH,
+                                    auth::auth::AUTH_KS, CREDENTIALS_CF, USER_NAME),
+                    auth::password_authenticator::consistency_for_user(username), { username }, true).then(
+                    [](::shared_ptr<cql3::untyped_result_set> res) {
+        if (res->empty()) {
+            return sstring();
+        }
+        return res->one().get_as<sstring>(SALTED_HASH);
+    });
+}
+
+// Makes all shards forget what they know about the user's credentials.
+static future<> invalidate_credentials(sstring username) {
+    return cred_cache.invoke_on_all([username = std::move(username)] (credentials_cache& c) {
+        c.invalidate(username);
+    });
+}
+
 future<> auth::password_authenticator::init() {
     gensalt(); // do this once to determine usable hashing
 
+    return cred_cache.start().then([this] {
+        return setup_credentials_table();
+    });
+}
+
+future<> auth::password_authenticator::stop() {
+    return cred_cache.stop();
+}
+
+future<> auth::password_authenticator::setup_credentials_table() {
     sstring create_table = sprint(
                     "CREATE TABLE %s.%s ("
                                     "%s text,"
@@ -213,20 +354,10 @@ future<::shared_ptr<auth::authenticated_user> > auth::password_authenticator::au
     auto& username = credentials.at(USERNAME_KEY);
     auto& password = credentials.at(PASSWORD_KEY);
 
-    // Here was a thread local, explicit cache of prepared statement. In normal execution this is
-    // fine, but since we in testing set up and tear down system over and over, we'd start using
-    // obsolete prepared statements pretty quickly.
-    // Rely on query processing caching statements instead, and lets assume
-    // that a map lookup string->statement is not gonna kill us much.
-    auto& qp = cql3::get_local_query_processor();
-    return qp.process(
-                    sprint("SELECT %s FROM %s.%s WHERE %s = ?", SALTED_HASH,
-                                    auth::AUTH_KS, CREDENTIALS_CF, USER_NAME),
-                    consistency_for_user(username), { username }, true).then_wrapped(
-                    [=](future<::shared_ptr<cql3::untyped_result_set>> f) {
+    return cred_cache.local().get_salted_hash(username).then_wrapped([=](future<sstring> f) {
         try {
-            auto res = f.get0();
-            if (res->empty() || !checkpw(password, res->one().get_as<sstring>(SALTED_HASH))) {
+            auto salted_hash = f.get0();
+            if (salted_hash.empty() || !cred_cache.local().check(username, password, salted_hash)) {
                 throw exceptions::authentication_exception("Username and/or password are incorrect");
             }
             return make_ready_future<::shared_ptr<authenticated_user>>(::make_shared<authenticated_user>(username));
@@ -247,7 +378,9 @@ future<> auth::password_authenticator::create(sstring username,
         auto query = sprint("INSERT INTO %s.%s (%s, %s) VALUES (?, ?)",
                         auth::AUTH_KS, CREDENTIALS_CF, USER_NAME, SALTED_HASH);
         auto& qp = cql3::get_local_query_processor();
-        return qp.process(query, consistency_for_user(username), { username, hashpw(password) }).discard_result();
+        return qp.process(query, consistency_for_user(username), { username, hashpw(password) }).discard_result().then([username] {
+            return invalidate_credentials(username);
+        });
     } catch (std::out_of_range&) {
         throw exceptions::invalid_request_exception("PasswordAuthenticator requires PASSWORD option");
     }
@@ -262,7 +395,9 @@ future<> auth::password_authenticator::alter(sstring username,
         auto query = sprint("UPDATE %s.%s SET %s = ? WHERE %s = ?",
                         auth::AUTH_KS, CREDENTIALS_CF, SALTED_HASH, USER_NAME);
         auto& qp = cql3::get_local_query_processor();
-        return qp.process(query, consistency_for_user(username), { hashpw(password), username }).discard_result();
+        return qp.process(query, consistency_for_user(username), { hashpw(password), username }).discard_result().then([username] {
+            return invalidate_credentials(username);
+        });
     } catch (std::out_of_range&) {
         throw exceptions::invalid_request_exception("PasswordAuthenticator requires PASSWORD option");
     }
@@ -275,7 +410,9 @@ future<> auth::password_authenticator::drop(sstring username)
         auto query = sprint("DELETE FROM %s.%s WHERE %s = ?",
                         auth::AUTH_KS, CREDENTIALS_CF, USER_NAME);
         auto& qp = cql3::get_local_query_processor();
-        return qp.process(query, consistency_for_user(username), { username }).discard_result();
+        return qp.process(query, consistency_for_user(username), { username }).discard_result().then([username] {
+            return invalidate_credentials(username);
+        });
     } catch (std::out_of_range&) {
         throw exceptions::invalid_request_exception("PasswordAuthenticator requires PASSWORD option");
     }
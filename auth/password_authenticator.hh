@@ -53,6 +53,7 @@ class password_authenticator : public authenticator {
     ~password_authenticator();
 
     future<> init();
+    future<> stop() override;
 
     const sstring& class_name() const override;
     bool require_authentication() const override;
@@ -67,6 +68,8 @@ class password_authenticator : public authenticator {
 
 
     static db::consistency_level consistency_for_user(const sstring& username);
+private:
+    future<> setup_credentials_table();
 };
 
 }
@@ -38,6 +38,9 @@ class bytes_ostream {
 public:
     using size_type = bytes::size_type;
     using value_type = bytes::value_type;
+    // Largest chunk allocated, unless a larger contiguous region is
+    // requested with write_place_holder().
+    static constexpr size_type max_chunk_size{128 * 1024};
 private:
     static_assert(sizeof(value_type) == 1, "value_type is assumed to be one byte long");
     struct chunk {
@@ -56,9 +59,9 @@ class bytes_ostream {
         value_type data[0];
         void operator delete(void* ptr) { free(ptr); }
     };
-    // FIXME: consider increasing chunk size as the buffer grows
     static constexpr size_type chunk_size{512};
     static constexpr size_type usable_chunk_size{chunk_size - sizeof(chunk)};
+    static constexpr size_type max_usable_chunk_size{max_chunk_size - sizeof(chunk)};
 private:
     std::unique_ptr<chunk> _begin;
     chunk* _current;
@@ -99,34 +102,41 @@ class bytes_ostream {
         }
         return _current->size - _current->offset;
     }
+    // Chunks grow geometrically as the buffer grows, up to max_chunk_size,
+    // unless a single contiguous region larger than that is requested.
+    size_type next_alloc_size(size_type data_size) const {
+        auto next_size = _current ? std::min<size_type>(2 * (_current->size + sizeof(chunk)), size_type(max_chunk_size)) : size_type(chunk_size);
+        return std::max<size_type>(next_size, data_size + sizeof(chunk));
+    }
+    // Appends an empty chunk with room for at least size bytes.
+    void add_chunk(size_type size) {
+        auto alloc_size = next_alloc_size(size);
+        auto space = malloc(alloc_size);
+        if (!space) {
+            throw std::bad_alloc();
+        }
+        auto new_chunk = std::unique_ptr<chunk>(new (space) chunk());
+        new_chunk->offset = 0;
+        new_chunk->size = alloc_size - sizeof(chunk);
+        if (_current) {
+            _current->next = std::move(new_chunk);
+            _current = _current->next.get();
+        } else {
+            _begin = std::move(new_chunk);
+            _current = _begin.get();
+        }
+    }
     // Makes room for a contiguous region of given size.
     // The region is accounted for as already written.
     // size must not be zero.
     value_type* alloc(size_type size) {
-        if (size <= current_space_left()) {
-            auto ret = _current->data + _current->offset;
-            _current->offset += size;
-            _size += size;
-            return ret;
-        } else {
-            auto alloc_size = size <= usable_chunk_size ? chunk_size : (size + sizeof(chunk));
-            auto space = malloc(alloc_size);
-            if (!space) {
-                throw std::bad_alloc();
-            }
-            auto new_chunk = std::unique_ptr<chunk>(new (space) chunk());
-            new_chunk->offset = size;
-            new_chunk->size = alloc_size - sizeof(chunk);
-            if (_current) {
-                _current->next = std::move(new_chunk);
-                _current = _current->next.get();
-            } else {
-                _begin = std::move(new_chunk);
-                _current = _begin.get();
-            }
-            _size += size;
-            return _current->data;
-        };
+        if (size > current_space_left()) {
+            add_chunk(size);
+        }
+        auto ret = _current->data + _current->offset;
+        _current->offset += size;
+        _size += size;
+        return ret;
     }
 public:
     bytes_ostream() noexcept
@@ -189,7 +199,9 @@ class bytes_ostream {
         return alloc(size);
     }
 
-    // Writes given sequence of bytes
+    // Writes given sequence of bytes.
+    // Large sequences are split across chunks of at most max_chunk_size,
+    // so that writing them doesn't need a large contiguous allocation.
     inline void write(bytes_view v) {
         if (v.empty()) {
             return;
@@ -200,13 +212,18 @@ class bytes_ostream {
             _current->offset += v.size();
             _size += v.size();
         } else {
-            if (space_left) {
-                memcpy(_current->data + _current->offset, v.begin(), space_left);
-                _current->offset += space_left;
-                _size += space_left;
-                v.remove_prefix(space_left);
+            while (!v.empty()) {
+                if (!space_left) {
+                    add_chunk(std::min<size_type>(v.size(), size_type(max_usable_chunk_size)));
+                    space_left = current_space_left();
+                }
+                auto n = std::min<size_type>(v.size(), space_left);
+                memcpy(_current->data + _current->offset, v.begin(), n);
+                _current->offset += n;
+                _size += n;
+                v.remove_prefix(n);
+                space_left -= n;
             }
-            memcpy(alloc(v.size()), v.begin(), v.size());
         }
     }
 
@@ -36,9 +36,15 @@ class caching_options {
     static constexpr auto default_key = "ALL";
     static constexpr auto default_row = "ALL";
 
+    static constexpr auto cell_compression_threshold_key = "cell_compression_threshold";
+
     sstring _key_cache;
     sstring _row_cache;
-    caching_options(sstring k, sstring r) : _key_cache(k), _row_cache(r) {
+    // Values of cached cells at least that many bytes large are kept
+    // compressed, 0 disables compression. See cell_compression.hh.
+    size_t _cell_compression_threshold = 0;
+    caching_options(sstring k, sstring r, size_t cell_compression_threshold = 0)
+        : _key_cache(k), _row_cache(r), _cell_compression_threshold(cell_compression_threshold) {
         if ((k != "ALL") && (k != "NONE")) {
             throw exceptions::configuration_exception("Invalid key value: " + k); 
         }
@@ -59,14 +65,28 @@ class caching_options {
 public:
 
     sstring to_sstring() const {
-        return json::to_json(std::map<sstring, sstring>({{ "keys", _key_cache }, { "rows_per_partition", _row_cache }}));
+        std::map<sstring, sstring> map({{ "keys", _key_cache }, { "rows_per_partition", _row_cache }});
+        // Left out when disabled, so that schemas which don't use it keep their digest.
+        if (_cell_compression_threshold) {
+            map.emplace(cell_compression_threshold_key, ::to_sstring(_cell_compression_threshold));
+        }
+        return json::to_json(map);
     }
 
     static caching_options from_sstring(const sstring& str) {
         auto map = json::to_map(str);
-        if (map.size() > 2) {
+        if (map.size() > 3) {
             throw exceptions::configuration_exception("Invalid map: " + str); 
         }
+        return from_map(map);
+    }
+
+    static caching_options from_map(const std::map<sstring, sstring>& map) {
+        for (auto&& e : map) {
+            if (e.first != "keys" && e.first != "rows_per_partition" && e.first != cell_compression_threshold_key) {
+                throw exceptions::configuration_exception("Invalid caching option: " + e.first);
+            }
+        }
         sstring k;
         sstring r;
         if (map.count("keys")) {
@@ -80,10 +100,26 @@ class caching_options {
         } else {
             r = default_row;
         }
-        return caching_options(k, r);
+
+        size_t threshold = 0;
+        if (map.count(cell_compression_threshold_key)) {
+            try {
+                threshold = boost::lexical_cast<size_t>(map.at(cell_compression_threshold_key));
+            } catch (boost::bad_lexical_cast& e) {
+                throw exceptions::configuration_exception("Invalid cell_compression_threshold value: " + map.at(cell_compression_threshold_key));
+            }
+        }
+        return caching_options(k, r, threshold);
+    }
+    bool key_cache_enabled() const {
+        return _key_cache == "ALL";
+    }
+    size_t cell_compression_threshold() const {
+        return _cell_compression_threshold;
     }
     bool operator==(const caching_options& other) const {
-        return _key_cache == other._key_cache && _row_cache == other._row_cache;
+        return _key_cache == other._key_cache && _row_cache == other._row_cache
+            && _cell_compression_threshold == other._cell_compression_threshold;
     }
     bool operator!=(const caching_options& other) const {
         return !(*this == other);
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lz4.h>
+#include <seastar/core/byteorder.hh>
+#include "cell_compression.hh"
+#include "mutation_partition.hh"
+
+namespace cell_compression {
+
+static constexpr size_t size_field_size = sizeof(uint32_t);
+
+std::experimental::optional<atomic_cell> compress(atomic_cell_view cell, size_t threshold) {
+    if (!cell.is_live() || cell.is_value_compressed()) {
+        return { };
+    }
+    auto value = cell.value();
+    if (value.size() < threshold || value.size() > LZ4_MAX_INPUT_SIZE) {
+        return { };
+    }
+    bytes buf(bytes::initialized_later(), size_field_size + LZ4_COMPRESSBOUND(value.size()));
+    write_be(reinterpret_cast<char*>(buf.begin()), uint32_t(value.size()));
+    auto len = LZ4_compress(reinterpret_cast<const char*>(value.begin()),
+            reinterpret_cast<char*>(buf.begin()) + size_field_size, value.size());
+    // Decompression on every read isn't worth saving less than an eighth.
+    if (len <= 0 || size_field_size + size_t(len) > value.size() - value.size() / 8) {
+        return { };
+    }
+    auto compressed = bytes_view(buf.begin(), size_field_size + len);
+    auto c = cell.is_live_and_has_ttl()
+            ? atomic_cell::make_live(cell.timestamp(), compressed, cell.expiry(), cell.ttl())
+            : atomic_cell::make_live(cell.timestamp(), compressed);
+    c.set_value_compressed(true);
+    return { std::move(c) };
+}
+
+bytes uncompressed_value(atomic_cell_view cell) {
+    auto value = cell.value();
+    if (!cell.is_value_compressed()) {
+        return to_bytes(value);
+    }
+    auto size = read_be<uint32_t>(reinterpret_cast<const char*>(value.begin()));
+    value.remove_prefix(size_field_size);
+    bytes out(bytes::initialized_later(), size);
+    auto ret = LZ4_decompress_safe(reinterpret_cast<const char*>(value.begin()),
+            reinterpret_cast<char*>(out.begin()), value.size(), size);
+    if (ret < 0 || uint32_t(ret) != size) {
+        throw std::runtime_error("LZ4 uncompression failure of a cached cell");
+    }
+    return out;
+}
+
+atomic_cell decompress(atomic_cell_view cell) {
+    auto value = uncompressed_value(cell);
+    if (cell.is_live_and_has_ttl()) {
+        return atomic_cell::make_live(cell.timestamp(), value, cell.expiry(), cell.ttl());
+    }
+    return atomic_cell::make_live(cell.timestamp(), value);
+}
+
+static bool is_compressible(const column_definition& def) {
+    return def.is_atomic() && !def.type->is_counter();
+}
+
+static void compress(const schema& s, column_kind kind, row& r, size_t threshold, stats& st) {
+    r.for_each_cell([&] (column_id id, atomic_cell_or_collection& c) {
+        if (!c || !is_compressible(s.column_at(kind, id))) {
+            return;
+        }
+        auto cell = c.as_atomic_cell();
+        auto compressed = compress(cell, threshold);
+        if (compressed) {
+            ++st.compressed_cells;
+            st.bytes_in += cell.value().size();
+            st.bytes_out += compressed->value().size();
+            c = std::move(*compressed);
+        }
+    });
+}
+
+void compress(const schema& s, mutation_partition& p, size_t threshold, stats& st) {
+    compress(s, column_kind::static_column, p.static_row(), threshold, st);
+    for (rows_entry& e : p.clustered_rows()) {
+        compress(s, column_kind::regular_column, e.row().cells(), threshold, st);
+    }
+}
+
+void decompress(const schema& s, column_kind kind, row& r) {
+    r.for_each_cell([&] (column_id id, atomic_cell_or_collection& c) {
+        if (c && is_compressible(s.column_at(kind, id)) && c.as_atomic_cell().is_value_compressed()) {
+            c = decompress(c.as_atomic_cell());
+        }
+    });
+}
+
+void decompress(const schema& s, mutation_partition& p) {
+    decompress(s, column_kind::static_column, p.static_row());
+    for (rows_entry& e : p.clustered_rows()) {
+        decompress(s, column_kind::regular_column, e.row().cells());
+    }
+}
+
+}
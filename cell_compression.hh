@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include "atomic_cell.hh"
+#include "schema.hh"
+
+class row;
+class mutation_partition;
+
+// Compression of large atomic cell values kept in row cache.
+//
+// A compressed cell has the COMPRESSED flag set and its value holds the size
+// of the uncompressed value followed by the value compressed with lz4:
+//
+//   <value> := <uint32_t:uncompressed size><lz4 block>
+//
+// Compressed cells never leave the cache, readers decompress them when they
+// copy rows out (see partition_snapshot_reader), and merging compares the
+// uncompressed values (see compare_atomic_cell_for_merge()).
+namespace cell_compression {
+
+struct stats {
+    uint64_t compressed_cells = 0;
+    // Sizes of values of compressed cells, before and after compression.
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+};
+
+// Returns the compressed form of the cell, or nothing if the cell is dead,
+// already compressed, its value is smaller than threshold or doesn't
+// compress well enough to be worth it.
+std::experimental::optional<atomic_cell> compress(atomic_cell_view, size_t threshold);
+
+// Requires cell.is_value_compressed().
+atomic_cell decompress(atomic_cell_view cell);
+
+// Returns the value of a live cell, uncompressing it if needed.
+bytes uncompressed_value(atomic_cell_view cell);
+
+// Compresses, in place, values of atomic cells of regular and static columns
+// which are at least threshold bytes large. Cells are allocated with the
+// current allocator.
+void compress(const schema&, mutation_partition&, size_t threshold, stats&);
+
+// Replaces compressed cells of given row with their uncompressed form.
+void decompress(const schema&, column_kind, row&);
+void decompress(const schema&, mutation_partition&);
+
+}
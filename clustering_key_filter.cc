@@ -41,6 +41,33 @@ clustering_key_filtering_context clustering_key_filtering_context::create_no_fil
 const clustering_key_filtering_context no_clustering_key_filtering =
     clustering_key_filtering_context::create_no_filtering();
 
+column_projection::column_projection(const schema& s, const partition_slice& slice)
+    : _static_columns(s.static_columns_count())
+    , _regular_columns(s.regular_columns_count())
+{
+    for (auto id : slice.static_columns) {
+        _static_columns[id] = true;
+    }
+    for (auto id : slice.regular_columns) {
+        _regular_columns[id] = true;
+    }
+    // Filters are evaluated on the values read.
+    for (auto&& f : slice.filters()) {
+        _regular_columns[f.column] = true;
+    }
+}
+
+clustering_key_filtering_context
+clustering_key_filtering_context::with_column_projection(const schema& s, const partition_slice& slice) const {
+    // Counter cells can't be reconciled without their values.
+    if (s.is_counter()) {
+        return *this;
+    }
+    auto ctx = *this;
+    ctx._columns = make_lw_shared<column_projection>(s, slice);
+    return ctx;
+}
+
 class stateless_clustering_key_filter_factory : public clustering_key_filter_factory {
     clustering_key_filter _filter;
     std::vector<range<clustering_key_prefix>> _ranges;
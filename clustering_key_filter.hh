@@ -49,9 +49,26 @@ class clustering_key_filter_factory {
     virtual ~clustering_key_filter_factory() = default;
 };
 
+// Columns a reader has to return the values of. Cells of the other columns
+// may be returned without their values: their timestamps, expiry and
+// deletion times are enough to tell whether a row is live and to reconcile
+// them with other versions, so they still have to be there.
+class column_projection {
+    std::vector<bool> _static_columns;
+    std::vector<bool> _regular_columns;
+public:
+    column_projection(const schema& s, const partition_slice& slice);
+
+    bool contains(column_kind kind, column_id id) const {
+        auto& columns = kind == column_kind::static_column ? _static_columns : _regular_columns;
+        return id < columns.size() && columns[id];
+    }
+};
+
 class clustering_key_filtering_context {
 private:
     shared_ptr<clustering_key_filter_factory> _factory;
+    lw_shared_ptr<column_projection> _columns;
     clustering_key_filtering_context() {};
     clustering_key_filtering_context(shared_ptr<clustering_key_filter_factory> factory) : _factory(factory) {}
 public:
@@ -65,6 +82,21 @@ class clustering_key_filtering_context {
     }
     const std::vector<range<clustering_key_prefix>>& get_ranges(const partition_key& key) const;
 
+    // Column projection readers may apply, null if all values are needed.
+    const column_projection* columns() const {
+        return _columns.get();
+    }
+    // Returns a context which also lets readers drop the values of the
+    // columns the slice doesn't select. Only for reads whose result is
+    // built from the selected columns only, not when the mutations read are
+    // kept or sent elsewhere.
+    clustering_key_filtering_context with_column_projection(const schema& s, const partition_slice& slice) const;
+    clustering_key_filtering_context without_column_projection() const {
+        auto ctx = *this;
+        ctx._columns = { };
+        return ctx;
+    }
+
     static const clustering_key_filtering_context create(schema_ptr, const partition_slice&);
 
     static clustering_key_filtering_context create_no_filtering();
@@ -32,6 +32,81 @@
 
 enum class allow_prefixes { no, yes };
 
+// Comparators of compounds with a fixed shape, which compare components
+// without type dispatch. Used by compound_type for common clustering keys.
+namespace compound_comparators {
+
+inline bytes_view read_component(bytes_view& v) {
+    auto len = read_simple<uint16_t>(v);
+    if (v.size() < len) {
+        throw marshal_exception();
+    }
+    bytes_view c(v.begin(), len);
+    v.remove_prefix(len);
+    return c;
+}
+
+struct unsigned_bytes {
+    int operator()(bytes_view v1, bytes_view v2) const {
+        return compare_unsigned(v1, v2);
+    }
+};
+
+// Big-endian two's complement integers of equal width.
+struct signed_integer {
+    int operator()(bytes_view v1, bytes_view v2) const {
+        if (v1.empty() || v2.empty()) {
+            return int(!v1.empty()) - int(!v2.empty());
+        }
+        if (v1[0] != v2[0]) {
+            return v1[0] < v2[0] ? -1 : 1;
+        }
+        return compare_unsigned(v1.substr(1), v2.substr(1));
+    }
+};
+
+struct timeuuid {
+    int operator()(bytes_view v1, bytes_view v2) const {
+        return timeuuid_tri_compare(v1, v2);
+    }
+};
+
+template<typename Compare>
+struct reversed {
+    int operator()(bytes_view v1, bytes_view v2) const {
+        return Compare()(v2, v1);
+    }
+};
+
+// Compares serialized compounds whose components are compared with
+// ComponentCompare..., in that order. Has the same semantics as
+// lexicographical_tri_compare(): a prefix sorts before the values it's a
+// prefix of.
+template<typename... ComponentCompare>
+struct fixed;
+
+template<>
+struct fixed<> {
+    static int compare(bytes_view v1, bytes_view v2) {
+        return int(!v1.empty()) - int(!v2.empty());
+    }
+};
+
+template<typename First, typename... Rest>
+struct fixed<First, Rest...> {
+    static int compare(bytes_view v1, bytes_view v2) {
+        if (v1.empty() || v2.empty()) {
+            return int(!v1.empty()) - int(!v2.empty());
+        }
+        auto c1 = read_component(v1);
+        auto c2 = read_component(v2);
+        auto r = First()(c1, c2);
+        return r ? r : fixed<Rest...>::compare(v1, v2);
+    }
+};
+
+}
+
 template<allow_prefixes AllowPrefixes = allow_prefixes::no>
 class compound_type final {
 private:
@@ -39,6 +114,49 @@ class compound_type final {
     const bool _byte_order_equal;
     const bool _byte_order_comparable;
     const bool _is_reversed;
+    const bool _is_abbreviable;
+    // Shapes of compounds for which compare() uses one of compound_comparators.
+    enum class shape {
+        generic,
+        unsigned_bytes,
+        signed_integer,
+        timeuuid,
+        reversed_unsigned_bytes,
+        reversed_signed_integer,
+        reversed_timeuuid,
+        // E.g. (text, timestamp)
+        unsigned_bytes_and_signed_integer,
+    };
+    const shape _shape;
+
+    static shape choose_shape(const std::vector<data_type>& types) {
+        using encoding = abstract_type::comparable_encoding;
+        auto single = [] (const data_type& t, shape u, shape s, shape tu) {
+            if (t.get() == timeuuid_type.get()) {
+                return tu;
+            }
+            switch (t->get_comparable_encoding()) {
+            case encoding::unsigned_bytes: return u;
+            case encoding::signed_integer: return s;
+            case encoding::none: return shape::generic;
+            }
+            abort();
+        };
+        if (types.size() == 1) {
+            auto& t = types[0];
+            if (t->is_reversed()) {
+                return single(t->underlying_type(), shape::reversed_unsigned_bytes,
+                    shape::reversed_signed_integer, shape::reversed_timeuuid);
+            }
+            return single(t, shape::unsigned_bytes, shape::signed_integer, shape::timeuuid);
+        }
+        if (types.size() == 2
+                && types[0]->get_comparable_encoding() == encoding::unsigned_bytes
+                && types[1]->get_comparable_encoding() == encoding::signed_integer) {
+            return shape::unsigned_bytes_and_signed_integer;
+        }
+        return shape::generic;
+    }
 public:
     static constexpr bool is_prefixable = AllowPrefixes == allow_prefixes::yes;
     using prefix_type = compound_type<allow_prefixes::yes>;
@@ -52,6 +170,9 @@ class compound_type final {
             }))
         , _byte_order_comparable(false)
         , _is_reversed(_types.size() == 1 && _types[0]->is_reversed())
+        , _is_abbreviable(!_types.empty()
+                && _types[0]->get_comparable_encoding() != abstract_type::comparable_encoding::none)
+        , _shape(choose_shape(_types))
     { }
 
     compound_type(compound_type&&) = default;
@@ -210,11 +331,76 @@ class compound_type final {
                 return compare_unsigned(b1, b2);
             }
         }
+        using namespace compound_comparators;
+        switch (_shape) {
+        case shape::unsigned_bytes:
+            return fixed<compound_comparators::unsigned_bytes>::compare(b1, b2);
+        case shape::signed_integer:
+            return fixed<compound_comparators::signed_integer>::compare(b1, b2);
+        case shape::timeuuid:
+            return fixed<compound_comparators::timeuuid>::compare(b1, b2);
+        case shape::reversed_unsigned_bytes:
+            return fixed<reversed<compound_comparators::unsigned_bytes>>::compare(b1, b2);
+        case shape::reversed_signed_integer:
+            return fixed<reversed<compound_comparators::signed_integer>>::compare(b1, b2);
+        case shape::reversed_timeuuid:
+            return fixed<reversed<compound_comparators::timeuuid>>::compare(b1, b2);
+        case shape::unsigned_bytes_and_signed_integer:
+            return fixed<compound_comparators::unsigned_bytes, compound_comparators::signed_integer>::compare(b1, b2);
+        case shape::generic:
+            break;
+        }
         return lexicographical_tri_compare(_types.begin(), _types.end(),
             begin(b1), end(b1), begin(b2), end(b2), [] (auto&& type, auto&& v1, auto&& v2) {
                 return type->compare(v1, v2);
             });
     }
+    bool is_abbreviable() const {
+        return _is_abbreviable;
+    }
+    // Returns the first 8 bytes of an encoding of given value whose unsigned
+    // lexicographical order is the order defined by compare(), as a big-endian
+    // number. So if abbreviate(b1) < abbreviate(b2) then compare(b1, b2) < 0,
+    // but nothing can be inferred from equal abbreviations.
+    //
+    // Each component is encoded with its 0x00 bytes escaped as 0x00 0xff and
+    // is followed by a 0x00 0x01 terminator, so that a prefix sorts before
+    // the values it's a prefix of. Encoding stops at the first component
+    // whose type has no comparable encoding. Returns 0 when the value has no
+    // components or is_abbreviable() is false.
+    uint64_t abbreviate(bytes_view v) const {
+        uint64_t result = 0;
+        int shift = 56;
+        auto put = [&] (uint8_t b) {
+            if (shift >= 0) {
+                result |= uint64_t(b) << shift;
+                shift -= 8;
+            }
+        };
+        auto t = _types.begin();
+        for (auto&& component : components(v)) {
+            if (shift < 0) {
+                break;
+            }
+            auto encoding = (*t++)->get_comparable_encoding();
+            if (encoding == abstract_type::comparable_encoding::none) {
+                break;
+            }
+            for (size_t i = 0; i < component.size() && shift >= 0; ++i) {
+                uint8_t b = component[i];
+                if (i == 0 && encoding == abstract_type::comparable_encoding::signed_integer) {
+                    b ^= 0x80;
+                }
+                put(b);
+                if (!b) {
+                    put(0xff);
+                }
+            }
+            put(0x00);
+            put(0x01);
+        }
+        return result;
+    }
     // Retruns true iff given prefix has no missing components
     bool is_full(bytes_view v) const {
         assert(AllowPrefixes == allow_prefixes::yes);
@@ -28,6 +28,7 @@ enum class compressor {
     lz4,
     snappy,
     deflate,
+    zstd,
 };
 
 class compression_parameters {
@@ -38,10 +39,22 @@ class compression_parameters {
     static constexpr auto SSTABLE_COMPRESSION = "sstable_compression";
     static constexpr auto CHUNK_LENGTH_KB = "chunk_length_kb";
     static constexpr auto CRC_CHECK_CHANCE = "crc_check_chance";
+    // chunk_length_kb value which lets each new sstable's chunk length follow
+    // the table's reads, see sstables::table_read_sizes.
+    static constexpr auto AUTO_CHUNK_LENGTH = "auto";
+
+    // ZstdCompressor only.
+    static constexpr int DEFAULT_ZSTD_COMPRESSION_LEVEL = 3;
+    static constexpr int MAX_ZSTD_DICTIONARY_SIZE_KB = 1024;
+    static constexpr auto COMPRESSION_LEVEL = "compression_level";
+    static constexpr auto DICTIONARY_SIZE_KB = "dictionary_size_kb";
 private:
     compressor _compressor = compressor::none;
     std::experimental::optional<int> _chunk_length;
+    bool _auto_chunk_length = false;
     std::experimental::optional<double> _crc_check_chance;
+    std::experimental::optional<int> _compression_level;
+    std::experimental::optional<int> _dictionary_size;
 public:
     compression_parameters() = default;
     compression_parameters(compressor c) : _compressor(c) { }
@@ -59,11 +72,15 @@ class compression_parameters {
             _compressor = compressor::snappy;
         } else if (is_compressor_class(compressor_class, "DeflateCompressor")) {
             _compressor = compressor::deflate;
+        } else if (is_compressor_class(compressor_class, "ZstdCompressor")) {
+            _compressor = compressor::zstd;
         } else {
             throw exceptions::configuration_exception(sstring("Unsupported compression class '") + compressor_class + "'.");
         }
         auto chunk_length = options.find(CHUNK_LENGTH_KB);
-        if (chunk_length != options.end()) {
+        if (chunk_length != options.end() && chunk_length->second == AUTO_CHUNK_LENGTH) {
+            _auto_chunk_length = true;
+        } else if (chunk_length != options.end()) {
             try {
                 _chunk_length = std::stoi(chunk_length->second) * 1024;
             } catch (const std::exception& e) {
@@ -78,11 +95,32 @@ class compression_parameters {
                 throw exceptions::syntax_exception(sstring("Invalid double value ") + crc_chance->second + "for " + CRC_CHECK_CHANCE);
             }
         }
+        auto level = options.find(COMPRESSION_LEVEL);
+        if (level != options.end()) {
+            try {
+                _compression_level = std::stoi(level->second);
+            } catch (const std::exception& e) {
+                throw exceptions::syntax_exception(sstring("Invalid integer value ") + level->second + " for " + COMPRESSION_LEVEL);
+            }
+        }
+        auto dictionary_size = options.find(DICTIONARY_SIZE_KB);
+        if (dictionary_size != options.end()) {
+            try {
+                _dictionary_size = std::stoi(dictionary_size->second) * 1024;
+            } catch (const std::exception& e) {
+                throw exceptions::syntax_exception(sstring("Invalid integer value ") + dictionary_size->second + " for " + DICTIONARY_SIZE_KB);
+            }
+        }
     }
 
     compressor get_compressor() const { return _compressor; }
     int32_t chunk_length() const { return _chunk_length.value_or(int(DEFAULT_CHUNK_LENGTH)); }
+    // When true, chunk_length() is only a default for tables with too few reads.
+    bool auto_chunk_length() const { return _auto_chunk_length; }
     double crc_check_chance() const { return _crc_check_chance.value_or(double(DEFAULT_CRC_CHECK_CHANCE)); }
+    int compression_level() const { return _compression_level.value_or(int(DEFAULT_ZSTD_COMPRESSION_LEVEL)); }
+    // Size of the dictionary trained for each sstable, 0 if none should be.
+    int32_t dictionary_size() const { return _dictionary_size.value_or(0); }
 
     void validate() {
         if (_chunk_length) {
@@ -98,6 +136,15 @@ class compression_parameters {
         if (_crc_check_chance && (_crc_check_chance.value() < 0.0 || _crc_check_chance.value() > 1.0)) {
             throw exceptions::configuration_exception(sstring(CRC_CHECK_CHANCE) + " must be between 0.0 and 1.0.");
         }
+        if ((_compression_level || _dictionary_size) && _compressor != compressor::zstd) {
+            throw exceptions::configuration_exception(sprint("%s and %s are only supported by ZstdCompressor.", COMPRESSION_LEVEL, DICTIONARY_SIZE_KB));
+        }
+        if (_compression_level && (_compression_level.value() < 1 || _compression_level.value() > 22)) {
+            throw exceptions::configuration_exception(sstring(COMPRESSION_LEVEL) + " must be between 1 and 22.");
+        }
+        if (_dictionary_size && (_dictionary_size.value() < 0 || _dictionary_size.value() > MAX_ZSTD_DICTIONARY_SIZE_KB * 1024)) {
+            throw exceptions::configuration_exception(sprint("%s must be between 0 and %d.", DICTIONARY_SIZE_KB, MAX_ZSTD_DICTIONARY_SIZE_KB));
+        }
     }
 
     std::map<sstring, sstring> get_options() const {
@@ -106,29 +153,41 @@ class compression_parameters {
         }
         std::map<sstring, sstring> opts;
         opts.emplace(sstring(SSTABLE_COMPRESSION), compressor_name());
-        if (_chunk_length) {
+        if (_auto_chunk_length) {
+            opts.emplace(sstring(CHUNK_LENGTH_KB), sstring(AUTO_CHUNK_LENGTH));
+        } else if (_chunk_length) {
             opts.emplace(sstring(CHUNK_LENGTH_KB), std::to_string(_chunk_length.value() / 1024));
         }
         if (_crc_check_chance) {
             opts.emplace(sstring(CRC_CHECK_CHANCE), std::to_string(_crc_check_chance.value()));
         }
+        if (_compression_level) {
+            opts.emplace(sstring(COMPRESSION_LEVEL), std::to_string(_compression_level.value()));
+        }
+        if (_dictionary_size) {
+            opts.emplace(sstring(DICTIONARY_SIZE_KB), std::to_string(_dictionary_size.value() / 1024));
+        }
         return opts;
     }
     bool operator==(const compression_parameters& other) const {
         return _compressor == other._compressor
                && _chunk_length == other._chunk_length
-               && _crc_check_chance == other._crc_check_chance;
+               && _auto_chunk_length == other._auto_chunk_length
+               && _crc_check_chance == other._crc_check_chance
+               && _compression_level == other._compression_level
+               && _dictionary_size == other._dictionary_size;
     }
     bool operator!=(const compression_parameters& other) const {
         return !(*this == other);
     }
 private:
     void validate_options(const std::map<sstring, sstring>& options) {
-        // currently, there are no options specific to a particular compressor
         static std::set<sstring> keywords({
             sstring(SSTABLE_COMPRESSION),
             sstring(CHUNK_LENGTH_KB),
             sstring(CRC_CHECK_CHANCE),
+            sstring(COMPRESSION_LEVEL),
+            sstring(DICTIONARY_SIZE_KB),
         });
         for (auto&& opt : options) {
             if (!keywords.count(opt.first)) {
@@ -148,6 +207,8 @@ class compression_parameters {
             return "org.apache.cassandra.io.compress.SnappyCompressor";
         case compressor::deflate:
             return "org.apache.cassandra.io.compress.DeflateCompressor";
+        case compressor::zstd:
+            return "org.apache.cassandra.io.compress.ZstdCompressor";
         default:
             abort();
         }
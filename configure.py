@@ -176,10 +176,18 @@ scylla_tests = [
     'tests/row_cache_alloc_stress',
     'tests/perf_row_cache_update',
     'tests/perf/perf_hash',
+    'tests/perf/perf_utf8',
+    'tests/perf/perf_range_tombstone_list',
+    'tests/perf/perf_lsa',
+    'tests/perf/perf_messaging',
+    'tests/perf/perf_row_cache',
+    'tests/perf/perf_commitlog',
     'tests/perf/perf_cql_parser',
     'tests/perf/perf_simple_query',
+    'tests/perf/perf_workload',
     'tests/memory_footprint',
     'tests/perf/perf_sstable',
+    'tests/perf/perf_repair_checksum',
     'tests/cql_query_test',
     'tests/storage_proxy_test',
     'tests/schema_change_test',
@@ -219,7 +227,12 @@ scylla_tests = [
     'tests/idl_test',
     'tests/range_tombstone_list_test',
     'tests/anchorless_list_test',
+    'tests/tournament_tree_test',
+    'tests/hdr_histogram_test',
+    'tests/frequency_sketch_test',
+    'tests/space_saving_test',
     'tests/database_test',
+    'tests/request_scheduler_test',
 ]
 
 apps = [
@@ -268,10 +281,15 @@ arg_parser.add_argument('--python', action = 'store', dest = 'python', default =
                         help = 'Python3 path')
 add_tristate(arg_parser, name = 'hwloc', dest = 'hwloc', help = 'hwloc support')
 add_tristate(arg_parser, name = 'xen', dest = 'xen', help = 'Xen support')
+arg_parser.add_argument('--enable-alloc-tracking', dest = 'alloc_tracking', action = 'store_true', default = False,
+                        help = 'Account heap allocations of read and write hot paths (see utils/alloc_tracker.hh)')
 args = arg_parser.parse_args()
 
 defines = []
 
+if args.alloc_tracking:
+    defines.append('SCYLLA_ALLOC_TRACKING=1')
+
 extra_cxxflags = {}
 
 cassandra_interface = Thrift(source = 'interface/cassandra.thrift', service = 'Cassandra')
@@ -284,7 +302,10 @@ scylla_core = (['database.cc',
                  'mutation.cc',
                  'streamed_mutation.cc',
                  'partition_version.cc',
+                 'cell_compression.cc',
+                 'counters.cc',
                  'row_cache.cc',
+                 'memory_balancer.cc',
                  'canonical_mutation.cc',
                  'frozen_mutation.cc',
                  'memtable.cc',
@@ -297,14 +318,25 @@ scylla_core = (['database.cc',
                  'mutation_partition_serializer.cc',
                  'mutation_reader.cc',
                  'mutation_query.cc',
+                 'querier_cache.cc',
                  'key_reader.cc',
                  'keys.cc',
                  'clustering_key_filter.cc',
                  'sstables/sstables.cc',
                  'sstables/compress.cc',
+                 'sstables/adaptive_input_stream.cc',
+                 'sstables/io_buffer_pool.cc',
                  'sstables/row.cc',
+                 'sstables/compact_format.cc',
+                 'sstables/partition_index.cc',
                  'sstables/partition.cc',
                  'sstables/filter.cc',
+                 'sstables/key_cache.cc',
+                 'sstables/filter_cache.cc',
+                 'sstables/index_summary_manager.cc',
+                 'sstables/trickle_fsync_file.cc',
+                 'sstables/chunk_cache.cc',
+                 'sstables/read_sizes.cc',
                  'sstables/compaction.cc',
                  'sstables/compaction_strategy.cc',
                  'sstables/compaction_manager.cc',
@@ -331,6 +363,7 @@ scylla_core = (['database.cc',
                  'cql3/statements/create_user_statement.cc',
                  'cql3/statements/drop_keyspace_statement.cc',
                  'cql3/statements/drop_table_statement.cc',
+                 'cql3/statements/drop_view_statement.cc',
                  'cql3/statements/drop_type_statement.cc',
                  'cql3/statements/schema_altering_statement.cc',
                  'cql3/statements/ks_prop_defs.cc',
@@ -345,6 +378,7 @@ scylla_core = (['database.cc',
                  'cql3/statements/index_prop_defs.cc',
                  'cql3/statements/index_target.cc',
                  'cql3/statements/create_index_statement.cc',
+                 'cql3/statements/create_view_statement.cc',
                  'cql3/statements/truncate_statement.cc',
                  'cql3/statements/alter_table_statement.cc',
                  'cql3/statements/alter_user_statement.cc',
@@ -365,11 +399,14 @@ scylla_core = (['database.cc',
                  'thrift/thrift_validation.cc',
                  'utils/runtime.cc',
                  'utils/murmur_hash.cc',
+                 'utils/crc.cc',
                  'utils/uuid.cc',
                  'utils/big_decimal.cc',
+                 'utils/utf8.cc',
                  'types.cc',
                  'validation.cc',
                  'service/priority_manager.cc',
+                 'service/request_scheduler.cc',
                  'service/migration_manager.cc',
                  'service/storage_proxy.cc',
                  'cql3/operator.cc',
@@ -400,6 +437,8 @@ scylla_core = (['database.cc',
                  'db/commitlog/commitlog_entry.cc',
                  'db/config.cc',
                  'db/index/secondary_index.cc',
+                 'db/index/local_index.cc',
+                 'db/view/view.cc',
                  'db/marshal/type_parser.cc',
                  'db/batchlog_manager.cc',
                  'io/io.cc',
@@ -413,6 +452,8 @@ scylla_core = (['database.cc',
                  'utils/dynamic_bitset.cc',
                  'utils/managed_bytes.cc',
                  'utils/exceptions.cc',
+                 'utils/stall_detector.cc',
+                 'utils/alloc_tracker.cc',
                  'gms/version_generator.cc',
                  'gms/versioned_value.cc',
                  'gms/gossiper.cc',
@@ -431,6 +472,7 @@ scylla_core = (['database.cc',
                  'unimplemented.cc',
                  'query.cc',
                  'query-result-set.cc',
+                 'query-result-columnar.cc',
                  'locator/abstract_replication_strategy.cc',
                  'locator/simple_strategy.cc',
                  'locator/local_strategy.cc',
@@ -439,6 +481,7 @@ scylla_core = (['database.cc',
                  'locator/token_metadata.cc',
                  'locator/locator.cc',
                  'locator/snitch_base.cc',
+                 'locator/dynamic_snitch.cc',
                  'locator/simple_snitch.cc',
                  'locator/rack_inferring_snitch.cc',
                  'locator/gossiping_property_file_snitch.cc',
@@ -484,7 +527,14 @@ scylla_core = (['database.cc',
                  'tracing/trace_state.cc',
                  'range_tombstone.cc',
                  'range_tombstone_list.cc',
-                 'db/size_estimates_recorder.cc'
+                 'db/size_estimates_recorder.cc',
+                 'db/cache_saver.cc',
+                 'db/top_partitions_sampler.cc',
+                 'db/data_placement.cc',
+                 'db/hints_manager.cc',
+                 'db/counter_cache.cc',
+                 'db/bulk_export.cc',
+                 'db/query_result_cache.cc',
                  ]
                 + [Antlr3Grammar('cql3/Cql.g')]
                 + [Thrift('interface/cassandra.thrift', 'Cassandra')]
@@ -493,6 +543,7 @@ scylla_core = (['database.cc',
 api = ['api/api.cc',
        'api/api-doc/storage_service.json',
        'api/api-doc/lsa.json',
+       'api/api-doc/memory.json',
        'api/storage_service.cc',
        'api/api-doc/commitlog.json',
        'api/commitlog.cc',
@@ -510,6 +561,7 @@ api = ['api/api.cc',
        'api/cache_service.cc',
        'api/api-doc/collectd.json',
        'api/collectd.cc',
+       'api/prometheus.cc',
        'api/api-doc/endpoint_snitch_info.json',
        'api/endpoint_snitch.cc',
        'api/api-doc/compaction_manager.json',
@@ -518,6 +570,7 @@ api = ['api/api.cc',
        'api/hinted_handoff.cc',
        'api/api-doc/utils.json',
        'api/lsa.cc',
+       'api/memory.cc',
        'api/api-doc/stream_manager.json',
        'api/stream_manager.cc',
        'api/api-doc/system.json',
@@ -545,6 +598,7 @@ idls = ['idl/gossip_digest.idl.hh',
         'idl/idl_test.idl.hh',
         'idl/commitlog.idl.hh',
         'idl/tracing.idl.hh',
+        'idl/replica_load.idl.hh',
         ]
 
 scylla_tests_dependencies = scylla_core + api + idls + [
@@ -574,9 +628,16 @@ tests_not_using_seastar_test_framework = set([
     'tests/perf_row_cache_update',
     'tests/cartesian_product_test',
     'tests/perf/perf_hash',
+    'tests/perf/perf_utf8',
+    'tests/perf/perf_range_tombstone_list',
+    'tests/perf/perf_lsa',
+    'tests/perf/perf_messaging',
+    'tests/perf/perf_row_cache',
+    'tests/perf/perf_commitlog',
     'tests/perf/perf_cql_parser',
     'tests/message',
     'tests/perf/perf_simple_query',
+    'tests/perf/perf_workload',
     'tests/memory_footprint',
     'tests/test-serialization',
     'tests/gossip',
@@ -584,11 +645,16 @@ tests_not_using_seastar_test_framework = set([
     'tests/range_test',
     'tests/crc_test',
     'tests/perf/perf_sstable',
+    'tests/perf/perf_repair_checksum',
     'tests/managed_vector_test',
     'tests/dynamic_bitset_test',
     'tests/idl_test',
     'tests/range_tombstone_list_test',
     'tests/anchorless_list_test',
+    'tests/tournament_tree_test',
+    'tests/hdr_histogram_test',
+    'tests/frequency_sketch_test',
+    'tests/space_saving_test',
 ])
 
 for t in tests_not_using_seastar_test_framework:
@@ -607,6 +673,10 @@ deps['tests/UUID_test'] = ['utils/UUID_gen.cc', 'tests/UUID_test.cc']
 deps['tests/murmur_hash_test'] = ['bytes.cc', 'utils/murmur_hash.cc', 'tests/murmur_hash_test.cc']
 deps['tests/allocation_strategy_test'] = ['tests/allocation_strategy_test.cc', 'utils/logalloc.cc', 'utils/dynamic_bitset.cc']
 deps['tests/anchorless_list_test'] = ['tests/anchorless_list_test.cc']
+deps['tests/tournament_tree_test'] = ['tests/tournament_tree_test.cc']
+deps['tests/hdr_histogram_test'] = ['tests/hdr_histogram_test.cc']
+deps['tests/frequency_sketch_test'] = ['tests/frequency_sketch_test.cc']
+deps['tests/space_saving_test'] = ['tests/space_saving_test.cc']
 
 warnings = [
     '-Wno-mismatched-tags',  # clang-only
@@ -734,7 +804,7 @@ for mode in build_modes:
 seastar_deps = 'practically_anything_can_change_so_lets_run_it_every_time_and_restat.'
 
 args.user_cflags += " " + pkg_config("--cflags", "jsoncpp")
-libs = "-lyaml-cpp -llz4 -lz -lsnappy " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem' + ' -lcrypt' + ' -lboost_date_time'
+libs = "-lyaml-cpp -llz4 -lz -lsnappy -lzstd " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem' + ' -lcrypt' + ' -lboost_date_time'
 for pkg in pkgs:
     args.user_cflags += ' ' + pkg_config('--cflags', pkg)
     libs += ' ' + pkg_config('--libs', pkg)
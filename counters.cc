@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "counters.hh"
+#include "cell_compression.hh"
+#include "types.hh"
+#include <boost/range/algorithm/find_if.hpp>
+
+void counter_shard::serialize(bytes::iterator& out) const {
+    auto write = [&out] (int64_t v) {
+        auto u = net::hton(v);
+        out = std::copy_n(reinterpret_cast<const char*>(&u), sizeof(u), out);
+    };
+    write(_id.get_most_significant_bits());
+    write(_id.get_least_significant_bits());
+    write(_value);
+    write(_logical_clock);
+}
+
+counter_shard counter_shard::deserialize(bytes_view& in) {
+    if (in.size() < serialized_size) {
+        throw marshal_exception(sprint("counter shard of %d bytes, expected %d", in.size(), serialized_size));
+    }
+    auto msb = read_simple<int64_t>(in);
+    auto lsb = read_simple<int64_t>(in);
+    auto value = read_simple<int64_t>(in);
+    auto clock = read_simple<int64_t>(in);
+    return counter_shard(utils::UUID(msb, lsb), value, clock);
+}
+
+std::ostream& operator<<(std::ostream& os, const counter_shard& cs) {
+    return os << "{" << cs._id << ", value: " << cs._value << ", clock: " << cs._logical_clock << "}";
+}
+
+atomic_cell counter_cell_builder::build(api::timestamp_type timestamp) const {
+    bytes value(bytes::initialized_later(), _shards.size() * counter_shard::serialized_size);
+    auto out = value.begin();
+    for (auto&& cs : _shards) {
+        cs.serialize(out);
+    }
+    return atomic_cell::make_live(timestamp, value);
+}
+
+counter_cell_view::counter_cell_view(atomic_cell_view ac) {
+    assert(ac.is_live());
+    if (ac.is_value_compressed()) {
+        _uncompressed = cell_compression::uncompressed_value(ac);
+        _value = *_uncompressed;
+    } else {
+        _value = ac.value();
+    }
+    if (_value.size() % counter_shard::serialized_size) {
+        throw marshal_exception(sprint("counter cell of %d bytes is not made of shards", _value.size()));
+    }
+}
+
+int64_t counter_cell_view::total_value() const {
+    int64_t total = 0;
+    for_each_shard([&total] (const counter_shard& cs) {
+        total += cs.value();
+    });
+    return total;
+}
+
+std::experimental::optional<counter_shard> counter_cell_view::get_shard(const utils::UUID& id) const {
+    std::experimental::optional<counter_shard> ret;
+    for_each_shard([&] (const counter_shard& cs) {
+        if (cs.id() == id) {
+            ret = cs;
+        }
+    });
+    return ret;
+}
+
+atomic_cell counter_cell_view::merge(atomic_cell_view a, atomic_cell_view b) {
+    counter_cell_view va(a);
+    counter_cell_view vb(b);
+    std::vector<counter_shard> shards;
+    shards.reserve(va.shard_count() + vb.shard_count());
+    va.for_each_shard([&] (const counter_shard& cs) {
+        shards.emplace_back(cs);
+    });
+    auto n = shards.size();
+    vb.for_each_shard([&] (const counter_shard& cs) {
+        auto end = shards.begin() + n;
+        auto it = boost::find_if(boost::make_iterator_range(shards.begin(), end), [&] (const counter_shard& s) {
+            return s.id() == cs.id();
+        });
+        if (it != end) {
+            it->apply(cs);
+        } else {
+            shards.emplace_back(cs);
+        }
+    });
+    std::sort(shards.begin(), shards.end(), [] (const counter_shard& x, const counter_shard& y) {
+        return x.id() < y.id();
+    });
+    counter_cell_builder ccb;
+    for (auto&& cs : shards) {
+        ccb.add_shard(cs);
+    }
+    return ccb.build(std::max(a.timestamp(), b.timestamp()));
+}
+
+std::ostream& operator<<(std::ostream& os, const counter_cell_view& ccv) {
+    os << "{";
+    auto first = true;
+    ccv.for_each_shard([&] (const counter_shard& cs) {
+        os << (first ? "" : ", ") << cs;
+        first = false;
+    });
+    return os << "}";
+}
+
+atomic_cell make_counter_update_cell(api::timestamp_type timestamp, int64_t delta) {
+    return atomic_cell::make_live(timestamp, long_type->decompose(delta));
+}
+
+int64_t counter_update_value(atomic_cell_view ac) {
+    return value_cast<int64_t>(long_type->deserialize(ac.value()));
+}
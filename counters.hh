@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <vector>
+#include "atomic_cell.hh"
+#include "utils/UUID.hh"
+
+// Counters
+//
+// A counter is kept as a set of shards, one for each node which was ever the
+// leader of an update to it. A shard holds the sum of the increments which
+// went through that node, and a logical clock which the node bumps with each
+// of them. Only the owner of a shard ever changes it, so of two versions of a
+// shard the one with the higher clock is the newer, and merging two counter
+// cells takes the newest version of each shard. The value of the counter is
+// the sum of the values of its shards.
+//
+// A live counter cell holds the shards, sorted by id:
+//
+//   <value> := <shard>*
+//   <shard> := <uint64_t:id msb><uint64_t:id lsb><int64_t:value><int64_t:logical clock>
+//
+// Counter updates, as produced by CQL, are live cells of counter columns whose
+// value is the serialized int64_t delta. They only travel from the coordinator
+// to the leader, which turns them into counter cells with its own shard (see
+// database::apply_counter_update()), and are never merged with other cells.
+
+class counter_shard {
+    utils::UUID _id;
+    int64_t _value;
+    int64_t _logical_clock;
+public:
+    static constexpr size_t serialized_size = 4 * sizeof(int64_t);
+
+    counter_shard(utils::UUID id, int64_t value, int64_t logical_clock)
+        : _id(id)
+        , _value(value)
+        , _logical_clock(logical_clock)
+    { }
+
+    const utils::UUID& id() const { return _id; }
+    int64_t value() const { return _value; }
+    int64_t logical_clock() const { return _logical_clock; }
+
+    // Replaces this version of the shard with other if it's newer.
+    void apply(const counter_shard& other) {
+        if (other._logical_clock > _logical_clock) {
+            *this = other;
+        }
+    }
+
+    void serialize(bytes::iterator& out) const;
+    // Consumes one shard from the front of in.
+    static counter_shard deserialize(bytes_view& in);
+
+    friend std::ostream& operator<<(std::ostream& os, const counter_shard& cs);
+};
+
+class counter_cell_builder {
+    std::vector<counter_shard> _shards;
+public:
+    counter_cell_builder() = default;
+
+    // Shards must be added in the order of their ids.
+    void add_shard(const counter_shard& cs) {
+        _shards.emplace_back(cs);
+    }
+
+    atomic_cell build(api::timestamp_type timestamp) const;
+};
+
+// Gives access to the shards of a live counter cell.
+class counter_cell_view {
+    // Set if the cell's value needs to be uncompressed.
+    std::experimental::optional<bytes> _uncompressed;
+    bytes_view _value;
+public:
+    explicit counter_cell_view(atomic_cell_view ac);
+
+    template<typename Func>
+    void for_each_shard(Func&& func) const {
+        auto in = _value;
+        while (!in.empty()) {
+            func(counter_shard::deserialize(in));
+        }
+    }
+
+    size_t shard_count() const {
+        return _value.size() / counter_shard::serialized_size;
+    }
+
+    int64_t total_value() const;
+    std::experimental::optional<counter_shard> get_shard(const utils::UUID& id) const;
+
+    // Merges two live counter cells. The result has the newest version of
+    // each of their shards and the higher of their timestamps.
+    static atomic_cell merge(atomic_cell_view a, atomic_cell_view b);
+
+    friend std::ostream& operator<<(std::ostream& os, const counter_cell_view& ccv);
+};
+
+atomic_cell make_counter_update_cell(api::timestamp_type timestamp, int64_t delta);
+// Requires a live counter update cell.
+int64_t counter_update_value(atomic_cell_view ac);
@@ -40,11 +40,13 @@ options {
 #include "cql3/statements/drop_keyspace_statement.hh"
 #include "cql3/statements/create_index_statement.hh"
 #include "cql3/statements/create_table_statement.hh"
+#include "cql3/statements/create_view_statement.hh"
 #include "cql3/statements/create_type_statement.hh"
 #include "cql3/statements/drop_type_statement.hh"
 #include "cql3/statements/alter_type_statement.hh"
 #include "cql3/statements/property_definitions.hh"
 #include "cql3/statements/drop_table_statement.hh"
+#include "cql3/statements/drop_view_statement.hh"
 #include "cql3/statements/truncate_statement.hh"
 #include "cql3/statements/raw/update_statement.hh"
 #include "cql3/statements/raw/insert_statement.hh"
@@ -340,6 +342,8 @@ cqlStatement returns [shared_ptr<raw::parsed_statement> stmt]
     | st30=createAggregateStatement    { $stmt = st30; }
     | st31=dropAggregateStatement      { $stmt = st31; }
 #endif
+    | st32=createViewStatement         { $stmt = st32; }
+    | st33=dropViewStatement           { $stmt = st33; }
     ;
 
 /*
@@ -359,8 +363,10 @@ selectStatement returns [shared_ptr<raw::select_statement> expr]
     @init {
         bool is_distinct = false;
         ::shared_ptr<cql3::term::raw> limit;
+        ::shared_ptr<cql3::term::raw> per_partition_limit;
         raw::select_statement::parameters::orderings_type orderings;
         bool allow_filtering = false;
+        bool bypass_cache = false;
     }
     : K_SELECT ( ( K_DISTINCT { is_distinct = true; } )?
                  sclause=selectClause
@@ -369,12 +375,14 @@ selectStatement returns [shared_ptr<raw::select_statement> expr]
       K_FROM cf=columnFamilyName
       ( K_WHERE wclause=whereClause )?
       ( K_ORDER K_BY orderByClause[orderings] ( ',' orderByClause[orderings] )* )?
+      ( K_PER K_PARTITION K_LIMIT pprows=intValue { per_partition_limit = pprows; } )?
       ( K_LIMIT rows=intValue { limit = rows; } )?
       ( K_ALLOW K_FILTERING  { allow_filtering = true; } )?
+      ( K_BYPASS K_CACHE { bypass_cache = true; } )?
       {
-          auto params = ::make_shared<raw::select_statement::parameters>(std::move(orderings), is_distinct, allow_filtering);
+          auto params = ::make_shared<raw::select_statement::parameters>(std::move(orderings), is_distinct, allow_filtering, bypass_cache);
           $expr = ::make_shared<raw::select_statement>(std::move(cf), std::move(params),
-            std::move(sclause), std::move(wclause), std::move(limit));
+            std::move(sclause), std::move(wclause), std::move(limit), std::move(per_partition_limit));
       }
     ;
 
@@ -744,6 +752,51 @@ cfamOrdering[shared_ptr<cql3::statements::create_table_statement::raw_statement>
     ;
 
 
+/**
+ * CREATE MATERIALIZED VIEW [IF NOT EXISTS] <view> AS
+ *     SELECT <column>, ... FROM <CF>
+ *     WHERE <pkColumn> IS NOT NULL AND ...
+ *     PRIMARY KEY (<pkColumn>, ...)
+ *     WITH <property> = <value> AND ...;
+ */
+createViewStatement returns [::shared_ptr<create_view_statement> expr]
+    @init {
+        bool if_not_exists = false;
+        create_view_statement::columns_type selected;
+        create_view_statement::columns_type not_null;
+        create_view_statement::columns_type partition_keys;
+        create_view_statement::columns_type clustering_keys;
+        create_view_statement::ordering_type ordering;
+        auto props = make_shared<cql3::statements::cf_prop_defs>();
+    }
+    : K_CREATE K_MATERIALIZED K_VIEW (K_IF K_NOT K_EXISTS { if_not_exists = true; } )? cf=columnFamilyName K_AS
+        K_SELECT ( '*' | c1=cident { selected.push_back(c1); } ( ',' cn=cident { selected.push_back(cn); } )* )
+        K_FROM basecf=columnFamilyName
+        K_WHERE viewNotNull[not_null] ( K_AND viewNotNull[not_null] )*
+        K_PRIMARY K_KEY '(' viewPartitionKey[partition_keys] ( ',' c=cident { clustering_keys.push_back(c); } )* ')'
+        ( K_WITH viewProperty[props, ordering] ( K_AND viewProperty[props, ordering] )* )?
+      { $expr = ::make_shared<create_view_statement>(cf, basecf, selected, not_null, partition_keys, clustering_keys, props, ordering, if_not_exists); }
+    ;
+
+viewNotNull[create_view_statement::columns_type& columns]
+    : c=cident K_IS K_NOT K_NULL { columns.push_back(c); }
+    ;
+
+viewPartitionKey[create_view_statement::columns_type& columns]
+    : k=cident { columns.push_back(k); }
+    | '(' k1=cident { columns.push_back(k1); } ( ',' kn=cident { columns.push_back(kn); } )* ')'
+    ;
+
+viewProperty[::shared_ptr<cql3::statements::cf_prop_defs> props, create_view_statement::ordering_type& ordering]
+    : property[props]
+    | K_CLUSTERING K_ORDER K_BY '(' viewOrdering[ordering] (',' viewOrdering[ordering])* ')'
+    ;
+
+viewOrdering[create_view_statement::ordering_type& ordering]
+    @init{ bool reversed=false; }
+    : k=cident (K_ASC | K_DESC { reversed=true;} ) { ordering.emplace_back(k, reversed); }
+    ;
+
 /**
  * CREATE TYPE foo (
  *    <name1> <type1>,
@@ -889,6 +942,14 @@ dropTableStatement returns [::shared_ptr<drop_table_statement> stmt]
     : K_DROP K_COLUMNFAMILY (K_IF K_EXISTS { if_exists = true; } )? cf=columnFamilyName { $stmt = ::make_shared<drop_table_statement>(cf, if_exists); }
     ;
 
+/**
+ * DROP MATERIALIZED VIEW [IF EXISTS] <view>;
+ */
+dropViewStatement returns [::shared_ptr<drop_view_statement> stmt]
+    @init { bool if_exists = false; }
+    : K_DROP K_MATERIALIZED K_VIEW (K_IF K_EXISTS { if_exists = true; } )? cf=columnFamilyName { $stmt = ::make_shared<drop_view_statement>(cf, if_exists); }
+    ;
+
 /**
  * DROP TYPE <name>;
  */
@@ -1493,6 +1554,13 @@ basic_unreserved_keyword returns [sstring str]
         | K_LANGUAGE
         | K_NON
         | K_DETERMINISTIC
+        | K_MATERIALIZED
+        | K_VIEW
+        | K_IS
+        | K_BYPASS
+        | K_CACHE
+        | K_PER
+        | K_PARTITION
         ) { $str = $k.text; }
     ;
 
@@ -1510,6 +1578,8 @@ K_INSERT:      I N S E R T;
 K_UPDATE:      U P D A T E;
 K_WITH:        W I T H;
 K_LIMIT:       L I M I T;
+K_PER:         P E R;
+K_PARTITION:   P A R T I T I O N;
 K_USING:       U S I N G;
 K_USE:         U S E;
 K_DISTINCT:    D I S T I N C T;
@@ -1550,6 +1620,8 @@ K_ASC:         A S C;
 K_DESC:        D E S C;
 K_ALLOW:       A L L O W;
 K_FILTERING:   F I L T E R I N G;
+K_BYPASS:      B Y P A S S;
+K_CACHE:       C A C H E;
 K_IF:          I F;
 K_CONTAINS:    C O N T A I N S;
 
@@ -1599,6 +1671,9 @@ K_INFINITY:    I N F I N I T Y;
 K_TUPLE:       T U P L E;
 
 K_TRIGGER:     T R I G G E R;
+K_MATERIALIZED: M A T E R I A L I Z E D;
+K_VIEW:        V I E W;
+K_IS:          I S;
 K_STATIC:      S T A T I C;
 K_FROZEN:      F R O Z E N;
 
@@ -61,6 +61,10 @@ bool abstract_marker::contains_bind_marker() const {
     return true;
 }
 
+bool abstract_marker::is_unset(const query_options& options) const {
+    return is_unset_value(options.get_value_at(_bind_index));
+}
+
 abstract_marker::raw::raw(int32_t bind_index)
     : _bind_index{bind_index}
 { }
@@ -61,6 +61,8 @@ class abstract_marker : public non_terminal {
 
     virtual bool contains_bind_marker() const override;
 
+    virtual bool is_unset(const query_options& options) const override;
+
     /**
      * A parsed, but non prepared, bind marker.
      */
@@ -71,6 +71,9 @@ int64_t attributes::get_timestamp(int64_t now, const query_options& options) {
     }
 
     auto tval = _timestamp->bind_and_get(options);
+    if (is_unset_value(tval)) {
+        return now;
+    }
     if (!tval) {
         throw exceptions::invalid_request_exception("Invalid null value of timestamp");
     }
@@ -88,6 +91,9 @@ int32_t attributes::get_time_to_live(const query_options& options) {
         return 0;
 
     auto tval = _time_to_live->bind_and_get(options);
+    if (is_unset_value(tval)) {
+        return 0;
+    }
     if (!tval) {
         throw exceptions::invalid_request_exception("Invalid null value of TTL");
     }
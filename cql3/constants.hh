@@ -172,6 +172,9 @@ class constants {
         virtual bytes_view_opt bind_and_get(const query_options& options) override {
             try {
                 auto value = options.get_value_at(_bind_index);
+                if (is_unset_value(value)) {
+                    return value;
+                }
                 if (value) {
                     _receiver->type->validate(*value);
                     return *value;
@@ -202,47 +205,36 @@ class constants {
         }
     };
 
-#if 0
-    public static class Adder extends Operation
-    {
-        public Adder(ColumnDefinition column, Term t)
-        {
-            super(column, t);
-        }
-
-        public void execute(ByteBuffer rowKey, ColumnFamily cf, Composite prefix, UpdateParameters params) throws InvalidRequestException
-        {
-            ByteBuffer bytes = t.bindAndGet(params.options);
-            if (bytes == null)
-                throw new InvalidRequestException("Invalid null value for counter increment");
-            long increment = ByteBufferUtil.toLong(bytes);
-            CellName cname = cf.getComparator().create(prefix, column);
-            cf.addColumn(params.makeCounter(cname, increment));
-        }
-    }
+    class adder : public operation {
+    public:
+        using operation::operation;
 
-    public static class Substracter extends Operation
-    {
-        public Substracter(ColumnDefinition column, Term t)
-        {
-            super(column, t);
+        virtual void execute(mutation& m, const exploded_clustering_prefix& prefix, const update_parameters& params) override {
+            auto value = _t->bind_and_get(params._options);
+            if (!value) {
+                throw exceptions::invalid_request_exception("Invalid null value for counter increment");
+            }
+            auto increment = value_cast<int64_t>(long_type->deserialize_value(*value));
+            m.set_cell(prefix, column, params.make_counter_update_cell(increment));
         }
+    };
 
-        public void execute(ByteBuffer rowKey, ColumnFamily cf, Composite prefix, UpdateParameters params) throws InvalidRequestException
-        {
-            ByteBuffer bytes = t.bindAndGet(params.options);
-            if (bytes == null)
-                throw new InvalidRequestException("Invalid null value for counter increment");
-
-            long increment = ByteBufferUtil.toLong(bytes);
-            if (increment == Long.MIN_VALUE)
-                throw new InvalidRequestException("The negation of " + increment + " overflows supported counter precision (signed 8 bytes integer)");
+    class subtracter : public operation {
+    public:
+        using operation::operation;
 
-            CellName cname = cf.getComparator().create(prefix, column);
-            cf.addColumn(params.makeCounter(cname, -increment));
+        virtual void execute(mutation& m, const exploded_clustering_prefix& prefix, const update_parameters& params) override {
+            auto value = _t->bind_and_get(params._options);
+            if (!value) {
+                throw exceptions::invalid_request_exception("Invalid null value for counter increment");
+            }
+            auto increment = value_cast<int64_t>(long_type->deserialize_value(*value));
+            if (increment == std::numeric_limits<int64_t>::min()) {
+                throw exceptions::invalid_request_exception(sprint("The negation of %d overflows supported counter precision (signed 8 bytes integer)", increment));
+            }
+            m.set_cell(prefix, column, params.make_counter_update_cell(-increment));
         }
-    }
-#endif
+    };
 
     class deleter : public operation {
     public:
@@ -52,6 +52,26 @@ namespace functions {
  */
 namespace aggregate_fcts {
 
+// Reads an aggregate argument. Fixed-width integers are read straight from
+// their serialized form, anything else, including empty values, goes through
+// the type.
+template <typename Type>
+inline
+std::enable_if_t<std::is_integral<Type>::value, Type>
+read_input(bytes_view v) {
+    if (v.size() == sizeof(Type)) {
+        return read_simple_exactly<Type>(v);
+    }
+    return value_cast<Type>(data_type_for<Type>()->deserialize(v));
+}
+
+template <typename Type>
+inline
+std::enable_if_t<!std::is_integral<Type>::value, Type>
+read_input(bytes_view v) {
+    return value_cast<Type>(data_type_for<Type>()->deserialize(v));
+}
+
 class impl_count_function : public aggregate_function::aggregate {
     int64_t _count;
 public:
@@ -64,6 +84,9 @@ class impl_count_function : public aggregate_function::aggregate {
     virtual void add_input(cql_serialization_format sf, const std::vector<opt_bytes>& values) override {
         ++_count;
     }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        _count += rows;
+    }
 };
 
     /**
@@ -90,7 +113,14 @@ class impl_sum_function_for final : public aggregate_function::aggregate {
         if (!values[0]) {
             return;
         }
-        _sum += value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
+        _sum += read_input<Type>(*values[0]);
+    }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        for (auto&& v : values[0]) {
+            if (v) {
+                _sum += read_input<Type>(*v);
+            }
+        }
     }
 };
 
@@ -132,7 +162,15 @@ class impl_avg_function_for final : public aggregate_function::aggregate {
             return;
         }
         ++_count;
-        _sum += value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
+        _sum += read_input<Type>(*values[0]);
+    }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        for (auto&& v : values[0]) {
+            if (v) {
+                ++_count;
+                _sum += read_input<Type>(*v);
+            }
+        }
     }
 };
 
@@ -155,6 +193,14 @@ make_avg_function() {
 template <typename Type>
 class impl_max_function_for final : public aggregate_function::aggregate {
    std::experimental::optional<Type> _max{};
+
+   void add(Type val) {
+       if (!_max) {
+           _max = val;
+       } else {
+           _max = std::max(*_max, val);
+       }
+   }
 public:
     virtual void reset() override {
         _max = {};
@@ -169,11 +215,13 @@ class impl_max_function_for final : public aggregate_function::aggregate {
         if (!values[0]) {
             return;
         }
-        auto val = value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
-        if (!_max) {
-            _max = val;
-        } else {
-            _max = std::max(*_max, val);
+        add(read_input<Type>(*values[0]));
+    }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        for (auto&& v : values[0]) {
+            if (v) {
+                add(read_input<Type>(*v));
+            }
         }
     }
 };
@@ -202,6 +250,14 @@ make_max_function() {
 template <typename Type>
 class impl_min_function_for final : public aggregate_function::aggregate {
    std::experimental::optional<Type> _min{};
+
+   void add(Type val) {
+       if (!_min) {
+           _min = val;
+       } else {
+           _min = std::min(*_min, val);
+       }
+   }
 public:
     virtual void reset() override {
         _min = {};
@@ -216,11 +272,13 @@ class impl_min_function_for final : public aggregate_function::aggregate {
         if (!values[0]) {
             return;
         }
-        auto val = value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
-        if (!_min) {
-            _min = val;
-        } else {
-            _min = std::min(*_min, val);
+        add(read_input<Type>(*values[0]));
+    }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        for (auto&& v : values[0]) {
+            if (v) {
+                add(read_input<Type>(*v));
+            }
         }
     }
 };
@@ -264,6 +322,9 @@ class impl_count_function_for final : public aggregate_function::aggregate {
         }
         ++_count;
     }
+    virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) override {
+        _count += std::count_if(values[0].begin(), values[0].end(), [] (const opt_bytes& v) { return bool(v); });
+    }
 };
 
 template <typename Type>
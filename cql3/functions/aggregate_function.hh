@@ -79,6 +79,24 @@ class aggregate_function : public virtual function {
          */
         virtual void add_input(cql_serialization_format sf, const std::vector<opt_bytes>& values) = 0;
 
+        /**
+         * Adds a batch of inputs to this aggregate, as if <code>add_input</code> was called for each row.
+         *
+         * @param sf native protocol version
+         * @param values the values to add, one vector of <code>rows</code> values per argument. Values
+         * may be moved out.
+         * @param rows the number of rows
+         */
+        virtual void add_input_batch(cql_serialization_format sf, std::vector<std::vector<opt_bytes>>& values, size_t rows) {
+            std::vector<opt_bytes> row(values.size());
+            for (size_t i = 0; i < rows; ++i) {
+                for (size_t j = 0; j < values.size(); ++j) {
+                    row[j] = std::move(values[j][i]);
+                }
+                add_input(sf, row);
+            }
+        }
+
         /**
          * Computes and returns the aggregate current value.
          *
@@ -50,12 +50,6 @@ functions::init() {
         if (type == cql3_type::varchar || type == cql3_type::blob) {
             continue;
         }
-        // counters are not supported yet
-        if (type->is_counter()) {
-            warn(unimplemented::cause::COUNTERS);
-            continue;
-        }
-
         declare(make_to_blob_function(type->get_type()));
         declare(make_from_blob_function(type->get_type()));
     }
@@ -313,6 +307,9 @@ function_call::bind_and_get(const query_options& options) {
         if (!val) {
             throw exceptions::invalid_request_exception(sprint("Invalid null value for argument to %s", *_fun));
         }
+        if (is_unset_value(val)) {
+            throw exceptions::invalid_request_exception(sprint("Invalid unset value for argument to %s", *_fun));
+        }
         buffers.push_back(std::move(to_bytes_opt(val)));
     }
     auto result = execute_internal(options.get_cql_serialization_format(), *_fun, std::move(buffers));
@@ -80,6 +80,17 @@ class native_scalar_function_for : public native_scalar_function {
     virtual bytes_opt execute(cql_serialization_format sf, const std::vector<bytes_opt>& parameters) override {
         return _func(sf, parameters);
     }
+    // Same as the default, but calls _func directly instead of through execute().
+    virtual void execute_batch(cql_serialization_format sf, std::vector<std::vector<bytes_opt>>& parameters, size_t rows,
+            std::vector<bytes_opt>& out) override {
+        std::vector<bytes_opt> row(parameters.size());
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < parameters.size(); ++j) {
+                row[j] = std::move(parameters[j][i]);
+            }
+            out.emplace_back(_func(sf, row));
+        }
+    }
 };
 
 template <bool Pure, typename Func>
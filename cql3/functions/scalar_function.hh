@@ -59,6 +59,26 @@ class scalar_function : public virtual function {
      * @throws InvalidRequestException if this function cannot not be applied to the parameter
      */
     virtual bytes_opt execute(cql_serialization_format sf, const std::vector<bytes_opt>& parameters) = 0;
+
+    /**
+     * Applies this function to each row of a batch of parameters.
+     *
+     * @param sf serialization format used for parameters and return values
+     * @param parameters the input parameters, one vector of <code>rows</code> values per parameter. Values
+     * may be moved out.
+     * @param rows the number of rows
+     * @param out where the results are appended
+     */
+    virtual void execute_batch(cql_serialization_format sf, std::vector<std::vector<bytes_opt>>& parameters, size_t rows,
+            std::vector<bytes_opt>& out) {
+        std::vector<bytes_opt> row(parameters.size());
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < parameters.size(); ++j) {
+                row[j] = std::move(parameters[j][i]);
+            }
+            out.emplace_back(execute(sf, row));
+        }
+    }
 };
 
 
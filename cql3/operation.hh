@@ -95,6 +95,12 @@ class operation {
         return params.make_cell(value);
     }
 
+    // An operation whose value the client left unset doesn't touch the
+    // column at all, rather than writing a tombstone.
+    bool is_unset(const query_options& options) const {
+        return _t && _t->is_unset(options);
+    }
+
     virtual bool uses_function(const sstring& ks_name, const sstring& function_name) const {
         return _t && _t->uses_function(ks_name, function_name);
     }
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include "core/shared_ptr.hh"
+#include "cql3/statements/prepared_statement.hh"
+
+namespace cql3 {
+
+struct prepared_statements_cache_stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    uint64_t removals = 0;
+};
+
+// Size of a prepared statement, as accounted by prepared_statements_cache.
+//
+// We can't measure the parsed statement tree, so this is an estimate
+// proportional to the length of the query string, which is what makes
+// statements with inlined literals expensive.
+inline size_t prepared_statement_weight(const statements::prepared_statement& p) {
+    static constexpr size_t fixed_overhead = 1024;
+    static constexpr size_t bytes_per_query_byte = 8;
+    return fixed_overhead + p.raw_cql_statement.size() * bytes_per_query_byte
+            + p.bound_names.size() * sizeof(column_specification);
+}
+
+// Shard-local cache of prepared statements, bounded by the estimated amount
+// of memory its entries take.
+//
+// When the limit is exceeded, the least recently used statements are evicted.
+// An evicted statement is just a miss on the next EXECUTE, and the client
+// re-prepares it after receiving an UNPREPARED error. Statements which are
+// executing when evicted are kept alive by their users.
+template <typename Key>
+class prepared_statements_cache {
+public:
+    using value_type = ::shared_ptr<statements::prepared_statement>;
+private:
+    struct entry {
+        Key key;
+        value_type prepared;
+        size_t weight;
+    };
+    using lru_type = std::list<entry>;
+
+    lru_type _lru;
+    std::unordered_map<Key, typename lru_type::iterator> _index;
+    size_t _max_size;
+    size_t _size = 0;
+    prepared_statements_cache_stats& _stats;
+private:
+    void erase(typename lru_type::iterator i) {
+        _size -= i->weight;
+        _index.erase(i->key);
+        _lru.erase(i);
+    }
+    void shrink() {
+        while (_size > _max_size && !_lru.empty()) {
+            erase(std::prev(_lru.end()));
+            ++_stats.evictions;
+        }
+    }
+public:
+    prepared_statements_cache(size_t max_size, prepared_statements_cache_stats& stats)
+        : _max_size(max_size)
+        , _stats(stats)
+    { }
+
+    // Returns a null pointer if there is no statement with given id.
+    value_type find(const Key& key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            ++_stats.misses;
+            return value_type();
+        }
+        ++_stats.hits;
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return it->second->prepared;
+    }
+
+    // Inserts the statement, unless one with the same id is already cached,
+    // and evicts the least recently used statements beyond the limit.
+    void insert(const Key& key, value_type prepared) {
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return;
+        }
+        auto weight = prepared_statement_weight(*prepared);
+        _lru.push_front(entry{key, std::move(prepared), weight});
+        try {
+            _index.emplace(key, _lru.begin());
+        } catch (...) {
+            _lru.pop_front();
+            throw;
+        }
+        _size += weight;
+        ++_stats.insertions;
+        shrink();
+    }
+
+    // Erases the statements for which filter returns true.
+    template <typename Pred>
+    void remove_if(Pred filter) {
+        for (auto it = _lru.begin(); it != _lru.end(); ) {
+            auto next = std::next(it);
+            if (filter(it->prepared->statement)) {
+                erase(it);
+                ++_stats.removals;
+            }
+            it = next;
+        }
+    }
+
+    size_t max_size() const {
+        return _max_size;
+    }
+    size_t memory_footprint() const {
+        return _size;
+    }
+    size_t size() const {
+        return _index.size();
+    }
+};
+
+}
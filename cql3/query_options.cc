@@ -44,6 +44,12 @@
 
 namespace cql3 {
 
+static const int8_t unset_value_marker = 0;
+
+bytes_view unset_value() {
+    return bytes_view(&unset_value_marker, 0);
+}
+
 thread_local const query_options::specific_options query_options::specific_options::DEFAULT{-1, {}, {}, api::missing_timestamp};
 
 thread_local query_options query_options::DEFAULT{db::consistency_level::ONE, std::experimental::nullopt,
@@ -88,7 +94,7 @@ query_options::query_options(query_options&& o, std::vector<std::vector<bytes_vi
     std::vector<query_options> tmp;
     tmp.reserve(value_views.size());
     std::transform(value_views.begin(), value_views.end(), std::back_inserter(tmp), [this](auto& vals) {
-        return query_options(_consistency, {}, vals, _skip_metadata, _options, _cql_serialization_format);
+        return query_options(_consistency, {}, std::move(vals), _skip_metadata, _options, _cql_serialization_format);
     });
     _batch_options = std::move(tmp);
 }
@@ -191,24 +197,26 @@ void query_options::prepare(const std::vector<::shared_ptr<column_specification>
         return;
     }
 
+    // Only the views are reordered, the values they point to stay where they
+    // are, be it in _values or in the request buffer.
     auto& names = *_names;
-    std::vector<bytes_opt> ordered_values;
+    std::vector<bytes_view_opt> ordered_values;
     ordered_values.reserve(specs.size());
     for (auto&& spec : specs) {
         auto& spec_name = spec->name->text();
         for (size_t j = 0; j < names.size(); j++) {
             if (names[j] == spec_name) {
-                ordered_values.emplace_back(_values[j]);
+                ordered_values.emplace_back(_value_views[j]);
                 break;
             }
         }
     }
-    _values = std::move(ordered_values);
-    fill_value_views();
+    _value_views = std::move(ordered_values);
 }
 
 void query_options::fill_value_views()
 {
+    _value_views.reserve(_values.size());
     for (auto&& value : _values) {
         if (value) {
             _value_views.emplace_back(bytes_view{*value});
@@ -52,6 +52,15 @@
 
 namespace cql3 {
 
+// Value of a bind marker the client explicitly left unset (native protocol
+// v4 and later). It's an empty view told apart by its address, so that it
+// survives being copied along with the other bound values.
+bytes_view unset_value();
+
+inline bool is_unset_value(const bytes_view_opt& v) {
+    return v && v->data() == unset_value().data();
+}
+
 /**
  * Options for a query.
  */
@@ -43,8 +43,13 @@
 #include "cql3/CqlParser.hpp"
 #include "cql3/error_collector.hh"
 #include "cql3/statements/batch_statement.hh"
+#include "cql3/statements/modification_statement.hh"
+#include "cql3/statements/select_statement.hh"
 
 #include "transport/messages/result_message.hh"
+#include "tracing/trace_state.hh"
+#include "service/request_scheduler.hh"
+#include "core/memory.hh"
 
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include <cryptopp/md5.h>
@@ -83,6 +88,12 @@ class query_processor::internal_state {
     }
 };
 
+// Each of the CQL and Thrift caches may take 1/256th of the shard's memory,
+// like in origin.
+static size_t max_prepared_cache_memory() {
+    return memory::stats().total_memory() / 256;
+}
+
 api::timestamp_type query_processor::next_timestamp() {
     return _internal_state->next_timestamp();
 }
@@ -93,12 +104,59 @@ query_processor::query_processor(distributed<service::storage_proxy>& proxy,
     , _proxy(proxy)
     , _db(db)
     , _internal_state(new internal_state())
+    , _prepared_statements(max_prepared_cache_memory(), _prepared_cache_stats)
+    , _thrift_prepared_statements(max_prepared_cache_memory(), _prepared_cache_stats)
+    , _unprepared_statements(max_prepared_cache_memory(), _unprepared_cache_stats)
 {
     _collectd_regs.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
                 , scollectd::per_cpu_plugin_instance
                 , "total_operations", "statements_prepared")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.prepare_invocations)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "prepared_cache_hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _prepared_cache_stats.hits)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "prepared_cache_misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _prepared_cache_stats.misses)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "prepared_cache_evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _prepared_cache_stats.evictions)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "prepared_statements")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                    return _prepared_statements.size() + _thrift_prepared_statements.size();
+                })));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "prepared_cache_used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                    return prepared_statements_memory_footprint();
+                })));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "unprepared_cache_hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _unprepared_cache_stats.hits)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "unprepared_cache_misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _unprepared_cache_stats.misses)));
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("query_processor"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "unprepared_cache_evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _unprepared_cache_stats.evictions)));
     service::get_local_migration_manager().register_listener(_migration_subscriber.get());
 }
 
@@ -116,7 +174,7 @@ query_processor::process(const sstring_view& query_string, service::query_state&
 {
     log.trace("process: \"{}\"", query_string);
     tracing::trace(query_state.get_trace_state(), "Parsing a statement");
-    auto p = get_statement(query_string, query_state.get_client_state());
+    auto p = get_unprepared_statement(query_string, query_state.get_client_state());
     options.prepare(p->bound_names);
     auto cql_statement = p->statement;
     if (cql_statement->get_bound_terms() != options.get_values_count()) {
@@ -132,6 +190,55 @@ query_processor::process(const sstring_view& query_string, service::query_state&
     return process_statement(std::move(cql_statement), query_state, options);
 }
 
+// Starts tracing a request which wasn't picked for tracing when it came in,
+// if the table it reads or writes is sampled with a probability of its own.
+// That's only known once the statement is prepared. A session kept only for
+// the slow query log is replaced by the full one.
+static void maybe_trace_table_query(const cql_statement& statement, service::query_state& query_state, const query_options& options) {
+    auto& client_state = query_state.get_client_state();
+    auto& trace_state = query_state.get_trace_state();
+    if ((trace_state && trace_state->full_tracing()) || client_state.is_internal()) {
+        return;
+    }
+
+    const sstring* ks;
+    const sstring* cf;
+    if (auto select = dynamic_cast<const statements::select_statement*>(&statement)) {
+        ks = &select->keyspace();
+        cf = &select->column_family();
+    } else if (auto modification = dynamic_cast<const statements::modification_statement*>(&statement)) {
+        ks = &modification->keyspace();
+        cf = &modification->column_family();
+    } else {
+        return;
+    }
+    if (!tracing::tracing::get_local_tracing_instance().trace_next_query(*ks, *cf)) {
+        return;
+    }
+
+    client_state.create_tracing_session(tracing::trace_type::QUERY, false);
+    query_state.get_trace_state() = client_state.get_trace_state();
+    tracing::set_consistency_level(query_state.get_trace_state(), options.get_consistency());
+    tracing::begin(query_state.get_trace_state(), sprint("Execute CQL3 query on %s.%s", *ks, *cf), client_state.get_client_address());
+}
+
+// The id a client request is scheduled by, see service::request_scheduler.
+// Statements which don't name a table are scheduled by the keyspace of the
+// connection.
+static sstring scheduling_id(const cql_statement* statement, const service::client_state& client_state) {
+    auto& rs = service::get_local_request_scheduler();
+    if (rs.enabled(service::request_scheduler::id_type::user)) {
+        auto user = client_state.user();
+        return user ? user->name() : sstring();
+    }
+    if (auto select = dynamic_cast<const statements::select_statement*>(statement)) {
+        return select->keyspace();
+    } else if (auto modification = dynamic_cast<const statements::modification_statement*>(statement)) {
+        return modification->keyspace();
+    }
+    return client_state.get_raw_keyspace();
+}
+
 future<::shared_ptr<result_message>>
 query_processor::process_statement(::shared_ptr<cql_statement> statement, service::query_state& query_state,
         const query_options& options)
@@ -139,7 +246,22 @@ query_processor::process_statement(::shared_ptr<cql_statement> statement, servic
 #if 0
         logger.trace("Process {} @CL.{}", statement, options.getConsistency());
 #endif
+    maybe_trace_table_query(*statement, query_state, options);
+
+    auto& client_state = query_state.get_client_state();
+    if (client_state.is_internal()) {
+        return do_process_statement(std::move(statement), query_state, options);
+    }
+    auto id = scheduling_id(statement.get(), client_state);
+    return service::get_local_request_scheduler().schedule(id, [this, statement = std::move(statement), &query_state, &options] () mutable {
+        return do_process_statement(std::move(statement), query_state, options);
+    });
+}
 
+future<::shared_ptr<result_message>>
+query_processor::do_process_statement(::shared_ptr<cql_statement> statement, service::query_state& query_state,
+        const query_options& options)
+{
     return statement->check_access(query_state.get_client_state()).then([this, statement, &query_state, &options]() {
         auto& client_state = query_state.get_client_state();
 
@@ -190,18 +312,18 @@ query_processor::get_stored_prepared_statement(const std::experimental::string_v
 {
     if (for_thrift) {
         auto statement_id = compute_thrift_id(query_string, keyspace);
-        auto it = _thrift_prepared_statements.find(statement_id);
-        if (it == _thrift_prepared_statements.end()) {
+        auto prepared = _thrift_prepared_statements.find(statement_id);
+        if (!prepared) {
             return ::shared_ptr<result_message::prepared>();
         }
-        return ::make_shared<result_message::prepared::thrift>(statement_id, it->second);
+        return ::make_shared<result_message::prepared::thrift>(statement_id, std::move(prepared));
     } else {
         auto statement_id = compute_id(query_string, keyspace);
-        auto it = _prepared_statements.find(statement_id);
-        if (it == _prepared_statements.end()) {
+        auto prepared = _prepared_statements.find(statement_id);
+        if (!prepared) {
             return ::shared_ptr<result_message::prepared>();
         }
-        return ::make_shared<result_message::prepared::cql>(statement_id, it->second);
+        return ::make_shared<result_message::prepared::cql>(statement_id, std::move(prepared));
     }
 }
 
@@ -209,25 +331,21 @@ future<::shared_ptr<transport::messages::result_message::prepared>>
 query_processor::store_prepared_statement(const std::experimental::string_view& query_string, const sstring& keyspace,
         ::shared_ptr<statements::prepared_statement> prepared, bool for_thrift)
 {
-#if 0
-    // Concatenate the current keyspace so we don't mix prepared statements between keyspace (#5352).
-    // (if the keyspace is null, queryString has to have a fully-qualified keyspace so it's fine.
-    long statementSize = measure(prepared.statement);
-    // don't execute the statement if it's bigger than the allowed threshold
-    if (statementSize > MAX_CACHE_PREPARED_MEMORY)
-        throw new InvalidRequestException(String.format("Prepared statement of size %d bytes is larger than allowed maximum of %d bytes.",
-                                                        statementSize,
-                                                        MAX_CACHE_PREPARED_MEMORY));
-#endif
     prepared->raw_cql_statement = query_string.data();
+    // don't execute the statement if it's bigger than the allowed threshold
+    auto statement_size = prepared_statement_weight(*prepared);
+    if (statement_size > _prepared_statements.max_size()) {
+        throw exceptions::invalid_request_exception(sprint("Prepared statement of size %d bytes is larger than allowed maximum of %d bytes.",
+                statement_size, _prepared_statements.max_size()));
+    }
     if (for_thrift) {
         auto statement_id = compute_thrift_id(query_string, keyspace);
-        _thrift_prepared_statements.emplace(statement_id, prepared);
+        _thrift_prepared_statements.insert(statement_id, prepared);
         auto msg = ::make_shared<result_message::prepared::thrift>(statement_id, prepared);
         return make_ready_future<::shared_ptr<result_message::prepared>>(std::move(msg));
     } else {
         auto statement_id = compute_id(query_string, keyspace);
-        _prepared_statements.emplace(statement_id, prepared);
+        _prepared_statements.insert(statement_id, prepared);
         auto msg = ::make_shared<result_message::prepared::cql>(statement_id, prepared);
         return make_ready_future<::shared_ptr<result_message::prepared>>(std::move(msg));
     }
@@ -281,6 +399,33 @@ query_processor::get_statement(const sstring_view& query, const service::client_
     return statement->prepare(_db.local());
 }
 
+// Only statements which don't depend on anything but their text and the
+// schema are cached. Statements changing the schema, user or keyspace of
+// the connection are rare enough not to be worth it.
+static bool is_cacheable(const cql_statement& stmt) {
+    return dynamic_cast<const select_statement*>(&stmt)
+        || dynamic_cast<const modification_statement*>(&stmt)
+        || dynamic_cast<const batch_statement*>(&stmt);
+}
+
+::shared_ptr<prepared_statement>
+query_processor::get_unprepared_statement(const sstring_view& query, const service::client_state& client_state)
+{
+    auto key = hash_target(query, client_state.get_raw_keyspace());
+    auto p = _unprepared_statements.find(key);
+    if (p) {
+        return p;
+    }
+    p = get_statement(query, client_state);
+    if (is_cacheable(*p->statement)) {
+        p->raw_cql_statement = query.to_string();
+        if (prepared_statement_weight(*p) <= _unprepared_statements.max_size()) {
+            _unprepared_statements.insert(key, p);
+        }
+    }
+    return p;
+}
+
 ::shared_ptr<raw::parsed_statement>
 query_processor::parse_statement(const sstring_view& query)
 {
@@ -397,11 +542,19 @@ future<::shared_ptr<untyped_result_set>> query_processor::process(
 
 future<::shared_ptr<transport::messages::result_message>>
 query_processor::process_batch(::shared_ptr<statements::batch_statement> batch, service::query_state& query_state, query_options& options) {
-    return batch->check_access(query_state.get_client_state()).then([this, &query_state, &options, batch] {
-        batch->validate();
-        batch->validate(_proxy, query_state.get_client_state());
-        return batch->execute(_proxy, query_state, options);
-    });
+    auto process = [this, &query_state, &options, batch] {
+        return batch->check_access(query_state.get_client_state()).then([this, &query_state, &options, batch] {
+            batch->validate();
+            batch->validate(_proxy, query_state.get_client_state());
+            return batch->execute(_proxy, query_state, options);
+        });
+    };
+    if (query_state.get_client_state().is_internal()) {
+        return process();
+    }
+    auto& statements = batch->get_statements();
+    auto id = scheduling_id(statements.empty() ? nullptr : statements.front().get(), query_state.get_client_state());
+    return service::get_local_request_scheduler().schedule(id, std::move(process));
 }
 
 query_processor::migration_subscriber::migration_subscriber(query_processor* qp)
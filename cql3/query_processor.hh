@@ -54,6 +54,7 @@
 #include "log.hh"
 #include "core/distributed.hh"
 #include "statements/prepared_statement.hh"
+#include "prepared_statements_cache.hh"
 #include "transport/messages/result_message.hh"
 #include "untyped_result_set.hh"
 
@@ -75,6 +76,9 @@ class query_processor {
         uint64_t prepare_invocations = 0;
     } _stats;
 
+    prepared_statements_cache_stats _prepared_cache_stats;
+    prepared_statements_cache_stats _unprepared_cache_stats;
+
     std::vector<scollectd::registration> _collectd_regs;
 
     class internal_state;
@@ -120,8 +124,10 @@ class query_processor {
     };
 #endif
 
-    std::unordered_map<bytes, ::shared_ptr<statements::prepared_statement>> _prepared_statements;
-    std::unordered_map<int32_t, ::shared_ptr<statements::prepared_statement>> _thrift_prepared_statements;
+    prepared_statements_cache<bytes> _prepared_statements;
+    prepared_statements_cache<int32_t> _thrift_prepared_statements;
+    // Statements of unprepared queries, keyed by keyspace and query text.
+    prepared_statements_cache<sstring> _unprepared_statements;
     std::unordered_map<sstring, ::shared_ptr<statements::prepared_statement>> _internal_statements;
 #if 0
 
@@ -213,20 +219,18 @@ class query_processor {
     }
 #endif
 public:
+    // Returns a null pointer if the statement was never prepared on this
+    // shard or was evicted, in which case the client has to re-prepare it.
     ::shared_ptr<statements::prepared_statement> get_prepared(const bytes& id) {
-        auto it = _prepared_statements.find(id);
-        if (it == _prepared_statements.end()) {
-            return ::shared_ptr<statements::prepared_statement>{};
-        }
-        return it->second;
+        return _prepared_statements.find(id);
     }
 
     ::shared_ptr<statements::prepared_statement> get_prepared_for_thrift(int32_t id) {
-        auto it = _thrift_prepared_statements.find(id);
-        if (it == _thrift_prepared_statements.end()) {
-            return ::shared_ptr<statements::prepared_statement>{};
-        }
-        return it->second;
+        return _thrift_prepared_statements.find(id);
+    }
+
+    size_t prepared_statements_memory_footprint() const {
+        return _prepared_statements.memory_footprint() + _thrift_prepared_statements.memory_footprint();
     }
 #if 0
     public static void validateKey(ByteBuffer key) throws InvalidRequestException
@@ -269,6 +273,11 @@ class query_processor {
 public:
     future<::shared_ptr<transport::messages::result_message>> process_statement(::shared_ptr<cql_statement> statement,
             service::query_state& query_state, const query_options& options);
+private:
+    // process_statement() once the request is scheduled.
+    future<::shared_ptr<transport::messages::result_message>> do_process_statement(::shared_ptr<cql_statement> statement,
+            service::query_state& query_state, const query_options& options);
+public:
 
 #if 0
     public static ResultMessage process(String queryString, ConsistencyLevel cl, QueryState queryState)
@@ -447,20 +456,9 @@ class query_processor {
     void invalidate_prepared_statements(Pred filter) {
         static_assert(std::is_same<bool, std::result_of_t<Pred(::shared_ptr<cql_statement>)>>::value,
                       "bad Pred signature");
-        for (auto it = _prepared_statements.begin(); it != _prepared_statements.end(); ) {
-            if (filter(it->second->statement)) {
-                it = _prepared_statements.erase(it);
-            } else {
-                ++it;
-            }
-        }
-        for (auto it = _thrift_prepared_statements.begin(); it != _thrift_prepared_statements.end(); ) {
-            if (filter(it->second->statement)) {
-                it = _thrift_prepared_statements.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        _prepared_statements.remove_if(filter);
+        _thrift_prepared_statements.remove_if(filter);
+        _unprepared_statements.remove_if(filter);
     }
 
 #if 0
@@ -494,6 +492,10 @@ class query_processor {
 
     ::shared_ptr<statements::prepared_statement> get_statement(const std::experimental::string_view& query,
             const service::client_state& client_state);
+    // Like get_statement(), but reuses the statement of an earlier unprepared
+    // query with the same text and keyspace, if it was cached.
+    ::shared_ptr<statements::prepared_statement> get_unprepared_statement(const std::experimental::string_view& query,
+            const service::client_state& client_state);
     static ::shared_ptr<statements::raw::parsed_statement> parse_statement(const std::experimental::string_view& query);
 
 #if 0
@@ -68,6 +68,15 @@ class single_column_restriction : public abstract_restriction {
     const column_definition& get_column_def() const {
         return _column_def;
     }
+protected:
+    bytes_opt bind_value(const ::shared_ptr<term>& t, const query_options& options) const {
+        auto value = t->bind_and_get(options);
+        if (is_unset_value(value)) {
+            throw exceptions::invalid_request_exception(sprint("Invalid unset value for column %s", _column_def.name_as_text()));
+        }
+        return to_bytes_opt(value);
+    }
+public:
 
 #if 0
     @Override
@@ -126,12 +135,12 @@ class single_column_restriction::EQ final : public single_column_restriction {
 
     virtual std::vector<bytes_opt> values(const query_options& options) const override {
         std::vector<bytes_opt> v;
-        v.push_back(to_bytes_opt(_value->bind_and_get(options)));
+        v.push_back(bind_value(_value, options));
         return v;
     }
 
     virtual bytes_opt value(const query_options& options) const override {
-        return to_bytes_opt(_value->bind_and_get(options));
+        return bind_value(_value, options);
     }
 
     virtual sstring to_string() const override {
@@ -192,7 +201,7 @@ class single_column_restriction::IN_with_values : public single_column_restricti
     virtual std::vector<bytes_opt> values(const query_options& options) const override {
         std::vector<bytes_opt> ret;
         for (auto&& v : _values) {
-            ret.emplace_back(to_bytes_opt(v->bind_and_get(options)));
+            ret.emplace_back(bind_value(v, options));
         }
         return ret;
     }
@@ -254,7 +263,7 @@ class single_column_restriction::slice : public single_column_restriction {
     }
 
     virtual std::vector<bytes_opt> bounds(statements::bound b, const query_options& options) const override {
-        return {to_bytes_opt(_slice.bound(b)->bind_and_get(options))};
+        return {bind_value(_slice.bound(b), options)};
     }
 
     virtual bool is_inclusive(statements::bound b) const override {
@@ -153,11 +153,14 @@ statement_restrictions::statement_restrictions(database& db,
         }
     }
 
-    warn(unimplemented::cause::INDEXES);
-#if 0
-    ColumnFamilyStore cfs = Keyspace.open(cfm.ks_name).getColumnFamilyStore(cfm.cfName);
-    secondary_index_manager secondaryIndexManager = cfs.index_manager;
-#endif
+    // Only an EQ restriction of an indexed regular column can be served by
+    // an index. Restrictions of key columns are never resolved through one.
+    for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+        if (def->is_indexed() && _nonprimary_key_restrictions->get_restriction(*def)->is_EQ()) {
+            _index_column = def;
+            break;
+        }
+    }
     bool has_queriable_clustering_column_index = false; /*_clustering_columns_restrictions->has_supporting_index(secondaryIndexManager);*/
     bool has_queriable_index = false; /*has_queriable_clustering_column_index
             || _partition_key_restrictions->has_supporting_index(secondaryIndexManager)
@@ -212,19 +215,85 @@ statement_restrictions::statement_restrictions(database& db,
         uses_secondary_indexing = true;
 #endif
     }
-    // Even if uses_secondary_indexing is false at this point, we'll still have to use one if
-    // there is restrictions not covered by the PK.
+    // Restrictions not covered by the PK are resolved through an index if
+    // there is one, the others are evaluated by replicas on every row.
     if (!_nonprimary_key_restrictions->empty()) {
-        _uses_secondary_indexing = true;
+        if (_index_column) {
+            _uses_secondary_indexing = true;
+        }
+        _uses_filtering = _nonprimary_key_restrictions->size() > (_index_column ? 1 : 0);
         _index_restrictions.push_back(_nonprimary_key_restrictions);
     }
 
     if (_uses_secondary_indexing) {
-        fail(unimplemented::cause::INDEXES);
-#if 0
+        if (!_index_column) {
+            throw exceptions::invalid_request_exception(
+                "No supported secondary index found for the non primary key columns restrictions");
+        }
+        if (_index_restrictions.size() > 1) {
+            throw exceptions::invalid_request_exception(
+                "Only a single EQ restriction of an indexed column is supported by secondary index queries");
+        }
         validate_secondary_index_selections(selects_only_static_columns);
-#endif
     }
+
+    if (_uses_filtering) {
+        validate_filtered_restrictions();
+    }
+}
+
+void statement_restrictions::validate_filtered_restrictions() const {
+    for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+        if (def == _index_column) {
+            continue;
+        }
+        auto r = _nonprimary_key_restrictions->get_restriction(*def);
+        if (!def->is_regular() || def->type->is_multi_cell() || !(r->is_EQ() || r->is_slice())) {
+            throw exceptions::invalid_request_exception(sprint(
+                "Restriction of column %s is not supported without a secondary index", def->name_as_text()));
+        }
+    }
+}
+
+std::vector<query::column_filter> statement_restrictions::get_column_filters(const query_options& options) const {
+    std::vector<query::column_filter> filters;
+    if (!_uses_filtering) {
+        return filters;
+    }
+    auto add_filter = [&] (const column_definition& def, query::column_filter::op op, bytes_opt value) {
+        if (!value) {
+            throw exceptions::invalid_request_exception(sprint("Unsupported null value for column %s", def.name_as_text()));
+        }
+        filters.push_back(query::column_filter{def.id, op, std::move(*value)});
+    };
+    for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+        if (def == _index_column) {
+            continue;
+        }
+        auto r = _nonprimary_key_restrictions->get_restriction(*def);
+        if (r->is_EQ()) {
+            add_filter(*def, query::column_filter::op::eq, r->value(options));
+            continue;
+        }
+        if (r->has_bound(statements::bound::START)) {
+            auto op = r->is_inclusive(statements::bound::START) ? query::column_filter::op::gte : query::column_filter::op::gt;
+            add_filter(*def, op, r->bounds(statements::bound::START, options)[0]);
+        }
+        if (r->has_bound(statements::bound::END)) {
+            auto op = r->is_inclusive(statements::bound::END) ? query::column_filter::op::lte : query::column_filter::op::lt;
+            add_filter(*def, op, r->bounds(statements::bound::END, options)[0]);
+        }
+    }
+    return filters;
+}
+
+query::index_restriction statement_restrictions::get_index_restriction(const query_options& options) const {
+    auto value = _nonprimary_key_restrictions->get_restriction(*_index_column)->value(options);
+    if (!value) {
+        throw exceptions::invalid_request_exception(sprint("Unsupported null value for indexed column %s",
+                _index_column->name_as_text()));
+    }
+    return query::index_restriction{_index_column->id, std::move(*value)};
 }
 
 void statement_restrictions::add_restriction(::shared_ptr<restriction> restriction) {
@@ -337,7 +406,8 @@ bool statement_restrictions::need_filtering() {
         number_of_restricted_columns += restrictions->size();
     }
 
-    return number_of_restricted_columns > 1
+    return _uses_filtering
+           || number_of_restricted_columns > 1
            || (number_of_restricted_columns == 0 && has_clustering_columns_restriction())
            || (number_of_restricted_columns != 0 && _nonprimary_key_restrictions->has_multiple_contains());
 }
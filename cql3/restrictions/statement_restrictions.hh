@@ -44,6 +44,7 @@
 #include <vector>
 #include "to_string.hh"
 #include "schema.hh"
+#include "query-request.hh"
 #include "cql3/restrictions/restrictions.hh"
 #include "cql3/restrictions/primary_key_restrictions.hh"
 #include "cql3/restrictions/single_column_restrictions.hh"
@@ -93,6 +94,16 @@ class statement_restrictions {
      */
     bool _uses_secondary_indexing = false;
 
+    /**
+     * The indexed column whose EQ restriction selects the rows, if any
+     */
+    const column_definition* _index_column = nullptr;
+
+    /**
+     * <code>true</code> if some restrictions have to be evaluated on every row by the replicas
+     */
+    bool _uses_filtering = false;
+
     /**
      * Specify if the query will return a range of partition keys.
      */
@@ -147,6 +158,22 @@ class statement_restrictions {
         return _uses_secondary_indexing;
     }
 
+    /**
+     * Returns the restriction to look the rows up by in the index of the
+     * restricted column. Only valid if uses_secondary_indexing().
+     */
+    query::index_restriction get_index_restriction(const query_options& options) const;
+
+    bool uses_filtering() const {
+        return _uses_filtering;
+    }
+
+    /**
+     * Returns the filters replicas evaluate the rows with, for the restrictions
+     * of regular columns which are not served by an index.
+     */
+    std::vector<query::column_filter> get_column_filters(const query_options& options) const;
+
 private:
     void process_partition_key_restrictions(bool has_queriable_index);
 
@@ -340,6 +367,8 @@ class statement_restrictions {
 
     void validate_secondary_index_selections(bool selects_only_static_columns);
 
+    void validate_filtered_restrictions() const;
+
     /**
      * Checks if the query has some restrictions on the clustering columns.
      *
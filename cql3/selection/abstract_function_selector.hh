@@ -55,13 +55,24 @@ class abstract_function_selector : public selector {
      * with each function call.
      */
     std::vector<bytes_opt> _args;
+    // Same as _args, for the batched evaluation.
+    std::vector<std::vector<bytes_opt>> _arg_batches;
     std::vector<shared_ptr<selector>> _arg_selectors;
+
+    // Evaluates the arguments for each row of the batch into _arg_batches.
+    void get_arg_batches(cql_serialization_format sf, const input_batch& batch) {
+        for (size_t i = 0; i < _arg_selectors.size(); ++i) {
+            _arg_batches[i].clear();
+            _arg_selectors[i]->get_output_batch(sf, batch, _arg_batches[i]);
+        }
+    }
 public:
     static shared_ptr<factory> new_factory(shared_ptr<functions::function> fun, shared_ptr<selector_factories> factories);
 
     abstract_function_selector(shared_ptr<functions::function> fun, std::vector<shared_ptr<selector>> arg_selectors)
             : _fun(std::move(fun)), _arg_selectors(std::move(arg_selectors)) {
         _args.resize(_arg_selectors.size());
+        _arg_batches.resize(_arg_selectors.size());
     }
 
     virtual data_type get_type() override {
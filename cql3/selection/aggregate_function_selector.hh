@@ -69,6 +69,16 @@ class aggregate_function_selector : public abstract_function_selector_for<functi
         return _aggregate->compute(sf);
     }
 
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+        // Aggregation of aggregation is not supported
+        get_arg_batches(sf, batch);
+        _aggregate->add_input_batch(sf, _arg_batches, batch.size());
+    }
+
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) override {
+        throw std::logic_error("aggregate selectors have no output per row");
+    }
+
     virtual void reset() override {
         _aggregate->reset();
     }
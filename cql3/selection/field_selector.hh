@@ -51,6 +51,20 @@ class field_selector : public selector {
     user_type _type;
     size_t _field;
     shared_ptr<selector> _selected;
+    // Recycled between calls to get_output_batch().
+    std::vector<bytes_opt> _values;
+
+    bytes_opt extract_field(const bytes_opt& value) const {
+        if (!value) {
+            return std::experimental::nullopt;
+        }
+        auto&& buffers = _type->split(*value);
+        bytes_opt ret;
+        if (_field < buffers.size() && buffers[_field]) {
+            ret = to_bytes(*buffers[_field]);
+        }
+        return ret;
+    }
 public:
     static shared_ptr<factory> new_factory(user_type type, size_t field, shared_ptr<selector::factory> factory) {
         struct field_selector_factory : selector::factory {
@@ -92,16 +106,19 @@ class field_selector : public selector {
     }
 
     virtual bytes_opt get_output(cql_serialization_format sf) override {
-        auto&& value = _selected->get_output(sf);
-        if (!value) {
-            return std::experimental::nullopt;
-        }
-        auto&& buffers = _type->split(*value);
-        bytes_opt ret;
-        if (_field < buffers.size() && buffers[_field]) {
-            ret = to_bytes(*buffers[_field]);
+        return extract_field(_selected->get_output(sf));
+    }
+
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+        _selected->add_input_batch(sf, batch);
+    }
+
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) override {
+        _values.clear();
+        _selected->get_output_batch(sf, batch, _values);
+        for (auto&& value : _values) {
+            out.emplace_back(extract_field(value));
         }
-        return ret;
     }
 
     virtual data_type get_type() override {
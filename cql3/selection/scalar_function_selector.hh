@@ -78,6 +78,17 @@ class scalar_function_selector : public abstract_function_selector_for<functions
         return fun()->execute(sf, _args);
     }
 
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+        for (auto&& s : _arg_selectors) {
+            s->add_input_batch(sf, batch);
+        }
+    }
+
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) override {
+        get_arg_batches(sf, batch);
+        fun()->execute_batch(sf, _arg_batches, batch.size(), out);
+    }
+
     scalar_function_selector(shared_ptr<functions::function> fun, std::vector<shared_ptr<selector>> arg_selectors)
             : abstract_function_selector_for<functions::scalar_function>(
                 dynamic_pointer_cast<functions::scalar_function>(std::move(fun)), std::move(arg_selectors)) {
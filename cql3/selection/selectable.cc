@@ -103,6 +103,11 @@ selectable::with_function::raw::processes_selection() const {
     return true;
 }
 
+bool
+selectable::with_function::raw::is_count_rows() const {
+    return _args.empty() && _function_name == functions::function_name::native_function("countRows");
+}
+
 shared_ptr<selector::factory>
 selectable::with_field_selection::new_selector_factory(database& db, schema_ptr s, std::vector<const column_definition*>& defs) {
     auto&& factory = _selected->new_selector_factory(db, s, defs);
@@ -107,6 +107,8 @@ class selectable::with_function : public selectable {
         }
         virtual shared_ptr<selectable> prepare(schema_ptr s) override;
         virtual bool processes_selection() const override;
+        // Whether this is COUNT(*) or COUNT(1).
+        bool is_count_rows() const;
     };
 };
 
@@ -165,6 +165,8 @@ class selection_with_processing : public selection {
     private:
         ::shared_ptr<selector_factories> _factories;
         std::vector<::shared_ptr<selector>> _selectors;
+        // Output of each selector for a batch, recycled between batches.
+        std::vector<std::vector<bytes_opt>> _outputs;
     public:
         selectors_with_processing(::shared_ptr<selector_factories> factories)
             : _factories(std::move(factories))
@@ -195,6 +197,35 @@ class selection_with_processing : public selection {
                 s->add_input(sf, rs);
             }
         }
+
+        virtual bool processes_batches() const override {
+            return true;
+        }
+
+        virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+            for (auto&& s : _selectors) {
+                s->add_input_batch(sf, batch);
+            }
+        }
+
+        virtual std::vector<std::vector<bytes_opt>> get_output_rows(cql_serialization_format sf, const input_batch& batch) override {
+            _outputs.resize(_selectors.size());
+            for (size_t i = 0; i < _selectors.size(); ++i) {
+                _outputs[i].clear();
+                _selectors[i]->get_output_batch(sf, batch, _outputs[i]);
+            }
+            std::vector<std::vector<bytes_opt>> rows;
+            rows.reserve(batch.size());
+            for (size_t r = 0; r < batch.size(); ++r) {
+                std::vector<bytes_opt> row;
+                row.reserve(_outputs.size());
+                for (auto&& output : _outputs) {
+                    row.emplace_back(std::move(output[r]));
+                }
+                rows.emplace_back(std::move(row));
+            }
+            return rows;
+        }
     };
 
     std::unique_ptr<selectors> new_selectors() const override  {
@@ -233,7 +264,12 @@ ::shared_ptr<selection> selection::from_selectors(database& db, schema_ptr schem
 
     auto metadata = collect_metadata(schema, raw_selectors, *factories);
     if (processes_selection(raw_selectors)) {
-        return ::make_shared<selection_with_processing>(schema, std::move(defs), std::move(metadata), std::move(factories));
+        auto s = ::make_shared<selection_with_processing>(schema, std::move(defs), std::move(metadata), std::move(factories));
+        if (raw_selectors.size() == 1) {
+            auto fn = dynamic_pointer_cast<selectable::with_function::raw>(raw_selectors[0]->selectable_);
+            s->_is_count_rows = fn && fn->is_count_rows();
+        }
+        return s;
     } else {
         return ::make_shared<simple_selection>(schema, std::move(defs), std::move(metadata), false);
     }
@@ -265,6 +301,9 @@ result_set_builder::result_set_builder(const selection& s, db_clock::time_point
     if (s._collect_TTLs) {
         _ttls.resize(s._columns.size(), 0);
     }
+    if (_selectors->processes_batches()) {
+        _batch.emplace(s._columns.size(), s._collect_timestamps, s._collect_TTLs);
+    }
 }
 
 void result_set_builder::add_empty() {
@@ -301,13 +340,38 @@ void result_set_builder::add_collection(const column_definition& def, bytes_view
     // timestamps, ttls meaningless for collections
 }
 
+void result_set_builder::process_current_row() {
+    if (_batch) {
+        _batch->add_row(*current, _timestamps, _ttls);
+        if (_batch->size() >= batch_size) {
+            process_batch();
+        }
+        return;
+    }
+    _selectors->add_input_row(_cql_serialization_format, *this);
+    if (!_selectors->is_aggregate()) {
+        _result_set->add_row(_selectors->get_output_row(_cql_serialization_format));
+        _selectors->reset();
+    }
+}
+
+void result_set_builder::process_batch() {
+    if (_batch->empty()) {
+        return;
+    }
+    if (_selectors->is_aggregate()) {
+        _selectors->add_input_batch(_cql_serialization_format, *_batch);
+    } else {
+        for (auto&& row : _selectors->get_output_rows(_cql_serialization_format, *_batch)) {
+            _result_set->add_row(std::move(row));
+        }
+    }
+    _batch->clear();
+}
+
 void result_set_builder::new_row() {
     if (current) {
-        _selectors->add_input_row(_cql_serialization_format, *this);
-        if (!_selectors->is_aggregate()) {
-            _result_set->add_row(_selectors->get_output_row(_cql_serialization_format));
-            _selectors->reset();
-        }
+        process_current_row();
         current->clear();
     } else {
         // FIXME: we use optional<> here because we don't have an end_row() signal
@@ -319,9 +383,18 @@ void result_set_builder::new_row() {
 
 std::unique_ptr<result_set> result_set_builder::build() {
     if (current) {
-        _selectors->add_input_row(_cql_serialization_format, *this);
-        _result_set->add_row(_selectors->get_output_row(_cql_serialization_format));
-        _selectors->reset();
+        if (_batch) {
+            _batch->add_row(*current, _timestamps, _ttls);
+            process_batch();
+            if (_selectors->is_aggregate()) {
+                _result_set->add_row(_selectors->get_output_row(_cql_serialization_format));
+                _selectors->reset();
+            }
+        } else {
+            _selectors->add_input_row(_cql_serialization_format, *this);
+            _result_set->add_row(_selectors->get_output_row(_cql_serialization_format));
+            _selectors->reset();
+        }
         current = std::experimental::nullopt;
     }
     if (_result_set->empty() && _selectors->is_aggregate()) {
@@ -74,6 +74,28 @@ class selectors {
     virtual std::vector<bytes_opt> get_output_row(cql_serialization_format sf) = 0;
 
     virtual void reset() = 0;
+
+    /**
+     * Checks if rows should be passed in batches, through <code>add_input_batch</code> for aggregates
+     * and <code>get_output_rows</code> otherwise, rather than one at a time.
+     */
+    virtual bool processes_batches() const {
+        return false;
+    }
+
+    /**
+     * Adds all rows of the batch to the aggregates.
+     */
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) {
+        throw std::logic_error("selectors don't process batches");
+    }
+
+    /**
+     * Returns the output row for each row of the batch.
+     */
+    virtual std::vector<std::vector<bytes_opt>> get_output_rows(cql_serialization_format sf, const input_batch& batch) {
+        throw std::logic_error("selectors don't process batches");
+    }
 };
 
 class selection {
@@ -84,6 +106,7 @@ class selection {
     const bool _collect_timestamps;
     const bool _collect_TTLs;
     const bool _contains_static_columns;
+    bool _is_count_rows = false;
 protected:
     selection(schema_ptr schema,
         std::vector<const column_definition*> columns,
@@ -98,6 +121,11 @@ class selection {
         return false;
     }
 
+    // Whether the selection is just COUNT(*), which replicas can compute.
+    bool is_count_rows() const {
+        return _is_count_rows;
+    }
+
     /**
      * Checks if this selection contains static columns.
      * @return <code>true</code> if this selection contains static columns, <code>false</code> otherwise;
@@ -228,8 +256,12 @@ class selection {
 
 class result_set_builder {
 private:
+    // Number of rows handed over at once to selectors which process batches.
+    static constexpr size_t batch_size = 256;
+
     std::unique_ptr<result_set> _result_set;
     std::unique_ptr<selectors> _selectors;
+    std::experimental::optional<input_batch> _batch;
 public:
     std::experimental::optional<std::vector<bytes_opt>> current;
 private:
@@ -273,6 +305,8 @@ class result_set_builder {
     };
 private:
     bytes_opt get_value(data_type t, query::result_atomic_cell_view c);
+    void process_current_row();
+    void process_batch();
 };
 
 }
@@ -26,6 +26,41 @@ namespace cql3 {
 
 namespace selection {
 
+input_batch::input_batch(size_t column_count, bool collect_timestamps, bool collect_TTLs)
+    : _columns(column_count)
+    , _timestamps(collect_timestamps ? column_count : 0)
+    , _ttls(collect_TTLs ? column_count : 0)
+{ }
+
+void input_batch::add_row(std::vector<bytes_opt>& values, const std::vector<api::timestamp_type>& timestamps,
+        const std::vector<int32_t>& ttls) {
+    assert(values.size() == _columns.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        _columns[i].emplace_back(std::move(values[i]));
+    }
+    for (size_t i = 0; i < _timestamps.size(); ++i) {
+        _timestamps[i].push_back(timestamps[i]);
+    }
+    for (size_t i = 0; i < _ttls.size(); ++i) {
+        _ttls[i].push_back(ttls[i]);
+    }
+    ++_size;
+}
+
+void input_batch::clear() {
+    // Keeps the capacity for the next batch.
+    for (auto&& c : _columns) {
+        c.clear();
+    }
+    for (auto&& c : _timestamps) {
+        c.clear();
+    }
+    for (auto&& c : _ttls) {
+        c.clear();
+    }
+    _size = 0;
+}
+
 ::shared_ptr<column_specification>
 selector::factory::get_column_specification(schema_ptr schema) {
     return ::make_shared<column_specification>(schema->ks_name(),
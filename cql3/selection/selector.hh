@@ -52,6 +52,46 @@ namespace selection {
 
 class result_set_builder;
 
+/**
+ * Rows buffered by the <code>result_set_builder</code>, laid out by column, so that selectors can
+ * be evaluated over many rows per call instead of being called once for each row.
+ */
+class input_batch {
+    std::vector<std::vector<bytes_opt>> _columns;
+    std::vector<std::vector<api::timestamp_type>> _timestamps;
+    std::vector<std::vector<int32_t>> _ttls;
+    size_t _size = 0;
+public:
+    input_batch(size_t column_count, bool collect_timestamps, bool collect_TTLs);
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return !_size;
+    }
+
+    const std::vector<bytes_opt>& column(size_t idx) const {
+        return _columns[idx];
+    }
+
+    const std::vector<api::timestamp_type>& timestamps_of(size_t idx) const {
+        return _timestamps[idx];
+    }
+
+    const std::vector<int32_t>& ttls_of(size_t idx) const {
+        return _ttls[idx];
+    }
+
+    /**
+     * Appends a row, moving its values out of <code>values</code>.
+     */
+    void add_row(std::vector<bytes_opt>& values, const std::vector<api::timestamp_type>& timestamps, const std::vector<int32_t>& ttls);
+
+    void clear();
+};
+
 /**
  * A <code>selector</code> is used to convert the data returned by the storage engine into the data requested by the
  * user. They correspond to the &lt;selector&gt; elements from the select clause.
@@ -82,6 +122,24 @@ class selector : public assignment_testable {
      */
     virtual bytes_opt get_output(cql_serialization_format sf) = 0;
 
+    /**
+     * Adds all rows of the specified batch, as if <code>add_input</code> was called for each of them.
+     *
+     * @param sf serialization format
+     * @param batch the rows to add, never empty
+     */
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) = 0;
+
+    /**
+     * Appends to <code>out</code> the output of a non aggregate selector for each row of the batch.
+     * Doesn't depend on, nor change, the state built by <code>add_input</code>.
+     *
+     * @param sf serialization format
+     * @param batch the input rows
+     * @param out where the outputs are appended
+     */
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) = 0;
+
     /**
      * Returns the <code>selector</code> output type.
      *
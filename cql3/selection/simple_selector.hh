@@ -97,6 +97,16 @@ class simple_selector : public selector {
         return std::move(_current);
     }
 
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+        _current = batch.column(_idx).back();
+    }
+
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) override {
+        // The same column may be selected more than once, so don't steal the values.
+        auto&& values = batch.column(_idx);
+        out.insert(out.end(), values.begin(), values.end());
+    }
+
     virtual void reset() override {
         _current = {};
     }
@@ -86,24 +86,50 @@ class writetime_or_ttl_selector : public selector {
         return make_shared<wtots_factory>(std::move(column_name), idx, is_writetime);
     }
 
+    static bytes_opt writetime_value(api::timestamp_type ts) {
+        if (ts == api::missing_timestamp) {
+            return std::experimental::nullopt;
+        }
+        bytes b(bytes::initialized_later(), 8);
+        auto i = b.begin();
+        serialize_int64(i, ts);
+        return b;
+    }
+
+    static bytes_opt ttl_value(int32_t ttl) {
+        if (ttl <= 0) {
+            return std::experimental::nullopt;
+        }
+        bytes b(bytes::initialized_later(), 4);
+        auto i = b.begin();
+        serialize_int32(i, ttl);
+        return b;
+    }
+
     virtual void add_input(cql_serialization_format sf, result_set_builder& rs) override {
         if (_is_writetime) {
-            int64_t ts = rs.timestamp_of(_idx);
-            if (ts != api::missing_timestamp) {
-                _current = bytes(bytes::initialized_later(), 8);
-                auto i = _current->begin();
-                serialize_int64(i, ts);
-            } else {
-                _current = std::experimental::nullopt;
+            _current = writetime_value(rs.timestamp_of(_idx));
+        } else {
+            _current = ttl_value(rs.ttl_of(_idx));
+        }
+    }
+
+    virtual void add_input_batch(cql_serialization_format sf, const input_batch& batch) override {
+        if (_is_writetime) {
+            _current = writetime_value(batch.timestamps_of(_idx).back());
+        } else {
+            _current = ttl_value(batch.ttls_of(_idx).back());
+        }
+    }
+
+    virtual void get_output_batch(cql_serialization_format sf, const input_batch& batch, std::vector<bytes_opt>& out) override {
+        if (_is_writetime) {
+            for (auto ts : batch.timestamps_of(_idx)) {
+                out.emplace_back(writetime_value(ts));
             }
         } else {
-            int ttl = rs.ttl_of(_idx);
-            if (ttl > 0) {
-                _current = bytes(bytes::initialized_later(), 4);
-                auto i = _current->begin();
-                serialize_int32(i, ttl);
-            } else {
-                _current = std::experimental::nullopt;
+            for (auto ttl : batch.ttls_of(_idx)) {
+                out.emplace_back(ttl_value(ttl));
             }
         }
     }
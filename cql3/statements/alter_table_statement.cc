@@ -81,6 +81,9 @@ future<bool> alter_table_statement::announce_migration(distributed<service::stor
 {
     auto& db = proxy.local().get_db().local();
     auto schema = validation::validate_column_family(db, keyspace(), column_family());
+    if (schema->is_view()) {
+        throw exceptions::invalid_request_exception("Cannot use ALTER TABLE on a materialized view");
+    }
     auto cfm = schema_builder(schema);
 
     shared_ptr<cql3_type> validator;
@@ -210,6 +213,12 @@ future<bool> alter_table_statement::announce_migration(distributed<service::stor
             throw exceptions::invalid_request_exception(sprint("Column %s was not found in table %s", column_name, column_family()));
         }
 
+        for (auto&& view : db.find_keyspace(keyspace()).metadata()->views_of(schema->id())) {
+            if (view->get_column_definition(column_name->name())) {
+                throw exceptions::invalid_request_exception(sprint("Cannot drop column %s, materialized view %s depends on it", column_name, view->cf_name()));
+            }
+        }
+
         if (def->is_primary_key()) {
             throw exceptions::invalid_request_exception(sprint("Cannot drop PRIMARY KEY part %s", column_name));
         } else {
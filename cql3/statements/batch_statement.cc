@@ -40,6 +40,7 @@
 #include "batch_statement.hh"
 #include "raw/batch_statement.hh"
 #include "db/config.hh"
+#include <map>
 
 namespace cql3 {
 
@@ -57,7 +58,7 @@ bool batch_statement::depends_on_column_family(const sstring& cf_name) const
     return false;
 }
 
-void batch_statement::verify_batch_size(const std::vector<mutation>& mutations) {
+std::experimental::optional<sstring> batch_statement::verify_batch_size(const std::vector<mutation>& mutations) {
     size_t warn_threshold = service::get_local_storage_proxy().get_db().local().get_config().batch_size_warn_threshold_in_kb();
 
     class my_partition_visitor : public mutation_partition_visitor {
@@ -94,11 +95,39 @@ void batch_statement::verify_batch_size(const std::vector<mutation>& mutations)
         for (auto&& m : mutations) {
             ks_cf_pairs.insert(m.schema()->ks_name() + "." + m.schema()->cf_name());
         }
-        _logger.warn(
-                        "Batch of prepared statements for {} is of size {}, exceeding specified threshold of {} by {}.{}",
-                        join(", ", ks_cf_pairs), size, warn_threshold,
-                        size - warn_threshold, "");
+        auto msg = sprint("Batch of prepared statements for %s is of size %d, exceeding specified threshold of %d by %d.",
+                join(", ", ks_cf_pairs), size, warn_threshold, size - warn_threshold);
+        _logger.warn("{}", msg);
+        return msg;
     }
+    return {};
+}
+
+void batch_statement::merge_mutations(std::vector<mutation>& mutations) {
+    if (mutations.size() < 2) {
+        return;
+    }
+    using partitions_type = std::map<dht::decorated_key, size_t, dht::decorated_key::less_comparator>;
+    std::unordered_map<utils::UUID, partitions_type> partitions;
+    std::vector<mutation> merged;
+    merged.reserve(mutations.size());
+    for (auto&& m : mutations) {
+        auto s = m.schema();
+        auto cf = partitions.find(s->id());
+        if (cf == partitions.end()) {
+            cf = partitions.emplace(s->id(), partitions_type(dht::decorated_key::less_comparator(s))).first;
+        }
+        auto i = cf->second.find(m.decorated_key());
+        // Statements prepared before and after a schema change may produce
+        // mutations of different versions; don't upgrade one into the other.
+        if (i != cf->second.end() && merged[i->second].schema()->version() == s->version()) {
+            merged[i->second].apply(std::move(m));
+            continue;
+        }
+        cf->second[m.decorated_key()] = merged.size();
+        merged.emplace_back(std::move(m));
+    }
+    mutations = std::move(merged);
 }
 
 namespace raw {
@@ -191,7 +191,12 @@ class batch_statement : public cql_statement_no_metadata {
      * Checks batch size to ensure threshold is met. If not, a warning is logged.
      * @param cfs ColumnFamilies that will store the batch's mutations.
      */
-    static void verify_batch_size(const std::vector<mutation>& mutations);
+    // Returns a warning for the client if the batch is larger than batch_size_warn_threshold_in_kb.
+    static std::experimental::optional<sstring> verify_batch_size(const std::vector<mutation>& mutations);
+
+    // Merges mutations of the same partition, so that each partition is
+    // written to the replicas and the commitlog once.
+    static void merge_mutations(std::vector<mutation>& mutations);
 
     virtual future<shared_ptr<transport::messages::result_message>> execute(
             distributed<service::storage_proxy>& storage, service::query_state& state, const query_options& options) override {
@@ -214,10 +219,15 @@ class batch_statement : public cql_statement_no_metadata {
         }
 
         return get_mutations(storage, options, local, now, query_state.get_trace_state()).then([this, &storage, &options, tr_state = query_state.get_trace_state()] (std::vector<mutation> ms) mutable {
-            return execute_without_conditions(storage, std::move(ms), options.get_consistency(), std::move(tr_state));
-        }).then([] {
-            return make_ready_future<shared_ptr<transport::messages::result_message>>(
-                    make_shared<transport::messages::result_message::void_message>());
+            auto warning = verify_batch_size(ms);
+            merge_mutations(ms);
+            return execute_without_conditions(storage, std::move(ms), options.get_consistency(), std::move(tr_state)).then([warning = std::move(warning)] {
+                auto msg = make_shared<transport::messages::result_message::void_message>();
+                if (warning) {
+                    msg->add_warning(*warning);
+                }
+                return make_ready_future<shared_ptr<transport::messages::result_message>>(std::move(msg));
+            });
         });
     }
 
@@ -237,8 +247,6 @@ class batch_statement : public cql_statement_no_metadata {
             }
         }));
 #endif
-        verify_batch_size(mutations);
-
         bool mutate_atomic = _type == type::LOGGED && mutations.size() > 1;
         return storage.local().mutate_with_triggers(std::move(mutations), cl, mutate_atomic, std::move(tr_state));
     }
@@ -109,6 +109,11 @@ void cf_prop_defs::validate() {
         cp.validate();
     }
 
+    auto caching = get_map(KW_CACHING);
+    if (caching) {
+        caching_options::from_map(*caching);
+    }
+
     validate_minimum_int(KW_DEFAULT_TIME_TO_LIVE, 0, DEFAULT_DEFAULT_TIME_TO_LIVE);
 
     auto min_index_interval = get_int(KW_MIN_INDEX_INTERVAL, DEFAULT_MIN_INDEX_INTERVAL);
@@ -209,11 +214,10 @@ void cf_prop_defs::apply_to_builder(schema_builder& builder) {
     if (!get_compression_options().empty()) {
         builder.set_compressor_params(compression_parameters(get_compression_options()));
     }
-#if 0
-    CachingOptions cachingOptions = getCachingOptions();
-    if (cachingOptions != null)
-        cfm.caching(cachingOptions);
-#endif
+    auto caching = get_map(KW_CACHING);
+    if (caching) {
+        builder.set_caching_options(caching_options::from_map(*caching));
+    }
 }
 
 void cf_prop_defs::validate_minimum_int(const sstring& field, int32_t minimum_value, int32_t default_value) const
@@ -47,6 +47,8 @@
 #include "schema.hh"
 #include "schema_builder.hh"
 
+#include <regex>
+
 cql3::statements::create_index_statement::create_index_statement(
         ::shared_ptr<cf_name> name, ::shared_ptr<index_name> index_name,
         ::shared_ptr<index_target::raw> raw_target,
@@ -165,11 +167,24 @@ cql3::statements::create_index_statement::validate(distributed<service::storage_
                         "Cannot create secondary index on partition key column %s",
                         *target->column));
     }
+
+    // Index tables are keyed by the indexed value, so only columns which
+    // hold a single value per row can be indexed for now.
+    if (!cd->is_regular()) {
+        throw exceptions::invalid_request_exception(
+                sprint("Secondary indexes are not supported on PRIMARY KEY column %s", *target->column));
+    }
+    if (cd->type->is_multi_cell()) {
+        throw exceptions::invalid_request_exception(
+                sprint("Secondary indexes are not supported on non-frozen collection column %s", *target->column));
+    }
+    if (!_index_name.empty() && !std::regex_match(std::string(_index_name), std::regex("\\w+"))) {
+        throw exceptions::invalid_request_exception(sprint("Illegal index name %s", _index_name));
+    }
 }
 
 future<bool>
 cql3::statements::create_index_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) {
-    throw std::runtime_error("Indexes are not supported yet");
     auto schema = proxy.local().get_db().local().find_schema(keyspace(), column_family());
     auto target = _raw_target->prepare(schema);
 
@@ -197,7 +212,10 @@ cql3::statements::create_index_statement::announce_migration(distributed<service
         idx.index_options = index_options_map();
     }
 
-    idx.index_name = _index_name;
+    if (!_index_name.empty()) {
+        idx.index_name = _index_name;
+    }
+    cfm.with_index(cd->name(), idx);
     cfm.add_default_index_names(proxy.local().get_db().local());
 
     return service::get_local_migration_manager().announce_column_family_update(
@@ -45,11 +45,14 @@
 
 #include <boost/range/adaptor/map.hpp>
 #include <boost/range/algorithm/adjacent_find.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 
 #include "cql3/statements/create_table_statement.hh"
 #include "cql3/statements/prepared_statement.hh"
 
 #include "schema_builder.hh"
+#include "service/storage_service.hh"
 
 namespace cql3 {
 
@@ -196,10 +199,6 @@ ::shared_ptr<prepared_statement> create_table_statement::raw_statement::prepare(
     for (auto&& entry : _definitions) {
         ::shared_ptr<column_identifier> id = entry.first;
         ::shared_ptr<cql3_type> pt = entry.second->prepare(db, keyspace());
-        // FIXME: remove this check once we support counters
-        if (pt->is_counter()) {
-            fail(unimplemented::cause::COUNTERS);
-        }
         if (pt->is_collection() && pt->get_type()->is_multi_cell()) {
             if (!defined_multi_cell_collections) {
                 defined_multi_cell_collections = std::map<bytes, data_type>{};
@@ -334,6 +333,19 @@ ::shared_ptr<prepared_statement> create_table_statement::raw_statement::prepare(
 #endif
     }
 
+    auto is_counter = [] (const data_type& t) { return t->is_counter(); };
+    if (boost::algorithm::any_of(stmt->_columns | boost::adaptors::map_values, is_counter)) {
+        if (!boost::algorithm::all_of(stmt->_columns | boost::adaptors::map_values, is_counter)) {
+            throw exceptions::invalid_request_exception("Cannot mix counter and non counter columns in the same table");
+        }
+        if (!service::get_local_storage_service().cluster_supports_counters()) {
+            throw exceptions::invalid_request_exception("Counters are not supported until all nodes are upgraded");
+        }
+        if (properties->get_default_time_to_live() > 0) {
+            throw exceptions::invalid_request_exception("Cannot set default_time_to_live on a table with counters");
+        }
+    }
+
     // If we give a clustering order, we must explicitly do so for all aliases and in the order of the PK
     if (!_defined_ordering.empty()) {
         if (_defined_ordering.size() > _column_aliases.size()) {
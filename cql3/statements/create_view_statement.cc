@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cql3/statements/create_view_statement.hh"
+#include "cql3/statements/prepared_statement.hh"
+#include "validation.hh"
+#include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
+#include "service/storage_service.hh"
+#include "schema_builder.hh"
+
+#include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/find_if.hpp>
+#include <boost/range/algorithm/for_each.hpp>
+
+namespace cql3 {
+
+namespace statements {
+
+create_view_statement::create_view_statement(::shared_ptr<cf_name> view_name, ::shared_ptr<cf_name> base_name,
+        columns_type selected, columns_type not_null,
+        columns_type partition_keys, columns_type clustering_keys,
+        ::shared_ptr<cf_prop_defs> properties,
+        ordering_type ordering,
+        bool if_not_exists)
+    : schema_altering_statement{std::move(view_name)}
+    , _base_name{std::move(base_name)}
+    , _selected{std::move(selected)}
+    , _not_null{std::move(not_null)}
+    , _partition_keys{std::move(partition_keys)}
+    , _clustering_keys{std::move(clustering_keys)}
+    , _properties{std::move(properties)}
+    , _ordering{std::move(ordering)}
+    , _if_not_exists{if_not_exists}
+{
+}
+
+future<> create_view_statement::check_access(const service::client_state& state) {
+    return state.has_column_family_access(keyspace(), _base_name->get_column_family(), auth::permission::ALTER);
+}
+
+void create_view_statement::validate(distributed<service::storage_proxy>& proxy, const service::client_state& state) {
+    if (!service::get_local_storage_service().cluster_supports_materialized_views()) {
+        throw exceptions::invalid_request_exception("Materialized views are not supported until all nodes are upgraded");
+    }
+    if (_base_name->has_keyspace() && _base_name->get_keyspace() != keyspace()) {
+        throw exceptions::invalid_request_exception("Cannot create a materialized view on a table in a different keyspace");
+    }
+    auto& db = proxy.local().get_db().local();
+    if (_if_not_exists && db.has_schema(keyspace(), column_family())) {
+        return;
+    }
+    get_view_schema(db);
+}
+
+// Builds the schema of the view, checking that it can be maintained: its
+// primary key must hold all columns of the primary key of the base, so that
+// every base row maps to at most one view row, and at most one other column,
+// which can't be null.
+schema_ptr create_view_statement::get_view_schema(database& db) {
+    auto base = validation::validate_column_family(db, keyspace(), _base_name->get_column_family());
+    if (base->is_view()) {
+        throw exceptions::invalid_request_exception("Materialized views can't be created on other materialized views");
+    }
+    if (base->is_counter()) {
+        throw exceptions::invalid_request_exception("Materialized views are not supported on counter tables");
+    }
+    if (base->is_dense() || !base->thrift().has_compound_comparator()) {
+        throw exceptions::invalid_request_exception("Materialized views are not supported on COMPACT STORAGE tables");
+    }
+
+    auto column_of = [&base] (const ::shared_ptr<column_identifier::raw>& raw) -> const column_definition& {
+        auto id = raw->prepare_column_identifier(base);
+        auto def = base->get_column_definition(id->name());
+        if (!def) {
+            throw exceptions::invalid_request_exception(sprint("Unknown column %s in materialized view definition", *id));
+        }
+        return *def;
+    };
+
+    std::vector<const column_definition*> included;
+    for (auto&& raw : _selected) {
+        auto& def = column_of(raw);
+        if (def.is_static()) {
+            throw exceptions::invalid_request_exception(sprint("Static column %s can't be included in a materialized view", def.name_as_text()));
+        }
+        included.push_back(&def);
+    }
+    if (_selected.empty()) {
+        for (auto&& def : base->regular_columns()) {
+            included.push_back(&def);
+        }
+    }
+
+    auto is_not_null = [&] (const column_definition& def) {
+        return boost::find_if(_not_null, [&] (auto&& raw) { return &column_of(raw) == &def; }) != _not_null.end();
+    };
+    std::vector<const column_definition*> pk_columns, ck_columns;
+    const column_definition* regular_key = nullptr;
+    auto add_key = [&] (std::vector<const column_definition*>& to, const ::shared_ptr<column_identifier::raw>& raw) {
+        auto& def = column_of(raw);
+        if (boost::find(pk_columns, &def) != pk_columns.end() || boost::find(ck_columns, &def) != ck_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("Column %s appears more than once in the PRIMARY KEY", def.name_as_text()));
+        }
+        if (def.is_static()) {
+            throw exceptions::invalid_request_exception(sprint("Static column %s can't be part of the PRIMARY KEY of a materialized view", def.name_as_text()));
+        }
+        if (def.is_regular()) {
+            if (regular_key) {
+                throw exceptions::invalid_request_exception(sprint("The PRIMARY KEY of a materialized view can hold at most one column which is not part of the base PRIMARY KEY (%s and %s)",
+                        regular_key->name_as_text(), def.name_as_text()));
+            }
+            if (def.type->is_multi_cell()) {
+                throw exceptions::invalid_request_exception(sprint("Non-frozen collection %s can't be part of the PRIMARY KEY of a materialized view", def.name_as_text()));
+            }
+            regular_key = &def;
+        }
+        if (!is_not_null(def)) {
+            throw exceptions::invalid_request_exception(sprint("PRIMARY KEY column %s must be restricted with IS NOT NULL", def.name_as_text()));
+        }
+        to.push_back(&def);
+    };
+    for (auto&& raw : _partition_keys) {
+        add_key(pk_columns, raw);
+    }
+    for (auto&& raw : _clustering_keys) {
+        add_key(ck_columns, raw);
+    }
+    auto check_base_key = [&] (const column_definition& def) {
+        if (boost::find(pk_columns, &def) == pk_columns.end() && boost::find(ck_columns, &def) == ck_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("Base PRIMARY KEY column %s must be part of the PRIMARY KEY of the materialized view", def.name_as_text()));
+        }
+    };
+    boost::for_each(base->partition_key_columns(), check_base_key);
+    boost::for_each(base->clustering_key_columns(), check_base_key);
+    for (auto&& raw : _not_null) {
+        auto& def = column_of(raw);
+        if (boost::find(pk_columns, &def) == pk_columns.end() && boost::find(ck_columns, &def) == ck_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("IS NOT NULL can only restrict PRIMARY KEY columns of the view, not %s", def.name_as_text()));
+        }
+    }
+
+    schema_builder builder{keyspace(), column_family()};
+    auto underlying = [] (const column_definition& def) {
+        return def.type->is_reversed() ? def.type->underlying_type() : def.type;
+    };
+    for (auto def : pk_columns) {
+        builder.with_column(def->name(), underlying(*def), column_kind::partition_key);
+    }
+    for (auto def : ck_columns) {
+        auto ordering = boost::find_if(_ordering, [&] (auto&& o) { return &column_of(o.first) == def; });
+        bool reversed = ordering != _ordering.end() && ordering->second;
+        auto type = underlying(*def);
+        builder.with_column(def->name(), reversed ? reversed_type_impl::get_instance(type) : type, column_kind::clustering_key);
+    }
+    for (auto&& o : _ordering) {
+        auto& def = column_of(o.first);
+        if (boost::find(ck_columns, &def) == ck_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("CLUSTERING ORDER BY can only name clustering columns of the view, not %s", def.name_as_text()));
+        }
+    }
+    for (auto def : included) {
+        if (def->is_regular() && def != regular_key) {
+            builder.with_column(def->name(), def->type);
+        }
+    }
+    _properties->validate();
+    _properties->apply_to_builder(builder);
+    builder.with_view_info(base->id(), base->cf_name(), _selected.empty());
+    return builder.build();
+}
+
+future<bool> create_view_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) {
+    return make_ready_future<>().then([this, &proxy, is_local_only] {
+        return service::get_local_migration_manager().announce_new_column_family(get_view_schema(proxy.local().get_db().local()), is_local_only);
+    }).then_wrapped([this] (auto&& f) {
+        try {
+            f.get();
+            return true;
+        } catch (const exceptions::already_exists_exception& e) {
+            if (_if_not_exists) {
+                return false;
+            }
+            throw e;
+        }
+    });
+}
+
+shared_ptr<transport::event::schema_change> create_view_statement::change_event() {
+    return make_shared<transport::event::schema_change>(transport::event::schema_change::change_type::CREATED,
+            transport::event::schema_change::target_type::TABLE, keyspace(), column_family());
+}
+
+shared_ptr<cql3::statements::prepared_statement>
+create_view_statement::prepare(database& db) {
+    return make_shared<prepared_statement>(make_shared<create_view_statement>(*this));
+}
+
+}
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cql3/statements/schema_altering_statement.hh"
+#include "cql3/statements/cf_prop_defs.hh"
+#include "cql3/column_identifier.hh"
+#include "cql3/cf_name.hh"
+
+#include "core/shared_ptr.hh"
+
+#include <utility>
+#include <vector>
+
+namespace cql3 {
+
+namespace statements {
+
+/** A <code>CREATE MATERIALIZED VIEW</code> parsed from a CQL query statement. */
+class create_view_statement : public schema_altering_statement {
+public:
+    using columns_type = std::vector<::shared_ptr<column_identifier::raw>>;
+    // Clustering columns of the view, with whether they are in descending order.
+    using ordering_type = std::vector<std::pair<::shared_ptr<column_identifier::raw>, bool>>;
+private:
+    const ::shared_ptr<cf_name> _base_name;
+    // Empty if all columns are selected.
+    const columns_type _selected;
+    const columns_type _not_null;
+    const columns_type _partition_keys;
+    const columns_type _clustering_keys;
+    const ::shared_ptr<cf_prop_defs> _properties;
+    const ordering_type _ordering;
+    const bool _if_not_exists;
+public:
+    create_view_statement(::shared_ptr<cf_name> view_name, ::shared_ptr<cf_name> base_name,
+            columns_type selected, columns_type not_null,
+            columns_type partition_keys, columns_type clustering_keys,
+            ::shared_ptr<cf_prop_defs> properties,
+            ordering_type ordering,
+            bool if_not_exists);
+
+    virtual future<> check_access(const service::client_state& state) override;
+
+    virtual void validate(distributed<service::storage_proxy>&, const service::client_state& state) override;
+
+    virtual future<bool> announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) override;
+
+    virtual shared_ptr<transport::event::schema_change> change_event() override;
+
+    virtual shared_ptr<prepared> prepare(database& db) override;
+private:
+    schema_ptr get_view_schema(database& db);
+};
+
+}
+
+}
@@ -73,6 +73,9 @@ void delete_statement::add_update_for_key(mutation& m, const exploded_clustering
     }
 
     for (auto&& op : _column_operations) {
+        if (op->is_unset(params._options)) {
+            throw exceptions::invalid_request_exception(sprint("Invalid unset value for column %s", op->column.name_as_text()));
+        }
         op->execute(m, prefix, params);
     }
 }
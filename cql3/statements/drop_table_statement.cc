@@ -43,6 +43,7 @@
 #include "cql3/statements/prepared_statement.hh"
 
 #include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
 
 namespace cql3 {
 
@@ -67,9 +68,22 @@ future<> drop_table_statement::check_access(const service::client_state& state)
     }
 }
 
-void drop_table_statement::validate(distributed<service::storage_proxy>&, const service::client_state& state)
+void drop_table_statement::validate(distributed<service::storage_proxy>& proxy, const service::client_state& state)
 {
-    // validated in announce_migration()
+    auto& db = proxy.local().get_db().local();
+    if (!db.has_schema(keyspace(), column_family())) {
+        // validated in announce_migration()
+        return;
+    }
+    auto s = db.find_schema(keyspace(), column_family());
+    if (s->is_view()) {
+        throw exceptions::invalid_request_exception("Cannot use DROP TABLE on a materialized view");
+    }
+    auto views = db.find_keyspace(keyspace()).metadata()->views_of(s->id());
+    if (!views.empty()) {
+        throw exceptions::invalid_request_exception(sprint("Cannot drop table %s.%s while materialized view %s depends on it",
+                keyspace(), column_family(), views.front()->cf_name()));
+    }
 }
 
 future<bool> drop_table_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only)
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cql3/statements/drop_view_statement.hh"
+#include "cql3/statements/prepared_statement.hh"
+
+#include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
+
+namespace cql3 {
+
+namespace statements {
+
+drop_view_statement::drop_view_statement(::shared_ptr<cf_name> view_name, bool if_exists)
+    : schema_altering_statement{std::move(view_name)}
+    , _if_exists{if_exists}
+{
+}
+
+future<> drop_view_statement::check_access(const service::client_state& state)
+{
+    // invalid_request_exception is only thrown synchronously.
+    try {
+        return state.has_column_family_access(keyspace(), column_family(), auth::permission::DROP);
+    } catch (exceptions::invalid_request_exception&) {
+        if (!_if_exists) {
+            throw;
+        }
+        return make_ready_future();
+    }
+}
+
+void drop_view_statement::validate(distributed<service::storage_proxy>& proxy, const service::client_state& state)
+{
+    auto& db = proxy.local().get_db().local();
+    if (db.has_schema(keyspace(), column_family()) && !db.find_schema(keyspace(), column_family())->is_view()) {
+        throw exceptions::invalid_request_exception(sprint("%s.%s is not a materialized view, use DROP TABLE", keyspace(), column_family()));
+    }
+}
+
+future<bool> drop_view_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only)
+{
+    return make_ready_future<>().then([this, is_local_only] {
+        return service::get_local_migration_manager().announce_column_family_drop(keyspace(), column_family(), is_local_only);
+    }).then_wrapped([this] (auto&& f) {
+        try {
+            f.get();
+            return true;
+        } catch (const exceptions::configuration_exception& e) {
+            if (_if_exists) {
+                return false;
+            }
+            throw e;
+        }
+    });
+}
+
+shared_ptr<transport::event::schema_change> drop_view_statement::change_event()
+{
+    using namespace transport;
+
+    return make_shared<event::schema_change>(event::schema_change::change_type::DROPPED,
+                                             event::schema_change::target_type::TABLE,
+                                             keyspace(),
+                                             column_family());
+}
+
+shared_ptr<cql3::statements::prepared_statement>
+drop_view_statement::prepare(database& db) {
+    return make_shared<prepared_statement>(make_shared<drop_view_statement>(*this));
+}
+
+}
+
+}
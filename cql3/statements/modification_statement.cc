@@ -155,7 +155,9 @@ modification_statement::get_mutations(distributed<service::storage_proxy>& proxy
             [this, keys, prefix, now] (auto params_ptr) {
                 std::vector<mutation> mutations;
                 mutations.reserve(keys->size());
-                for (auto key : *keys) {
+                // The keys were only needed to read the rows required by
+                // the update, which has been done by now.
+                for (auto&& key : *keys) {
                     mutations.emplace_back(std::move(key), s);
                     auto& m = mutations.back();
                     this->add_update_for_key(m, *prefix, *params_ptr);
@@ -338,11 +340,11 @@ modification_statement::create_exploded_clustering_prefix_internal(const query_o
         } else {
             auto values = i->second->values(options);
             assert(values.size() == 1);
-            auto val = values[0];
+            auto& val = values[0];
             if (!val) {
                 throw exceptions::invalid_request_exception(sprint("Invalid null value for clustering key part %s", def.name_as_text()));
             }
-            components.push_back(*val);
+            components.push_back(std::move(*val));
         }
     }
     return exploded_clustering_prefix(std::move(components));
@@ -403,11 +405,11 @@ modification_statement::build_partition_keys(const query_options& options) {
 
         if (remaining == 1) {
             if (values.size() == 1) {
-                auto val = values[0];
+                auto& val = values[0];
                 if (!val) {
                     throw exceptions::invalid_request_exception(sprint("Invalid null value for partition key part %s", def.name_as_text()));
                 }
-                components.push_back(*val);
+                components.push_back(std::move(*val));
                 auto key = partition_key::from_exploded(*s, components);
                 validation::validate_cql_key(s, key);
                 result.emplace_back(std::move(key));
@@ -419,7 +421,7 @@ modification_statement::build_partition_keys(const query_options& options) {
                     std::vector<bytes> full_components;
                     full_components.reserve(components.size() + 1);
                     auto i = std::copy(components.begin(), components.end(), std::back_inserter(full_components));
-                    *i = *val;
+                    *i = std::move(*val);
                     auto key = partition_key::from_exploded(*s, full_components);
                     validation::validate_cql_key(s, key);
                     result.emplace_back(std::move(key));
@@ -429,11 +431,11 @@ modification_statement::build_partition_keys(const query_options& options) {
             if (values.size() != 1) {
                 throw exceptions::invalid_request_exception("IN is only supported on the last column of the partition key");
             }
-            auto val = values[0];
+            auto& val = values[0];
             if (!val) {
                 throw exceptions::invalid_request_exception(sprint("Invalid null value for partition key part %s", def.name_as_text()));
             }
-            components.push_back(*val);
+            components.push_back(std::move(*val));
         }
 
         remaining--;
@@ -577,6 +579,9 @@ modification_statement::modification_statement::prepare(database& db) {
 ::shared_ptr<cql3::statements::modification_statement>
 modification_statement::prepare(database& db, ::shared_ptr<variable_specifications> bound_names) {
     schema_ptr schema = validation::validate_column_family(db, keyspace(), column_family());
+    if (schema->is_view()) {
+        throw exceptions::invalid_request_exception("Cannot directly modify a materialized view");
+    }
 
     auto prepared_attributes = _attrs->prepare(db, keyspace(), column_family());
     prepared_attributes->collect_marker_specification(bound_names);
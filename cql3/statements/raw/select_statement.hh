@@ -74,13 +74,16 @@ class select_statement : public cf_statement
         const orderings_type _orderings;
         const bool _is_distinct;
         const bool _allow_filtering;
+        const bool _bypass_cache;
     public:
         parameters();
         parameters(orderings_type orderings,
             bool is_distinct,
-            bool allow_filtering);
+            bool allow_filtering,
+            bool bypass_cache = false);
         bool is_distinct();
         bool allow_filtering();
+        bool bypass_cache();
         orderings_type const& orderings();
     };
     template<typename T>
@@ -93,12 +96,14 @@ class select_statement : public cf_statement
     std::vector<::shared_ptr<selection::raw_selector>> _select_clause;
     std::vector<::shared_ptr<relation>> _where_clause;
     ::shared_ptr<term::raw> _limit;
+    ::shared_ptr<term::raw> _per_partition_limit;
 public:
     select_statement(::shared_ptr<cf_name> cf_name,
             ::shared_ptr<parameters> parameters,
             std::vector<::shared_ptr<selection::raw_selector>> select_clause,
             std::vector<::shared_ptr<relation>> where_clause,
-            ::shared_ptr<term::raw> limit);
+            ::shared_ptr<term::raw> limit,
+            ::shared_ptr<term::raw> per_partition_limit);
 
     virtual ::shared_ptr<prepared> prepare(database& db) override;
 private:
@@ -109,7 +114,8 @@ class select_statement : public cf_statement
         ::shared_ptr<selection::selection> selection);
 
     /** Returns a ::shared_ptr<term> for the limit or null if no limit is set */
-    ::shared_ptr<term> prepare_limit(database& db, ::shared_ptr<variable_specifications> bound_names);
+    ::shared_ptr<term> prepare_limit(database& db, ::shared_ptr<variable_specifications> bound_names,
+        ::shared_ptr<term::raw> limit, ::shared_ptr<column_specification> receiver);
 
     static void verify_ordering_is_allowed(::shared_ptr<restrictions::statement_restrictions> restrictions);
 
@@ -131,6 +137,7 @@ class select_statement : public cf_statement
     bool contains_alias(::shared_ptr<column_identifier> name);
 
     ::shared_ptr<column_specification> limit_receiver();
+    ::shared_ptr<column_specification> per_partition_limit_receiver();
 
 #if 0
     public:
@@ -48,6 +48,9 @@
 #include "query-result-reader.hh"
 #include "query_result_merger.hh"
 #include "service/pager/query_pagers.hh"
+#include "service/storage_service.hh"
+#include "db/config.hh"
+#include <boost/algorithm/string/case_conv.hpp>
 
 namespace cql3 {
 
@@ -58,14 +61,17 @@ thread_local const shared_ptr<select_statement::parameters> select_statement::_d
 select_statement::parameters::parameters()
     : _is_distinct{false}
     , _allow_filtering{false}
+    , _bypass_cache{false}
 { }
 
 select_statement::parameters::parameters(orderings_type orderings,
                                          bool is_distinct,
-                                         bool allow_filtering)
+                                         bool allow_filtering,
+                                         bool bypass_cache)
     : _orderings{std::move(orderings)}
     , _is_distinct{is_distinct}
     , _allow_filtering{allow_filtering}
+    , _bypass_cache{bypass_cache}
 { }
 
 bool select_statement::parameters::is_distinct() {
@@ -76,6 +82,10 @@ bool select_statement::parameters::allow_filtering() {
     return _allow_filtering;
 }
 
+bool select_statement::parameters::bypass_cache() {
+    return _bypass_cache;
+}
+
 select_statement::parameters::orderings_type const& select_statement::parameters::orderings() {
     return _orderings;
 }
@@ -87,7 +97,8 @@ select_statement::select_statement(schema_ptr schema,
                                    ::shared_ptr<restrictions::statement_restrictions> restrictions,
                                    bool is_reversed,
                                    ordering_comparator_type ordering_comparator,
-                                   ::shared_ptr<term> limit)
+                                   ::shared_ptr<term> limit,
+                                   ::shared_ptr<term> per_partition_limit)
     : _schema(schema)
     , _bound_terms(bound_terms)
     , _parameters(std::move(parameters))
@@ -95,15 +106,24 @@ select_statement::select_statement(schema_ptr schema,
     , _restrictions(std::move(restrictions))
     , _is_reversed(is_reversed)
     , _limit(std::move(limit))
+    , _per_partition_limit(std::move(per_partition_limit))
     , _ordering_comparator(std::move(ordering_comparator))
 {
     _opts = _selection->get_query_options();
+    if (_parameters->bypass_cache()) {
+        _opts.set(query::partition_slice::option::bypass_cache);
+    }
+    // Only range scans honour it, see storage_proxy::query().
+    if (service::get_local_storage_proxy().get_db().local().get_config().columnar_range_scan_results()) {
+        _opts.set(query::partition_slice::option::columnar);
+    }
 }
 
 bool select_statement::uses_function(const sstring& ks_name, const sstring& function_name) const {
     return _selection->uses_function(ks_name, function_name)
         || _restrictions->uses_function(ks_name, function_name)
-        || (_limit && _limit->uses_function(ks_name, function_name));
+        || (_limit && _limit->uses_function(ks_name, function_name))
+        || (_per_partition_limit && _per_partition_limit->uses_function(ks_name, function_name));
 }
 
 ::shared_ptr<select_statement>
@@ -115,6 +135,7 @@ select_statement::for_selection(schema_ptr schema, ::shared_ptr<selection::selec
         ::make_shared<restrictions::statement_restrictions>(schema),
         false,
         ordering_comparator_type{},
+        ::shared_ptr<term>{},
         ::shared_ptr<term>{});
 }
 
@@ -183,29 +204,45 @@ select_statement::make_partition_slice(const query_options& options)
         std::reverse(bounds.begin(), bounds.end());
     }
     return query::partition_slice(std::move(bounds),
-        std::move(static_columns), std::move(regular_columns), _opts, nullptr, options.get_cql_serialization_format());
+        std::move(static_columns), std::move(regular_columns), _opts, nullptr, options.get_cql_serialization_format(),
+        get_per_partition_limit(options), _restrictions->get_column_filters(options));
 }
 
-int32_t select_statement::get_limit(const query_options& options) const {
-    if (!_limit) {
+// Binds a LIMIT or PER PARTITION LIMIT term, name is how it is called in error messages.
+static int32_t bind_limit(const ::shared_ptr<term>& limit, const query_options& options, const sstring& name) {
+    if (!limit) {
         return std::numeric_limits<int32_t>::max();
     }
 
-    auto val = _limit->bind_and_get(options);
+    auto val = limit->bind_and_get(options);
+    if (is_unset_value(val)) {
+        return std::numeric_limits<int32_t>::max();
+    }
     if (!val) {
-        throw exceptions::invalid_request_exception("Invalid null value of limit");
+        throw exceptions::invalid_request_exception(sprint("Invalid null value of %s", name));
     }
 
     try {
         int32_type->validate(*val);
         auto l = value_cast<int32_t>(int32_type->deserialize(*val));
         if (l <= 0) {
-            throw exceptions::invalid_request_exception("LIMIT must be strictly positive");
+            throw exceptions::invalid_request_exception(sprint("%s must be strictly positive", boost::to_upper_copy(name)));
         }
         return l;
     } catch (const marshal_exception& e) {
-        throw exceptions::invalid_request_exception("Invalid limit value");
+        throw exceptions::invalid_request_exception(sprint("Invalid %s value", name));
+    }
+}
+
+int32_t select_statement::get_limit(const query_options& options) const {
+    return bind_limit(_limit, options, "limit");
+}
+
+uint32_t select_statement::get_per_partition_limit(const query_options& options) const {
+    if (!_per_partition_limit) {
+        return query::max_rows;
     }
+    return bind_limit(_per_partition_limit, options, "per partition limit");
 }
 
 bool select_statement::needs_post_query_ordering() const {
@@ -227,6 +264,17 @@ select_statement::execute(distributed<service::storage_proxy>& proxy,
 
     auto command = ::make_lw_shared<query::read_command>(_schema->id(), _schema->version(),
         make_partition_slice(options), limit, to_gc_clock(now), tracing::make_trace_info(state.get_trace_state()), query::max_partitions, options.get_timestamp(state));
+    if (_restrictions->uses_secondary_indexing()) {
+        // Replicas which don't know the index restriction would ignore it
+        // and return every row of the range.
+        if (!service::get_local_storage_service().cluster_supports_secondary_indexes()) {
+            throw exceptions::invalid_request_exception("Secondary index queries are not supported until all nodes are upgraded");
+        }
+        command->index = _restrictions->get_index_restriction(options);
+    }
+    if (_restrictions->uses_filtering() && !service::get_local_storage_service().cluster_supports_row_filtering()) {
+        throw exceptions::invalid_request_exception("Filtering queries are not supported until all nodes are upgraded");
+    }
 
     int32_t page_size = options.get_page_size();
 
@@ -240,6 +288,10 @@ select_statement::execute(distributed<service::storage_proxy>& proxy,
 
     auto key_ranges = _restrictions->get_partition_key_ranges(options);
 
+    if (can_count_on_replicas(cl, key_ranges)) {
+        return execute_count(proxy, command, std::move(key_ranges), state, options);
+    }
+
     if (!aggregate && (page_size <= 0
             || !service::pager::query_pagers::may_need_paging(page_size,
                     *command, key_ranges))) {
@@ -254,13 +306,16 @@ select_statement::execute(distributed<service::storage_proxy>& proxy,
         return do_with(
                 cql3::selection::result_set_builder(*_selection, now,
                         options.get_cql_serialization_format()),
-                [p, page_size, now](auto& builder) {
+                [p, page_size, now, &options](auto& builder) {
                     return do_until([p] {return p->is_exhausted();},
                             [p, &builder, page_size, now] {
                                 return p->fetch_page(builder, page_size, now);
                             }
-                    ).then([&builder] {
+                    ).then([&builder, &options] {
                                 auto rs = builder.build();
+                                if (options.skip_metadata()) {
+                                    rs->get_metadata().set_skip_metadata();
+                                }
                                 auto msg = ::make_shared<transport::messages::result_message::rows>(std::move(rs));
                                 return make_ready_future<shared_ptr<transport::messages::result_message>>(std::move(msg));
                             });
@@ -279,12 +334,48 @@ select_statement::execute(distributed<service::storage_proxy>& proxy,
                 if (!p->is_exhausted()) {
                     rs->get_metadata().set_has_more_pages(p->state());
                 }
+                if (options.skip_metadata()) {
+                    rs->get_metadata().set_skip_metadata();
+                }
 
                 auto msg = ::make_shared<transport::messages::result_message::rows>(std::move(rs));
                 return make_ready_future<shared_ptr<transport::messages::result_message>>(std::move(msg));
             });
 }
 
+// A COUNT(*) over a range of partitions can be computed by replicas, instead
+// of shipping every row to the coordinator. Since replica results aren't
+// reconciled, only if a single replica is consulted.
+bool select_statement::can_count_on_replicas(db::consistency_level cl, const std::vector<query::partition_range>& key_ranges) const {
+    return _selection->is_count_rows()
+        && !_limit
+        && !_parameters->is_distinct()
+        && !_restrictions->uses_secondary_indexing()
+        && (cl == db::consistency_level::ONE || cl == db::consistency_level::LOCAL_ONE)
+        && key_ranges.size() == 1 && !query::is_single_partition(key_ranges[0])
+        && service::get_local_storage_service().cluster_supports_count_rows();
+}
+
+future<shared_ptr<transport::messages::result_message>>
+select_statement::execute_count(distributed<service::storage_proxy>& proxy,
+                                lw_shared_ptr<query::read_command> cmd,
+                                std::vector<query::partition_range>&& partition_ranges,
+                                service::query_state& state,
+                                const query_options& options)
+{
+    cmd->slice.options.set<query::partition_slice::option::count_rows>();
+    return proxy.local().query(_schema, cmd, std::move(partition_ranges), options.get_consistency(), state.get_trace_state())
+            .then([this, &options, cmd] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+        auto rs = std::make_unique<cql3::result_set>(::make_shared<metadata>(*_selection->get_result_metadata()));
+        rs->add_row({long_type->decompose(int64_t(result->row_count().value_or(0)))});
+        if (options.skip_metadata()) {
+            rs->get_metadata().set_skip_metadata();
+        }
+        auto msg = ::make_shared<transport::messages::result_message::rows>(std::move(rs));
+        return make_ready_future<shared_ptr<transport::messages::result_message>>(std::move(msg));
+    });
+}
+
 future<shared_ptr<transport::messages::result_message>>
 select_statement::execute(distributed<service::storage_proxy>& proxy,
                           lw_shared_ptr<query::read_command> cmd,
@@ -325,6 +416,9 @@ select_statement::execute_internal(distributed<service::storage_proxy>& proxy,
     auto now = db_clock::now();
     auto command = ::make_lw_shared<query::read_command>(_schema->id(), _schema->version(),
         make_partition_slice(options), limit, to_gc_clock(now), std::experimental::nullopt, query::max_partitions, options.get_timestamp(state));
+    if (_restrictions->uses_secondary_indexing()) {
+        command->index = _restrictions->get_index_restriction(options);
+    }
     auto partition_ranges = _restrictions->get_partition_key_ranges(options);
 
     if (needs_post_query_ordering() && _limit) {
@@ -365,6 +459,10 @@ select_statement::process_results(foreign_ptr<lw_shared_ptr<query::result>> resu
         }
     }
     rs->trim(cmd->row_limit);
+    // The client already has the result metadata of the prepared statement.
+    if (options.skip_metadata()) {
+        rs->get_metadata().set_skip_metadata();
+    }
     return ::make_shared<transport::messages::result_message::rows>(std::move(rs));
 }
 
@@ -374,12 +472,14 @@ select_statement::select_statement(::shared_ptr<cf_name> cf_name,
                                    ::shared_ptr<parameters> parameters,
                                    std::vector<::shared_ptr<selection::raw_selector>> select_clause,
                                    std::vector<::shared_ptr<relation>> where_clause,
-                                   ::shared_ptr<term::raw> limit)
+                                   ::shared_ptr<term::raw> limit,
+                                   ::shared_ptr<term::raw> per_partition_limit)
     : cf_statement(std::move(cf_name))
     , _parameters(std::move(parameters))
     , _select_clause(std::move(select_clause))
     , _where_clause(std::move(where_clause))
     , _limit(std::move(limit))
+    , _per_partition_limit(std::move(per_partition_limit))
 { }
 
 ::shared_ptr<prepared_statement> select_statement::prepare(database& db) {
@@ -396,6 +496,15 @@ ::shared_ptr<prepared_statement> select_statement::prepare(database& db) {
         validate_distinct_selection(schema, selection, restrictions);
     }
 
+    if (_per_partition_limit) {
+        if (_parameters->is_distinct()) {
+            throw exceptions::invalid_request_exception("PER PARTITION LIMIT is not allowed with SELECT DISTINCT queries");
+        }
+        if (selection->is_aggregate()) {
+            throw exceptions::invalid_request_exception("PER PARTITION LIMIT is not allowed with aggregate queries.");
+        }
+    }
+
     select_statement::ordering_comparator_type ordering_comparator;
     bool is_reversed_ = false;
 
@@ -414,7 +523,8 @@ ::shared_ptr<prepared_statement> select_statement::prepare(database& db) {
         std::move(restrictions),
         is_reversed_,
         std::move(ordering_comparator),
-        prepare_limit(db, bound_names));
+        prepare_limit(db, bound_names, _limit, limit_receiver()),
+        prepare_limit(db, bound_names, _per_partition_limit, per_partition_limit_receiver()));
 
     return ::make_shared<prepared>(std::move(stmt), std::move(*bound_names));
 }
@@ -438,13 +548,14 @@ select_statement::prepare_restrictions(database& db,
 
 /** Returns a ::shared_ptr<term> for the limit or null if no limit is set */
 ::shared_ptr<term>
-select_statement::prepare_limit(database& db, ::shared_ptr<variable_specifications> bound_names)
+select_statement::prepare_limit(database& db, ::shared_ptr<variable_specifications> bound_names,
+                                ::shared_ptr<term::raw> limit, ::shared_ptr<column_specification> receiver)
 {
-    if (!_limit) {
+    if (!limit) {
         return {};
     }
 
-    auto prep_limit = _limit->prepare(db, keyspace(), limit_receiver());
+    auto prep_limit = limit->prepare(db, keyspace(), receiver);
     prep_limit->collect_marker_specification(bound_names);
     return prep_limit;
 }
@@ -591,7 +702,8 @@ bool select_statement::is_reversed(schema_ptr schema) {
 void select_statement::check_needs_filtering(::shared_ptr<restrictions::statement_restrictions> restrictions)
 {
     // non-key-range non-indexed queries cannot involve filtering underneath
-    if (!_parameters->allow_filtering() && (restrictions->is_key_range() || restrictions->uses_secondary_indexing())) {
+    if (!_parameters->allow_filtering() && (restrictions->is_key_range() || restrictions->uses_secondary_indexing()
+            || restrictions->uses_filtering())) {
         // We will potentially filter data if either:
         //  - Have more than one IndexExpression
         //  - Have no index expression and the column filter is not the identity
@@ -615,6 +727,11 @@ ::shared_ptr<column_specification> select_statement::limit_receiver() {
         int32_type);
 }
 
+::shared_ptr<column_specification> select_statement::per_partition_limit_receiver() {
+    return ::make_shared<column_specification>(keyspace(), column_family(), ::make_shared<column_identifier>("[per_partition_limit]", true),
+        int32_type);
+}
+
 }
 
 }
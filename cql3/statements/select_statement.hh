@@ -76,6 +76,7 @@ class select_statement : public cql_statement {
     ::shared_ptr<restrictions::statement_restrictions> _restrictions;
     bool _is_reversed;
     ::shared_ptr<term> _limit;
+    ::shared_ptr<term> _per_partition_limit;
 
     template<typename T>
     using compare_fn = raw::select_statement::compare_fn<T>;
@@ -97,7 +98,8 @@ class select_statement : public cql_statement {
             ::shared_ptr<restrictions::statement_restrictions> restrictions,
             bool is_reversed,
             ordering_comparator_type ordering_comparator,
-            ::shared_ptr<term> limit);
+            ::shared_ptr<term> limit,
+            ::shared_ptr<term> per_partition_limit);
 
     virtual bool uses_function(const sstring& ks_name, const sstring& function_name) const override;
 
@@ -126,6 +128,13 @@ class select_statement : public cql_statement {
 
     shared_ptr<transport::messages::result_message> process_results(foreign_ptr<lw_shared_ptr<query::result>> results,
         lw_shared_ptr<query::read_command> cmd, const query_options& options, db_clock::time_point now);
+private:
+    bool can_count_on_replicas(db::consistency_level cl, const std::vector<query::partition_range>& key_ranges) const;
+
+    future<::shared_ptr<transport::messages::result_message>> execute_count(distributed<service::storage_proxy>& proxy,
+        lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, service::query_state& state,
+        const query_options& options);
+public:
 #if 0
     private ResultMessage.Rows pageAggregateQuery(QueryPager pager, QueryOptions options, int pageSize, long now)
             throws RequestValidationException, RequestExecutionException
@@ -196,6 +205,7 @@ class select_statement : public cql_statement {
 
 private:
     int32_t get_limit(const query_options& options) const;
+    uint32_t get_per_partition_limit(const query_options& options) const;
     bool needs_post_query_ordering() const;
 
 #if 0
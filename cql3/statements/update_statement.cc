@@ -87,7 +87,9 @@ void update_statement::add_update_for_key(mutation& m, const exploded_clustering
     }
 
     for (auto&& update : _column_operations) {
-        update->execute(m, prefix, params);
+        if (!update->is_unset(params._options)) {
+            update->execute(m, prefix, params);
+        }
     }
 
     warn(unimplemented::cause::INDEXES);
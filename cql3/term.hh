@@ -100,6 +100,13 @@ class term : public ::enable_shared_from_this<term> {
      */
     virtual bool contains_bind_marker() const = 0;
 
+    /**
+     * Whether this is a bind marker whose value the client left unset.
+     */
+    virtual bool is_unset(const query_options& options) const {
+        return false;
+    }
+
     virtual bool uses_function(const sstring& ks_name, const sstring& function_name) const = 0;
 
     virtual sstring to_string() const {
@@ -64,6 +64,9 @@ class untyped_result_set {
         bytes get_blob(const sstring& name) const {
             return *_data.at(name);
         }
+        bytes_view get_view(const sstring& name) const {
+            return *_data.at(name);
+        }
         template<typename T>
         T get_as(const sstring& name) const {
             return value_cast<T>(data_type_for<T>()->deserialize(get_blob(name)));
@@ -45,6 +45,7 @@
 #include "timestamp.hh"
 #include "schema.hh"
 #include "atomic_cell.hh"
+#include "counters.hh"
 #include "tombstone.hh"
 #include "exceptions/exceptions.hh"
 #include "cql3/query_options.hh"
@@ -146,13 +147,9 @@ class update_parameters final {
         }
     };
 
-#if 0
-     public Cell makeCounter(CellName name, long delta) throws InvalidRequestException
-     {
-         QueryProcessor.validateCellName(name, metadata.comparator);
-         return new BufferCounterUpdateCell(name, delta, FBUtilities.timestampMicros());
-     }
-#endif
+    atomic_cell make_counter_update_cell(int64_t delta) const {
+        return ::make_counter_update_cell(_timestamp, delta);
+    }
 
     tombstone make_tombstone() const {
         return {_timestamp, _local_deletion_time};
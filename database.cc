@@ -28,33 +28,46 @@
 #include "db/consistency_level.hh"
 #include "db/commitlog/commitlog.hh"
 #include "db/config.hh"
+#include "db/counter_cache.hh"
+#include "db/query_result_cache.hh"
 #include "to_string.hh"
 #include "query-result-writer.hh"
 #include "nway_merger.hh"
+#include "cell_compression.hh"
 #include "cql3/column_identifier.hh"
 #include "core/seastar.hh"
 #include <seastar/core/sleep.hh>
 #include <seastar/core/rwlock.hh>
+#include <deque>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include "sstables/sstables.hh"
 #include "sstables/compaction.hh"
+#include "sstables/trickle_fsync_file.hh"
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include "locator/simple_snitch.hh"
 #include <boost/algorithm/cxx11/all_of.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 #include <boost/function_output_iterator.hpp>
 #include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/algorithm/remove_if.hpp>
+#include <boost/range/algorithm/count_if.hpp>
 #include <boost/range/algorithm/find.hpp>
 #include <boost/range/algorithm/find_if.hpp>
+#include <boost/range/algorithm/count_if.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include "frozen_mutation.hh"
 #include "mutation_partition_applier.hh"
 #include "core/do_with.hh"
+#include "core/queue.hh"
 #include "service/migration_manager.hh"
 #include "service/storage_service.hh"
 #include "mutation_query.hh"
+#include "db/index/local_index.hh"
+#include "db/view/view.hh"
+#include "counters.hh"
+#include "service/storage_proxy.hh"
 #include "sstable_mutation_readers.hh"
 #include <core/fstream.hh>
 #include <seastar/core/enum.hh>
@@ -62,6 +75,9 @@
 #include "utils/flush_queue.hh"
 #include "schema_registry.hh"
 #include "service/priority_manager.hh"
+#include "service/request_scheduler.hh"
+#include "utils/alloc_tracker.hh"
+#include "exceptions/exceptions.hh"
 
 #include "checked-file-impl.hh"
 #include "disk-error-handler.hh"
@@ -132,9 +148,59 @@ column_family::column_family(schema_ptr schema, config config, db::commitlog* cl
     , _compaction_manager(compaction_manager)
     , _flush_queue(std::make_unique<memtable_flush_queue>())
 {
+    if (_config.memtable_flush_concurrency) {
+        _flush_concurrency_sem.emplace(_config.memtable_flush_concurrency);
+    }
     if (!_config.enable_disk_writes) {
         dblog.warn("Writes disabled, column family no durable.");
     }
+    _expired_data_sweep_timer.set_callback([this] {
+        if (_expired_data_sweep_gate.is_closed()) {
+            return;
+        }
+        with_gate(_expired_data_sweep_gate, [this] {
+            return sweep_expired_data();
+        }).handle_exception([this] (std::exception_ptr ep) {
+            dblog.warn("Failed to compact expired data of {}.{}: {}", _schema->ks_name(), _schema->cf_name(), ep);
+        }).finally([this] {
+            arm_expired_data_sweep();
+        });
+    });
+}
+
+constexpr size_t column_family::expired_data_sweep_partitions_per_step;
+constexpr size_t column_family::expired_data_sweep_max_rows;
+
+void column_family::arm_expired_data_sweep() {
+    if (_config.expired_data_sweep_period.count() && !_expired_data_sweep_gate.is_closed()) {
+        _expired_data_sweep_timer.arm(_config.expired_data_sweep_period);
+    }
+}
+
+future<> column_family::sweep_expired_data() {
+    auto now = gc_clock::now();
+    auto mt = _memtables->back();
+    return do_with(std::experimental::optional<dht::decorated_key>(), [this, mt, now] (auto& last) {
+        return repeat([this, mt, now, &last] {
+            // A sealed memtable is being flushed, and is left alone.
+            if (mt != _memtables->back()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto stop = mt->compact_expired(last, now, expired_data_sweep_partitions_per_step, expired_data_sweep_max_rows);
+            return later().then([stop] {
+                return stop;
+            });
+        });
+    }).then([this, now] {
+        return do_with(std::experimental::optional<dht::ring_position>(), [this, now] (auto& last) {
+            return repeat([this, now, &last] {
+                auto stop = _cache.compact_expired(last, now, expired_data_sweep_partitions_per_step, expired_data_sweep_max_rows);
+                return later().then([stop] {
+                    return stop;
+                });
+            });
+        });
+    });
 }
 
 partition_presence_checker
@@ -164,6 +230,16 @@ column_family::sstables_as_mutation_source() {
 column_family::~column_family() {
 }
 
+std::pair<sstring, db::data_placement::permit>
+column_family::new_sstable_directory(uint64_t estimated_size) {
+    if (!_config.data_placement || _config.all_datadirs.size() < 2) {
+        return { _config.datadir, db::data_placement::permit() };
+    }
+    auto p = _config.data_placement->pick(estimated_size);
+    auto& dir = _config.all_datadirs[p.directory()];
+    return { dir, std::move(p) };
+}
+
 
 logalloc::occupancy_stats column_family::occupancy() const {
     logalloc::occupancy_stats res;
@@ -186,9 +262,25 @@ bool belongs_to_current_shard(const streamed_mutation& m) {
     return dht::shard_of(m.decorated_key().token()) == engine().cpu_id();
 }
 
+// Returns the part of pr past start, or nothing if there's no such part.
+static std::experimental::optional<query::partition_range>
+partition_range_past(const schema& s, const query::partition_range& pr, const dht::decorated_key& start) {
+    dht::ring_position rp(start);
+    if (pr.end() && pr.end()->value().tri_compare(s, rp) <= 0) {
+        return { };
+    }
+    if (pr.start() && pr.start()->value().tri_compare(s, rp) > 0) {
+        return pr;
+    }
+    return query::partition_range(query::partition_range::bound(std::move(rp), false), pr.end());
+}
+
 class range_sstable_reader final : public mutation_reader::impl {
     const query::partition_range& _pr;
     lw_shared_ptr<sstables::sstable_set> _sstables;
+    // Ranges of sstables which are read only past some key, see
+    // sstable_set::read_start(). Readers keep references to them.
+    std::deque<query::partition_range> _narrowed_ranges;
     mutation_reader _reader;
     // Use a pointer instead of copying, so we don't need to regenerate the reader if
     // the priority changes.
@@ -206,10 +298,24 @@ class range_sstable_reader final : public mutation_reader::impl {
         , _ck_filtering(ck_filtering)
     {
         std::vector<mutation_reader> readers;
+        auto wraps = pr.is_wrap_around(dht::ring_position_comparator(*s));
         for (const lw_shared_ptr<sstables::sstable>& sst : _sstables->select(pr)) {
+            const query::partition_range* range = &pr;
+            // The skipped part of the sstable is also in an early opened
+            // compaction output. Reading it twice would only cost time, so
+            // wrapping ranges are read whole instead of being split.
+            auto start = _sstables->read_start(sst);
+            if (start && !wraps) {
+                auto narrowed = partition_range_past(*s, pr, *start);
+                if (!narrowed) {
+                    continue;
+                }
+                _narrowed_ranges.emplace_back(std::move(*narrowed));
+                range = &_narrowed_ranges.back();
+            }
             // FIXME: make sstable::read_range_rows() return ::mutation_reader so that we can drop this wrapper.
             mutation_reader reader =
-                make_mutation_reader<sstable_range_wrapping_reader>(sst, s, pr, _ck_filtering, _pc);
+                make_mutation_reader<sstable_range_wrapping_reader>(sst, s, *range, _ck_filtering, _pc);
             if (sst->is_shared()) {
                 reader = make_filtering_reader(std::move(reader), belongs_to_current_shard);
             }
@@ -236,33 +342,70 @@ class single_key_sstable_reader final : public mutation_reader::impl {
     // the priority changes.
     const io_priority_class& _pc;
     query::clustering_key_filtering_context _ck_filtering;
+    column_family::stats& _cf_stats;
+    ::cf_stats* _shard_stats;
+    uint64_t _data_bytes = 0;
+private:
+    void update_stats(const sstables::key_selection_stats& selection, unsigned summary_misses, unsigned read, unsigned index_reads) {
+        // Filter passes which didn't find the partition, in the summary or later.
+        auto false_positives = summary_misses + read - std::min<unsigned>(read, _mutations.size());
+        _cf_stats.sstables_checked_per_read.add(selection.checked);
+        _cf_stats.estimated_sstable_per_read.add(read);
+        _cf_stats.false_positives_per_read.add(false_positives);
+        _cf_stats.index_reads_per_read.add(index_reads);
+        _cf_stats.data_bytes_per_read.add(_data_bytes);
+        if (_shard_stats) {
+            ++_shard_stats->sstable_point_reads;
+            _shard_stats->sstables_checked += selection.checked;
+            _shard_stats->sstables_read += read;
+            _shard_stats->filter_false_positives += false_positives;
+            _shard_stats->index_reads += index_reads;
+            _shard_stats->data_bytes_read += _data_bytes;
+        }
+    }
 public:
     single_key_sstable_reader(schema_ptr schema,
                               lw_shared_ptr<sstables::sstable_set> sstables,
                               const partition_key& key,
                               query::clustering_key_filtering_context ck_filtering,
-                              const io_priority_class& pc)
+                              const io_priority_class& pc,
+                              column_family::stats& cf_stats,
+                              ::cf_stats* shard_stats)
         : _schema(std::move(schema))
         , _rp(dht::global_partitioner().decorate_key(*_schema, key))
         , _key(sstables::key::from_partition_key(*_schema, key))
         , _sstables(std::move(sstables))
         , _pc(pc)
         , _ck_filtering(ck_filtering)
+        , _cf_stats(cf_stats)
+        , _shard_stats(shard_stats)
     { }
 
     virtual future<streamed_mutation_opt> operator()() override {
         if (_done) {
             return make_ready_future<streamed_mutation_opt>();
         }
-        return parallel_for_each(_sstables->select(query::partition_range(_rp)),
-            [this](const lw_shared_ptr<sstables::sstable>& sstable) {
-                return sstable->read_row(_schema, _key, _ck_filtering, _pc).then([this](auto smo) {
+        sstables::key_selection_stats selection;
+        auto candidates = _sstables->select_for_key(*_schema, _rp, _key, &selection);
+        unsigned summary_misses = selection.filter_passed - candidates.size();
+        // Sstables whose clustering bounds miss the requested ranges can be
+        // left out, which helps slices of partitions spread over many sstables.
+        auto& ck_ranges = _ck_filtering.get_ranges(*_rp.key());
+        candidates.erase(boost::remove_if(candidates, [&] (auto& c) {
+            return !c.first->may_contain_rows(*_schema, ck_ranges);
+        }), candidates.end());
+        unsigned read = candidates.size();
+        unsigned index_reads = boost::count_if(candidates, [] (auto& c) { return !c.second.cached; });
+        return parallel_for_each(std::move(candidates),
+            [this](std::pair<sstables::shared_sstable, sstables::partition_lookup>& c) {
+                return c.first->read_row(_schema, _key, std::move(c.second), _ck_filtering, _pc, &_data_bytes).then([this](auto smo) {
                     if (smo) {
                         _mutations.emplace_back(std::move(*smo));
                     }
                 });
-        }).then([this] () -> streamed_mutation_opt {
+        }).then([this, selection, summary_misses, read, index_reads] () -> streamed_mutation_opt {
             _done = true;
+            update_stats(selection, summary_misses, read, index_reads);
             if (_mutations.empty()) {
                 return { };
             }
@@ -271,15 +414,22 @@ class single_key_sstable_reader final : public mutation_reader::impl {
     }
 };
 
+// Estimated memory of the buffers of sstable reads, charged on their
+// admission. A point read is expected to touch few sstables, those whose
+// filter passed, with a small index page and data buffer each. A scan keeps
+// a full sized data buffer for every sstable it reads.
+static constexpr size_t sstable_point_read_memory = 32 * 1024;
+static constexpr size_t sstable_scan_memory = 128 * 1024;
+
 mutation_reader
 column_family::make_sstable_reader(schema_ptr s,
                                    const query::partition_range& pr,
                                    query::clustering_key_filtering_context ck_filtering,
                                    const io_priority_class& pc) const {
     // restricts a reader's concurrency if the configuration specifies it
-    auto restrict_reader = [&] (mutation_reader&& in) {
+    auto restrict_reader = [&] (mutation_reader&& in, size_t memory) {
         if (_config.read_concurrency_config.sem) {
-            return make_restricted_reader(_config.read_concurrency_config, 1, std::move(in));
+            return make_restricted_reader(_config.read_concurrency_config, reader_resources(1, memory), std::move(in));
         } else {
             return std::move(in);
         }
@@ -287,13 +437,15 @@ column_family::make_sstable_reader(schema_ptr s,
 
     if (pr.is_singular() && pr.start()->value().has_key()) {
         const dht::ring_position& pos = pr.start()->value();
-        if (dht::shard_of(pos.token()) != engine().cpu_id()) {
+        if (!_config.shard_local && dht::shard_of(pos.token()) != engine().cpu_id()) {
             return make_empty_reader(); // range doesn't belong to this shard
         }
-        return restrict_reader(make_mutation_reader<single_key_sstable_reader>(std::move(s), _sstables, *pos.key(), ck_filtering, pc));
+        return restrict_reader(make_mutation_reader<single_key_sstable_reader>(std::move(s), _sstables, *pos.key(), ck_filtering, pc,
+                _stats, _config.cf_stats), sstable_point_read_memory);
     } else {
         // range_sstable_reader is not movable so we need to wrap it
-        return restrict_reader(make_mutation_reader<range_sstable_reader>(std::move(s), _sstables, pr, ck_filtering, pc));
+        auto memory = _sstables->select(pr).size() * sstable_scan_memory;
+        return restrict_reader(make_mutation_reader<range_sstable_reader>(std::move(s), _sstables, pr, ck_filtering, pc), memory);
     }
 }
 
@@ -314,6 +466,26 @@ key_source column_family::sstables_as_key_source() const {
     });
 }
 
+key_source column_family::memtables_as_key_source() const {
+    return key_source([this] (const query::partition_range& range) {
+        std::vector<key_reader> readers;
+        readers.reserve(_memtables->size());
+        for (auto&& mt : *_memtables) {
+            readers.emplace_back(mt->as_key_source()(range));
+        }
+        return make_combined_reader(_schema, std::move(readers));
+    });
+}
+
+bool column_family::has_only_live_sstable_partitions(const schema& s, const query::partition_range& range) const {
+    if (query::is_wrap_around(range, s)) {
+        return false;
+    }
+    return boost::algorithm::all_of(_sstables->select(range), [] (const sstables::shared_sstable& sst) {
+        return sst->has_only_live_partitions();
+    });
+}
+
 // Exposed for testing, not performance critical.
 future<column_family::const_mutation_partition_ptr>
 column_family::find_partition(schema_ptr s, const dht::decorated_key& key) const {
@@ -356,7 +528,8 @@ mutation_reader
 column_family::make_reader(schema_ptr s,
                            const query::partition_range& range,
                            const query::clustering_key_filtering_context& ck_filtering,
-                           const io_priority_class& pc) const {
+                           const io_priority_class& pc,
+                           bool bypass_cache) const {
     if (query::is_wrap_around(range, *s)) {
         // make_combined_reader() can't handle streams that wrap around yet.
         fail(unimplemented::cause::WRAP_AROUND);
@@ -389,7 +562,7 @@ column_family::make_reader(schema_ptr s,
         readers.emplace_back(mt->make_reader(s, range, ck_filtering, pc));
     }
 
-    if (_config.enable_cache) {
+    if (_config.enable_cache && !bypass_cache) {
         readers.emplace_back(_cache.make_reader(s, range, ck_filtering, pc));
     } else {
         readers.emplace_back(make_sstable_reader(s, range, ck_filtering, pc));
@@ -398,6 +571,53 @@ column_family::make_reader(schema_ptr s,
     return make_combined_reader(std::move(readers));
 }
 
+mutation_reader
+column_family::make_unrepaired_reader(schema_ptr s, const query::partition_range& range, const io_priority_class& pc) const {
+    auto unrepaired = make_lw_shared(_compaction_strategy.make_sstable_set(_schema));
+    for (auto&& sst : *_sstables->all()) {
+        if (!sst->is_repaired()) {
+            unrepaired->insert(sst);
+        }
+    }
+    std::vector<mutation_reader> readers;
+    readers.reserve(_memtables->size() + 1);
+    for (auto&& mt : *_memtables) {
+        readers.emplace_back(mt->make_reader(s, range, query::no_clustering_key_filtering, pc));
+    }
+    readers.emplace_back(make_mutation_reader<range_sstable_reader>(std::move(s), std::move(unrepaired), range, query::no_clustering_key_filtering, pc));
+    return make_combined_reader(std::move(readers));
+}
+
+void column_family::start_repair_session(uint64_t repaired_at) {
+    if (_repair_sessions.count(repaired_at)) {
+        return;
+    }
+    if (_repair_sessions.size() >= max_repair_sessions) {
+        _repair_sessions.erase(_repair_sessions.begin());
+    }
+    auto& generations = _repair_sessions[repaired_at];
+    for (auto&& sst : *_sstables->all()) {
+        if (!sst->is_repaired()) {
+            generations.insert(sst->generation());
+        }
+    }
+}
+
+std::vector<sstables::shared_sstable> column_family::finish_repair_session(uint64_t repaired_at) {
+    std::vector<sstables::shared_sstable> ret;
+    auto i = _repair_sessions.find(repaired_at);
+    if (i == _repair_sessions.end()) {
+        return ret;
+    }
+    for (auto&& sst : *_sstables->all()) {
+        if (i->second.count(sst->generation())) {
+            ret.push_back(sst);
+        }
+    }
+    _repair_sessions.erase(i);
+    return ret;
+}
+
 // Not performance critical. Currently used for testing only.
 template <typename Func>
 future<bool>
@@ -546,6 +766,34 @@ static bool belongs_to_other_shard(const schema& s, range<partition_key> r) {
 
 future<> column_family::load_sstable(sstables::sstable&& sstab, bool reset_level) {
     auto sst = make_lw_shared<sstables::sstable>(std::move(sstab));
+    if (!_config.sstable_load_sem) {
+        return do_load_sstable(std::move(sst), reset_level);
+    }
+    if (_config.cf_stats) {
+        _config.cf_stats->pending_sstable_loads++;
+    }
+    return with_semaphore(*_config.sstable_load_sem, 1, [this, sst = std::move(sst), reset_level] () mutable {
+        return do_load_sstable(std::move(sst), reset_level);
+    }).finally([this] {
+        if (_config.cf_stats) {
+            _config.cf_stats->pending_sstable_loads--;
+            _config.cf_stats->sstables_loaded++;
+        }
+    });
+}
+
+future<> column_family::do_load_sstable(lw_shared_ptr<sstables::sstable> sst, bool reset_level) {
+    if (_config.shard_local) {
+        // Everything in the directory of a shard local column family is
+        // owned by this shard, whatever the tokens of its partitions.
+        return sst->load().then([this, sst, reset_level] {
+            sst->set_unshared();
+            if (reset_level) {
+                sst->set_sstable_level(0);
+            }
+            add_sstable(sst);
+        });
+    }
     return sst->get_sstable_key_range(*_schema).then([this, sst, reset_level] (range<partition_key> r) mutable {
         // Checks whether or not sstable belongs to current shard.
         if (!belongs_to_current_shard(*_schema, r)) {
@@ -582,12 +830,13 @@ future<> column_family::load_sstable(sstables::sstable&& sstab, bool reset_level
 // load_sstable() wants to start rewriting sstables which are shared between
 // several shards, but we can't start any compaction before all the sstables
 // of this CF were loaded. So call this function to start rewrites, if any.
-void column_family::start_rewrite() {
-    for (auto sst : _sstables_need_rewrite) {
-        dblog.info("Splitting {} for shard", sst->get_filename());
-        _compaction_manager.submit_sstable_rewrite(this, sst);
-    }
+future<> column_family::start_rewrite() {
+    auto need_rewrite = std::move(_sstables_need_rewrite);
     _sstables_need_rewrite.clear();
+    return parallel_for_each(std::move(need_rewrite), [this] (sstables::shared_sstable sst) {
+        dblog.info("Splitting {} for shard", sst->get_filename());
+        return _compaction_manager.submit_sstable_rewrite(this, sst);
+    });
 }
 
 future<sstables::entry_descriptor> column_family::probe_file(sstring sstdir, sstring fname) {
@@ -708,9 +957,10 @@ column_family::seal_active_streaming_memtable_immediate() {
 
         _config.streaming_dirty_memory_manager->serialize_flush([this, old] {
           return with_lock(_sstables_lock.for_read(), [this, old] {
+            auto dir = new_sstable_directory(old->occupancy().total_space());
             auto newtab = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(),
-                _config.datadir, calculate_generation_for_new_table(),
-                sstables::sstable::version_types::ka,
+                dir.first, calculate_generation_for_new_table(),
+                sstable_write_version(),
                 sstables::sstable::format_types::big);
 
             newtab->set_unshared();
@@ -722,18 +972,23 @@ column_family::seal_active_streaming_memtable_immediate() {
             // If we ever need to, we'll keep them separate statistics, but we don't want to polute the
             // main stats about memtables with streaming memtables.
             //
-            // Second, we will not bother touching the cache after this flush. The current streaming code
-            // will invalidate the ranges it touches, so we won't do it twice. Even when that changes, the
-            // cache management code in here will have to differ from the main memtable's one. Please see
-            // the comment at flush_streaming_mutations() for details.
+            // Second, we don't merge the memtable into the cache, as streaming may bring in data for
+            // ranges this node is only about to own, which would just pollute it. We only invalidate
+            // the partitions the memtable has, so that the cache stays coherent with the new sstable.
+            // Please see the comment at flush_streaming_mutations() for details.
             //
             // Lastly, we don't have any commitlog RP to update, and we don't need to deal manipulate the
             // memtable list, since this memtable was not available for reading up until this point.
-            return newtab->write_components(*old, incremental_backups_enabled(), priority).then([this, newtab, old] {
+            return newtab->write_components(*old, incremental_backups_enabled(), priority).then([this, newtab, old, placement = std::move(dir.second)] {
                 return newtab->open_data();
             }).then([this, old, newtab] () {
                 add_sstable(newtab);
+                invalidate_cached_results();
                 trigger_compaction();
+                if (!_config.enable_cache) {
+                    return make_ready_future<>();
+                }
+                return _cache.invalidate(*old).finally([old] { });
             }).handle_exception([] (auto ep) {
                 dblog.error("failed to write streamed sstable: {}", ep);
                 return make_exception_future<>(ep);
@@ -763,15 +1018,17 @@ future<> column_family::seal_active_streaming_memtable_big(streaming_memtable_bi
     return with_gate(_streaming_flush_gate, [this, old, &smb] {
         return with_gate(smb.flush_in_progress, [this, old, &smb] {
             return with_lock(_sstables_lock.for_read(), [this, old, &smb] {
+                auto dir = new_sstable_directory(old->occupancy().total_space());
                 auto newtab = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(),
-                                                                _config.datadir, calculate_generation_for_new_table(),
-                                                                sstables::sstable::version_types::ka,
+                                                                dir.first, calculate_generation_for_new_table(),
+                                                                sstable_write_version(),
                                                                 sstables::sstable::format_types::big);
 
                 newtab->set_unshared();
 
                 auto&& priority = service::get_local_streaming_write_priority();
-                return newtab->write_components(*old, incremental_backups_enabled(), priority, true).then([this, newtab, old, &smb] {
+                return newtab->write_components(*old, incremental_backups_enabled(), priority, true).then([this, newtab, old, &smb,
+                        placement = std::move(dir.second)] {
                     smb.sstables.emplace_back(newtab);
                 }).handle_exception([] (auto ep) {
                     dblog.error("failed to write streamed sstable: {}", ep);
@@ -792,41 +1049,79 @@ column_family::seal_active_memtable(memtable_list::flush_behavior ignored) {
         return make_ready_future<>();
     }
     _memtables->add_memtable();
+    ++_queued_memtable_flushes;
+    ++_config.cf_stats->memtables_queued_for_flush;
 
     assert(_highest_flushed_rp < old->replay_position()
     || (_highest_flushed_rp == db::replay_position() && old->replay_position() == db::replay_position())
     );
     _highest_flushed_rp = old->replay_position();
 
-    return _flush_queue->run_cf_flush(old->replay_position(), [old, this] {
-      return _config.dirty_memory_manager->serialize_flush([this, old] {
-        return repeat([this, old] {
-            return with_lock(_sstables_lock.for_read(), [this, old] {
-                _flush_queue->check_open_gate();
-                return try_flush_memtable_to_sstable(old);
+    // run_cf_flush() may throw, the memtable must leave the queue anyway.
+    return futurize_apply([this, old] {
+        return _flush_queue->run_cf_flush(old->replay_position(), [old, this] {
+          auto flush = [this, old] {
+            auto& mgr = *_config.dirty_memory_manager;
+            return mgr.get_flush_permit(old->occupancy().total_space(), old->replay_position()).then([this, old] (flush_permit permit) {
+              return do_with(std::move(permit), [this, old] (flush_permit& permit) {
+                return repeat([this, old, &permit] {
+                  return with_lock(_sstables_lock.for_read(), [this, old, &permit] {
+                      _flush_queue->check_open_gate();
+                      return try_flush_memtable_to_sstable(old, permit);
+                  });
+                });
+              });
             });
+          };
+          auto f = _flush_concurrency_sem ? with_semaphore(*_flush_concurrency_sem, 1, std::move(flush)) : flush();
+          return f.then([this] {
+            // Index tables have no commitlog of their own, their entries must
+            // be on disk before the commitlog segments they came from go away.
+            return flush_indexes();
+          });
+        }, [old, this] {
+            if (_commitlog) {
+                _commitlog->discard_completed_segments(_schema->id(), old->replay_position());
+            }
         });
-      });
-    }, [old, this] {
-        if (_commitlog) {
-            _commitlog->discard_completed_segments(_schema->id(), old->replay_position());
-        }
+    }).finally([this] {
+        memtable_flush_done();
     });
     // FIXME: release commit log
-    // FIXME: provide back-pressure to upper layers
+}
+
+void column_family::memtable_flush_done() {
+    --_queued_memtable_flushes;
+    --_config.cf_stats->memtables_queued_for_flush;
+    if (_queued_memtable_flushes < _config.memtable_flush_queue_size || !_config.memtable_flush_queue_size) {
+        _config.cf_stats->writes_waiting_for_flush_queue -= _flush_queue_waiters.size();
+        for (auto&& pr : std::exchange(_flush_queue_waiters, std::vector<promise<>>())) {
+            pr.set_value();
+        }
+    }
+}
+
+future<> column_family::wait_for_flush_queue() {
+    if (!_config.memtable_flush_queue_size || _queued_memtable_flushes < _config.memtable_flush_queue_size) {
+        return make_ready_future<>();
+    }
+    ++_config.cf_stats->writes_blocked_by_flush_queue;
+    ++_config.cf_stats->writes_waiting_for_flush_queue;
+    _flush_queue_waiters.emplace_back();
+    return _flush_queue_waiters.back().get_future();
 }
 
 future<stop_iteration>
-column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
+column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old, flush_permit& permit) {
     auto gen = calculate_generation_for_new_table();
+    auto memtable_size = old->occupancy().total_space();
+    auto dir = new_sstable_directory(memtable_size);
 
     auto newtab = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(),
-        _config.datadir, gen,
-        sstables::sstable::version_types::ka,
+        dir.first, gen,
+        sstable_write_version(),
         sstables::sstable::format_types::big);
 
-    auto memtable_size = old->occupancy().total_space();
-
     _config.cf_stats->pending_memtables_flushes_count++;
     _config.cf_stats->pending_memtables_flushes_bytes += memtable_size;
     newtab->set_unshared();
@@ -843,9 +1138,9 @@ column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
     // The code as is guarantees that we'll never partially backup a
     // single sstable, so that is enough of a guarantee.
     auto&& priority = service::get_local_memtable_flush_priority();
-    return newtab->write_components(*old, incremental_backups_enabled(), priority).then([this, newtab, old] {
+    return newtab->write_components(*old, incremental_backups_enabled(), priority).then([this, newtab, old, placement = std::move(dir.second)] {
         return newtab->open_data();
-    }).then_wrapped([this, old, newtab, memtable_size] (future<> ret) {
+    }).then_wrapped([this, old, newtab, memtable_size, &permit] (future<> ret) {
         _config.cf_stats->pending_memtables_flushes_count--;
         _config.cf_stats->pending_memtables_flushes_bytes -= memtable_size;
         dblog.debug("Flushing to {} done", newtab->get_filename());
@@ -857,9 +1152,14 @@ column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
             auto old_sstables = _sstables;
             add_sstable(newtab);
             old->mark_flushed(newtab);
+            _stats.bytes_flushed += newtab->data_size();
 
             trigger_compaction();
 
+            // The memtable is on disk, let the next flush write while this one
+            // is being moved into cache.
+            permit.release();
+
             return update_cache(*old, newtab).then_wrapped([this, newtab, old] (future<> f) {
                 try {
                     f.get();
@@ -875,6 +1175,8 @@ column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
         } catch (...) {
             dblog.error("failed to write sstable {}: {}", newtab->get_filename(), std::current_exception());
         }
+        // The retry will release the memory again as it writes.
+        old->revert_flushed_memory();
         return sleep(10s).then([] {
             return make_ready_future<stop_iteration>(stop_iteration::no);
         });
@@ -885,17 +1187,32 @@ void
 column_family::start() {
     // FIXME: add option to disable automatic compaction.
     start_compaction();
+    arm_expired_data_sweep();
 }
 
 future<>
 column_family::stop() {
     _memtables->seal_active_memtable(memtable_list::flush_behavior::immediate);
     _streaming_memtables->seal_active_memtable(memtable_list::flush_behavior::immediate);
-    return _compaction_manager.remove(this).then([this] {
+    _expired_data_sweep_timer.cancel();
+    return abort_streaming_writers().then([this] {
+        return _expired_data_sweep_gate.close();
+    }).then([this] {
+        return _compaction_manager.remove(this);
+    }).then([this] {
         // Nest, instead of using when_all, so we don't lose any exceptions.
         return _flush_queue->close().then([this] {
             return _streaming_flush_gate.close();
         });
+    }).then([this] {
+        return _index_gate.close();
+    }).then([this] {
+        return _view_build_gate.close();
+    }).then([this] {
+        return parallel_for_each(_indexes | boost::adaptors::map_values, [] (lw_shared_ptr<local_index> idx) {
+            idx->ready = false;
+            return idx->cf->stop();
+        });
     }).then([this] {
         return _sstable_deletion_gate.close();
     });
@@ -1033,39 +1350,48 @@ column_family::rebuild_sstable_list(const std::vector<sstables::shared_sstable>&
     // to avoid a new compaction from ignoring data in the old sstables
     // if the deletion fails (note deletion of shared sstables can take
     // unbounded time, because all shards must agree on the deletion).
-    auto current_sstables = _sstables;
-    auto new_sstable_list = _compaction_strategy.make_sstable_set(_schema);
+    //
+    // Copying the set is cheap, its copies share the sstable index, so update
+    // a copy of the current set rather than building a new one from scratch.
+    auto new_sstable_list = make_lw_shared(*_sstables);
     auto new_compacted_but_not_deleted = _sstables_compacted_but_not_deleted;
 
 
     std::unordered_set<sstables::shared_sstable> s(
            sstables_to_remove.begin(), sstables_to_remove.end());
 
-    // First, add the new sstables.
-
-    // this might seem dangerous, but "move" here just avoids constness,
-    // making the two ranges compatible when compiling with boost 1.55.
-    // Noone is actually moving anything...
-    for (auto&& tab : boost::range::join(new_sstables, std::move(*current_sstables->all()))) {
-        // Checks if oldtab is a sstable not being compacted.
+    // First, add the new sstables. The ones which were opened early are
+    // already in the list.
+    for (auto&& tab : new_sstables) {
         if (!s.count(tab)) {
-            new_sstable_list.insert(tab);
+            if (!new_sstable_list->all()->count(tab)) {
+                new_sstable_list->insert(tab);
+            }
         } else {
             new_compacted_but_not_deleted.push_back(tab);
         }
     }
-    _sstables = make_lw_shared(std::move(new_sstable_list));
+    // Then remove the compacted ones which are still in the list.
+    for (auto&& tab : s) {
+        if (_sstables->all()->count(tab)) {
+            new_sstable_list->erase(tab);
+            new_compacted_but_not_deleted.push_back(tab);
+        }
+    }
+    _sstables = std::move(new_sstable_list);
     _sstables_compacted_but_not_deleted = std::move(new_compacted_but_not_deleted);
 
     rebuild_statistics();
 
     // Second, delete the old sstables.  This is done in the background, so we can
     // consider this compaction completed.
-    seastar::with_gate(_sstable_deletion_gate, [this, sstables_to_remove] {
-        return sstables::delete_atomically(sstables_to_remove).then([this, sstables_to_remove] {
-            auto current_sstables = _sstables;
-            auto new_sstable_list = make_lw_shared<sstable_list>();
+    delete_compacted_sstables(sstables_to_remove);
+}
 
+void
+column_family::delete_compacted_sstables(std::vector<sstables::shared_sstable> sstables_to_remove) {
+    seastar::with_gate(_sstable_deletion_gate, [this, sstables_to_remove = std::move(sstables_to_remove)] {
+        return sstables::delete_atomically(sstables_to_remove).then([this, sstables_to_remove] {
             std::unordered_set<sstables::shared_sstable> s(
                    sstables_to_remove.begin(), sstables_to_remove.end());
             auto e = boost::range::remove_if(_sstables_compacted_but_not_deleted, [&] (sstables::shared_sstable sst) -> bool {
@@ -1093,23 +1419,129 @@ column_family::compact_sstables(sstables::compaction_descriptor descriptor, bool
     return with_lock(_sstables_lock.for_read(), [this, descriptor = std::move(descriptor), cleanup] {
         auto sstables_to_compact = make_lw_shared<std::vector<sstables::shared_sstable>>(std::move(descriptor.sstables));
 
-        auto create_sstable = [this] {
+        uint64_t input_size = 0;
+        for (auto& sst : *sstables_to_compact) {
+            input_size += sst->data_size();
+        }
+        auto output_size = std::min(input_size, descriptor.max_sstable_bytes);
+        // Writes to the output sstables are accounted to their directories
+        // until the compaction is done and the creator is destroyed.
+        auto placements = make_lw_shared<std::vector<db::data_placement::permit>>();
+        auto create_sstable = [this, output_size, placements] {
                 auto gen = this->calculate_generation_for_new_table();
+                auto dir = this->new_sstable_directory(output_size);
+                placements->push_back(std::move(dir.second));
                 // FIXME: use "tmp" marker in names of incomplete sstable
-                auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), _config.datadir, gen,
-                        sstables::sstable::version_types::ka,
+                auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), dir.first, gen,
+                        this->sstable_write_version(),
                         sstables::sstable::format_types::big);
                 sst->set_unshared();
                 return sst;
         };
-        return sstables::compact_sstables(*sstables_to_compact, *this, create_sstable, descriptor.max_sstable_bytes, descriptor.level,
-                cleanup).then([this, sstables_to_compact] (auto new_sstables) {
-            return this->rebuild_sstable_list(new_sstables, *sstables_to_compact);
+        auto ranges = sstables::split_for_compaction(*_schema, *sstables_to_compact, descriptor.sub_ranges);
+        if (ranges.size() == 1) {
+            // Output is only opened early if it's split into bounded size
+            // sstables, a single sstable would only be opened at the end.
+            auto early_open_interval = uint64_t(0);
+            if (!cleanup && descriptor.max_sstable_bytes != std::numeric_limits<uint64_t>::max()) {
+                early_open_interval = _config.sstable_preemptive_open_interval;
+            }
+            return sstables::compact_sstables(*sstables_to_compact, *this, create_sstable, descriptor.max_sstable_bytes, descriptor.level,
+                    cleanup, descriptor.range, early_open_interval).then([this, sstables_to_compact] (auto new_sstables) {
+                // Those released by open_early() are being deleted already.
+                auto e = boost::range::remove_if(*sstables_to_compact, [this] (const sstables::shared_sstable& sst) {
+                    return !_sstables->all()->count(sst);
+                });
+                sstables_to_compact->erase(e, sstables_to_compact->end());
+                this->rebuild_sstable_list(new_sstables, *sstables_to_compact);
+                _compaction_manager.deregister_compacting_sstables(new_sstables);
+            });
+        }
+        // The sub-range compactions write disjoint sstables, which replace
+        // the compacted ones together once all of them are done.
+        auto new_sstables = make_lw_shared<std::vector<sstables::shared_sstable>>();
+        auto max_sstable_bytes = descriptor.max_sstable_bytes;
+        auto level = descriptor.level;
+        return do_with(std::move(ranges), [this, sstables_to_compact, create_sstable, max_sstable_bytes, level, cleanup, new_sstables] (auto& ranges) {
+            return parallel_for_each(ranges, [this, sstables_to_compact, create_sstable, max_sstable_bytes, level, cleanup, new_sstables] (auto& range) {
+                return sstables::compact_sstables(*sstables_to_compact, *this, create_sstable, max_sstable_bytes, level,
+                        cleanup, range).then([new_sstables] (auto sstables) {
+                    new_sstables->insert(new_sstables->end(), sstables.begin(), sstables.end());
+                });
+            });
+        }).then_wrapped([this, sstables_to_compact, new_sstables] (future<> f) {
+            try {
+                f.get();
+            } catch (...) {
+                // Sub-ranges which were compacted before another one failed
+                // left sstables which nothing uses.
+                for (auto& sst : *new_sstables) {
+                    sst->mark_for_deletion();
+                }
+                throw;
+            }
+            this->rebuild_sstable_list(*new_sstables, *sstables_to_compact);
         });
     });
 }
 
-static bool needs_cleanup(const lw_shared_ptr<sstables::sstable>& sst,
+std::vector<sstables::shared_sstable>
+column_family::open_early(const std::vector<sstables::shared_sstable>& new_sstables,
+                          const std::vector<sstables::shared_sstable>& compacting) {
+    // The new sstables hold everything the compacted ones have up to the
+    // last key written, so from now on only the rest is read from those.
+    auto last = new_sstables.back()->get_last_decorated_key(*_schema);
+    auto new_sstable_list = make_lw_shared(*_sstables);
+    for (auto&& tab : new_sstables) {
+        new_sstable_list->insert(tab);
+    }
+    std::vector<sstables::shared_sstable> released;
+    for (auto&& tab : compacting) {
+        if (!_sstables->all()->count(tab)) {
+            continue;
+        }
+        if (tab->get_last_decorated_key(*_schema).tri_compare(*_schema, last) <= 0) {
+            new_sstable_list->erase(tab);
+            _sstables_compacted_but_not_deleted.push_back(tab);
+            released.push_back(tab);
+        } else {
+            new_sstable_list->set_read_start(tab, last);
+        }
+    }
+    // They are still being written to by the compaction as a whole, don't
+    // let another one pick them up.
+    _compaction_manager.register_compacting_sstables(new_sstables);
+    _sstables = std::move(new_sstable_list);
+    rebuild_statistics();
+    dblog.debug("Opened {} sstables of compaction of {}.{} early, up to {}, releasing {} compacted sstables", new_sstables.size(),
+            _schema->ks_name(), _schema->cf_name(), last, released.size());
+    if (!released.empty()) {
+        delete_compacted_sstables(released);
+    }
+    return released;
+}
+
+void
+column_family::revert_early_open(const std::vector<sstables::shared_sstable>& new_sstables,
+                                 const std::vector<sstables::shared_sstable>& compacting) {
+    auto new_sstable_list = make_lw_shared(*_sstables);
+    for (auto&& tab : new_sstables) {
+        if (_sstables->all()->count(tab)) {
+            new_sstable_list->erase(tab);
+        }
+    }
+    for (auto&& tab : compacting) {
+        new_sstable_list->clear_read_start(tab);
+    }
+    _compaction_manager.deregister_compacting_sstables(new_sstables);
+    _sstables = std::move(new_sstable_list);
+    rebuild_statistics();
+}
+
+// How much of an sstable's data belongs to the token ranges owned by this node.
+enum class sstable_ownership { full, partial, none };
+
+static sstable_ownership get_sstable_ownership(const lw_shared_ptr<sstables::sstable>& sst,
                    const lw_shared_ptr<std::vector<range<dht::token>>>& owned_ranges,
                    schema_ptr s) {
     auto first = sst->get_first_partition_key(*s);
@@ -1118,27 +1550,50 @@ static bool needs_cleanup(const lw_shared_ptr<sstables::sstable>& sst,
     auto last_token = dht::global_partitioner().get_token(*s, last);
     range<dht::token> sst_token_range = range<dht::token>::make(first_token, last_token);
 
-    // return true iff sst partition range isn't fully contained in any of the owned ranges.
+    // full iff sst partition range is fully contained in one of the owned ranges,
+    // none iff it overlaps none of them.
+    auto ownership = sstable_ownership::none;
     for (auto& r : *owned_ranges) {
         if (r.contains(sst_token_range, dht::token_comparator())) {
-            return false;
+            return sstable_ownership::full;
+        }
+        if (r.overlaps(sst_token_range, dht::token_comparator())) {
+            ownership = sstable_ownership::partial;
         }
     }
-    return true;
+    return ownership;
 }
 
 future<> column_family::cleanup_sstables(sstables::compaction_descriptor descriptor) {
     std::vector<range<dht::token>> r = service::get_local_storage_service().get_local_ranges(_schema->ks_name());
     auto owned_ranges = make_lw_shared<std::vector<range<dht::token>>>(std::move(r));
-    auto sstables_to_cleanup = make_lw_shared<std::vector<sstables::shared_sstable>>(std::move(descriptor.sstables));
-
-    return parallel_for_each(*sstables_to_cleanup, [this, owned_ranges = std::move(owned_ranges), sstables_to_cleanup] (auto& sst) {
-        if (!owned_ranges->empty() && !needs_cleanup(sst, owned_ranges, _schema)) {
-           return make_ready_future<>();
+    auto sstables_to_cleanup = make_lw_shared<std::vector<sstables::shared_sstable>>();
+    std::vector<sstables::shared_sstable> unowned;
+
+    // Only sstables which straddle the boundary of the owned ranges have to
+    // be rewritten, those with no owned data at all are dropped unread.
+    for (auto& sst : descriptor.sstables) {
+        auto ownership = owned_ranges->empty() ? sstable_ownership::partial : get_sstable_ownership(sst, owned_ranges, _schema);
+        if (ownership == sstable_ownership::partial) {
+            sstables_to_cleanup->push_back(sst);
+        } else if (ownership == sstable_ownership::none) {
+            unowned.push_back(sst);
         }
+    }
 
-        std::vector<sstables::shared_sstable> sstable_to_compact({ sst });
-        return this->compact_sstables(sstables::compaction_descriptor(std::move(sstable_to_compact), sst->get_sstable_level()), true);
+    auto f = make_ready_future<>();
+    if (!unowned.empty()) {
+        f = with_lock(_sstables_lock.for_read(), [this, unowned = std::move(unowned)] {
+            dblog.info("Dropping {} sstables of {}.{} which hold no data owned by this node", unowned.size(),
+                    _schema->ks_name(), _schema->cf_name());
+            this->rebuild_sstable_list({}, unowned);
+        });
+    }
+    return f.then([this, sstables_to_cleanup] {
+        return parallel_for_each(*sstables_to_cleanup, [this, sstables_to_cleanup] (auto& sst) {
+            std::vector<sstables::shared_sstable> sstable_to_compact({ sst });
+            return this->compact_sstables(sstables::compaction_descriptor(std::move(sstable_to_compact), sst->get_sstable_level()), true);
+        });
     });
 }
 
@@ -1149,7 +1604,9 @@ column_family::load_new_sstables(std::vector<sstables::entry_descriptor> new_tab
                 _schema->ks_name(), _schema->cf_name(), _config.datadir,
                 comps.generation, comps.version, comps.format), true);
     }).then([this] {
+        // The rewrites run in the background.
         start_rewrite();
+        invalidate_cached_results();
         // Drop entire cache for this column family because it may be populated
         // with stale data.
         return get_row_cache().clear();
@@ -1160,14 +1617,24 @@ column_family::load_new_sstables(std::vector<sstables::entry_descriptor> new_tab
 // Note: We assume that the column_family does not get destroyed during compaction.
 future<>
 column_family::compact_all_sstables() {
-    std::vector<sstables::shared_sstable> sstables;
-    sstables.reserve(_sstables->all()->size());
+    std::vector<sstables::shared_sstable> unrepaired;
+    std::vector<sstables::shared_sstable> repaired;
     for (auto&& sst : *_sstables->all()) {
-        sstables.push_back(sst);
+        (sst->is_repaired() ? repaired : unrepaired).push_back(sst);
     }
     // FIXME: check if the lower bound min_compaction_threshold() from schema
     // should be taken into account before proceeding with compaction.
-    return compact_sstables(sstables::compaction_descriptor(std::move(sstables)));
+    auto compact = [this] (std::vector<sstables::shared_sstable> sstables) {
+        if (sstables.empty()) {
+            return make_ready_future<>();
+        }
+        auto descriptor = sstables::compaction_descriptor(std::move(sstables), 0, compaction_fragment_size());
+        descriptor.sub_ranges = _config.major_compaction_sub_ranges;
+        return compact_sstables(std::move(descriptor));
+    };
+    return compact(std::move(unrepaired)).then([compact, repaired = std::move(repaired)] () mutable {
+        return compact(std::move(repaired));
+    });
 }
 
 void column_family::start_compaction() {
@@ -1202,6 +1669,23 @@ void column_family::set_compaction_strategy(sstables::compaction_strategy_type s
     _sstables = std::move(new_sstables);
 }
 
+bool column_family::start_top_partitions_sampling(size_t capacity) {
+    if (_top_partitions) {
+        return false;
+    }
+    _top_partitions = std::make_unique<db::top_partitions_sampler>(_schema, capacity);
+    return true;
+}
+
+db::top_partitions_sampler::results column_family::stop_top_partitions_sampling() {
+    if (!_top_partitions) {
+        return { };
+    }
+    auto res = _top_partitions->get_results();
+    _top_partitions.reset();
+    return res;
+}
+
 size_t column_family::sstables_count() const {
     return _sstables->all()->size();
 }
@@ -1363,6 +1847,7 @@ future<> column_family::populate(sstring sstdir) {
     }).then([this] {
         // Make sure this is called even if CF is empty
         mark_ready_for_writes();
+        return update_indexes();
     });
 }
 
@@ -1393,15 +1878,94 @@ database::database(const db::config& cfg)
     , _system_dirty_memory_manager(*this, _memtable_total_space + (10 << 20))
     , _dirty_memory_manager(*this, &_system_dirty_memory_manager, _memtable_total_space)
     , _streaming_dirty_memory_manager(*this, &_dirty_memory_manager, _streaming_memtable_total_space)
+    // Wide partition scans hold big buffers for long, admit as many reads
+    // as their buffers fit in 4% of memory.
+    , _max_memory_for_reads(memory::stats().total_memory() * 0.04)
+    , _read_memory_sem(_max_memory_for_reads)
+    , _counter_write_sem(std::max<size_t>(_cfg->concurrent_counter_writes() / smp::count, 1))
     , _version(empty_version)
     , _enable_incremental_backups(cfg.incremental_backups())
 {
     _compaction_manager.start();
+    _compaction_manager.start_throughput_controller((uint64_t(_cfg->compaction_throughput_mb_per_sec()) << 20) / smp::count,
+            std::chrono::milliseconds(_cfg->compaction_read_latency_target_ms()), [this] {
+        compaction_manager::controller_input input;
+        for (auto& cf : _column_families | boost::adaptors::map_values) {
+            input.backlog += cf->get_compaction_strategy().estimated_pending_compactions(*cf);
+            auto& reads = cf->get_stats().reads.hist;
+            input.reads += reads.total;
+            input.read_latency_sum += reads.sum;
+        }
+        return input;
+    });
+    sstables::global_key_cache().set_capacity((size_t(_cfg->key_cache_size_in_mb()) << 20) / smp::count);
+    sstables::global_chunk_cache().set_capacity((size_t(_cfg->file_cache_size_in_mb()) << 20) / smp::count);
+    sstables::global_filter_cache().set_capacity((size_t(_cfg->sstable_filter_memory_in_mb()) << 20) / smp::count);
+    db::global_counter_cache().set_capacity((size_t(_cfg->counter_cache_size_in_mb()) << 20) / smp::count);
+    db::global_query_result_cache().set_capacity((size_t(_cfg->query_result_cache_size_in_mb()) << 20) / smp::count);
+    _index_summary_manager.start((size_t(_cfg->index_summary_capacity_in_mb()) << 20) / smp::count,
+            std::chrono::minutes(_cfg->index_summary_resize_interval_in_minutes()), [this] {
+        std::vector<sstables::index_summary_manager::candidate> candidates;
+        for (auto& cf : _column_families | boost::adaptors::map_values) {
+            for (auto& sst : *cf->get_sstables()) {
+                candidates.push_back({sst, cf->schema()->max_index_interval()});
+            }
+        }
+        return candidates;
+    });
+    sstables::set_filter_layout(_cfg->enable_blocked_bloom_filter() ? utils::filter_layout::blocked : utils::filter_layout::classic);
+    sstables::set_trickle_fsync_interval(_cfg->trickle_fsync() ? size_t(_cfg->trickle_fsync_interval_in_kb()) << 10 : 0);
+    sstables::set_large_partition_handler(uint64_t(_cfg->compaction_large_partition_warning_threshold_mb()) << 20,
+            [this] (const sstables::sstable& sst, const schema& s, const sstables::key& k, uint64_t size, uint64_t rows) {
+        on_large_partition(sst, s, k, size, rows);
+    });
+    start_memory_balancer();
     setup_collectd();
 
     dblog.info("Row: max_vector_size: {}, internal_count: {}", size_t(row::max_vector_size), size_t(row::internal_count));
 }
 
+void database::start_memory_balancer() {
+    memory_balancer::config cfg;
+    cfg.interval = std::chrono::milliseconds(_cfg->memory_balancing_interval_in_ms());
+    cfg.cache_reserve_share = std::min(std::max(_cfg->row_cache_reserve_share(), 0.0), 1.0);
+    // Long enough to write a memtable out, so that writes are not throttled while it's flushed.
+    cfg.flush_window = std::chrono::seconds(10);
+    cfg.min_dirty = _memtable_total_space / 4;
+    cfg.max_dirty = _memtable_total_space;
+    _memory_balancer.start(cfg, [this] {
+        auto& tracker = global_cache_tracker();
+        memory_balancer::input in;
+        in.cache_hits = tracker.hits();
+        in.cache_misses = tracker.misses();
+        in.bytes_written = _stats->total_bytes_written;
+        in.cache_used = tracker.region().occupancy().total_space();
+        in.dirty_used = _dirty_memory_manager.region_group().memory_used();
+        auto total = memory::stats().total_memory();
+        auto lsa = logalloc::shard_tracker().occupancy().total_space();
+        auto standard = memory::stats().allocated_memory() - std::min(memory::stats().allocated_memory(), lsa);
+        // Leave some room for standard allocations to grow.
+        in.lsa_memory = total - std::min(total, standard + total / 10);
+        return in;
+    }, memory_balancer::actuators{
+        [this] (size_t dirty_target) {
+            _dirty_memory_manager.set_soft_limit(dirty_target);
+        },
+        [] (size_t bytes) {
+            return global_cache_tracker().evict(bytes);
+        },
+    });
+}
+
+replica_load database::get_load() const {
+    replica_load load;
+    auto dirty = dirty_memory_region_group().memory_used() * 100 / std::max<size_t>(_dirty_memory_manager.throttle_threshold(), 1);
+    load.dirty_percent = std::min<size_t>(dirty, std::numeric_limits<uint8_t>::max());
+    load.read_queue_length = _read_concurrency_sem.waiters() + _read_memory_sem.waiters();
+    load.pending_compactions = _compaction_manager.get_stats().pending_tasks;
+    return load;
+}
+
 void
 database::setup_collectd() {
     _collectd.push_back(
@@ -1412,6 +1976,38 @@ database::setup_collectd() {
             return dirty_memory_region_group().memory_used();
     })));
 
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "dirty_target")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _memory_balancer.get_targets().dirty;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "cache")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [] {
+            return global_cache_tracker().region().occupancy().total_space();
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "cache_target")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _memory_balancer.get_targets().cache;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "balancer_evicted")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            return _memory_balancer.get_stats().evicted_bytes;
+    })));
+
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("memtables"
                 , scollectd::per_cpu_plugin_instance
@@ -1427,65 +2023,177 @@ database::setup_collectd() {
     ));
 
     _collectd.push_back(
-        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtables"
                 , scollectd::per_cpu_plugin_instance
-                , "total_operations", "total_writes")
-                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats->total_writes)
+                , "queue_length", "queued_flushes")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _cf_stats.memtables_queued_for_flush)
+    ));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtables"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "writes_waiting_for_flush_queue")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _cf_stats.writes_waiting_for_flush_queue)
+    ));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "writes_blocked_by_flush_queue")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.writes_blocked_by_flush_queue)
     ));
 
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "total_operations", "total_reads")
-                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats->total_reads)
+                , "queue_length", "pending_sstable_loads")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _cf_stats.pending_sstable_loads)
     ));
 
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "total_operations", "sstable_read_queue_overloads")
-                , scollectd::make_typed(scollectd::data_type::COUNTER, _stats->sstable_read_queue_overloaded)
+                , "total_operations", "sstables_loaded")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.sstables_loaded)
     ));
 
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "queue_length", "active_reads")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return max_concurrent_reads() - _read_concurrency_sem.current(); })
+                , "total_operations", "sstable_point_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.sstable_point_reads)
     ));
+
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "queue_length", "queued_reads")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _read_concurrency_sem.waiters(); })
+                , "total_operations", "point_read_sstables_checked")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.sstables_checked)
     ));
+
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "queue_length", "active_reads_system_keyspace")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return max_system_concurrent_reads() - _system_read_concurrency_sem.current(); })
+                , "total_operations", "point_read_sstables_read")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.sstables_read)
     ));
+
     _collectd.push_back(
         scollectd::add_polled_metric(scollectd::type_instance_id("database"
                 , scollectd::per_cpu_plugin_instance
-                , "queue_length", "queued_reads_system_keyspace")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _system_read_concurrency_sem.waiters(); })
+                , "total_operations", "point_read_filter_false_positives")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.filter_false_positives)
     ));
-}
 
-database::~database() {
-}
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "point_read_index_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.index_reads)
+    ));
 
-void database::update_version(const utils::UUID& version) {
-    _version = version;
-}
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "point_read_data_bytes")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _cf_stats.data_bytes_read)
+    ));
 
-const utils::UUID& database::get_version() const {
-    return _version;
-}
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "total_writes")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats->total_writes)
+    ));
 
-future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
-    auto ksdir = datadir + "/" + ks_name;
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "total_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats->total_reads)
+    ));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "sstable_read_queue_overloads")
+                , scollectd::make_typed(scollectd::data_type::COUNTER, _stats->sstable_read_queue_overloaded)
+    ));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "expired_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats->expired_reads)
+    ));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "active_reads")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return max_concurrent_reads() - _read_concurrency_sem.current(); })
+    ));
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "queued_reads")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _read_concurrency_sem.waiters(); })
+    ));
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "active_reads_memory")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _max_memory_for_reads - _read_memory_sem.current(); })
+    ));
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "reads_queued_for_memory")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _read_memory_sem.waiters(); })
+    ));
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "active_reads_system_keyspace")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return max_system_concurrent_reads() - _system_read_concurrency_sem.current(); })
+    ));
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "queued_reads_system_keyspace")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _system_read_concurrency_sem.waiters(); })
+    ));
+}
+
+database::~database() {
+    sstables::set_large_partition_handler(0, {});
+}
+
+void database::on_large_partition(const sstables::sstable& sst, const schema& s, const sstables::key& k, uint64_t size, uint64_t rows) {
+    auto key = db::key_to_string(s, k.to_partition_key(s));
+    dblog.warn("Writing large partition {}.{}:{} ({} bytes, {} rows) to {}", s.ks_name(), s.cf_name(), key, size, rows, sst.get_filename());
+    // Partitions of the system tables are only logged, recording them could
+    // in turn create large partitions of system.large_partitions.
+    if (s.ks_name() == db::system_keyspace::NAME || _large_partitions_gate.is_closed()) {
+        return;
+    }
+    with_gate(_large_partitions_gate, [&s, &sst, key = std::move(key), size, rows] () mutable {
+        return db::system_keyspace::record_large_partition(s.ks_name(), s.cf_name(), sst.get_filename(), std::move(key), size, rows);
+    }).handle_exception([] (std::exception_ptr ep) {
+        dblog.warn("Failed to record large partition: {}", ep);
+    });
+}
+
+void database::update_version(const utils::UUID& version) {
+    _version = version;
+}
+
+const utils::UUID& database::get_version() const {
+    return _version;
+}
+
+future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
+    auto ksdir = datadir + "/" + ks_name;
     auto i = _keyspaces.find(ks_name);
     if (i == _keyspaces.end()) {
         dblog.warn("Skipping undefined keyspace: {}", ks_name);
@@ -1494,11 +2202,11 @@ future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
         dblog.info("Populating Keyspace {}", ks_name);
         auto& ks = i->second;
         return parallel_for_each(ks.metadata()->cf_meta_data() | boost::adaptors::map_values,
-            [ks_name, &ks, this] (schema_ptr s) {
+            [ks_name, ksdir, &ks, this] (schema_ptr s) {
                 utils::UUID uuid = s->id();
                 lw_shared_ptr<column_family> cf = _column_families[uuid];
                 sstring cfname = cf->schema()->cf_name();
-                auto sstdir = ks.column_family_directory(cfname, uuid);
+                auto sstdir = keyspace::column_family_directory(ksdir, cfname, uuid);
                 dblog.info("Keyspace {}: Reading CF {} ", ks_name, cfname);
                 return ks.make_directory_for_column_family(cfname, uuid).then([cf, sstdir] {
                     return cf->populate(sstdir);
@@ -1515,12 +2223,19 @@ future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
 }
 
 future<> database::populate(sstring datadir) {
-    return lister::scan_dir(datadir, { directory_entry_type::directory }, [this, datadir] (directory_entry de) {
-        auto& ks_name = de.name;
-        if (ks_name == "system") {
+    // Keyspaces are loaded in parallel, the number of sstables loaded at
+    // a time is bounded by _sstable_load_sem.
+    return do_with(std::vector<sstring>(), [this, datadir] (std::vector<sstring>& ks_names) {
+        return lister::scan_dir(datadir, { directory_entry_type::directory }, [&ks_names] (directory_entry de) {
+            if (de.name != "system") {
+                ks_names.push_back(de.name);
+            }
             return make_ready_future<>();
-        }
-        return populate_keyspace(datadir, ks_name);
+        }).then([this, datadir, &ks_names] {
+            return parallel_for_each(ks_names, [this, datadir] (const sstring& ks_name) {
+                return populate_keyspace(datadir, ks_name);
+            });
+        });
     });
 }
 
@@ -1593,13 +2308,17 @@ future<> database::parse_system_tables(distributed<service::storage_proxy>& prox
 future<>
 database::init_system_keyspace() {
     bool durable = _cfg->data_file_directories().size() > 0;
+    if (durable) {
+        _data_placement = std::make_unique<db::data_placement>(_cfg->data_file_directories());
+    }
     db::system_keyspace::make(*this, durable, _cfg->volatile_system_keyspace_for_testing());
 
-    // FIXME support multiple directories
-    return io_check(touch_directory, _cfg->data_file_directories()[0] + "/" + db::system_keyspace::NAME).then([this] {
-        return populate_keyspace(_cfg->data_file_directories()[0], db::system_keyspace::NAME).then([this]() {
-            return init_commitlog();
+    return do_for_each(_cfg->data_file_directories(), [this] (const sstring& datadir) {
+        return io_check(touch_directory, datadir + "/" + db::system_keyspace::NAME).then([this, datadir] {
+            return populate_keyspace(datadir, db::system_keyspace::NAME);
         });
+    }).then([this] {
+        return init_commitlog();
     }).then([this] {
         auto& ks = find_keyspace(db::system_keyspace::NAME);
         return parallel_for_each(ks.metadata()->cf_meta_data(), [this] (auto& pair) {
@@ -1614,22 +2333,81 @@ database::init_system_keyspace() {
 future<>
 database::load_sstables(distributed<service::storage_proxy>& proxy) {
 	return parse_system_tables(proxy).then([this] {
-		return populate(_cfg->data_file_directories()[0]);
+		return do_for_each(_cfg->data_file_directories(), [this] (const sstring& datadir) {
+			return populate(datadir);
+		});
 	});
 }
 
 future<>
 database::init_commitlog() {
-    return db::commitlog::create_commitlog(*_cfg).then([this](db::commitlog&& log) {
-        _commitlog = std::make_unique<db::commitlog>(std::move(log));
-        _commitlog->add_flush_handler([this](db::cf_id_type id, db::replay_position pos) {
-            if (_column_families.count(id) == 0) {
-                // the CF has been removed.
-                _commitlog->discard_completed_segments(id, pos);
-                return;
-            }
-            _column_families[id]->flush(pos);
-        }).release(); // we have longer life time than CL. Ignore reg anchor
+    auto make_commitlog = [this] (db::commitlog::config cfg) {
+        return db::commitlog::create_commitlog(std::move(cfg)).then([this](db::commitlog&& log) {
+            auto cl = std::make_unique<db::commitlog>(std::move(log));
+            cl->add_flush_handler([this, cl = cl.get()](db::cf_id_type id, db::replay_position pos) {
+                if (_column_families.count(id) == 0) {
+                    // the CF has been removed.
+                    cl->discard_completed_segments(id, pos);
+                    return;
+                }
+                _column_families[id]->flush(pos);
+            }).release(); // we have longer life time than CL. Ignore reg anchor
+            return cl;
+        });
+    };
+
+    std::vector<sstring> isolated;
+    sstring names = _cfg->commitlog_isolated_tables();
+    boost::split(isolated, names, boost::is_any_of(", "), boost::token_compress_on);
+    isolated.erase(boost::range::remove_if(isolated, [] (const sstring& name) { return name.empty(); }), isolated.end());
+
+    return make_commitlog(db::commitlog::config(*_cfg)).then([this, make_commitlog, isolated = std::move(isolated)] (auto cl) mutable {
+        _commitlog = std::move(cl);
+        return do_with(std::move(isolated), [this, make_commitlog] (std::vector<sstring>& isolated) {
+            return do_for_each(isolated, [this, make_commitlog] (const sstring& name) {
+                db::commitlog::config cfg(*_cfg);
+                cfg.commit_log_location = cfg.commit_log_location + "/" + name;
+                return io_check(recursive_touch_directory, cfg.commit_log_location).then([make_commitlog, cfg = std::move(cfg)] () mutable {
+                    return make_commitlog(std::move(cfg));
+                }).then([this, name] (auto cl) {
+                    dblog.info("Using isolated commitlog in {} for {}", cl->active_config().commit_log_location, name);
+                    _isolated_commitlogs[name] = std::move(cl);
+                });
+            });
+        });
+    });
+}
+
+db::commitlog*
+database::commitlog_for(const schema& s) const {
+    if (!_isolated_commitlogs.empty()) {
+        auto i = _isolated_commitlogs.find(s.ks_name() + "." + s.cf_name());
+        if (i == _isolated_commitlogs.end()) {
+            i = _isolated_commitlogs.find(s.ks_name());
+        }
+        if (i != _isolated_commitlogs.end()) {
+            return i->second.get();
+        }
+    }
+    return _commitlog.get();
+}
+
+std::vector<db::commitlog*>
+database::commitlogs() const {
+    std::vector<db::commitlog*> res;
+    if (_commitlog) {
+        res.push_back(_commitlog.get());
+    }
+    for (auto&& cl : _isolated_commitlogs | boost::adaptors::map_values) {
+        res.push_back(cl.get());
+    }
+    return res;
+}
+
+future<>
+database::shutdown_commitlogs() {
+    return parallel_for_each(commitlogs(), [] (db::commitlog* cl) {
+        return cl->shutdown();
     });
 }
 
@@ -1681,8 +2459,9 @@ void database::add_column_family(schema_ptr schema, column_family::config cfg) {
     schema->registry_entry()->mark_synced();
     auto uuid = schema->id();
     lw_shared_ptr<column_family> cf;
-    if (cfg.enable_commitlog && _commitlog) {
-       cf = make_lw_shared<column_family>(schema, std::move(cfg), *_commitlog, _compaction_manager);
+    auto cl = commitlog_for(*schema);
+    if (cfg.enable_commitlog && cl) {
+       cf = make_lw_shared<column_family>(schema, std::move(cfg), *cl, _compaction_manager);
     } else {
        cf = make_lw_shared<column_family>(schema, std::move(cfg), column_family::no_commitlog(), _compaction_manager);
     }
@@ -1700,6 +2479,24 @@ void database::add_column_family(schema_ptr schema, column_family::config cfg) {
     }
     ks->second.add_or_update_column_family(schema);
     cf->start();
+    if (_index_builds_enabled) {
+        cf->start_index_builds();
+    }
+    if (_view_builds_enabled) {
+        cf->start_view_builds();
+    }
+    if (schema->is_view()) {
+        if (column_family_exists(schema->view_info().base_id)) {
+            find_column_family(schema->view_info().base_id).add_or_update_view(schema);
+        }
+    } else {
+        // Views are loaded along with their base, in whichever order.
+        for (auto& v : ks->second.metadata()->views_of(uuid)) {
+            if (column_family_exists(v->id())) {
+                cf->add_or_update_view(find_column_family(v->id()).schema());
+            }
+        }
+    }
     _column_families.emplace(uuid, std::move(cf));
     _ks_cf_to_uuid.emplace(std::move(kscf), uuid);
 }
@@ -1708,6 +2505,10 @@ future<> database::drop_column_family(const sstring& ks_name, const sstring& cf_
     auto uuid = find_uuid(ks_name, cf_name);
     auto& ks = find_keyspace(ks_name);
     auto cf = _column_families.at(uuid);
+    auto s = cf->schema();
+    if (s->is_view() && column_family_exists(s->view_info().base_id)) {
+        find_column_family(s->view_info().base_id).remove_view(s);
+    }
     _column_families.erase(uuid);
     ks.metadata()->remove_column_family(cf->schema());
     _ks_cf_to_uuid.erase(std::make_pair(ks_name, cf_name));
@@ -1841,6 +2642,8 @@ column_family::config
 keyspace::make_column_family_config(const schema& s, const db::config& db_config) const {
     column_family::config cfg;
     cfg.datadir = column_family_directory(s.cf_name(), s.id());
+    cfg.all_datadirs = column_family_directories(s.cf_name(), s.id());
+    cfg.data_placement = _config.data_placement;
     cfg.enable_disk_reads = _config.enable_disk_reads;
     cfg.enable_disk_writes = _config.enable_disk_writes;
     cfg.enable_commitlog = _config.enable_commitlog;
@@ -1851,25 +2654,54 @@ keyspace::make_column_family_config(const schema& s, const db::config& db_config
     cfg.streaming_dirty_memory_manager = _config.streaming_dirty_memory_manager;
     cfg.read_concurrency_config = _config.read_concurrency_config;
     cfg.cf_stats = _config.cf_stats;
+    cfg.sstable_load_sem = _config.sstable_load_sem;
     cfg.enable_incremental_backups = _config.enable_incremental_backups;
     cfg.max_cached_partition_size_in_bytes = db_config.max_cached_partition_size_in_kb() * 1024;
+    cfg.major_compaction_sub_ranges = db_config.major_compaction_sub_ranges();
+    cfg.sstable_preemptive_open_interval = uint64_t(db_config.sstable_preemptive_open_interval_in_mb()) << 20;
+    cfg.compaction_fragment_size = uint64_t(db_config.compaction_fragment_size_in_mb()) << 20;
+    cfg.sstable_write_version = db_config.enable_sstables_compact_format()
+            ? sstables::sstable::version_types::sa : sstables::sstable::version_types::ka;
+    cfg.tombstone_warn_threshold = db_config.tombstone_warn_threshold();
+    cfg.tombstone_failure_threshold = db_config.tombstone_failure_threshold();
+    cfg.expired_data_sweep_period = std::chrono::seconds(db_config.expired_data_sweep_period_in_s());
+    cfg.memtable_flush_queue_size = db_config.memtable_flush_queue_size();
+    cfg.memtable_flush_concurrency = db_config.memtable_flush_concurrency_per_table();
 
     return cfg;
 }
 
 sstring
-keyspace::column_family_directory(const sstring& name, utils::UUID uuid) const {
+keyspace::column_family_directory(const sstring& ksdir, const sstring& name, utils::UUID uuid) {
     auto uuid_sstring = uuid.to_sstring();
     boost::erase_all(uuid_sstring, "-");
-    return sprint("%s/%s-%s", _config.datadir, name, uuid_sstring);
+    return sprint("%s/%s-%s", ksdir, name, uuid_sstring);
+}
+
+sstring
+keyspace::column_family_directory(const sstring& name, utils::UUID uuid) const {
+    return column_family_directory(_config.datadir, name, uuid);
+}
+
+std::vector<sstring>
+keyspace::column_family_directories(const sstring& name, utils::UUID uuid) const {
+    if (_config.all_datadirs.empty()) {
+        return { column_family_directory(name, uuid) };
+    }
+    return boost::copy_range<std::vector<sstring>>(_config.all_datadirs | boost::adaptors::transformed([&] (const sstring& ksdir) {
+        return column_family_directory(ksdir, name, uuid);
+    }));
 }
 
 future<>
 keyspace::make_directory_for_column_family(const sstring& name, utils::UUID uuid) {
-    auto cfdir = column_family_directory(name, uuid);
-    return seastar::async([cfdir = std::move(cfdir)] {
-        io_check(touch_directory, cfdir).get();
-        io_check(touch_directory, cfdir + "/upload").get();
+    auto cfdirs = column_family_directories(name, uuid);
+    return seastar::async([cfdirs = std::move(cfdirs)] {
+        for (auto& cfdir : cfdirs) {
+            io_check(touch_directory, cfdir).get();
+        }
+        // Uploads are only looked for in the first one.
+        io_check(touch_directory, cfdirs.front() + "/upload").get();
     });
 }
 
@@ -1934,9 +2766,11 @@ database::create_keyspace(const lw_shared_ptr<keyspace_metadata>& ksm) {
     }
 
     create_in_memory_keyspace(ksm);
-    auto& datadir = _keyspaces.at(ksm->name()).datadir();
-    if (datadir != "") {
-        return io_check(touch_directory, datadir);
+    auto& ks = _keyspaces.at(ksm->name());
+    if (ks.datadir() != "") {
+        return do_for_each(ks.all_datadirs(), [] (const sstring& datadir) {
+            return io_check(touch_directory, datadir);
+        });
     } else {
         return make_ready_future<>();
     }
@@ -1972,7 +2806,10 @@ compare_atomic_cell_for_merge(atomic_cell_view left, atomic_cell_view right) {
         return left.is_live() ? -1 : 1;
     }
     if (left.is_live()) {
-        auto c = compare_unsigned(left.value(), right.value());
+        // Cached cells may be compressed, reconcile them by the uncompressed values.
+        auto c = left.is_value_compressed() || right.is_value_compressed()
+                 ? compare_unsigned(cell_compression::uncompressed_value(left), cell_compression::uncompressed_value(right))
+                 : compare_unsigned(left.value(), right.value());
         if (c != 0) {
             return c;
         }
@@ -1999,15 +2836,17 @@ compare_atomic_cell_for_merge(atomic_cell_view left, atomic_cell_view right) {
 struct query_state {
     explicit query_state(schema_ptr s,
                          const query::read_command& cmd,
-                         query::result_request request,
-                         const std::vector<query::partition_range>& ranges)
+                         query::result_options opts,
+                         const std::vector<query::partition_range>& ranges,
+                         query::tombstone_counter tombstones)
             : schema(std::move(s))
             , cmd(cmd)
-            , builder(cmd.slice, request)
+            , builder(cmd.slice, opts, cmd.max_result_size)
             , limit(cmd.row_limit)
             , partition_limit(cmd.partition_limit)
             , current_partition_range(ranges.begin())
-            , range_end(ranges.end()){
+            , range_end(ranges.end())
+            , tombstones(tombstones) {
     }
     schema_ptr schema;
     const query::read_command& cmd;
@@ -2017,64 +2856,691 @@ struct query_state {
     bool range_empty = false;   // Avoid ubsan false-positive when moving after construction
     std::vector<query::partition_range>::const_iterator current_partition_range;
     std::vector<query::partition_range>::const_iterator range_end;
+    query::tombstone_counter tombstones;
     mutation_reader reader;
     bool done() const {
-        return !limit || current_partition_range == range_end;
+        return !limit || builder.is_short_read() || current_partition_range == range_end;
     }
 };
 
-future<lw_shared_ptr<query::result>>
-column_family::query(schema_ptr s, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& partition_ranges) {
-    utils::latency_counter lc;
-    _stats.reads.set_latency(lc);
-    auto qs_ptr = std::make_unique<query_state>(std::move(s), cmd, request, partition_ranges);
-    auto& qs = *qs_ptr;
-    {
-        return do_until(std::bind(&query_state::done, &qs), [this, &qs] {
-            auto&& range = *qs.current_partition_range++;
-            return data_query(qs.schema, as_mutation_source(), range, qs.cmd.slice, qs.limit, qs.partition_limit,
-                              qs.cmd.timestamp, qs.builder).then([&qs] (auto&& r) {
-                qs.limit -= r.live_rows;
-                qs.partition_limit -= r.partitions;
+// Listings of partition keys, i.e. SELECT DISTINCT of partition key columns
+// only, which can be answered by partition_key_query().
+static bool is_partition_key_listing(const query::read_command& cmd, query::result_options opts) {
+    auto& slice = cmd.slice;
+    return slice.options.contains<query::partition_slice::option::distinct>()
+        && slice.static_columns.empty()
+        && slice.regular_columns.empty()
+        && slice.filters().empty()
+        && !cmd.index
+        && opts.request == query::result_request::only_result;
+}
+
+// Single-partition queries whose results may be kept in
+// db::query_result_cache. Partition key listings don't go through
+// mutation_querier, which finds out how long a result stays valid.
+static bool is_cacheable_query(const query::read_command& cmd, const std::vector<query::partition_range>& ranges) {
+    return ranges.size() == 1
+        && query::is_single_partition(ranges.front())
+        && !cmd.index
+        && !cmd.slice.options.contains<query::partition_slice::option::bypass_cache>()
+        && !cmd.slice.options.contains<query::partition_slice::option::distinct>();
+}
+
+void column_family::invalidate_cached_results(partition_key_view pk) {
+    ++_cached_results_phase;
+    db::global_query_result_cache().invalidate(_schema->id(), pk);
+}
+
+void column_family::invalidate_cached_results() {
+    ++_cached_results_phase;
+    db::global_query_result_cache().invalidate(_schema->id());
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::query(schema_ptr s, const query::read_command& cmd, query::result_options opts, const std::vector<query::partition_range>& partition_ranges,
+                     querier_cache* cache) {
+    utils::latency_counter lc;
+    _stats.reads.set_latency(lc);
+    // Unlike the sampled histogram above, every read is recorded here.
+    auto& latency = boost::algorithm::all_of(partition_ranges, [] (auto& pr) { return query::is_single_partition(pr); })
+            ? _stats.read_latency : _stats.range_latency;
+    auto start = utils::latency_counter::now();
+    auto& results_cache = db::global_query_result_cache();
+    stdx::optional<db::query_result_cache_key> cache_key;
+    if (results_cache.enabled() && is_cacheable_query(cmd, partition_ranges)) {
+        cache_key.emplace(*s, partition_ranges.front().start()->value().as_decorated_key().key(), cmd, opts);
+        if (auto result = results_cache.lookup(_schema->id(), *cache_key, cmd.timestamp)) {
+            _stats.reads.mark(lc);
+            latency.add(utils::latency_counter::now() - start);
+            return make_ready_future<lw_shared_ptr<query::result>>(std::move(result));
+        }
+    }
+    auto qs_ptr = std::make_unique<query_state>(std::move(s), cmd, opts, partition_ranges, make_tombstone_counter());
+    auto& qs = *qs_ptr;
+    if (cache_key) {
+        qs.builder.track_expiry();
+    }
+    {
+        auto bypass_cache = cmd.slice.options.contains<query::partition_slice::option::bypass_cache>();
+        if (bypass_cache) {
+            _cache.on_bypass();
+        }
+        auto source = cmd.index ? as_index_mutation_source(*cmd.index) : as_mutation_source(bypass_cache);
+        if (cmd.index) {
+            cache = nullptr;
+        }
+        auto list_keys = is_partition_key_listing(cmd, opts);
+        return do_until(std::bind(&query_state::done, &qs), [this, &qs, cache, list_keys, source = std::move(source)] {
+            if (std::chrono::steady_clock::now() > qs.cmd.deadline) {
+                return make_exception_future<>(expired_request_exception());
+            }
+            auto&& range = *qs.current_partition_range++;
+            auto f = [&] {
+                // Only the partitions in memtables need to be read, those in
+                // sstables are listed from their indexes.
+                if (list_keys && has_only_live_sstable_partitions(*qs.schema, range)) {
+                    auto& pc = service::get_local_request_scheduler().read_priority(qs.schema->ks_name());
+                    return partition_key_query(qs.schema, sstables_as_key_source()(range, pc), memtables_as_key_source()(range),
+                                               source, qs.cmd.slice, qs.limit, qs.partition_limit, qs.cmd.timestamp, qs.builder, &qs.tombstones);
+                }
+                return data_query(qs.schema, source, range, qs.cmd.slice, qs.limit, qs.partition_limit,
+                                  qs.cmd.timestamp, qs.builder, cache, &qs.tombstones);
+            }();
+            return f.then([&qs] (auto&& r) {
+                qs.limit -= r.live_rows;
+                qs.partition_limit -= r.partitions;
+            });
+        }).then([this, &qs, cache_key = std::move(cache_key), phase = _cached_results_phase] {
+            auto result = make_lw_shared<query::result>(qs.builder.build());
+            result->set_scanned_tombstones(qs.tombstones.count());
+            if (cache_key && !result->is_short_read() && phase == _cached_results_phase) {
+                db::global_query_result_cache().insert(_schema->id(), *cache_key, *result, qs.builder.valid_until());
+            }
+            return make_ready_future<lw_shared_ptr<query::result>>(std::move(result));
+        }).finally([lc, start, &latency, this, qs_ptr = std::move(qs_ptr)]() mutable {
+            account_scanned_tombstones(*qs_ptr->schema, qs_ptr->tombstones);
+            _stats.reads.mark(lc);
+            if (lc.is_start()) {
+                _stats.estimated_read.add(lc.latency(), _stats.reads.hist.count);
+            }
+            latency.add(utils::latency_counter::now() - start);
+        });
+    }
+}
+
+query::tombstone_counter column_family::make_tombstone_counter() const {
+    return query::tombstone_counter(_config.tombstone_warn_threshold, _config.tombstone_failure_threshold);
+}
+
+void column_family::account_scanned_tombstones(const schema& s, const query::tombstone_counter& tombstones) {
+    _stats.tombstone_scanned.mark(tombstones.count());
+    if (tombstones.count() > _config.tombstone_failure_threshold) {
+        dblog.error("Scanned over {} tombstones during query on {}.{}, query aborted (see tombstone_failure_threshold)",
+                _config.tombstone_failure_threshold, s.ks_name(), s.cf_name());
+    } else if (tombstones.over_warn_threshold()) {
+        dblog.warn("Read {} tombstones during query on {}.{} (see tombstone_warn_threshold)",
+                tombstones.count(), s.ks_name(), s.cf_name());
+    }
+}
+
+mutation_source
+column_family::as_mutation_source(bool bypass_cache) const {
+    return mutation_source([this, bypass_cache] (schema_ptr s,
+                                   const query::partition_range& range,
+                                   query::clustering_key_filtering_context ck_filtering,
+                                   const io_priority_class& pc) {
+        return this->make_reader(std::move(s), range, ck_filtering, pc, bypass_cache);
+    });
+}
+
+mutation_source
+column_family::as_index_mutation_source(query::index_restriction restriction) const {
+    return mutation_source([this, restriction = std::move(restriction)] (schema_ptr s,
+                                   const query::partition_range& range,
+                                   query::clustering_key_filtering_context ck_filtering,
+                                   const io_priority_class& pc) {
+        auto& cdef = s->regular_column_at(restriction.column);
+        auto indexes = _indexes | boost::adaptors::map_values;
+        auto i = boost::find_if(indexes, [&cdef] (const lw_shared_ptr<local_index>& idx) {
+            return idx->column_name == cdef.name();
+        });
+        if (i == indexes.end() || !(*i)->built) {
+            return db::index::make_index_scan_reader(s, cdef, restriction.value, as_mutation_source(), range,
+                std::move(ck_filtering), pc);
+        }
+        auto idx = *i;
+        return db::index::make_index_reader(s, cdef, restriction.value, as_mutation_source(),
+                idx->cf->schema(), idx->cf->as_mutation_source(), range, std::move(ck_filtering), pc,
+                [this, idx] (mutation m) {
+            // Entries of streamed partitions which are written directly to
+            // sstables point at data which isn't visible yet.
+            if (idx->ready && _streaming_memtables_big.empty() && _streaming_writers.empty()) {
+                idx->cf->apply(m);
+            }
+        });
+    });
+}
+
+sstring column_family::index_directory(const sstring& index_name) const {
+    return sprint("%s/.%s/%d", _config.datadir, index_name, engine().cpu_id());
+}
+
+future<> column_family::update_indexes() {
+    std::vector<lw_shared_ptr<local_index>> created;
+    for (auto& cdef : _schema->regular_columns()) {
+        if (!cdef.is_indexed() || !cdef.idx_info.index_name || _indexes.count(*cdef.idx_info.index_name)) {
+            continue;
+        }
+        auto& name = *cdef.idx_info.index_name;
+        auto cfg = _config;
+        cfg.datadir = index_directory(name);
+        cfg.enable_commitlog = false;
+        cfg.shard_local = true;
+        auto idx = make_lw_shared<local_index>();
+        idx->column_name = cdef.name();
+        idx->cf = make_lw_shared<column_family>(db::index::index_table_schema(*_schema, cdef), std::move(cfg),
+            no_commitlog(), _compaction_manager);
+        _indexes.emplace(name, idx);
+        created.push_back(std::move(idx));
+    }
+    for (auto i = _indexes.begin(); i != _indexes.end();) {
+        auto cdef = _schema->get_column_definition(i->second->column_name);
+        if (cdef && cdef->is_indexed() && cdef->idx_info.index_name == i->first) {
+            ++i;
+            continue;
+        }
+        dblog.info("Dropping index {} of {}.{}", i->first, _schema->ks_name(), _schema->cf_name());
+        auto idx = i->second;
+        auto marker = index_build_marker(i->first);
+        i = _indexes.erase(i);
+        idx->ready = false;
+        idx->cf->stop().then([ks_name = _schema->ks_name(), marker] {
+            return db::system_keyspace::set_index_removed(ks_name, marker);
+        }).handle_exception([] (std::exception_ptr ep) {
+            dblog.warn("Failed to drop index: {}", ep);
+        }).finally([idx] { });
+    }
+    return parallel_for_each(created, [this] (lw_shared_ptr<local_index> idx) {
+        return open_index(std::move(idx));
+    });
+}
+
+future<> column_family::open_index(lw_shared_ptr<local_index> idx) {
+    auto dir = idx->cf->_config.datadir;
+    return io_check(recursive_touch_directory, dir).then([idx, dir] {
+        return idx->cf->populate(dir);
+    }).then([this, idx] {
+        idx->cf->start();
+        idx->ready = true;
+        if (_index_builds_enabled) {
+            start_index_builds();
+        }
+    });
+}
+
+void column_family::start_index_builds() {
+    _index_builds_enabled = true;
+    for (auto& p : _indexes) {
+        auto idx = p.second;
+        if (!idx->ready || idx->built || idx->building || _index_gate.is_closed()) {
+            continue;
+        }
+        idx->building = true;
+        with_gate(_index_gate, [this, name = p.first, idx] {
+            return build_index(name, idx);
+        }).handle_exception([this, name = p.first] (std::exception_ptr ep) {
+            dblog.error("Failed to build index {} of {}.{}: {}", name, _schema->ks_name(), _schema->cf_name(), ep);
+        }).finally([idx] {
+            idx->building = false;
+        });
+    }
+}
+
+// Name under which the index is recorded as built in system.IndexInfo.
+// Index tables of a shard only describe the partitions the shard owns, so
+// they are built per shard and have to be rebuilt when the number of shards
+// changes. The table id keeps a dropped and recreated table from inheriting
+// the state of its indexes.
+sstring column_family::index_build_marker(const sstring& index_name) const {
+    return sprint("%s.%s:%s:%d/%d", _schema->cf_name(), index_name, _schema->id(), engine().cpu_id(), smp::count);
+}
+
+future<> column_family::build_index(sstring name, lw_shared_ptr<local_index> idx) {
+    auto marker = index_build_marker(name);
+    return db::system_keyspace::is_index_built(_schema->ks_name(), marker).then([this, name, idx, marker] (bool built) {
+        if (built) {
+            idx->built = true;
+            return make_ready_future<>();
+        }
+        dblog.info("Building index {} of {}.{}", name, _schema->ks_name(), _schema->cf_name());
+        auto stopped = [this, idx] {
+            return _index_gate.is_closed() || !idx->ready;
+        };
+        // Writes made from now on are indexed as they come, so one pass over
+        // the data which is already there covers it all.
+        return do_with(make_reader(_schema, query::full_partition_range, query::no_clustering_key_filtering,
+                service::get_local_compaction_priority()), [this, idx, stopped] (mutation_reader& reader) {
+            return repeat([this, idx, stopped, &reader] {
+                if (stopped()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return reader().then([this, idx] (streamed_mutation_opt smo) {
+                    if (!smo) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return do_with(std::move(*smo), [this, idx] (streamed_mutation& sm) {
+                        auto cdef = sm.schema()->get_column_definition(idx->column_name);
+                        return repeat([this, idx, cdef, &sm] {
+                            return sm().then([this, idx, cdef, &sm] (mutation_fragment_opt mf) {
+                                if (!mf) {
+                                    return stop_iteration::yes;
+                                }
+                                if (cdef && idx->ready && mf->is_clustering_row()) {
+                                    auto entry = db::index::make_index_entry(idx->cf->schema(), *cdef, sm.key(),
+                                        mf->as_clustering_row().cells());
+                                    if (entry) {
+                                        idx->cf->apply(*entry);
+                                    }
+                                }
+                                return stop_iteration::no;
+                            });
+                        });
+                    }).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        }).then([this, name, idx, marker, stopped] {
+            if (stopped()) {
+                return make_ready_future<>();
+            }
+            return idx->cf->flush().then([this, marker] {
+                return db::system_keyspace::set_index_built(_schema->ks_name(), marker);
+            }).then([this, name, idx] {
+                dblog.info("Built index {} of {}.{}", name, _schema->ks_name(), _schema->cf_name());
+                idx->built = true;
+            });
+        });
+    });
+}
+
+void column_family::apply_to_indexes(const mutation& m) {
+    for (auto& p : _indexes) {
+        auto& idx = *p.second;
+        if (!idx.ready) {
+            continue;
+        }
+        auto cdef = m.schema()->get_column_definition(idx.column_name);
+        if (!cdef) {
+            continue;
+        }
+        db::index::for_each_index_entry(idx.cf->schema(), *cdef, m, [&idx] (mutation entry) {
+            idx.cf->apply(entry);
+        });
+    }
+}
+
+schema_ptr column_family::find_view(const utils::UUID& id) const {
+    auto i = boost::find_if(_views, [&id] (const schema_ptr& v) {
+        return v->id() == id;
+    });
+    return i == _views.end() ? schema_ptr() : *i;
+}
+
+void column_family::add_or_update_view(schema_ptr view) {
+    auto i = boost::find_if(_views, [&view] (const schema_ptr& v) {
+        return v->id() == view->id();
+    });
+    if (i != _views.end()) {
+        *i = std::move(view);
+        return;
+    }
+    _views.push_back(view);
+    maybe_build_view(std::move(view));
+}
+
+void column_family::remove_view(schema_ptr view) {
+    _views.erase(boost::remove_if(_views, [&view] (const schema_ptr& v) {
+        return v->id() == view->id();
+    }), _views.end());
+}
+
+future<> column_family::push_view_replica_updates(const schema_ptr& s, const frozen_mutation& fm, std::function<future<> ()> apply_base) {
+    auto m = fm.unfreeze(s);
+    auto token = m.token();
+    auto& lock = _view_update_locks[token];
+    if (!lock) {
+        lock = make_lw_shared<semaphore>(1);
+    }
+    return with_semaphore(*lock, 1, [this, s, m = std::move(m), apply_base = std::move(apply_base)] () mutable {
+        auto slice = db::view::affected_rows_slice(*s, m);
+        auto f = make_ready_future<mutation_opt>();
+        if (!slice.row_ranges(*s, m.key()).empty()) {
+            f = do_with(std::move(slice), query::partition_range::make_singular(m.decorated_key()),
+                    [this, s] (query::partition_slice& slice, query::partition_range& range) {
+                auto reader = make_reader(s, range, query::clustering_key_filtering_context::create(s, slice),
+                    service::get_local_sstable_query_read_priority());
+                return do_with(std::move(reader), [] (mutation_reader& reader) {
+                    return reader().then([] (streamed_mutation_opt smo) {
+                        return mutation_from_streamed_mutation(std::move(smo));
+                    });
+                });
+            });
+        }
+        return f.then([this, s, m = std::move(m), apply_base = std::move(apply_base)] (mutation_opt existing) {
+            auto updates = db::view::generate_view_updates(s, _views, m, existing, gc_clock::now());
+            return apply_base().then([token = m.token(), updates = std::move(updates)] () mutable {
+                // Only waits for the view updates which stay on this node,
+                // like the base write waits only for this replica.
+                return service::get_local_storage_proxy().mutate_view_replicas(token, std::move(updates)).handle_exception([] (std::exception_ptr ep) {
+                    dblog.warn("Failed to apply view updates: {}", ep);
+                });
+            });
+        });
+    }).finally([this, token, lock] {
+        if (lock.use_count() == 2 && lock->current() == 1) {
+            _view_update_locks.erase(token);
+        }
+    });
+}
+
+// Whether applying m may change the local shards of counter cells other
+// than by the counter updates it has.
+static bool has_counter_deletions(const schema& s, const mutation_partition& mp) {
+    if (mp.partition_tombstone() || !mp.row_tombstones().empty()) {
+        return true;
+    }
+    auto has_dead_cells = [] (const row& cells) {
+        bool dead = false;
+        cells.for_each_cell_until([&dead] (column_id, const atomic_cell_or_collection& c) {
+            dead = !c.as_atomic_cell().is_live();
+            return stop_iteration(dead);
+        });
+        return dead;
+    };
+    if (has_dead_cells(mp.static_row())) {
+        return true;
+    }
+    return boost::algorithm::any_of(mp.clustered_rows(), [&] (const rows_entry& e) {
+        return e.row().deleted_at() || has_dead_cells(e.row().cells());
+    });
+}
+
+// Selects the rows and columns a counter update changes.
+static query::partition_slice counter_update_slice(const schema& s, const mutation& m) {
+    std::vector<query::clustering_range> ranges;
+    for (auto&& e : m.partition().clustered_rows()) {
+        ranges.emplace_back(query::clustering_range::make_singular(e.key()));
+    }
+    std::vector<column_id> static_columns;
+    for (const column_definition& def : s.static_columns()) {
+        static_columns.push_back(def.id);
+    }
+    std::vector<column_id> regular_columns;
+    for (const column_definition& def : s.regular_columns()) {
+        regular_columns.push_back(def.id);
+    }
+    return query::partition_slice(std::move(ranges), std::move(static_columns), std::move(regular_columns),
+        query::partition_slice::option_set());
+}
+
+future<mutation> column_family::apply_counter_update(const schema_ptr& s, mutation m, const utils::UUID& counter_id,
+        std::function<future<> (const mutation&)> apply) {
+    auto token = m.token();
+    auto& lock = _counter_update_locks[token];
+    if (!lock) {
+        lock = make_lw_shared<semaphore>(1);
+    }
+    return with_semaphore(*lock, 1, [this, s, m = std::move(m), counter_id, apply = std::move(apply)] () mutable {
+        auto& cache = db::global_counter_cache();
+        auto deletions = has_counter_deletions(*s, m.partition());
+        if (deletions) {
+            // The shards the cache has may be deleted now.
+            cache.invalidate(s->id(), m.key());
+        }
+
+        // The local shard of each updated cell, in the order of
+        // for_each_update(), as far as the cache knows them.
+        struct cell_update {
+            db::counter_cache_key key;
+            std::experimental::optional<db::counter_cache_value> current;
+        };
+        std::vector<cell_update> updates;
+        auto for_each_update = [s] (mutation& m, auto&& func) {
+            auto visit = [&] (const clustering_key* ck, column_kind kind, row& cells) {
+                cells.for_each_cell([&] (column_id id, atomic_cell_or_collection& c) {
+                    if (c.as_atomic_cell().is_live()) {
+                        func(ck, s->column_at(kind, id), c);
+                    }
+                });
+            };
+            visit(nullptr, column_kind::static_column, m.partition().static_row());
+            for (auto&& e : m.partition().clustered_rows()) {
+                visit(&e.key(), column_kind::regular_column, e.row().cells());
+            }
+        };
+        bool all_cached = true;
+        for_each_update(m, [&] (const clustering_key* ck, const column_definition& def, atomic_cell_or_collection&) {
+            db::counter_cache_key key(*s, m.key(), ck, def);
+            auto current = deletions ? std::experimental::nullopt : cache.lookup(s->id(), key);
+            all_cached &= bool(current);
+            updates.push_back(cell_update{std::move(key), current});
+        });
+
+        auto f = make_ready_future<mutation_opt>();
+        if (!all_cached) {
+            f = do_with(counter_update_slice(*s, m), query::partition_range::make_singular(m.decorated_key()),
+                    [this, s] (query::partition_slice& slice, query::partition_range& range) {
+                auto reader = make_reader(s, range, query::clustering_key_filtering_context::create(s, slice),
+                    service::get_local_sstable_query_read_priority());
+                return do_with(std::move(reader), [] (mutation_reader& reader) {
+                    return reader().then([] (streamed_mutation_opt smo) {
+                        return mutation_from_streamed_mutation(std::move(smo));
+                    });
+                });
+            });
+        }
+        return f.then([this, s, m = std::move(m), counter_id, apply = std::move(apply), updates = std::move(updates),
+                for_each_update = std::move(for_each_update)] (mutation_opt existing) mutable {
+            // Finds the local shard of a cell which isn't cached. A deleted shard
+            // starts over from 0, but keeps its clock so that the new version of
+            // it wins over the deleted one.
+            auto read_current = [&] (const clustering_key* ck, const column_definition& def) {
+                db::counter_cache_value current{0, 0};
+                if (!existing) {
+                    return current;
+                }
+                auto& mp = existing->partition();
+                auto t = mp.partition_tombstone();
+                const atomic_cell_or_collection* c;
+                if (ck) {
+                    t.apply(mp.tombstone_for_row(*s, *ck));
+                    auto r = mp.find_row(*ck);
+                    c = r ? r->find_cell(def.id) : nullptr;
+                } else {
+                    c = mp.static_row().find_cell(def.id);
+                }
+                if (!c || !c->as_atomic_cell().is_live()) {
+                    return current;
+                }
+                auto shard = counter_cell_view(c->as_atomic_cell()).get_shard(counter_id);
+                if (shard) {
+                    current.logical_clock = shard->logical_clock();
+                    if (c->as_atomic_cell().is_live(t)) {
+                        current.value = shard->value();
+                    }
+                }
+                return current;
+            };
+            auto it = updates.begin();
+            for_each_update(m, [&] (const clustering_key* ck, const column_definition& def, atomic_cell_or_collection& c) {
+                auto& u = *it++;
+                if (!u.current) {
+                    u.current = read_current(ck, def);
+                }
+                auto delta = counter_update_value(c.as_atomic_cell());
+                u.current = db::counter_cache_value{u.current->value + delta, u.current->logical_clock + 1};
+                counter_cell_builder ccb;
+                ccb.add_shard(counter_shard(counter_id, u.current->value, u.current->logical_clock));
+                c = ccb.build(c.as_atomic_cell().timestamp());
+            });
+            return do_with(std::move(m), [this, s, apply = std::move(apply), updates = std::move(updates)] (mutation& m) {
+                return apply(m).then([this, s, &m, updates = std::move(updates)] {
+                    auto& cache = db::global_counter_cache();
+                    for (auto&& u : updates) {
+                        cache.insert(s->id(), u.key, *u.current);
+                    }
+                    return std::move(m);
+                });
+            });
+        });
+    }).finally([this, token, lock] {
+        if (lock.use_count() == 2 && lock->current() == 1) {
+            _counter_update_locks.erase(token);
+        }
+    });
+}
+
+void column_family::start_view_builds() {
+    _view_builds_enabled = true;
+    for (auto& v : _views) {
+        maybe_build_view(v);
+    }
+}
+
+void column_family::maybe_build_view(schema_ptr view) {
+    if (!_view_builds_enabled || _view_build_gate.is_closed() || _views_building.count(view->id())) {
+        return;
+    }
+    _views_building.insert(view->id());
+    with_gate(_view_build_gate, [this, view] {
+        return build_view(view);
+    }).handle_exception([this, view] (std::exception_ptr ep) {
+        dblog.error("Failed to build view {}.{}: {}", view->ks_name(), view->cf_name(), ep);
+    }).finally([this, id = view->id()] {
+        _views_building.erase(id);
+    });
+}
+
+// Generates updates of the view for all data of this shard, as if it was
+// all written anew. Writes made meanwhile generate their own updates, so
+// one pass is enough.
+future<> column_family::build_view(schema_ptr view) {
+    return db::system_keyspace::is_view_built(view->ks_name(), view->cf_name()).then([this, view] (bool built) {
+        if (built) {
+            return make_ready_future<>();
+        }
+        dblog.info("Building view {}.{}", view->ks_name(), view->cf_name());
+        auto stopped = [this, id = view->id()] {
+            return _view_build_gate.is_closed() || !find_view(id);
+        };
+        // Sequential, and at compaction priority, so that it doesn't take
+        // over the foreground work.
+        return do_with(make_reader(_schema, query::full_partition_range, query::no_clustering_key_filtering,
+                service::get_local_compaction_priority()), [this, view, stopped] (mutation_reader& reader) {
+            return repeat([this, view, stopped, &reader] {
+                if (stopped()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return reader().then([] (streamed_mutation_opt smo) {
+                    return mutation_from_streamed_mutation(std::move(smo));
+                }).then([this, view] (mutation_opt m) {
+                    if (!m) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto v = find_view(view->id());
+                    if (!v) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto updates = db::view::generate_view_updates(m->schema(), { v }, *m, { }, gc_clock::now());
+                    return service::get_local_storage_proxy().mutate_view_replicas(m->token(), std::move(updates)).then([] {
+                        return stop_iteration::no;
+                    });
+                });
             });
-        }).then([qs_ptr = std::move(qs_ptr), &qs] {
-            return make_ready_future<lw_shared_ptr<query::result>>(
-                    make_lw_shared<query::result>(qs.builder.build()));
-        }).finally([lc, this]() mutable {
-            _stats.reads.mark(lc);
-            if (lc.is_start()) {
-                _stats.estimated_read.add(lc.latency(), _stats.reads.hist.count);
+        }).then([view, stopped] {
+            if (stopped()) {
+                return make_ready_future<>();
             }
+            return db::system_keyspace::set_view_built(view->ks_name(), view->cf_name()).then([view] {
+                dblog.info("Built view {}.{}", view->ks_name(), view->cf_name());
+            });
         });
-    }
+    });
 }
 
-mutation_source
-column_family::as_mutation_source() const {
-    return mutation_source([this] (schema_ptr s,
-                                   const query::partition_range& range,
-                                   query::clustering_key_filtering_context ck_filtering,
-                                   const io_priority_class& pc) {
-        return this->make_reader(std::move(s), range, ck_filtering, pc);
+future<> column_family::flush_indexes() {
+    return parallel_for_each(_indexes | boost::adaptors::map_values, [] (lw_shared_ptr<local_index> idx) {
+        return idx->ready ? idx->cf->flush() : make_ready_future<>();
+    });
+}
+
+future<> column_family::discard_index_sstables(db_clock::time_point truncated_at) {
+    return parallel_for_each(_indexes | boost::adaptors::map_values, [truncated_at] (lw_shared_ptr<local_index> idx) {
+        return idx->cf->run_with_compaction_disabled([idx, truncated_at] {
+            return idx->cf->discard_sstables(truncated_at).discard_result();
+        });
     });
 }
 
+// Only single partition reads are sampled, the result size is split evenly
+// between the partitions of a multi-partition read.
+static void sample_reads(db::top_partitions_sampler& sampler, const std::vector<query::partition_range>& ranges, size_t result_size) {
+    auto keys = boost::count_if(ranges, [] (auto& pr) { return query::is_single_partition(pr); });
+    for (auto&& pr : ranges) {
+        if (query::is_single_partition(pr)) {
+            sampler.record_read(pr.start()->value().as_decorated_key().key(), result_size / keys);
+        }
+    }
+}
+
 future<lw_shared_ptr<query::result>>
-database::query(schema_ptr s, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& ranges) {
+database::query(schema_ptr s, const query::read_command& cmd, query::result_options opts, const std::vector<query::partition_range>& ranges) {
+    if (std::chrono::steady_clock::now() > cmd.deadline) {
+        ++_stats->expired_reads;
+        return make_exception_future<lw_shared_ptr<query::result>>(expired_request_exception());
+    }
     column_family& cf = find_column_family(cmd.cf_id);
-    return cf.query(std::move(s), cmd, request, ranges).then([this, s = _stats] (auto&& res) {
-        ++s->total_reads;
-        return std::move(res);
+    // Suspended readers hold read concurrency units, give them up
+    // rather than make new reads wait for them.
+    if (_read_concurrency_sem.waiters()) {
+        _querier_cache.clear();
+    }
+    return cf.query(std::move(s), cmd, opts, ranges, &_querier_cache).then_wrapped([this, s = _stats, &cf, &ranges] (auto&& f) {
+        try {
+            auto res = f.get0();
+            ++s->total_reads;
+            if (auto sampler = cf.get_top_partitions_sampler()) {
+                sample_reads(*sampler, ranges, res->buf().size());
+            }
+            return std::move(res);
+        } catch (expired_request_exception&) {
+            ++s->expired_reads;
+            throw;
+        }
     });
 }
 
 future<reconcilable_result>
 database::query_mutations(schema_ptr s, const query::read_command& cmd, const query::partition_range& range) {
+    if (std::chrono::steady_clock::now() > cmd.deadline) {
+        ++_stats->expired_reads;
+        return make_exception_future<reconcilable_result>(expired_request_exception());
+    }
     column_family& cf = find_column_family(cmd.cf_id);
-    return mutation_query(std::move(s), cf.as_mutation_source(), range, cmd.slice, cmd.row_limit, cmd.partition_limit,
-            cmd.timestamp).then([this, s = _stats] (auto&& res) {
+    auto bypass_cache = cmd.slice.options.contains<query::partition_slice::option::bypass_cache>();
+    if (bypass_cache) {
+        cf.get_row_cache().on_bypass();
+    }
+    auto source = cmd.index ? cf.as_index_mutation_source(*cmd.index) : cf.as_mutation_source(bypass_cache);
+    auto tombstones = std::make_unique<query::tombstone_counter>(cf.make_tombstone_counter());
+    auto& tombstones_ref = *tombstones;
+    return mutation_query(s, std::move(source), range, cmd.slice, cmd.row_limit, cmd.partition_limit,
+            cmd.timestamp, &tombstones_ref, cmd.max_result_size).then([this, s = _stats] (auto&& res) {
         ++s->total_reads;
         return std::move(res);
+    }).finally([&cf, s, tombstones = std::move(tombstones)] {
+        cf.account_scanned_tombstones(*s, *tombstones);
     });
 }
 
@@ -2144,25 +3610,228 @@ void
 column_family::apply(const mutation& m, const db::replay_position& rp) {
     utils::latency_counter lc;
     _stats.writes.set_latency(lc);
+    auto start = utils::latency_counter::now();
+    if (rp != db::replay_position()) {
+        check_valid_rp(rp);
+    }
     _memtables->active_memtable().apply(m, rp);
+    invalidate_cached_results(m.key().view());
+    if (!_indexes.empty()) {
+        apply_to_indexes(m);
+    }
     _memtables->seal_on_overflow();
     _stats.writes.mark(lc);
     if (lc.is_start()) {
         _stats.estimated_write.add(lc.latency(), _stats.writes.hist.count);
     }
+    _stats.write_latency.add(utils::latency_counter::now() - start);
 }
 
 void
 column_family::apply(const frozen_mutation& m, const schema_ptr& m_schema, const db::replay_position& rp) {
     utils::latency_counter lc;
     _stats.writes.set_latency(lc);
+    auto start = utils::latency_counter::now();
     check_valid_rp(rp);
     _memtables->active_memtable().apply(m, m_schema, rp);
+    invalidate_cached_results(m.key(*m_schema));
+    if (!_indexes.empty()) {
+        apply_to_indexes(m.unfreeze(m_schema));
+    }
     _memtables->seal_on_overflow();
     _stats.writes.mark(lc);
     if (lc.is_start()) {
         _stats.estimated_write.add(lc.latency(), _stats.writes.hist.count);
     }
+    _stats.write_latency.add(utils::latency_counter::now() - start);
+}
+
+// Writes the unfragmented mutations which a streaming plan brings to a column
+// family straight to sstables. Partitions must be written in ring order, but
+// they are sent with some parallelism and so arrive only roughly ordered: a
+// few of them are held back and written in order. A partition which arrives
+// too late to be written in order to the current sstable starts a new one.
+class column_family::streaming_sstable_writer {
+    static constexpr size_t max_held_back_partitions = 64;
+    static constexpr size_t max_held_back_bytes = 4 << 20;
+    static constexpr size_t max_queued_partitions = 16;
+    // The number of partitions is not known in advance, this only sizes the
+    // bloom filters.
+    static constexpr uint64_t estimated_partitions = 1 << 16;
+
+    struct output {
+        sstables::shared_sstable sst;
+        schema_ptr s;
+        seastar::queue<mutation_opt> queue{max_queued_partitions};
+        std::experimental::optional<dht::decorated_key> last_key;
+        future<> done = make_ready_future<>();
+    };
+
+    class queue_reader : public mutation_reader::impl {
+        lw_shared_ptr<output> _output;
+    public:
+        explicit queue_reader(lw_shared_ptr<output> o) : _output(std::move(o)) { }
+        virtual future<streamed_mutation_opt> operator()() override {
+            return _output->queue.pop_eventually().then([] (mutation_opt m) {
+                if (!m) {
+                    return streamed_mutation_opt();
+                }
+                return streamed_mutation_opt(streamed_mutation_from_mutation(std::move(*m)));
+            });
+        }
+    };
+
+    struct held_back_mutation {
+        mutation m;
+        size_t size;
+    };
+
+    column_family& _cf;
+    std::map<dht::decorated_key, held_back_mutation, dht::decorated_key::less_comparator> _held_back;
+    size_t _held_back_bytes = 0;
+    lw_shared_ptr<output> _output;
+    std::vector<sstables::shared_sstable> _sstables;
+    // Serializes writers, and them with finish() and abort().
+    semaphore _lock{1};
+    bool _aborted = false;
+private:
+    void open_output(schema_ptr s) {
+        auto dir = _cf.new_sstable_directory(0);
+        _output = make_lw_shared<output>();
+        _output->s = s;
+        _output->sst = make_lw_shared<sstables::sstable>(s->ks_name(), s->cf_name(),
+                dir.first, _cf.calculate_generation_for_new_table(),
+                _cf.sstable_write_version(),
+                sstables::sstable::format_types::big);
+        _output->sst->set_unshared();
+        auto&& priority = service::get_local_streaming_write_priority();
+        auto o = _output;
+        _output->done = o->sst->write_components(make_mutation_reader<queue_reader>(o), estimated_partitions, s,
+                std::numeric_limits<uint64_t>::max(), _cf.incremental_backups_enabled(), priority, true).handle_exception([o] (auto ep) {
+            dblog.error("failed to write streamed sstable: {}", ep);
+            // Fail the writers waiting for room in the queue.
+            o->queue.abort(ep);
+            return make_exception_future<>(ep);
+        }).finally([placement = std::move(dir.second)] { });
+    }
+
+    future<> close_output() {
+        auto o = std::exchange(_output, { });
+        return o->queue.push_eventually(mutation_opt()).then([this, o] {
+            return std::move(o->done);
+        }).then([this, o] {
+            _sstables.emplace_back(o->sst);
+        });
+    }
+
+    future<> write_in_order(mutation m) {
+        if (_output && (_output->s != m.schema() || !_output->last_key->less_compare(*m.schema(), m.decorated_key()))) {
+            return close_output().then([this, m = std::move(m)] () mutable {
+                return write_in_order(std::move(m));
+            });
+        }
+        if (!_output) {
+            open_output(m.schema());
+        }
+        _output->last_key = m.decorated_key();
+        return _output->queue.push_eventually(mutation_opt(std::move(m)));
+    }
+
+    future<> write_first_held_back() {
+        auto it = _held_back.begin();
+        auto m = std::move(it->second.m);
+        _held_back_bytes -= it->second.size;
+        _held_back.erase(it);
+        return write_in_order(std::move(m));
+    }
+public:
+    explicit streaming_sstable_writer(column_family& cf)
+        : _cf(cf)
+        , _held_back(dht::decorated_key::less_comparator(cf.schema()))
+    { }
+
+    future<> write(mutation m, size_t size) {
+        return with_semaphore(_lock, 1, [this, m = std::move(m), size] () mutable {
+            if (_aborted) {
+                return make_exception_future<>(std::runtime_error("streaming of the column family was aborted"));
+            }
+            auto it = _held_back.find(m.decorated_key());
+            if (it != _held_back.end()) {
+                it->second.m.apply(std::move(m));
+                it->second.size += size;
+            } else {
+                auto key = m.decorated_key();
+                _held_back.emplace(std::move(key), held_back_mutation{std::move(m), size});
+            }
+            _held_back_bytes += size;
+            return repeat([this] {
+                if (_held_back.size() <= max_held_back_partitions && _held_back_bytes <= max_held_back_bytes) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return write_first_held_back().then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    // Writes the held back partitions and returns the unsealed sstables.
+    future<std::vector<sstables::shared_sstable>> finish() {
+        return with_semaphore(_lock, 1, [this] {
+            return repeat([this] {
+                if (_held_back.empty()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return write_first_held_back().then([] {
+                    return stop_iteration::no;
+                });
+            }).then([this] {
+                return _output ? close_output() : make_ready_future<>();
+            }).then([this] {
+                return std::move(_sstables);
+            });
+        });
+    }
+
+    // Stops writing and deletes what was written.
+    future<> abort() {
+        _aborted = true;
+        if (_output) {
+            _output->queue.abort(std::make_exception_ptr(std::runtime_error("streaming of the column family was aborted")));
+        }
+        return with_semaphore(_lock, 1, [this] {
+            _held_back.clear();
+            _held_back_bytes = 0;
+            auto f = make_ready_future<>();
+            if (_output) {
+                _sstables.emplace_back(_output->sst);
+                f = std::move(_output->done).handle_exception([] (auto ep) { });
+                _output = { };
+            }
+            return f.then([this] {
+                for (auto&& sst : _sstables) {
+                    sst->mark_for_deletion();
+                }
+                _sstables.clear();
+            });
+        });
+    }
+};
+
+future<> column_family::write_streaming_mutation(schema_ptr m_schema, utils::UUID plan_id, const frozen_mutation& fm) {
+    auto it = _streaming_writers.find(plan_id);
+    if (it == _streaming_writers.end()) {
+        it = _streaming_writers.emplace(plan_id, make_lw_shared<streaming_sstable_writer>(*this)).first;
+    }
+    auto writer = it->second;
+    auto m = fm.unfreeze(m_schema);
+    if (m.schema() != _schema) {
+        m.upgrade(_schema);
+    }
+    if (!_indexes.empty()) {
+        apply_to_indexes(m);
+    }
+    return writer->write(std::move(m), fm.representation().size()).finally([writer] { });
 }
 
 void column_family::apply_streaming_mutation(schema_ptr m_schema, utils::UUID plan_id, const frozen_mutation& m, bool fragmented) {
@@ -2171,6 +3840,9 @@ void column_family::apply_streaming_mutation(schema_ptr m_schema, utils::UUID pl
         return;
     }
     _streaming_memtables->active_memtable().apply(m, m_schema);
+    if (!_indexes.empty()) {
+        apply_to_indexes(m.unfreeze(m_schema));
+    }
     _streaming_memtables->seal_on_overflow();
 }
 
@@ -2182,6 +3854,11 @@ void column_family::apply_streaming_big_mutation(schema_ptr m_schema, utils::UUI
     }
     auto entry = it->second;
     entry->memtables->active_memtable().apply(m, m_schema);
+    if (!_indexes.empty()) {
+        // Index reads skip these entries until the streamed data becomes
+        // visible, and don't treat them as stale meanwhile.
+        apply_to_indexes(m.unfreeze(m_schema));
+    }
     entry->memtables->seal_on_overflow();
 }
 
@@ -2199,13 +3876,83 @@ future<> dirty_memory_manager::shutdown() {
     });
 }
 
+void flush_permit::release() {
+    if (_manager) {
+        std::exchange(_manager, nullptr)->release_flush_permit();
+    }
+}
+
+future<flush_permit> dirty_memory_manager::get_flush_permit(size_t memory, db::replay_position rp) {
+    if (_parent_manager) {
+        return _parent_manager->get_flush_permit(memory, rp);
+    }
+    // Every permit, held or waited for, keeps shutdown() waiting.
+    try {
+        _waiting_flush_gate.enter();
+    } catch (...) {
+        return make_exception_future<flush_permit>(std::current_exception());
+    }
+    if (_running_flushes < _concurrency && _waiting_flushes.empty()) {
+        ++_running_flushes;
+        return make_ready_future<flush_permit>(flush_permit(this));
+    }
+    _waiting_flushes.push_back(pending_flush{memory, rp, _next_flush_seq++, promise<flush_permit>()});
+    return _waiting_flushes.back().pr.get_future();
+}
+
+void dirty_memory_manager::release_flush_permit() {
+    _waiting_flush_gate.leave();
+    if (_waiting_flushes.empty()) {
+        --_running_flushes;
+        maybe_do_active_flush();
+        return;
+    }
+    db::replay_position newest;
+    for (auto&& f : _waiting_flushes) {
+        newest = std::max(newest, f.rp);
+    }
+    auto next = std::max_element(_waiting_flushes.begin(), _waiting_flushes.end(), [&newest] (const pending_flush& a, const pending_flush& b) {
+        auto sa = a.score(newest);
+        auto sb = b.score(newest);
+        return sa < sb || (sa == sb && a.seq > b.seq);
+    });
+    auto pr = std::move(next->pr);
+    _waiting_flushes.erase(next);
+    // The slot goes straight to the chosen flush.
+    pr.set_value(flush_permit(this));
+}
+
 void dirty_memory_manager::maybe_do_active_flush() {
-    if (!_db || !under_pressure() || _db_shutdown_requested) {
+    if (_parent_manager) {
+        _parent_manager->maybe_do_active_flush();
+        return;
+    }
+
+    if (!_db || _db_shutdown_requested) {
         return;
     }
 
     // Flush already ongoing. We don't need to initiate an active flush at this moment.
-    if (_flush_serializer.current() != _concurrency) {
+    if (_running_flushes) {
+        return;
+    }
+
+    // When all user memtables together are over the limit, flush from the
+    // keyspace holding the most memory, so that the others are throttled as
+    // shortly as possible. Otherwise, a keyspace may be over its own quota.
+    auto over_limit = under_pressure() || _region_group.memory_used() > _soft_limit;
+    logalloc::region_group* rg = over_limit ? &_region_group : nullptr;
+    dirty_memory_manager* offender = nullptr;
+    for (auto&& m : _keyspace_managers) {
+        if ((rg || m->under_pressure()) && m->_region_group.memory_used()
+                && (!offender || m->_region_group.memory_used() > offender->_region_group.memory_used())) {
+            offender = m;
+        }
+    }
+    if (offender) {
+        rg = &offender->_region_group;
+    }
+    if (!rg) {
         return;
     }
 
@@ -2221,7 +3968,7 @@ void dirty_memory_manager::maybe_do_active_flush() {
     //
     // However, since we'll very soon have a mechanism in place to account for the memory
     // that was already written in one form or another, that disadvantage is mitigated.
-    memtable& biggest_memtable = memtable::from_region(*_region_group.get_largest_region());
+    memtable& biggest_memtable = memtable::from_region(*rg->get_largest_region());
     auto& biggest_cf = _db->find_column_family(biggest_memtable.schema());
     memtable_list& mtlist = get_memtable_list(biggest_cf);
     // Please note that this will eventually take the semaphore and prevent two concurrent flushes.
@@ -2241,11 +3988,41 @@ void dirty_memory_manager::start_reclaiming() {
     maybe_do_active_flush();
 }
 
+dirty_memory_manager& database::dirty_memory_manager_for(const utils::UUID& cf_id) {
+    auto i = _column_families.find(cf_id);
+    return i == _column_families.end() ? _dirty_memory_manager : i->second->get_dirty_memory_manager();
+}
+
+dirty_memory_manager& database::keyspace_dirty_memory_manager(const sstring& ks_name) {
+    auto i = _keyspace_dirty_memory_managers.find(ks_name);
+    if (i == _keyspace_dirty_memory_managers.end()) {
+        auto mgr = std::make_unique<memtable_dirty_memory_manager>(*this, &_dirty_memory_manager, _memtable_total_space);
+        _dirty_memory_manager.add_keyspace_manager(*mgr);
+        i = _keyspace_dirty_memory_managers.emplace(ks_name, std::move(mgr)).first;
+        update_keyspace_memtable_quotas();
+    }
+    return *i->second;
+}
+
+// A keyspace may take all of the user memtable memory except for what is
+// reserved for each of the other keyspaces, so that they can keep writing
+// through its write bursts. At most half of the memory is reserved.
+void database::update_keyspace_memtable_quotas() {
+    auto others = _keyspace_dirty_memory_managers.size() - 1;
+    auto reserved = std::min(_cfg->memtable_keyspace_reserve() * others, 0.5);
+    auto quota = size_t(_memtable_total_space * (1 - std::max(reserved, 0.0)));
+    for (auto&& m : _keyspace_dirty_memory_managers) {
+        m.second->set_throttle_threshold(quota);
+    }
+}
+
 future<> database::apply_in_memory(const frozen_mutation& m, schema_ptr m_schema, db::replay_position rp) {
-    return _dirty_memory_manager.region_group().run_when_memory_available([this, &m, m_schema = std::move(m_schema), rp = std::move(rp)] {
+    return dirty_memory_manager_for(m.column_family_id()).region_group().run_when_memory_available([this, &m, m_schema = std::move(m_schema), rp = std::move(rp)] {
         try {
+            utils::alloc_scope alloc(utils::alloc_scope_id::memtable_apply);
             auto& cf = find_column_family(m.column_family_id());
             cf.apply(m, m_schema, rp);
+            _stats->total_bytes_written += m.representation().size();
         } catch (no_such_column_family&) {
             dblog.error("Attempting to mutate non-existent table {}", m.column_family_id());
         }
@@ -2262,32 +4039,119 @@ future<> database::do_apply(schema_ptr s, const frozen_mutation& m) {
         throw std::runtime_error(sprint("attempted to mutate using not synced schema of %s.%s, version=%s",
                                  s->ks_name(), s->cf_name(), s->version()));
     }
-    if (cf.commitlog() != nullptr) {
-        commitlog_entry_writer cew(s, m);
-        return cf.commitlog()->add_entry(uuid, cew).then([&m, this, s](auto rp) {
-            return this->apply_in_memory(m, s, rp).handle_exception([this, s, &m] (auto ep) {
+    return cf.wait_for_flush_queue().then([this, s, &m, &cf, uuid] {
+        if (cf.commitlog() != nullptr) {
+            commitlog_entry_writer cew(s, m);
+            return cf.commitlog()->add_entry(uuid, cew).then([&m, this, s](auto rp) {
+                return this->apply_in_memory(m, s, rp).handle_exception([this, s, &m] (auto ep) {
+                    try {
+                        std::rethrow_exception(ep);
+                    } catch (replay_position_reordered_exception&) {
+                        // expensive, but we're assuming this is super rare.
+                        // if we failed to apply the mutation due to future re-ordering
+                        // (which should be the ever only reason for rp mismatch in CF)
+                        // let's just try again, add the mutation to the CL once more,
+                        // and assume success in inevitable eventually.
+                        dblog.debug("replay_position reordering detected");
+                        return this->do_apply(s, m);
+                    }
+                });
+            });
+        }
+        return apply_in_memory(m, s, db::replay_position());
+    });
+}
+
+future<> database::apply(schema_ptr s, const frozen_mutation& m) {
+    if (dblog.is_enabled(logging::log_level::trace)) {
+        dblog.trace("apply {}", m.pretty_printer(s));
+    }
+    auto& cf = find_column_family(m.column_family_id());
+    if (auto sampler = cf.get_top_partitions_sampler()) {
+        sampler->record_write(partition_key(m.key(*s)), m.representation().size());
+    }
+    auto f = cf.views().empty() ? do_apply(s, m) : cf.push_view_replica_updates(s, m, [this, s, &m] {
+        return do_apply(s, m);
+    });
+    return f.then([this, s = _stats] {
+        ++s->total_writes;
+    });
+}
+
+future<mutation> database::apply_counter_update(schema_ptr s, const frozen_mutation& fm, const utils::UUID& counter_id) {
+    if (!s->is_synced()) {
+        throw std::runtime_error(sprint("attempted to mutate using not synced schema of %s.%s, version=%s",
+                                 s->ks_name(), s->cf_name(), s->version()));
+    }
+    auto& cf = find_column_family(fm.column_family_id());
+    return with_semaphore(_counter_write_sem, 1, [this, s, &cf, &fm, counter_id] {
+        return cf.apply_counter_update(s, fm.unfreeze(s), counter_id, [this, s] (const mutation& m) {
+            return do_with(freeze(m), [this, s] (frozen_mutation& fm) {
+                return apply(s, fm);
+            });
+        });
+    });
+}
+
+future<> database::apply_in_memory(const mutation& m, db::replay_position rp) {
+    return dirty_memory_manager_for(m.schema()->id()).region_group().run_when_memory_available([this, &m, rp] {
+        try {
+            utils::alloc_scope alloc(utils::alloc_scope_id::memtable_apply);
+            find_column_family(m.schema()->id()).apply(m, rp);
+        } catch (no_such_column_family&) {
+            dblog.error("Attempting to mutate non-existent table {}", m.schema()->id());
+        }
+    });
+}
+
+future<> database::do_apply(const mutation& m, const frozen_mutation& fm) {
+    auto s = m.schema();
+    auto& cf = find_column_family(s->id());
+    return cf.wait_for_flush_queue().then([this, s, &m, &fm, &cf] {
+        commitlog_entry_writer cew(s, fm);
+        return cf.commitlog()->add_entry(s->id(), cew).then([this, &m, &fm] (auto rp) {
+            return this->apply_in_memory(m, rp).handle_exception([this, &m, &fm] (auto ep) {
                 try {
                     std::rethrow_exception(ep);
                 } catch (replay_position_reordered_exception&) {
-                    // expensive, but we're assuming this is super rare.
-                    // if we failed to apply the mutation due to future re-ordering
-                    // (which should be the ever only reason for rp mismatch in CF)
-                    // let's just try again, add the mutation to the CL once more,
-                    // and assume success in inevitable eventually.
                     dblog.debug("replay_position reordering detected");
-                    return this->apply(s, m);
+                    return this->do_apply(m, fm);
                 }
             });
         });
-    }
-    return apply_in_memory(m, s, db::replay_position());
+    });
 }
 
-future<> database::apply(schema_ptr s, const frozen_mutation& m) {
+future<> database::apply(const mutation& m) {
+    auto s = m.schema();
+    auto& cf = find_column_family(s->id());
+    if (!cf.views().empty()) {
+        return do_with(freeze(m), [this, s] (frozen_mutation& fm) {
+            return apply(s, fm);
+        });
+    }
+    if (!s->is_synced()) {
+        throw std::runtime_error(sprint("attempted to mutate using not synced schema of %s.%s, version=%s",
+                                 s->ks_name(), s->cf_name(), s->version()));
+    }
     if (dblog.is_enabled(logging::log_level::trace)) {
-        dblog.trace("apply {}", m.pretty_printer(s));
+        dblog.trace("apply {}", m);
+    }
+    if (cf.commitlog() != nullptr) {
+        // The commitlog entry needs the serialized form, but the memtable
+        // takes the mutation itself.
+        return do_with(freeze(m), [this, &m, &cf] (frozen_mutation& fm) {
+            if (auto sampler = cf.get_top_partitions_sampler()) {
+                sampler->record_write(m.key(), fm.representation().size());
+            }
+            return do_apply(m, fm);
+        }).then([this, s = _stats] {
+            ++s->total_writes;
+        });
     }
-    return do_apply(std::move(s), m).then([this, s = _stats] {
+    return cf.wait_for_flush_queue().then([this, &m] {
+        return apply_in_memory(m, db::replay_position());
+    }).then([this, s = _stats] {
         ++s->total_writes;
     });
 }
@@ -2297,6 +4161,12 @@ future<> database::apply_streaming_mutation(schema_ptr s, utils::UUID plan_id, c
         throw std::runtime_error(sprint("attempted to mutate using not synced schema of %s.%s, version=%s",
                                  s->ks_name(), s->cf_name(), s->version()));
     }
+    if (!fragmented && column_family_exists(m.column_family_id())) {
+        auto& cf = find_column_family(m.column_family_id());
+        if (cf.writes_streaming_mutations_directly()) {
+            return cf.write_streaming_mutation(std::move(s), plan_id, m);
+        }
+    }
     return _streaming_dirty_memory_manager.region_group().run_when_memory_available([this, &m, plan_id, fragmented, s = std::move(s)] {
         auto uuid = m.column_family_id();
         auto& cf = find_column_family(uuid);
@@ -2306,10 +4176,13 @@ future<> database::apply_streaming_mutation(schema_ptr s, utils::UUID plan_id, c
 
 keyspace::config
 database::make_keyspace_config(const keyspace_metadata& ksm) {
-    // FIXME support multiple directories
     keyspace::config cfg;
     if (_cfg->data_file_directories().size() > 0) {
         cfg.datadir = sprint("%s/%s", _cfg->data_file_directories()[0], ksm.name());
+        for (auto& dir : _cfg->data_file_directories()) {
+            cfg.all_datadirs.push_back(sprint("%s/%s", dir, ksm.name()));
+        }
+        cfg.data_placement = _data_placement.get();
         cfg.enable_disk_writes = !_cfg->enable_in_memory_data_store();
         cfg.enable_disk_reads = true; // we allways read from disk
         cfg.enable_commitlog = ksm.durable_writes() && _cfg->enable_commitlog() && !_cfg->enable_in_memory_data_store();
@@ -2329,17 +4202,23 @@ database::make_keyspace_config(const keyspace_metadata& ksm) {
         // All writes should go to the main memtable list if we're not durable
         cfg.max_streaming_memtable_size = 0;
     }
-    cfg.dirty_memory_manager = &_dirty_memory_manager;
+    // The system keyspace is given its own manager by system_keyspace::make(),
+    // and mustn't take a share of the user memtable memory.
+    cfg.dirty_memory_manager = ksm.name() == db::system_keyspace::NAME ? &_system_dirty_memory_manager
+            : &keyspace_dirty_memory_manager(ksm.name());
     cfg.streaming_dirty_memory_manager = &_streaming_dirty_memory_manager;
     cfg.read_concurrency_config.sem = &_read_concurrency_sem;
+    cfg.read_concurrency_config.memory_sem = &_read_memory_sem;
+    cfg.read_concurrency_config.max_memory = _max_memory_for_reads;
     cfg.read_concurrency_config.timeout = _cfg->read_request_timeout_in_ms() * 1ms;
     // Assume a queued read takes up 10kB of memory, and allow 2% of memory to be filled up with such reads.
     cfg.read_concurrency_config.max_queue_length = memory::stats().total_memory() * 0.02 / 10000;
     cfg.read_concurrency_config.raise_queue_overloaded_exception = [this] {
         ++_stats->sstable_read_queue_overloaded;
-        throw std::runtime_error("sstable inactive read queue overloaded");
+        throw exceptions::overloaded_exception("sstable inactive read queue overloaded");
     };
     cfg.cf_stats = &_cf_stats;
+    cfg.sstable_load_sem = &_sstable_load_sem;
     cfg.enable_incremental_backups = _enable_incremental_backups;
     return cfg;
 }
@@ -2393,18 +4272,25 @@ operator<<(std::ostream& os, const atomic_cell& ac) {
 
 future<>
 database::stop() {
-    return _compaction_manager.stop().then([this] {
+    _memory_balancer.stop();
+    return _index_summary_manager.stop().then([this] {
+        return _large_partitions_gate.close();
+    }).then([this] {
+        return _compaction_manager.stop();
+    }).then([this] {
         // try to ensure that CL has done disk flushing
-        if (_commitlog != nullptr) {
-            return _commitlog->shutdown();
-        }
-        return make_ready_future<>();
+        return shutdown_commitlogs();
     }).then([this] {
+        _querier_cache.clear();
         return parallel_for_each(_column_families, [this] (auto& val_pair) {
             return val_pair.second->stop();
         });
     }).then([this] {
         return _system_dirty_memory_manager.shutdown();
+    }).then([this] {
+        return parallel_for_each(_keyspace_dirty_memory_managers, [] (auto& m) {
+            return m.second->shutdown();
+        });
     }).then([this] {
         return _dirty_memory_manager.shutdown();
     }).then([this] {
@@ -2418,6 +4304,20 @@ future<> database::flush_all_memtables() {
     });
 }
 
+void database::start_index_builds() {
+    _index_builds_enabled = true;
+    for (auto& cfp : _column_families) {
+        cfp.second->start_index_builds();
+    }
+}
+
+void database::start_view_builds() {
+    _view_builds_enabled = true;
+    for (auto& cfp : _column_families) {
+        cfp.second->start_view_builds();
+    }
+}
+
 future<> database::truncate(sstring ksname, sstring cfname, timestamp_func tsf) {
     auto& ks = find_keyspace(ksname);
     auto& cf = find_column_family(ksname, cfname);
@@ -2426,34 +4326,43 @@ future<> database::truncate(sstring ksname, sstring cfname, timestamp_func tsf)
 
 future<> database::truncate(const keyspace& ks, column_family& cf, timestamp_func tsf)
 {
-    const auto durable = ks.metadata()->durable_writes();
+    _querier_cache.evict_all_for_table(cf.schema()->id());
+
     const auto auto_snapshot = get_config().auto_snapshot();
 
-    future<> f = make_ready_future<>();
-    if (durable || auto_snapshot) {
+    future<db::replay_position> f = make_ready_future<db::replay_position>();
+    if (auto_snapshot) {
+        // The snapshot has to include the memtables.
         // TODO:
         // this is not really a guarantee at all that we've actually
         // gotten all things to disk. Again, need queue-ish or something.
-        f = cf.flush();
+        f = cf.flush().then([] {
+            return db::replay_position();
+        });
     } else {
-        f = cf.clear();
+        // The data is about to be thrown away, don't write it out first.
+        f = cf.discard_memtables();
     }
 
     return cf.run_with_compaction_disabled([f = std::move(f), &cf, auto_snapshot, tsf = std::move(tsf)]() mutable {
-        return f.then([&cf, auto_snapshot, tsf = std::move(tsf)] {
+        return f.then([&cf, auto_snapshot, tsf = std::move(tsf)] (db::replay_position memtables_rp) {
             dblog.debug("Discarding sstable data for truncated CF + indexes");
             // TODO: notify truncation
 
-            return tsf().then([&cf, auto_snapshot](db_clock::time_point truncated_at) {
+            return tsf().then([&cf, auto_snapshot, memtables_rp](db_clock::time_point truncated_at) {
                 future<> f = make_ready_future<>();
                 if (auto_snapshot) {
                     auto name = sprint("%d-%s", truncated_at.time_since_epoch().count(), cf.schema()->cf_name());
                     f = cf.snapshot(name);
                 }
-                return f.then([&cf, truncated_at] {
-                    return cf.discard_sstables(truncated_at).then([&cf, truncated_at](db::replay_position rp) {
-                        // TODO: indexes.
-                        return db::system_keyspace::save_truncation_record(cf, truncated_at, rp);
+                return f.then([&cf, truncated_at, memtables_rp] {
+                    return cf.discard_sstables(truncated_at).then([&cf, truncated_at, memtables_rp](db::replay_position rp) {
+                        db::global_counter_cache().invalidate(cf.schema()->id());
+                        // Commitlog replay must skip the discarded memtable contents too.
+                        rp = std::max(rp, memtables_rp);
+                        return cf.discard_index_sstables(truncated_at).then([&cf, truncated_at, rp] {
+                            return db::system_keyspace::save_truncation_record(cf, truncated_at, rp);
+                        });
                     });
                 });
             });
@@ -2577,36 +4486,44 @@ seal_snapshot(sstring jsondir) {
     });
 }
 
-future<> column_family::snapshot(sstring name) {
-    return flush().then([this, name = std::move(name)]() {
+// Limits the number of sstables linked into snapshots at a time, across all
+// tables being snapshotted on a shard.
+static constexpr size_t max_concurrent_snapshot_links = 64;
+static thread_local semaphore snapshot_links_sem(max_concurrent_snapshot_links);
+
+future<> column_family::snapshot(sstring name, bool skip_flush) {
+    auto f = skip_flush ? make_ready_future<>() : flush();
+    return f.then([this, name = std::move(name)]() {
         auto tables = boost::copy_range<std::vector<sstables::shared_sstable>>(*_sstables->all());
         return do_with(std::move(tables), [this, name](std::vector<sstables::shared_sstable> & tables) {
             auto jsondir = _config.datadir + "/snapshots/" + name;
+            std::set<sstring> dirs;
+            for (auto& sst : tables) {
+                dirs.insert(sst->get_dir() + "/snapshots/" + name);
+            }
 
-            return parallel_for_each(tables, [name](sstables::shared_sstable sstable) {
-                auto dir = sstable->get_dir() + "/snapshots/" + name;
-                return io_check(recursive_touch_directory, dir).then([sstable, dir] {
-                    return sstable->create_links(dir).then_wrapped([] (future<> f) {
-                        // If the SSTables are shared, one of the CPUs will fail here.
-                        // That is completely fine, though. We only need one link.
-                        try {
-                            f.get();
-                        } catch (std::system_error& e) {
-                            if (e.code() != std::error_code(EEXIST, std::system_category())) {
-                                throw;
-                            }
-                        }
-                        return make_ready_future<>();
+            return do_with(std::move(dirs), [&tables, name] (std::set<sstring>& dirs) {
+                return parallel_for_each(dirs, [] (const sstring& dir) {
+                    return io_check(recursive_touch_directory, dir);
+                }).then([&tables, name] {
+                    return parallel_for_each(tables, [name] (sstables::shared_sstable sstable) {
+                        return with_semaphore(snapshot_links_sem, 1, [sstable, name] {
+                            return sstable->create_snapshot_links(sstable->get_dir() + "/snapshots/" + name);
+                        });
+                    });
+                }).then([&dirs] {
+                    // One sync per directory makes all links in it durable
+                    // before the manifest is written.
+                    return parallel_for_each(dirs, [] (const sstring& dir) {
+                        return io_check(sync_directory, dir);
                     });
                 });
-            }).then([jsondir, &tables] {
-                // This is not just an optimization. If we have no files, jsondir may not have been created,
-                // and sync_directory would throw.
-                if (tables.size()) {
+            }).then([jsondir] {
+                // The sstables may all live in other data directories, so jsondir
+                // may not have been created by the links above.
+                return io_check(recursive_touch_directory, jsondir).then([jsondir] {
                     return io_check(sync_directory, std::move(jsondir));
-                } else {
-                    return make_ready_future<>();
-                }
+                });
             }).finally([this, &tables, jsondir] {
                 auto shard = std::hash<sstring>()(jsondir) % smp::count;
                 std::unordered_set<sstring> table_names;
@@ -2675,16 +4592,16 @@ file_missing(future<> f) {
     }
 }
 
-future<> column_family::clear_snapshot(sstring tag) {
-    sstring jsondir = _config.datadir + "/snapshots/";
-    sstring parent = _config.datadir;
+static future<> clear_snapshot_in(sstring datadir, sstring tag) {
+    sstring jsondir = datadir + "/snapshots/";
+    sstring parent = datadir;
     if (!tag.empty()) {
         jsondir += tag;
         parent += "/snapshots/";
     }
 
     lister::dir_entry_types dir_and_files = { directory_entry_type::regular, directory_entry_type::directory };
-    return lister::scan_dir(jsondir, dir_and_files, [this, curr_dir = jsondir, dir_and_files, tag] (directory_entry de) {
+    return lister::scan_dir(jsondir, dir_and_files, [curr_dir = jsondir, dir_and_files, tag] (directory_entry de) {
         // FIXME: We really need a better directory walker. This should eventually be part of the seastar infrastructure.
         // It's hard to write this in a fully recursive manner because we need to keep information about the parent directory,
         // so we can remove the file. For now, we'll take advantage of the fact that we will at most visit 2 levels and keep
@@ -2696,7 +4613,7 @@ future<> column_family::clear_snapshot(sstring tag) {
                 throw std::runtime_error(sprint("Unexpected directory %s found at %s! Aborting", de.name, curr_dir));
             }
             auto newdir = curr_dir + "/" + de.name;
-            recurse = lister::scan_dir(newdir, dir_and_files, [this, curr_dir = newdir] (directory_entry de) {
+            recurse = lister::scan_dir(newdir, dir_and_files, [curr_dir = newdir] (directory_entry de) {
                 return io_check(remove_file, curr_dir + "/" + de.name);
             });
         }
@@ -2720,19 +4637,28 @@ future<> column_family::clear_snapshot(sstring tag) {
     });
 }
 
+future<> column_family::clear_snapshot(sstring tag) {
+    return do_with(data_directories(), [tag = std::move(tag)] (const std::vector<sstring>& dirs) {
+        return do_for_each(dirs, [tag] (const sstring& datadir) {
+            return clear_snapshot_in(datadir, tag);
+        });
+    });
+}
+
 future<std::unordered_map<sstring, column_family::snapshot_details>> column_family::get_snapshot_details() {
     std::unordered_map<sstring, snapshot_details> all_snapshots;
-    return do_with(std::move(all_snapshots), [this] (auto& all_snapshots) {
-        return io_check([&] { return engine().file_exists(_config.datadir + "/snapshots"); }).then([this, &all_snapshots](bool file_exists) {
+    return do_with(std::move(all_snapshots), data_directories(), [] (auto& all_snapshots, const std::vector<sstring>& dirs) {
+        return do_for_each(dirs, [&all_snapshots] (const sstring& datadir) {
+        return io_check([&] { return engine().file_exists(datadir + "/snapshots"); }).then([datadir, &all_snapshots](bool file_exists) {
             if (!file_exists) {
                 return make_ready_future<>();
             }
-            return lister::scan_dir(_config.datadir + "/snapshots",  { directory_entry_type::directory }, [this, &all_snapshots] (directory_entry de) {
+            return lister::scan_dir(datadir + "/snapshots",  { directory_entry_type::directory }, [datadir, &all_snapshots] (directory_entry de) {
             auto snapshot_name = de.name;
-            auto snapshot = _config.datadir + "/snapshots/" + snapshot_name;
+            auto snapshot = datadir + "/snapshots/" + snapshot_name;
             all_snapshots.emplace(snapshot_name, snapshot_details());
-            return lister::scan_dir(snapshot,  { directory_entry_type::regular }, [this, &all_snapshots, snapshot, snapshot_name] (directory_entry de) {
-                return io_check(file_size, snapshot + "/" + de.name).then([this, &all_snapshots, snapshot_name, name = de.name] (auto size) {
+            return lister::scan_dir(snapshot,  { directory_entry_type::regular }, [datadir, &all_snapshots, snapshot, snapshot_name] (directory_entry de) {
+                return io_check(file_size, snapshot + "/" + de.name).then([&all_snapshots, snapshot_name, name = de.name] (auto size) {
                     // The manifest is the only file expected to be in this directory not belonging to the SSTable.
                     // For it, we account the total size, but zero it for the true size calculation.
                     //
@@ -2745,10 +4671,10 @@ future<std::unordered_map<sstring, column_family::snapshot_details>> column_fami
                         size = 0;
                     }
                     return make_ready_future<uint64_t>(size);
-                }).then([this, &all_snapshots, snapshot_name, name = de.name] (auto size) {
-                    // FIXME: When we support multiple data directories, the file may not necessarily
-                    // live in this same location. May have to test others as well.
-                    return io_check(file_size, _config.datadir + "/" + name).then_wrapped([&all_snapshots, snapshot_name, size] (auto fut) {
+                }).then([datadir, &all_snapshots, snapshot_name, name = de.name] (auto size) {
+                    // Snapshot links are made in the directory of the sstable they
+                    // link to, so it is enough to look for the file in this one.
+                    return io_check(file_size, datadir + "/" + name).then_wrapped([&all_snapshots, snapshot_name, size] (auto fut) {
                         try {
                             // File exists in the main SSTable directory. Snapshots are not contributing to size
                             fut.get0();
@@ -2763,6 +4689,7 @@ future<std::unordered_map<sstring, column_family::snapshot_details>> column_fami
                 });
             });
         });
+        });
         }).then([&all_snapshots] {
             return std::move(all_snapshots);
         });
@@ -2798,68 +4725,118 @@ future<> column_family::flush(const db::replay_position& pos) {
     return _memtables->seal_active_memtable(memtable_list::flush_behavior::immediate);
 }
 
-// FIXME: We can do much better than this in terms of cache management. Right
-// now, we only have to flush the touched ranges because of the possibility of
-// streaming containing token ownership changes.
-//
-// Right now we can't differentiate between that and a normal repair process,
-// so we always flush. When we can differentiate those streams, we should not
-// be indiscriminately touching the cache during repair. We will just have to
-// invalidate the entries that are relevant to things we already have in the cache.
+// Streamed data doesn't go through the cache, only the cache entries of the
+// partitions it has are invalidated. For the streaming memtables, that is done
+// as they are flushed, by their keys. Big streamed mutations are written to
+// sstables directly, so we only know their partitions by the sstables' bloom
+// filters: entries of the streamed ranges which the filters may contain are
+// removed here. Continuity is cleared in all of the ranges, as they may have
+// gained partitions which aren't cached.
 future<> column_family::flush_streaming_mutations(utils::UUID plan_id, std::vector<query::partition_range> ranges) {
     // This will effectively take the gate twice for this call. The proper way to fix that would
     // be to change seal_active_streaming_memtable_delayed to take a range parameter. However, we
     // need this code to go away as soon as we can (see FIXME above). So the double gate is a better
     // temporary counter measure.
     return with_gate(_streaming_flush_gate, [this, plan_id, ranges = std::move(ranges)] {
-        return flush_streaming_big_mutations(plan_id).then([this] {
+        auto big_sstables = make_lw_shared<std::vector<sstables::shared_sstable>>();
+        return flush_streaming_big_mutations(plan_id).then([this, plan_id, big_sstables] (std::vector<sstables::shared_sstable> sstables) {
+            *big_sstables = std::move(sstables);
+            return flush_streaming_writer(plan_id);
+        }).then([this, big_sstables] (std::vector<sstables::shared_sstable> sstables) {
+            big_sstables->insert(big_sstables->end(), sstables.begin(), sstables.end());
             return _streaming_memtables->seal_active_memtable(memtable_list::flush_behavior::delayed);
         }).finally([this] {
             return _streaming_flush_phaser.advance_and_await();
-        }).finally([this, ranges = std::move(ranges)] {
-            if (!_config.enable_cache) {
+        }).finally([this, ranges = std::move(ranges), big_sstables] {
+            invalidate_cached_results();
+            if (!_config.enable_cache || big_sstables->empty()) {
                 return make_ready_future<>();
             }
-            return do_with(std::move(ranges), [this] (auto& ranges) {
-                return parallel_for_each(ranges, [this](auto&& range) {
-                    return _cache.invalidate(range);
+            return do_with(std::move(ranges), [this, big_sstables] (auto& ranges) {
+                return parallel_for_each(ranges, [this, big_sstables] (auto&& range) {
+                    return _cache.invalidate(range, [this, big_sstables] (const dht::decorated_key& dk) {
+                        return boost::algorithm::any_of(*big_sstables, [this, &dk] (const sstables::shared_sstable& sst) {
+                            return sst->filter_has_key(*_schema, dk);
+                        });
+                    });
                 });
             });
         });
     });
 }
 
-future<> column_family::flush_streaming_big_mutations(utils::UUID plan_id) {
+future<std::vector<sstables::shared_sstable>> column_family::flush_streaming_big_mutations(utils::UUID plan_id) {
     auto it = _streaming_memtables_big.find(plan_id);
     if (it == _streaming_memtables_big.end()) {
-        return make_ready_future<>();
+        return make_ready_future<std::vector<sstables::shared_sstable>>();
     }
     auto entry = it->second;
     _streaming_memtables_big.erase(it);
     return entry->memtables->seal_active_memtable(memtable_list::flush_behavior::immediate).then([entry] {
         return entry->flush_in_progress.close();
     }).then([this, entry] {
-        return parallel_for_each(entry->sstables, [this] (auto& sst) {
+        return add_streamed_sstables(std::move(entry->sstables));
+    });
+}
+
+future<std::vector<sstables::shared_sstable>> column_family::flush_streaming_writer(utils::UUID plan_id) {
+    auto it = _streaming_writers.find(plan_id);
+    if (it == _streaming_writers.end()) {
+        return make_ready_future<std::vector<sstables::shared_sstable>>();
+    }
+    auto writer = it->second;
+    _streaming_writers.erase(it);
+    return writer->finish().then_wrapped([this, writer] (future<std::vector<sstables::shared_sstable>> f) {
+        if (f.failed()) {
+            auto ep = f.get_exception();
+            return writer->abort().then([ep = std::move(ep)] {
+                return make_exception_future<std::vector<sstables::shared_sstable>>(ep);
+            });
+        }
+        return add_streamed_sstables(f.get0());
+    });
+}
+
+future<std::vector<sstables::shared_sstable>> column_family::add_streamed_sstables(std::vector<sstables::shared_sstable> sstables) {
+    return do_with(std::move(sstables), [this] (auto& sstables) {
+        return parallel_for_each(sstables, [this] (auto& sst) {
             return sst->seal_sstable(this->incremental_backups_enabled()).then([sst] {
                 return sst->open_data();
             });
-        }).then([this, entry] {
-            for (auto&& sst : entry->sstables) {
+        }).then([this, &sstables] {
+            for (auto&& sst : sstables) {
                 add_sstable(sst);
             }
             trigger_compaction();
+            return std::move(sstables);
         });
     });
 }
 
+future<> column_family::abort_streaming_writers() {
+    auto writers = std::exchange(_streaming_writers, { });
+    return parallel_for_each(writers | boost::adaptors::map_values, [] (lw_shared_ptr<streaming_sstable_writer> writer) {
+        return writer->abort().finally([writer] { });
+    });
+}
+
 future<> column_family::fail_streaming_mutations(utils::UUID plan_id) {
+    auto f = make_ready_future<>();
+    auto wit = _streaming_writers.find(plan_id);
+    if (wit != _streaming_writers.end()) {
+        auto writer = wit->second;
+        _streaming_writers.erase(wit);
+        f = writer->abort().finally([writer] { });
+    }
     auto it = _streaming_memtables_big.find(plan_id);
     if (it == _streaming_memtables_big.end()) {
-        return make_ready_future<>();
+        return f;
     }
     auto entry = it->second;
     _streaming_memtables_big.erase(it);
-    return entry->flush_in_progress.close().then([this, entry] {
+    return f.then([entry] {
+        return entry->flush_in_progress.close();
+    }).then([this, entry] {
         for (auto&& sst : entry->sstables) {
             sst->mark_for_deletion();
         }
@@ -2872,7 +4849,31 @@ future<> column_family::clear() {
     _streaming_memtables->clear();
     _streaming_memtables->add_memtable();
     _streaming_memtables_big.clear();
-    return _cache.clear();
+    invalidate_cached_results();
+    return abort_streaming_writers().then([this] {
+        return _cache.clear();
+    }).then([this] {
+        return parallel_for_each(_indexes | boost::adaptors::map_values, [] (lw_shared_ptr<local_index> idx) {
+            return idx->cf->clear();
+        });
+    });
+}
+
+future<db::replay_position> column_family::discard_memtables() {
+    // Let flushes which are already running finish, their sstables are
+    // discarded with the rest.
+    return _flush_queue->wait_for_pending().then([this] {
+        auto rp = _highest_flushed_rp;
+        for (auto&& m : *_memtables) {
+            rp = std::max(rp, m->replay_position());
+        }
+        return clear().then([this, rp] {
+            if (_commitlog && rp != db::replay_position()) {
+                _commitlog->discard_completed_segments(_schema->id(), rp);
+            }
+            return rp;
+        });
+    });
 }
 
 // NOTE: does not need to be futurized, but might eventually, depending on
@@ -2897,6 +4898,7 @@ future<db::replay_position> column_family::discard_sstables(db_clock::time_point
         }
 
         _sstables = std::move(pruned);
+        invalidate_cached_results();
         dblog.debug("cleaning out row cache");
         return _cache.clear().then([rp, remove = std::move(remove)] () mutable {
             return parallel_for_each(remove, [](sstables::shared_sstable s) {
@@ -2965,4 +4967,12 @@ void column_family::set_schema(schema_ptr s) {
 
     set_compaction_strategy(_schema->compaction_strategy());
     trigger_compaction();
+
+    if (!_index_gate.is_closed()) {
+        with_gate(_index_gate, [this] {
+            return update_indexes();
+        }).handle_exception([this] (std::exception_ptr ep) {
+            dblog.error("Failed to update indexes of {}.{}: {}", _schema->ks_name(), _schema->cf_name(), ep);
+        });
+    }
 }
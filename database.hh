@@ -37,6 +37,7 @@
 #include <functional>
 #include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <set>
 #include <iostream>
@@ -67,10 +68,17 @@
 #include "sstables/compaction_manager.hh"
 #include "utils/exponential_backoff_retry.hh"
 #include "utils/histogram.hh"
+#include "utils/hdr_histogram.hh"
 #include "sstables/estimated_histogram.hh"
 #include "sstables/compaction.hh"
 #include "sstables/sstable_set.hh"
+#include "sstables/index_summary_manager.hh"
+#include "memory_balancer.hh"
 #include "key_reader.hh"
+#include "querier_cache.hh"
+#include "db/data_placement.hh"
+#include "db/top_partitions_sampler.hh"
+#include "replica_load.hh"
 #include <seastar/core/rwlock.hh>
 #include <seastar/core/shared_future.hh>
 
@@ -104,6 +112,28 @@ class replay_position_reordered_exception : public std::exception {};
 using shared_memtable = lw_shared_ptr<memtable>;
 class memtable_list;
 
+class dirty_memory_manager;
+
+// A slot for running a flush, obtained from dirty_memory_manager::get_flush_permit().
+// Giving it up lets the next waiting flush start.
+class flush_permit {
+    dirty_memory_manager* _manager;
+public:
+    explicit flush_permit(dirty_memory_manager* manager) : _manager(manager) {}
+    flush_permit(flush_permit&& o) noexcept : _manager(std::exchange(o._manager, nullptr)) {}
+    flush_permit& operator=(flush_permit&& o) noexcept {
+        if (this != &o) {
+            release();
+            _manager = std::exchange(o._manager, nullptr);
+        }
+        return *this;
+    }
+    ~flush_permit() {
+        release();
+    }
+    void release();
+};
+
 class dirty_memory_manager: public logalloc::region_group_reclaimer {
     // We need a separate boolean, because from the LSA point of view, pressure may still be
     // mounting, in which case the pressure flag could be set back on if we force it off.
@@ -130,12 +160,49 @@ class dirty_memory_manager: public logalloc::region_group_reclaimer {
     // FIXME: enable write behind and set both to 1. Right now we will take advantage of the fact
     // that memtables and streaming will use different specialized classes here and set them as
     // default values here.
+    //
+    // A memtable flush gives up its slot as soon as its sstable is written, so that the next
+    // flush writes while the previous one is being merged into cache. Flushes waiting for a slot
+    // are not started in FIFO order, but by how much memory they release and how old the
+    // commitlog segments they hold back are, see pending_flush::score().
     size_t _concurrency;
-    semaphore _flush_serializer;
+    size_t _running_flushes = 0;
+
+    struct pending_flush {
+        size_t memory;
+        db::replay_position rp;
+        uint64_t seq;
+        promise<flush_permit> pr;
+
+        // Memory weighted by the number of commitlog segments written since the memtable's
+        // oldest one, so that a small memtable pinning old segments isn't starved by the
+        // big ones.
+        double score(const db::replay_position& newest) const {
+            auto age = rp.id && newest.id > rp.id ? newest.id - rp.id : 0;
+            return double(memory) * (1 + age);
+        }
+    };
+    std::vector<pending_flush> _waiting_flushes;
+    uint64_t _next_flush_seq = 0;
 
     seastar::gate _waiting_flush_gate;
     std::vector<shared_memtable> _pending_flushes;
+
+    // The memtables of each user keyspace are accounted by a manager of
+    // their own, below the one of all user memtables, which caps the memory
+    // a single keyspace can take. Keyspace managers take their flush slots
+    // from the parent, which flushes the keyspace using the most memory
+    // first when under pressure.
+    dirty_memory_manager* _parent_manager = nullptr;
+    std::vector<dirty_memory_manager*> _keyspace_managers;
+
+    // Memtables are flushed above this, before the throttle threshold is
+    // reached, when the memory is better used by the cache.
+    size_t _soft_limit = std::numeric_limits<size_t>::max();
+
     void maybe_do_active_flush();
+    void release_flush_permit();
+    friend class flush_permit;
 protected:
     virtual memtable_list& get_memtable_list(column_family& cf) = 0;
     virtual void start_reclaiming() override;
@@ -146,15 +213,13 @@ class dirty_memory_manager: public logalloc::region_group_reclaimer {
                                            : logalloc::region_group_reclaimer(threshold)
                                            , _db(db)
                                            , _region_group(*this)
-                                           , _concurrency(concurrency)
-                                           , _flush_serializer(concurrency) {}
+                                           , _concurrency(concurrency) {}
 
     dirty_memory_manager(database* db, dirty_memory_manager *parent, size_t threshold, size_t concurrency)
                                                                          : logalloc::region_group_reclaimer(threshold)
                                                                          , _db(db)
                                                                          , _region_group(&parent->_region_group, *this)
-                                                                         , _concurrency(concurrency)
-                                                                         , _flush_serializer(concurrency) {}
+                                                                         , _concurrency(concurrency) {}
     logalloc::region_group& region_group() {
         return _region_group;
     }
@@ -163,11 +228,31 @@ class dirty_memory_manager: public logalloc::region_group_reclaimer {
         return _region_group;
     }
 
+    void add_keyspace_manager(dirty_memory_manager& m) {
+        m._parent_manager = this;
+        _keyspace_managers.push_back(&m);
+    }
+
+    void set_soft_limit(size_t limit) {
+        _soft_limit = limit;
+        maybe_do_active_flush();
+    }
+
+    void set_throttle_threshold(size_t threshold) {
+        _threshold = threshold;
+        // Releases requests which the new threshold lets through.
+        _region_group.update(0);
+    }
+
+    // Waits for a flush slot. When several flushes wait, the one which releases the most
+    // memory, weighted by the age of its replay position, gets the slot first.
+    future<flush_permit> get_flush_permit(size_t memory, db::replay_position rp);
+
     template <typename Func>
     future<> serialize_flush(Func&& func) {
         return seastar::with_gate(_waiting_flush_gate,  [this, func] () mutable {
-            return with_semaphore(_flush_serializer, 1, func).finally([this] {
-                maybe_do_active_flush();
+            return get_flush_permit(0, db::replay_position()).then([func] (flush_permit permit) mutable {
+                return futurize_apply(func).finally([permit = std::move(permit)] { });
             });
         });
     }
@@ -299,12 +384,31 @@ using sstable_list = sstables::sstable_list;
 struct cf_stats {
     int64_t pending_memtables_flushes_count = 0;
     int64_t pending_memtables_flushes_bytes = 0;
+    // Memtables sealed and not flushed yet, see column_family::config::memtable_flush_queue_size.
+    int64_t memtables_queued_for_flush = 0;
+    int64_t writes_waiting_for_flush_queue = 0;
+    uint64_t writes_blocked_by_flush_queue = 0;
+    // sstables waiting for, or in the middle of, being loaded.
+    int64_t pending_sstable_loads = 0;
+    uint64_t sstables_loaded = 0;
+    // Totals of the single partition sstable reads, see column_family::stats.
+    uint64_t sstable_point_reads = 0;
+    uint64_t sstables_checked = 0;
+    uint64_t sstables_read = 0;
+    uint64_t filter_false_positives = 0;
+    uint64_t index_reads = 0;
+    uint64_t data_bytes_read = 0;
 };
 
 class column_family {
 public:
     struct config {
         sstring datadir;
+        // datadir and its counterparts in the other data file directories,
+        // in the order of data_placement's directories. New sstables are
+        // spread over them, datadir holds snapshot manifests and uploads.
+        std::vector<sstring> all_datadirs;
+        db::data_placement* data_placement = nullptr;
         bool enable_disk_writes = true;
         bool enable_disk_reads = true;
         bool enable_cache = true;
@@ -316,7 +420,34 @@ class column_family {
         ::dirty_memory_manager* streaming_dirty_memory_manager = &default_dirty_memory_manager;
         restricted_mutation_reader_config read_concurrency_config;
         ::cf_stats* cf_stats = nullptr;
+        // Bounds the number of sstables being loaded concurrently.
+        semaphore* sstable_load_sem = nullptr;
         uint64_t max_cached_partition_size_in_bytes;
+        unsigned major_compaction_sub_ranges = 1;
+        // Compactions writing several bounded size sstables make the ones
+        // already written readable each time this much more was written.
+        // 0 disables early opening of compaction output.
+        uint64_t sstable_preemptive_open_interval = 0;
+        // Size of the sstables size-tiered and major compactions split
+        // their output into. 0 writes a single sstable.
+        uint64_t compaction_fragment_size = 0;
+        // Format new sstables are written in.
+        sstables::sstable::version_types sstable_write_version = sstables::sstable::version_types::ka;
+        // Queries scanning more tombstones than this are logged.
+        uint32_t tombstone_warn_threshold = query::max_rows;
+        // Queries scanning more tombstones than this are aborted.
+        uint32_t tombstone_failure_threshold = query::max_rows;
+        // Partitions aren't distributed among shards by token, every shard
+        // owns all data it has. Used by local index tables.
+        bool shard_local = false;
+        // How often sweep_expired_data() runs. 0 disables it.
+        std::chrono::seconds expired_data_sweep_period{0};
+        // Writes wait while this many memtables are sealed and not flushed
+        // yet. 0 doesn't bound them.
+        size_t memtable_flush_queue_size = 0;
+        // Flushes of the table running at once, including the move of the
+        // flushed memtable into cache. 0 leaves it to the dirty memory manager.
+        size_t memtable_flush_concurrency = 0;
     };
     struct no_commitlog {};
     struct stats {
@@ -329,13 +460,31 @@ class column_family {
         int64_t live_sstable_count = 0;
         /** Estimated number of compactions pending for this column family */
         int64_t pending_compactions = 0;
+        // Bytes written by flushes, and read and written by compactions.
+        // Write amplification is all the bytes written over those flushed.
+        int64_t bytes_flushed = 0;
+        int64_t compactions_completed = 0;
+        int64_t compaction_bytes_read = 0;
+        int64_t compaction_bytes_written = 0;
         utils::timed_rate_moving_average_and_histogram reads{256};
         utils::timed_rate_moving_average_and_histogram writes{256};
         sstables::estimated_histogram estimated_read;
         sstables::estimated_histogram estimated_write;
+        // Sstables read from, past their filter, by each single partition read.
         sstables::estimated_histogram estimated_sstable_per_read;
+        // Read amplification of single partition reads: sstables whose range
+        // covers the key, filter false positives, index lookups, and bytes of
+        // the data file spanned by the partitions read.
+        sstables::estimated_histogram sstables_checked_per_read;
+        sstables::estimated_histogram false_positives_per_read;
+        sstables::estimated_histogram index_reads_per_read;
+        sstables::estimated_histogram data_bytes_per_read;
         utils::timed_rate_moving_average_and_histogram tombstone_scanned;
         utils::timed_rate_moving_average_and_histogram live_scanned;
+        // Latencies of every local read, range scan and write, in microseconds.
+        utils::hdr_histogram read_latency;
+        utils::hdr_histogram range_latency;
+        utils::hdr_histogram write_latency;
     };
 
     struct snapshot_details {
@@ -345,7 +494,8 @@ class column_family {
 private:
     schema_ptr _schema;
     config _config;
-    stats _stats;
+    // Updated by reads, which are const.
+    mutable stats _stats;
 
     lw_shared_ptr<memtable_list> _memtables;
 
@@ -366,6 +516,12 @@ class column_family {
     // even multiple senders, as well as automatically tapping into the dirty
     // memory throttling mechanism, guaranteeing we will not overload the
     // server.
+    //
+    // Column families which write to disk now write unfragmented streamed
+    // mutations to sstables directly instead (see streaming_sstable_writer),
+    // which orders what it can with a small bounded buffer and saves a copy
+    // of all the streamed data to memory. The streaming memtables remain for
+    // writes which don't go through it.
     lw_shared_ptr<memtable_list> _streaming_memtables;
     utils::phased_barrier _streaming_flush_phaser;
 
@@ -386,7 +542,20 @@ class column_family {
     };
     std::unordered_map<utils::UUID, lw_shared_ptr<streaming_memtable_big>> _streaming_memtables_big;
 
-    future<> flush_streaming_big_mutations(utils::UUID plan_id);
+    // Unfragmented mutations of a streaming plan are written straight to
+    // sstables, without the streaming memtable, when disk writes are enabled.
+    // As with streaming_memtable_big, the sstables are made visible only once
+    // the plan is done with the column family.
+    class streaming_sstable_writer;
+    std::unordered_map<utils::UUID, lw_shared_ptr<streaming_sstable_writer>> _streaming_writers;
+
+    // Returns the sstables the big mutations were written to.
+    future<std::vector<sstables::shared_sstable>> flush_streaming_big_mutations(utils::UUID plan_id);
+    // Returns the sstables the plan's streaming_sstable_writer wrote to.
+    future<std::vector<sstables::shared_sstable>> flush_streaming_writer(utils::UUID plan_id);
+    future<> abort_streaming_writers();
+    // Seals and opens sstables of a streaming plan and makes them visible.
+    future<std::vector<sstables::shared_sstable>> add_streamed_sstables(std::vector<sstables::shared_sstable> sstables);
     void apply_streaming_big_mutation(schema_ptr m_schema, utils::UUID plan_id, const frozen_mutation& m);
     future<> seal_active_streaming_memtable_big(streaming_memtable_big& smb);
 
@@ -414,6 +583,14 @@ class column_family {
     rwlock _sstables_lock;
     mutable row_cache _cache; // Cache covers only sstables.
     std::experimental::optional<int64_t> _sstable_generation = {};
+    // Generations of the unrepaired sstables which existed when an incremental
+    // repair session started to read this column family, by session, see
+    // start_repair_session(). Sessions of failed repairs are dropped when a
+    // later one starts.
+    std::map<uint64_t, std::unordered_set<int64_t>> _repair_sessions;
+    static constexpr size_t max_repair_sessions = 16;
+    // Set while partitions accessed by reads and writes are being sampled.
+    std::unique_ptr<db::top_partitions_sampler> _top_partitions;
 
     db::replay_position _highest_flushed_rp;
     // Provided by the database that owns this commitlog
@@ -422,6 +599,11 @@ class column_family {
     int _compaction_disabled = 0;
     class memtable_flush_queue;
     std::unique_ptr<memtable_flush_queue> _flush_queue;
+    // Sealed memtables which aren't flushed yet, and the writes waiting for
+    // their number to drop below _config.memtable_flush_queue_size.
+    size_t _queued_memtable_flushes = 0;
+    std::vector<promise<>> _flush_queue_waiters;
+    std::experimental::optional<semaphore> _flush_concurrency_sem;
     // Because streaming mutations bypass the commitlog, there is
     // no need for the complications of the flush queue. Besides, it
     // is easier to just use a common gate than it is to modify the flush_queue
@@ -430,15 +612,61 @@ class column_family {
     // Last but not least, we seldom need to guarantee any ordering here: as long
     // as all data is waited for, we're good.
     seastar::gate _streaming_flush_gate;
+
+    // Shard local index table of an indexed column. See db/index/local_index.hh.
+    struct local_index {
+        bytes column_name;
+        lw_shared_ptr<column_family> cf;
+        // Set once the sstables of the index were loaded, writes to the
+        // column family are reflected in the index from then on.
+        bool ready = false;
+        // Set once the index covers all data of the column family, reads can
+        // use it from then on.
+        bool built = false;
+        bool building = false;
+    };
+    // By index name.
+    std::unordered_map<sstring, lw_shared_ptr<local_index>> _indexes;
+    bool _index_builds_enabled = false;
+    // Keeps background opening and building of indexes.
+    seastar::gate _index_gate;
+
+    // Materialized views of this column family. See db/view/view.hh.
+    std::vector<schema_ptr> _views;
+    // Serializes the read-before-write of view updates of writes to the same
+    // partition, so that each of them sees the writes which preceded it.
+    std::unordered_map<dht::token, lw_shared_ptr<semaphore>> _view_update_locks;
+    // Serializes the read-modify-write of counter updates to the same
+    // partition, see apply_counter_update().
+    std::unordered_map<dht::token, lw_shared_ptr<semaphore>> _counter_update_locks;
+    // Advanced whenever cached query results of this column family are
+    // invalidated, so that a query which raced with a write doesn't cache
+    // its result.
+    uint64_t _cached_results_phase = 0;
+    bool _view_builds_enabled = false;
+    std::unordered_set<utils::UUID> _views_building;
+    // Keeps background builds of views.
+    seastar::gate _view_build_gate;
+    // Runs sweep_expired_data() periodically.
+    timer<> _expired_data_sweep_timer;
+    seastar::gate _expired_data_sweep_gate;
+    // Bounds of a step of sweep_expired_data(), which yields between steps.
+    static constexpr size_t expired_data_sweep_partitions_per_step = 128;
+    static constexpr size_t expired_data_sweep_max_rows = 1024;
 private:
     void update_stats_for_new_sstable(uint64_t disk_space_used_by_sstable);
     void add_sstable(sstables::sstable&& sstable);
     void add_sstable(lw_shared_ptr<sstables::sstable> sstable);
     future<> load_sstable(sstables::sstable&& sstab, bool reset_level = false);
+    future<> do_load_sstable(lw_shared_ptr<sstables::sstable> sst, bool reset_level);
     lw_shared_ptr<memtable> new_memtable();
     lw_shared_ptr<memtable> new_streaming_memtable();
-    future<stop_iteration> try_flush_memtable_to_sstable(lw_shared_ptr<memtable> memt);
+    future<stop_iteration> try_flush_memtable_to_sstable(lw_shared_ptr<memtable> memt, flush_permit& permit);
     future<> update_cache(memtable&, sstables::shared_sstable exclude_sstable);
+    // Drops the cached query results of given partition, or of all of them,
+    // see db::query_result_cache.
+    void invalidate_cached_results(partition_key_view pk);
+    void invalidate_cached_results();
     struct merge_comparator;
 
     // update the sstable generation, making sure that new new sstables don't overwrite this one.
@@ -449,6 +677,19 @@ class column_family {
         _sstable_generation = std::max<uint64_t>(*_sstable_generation, generation /  smp::count + 1);
     }
 
+    // Returns the directory a new sstable of about estimated_size bytes is
+    // to be written to, and the permit accounting the write to it.
+    std::pair<sstring, db::data_placement::permit> new_sstable_directory(uint64_t estimated_size);
+    // The directories sstables of this column family may be found in.
+    std::vector<sstring> data_directories() const {
+        return _config.all_datadirs.empty() ? std::vector<sstring>{_config.datadir} : _config.all_datadirs;
+    }
+
+    // The format flushes, compactions and streaming write new sstables in.
+    sstables::sstable::version_types sstable_write_version() const {
+        return _config.sstable_write_version;
+    }
+
     uint64_t calculate_generation_for_new_table() {
         assert(_sstable_generation);
         // FIXME: better way of ensuring we don't attempt to
@@ -460,6 +701,9 @@ class column_family {
     void rebuild_sstable_list(const std::vector<sstables::shared_sstable>& new_sstables,
                               const std::vector<sstables::shared_sstable>& sstables_to_remove);
     void rebuild_statistics();
+    // Deletes compacted sstables, which were moved from the sstable set to
+    // _sstables_compacted_but_not_deleted, in the background.
+    void delete_compacted_sstables(std::vector<sstables::shared_sstable> sstables);
 private:
     // Creates a mutation reader which covers sstables.
     // Caller needs to ensure that column_family remains live (FIXME: relax this).
@@ -472,9 +716,27 @@ class column_family {
 
     mutation_source sstables_as_mutation_source();
     key_source sstables_as_key_source() const;
+    key_source memtables_as_key_source() const;
+    // Whether every partition of the sstables covering the range is live, so
+    // that their keys can be listed from the indexes alone.
+    bool has_only_live_sstable_partitions(const schema& s, const query::partition_range& range) const;
     partition_presence_checker make_partition_presence_checker(sstables::shared_sstable exclude_sstable);
     std::chrono::steady_clock::time_point _sstable_writes_disabled_at;
     void do_trigger_compaction();
+
+    sstring index_directory(const sstring& index_name) const;
+    // Creates index tables for columns of the current schema which became
+    // indexed and drops those of columns which no longer are. The returned
+    // future resolves when the new index tables are ready.
+    future<> update_indexes();
+    future<> open_index(lw_shared_ptr<local_index> idx);
+    future<> build_index(sstring name, lw_shared_ptr<local_index> idx);
+    sstring index_build_marker(const sstring& index_name) const;
+    void apply_to_indexes(const mutation& m);
+    void maybe_build_view(schema_ptr view);
+    future<> build_view(schema_ptr view);
+    schema_ptr find_view(const utils::UUID& id) const;
+    future<> flush_indexes();
 public:
 
     // This function should be called when this column family is ready for writes, IOW,
@@ -504,12 +766,45 @@ class column_family {
     // Mutations returned by the reader will all have given schema.
     // If I/O needs to be issued to read anything in the specified range, the operations
     // will be scheduled under the priority class given by pc.
+    // With bypass_cache, the reader reads memtables and sstables directly,
+    // leaving the cache as it is.
     mutation_reader make_reader(schema_ptr schema,
             const query::partition_range& range = query::full_partition_range,
             const query::clustering_key_filtering_context& ck_filtering = query::no_clustering_key_filtering,
-            const io_priority_class& pc = default_priority_class()) const;
-
-    mutation_source as_mutation_source() const;
+            const io_priority_class& pc = default_priority_class(),
+            bool bypass_cache = false) const;
+
+    mutation_source as_mutation_source(bool bypass_cache = false) const;
+
+    // The manager writes to this column family are throttled by.
+    ::dirty_memory_manager& get_dirty_memory_manager() const {
+        return *_config.dirty_memory_manager;
+    }
+
+    // Like make_reader() with bypass_cache, but reads the unrepaired sstables
+    // only, for incremental repair.
+    mutation_reader make_unrepaired_reader(schema_ptr schema,
+            const query::partition_range& range,
+            const io_priority_class& pc) const;
+    // Remembers the unrepaired sstables of this column family as those read
+    // by incremental repair session repaired_at, unless it already started.
+    // Only those can be marked as repaired when the session succeeds, see
+    // finish_repair_session(), as sstables written later may have data which
+    // the repair didn't see.
+    void start_repair_session(uint64_t repaired_at);
+    // Ends an incremental repair session, returning its sstables which are
+    // still live.
+    std::vector<sstables::shared_sstable> finish_repair_session(uint64_t repaired_at);
+    // Source of the rows matching the restriction, read through the local
+    // index of the restricted column.
+    mutation_source as_index_mutation_source(query::index_restriction restriction) const;
+
+    // Counter of the tombstones scanned by a query, with this column
+    // family's thresholds.
+    query::tombstone_counter make_tombstone_counter() const;
+    // Records the tombstones scanned by a query in the statistics, and
+    // logs queries which went over the thresholds.
+    void account_scanned_tombstones(const schema& s, const query::tombstone_counter& tombstones);
 
     // Queries can be satisfied from multiple data sources, so they are returned
     // as temporaries.
@@ -547,11 +842,20 @@ class column_family {
     void apply(const frozen_mutation& m, const schema_ptr& m_schema, const db::replay_position& = db::replay_position());
     void apply(const mutation& m, const db::replay_position& = db::replay_position());
     void apply_streaming_mutation(schema_ptr, utils::UUID plan_id, const frozen_mutation&, bool fragmented);
+    // Whether unfragmented streamed mutations go to write_streaming_mutation()
+    // rather than to apply_streaming_mutation().
+    bool writes_streaming_mutations_directly() const {
+        return _config.enable_disk_writes;
+    }
+    // Writes a streamed mutation to the plan's sstables. The returned future
+    // resolves once the writer has room for more.
+    future<> write_streaming_mutation(schema_ptr, utils::UUID plan_id, const frozen_mutation&);
 
     // Returns at most "cmd.limit" rows
     future<lw_shared_ptr<query::result>> query(schema_ptr,
-        const query::read_command& cmd, query::result_request request,
-        const std::vector<query::partition_range>& ranges);
+        const query::read_command& cmd, query::result_options opts,
+        const std::vector<query::partition_range>& ranges,
+        querier_cache* cache = nullptr);
 
     future<> populate(sstring datadir);
 
@@ -559,10 +863,45 @@ class column_family {
     future<> stop();
     future<> flush();
     future<> flush(const db::replay_position&);
+    // Resolves once the table has room for more sealed memtables, see
+    // config::memtable_flush_queue_size. Writes wait on it before going to
+    // the commitlog, so that a slow disk throttles them rather than piling up
+    // memtables.
+    future<> wait_for_flush_queue();
     future<> flush_streaming_mutations(utils::UUID plan_id, std::vector<query::partition_range> ranges = std::vector<query::partition_range>{});
     future<> fail_streaming_mutations(utils::UUID plan_id);
     future<> clear(); // discards memtable(s) without flushing them to disk.
+    // Like clear(), and releases the commitlog segments of the discarded data.
+    // Returns the highest replay position of the discarded data.
+    future<db::replay_position> discard_memtables();
     future<db::replay_position> discard_sstables(db_clock::time_point);
+    future<> discard_index_sstables(db_clock::time_point);
+
+    // Starts building the indexes which don't cover the column family yet,
+    // and those created later. Needs the system keyspace to be set up.
+    void start_index_builds();
+
+    const std::vector<schema_ptr>& views() const {
+        return _views;
+    }
+    void add_or_update_view(schema_ptr view);
+    void remove_view(schema_ptr view);
+    // Applies a write to this column family, through apply_base, and sends
+    // the updates of its views generated by it. The write must be to a
+    // column family with views.
+    future<> push_view_replica_updates(const schema_ptr& s, const frozen_mutation& fm, std::function<future<> ()> apply_base);
+    // Turns the counter updates of m into counter cells holding the shard
+    // counter_id with its new value and clock, and applies them through
+    // apply. Returns the mutation which was applied.
+    future<mutation> apply_counter_update(const schema_ptr& s, mutation m, const utils::UUID& counter_id,
+            std::function<future<> (const mutation&)> apply);
+    // Starts building the views whose build on this shard didn't complete,
+    // and those created later. Needs the system keyspace to be set up.
+    void start_view_builds();
+
+    bool is_shard_local() const {
+        return _config.shard_local;
+    }
 
     // Important warning: disabling writes will only have an effect in the current shard.
     // The other shards will keep writing tables at will. Therefore, you very likely need
@@ -621,12 +960,26 @@ class column_family {
     // FIXME: this is just an example, should be changed to something more
     // general. compact_all_sstables() starts a compaction of all sstables.
     // It doesn't flush the current memtable first. It's just a ad-hoc method,
-    // not a real compaction policy.
+    // not a real compaction policy. Repaired and unrepaired sstables are
+    // compacted separately.
     future<> compact_all_sstables();
     // Compact all sstables provided in the vector.
     // If cleanup is set to true, compaction_sstables will run on behalf of a cleanup job,
     // meaning that irrelevant keys will be discarded.
     future<> compact_sstables(sstables::compaction_descriptor descriptor, bool cleanup = false);
+    // Makes sstables written by a compaction which is still running readable,
+    // in place of the same partitions of the sstables being compacted.
+    //
+    // Those of the compacted sstables which have nothing left past what was
+    // written are released: removed from the sstable set and deleted. They
+    // are returned, and must not be deleted again when the compaction is
+    // done. Once it released any, a failed compaction has to keep the
+    // sstables it opened early, which hold the data of the released ones.
+    std::vector<sstables::shared_sstable> open_early(const std::vector<sstables::shared_sstable>& new_sstables,
+                                                     const std::vector<sstables::shared_sstable>& compacting);
+    // Undoes open_early(), for a compaction which failed.
+    void revert_early_open(const std::vector<sstables::shared_sstable>& new_sstables,
+                           const std::vector<sstables::shared_sstable>& compacting);
     // Performs a cleanup on each sstable of this column family, excluding
     // those ones that are irrelevant to this node or being compacted.
     // Cleanup is about discarding keys that are no longer relevant for a
@@ -637,7 +990,9 @@ class column_family {
     future<bool> snapshot_exists(sstring name);
 
     future<> load_new_sstables(std::vector<sstables::entry_descriptor> new_tables);
-    future<> snapshot(sstring name);
+    // Unless skip_flush is set, memtables are flushed first. Otherwise the
+    // snapshot holds what is in sstables only, like after a crash.
+    future<> snapshot(sstring name, bool skip_flush = false);
     future<> clear_snapshot(sstring name);
     future<std::unordered_map<sstring, snapshot_details>> get_snapshot_details();
 
@@ -667,10 +1022,32 @@ class column_family {
         return _compaction_strategy;
     }
 
+    // Size of the sstables of the output runs of size-tiered and major
+    // compactions, see the compaction_fragment_size_in_mb option.
+    uint64_t compaction_fragment_size() const {
+        return _config.compaction_fragment_size ? _config.compaction_fragment_size : std::numeric_limits<uint64_t>::max();
+    }
+
     const stats& get_stats() const {
         return _stats;
     }
 
+    // Called by compaction (not cleanups) once it has written its output.
+    void account_compaction(uint64_t bytes_read, uint64_t bytes_written) {
+        _stats.compactions_completed++;
+        _stats.compaction_bytes_read += bytes_read;
+        _stats.compaction_bytes_written += bytes_written;
+    }
+
+    // Starts counting the partitions read and written, keeping track of at
+    // most capacity of them. Returns false if sampling was already running.
+    bool start_top_partitions_sampling(size_t capacity);
+    // Stops sampling and returns the partitions seen most often.
+    db::top_partitions_sampler::results stop_top_partitions_sampling();
+    db::top_partitions_sampler* get_top_partitions_sampler() {
+        return _top_partitions.get();
+    }
+
     compaction_manager& get_compaction_manager() const {
         return _compaction_manager;
     }
@@ -696,6 +1073,7 @@ class column_family {
     // waiting on this future. This is useful in situations where we want to
     // synchronously flush data to disk.
     future<> seal_active_memtable(memtable_list::flush_behavior behavior = memtable_list::flush_behavior::delayed);
+    void memtable_flush_done();
 
     // I am assuming here that the repair process will potentially send ranges containing
     // few mutations, definitely not enough to fill a memtable. It wants to know whether or
@@ -742,8 +1120,18 @@ class column_family {
     future<bool> for_all_partitions(schema_ptr, Func&& func) const;
     future<sstables::entry_descriptor> probe_file(sstring sstdir, sstring fname);
     void check_valid_rp(const db::replay_position&) const;
+    void arm_expired_data_sweep();
 public:
-    void start_rewrite();
+    // Starts rewriting the sstables load_sstable() found to be shared with
+    // other shards. The returned future resolves when all rewrites are done.
+    future<> start_rewrite();
+    // Compacts the partitions of the cache and of the active memtable, with
+    // preemption between steps, so that expired cells turn into tombstones
+    // and the data they, and other tombstones, cover is freed. The cache also
+    // drops tombstones past gc_grace_seconds; memtables keep them, as they may
+    // shadow data in sstables. Partitions being read are skipped, as are wide
+    // and large ones.
+    future<> sweep_expired_data();
     // Iterate over all partitions.  Protocol is the same as std::all_of(),
     // so that iteration can be stopped by returning false.
     future<bool> for_all_partitions_slow(schema_ptr, std::function<bool (const dht::decorated_key&, const mutation_partition&)> func) const;
@@ -831,6 +1219,16 @@ class keyspace_metadata final {
     void remove_column_family(const schema_ptr& s) {
         _cf_meta_data.erase(s->cf_name());
     }
+    // Materialized views of the table with the given id.
+    std::vector<schema_ptr> views_of(const utils::UUID& base_id) const {
+        std::vector<schema_ptr> views;
+        for (auto&& p : _cf_meta_data) {
+            if (p.second->is_view() && p.second->view_info().base_id == base_id) {
+                views.push_back(p.second);
+            }
+        }
+        return views;
+    }
     void add_user_type(const user_type ut) {
         _user_types->add_type(ut);
     }
@@ -844,6 +1242,9 @@ class keyspace {
 public:
     struct config {
         sstring datadir;
+        // datadir and its counterparts in the other data file directories.
+        std::vector<sstring> all_datadirs;
+        db::data_placement* data_placement = nullptr;
         bool enable_commitlog = true;
         bool enable_disk_reads = true;
         bool enable_disk_writes = true;
@@ -855,6 +1256,7 @@ class keyspace {
         ::dirty_memory_manager* streaming_dirty_memory_manager = &default_dirty_memory_manager;
         restricted_mutation_reader_config read_concurrency_config;
         ::cf_stats* cf_stats = nullptr;
+        semaphore* sstable_load_sem = nullptr;
     };
 private:
     std::unique_ptr<locator::abstract_replication_strategy> _replication_strategy;
@@ -911,8 +1313,21 @@ class keyspace {
     const sstring& datadir() const {
         return _config.datadir;
     }
+    const std::vector<sstring>& all_datadirs() const {
+        return _config.all_datadirs;
+    }
 
     sstring column_family_directory(const sstring& name, utils::UUID uuid) const;
+    // The directories of the column family in all data file directories.
+    std::vector<sstring> column_family_directories(const sstring& name, utils::UUID uuid) const;
+    static sstring column_family_directory(const sstring& ksdir, const sstring& name, utils::UUID uuid);
+};
+
+// Thrown by replica work found to have passed the deadline of its request,
+// when nobody waits for its result any more.
+class expired_request_exception : public std::runtime_error {
+public:
+    expired_request_exception() : std::runtime_error("Request expired on the replica") {}
 };
 
 class no_such_keyspace : public std::runtime_error {
@@ -935,10 +1350,17 @@ class database {
     ::cf_stats _cf_stats;
     static constexpr size_t max_concurrent_reads() { return 100; }
     static constexpr size_t max_system_concurrent_reads() { return 10; }
+    // Loading an sstable is mostly waiting for small reads of its metadata
+    // components, so many loads are needed to keep the disk busy.
+    static constexpr size_t max_concurrent_sstable_loads() { return 64; }
     struct db_stats {
         uint64_t total_writes = 0;
         uint64_t total_reads = 0;
+        // Serialized size of the mutations applied to memtables.
+        uint64_t total_bytes_written = 0;
         uint64_t sstable_read_queue_overloaded = 0;
+        // Reads which passed their deadline before they were done.
+        uint64_t expired_reads = 0;
     };
 
     lw_shared_ptr<db_stats> _stats;
@@ -949,23 +1371,51 @@ class database {
     memtable_dirty_memory_manager _system_dirty_memory_manager;
     memtable_dirty_memory_manager _dirty_memory_manager;
     streaming_dirty_memory_manager _streaming_dirty_memory_manager;
+    // Memtable quotas of the user keyspaces, below _dirty_memory_manager.
+    // Kept for the lifetime of the database, as memtables of a dropped
+    // keyspace may still be around.
+    std::unordered_map<sstring, std::unique_ptr<memtable_dirty_memory_manager>> _keyspace_dirty_memory_managers;
     semaphore _read_concurrency_sem{max_concurrent_reads()};
+    // Budget of the estimated buffer memory of admitted sstable reads.
+    size_t _max_memory_for_reads;
+    semaphore _read_memory_sem{0};
     restricted_mutation_reader_config _read_concurrency_config;
     semaphore _system_read_concurrency_sem{max_system_concurrent_reads()};
     restricted_mutation_reader_config _system_read_concurrency_config;
+    semaphore _sstable_load_sem{max_concurrent_sstable_loads()};
+    // Counter updates applied concurrently by this shard as the leader.
+    semaphore _counter_write_sem;
+    std::unique_ptr<db::data_placement> _data_placement;
 
     std::unordered_map<sstring, keyspace> _keyspaces;
     std::unordered_map<utils::UUID, lw_shared_ptr<column_family>> _column_families;
     std::unordered_map<std::pair<sstring, sstring>, utils::UUID, utils::tuple_hash> _ks_cf_to_uuid;
     std::unique_ptr<db::commitlog> _commitlog;
+    // Commitlogs of keyspaces and tables listed in commitlog_isolated_tables,
+    // keyed by "ks" or "ks.table".
+    std::unordered_map<sstring, std::unique_ptr<db::commitlog>> _isolated_commitlogs;
     utils::UUID _version;
     // compaction_manager object is referenced by all column families of a database.
     compaction_manager _compaction_manager;
+    sstables::index_summary_manager _index_summary_manager;
+    memory_balancer _memory_balancer;
+    // Background writes of entries of system.large_partitions.
+    seastar::gate _large_partitions_gate;
+    querier_cache _querier_cache;
     std::vector<scollectd::registration> _collectd;
     bool _enable_incremental_backups = false;
+    bool _index_builds_enabled = false;
+    bool _view_builds_enabled = false;
 
     future<> init_commitlog();
+    db::commitlog* commitlog_for(const schema& s) const;
     future<> apply_in_memory(const frozen_mutation& m, schema_ptr m_schema, db::replay_position);
+    future<> apply_in_memory(const mutation& m, db::replay_position);
+    dirty_memory_manager& dirty_memory_manager_for(const utils::UUID& cf_id);
+    dirty_memory_manager& keyspace_dirty_memory_manager(const sstring& ks_name);
+    void update_keyspace_memtable_quotas();
+    void start_memory_balancer();
+    void on_large_partition(const sstables::sstable& sst, const schema& s, const sstables::key& k, uint64_t size, uint64_t rows);
     future<> populate(sstring datadir);
     future<> populate_keyspace(sstring datadir, sstring ks_name);
 
@@ -978,6 +1428,8 @@ class database {
     void setup_collectd();
 
     future<> do_apply(schema_ptr, const frozen_mutation&);
+    // Logs fm, the frozen form of m, and applies m to the memtable.
+    future<> do_apply(const mutation& m, const frozen_mutation& fm);
 public:
     static utils::UUID empty_version;
 
@@ -997,6 +1449,10 @@ class database {
         return _commitlog.get();
     }
 
+    // The shared commitlog followed by all isolated ones.
+    std::vector<db::commitlog*> commitlogs() const;
+    future<> shutdown_commitlogs();
+
     compaction_manager& get_compaction_manager() {
         return _compaction_manager;
     }
@@ -1042,10 +1498,26 @@ class database {
     unsigned shard_of(const dht::token& t);
     unsigned shard_of(const mutation& m);
     unsigned shard_of(const frozen_mutation& m);
-    future<lw_shared_ptr<query::result>> query(schema_ptr, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& ranges);
+    future<lw_shared_ptr<query::result>> query(schema_ptr, const query::read_command& cmd, query::result_options opts, const std::vector<query::partition_range>& ranges);
     future<reconcilable_result> query_mutations(schema_ptr, const query::read_command& cmd, const query::partition_range& range);
     future<> apply(schema_ptr, const frozen_mutation&);
+    // Applies a mutation of counter updates as their leader, see
+    // column_family::apply_counter_update(). Returns the mutation of counter
+    // cells to replicate.
+    future<mutation> apply_counter_update(schema_ptr, const frozen_mutation&, const utils::UUID& counter_id);
+    // Applies a mutation built on this shard. The memtable takes it as is,
+    // without going through a frozen_mutation; it is only serialized for
+    // the commitlog entry, and for tables with views. The mutation must
+    // be kept alive until the returned future resolves.
+    future<> apply(const mutation&);
     future<> apply_streaming_mutation(schema_ptr, utils::UUID plan_id, const frozen_mutation&, bool fragmented);
+    // Runs func, which must not return a future, once memtables are below
+    // their dirty memory limit. Lets commitlog replay apply mutations straight
+    // into memtables without getting ahead of the flushes that free memory.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> run_when_memory_available(Func&& func) {
+        return _dirty_memory_manager.region_group().run_when_memory_available(std::forward<Func>(func));
+    }
     keyspace::config make_keyspace_config(const keyspace_metadata& ksm);
     const sstring& get_snitch_name() const;
     future<> clear_snapshot(sstring tag, std::vector<sstring> keyspace_names);
@@ -1080,6 +1552,14 @@ class database {
 
     future<> flush_all_memtables();
 
+    // Starts building local indexes of all column families of this shard,
+    // and of those added later. Called once the system keyspace is set up.
+    void start_index_builds();
+
+    // Starts building materialized views of all column families of this
+    // shard, and of those added later. Called once the system keyspace is set up.
+    void start_view_builds();
+
     // See #937. Truncation now requires a callback to get a time stamp
     // that must be guaranteed to be the same for all shards.
     typedef std::function<future<db_clock::time_point>()> timestamp_func;
@@ -1094,6 +1574,22 @@ class database {
         return _dirty_memory_manager.region_group();
     }
 
+    const logalloc::region_group& system_dirty_memory_region_group() const {
+        return _system_dirty_memory_manager.region_group();
+    }
+
+    const logalloc::region_group& streaming_dirty_memory_region_group() const {
+        return _streaming_dirty_memory_manager.region_group();
+    }
+
+    // Estimated buffer memory of the admitted sstable reads.
+    size_t sstable_reads_memory_in_use() const {
+        return _max_memory_for_reads - std::min<size_t>(_max_memory_for_reads, std::max<ssize_t>(_read_memory_sem.available_units(), 0));
+    }
+
+    // Load of this shard, as reported to coordinators.
+    replica_load get_load() const;
+
     std::unordered_set<sstring> get_initial_tokens();
     std::experimental::optional<gms::inet_address> get_replace_address();
     bool is_replacing();
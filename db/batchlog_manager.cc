@@ -55,6 +55,7 @@
 #include "serializer.hh"
 #include "db_clock.hh"
 #include "database.hh"
+#include "dht/i_partitioner.hh"
 #include "unimplemented.hh"
 #include "db/config.hh"
 #include "gms/failure_detector.hh"
@@ -70,7 +71,8 @@
 static logging::logger logger("batchlog_manager");
 
 const uint32_t db::batchlog_manager::replay_interval;
-const uint32_t db::batchlog_manager::page_size;
+const uint32_t db::batchlog_manager::max_page_size;
+const size_t db::batchlog_manager::page_target_bytes;
 
 db::batchlog_manager::batchlog_manager(cql3::query_processor& qp)
         : _qp(qp)
@@ -91,8 +93,12 @@ future<> db::batchlog_manager::do_batch_log_replay() {
         });
     }).then([] (auto dest) {
         logger.debug("Batchlog replay on shard {}: starts", dest);
-        return get_batchlog_manager().invoke_on(dest, [] (auto& bm) {
-            return bm.replay_all_failed_batches();
+        return get_batchlog_manager().invoke_on_all([] (auto& bm) {
+            bm.reset_limiter();
+        }).then([dest] {
+            return get_batchlog_manager().invoke_on(dest, [] (auto& bm) {
+                return bm.replay_all_failed_batches();
+            });
         }).then([dest] {
             logger.debug("Batchlog replay on shard {}: done", dest);
         });
@@ -107,9 +113,10 @@ future<> db::batchlog_manager::start() {
     // Since replay is a "node global" operation, we should not attempt to do
     // it in parallel on each shard. It will just overlap/interfere.  To
     // simplify syncing between the timer and user initiated replay operations,
-    // we use the _timer and _sem on shard zero only. Replaying batchlog can
-    // generate a lot of work, so we distrute the real work on all cpus with
-    // round-robin scheduling.
+    // we use the _timer and _sem on shard zero only. The batchlog is read by
+    // one shard, picked with round-robin scheduling, and each batch is then
+    // replayed by the shard which owns it, so that the real work is spread
+    // over all cpus.
     if (engine().cpu_id() == 0) {
         _timer.set_callback([this] {
             return do_batch_log_replay().handle_exception([] (auto ep) {
@@ -170,40 +177,35 @@ db_clock::duration db::batchlog_manager::get_batch_log_timeout() const {
     return db_clock::duration(_qp.db().local().get_config().write_request_timeout_in_ms()) * 2;
 }
 
-future<> db::batchlog_manager::replay_all_failed_batches() {
-    typedef db_clock::rep clock_type;
-
+void db::batchlog_manager::reset_limiter() {
     // rate limit is in bytes per second. Uses Double.MAX_VALUE if disabled (set to 0 in cassandra.yaml).
-    // max rate is scaled by the number of nodes in the cluster (same as for HHOM - see CASSANDRA-5272).
+    // max rate is scaled by the number of nodes in the cluster (same as for HHOM - see CASSANDRA-5272),
+    // and split among the shards, which all replay batches.
     auto throttle_in_kb = _qp.db().local().get_config().batchlog_replay_throttle_in_kb() / service::get_storage_service().local().get_token_metadata().get_all_endpoints().size();
-    auto limiter = make_lw_shared<utils::rate_limiter>(throttle_in_kb * 1000);
-
-    auto batch = [this, limiter](const cql3::untyped_result_set::row& row) {
-        auto written_at = row.get_as<db_clock::time_point>("written_at");
-        auto id = row.get_as<utils::UUID>("id");
-        // enough time for the actual write + batchlog entry mutation delivery (two separate requests).
-        auto timeout = get_batch_log_timeout();
-        if (db_clock::now() < written_at + timeout) {
-            logger.debug("Skipping replay of {}, too fresh", id);
-            return make_ready_future<>();
-        }
-
-        // check version of serialization format
-        if (!row.has("version")) {
-            logger.warn("Skipping logged batch because of unknown version");
-            return make_ready_future<>();
-        }
+    auto rate = throttle_in_kb * 1024 / smp::count;
+    if (throttle_in_kb && !rate) {
+        rate = 1;
+    }
+    _limiter = make_lw_shared<utils::rate_limiter>(rate);
+}
 
-        auto version = row.get_as<int32_t>("version");
-        if (version != net::messaging_service::current_version) {
-            logger.warn("Skipping logged batch because of incorrect version");
-            return make_ready_future<>();
-        }
+uint32_t db::batchlog_manager::page_size_for(size_t mean_batch_size) {
+    if (!mean_batch_size) {
+        return max_page_size;
+    }
+    return std::max<size_t>(1, std::min<size_t>(max_page_size, page_target_bytes / mean_batch_size));
+}
 
-        auto data = row.get_blob("data");
+future<> db::batchlog_manager::replay_batch(utils::UUID id, db_clock::time_point written_at, bytes data) {
+    typedef db_clock::rep clock_type;
 
+    return seastar::with_gate(_gate, [this, id, written_at, data = std::move(data)] {
         logger.debug("Replaying batch {}", id);
 
+        if (!_limiter) {
+            reset_limiter();
+        }
+        auto limiter = _limiter;
         auto fms = make_lw_shared<std::deque<canonical_mutation>>();
         auto in = ser::as_input_stream(data);
         while (in.size()) {
@@ -285,13 +287,44 @@ future<> db::batchlog_manager::replay_all_failed_batches() {
             m.partition().apply_delete(*schema, {}, tombstone(now, gc_clock::now()));
             return _qp.proxy().local().mutate_locally(m);
         });
+    });
+}
+
+future<> db::batchlog_manager::replay_all_failed_batches() {
+    auto batch = [this](const cql3::untyped_result_set::row& row) {
+        auto written_at = row.get_as<db_clock::time_point>("written_at");
+        auto id = row.get_as<utils::UUID>("id");
+        // enough time for the actual write + batchlog entry mutation delivery (two separate requests).
+        auto timeout = get_batch_log_timeout();
+        if (db_clock::now() < written_at + timeout) {
+            logger.debug("Skipping replay of {}, too fresh", id);
+            return make_ready_future<>();
+        }
+
+        // check version of serialization format
+        if (!row.has("version")) {
+            logger.warn("Skipping logged batch because of unknown version");
+            return make_ready_future<>();
+        }
+
+        auto version = row.get_as<int32_t>("version");
+        if (version != net::messaging_service::current_version) {
+            logger.warn("Skipping logged batch because of incorrect version");
+            return make_ready_future<>();
+        }
+
+        auto schema = _qp.db().local().find_schema(system_keyspace::NAME, system_keyspace::BATCHLOG);
+        auto shard = dht::shard_of(dht::global_partitioner().get_token(*schema, partition_key::from_singular(*schema, id)));
+        return get_batchlog_manager().invoke_on(shard, [id, written_at, data = row.get_blob("data")] (auto& bm) mutable {
+            return bm.replay_batch(id, written_at, std::move(data));
+        });
     };
 
     return seastar::with_gate(_gate, [this, batch = std::move(batch)] {
         logger.debug("Started replayAllFailedBatches (cpu {})", engine().cpu_id());
 
         typedef ::shared_ptr<cql3::untyped_result_set> page_ptr;
-        sstring query = sprint("SELECT id, data, written_at, version FROM %s.%s LIMIT %d", system_keyspace::NAME, system_keyspace::BATCHLOG, page_size);
+        sstring query = sprint("SELECT id, data, written_at, version FROM %s.%s LIMIT %d", system_keyspace::NAME, system_keyspace::BATCHLOG, _page_size);
         return _qp.execute_internal(query).then([this, batch = std::move(batch)](page_ptr page) {
             return do_with(std::move(page), [this, batch = std::move(batch)](page_ptr & page) mutable {
                 return repeat([this, &page, batch = std::move(batch)]() mutable {
@@ -299,14 +332,21 @@ future<> db::batchlog_manager::replay_all_failed_batches() {
                         return make_ready_future<stop_iteration>(stop_iteration::yes);
                     }
                     auto id = page->back().get_as<utils::UUID>("id");
-                    return parallel_for_each(*page, batch).then([this, &page, id]() {
-                        if (page->size() < page_size) {
+                    auto requested = _page_size;
+                    // Size the next page after the batches of this one.
+                    size_t bytes = 0;
+                    for (auto& row : *page) {
+                        bytes += row.get_view("data").size();
+                    }
+                    _page_size = page_size_for(bytes / page->size());
+                    return parallel_for_each(*page, batch).then([this, &page, id, requested]() {
+                        if (page->size() < requested) {
                             return make_ready_future<stop_iteration>(stop_iteration::yes); // we've exhausted the batchlog, next query would be empty.
                         }
                         sstring query = sprint("SELECT id, data, written_at, version FROM %s.%s WHERE token(id) > token(?) LIMIT %d",
                                 system_keyspace::NAME,
                                 system_keyspace::BATCHLOG,
-                                page_size);
+                                _page_size);
                         return _qp.execute_internal(query, {id}).then([&page](auto res) {
                                     page = std::move(res);
                                     return make_ready_future<stop_iteration>(stop_iteration::no);
@@ -362,40 +402,37 @@ std::unordered_set<gms::inet_address> db::batchlog_manager::endpoint_filter(cons
         return boost::copy_range<return_type>(validated | boost::adaptors::map_values);
     }
 
-    if (validated.size() - validated.count(local_rack) >= 2) {
-        // we have enough endpoints in other racks
-        validated.erase(local_rack);
-    }
-
-    if (validated.bucket_count() == 1) {
-        // we have only 1 `other` rack
-        auto res = validated | boost::adaptors::map_values;
-        if (validated.size() > 2) {
-            return boost::copy_range<return_type>(
-                    boost::copy_range<std::vector<gms::inet_address>>(res)
-                            | boost::adaptors::sliced(0, 2));
-        }
-        return boost::copy_range<return_type>(res);
-    }
-
-    // randomize which racks we pick from if more than 2 remaining
+    // Prefer two random live members of the local rack, so that writing the
+    // batchlog doesn't cost cross-rack traffic. Only if the local rack doesn't
+    // have enough of them pick the rest from random other racks, one per rack.
+    auto pick = [this] (std::vector<gms::inet_address>& v) {
+        std::uniform_int_distribution<size_t> rdist(0, v.size() - 1);
+        auto i = v.begin() + rdist(_e1);
+        auto a = *i;
+        v.erase(i);
+        return a;
+    };
 
-    std::vector<sstring> racks = boost::copy_range<std::vector<sstring>>(validated | boost::adaptors::map_keys);
+    return_type result;
 
-    if (validated.bucket_count() > 2) {
-        std::shuffle(racks.begin(), racks.end(), _e1);
-        racks.resize(2);
+    auto local = boost::copy_range<std::vector<gms::inet_address>>(validated.equal_range(local_rack) | boost::adaptors::map_values);
+    while (!local.empty() && result.size() < 2) {
+        result.emplace(pick(local));
     }
 
-    std::unordered_set<gms::inet_address> result;
+    validated.erase(local_rack);
+    std::vector<sstring> racks;
+    for (auto i = validated.begin(); i != validated.end(); i = validated.equal_range(i->first).second) {
+        racks.push_back(i->first);
+    }
+    std::shuffle(racks.begin(), racks.end(), _e1);
 
-    // grab a random member of up to two racks
     for (auto& rack : racks) {
-        auto rack_members = validated.bucket(rack);
-        auto n = validated.bucket_size(rack_members);
-        auto cpy = boost::copy_range<std::vector<gms::inet_address>>(validated.equal_range(rack) | boost::adaptors::map_values);
-        std::uniform_int_distribution<size_t> rdist(0, n - 1);
-        result.emplace(cpy[rdist(_e1)]);
+        if (result.size() >= 2) {
+            break;
+        }
+        auto rack_members = boost::copy_range<std::vector<gms::inet_address>>(validated.equal_range(rack) | boost::adaptors::map_values);
+        result.emplace(pick(rack_members));
     }
 
     return result;
@@ -50,13 +50,18 @@
 #include "cql3/query_processor.hh"
 #include "gms/inet_address.hh"
 #include "db_clock.hh"
+#include "utils/rate_limiter.hh"
 
 namespace db {
 
 class batchlog_manager {
 private:
     static constexpr uint32_t replay_interval = 60 * 1000; // milliseconds
-    static constexpr uint32_t page_size = 128; // same as HHOM, for now, w/out using any heuristics. TODO: set based on avg batch size.
+    // Pages of batches are read at most this many at a time (same as HHOM),
+    // and fewer if they are large, so that a page takes about
+    // page_target_bytes.
+    static constexpr uint32_t max_page_size = 128;
+    static constexpr size_t page_target_bytes = 4 * 1024 * 1024;
 
     using clock_type = lowres_clock;
 
@@ -74,10 +79,17 @@ class batchlog_manager {
     unsigned _cpu = 0;
     bool _stop = false;
 
+    uint32_t _page_size = max_page_size;
+    // Throttles the batches replayed by this shard in a replay round.
+    lw_shared_ptr<utils::rate_limiter> _limiter;
+
     std::random_device _rd;
     std::default_random_engine _e1;
 
     future<> replay_all_failed_batches();
+    future<> replay_batch(utils::UUID id, db_clock::time_point written_at, bytes data);
+    void reset_limiter();
+    static uint32_t page_size_for(size_t mean_batch_size);
 public:
     // Takes a QP, not a distributes. Because this object is supposed
     // to be per shard and does no dispatching beyond delegating the the
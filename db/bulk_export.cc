@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/bulk_export.hh"
+#include "database.hh"
+#include "frozen_schema.hh"
+#include "frozen_mutation.hh"
+#include "disk-error-handler.hh"
+#include "checked-file-impl.hh"
+#include "service/priority_manager.hh"
+#include "utils/fb_utilities.hh"
+#include "log.hh"
+#include "core/fstream.hh"
+#include "core/thread.hh"
+#include "net/byteorder.hh"
+
+namespace db {
+
+static logging::logger logger("bulk_export");
+
+static future<> write_record(output_stream<char>& out, bytes_view data) {
+    auto size = net::hton(uint32_t(data.size()));
+    return out.write(reinterpret_cast<const char*>(&size), sizeof(size)).then([&out, data] {
+        return out.write(reinterpret_cast<const char*>(data.begin()), data.size());
+    });
+}
+
+// Must be called from a seastar thread.
+static uint64_t export_shard(column_family& cf, const sstring& dir, const std::vector<query::partition_range>& ranges) {
+    auto& pc = service::get_local_bulk_export_priority();
+    io_check(recursive_touch_directory, dir).get();
+    auto path = sprint("%s/%d.export", dir, engine().cpu_id());
+    auto f = open_checked_file_dma(general_disk_error, path, open_flags::wo | open_flags::create | open_flags::exclusive).get0();
+    file_output_stream_options options;
+    options.io_priority_class = pc;
+    auto out = make_file_output_stream(std::move(f), options);
+
+    uint64_t partitions = 0;
+    std::exception_ptr ex;
+    try {
+        auto s = cf.schema();
+        auto fs = frozen_schema(s);
+        write_record(out, fs.representation()).get();
+        for (auto&& pr : ranges) {
+            // Reads memtables and sstables, leaving the cache as it is.
+            auto reader = cf.make_reader(s, pr, query::no_clustering_key_filtering, pc, true);
+            while (auto sm = reader().get0()) {
+                fragment_and_freeze(std::move(*sm), [&out] (frozen_mutation fm, bool) {
+                    return do_with(std::move(fm), [&out] (const frozen_mutation& fm) {
+                        return write_record(out, fm.representation());
+                    });
+                }).get();
+                ++partitions;
+            }
+        }
+        write_record(out, bytes_view()).get();
+        out.flush().get();
+    } catch (...) {
+        ex = std::current_exception();
+    }
+    out.close().get();
+    if (ex) {
+        std::rethrow_exception(ex);
+    }
+    logger.debug("Exported {} partitions of {}.{} to {}", partitions, cf.schema()->ks_name(), cf.schema()->cf_name(), path);
+    return partitions;
+}
+
+future<uint64_t> export_primary_ranges(distributed<database>& db, sstring ks_name, sstring cf_name, sstring tag) {
+    if (tag.empty() || tag.find('/') != sstring::npos) {
+        throw std::invalid_argument(sprint("Invalid export name '%s'", tag));
+    }
+    auto& ks = db.local().find_keyspace(ks_name);
+    auto s = db.local().find_schema(ks_name, cf_name);
+    auto dir = ks.column_family_directory(s->cf_name(), s->id()) + "/exports/" + tag;
+
+    std::vector<query::partition_range> ranges;
+    for (auto&& r : ks.get_replication_strategy().get_primary_ranges(utils::fb_utilities::get_broadcast_address())) {
+        if (r.is_wrap_around(dht::token_comparator())) {
+            auto unwrapped = r.unwrap();
+            ranges.push_back(dht::to_partition_range(unwrapped.second));
+            ranges.push_back(dht::to_partition_range(unwrapped.first));
+        } else {
+            ranges.push_back(dht::to_partition_range(r));
+        }
+    }
+    logger.info("Exporting {} primary ranges of {}.{} to {}", ranges.size(), ks_name, cf_name, dir);
+    return io_check([dir] { return engine().file_exists(dir); }).then([&db, id = s->id(), dir, ranges = std::move(ranges), tag] (bool exists) {
+        if (exists) {
+            throw std::runtime_error(sprint("Export %s already exists", tag));
+        }
+        return db.map_reduce0([id, dir, ranges] (database& db) {
+            return seastar::async([&db, id, dir, ranges] {
+                return export_shard(db.find_column_family(id), dir, ranges);
+            });
+        }, uint64_t(0), std::plus<uint64_t>());
+    }).then([dir] (uint64_t partitions) {
+        return io_check(sync_directory, dir).then([partitions] {
+            return partitions;
+        });
+    });
+}
+
+}
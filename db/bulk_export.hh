@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/distributed.hh"
+#include "core/sstring.hh"
+
+class database;
+
+namespace db {
+
+// Node-local bulk export of a table, for consumers which want all of its
+// data in bulk, rather than going through CQL range scans.
+//
+// The data the node is the primary replica of is read by every shard straight
+// from its memtables and sstables, without populating the cache and under the
+// bulk_export I/O priority class, and written without reconciliation with the
+// other replicas to <table directory>/exports/<tag>/<shard>.export. Integers
+// are big endian, and each file holds:
+//
+//   - a u32 size, followed by the frozen_schema of the table,
+//   - for each partition, in ring order within each primary range, records
+//     made of a u32 size followed by a frozen_mutation. Large partitions are
+//     split into several consecutive records of the same key,
+//   - a u32 0, marking the end of the file.
+//
+// Fails if the export exists already. Returns the number of partitions written.
+future<uint64_t> export_primary_ranges(distributed<database>& db, sstring ks_name, sstring cf_name, sstring tag);
+
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/cache_saver.hh"
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/util/log.hh>
+#include <boost/range/irange.hpp>
+#include "database.hh"
+#include "db/config.hh"
+#include "row_cache.hh"
+#include "service/priority_manager.hh"
+#include "utils/data_input.hh"
+#include "utils/data_output.hh"
+
+static seastar::logger logger("cache_saver");
+
+namespace db {
+
+distributed<cache_saver> _cache_saver;
+
+static constexpr uint32_t saved_cache_format_version = 1;
+
+cache_saver::cache_saver(distributed<database>& db)
+    : _db(db)
+    , _save_period(db.local().get_config().row_cache_save_period())
+    , _keys_to_save(db.local().get_config().row_cache_keys_to_save())
+    , _directory(db.local().get_config().saved_caches_directory())
+{
+    _timer.set_callback([this] {
+        save().handle_exception([] (std::exception_ptr ep) {
+            logger.warn("Failed to save row cache keys: {}", ep);
+        }).finally([this] {
+            if (!_gate.is_closed()) {
+                _timer.arm(_save_period);
+            }
+        });
+    });
+}
+
+void cache_saver::start() {
+    if (_save_period.count()) {
+        _timer.arm(_save_period);
+    }
+}
+
+sstring cache_saver::file_name() const {
+    return sprint("%s/RowCache-%d.db", _directory, engine().cpu_id());
+}
+
+std::vector<cache_saver::saved_key> cache_saver::collect_hot_keys() const {
+    std::vector<saved_key> keys;
+    global_cache_tracker().for_each_hot_entry([&] (const cache_entry& e) {
+        if (e.key().has_key()) {
+            keys.emplace_back(saved_key{e.schema()->id(), to_bytes(e.key().key()->representation())});
+        }
+        return _keys_to_save && keys.size() >= _keys_to_save ? stop_iteration::yes : stop_iteration::no;
+    });
+    return keys;
+}
+
+future<> cache_saver::save() {
+    return with_gate(_gate, [this] {
+        auto keys = collect_hot_keys();
+
+        size_t size = 2 * sizeof(uint32_t);
+        for (auto&& k : keys) {
+            size += 2 * sizeof(int64_t) + data_output::serialized_size(k.key);
+        }
+        bytes buf(bytes::initialized_later(), size);
+        data_output out(buf);
+        out.write(saved_cache_format_version);
+        out.write(uint32_t(keys.size()));
+        for (auto&& k : keys) {
+            out.write(k.cf_id.get_most_significant_bits());
+            out.write(k.cf_id.get_least_significant_bits());
+            out.write(k.key);
+        }
+
+        auto tmp = file_name() + ".tmp";
+        logger.debug("Saving {} row cache keys to {}", keys.size(), file_name());
+        return recursive_touch_directory(_directory).then([tmp] {
+            return open_file_dma(tmp, open_flags::wo | open_flags::create | open_flags::truncate);
+        }).then([buf = std::move(buf)] (file f) mutable {
+            return do_with(make_file_output_stream(std::move(f)), std::move(buf), [] (output_stream<char>& out, bytes& buf) {
+                return out.write(reinterpret_cast<const char*>(buf.data()), buf.size()).then([&out] {
+                    return out.flush();
+                }).then([&out] {
+                    return out.close();
+                });
+            });
+        }).then([this, tmp] {
+            return engine().rename_file(tmp, file_name());
+        }).then([this] {
+            return sync_directory(_directory);
+        });
+    });
+}
+
+future<> cache_saver::load() {
+    auto name = file_name();
+    return engine().file_exists(name).then([this, name] (bool exists) {
+        if (!exists) {
+            return make_ready_future<>();
+        }
+        return open_file_dma(name, open_flags::ro).then([] (file f) {
+            return do_with(std::move(f), [] (file& f) {
+                return f.size().then([&f] (uint64_t size) {
+                    return f.dma_read_exactly<char>(0, size);
+                });
+            });
+        }).then([this, name] (temporary_buffer<char> buf) {
+            std::vector<saved_key> keys;
+            data_input in(buf);
+            auto version = in.read<uint32_t>();
+            if (version != saved_cache_format_version) {
+                logger.warn("Ignoring {}: unsupported format version {}", name, version);
+                return make_ready_future<>();
+            }
+            auto count = in.read<uint32_t>();
+            keys.reserve(count);
+            while (count--) {
+                auto msb = in.read<int64_t>();
+                auto lsb = in.read<int64_t>();
+                keys.emplace_back(saved_key{utils::UUID(msb, lsb), in.read<bytes>()});
+            }
+
+            // The number of shards may have changed since the keys were
+            // saved, so warm each key up on the shard which owns it now.
+            std::vector<std::vector<saved_key>> per_shard(smp::count);
+            auto& db = _db.local();
+            for (auto&& k : keys) {
+                if (!db.column_family_exists(k.cf_id)) {
+                    continue;
+                }
+                auto s = db.find_column_family(k.cf_id).schema();
+                auto token = dht::global_partitioner().get_token(*s, partition_key::from_bytes(k.key));
+                per_shard[dht::shard_of(token)].push_back(std::move(k));
+            }
+            logger.info("Warming up row cache with {} keys from {}", keys.size(), name);
+            return parallel_for_each(boost::irange<unsigned>(0, smp::count), [per_shard = std::move(per_shard)] (unsigned shard) mutable {
+                return smp::submit_to(shard, [keys = std::move(per_shard[shard])] () mutable {
+                    return get_local_cache_saver().warm_up(std::move(keys));
+                });
+            });
+        }).handle_exception([name] (std::exception_ptr ep) {
+            logger.warn("Failed to load saved row cache keys from {}: {}", name, ep);
+        });
+    });
+}
+
+future<> cache_saver::warm_up(std::vector<saved_key> keys) {
+    return with_gate(_gate, [this, keys = std::move(keys)] () mutable {
+        return do_with(std::move(keys), [this] (std::vector<saved_key>& keys) {
+            return do_for_each(keys, [this] (saved_key& k) {
+                auto& db = _db.local();
+                if (!db.column_family_exists(k.cf_id) || _gate.is_closed()) {
+                    return make_ready_future<>();
+                }
+                auto& cf = db.find_column_family(k.cf_id);
+                auto s = cf.schema();
+                auto dk = dht::global_partitioner().decorate_key(*s, partition_key::from_bytes(std::move(k.key)));
+                return do_with(query::partition_range::make_singular(std::move(dk)), [&cf, s] (auto& range) {
+                    return do_with(cf.get_row_cache().make_reader(s, range, query::no_clustering_key_filtering,
+                            service::get_local_cache_warmup_priority()), [] (mutation_reader& reader) {
+                        // Reading through the cache populates it.
+                        return reader().discard_result();
+                    });
+                }).handle_exception([] (std::exception_ptr ep) {
+                    logger.debug("Failed to warm up partition: {}", ep);
+                });
+            });
+        });
+    });
+}
+
+future<> cache_saver::stop() {
+    _timer.cancel();
+    auto f = _save_period.count() ? save() : make_ready_future<>();
+    return f.handle_exception([] (std::exception_ptr ep) {
+        logger.warn("Failed to save row cache keys: {}", ep);
+    }).then([this] {
+        return _gate.close();
+    });
+}
+
+}
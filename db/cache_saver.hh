@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/distributed.hh>
+#include "utils/UUID.hh"
+#include "bytes.hh"
+
+class database;
+
+namespace db {
+
+/**
+ * Saves keys of the hottest row_cache partitions to saved_caches_directory
+ * and warms up the cache from them on the next boot.
+ *
+ * Every shard periodically (every row_cache_save_period seconds, 0 disables
+ * saving) writes the row_cache_keys_to_save most recently used partition keys
+ * of the shard-wide cache_tracker into its own file. On boot, load() reads
+ * the keys back and reads each of them through the row_cache of its table, on
+ * the shard which owns it, using a low I/O priority class.
+ */
+class cache_saver {
+public:
+    struct saved_key {
+        utils::UUID cf_id;
+        bytes key;
+    };
+private:
+    distributed<database>& _db;
+    std::chrono::seconds _save_period;
+    uint32_t _keys_to_save;
+    sstring _directory;
+    timer<> _timer;
+    seastar::gate _gate;
+private:
+    sstring file_name() const;
+    std::vector<saved_key> collect_hot_keys() const;
+    future<> warm_up(std::vector<saved_key> keys);
+public:
+    cache_saver(distributed<database>& db);
+
+    // Arms the periodic save timer.
+    void start();
+    // Saves this shard's keys.
+    future<> save();
+    // Loads keys saved by this shard and warms up the cache with them.
+    future<> load();
+    future<> stop();
+};
+
+extern distributed<cache_saver> _cache_saver;
+inline cache_saver& get_local_cache_saver() {
+    return _cache_saver.local();
+}
+inline distributed<cache_saver>& get_cache_saver() {
+    return _cache_saver;
+}
+
+}
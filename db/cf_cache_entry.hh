@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "bytes.hh"
+#include "keys.hh"
+#include "net/byteorder.hh"
+#include "utils/UUID.hh"
+#include "utils/lsa_lru_cache.hh"
+
+namespace db {
+
+// Keys of the entries of caches of per-partition data, like counter_cache
+// and query_result_cache. They start with the serialized partition key, so
+// that the entries of a partition are next to each other and can be
+// invalidated together:
+//
+//   <key> := <uint32_t:size of pk><pk><rest of the key>
+class cf_cache_key_builder {
+    bytes _key;
+    bytes::iterator _out;
+public:
+    // rest_size is the size of what is written after the partition key.
+    cf_cache_key_builder(partition_key_view pk, size_t rest_size)
+        : _key(bytes::initialized_later(), sizeof(uint32_t) + pk.representation().size() + rest_size)
+        , _out(_key.begin())
+    {
+        auto pk_bytes = pk.representation();
+        write(uint32_t(pk_bytes.size()));
+        write(pk_bytes);
+    }
+
+    template<typename T>
+    void write(T v) {
+        auto u = net::hton(v);
+        _out = std::copy_n(reinterpret_cast<const char*>(&u), sizeof(u), _out);
+    }
+
+    void write(bytes_view v) {
+        _out = std::copy(v.begin(), v.end(), _out);
+    }
+
+    bytes build() && {
+        return std::move(_key);
+    }
+};
+
+// The common prefix of the keys of the entries of a partition.
+inline bytes cf_cache_partition_prefix(partition_key_view pk) {
+    return cf_cache_key_builder(pk, 0).build();
+}
+
+class cf_cache_entry : public utils::lsa_lru_cache_entry {
+    utils::UUID _cf_id;
+    managed_bytes _key;
+public:
+    cf_cache_entry(const utils::UUID& cf_id, bytes_view key)
+        : _cf_id(cf_id)
+        , _key(key)
+    { }
+
+    cf_cache_entry(cf_cache_entry&&) noexcept = default;
+
+    const utils::UUID& cf_id() const { return _cf_id; }
+    bytes_view key() const { return bytes_view(_key); }
+};
+
+// Partial key of the entries of a partition.
+struct cf_cache_partition {
+    utils::UUID cf_id;
+    bytes_view prefix;
+};
+
+// Orders entries by column family and key. Also orders the keys of entries,
+// as (column family, key) pairs, and the partial keys of all entries of a
+// column family or of a partition against them.
+struct cf_cache_compare {
+    static int tri_compare(const utils::UUID& c1, bytes_view k1, const utils::UUID& c2, bytes_view k2) {
+        if (c1 != c2) {
+            return c1 < c2 ? -1 : 1;
+        }
+        return compare_unsigned(k1, k2);
+    }
+    static int tri_compare(const cf_cache_entry& e, const cf_cache_partition& p) {
+        auto k = e.key();
+        return tri_compare(e.cf_id(), k.substr(0, std::min(k.size(), p.prefix.size())), p.cf_id, p.prefix);
+    }
+    bool operator()(const cf_cache_entry& e1, const cf_cache_entry& e2) const {
+        return tri_compare(e1.cf_id(), e1.key(), e2.cf_id(), e2.key()) < 0;
+    }
+    bool operator()(const std::pair<utils::UUID, bytes_view>& k, const cf_cache_entry& e) const {
+        return tri_compare(k.first, k.second, e.cf_id(), e.key()) < 0;
+    }
+    bool operator()(const cf_cache_entry& e, const std::pair<utils::UUID, bytes_view>& k) const {
+        return tri_compare(e.cf_id(), e.key(), k.first, k.second) < 0;
+    }
+    bool operator()(const cf_cache_partition& p, const cf_cache_entry& e) const {
+        return tri_compare(e, p) > 0;
+    }
+    bool operator()(const cf_cache_entry& e, const cf_cache_partition& p) const {
+        return tri_compare(e, p) < 0;
+    }
+    bool operator()(const utils::UUID& cf_id, const cf_cache_entry& e) const {
+        return cf_id < e.cf_id();
+    }
+    bool operator()(const cf_cache_entry& e, const utils::UUID& cf_id) const {
+        return e.cf_id() < cf_id;
+    }
+};
+
+}
@@ -40,6 +40,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <cstring>
 #include <sys/stat.h>
 #include <malloc.h>
 #include <regex>
@@ -55,6 +56,7 @@
 #include <core/rwlock.hh>
 #include <core/gate.hh>
 #include <core/fstream.hh>
+#include <core/shared_future.hh>
 #include <seastar/core/memory.hh>
 #include <net/byteorder.hh>
 
@@ -67,6 +69,7 @@
 #include "log.hh"
 #include "commitlog_entry.hh"
 #include "service/priority_manager.hh"
+#include "sstables/compress.hh"
 
 #include <boost/range/numeric.hpp>
 #include <boost/range/adaptor/transformed.hpp>
@@ -102,6 +105,10 @@ db::commitlog::config::config(const db::config& cfg)
     , commitlog_total_space_in_mb(cfg.commitlog_total_space_in_mb() >= 0 ? cfg.commitlog_total_space_in_mb() : memory::stats().total_memory() >> 20)
     , commitlog_segment_size_in_mb(cfg.commitlog_segment_size_in_mb())
     , commitlog_sync_period_in_ms(cfg.commitlog_sync_period_in_ms())
+    , reuse_segments(cfg.commitlog_reuse_segments())
+    , group_commit_window_in_us(cfg.commitlog_sync_group_window_in_us())
+    , group_commit_window_in_kb(cfg.commitlog_sync_group_window_in_kb())
+    , compression(cfg.commitlog_compression())
     , mode(cfg.commitlog_sync() == "batch" ? sync_mode::BATCH : sync_mode::PERIODIC)
 {}
 
@@ -180,8 +187,10 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
         uint64_t allocation_count = 0;
         uint64_t bytes_written = 0;
         uint64_t bytes_slack = 0;
+        uint64_t bytes_compressed = 0;
         uint64_t segments_created = 0;
         uint64_t segments_destroyed = 0;
+        uint64_t segments_reused = 0;
         uint64_t pending_writes = 0;
         uint64_t pending_flushes = 0;
         uint64_t pending_allocations = 0;
@@ -190,6 +199,8 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
         uint64_t total_size = 0;
         uint64_t buffer_list_bytes = 0;
         uint64_t total_size_on_disk = 0;
+        utils::ihistogram group_commit_size;
+        utils::ihistogram group_commit_latency;
     };
 
     stats totals;
@@ -220,6 +231,10 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
         --totals.pending_flushes;
     }
 
+    bool uses_group_commit() const {
+        return cfg.mode == sync_mode::BATCH && cfg.group_commit_window_in_us != 0;
+    }
+
     bool should_wait_for_write() const {
         return cfg.mode == sync_mode::BATCH || _write_semaphore.waiters() > 0 || _flush_semaphore.waiters() > 0;
     }
@@ -271,6 +286,14 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     future<sseg_ptr> new_segment();
     future<sseg_ptr> active_segment();
     future<sseg_ptr> allocate_segment(bool active);
+    future<sseg_ptr> create_segment(descriptor d, bool active);
+    future<sseg_ptr> reuse_segment(sstring file_name, descriptor d, bool active);
+    future<> replenish_reserve();
+    void replenish_reserve_in_background();
+    // Called for segments whose data has been flushed. Keeps the file for
+    // reuse, or deletes it.
+    void release_segment_file(const sstring& file_name, const descriptor& d);
+    void add_recycled_segments(std::vector<sstring> file_names);
 
     future<> clear();
     future<> sync_all_segments(bool shutdown = false);
@@ -300,6 +323,12 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     buffer_type acquire_buffer(size_t s);
     void release_buffer(buffer_type&&);
 
+    struct segment_listing {
+        std::vector<descriptor> descriptors;
+        // Names of files kept for reuse.
+        std::vector<sstring> recycled;
+    };
+    future<segment_listing> list_segments(sstring dir);
     future<std::vector<descriptor>> list_descriptors(sstring dir);
 
     flush_handler_id add_flush_handler(flush_handler h) {
@@ -317,6 +346,8 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     segment_id_type _ids = 0;
     std::vector<sseg_ptr> _segments;
     std::deque<sseg_ptr> _reserve_segments;
+    // Files of flushed segments, ready to be reused by allocate_segment().
+    std::deque<sstring> _recycled_segments;
     std::vector<buffer_type> _temp_buffers;
     std::unordered_map<flush_handler_id, flush_handler> _flush_handlers;
     flush_handler_id _flush_ids = 0;
@@ -331,8 +362,14 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     size_t _num_reserve_segments = 0;
     seastar::gate _gate;
     uint64_t _new_counter = 0;
+public:
+    // Files of segments kept for reuse are renamed with this prefix, so
+    // that they are not mistaken for segments to replay.
+    static const std::string RECYCLED_PREFIX;
 };
 
+const std::string db::commitlog::segment_manager::RECYCLED_PREFIX("Recycled-");
+
 /*
  * A single commit log file on disk. Manages creation of the file and writing mutations to disk,
  * as well as tracking the last mutation position of any "dirty" CFs covered by the segment file. Segment
@@ -386,7 +423,14 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     uint64_t _file_pos = 0;
     uint64_t _flush_pos = 0;
     uint64_t _buf_pos = 0;
+    // Where the next buffer goes in the file. Same as _file_pos, unless the
+    // segment is compressed, in which case positions (_file_pos, _flush_pos
+    // and replay positions) are offsets into the uncompressed data.
+    uint64_t _disk_pos = 0;
     bool _closed = false;
+    // Set if the file was used by an earlier segment, so that everything
+    // past the last chunk written is stale data of that segment.
+    bool _recycled = false;
 
     size_t _needed_size = 0;
 
@@ -406,6 +450,14 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
     std::unordered_set<table_schema_version> _known_schema_versions;
 
+    // Open group commit window, if any. Entries added to the buffer while
+    // it is open wait on it, and are resolved together once the buffer
+    // has been written and flushed.
+    std::experimental::optional<shared_promise<>> _group_commit;
+    timer<> _group_commit_timer;
+    size_t _group_commit_bytes = 0;
+    std::chrono::steady_clock::time_point _group_commit_start;
+
     friend std::ostream& operator<<(std::ostream&, const segment&);
     friend class segment_manager;
 
@@ -442,6 +494,18 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     static constexpr size_t segment_overhead_size = 2 * sizeof(uint32_t);
     static constexpr size_t descriptor_header_size = 5 * sizeof(uint32_t);
     static constexpr uint32_t segment_magic = ('S'<<24) |('C'<< 16) | ('L' << 8) | 'C';
+    // Magic of segments written to a reused file. Readers treat an invalid
+    // chunk header in them as the end of the segment, not as corruption.
+    static constexpr uint32_t recycled_segment_magic = ('S'<<24) |('C'<< 16) | ('L' << 8) | 'R';
+
+    static constexpr uint32_t default_segment_version = 1;
+    // Descriptor version of segments whose chunks are compressed with lz4.
+    static constexpr uint32_t compressed_segment_version = 2;
+    // Header of a compressed chunk (int: next position + int: uncompressed
+    // size + int: compressed size + int: checksum [segmentId, file offset,
+    // next position, sizes]). The entries of a chunk start at the same
+    // position as they would in an uncompressed segment.
+    static constexpr size_t compressed_chunk_header_size = 4 * sizeof(uint32_t);
 
     // The commit log (chained) sync marker/header size in bytes (int: length + int: checksum [segmentId, position])
     static constexpr size_t sync_marker_size = 2 * sizeof(uint32_t);
@@ -450,25 +514,24 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     // TODO : tune initial / default size
     static constexpr size_t default_size = align_up<size_t>(128 * 1024, alignment);
 
-    segment(::shared_ptr<segment_manager> m, const descriptor& d, file && f, bool active)
+    segment(::shared_ptr<segment_manager> m, const descriptor& d, file && f, bool active, bool recycled = false)
             : _segment_manager(std::move(m)), _desc(std::move(d)), _file(std::move(f)),
-        _file_name(_segment_manager->cfg.commit_log_location + "/" + _desc.filename()), _sync_time(
+        _file_name(_segment_manager->cfg.commit_log_location + "/" + _desc.filename()), _recycled(recycled), _sync_time(
                     clock_type::now())
     {
         ++_segment_manager->totals.segments_created;
-        logger.debug("Created new {} segment {}", active ? "active" : "reserve", *this);
+        logger.debug("Created new {} segment {}{}", active ? "active" : "reserve", *this, recycled ? " from a reused file" : "");
+        _group_commit_timer.set_callback([this] {
+            commit_group();
+        });
     }
     ~segment() {
         if (is_clean()) {
-            logger.debug("Segment {} is no longer active and will be deleted now", *this);
+            logger.debug("Segment {} is no longer active and will be released now", *this);
             ++_segment_manager->totals.segments_destroyed;
             _segment_manager->totals.total_size_on_disk -= size_on_disk();
             _segment_manager->totals.total_size -= (size_on_disk() + _buffer.size());
-            try {
-                commit_io_check(::unlink, _file_name.c_str());
-            } catch (...) {
-                logger.error("Could not delete segment {}: {}", *this, std::current_exception());
-            }
+            _segment_manager->release_segment_file(_file_name, _desc);
         } else {
             logger.warn("Segment {} is dirty and is left on disk.", *this);
         }
@@ -502,6 +565,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
      */
     future<sseg_ptr> finish_and_get_new() {
         _closed = true;
+        commit_group();
         return maybe_wait_for_write(sync()).then([](sseg_ptr s) {
             return s->_segment_manager->active_segment();
         });
@@ -520,6 +584,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
          * queue, just to be sure.
          */
         if (shutdown) {
+            commit_group();
             auto me = shared_from_this();
             return _gate.close().then([me] {
                 return me->sync().finally([me] {
@@ -599,6 +664,11 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
         auto a = align_up(s + overhead, alignment);
         auto k = std::max(a, default_size);
+        if (_segment_manager->uses_group_commit()) {
+            // Make room for a full window, so that it goes out in a single write.
+            auto w = _segment_manager->cfg.group_commit_window_in_kb * 1024;
+            k = std::max(k, align_up<size_t>(w + overhead, alignment));
+        }
 
         for (;;) {
             try {
@@ -633,6 +703,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             return flush_after ? flush() : make_ready_future<sseg_ptr>(shared_from_this());
         }
 
+        auto used = _buf_pos;
         auto size = clear_buffer_slack();
         auto buf = std::move(_buffer);
         auto off = _file_pos;
@@ -655,7 +726,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
         if (off == 0) {
             // first block. write file header.
-            out.write(segment_magic);
+            out.write(_recycled ? recycled_segment_magic : segment_magic);
             out.write(_desc.ver);
             out.write(_desc.id);
             crc32_nbo crc;
@@ -681,6 +752,13 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
         logger.trace("Writing {} entries, {} k in {} -> {}", num, size, off, off + size);
 
+        if (is_compressed()) {
+            std::tie(buf, size) = compress_chunk(std::move(buf), header_size, used, top);
+            logger.trace("Compressed {} -> {} k at {}", top - off, size, _disk_pos);
+        }
+        off = _disk_pos;
+        _disk_pos += size;
+
         // The write will be allowed to start now, but flush (below) must wait for not only this,
         // but all previous write/flush pairs.
         return _pending_ops.run_with_ordered_post_op(rp, [this, size, off, buf = std::move(buf)]() mutable {
@@ -768,6 +846,49 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         });
     }
 
+    /**
+     * Group commit: instead of cycling the buffer for each allocation,
+     * as batch_cycle() does, entries join a window which is written and
+     * flushed at once when its time runs out or when it gets big enough.
+     */
+    future<> join_group(size_t s) {
+        if (!_group_commit) {
+            _group_commit.emplace();
+            _group_commit_start = std::chrono::steady_clock::now();
+            _group_commit_timer.arm(std::chrono::microseconds(_segment_manager->cfg.group_commit_window_in_us));
+        }
+        _group_commit_bytes += s;
+        auto f = _group_commit->get_shared_future();
+        auto max = _segment_manager->cfg.group_commit_window_in_kb * 1024;
+        if (max && _group_commit_bytes >= max) {
+            commit_group();
+        }
+        return f;
+    }
+
+    // Closes the open group commit window, if any, and resolves its
+    // entries once they are on disk.
+    void commit_group() {
+        _group_commit_timer.cancel();
+        if (!_group_commit) {
+            return;
+        }
+        auto pr = std::move(*_group_commit);
+        _group_commit = {};
+        _segment_manager->totals.group_commit_size.mark(std::exchange(_group_commit_bytes, 0));
+        auto start = _group_commit_start;
+        sync().then_wrapped([me = shared_from_this(), pr = std::move(pr), start](future<sseg_ptr> f) mutable {
+            auto latency = std::chrono::steady_clock::now() - start;
+            me->_segment_manager->totals.group_commit_latency.mark(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+            try {
+                f.get();
+                pr.set_value();
+            } catch (...) {
+                pr.set_exception(std::current_exception());
+            }
+        });
+    }
+
     future<sseg_ptr> batch_cycle() {
         /**
          * For batch mode we force a write "immediately".
@@ -822,7 +943,12 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             new_buffer(s);
         } else if (s > (_buffer.size() - _buf_pos)) { // enough data?
             _needed_size += s; // hint to next new_buffer, in case we are not first.
-            if (_segment_manager->cfg.mode == sync_mode::BATCH) {
+            if (_group_commit) {
+                // The window doesn't fit the buffer. Close it now and
+                // start a new one with this entry.
+                commit_group();
+                op = make_ready_future<sseg_ptr>(shared_from_this());
+            } else if (_segment_manager->cfg.mode == sync_mode::BATCH) {
                 // TODO: this could cause starvation if we're really unlucky.
                 // If we run batch mode and find ourselves not fit in a non-empty
                 // buffer, we must force a cycle and wait for it (to keep flush order)
@@ -869,6 +995,11 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
         _gate.leave();
 
+        if (_segment_manager->uses_group_commit()) {
+            return join_group(s).then([rp] {
+                return make_ready_future<replay_position>(rp);
+            });
+        }
         if (_segment_manager->cfg.mode == sync_mode::BATCH) {
             return batch_cycle().then([rp](auto s) {
                 return make_ready_future<replay_position>(rp);
@@ -883,7 +1014,51 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     }
 
     size_t size_on_disk() const {
-        return _file_pos;
+        return _disk_pos;
+    }
+
+    bool is_compressed() const {
+        return _desc.ver == compressed_segment_version;
+    }
+
+    /**
+     * Compresses the entries in a buffer about to be written as the chunk
+     * ending at position next, and returns the buffer to write instead,
+     * along with the (aligned) number of bytes to write.
+     * header_size is the size of the file header at the buffer start, if any,
+     * which is written as is.
+     */
+    std::pair<buffer_type, size_t> compress_chunk(buffer_type buf, size_t header_size, size_t used, position_type next) {
+        auto data_start = header_size + segment_overhead_size;
+        auto data_size = used - data_start;
+        auto max_size = header_size + compressed_chunk_header_size + compress_max_size_lz4(data_size);
+        auto out = _segment_manager->acquire_buffer(align_up(max_size, alignment));
+
+        auto * p = out.get_write();
+        std::copy_n(buf.get(), header_size, p);
+        auto * cp = p + header_size + compressed_chunk_header_size;
+        auto compressed_size = compress_lz4(buf.get() + data_start, data_size, cp, out.size() - (cp - p));
+        _segment_manager->release_buffer(std::move(buf));
+
+        crc32_nbo crc;
+        crc.process<int32_t>(_desc.id & 0xffffffff);
+        crc.process<int32_t>(_desc.id >> 32);
+        crc.process(uint32_t(_disk_pos + header_size));
+        crc.process(uint32_t(next));
+        crc.process(uint32_t(data_size));
+        crc.process(uint32_t(compressed_size));
+
+        data_output out_header(p + header_size, compressed_chunk_header_size);
+        out_header.write(uint32_t(next));
+        out_header.write(uint32_t(data_size));
+        out_header.write(uint32_t(compressed_size));
+        out_header.write(crc.checksum());
+
+        auto end = cp + compressed_size - p;
+        auto size = align_up(end, alignment);
+        std::fill(p + end, p + size, 0);
+        _segment_manager->totals.bytes_compressed += data_size;
+        return std::make_pair(std::move(out), size);
     }
 
     // ensures no more of this segment is writeable, by allocating any unused section at the end and marking it discarded
@@ -936,13 +1111,13 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
 const size_t db::commitlog::segment::default_size;
 
-future<std::vector<db::commitlog::descriptor>>
-db::commitlog::segment_manager::list_descriptors(sstring dirname) {
+future<db::commitlog::segment_manager::segment_listing>
+db::commitlog::segment_manager::list_segments(sstring dirname) {
     struct helper {
         sstring _dirname;
         file _file;
         subscription<directory_entry> _list;
-        std::vector<db::commitlog::descriptor> _result;
+        segment_listing _result;
 
         helper(helper&&) = default;
         helper(sstring n, file && f)
@@ -961,8 +1136,12 @@ db::commitlog::segment_manager::list_descriptors(sstring dirname) {
             };
             return entry_type(de).then([this, de](std::experimental::optional<directory_entry_type> type) {
                 if (type == directory_entry_type::regular && de.name[0] != '.' && !is_cassandra_segment(de.name)) {
+                    if (is_recycled_segment(de.name)) {
+                        _result.recycled.emplace_back(de.name);
+                        return make_ready_future<>();
+                    }
                     try {
-                        _result.emplace_back(de.name);
+                        _result.descriptors.emplace_back(de.name);
                     } catch (std::domain_error& e) {
                         logger.warn(e.what());
                     }
@@ -983,22 +1162,35 @@ db::commitlog::segment_manager::list_descriptors(sstring dirname) {
             }
             return name.substr(0, c.size()) == c;
         }
+
+        static bool is_recycled_segment(sstring name) {
+            auto& p = RECYCLED_PREFIX;
+            return name.size() >= p.size() && name.substr(0, p.size()) == p;
+        }
     };
 
     return open_checked_directory(commit_error, dirname).then([this, dirname](file dir) {
         auto h = make_lw_shared<helper>(std::move(dirname), std::move(dir));
         return h->done().then([h]() {
-            return make_ready_future<std::vector<db::commitlog::descriptor>>(std::move(h->_result));
+            return make_ready_future<segment_listing>(std::move(h->_result));
         }).finally([h] {});
     });
 }
 
+future<std::vector<db::commitlog::descriptor>>
+db::commitlog::segment_manager::list_descriptors(sstring dirname) {
+    return list_segments(std::move(dirname)).then([](segment_listing l) {
+        return make_ready_future<std::vector<descriptor>>(std::move(l.descriptors));
+    });
+}
+
 future<> db::commitlog::segment_manager::init() {
-    return list_descriptors(cfg.commit_log_location).then([this](std::vector<descriptor> descs) {
+    return list_segments(cfg.commit_log_location).then([this](segment_listing l) {
         segment_id_type id = std::chrono::duration_cast<std::chrono::milliseconds>(runtime::get_boot_time().time_since_epoch()).count() + 1;
-        for (auto& d : descs) {
+        for (auto& d : l.descriptors) {
             id = std::max(id, replay_position(d.id).base_id());
         }
+        add_recycled_segments(std::move(l.recycled));
 
         // base id counter is [ <shard> | <base> ]
         _ids = replay_position(engine().cpu_id(), id).id;
@@ -1041,6 +1233,15 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                                     });
                         })
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "queue_length", "recycled_segments")
+                , make_typed(data_type::GAUGE
+                        , std::bind(&decltype(_recycled_segments)::size, &_recycled_segments))
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "segments_reused")
+                , make_typed(data_type::DERIVE, totals.segments_reused)
+        ),
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "total_operations", "alloc")
                 , make_typed(data_type::DERIVE, totals.allocation_count)
@@ -1062,6 +1263,10 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                         , per_cpu_plugin_instance, "total_bytes", "slack")
                 , make_typed(data_type::DERIVE, totals.bytes_slack)
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_bytes", "compressed")
+                , make_typed(data_type::DERIVE, totals.bytes_compressed)
+        ),
 
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "queue_length", "pending_writes")
@@ -1132,7 +1337,16 @@ void db::commitlog::segment_manager::flush_segments(bool force) {
 }
 
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::allocate_segment(bool active) {
-    descriptor d(next_id());
+    descriptor d(next_id(), cfg.compression ? segment::compressed_segment_version : segment::default_segment_version);
+    if (!_recycled_segments.empty()) {
+        auto file_name = std::move(_recycled_segments.front());
+        _recycled_segments.pop_front();
+        return reuse_segment(std::move(file_name), std::move(d), active);
+    }
+    return create_segment(std::move(d), active);
+}
+
+future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::create_segment(descriptor d, bool active) {
     file_open_options opt;
     opt.extent_allocation_size_hint = max_size;
     return open_checked_file_dma(commit_error, cfg.commit_log_location + "/" + d.filename(), open_flags::wo | open_flags::create, opt).then([this, d, active](file f) {
@@ -1144,6 +1358,84 @@ future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager:
     });
 }
 
+/*
+ * Turns the file of a flushed segment into a new segment. The file is already
+ * sized and its extents are allocated, so writing to it needs no metadata
+ * updates. Its first block is cleared, so that a segment which is never
+ * written to reads back as empty rather than as the segment which used the
+ * file before.
+ */
+future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::reuse_segment(sstring file_name, descriptor d, bool active) {
+    auto new_name = cfg.commit_log_location + "/" + d.filename();
+    return commit_io_check([&] {
+        return engine().rename_file(file_name, new_name);
+    }).then([new_name] {
+        return open_checked_file_dma(commit_error, new_name, open_flags::wo);
+    }).then([this, d, active](file f) {
+        auto bufptr = allocate_aligned_buffer<char>(segment::alignment, segment::alignment);
+        auto p = bufptr.get();
+        std::fill(p, p + segment::alignment, 0);
+        auto&& priority_class = service::get_local_commitlog_priority();
+        return f.dma_write(0, p, segment::alignment, priority_class).then([this, d, active, f, bufptr = std::move(bufptr)](size_t) mutable {
+            ++totals.segments_reused;
+            auto s = make_lw_shared<segment>(this->shared_from_this(), d, std::move(f), active, true);
+            return make_ready_future<sseg_ptr>(s);
+        });
+    }).handle_exception([this, file_name, d, active](std::exception_ptr ep) {
+        logger.warn("Could not reuse segment file {}: {}. Creating a new one.", file_name, ep);
+        return create_segment(d, active);
+    });
+}
+
+void db::commitlog::segment_manager::release_segment_file(const sstring& file_name, const descriptor& d) {
+    if (cfg.reuse_segments && !_shutdown && _recycled_segments.size() < cfg.max_reserve_segments) {
+        auto recycled_name = cfg.commit_log_location + "/" + RECYCLED_PREFIX + d.filename();
+        try {
+            if (commit_io_check(::rename, file_name.c_str(), recycled_name.c_str()) == 0) {
+                logger.debug("Keeping segment file {} for reuse", recycled_name);
+                _recycled_segments.emplace_back(std::move(recycled_name));
+                return;
+            }
+            logger.warn("Could not keep segment file {} for reuse: {}", file_name, std::strerror(errno));
+        } catch (...) {
+            logger.warn("Could not keep segment file {} for reuse: {}", file_name, std::current_exception());
+        }
+    }
+    try {
+        commit_io_check(::unlink, file_name.c_str());
+    } catch (...) {
+        logger.error("Could not delete segment {}: {}", file_name, std::current_exception());
+    }
+}
+
+// Takes over files kept for reuse by a previous run. As all shards share
+// the directory, each one only takes the files of the segments it would
+// have written.
+void db::commitlog::segment_manager::add_recycled_segments(std::vector<sstring> file_names) {
+    for (auto& name : file_names) {
+        try {
+            descriptor d(name.substr(RECYCLED_PREFIX.size()));
+            if (replay_position(d.id).shard_id() % smp::count != engine().cpu_id()) {
+                continue;
+            }
+        } catch (std::domain_error& e) {
+            logger.warn(e.what());
+            continue;
+        }
+        auto path = cfg.commit_log_location + "/" + name;
+        if (cfg.reuse_segments && _recycled_segments.size() < cfg.max_reserve_segments) {
+            _recycled_segments.emplace_back(std::move(path));
+        } else {
+            try {
+                commit_io_check(::unlink, path.c_str());
+            } catch (...) {
+                logger.error("Could not delete segment {}: {}", path, std::current_exception());
+            }
+        }
+    }
+    logger.debug("Reusing {} segment files", _recycled_segments.size());
+}
+
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::new_segment() {
     if (_shutdown) {
         throw std::runtime_error("Commitlog has been shut down. Cannot add data");
@@ -1158,6 +1450,7 @@ future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager:
         }
         return allocate_segment(true).then([this](sseg_ptr s) {
             _segments.push_back(s);
+            replenish_reserve_in_background();
             return make_ready_future<sseg_ptr>(s);
         });
     }
@@ -1166,6 +1459,10 @@ future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager:
     _reserve_segments.pop_front();
     _segments.back()->reset_sync_time();
     logger.trace("Acquired segment {} from reserve", _segments.back());
+    // Replace the segment taken now rather than on the next timer tick, so
+    // that a burst of writes does not drain the reserve and end up creating
+    // segments on the write path.
+    replenish_reserve_in_background();
     return make_ready_future<sseg_ptr>(_segments.back());
 }
 
@@ -1302,41 +1599,56 @@ void db::commitlog::segment_manager::on_timer() {
                 flush_segments();
             }
         }
-        // take outstanding allocations into regard. This is paranoid,
-        // but if for some reason the file::open takes longer than timer period,
-        // we could flood the reserve list with new segments
-        //
-        // #482 - _reserve_allocating is decremented in the finally clause below.
-        // This is needed because if either allocate_segment _or_ emplacing into
-        // _reserve_segments should throw, we still need the counter reset
-        // However, because of this, it might be that emplace was done, but not decrement,
-        // when we get here again. So occasionally we might get a sum of the two that is
-        // not consistent. It should however always just potentially be _to much_, i.e.
-        // just an indicator that we don't need to do anything. So lets do that.
-        auto n = std::min(_reserve_segments.size() + _reserve_allocating, _num_reserve_segments);
-        return parallel_for_each(boost::irange(n, _num_reserve_segments), [this, n](auto i) {
-            ++_reserve_allocating;
-            return this->allocate_segment(false).then([this](sseg_ptr s) {
-                if (!_shutdown) {
-                    // insertion sort.
-                    auto i = std::upper_bound(_reserve_segments.begin(), _reserve_segments.end(), s, [](sseg_ptr s1, sseg_ptr s2) {
-                        const descriptor& d1 = s1->_desc;
-                        const descriptor& d2 = s2->_desc;
-                        return d1.id < d2.id;
-                    });
-                    i = _reserve_segments.emplace(i, std::move(s));
-                    logger.trace("Added reserve segment {}", *i);
-                }
-            }).finally([this] {
-                --_reserve_allocating;
-            });
-        });
+        return replenish_reserve();
     }).handle_exception([](std::exception_ptr ep) {
         logger.warn("Exception in segment reservation: {}", ep);
     });
     arm();
 }
 
+future<> db::commitlog::segment_manager::replenish_reserve() {
+    // take outstanding allocations into regard. This is paranoid,
+    // but if for some reason the file::open takes longer than timer period,
+    // we could flood the reserve list with new segments
+    //
+    // #482 - _reserve_allocating is decremented in the finally clause below.
+    // This is needed because if either allocate_segment _or_ emplacing into
+    // _reserve_segments should throw, we still need the counter reset
+    // However, because of this, it might be that emplace was done, but not decrement,
+    // when we get here again. So occasionally we might get a sum of the two that is
+    // not consistent. It should however always just potentially be _to much_, i.e.
+    // just an indicator that we don't need to do anything. So lets do that.
+    auto n = std::min(_reserve_segments.size() + _reserve_allocating, _num_reserve_segments);
+    return parallel_for_each(boost::irange(n, _num_reserve_segments), [this, n](auto i) {
+        ++_reserve_allocating;
+        return this->allocate_segment(false).then([this](sseg_ptr s) {
+            if (!_shutdown) {
+                // insertion sort.
+                auto i = std::upper_bound(_reserve_segments.begin(), _reserve_segments.end(), s, [](sseg_ptr s1, sseg_ptr s2) {
+                    const descriptor& d1 = s1->_desc;
+                    const descriptor& d2 = s2->_desc;
+                    return d1.id < d2.id;
+                });
+                i = _reserve_segments.emplace(i, std::move(s));
+                logger.trace("Added reserve segment {}", *i);
+            }
+        }).finally([this] {
+            --_reserve_allocating;
+        });
+    });
+}
+
+void db::commitlog::segment_manager::replenish_reserve_in_background() {
+    if (_shutdown) {
+        return;
+    }
+    seastar::with_gate(_gate, [this] {
+        return replenish_reserve();
+    }).handle_exception([](std::exception_ptr ep) {
+        logger.warn("Exception in segment reservation: {}", ep);
+    });
+}
+
 std::vector<sstring> db::commitlog::segment_manager::get_active_names() const {
     std::vector<sstring> res;
     for (auto i: _segments) {
@@ -1563,9 +1875,21 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
         size_t corrupt_size = 0;
         bool eof = false;
         bool header = true;
+        bool recycled = false;
+        bool compressed = false;
+        // Position, as in replay_position, of the next compressed chunk.
+        size_t chunk_pos = 0;
 
         work(file f, position_type o = 0)
-                : f(f), fin(make_file_input_stream(f)), start_off(o) {
+                : f(f), fin(make_file_input_stream(f, 0, make_options())), start_off(o) {
+        }
+        // Segments are read front to back, so use large buffers and keep
+        // a few of them in flight to overlap I/O with parsing.
+        static file_input_stream_options make_options() {
+            file_input_stream_options options;
+            options.buffer_size = 128 * 1024;
+            options.read_ahead = 4;
+            return options;
         }
         work(work&&) = default;
 
@@ -1615,9 +1939,11 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                     return stop();
                 }
 
-                if (magic != segment::segment_magic) {
+                if (magic != segment::segment_magic && magic != segment::recycled_segment_magic) {
                     throw std::invalid_argument("Not a scylla format commitlog file");
                 }
+                this->recycled = magic == segment::recycled_segment_magic;
+                this->compressed = ver == segment::compressed_segment_version;
                 crc32_nbo crc;
                 crc.process(ver);
                 crc.process<int32_t>(id & 0xffffffff);
@@ -1635,6 +1961,9 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
             });
         }
         future<> read_chunk() {
+            if (compressed) {
+                return read_compressed_chunk();
+            }
             return fin.read_exactly(segment::segment_overhead_size).then([this](temporary_buffer<char> buf) {
                 auto start = pos;
 
@@ -1657,6 +1986,12 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                 crc.process<uint32_t>(start);
 
                 auto cs = crc.checksum();
+                if (cs != checksum && recycled) {
+                    // what follows the last chunk of a segment in a reused
+                    // file is whatever the previous segment wrote there.
+                    logger.trace("End of reused segment at {}.", start);
+                    return stop();
+                }
                 if (cs != checksum) {
                     // if a chunk header checksum is broken, we shall just assume that all
                     // remaining is as well. We cannot trust the "next" pointer, so...
@@ -1674,6 +2009,117 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                 return do_until(std::bind(&work::end_of_chunk, this), std::bind(&work::read_entry, this));
             });
         }
+        future<> read_compressed_chunk() {
+            return fin.read_exactly(segment::compressed_chunk_header_size).then([this](temporary_buffer<char> buf) {
+                auto start = pos;
+
+                if (!advance(buf)) {
+                    return make_ready_future<>();
+                }
+
+                data_input in(buf);
+                auto next = in.read<uint32_t>();
+                auto size = in.read<uint32_t>();
+                auto compressed_size = in.read<uint32_t>();
+                auto checksum = in.read<uint32_t>();
+
+                if (next == 0 && size == 0 && compressed_size == 0 && checksum == 0) {
+                    return stop();
+                }
+
+                crc32_nbo crc;
+                crc.process<int32_t>(id & 0xffffffff);
+                crc.process<int32_t>(id >> 32);
+                crc.process<uint32_t>(start);
+                crc.process(next);
+                crc.process(size);
+                crc.process(compressed_size);
+
+                if (crc.checksum() != checksum) {
+                    if (recycled) {
+                        logger.trace("End of reused segment at {}.", start);
+                    } else {
+                        logger.debug("Checksum error in compressed segment chunk at {}.", start);
+                        corrupt_size += (file_size - pos);
+                    }
+                    return stop();
+                }
+
+                // Entries start where they would in an uncompressed chunk.
+                auto data_pos = chunk_pos + segment::segment_overhead_size
+                                + (chunk_pos == 0 ? segment::descriptor_header_size : 0);
+                auto chunk_end = align_up<size_t>(pos + compressed_size, segment::alignment);
+                chunk_pos = next;
+
+                if (start_off >= next) {
+                    return skip(chunk_end - pos);
+                }
+
+                return fin.read_exactly(compressed_size).then([this, size, compressed_size, data_pos, chunk_end](temporary_buffer<char> buf) {
+                    if (!advance(buf) || buf.size() != compressed_size) {
+                        corrupt_size += buf.size();
+                        return stop();
+                    }
+                    temporary_buffer<char> data(size);
+                    try {
+                        if (uncompress_lz4(buf.get(), buf.size(), data.get_write(), data.size()) != size) {
+                            throw std::runtime_error("unexpected uncompressed size");
+                        }
+                    } catch (...) {
+                        logger.debug("Failed to decompress segment chunk at {}: {}", data_pos, std::current_exception());
+                        corrupt_size += compressed_size;
+                        return skip(chunk_end - pos);
+                    }
+                    return skip(chunk_end - pos).then([this, data = std::move(data), data_pos] () mutable {
+                        return read_entries(std::move(data), data_pos);
+                    });
+                });
+            });
+        }
+        // Reads the entries of a decompressed chunk whose data starts at position data_pos.
+        future<> read_entries(temporary_buffer<char> data, size_t data_pos) {
+            static constexpr size_t entry_header_size = segment::entry_overhead_size - sizeof(uint32_t);
+
+            return do_with(std::move(data), size_t(0), [this, data_pos] (temporary_buffer<char>& data, size_t& off) {
+                return repeat([this, data_pos, &data, &off] {
+                    if (eof || off + entry_header_size >= data.size()) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    replay_position rp(id, position_type(data_pos + off));
+
+                    data_input in(data.share(off, entry_header_size));
+                    auto size = in.read<uint32_t>();
+                    auto checksum = in.read<uint32_t>();
+
+                    crc32_nbo crc;
+                    crc.process(size);
+
+                    if (size < 3 * sizeof(uint32_t) || checksum != crc.checksum() || off + size > data.size()) {
+                        if (size != 0) {
+                            logger.debug("Segment entry at {} has broken header. Skipping to next chunk ({} bytes)", rp, data.size() - off);
+                            corrupt_size += data.size() - off;
+                        }
+                        // size == 0 -> zero padding up to the chunk end
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+
+                    auto data_size = size - segment::entry_overhead_size;
+                    auto entry = data.share(off + entry_header_size, data_size);
+                    crc.process_bytes(entry.get(), data_size);
+                    auto tail = data_input(data.share(off + size - sizeof(uint32_t), sizeof(uint32_t))).read<uint32_t>();
+                    off += size;
+
+                    if (crc.checksum() != tail) {
+                        logger.debug("Segment entry at {} checksum error. Skipping {} bytes", rp, size);
+                        corrupt_size += size;
+                        return make_ready_future<stop_iteration>(stop_iteration::no);
+                    }
+                    return s.produce(std::move(entry), rp).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        }
         future<> read_entry() {
             static constexpr size_t entry_header_size = segment::entry_overhead_size - sizeof(uint32_t);
 
@@ -1813,6 +2259,22 @@ uint64_t db::commitlog::get_num_segments_destroyed() const {
     return _segment_manager->totals.segments_destroyed;
 }
 
+uint64_t db::commitlog::get_num_segments_reused() const {
+    return _segment_manager->totals.segments_reused;
+}
+
+uint64_t db::commitlog::get_bytes_written() const {
+    return _segment_manager->totals.bytes_written;
+}
+
+utils::ihistogram db::commitlog::get_group_commit_size_histogram() const {
+    return _segment_manager->totals.group_commit_size;
+}
+
+utils::ihistogram db::commitlog::get_group_commit_latency_histogram() const {
+    return _segment_manager->totals.group_commit_latency;
+}
+
 uint64_t db::commitlog::get_num_dirty_segments() const {
     return _segment_manager->get_num_dirty_segments();
 }
@@ -49,6 +49,7 @@
 #include "utils/UUID.hh"
 #include "replay_position.hh"
 #include "commitlog_entry.hh"
+#include "utils/histogram.hh"
 
 class file;
 
@@ -115,10 +116,24 @@ class commitlog {
         // Max number of segments to keep in pre-alloc reserve.
         // Not (yet) configurable from scylla.conf.
         uint64_t max_reserve_segments = 12;
+        // Keep files of segments whose data has been flushed, and use
+        // them for new segments instead of creating new files.
+        bool reuse_segments = true;
         // Max active writes/flushes. Default value
         // zero means try to figure it out ourselves
         uint64_t max_active_writes = 0;
         uint64_t max_active_flushes = 0;
+        // Group commit window for batch mode. If non-zero, entries added
+        // within this many microseconds of each other are written and
+        // flushed together, and all of them complete at once.
+        uint64_t group_commit_window_in_us = 0;
+        // A group commit window is also closed once it holds this many
+        // kilobytes of entries. Zero means no limit.
+        uint64_t group_commit_window_in_kb = 0;
+        // Compress each buffer with lz4 before writing it to the segment.
+        // Replay positions keep referring to offsets in the uncompressed
+        // data.
+        bool compression = false;
 
         sync_mode mode = sync_mode::PERIODIC;
     };
@@ -252,6 +267,12 @@ class commitlog {
     uint64_t get_flush_limit_exceeded_count() const;
     uint64_t get_num_segments_created() const;
     uint64_t get_num_segments_destroyed() const;
+    uint64_t get_num_segments_reused() const;
+    uint64_t get_bytes_written() const;
+    // Size in bytes and write+flush latency in nanoseconds of group
+    // commit windows.
+    utils::ihistogram get_group_commit_size_histogram() const;
+    utils::ihistogram get_group_commit_latency_histogram() const;
     /**
      * Get number of inactive (finished), segments lingering
      * due to still being dirty
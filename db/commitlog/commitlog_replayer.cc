@@ -44,9 +44,12 @@
 #include <algorithm>
 #include <unordered_map>
 #include <boost/range/adaptor/map.hpp>
+#include <boost/range/irange.hpp>
 
 #include <core/future.hh>
 #include <core/sharded.hh>
+#include <core/semaphore.hh>
+#include <core/gate.hh>
 
 #include "commitlog.hh"
 #include "commitlog_replayer.hh"
@@ -62,7 +65,6 @@
 static logging::logger logger("commitlog_replayer");
 
 class db::commitlog_replayer::impl {
-    std::unordered_map<table_schema_version, column_mapping> _column_mappings;
 public:
     impl(seastar::sharded<cql3::query_processor>& db);
 
@@ -88,13 +90,30 @@ class db::commitlog_replayer::impl {
         }
     };
 
-    future<> process(stats*, temporary_buffer<char> buf, replay_position rp);
-    future<stats> recover(sstring file);
+    class shard_replayer;
+
+    // Replays given segments on the current shard.
+    future<stats> recover(std::vector<sstring> files) const;
 
     typedef std::unordered_map<utils::UUID, replay_position> rp_map;
     typedef std::unordered_map<unsigned, rp_map> shard_rpm_map;
     typedef std::unordered_map<unsigned, replay_position> shard_rp_map;
 
+    replay_position min_pos(unsigned shard) const {
+        auto i = _min_pos.find(shard);
+        return i != _min_pos.end() ? i->second : replay_position();
+    }
+    // Returns the position up to which the data of given column family,
+    // written by given shard, is already in sstables, if known.
+    const replay_position* flushed_pos(unsigned shard, const utils::UUID& uuid) const {
+        auto i = _rpm.find(shard);
+        if (i == _rpm.end()) {
+            return nullptr;
+        }
+        auto j = i->second.find(uuid);
+        return j != i->second.end() ? &j->second : nullptr;
+    }
+
     seastar::sharded<cql3::query_processor>&
         _qp;
     shard_rpm_map
@@ -103,6 +122,56 @@ class db::commitlog_replayer::impl {
         _min_pos;
 };
 
+/*
+ * Replays a set of segments on one shard.
+ *
+ * Entries are parsed and filtered against the replay positions recorded in
+ * sstables on the shard which reads them, then routed to the shard owning
+ * them in batches, so that no mutation costs a cross-shard round trip of its
+ * own. The owning shard applies them directly into memtables, waiting for
+ * dirty memory to drop below its limit, so replay memory stays bounded while
+ * memtables are flushed in the background.
+ */
+class db::commitlog_replayer::impl::shard_replayer {
+    struct entry {
+        commitlog_entry_reader cer;
+        const column_mapping* cm;
+        replay_position rp;
+    };
+    struct batch {
+        std::vector<entry> entries;
+        size_t size = 0;
+    };
+
+    // A batch is sent to its shard once it holds this many bytes.
+    static constexpr size_t max_batch_size = 128 * 1024;
+    // Bounds memory of parsed mutations buffered for all shards.
+    static constexpr size_t max_buffered_size = 4 * 1024 * 1024;
+    // Bounds memory of batches sent, but not yet applied.
+    static constexpr size_t max_in_flight_size = 16 * 1024 * 1024;
+
+    const impl& _impl;
+    std::unordered_map<table_schema_version, column_mapping> _column_mappings;
+    std::vector<batch> _batches;
+    size_t _buffered = 0;
+    semaphore _in_flight{max_in_flight_size};
+    seastar::gate _pending;
+    stats _stats;
+private:
+    future<> process(stats*, temporary_buffer<char> buf, replay_position rp);
+    future<stats> recover(sstring file);
+    future<> flush(unsigned shard);
+    future<> flush_all();
+    static future<stats> apply(database& db, batch& b);
+public:
+    shard_replayer(const impl& i)
+        : _impl(i)
+        , _batches(smp::count)
+    { }
+
+    future<stats> recover(std::vector<sstring> files);
+};
+
 db::commitlog_replayer::impl::impl(seastar::sharded<cql3::query_processor>& qp)
     : _qp(qp)
 {}
@@ -182,9 +251,54 @@ future<> db::commitlog_replayer::impl::init() {
 }
 
 future<db::commitlog_replayer::impl::stats>
-db::commitlog_replayer::impl::recover(sstring file) {
+db::commitlog_replayer::impl::recover(std::vector<sstring> files) const {
+    auto r = std::make_unique<shard_replayer>(*this);
+    auto f = r->recover(std::move(files));
+    return f.finally([r = std::move(r)] {});
+}
+
+future<db::commitlog_replayer::impl::stats>
+db::commitlog_replayer::impl::shard_replayer::recover(std::vector<sstring> files) {
+    return do_with(std::move(files), [this] (std::vector<sstring>& files) {
+        return do_for_each(files, [this] (const sstring& f) {
+            logger.debug("Replaying {}", f);
+            return recover(f).then([this, f](impl::stats stats) {
+                if (stats.corrupt_bytes != 0) {
+                    logger.warn("Corrupted file: {}. {} bytes skipped.", f, stats.corrupt_bytes);
+                }
+                logger.debug("Log replay of {} complete ({} invalid, {} skipped)"
+                                , f
+                                , stats.invalid_mutations
+                                , stats.skipped_mutations
+                );
+                _stats += stats;
+            }).handle_exception([f](auto ep) {
+                logger.error("Error recovering {}: {}", f, ep);
+                try {
+                    std::rethrow_exception(ep);
+                } catch (std::invalid_argument&) {
+                    logger.error("Scylla cannot process {}. Make sure to fully flush all Cassandra commit log files to sstable before migrating.", f);
+                    throw;
+                } catch (...) {
+                    throw;
+                }
+            });
+        });
+    }).then([this] {
+        return flush_all();
+    }).finally([this] {
+        // Wait for batches still being applied, even on failure,
+        // since they refer to this object.
+        return _pending.close();
+    }).then([this] {
+        return make_ready_future<stats>(_stats);
+    });
+}
+
+future<db::commitlog_replayer::impl::stats>
+db::commitlog_replayer::impl::shard_replayer::recover(sstring file) {
     replay_position rp{commitlog::descriptor(file)};
-    auto gp = _min_pos[rp.shard_id()];
+    auto gp = _impl.min_pos(rp.shard_id());
 
     if (rp.id < gp.id) {
         logger.debug("skipping replay of fully-flushed {}", file);
@@ -198,7 +312,7 @@ db::commitlog_replayer::impl::recover(sstring file) {
     auto s = make_lw_shared<stats>();
 
     return db::commitlog::read_log_file(file,
-            std::bind(&impl::process, this, s.get(), std::placeholders::_1,
+            std::bind(&shard_replayer::process, this, s.get(), std::placeholders::_1,
                     std::placeholders::_2), p).then([](auto s) {
         auto f = s->done();
         return f.finally([s = std::move(s)] {});
@@ -214,7 +328,7 @@ db::commitlog_replayer::impl::recover(sstring file) {
     });
 }
 
-future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char> buf, replay_position rp) {
+future<> db::commitlog_replayer::impl::shard_replayer::process(stats* s, temporary_buffer<char> buf, replay_position rp) {
     try {
 
         commitlog_entry_reader cer(buf);
@@ -230,54 +344,32 @@ future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char>
         }
 
         auto shard_id = rp.shard_id();
-        if (rp < _min_pos[shard_id]) {
+        if (rp < _impl.min_pos(shard_id)) {
             logger.trace("entry {} is less than global min position. skipping", rp);
             s->skipped_mutations++;
             return make_ready_future<>();
         }
 
         auto uuid = fm.column_family_id();
-        auto& map = _rpm[shard_id];
-        auto i = map.find(uuid);
-        if (i != map.end() && rp <= i->second) {
-            logger.trace("entry {} at {} is younger than recorded replay position {}. skipping", fm.column_family_id(), rp, i->second);
+        auto flushed = _impl.flushed_pos(shard_id, uuid);
+        if (flushed && rp <= *flushed) {
+            logger.trace("entry {} at {} is younger than recorded replay position {}. skipping", fm.column_family_id(), rp, *flushed);
             s->skipped_mutations++;
             return make_ready_future<>();
         }
 
-        auto shard = _qp.local().db().local().shard_of(fm);
-        return _qp.local().db().invoke_on(shard, [this, cer = std::move(cer), cm_it, rp, shard, s] (database& db) -> future<> {
-            auto& fm = cer.mutation();
-            // TODO: might need better verification that the deserialized mutation
-            // is schema compatible. My guess is that just applying the mutation
-            // will not do this.
-            auto& cf = db.find_column_family(fm.column_family_id());
-
-            if (logger.is_enabled(logging::log_level::debug)) {
-                logger.debug("replaying at {} v={} {}:{} at {}", fm.column_family_id(), fm.schema_version(),
-                        cf.schema()->ks_name(), cf.schema()->cf_name(), rp);
-            }
-            // Removed forwarding "new" RP. Instead give none/empty.
-            // This is what origin does, and it should be fine.
-            // The end result should be that once sstables are flushed out
-            // their "replay_position" attribute will be empty, which is
-            // lower than anything the new session will produce.
-            if (cf.schema()->version() != fm.schema_version()) {
-                const column_mapping& cm = cm_it->second;
-                mutation m(fm.decorated_key(*cf.schema()), cf.schema());
-                converting_mutation_partition_applier v(cm, *cf.schema(), m.partition());
-                fm.partition().accept(cm, v);
-                cf.apply(std::move(m));
-            } else {
-                cf.apply(fm, cf.schema());
-            }
-            s->applied_mutations++;
-            return make_ready_future<>();
-        }).handle_exception([s](auto ep) {
-            s->invalid_mutations++;
-            // TODO: write mutation to file like origin.
-            logger.warn("error replaying: {}", ep);
-        });
+        auto shard = _impl._qp.local().db().local().shard_of(fm);
+        auto size = fm.representation().size();
+        auto& b = _batches[shard];
+        b.entries.push_back(entry{std::move(cer), &cm_it->second, rp});
+        b.size += size;
+        _buffered += size;
+        if (b.size >= max_batch_size) {
+            return flush(shard);
+        }
+        if (_buffered >= max_buffered_size) {
+            return flush_all();
+        }
     } catch (no_such_column_family&) {
         // No such CF now? Origin just ignores this.
     } catch (...) {
@@ -289,6 +381,82 @@ future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char>
     return make_ready_future<>();
 }
 
+// Hands the batch buffered for given shard over to it. Resolves once
+// there is room for it in flight, not when it is applied, so that this
+// shard can go on parsing while the owner applies the batch.
+future<> db::commitlog_replayer::impl::shard_replayer::flush(unsigned shard) {
+    auto b = std::exchange(_batches[shard], batch());
+    if (b.entries.empty()) {
+        return make_ready_future<>();
+    }
+    _buffered -= b.size;
+    auto units = std::min(b.size, max_in_flight_size);
+    return _in_flight.wait(units).then([this, shard, b = std::move(b)] () mutable {
+        with_gate(_pending, [this, shard, b = std::move(b)] () mutable {
+            return _impl._qp.local().db().invoke_on(shard, [b = std::move(b)] (database& db) mutable {
+                return do_with(std::move(b), [&db] (batch& b) {
+                    return apply(db, b);
+                });
+            }).then([this] (stats st) {
+                _stats += st;
+            });
+        }).handle_exception([] (auto ep) {
+            logger.warn("error replaying: {}", ep);
+        }).finally([this, units] {
+            _in_flight.signal(units);
+        });
+    });
+}
+
+future<> db::commitlog_replayer::impl::shard_replayer::flush_all() {
+    return do_for_each(boost::irange<unsigned>(0, smp::count), [this] (unsigned shard) {
+        return flush(shard);
+    });
+}
+
+// Runs on the shard owning the mutations of the batch.
+future<db::commitlog_replayer::impl::stats>
+db::commitlog_replayer::impl::shard_replayer::apply(database& db, batch& b) {
+    return do_with(stats(), [&db, &b] (stats& s) {
+        return do_for_each(b.entries, [&db, &s] (entry& e) {
+            return db.run_when_memory_available([&db, &e] {
+                auto& fm = e.cer.mutation();
+                // TODO: might need better verification that the deserialized mutation
+                // is schema compatible. My guess is that just applying the mutation
+                // will not do this.
+                auto& cf = db.find_column_family(fm.column_family_id());
+
+                if (logger.is_enabled(logging::log_level::debug)) {
+                    logger.debug("replaying at {} v={} {}:{} at {}", fm.column_family_id(), fm.schema_version(),
+                            cf.schema()->ks_name(), cf.schema()->cf_name(), e.rp);
+                }
+                // Removed forwarding "new" RP. Instead give none/empty.
+                // This is what origin does, and it should be fine.
+                // The end result should be that once sstables are flushed out
+                // their "replay_position" attribute will be empty, which is
+                // lower than anything the new session will produce.
+                if (cf.schema()->version() != fm.schema_version()) {
+                    const column_mapping& cm = *e.cm;
+                    mutation m(fm.decorated_key(*cf.schema()), cf.schema());
+                    converting_mutation_partition_applier v(cm, *cf.schema(), m.partition());
+                    fm.partition().accept(cm, v);
+                    cf.apply(std::move(m));
+                } else {
+                    cf.apply(fm, cf.schema());
+                }
+            }).then([&s] {
+                s.applied_mutations++;
+            }).handle_exception([&s] (auto ep) {
+                s.invalid_mutations++;
+                // TODO: write mutation to file like origin.
+                logger.warn("error replaying: {}", ep);
+            });
+        }).then([&s] {
+            return make_ready_future<stats>(s);
+        });
+    });
+}
+
 db::commitlog_replayer::commitlog_replayer(seastar::sharded<cql3::query_processor>& qp)
     : _impl(std::make_unique<impl>(qp))
 {}
@@ -311,29 +479,18 @@ future<db::commitlog_replayer> db::commitlog_replayer::create_replayer(seastar::
 
 future<> db::commitlog_replayer::recover(std::vector<sstring> files) {
     logger.info("Replaying {}", join(", ", files));
-    return map_reduce(files, [this](auto f) {
-        logger.debug("Replaying {}", f);
-        return _impl->recover(f).then([f](impl::stats stats) {
-            if (stats.corrupt_bytes != 0) {
-                logger.warn("Corrupted file: {}. {} bytes skipped.", f, stats.corrupt_bytes);
-            }
-            logger.debug("Log replay of {} complete, {} replayed mutations ({} invalid, {} skipped)"
-                            , f
-                            , stats.applied_mutations
-                            , stats.invalid_mutations
-                            , stats.skipped_mutations
-            );
-            return make_ready_future<impl::stats>(stats);
-        }).handle_exception([f](auto ep) -> future<impl::stats> {
-            logger.error("Error recovering {}: {}", f, ep);
-            try {
-                std::rethrow_exception(ep);
-            } catch (std::invalid_argument&) {
-                logger.error("Scylla cannot process {}. Make sure to fully flush all Cassandra commit log files to sstable before migrating.", f);
-                throw;
-            } catch (...) {
-                throw;
-            }
+    // Spread the segments over all shards, so that reading and parsing
+    // them scales with the number of cores.
+    std::vector<std::vector<sstring>> per_shard(smp::count);
+    for (size_t i = 0; i < files.size(); ++i) {
+        per_shard[i % smp::count].push_back(files[i]);
+    }
+    return map_reduce(boost::irange<unsigned>(0, smp::count), [this, per_shard = std::move(per_shard)] (unsigned shard) {
+        return smp::submit_to(shard, [&rpl = *_impl, files = per_shard[shard]] () mutable {
+            // Each shard works on its own copy of the replay positions.
+            auto local = std::make_unique<impl>(rpl);
+            auto f = local->recover(std::move(files));
+            return f.finally([local = std::move(local)] {});
         });
     }, impl::stats(), std::plus<impl::stats>()).then([](impl::stats totals) {
         logger.info("Log replay complete, {} replayed mutations ({} invalid, {} skipped)"
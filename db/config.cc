@@ -130,6 +130,14 @@ struct convert<db::string_map> {
         }
         rhs.clear();
         for (auto& n : node) {
+            // Nested maps, like the weights of request_scheduler_options,
+            // are flattened to "key.nested_key".
+            if (n.second.IsMap()) {
+                for (auto& n2 : n.second) {
+                    rhs[n.first.as<sstring>() + "." + n2.first.as<sstring>()] = n2.second.as<sstring>();
+                }
+                continue;
+            }
             rhs[n.first.as<sstring>()] = n.second.as<sstring>();
         }
         return true;
@@ -186,9 +186,12 @@ class config {
     val(data_file_directories, string_list, { "/var/lib/scylla/data" }, Used,   \
             "The directory location where table data (SSTables) is stored"   \
     )                                           \
-    val(saved_caches_directory, sstring, "/var/lib/scylla/saved_caches", Unused, \
+    val(saved_caches_directory, sstring, "/var/lib/scylla/saved_caches", Used, \
             "The directory location where table key and row caches are stored."  \
     )                                                   \
+    val(hints_directory, sstring, "/var/lib/scylla/hints", Used, \
+            "The directory where hints, writes which could not be delivered to a replica, are kept until the replica comes back."  \
+    )                                                   \
     /* Commonly used properties */  \
     /* Properties most frequently used when configuring Scylla. */   \
     /* Before starting a node for the first time, you should carefully evaluate your requirements. */   \
@@ -248,12 +251,25 @@ class config {
             "Related information: Initializing a multiple node cluster (single data center) and Initializing a multiple node cluster (multiple data centers)."  \
     )                                                   \
     /* Common compaction settings */    \
-    val(compaction_throughput_mb_per_sec, uint32_t, 16, Unused,     \
+    val(compaction_throughput_mb_per_sec, uint32_t, 0, Used,     \
             "Throttles compaction to the specified total throughput across the entire system. The faster you insert data, the faster you need to compact in order to keep the SSTable count down. The recommended Value is 16 to 32 times the rate of write throughput (in MBs/second). Setting the value to 0 disables compaction throttling.\n"  \
+            "The throughput is a base which is raised, up to eight times, while compactions are pending, and lowered while foreground reads are slower than compaction_read_latency_target_ms.\n" \
             "Related information: Configuring compaction"   \
     )                                                   \
-    val(compaction_large_partition_warning_threshold_mb, uint32_t, 100, Unused, \
-            "Log a warning when compacting partitions larger than this value"   \
+    val(compaction_read_latency_target_ms, uint32_t, 5, Used,     \
+            "Mean latency of sstable reads above which throttled compaction slows down, unless its backlog is large."  \
+    )                                                   \
+    val(compaction_large_partition_warning_threshold_mb, uint32_t, 100, Used, \
+            "Log a warning when writing partitions larger than this value to an sstable, by a flush or a compaction, and record them in system.large_partitions. 0 disables the warning."   \
+    )                                               \
+    val(major_compaction_sub_ranges, uint32_t, 1, Used, \
+            "Split a major compaction of a table into this many compactions of disjoint token sub-ranges, rounded down to a power of two, which run in parallel and write sstables which don't overlap. 1 compacts everything in a single pass."   \
+    )                                               \
+    val(reshard_on_startup, bool, false, Used, \
+            "When the number of shards changed since the SSTables were written, split the SSTables shared by several shards into one per shard before the node starts serving requests, rather than in the background. Each shard reads only its own part of every shared SSTable, and all shards split in parallel."   \
+    )                                               \
+    val(compaction_fragment_size_in_mb, uint32_t, 1024, Used, \
+            "Size-tiered and major compactions split their output into a run of SSTables of about this size, and release each compacted SSTable as soon as the SSTables written so far hold all of its data rather than when the whole compaction is done, so that a compaction needs about this much extra disk space instead of the size of what it compacts. Releasing takes sstable_preemptive_open_interval_in_mb not to be 0. Set to 0 to write a single SSTable."   \
     )                                               \
     /* Common memtable settings */  \
     val(memtable_total_space_in_mb, uint32_t, 0, Used,     \
@@ -266,7 +282,7 @@ class config {
     val(concurrent_writes, uint32_t, 32, Invalid,     \
             "Writes in Cassandra are rarely I/O bound, so the ideal number of concurrent writes depends on the number of CPU cores in your system. The recommended value is (8 x number_of_cpu_cores)."  \
     )                                                   \
-    val(concurrent_counter_writes, uint32_t, 32, Unused,     \
+    val(concurrent_counter_writes, uint32_t, 32, Used,     \
             "Counter writes read the current values before incrementing and writing them back. The recommended value is (16 × number_of_drives) ."  \
     )                                                   \
     /* Common automatic backup settings */  \
@@ -283,6 +299,9 @@ class config {
             "Adjusts the sensitivity of the failure detector on an exponential scale. Generally this setting never needs adjusting.\n"  \
             "Related information: Failure detection and recovery"  \
     )                                                   \
+    val(fd_heartbeat_interval_in_ms, uint32_t, 250, Used,     \
+            "Interval at which each live node is sent a lightweight heartbeat over the internode connection. Nodes whose heartbeats stop arriving are tried last by reads, before gossip marks them down. 0 disables the heartbeats."  \
+    )                                                   \
     /* Performance tuning properties */ \
     /* Tuning performance and system reso   urce utilization, including commit log, compaction, memory, disk I/O, CPU, reads, and writes. */    \
     /* Commit log settings */   \
@@ -305,10 +324,25 @@ class config {
     val(commitlog_sync_batch_window_in_ms, uint32_t, 10000, Used,     \
             "Controls how long the system waits for other writes before performing a sync in \"batch\" mode."    \
     )   \
+    val(commitlog_sync_group_window_in_us, uint32_t, 0, Used,     \
+            "Group commit window in \"batch\" mode. If non-zero, writes arriving within this many microseconds of each other are written to the commit log and synced together, and are acknowledged together. 0 syncs every write, or set of concurrent writes, on its own."    \
+    )   \
+    val(commitlog_sync_group_window_in_kb, uint32_t, 256, Used,     \
+            "A group commit window is also closed, and synced, once the writes in it add up to this many kilobytes. 0 means no limit."    \
+    )   \
     val(commitlog_total_space_in_mb, int64_t, -1, Used,     \
             "Total space used for commitlogs. If the used space goes above this value, Scylla rounds up to the next nearest segment multiple and flushes memtables to disk for the oldest commitlog segments, removing those log segments. This reduces the amount of data to replay on startup, and prevents infrequently-updated tables from indefinitely keeping commitlog segments. A small total commitlog space tends to cause more flush activity on less-active tables.\n"  \
             "Related information: Configuring memtable throughput"  \
     )                                                   \
+    val(commitlog_reuse_segments, bool, true, Used,     \
+            "Whether to keep the files of commitlog segments whose data has been flushed to SSTables, and reuse them for new segments instead of creating new files. Reusing a file avoids the filesystem metadata updates of creating and extending a new one on the write path."    \
+    )                                                   \
+    val(commitlog_compression, bool, false, Used,     \
+            "Compress commitlog segments with LZ4. Trades some CPU on the write path for fewer bytes written to the commitlog disk. Segments written with and without compression can be replayed either way."    \
+    )                                                   \
+    val(commitlog_isolated_tables, sstring, "", Used,     \
+            "Comma separated list of keyspaces (\"ks\") and tables (\"ks.table\") which get a commitlog of their own, in a subdirectory of commitlog_directory named after the entry. Writes to these tables don't share segments with other tables, so their segment turnover doesn't force flushes of unrelated tables, and vice versa. Each isolated commitlog has its own commitlog_total_space_in_mb budget."    \
+    )                                                   \
     /* Compaction settings */   \
     /* Related information: Configuring compaction */   \
     val(compaction_preheat_key_cache, bool, true, Unused,                \
@@ -323,8 +357,14 @@ class config {
     val(preheat_kernel_page_cache, bool, false, Unused, \
             "Enable or disable kernel page cache preheating from contents of the key cache after compaction. When enabled it preheats only first page (4KB) of each row to optimize for sequential access. It can be harmful for fat rows, see CASSANDRA-4937 for more details."    \
     )   \
-    val(sstable_preemptive_open_interval_in_mb, uint32_t, 50, Unused,     \
-            "When compacting, the replacement opens SSTables before they are completely written and uses in place of the prior SSTables for any range previously written. This setting helps to smoothly transfer reads between the SSTables by reducing page cache churn and keeps hot rows hot."  \
+    val(sstable_preemptive_open_interval_in_mb, uint32_t, 50, Used,     \
+            "When compacting, the replacement opens SSTables before they are completely written and uses in place of the prior SSTables for any range previously written. This setting helps to smoothly transfer reads between the SSTables by reducing page cache churn and keeps hot rows hot. Only compactions which split their output into SSTables of bounded size, like those of the leveled strategy or those split by compaction_fragment_size_in_mb, open it early, a whole output SSTable at a time, each time this much more was written. Set to 0 to disable."  \
+    )                                                   \
+    val(enable_blocked_bloom_filter, bool, false, Used,     \
+            "Write bloom filters of new SSTables in a cache-line blocked layout, which makes lookups touch a single cache line at the price of a slightly higher false positive rate. SSTables with such filters can't be read by Cassandra."  \
+    )                                                   \
+    val(enable_sstables_compact_format, bool, false, Used,     \
+            "Write new SSTables in the compact sa format, which stores the partition index more densely and delta-encodes cells. SSTables in this format can't be read by Cassandra or by Scylla versions which predate it, so enable it only once all nodes are upgraded."  \
     )                                                   \
     val(defragment_memory_on_idle, bool, true, Used, "Set to true to defragment memory when the cpu is idle.  This reduces the amount of work Scylla performs when processing client requests.") \
     /* Memtable settings */ \
@@ -334,16 +374,31 @@ class config {
             "\toffheap_buffers  Off heap (direct) NIO buffers.\n"   \
             "\toffheap_objects  Native memory, eliminating NIO buffer heap overhead."   \
     )                                                   \
+    val(memory_balancing_interval_in_ms, uint32_t, 1000, Used, \
+            "How often memory is rebalanced between the row cache and memtables, from the recent read hit rate and write rate. Memtables above their share are flushed early, and the cache above its share is evicted in the background. 0 disables balancing, which leaves the split to memory reclaim." \
+    )   \
+    val(row_cache_reserve_share, double, .5, Used, \
+            "Share of the memory available to the row cache and memtables which is kept for the row cache against write bursts when all reads hit the cache. The share shrinks with the read hit rate." \
+    )   \
+    val(memtable_keyspace_reserve, double, .1, Used, \
+            "Share of the memtable memory reserved for each user keyspace against write bursts of the others. A keyspace may use all memtable memory but what is reserved for the other keyspaces, or half of it if that is less, after which its writes are throttled and its memtables flushed while the other keyspaces keep writing. 0 lets a single keyspace take all of it." \
+    )   \
     val(memtable_cleanup_threshold, double, .11, Used, \
             "Ratio of occupied non-flushing memtable size to total permitted size for triggering a flush of the largest memtable. Larger values mean larger flushes and less compaction, but also less concurrent flush activity, which can make it difficult to keep your disks saturated under heavy write load." \
     )   \
-    val(file_cache_size_in_mb, uint32_t, 512, Unused,  \
-            "Total memory to use for SSTable-reading buffers."  \
+    val(file_cache_size_in_mb, uint32_t, 512, Used,  \
+            "Total memory to use for caching decompressed chunks of compressed SSTables. The memory is divided evenly between shards. To disable set to 0."  \
     )   \
-    val(memtable_flush_queue_size, uint32_t, 4, Unused,     \
-            "The number of full memtables to allow pending flush (memtables waiting for a write thread). At a minimum, set to the maximum number of indexes created on a single table.\n"  \
+    val(sstable_filter_memory_in_mb, uint32_t, 0, Used,  \
+            "Total memory the bloom filters of SSTables may occupy. The memory is divided evenly between shards. When set, filters are loaded on the first read of their SSTable and the least recently used ones are dropped to stay within the limit, so filters of rarely read tables don't stay in memory. 0 loads all filters when the SSTables are opened and keeps them."  \
+    )   \
+    val(memtable_flush_queue_size, uint32_t, 4, Used,     \
+            "The number of full memtables of a table to allow pending flush (memtables waiting for, or in the middle of, being written). Writes to the table wait while the queue is full, so that slow storage throttles writes instead of accumulating memtables in memory. 0 doesn't bound the queue.\n"  \
             "Related information: Flushing data from the memtable"  \
     )   \
+    val(memtable_flush_concurrency_per_table, uint32_t, 0, Used,     \
+            "The number of memtables of a single table flushed at the same time. Flushes are also bounded by the flush slots of the shard, so 0 leaves it to them."  \
+    )   \
     val(memtable_flush_writers, uint32_t, 1, Invalid,     \
             "Sets the number of memtable flush writer threads. These threads are blocked by disk I/O, and each one holds a memtable in memory while blocked. If you have a large Java heap size and many data directories, you can increase the value for better flush performance."  \
     )   \
@@ -357,11 +412,11 @@ class config {
     val(column_index_size_in_kb, uint32_t, 64, Unused,     \
             "Granularity of the index of rows within a partition. For huge rows, decrease this setting to improve seek time. If you use key cache, be careful not to make this setting too large because key cache will be overwhelmed. If you're unsure of the size of the rows, it's best to use the default setting."  \
     )   \
-    val(index_summary_capacity_in_mb, uint32_t, 0, Unused,     \
-            "Fixed memory pool size in MB for SSTable index summaries. If the memory usage of all index summaries exceeds this limit, any SSTables with low read rates shrink their index summaries to meet this limit. This is a best-effort process. In extreme conditions, Cassandra may need to use more than this amount of memory."  \
+    val(index_summary_capacity_in_mb, uint32_t, 0, Used,     \
+            "Fixed memory pool size in MB for SSTable index summaries. If the memory usage of all index summaries exceeds this limit, any SSTables with low read rates shrink their index summaries to meet this limit. This is a best-effort process. In extreme conditions, Scylla may need to use more than this amount of memory. The memory is divided evenly between shards. 0 keeps all summaries at their sampling level on disk."  \
     )   \
-    val(index_summary_resize_interval_in_minutes, uint32_t, 60, Unused,     \
-            "How frequently index summaries should be re-sampled. This is done periodically to redistribute memory from the fixed-size pool to SSTables proportional their recent read rates. To disable, set to -1. This leaves existing index summaries at their current sampling level."  \
+    val(index_summary_resize_interval_in_minutes, uint32_t, 60, Used,     \
+            "How frequently index summaries should be re-sampled. This is done periodically to redistribute memory from the fixed-size pool to SSTables proportional their recent read rates. To disable, set to 0. This leaves existing index summaries at their current sampling level."  \
     )   \
     val(reduce_cache_capacity_to, double, .6, Invalid,     \
             "Sets the size percentage to which maximum cache capacity is reduced when Java heap usage reaches the threshold defined by reduce_cache_sizes_at. Together with flush_largest_memtables_at, these properties constitute an emergency measure for preventing sudden out-of-memory (OOM) errors."  \
@@ -372,17 +427,20 @@ class config {
     val(max_cached_partition_size_in_kb, uint64_t, 10240uLL, Used,     \
             "Partitions with size greater than this value won't be cached."  \
     )   \
+    val(expired_data_sweep_period_in_s, uint32_t, 60, Used,     \
+            "How often partitions in the cache and the active memtable of each table are compacted in the background, so that expired cells, and tombstones past gc_grace_seconds in the cache, stop taking memory and slowing down reads before the next flush or compaction. 0 disables the sweep."  \
+    )   \
     /* Disks settings */    \
-    val(stream_throughput_outbound_megabits_per_sec, uint32_t, 400, Unused,     \
-            "Throttles all outbound streaming file transfers on a node to the specified throughput. Cassandra does mostly sequential I/O when streaming data during bootstrap or repair, which can lead to saturating the network connection and degrading client (RPC) performance."  \
+    val(stream_throughput_outbound_megabits_per_sec, uint32_t, 400, Used,     \
+            "Throttles all outbound streaming file transfers on a node to the specified throughput. Cassandra does mostly sequential I/O when streaming data during bootstrap or repair, which can lead to saturating the network connection and degrading client (RPC) performance. 0 disables throttling."  \
     )   \
-    val(inter_dc_stream_throughput_outbound_megabits_per_sec, uint32_t, 0, Unused,     \
-            "Throttles all streaming file transfer between the data centers. This setting allows throttles streaming throughput betweens data centers in addition to throttling all network stream traffic as configured with stream_throughput_outbound_megabits_per_sec."  \
+    val(inter_dc_stream_throughput_outbound_megabits_per_sec, uint32_t, 0, Used,     \
+            "Throttles all streaming file transfer between the data centers. This setting allows throttles streaming throughput betweens data centers in addition to throttling all network stream traffic as configured with stream_throughput_outbound_megabits_per_sec. 0 disables throttling."  \
     )   \
-    val(trickle_fsync, bool, false, Unused,     \
-            "When doing sequential writing, enabling this option tells fsync to force the operating system to flush the dirty buffers at a set interval trickle_fsync_interval_in_kb. Enable this parameter to avoid sudden dirty buffer flushing from impacting read latencies. Recommended to use on SSDs, but not on HDDs."  \
+    val(trickle_fsync, bool, false, Used,     \
+            "When doing sequential writing, enabling this option tells fsync to force the operating system to flush the dirty buffers at a set interval trickle_fsync_interval_in_kb. Enable this parameter to avoid sudden dirty buffer flushing from impacting read latencies. Recommended to use on SSDs, but not on HDDs. Applies to data and index files of SSTables written by flushes and compactions."  \
     )   \
-    val(trickle_fsync_interval_in_kb, uint32_t, 10240, Unused,     \
+    val(trickle_fsync_interval_in_kb, uint32_t, 10240, Used,     \
             "Sets the size of the fsync in kilobytes."  \
     )   \
     /* Advanced properties */   \
@@ -409,6 +467,9 @@ class config {
             "If not using vnodes, comment #num_tokens : 256 or set num_tokens : 1 and use initial_token. If you already have an existing cluster with one token per node and wish to migrate to vnodes, see Enabling virtual nodes on an existing production cluster.\n"    \
             "Note: If using DataStax Enterprise, the default setting of this property depends on the type of node and type of install."  \
     )   \
+    val(allocate_tokens_for_keyspace, sstring, "", Used,     \
+            "When set, a bootstrapping node doesn't pick its num_tokens tokens at random, but places them so as to even out the replicated ownership of the nodes, taking the given keyspace's replication strategy and the rack layout into account. The keyspace must exist. Has no effect when initial_token is set." \
+    )   \
     val(partitioner, sstring, "org.apache.cassandra.dht.Murmur3Partitioner", Used,                \
             "Distributes rows (by partition key) across all nodes in the cluster. Any IPartitioner may be used, including your own as long as it is in the class path. For new clusters use the default partitioner.\n" \
             "Scylla provides the following partitioners for backwards compatibility:\n"  \
@@ -439,17 +500,17 @@ class config {
     val(key_cache_save_period, uint32_t, 14400, Unused,                \
             "Duration in seconds that keys are saved in cache. Caches are saved to saved_caches_directory. Saved caches greatly improve cold-start speeds and has relatively little effect on I/O."  \
     )   \
-    val(key_cache_size_in_mb, uint32_t, 100, Unused,                \
+    val(key_cache_size_in_mb, uint32_t, 100, Used,                \
             "A global cache setting for tables. It is the maximum size of the key cache in memory. To disable set to 0.\n"  \
             "Related information: nodetool setcachecapacity."   \
     )   \
-    val(row_cache_keys_to_save, uint32_t, 0, Unused,                \
+    val(row_cache_keys_to_save, uint32_t, 0, Used,                \
             "Number of keys from the row cache to save."  \
     )   \
     val(row_cache_size_in_mb, uint32_t, 0, Unused,                \
             "Maximum size of the row cache in memory. Row cache can save more time than key_cache_size_in_mb, but is space-intensive because it contains the entire row. Use the row cache only for hot rows or static rows. If you reduce the size, you may not get you hottest keys loaded on start up."  \
     )   \
-    val(row_cache_save_period, uint32_t, 0, Unused,     \
+    val(row_cache_save_period, uint32_t, 0, Used,     \
             "Duration in seconds that rows are saved in cache. Caches are saved to saved_caches_directory."  \
     )   \
     val(memory_allocator, sstring, "NativeAllocator", Invalid,     \
@@ -462,8 +523,8 @@ class config {
     /* Counter caches properties */ \
     /* Counter cache helps to reduce counter locks' contention for hot counter cells. In case of RF = 1 a counter cache hit will cause Cassandra to skip the read before write entirely. With RF > 1 a counter cache hit will still help to reduce the duration of the lock hold, helping with hot counter cell updates, but will not allow skipping the read entirely. Only the local (clock, count) tuple of a counter cell is kept in memory, not the whole counter, so it's relatively cheap. */    \
     /* Note: Reducing the size counter cache may result in not getting the hottest keys loaded on start-up. */  \
-    val(counter_cache_size_in_mb, uint32_t, 0, Unused,     \
-            "When no value is specified a minimum of 2.5% of Heap or 50MB. If you perform counter deletes and rely on low gc_grace_seconds, you should disable the counter cache. To disable, set to 0"  \
+    val(counter_cache_size_in_mb, uint32_t, 50, Used,     \
+            "The amount of memory the counter cache may use, split evenly between the shards. If you perform counter deletes and rely on low gc_grace_seconds, you should disable the counter cache. To disable, set to 0"  \
     )   \
     val(counter_cache_save_period, uint32_t, 7200, Unused,     \
             "Duration after which Cassandra should save the counter cache (keys only). Caches are saved to saved_caches_directory."  \
@@ -471,15 +532,21 @@ class config {
     val(counter_cache_keys_to_save, uint32_t, 0, Unused,     \
             "Number of keys from the counter cache to save. When disabled all keys are saved."  \
     )   \
+    val(query_result_cache_size_in_mb, uint32_t, 0, Used,     \
+            "The amount of memory the cache of single-partition query results may use, split evenly between the shards. It helps partitions which are read very often with the same query, and seldom written to. To disable, set to 0"  \
+    )   \
     /* Tombstone settings */    \
     /* When executing a scan, within or across a partition, tombstones must be kept in memory to allow returning them to the coordinator. The coordinator uses them to ensure other replicas know about the deleted rows. Workloads that generate numerous tombstones may cause performance problems and exhaust the server heap. See Cassandra anti-patterns: Queues and queue-like datasets. Adjust these thresholds only if you understand the impact and want to scan more tombstones. Additionally, you can adjust these thresholds at runtime using the StorageServiceMBean. */   \
     /* Related information: Cassandra anti-patterns: Queues and queue-like datasets */  \
-    val(tombstone_warn_threshold, uint32_t, 1000, Unused,     \
+    val(tombstone_warn_threshold, uint32_t, 1000, Used,     \
             "The maximum number of tombstones a query can scan before warning."  \
     )   \
-    val(tombstone_failure_threshold, uint32_t, 100000, Unused,     \
+    val(tombstone_failure_threshold, uint32_t, 100000, Used,     \
             "The maximum number of tombstones a query can scan before aborting."  \
     )   \
+    val(max_page_size_in_kb, uint64_t, 1024, Used,     \
+            "The maximum size of a page of query results. Replicas end a page early, and return it with the paging state, once the results they have gathered for it reach this size, so wide rows can't make a page arbitrarily large. 0 disables the limit."  \
+    )   \
     /* Network timeout settings */  \
     val(range_request_timeout_in_ms, uint32_t, 10000, Unused,     \
             "The time in milliseconds that the coordinator waits for sequential or index scans to complete."  \
@@ -487,7 +554,16 @@ class config {
     val(read_request_timeout_in_ms, uint32_t, 5000, Used,     \
             "The time that the coordinator waits for read operations to complete"  \
     )   \
-    val(counter_write_request_timeout_in_ms, uint32_t, 5000, Unused,     \
+    val(read_repair_page_size_in_rows, uint32_t, 1000, Used,     \
+            "After a digest mismatch, a single partition read is reconciled in pages of at most this many rows, with the repair of each page sent before the next one is read. This bounds the memory the coordinator needs to hold the versions of wide partitions from all replicas. 0 reconciles the whole read at once."  \
+    )   \
+    val(slow_query_log_timeout_in_ms, uint32_t, 0, Used,     \
+            "Queries which take longer than this on the coordinator are recorded in system_traces.node_slow_log, whether or not they were traced, with the time each replica took to respond. The number of records written is capped per shard. 0 disables the slow query log."  \
+    )   \
+    val(columnar_range_scan_results, bool, false, Used,     \
+            "CQL range scans build their results in a columnar encoding, which stores the cells of each selected column together, instead of framing every cell of every row. Results are built that way on the coordinator only, from the rows reconciled from the replicas, so this doesn't affect other nodes or the size of what they send, and the extra encoding pass may cost more than it saves."  \
+    )   \
+    val(counter_write_request_timeout_in_ms, uint32_t, 5000, Used,     \
             "The time that the coordinator waits for counter writes to complete."  \
     )   \
     val(cas_contention_timeout_in_ms, uint32_t, 5000, Unused,     \
@@ -505,8 +581,8 @@ class config {
             "Related information: About hinted handoff writes"  \
     )   \
     /* Inter-node settings */   \
-    val(cross_node_timeout, bool, false, Unused,                \
-            "Enable or disable operation timeout information exchange between nodes (to accurately measure request timeouts). If disabled Cassandra assumes the request was forwarded to the replica instantly by the coordinator.\n"   \
+    val(cross_node_timeout, bool, false, Used,                \
+            "Enable or disable operation timeout information exchange between nodes (to accurately measure request timeouts). If disabled Scylla assumes the request was forwarded to the replica instantly by the coordinator, and replicas time out reads and writes after read_request_timeout_in_ms and write_request_timeout_in_ms.\n"   \
             "CAUTION:\n"    \
             "Before enabling this property make sure NTP (network time protocol) is installed and the times are synchronized between the nodes."  \
     )   \
@@ -529,12 +605,18 @@ class config {
             "\tdc : Traffic between data centers is compressed.\n"  \
             "\tnone : No compression."  \
     )   \
-    val(inter_dc_tcp_nodelay, bool, false, Unused,     \
+    val(inter_dc_tcp_nodelay, bool, false, Used,     \
             "Enable or disable tcp_nodelay for inter-data center communication. When disabled larger, but fewer, network packets are sent. This reduces overhead from the TCP protocol itself. However, if cross data-center responses are blocked, it will increase latency."  \
     )   \
     val(streaming_socket_timeout_in_ms, uint32_t, 0, Unused,     \
             "Enable or disable socket timeout for streaming operations. When a timeout occurs during streaming, streaming is retried from the start of the current file. Avoid setting this value too low, as it can result in a significant amount of data re-streaming."  \
     )   \
+    val(repair_ranges_per_shard, uint32_t, 4, Used,     \
+            "The number of token ranges each shard repairs concurrently. Every range is repaired on the shard which owns it, so a node repairs up to this many ranges times the number of shards at once."  \
+    )   \
+    val(repair_syncs_per_shard, uint32_t, 2, Used,     \
+            "The number of stream plans syncing differing ranges each shard runs concurrently during repair. When this many are running, the shard stops checksumming further ranges until one completes."  \
+    )   \
     /* Native transport (CQL Binary Protocol) */    \
     val(start_native_transport, bool, true, Unused,                \
             "Enable or disable the native transport server. Uses the same address as the rpc_address, but the port is different from the rpc_port. See native_transport_port."  \
@@ -587,55 +669,57 @@ class config {
     )   \
     /* Advanced fault detection settings */ \
     /* Settings to handle poorly performing or failing nodes. */    \
-    val(dynamic_snitch_badness_threshold, double, 0, Unused,     \
+    val(dynamic_snitch, bool, true, Used,     \
+            "Reorder replicas for reads by their recent read latency, on top of the order given by endpoint_snitch."  \
+    )   \
+    val(dynamic_snitch_badness_threshold, double, 0.1, Used,     \
             "Sets the performance threshold for dynamically routing requests away from a poorly performing node. A value of 0.2 means Cassandra continues to prefer the static snitch values until the node response time is 20% worse than the best performing node. Until the threshold is reached, incoming client requests are statically routed to the closest replica (as determined by the snitch). Having requests consistently routed to a given replica can help keep a working set of data hot when read repair is less than 1."  \
     )   \
-    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 60000, Unused,     \
+    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 60000, Used,     \
             "Time interval in milliseconds to reset all node scores, which allows a bad node to recover."  \
     )   \
-    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Unused,     \
+    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Used,     \
             "The time interval for how often the snitch calculates node scores. Because score calculation is CPU intensive, be careful when reducing this interval."  \
     )   \
-    val(hinted_handoff_enabled, bool, true, Unused,     \
+    val(hinted_handoff_enabled, bool, true, Used,     \
             "Enable or disable hinted handoff. To enable per data center, add data center list. For example: hinted_handoff_enabled: DC1,DC2. A hint indicates that the write needs to be replayed to an unavailable node. Where Cassandra writes the hint depends on the version:\n"  \
             "\n"    \
             "\tPrior to 1.0: Writes to a live replica node.\n"  \
             "\t1.0 and later: Writes to the coordinator node.\n"  \
             "Related information: About hinted handoff writes"  \
     )   \
-    val(hinted_handoff_throttle_in_kb, uint32_t, 1024, Unused,     \
+    val(hinted_handoff_throttle_in_kb, uint32_t, 1024, Used,     \
             "Maximum throttle per delivery thread in kilobytes per second. This rate reduces proportionally to the number of nodes in the cluster. For example, if there are two nodes in the cluster, each delivery thread will use the maximum rate. If there are three, each node will throttle to half of the maximum, since the two nodes are expected to deliver hints simultaneously."  \
     )   \
-    val(max_hint_window_in_ms, uint32_t, 10800000, Unused,     \
+    val(max_hint_window_in_ms, uint32_t, 10800000, Used,     \
             "Maximum amount of time that hints are generates hints for an unresponsive node. After this interval, new hints are no longer generated until the node is back up and responsive. If the node goes down again, a new interval begins. This setting can prevent a sudden demand for resources when a node is brought back online and the rest of the cluster attempts to replay a large volume of hinted writes.\n"  \
             "Related information: Failure detection and recovery"  \
     )   \
     val(max_hints_delivery_threads, uint32_t, 2, Invalid,     \
             "Number of threads with which to deliver hints. In multiple data-center deployments, consider increasing this number because cross data-center handoff is generally slower."  \
     )   \
-    val(batchlog_replay_throttle_in_kb, uint32_t, 1024, Unused,     \
-            "Total maximum throttle. Throttling is reduced proportionally to the number of nodes in the cluster."  \
+    val(batchlog_replay_throttle_in_kb, uint32_t, 1024, Used,     \
+            "Total maximum throttle. Throttling is reduced proportionally to the number of nodes in the cluster, and split among the shards replaying batches. 0 disables throttling."  \
     )   \
     /* Request scheduler properties */  \
     /* Settings to handle incoming client requests according to a defined policy. If you need to use these properties, your nodes are overloaded and dropping requests. It is recommended that you add more nodes and not try to prioritize requests. */    \
-    val(request_scheduler, sstring, "org.apache.cassandra.scheduler.NoScheduler", Unused,     \
+    val(request_scheduler, sstring, "org.apache.cassandra.scheduler.NoScheduler", Used,     \
             "Defines a scheduler to handle incoming client requests according to a defined policy. This scheduler is useful for throttling client requests in single clusters containing multiple keyspaces. This parameter is specifically for requests from the client and does not affect inter-node communication. Valid values are:\n" \
             "\n"    \
             "\torg.apache.cassandra.scheduler.NoScheduler   No scheduling takes place.\n"   \
             "\torg.apache.cassandra.scheduler.RoundRobinScheduler   Round robin of client requests to a node with a separate queue for each request_scheduler_id property.\n"   \
-            "\tA Java class that implements the RequestScheduler interface."  \
             , "org.apache.cassandra.scheduler.NoScheduler"  \
             , "org.apache.cassandra.scheduler.RoundRobinScheduler"  \
     )   \
-    val(request_scheduler_id, sstring, /* keyspace */, Unused,     \
-            "An identifier on which to perform request scheduling. Currently the only valid value is keyspace. See weights."  \
+    val(request_scheduler_id, sstring, "keyspace", Used,     \
+            "An identifier on which to perform request scheduling: keyspace, the keyspace of the table a statement reads or writes, or user, the authenticated user. See weights."  \
     )   \
-    val(request_scheduler_options, string_map, /* disabled */, Unused,     \
+    val(request_scheduler_options, string_map, /* disabled */, Used,     \
             "Contains a list of properties that define configuration options for request_scheduler:\n"  \
             "\n"    \
-            "\tthrottle_limit: The number of in-flight requests per client. Requests beyond this limit are queued up until running requests complete. Recommended value is ((concurrent_reads + concurrent_writes) × 2)\n" \
+            "\tthrottle_limit: The number of requests executed at a time by the node. Requests beyond this limit are queued up until running requests complete. Recommended value is ((concurrent_reads + concurrent_writes) × 2)\n" \
             "\tdefault_weight: (Default: 1 **)  How many requests are handled during each turn of the RoundRobin.\n" \
-            "\tweights: (Default: Keyspace: 1)  Takes a list of keyspaces. It sets how many requests are handled during each turn of the RoundRobin, based on the request_scheduler_id."  \
+            "\tweights: (Default: Keyspace: 1)  Takes a list of keyspaces, or users. It sets how many requests are handled during each turn of the RoundRobin, based on the request_scheduler_id. Keyspaces listed here also get a share of the disk for their queries' reads in the same proportion."  \
     )   \
     /* Thrift interface properties */   \
     /* Legacy API for older clients. CQL is a simpler and better API for Scylla. */  \
@@ -678,6 +762,15 @@ class config {
     val(permissions_cache_max_entries, uint32_t, 1000, Used,    \
             "Maximum cached permission entries" \
     )   \
+    val(credentials_validity_in_ms, uint32_t, 2000, Used,     \
+            "How long the password hashes and verified logins of PasswordAuthenticator remain cached on each shard. Set to 0 to disable the cache."  \
+    )   \
+    val(credentials_update_interval_in_ms, uint32_t, 1000, Used,     \
+            "Refresh interval for the credentials cache (if enabled). After this interval, cache entries become eligible for refresh. On next access, an async reload is scheduled and the old value is returned until it completes. Defaults to credentials_validity_in_ms if set to 0."   \
+    )   \
+    val(credentials_cache_max_entries, uint32_t, 1000, Used,    \
+            "Maximum cached credentials entries" \
+    )   \
     val(server_encryption_options, string_map, /*none*/, Used,     \
             "Enable or disable inter-node encryption. You must also generate keys and provide the appropriate key and trust store locations and passwords. No custom encryption options are currently enabled. The available options are:\n"    \
             "\n"    \
@@ -735,6 +828,10 @@ class config {
     val(prometheus_port, uint16_t, 9180, Used, "Prometheus port, set to zero to disable") \
     val(prometheus_address, sstring, "0.0.0.0", Used, "Prometheus listening address") \
     val(abort_on_lsa_bad_alloc, bool, false, Used, "Abort when allocation in LSA region fails") \
+    val(lsa_huge_page_zones, bool, false, Used, "Align and size LSA memory zones in 2 MB huge pages, so that the kernel can back them with transparent huge pages. Reduces TLB misses during cache scans.") \
+    val(lsa_reserved_memory_in_mb, uint32_t, 0, Used, "Amount of memory per shard, in megabytes, which is set aside for LSA at startup and never given back to the standard allocator. 0 disables the reservation.") \
+    val(stall_report_threshold_in_us, uint32_t, 2000, Used, "Synchronous sections of row cache updates, compaction, token metadata updates and schema merges which run longer than this, in microseconds, are counted as reactor stalls of that subsystem and reported through the API, collectd and the log. Should be set to the task quota.") \
+    val(io_priority_class_shares, string_map, /* built-in shares */, Used, "Shares of the disk bandwidth given to each I/O priority class when several of them have requests queued, by class name: commitlog (100), memtable_flush (100), streaming_read (20), streaming_write (20), repair_read (20), query (100), compaction (100), cache_warmup (10), bulk_export (10). Classes not listed keep the shares in parentheses. Per-class queue length and latency are reported by the io_queue metrics.") \
     /* done! */
 
 #define _make_value_member(name, type, deflt, status, desc, ...)    \
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/counter_cache.hh"
+
+namespace db {
+
+counter_cache& global_counter_cache() {
+    static thread_local counter_cache instance;
+    return instance;
+}
+
+counter_cache_key::counter_cache_key(const schema& s, const partition_key& pk, const clustering_key* ck, const column_definition& def) {
+    auto ck_bytes = ck ? ck->representation() : bytes_view();
+    cf_cache_key_builder b(pk.view(), sizeof(uint8_t) + sizeof(uint32_t) + ck_bytes.size());
+    b.write(uint8_t(def.kind));
+    b.write(uint32_t(def.id));
+    b.write(ck_bytes);
+    _key = std::move(b).build();
+}
+
+std::experimental::optional<counter_cache_value> counter_cache::lookup(const utils::UUID& cf_id, const counter_cache_key& key) {
+    return _cache.lookup(std::make_pair(cf_id, key.representation()), [] (const counter_cache_entry& e) {
+        return e.value();
+    });
+}
+
+void counter_cache::insert(const utils::UUID& cf_id, const counter_cache_key& key, counter_cache_value value) {
+    _cache.insert(std::make_pair(cf_id, key.representation()), [value] (counter_cache_entry& e) {
+        e.set_value(value);
+    }, cf_id, key.representation(), value);
+}
+
+void counter_cache::invalidate(const utils::UUID& cf_id, const partition_key& pk) {
+    auto prefix = cf_cache_partition_prefix(pk.view());
+    _cache.invalidate(cf_cache_partition{cf_id, bytes_view(prefix)});
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+
+#include "db/cf_cache_entry.hh"
+#include "schema.hh"
+
+namespace db {
+
+// The local shard of a counter cell.
+struct counter_cache_value {
+    int64_t value;
+    int64_t logical_clock;
+};
+
+// Identifies a counter cell within a column family.
+//
+//   <key> := <partition prefix><uint8_t:column kind><uint32_t:column id><ck>?
+class counter_cache_key {
+    bytes _key;
+public:
+    counter_cache_key(const schema& s, const partition_key& pk, const clustering_key* ck, const column_definition& def);
+    bytes_view representation() const { return _key; }
+};
+
+class counter_cache_entry : public cf_cache_entry {
+    counter_cache_value _value;
+public:
+    counter_cache_entry(const utils::UUID& cf_id, bytes_view key, counter_cache_value value)
+        : cf_cache_entry(cf_id, key)
+        , _value(value)
+    { }
+
+    counter_cache_entry(counter_cache_entry&&) noexcept = default;
+
+    counter_cache_value value() const { return _value; }
+    void set_value(counter_cache_value value) { _value = value; }
+};
+
+// Shard-wide cache of the local shards of counter cells.
+//
+// The leader of a counter update has to know the current value and logical
+// clock of its own shard of each updated cell. Only the shard which owns the
+// partition ever changes them, so once known they can be kept in memory,
+// which saves the read before write on most updates of hot counters.
+//
+// Whatever may change a cell other than the leader's updates, like
+// deletions, truncation or streaming, has to invalidate its entries.
+class counter_cache final {
+    using cache_type = utils::lsa_lru_cache<counter_cache_entry, cf_cache_compare>;
+public:
+    using stats = cache_type::stats;
+private:
+    cache_type _cache{"counter_cache"};
+public:
+    std::experimental::optional<counter_cache_value> lookup(const utils::UUID& cf_id, const counter_cache_key& key);
+    void insert(const utils::UUID& cf_id, const counter_cache_key& key, counter_cache_value value);
+    // Removes the entries of all cells of given partition.
+    void invalidate(const utils::UUID& cf_id, const partition_key& pk);
+    // Removes all entries of given column family.
+    void invalidate(const utils::UUID& cf_id) { _cache.invalidate(cf_id); }
+    void clear() { _cache.clear(); }
+
+    void set_capacity(size_t bytes) { _cache.set_capacity(bytes); }
+    size_t capacity() const { return _cache.capacity(); }
+    bool enabled() const { return _cache.enabled(); }
+
+    const stats& get_stats() const { return _cache.get_stats(); }
+    const logalloc::region& region() const { return _cache.region(); }
+};
+
+// Returns a reference to shard-wide counter_cache.
+counter_cache& global_counter_cache();
+
+}
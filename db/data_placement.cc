@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/data_placement.hh"
+#include <sys/statvfs.h>
+#include <cstring>
+#include <seastar/util/log.hh>
+#include "core/print.hh"
+
+static seastar::logger logger("data_placement");
+
+namespace db {
+
+constexpr std::chrono::seconds data_placement::refresh_interval;
+
+data_placement::permit::permit(data_placement& p, unsigned directory)
+    : _placement(&p)
+    , _directory(directory)
+{
+    ++_placement->_stats[_directory].writes_in_progress;
+}
+
+void data_placement::permit::release() {
+    if (_placement) {
+        --_placement->_stats[_directory].writes_in_progress;
+        _placement = nullptr;
+    }
+}
+
+data_placement::data_placement(std::vector<sstring> directories)
+    : _directories(std::move(directories))
+    , _stats(_directories.size())
+    , _refresh_timer([this] { refresh_free_space(); })
+{
+    refresh_free_space();
+    // With a single directory there is nothing to choose from.
+    if (_directories.size() > 1) {
+        _refresh_timer.arm_periodic(refresh_interval);
+    }
+    setup_collectd();
+}
+
+void data_placement::setup_collectd() {
+    for (unsigned i = 0; i < _directories.size(); ++i) {
+        auto instance = sprint("data_directory-%d", i);
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id(instance
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "sstables_written")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats[i].sstables_written)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id(instance
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "sstables_written")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats[i].bytes_written)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id(instance
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "writes_in_progress")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats[i].writes_in_progress)
+        ));
+    }
+}
+
+void data_placement::refresh_free_space() {
+    for (unsigned i = 0; i < _directories.size(); ++i) {
+        // statvfs() only reads file system metadata which is kept in memory,
+        // it isn't worth a round trip to the syscall thread.
+        struct statvfs st;
+        if (::statvfs(_directories[i].c_str(), &st) < 0) {
+            logger.warn("Failed to get free space of {}: {}", _directories[i], strerror(errno));
+            continue;
+        }
+        _stats[i].free_bytes = uint64_t(st.f_bavail) * st.f_frsize;
+    }
+}
+
+data_placement::permit data_placement::pick(uint64_t estimated_size) {
+    unsigned best = 0;
+    for (unsigned i = 1; i < _directories.size(); ++i) {
+        auto& b = _stats[best];
+        auto& c = _stats[i];
+        auto b_fits = b.free_bytes >= estimated_size;
+        auto c_fits = c.free_bytes >= estimated_size;
+        if (b_fits != c_fits) {
+            if (c_fits) {
+                best = i;
+            }
+        } else if (c.writes_in_progress != b.writes_in_progress) {
+            if (c.writes_in_progress < b.writes_in_progress) {
+                best = i;
+            }
+        } else if (c.free_bytes > b.free_bytes) {
+            best = i;
+        }
+    }
+    auto& st = _stats[best];
+    st.free_bytes -= std::min(st.free_bytes, estimated_size);
+    ++st.sstables_written;
+    st.bytes_written += estimated_size;
+    return permit(*this, best);
+}
+
+}
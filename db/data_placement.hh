@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <utility>
+#include <vector>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/scollectd.hh>
+
+namespace db {
+
+// Spreads the sstables written by a shard over the data file directories.
+//
+// A new sstable goes to the directory with the fewest sstable writes of the
+// shard in progress among those with room for it, ties going to the one with
+// the most free space. This keeps concurrent flushes and compactions on
+// different disks, and fills the disks evenly. Free space is refreshed from
+// the file system every refresh_interval, and is lowered by the estimated
+// size of every sstable written in between.
+class data_placement {
+public:
+    static constexpr std::chrono::seconds refresh_interval{10};
+
+    struct directory_stats {
+        uint64_t free_bytes = 0;
+        unsigned writes_in_progress = 0;
+        uint64_t sstables_written = 0;
+        // Sum of the estimated sizes of the sstables written.
+        uint64_t bytes_written = 0;
+    };
+
+    // Accounts an sstable write to a directory while it is held.
+    class permit {
+        data_placement* _placement = nullptr;
+        unsigned _directory = 0;
+    public:
+        permit() = default;
+        permit(data_placement& p, unsigned directory);
+        permit(permit&& o) noexcept
+            : _placement(std::exchange(o._placement, nullptr))
+            , _directory(o._directory)
+        { }
+        permit& operator=(permit&& o) noexcept {
+            if (this != &o) {
+                release();
+                _placement = std::exchange(o._placement, nullptr);
+                _directory = o._directory;
+            }
+            return *this;
+        }
+        ~permit() {
+            release();
+        }
+        void release();
+        unsigned directory() const {
+            return _directory;
+        }
+    };
+private:
+    std::vector<sstring> _directories;
+    std::vector<directory_stats> _stats;
+    timer<> _refresh_timer;
+    std::vector<scollectd::registration> _collectd_registrations;
+private:
+    void setup_collectd();
+public:
+    explicit data_placement(std::vector<sstring> directories);
+
+    // Picks the directory for a new sstable of about estimated_size bytes.
+    // There must be at least one directory.
+    permit pick(uint64_t estimated_size);
+
+    void refresh_free_space();
+
+    const std::vector<sstring>& directories() const {
+        return _directories;
+    }
+    const std::vector<directory_stats>& stats() const {
+        return _stats;
+    }
+};
+
+}
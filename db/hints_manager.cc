@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/hints_manager.hh"
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/util/log.hh>
+#include "database.hh"
+#include "db/config.hh"
+#include "db/commitlog/commitlog_entry.hh"
+#include "converting_mutation_partition_applier.hh"
+#include "checked-file-impl.hh"
+#include "disk-error-handler.hh"
+#include "gms/failure_detector.hh"
+#include "gms/gossiper.hh"
+#include "message/messaging_service.hh"
+#include "service/storage_service.hh"
+#include "utils/crc.hh"
+#include "utils/data_input.hh"
+#include "utils/data_output.hh"
+
+static seastar::logger logger("hints_manager");
+
+namespace db {
+
+distributed<hints_manager> _the_hints_manager;
+
+constexpr std::chrono::seconds hints_manager::flush_period;
+
+static const sstring segment_prefix = "HintsLog-";
+static const sstring segment_suffix = ".log";
+
+// A record is the size and crc32 of its payload followed by the payload:
+// the gc_clock time the hint was written at and a commitlog_entry with the
+// mutation and the column mapping of its schema.
+static constexpr size_t record_header_size = 2 * sizeof(uint32_t);
+
+static future<std::vector<sstring>> list_directory(sstring dir, directory_entry_type type) {
+    return open_checked_directory(general_disk_error, dir).then([dir, type] (file d) {
+        auto names = make_lw_shared<std::vector<sstring>>();
+        auto listing = make_lw_shared<subscription<directory_entry>>(d.list_directory([dir, type, names] (directory_entry de) {
+            auto f = de.type ? make_ready_future<std::experimental::optional<directory_entry_type>>(de.type) : engine().file_type(dir + "/" + de.name);
+            return f.then([type, names, name = de.name] (std::experimental::optional<directory_entry_type> t) {
+                if (t == type && name[0] != '.') {
+                    names->push_back(name);
+                }
+            });
+        }));
+        return listing->done().then([d, listing, names] {
+            return std::move(*names);
+        });
+    });
+}
+
+hints_manager::hints_manager(distributed<database>& db)
+    : _db(db)
+    , _directory(sprint("%s/%d", db.local().get_config().hints_directory(), engine().cpu_id()))
+    , _throttle_bytes_per_second(uint64_t(db.local().get_config().hinted_handoff_throttle_in_kb()) * 1024)
+    , _next_segment_id(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
+{
+    _timer.set_callback([this] { on_timer(); });
+}
+
+lw_shared_ptr<hints_manager::endpoint_hints> hints_manager::get_endpoint(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end()) {
+        auto eh = make_lw_shared<endpoint_hints>();
+        eh->ep = ep;
+        eh->dir = _directory + "/" + ep.to_sstring();
+        i = _endpoints.emplace(ep, std::move(eh)).first;
+    }
+    return i->second;
+}
+
+future<> hints_manager::start() {
+    return io_check(recursive_touch_directory, _directory).then([this] {
+        return list_directory(_directory, directory_entry_type::directory);
+    }).then([this] (std::vector<sstring> names) {
+        return do_with(std::move(names), [this] (std::vector<sstring>& names) {
+            return parallel_for_each(names, [this] (const sstring& name) {
+                try {
+                    return load_endpoint(gms::inet_address(name), _directory + "/" + name);
+                } catch (...) {
+                    logger.warn("Ignoring {}/{}: not an endpoint address", _directory, name);
+                    return make_ready_future<>();
+                }
+            });
+        });
+    }).then([this] {
+        _timer.arm_periodic(flush_period);
+    });
+}
+
+future<> hints_manager::load_endpoint(gms::inet_address ep, sstring dir) {
+    auto eh = get_endpoint(ep);
+    return list_directory(dir, directory_entry_type::regular).then([this, eh] (std::vector<sstring> names) {
+        std::vector<std::pair<uint64_t, sstring>> segments;
+        for (auto&& name : names) {
+            if (name.size() <= segment_prefix.size() + segment_suffix.size()
+                    || name.compare(0, segment_prefix.size(), segment_prefix) != 0
+                    || name.compare(name.size() - segment_suffix.size(), segment_suffix.size(), segment_suffix) != 0) {
+                continue;
+            }
+            try {
+                auto id = std::stoull(name.substr(segment_prefix.size(), name.size() - segment_prefix.size() - segment_suffix.size()));
+                segments.emplace_back(id, eh->dir + "/" + name);
+            } catch (std::logic_error&) {
+                logger.warn("Ignoring {}/{}: not a hints segment", eh->dir, name);
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+        for (auto&& s : segments) {
+            eh->segments.push_back(std::move(s.second));
+            _next_segment_id = std::max(_next_segment_id, s.first + 1);
+        }
+        eh->dir_created = true;
+        if (!eh->segments.empty()) {
+            logger.info("Found {} hint segments for {}", eh->segments.size(), eh->ep);
+        }
+    });
+}
+
+future<> hints_manager::open_segment(endpoint_hints& eh) {
+    auto f = eh.dir_created ? make_ready_future<>() : io_check(recursive_touch_directory, eh.dir).then([&eh] {
+        eh.dir_created = true;
+    });
+    auto name = sprint("%s/%s%d%s", eh.dir, segment_prefix, _next_segment_id++, segment_suffix);
+    return f.then([name] {
+        return open_checked_file_dma(general_disk_error, name, open_flags::wo | open_flags::create | open_flags::exclusive);
+    }).then([&eh, name] (file f) {
+        eh.out = make_file_output_stream(std::move(f));
+        eh.out_name = name;
+        eh.out_size = 0;
+    });
+}
+
+// Must be called with write_sem held.
+future<> hints_manager::close_segment(endpoint_hints& eh) {
+    if (!eh.out) {
+        return make_ready_future<>();
+    }
+    auto out = std::move(*eh.out);
+    eh.out = std::experimental::nullopt;
+    auto name = eh.out_name;
+    auto size = std::exchange(eh.out_size, 0);
+    return do_with(std::move(out), [] (output_stream<char>& out) {
+        return out.close();
+    }).then_wrapped([&eh, name, size] (future<> f) {
+        try {
+            f.get();
+        } catch (...) {
+            // Whatever made it to the file can still be replayed.
+            logger.warn("Failed to close hints segment {}: {}", name, std::current_exception());
+        }
+        if (!size) {
+            return io_check(remove_file, name);
+        }
+        eh.segments.push_back(name);
+        return make_ready_future<>();
+    });
+}
+
+future<> hints_manager::roll_segment(lw_shared_ptr<endpoint_hints> eh) {
+    return with_semaphore(eh->write_sem, 1, [this, eh] {
+        return close_segment(*eh);
+    });
+}
+
+future<> hints_manager::store_hint(gms::inet_address ep, schema_ptr s, lw_shared_ptr<const frozen_mutation> fm) {
+    if (_gate.is_closed()) {
+        return make_exception_future<>(gate_closed_exception());
+    }
+    return with_gate(_gate, [this, ep, s = std::move(s), fm = std::move(fm)] {
+        commitlog_entry_writer cew(s, *fm);
+        auto payload_size = sizeof(int64_t) + cew.size();
+        temporary_buffer<char> buf(record_header_size + payload_size);
+        data_output out(buf.get_write() + record_header_size, payload_size);
+        out.write(int64_t(gc_clock::now().time_since_epoch().count()));
+        cew.write(out);
+        crc32 crc;
+        crc.process(reinterpret_cast<const uint8_t*>(buf.get() + record_header_size), payload_size);
+        data_output header(buf.get_write(), record_header_size);
+        header.write(uint32_t(payload_size));
+        header.write(crc.get());
+
+        auto eh = get_endpoint(ep);
+        return with_semaphore(eh->write_sem, 1, [this, eh, buf = std::move(buf)] () mutable {
+            auto f = eh->out ? make_ready_future<>() : open_segment(*eh);
+            return f.then([eh, buf = std::move(buf)] () mutable {
+                eh->out_size += buf.size();
+                return eh->out->write(std::move(buf));
+            }).then([this, eh] {
+                return eh->out_size >= max_segment_size ? close_segment(*eh) : make_ready_future<>();
+            });
+        }).then([this, eh] {
+            ++eh->created;
+            ++_stats.written;
+        });
+    }).handle_exception([this] (std::exception_ptr ep) {
+        ++_stats.write_errors;
+        return make_exception_future<>(ep);
+    });
+}
+
+void hints_manager::note_not_stored(gms::inet_address ep) {
+    ++get_endpoint(ep)->not_stored;
+}
+
+bool hints_manager::can_replay(gms::inet_address ep) {
+    return !_paused && !_gate.is_closed()
+            && service::get_local_storage_service().cluster_supports_hinted_handoff()
+            && gms::get_local_failure_detector().is_alive(ep);
+}
+
+void hints_manager::on_timer() {
+    if (_gate.is_closed()) {
+        return;
+    }
+    for (auto&& e : _endpoints) {
+        auto eh = e.second;
+        with_gate(_gate, [this, eh] {
+            return roll_segment(eh).then([this, eh] {
+                return replay(eh);
+            });
+        }).handle_exception([eh] (std::exception_ptr ep) {
+            logger.warn("Failed to flush hints for {}: {}", eh->ep, ep);
+        });
+    }
+}
+
+future<> hints_manager::replay(lw_shared_ptr<endpoint_hints> eh) {
+    if (eh->replaying || eh->segments.empty() || !can_replay(eh->ep)) {
+        return make_ready_future<>();
+    }
+    eh->replaying = true;
+    logger.debug("Replaying {} hint segments to {}", eh->segments.size(), eh->ep);
+    return repeat([this, eh] {
+        if (eh->segments.empty() || !can_replay(eh->ep)) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto name = eh->segments.front();
+        return replay_segment(eh->ep, name).then([eh, name] {
+            // The hints may have been truncated meanwhile.
+            if (!eh->segments.empty() && eh->segments.front() == name) {
+                eh->segments.pop_front();
+                return io_check(remove_file, name);
+            }
+            return make_ready_future<>();
+        }).then([] {
+            return stop_iteration::no;
+        });
+    }).handle_exception([eh] (std::exception_ptr ep) {
+        logger.warn("Failed to replay hints to {}, will retry: {}", eh->ep, ep);
+    }).finally([eh] {
+        eh->replaying = false;
+    });
+}
+
+future<> hints_manager::replay_segment(gms::inet_address ep, sstring name) {
+    return open_checked_file_dma(general_disk_error, name, open_flags::ro).then([this, ep, name] (file f) {
+        return do_with(make_file_input_stream(std::move(f)), std::vector<temporary_buffer<char>>(), size_t(0),
+                [this, ep, name] (input_stream<char>& in, std::vector<temporary_buffer<char>>& batch, size_t& batch_bytes) {
+            return repeat([this, ep, name, &in, &batch, &batch_bytes] {
+                return in.read_exactly(record_header_size).then([this, ep, name, &in, &batch, &batch_bytes] (temporary_buffer<char> header) {
+                    if (header.size() < record_header_size) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    data_input hin(header);
+                    auto size = hin.read<uint32_t>();
+                    auto crc = hin.read<uint32_t>();
+                    if (!size) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return in.read_exactly(size).then([this, ep, name, size, crc, &batch, &batch_bytes] (temporary_buffer<char> payload) {
+                        crc32 c;
+                        c.process(reinterpret_cast<const uint8_t*>(payload.get()), payload.size());
+                        if (payload.size() != size || c.get() != crc) {
+                            logger.warn("Stopping replay of {} at a damaged record", name);
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        batch_bytes += size;
+                        batch.push_back(std::move(payload));
+                        if (batch.size() < max_replay_batch_size) {
+                            return make_ready_future<stop_iteration>(stop_iteration::no);
+                        }
+                        auto bytes = std::exchange(batch_bytes, 0);
+                        return send_batch(ep, std::exchange(batch, {}), bytes).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                });
+            }).then([this, ep, &batch, &batch_bytes] {
+                return send_batch(ep, std::move(batch), batch_bytes);
+            }).finally([&in] {
+                return in.close();
+            });
+        });
+    });
+}
+
+future<> hints_manager::send_batch(gms::inet_address ep, std::vector<temporary_buffer<char>> hints, size_t bytes) {
+    if (hints.empty()) {
+        return make_ready_future<>();
+    }
+    auto start = clock_type::now();
+    return do_with(std::move(hints), [this, ep] (std::vector<temporary_buffer<char>>& hints) {
+        return parallel_for_each(hints, [this, ep] (temporary_buffer<char>& hint) {
+            return send_hint(ep, hint.share());
+        });
+    }).then([this, start, bytes] {
+        if (!_throttle_bytes_per_second) {
+            return make_ready_future<>();
+        }
+        // The throttle is shared by all the nodes which may be replaying
+        // hints at the same time, and by all shards.
+        auto others = std::max<size_t>(gms::get_local_gossiper().get_endpoint_states().size(), 2) - 1;
+        auto rate = double(_throttle_bytes_per_second) / others / smp::count;
+        auto wanted = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(bytes / rate));
+        auto elapsed = clock_type::now() - start;
+        return elapsed < wanted ? sleep(wanted - elapsed) : make_ready_future<>();
+    });
+}
+
+future<> hints_manager::send_hint(gms::inet_address ep, temporary_buffer<char> hint) {
+    data_input in(hint);
+    auto written_at = gc_clock::time_point(gc_clock::duration(in.read<int64_t>()));
+    commitlog_entry_reader cer(hint.share(sizeof(int64_t), hint.size() - sizeof(int64_t)));
+    auto& fm = cer.mutation();
+    auto& db = _db.local();
+    if (!db.column_family_exists(fm.column_family_id())) {
+        ++_stats.dropped;
+        return make_ready_future<>();
+    }
+    auto s = db.find_column_family(fm.column_family_id()).schema();
+    if (written_at + s->gc_grace_seconds() < gc_clock::now()) {
+        // Tombstones of the write may have been purged elsewhere already.
+        ++_stats.dropped;
+        return make_ready_future<>();
+    }
+    auto f = make_ready_future<>();
+    auto& ms = net::get_local_messaging_service();
+    net::messaging_service::msg_addr addr{ep, 0};
+    if (s->version() == fm.schema_version()) {
+        f = ms.send_hint_mutation(addr, fm);
+    } else if (cer.get_column_mapping()) {
+        auto& cm = *cer.get_column_mapping();
+        mutation m(fm.decorated_key(*s), s);
+        converting_mutation_partition_applier v(cm, *s, m.partition());
+        fm.partition().accept(cm, v);
+        f = ms.send_hint_mutation(addr, freeze(m));
+    } else {
+        logger.warn("Dropping hint for {} of unknown schema version {}", ep, fm.schema_version());
+        ++_stats.dropped;
+        return make_ready_future<>();
+    }
+    return f.then([this] {
+        ++_stats.replayed;
+    });
+}
+
+future<> hints_manager::schedule_delivery(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end() || _gate.is_closed()) {
+        return make_ready_future<>();
+    }
+    auto eh = i->second;
+    return with_gate(_gate, [this, eh] {
+        return roll_segment(eh).then([this, eh] {
+            return replay(eh);
+        });
+    });
+}
+
+future<> hints_manager::truncate(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end()) {
+        return make_ready_future<>();
+    }
+    auto eh = i->second;
+    return with_semaphore(eh->write_sem, 1, [eh, this] {
+        return close_segment(*eh).then([eh] {
+            return do_with(std::exchange(eh->segments, {}), [eh] (std::deque<sstring>& segments) {
+                logger.info("Deleting {} hint segments of {}", segments.size(), eh->ep);
+                return parallel_for_each(segments, [] (const sstring& name) {
+                    return io_check(remove_file, name);
+                });
+            });
+        });
+    });
+}
+
+future<> hints_manager::truncate_all() {
+    return do_with(boost::copy_range<std::vector<gms::inet_address>>(_endpoints | boost::adaptors::map_keys), [this] (std::vector<gms::inet_address>& eps) {
+        return parallel_for_each(eps, [this] (gms::inet_address ep) {
+            return truncate(ep);
+        });
+    });
+}
+
+std::vector<gms::inet_address> hints_manager::endpoints_pending_hints() const {
+    std::vector<gms::inet_address> eps;
+    for (auto&& e : _endpoints) {
+        if (e.second->has_pending()) {
+            eps.push_back(e.first);
+        }
+    }
+    return eps;
+}
+
+uint64_t hints_manager::created_hints(gms::inet_address ep) const {
+    auto i = _endpoints.find(ep);
+    return i == _endpoints.end() ? 0 : i->second->created;
+}
+
+uint64_t hints_manager::not_stored_hints(gms::inet_address ep) const {
+    auto i = _endpoints.find(ep);
+    return i == _endpoints.end() ? 0 : i->second->not_stored;
+}
+
+future<> hints_manager::stop() {
+    _timer.cancel();
+    return _gate.close().then([this] {
+        return parallel_for_each(_endpoints, [this] (auto& e) {
+            return this->roll_segment(e.second);
+        });
+    });
+}
+
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <seastar/core/future.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/fstream.hh>
+#include "gms/inet_address.hh"
+#include "frozen_mutation.hh"
+#include "schema.hh"
+
+class database;
+
+namespace db {
+
+/**
+ * Keeps writes which could not be delivered to a replica ("hints") on disk
+ * and delivers them once the replica is back.
+ *
+ * Each shard keeps the hints of the writes it coordinated, in a directory of
+ * its own per destination endpoint under hints_directory/<shard>/. Hints are
+ * appended to a segment file, which is closed when it grows past
+ * max_segment_size or after flush_period, commitlog style; hints written
+ * in the last flush_period are lost if the node crashes. Every record is
+ * checksummed and a segment is read up to its first damaged record.
+ *
+ * Every flush_period, the closed segments of every endpoint the failure
+ * detector considers alive are replayed, oldest first, in batches throttled
+ * to hinted_handoff_throttle_in_kb, divided among the other nodes and the
+ * shards. A segment is deleted when all its hints have been delivered or
+ * dropped; hints older than the gc_grace_seconds of their table, and hints
+ * of dropped tables, are dropped. If a delivery fails, replay of that
+ * endpoint stops and is tried again in the next period.
+ */
+class hints_manager {
+public:
+    using clock_type = lowres_clock;
+
+    struct stats {
+        uint64_t written = 0;
+        uint64_t write_errors = 0;
+        uint64_t replayed = 0;
+        uint64_t dropped = 0;
+    };
+private:
+    static constexpr size_t max_segment_size = 4 * 1024 * 1024;
+    static constexpr size_t max_replay_batch_size = 128;
+    static constexpr std::chrono::seconds flush_period{10};
+
+    struct endpoint_hints {
+        gms::inet_address ep;
+        sstring dir;
+        bool dir_created = false;
+        // The segment being written.
+        std::experimental::optional<output_stream<char>> out;
+        sstring out_name;
+        size_t out_size = 0;
+        // Closed segments, oldest first.
+        std::deque<sstring> segments;
+        // Serializes writes and segment switches.
+        semaphore write_sem{1};
+        bool replaying = false;
+        // Hints written and not written because the endpoint was down for
+        // longer than max_hint_window_in_ms.
+        uint64_t created = 0;
+        uint64_t not_stored = 0;
+
+        bool has_pending() const {
+            return out_size || !segments.empty();
+        }
+    };
+
+    distributed<database>& _db;
+    sstring _directory;
+    uint64_t _throttle_bytes_per_second;
+    stats _stats;
+    std::unordered_map<gms::inet_address, lw_shared_ptr<endpoint_hints>> _endpoints;
+    uint64_t _next_segment_id;
+    bool _paused = false;
+    timer<clock_type> _timer;
+    seastar::gate _gate;
+private:
+    lw_shared_ptr<endpoint_hints> get_endpoint(gms::inet_address ep);
+    future<> load_endpoint(gms::inet_address ep, sstring dir);
+    future<> open_segment(endpoint_hints& eh);
+    future<> close_segment(endpoint_hints& eh);
+    future<> roll_segment(lw_shared_ptr<endpoint_hints> eh);
+    future<> replay(lw_shared_ptr<endpoint_hints> eh);
+    future<> replay_segment(gms::inet_address ep, sstring name);
+    future<> send_batch(gms::inet_address ep, std::vector<temporary_buffer<char>> hints, size_t bytes);
+    future<> send_hint(gms::inet_address ep, temporary_buffer<char> hint);
+    bool can_replay(gms::inet_address ep);
+    void on_timer();
+public:
+    hints_manager(distributed<database>& db);
+
+    // Loads the existing segments of this shard and arms the replay timer.
+    future<> start();
+    future<> stop();
+
+    // Writes a hint for ep. Fails if the hint could not be written.
+    future<> store_hint(gms::inet_address ep, schema_ptr s, lw_shared_ptr<const frozen_mutation> fm);
+    // Records a hint which was not written because ep has been down too long.
+    void note_not_stored(gms::inet_address ep);
+
+    // Replays the hints of ep now, if it is alive.
+    future<> schedule_delivery(gms::inet_address ep);
+    // Deletes all hints of ep.
+    future<> truncate(gms::inet_address ep);
+    // Deletes all hints.
+    future<> truncate_all();
+    void pause_delivery(bool pause) {
+        _paused = pause;
+    }
+
+    std::vector<gms::inet_address> endpoints_pending_hints() const;
+    uint64_t created_hints(gms::inet_address ep) const;
+    uint64_t not_stored_hints(gms::inet_address ep) const;
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
+
+extern distributed<hints_manager> _the_hints_manager;
+
+inline distributed<hints_manager>& get_hints_manager() {
+    return _the_hints_manager;
+}
+
+inline hints_manager& get_local_hints_manager() {
+    return _the_hints_manager.local();
+}
+
+}
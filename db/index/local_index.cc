@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/index/local_index.hh"
+#include "schema_builder.hh"
+#include "streamed_mutation.hh"
+#include "utils/UUID_gen.hh"
+#include "dht/i_partitioner.hh"
+
+namespace db {
+namespace index {
+
+schema_ptr index_table_schema(const schema& base, const column_definition& cdef) {
+    auto& name = *cdef.idx_info.index_name;
+    schema_builder builder(base.ks_name(), name, utils::UUID_gen::get_name_UUID(base.id().to_sstring() + "." + name));
+    builder.with_column(cdef.name(), cdef.type, column_kind::partition_key);
+    builder.with_column(to_bytes("partition_key"), bytes_type, column_kind::clustering_key);
+    builder.set_gc_grace_seconds(base.gc_grace_seconds().count());
+    builder.set_compaction_strategy(base.compaction_strategy());
+    builder.set_compaction_strategy_options(base.compaction_strategy_options());
+    builder.set_compressor_params(base.get_compressor_params());
+    builder.set_comment(sprint("Index %s of %s.%s", name, base.ks_name(), base.cf_name()));
+    return builder.build();
+}
+
+std::experimental::optional<mutation> make_index_entry(const schema_ptr& index_schema, const column_definition& cdef,
+        const partition_key& base_key, const row& cells) {
+    auto cell = cells.find_cell(cdef.id);
+    if (!cell) {
+        return { };
+    }
+    auto ac = cell->as_atomic_cell();
+    if (!ac.is_live() || ac.value().empty()) {
+        return { };
+    }
+    mutation m(partition_key::from_single_value(*index_schema, to_bytes(ac.value())), index_schema);
+    auto& r = m.partition().clustered_row(clustering_key::from_single_value(*index_schema, to_bytes(base_key.representation())));
+    if (ac.is_live_and_has_ttl()) {
+        r.apply(row_marker(ac.timestamp(), ac.ttl(), ac.expiry()));
+    } else {
+        r.apply(row_marker(ac.timestamp()));
+    }
+    return std::move(m);
+}
+
+void for_each_index_entry(const schema_ptr& index_schema, const column_definition& cdef, const mutation& m,
+        std::function<void (mutation)> func) {
+    for (const rows_entry& re : m.partition().clustered_rows()) {
+        auto entry = make_index_entry(index_schema, cdef, m.key(), re.row().cells());
+        if (entry) {
+            func(std::move(*entry));
+        }
+    }
+}
+
+// Reads the partitions of the base table which are candidates for having
+// rows with the indexed value, and drops the rows which don't have it.
+//
+// In the index lookup mode the candidates are the partitions pointed at by
+// the live entries of the index partition of the value, read one by one in
+// ring order. Otherwise, they are all partitions of the range.
+class index_reader final : public mutation_reader::impl {
+    struct entry {
+        dht::decorated_key key;
+        api::timestamp_type timestamp;
+    };
+
+    schema_ptr _schema;
+    const column_definition& _cdef;
+    bytes _value;
+    mutation_source _base_source;
+    const query::partition_range& _range;
+    query::clustering_key_filtering_context _ck_filtering;
+    const io_priority_class& _pc;
+    gc_clock::time_point _now = gc_clock::now();
+    mutation_reader _reader;
+
+    schema_ptr _index_schema;
+    std::experimental::optional<mutation_source> _index_source;
+    stale_entry_handler _on_stale;
+    std::experimental::optional<dht::decorated_key> _index_key;
+    std::vector<entry> _entries;
+    size_t _next_entry = 0;
+    query::partition_range _current_range = query::partition_range::make_open_ended_both_sides();
+private:
+    bool matches(const mutation_partition& p, const rows_entry& re) const {
+        auto cell = re.row().cells().find_cell(_cdef.id);
+        if (!cell) {
+            return false;
+        }
+        auto ac = cell->as_atomic_cell();
+        return ac.is_live(p.tombstone_for_row(*_schema, re), _now) && ac.value() == bytes_view(_value);
+    }
+
+    // Whether the rows of the partition were read regardless of the
+    // clustering restrictions of the query.
+    bool all_rows_read(const partition_key& key) const {
+        auto& ranges = _ck_filtering.get_ranges(key);
+        return ranges.size() == 1 && ranges.front().is_full();
+    }
+
+    mutation_opt filter(mutation_opt mo, const entry* e) {
+        if (mo) {
+            auto& p = mo->partition();
+            auto& rows = p.clustered_rows();
+            auto i = rows.begin();
+            while (i != rows.end()) {
+                if (matches(p, *i)) {
+                    ++i;
+                } else {
+                    i = rows.erase_and_dispose(i, current_deleter<rows_entry>());
+                }
+            }
+            if (!rows.empty()) {
+                return mo;
+            }
+        }
+        if (e && all_rows_read(e->key.key())) {
+            mutation m(*_index_key, _index_schema);
+            m.partition().apply_delete(*_index_schema,
+                clustering_key::from_single_value(*_index_schema, to_bytes(e->key.key().representation())),
+                tombstone(e->timestamp, _now));
+            _on_stale(std::move(m));
+        }
+        return { };
+    }
+
+    future<> read_entries() {
+        _index_key = dht::global_partitioner().decorate_key(*_index_schema,
+            partition_key::from_single_value(*_index_schema, _value));
+        _current_range = query::partition_range::make_singular(*_index_key);
+        _reader = (*_index_source)(_index_schema, _current_range, query::no_clustering_key_filtering, _pc);
+        return _reader().then([] (streamed_mutation_opt smo) {
+            return mutation_from_streamed_mutation(std::move(smo));
+        }).then([this] (mutation_opt mo) {
+            if (mo) {
+                auto& p = mo->partition();
+                dht::ring_position_comparator cmp(*_schema);
+                for (const rows_entry& re : p.clustered_rows()) {
+                    auto& marker = re.row().marker();
+                    if (!marker.is_live(p.tombstone_for_row(*_index_schema, re), _now)) {
+                        continue;
+                    }
+                    auto key = partition_key::from_bytes(re.key().explode(*_index_schema).front());
+                    auto dk = dht::global_partitioner().decorate_key(*_schema, std::move(key));
+                    if (_range.contains(dht::ring_position(dk), cmp)) {
+                        _entries.push_back(entry{std::move(dk), marker.timestamp()});
+                    }
+                }
+            }
+            dht::decorated_key::less_comparator less(_schema);
+            std::sort(_entries.begin(), _entries.end(), [&less] (const entry& e1, const entry& e2) {
+                return less(e1.key, e2.key);
+            });
+        });
+    }
+
+    // Returns a disengaged optional at the end of the stream, and a
+    // disengaged mutation_opt for a candidate without matching rows.
+    future<std::experimental::optional<mutation_opt>> next_candidate() {
+        using result_type = std::experimental::optional<mutation_opt>;
+        if (!_index_source) {
+            return _reader().then([this] (streamed_mutation_opt smo) {
+                if (!smo) {
+                    return make_ready_future<result_type>();
+                }
+                return mutation_from_streamed_mutation(std::move(smo)).then([this] (mutation_opt mo) {
+                    return result_type(filter(std::move(mo), nullptr));
+                });
+            });
+        }
+        if (_next_entry == _entries.size()) {
+            return make_ready_future<result_type>();
+        }
+        auto& e = _entries[_next_entry++];
+        _current_range = query::partition_range::make_singular(e.key);
+        _reader = _base_source(_schema, _current_range, _ck_filtering, _pc);
+        return _reader().then([] (streamed_mutation_opt smo) {
+            return mutation_from_streamed_mutation(std::move(smo));
+        }).then([this, &e] (mutation_opt mo) {
+            return result_type(filter(std::move(mo), &e));
+        });
+    }
+
+    future<streamed_mutation_opt> next() {
+        return repeat_until_value([this] {
+            return next_candidate().then([] (std::experimental::optional<mutation_opt> c) {
+                using result_type = std::experimental::optional<streamed_mutation_opt>;
+                if (!c) {
+                    return result_type(streamed_mutation_opt());
+                }
+                if (!*c) {
+                    return result_type();
+                }
+                return result_type(streamed_mutation_from_mutation(std::move(**c)));
+            });
+        });
+    }
+public:
+    index_reader(schema_ptr s, const column_definition& cdef, bytes value, mutation_source base_source,
+            const query::partition_range& range, query::clustering_key_filtering_context ck_filtering,
+            const io_priority_class& pc)
+        : _schema(std::move(s))
+        , _cdef(cdef)
+        , _value(std::move(value))
+        , _base_source(std::move(base_source))
+        , _range(range)
+        , _ck_filtering(std::move(ck_filtering))
+        , _pc(pc)
+    { }
+
+    index_reader(schema_ptr s, const column_definition& cdef, bytes value, mutation_source base_source,
+            schema_ptr index_schema, mutation_source index_source, const query::partition_range& range,
+            query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc,
+            stale_entry_handler on_stale)
+        : index_reader(std::move(s), cdef, std::move(value), std::move(base_source), range, std::move(ck_filtering), pc)
+    {
+        _index_schema = std::move(index_schema);
+        _index_source = std::move(index_source);
+        _on_stale = std::move(on_stale);
+    }
+
+    void start_scan() {
+        _reader = _base_source(_schema, _range, _ck_filtering, _pc);
+    }
+
+    virtual future<streamed_mutation_opt> operator()() override {
+        if (_index_source && !_index_key) {
+            return read_entries().then([this] {
+                return next();
+            });
+        }
+        return next();
+    }
+};
+
+mutation_reader make_index_reader(schema_ptr s, const column_definition& cdef, bytes value,
+        mutation_source base_source, schema_ptr index_schema, mutation_source index_source,
+        const query::partition_range& range, query::clustering_key_filtering_context ck_filtering,
+        const io_priority_class& pc, stale_entry_handler on_stale) {
+    return make_mutation_reader<index_reader>(std::move(s), cdef, std::move(value), std::move(base_source),
+        std::move(index_schema), std::move(index_source), range, std::move(ck_filtering), pc, std::move(on_stale));
+}
+
+mutation_reader make_index_scan_reader(schema_ptr s, const column_definition& cdef, bytes value,
+        mutation_source base_source, const query::partition_range& range,
+        query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc) {
+    auto rd = std::make_unique<index_reader>(std::move(s), cdef, std::move(value), std::move(base_source), range,
+        std::move(ck_filtering), pc);
+    rd->start_scan();
+    return mutation_reader(std::move(rd));
+}
+
+}
+}
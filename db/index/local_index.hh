@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include "schema.hh"
+#include "mutation.hh"
+#include "mutation_reader.hh"
+#include "query-request.hh"
+
+namespace db {
+namespace index {
+
+// Local secondary indexes.
+//
+// Every shard keeps, for each indexed regular column of a table, a hidden
+// index table holding an entry for each partition of the base table owned by
+// the shard in which some row has a live value in the column. The index table
+// is partitioned by the indexed value and clustered by the base partition key,
+// so all entries for a value live in a single partition of the index. The
+// index tables are purely shard local: their partitions are not distributed
+// by token, since the index of a shard only describes partitions of that
+// shard.
+//
+// Entries are written together with the base table write. They are never
+// deleted on update of the base table, as that would need a read before
+// the write; instead, index reads check every entry against the base table
+// and delete the ones found to be stale.
+
+// Schema of the index table for the given indexed column of base.
+schema_ptr index_table_schema(const schema& base, const column_definition& cdef);
+
+// Returns the index entry for the given base row, if the row has a live
+// non-empty value in the indexed column.
+std::experimental::optional<mutation> make_index_entry(const schema_ptr& index_schema, const column_definition& cdef,
+        const partition_key& base_key, const row& cells);
+
+// Calls func with the index entries of all rows of the given mutation of the
+// base table.
+void for_each_index_entry(const schema_ptr& index_schema, const column_definition& cdef, const mutation& m,
+        std::function<void (mutation)> func);
+
+using stale_entry_handler = std::function<void (mutation)>;
+
+// Returns a reader of the partitions of base in range which have rows where
+// the indexed column has the given value, with only those rows.
+//
+// The partitions are looked up in the index through index_source. A mutation
+// deleting every index entry found to be stale is passed to on_stale.
+mutation_reader make_index_reader(schema_ptr s, const column_definition& cdef, bytes value,
+        mutation_source base_source, schema_ptr index_schema, mutation_source index_source,
+        const query::partition_range& range, query::clustering_key_filtering_context ck_filtering,
+        const io_priority_class& pc, stale_entry_handler on_stale);
+
+// Like make_index_reader(), but for when the index can't be used yet: finds
+// the partitions by filtering a scan of the range of base.
+mutation_reader make_index_scan_reader(schema_ptr s, const column_definition& cdef, bytes value,
+        mutation_source base_source, const query::partition_range& range,
+        query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc);
+
+}
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/query_result_cache.hh"
+
+#include "idl/uuid.dist.hh"
+#include "idl/keys.dist.hh"
+#include "idl/range.dist.hh"
+#include "idl/tracing.dist.hh"
+#include "idl/read_command.dist.hh"
+#include "serializer_impl.hh"
+#include "serialization_visitors.hh"
+#include "idl/uuid.dist.impl.hh"
+#include "idl/keys.dist.impl.hh"
+#include "idl/range.dist.impl.hh"
+#include "idl/tracing.dist.impl.hh"
+#include "idl/read_command.dist.impl.hh"
+
+namespace db {
+
+query_result_cache& global_query_result_cache() {
+    static thread_local query_result_cache instance;
+    return instance;
+}
+
+//   <key> := <partition prefix><uint64_t:schema version msb><uint64_t:schema version lsb>
+//            <uint32_t:row limit><uint32_t:partition limit><uint64_t:max result size>
+//            <uint8_t:result request><uint8_t:digest algorithm><serialized slice>
+query_result_cache_key::query_result_cache_key(const schema& s, const partition_key& pk, const query::read_command& cmd, query::result_options opts) {
+    auto slice = ser::serialize_to_buffer<bytes>(cmd.slice);
+    cf_cache_key_builder b(pk.view(), 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(uint8_t) + slice.size());
+    b.write(uint64_t(s.version().get_most_significant_bits()));
+    b.write(uint64_t(s.version().get_least_significant_bits()));
+    b.write(uint32_t(cmd.row_limit));
+    b.write(uint32_t(cmd.partition_limit));
+    b.write(uint64_t(cmd.max_result_size));
+    b.write(uint8_t(opts.request));
+    b.write(uint8_t(opts.digest_algo));
+    b.write(bytes_view(slice));
+    _key = std::move(b).build();
+}
+
+static bytes linearized(const bytes_ostream& buf) {
+    bytes b(bytes::initialized_later(), buf.size());
+    auto out = b.begin();
+    for (bytes_view f : buf.fragments()) {
+        out = std::copy(f.begin(), f.end(), out);
+    }
+    return b;
+}
+
+query_result_cache_entry::query_result_cache_entry(const utils::UUID& cf_id, bytes_view key, const query::result& r, gc_clock::time_point valid_until)
+    : cf_cache_entry(cf_id, key)
+    , _result(linearized(r.buf()))
+    , _digest(r.digest())
+    , _last_modified(r.last_modified())
+    , _row_count(r.row_count())
+    , _valid_until(valid_until)
+{ }
+
+void query_result_cache_entry::set_result(const query::result& r, gc_clock::time_point valid_until) {
+    _result = managed_bytes(linearized(r.buf()));
+    _digest = r.digest();
+    _last_modified = r.last_modified();
+    _row_count = r.row_count();
+    _valid_until = valid_until;
+}
+
+query::result query_result_cache_entry::result() const {
+    bytes_ostream buf;
+    buf.write(bytes_view(_result));
+    return query::result(std::move(buf), _digest, _last_modified, _row_count);
+}
+
+lw_shared_ptr<query::result> query_result_cache::lookup(const utils::UUID& cf_id, const query_result_cache_key& key, gc_clock::time_point now) {
+    auto r = _cache.lookup(std::make_pair(cf_id, key.representation()), [] (const query_result_cache_entry& e) {
+        return make_lw_shared<query::result>(e.result());
+    }, [now] (const query_result_cache_entry& e) {
+        return now < e.valid_until();
+    });
+    return r ? std::move(*r) : lw_shared_ptr<query::result>();
+}
+
+void query_result_cache::insert(const utils::UUID& cf_id, const query_result_cache_key& key, const query::result& r, gc_clock::time_point valid_until) {
+    if (r.buf().size() > max_result_size) {
+        return;
+    }
+    // A result of the same query which is there already can only be older.
+    _cache.insert(std::make_pair(cf_id, key.representation()), [&r, valid_until] (query_result_cache_entry& e) {
+        e.set_result(r, valid_until);
+    }, cf_id, key.representation(), r, valid_until);
+}
+
+void query_result_cache::invalidate(const utils::UUID& cf_id, partition_key_view pk) {
+    auto prefix = cf_cache_partition_prefix(pk);
+    _cache.invalidate(cf_cache_partition{cf_id, bytes_view(prefix)});
+}
+
+}
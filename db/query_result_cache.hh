@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "db/cf_cache_entry.hh"
+#include "query-request.hh"
+#include "query-result.hh"
+#include "schema.hh"
+#include "gc_clock.hh"
+
+namespace db {
+
+// Identifies the result of a single-partition query within a column family.
+class query_result_cache_key {
+    bytes _key;
+public:
+    query_result_cache_key(const schema& s, const partition_key& pk, const query::read_command& cmd, query::result_options opts);
+    bytes_view representation() const { return _key; }
+};
+
+class query_result_cache_entry : public cf_cache_entry {
+    managed_bytes _result;
+    stdx::optional<query::result_digest> _digest;
+    api::timestamp_type _last_modified;
+    stdx::optional<uint32_t> _row_count;
+    gc_clock::time_point _valid_until;
+public:
+    // Requires linearized managed_bytes.
+    query_result_cache_entry(const utils::UUID& cf_id, bytes_view key, const query::result& r, gc_clock::time_point valid_until);
+
+    query_result_cache_entry(query_result_cache_entry&&) noexcept = default;
+
+    gc_clock::time_point valid_until() const { return _valid_until; }
+    // Requires linearized managed_bytes.
+    query::result result() const;
+    // Must be called with the cache's allocator.
+    void set_result(const query::result& r, gc_clock::time_point valid_until);
+};
+
+// Shard-wide cache of the results of single-partition queries.
+//
+// Some partitions are read over and over with the same slice, while they are
+// seldom written to. Even when they are in row_cache, each such read has to
+// walk the partition and write the result again. Caching the result makes
+// repeating such a read cost a lookup and a copy.
+//
+// A result stays valid until the partition is written to, which has to
+// invalidate its entries, or until some of its data expires. Whatever makes
+// other data of a column family visible, like streaming or truncation, has
+// to invalidate all its entries.
+class query_result_cache final {
+    using cache_type = utils::lsa_lru_cache<query_result_cache_entry, cf_cache_compare>;
+public:
+    using stats = cache_type::stats;
+private:
+    // Results larger than this are not cached, they are not what the cache
+    // is for and would push out many small ones.
+    static constexpr size_t max_result_size = 64 * 1024;
+private:
+    cache_type _cache{"query_result_cache"};
+public:
+    // Returns the cached result of the query of given key at time now, or
+    // a disengaged pointer if there is none.
+    lw_shared_ptr<query::result> lookup(const utils::UUID& cf_id, const query_result_cache_key& key, gc_clock::time_point now);
+    // Caches the result of the query of given key, which stays the same
+    // for queries until valid_until.
+    void insert(const utils::UUID& cf_id, const query_result_cache_key& key, const query::result& r, gc_clock::time_point valid_until);
+    // Removes the entries of all results of given partition.
+    void invalidate(const utils::UUID& cf_id, partition_key_view pk);
+    // Removes all entries of given column family.
+    void invalidate(const utils::UUID& cf_id) { _cache.invalidate(cf_id); }
+    void clear() { _cache.clear(); }
+
+    void set_capacity(size_t bytes) { _cache.set_capacity(bytes); }
+    size_t capacity() const { return _cache.capacity(); }
+    bool enabled() const { return _cache.enabled(); }
+
+    const stats& get_stats() const { return _cache.get_stats(); }
+    const logalloc::region& region() const { return _cache.region(); }
+};
+
+// Returns a reference to shard-wide query_result_cache.
+query_result_cache& global_query_result_cache();
+
+}
@@ -60,12 +60,14 @@
 #include "db/marshal/type_parser.hh"
 #include "db/config.hh"
 #include "md5_hasher.hh"
+#include "bytes_ostream.hh"
 
 #include <boost/range/algorithm/copy.hpp>
 #include <boost/range/adaptor/map.hpp>
 
 #include "compaction_strategy.hh"
 #include "utils/joinpoint.hh"
+#include "utils/stall_detector.hh"
 
 using namespace db::system_keyspace;
 using namespace std::chrono_literals;
@@ -180,6 +182,10 @@ using days = std::chrono::duration<int, std::ratio<24 * 3600>>;
             {"value_alias", utf8_type},
             {"column_aliases", utf8_type},
             {"index_interval", int32_type},
+            // Only present in definitions of materialized views
+            {"view_base_id", uuid_type},
+            {"view_base_table", utf8_type},
+            {"view_include_all_columns", boolean_type},
         },
         // static columns
         {},
@@ -372,40 +378,166 @@ future<> save_system_keyspace_schema() {
     }
 #endif
 
-/**
- * Read schema from system keyspace and calculate MD5 digest of every row, resulting digest
- * will be converted into UUID which would act as content-based version of the schema.
- */
-future<utils::UUID> calculate_schema_digest(distributed<service::storage_proxy>& proxy)
-{
-    auto map = [&proxy] (sstring table) {
-        return db::system_keyspace::query_mutations(proxy, table).then([&proxy, table] (auto rs) {
+// Hasher which keeps what is fed to it, so that it can be fed to the real
+// hasher again later.
+struct digest_input_recorder {
+    bytes_ostream out;
+
+    void update(const char* ptr, size_t length) {
+        out.write(ptr, length);
+    }
+};
+
+static bool is_system_keyspace_partition(const schema& s, const partition_key& key) {
+    return value_cast<sstring>(utf8_type->deserialize(key.get_component(s, 0))) == system_keyspace::NAME;
+}
+
+// Keeps the digest input of every partition of every schema table, so that
+// the schema digest can be recalculated after a merge by re-reading only the
+// partitions of the keyspaces the merge touched, rather than all schema tables.
+//
+// The cache lives on shard 0. Merges invalidate the keyspaces they wrote to
+// once the mutations have been applied; a keyspace invalidated while the
+// digest is being calculated stays dirty, so the next calculation re-reads it.
+class schema_digest_cache {
+    using partitions_type = std::map<dht::decorated_key, bytes_ostream, dht::decorated_key::less_comparator>;
+
+    // Indexed like ALL.
+    std::vector<partitions_type> _tables;
+    std::set<sstring> _dirty_keyspaces;
+    // Serializes calculations, which update _tables.
+    semaphore _lock{1};
+private:
+    static bytes_ostream digest_input(const mutation& m) {
+        digest_input_recorder r;
+        feed_hash_for_schema_digest(r, m);
+        return std::move(r.out);
+    }
+
+    // Call inside a seastar thread
+    void load(distributed<service::storage_proxy>& proxy) {
+        _dirty_keyspaces.clear();
+        std::vector<partitions_type> tables;
+        for (auto&& table : ALL) {
             auto s = proxy.local().get_db().local().find_schema(system_keyspace::NAME, table);
-            std::vector<mutation> mutations;
+            auto rs = db::system_keyspace::query_mutations(proxy, table).get0();
+            partitions_type partitions{dht::decorated_key::less_comparator(s)};
             for (auto&& p : rs->partitions()) {
                 auto mut = p.mut().unfreeze(s);
-                auto partition_key = value_cast<sstring>(utf8_type->deserialize(mut.key().get_component(*s, 0)));
-                if (partition_key == system_keyspace::NAME) {
+                if (is_system_keyspace_partition(*s, mut.key())) {
                     continue;
                 }
-                mutations.emplace_back(std::move(mut));
+                partitions.emplace(mut.decorated_key(), digest_input(mut));
+                if (seastar::thread::should_yield()) {
+                    seastar::thread::yield();
+                }
             }
-            return mutations;
-        });
-    };
-    auto reduce = [] (auto& hash, auto&& mutations) {
-        for (const mutation& m : mutations) {
-            feed_hash_for_schema_digest(hash, m);
+            tables.emplace_back(std::move(partitions));
         }
-    };
-    return do_with(md5_hasher(), [map, reduce] (auto& hash) {
-        return do_for_each(ALL.begin(), ALL.end(), [&hash, map, reduce] (auto& table) {
-            return map(table).then([&hash, reduce] (auto&& mutations) {
-                reduce(hash, mutations);
+        _tables = std::move(tables);
+    }
+
+    // Call inside a seastar thread
+    void refresh(distributed<service::storage_proxy>& proxy, const sstring& keyspace_name) {
+        for (size_t i = 0; i < ALL.size(); ++i) {
+            auto s = proxy.local().get_db().local().find_schema(system_keyspace::NAME, ALL[i]);
+            auto dk = dht::global_partitioner().decorate_key(*s, partition_key::from_singular(*s, keyspace_name));
+            auto slice = partition_slice_builder(*s).build();
+            auto cmd = make_lw_shared<query::read_command>(s->id(), s->version(),
+                std::move(slice), std::numeric_limits<uint32_t>::max());
+            auto range = query::partition_range::make_singular(dk);
+            auto rs = proxy.local().query_mutations_locally(s, std::move(cmd), range).get0();
+            // Like the full scan in load(), only partitions which are
+            // present in the result contribute to the digest.
+            auto&& partitions = rs->partitions();
+            assert(partitions.size() <= 1 && "Results must have at most one partition");
+            _tables[i].erase(dk);
+            if (!partitions.empty()) {
+                _tables[i].emplace(std::move(dk), digest_input(partitions[0].mut().unfreeze(s)));
+            }
+        }
+    }
+
+    // Call inside a seastar thread
+    utils::UUID do_calculate(distributed<service::storage_proxy>& proxy) {
+        if (_tables.empty()) {
+            load(proxy);
+        } else {
+            auto dirty = std::exchange(_dirty_keyspaces, {});
+            try {
+                for (auto&& keyspace_name : dirty) {
+                    if (keyspace_name != system_keyspace::NAME) {
+                        refresh(proxy, keyspace_name);
+                    }
+                }
+            } catch (...) {
+                _tables.clear();
+                throw;
+            }
+        }
+        md5_hasher hash;
+        for (auto&& partitions : _tables) {
+            for (auto&& e : partitions) {
+                for (bytes_view fragment : e.second) {
+                    hash.update(reinterpret_cast<const char*>(fragment.begin()), fragment.size());
+                }
+                if (seastar::thread::should_yield()) {
+                    seastar::thread::yield();
+                }
+            }
+        }
+        return utils::UUID_gen::get_name_UUID(hash.finalize());
+    }
+public:
+    future<utils::UUID> calculate(distributed<service::storage_proxy>& proxy) {
+        return with_semaphore(_lock, 1, [this, &proxy] {
+            return seastar::async([this, &proxy] {
+                return do_calculate(proxy);
             });
-        }).then([&hash] {
-            return make_ready_future<utils::UUID>(utils::UUID_gen::get_name_UUID(hash.finalize()));
         });
+    }
+
+    void invalidate(const std::set<sstring>& keyspace_names) {
+        _dirty_keyspaces.insert(keyspace_names.begin(), keyspace_names.end());
+    }
+
+    future<> clear() {
+        return with_semaphore(_lock, 1, [this] {
+            _tables.clear();
+            _dirty_keyspaces.clear();
+        });
+    }
+};
+
+static schema_digest_cache& local_schema_digest_cache() {
+    static thread_local schema_digest_cache cache;
+    return cache;
+}
+
+static future<> invalidate_schema_digest(std::set<sstring> keyspace_names) {
+    return smp::submit_to(0, [keyspace_names = std::move(keyspace_names)] {
+        local_schema_digest_cache().invalidate(keyspace_names);
+    });
+}
+
+/**
+ * Read schema from system keyspace and calculate MD5 digest of every row, resulting digest
+ * will be converted into UUID which would act as content-based version of the schema.
+ *
+ * Only keyspaces changed by merges since the last calculation are read again,
+ * see schema_digest_cache.
+ */
+future<utils::UUID> calculate_schema_digest(distributed<service::storage_proxy>& proxy)
+{
+    return smp::submit_to(0, [&proxy] {
+        return local_schema_digest_cache().calculate(proxy);
+    });
+}
+
+future<> clear_schema_digest_cache()
+{
+    return smp::submit_to(0, [] {
+        return local_schema_digest_cache().clear();
     });
 }
 
@@ -573,16 +705,73 @@ static read_table_names_of_keyspace(distributed<service::storage_proxy>& proxy,
     });
 }
 
+// Tables whose definitions may be changed by a set of schema mutations
+struct affected_tables {
+    std::map<sstring, std::set<sstring>> tables;
+    // Keyspaces in which any table may be affected
+    std::set<sstring> keyspaces;
+
+    void add(const mutation& m) {
+        auto&& s = *m.schema();
+        if (s.cf_name() != COLUMNFAMILIES && s.cf_name() != COLUMNS) {
+            return;
+        }
+        auto keyspace_name = value_cast<sstring>(utf8_type->deserialize(m.key().get_component(s, 0)));
+        auto&& p = m.partition();
+        if (p.partition_tombstone() || !p.static_row().empty()) {
+            keyspaces.emplace(std::move(keyspace_name));
+            return;
+        }
+        auto table_name = [&s] (const clustering_key_prefix& ckp) {
+            return ckp.size(s) ? value_cast<sstring>(utf8_type->deserialize(ckp.get_component(s, 0))) : sstring();
+        };
+        auto& names = tables[keyspace_name];
+        for (auto&& rt : p.row_tombstones()) {
+            // Dropping a table deletes all of its columns with a single range
+            // tombstone, which is limited to that table.
+            auto start = table_name(rt.start);
+            if (start.empty() || start != table_name(rt.end)) {
+                keyspaces.emplace(std::move(keyspace_name));
+                return;
+            }
+            names.emplace(std::move(start));
+        }
+        for (auto&& row : p.clustered_rows()) {
+            names.emplace(table_name(row.key()));
+        }
+    }
+};
+
 // Call inside a seastar thread
 static
 std::map<qualified_name, schema_mutations>
-read_tables_for_keyspaces(distributed<service::storage_proxy>& proxy, const std::set<sstring>& keyspace_names)
+read_tables(distributed<service::storage_proxy>& proxy, const affected_tables& affected)
 {
     std::map<qualified_name, schema_mutations> result;
-    for (auto&& keyspace_name : keyspace_names) {
-        for (auto&& table_name : read_table_names_of_keyspace(proxy, keyspace_name).get0()) {
-            auto qn = qualified_name(keyspace_name, table_name);
-            result.emplace(qn, read_table_mutations(proxy, qn).get0());
+    auto read = [&] (const sstring& keyspace_name, const sstring& table_name) {
+        auto qn = qualified_name(keyspace_name, table_name);
+        auto sm = read_table_mutations(proxy, qn).get0();
+        // Only live table definitions, like read_table_names_of_keyspace()
+        if (sm.columnfamilies_mutation().live_row_count() > 0) {
+            result.emplace(std::move(qn), std::move(sm));
+        }
+    };
+    for (auto&& e : affected.tables) {
+        if (!affected.keyspaces.count(e.first)) {
+            for (auto&& table_name : e.second) {
+                read(e.first, table_name);
+            }
+        }
+    }
+    for (auto&& keyspace_name : affected.keyspaces) {
+        auto names = read_table_names_of_keyspace(proxy, keyspace_name).get0();
+        std::set<sstring> table_names(names.begin(), names.end());
+        auto i = affected.tables.find(keyspace_name);
+        if (i != affected.tables.end()) {
+            table_names.insert(i->second.begin(), i->second.end());
+        }
+        for (auto&& table_name : table_names) {
+            read(keyspace_name, table_name);
         }
     }
     return result;
@@ -595,21 +784,27 @@ future<> do_merge_schema(distributed<service::storage_proxy>& proxy, std::vector
        // compare before/after schemas of the affected keyspaces only
        std::set<sstring> keyspaces;
        std::set<utils::UUID> column_families;
+       // and of the tables named by the mutations only, unless they
+       // delete more than single table definitions
+       affected_tables tables;
        for (auto&& mutation : mutations) {
            keyspaces.emplace(value_cast<sstring>(utf8_type->deserialize(mutation.key().get_component(*s, 0))));
            column_families.emplace(mutation.column_family_id());
+           tables.add(mutation);
        }
 
        // current state of the schema
        auto&& old_keyspaces = read_schema_for_keyspaces(proxy, KEYSPACES, keyspaces).get0();
-       auto&& old_column_families = read_tables_for_keyspaces(proxy, keyspaces);
+       auto&& old_column_families = read_tables(proxy, tables);
        auto&& old_types = read_schema_for_keyspaces(proxy, USERTYPES, keyspaces).get0();
 #if 0 // not in 2.1.8
        /*auto& old_functions = */read_schema_for_keyspaces(proxy, FUNCTIONS, keyspaces).get0();
        /*auto& old_aggregates = */read_schema_for_keyspaces(proxy, AGGREGATES, keyspaces).get0();
 #endif
 
-       proxy.local().mutate_locally(std::move(mutations)).get0();
+       proxy.local().mutate_locally(std::move(mutations)).finally([keyspaces] {
+           return invalidate_schema_digest(keyspaces);
+       }).get0();
 
        if (do_flush) {
            proxy.local().get_db().invoke_on_all([s, cfs = std::move(column_families)] (database& db) {
@@ -622,7 +817,7 @@ future<> do_merge_schema(distributed<service::storage_proxy>& proxy, std::vector
 
        // with new data applied
        auto&& new_keyspaces = read_schema_for_keyspaces(proxy, KEYSPACES, keyspaces).get0();
-       auto&& new_column_families = read_tables_for_keyspaces(proxy, keyspaces);
+       auto&& new_column_families = read_tables(proxy, tables);
        auto&& new_types = read_schema_for_keyspaces(proxy, USERTYPES, keyspaces).get0();
 #if 0 // not in 2.1.8
        /*auto& new_functions = */read_schema_for_keyspaces(proxy, FUNCTIONS, keyspaces).get0();
@@ -707,6 +902,9 @@ static future<> update_column_family(database& db, schema_ptr new_schema) {
     s->registry_entry()->mark_synced();
     cfm.set_schema(std::move(s));
     ks.metadata()->add_or_update_column_family(new_schema);
+    if (new_schema->is_view() && db.column_family_exists(new_schema->view_info().base_id)) {
+        db.find_column_family(new_schema->view_info().base_id).add_or_update_view(cfm.schema());
+    }
 
     return service::get_local_migration_manager().notify_update_column_family(cfm.schema(), columns_changed);
 }
@@ -726,6 +924,7 @@ static void merge_tables(distributed<service::storage_proxy>& proxy,
     std::vector<global_schema_ptr> altered;
     std::vector<dropped_table> dropped;
 
+    utils::stall_scope stall(utils::stall_subsystem::schema_merge);
     auto diff = difference(before, after);
     for (auto&& key : diff.entries_only_on_left) {
         auto&& s = proxy.local().get_db().local().find_schema(key.keyspace_name, key.table_name);
@@ -742,6 +941,7 @@ static void merge_tables(distributed<service::storage_proxy>& proxy,
         logger.info("Altering {}.{} id={} version={}", s->ks_name(), s->cf_name(), s->id(), s->version());
         altered.emplace_back(s);
     }
+    stall.pause();
 
     proxy.local().get_db().invoke_on_all([&created, &dropped, &altered] (database& db) {
             return seastar::async([&] {
@@ -761,6 +961,11 @@ static void merge_tables(distributed<service::storage_proxy>& proxy,
                 parallel_for_each(dropped.begin(), dropped.end(), [&db](dropped_table& dt) {
                     schema_ptr s = dt.schema.get();
                     return db.drop_column_family(s->ks_name(), s->cf_name(), [&dt] { return dt.jp.value(); }).then([s] {
+                        if (s->is_view()) {
+                            return db::system_keyspace::set_view_removed(s->ks_name(), s->cf_name());
+                        }
+                        return make_ready_future<>();
+                    }).then([s] {
                         return service::get_local_migration_manager().notify_drop_column_family(s);
                     });
                 }).get();
@@ -1230,6 +1435,13 @@ schema_mutations make_table_mutations(schema_ptr table, api::timestamp_type time
 
     m.set_clustered_cell(ckey, "is_dense", table->is_dense(), timestamp);
 
+    if (table->is_view()) {
+        auto& vi = table->view_info();
+        m.set_clustered_cell(ckey, "view_base_id", vi.base_id, timestamp);
+        m.set_clustered_cell(ckey, "view_base_table", vi.base_name, timestamp);
+        m.set_clustered_cell(ckey, "view_include_all_columns", vi.include_all_columns, timestamp);
+    }
+
     mutation columns_mutation(pkey, columns());
     if (with_columns_and_triggers) {
         for (auto&& column : table->all_columns_in_select_order()) {
@@ -1543,6 +1755,12 @@ schema_ptr create_table_from_mutations(schema_mutations sm, std::experimental::o
         };
     }
 
+    if (table_row.has("view_base_id")) {
+        builder.with_view_info(table_row.get_nonnull<utils::UUID>("view_base_id"),
+                table_row.get_nonnull<sstring>("view_base_table"),
+                table_row.get_nonnull<bool>("view_include_all_columns"));
+    }
+
     for (auto&& cdef : column_defs) {
         builder.with_column(cdef);
     }
@@ -1579,11 +1797,27 @@ void add_column_to_schema_mutation(schema_ptr table,
     if (!column.is_on_all_components()) {
         m.set_clustered_cell(ckey, "component_index", int32_t(table->position(column)), timestamp);
     }
-#if 0
-    adder.add("index_name", column.getIndexName());
-    adder.add("index_type", column.getIndexType() == null ? null : column.getIndexType().toString());
-    adder.add("index_options", json(column.getIndexOptions()));
-#endif
+    if (column.is_indexed()) {
+        m.set_clustered_cell(ckey, "index_type", to_sstring(column.idx_info.index_type), timestamp);
+        if (column.idx_info.index_name) {
+            m.set_clustered_cell(ckey, "index_name", *column.idx_info.index_name, timestamp);
+        }
+        if (column.idx_info.index_options) {
+            m.set_clustered_cell(ckey, "index_options", json::to_json(*column.idx_info.index_options), timestamp);
+        }
+    }
+}
+
+static index_type deserialize_index_type(const sstring& type) {
+    if (type == "KEYS") {
+        return index_type::keys;
+    } else if (type == "CUSTOM") {
+        return index_type::custom;
+    } else if (type == "COMPOSITES") {
+        return index_type::composites;
+    } else {
+        throw std::invalid_argument("unknown index type: " + type);
+    }
 }
 
 sstring serialize_kind(column_kind kind)
@@ -1668,20 +1902,18 @@ column_definition create_column_from_column_row(const query::result_set_row& row
 
     auto validator = parse_type(row.get_nonnull<sstring>("validator"));
 
-#if 0
-    IndexType indexType = null;
-    if (row.has("index_type"))
-        indexType = IndexType.valueOf(row.getString("index_type"));
-
-    Map<String, String> indexOptions = null;
-    if (row.has("index_options"))
-        indexOptions = fromJsonMap(row.getString("index_options"));
-
-    String indexName = null;
-    if (row.has("index_name"))
-        indexName = row.getString("index_name");
-#endif
-    auto c = column_definition{utf8_type->decompose(name), validator, kind, component_index};
+    index_info idx;
+    if (row.has("index_type")) {
+        idx.index_type = deserialize_index_type(row.get_nonnull<sstring>("index_type"));
+    }
+    if (row.has("index_options")) {
+        auto options = json::to_map(row.get_nonnull<sstring>("index_options"));
+        idx.index_options = index_options_map(options.begin(), options.end());
+    }
+    if (row.has("index_name")) {
+        idx.index_name = row.get_nonnull<sstring>("index_name");
+    }
+    auto c = column_definition{utf8_type->decompose(name), validator, kind, component_index, std::move(idx)};
     return c;
 }
 
@@ -75,6 +75,9 @@ future<> save_system_keyspace_schema();
 
 future<utils::UUID> calculate_schema_digest(distributed<service::storage_proxy>& proxy);
 
+// Makes the next calculate_schema_digest() read all of the schema again.
+future<> clear_schema_digest_cache();
+
 future<std::vector<frozen_mutation>> convert_schema_to_mutations(distributed<service::storage_proxy>& proxy);
 
 future<schema_result_value_type>
@@ -66,11 +66,29 @@ size_estimates_recorder::size_estimates_recorder() {
     }
 }
 
+// Estimates of the sstables of this shard. Keys present in several sstables
+// are counted once, using the sketches of the keys of the sstables
+// overlapping each range.
 static std::vector<db::system_keyspace::range_estimates> estimates_for(const column_family& cf, const std::vector<query::partition_range>& local_ranges) {
-    // for each local primary range, estimate (crudely) mean partition size and partitions count.
+    // for each local primary range, estimate mean partition size and partitions count.
     std::vector<db::system_keyspace::range_estimates> estimates;
     estimates.reserve(local_ranges.size());
 
+    // Sketches written before they had enough registers to be accurate are
+    // not used.
+    std::unordered_map<const sstables::sstable*, std::experimental::optional<hll::HyperLogLog>> sketches;
+    auto sketch_of = [&sketches] (const sstables::shared_sstable& sst) -> const std::experimental::optional<hll::HyperLogLog>& {
+        auto i = sketches.find(sst.get());
+        if (i == sketches.end()) {
+            auto sketch = sst->get_cardinality();
+            if (sketch && sketch->registerSize() != (1u << sstables::metadata_collector::cardinality_precision)) {
+                sketch = { };
+            }
+            i = sketches.emplace(sst.get(), std::move(sketch)).first;
+        }
+        return i->second;
+    };
+
     std::vector<query::partition_range> unwrapped;
     // Each range defines both bounds.
     for (auto& range : local_ranges) {
@@ -85,10 +103,37 @@ static std::vector<db::system_keyspace::range_estimates> estimates_for(const col
             unwrapped.push_back(range);
         }
         for (auto&& uwr : unwrapped) {
+            auto token_range = uwr.transform([] (const dht::ring_position& rp) { return rp.token(); });
+            std::experimental::optional<hll::HyperLogLog> keys;
+            uint64_t sketched = 0;
+            uint64_t sketched_in_range = 0;
+            uint64_t unsketched_in_range = 0;
             for (auto&& sstable : cf.select_sstables(uwr)) {
-                count += sstable->get_estimated_key_count();
+                // An sstable shared by several shards is counted by the
+                // shard owning its first key only.
+                if (sstable->is_shared() && dht::shard_of(sstable->get_first_decorated_key(*cf.schema()).token()) != engine().cpu_id()) {
+                    continue;
+                }
+                auto in_range = sstable->estimated_keys_for_range(token_range);
+                auto& sketch = sketch_of(sstable);
+                if (sketch) {
+                    if (!keys) {
+                        keys = *sketch;
+                    } else {
+                        keys->merge(*sketch);
+                    }
+                    sketched += sstable->get_estimated_key_count();
+                    sketched_in_range += in_range;
+                } else {
+                    unsketched_in_range += in_range;
+                }
                 hist.merge(sstable->get_stats_metadata().estimated_row_size);
             }
+            // The sketches cover all of the sstables' keys, not just those in
+            // the range, so assume the share of distinct keys is the same in
+            // the range.
+            auto distinct = keys && sketched ? std::min(1.0, keys->estimate() / sketched) : 1.0;
+            count += unsketched_in_range + int64_t(sketched_in_range * distinct);
         }
         estimates.emplace_back(db::system_keyspace::range_estimates{
                 range.start()->value().token(),
@@ -100,9 +145,26 @@ static std::vector<db::system_keyspace::range_estimates> estimates_for(const col
     return estimates;
 }
 
+// Shards own disjoint tokens, so their partition counts add up.
+static std::vector<db::system_keyspace::range_estimates> merge_estimates(std::vector<db::system_keyspace::range_estimates> a,
+        std::vector<db::system_keyspace::range_estimates> b) {
+    if (a.empty()) {
+        return b;
+    }
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++) {
+        auto count = a[i].partitions_count + b[i].partitions_count;
+        if (count > 0) {
+            a[i].mean_partition_size = (a[i].mean_partition_size * a[i].partitions_count
+                    + b[i].mean_partition_size * b[i].partitions_count) / count;
+        }
+        a[i].partitions_count = count;
+    }
+    return a;
+}
+
 future<> size_estimates_recorder::record_size_estimates() {
-    // We constrain ourselves to a single CPU since we're dealing with ranges, and
-    // multipe CPUs might access the same sstables, skewing the estimations.
+    // We drive the recording from a single CPU, which collects the estimates
+    // of the sstables of all shards.
     if (engine().cpu_id() != 0) {
         return get_size_estimates_recorder().invoke_on(0, [](auto&& recorder) {
             return recorder.record_size_estimates();
@@ -129,12 +191,18 @@ future<> size_estimates_recorder::record_size_estimates() {
 
             _logger.debug("Recording size estimates");
 
-            auto&& db = service::get_local_storage_proxy().get_db().local();
-            parallel_for_each(db.get_non_system_column_families(), [&local_ranges](lw_shared_ptr<column_family> cf) {
+            auto&& db = service::get_local_storage_proxy().get_db();
+            parallel_for_each(db.local().get_non_system_column_families(), [&db, &local_ranges](lw_shared_ptr<column_family> cf) {
                 auto start = std::chrono::steady_clock::now();
                 auto s = cf->schema();
-                auto estimates = estimates_for(*cf, local_ranges);
-                return db::system_keyspace::update_size_estimates(s->ks_name(), s->cf_name(), std::move(estimates)).then([start, s] {
+                return db.map_reduce0([id = s->id(), &local_ranges] (database& db) {
+                    if (!db.column_family_exists(id)) {
+                        return std::vector<db::system_keyspace::range_estimates>();
+                    }
+                    return estimates_for(db.find_column_family(id), local_ranges);
+                }, std::vector<db::system_keyspace::range_estimates>(), merge_estimates).then([s] (auto estimates) {
+                    return db::system_keyspace::update_size_estimates(s->ks_name(), s->cf_name(), std::move(estimates));
+                }).then([start, s] {
                     auto passed = std::chrono::steady_clock::now() - start;
                     _logger.debug("Spent {} milliseconds on estimating {}.{} size",
                                   std::chrono::duration_cast<std::chrono::milliseconds>(passed).count(),
@@ -362,8 +362,16 @@ schema_ptr built_indexes() {
             {"bytes_out", long_type},
             {"columnfamily_name", utf8_type},
             {"compacted_at", timestamp_type},
+            {"compaction_strategy", utf8_type},
+            {"duration_ms", long_type},
             {"keyspace_name", utf8_type},
+            {"partitions_in", long_type},
+            {"partitions_out", long_type},
             {"rows_merged", map_type_impl::get_instance(int32_type, long_type, true)},
+            {"sstables_in", int32_type},
+            {"sstables_out", int32_type},
+            {"tombstones_expired", long_type},
+            {"tombstones_purged", long_type},
         },
         // static columns
         {},
@@ -434,6 +442,30 @@ schema_ptr size_estimates() {
     return size_estimates;
 }
 
+schema_ptr built_views() {
+    static thread_local auto built_views = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(NAME, BUILT_VIEWS), NAME, BUILT_VIEWS,
+            // partition key
+            {{"keyspace_name", utf8_type}},
+            // clustering key
+            {{"view_name", utf8_type}, {"cpu_id", int32_type}},
+            // regular columns
+            {
+                {"shard_count", int32_type},
+            },
+            // static columns
+            {},
+            // regular column name type
+            utf8_type,
+            // comment
+            "built materialized views, by shard"
+            )));
+        builder.with_version(generate_schema_version(builder.uuid()));
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return built_views;
+}
+
 static future<> setup_version() {
     sstring req = "INSERT INTO system.%s (key, release_version, cql_version, thrift_version, native_protocol_version, data_center, rack, partitioner, rpc_address, broadcast_address, listen_address, supported_features) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
@@ -1001,6 +1033,136 @@ future<> set_bootstrap_state(bootstrap_state state) {
     });
 }
 
+future<bool> is_index_built(sstring keyspace_name, sstring index_name) {
+    sstring req = "SELECT index_name FROM system.\"%s\" WHERE table_name = ? AND index_name = ?";
+    return execute_cql(req, BUILT_INDEXES, keyspace_name, index_name).then([] (::shared_ptr<cql3::untyped_result_set> msg) {
+        return !msg->empty();
+    });
+}
+
+future<> set_index_built(sstring keyspace_name, sstring index_name) {
+    sstring req = "INSERT INTO system.\"%s\" (table_name, index_name) VALUES (?, ?)";
+    return execute_cql(req, BUILT_INDEXES, keyspace_name, index_name).discard_result();
+}
+
+future<> set_index_removed(sstring keyspace_name, sstring index_name) {
+    sstring req = "DELETE FROM system.\"%s\" WHERE table_name = ? AND index_name = ?";
+    return execute_cql(req, BUILT_INDEXES, keyspace_name, index_name).discard_result();
+}
+
+future<bool> is_view_built(sstring keyspace_name, sstring view_name) {
+    sstring req = "SELECT shard_count FROM system.%s WHERE keyspace_name = ? AND view_name = ? AND cpu_id = ?";
+    return execute_cql(req, BUILT_VIEWS, keyspace_name, view_name, int32_t(engine().cpu_id())).then([] (::shared_ptr<cql3::untyped_result_set> msg) {
+        return !msg->empty() && msg->one().get_as<int32_t>("shard_count") == int32_t(smp::count);
+    });
+}
+
+future<> set_view_built(sstring keyspace_name, sstring view_name) {
+    sstring req = "INSERT INTO system.%s (keyspace_name, view_name, cpu_id, shard_count) VALUES (?, ?, ?, ?)";
+    return execute_cql(req, BUILT_VIEWS, keyspace_name, view_name, int32_t(engine().cpu_id()), int32_t(smp::count)).discard_result();
+}
+
+future<> set_view_removed(sstring keyspace_name, sstring view_name) {
+    sstring req = "DELETE FROM system.%s WHERE keyspace_name = ? AND view_name = ? AND cpu_id = ?";
+    return execute_cql(req, BUILT_VIEWS, keyspace_name, view_name, int32_t(engine().cpu_id())).discard_result();
+}
+
+schema_ptr streamed_ranges() {
+    static thread_local auto streamed_ranges = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(NAME, STREAMED_RANGES), NAME, STREAMED_RANGES,
+            // partition key
+            {{"operation", utf8_type}},
+            // clustering key
+            {{"keyspace_name", utf8_type}, {"range_start", utf8_type}, {"range_end", utf8_type}},
+            // regular columns
+            {
+                {"streamed_at", timestamp_type},
+            },
+            // static columns
+            {},
+            // regular column name type
+            utf8_type,
+            // comment
+            "ranges fetched by streaming operations in progress"
+            )));
+        builder.with_version(generate_schema_version(builder.uuid()));
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return streamed_ranges;
+}
+
+schema_ptr large_partitions() {
+    static thread_local auto large_partitions = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(NAME, LARGE_PARTITIONS), NAME, LARGE_PARTITIONS,
+            // partition key
+            {{"keyspace_name", utf8_type}, {"table_name", utf8_type}},
+            // clustering key, largest partitions first
+            {{"partition_size", reversed_type_impl::get_instance(long_type)}, {"sstable_name", utf8_type}, {"partition_key", utf8_type}},
+            // regular columns
+            {
+                {"rows", long_type},
+                {"compaction_time", timestamp_type},
+            },
+            // static columns
+            {},
+            // regular column name type
+            utf8_type,
+            // comment
+            "partitions larger than the large partition threshold written to sstables"
+            )));
+        builder.set_default_time_to_live(std::chrono::duration_cast<std::chrono::seconds>(days(30)));
+        builder.with_version(generate_schema_version(builder.uuid()));
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return large_partitions;
+}
+
+future<> record_large_partition(sstring keyspace_name, sstring table_name, sstring sstable_name, sstring partition_key,
+        int64_t partition_size, int64_t rows) {
+    if (!qctx) {
+        return make_ready_future<>();
+    }
+    sstring req = "INSERT INTO system.%s (keyspace_name, table_name, partition_size, sstable_name, partition_key, rows, compaction_time) VALUES (?, ?, ?, ?, ?, ?, ?)";
+    return execute_cql(req, LARGE_PARTITIONS, std::move(keyspace_name), std::move(table_name), partition_size, std::move(sstable_name),
+            std::move(partition_key), rows, db_clock::now()).discard_result();
+}
+
+future<std::unordered_map<sstring, std::vector<range<dht::token>>>> get_streamed_ranges(sstring operation) {
+    sstring req = "SELECT keyspace_name, range_start, range_end FROM system.%s WHERE operation = ?";
+    return execute_cql(req, STREAMED_RANGES, operation).then([] (::shared_ptr<cql3::untyped_result_set> msg) {
+        std::unordered_map<sstring, std::vector<range<dht::token>>> ret;
+        auto& p = dht::global_partitioner();
+        for (auto& row : *msg) {
+            ret[row.get_as<sstring>("keyspace_name")].emplace_back(
+                range<dht::token>::bound(p.from_sstring(row.get_as<sstring>("range_start")), false),
+                range<dht::token>::bound(p.from_sstring(row.get_as<sstring>("range_end")), true));
+        }
+        return ret;
+    });
+}
+
+// Only ranges with an exclusive start and an inclusive end, like those of the
+// token ring, are recorded. Others are streamed again on retry.
+future<> add_streamed_ranges(sstring operation, sstring keyspace_name, std::vector<range<dht::token>> ranges) {
+    return do_with(std::move(operation), std::move(keyspace_name), std::move(ranges),
+            [] (sstring& operation, sstring& keyspace_name, std::vector<range<dht::token>>& ranges) {
+        return do_for_each(ranges, [&operation, &keyspace_name] (const range<dht::token>& r) {
+            if (!r.start() || r.start()->is_inclusive() || !r.end() || !r.end()->is_inclusive()) {
+                return make_ready_future<>();
+            }
+            auto& p = dht::global_partitioner();
+            sstring req = "INSERT INTO system.%s (operation, keyspace_name, range_start, range_end, streamed_at) VALUES (?, ?, ?, ?, ?)";
+            return execute_cql(req, STREAMED_RANGES, operation, keyspace_name,
+                    p.to_sstring(r.start()->value()), p.to_sstring(r.end()->value()), db_clock::now()).discard_result();
+        });
+    });
+}
+
+future<> clear_streamed_ranges(sstring operation) {
+    sstring req = "DELETE FROM system.%s WHERE operation = ?";
+    return execute_cql(req, STREAMED_RANGES, operation).discard_result();
+}
+
 std::vector<schema_ptr> all_tables() {
     std::vector<schema_ptr> r;
     auto legacy_tables = db::schema_tables::all_tables();
@@ -1017,6 +1179,9 @@ std::vector<schema_ptr> all_tables() {
     r.push_back(compaction_history());
     r.push_back(sstable_activity());
     r.push_back(size_estimates());
+    r.push_back(built_views());
+    r.push_back(streamed_ranges());
+    r.push_back(large_partitions());
     return r;
 }
 
@@ -1125,20 +1290,28 @@ static map_type_impl::native_type prepare_rows_merged(std::unordered_map<int32_t
     return tmp;
 }
 
-future<> update_compaction_history(sstring ksname, sstring cfname, int64_t compacted_at, int64_t bytes_in, int64_t bytes_out,
-                                   std::unordered_map<int32_t, int64_t> rows_merged)
+future<> update_compaction_history(const compaction_history_entry& entry)
 {
     // don't write anything when the history table itself is compacted, since that would in turn cause new compactions
-    if (ksname == "system" && cfname == COMPACTION_HISTORY) {
+    if (entry.ks == "system" && entry.cf == COMPACTION_HISTORY) {
         return make_ready_future<>();
     }
 
     auto map_type = map_type_impl::get_instance(int32_type, long_type, true);
 
-    sstring req = "INSERT INTO system.%s (id, keyspace_name, columnfamily_name, compacted_at, bytes_in, bytes_out, rows_merged) VALUES (?, ?, ?, ?, ?, ?, ?)";
+    sstring req = "INSERT INTO system.%s (id, keyspace_name, columnfamily_name, compacted_at, bytes_in, bytes_out, rows_merged, "
+            "sstables_in, sstables_out, partitions_in, partitions_out, tombstones_expired, tombstones_purged, duration_ms, compaction_strategy) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+    return execute_cql(req, COMPACTION_HISTORY, utils::UUID_gen::get_time_UUID(), entry.ks, entry.cf, entry.compacted_at, entry.bytes_in, entry.bytes_out,
+                       make_map_value(map_type, prepare_rows_merged(entry.rows_merged)), entry.sstables_in, entry.sstables_out,
+                       entry.partitions_in, entry.partitions_out, entry.tombstones_expired, entry.tombstones_purged, entry.duration_ms,
+                       entry.compaction_strategy).discard_result();
+}
 
-    return execute_cql(req, COMPACTION_HISTORY, utils::UUID_gen::get_time_UUID(), ksname, cfname, compacted_at, bytes_in, bytes_out,
-                       make_map_value(map_type, prepare_rows_merged(rows_merged))).discard_result();
+template<typename T>
+static T get_or(const cql3::untyped_result_set::row& row, const sstring& name, T def) {
+    return row.has(name) ? row.get_as<T>(name) : def;
 }
 
 future<std::vector<compaction_history_entry>> get_compaction_history()
@@ -1158,6 +1331,15 @@ future<std::vector<compaction_history_entry>> get_compaction_history()
             if (row.has("rows_merged")) {
                 entry.rows_merged = row.get_map<int32_t, int64_t>("rows_merged");
             }
+            // Entries written by older versions don't have the columns below.
+            entry.sstables_in = get_or<int32_t>(row, "sstables_in", 0);
+            entry.sstables_out = get_or<int32_t>(row, "sstables_out", 0);
+            entry.partitions_in = get_or<int64_t>(row, "partitions_in", 0);
+            entry.partitions_out = get_or<int64_t>(row, "partitions_out", 0);
+            entry.tombstones_expired = get_or<int64_t>(row, "tombstones_expired", 0);
+            entry.tombstones_purged = get_or<int64_t>(row, "tombstones_purged", 0);
+            entry.duration_ms = get_or<int64_t>(row, "duration_ms", 0);
+            entry.compaction_strategy = get_or<sstring>(row, "compaction_strategy", sstring());
             history.push_back(std::move(entry));
         }
         return std::move(history);
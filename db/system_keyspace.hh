@@ -78,6 +78,9 @@ static constexpr auto COMPACTIONS_IN_PROGRESS = "compactions_in_progress";
 static constexpr auto COMPACTION_HISTORY = "compaction_history";
 static constexpr auto SSTABLE_ACTIVITY = "sstable_activity";
 static constexpr auto SIZE_ESTIMATES = "size_estimates";
+static constexpr auto BUILT_VIEWS = "built_views";
+static constexpr auto STREAMED_RANGES = "streamed_ranges";
+static constexpr auto LARGE_PARTITIONS = "large_partitions";
 
 // Partition estimates for a given range of tokens.
 struct range_estimates {
@@ -285,10 +288,19 @@ enum class bootstrap_state {
         // Key: number of rows merged
         // Value: counter
         std::unordered_map<int32_t, int64_t> rows_merged;
+        int32_t sstables_in = 0;
+        int32_t sstables_out = 0;
+        // Estimated from the input sstables' key counts.
+        int64_t partitions_in = 0;
+        int64_t partitions_out = 0;
+        int64_t tombstones_expired = 0;
+        int64_t tombstones_purged = 0;
+        int64_t duration_ms = 0;
+        sstring compaction_strategy;
     };
 
-    future<> update_compaction_history(sstring ksname, sstring cfname, int64_t compacted_at, int64_t bytes_in, int64_t bytes_out,
-                                       std::unordered_map<int32_t, int64_t> rows_merged);
+    // The id of the entry is ignored, a new one is generated.
+    future<> update_compaction_history(const compaction_history_entry& entry);
     future<std::vector<compaction_history_entry>> get_compaction_history();
 
     typedef std::vector<db::replay_position> replay_positions;
@@ -419,31 +431,26 @@ bootstrap_state get_bootstrap_state();
 bool was_decommissioned();
 future<> set_bootstrap_state(bootstrap_state state);
 
-#if 0
-    public static boolean isIndexBuilt(String keyspaceName, String indexName)
-    {
-        ColumnFamilyStore cfs = Keyspace.open(NAME).getColumnFamilyStore(BUILT_INDEXES);
-        QueryFilter filter = QueryFilter.getNamesFilter(decorate(ByteBufferUtil.bytes(keyspaceName)),
-                                                        BUILT_INDEXES,
-                                                        FBUtilities.singleton(cfs.getComparator().makeCellName(indexName), cfs.getComparator()),
-                                                        System.currentTimeMillis());
-        return ColumnFamilyStore.removeDeleted(cfs.getColumnFamily(filter), Integer.MAX_VALUE) != null;
-    }
-
-    public static void setIndexBuilt(String keyspaceName, String indexName)
-    {
-        ColumnFamily cf = ArrayBackedSortedColumns.factory.create(NAME, BUILT_INDEXES);
-        cf.addColumn(new BufferCell(cf.getComparator().makeCellName(indexName), ByteBufferUtil.EMPTY_BYTE_BUFFER, FBUtilities.timestampMicros()));
-        new Mutation(NAME, ByteBufferUtil.bytes(keyspaceName), cf).apply();
-    }
-
-    public static void setIndexRemoved(String keyspaceName, String indexName)
-    {
-        Mutation mutation = new Mutation(NAME, ByteBufferUtil.bytes(keyspaceName));
-        mutation.delete(BUILT_INDEXES, BuiltIndexes.comparator.makeCellName(indexName), FBUtilities.timestampMicros());
-        mutation.apply();
-    }
-#endif
+future<bool> is_index_built(sstring keyspace_name, sstring index_name);
+future<> set_index_built(sstring keyspace_name, sstring index_name);
+future<> set_index_removed(sstring keyspace_name, sstring index_name);
+
+// Materialized views are built by every shard on its own; the build state
+// of a shard is only valid for the number of shards it was built with.
+future<bool> is_view_built(sstring keyspace_name, sstring view_name);
+future<> set_view_built(sstring keyspace_name, sstring view_name);
+future<> set_view_removed(sstring keyspace_name, sstring view_name);
+
+// Ranges already fetched by a streaming operation (bootstrap, rebuild) which
+// hasn't completed yet, by keyspace, so that a retry can skip them.
+future<std::unordered_map<sstring, std::vector<range<dht::token>>>> get_streamed_ranges(sstring operation);
+future<> add_streamed_ranges(sstring operation, sstring keyspace_name, std::vector<range<dht::token>> ranges);
+future<> clear_streamed_ranges(sstring operation);
+
+// Records a partition above compaction_large_partition_warning_threshold_mb
+// written to the given sstable. Entries expire after a month.
+future<> record_large_partition(sstring keyspace_name, sstring table_name, sstring sstable_name, sstring partition_key,
+        int64_t partition_size, int64_t rows);
 
     /**
      * Read the host ID from the system keyspace, creating (and storing) one if
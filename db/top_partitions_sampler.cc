@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unordered_map>
+#include <boost/algorithm/string/join.hpp>
+#include "db/top_partitions_sampler.hh"
+
+namespace db {
+
+top_partitions_sampler::top_partitions_sampler(schema_ptr s, size_t capacity)
+    : _schema(std::move(s))
+    , _reads(capacity, partition_key::hashing(*_schema), partition_key::equality(*_schema))
+    , _writes(capacity, partition_key::hashing(*_schema), partition_key::equality(*_schema))
+{ }
+
+sstring key_to_string(const schema& s, const partition_key& key) {
+    std::vector<sstring> components;
+    auto values = key.explode(s);
+    auto v = values.begin();
+    for (auto&& cdef : s.partition_key_columns()) {
+        components.push_back(cdef.type->to_string(*v++));
+    }
+    return boost::algorithm::join(components, ":");
+}
+
+std::vector<top_partitions_sampler::sampled_partition> top_partitions_sampler::top(const summary& s) const {
+    std::vector<sampled_partition> res;
+    for (auto&& c : s.top(s.size())) {
+        res.push_back(sampled_partition{key_to_string(*_schema, c.key), c.count, c.error, c.weight});
+    }
+    return res;
+}
+
+top_partitions_sampler::results top_partitions_sampler::get_results() const {
+    return results{top(_reads), top(_writes)};
+}
+
+static std::vector<top_partitions_sampler::sampled_partition>
+merge_lists(std::vector<top_partitions_sampler::sampled_partition> a, std::vector<top_partitions_sampler::sampled_partition> b, size_t k) {
+    // Partitions are owned by a single shard, so lists of different shards
+    // rarely share keys, but sum them up if they do.
+    std::unordered_map<sstring, size_t> index;
+    for (size_t i = 0; i < a.size(); ++i) {
+        index.emplace(a[i].key, i);
+    }
+    for (auto&& p : b) {
+        auto i = index.find(p.key);
+        if (i == index.end()) {
+            a.push_back(std::move(p));
+        } else {
+            auto& q = a[i->second];
+            q.count += p.count;
+            q.error += p.error;
+            q.bytes += p.bytes;
+        }
+    }
+    std::sort(a.begin(), a.end(), [] (auto& x, auto& y) {
+        return x.count > y.count;
+    });
+    a.resize(std::min(a.size(), k));
+    return a;
+}
+
+top_partitions_sampler::results top_partitions_sampler::merge(results a, results b, size_t k) {
+    return results{merge_lists(std::move(a.reads), std::move(b.reads), k),
+                   merge_lists(std::move(a.writes), std::move(b.writes), k)};
+}
+
+}
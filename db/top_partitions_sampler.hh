@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "core/sstring.hh"
+#include "keys.hh"
+#include "schema.hh"
+#include "utils/space_saving.hh"
+
+namespace db {
+
+/**
+ * Finds the partitions of a column_family which are read and written the
+ * most, for the toppartitions REST call.
+ *
+ * A column_family owns a sampler only while a sampling session is running,
+ * so that it costs nothing but a null check otherwise. Reads and writes are
+ * counted in separate Space-Saving summaries of the given capacity, along
+ * with the bytes they carried; the summaries of all shards are combined with
+ * merge() when the session ends.
+ */
+class top_partitions_sampler {
+public:
+    struct sampled_partition {
+        // The partition key, as a colon separated list of its components.
+        sstring key;
+        uint64_t count;
+        // How much count may exceed the real number of operations.
+        uint64_t error;
+        uint64_t bytes;
+    };
+    struct results {
+        std::vector<sampled_partition> reads;
+        std::vector<sampled_partition> writes;
+    };
+private:
+    using summary = utils::space_saving<partition_key, partition_key::hashing, partition_key::equality>;
+
+    schema_ptr _schema;
+    summary _reads;
+    summary _writes;
+private:
+    std::vector<sampled_partition> top(const summary& s) const;
+public:
+    top_partitions_sampler(schema_ptr s, size_t capacity);
+
+    void record_read(const partition_key& key, uint64_t bytes) {
+        _reads.offer(key, bytes);
+    }
+    void record_write(const partition_key& key, uint64_t bytes) {
+        _writes.offer(key, bytes);
+    }
+
+    // All monitored partitions, most frequent first.
+    results get_results() const;
+
+    // Combines results of different shards, keeping the k most frequent
+    // partitions in each list.
+    static results merge(results a, results b, size_t k);
+};
+
+// Formats the key as its components' values separated by colons.
+sstring key_to_string(const schema& s, const partition_key& key);
+
+}
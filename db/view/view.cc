@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <set>
+#include <boost/range/algorithm/for_each.hpp>
+#include "db/view/view.hh"
+#include "types.hh"
+
+namespace db {
+namespace view {
+
+query::clustering_row_ranges affected_ranges(const schema& base, const mutation& update) {
+    auto& p = update.partition();
+    if (p.partition_tombstone() || !p.row_tombstones().empty()) {
+        // Can't tell which rows are deleted without reading them all.
+        return { query::clustering_range::make_open_ended_both_sides() };
+    }
+    query::clustering_row_ranges ranges;
+    for (const rows_entry& e : p.clustered_rows()) {
+        ranges.emplace_back(query::clustering_range::make_singular(e.key()));
+    }
+    return ranges;
+}
+
+query::partition_slice affected_rows_slice(const schema& base, const mutation& update) {
+    std::vector<column_id> regular_columns;
+    for (const column_definition& def : base.regular_columns()) {
+        regular_columns.push_back(def.id);
+    }
+    return query::partition_slice(affected_ranges(base, update), { }, std::move(regular_columns),
+        query::partition_slice::option_set());
+}
+
+namespace {
+
+// Accumulates the updates of a single view.
+class view_updates {
+    struct view_key {
+        partition_key pk;
+        clustering_key ck;
+        bool equal(const schema& s, const view_key& o) const {
+            return pk.equal(s, o.pk) && ck.equal(s, o.ck);
+        }
+    };
+    const schema& _base;
+    schema_ptr _view;
+    gc_clock::time_point _now;
+    // The regular column of the base which is part of the view primary key, if any.
+    const column_definition* _key_column = nullptr;
+    std::map<partition_key, mutation, partition_key::less_compare> _updates;
+public:
+    view_updates(const schema& base, schema_ptr view, gc_clock::time_point now)
+        : _base(base)
+        , _view(std::move(view))
+        , _now(now)
+        , _updates(partition_key::less_compare(*_view))
+    {
+        auto find_key_column = [&] (const column_definition& vdef) {
+            auto bdef = _base.get_column_definition(vdef.name());
+            if (bdef && bdef->is_regular()) {
+                _key_column = bdef;
+            }
+        };
+        boost::for_each(_view->partition_key_columns(), find_key_column);
+        boost::for_each(_view->clustering_key_columns(), find_key_column);
+    }
+
+    // Updates the view for a write to the base row with the given key.
+    //
+    // The tombstones are the partition and range tombstones covering the row,
+    // the row tombstone is held by the row itself.
+    void on_row(const std::vector<bytes>& base_pk, const clustering_key& base_ck,
+            const deletable_row* old_row, tombstone old_t,
+            const deletable_row& new_row, tombstone new_t,
+            const deletable_row& update, tombstone update_t) {
+        auto ck = base_ck.explode(_base);
+        auto old_key = key_of(base_pk, ck, old_row, old_t);
+        auto new_key = key_of(base_pk, ck, &new_row, new_t);
+        if (old_key && new_key && old_key->equal(*_view, *new_key)) {
+            update_entry(*new_key, update, update_t);
+            return;
+        }
+        if (old_key) {
+            delete_entry(*old_key, *old_row);
+        }
+        if (new_key) {
+            create_entry(*new_key, new_row, new_t);
+        }
+    }
+
+    void move_to(std::vector<mutation>& out) {
+        for (auto&& e : _updates) {
+            out.emplace_back(std::move(e.second));
+        }
+        _updates.clear();
+    }
+private:
+    deletable_row& get_view_row(const view_key& k) {
+        auto i = _updates.find(k.pk);
+        if (i == _updates.end()) {
+            i = _updates.emplace(k.pk, mutation(k.pk, _view)).first;
+        }
+        return i->second.partition().clustered_row(k.ck);
+    }
+
+    const atomic_cell_or_collection* live_cell(const column_definition& def, const deletable_row& row, tombstone t) const {
+        auto c = row.cells().find_cell(def.id);
+        if (!c) {
+            return nullptr;
+        }
+        t.apply(row.deleted_at());
+        return c->as_atomic_cell().is_live(t, _now) ? c : nullptr;
+    }
+
+    // Returns the key of the view row of the given base row, or nothing if
+    // the base row is not live or lacks the value of the view key column.
+    std::experimental::optional<view_key> key_of(const std::vector<bytes>& base_pk, const std::vector<bytes>& base_ck,
+            const deletable_row* row, tombstone t) const {
+        if (!row || !row->is_live(_base, t, _now)) {
+            return { };
+        }
+        auto value_of = [&] (const column_definition& vdef) -> bytes_opt {
+            auto& bdef = *_base.get_column_definition(vdef.name());
+            if (bdef.is_partition_key()) {
+                return base_pk[bdef.id];
+            }
+            if (bdef.is_clustering_key()) {
+                return base_ck[bdef.id];
+            }
+            auto c = live_cell(bdef, *row, t);
+            if (!c) {
+                return { };
+            }
+            return to_bytes(c->as_atomic_cell().value());
+        };
+        std::vector<bytes> pk, ck;
+        for (const column_definition& vdef : _view->partition_key_columns()) {
+            auto v = value_of(vdef);
+            if (!v) {
+                return { };
+            }
+            pk.emplace_back(std::move(*v));
+        }
+        for (const column_definition& vdef : _view->clustering_key_columns()) {
+            auto v = value_of(vdef);
+            if (!v) {
+                return { };
+            }
+            ck.emplace_back(std::move(*v));
+        }
+        return view_key{partition_key::from_exploded(*_view, pk), clustering_key::from_exploded(*_view, ck)};
+    }
+
+    // The view row is live as long as the base row has a live marker, and
+    // expires with the value of the view key column, if there is one.
+    row_marker marker_of(const deletable_row& row, tombstone t) const {
+        row_marker m;
+        auto row_t = t;
+        row_t.apply(row.deleted_at());
+        if (row.marker().is_live(row_t, _now)) {
+            m = row.marker();
+        }
+        if (_key_column) {
+            auto c = live_cell(*_key_column, row, t);
+            if (c) {
+                auto ac = c->as_atomic_cell();
+                m.apply(ac.is_live_and_has_ttl() ? row_marker(ac.timestamp(), ac.ttl(), ac.expiry()) : row_marker(ac.timestamp()));
+            }
+        }
+        return m;
+    }
+
+    void copy_selected_cells(const deletable_row& from, deletable_row& to) const {
+        from.cells().for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+            auto vdef = _view->get_column_definition(_base.regular_column_at(id).name());
+            if (vdef && vdef->is_regular()) {
+                to.cells().apply(*vdef, c);
+            }
+        });
+    }
+
+    // Highest timestamp of the parts of the base row which made it to the view.
+    api::timestamp_type max_timestamp(const deletable_row& row) const {
+        auto ts = row.marker().is_missing() ? api::missing_timestamp : row.marker().timestamp();
+        row.cells().for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+            auto& bdef = _base.regular_column_at(id);
+            if (!_view->get_column_definition(bdef.name())) {
+                return;
+            }
+            if (bdef.is_atomic()) {
+                ts = std::max(ts, c.as_atomic_cell().timestamp());
+            } else {
+                auto ctype = static_pointer_cast<const collection_type_impl>(bdef.type);
+                ts = std::max(ts, ctype->last_update(c.as_collection_mutation()));
+            }
+        });
+        return ts;
+    }
+
+    void create_entry(const view_key& k, const deletable_row& row, tombstone t) {
+        auto& r = get_view_row(k);
+        auto row_t = t;
+        row_t.apply(row.deleted_at());
+        r.apply(row_t);
+        r.apply(marker_of(row, t));
+        copy_selected_cells(row, r);
+    }
+
+    void delete_entry(const view_key& k, const deletable_row& old_row) {
+        get_view_row(k).apply(tombstone(max_timestamp(old_row), _now));
+    }
+
+    void update_entry(const view_key& k, const deletable_row& update, tombstone t) {
+        auto& r = get_view_row(k);
+        auto row_t = t;
+        row_t.apply(update.deleted_at());
+        r.apply(row_t);
+        r.apply(marker_of(update, t));
+        copy_selected_cells(update, r);
+    }
+};
+
+}
+
+std::vector<mutation> generate_view_updates(const schema_ptr& base, const std::vector<schema_ptr>& views,
+        const mutation& update, const mutation_opt& existing, gc_clock::time_point now) {
+    std::vector<view_updates> updates;
+    for (auto&& v : views) {
+        updates.emplace_back(*base, v, now);
+    }
+
+    auto& up = update.partition();
+    auto old_p = existing ? &existing->partition() : nullptr;
+    std::set<clustering_key, clustering_key::less_compare> keys{clustering_key::less_compare(*base)};
+    for (const rows_entry& e : up.clustered_rows()) {
+        keys.insert(e.key());
+    }
+    if (old_p && (up.partition_tombstone() || !up.row_tombstones().empty())) {
+        for (const rows_entry& e : old_p->clustered_rows()) {
+            keys.insert(e.key());
+        }
+    }
+
+    auto find_row = [&] (const mutation_partition& p, const clustering_key& ck) -> const deletable_row* {
+        auto i = p.clustered_rows().find(ck, rows_entry::compare(*base));
+        return i == p.clustered_rows().end() ? nullptr : &i->row();
+    };
+
+    auto base_pk = update.key().explode(*base);
+    const deletable_row no_row;
+    for (auto&& ck : keys) {
+        auto old_row = old_p ? find_row(*old_p, ck) : nullptr;
+        auto old_t = old_p ? old_p->range_tombstone_for_row(*base, ck) : tombstone();
+        auto update_row = find_row(up, ck);
+        auto update_t = up.range_tombstone_for_row(*base, ck);
+        if (!update_row) {
+            update_row = &no_row;
+        }
+
+        auto new_row = old_row ? *old_row : deletable_row();
+        new_row.apply(update_row->deleted_at());
+        new_row.apply(update_row->marker());
+        new_row.cells().apply(*base, column_kind::regular_column, update_row->cells());
+        auto new_t = old_t;
+        new_t.apply(update_t);
+
+        for (auto&& vu : updates) {
+            vu.on_row(base_pk, ck, old_row, old_t, new_row, new_t, *update_row, update_t);
+        }
+    }
+
+    std::vector<mutation> result;
+    for (auto&& vu : updates) {
+        vu.move_to(result);
+    }
+    return result;
+}
+
+}
+}
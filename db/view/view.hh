@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "schema.hh"
+#include "mutation.hh"
+#include "query-request.hh"
+
+namespace db {
+namespace view {
+
+// Materialized views.
+//
+// A view is a table whose rows are derived from the rows of a base table,
+// keyed by a primary key made of all columns of the base primary key plus at
+// most one regular column of the base. The view is maintained by the base
+// replicas: every write to the base table is preceded by a read of the base
+// rows it touches, and the old and new state of each row are used to compute
+// the view rows to delete and to write. Each base replica sends its view
+// updates to a single view replica, the one paired with it (see
+// storage_proxy::mutate_view_replicas()), so that the view gets the updates
+// once per replica, like the base does.
+
+// Returns the clustering ranges of the base rows whose current state is needed
+// to compute the view updates of the given write to the base.
+query::clustering_row_ranges affected_ranges(const schema& base, const mutation& update);
+
+// Returns a slice selecting the rows returned by affected_ranges(), with all
+// of their regular columns.
+query::partition_slice affected_rows_slice(const schema& base, const mutation& update);
+
+// Computes the updates of the given views of base for a write to it.
+//
+// existing holds the state of the rows selected by affected_rows_slice()
+// before the write, or is disengaged if there are none. Both it and update
+// must be in the base schema.
+std::vector<mutation> generate_view_updates(const schema_ptr& base, const std::vector<schema_ptr>& views,
+        const mutation& update, const mutation_opt& existing, gc_clock::time_point now);
+
+}
+}
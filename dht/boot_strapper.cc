@@ -40,7 +40,10 @@
 #include "service/storage_service.hh"
 #include "dht/range_streamer.hh"
 #include "gms/failure_detector.hh"
+#include "locator/abstract_replication_strategy.hh"
+#include "utils/fb_utilities.hh"
 #include "log.hh"
+#include <seastar/core/thread.hh>
 
 static logging::logger logger("boot_strapper");
 
@@ -96,11 +99,105 @@ std::unordered_set<token> boot_strapper::get_bootstrap_tokens(token_metadata met
         logger.warn("Picking random token for a single vnode.  You should probably add more vnodes; failing that, you should probably specify the token manually");
     }
 
+    auto& keyspace = db.get_config().allocate_tokens_for_keyspace();
+    if (!keyspace.empty()) {
+        if (!db.has_keyspace(keyspace)) {
+            throw std::runtime_error(sprint("Can't allocate tokens for unknown keyspace %s", keyspace));
+        }
+        auto& rs = db.find_keyspace(keyspace).get_replication_strategy();
+        auto tokens = allocate_tokens(metadata, rs, utils::fb_utilities::get_broadcast_address(), num_tokens);
+        logger.debug("Get allocated bootstrap_tokens={} for keyspace {}", tokens, keyspace);
+        return tokens;
+    }
+
     auto tokens = get_random_tokens(metadata, num_tokens);
     logger.debug("Get random bootstrap_tokens={}", tokens);
     return tokens;
 }
 
+std::unordered_set<token> boot_strapper::allocate_tokens(token_metadata metadata, locator::abstract_replication_strategy& rs,
+        inet_address address, size_t num_tokens) {
+    auto tm = metadata.clone_only_token_map();
+    if (tm.sorted_tokens().empty()) {
+        return get_random_tokens(std::move(tm), num_tokens);
+    }
+    tm.update_topology(address);
+    auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+    auto dc = snitch->get_datacenter(address);
+    auto rack = snitch->get_rack(address);
+    bool by_topology = rs.get_type() == locator::replication_strategy_type::network_topology;
+
+    std::unordered_set<token> tokens;
+    while (tokens.size() < num_tokens) {
+        const auto& sorted = tm.sorted_tokens();
+        auto widths = global_partitioner().describe_ownership(sorted);
+        std::vector<std::vector<inet_address>> replicas;
+        replicas.reserve(sorted.size());
+        std::unordered_map<inet_address, double> load;
+        for (auto&& t : sorted) {
+            replicas.push_back(rs.calculate_natural_endpoints(t, tm));
+            for (auto&& ep : replicas.back()) {
+                load[ep] += widths[t];
+            }
+            if (thread::should_yield()) {
+                thread::yield();
+            }
+        }
+
+        // The new node takes a vnode over from the replica of that vnode
+        // which it replaces: one in the same rack and data center with
+        // NetworkTopologyStrategy, if there is one, or else one in the same
+        // data center. Split the vnode for which this takes the most from
+        // the most loaded such replica.
+        std::experimental::optional<size_t> best;
+        double best_score = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            auto& eps = replicas[i];
+            if (std::find(eps.begin(), eps.end(), address) != eps.end()) {
+                continue;
+            }
+            double peer_load = 0;
+            bool same_rack = false;
+            for (auto&& ep : eps) {
+                if (by_topology) {
+                    if (snitch->get_datacenter(ep) != dc) {
+                        continue;
+                    }
+                    auto in_rack = snitch->get_rack(ep) == rack;
+                    if (in_rack && !same_rack) {
+                        same_rack = true;
+                        peer_load = 0;
+                    } else if (!in_rack && same_rack) {
+                        continue;
+                    }
+                }
+                peer_load = std::max(peer_load, load[ep]);
+            }
+            auto score = widths[sorted[i]] * peer_load;
+            if (score > best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+
+        auto t = [&] {
+            if (best) {
+                auto& end = sorted[*best];
+                auto& start = *best ? sorted[*best - 1] : sorted.back();
+                auto mid = global_partitioner().midpoint(start, end);
+                if (!tm.get_endpoint(mid)) {
+                    return mid;
+                }
+            }
+            // Nothing left to take over, or the vnode is too small to split.
+            return *get_random_tokens(tm, 1).begin();
+        }();
+        tokens.insert(t);
+        tm.update_normal_token(t, address);
+    }
+    return tokens;
+}
+
 std::unordered_set<token> boot_strapper::get_random_tokens(token_metadata metadata, size_t num_tokens) {
     std::unordered_set<token> tokens;
     while (tokens.size() < num_tokens) {
@@ -73,6 +73,15 @@ class boot_strapper {
     static std::unordered_set<token> get_bootstrap_tokens(token_metadata metadata, database& db);
 
     static std::unordered_set<token> get_random_tokens(token_metadata metadata, size_t num_tokens);
+
+    /**
+     * Picks num_tokens tokens for the node at address, one at a time, each
+     * splitting the vnode whose replicas include the most loaded node the new
+     * one would take data from, by ownership replicated according to rs.
+     * Must run in a seastar thread.
+     */
+    static std::unordered_set<token> allocate_tokens(token_metadata metadata, locator::abstract_replication_strategy& rs,
+            inet_address address, size_t num_tokens);
 #if 0
     public static class StringSerializer implements IVersionedSerializer<String>
     {
@@ -161,6 +161,19 @@ byte_ordered_partitioner::shard_of(const token& t) const {
     assert(0);
 }
 
+token
+byte_ordered_partitioner::token_for_shard(unsigned shard) const {
+    if (shard == 0) {
+        return minimum_token();
+    }
+    auto first_byte = (shard * 256 + smp::count - 1) / smp::count;
+    if (first_byte > 255) {
+        // With more than 256 shards, some of the last ones handle no tokens.
+        return maximum_token();
+    }
+    return token(token::kind::key, managed_bytes({int8_t(uint8_t(first_byte))}));
+}
+
 using registry = class_registrator<i_partitioner, byte_ordered_partitioner>;
 static registry registrator("org.apache.cassandra.dht.ByteOrderedPartitioner");
 static registry registrator_short_name("ByteOrderedPartitioner");
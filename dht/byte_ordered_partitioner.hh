@@ -66,6 +66,7 @@ class byte_ordered_partitioner final : public i_partitioner {
         }
     }
     virtual unsigned shard_of(const token& t) const override;
+    virtual token token_for_shard(unsigned shard) const override;
 };
 
 }
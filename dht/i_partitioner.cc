@@ -263,6 +263,17 @@ unsigned shard_of(const token& t) {
     return global_partitioner().shard_of(t);
 }
 
+range<ring_position> shard_range(unsigned shard) {
+    using bound_opt = std::experimental::optional<range<ring_position>::bound>;
+    auto start = shard == 0
+                 ? bound_opt()
+                 : bound_opt(ring_position::starting_at(global_partitioner().token_for_shard(shard)));
+    auto end = shard + 1 == smp::count
+               ? bound_opt()
+               : bound_opt(range<ring_position>::bound(ring_position::starting_at(global_partitioner().token_for_shard(shard + 1)), false));
+    return { std::move(start), std::move(end) };
+}
+
 int ring_position_comparator::operator()(const ring_position& lh, const ring_position& rh) const {
     return lh.tri_compare(s, rh);
 }
@@ -256,6 +256,12 @@ class i_partitioner {
      */
     virtual unsigned shard_of(const token& t) const = 0;
 
+    /**
+     * @return the smallest token handled by given shard. Every shard handles
+     * a contiguous range of tokens, which ends where the next shard's begins.
+     */
+    virtual token token_for_shard(unsigned shard) const = 0;
+
     /**
      * @return bytes that represent the token as required by get_token_validator().
      */
@@ -417,6 +423,9 @@ i_partitioner& global_partitioner();
 
 unsigned shard_of(const token&);
 
+// Returns the range of partitions handled by given shard.
+range<ring_position> shard_range(unsigned shard);
+
 range<ring_position> to_partition_range(range<dht::token>);
 
 } // dht
@@ -204,6 +204,16 @@ murmur3_partitioner::shard_of(const token& t) const {
     assert(0);
 }
 
+token
+murmur3_partitioner::token_for_shard(unsigned shard) const {
+    if (shard == 0) {
+        return minimum_token();
+    }
+    // The smallest adjusted value which shard_of() maps to shard, rounding up.
+    auto adjusted = uint64_t((((unsigned __int128)(shard) << 64) + smp::count - 1) / smp::count);
+    return get_token(adjusted - uint64_t(std::numeric_limits<int64_t>::min()));
+}
+
 using registry = class_registrator<i_partitioner, murmur3_partitioner>;
 static registry registrator("org.apache.cassandra.dht.Murmur3Partitioner");
 static registry registrator_short_name("Murmur3Partitioner");
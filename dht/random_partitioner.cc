@@ -213,6 +213,15 @@ unsigned random_partitioner::shard_of(const token& t) const {
     assert(0);
 }
 
+token random_partitioner::token_for_shard(unsigned shard) const {
+    if (shard == 0) {
+        return minimum_token();
+    }
+    // Computed with unbounded precision, shard * 2^127 doesn't fit in 128 bits.
+    boost::multiprecision::cpp_int start = ((boost::multiprecision::cpp_int(shard) << 127) + smp::count - 1) / smp::count;
+    return cppint_to_token(start.convert_to<boost::multiprecision::uint128_t>());
+}
+
 bytes random_partitioner::token_to_bytes(const token& t) const {
     static const bytes zero_byte(1, int8_t(0x00));
     if (t.is_minimum() || t._data.empty()) {
@@ -43,6 +43,7 @@ class random_partitioner final : public i_partitioner {
     virtual sstring to_sstring(const dht::token& t) const override;
     virtual dht::token from_sstring(const sstring& t) const override;
     virtual unsigned shard_of(const token& t) const override;
+    virtual token token_for_shard(unsigned shard) const override;
 private:
     token get_token(bytes data);
 };
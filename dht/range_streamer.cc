@@ -46,6 +46,7 @@
 #include "streaming/stream_plan.hh"
 #include "streaming/stream_state.hh"
 #include "service/storage_service.hh"
+#include "db/system_keyspace.hh"
 
 namespace dht {
 
@@ -211,6 +212,35 @@ bool range_streamer::use_strict_sources_for_ranges(const sstring& keyspace_name)
            && _metadata.get_all_endpoints().size() != strat.get_replication_factor();
 }
 
+// Splits r in at least parts sub-ranges of about equal size, by repeatedly
+// cutting the parts in two at their midpoints, where possible.
+static std::vector<range<token>> split_range(const range<token>& r, size_t parts) {
+    std::vector<range<token>> ret{r};
+    while (ret.size() < parts) {
+        std::vector<range<token>> next;
+        for (auto& x : ret) {
+            if (!x.start() || !x.end()) {
+                next.push_back(x);
+                continue;
+            }
+            auto& left = x.start()->value();
+            auto& right = x.end()->value();
+            auto mid = dht::global_partitioner().midpoint(left, right);
+            if (mid == left || mid == right) {
+                next.push_back(x);
+                continue;
+            }
+            next.emplace_back(x.start(), range<token>::bound(mid, true));
+            next.emplace_back(range<token>::bound(mid, false), x.end());
+        }
+        if (next.size() == ret.size()) {
+            break;
+        }
+        ret = std::move(next);
+    }
+    return ret;
+}
+
 void range_streamer::add_ranges(const sstring& keyspace_name, std::vector<range<token>> ranges) {
     auto ranges_for_keyspace = use_strict_sources_for_ranges(keyspace_name)
         ? get_all_ranges_with_strict_sources_for(keyspace_name, ranges)
@@ -222,34 +252,159 @@ void range_streamer::add_ranges(const sstring& keyspace_name, std::vector<range<
         }
     }
 
-    std::unordered_map<inet_address, std::vector<range<token>>> range_fetch_map;
-    for (auto& x : get_range_fetch_map(ranges_for_keyspace, _source_filters, keyspace_name)) {
-        range_fetch_map[x.first].emplace_back(x.second);
-    }
+    auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+    for (auto& x : unordered_multimap_to_unordered_map(ranges_for_keyspace)) {
+        const range<token>& range_ = x.first;
+        bool found_source = false;
+        std::unordered_set<inet_address> sources;
+        for (auto address : x.second) {
+            if (address == utils::fb_utilities::get_broadcast_address()) {
+                // If localhost is a source, we have found one, but we don't add it to the sources to avoid streaming locally
+                found_source = true;
+                continue;
+            }
+            auto filtered = std::any_of(_source_filters.begin(), _source_filters.end(), [address] (auto& filter) {
+                return !filter->should_include(address);
+            });
+            if (!filtered) {
+                sources.emplace(address);
+            }
+        }
 
-    if (logger.is_enabled(logging::log_level::debug)) {
-        for (auto& x : range_fetch_map) {
-            logger.debug("{} : range {} from source {} for keyspace {}", _description, x.second, x.first, keyspace_name);
+        if (sources.empty()) {
+            if (!found_source) {
+                throw std::runtime_error(sprint("unable to find sufficient sources for streaming range %s in keyspace %s", range_, keyspace_name));
+            }
+            continue;
+        }
+
+        auto sorted_sources = snitch->get_sorted_list_by_proximity(_address, sources);
+        auto parts = sorted_sources.size() > 1 ? sorted_sources.size() * splits_per_source : 1;
+        for (auto& part : split_range(range_, parts)) {
+            logger.debug("{} : range {} from sources {} for keyspace {}", _description, part, sorted_sources, keyspace_name);
+            _to_fetch.push_back(range_to_fetch{keyspace_name, part, sorted_sources});
         }
     }
-    _to_fetch.emplace(keyspace_name, std::move(range_fetch_map));
 }
 
-future<streaming::stream_state> range_streamer::fetch_async() {
-    for (auto& fetch : _to_fetch) {
-        const auto& keyspace = fetch.first;
-        for (auto& x : fetch.second) {
-            auto& source = x.first;
-            auto& ranges = x.second;
+// Takes the next batch of ranges source can serve. Ranges for which source
+// is the closest replica are taken first, then those of other sources which
+// haven't been started yet. Each source takes at most its fair share of what
+// is left, so that sources still have work to take from slower ones.
+std::vector<range_streamer::range_to_fetch> range_streamer::take_ranges_to_fetch(inet_address source) {
+    auto limit = std::max<size_t>(1, std::min(max_ranges_per_session, _to_fetch.size() / std::max<size_t>(1, _active_sources)));
+    std::vector<range_to_fetch> ret;
+    auto take = [&] (auto&& pred) {
+        for (auto it = _to_fetch.begin(); it != _to_fetch.end() && ret.size() < limit;) {
+            if (pred(*it)) {
+                ret.emplace_back(std::move(*it));
+                it = _to_fetch.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    };
+    take([source] (const range_to_fetch& r) {
+        return r.sources.front() == source;
+    });
+    take([source] (const range_to_fetch& r) {
+        return std::find(r.sources.begin(), r.sources.end(), source) != r.sources.end();
+    });
+    return ret;
+}
+
+future<> range_streamer::fetch_from(inet_address source, std::vector<streaming::session_info>& sessions) {
+    ++_active_sources;
+    return repeat([this, source, &sessions] {
+        auto ranges = take_ranges_to_fetch(source);
+        if (ranges.empty()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        std::map<sstring, std::vector<range<token>>> ranges_per_keyspace;
+        for (auto& r : ranges) {
+            ranges_per_keyspace[r.keyspace].emplace_back(r.range_);
+        }
+        auto plan = make_lw_shared<stream_plan>(_description);
+        for (auto& x : ranges_per_keyspace) {
             /* Send messages to respective folks to stream data over to me */
             if (logger.is_enabled(logging::log_level::debug)) {
-                logger.debug("{}ing from {} ranges {}", _description, source, ranges);
+                logger.debug("{}ing from {} ranges {}", _description, source, x.second);
             }
-            _stream_plan.request_ranges(source, keyspace, ranges);
+            plan->request_ranges(source, x.first, std::move(x.second));
         }
-    }
+        return plan->execute().then_wrapped([this, plan, source, ranges = std::move(ranges), &sessions] (future<stream_state> f) mutable {
+            try {
+                auto state = f.get0();
+                std::move(state.sessions.begin(), state.sessions.end(), std::back_inserter(sessions));
+            } catch (...) {
+                logger.warn("{}ing from {} failed, leaving its ranges to other sources: {}", _description, source, std::current_exception());
+                for (auto& r : ranges) {
+                    r.sources.erase(std::remove(r.sources.begin(), r.sources.end(), source), r.sources.end());
+                    if (r.sources.empty()) {
+                        throw std::runtime_error(sprint("%s of range %s in keyspace %s failed on all sources", _description, r.range_, r.keyspace));
+                    }
+                    _to_fetch.push_back(std::move(r));
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            // Remember what is done, so that a retry of the whole operation
+            // doesn't have to stream it again.
+            return do_with(std::move(ranges), [this] (std::vector<range_to_fetch>& ranges) {
+                return do_for_each(ranges, [this] (range_to_fetch& r) {
+                    return db::system_keyspace::add_streamed_ranges(_description, r.keyspace, {r.range_});
+                });
+            }).then([] {
+                return stop_iteration::no;
+            });
+        });
+    }).finally([this] {
+        --_active_sources;
+    });
+}
+
+// Drops the ranges which an earlier, interrupted, run of the same operation
+// has already fetched.
+future<> range_streamer::skip_streamed_ranges() {
+    return db::system_keyspace::get_streamed_ranges(_description).then([this] (auto streamed) {
+        auto is_streamed = [&streamed] (const range_to_fetch& r) {
+            auto it = streamed.find(r.keyspace);
+            return it != streamed.end() && std::any_of(it->second.begin(), it->second.end(), [&r] (const range<token>& done) {
+                return done.contains(r.range_, dht::tri_compare);
+            });
+        };
+        auto before = _to_fetch.size();
+        _to_fetch.remove_if(is_streamed);
+        if (before != _to_fetch.size()) {
+            logger.info("{}: skipping {} of {} ranges fetched before", _description, before - _to_fetch.size(), before);
+        }
+    });
+}
 
-    return _stream_plan.execute();
+future<streaming::stream_state> range_streamer::fetch_async() {
+    return skip_streamed_ranges().then([this] {
+      return do_with(std::vector<streaming::session_info>(), [this] (std::vector<streaming::session_info>& sessions) {
+        // Ranges given back by a failed source may be left behind by sources
+        // which were done by then, so go on until there is nothing left.
+        return repeat([this, &sessions] {
+            if (_to_fetch.empty()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            std::set<inet_address> sources;
+            for (auto& r : _to_fetch) {
+                sources.insert(r.sources.begin(), r.sources.end());
+            }
+            return parallel_for_each(sources, [this, &sessions] (inet_address source) {
+                return fetch_from(source, sessions);
+            }).then([] {
+                return stop_iteration::no;
+            });
+        }).then([this] {
+            return db::system_keyspace::clear_streamed_ranges(_description);
+        }).then([this, &sessions] {
+            return stream_state(utils::UUID_gen::get_time_UUID(), _description, std::move(sessions));
+        });
+      });
+    });
 }
 
 std::unordered_multimap<inet_address, range<token>>
@@ -48,6 +48,7 @@
 #include <seastar/core/distributed.hh>
 #include <unordered_map>
 #include <memory>
+#include <list>
 
 class database;
 
@@ -106,8 +107,7 @@ class range_streamer {
         , _metadata(tm)
         , _tokens(std::move(tokens))
         , _address(address)
-        , _description(std::move(description))
-        , _stream_plan(_description) {
+        , _description(std::move(description)) {
     }
 
     range_streamer(distributed<database>& db, token_metadata& tm, inet_address address, sstring description)
@@ -159,16 +159,40 @@ class range_streamer {
     }
 #endif
 public:
+    /**
+     * Fetches all added ranges. Every source runs one session at a time and
+     * takes the next batch of ranges it can serve once its previous session
+     * is done, so that faster sources end up serving more of the ranges.
+     * Ranges of a failed session are left to the other sources of the range.
+     */
     future<streaming::stream_state> fetch_async();
+private:
+    // A part of a range to fetch, and the sources to fetch it from, closest first.
+    struct range_to_fetch {
+        sstring keyspace;
+        range<token> range_;
+        std::vector<inet_address> sources;
+    };
+
+    // Ranges with several sources are split into this many parts per source,
+    // so that all of the sources can work on them.
+    static constexpr size_t splits_per_source = 4;
+    // Upper bound on the number of ranges requested in a single session.
+    static constexpr size_t max_ranges_per_session = 32;
+
+    future<> skip_streamed_ranges();
+    std::vector<range_to_fetch> take_ranges_to_fetch(inet_address source);
+    future<> fetch_from(inet_address source, std::vector<streaming::session_info>& sessions);
 private:
     distributed<database>& _db;
     token_metadata& _metadata;
     std::unordered_set<token> _tokens;
     inet_address _address;
     sstring _description;
-    std::unordered_multimap<sstring, std::unordered_map<inet_address, std::vector<range<token>>>> _to_fetch;
+    std::list<range_to_fetch> _to_fetch;
     std::unordered_set<std::unique_ptr<i_source_filter>> _source_filters;
-    stream_plan _stream_plan;
+    // Number of sources currently fetching
+    size_t _active_sources = 0;
 };
 
 } // dht
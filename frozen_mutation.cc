@@ -76,6 +76,17 @@ partition_key frozen_mutation::deserialize_key() const {
     return mv.key();
 }
 
+// Copies the serialized form into a single buffer. Linearizing the stream
+// first would need another allocation of the full size.
+static bytes flatten(const bytes_ostream& out) {
+    bytes b(bytes::initialized_later(), out.size());
+    auto dst = b.begin();
+    for (bytes_view frag : out.fragments()) {
+        dst = std::copy(frag.begin(), frag.end(), dst);
+    }
+    return b;
+}
+
 frozen_mutation::frozen_mutation(bytes&& b)
     : _bytes(std::move(b))
     , _pk(deserialize_key())
@@ -86,6 +97,11 @@ frozen_mutation::frozen_mutation(bytes_view bv, partition_key pk)
     , _pk(std::move(pk))
 { }
 
+frozen_mutation::frozen_mutation(bytes&& b, partition_key pk)
+    : _bytes(std::move(b))
+    , _pk(std::move(pk))
+{ }
+
 frozen_mutation::frozen_mutation(const mutation& m)
     : _pk(m.key())
 {
@@ -100,8 +116,7 @@ frozen_mutation::frozen_mutation(const mutation& m)
                       part_ser.write(std::move(wr));
                   }).end_mutation();
 
-    auto bv = out.linearize();
-    _bytes = bytes(bv.begin(), bv.end()); // FIXME: avoid copy
+    _bytes = flatten(out);
 }
 
 mutation
@@ -168,7 +183,7 @@ frozen_mutation streamed_mutation_freezer::consume_end_of_stream() {
                                                    std::move(_sr), std::move(_rts),
                                                    std::move(_crs), std::move(wr));
                   }).end_mutation();
-    return frozen_mutation(out.linearize(), std::move(_key));
+    return frozen_mutation(flatten(out), std::move(_key));
 }
 
 future<frozen_mutation> freeze(streamed_mutation sm) {
@@ -208,7 +223,7 @@ class fragmenting_mutation_freezer {
         _rts.clear();
         _crs.clear();
         _dirty_size = 0;
-        return _consumer(frozen_mutation(out.linearize(), _key), _fragmented);
+        return _consumer(frozen_mutation(flatten(out), _key), _fragmented);
     }
 
     future<stop_iteration> maybe_flush() {
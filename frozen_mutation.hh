@@ -49,6 +49,7 @@ class frozen_mutation final {
     frozen_mutation(const mutation& m);
     explicit frozen_mutation(bytes&& b);
     frozen_mutation(bytes_view bv, partition_key key);
+    frozen_mutation(bytes&& b, partition_key key);
     frozen_mutation(frozen_mutation&& m) = default;
     frozen_mutation(const frozen_mutation& m) = default;
     frozen_mutation& operator=(frozen_mutation&&) = default;
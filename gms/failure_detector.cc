@@ -43,6 +43,8 @@
 #include "gms/endpoint_state.hh"
 #include "gms/application_state.hh"
 #include "gms/inet_address.hh"
+#include "message/messaging_service.hh"
+#include "utils/fb_utilities.hh"
 #include "log.hh"
 #include <iostream>
 #include <chrono>
@@ -52,6 +54,7 @@ namespace gms {
 static logging::logger logger("failure_detector");
 
 constexpr std::chrono::milliseconds failure_detector::DEFAULT_MAX_PAUSE;
+constexpr std::chrono::milliseconds failure_detector::DEFAULT_HEARTBEAT_INTERVAL;
 
 using clk = arrival_window::clk;
 
@@ -277,6 +280,91 @@ void failure_detector::force_conviction(inet_address ep) {
 
 void failure_detector::remove(inet_address ep) {
     _arrival_samples.erase(ep);
+    _heartbeat_samples.erase(ep);
+}
+
+void failure_detector::start_heartbeats() {
+    if (!_heartbeat_interval.count()) {
+        return;
+    }
+    _heartbeat_timer.set_callback([this] {
+        send_heartbeats();
+        update_suspects();
+        _heartbeat_timer.arm(_heartbeat_interval);
+    });
+    _heartbeat_timer.arm(_heartbeat_interval);
+}
+
+future<> failure_detector::stop_heartbeats() {
+    _heartbeat_timer.cancel();
+    _heartbeat_samples.clear();
+    return get_failure_detector().invoke_on_all([] (failure_detector& fd) {
+        fd._suspects.clear();
+    });
+}
+
+// Sends a heartbeat to every endpoint gossip considers alive, unless the
+// previous one hasn't been answered yet. Replies are recorded as arrivals.
+void failure_detector::send_heartbeats() {
+    auto& gossiper = get_local_gossiper();
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(arrival_window::get_max_interval());
+    for (auto& entry : _arrival_samples) {
+        auto& ep = entry.first;
+        if (ep == utils::fb_utilities::get_broadcast_address() || !gossiper.is_alive(ep)
+                || !_heartbeats_in_flight.insert(ep).second) {
+            continue;
+        }
+        net::messaging_service::msg_addr id{ep, 0};
+        net::get_local_messaging_service().send_fd_heartbeat(id, timeout).then_wrapped([this, ep, fd = shared_from_this()] (future<> f) {
+            _heartbeats_in_flight.erase(ep);
+            try {
+                f.get();
+            } catch (...) {
+                logger.trace("failure_detector: heartbeat to {} failed: {}", ep, std::current_exception());
+                return;
+            }
+            auto it = _heartbeat_samples.find(ep);
+            if (it == _heartbeat_samples.end()) {
+                it = _heartbeat_samples.emplace(ep, arrival_window(HEARTBEAT_SAMPLE_SIZE)).first;
+            }
+            it->second.add(clk::now(), ep);
+        });
+    }
+}
+
+// Marks endpoints whose heartbeats are overdue by the same phi threshold gossip
+// convicts with, and publishes the result to all cpus when it changes.
+void failure_detector::update_suspects() {
+    auto now = clk::now();
+    if (now - _last_paused < get_max_local_pause()) {
+        return;
+    }
+    auto& gossiper = get_local_gossiper();
+    std::set<inet_address> suspects;
+    for (auto it = _heartbeat_samples.begin(); it != _heartbeat_samples.end();) {
+        if (!gossiper.is_alive(it->first)) {
+            // Down endpoints are gossip's business, start over once they're back.
+            it = _heartbeat_samples.erase(it);
+            continue;
+        }
+        if (PHI_FACTOR * it->second.phi(now) > get_phi_convict_threshold()) {
+            suspects.insert(it->first);
+        }
+        ++it;
+    }
+    if (suspects == _suspects) {
+        return;
+    }
+    for (auto& ep : suspects) {
+        if (!_suspects.count(ep)) {
+            logger.debug("failure_detector: {} stopped answering heartbeats, marking it suspect", ep);
+        }
+    }
+    get_failure_detector().invoke_on_all([suspects = std::move(suspects)] (failure_detector& fd) {
+        fd._suspects = suspects;
+    }).handle_exception([] (std::exception_ptr ep) {
+        logger.warn("failure_detector: failed to update suspect endpoints: {}", ep);
+    });
 }
 
 void failure_detector::register_failure_detection_event_listener(i_failure_detection_event_listener* listener) {
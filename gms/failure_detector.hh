@@ -42,12 +42,14 @@
 #include "core/sstring.hh"
 #include "core/shared_ptr.hh"
 #include "core/distributed.hh"
+#include "core/timer.hh"
 #include "utils/bounded_stats_deque.hh"
 #include "gms/i_failure_detector.hh"
 #include <iostream>
 #include <cmath>
 #include <list>
 #include <map>
+#include <set>
 #include <experimental/optional>
 
 
@@ -129,10 +131,30 @@ class failure_detector : public i_failure_detector, public seastar::async_sharde
     std::experimental::optional<arrival_window::clk::time_point> _last_interpret;
     arrival_window::clk::time_point _last_paused;
 
+    // Gossip runs once a second, so it takes several seconds of silence for
+    // phi to convict a node. Internode heartbeats, sent much more often, let
+    // us notice that a node stopped responding earlier, and mark it suspect
+    // so that reads avoid it until gossip decides whether it is down.
+    static constexpr int HEARTBEAT_SAMPLE_SIZE = 100;
+    static constexpr std::chrono::milliseconds DEFAULT_HEARTBEAT_INTERVAL{250};
+
+    std::chrono::milliseconds _heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
+    timer<> _heartbeat_timer;
+    // Tracked on cpu 0 only.
+    std::map<inet_address, arrival_window> _heartbeat_samples;
+    std::set<inet_address> _heartbeats_in_flight;
+    // Replicated to all cpus.
+    std::set<inet_address> _suspects;
+
+    void send_heartbeats();
+    void update_suspects();
+
 public:
     failure_detector() = default;
 
-    failure_detector(double phi) : _phi(phi) {
+    failure_detector(double phi, std::chrono::milliseconds heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL)
+        : _phi(phi)
+        , _heartbeat_interval(heartbeat_interval) {
     }
 
     future<> stop() {
@@ -184,6 +206,17 @@ class failure_detector : public i_failure_detector, public seastar::async_sharde
 
     bool is_alive(inet_address ep);
 
+    // Whether ep is alive as far as gossip knows, but stopped answering
+    // heartbeats. Can be called on any cpu.
+    bool is_suspect(inet_address ep) const {
+        return _suspects.count(ep);
+    }
+
+    // Starts and stops sending heartbeats to live endpoints. Must be called
+    // on cpu 0, together with starting and stopping gossip.
+    void start_heartbeats();
+    future<> stop_heartbeats();
+
     void report(inet_address ep);
 
     void interpret(inet_address ep);
@@ -64,11 +64,19 @@ class gossip_digest_ack {
         , _map(std::move(m)) {
     }
 
-    std::vector<gossip_digest> get_gossip_digest_list() const {
+    std::vector<gossip_digest>& get_gossip_digest_list() {
         return _digests;
     }
 
-    std::map<inet_address, endpoint_state> get_endpoint_state_map() const {
+    const std::vector<gossip_digest>& get_gossip_digest_list() const {
+        return _digests;
+    }
+
+    std::map<inet_address, endpoint_state>& get_endpoint_state_map() {
+        return _map;
+    }
+
+    const std::map<inet_address, endpoint_state>& get_endpoint_state_map() const {
         return _map;
     }
 
@@ -80,7 +80,11 @@ class gossip_digest_syn {
         return partioner();
     }
 
-    std::vector<gossip_digest> get_gossip_digests() const {
+    std::vector<gossip_digest>& get_gossip_digests() {
+        return _digests;
+    }
+
+    const std::vector<gossip_digest>& get_gossip_digests() const {
         return _digests;
     }
 
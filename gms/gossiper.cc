@@ -132,7 +132,7 @@ void gossiper::set_last_processed_message_at(clk::time_point tp) {
 void gossiper::do_sort(std::vector<gossip_digest>& g_digest_list) {
     /* Construct a map of endpoint to GossipDigest. */
     std::map<inet_address, gossip_digest> ep_to_digest_map;
-    for (auto g_digest : g_digest_list) {
+    for (auto& g_digest : g_digest_list) {
         ep_to_digest_map.emplace(g_digest.get_endpoint(), g_digest);
     }
 
@@ -141,7 +141,8 @@ void gossiper::do_sort(std::vector<gossip_digest>& g_digest_list) {
      * of the local EndpointState and the version found in the GossipDigest.
     */
     std::vector<gossip_digest> diff_digests;
-    for (auto g_digest : g_digest_list) {
+    diff_digests.reserve(g_digest_list.size());
+    for (auto& g_digest : g_digest_list) {
         auto ep = g_digest.get_endpoint();
         auto ep_state = this->get_endpoint_state_for_endpoint(ep);
         int version = ep_state ? this->get_max_endpoint_state_version(*ep_state) : 0;
@@ -180,7 +181,7 @@ future<> gossiper::handle_syn_msg(msg_addr from, gossip_digest_syn syn_msg) {
         return make_ready_future<>();
     }
 
-    auto g_digest_list = syn_msg.get_gossip_digests();
+    auto& g_digest_list = syn_msg.get_gossip_digests();
     do_sort(g_digest_list);
     std::vector<gossip_digest> delta_gossip_digest_list;
     std::map<inet_address, endpoint_state> delta_ep_state_map;
@@ -201,14 +202,14 @@ future<> gossiper::handle_ack_msg(msg_addr id, gossip_digest_ack ack_msg) {
         return make_ready_future<>();
     }
 
-    auto g_digest_list = ack_msg.get_gossip_digest_list();
-    auto ep_state_map = ack_msg.get_endpoint_state_map();
+    auto g_digest_list = std::move(ack_msg.get_gossip_digest_list());
+    auto& ep_state_map = ack_msg.get_endpoint_state_map();
 
     auto f = make_ready_future<>();
     if (ep_state_map.size() > 0) {
         /* Notify the Failure Detector */
         this->notify_failure_detector(ep_state_map);
-        f = this->apply_state_locally(ep_state_map);
+        f = this->apply_state_locally(std::move(ep_state_map));
     }
 
     return f.then([id, g_digest_list = std::move(g_digest_list), this] {
@@ -219,7 +220,7 @@ future<> gossiper::handle_ack_msg(msg_addr id, gossip_digest_ack ack_msg) {
         }
         /* Get the state required to send to this gossipee - construct GossipDigestAck2Message */
         std::map<inet_address, endpoint_state> delta_ep_state_map;
-        for (auto g_digest : g_digest_list) {
+        for (auto& g_digest : g_digest_list) {
             inet_address addr = g_digest.get_endpoint();
             auto local_ep_state_ptr = this->get_state_for_version_bigger_than(addr, g_digest.get_max_version());
             if (local_ep_state_ptr) {
@@ -248,7 +249,7 @@ future<> gossiper::handle_ack2_msg(gossip_digest_ack2 msg) {
     auto& remote_ep_state_map = msg.get_endpoint_state_map();
     /* Notify the Failure Detector */
     notify_failure_detector(remote_ep_state_map);
-    return apply_state_locally(remote_ep_state_map);
+    return apply_state_locally(std::move(remote_ep_state_map));
 }
 
 future<> gossiper::handle_echo_msg() {
@@ -305,6 +306,9 @@ void gossiper::init_messaging_service_handler() {
             return gms::get_local_gossiper().handle_echo_msg();
         });
     });
+    ms().register_fd_heartbeat([] {
+        return make_ready_future<>();
+    });
     ms().register_gossip_shutdown([] (inet_address from) {
         smp::submit_to(0, [from] {
             return gms::get_local_gossiper().handle_shutdown_msg(from);
@@ -321,6 +325,7 @@ void gossiper::init_messaging_service_handler() {
 void gossiper::uninit_messaging_service_handler() {
     auto& ms = net::get_local_messaging_service();
     ms.unregister_gossip_echo();
+    ms.unregister_fd_heartbeat();
     ms.unregister_gossip_shutdown();
     ms.unregister_gossip_digest_syn();
     ms.unregister_gossip_digest_ack();
@@ -350,7 +355,7 @@ future<> gossiper::send_gossip(gossip_digest_syn message, std::set<inet_address>
 }
 
 
-void gossiper::notify_failure_detector(inet_address endpoint, endpoint_state remote_endpoint_state) {
+void gossiper::notify_failure_detector(inet_address endpoint, const endpoint_state& remote_endpoint_state) {
     /*
      * If the local endpoint state exists then report to the FD only
      * if the versions workout.
@@ -385,9 +390,12 @@ void gossiper::notify_failure_detector(inet_address endpoint, endpoint_state rem
     }
 }
 
-future<> gossiper::apply_state_locally(const std::map<inet_address, endpoint_state>& map) {
-    return seastar::async([this, g = this->shared_from_this(), map] () mutable {
+future<> gossiper::apply_state_locally(std::map<inet_address, endpoint_state> map) {
+    return seastar::async([this, g = this->shared_from_this(), map = std::move(map)] () mutable {
         for (auto& entry : map) {
+            if (seastar::thread::should_yield()) {
+                seastar::thread::yield();
+            }
             const auto& ep = entry.first;
             if (ep == get_broadcast_address() && !is_in_shadow_round()) {
                 continue;
@@ -1101,7 +1109,7 @@ int gossiper::compare_endpoint_startup(inet_address addr1, inet_address addr2) {
     return ep1->get_heart_beat_state().get_generation() - ep2->get_heart_beat_state().get_generation();
 }
 
-void gossiper::notify_failure_detector(std::map<inet_address, endpoint_state> remoteEpStateMap) {
+void gossiper::notify_failure_detector(const std::map<inet_address, endpoint_state>& remoteEpStateMap) {
     for (auto& entry : remoteEpStateMap) {
         notify_failure_detector(entry.first, entry.second);
     }
@@ -1378,6 +1386,7 @@ future<> gossiper::start_gossiping(int generation_nbr, std::map<application_stat
             _enabled = true;
             _nr_run = 0;
             _scheduled_gossip_task.arm(INTERVAL);
+            get_local_failure_detector().start_heartbeats();
             return make_ready_future<>();
         });
     });
@@ -1520,6 +1529,7 @@ future<> gossiper::do_stop_gossiping() {
             logger.warn("No local state or state is in silent shutdown, not announcing shutdown");
         }
         _scheduled_gossip_task.cancel();
+        get_local_failure_detector().stop_heartbeats().get();
         timer_callback_lock().get();
         //
         // Release the timer semaphore since storage_proxy may be waiting for
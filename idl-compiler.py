@@ -282,6 +282,37 @@ def get_members(cls):
 
 def is_final(cls):
     return "final" in cls
+
+def is_trivially_serializable(cls):
+    return "attribute" in cls and cls["attribute"][0][0] == "trivially_serializable"
+
+def add_trivially_serializable(cls, hout, cout, name):
+    if not is_final(cls) or "template" in cls:
+        raise Exception("[[trivially_serializable]] class " + name + " must be final and not a template")
+    members = get_members(cls)
+    types = [param_type(m["type"]) for m in members]
+    if config.ns != '':
+        fprintln(hout, "namespace ", config.ns, " {")
+    fprintln(hout, Template("""
+template <>
+struct is_trivially_serializable<$name> : std::true_type {};
+""").substitute({'name' : name}))
+    if config.ns != '':
+        fprintln(hout, "}")
+    fprintln(cout, Template("""
+static_assert(std::is_trivially_copyable<$name>::value, "$name is [[trivially_serializable]] so it must be trivially copyable");
+static_assert(sizeof($name) == $size, "$name is [[trivially_serializable]] so it must consist of its serialized members only");""").substitute(
+        {'name' : name, 'size' : " + ".join("sizeof(%s)" % t for t in types)}))
+    offset = []
+    for m, t in zip(members, types):
+        fprintln(cout, Template("""static_assert(is_trivially_serializable<$type>::value, "members of [[trivially_serializable]] $name must be trivially serializable");""").substitute(
+            {'name' : name, 'type' : t}))
+        # Getters hide the layout, so the order of members can only be verified for data members.
+        if not m["name"].endswith("()"):
+            fprintln(cout, Template("""static_assert(offsetof($name, $member) == $offset, "members of [[trivially_serializable]] $name must be laid out in IDL order");""").substitute(
+                {'name' : name, 'member' : m["name"], 'offset' : " + ".join(offset) if offset else "0"}))
+        offset.append("sizeof(%s)" % t)
+
 def get_variant_type(lst):
     if is_variant(lst):
         return "variant"
@@ -849,6 +880,8 @@ def handle_class(cls, hout, cout, namespaces=[], parent_template_param = []):
         elif is_enum(param):
             handle_enum(param, hout, cout, namespaces + [cls["name"] + template_class_param], parent_template_param + template_param_list)
     declear_methods(hout, name + template_class_param, temp_def)
+    if is_trivially_serializable(cls):
+        add_trivially_serializable(cls, hout, cout, name)
     is_final = "final" in cls
 
     fprintln(cout, Template("""
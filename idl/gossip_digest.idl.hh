@@ -38,7 +38,7 @@ enum class application_state:int {
         SUPPORTED_FEATURES
 };
 
-class inet_address final {
+class inet_address final [[trivially_serializable]] {
   uint32_t raw_addr();
 };
 
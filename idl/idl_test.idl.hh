@@ -26,6 +26,12 @@ class simple_compound {
     uint32_t bar;
 };
 
+struct trivially_serializable_compound final [[trivially_serializable]] {
+    uint32_t foo;
+    uint32_t bar;
+    uint64_t baz;
+};
+
 class writable_final_simple_compound final stub [[writable]] {
     uint32_t foo;
     uint32_t bar;
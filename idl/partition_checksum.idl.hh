@@ -22,6 +22,7 @@
 enum class repair_checksum : uint8_t {
     legacy = 0,
     streamed = 1,
+    murmur3 = 2,
 };
 
 class partition_checksum {
@@ -30,6 +30,19 @@ class specific_ranges {
     std::vector<range<clustering_key_prefix>> ranges();
 };
 
+struct column_filter {
+    enum class op : uint8_t {
+        eq,
+        lt,
+        lte,
+        gt,
+        gte,
+    };
+    uint32_t column;
+    query::column_filter::op type;
+    bytes value;
+};
+
 class partition_slice {
     std::vector<range<clustering_key_prefix>> default_row_ranges();
     std::vector<uint32_t> static_columns;
@@ -38,6 +51,12 @@ class partition_slice {
     std::unique_ptr<query::specific_ranges> get_specific_ranges();
     cql_serialization_format cql_format();
     uint32_t partition_row_limit() [[version 1.3]] = std::numeric_limits<uint32_t>::max();
+    std::vector<query::column_filter> filters() [[version 1.4]];
+};
+
+struct index_restriction {
+    uint32_t column;
+    bytes value;
 };
 
 class read_command {
@@ -48,6 +67,8 @@ class read_command {
     std::chrono::time_point<gc_clock, gc_clock::duration> timestamp;
     std::experimental::optional<tracing::trace_info> trace_info [[version 1.3]];
     uint32_t partition_limit [[version 1.3]] = std::numeric_limits<uint32_t>::max();
+    std::experimental::optional<query::index_restriction> index [[version 1.4]];
+    uint64_t max_result_size [[version 1.5]] = std::numeric_limits<uint64_t>::max();
 };
 
 }
@@ -27,4 +27,5 @@ class partition {
 class reconcilable_result {
     uint32_t row_count();
     std::vector<partition> partitions();
+    bool is_short_read() [[version 1.5]] = false;
 };
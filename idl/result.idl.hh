@@ -21,6 +21,12 @@
 
 namespace query {
 
+enum class digest_algorithm : uint8_t {
+    none = 0,
+    MD5 = 1,
+    murmur3 = 2,
+};
+
 class result_digest final {
     std::array<uint8_t, 16> get();
 };
@@ -29,6 +35,8 @@ class result {
     bytes_ostream buf();
     std::experimental::optional<query::result_digest> digest();
     api::timestamp_type last_modified() [ [version 1.2] ] = api::missing_timestamp;
+    std::experimental::optional<uint32_t> row_count() [[version 1.4]];
+    bool is_short_read() [[version 1.5]] = false;
 };
 
 }
@@ -20,7 +20,7 @@
  */
 
 namespace utils {
-class UUID final {
+class UUID final [[trivially_serializable]] {
     int64_t get_most_significant_bits();
     int64_t get_least_significant_bits();
 };
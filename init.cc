@@ -46,14 +46,17 @@ void init_ms_fd_gossiper(sstring listen_address
                 , sstring ms_cert
                 , sstring ms_key
                 , sstring ms_compress
+                , bool inter_dc_tcp_nodelay
                 , db::seed_provider_type seed_provider
                 , sstring cluster_name
-                , double phi)
+                , double phi
+                , std::chrono::milliseconds fd_heartbeat_interval)
 {
     const gms::inet_address listen(listen_address);
 
     using encrypt_what = net::messaging_service::encrypt_what;
     using compress_what = net::messaging_service::compress_what;
+    using tcp_nodelay_what = net::messaging_service::tcp_nodelay_what;
     using namespace seastar::tls;
 
     encrypt_what ew = encrypt_what::none;
@@ -72,6 +75,8 @@ void init_ms_fd_gossiper(sstring listen_address
         cw = compress_what::dc;
     }
 
+    tcp_nodelay_what tndw = inter_dc_tcp_nodelay ? tcp_nodelay_what::all : tcp_nodelay_what::local;
+
     future<> f = make_ready_future<>();
     std::shared_ptr<credentials_builder> creds;
 
@@ -90,12 +95,12 @@ void init_ms_fd_gossiper(sstring listen_address
     // Init messaging_service
     // Delay listening messaging_service until gossip message handlers are registered
     bool listen_now = false;
-    net::get_messaging_service().start(listen, storage_port, ew, cw, ssl_storage_port, creds, listen_now).get();
+    net::get_messaging_service().start(listen, storage_port, ew, cw, tndw, ssl_storage_port, creds, listen_now).get();
 
     // #293 - do not stop anything
     //engine().at_exit([] { return net::get_messaging_service().stop(); });
     // Init failure_detector
-    gms::get_failure_detector().start(std::move(phi)).get();
+    gms::get_failure_detector().start(std::move(phi), fd_heartbeat_interval).get();
     // #293 - do not stop anything
     //engine().at_exit([]{ return gms::get_failure_detector().stop(); });
     // Init gossiper
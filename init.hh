@@ -35,6 +35,8 @@ void init_ms_fd_gossiper(sstring listen_address
                 , sstring ms_cert
                 , sstring ms_key
                 , sstring ms_compress
+                , bool inter_dc_tcp_nodelay
                 , db::seed_provider_type seed_provider
                 , sstring cluster_name = "Test Cluster"
-                , double phi = 8);
+                , double phi = 8
+                , std::chrono::milliseconds fd_heartbeat_interval = std::chrono::milliseconds(250));
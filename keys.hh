@@ -101,6 +101,11 @@ class compound_view_wrapper {
         return get_compound_type(s)->equal(representation(), other.representation());
     }
 
+    // See compound_type::abbreviate().
+    uint64_t abbreviate(const schema& s) const {
+        return get_compound_type(s)->abbreviate(representation());
+    }
+
     // begin() and end() return iterators over components of this compound. The iterator yields a bytes_view to the component.
     // The iterators satisfy InputIterator concept.
     auto begin() const {
@@ -286,6 +291,11 @@ class compound_wrapper {
         return _bytes;
     }
 
+    // See compound_type::abbreviate().
+    uint64_t abbreviate(const schema& s) const {
+        return get_compound_type(s)->abbreviate(representation());
+    }
+
     // begin() and end() return iterators over components of this compound. The iterator yields a bytes_view to the component.
     // The iterators satisfy InputIterator concept.
     auto begin(const schema& s) const {
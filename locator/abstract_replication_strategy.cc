@@ -83,19 +83,16 @@ void abstract_replication_strategy::validate_replication_strategy(const sstring&
 }
 
 std::vector<inet_address> abstract_replication_strategy::get_natural_endpoints(const token& search_token) {
-    const token& key_token = _token_metadata.first_token(search_token);
     auto& cached_endpoints = get_cached_endpoints();
-    auto res = cached_endpoints.find(key_token);
+    auto& res = cached_endpoints[_token_metadata.first_token_index(search_token)];
 
-    if (res == cached_endpoints.end()) {
-        auto endpoints = calculate_natural_endpoints(search_token, _token_metadata);
-        cached_endpoints.emplace(key_token, endpoints);
-
-        return std::move(endpoints);
+    if (!res) {
+        res = calculate_natural_endpoints(search_token, _token_metadata);
+        return *res;
     }
 
     ++_cache_hits_count;
-    return res->second;
+    return *res;
 }
 
 void abstract_replication_strategy::validate_replication_factor(sstring rf) const
@@ -111,10 +108,12 @@ void abstract_replication_strategy::validate_replication_factor(sstring rf) cons
     }
 }
 
-inline std::unordered_map<token, std::vector<inet_address>>&
+inline std::vector<std::experimental::optional<std::vector<inet_address>>>&
 abstract_replication_strategy::get_cached_endpoints() {
-    if (_last_invalidated_ring_version != _token_metadata.get_ring_version()) {
+    auto ring_size = _token_metadata.sorted_tokens().size();
+    if (_last_invalidated_ring_version != _token_metadata.get_ring_version() || _cached_endpoints.size() != ring_size) {
         _cached_endpoints.clear();
+        _cached_endpoints.resize(ring_size);
         _last_invalidated_ring_version = _token_metadata.get_ring_version();
     }
 
@@ -180,6 +179,37 @@ abstract_replication_strategy::get_address_ranges(token_metadata& tm) const {
     return ret;
 }
 
+std::vector<range<token>>
+abstract_replication_strategy::get_address_ranges(token_metadata& tm, inet_address endpoint) const {
+    std::vector<range<token>> ret;
+    auto& tokens = tm.sorted_tokens();
+    // Ends of the ranges already examined, a walk reaching one of them
+    // continues where another walk has already been.
+    std::unordered_set<token> visited;
+    for (auto& t : tm.get_tokens(endpoint)) {
+        auto it = std::lower_bound(tokens.begin(), tokens.end(), t);
+        while (visited.insert(*it).second) {
+            auto eps = calculate_natural_endpoints(*it, tm);
+            if (std::find(eps.begin(), eps.end(), endpoint) == eps.end()) {
+                break;
+            }
+            range<token> r = tm.get_primary_range_for(*it);
+            if (r.is_wrap_around(dht::token_comparator())) {
+                auto split_ranges = r.unwrap();
+                ret.emplace_back(std::move(split_ranges.first));
+                ret.emplace_back(std::move(split_ranges.second));
+            } else {
+                ret.emplace_back(std::move(r));
+            }
+            if (it == tokens.begin()) {
+                it = tokens.end();
+            }
+            --it;
+        }
+    }
+    return ret;
+}
+
 std::unordered_multimap<range<token>, inet_address>
 abstract_replication_strategy::get_range_addresses(token_metadata& tm) const {
     std::unordered_multimap<range<token>, inet_address> ret;
@@ -209,15 +239,9 @@ abstract_replication_strategy::get_pending_address_ranges(token_metadata& tm, to
 
 std::vector<range<token>>
 abstract_replication_strategy::get_pending_address_ranges(token_metadata& tm, std::unordered_set<token> pending_tokens, inet_address pending_address) {
-    std::vector<range<token>> ret;
     auto temp = tm.clone_only_token_map();
     temp.update_normal_tokens(pending_tokens, pending_address);
-    for (auto& x : get_address_ranges(temp)) {
-        if (x.first == pending_address) {
-            ret.push_back(x.second);
-        }
-    }
-    return ret;
+    return get_address_ranges(temp, pending_address);
 }
 
 } // namespace locator
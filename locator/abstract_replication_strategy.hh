@@ -47,12 +47,16 @@ enum class replication_strategy_type {
 class abstract_replication_strategy {
 private:
     long _last_invalidated_ring_version = 0;
-    std::unordered_map<token, std::vector<inet_address>> _cached_endpoints;
+    // Natural endpoints of each vnode, in the order of the ring's sorted
+    // tokens: entry i is for the range ending at sorted_tokens()[i], so a
+    // lookup is a binary search in sorted_tokens(). Entries are computed on
+    // first use, and all of them are dropped when the ring changes.
+    std::vector<std::experimental::optional<std::vector<inet_address>>> _cached_endpoints;
     uint64_t _cache_hits_count = 0;
 
     static logging::logger logger;
 
-    std::unordered_map<token, std::vector<inet_address>>&
+    std::vector<std::experimental::optional<std::vector<inet_address>>>&
     get_cached_endpoints();
 protected:
     sstring _ks_name;
@@ -116,6 +120,15 @@ class abstract_replication_strategy {
 
     std::unordered_multimap<inet_address, range<token>> get_address_ranges(token_metadata& tm) const;
 
+    // Returns the ranges the given endpoint replicates in tm, the same as
+    // get_address_ranges(tm) filtered on the endpoint. Only the ranges which
+    // precede the endpoint's tokens are examined, walking the ring backwards
+    // from each token until a range the endpoint doesn't replicate. This
+    // relies on replicas being picked walking the ring forward, so that an
+    // endpoint which doesn't replicate a range doesn't replicate any range
+    // before it, up to the previous token it owns.
+    std::vector<range<token>> get_address_ranges(token_metadata& tm, inet_address endpoint) const;
+
     std::unordered_multimap<range<token>, inet_address> get_range_addresses(token_metadata& tm) const;
 
     std::vector<range<token>> get_pending_address_ranges(token_metadata& tm, token pending_token, inet_address pending_address);
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "locator/dynamic_snitch.hh"
+#include "locator/snitch_base.hh"
+#include <algorithm>
+
+namespace locator {
+
+distributed<dynamic_snitch> _the_dynamic_snitch;
+
+dynamic_snitch::dynamic_snitch(double badness_threshold, std::chrono::milliseconds update_interval, std::chrono::milliseconds reset_interval)
+    : _badness_threshold(badness_threshold)
+    , _update_interval(update_interval)
+    , _reset_interval(reset_interval)
+{
+    _update_timer.set_callback([this] { update_scores(); });
+    _reset_timer.set_callback([this] { _latencies.clear(); });
+}
+
+void dynamic_snitch::start() {
+    if (_update_interval.count()) {
+        _update_timer.arm_periodic(_update_interval);
+    }
+    if (_reset_interval.count()) {
+        _reset_timer.arm_periodic(_reset_interval);
+    }
+}
+
+future<> dynamic_snitch::stop() {
+    _update_timer.cancel();
+    _reset_timer.cancel();
+    return make_ready_future<>();
+}
+
+void dynamic_snitch::receive_timing(inet_address ep, clock_type::duration latency) {
+    double sample = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    auto i = _latencies.find(ep);
+    if (i == _latencies.end()) {
+        _latencies.emplace(ep, sample);
+    } else {
+        i->second = alpha * sample + (1 - alpha) * i->second;
+    }
+}
+
+void dynamic_snitch::update_scores() {
+    _scores.clear();
+    double max_latency = 0;
+    for (auto&& l : _latencies) {
+        max_latency = std::max(max_latency, l.second);
+    }
+    if (max_latency == 0) {
+        return;
+    }
+    for (auto&& l : _latencies) {
+        _scores.emplace(l.first, l.second / max_latency);
+    }
+}
+
+double dynamic_snitch::score(inet_address ep) const {
+    auto i = _scores.find(ep);
+    return i == _scores.end() ? 0 : i->second;
+}
+
+void dynamic_snitch::sort_by_score(std::vector<inet_address>& addresses) const {
+    // Stable, so that endpoints with equal scores keep the static order.
+    std::stable_sort(addresses.begin(), addresses.end(), [this] (inet_address a1, inet_address a2) {
+        return score(a1) < score(a2);
+    });
+}
+
+void dynamic_snitch::sort_by_proximity(inet_address address, std::vector<inet_address>& addresses) {
+    i_endpoint_snitch::get_local_snitch_ptr()->sort_by_proximity(address, addresses);
+    if (_scores.empty() || addresses.size() < 2) {
+        return;
+    }
+    if (_badness_threshold == 0) {
+        sort_by_score(addresses);
+        return;
+    }
+    std::vector<double> static_order_scores;
+    static_order_scores.reserve(addresses.size());
+    for (auto&& ep : addresses) {
+        static_order_scores.push_back(score(ep));
+    }
+    auto sorted_scores = static_order_scores;
+    std::sort(sorted_scores.begin(), sorted_scores.end());
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (static_order_scores[i] > sorted_scores[i] * (1 + _badness_threshold)) {
+            sort_by_score(addresses);
+            return;
+        }
+    }
+}
+
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <seastar/core/timer.hh>
+#include <seastar/core/distributed.hh>
+#include "gms/inet_address.hh"
+
+namespace locator {
+
+/**
+ * Reorders replicas sorted by the static snitch according to how fast they
+ * have been answering reads recently, so that a replica which is slow at
+ * the moment (GC pause, compaction, bad disk) stops getting its share of
+ * the reads.
+ *
+ * storage_proxy reports the latency of every read request through
+ * receive_timing(), which is kept as an exponentially weighted moving
+ * average per endpoint. Every update interval the averages are turned into
+ * scores, the average divided by the highest average, so 1 is the slowest
+ * endpoint. The averages are forgotten every reset interval, so that a bad
+ * endpoint gets a chance to recover.
+ *
+ * Each shard keeps its own scores, from the reads it coordinates.
+ */
+class dynamic_snitch {
+public:
+    using inet_address = gms::inet_address;
+    using clock_type = std::chrono::steady_clock;
+private:
+    // Weight of a new sample in the moving average.
+    static constexpr double alpha = 0.25;
+
+    double _badness_threshold;
+    std::chrono::milliseconds _update_interval;
+    std::chrono::milliseconds _reset_interval;
+    std::unordered_map<inet_address, double> _latencies;
+    std::unordered_map<inet_address, double> _scores;
+    timer<> _update_timer;
+    timer<> _reset_timer;
+private:
+    void update_scores();
+    double score(inet_address ep) const;
+    void sort_by_score(std::vector<inet_address>& addresses) const;
+public:
+    dynamic_snitch(double badness_threshold, std::chrono::milliseconds update_interval, std::chrono::milliseconds reset_interval);
+
+    void start();
+    future<> stop();
+
+    void receive_timing(inet_address ep, clock_type::duration latency);
+
+    // Sorts addresses by proximity to address according to the static
+    // snitch, then reorders them by score if the static order has an
+    // endpoint scoring worse than badness_threshold times the one which
+    // would be in its place when sorted by score. A threshold of 0 always
+    // sorts by score.
+    void sort_by_proximity(inet_address address, std::vector<inet_address>& addresses);
+
+    const std::unordered_map<inet_address, double>& get_scores() const {
+        return _scores;
+    }
+};
+
+extern distributed<dynamic_snitch> _the_dynamic_snitch;
+
+inline distributed<dynamic_snitch>& get_dynamic_snitch() {
+    return _the_dynamic_snitch;
+}
+
+inline dynamic_snitch& get_local_dynamic_snitch() {
+    return _the_dynamic_snitch.local();
+}
+
+}
@@ -25,6 +25,8 @@
 #include "locator/snitch_base.hh"
 #include "locator/abstract_replication_strategy.hh"
 #include "log.hh"
+#include "core/thread.hh"
+#include "utils/stall_detector.hh"
 #include <unordered_map>
 #include <algorithm>
 #include <boost/icl/interval.hpp>
@@ -103,6 +105,7 @@ void token_metadata::update_normal_tokens(std::unordered_map<inet_address, std::
         return;
     }
 
+    utils::stall_scope stall(utils::stall_subsystem::token_metadata);
     bool should_sort_tokens = false;
     for (auto&& i : endpoint_tokens) {
         inet_address endpoint = i.first;
@@ -415,6 +418,14 @@ token_metadata::get_pending_ranges(sstring keyspace_name, inet_address endpoint)
     return ret;
 }
 
+static void maybe_yield(utils::stall_scope& stall) {
+    if (seastar::thread::should_yield()) {
+        stall.pause();
+        seastar::thread::yield();
+        stall.resume();
+    }
+}
+
 void token_metadata::calculate_pending_ranges(abstract_replication_strategy& strategy, const sstring& keyspace_name) {
     std::unordered_multimap<range<token>, inet_address> new_pending_ranges;
 
@@ -424,23 +435,27 @@ void token_metadata::calculate_pending_ranges(abstract_replication_strategy& str
         return;
     }
 
-    std::unordered_multimap<inet_address, range<token>> address_ranges = strategy.get_address_ranges(*this);
+    utils::stall_scope stall(utils::stall_subsystem::token_metadata);
+    // We yield below, so work on a snapshot of the topology rather than on
+    // members which may change in the meantime.
+    auto bootstrap_tokens = _bootstrap_tokens;
+    auto leaving_endpoints = _leaving_endpoints;
+    auto moving_endpoints = _moving_endpoints;
+    auto metadata = clone_only_token_map(); // don't do this in the loop! #7758
 
-    // FIMXE
     // Copy of metadata reflecting the situation after all leave operations are finished.
     auto all_left_metadata = clone_after_all_left();
 
     // get all ranges that will be affected by leaving nodes
     std::unordered_set<range<token>> affected_ranges;
-    for (auto endpoint : _leaving_endpoints) {
-        auto r = address_ranges.equal_range(endpoint);
-        for (auto x = r.first; x != r.second; x++) {
-            affected_ranges.emplace(x->second);
+    for (auto endpoint : leaving_endpoints) {
+        for (auto& r : strategy.get_address_ranges(metadata, endpoint)) {
+            affected_ranges.emplace(std::move(r));
         }
+        maybe_yield(stall);
     }
     // for each of those ranges, find what new nodes will be responsible for the range when
     // all leaving nodes are gone.
-    auto metadata = clone_only_token_map(); // don't do this in the loop! #7758
     for (const auto& r : affected_ranges) {
         auto t = r.end() ? r.end()->value() : dht::maximum_token();
         auto current_endpoints = strategy.calculate_natural_endpoints(t, metadata);
@@ -453,35 +468,28 @@ void token_metadata::calculate_pending_ranges(abstract_replication_strategy& str
         for (auto& ep : diff) {
             new_pending_ranges.emplace(r, ep);
         }
+        maybe_yield(stall);
     }
 
     // At this stage newPendingRanges has been updated according to leave operations. We can
     // now continue the calculation by checking bootstrapping nodes.
 
     // For each of the bootstrapping nodes, simply add and remove them one by one to
-    // allLeftMetadata and check in between what their ranges would be.
-    std::unordered_multimap<inet_address, token> bootstrap_addresses;
-    for (auto& x : _bootstrap_tokens) {
-        bootstrap_addresses.emplace(x.second, x.first);
+    // allLeftMetadata and check in between what their ranges would be. Only the ranges
+    // next to the tokens of the node can change, so only those are looked at.
+    std::unordered_map<inet_address, std::unordered_set<token>> bootstrap_addresses;
+    for (auto& x : bootstrap_tokens) {
+        bootstrap_addresses[x.second].insert(x.first);
     }
-
-    // TODO: share code with unordered_multimap_to_unordered_map
-    std::unordered_map<inet_address, std::unordered_set<token>> tmp;
     for (auto& x : bootstrap_addresses) {
-        auto& addr = x.first;
-        auto& t = x.second;
-        tmp[addr].insert(t);
-    }
-    for (auto& x : tmp) {
         auto& endpoint = x.first;
         auto& tokens = x.second;
         all_left_metadata.update_normal_tokens(tokens, endpoint);
-        for (auto& x : strategy.get_address_ranges(all_left_metadata)) {
-            if (x.first == endpoint) {
-                new_pending_ranges.emplace(x.second, endpoint);
-            }
+        for (auto& r : strategy.get_address_ranges(all_left_metadata, endpoint)) {
+            new_pending_ranges.emplace(std::move(r), endpoint);
         }
         all_left_metadata.remove_endpoint(endpoint);
+        maybe_yield(stall);
     }
 
     // At this stage newPendingRanges has been updated according to leaving and bootstrapping nodes.
@@ -489,20 +497,19 @@ void token_metadata::calculate_pending_ranges(abstract_replication_strategy& str
 
     // For each of the moving nodes, we do the same thing we did for bootstrapping:
     // simply add and remove them one by one to allLeftMetadata and check in between what their ranges would be.
-    for (auto& moving : _moving_endpoints) {
+    for (auto& moving : moving_endpoints) {
         auto& t = moving.first;
         auto& endpoint = moving.second; // address of the moving node
 
         // moving.left is a new token of the endpoint
         all_left_metadata.update_normal_token(t, endpoint);
 
-        for (auto& x : strategy.get_address_ranges(all_left_metadata)) {
-            if (x.first == endpoint) {
-                new_pending_ranges.emplace(x.second, endpoint);
-            }
+        for (auto& r : strategy.get_address_ranges(all_left_metadata, endpoint)) {
+            new_pending_ranges.emplace(std::move(r), endpoint);
         }
 
         all_left_metadata.remove_endpoint(endpoint);
+        maybe_yield(stall);
     }
 
     set_pending_ranges(keyspace_name, std::move(new_pending_ranges));
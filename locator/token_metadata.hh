@@ -643,8 +643,11 @@ class token_metadata final {
      * node could have. It might be that other bootstraps make our actual final ranges smaller,
      * but it does not matter as we can clean up the data afterwards.
      *
-     * NOTE: This is heavy and ineffective operation. This will be done only once when a node
-     * changes state in the cluster, so it should be manageable.
+     * Only the ranges next to the tokens of the changing nodes are examined, see
+     * abstract_replication_strategy::get_address_ranges(tm, endpoint).
+     *
+     * Must be called in a seastar thread, it yields while computing the ranges. The
+     * computation works on a snapshot of the topology taken when it starts.
      */
     void calculate_pending_ranges(abstract_replication_strategy& strategy, const sstring& keyspace_name);
 public:
@@ -31,6 +31,8 @@
 #include "service/storage_service.hh"
 #include "service/migration_manager.hh"
 #include "service/load_broadcaster.hh"
+#include "service/request_scheduler.hh"
+#include "service/priority_manager.hh"
 #include "streaming/stream_session.hh"
 #include "db/system_keyspace.hh"
 #include "db/batchlog_manager.hh"
@@ -38,6 +40,7 @@
 #include "db/commitlog/commitlog_replayer.hh"
 #include "utils/runtime.hh"
 #include "utils/file_lock.hh"
+#include "utils/stall_detector.hh"
 #include "dns.hh"
 #include "log.hh"
 #include "debug.hh"
@@ -51,6 +54,9 @@
 #include "disk-error-handler.hh"
 #include "tracing/tracing.hh"
 #include "db/size_estimates_recorder.hh"
+#include "db/cache_saver.hh"
+#include "db/hints_manager.hh"
+#include "locator/dynamic_snitch.hh"
 #include "core/prometheus.hh"
 
 #ifdef HAVE_LIBSYSTEMD
@@ -344,6 +350,16 @@ int main(int ac, char** av) {
                     cfg->log_to_stdout(), cfg->log_to_syslog());
             verify_rlimit(cfg->developer_mode());
             dht::set_global_partitioner(cfg->partitioner());
+            service::priority_class_shares io_shares;
+            try {
+                io_shares = service::parse_priority_class_shares(cfg->io_priority_class_shares());
+            } catch (...) {
+                startlog.error("Bad configuration: invalid 'io_priority_class_shares': {}", std::current_exception());
+                throw bad_configuration_error();
+            }
+            smp::invoke_on_all([io_shares] {
+                service::set_priority_class_shares(io_shares);
+            }).get();
             auto start_thrift = cfg->start_rpc();
             uint16_t api_port = cfg->api_port();
             ctx.api_dir = cfg->api_ui_dir();
@@ -422,6 +438,15 @@ int main(int ac, char** av) {
             print("Scylla API server listening on %s:%s ...\n", api_address, api_port);
             supervisor_notify("initializing storage service");
             init_storage_service(db);
+            smp::invoke_on_all([&cfg] {
+                if (cfg->lsa_huge_page_zones()) {
+                    logalloc::shard_tracker().enable_huge_page_zones();
+                }
+                if (cfg->lsa_reserved_memory_in_mb()) {
+                    logalloc::shard_tracker().reserve_memory(size_t(cfg->lsa_reserved_memory_in_mb()) << 20);
+                }
+                utils::local_stall_detector().set_threshold(std::chrono::microseconds(cfg->stall_report_threshold_in_us()));
+            }).get();
             supervisor_notify("starting per-shard database core");
             // Note: changed from using a move here, because we want the config object intact.
             db.start(std::ref(*cfg)).get();
@@ -494,14 +519,30 @@ int main(int ac, char** av) {
                     , cert
                     , key
                     , cfg->internode_compression()
+                    , cfg->inter_dc_tcp_nodelay()
                     , seed_provider
                     , cluster_name
-                    , phi);
+                    , phi
+                    , std::chrono::milliseconds(cfg->fd_heartbeat_interval_in_ms()));
             supervisor_notify("starting messaging service");
+            supervisor_notify("starting dynamic snitch");
+            locator::get_dynamic_snitch().start(cfg->dynamic_snitch_badness_threshold(),
+                    std::chrono::milliseconds(cfg->dynamic_snitch_update_interval_in_ms()),
+                    std::chrono::milliseconds(cfg->dynamic_snitch_reset_interval_in_ms())).get();
+            engine().at_exit([] { return locator::get_dynamic_snitch().stop(); });
+            locator::get_dynamic_snitch().invoke_on_all([] (locator::dynamic_snitch& ds) {
+                ds.start();
+            }).get();
             supervisor_notify("starting storage proxy");
             proxy.start(std::ref(db)).get();
             // #293 - do not stop anything
             // engine().at_exit([&proxy] { return proxy.stop(); });
+            supervisor_notify("starting hints manager");
+            db::get_hints_manager().start(std::ref(db)).get();
+            engine().at_exit([] { return db::get_hints_manager().stop(); });
+            db::get_hints_manager().invoke_on_all([] (db::hints_manager& hm) {
+                return hm.start();
+            }).get();
             supervisor_notify("starting migration manager");
             mm.start().get();
             // #293 - do not stop anything
@@ -536,20 +577,33 @@ int main(int ac, char** av) {
             // all sstables in this CF were loaded on all shards - otherwise
             // we will have races between the compaction and loading processes
             // We also want to trigger regular compaction on boot.
-            db.invoke_on_all([&proxy] (database& db) {
-                for (auto& x : db.get_column_families()) {
+            // After the number of shards changed, the rewrites split each
+            // sstable into one per shard, every shard reading only its part,
+            // in parallel. They can be waited for, so that the node serves
+            // requests only once every shard reads just its own sstables.
+            auto wait_for_rewrites = cfg->reshard_on_startup();
+            db.invoke_on_all([&proxy, wait_for_rewrites] (database& db) {
+                auto rewrites = parallel_for_each(db.get_column_families(), [] (auto& x) {
                     column_family& cf = *(x.second);
-                    // We start the rewrite, but do not wait for it.
-                    cf.start_rewrite();
+                    auto f = cf.start_rewrite();
                     cf.trigger_compaction();
+                    return f;
+                });
+                if (wait_for_rewrites) {
+                    return rewrites;
                 }
+                // We start the rewrite, but do not wait for it.
+                return make_ready_future<>();
             }).get();
             supervisor_notify("setting up system keyspace");
             db::system_keyspace::setup(db, qp).get();
             supervisor_notify("starting commit log");
-            auto cl = db.local().commitlog();
-            if (cl != nullptr) {
-                auto paths = cl->list_existing_segments().get0();
+            {
+                std::vector<sstring> paths;
+                for (auto cl : db.local().commitlogs()) {
+                    auto cl_paths = cl->list_existing_segments().get0();
+                    std::move(cl_paths.begin(), cl_paths.end(), std::back_inserter(paths));
+                }
                 if (!paths.empty()) {
                     supervisor_notify("replaying commit log");
                     auto rp = db::commitlog_replayer::create_replayer(qp).get0();
@@ -564,6 +618,20 @@ int main(int ac, char** av) {
                     }
                 }
             }
+            // Building indexes and views needs the system keyspace, and the data which
+            // was replayed from the commitlog.
+            db.invoke_on_all([] (database& db) {
+                db.start_index_builds();
+                db.start_view_builds();
+            }).get();
+            supervisor_notify("warming up row cache");
+            db::get_cache_saver().start(std::ref(db)).get();
+            engine().at_exit([] { return db::get_cache_saver().stop(); });
+            db::get_cache_saver().invoke_on_all([] (db::cache_saver& cs) {
+                return cs.load().then([&cs] {
+                    cs.start();
+                });
+            }).get();
             api::set_server_storage_service(ctx).get();
             api::set_server_gossip(ctx).get();
             api::set_server_snitch(ctx).get();
@@ -580,13 +648,29 @@ int main(int ac, char** av) {
             supervisor_notify("starting streaming service");
             streaming::stream_session::init_streaming_service(db).get();
             api::set_server_stream_manager(ctx).get();
-            // Start handling REPAIR_CHECKSUM_RANGE messages
+            // Start handling REPAIR_CHECKSUM_RANGE, REPAIR_CHECKSUM_RANGES and REPAIR_MARK_REPAIRED messages
             net::get_messaging_service().invoke_on_all([&db] (auto& ms) {
-                ms.register_repair_checksum_range([&db] (sstring keyspace, sstring cf, query::range<dht::token> range, rpc::optional<repair_checksum> hash_version) {
+                ms.register_repair_checksum_range([&db] (sstring keyspace, sstring cf, query::range<dht::token> range, rpc::optional<repair_checksum> hash_version,
+                        rpc::optional<uint64_t> repaired_at) {
                     auto hv = hash_version ? *hash_version : repair_checksum::legacy;
+                    auto ra = repaired_at ? *repaired_at : 0;
                     return do_with(std::move(keyspace), std::move(cf), std::move(range),
-                            [&db, hv] (auto& keyspace, auto& cf, auto& range) {
-                        return checksum_range(db, keyspace, cf, range, hv);
+                            [&db, hv, ra] (auto& keyspace, auto& cf, auto& range) {
+                        return checksum_range(db, keyspace, cf, range, hv, ra);
+                    });
+                });
+                ms.register_repair_checksum_ranges([&db] (sstring keyspace, sstring cf, std::vector<query::range<dht::token>> ranges, repair_checksum hash_version,
+                        rpc::optional<uint64_t> repaired_at) {
+                    auto ra = repaired_at ? *repaired_at : 0;
+                    return do_with(std::move(keyspace), std::move(cf), std::move(ranges),
+                            [&db, hash_version, ra] (auto& keyspace, auto& cf, auto& ranges) {
+                        return checksum_ranges(db, keyspace, cf, ranges, hash_version, ra);
+                    });
+                });
+                ms.register_repair_mark_repaired([&db] (sstring keyspace, sstring cf, std::vector<query::range<dht::token>> ranges, uint64_t repaired_at) {
+                    return do_with(std::move(keyspace), std::move(cf), std::move(ranges),
+                            [&db, repaired_at] (auto& keyspace, auto& cf, auto& ranges) {
+                        return mark_repaired(db, keyspace, cf, ranges, repaired_at);
                     });
                 });
             }).get();
@@ -610,10 +694,24 @@ int main(int ac, char** av) {
             api::set_server_gossip_settle(ctx).get();
             supervisor_notify("starting tracing");
             tracing::tracing::create_tracing("trace_keyspace_helper").get();
+            tracing::tracing::tracing_instance().invoke_on_all([threshold = cfg->slow_query_log_timeout_in_ms()] (tracing::tracing& t) {
+                t.set_slow_query_threshold(std::chrono::milliseconds(threshold));
+            }).get();
             supervisor_notify("starting size estimates recorder");
             auto&& recorder = db::get_size_estimates_recorder();
             recorder.start().get();
             engine().at_exit([] { return db::get_size_estimates_recorder().stop(); });
+            service::request_scheduler::config scheduler_cfg;
+            try {
+                scheduler_cfg = service::request_scheduler::make_config(cfg->request_scheduler(), cfg->request_scheduler_id(),
+                                                                        cfg->request_scheduler_options());
+            } catch (...) {
+                startlog.error("Bad configuration: {}", std::current_exception());
+                throw bad_configuration_error();
+            }
+            smp::invoke_on_all([scheduler_cfg] {
+                service::get_local_request_scheduler().configure(scheduler_cfg);
+            }).get();
             supervisor_notify("starting native transport");
             service::get_local_storage_service().start_native_transport().get();
             if (start_thrift) {
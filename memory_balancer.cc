@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory_balancer.hh"
+#include "log.hh"
+#include <algorithm>
+
+static logging::logger logger("memory_balancer");
+
+void memory_balancer::start(config cfg, input_source input, actuators act) {
+    _cfg = cfg;
+    _input = std::move(input);
+    _actuators = std::move(act);
+    if (!_cfg.interval.count()) {
+        return;
+    }
+    _last = _input();
+    _targets = compute_targets(_cfg, _hit_rate, _write_rate, _last.lsa_memory);
+    _timer.set_callback([this] { balance(); });
+    _timer.arm_periodic(_cfg.interval);
+}
+
+void memory_balancer::stop() {
+    _timer.cancel();
+}
+
+void memory_balancer::balance() {
+    auto in = _input();
+    auto hits = in.cache_hits - _last.cache_hits;
+    auto misses = in.cache_misses - _last.cache_misses;
+    if (hits + misses) {
+        _hit_rate += rate_weight * (double(hits) / (hits + misses) - _hit_rate);
+    }
+    auto seconds = std::chrono::duration<double>(_cfg.interval).count();
+    _write_rate += rate_weight * ((in.bytes_written - _last.bytes_written) / seconds - _write_rate);
+    _last = in;
+
+    _targets = compute_targets(_cfg, _hit_rate, _write_rate, in.lsa_memory);
+    ++_stats.adjustments;
+    logger.debug("hit rate {:.3f}, write rate {:.0f} B/s, cache {}/{}, dirty {}/{}", _hit_rate, _write_rate,
+            in.cache_used, _targets.cache, in.dirty_used, _targets.dirty);
+
+    _actuators.set_dirty_target(_targets.dirty);
+    if (in.cache_used > _targets.cache) {
+        auto step = std::min(in.cache_used - _targets.cache, in.lsa_memory / eviction_step_divisor);
+        _stats.evicted_bytes += _actuators.evict_cache(step);
+    }
+}
+
+memory_balancer::targets memory_balancer::compute_targets(const config& cfg, double hit_rate, double write_rate, size_t lsa_memory) {
+    targets t;
+    auto needed = size_t(write_rate * std::chrono::duration<double>(cfg.flush_window).count());
+    auto cache_reserve = size_t(lsa_memory * cfg.cache_reserve_share * std::min(std::max(hit_rate, 0.0), 1.0));
+    auto available = lsa_memory - std::min(lsa_memory, cache_reserve);
+    t.dirty = std::max(std::min(cfg.min_dirty, cfg.max_dirty), std::min({needed, available, cfg.max_dirty}));
+    t.cache = lsa_memory - std::min(lsa_memory, t.dirty);
+    return t;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/timer.hh"
+#include <chrono>
+#include <functional>
+
+// Splits the memory LSA may use between row_cache and memtables.
+//
+// Without it, the split is decided by reclaim alone: memtables take segments
+// from the cache as they grow, so a write-heavy phase may evict the whole
+// cache, which then takes long to warm up again once writes stop.
+//
+// Every interval, the balancer sets a target for the memory of memtables from
+// the recent write rate, enough to absorb the writes during flush_window, and
+// caps it so that the cache keeps a share of the memory which grows with the
+// recent read hit rate. The cache's target is what is left. Memtables above
+// their target are flushed early, and the cache above its target is evicted
+// in bounded steps outside of allocation paths.
+class memory_balancer {
+public:
+    struct input {
+        // Cumulative counts.
+        uint64_t cache_hits;
+        uint64_t cache_misses;
+        uint64_t bytes_written;
+        // Current usage.
+        size_t cache_used;
+        size_t dirty_used;
+        // Memory LSA may use, that is the memory not taken by standard allocations.
+        size_t lsa_memory;
+    };
+    using input_source = std::function<input()>;
+
+    struct config {
+        std::chrono::milliseconds interval;
+        // Share of LSA memory kept for the cache at a hit rate of 1.
+        double cache_reserve_share;
+        std::chrono::milliseconds flush_window;
+        size_t min_dirty;
+        size_t max_dirty;
+    };
+
+    struct targets {
+        size_t cache = 0;
+        size_t dirty = 0;
+    };
+
+    struct actuators {
+        std::function<void(size_t)> set_dirty_target;
+        // Evicts up to the given amount of bytes from the cache, returns the amount evicted.
+        std::function<size_t(size_t)> evict_cache;
+    };
+
+    struct stats {
+        uint64_t adjustments = 0;
+        uint64_t evicted_bytes = 0;
+    };
+private:
+    // Weight of the latest interval in the averaged rates.
+    static constexpr double rate_weight = 0.2;
+    // Evictions per interval are bounded to this fraction of LSA memory.
+    static constexpr unsigned eviction_step_divisor = 32;
+
+    config _cfg;
+    input_source _input;
+    actuators _actuators;
+    timer<> _timer;
+    input _last{};
+    double _hit_rate = 0;
+    double _write_rate = 0;
+    targets _targets;
+    stats _stats;
+public:
+    memory_balancer() = default;
+
+    // Arms the periodic balancing. Does nothing if the interval is zero.
+    void start(config cfg, input_source input, actuators act);
+    void stop();
+
+    // Balances once, from the input gathered since the previous call.
+    void balance();
+
+    // Computes the targets from the averaged read hit rate, write rate in
+    // bytes per second and the memory LSA may use.
+    static targets compute_targets(const config& cfg, double hit_rate, double write_rate, size_t lsa_memory);
+
+    const targets& get_targets() const { return _targets; }
+    double hit_rate() const { return _hit_rate; }
+    double write_rate() const { return _write_rate; }
+    const stats& get_stats() const { return _stats; }
+};
@@ -25,14 +25,21 @@
 
 namespace stdx = std::experimental;
 
+constexpr size_t memtable::initial_index_buckets;
+
 memtable::memtable(schema_ptr schema, logalloc::region_group* dirty_memory_region_group)
         : logalloc::region(dirty_memory_region_group ? logalloc::region(*dirty_memory_region_group) : logalloc::region())
         , _schema(std::move(schema))
-        , partitions(memtable_entry::compare(_schema)) {
+        , partitions(memtable_entry::compare(_schema))
+        , _index_buckets(std::make_unique<index_type::bucket_type[]>(initial_index_buckets))
+        , _index(index_type::bucket_traits(_index_buckets.get(), initial_index_buckets))
+        , _dirty_memory_region_group(dirty_memory_region_group) {
 }
 
 memtable::~memtable() {
+    revert_flushed_memory();
     with_allocator(allocator(), [this] {
+        _index.clear();
         partitions.clear_and_dispose(current_deleter<memtable_entry>());
     });
 }
@@ -61,12 +68,13 @@ partition_entry&
 memtable::find_or_create_partition(const dht::decorated_key& key) {
     assert(!reclaiming_enabled());
 
-    // call lower_bound so we have a hint for the insert, just in case.
-    auto i = partitions.lower_bound(key, memtable_entry::compare(_schema));
-    if (i == partitions.end() || !key.equal(*_schema, i->key())) {
+    auto i = _index.find(key, memtable_entry::hash(), memtable_entry::equal());
+    if (i == _index.end()) {
+        maybe_grow_index();
         memtable_entry* entry = current_allocator().construct<memtable_entry>(
             _schema, dht::decorated_key(key), mutation_partition(_schema));
-        i = partitions.insert(i, *entry);
+        partitions.insert(*entry);
+        _index.insert(*entry);
         return entry->partition();
     } else {
         upgrade_entry(*i);
@@ -74,15 +82,33 @@ memtable::find_or_create_partition(const dht::decorated_key& key) {
     return i->partition();
 }
 
+// Keeps the load factor of the index at most 1.
+void memtable::maybe_grow_index() {
+    auto n = _index.bucket_count();
+    if (partitions.size() < n) {
+        return;
+    }
+    std::unique_ptr<index_type::bucket_type[]> buckets;
+    try {
+        buckets = std::make_unique<index_type::bucket_type[]>(n * 2);
+    } catch (const std::bad_alloc&) {
+        // Lookups just get slower.
+        return;
+    }
+    _index.rehash(index_type::bucket_traits(buckets.get(), n * 2));
+    _index_buckets = std::move(buckets);
+}
+
 boost::iterator_range<memtable::partitions_type::const_iterator>
 memtable::slice(const query::partition_range& range) const {
     if (query::is_single_partition(range)) {
         const query::ring_position& pos = range.start()->value();
-        auto i = partitions.find(pos, memtable_entry::compare(_schema));
-        if (i != partitions.end()) {
-            return boost::make_iterator_range(i, std::next(i));
+        auto i = _index.find(pos, memtable_entry::hash(), memtable_entry::equal());
+        if (i != _index.end()) {
+            auto j = partitions.iterator_to(*i);
+            return boost::make_iterator_range(j, std::next(j));
         } else {
-            return boost::make_iterator_range(i, i);
+            return boost::make_iterator_range(partitions.cend(), partitions.cend());
         }
     } else {
         auto cmp = memtable_entry::compare(_schema);
@@ -191,6 +217,60 @@ class scanning_reader final : public mutation_reader::impl {
     }
 };
 
+class flush_reader final : public mutation_reader::impl {
+    lw_shared_ptr<memtable> _memtable;
+    mutation_reader _reader;
+    size_t _partition_count;
+    size_t _partitions_read = 0;
+private:
+    // Releases the memory of partitions which were consumed, assuming they
+    // all take an equal share of the memtable.
+    void account_flushed(size_t flushed_partitions) {
+        if (!_memtable->_dirty_memory_region_group || !_partition_count) {
+            return;
+        }
+        auto total = _memtable->occupancy().total_space();
+        auto flushed = total * std::min(flushed_partitions, _partition_count) / _partition_count;
+        if (flushed > _memtable->_flushed_memory) {
+            _memtable->_dirty_memory_region_group->update(-ssize_t(flushed - _memtable->_flushed_memory));
+            _memtable->_flushed_memory = flushed;
+        }
+    }
+public:
+    flush_reader(schema_ptr s, lw_shared_ptr<memtable> m, const io_priority_class& pc)
+        : _memtable(m)
+        , _reader(make_mutation_reader<scanning_reader>(std::move(s), std::move(m), query::full_partition_range,
+                                                        query::no_clustering_key_filtering, pc))
+        , _partition_count(_memtable->partition_count())
+    { }
+
+    virtual future<streamed_mutation_opt> operator()() override {
+        // The partition returned previously was consumed by now.
+        account_flushed(_partitions_read);
+        return _reader().then([this] (streamed_mutation_opt smo) {
+            if (smo) {
+                ++_partitions_read;
+            } else {
+                account_flushed(_partition_count);
+            }
+            return std::move(smo);
+        });
+    }
+};
+
+mutation_reader
+memtable::make_flush_reader(schema_ptr s, const io_priority_class& pc) {
+    return make_mutation_reader<flush_reader>(std::move(s), shared_from_this(), pc);
+}
+
+void
+memtable::revert_flushed_memory() {
+    if (_flushed_memory) {
+        _dirty_memory_region_group->update(_flushed_memory);
+        _flushed_memory = 0;
+    }
+}
+
 mutation_reader
 memtable::make_reader(schema_ptr s,
                       const query::partition_range& range,
@@ -204,8 +284,8 @@ memtable::make_reader(schema_ptr s,
         const query::ring_position& pos = range.start()->value();
         return _read_section(*this, [&] {
         managed_bytes::linearization_context_guard lcg;
-        auto i = partitions.find(pos, memtable_entry::compare(_schema));
-        if (i != partitions.end()) {
+        auto i = _index.find(pos, memtable_entry::hash(), memtable_entry::equal());
+        if (i != _index.end()) {
             upgrade_entry(*i);
             return make_reader_returning(i->read(shared_from_this(), s, ck_filtering));
         } else {
@@ -253,7 +333,10 @@ memtable::apply(const frozen_mutation& m, const schema_ptr& m_schema, const db::
         _allocating_section(*this, [&, this] {
           with_linearized_managed_bytes([&] {
             auto& p = find_or_create_partition_slow(m.key(*_schema));
-            p.apply(*_schema, m.partition(), *m_schema);
+            // Cells are copied straight from the frozen mutation. If this
+            // throws, the allocating section retries, and completes a
+            // partially applied mutation.
+            p.apply_weak(*_schema, m.partition(), *m_schema);
           });
         });
     });
@@ -289,6 +372,7 @@ memtable_entry::memtable_entry(memtable_entry&& o) noexcept
     using container_type = memtable::partitions_type;
     container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
     container_type::node_algorithms::init(o._link.this_ptr());
+    _index_link.swap_nodes(o._index_link);
 }
 
 void memtable::mark_flushed(lw_shared_ptr<sstables::sstable> sst) {
@@ -311,6 +395,31 @@ memtable_entry::read(lw_shared_ptr<memtable> mtbl, const schema_ptr& target_sche
     return make_partition_snapshot_reader(_schema, _key, ck_filtering, cr, snp, *mtbl, mtbl->_read_section, mtbl);
 }
 
+stop_iteration
+memtable::compact_expired(std::experimental::optional<dht::decorated_key>& last, gc_clock::time_point now,
+        size_t max_partitions, size_t max_rows) {
+    static thread_local can_gc_fn never_gc = [] (tombstone) { return false; };
+    return with_allocator(allocator(), [&] {
+        return _allocating_section(*this, [&] {
+          return with_linearized_managed_bytes([&] {
+            auto cmp = memtable_entry::compare(_schema);
+            auto i = last ? partitions.upper_bound(*last, cmp) : partitions.begin();
+            auto visited = partitions.end();
+            for (auto n = max_partitions; i != partitions.end() && n; ++i, --n) {
+                i->partition().compact(*i->schema(), never_gc, now, max_rows);
+                visited = i;
+            }
+            if (visited != partitions.end()) {
+                with_allocator(standard_allocator(), [&] {
+                    last = visited->key();
+                });
+            }
+            return stop_iteration(i == partitions.end());
+          });
+        });
+    });
+}
+
 void memtable::upgrade_entry(memtable_entry& e) {
     if (e._schema != _schema) {
         assert(!reclaiming_enabled());
@@ -23,6 +23,8 @@
 
 #include <map>
 #include <memory>
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/unordered_set.hpp>
 #include "database_fwd.hh"
 #include "dht/i_partitioner.hh"
 #include "schema.hh"
@@ -38,7 +40,12 @@ class frozen_mutation;
 namespace bi = boost::intrusive;
 
 class memtable_entry {
+    using index_link_type = bi::unordered_set_member_hook<bi::link_mode<bi::auto_unlink>>;
+
     bi::set_member_hook<> _link;
+    // Links the entry into memtable::_index. auto_unlink, so that entries
+    // disposed of through the ordered set leave the index too.
+    index_link_type _index_link;
     schema_ptr _schema;
     dht::decorated_key _key;
     partition_entry _pe;
@@ -88,6 +95,34 @@ class memtable_entry {
             return _c(k1, k2._key);
         }
     };
+
+    struct hash {
+        size_t operator()(const dht::token& t) const {
+            return std::hash<dht::token>()(t);
+        }
+        size_t operator()(const dht::decorated_key& k) const {
+            return operator()(k.token());
+        }
+        size_t operator()(const dht::ring_position& k) const {
+            return operator()(k.token());
+        }
+        size_t operator()(const memtable_entry& e) const {
+            return operator()(e._key);
+        }
+    };
+
+    struct equal {
+        bool operator()(const memtable_entry& e1, const memtable_entry& e2) const {
+            return e1._key.equal(*e1._schema, e2._key);
+        }
+        bool operator()(const dht::decorated_key& k, const memtable_entry& e) const {
+            return e._key.equal(*e._schema, k);
+        }
+        // Requires: k has a key.
+        bool operator()(const dht::ring_position& k, const memtable_entry& e) const {
+            return e._key.tri_compare(*e._schema, k) == 0;
+        }
+    };
 };
 
 // Managed by lw_shared_ptr<>.
@@ -96,13 +131,30 @@ class memtable final : public enable_lw_shared_from_this<memtable>, private loga
     using partitions_type = bi::set<memtable_entry,
         bi::member_hook<memtable_entry, bi::set_member_hook<>, &memtable_entry::_link>,
         bi::compare<memtable_entry::compare>>;
+    // Hash index over partitions, for point lookups and applies. The
+    // ordered set is still used by range scans and flushes.
+    using index_type = bi::unordered_set<memtable_entry,
+        bi::member_hook<memtable_entry, memtable_entry::index_link_type, &memtable_entry::_index_link>,
+        bi::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
+        bi::hash<memtable_entry::hash>,
+        bi::equal<memtable_entry::equal>,
+        bi::power_2_buckets<true>>;
+private:
+    static constexpr size_t initial_index_buckets = 16;
 private:
     schema_ptr _schema;
     logalloc::allocating_section _read_section;
     logalloc::allocating_section _allocating_section;
     partitions_type partitions;
+    // Outside of LSA, _index must not outlive it.
+    std::unique_ptr<index_type::bucket_type[]> _index_buckets;
+    index_type _index;
     db::replay_position _replay_position;
     lw_shared_ptr<sstables::sstable> _sstable;
+    logalloc::region_group* _dirty_memory_region_group;
+    // Memory of partitions already written to an sstable by a flush
+    // reader, which is no longer accounted in _dirty_memory_region_group.
+    size_t _flushed_memory = 0;
     void update(const db::replay_position&);
     friend class row_cache;
     friend class memtable_entry;
@@ -110,6 +162,7 @@ class memtable final : public enable_lw_shared_from_this<memtable>, private loga
     boost::iterator_range<partitions_type::const_iterator> slice(const query::partition_range& r) const;
     partition_entry& find_or_create_partition(const dht::decorated_key& key);
     partition_entry& find_or_create_partition_slow(partition_key_view key);
+    void maybe_grow_index();
     void upgrade_entry(memtable_entry&);
 public:
     explicit memtable(schema_ptr schema, logalloc::region_group* dirty_memory_region_group = nullptr);
@@ -134,6 +187,15 @@ class memtable final : public enable_lw_shared_from_this<memtable>, private loga
     size_t partition_count() const;
     logalloc::occupancy_stats occupancy() const;
 
+    // Compacts up to max_partitions partitions following last, and sets last
+    // to the last one visited. Expired cells become tombstones and data
+    // covered by tombstones of its partition is dropped, but tombstones are
+    // kept, as they may shadow data in sstables. Partitions which are being
+    // read, or are larger than max_rows rows, are skipped. Returns
+    // stop_iteration::yes when there are no partitions past last.
+    stop_iteration compact_expired(std::experimental::optional<dht::decorated_key>& last, gc_clock::time_point now,
+        size_t max_partitions, size_t max_rows);
+
     // Creates a reader of data in this memtable for given partition range.
     //
     // Live readers share ownership of the memtable instance, so caller
@@ -147,6 +209,21 @@ class memtable final : public enable_lw_shared_from_this<memtable>, private loga
                                 const query::clustering_key_filtering_context& ck_filtering = query::no_clustering_key_filtering,
                                 const io_priority_class& pc = default_priority_class());
 
+    // Creates a reader of all data in this memtable for writing it to an
+    // sstable.
+    //
+    // As partitions are consumed, their share of the memtable's memory is
+    // released from the dirty memory region group, so that writers throttled
+    // on dirty memory are let in as the flush progresses instead of when the
+    // whole memtable is gone. The memory is accounted back by
+    // revert_flushed_memory().
+    mutation_reader make_flush_reader(schema_ptr, const io_priority_class& pc = default_priority_class());
+
+    // Accounts memory released by a flush reader back to the dirty memory
+    // region group. Must be called before this memtable leaves the group,
+    // or when the flush failed and has to be retried.
+    void revert_flushed_memory();
+
     mutation_source as_data_source();
     key_source as_key_source();
 
@@ -159,4 +236,5 @@ class memtable final : public enable_lw_shared_from_this<memtable>, private loga
     }
 
     friend class scanning_reader;
+    friend class flush_reader;
 };
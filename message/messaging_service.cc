@@ -51,6 +51,7 @@
 #include "idl/read_command.dist.hh"
 #include "idl/range.dist.hh"
 #include "idl/partition_checksum.dist.hh"
+#include "idl/replica_load.dist.hh"
 #include "serializer_impl.hh"
 #include "serialization_visitors.hh"
 #include "idl/tracing.dist.impl.hh"
@@ -67,6 +68,7 @@
 #include "idl/read_command.dist.impl.hh"
 #include "idl/range.dist.impl.hh"
 #include "idl/partition_checksum.dist.impl.hh"
+#include "idl/replica_load.dist.impl.hh"
 #include "rpc/lz4_compressor.hh"
 #include "rpc/multi_algo_compressor_factory.hh"
 
@@ -217,7 +219,7 @@ void register_handler(messaging_service* ms, messaging_verb verb, Func&& func) {
 }
 
 messaging_service::messaging_service(gms::inet_address ip, uint16_t port, bool listen_now)
-    : messaging_service(std::move(ip), port, encrypt_what::none, compress_what::none, 0, nullptr, listen_now)
+    : messaging_service(std::move(ip), port, encrypt_what::none, compress_what::none, tcp_nodelay_what::all, 0, nullptr, listen_now)
 {}
 
 static
@@ -260,6 +262,7 @@ messaging_service::messaging_service(gms::inet_address ip
         , uint16_t port
         , encrypt_what ew
         , compress_what cw
+        , tcp_nodelay_what tnw
         , uint16_t ssl_port
         , std::shared_ptr<seastar::tls::credentials_builder> credentials
         , bool listen_now)
@@ -268,6 +271,7 @@ messaging_service::messaging_service(gms::inet_address ip
     , _ssl_port(ssl_port)
     , _encrypt_what(ew)
     , _compress_what(cw)
+    , _tcp_nodelay_what(tnw)
     , _rpc(new rpc_protocol_wrapper(serializer { }))
     , _credentials(credentials ? credentials->build_server_credentials() : nullptr)
 {
@@ -341,26 +345,46 @@ rpc::no_wait_type messaging_service::no_wait() {
     return rpc::no_wait;
 }
 
+// Each peer gets a separate connection, with its own output queue, per class
+// of verbs, so that bulk transfers don't delay gossip and short requests.
 static unsigned get_rpc_client_idx(messaging_verb verb) {
-    unsigned idx = 0;
+    switch (verb) {
     // GET_SCHEMA_VERSION is sent from read/mutate verbs so should be
     // sent on a different connection to avoid potential deadlocks
     // as well as reduce latency as there are potentially many requests
     // blocked on schema version request.
-    if (verb == messaging_verb::GOSSIP_DIGEST_SYN ||
-        verb == messaging_verb::GOSSIP_DIGEST_ACK2 ||
-        verb == messaging_verb::GOSSIP_SHUTDOWN ||
-        verb == messaging_verb::GOSSIP_ECHO ||
-        verb == messaging_verb::GET_SCHEMA_VERSION) {
-        idx = 1;
-    } else if (verb == messaging_verb::PREPARE_MESSAGE ||
-               verb == messaging_verb::PREPARE_DONE_MESSAGE ||
-               verb == messaging_verb::STREAM_MUTATION ||
-               verb == messaging_verb::STREAM_MUTATION_DONE ||
-               verb == messaging_verb::COMPLETE_MESSAGE) {
-        idx = 2;
+    case messaging_verb::GOSSIP_DIGEST_SYN:
+    case messaging_verb::GOSSIP_DIGEST_ACK2:
+    case messaging_verb::GOSSIP_SHUTDOWN:
+    case messaging_verb::GOSSIP_ECHO:
+    case messaging_verb::FD_HEARTBEAT:
+    case messaging_verb::GET_SCHEMA_VERSION:
+    case messaging_verb::SCHEMA_PUSH:
+        return 1;
+    case messaging_verb::PREPARE_MESSAGE:
+    case messaging_verb::PREPARE_DONE_MESSAGE:
+    case messaging_verb::STREAM_MUTATION:
+    case messaging_verb::STREAM_MUTATION_DONE:
+    case messaging_verb::COMPLETE_MESSAGE:
+    case messaging_verb::HINT_MUTATION:
+    case messaging_verb::REPAIR_CHECKSUM_RANGE:
+    case messaging_verb::REPAIR_CHECKSUM_RANGES:
+    case messaging_verb::REPAIR_MARK_REPAIRED:
+        return 2;
+    case messaging_verb::MUTATION:
+    case messaging_verb::MUTATION_DONE:
+    case messaging_verb::MUTATION_BATCH:
+    case messaging_verb::VIEW_UPDATE:
+    case messaging_verb::COUNTER_MUTATION:
+        return 3;
+    case messaging_verb::READ_DATA:
+    case messaging_verb::READ_MUTATION_DATA:
+    case messaging_verb::READ_DIGEST:
+    case messaging_verb::READ_DATA_BATCH:
+        return 4;
+    default:
+        return 0;
     }
-    return idx;
 }
 
 /**
@@ -441,15 +465,19 @@ shared_ptr<messaging_service::rpc_protocol_client_wrapper> messaging_service::ge
                         != snitch_ptr->get_rack(utils::fb_utilities::get_broadcast_address());
     }();
 
-    auto must_compress = [&id, this] {
+    auto remote_dc = [&id] {
+        auto& snitch_ptr = locator::i_endpoint_snitch::get_local_snitch_ptr();
+        return snitch_ptr->get_datacenter(id.addr)
+                        != snitch_ptr->get_datacenter(utils::fb_utilities::get_broadcast_address());
+    };
+
+    auto must_compress = [&remote_dc, this] {
         if (_compress_what == compress_what::none) {
             return false;
         }
 
         if (_compress_what == compress_what::dc) {
-            auto& snitch_ptr = locator::i_endpoint_snitch::get_local_snitch_ptr();
-            return snitch_ptr->get_datacenter(id.addr)
-                            != snitch_ptr->get_datacenter(utils::fb_utilities::get_broadcast_address());
+            return remote_dc();
         }
 
         return true;
@@ -464,6 +492,9 @@ shared_ptr<messaging_service::rpc_protocol_client_wrapper> messaging_service::ge
     if (must_compress) {
         opts.compressor_factory = &compressor_factory;
     }
+    // Connections within a DC always disable Nagle's algorithm, across DCs
+    // larger, but fewer, packets may be preferred.
+    opts.tcp_nodelay = _tcp_nodelay_what == tcp_nodelay_what::all || !remote_dc();
 
     auto client = must_encrypt ?
                     ::make_shared<rpc_protocol_client_wrapper>(*_rpc, std::move(opts),
@@ -711,6 +742,16 @@ future<> messaging_service::send_gossip_echo(msg_addr id) {
     return send_message_timeout<void>(this, messaging_verb::GOSSIP_ECHO, std::move(id), 3000ms);
 }
 
+void messaging_service::register_fd_heartbeat(std::function<future<> ()>&& func) {
+    register_handler(this, messaging_verb::FD_HEARTBEAT, std::move(func));
+}
+void messaging_service::unregister_fd_heartbeat() {
+    _rpc->unregister_handler(net::messaging_verb::FD_HEARTBEAT);
+}
+future<> messaging_service::send_fd_heartbeat(msg_addr id, std::chrono::milliseconds timeout) {
+    return send_message_timeout<void>(this, messaging_verb::FD_HEARTBEAT, std::move(id), timeout);
+}
+
 void messaging_service::register_gossip_shutdown(std::function<rpc::no_wait_type (inet_address from)>&& func) {
     register_handler(this, messaging_verb::GOSSIP_SHUTDOWN, std::move(func));
 }
@@ -774,8 +815,17 @@ future<std::vector<frozen_mutation>> messaging_service::send_migration_request(m
     return send_message<std::vector<frozen_mutation>>(this, messaging_verb::MIGRATION_REQUEST, std::move(id));
 }
 
+// The wall clock time a request sent now with given timeout times out at.
+static db_clock::time_point to_deadline(messaging_service::clock_type::time_point timeout) {
+    if (timeout == messaging_service::clock_type::time_point::max()) {
+        return db_clock::time_point::max();
+    }
+    return db_clock::now() + std::chrono::duration_cast<db_clock::duration>(timeout - messaging_service::clock_type::now());
+}
+
 void messaging_service::register_mutation(std::function<future<rpc::no_wait_type> (const rpc::client_info&, frozen_mutation fm, std::vector<inet_address> forward,
-    inet_address reply_to, unsigned shard, response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info)>&& func) {
+    inet_address reply_to, unsigned shard, response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info,
+    deadline_type deadline)>&& func) {
     register_handler(this, net::messaging_verb::MUTATION, std::move(func));
 }
 void messaging_service::unregister_mutation() {
@@ -784,27 +834,53 @@ void messaging_service::unregister_mutation() {
 future<> messaging_service::send_mutation(msg_addr id, clock_type::time_point timeout, const frozen_mutation& fm, std::vector<inet_address> forward,
     inet_address reply_to, unsigned shard, response_id_type response_id, std::experimental::optional<tracing::trace_info> trace_info) {
     return send_message_oneway_timeout(this, timeout, messaging_verb::MUTATION, std::move(id), fm, std::move(forward),
-        std::move(reply_to), std::move(shard), std::move(response_id), std::move(trace_info));
+        std::move(reply_to), std::move(shard), std::move(response_id), std::move(trace_info), to_deadline(timeout));
 }
 
-void messaging_service::register_mutation_done(std::function<future<rpc::no_wait_type> (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id)>&& func) {
+void messaging_service::register_mutation_batch(std::function<future<std::vector<uint32_t>> (const rpc::client_info&, std::vector<frozen_mutation> mutations)>&& func) {
+    register_handler(this, net::messaging_verb::MUTATION_BATCH, std::move(func));
+}
+void messaging_service::unregister_mutation_batch() {
+    _rpc->unregister_handler(net::messaging_verb::MUTATION_BATCH);
+}
+future<std::vector<uint32_t>> messaging_service::send_mutation_batch(msg_addr id, clock_type::time_point timeout, std::vector<frozen_mutation> mutations) {
+    return send_message_timeout<std::vector<uint32_t>>(this, messaging_verb::MUTATION_BATCH, std::move(id), timeout, std::move(mutations));
+}
+
+void messaging_service::register_mutation_done(std::function<future<rpc::no_wait_type> (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id,
+        rpc::optional<replica_load> load)>&& func) {
     register_handler(this, net::messaging_verb::MUTATION_DONE, std::move(func));
 }
 void messaging_service::unregister_mutation_done() {
     _rpc->unregister_handler(net::messaging_verb::MUTATION_DONE);
 }
-future<> messaging_service::send_mutation_done(msg_addr id, unsigned shard, response_id_type response_id) {
-    return send_message_oneway(this, messaging_verb::MUTATION_DONE, std::move(id), std::move(shard), std::move(response_id));
+future<> messaging_service::send_mutation_done(msg_addr id, unsigned shard, response_id_type response_id, replica_load load) {
+    return send_message_oneway(this, messaging_verb::MUTATION_DONE, std::move(id), std::move(shard), std::move(response_id), std::move(load));
 }
 
-void messaging_service::register_read_data(std::function<future<foreign_ptr<lw_shared_ptr<query::result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func) {
+void messaging_service::register_read_data(std::function<future<foreign_ptr<lw_shared_ptr<query::result>>, replica_load> (const rpc::client_info&, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> da,
+        deadline_type deadline)>&& func) {
     register_handler(this, net::messaging_verb::READ_DATA, std::move(func));
 }
 void messaging_service::unregister_read_data() {
     _rpc->unregister_handler(net::messaging_verb::READ_DATA);
 }
-future<query::result> messaging_service::send_read_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr) {
-    return send_message_timeout<query::result>(this, messaging_verb::READ_DATA, std::move(id), timeout, cmd, pr);
+future<query::result, rpc::optional<replica_load>> messaging_service::send_read_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr, query::digest_algorithm da) {
+    return send_message_timeout<future<query::result, rpc::optional<replica_load>>>(this, messaging_verb::READ_DATA, std::move(id), timeout, cmd, pr, da, to_deadline(timeout));
+}
+
+void messaging_service::register_read_data_batch(std::function<future<std::vector<query::result>> (const rpc::client_info&, query::read_command cmd,
+        std::vector<query::partition_range> data_ranges, std::vector<query::partition_range> digest_ranges, query::digest_algorithm da, bool data_digest,
+        deadline_type deadline)>&& func) {
+    register_handler(this, net::messaging_verb::READ_DATA_BATCH, std::move(func));
+}
+void messaging_service::unregister_read_data_batch() {
+    _rpc->unregister_handler(net::messaging_verb::READ_DATA_BATCH);
+}
+future<std::vector<query::result>> messaging_service::send_read_data_batch(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd,
+        const std::vector<query::partition_range>& data_ranges, const std::vector<query::partition_range>& digest_ranges, query::digest_algorithm da, bool data_digest) {
+    return send_message_timeout<std::vector<query::result>>(this, messaging_verb::READ_DATA_BATCH, std::move(id), timeout, cmd, data_ranges, digest_ranges, da, data_digest,
+            to_deadline(timeout));
 }
 
 void messaging_service::register_get_schema_version(std::function<future<frozen_schema>(unsigned, table_schema_version)>&& func) {
@@ -817,6 +893,16 @@ future<frozen_schema> messaging_service::send_get_schema_version(msg_addr dst, t
     return send_message<frozen_schema>(this, messaging_verb::GET_SCHEMA_VERSION, dst, static_cast<unsigned>(dst.cpu_id), v);
 }
 
+void messaging_service::register_schema_push(std::function<rpc::no_wait_type (const rpc::client_info& cinfo, std::vector<frozen_schema> schemas)>&& func) {
+    register_handler(this, net::messaging_verb::SCHEMA_PUSH, std::move(func));
+}
+void messaging_service::unregister_schema_push() {
+    _rpc->unregister_handler(net::messaging_verb::SCHEMA_PUSH);
+}
+future<> messaging_service::send_schema_push(msg_addr id, std::vector<frozen_schema> schemas) {
+    return send_message_oneway(this, messaging_verb::SCHEMA_PUSH, std::move(id), std::move(schemas));
+}
+
 void messaging_service::register_schema_check(std::function<future<utils::UUID>()>&& func) {
     register_handler(this, net::messaging_verb::SCHEMA_CHECK, std::move(func));
 }
@@ -827,24 +913,26 @@ future<utils::UUID> messaging_service::send_schema_check(msg_addr dst) {
     return send_message<utils::UUID>(this, net::messaging_verb::SCHEMA_CHECK, dst);
 }
 
-void messaging_service::register_read_mutation_data(std::function<future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func) {
+void messaging_service::register_read_mutation_data(std::function<future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr,
+        deadline_type deadline)>&& func) {
     register_handler(this, net::messaging_verb::READ_MUTATION_DATA, std::move(func));
 }
 void messaging_service::unregister_read_mutation_data() {
     _rpc->unregister_handler(net::messaging_verb::READ_MUTATION_DATA);
 }
 future<reconcilable_result> messaging_service::send_read_mutation_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr) {
-    return send_message_timeout<reconcilable_result>(this, messaging_verb::READ_MUTATION_DATA, std::move(id), timeout, cmd, pr);
+    return send_message_timeout<reconcilable_result>(this, messaging_verb::READ_MUTATION_DATA, std::move(id), timeout, cmd, pr, to_deadline(timeout));
 }
 
-void messaging_service::register_read_digest(std::function<future<query::result_digest, api::timestamp_type> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func) {
+void messaging_service::register_read_digest(std::function<future<query::result_digest, api::timestamp_type, replica_load> (const rpc::client_info&, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> da,
+        deadline_type deadline)>&& func) {
     register_handler(this, net::messaging_verb::READ_DIGEST, std::move(func));
 }
 void messaging_service::unregister_read_digest() {
     _rpc->unregister_handler(net::messaging_verb::READ_DIGEST);
 }
-future<query::result_digest, rpc::optional<api::timestamp_type>> messaging_service::send_read_digest(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr) {
-    return send_message_timeout<future<query::result_digest, rpc::optional<api::timestamp_type>>>(this, net::messaging_verb::READ_DIGEST, std::move(id), timeout, cmd, pr);
+future<query::result_digest, rpc::optional<api::timestamp_type>, rpc::optional<replica_load>> messaging_service::send_read_digest(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr, query::digest_algorithm da) {
+    return send_message_timeout<future<query::result_digest, rpc::optional<api::timestamp_type>, rpc::optional<replica_load>>>(this, net::messaging_verb::READ_DIGEST, std::move(id), timeout, cmd, pr, da, to_deadline(timeout));
 }
 
 // Wrapper for TRUNCATE
@@ -875,18 +963,88 @@ future<> messaging_service::send_replication_finished(msg_addr id, inet_address
 // Wrapper for REPAIR_CHECKSUM_RANGE
 void messaging_service::register_repair_checksum_range(
         std::function<future<partition_checksum> (sstring keyspace,
-                sstring cf, query::range<dht::token> range, rpc::optional<repair_checksum> hash_version)>&& f) {
+                sstring cf, query::range<dht::token> range, rpc::optional<repair_checksum> hash_version,
+                rpc::optional<uint64_t> repaired_at)>&& f) {
     register_handler(this, messaging_verb::REPAIR_CHECKSUM_RANGE, std::move(f));
 }
 void messaging_service::unregister_repair_checksum_range() {
     _rpc->unregister_handler(messaging_verb::REPAIR_CHECKSUM_RANGE);
 }
 future<partition_checksum> messaging_service::send_repair_checksum_range(
-        msg_addr id, sstring keyspace, sstring cf, ::range<dht::token> range, repair_checksum hash_version)
+        msg_addr id, sstring keyspace, sstring cf, ::range<dht::token> range, repair_checksum hash_version, uint64_t repaired_at)
 {
     return send_message<partition_checksum>(this,
             messaging_verb::REPAIR_CHECKSUM_RANGE, std::move(id),
-            std::move(keyspace), std::move(cf), std::move(range), hash_version);
+            std::move(keyspace), std::move(cf), std::move(range), hash_version, repaired_at);
+}
+
+// Wrapper for REPAIR_CHECKSUM_RANGES
+void messaging_service::register_repair_checksum_ranges(
+        std::function<future<std::vector<partition_checksum>> (sstring keyspace,
+                sstring cf, std::vector<range<dht::token>> ranges, repair_checksum hash_version,
+                rpc::optional<uint64_t> repaired_at)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_CHECKSUM_RANGES, std::move(f));
+}
+void messaging_service::unregister_repair_checksum_ranges() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_CHECKSUM_RANGES);
+}
+future<std::vector<partition_checksum>> messaging_service::send_repair_checksum_ranges(
+        msg_addr id, sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, repair_checksum hash_version, uint64_t repaired_at)
+{
+    return send_message<std::vector<partition_checksum>>(this,
+            messaging_verb::REPAIR_CHECKSUM_RANGES, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(ranges), hash_version, repaired_at);
+}
+
+// Wrapper for REPAIR_MARK_REPAIRED
+void messaging_service::register_repair_mark_repaired(
+        std::function<future<> (sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, uint64_t repaired_at)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_MARK_REPAIRED, std::move(f));
+}
+void messaging_service::unregister_repair_mark_repaired() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_MARK_REPAIRED);
+}
+future<> messaging_service::send_repair_mark_repaired(
+        msg_addr id, sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, uint64_t repaired_at)
+{
+    return send_message<void>(this,
+            messaging_verb::REPAIR_MARK_REPAIRED, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(ranges), repaired_at);
+}
+
+// Wrapper for HINT_MUTATION
+void messaging_service::register_hint_mutation(std::function<future<> (const rpc::client_info& cinfo, frozen_mutation fm)>&& func) {
+    register_handler(this, messaging_verb::HINT_MUTATION, std::move(func));
+}
+void messaging_service::unregister_hint_mutation() {
+    _rpc->unregister_handler(messaging_verb::HINT_MUTATION);
+}
+future<> messaging_service::send_hint_mutation(msg_addr id, frozen_mutation fm) {
+    return send_message<void>(this, messaging_verb::HINT_MUTATION, std::move(id), std::move(fm));
+}
+
+// Wrapper for VIEW_UPDATE
+void messaging_service::register_view_update(std::function<future<> (const rpc::client_info& cinfo, frozen_mutation fm)>&& func) {
+    register_handler(this, messaging_verb::VIEW_UPDATE, std::move(func));
+}
+void messaging_service::unregister_view_update() {
+    _rpc->unregister_handler(messaging_verb::VIEW_UPDATE);
+}
+future<> messaging_service::send_view_update(msg_addr id, clock_type::time_point timeout, frozen_mutation fm) {
+    return send_message_timeout<void>(this, messaging_verb::VIEW_UPDATE, std::move(id), timeout, std::move(fm));
+}
+
+// Wrapper for COUNTER_MUTATION
+void messaging_service::register_counter_mutation(std::function<future<> (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms, int32_t cl,
+        std::experimental::optional<tracing::trace_info> trace_info)>&& func) {
+    register_handler(this, messaging_verb::COUNTER_MUTATION, std::move(func));
+}
+void messaging_service::unregister_counter_mutation() {
+    _rpc->unregister_handler(messaging_verb::COUNTER_MUTATION);
+}
+future<> messaging_service::send_counter_mutation(msg_addr id, clock_type::time_point timeout, std::vector<frozen_mutation> fms, int32_t cl,
+        std::experimental::optional<tracing::trace_info> trace_info) {
+    return send_message_timeout<void>(this, messaging_verb::COUNTER_MUTATION, std::move(id), timeout, std::move(fms), cl, std::move(trace_info));
 }
 
 } // namespace net
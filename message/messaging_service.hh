@@ -32,6 +32,8 @@
 #include "range.hh"
 #include "repair/repair.hh"
 #include "tracing/tracing.hh"
+#include "db_clock.hh"
+#include "replica_load.hh"
 
 #include <seastar/net/tls.hh>
 
@@ -99,7 +101,16 @@ enum class messaging_verb : int32_t {
     REPAIR_CHECKSUM_RANGE = 20,
     GET_SCHEMA_VERSION = 21,
     SCHEMA_CHECK = 22,
-    LAST = 23,
+    REPAIR_CHECKSUM_RANGES = 23,
+    HINT_MUTATION = 24,
+    MUTATION_BATCH = 25,
+    VIEW_UPDATE = 26,
+    READ_DATA_BATCH = 27,
+    COUNTER_MUTATION = 28,
+    FD_HEARTBEAT = 29,
+    REPAIR_MARK_REPAIRED = 30,
+    SCHEMA_PUSH = 31,
+    LAST = 32,
 };
 
 } // namespace net
@@ -175,19 +186,26 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
         all,
     };
 
+    enum class tcp_nodelay_what {
+        local,
+        all,
+    };
+
 private:
     gms::inet_address _listen_address;
     uint16_t _port;
     uint16_t _ssl_port;
     encrypt_what _encrypt_what;
     compress_what _compress_what;
+    tcp_nodelay_what _tcp_nodelay_what;
     // map: Node broadcast address -> Node internal IP for communication within the same data center
     std::unordered_map<gms::inet_address, gms::inet_address> _preferred_ip_cache;
     std::unique_ptr<rpc_protocol_wrapper> _rpc;
     std::unique_ptr<rpc_protocol_server_wrapper> _server;
     ::shared_ptr<seastar::tls::server_credentials> _credentials;
     std::unique_ptr<rpc_protocol_server_wrapper> _server_tls;
-    std::array<clients_map, 3> _clients;
+    // Connections per verb class: other, gossip, streaming and repair, writes, reads.
+    std::array<clients_map, 5> _clients;
     uint64_t _dropped_messages[static_cast<int32_t>(messaging_verb::LAST)] = {};
     bool _stopping = false;
 public:
@@ -195,7 +213,7 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
 public:
     messaging_service(gms::inet_address ip = gms::inet_address("0.0.0.0"),
             uint16_t port = 7000, bool listen_now = true);
-    messaging_service(gms::inet_address ip, uint16_t port, encrypt_what, compress_what,
+    messaging_service(gms::inet_address ip, uint16_t port, encrypt_what, compress_what, tcp_nodelay_what,
             uint16_t ssl_port, std::shared_ptr<seastar::tls::credentials_builder>,
             bool listen_now = true);
     ~messaging_service();
@@ -235,15 +253,51 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     future<> send_complete_message(msg_addr id, UUID plan_id, unsigned dst_cpu_id);
 
     // Wrapper for REPAIR_CHECKSUM_RANGE verb
-    void register_repair_checksum_range(std::function<future<partition_checksum> (sstring keyspace, sstring cf, range<dht::token> range, rpc::optional<repair_checksum> hash_version)>&& func);
+    void register_repair_checksum_range(std::function<future<partition_checksum> (sstring keyspace, sstring cf, range<dht::token> range, rpc::optional<repair_checksum> hash_version, rpc::optional<uint64_t> repaired_at)>&& func);
     void unregister_repair_checksum_range();
-    future<partition_checksum> send_repair_checksum_range(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range, repair_checksum hash_version);
+    future<partition_checksum> send_repair_checksum_range(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range, repair_checksum hash_version, uint64_t repaired_at);
+
+    // Wrapper for REPAIR_CHECKSUM_RANGES
+    void register_repair_checksum_ranges(std::function<future<std::vector<partition_checksum>> (sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, repair_checksum hash_version, rpc::optional<uint64_t> repaired_at)>&& func);
+    void unregister_repair_checksum_ranges();
+    future<std::vector<partition_checksum>> send_repair_checksum_ranges(msg_addr id, sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, repair_checksum hash_version, uint64_t repaired_at);
+
+    // Wrapper for REPAIR_MARK_REPAIRED
+    void register_repair_mark_repaired(std::function<future<> (sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, uint64_t repaired_at)>&& func);
+    void unregister_repair_mark_repaired();
+    future<> send_repair_mark_repaired(msg_addr id, sstring keyspace, sstring cf, std::vector<range<dht::token>> ranges, uint64_t repaired_at);
+
+    // Wrapper for HINT_MUTATION verb
+    void register_hint_mutation(std::function<future<> (const rpc::client_info& cinfo, frozen_mutation fm)>&& func);
+    void unregister_hint_mutation();
+    future<> send_hint_mutation(msg_addr id, frozen_mutation fm);
+
+    // Wrapper for VIEW_UPDATE verb. Applies an update of a materialized view,
+    // sent by the paired base replica, on the destination.
+    void register_view_update(std::function<future<> (const rpc::client_info& cinfo, frozen_mutation fm)>&& func);
+    void unregister_view_update();
+    future<> send_view_update(msg_addr id, clock_type::time_point timeout, frozen_mutation fm);
+
+    // Wrapper for COUNTER_MUTATION verb. Asks a replica of the counter updates
+    // to apply them as their leader, and to replicate the results with the
+    // given consistency level.
+    void register_counter_mutation(std::function<future<> (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms, int32_t cl,
+        std::experimental::optional<tracing::trace_info> trace_info)>&& func);
+    void unregister_counter_mutation();
+    future<> send_counter_mutation(msg_addr id, clock_type::time_point timeout, std::vector<frozen_mutation> fms, int32_t cl,
+        std::experimental::optional<tracing::trace_info> trace_info = std::experimental::nullopt);
 
     // Wrapper for GOSSIP_ECHO verb
     void register_gossip_echo(std::function<future<> ()>&& func);
     void unregister_gossip_echo();
     future<> send_gossip_echo(msg_addr id);
 
+    // Wrapper for FD_HEARTBEAT verb. Sent by the failure detector to every
+    // live node more often than gossip runs.
+    void register_fd_heartbeat(std::function<future<> ()>&& func);
+    void unregister_fd_heartbeat();
+    future<> send_fd_heartbeat(msg_addr id, std::chrono::milliseconds timeout);
+
     // Wrapper for GOSSIP_SHUTDOWN
     void register_gossip_shutdown(std::function<rpc::no_wait_type (inet_address from)>&& func);
     void unregister_gossip_shutdown();
@@ -276,43 +330,77 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
 
     // FIXME: response_id_type is an alias in service::storage_proxy::response_id_type
     using response_id_type = uint64_t;
+    // Wrappers for MUTATION and the READ_* verbs carry the time the coordinator
+    // stops waiting for the reply, as the wall clock deadline of the request.
+    // Older coordinators don't send it.
+    using deadline_type = rpc::optional<db_clock::time_point>;
+
     // Wrapper for MUTATION
     void register_mutation(std::function<future<rpc::no_wait_type> (const rpc::client_info&, frozen_mutation fm, std::vector<inet_address> forward,
-        inet_address reply_to, unsigned shard, response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info)>&& func);
+        inet_address reply_to, unsigned shard, response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info,
+        deadline_type deadline)>&& func);
     void unregister_mutation();
     future<> send_mutation(msg_addr id, clock_type::time_point timeout, const frozen_mutation& fm, std::vector<inet_address> forward,
         inet_address reply_to, unsigned shard, response_id_type response_id, std::experimental::optional<tracing::trace_info> trace_info = std::experimental::nullopt);
 
-    // Wrapper for MUTATION_DONE
-    void register_mutation_done(std::function<future<rpc::no_wait_type> (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id)>&& func);
+    // Wrapper for MUTATION_BATCH. Applies the mutations on the destination
+    // and replies with the indexes of those which failed.
+    void register_mutation_batch(std::function<future<std::vector<uint32_t>> (const rpc::client_info&, std::vector<frozen_mutation> mutations)>&& func);
+    void unregister_mutation_batch();
+    future<std::vector<uint32_t>> send_mutation_batch(msg_addr id, clock_type::time_point timeout, std::vector<frozen_mutation> mutations);
+
+    // Wrapper for MUTATION_DONE. Carries the load of the replica, which
+    // older replicas don't send.
+    void register_mutation_done(std::function<future<rpc::no_wait_type> (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id,
+            rpc::optional<replica_load> load)>&& func);
     void unregister_mutation_done();
-    future<> send_mutation_done(msg_addr id, unsigned shard, response_id_type response_id);
+    future<> send_mutation_done(msg_addr id, unsigned shard, response_id_type response_id, replica_load load);
 
-    // Wrapper for READ_DATA
+    // Wrapper for READ_DATA. The reply carries the load of the replica, as
+    // does the one of READ_DIGEST.
     // Note: WTH is future<foreign_ptr<lw_shared_ptr<query::result>>
-    void register_read_data(std::function<future<foreign_ptr<lw_shared_ptr<query::result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func);
+    void register_read_data(std::function<future<foreign_ptr<lw_shared_ptr<query::result>>, replica_load> (const rpc::client_info&, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> da,
+            deadline_type deadline)>&& func);
     void unregister_read_data();
-    future<query::result> send_read_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr);
+    future<query::result, rpc::optional<replica_load>> send_read_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr, query::digest_algorithm da);
+
+    // Wrapper for READ_DATA_BATCH. Reads the data of data_ranges, and the
+    // digests of digest_ranges, with one result per range, in that order.
+    // Data results carry a digest only if data_digest is set.
+    void register_read_data_batch(std::function<future<std::vector<query::result>> (const rpc::client_info&, query::read_command cmd,
+            std::vector<query::partition_range> data_ranges, std::vector<query::partition_range> digest_ranges, query::digest_algorithm da, bool data_digest,
+            deadline_type deadline)>&& func);
+    void unregister_read_data_batch();
+    future<std::vector<query::result>> send_read_data_batch(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd,
+            const std::vector<query::partition_range>& data_ranges, const std::vector<query::partition_range>& digest_ranges, query::digest_algorithm da, bool data_digest);
 
     // Wrapper for GET_SCHEMA_VERSION
     void register_get_schema_version(std::function<future<frozen_schema>(unsigned, table_schema_version)>&& func);
     void unregister_get_schema_version();
     future<frozen_schema> send_get_schema_version(msg_addr, table_schema_version);
 
+    // Wrapper for SCHEMA_PUSH. Carries new versions of table schemas, so
+    // that the receiver knows about them before requests using them arrive.
+    void register_schema_push(std::function<rpc::no_wait_type (const rpc::client_info& cinfo, std::vector<frozen_schema> schemas)>&& func);
+    void unregister_schema_push();
+    future<> send_schema_push(msg_addr id, std::vector<frozen_schema> schemas);
+
     // Wrapper for SCHEMA_CHECK
     void register_schema_check(std::function<future<utils::UUID>()>&& func);
     void unregister_schema_check();
     future<utils::UUID> send_schema_check(msg_addr);
 
     // Wrapper for READ_MUTATION_DATA
-    void register_read_mutation_data(std::function<future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func);
+    void register_read_mutation_data(std::function<future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> (const rpc::client_info&, query::read_command cmd, query::partition_range pr,
+            deadline_type deadline)>&& func);
     void unregister_read_mutation_data();
     future<reconcilable_result> send_read_mutation_data(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr);
 
     // Wrapper for READ_DIGEST
-    void register_read_digest(std::function<future<query::result_digest, api::timestamp_type> (const rpc::client_info&, query::read_command cmd, query::partition_range pr)>&& func);
+    void register_read_digest(std::function<future<query::result_digest, api::timestamp_type, replica_load> (const rpc::client_info&, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> da,
+            deadline_type deadline)>&& func);
     void unregister_read_digest();
-    future<query::result_digest, rpc::optional<api::timestamp_type>> send_read_digest(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr);
+    future<query::result_digest, rpc::optional<api::timestamp_type>, rpc::optional<replica_load>> send_read_digest(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr, query::digest_algorithm da);
 
     // Wrapper for TRUNCATE
     void register_truncate(std::function<future<>(sstring, sstring)>&& func);
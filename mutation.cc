@@ -21,6 +21,7 @@
 
 #include "mutation.hh"
 #include "query-result-writer.hh"
+#include "query-result-columnar.hh"
 
 mutation::data::data(dht::decorated_key&& key, schema_ptr&& schema)
     : _schema(std::move(schema))
@@ -140,22 +141,36 @@ mutation::query(query::result::builder& builder,
     p.query_compacted(pb, *schema(), limit);
 }
 
+void
+mutation::query(query::columnar_result_builder& builder,
+    const query::partition_slice& slice,
+    gc_clock::time_point now,
+    uint32_t row_limit) &&
+{
+    builder.start_partition(*schema(), key());
+    auto is_reversed = slice.options.contains<query::partition_slice::option::reversed>();
+    mutation_partition& p = partition();
+    auto limit = std::min(row_limit, slice.partition_row_limit());
+    p.compact_for_query(*schema(), now, slice.row_ranges(*schema(), key()), is_reversed, limit);
+    p.query_compacted(builder, *schema(), limit);
+}
+
 query::result
 mutation::query(const query::partition_slice& slice,
-    query::result_request request,
+    query::result_options opts,
     gc_clock::time_point now, uint32_t row_limit) &&
 {
-    query::result::builder builder(slice, request);
+    query::result::builder builder(slice, opts);
     std::move(*this).query(builder, slice, now, row_limit);
     return builder.build();
 }
 
 query::result
 mutation::query(const query::partition_slice& slice,
-    query::result_request request,
+    query::result_options opts,
     gc_clock::time_point now, uint32_t row_limit) const&
 {
-    return mutation(*this).query(slice, request, now, row_limit);
+    return mutation(*this).query(slice, opts, now, row_limit);
 }
 
 size_t
@@ -49,16 +49,27 @@ concept bool CompactedMutationsConsumer() {
         obj.consume_new_partition(dk);
         obj.consume(t);
         obj.consume(std::move(sr), current_tombstone, is_alive);
-        obj.consume(std::move(cr), current_tombstone, is_alive);
+        { obj.consume(std::move(cr), current_tombstone, is_alive) } -> stop_iteration;
         obj.consume(std::move(rt));
-        obj.consume_end_of_partition();
+        { obj.consume_end_of_partition() } -> stop_iteration;
         obj.consume_end_of_stream();
     };
 }
 */
+// When querying, a consumer returning stop_iteration::yes for a clustering
+// row ends the partition after it, and ends the query along with the
+// partition. One returning it from consume_end_of_partition() ends the
+// query. SSTable compaction ignores both.
 // emit_only_live::yes will cause compact_for_query to emit only live
 // static and clustering rows. It doesn't affect the way range tombstones are
 // emitted.
+// Tombstones past gc_grace_seconds sstable compaction came across, and how
+// many of them it could purge.
+struct tombstone_purge_stats {
+    uint64_t expired = 0;
+    uint64_t purged = 0;
+};
+
 template<emit_only_live_rows OnlyLive, compact_for_sstables SSTableCompaction, typename CompactedMutationsConsumer>
 class compact_mutation {
     const schema& _schema;
@@ -81,6 +92,10 @@ class compact_mutation {
     bool _empty_partition{};
     const dht::decorated_key* _dk;
     bool _has_ck_selector{};
+    bool _stopped_by_consumer{};
+    query::tombstone_counter* _tombstones = nullptr;
+    tombstone_purge_stats* _purge_stats = nullptr;
+    bool _partition_tombstone_purged{};
 private:
     static constexpr bool only_live() {
         return OnlyLive == emit_only_live_rows::yes;
@@ -94,7 +109,7 @@ class compact_mutation {
             _empty_partition = false;
             _consumer.consume_new_partition(*_dk);
             auto pt = _range_tombstones.get_partition_tombstone();
-            if (pt && !can_purge_tombstone(pt)) {
+            if (pt && !_partition_tombstone_purged) {
                 _consumer.consume(pt);
             }
         }
@@ -114,13 +129,27 @@ class compact_mutation {
         if (_max_purgeable == api::missing_timestamp) {
             _max_purgeable = _get_max_purgeable(*_dk);
         }
-        return t.timestamp < _max_purgeable;
+        // Only called for tombstones past gc_grace_seconds.
+        bool purged = t.timestamp < _max_purgeable;
+        if (_purge_stats) {
+            ++_purge_stats->expired;
+            _purge_stats->purged += purged;
+        }
+        return purged;
     };
+
+    void tombstone_scanned() {
+        if (_tombstones) {
+            _tombstones->scanned();
+        }
+    }
 public:
     compact_mutation(compact_mutation&&) = delete; // Because 'this' is captured
 
+    // If tombstones is given, scanned tombstones are counted there, and the
+    // query is aborted when the counter's failure threshold is exceeded.
     compact_mutation(const schema& s, gc_clock::time_point query_time, const query::partition_slice& slice, uint32_t limit,
-              uint32_t partition_limit, CompactedMutationsConsumer consumer)
+              uint32_t partition_limit, CompactedMutationsConsumer consumer, query::tombstone_counter* tombstones = nullptr)
         : _schema(s)
         , _query_time(query_time)
         , _gc_before(query_time - s.gc_grace_seconds())
@@ -131,12 +160,15 @@ class compact_mutation {
         , _partition_row_limit(_slice.options.contains(query::partition_slice::option::distinct) ? 1 : slice.partition_row_limit())
         , _consumer(std::move(consumer))
         , _range_tombstones(s, _slice.options.contains(query::partition_slice::option::reversed))
+        , _tombstones(tombstones)
     {
         static_assert(!sstable_compaction(), "This constructor cannot be used for sstable compaction.");
     }
 
+    // If purge_stats is given, expired tombstones are counted there.
     compact_mutation(const schema& s, gc_clock::time_point compaction_time, CompactedMutationsConsumer consumer,
-                     std::function<api::timestamp_type(const dht::decorated_key&)> get_max_purgeable)
+                     std::function<api::timestamp_type(const dht::decorated_key&)> get_max_purgeable,
+                     tombstone_purge_stats* purge_stats = nullptr)
         : _schema(s)
         , _query_time(compaction_time)
         , _gc_before(_query_time - s.gc_grace_seconds())
@@ -145,6 +177,7 @@ class compact_mutation {
         , _slice(query::full_slice)
         , _consumer(std::move(consumer))
         , _range_tombstones(s, false)
+        , _purge_stats(purge_stats)
     {
         static_assert(sstable_compaction(), "This constructor can only be used for sstable compaction.");
         static_assert(!only_live(), "SSTable compaction cannot be run with emit_only_live_rows::yes.");
@@ -153,18 +186,25 @@ class compact_mutation {
     void consume_new_partition(const dht::decorated_key& dk) {
         auto& pk = dk.key();
         _dk = &dk;
-        _has_ck_selector = has_ck_selector(_slice.row_ranges(_schema, pk));
+        // A partition with filters has to have matching rows to be returned,
+        // like one with a restriction of its clustering key.
+        _has_ck_selector = has_ck_selector(_slice.row_ranges(_schema, pk)) || !_slice.filters().empty();
         _empty_partition = true;
         _rows_in_current_partition = 0;
         _static_row_live = false;
         _range_tombstones.clear();
         _current_partition_limit = std::min(_row_limit, _partition_row_limit);
         _max_purgeable = api::missing_timestamp;
+        _partition_tombstone_purged = false;
     }
 
     void consume(tombstone t) {
+        if (t) {
+            tombstone_scanned();
+        }
         _range_tombstones.set_partition_tombstone(t);
-        if (!only_live() && !can_purge_tombstone(t)) {
+        _partition_tombstone_purged = can_purge_tombstone(t);
+        if (!only_live() && !_partition_tombstone_purged) {
             partition_is_not_empty();
         }
     }
@@ -186,17 +226,31 @@ class compact_mutation {
         auto current_tombstone = _range_tombstones.tombstone_for_row(cr.key());
         auto t = current_tombstone;
         t.apply(cr.tomb());
+        bool has_tombstone = bool(cr.tomb());
         if (cr.tomb() <= current_tombstone || can_purge_tombstone(cr.tomb())) {
             cr.remove_tombstone();
         }
         bool is_live = cr.marker().compact_and_expire(t, _query_time, _can_gc, _gc_before);
         is_live |= cr.cells().compact_and_expire(_schema, column_kind::regular_column, t, _query_time, _can_gc, _gc_before);
+        if (has_tombstone || !is_live) {
+            // A row which is deleted or has only dead data costs as much to scan as a tombstone.
+            tombstone_scanned();
+        }
+        if (is_live && !sstable_compaction() && !_slice.filters().empty() && !matches_filters(_schema, _slice, cr.cells())) {
+            // When emitting dead rows too, the row is emitted so that results
+            // of replicas can be reconciled, but it doesn't count as a match.
+            is_live = false;
+        }
         if (only_live() && is_live) {
             partition_is_not_empty();
-            _consumer.consume(std::move(cr), t, true);
+            auto stop = _consumer.consume(std::move(cr), t, true);
             if (++_rows_in_current_partition == _current_partition_limit) {
                 return stop_iteration::yes;
             }
+            if (stop) {
+                _stopped_by_consumer = true;
+                return stop_iteration::yes;
+            }
         } else if (!only_live()) {
             if (is_live) {
                 if (!sstable_compaction() && _rows_in_current_partition == _current_partition_limit) {
@@ -206,13 +260,17 @@ class compact_mutation {
             }
             if (!cr.empty()) {
                 partition_is_not_empty();
-                _consumer.consume(std::move(cr), t, is_live);
+                if (_consumer.consume(std::move(cr), t, is_live) && !sstable_compaction()) {
+                    _stopped_by_consumer = true;
+                    return stop_iteration::yes;
+                }
             }
         }
         return stop_iteration::no;
     }
 
     stop_iteration consume(range_tombstone&& rt) {
+        tombstone_scanned();
         _range_tombstones.apply(rt);
         // FIXME: drop tombstone if it is fully covered by other range tombstones
         if (!can_purge_tombstone(rt.tomb) && rt.tomb > _range_tombstones.get_partition_tombstone()) {
@@ -232,9 +290,9 @@ class compact_mutation {
 
             _row_limit -= _rows_in_current_partition;
             _partition_limit -= _rows_in_current_partition > 0;
-            _consumer.consume_end_of_partition();
+            _stopped_by_consumer |= bool(_consumer.consume_end_of_partition());
             if (!sstable_compaction()) {
-                return _row_limit && _partition_limit ? stop_iteration::no : stop_iteration::yes;
+                return _row_limit && _partition_limit && !_stopped_by_consumer ? stop_iteration::no : stop_iteration::yes;
             }
         }
         return stop_iteration::no;
@@ -23,15 +23,20 @@
 #include <seastar/util/defer.hh>
 #include "mutation_partition.hh"
 #include "mutation_partition_applier.hh"
+#include "counters.hh"
 #include "converting_mutation_partition_applier.hh"
 #include "partition_builder.hh"
 #include "query-result-writer.hh"
+#include "query-result-columnar.hh"
 #include "atomic_cell_hash.hh"
 #include "reversibly_mergeable.hh"
 #include "streamed_mutation.hh"
 #include "mutation_query.hh"
 #include "service/priority_manager.hh"
+#include "service/request_scheduler.hh"
 #include "mutation_compactor.hh"
+#include "querier_cache.hh"
+#include "utils/alloc_tracker.hh"
 
 template<bool reversed>
 struct reversal_traits;
@@ -110,7 +115,7 @@ struct reversal_traits<true> {
 
 //
 // apply_reversibly_intrusive_set() and revert_intrusive_set() implement ReversiblyMergeable
-// for a boost::intrusive_set<> container of ReversiblyMergeable entries.
+// for a bptree<> container of ReversiblyMergeable entries.
 //
 // See reversibly_mergeable.hh
 //
@@ -151,8 +156,8 @@ void revert_intrusive_set_range(Container& dst, Container& src,
 
         if (e.empty()) {
             dst.erase(i);
-            start = src.erase_and_dispose(start, deleter);
-            start = src.insert_before(start, dst_e);
+            src.replace_node(start, dst_e);
+            deleter(&e);
         } else {
             revert(dst_e, e);
         }
@@ -193,11 +198,14 @@ auto apply_reversibly_intrusive_set(Container& dst, Container& src, Apply&& appl
             if (i == dst.end() || dst.key_comp()(src_e, *i)) {
                 // Construct neutral entry which will represent missing dst entry for revert.
                 value_type* empty_e = current_allocator().construct<value_type>(src_e.key());
-                [&] () noexcept {
-                    src_i = src.erase(src_i);
-                    src_i = src.insert_before(src_i, *empty_e);
+                src.replace_node(src_i, *empty_e);
+                try {
                     dst.insert_before(i, src_e);
-                }();
+                } catch (...) {
+                    src.replace_node(src_i, src_e);
+                    current_allocator().destroy(empty_e);
+                    throw;
+                }
             } else {
                 apply(*i, src_e);
             }
@@ -339,6 +347,41 @@ mutation_partition::apply(const schema& s, mutation_partition&& p) {
     revert_static_row.cancel();
 }
 
+stop_iteration
+mutation_partition::apply_some(const schema& s, mutation_partition& p, size_t max_rows) {
+    auto deleter = current_deleter<rows_entry>();
+    auto src_i = p._rows.begin();
+    while (src_i != p._rows.end()) {
+        if (!max_rows--) {
+            return stop_iteration::no;
+        }
+        rows_entry& src_e = *src_i;
+        if (src_e.empty()) {
+            src_i = p._rows.erase_and_dispose(src_i, deleter);
+            continue;
+        }
+        auto i = _rows.lower_bound(src_e);
+        if (i == _rows.end() || _rows.key_comp()(src_e, *i)) {
+            // Keeps the position of src_e in p, so that p is unchanged if
+            // the insertion fails.
+            rows_entry* placeholder = current_allocator().construct<rows_entry>(src_e.key());
+            p._rows.replace_node(src_i, *placeholder);
+            try {
+                _rows.insert_before(i, src_e);
+            } catch (...) {
+                p._rows.replace_node(src_i, src_e);
+                current_allocator().destroy(placeholder);
+                throw;
+            }
+        } else {
+            i->apply_reversibly(s, src_e);
+        }
+        src_i = p._rows.erase_and_dispose(src_i, deleter);
+    }
+    apply(s, std::move(p));
+    return stop_iteration::yes;
+}
+
 void
 mutation_partition::apply(const schema& s, mutation_partition_view p, const schema& p_schema) {
     if (p_schema.version() == s.version()) {
@@ -355,6 +398,19 @@ mutation_partition::apply(const schema& s, mutation_partition_view p, const sche
     }
 }
 
+void
+mutation_partition::apply_weak(const schema& s, mutation_partition_view p, const schema& p_schema) {
+    // Applying a mutation is idempotent, so re-applying the part which got
+    // applied before the failure doesn't change the result.
+    if (p_schema.version() == s.version()) {
+        mutation_partition_applier v(s, *this);
+        p.accept(s, v);
+    } else {
+        converting_mutation_partition_applier v(p_schema.get_column_mapping(), s, *this);
+        p.accept(p_schema.get_column_mapping(), v);
+    }
+}
+
 tombstone
 mutation_partition::range_tombstone_for_row(const schema& schema, const clustering_key& key) const {
     tombstone t = _tombstone;
@@ -432,18 +488,18 @@ mutation_partition::apply_insert(const schema& s, clustering_key_view key, api::
 }
 
 void mutation_partition::insert_row(const schema& s, const clustering_key& key, deletable_row&& row) {
-    auto e = current_allocator().construct<rows_entry>(key, std::move(row));
+    auto e = current_allocator().construct<rows_entry>(_rows.key_comp(), key, std::move(row));
     _rows.insert(_rows.end(), *e);
 }
 
 void mutation_partition::insert_row(const schema& s, const clustering_key& key, const deletable_row& row) {
-    auto e = current_allocator().construct<rows_entry>(key, row);
+    auto e = current_allocator().construct<rows_entry>(_rows.key_comp(), key, row);
     _rows.insert(_rows.end(), *e);
 }
 
 const row*
 mutation_partition::find_row(const clustering_key& key) const {
-    auto i = _rows.find(key);
+    auto i = _rows.find(_rows.key_comp().make_lookup_key(key));
     if (i == _rows.end()) {
         return nullptr;
     }
@@ -452,9 +508,10 @@ mutation_partition::find_row(const clustering_key& key) const {
 
 deletable_row&
 mutation_partition::clustered_row(clustering_key&& key) {
-    auto i = _rows.find(key);
+    auto& cmp = _rows.key_comp();
+    auto i = _rows.find(cmp.make_lookup_key(key));
     if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(std::move(key));
+        auto e = current_allocator().construct<rows_entry>(cmp, std::move(key));
         _rows.insert(i, *e);
         return e->row();
     }
@@ -463,9 +520,10 @@ mutation_partition::clustered_row(clustering_key&& key) {
 
 deletable_row&
 mutation_partition::clustered_row(const clustering_key& key) {
-    auto i = _rows.find(key);
+    auto& cmp = _rows.key_comp();
+    auto i = _rows.find(cmp.make_lookup_key(key));
     if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(key);
+        auto e = current_allocator().construct<rows_entry>(cmp, key);
         _rows.insert(i, *e);
         return e->row();
     }
@@ -474,9 +532,10 @@ mutation_partition::clustered_row(const clustering_key& key) {
 
 deletable_row&
 mutation_partition::clustered_row(const schema& s, const clustering_key_view& key) {
-    auto i = _rows.find(key, rows_entry::compare(s));
+    rows_entry::compare cmp(s);
+    auto i = _rows.find(cmp.make_lookup_key(key), cmp);
     if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(key);
+        auto e = current_allocator().construct<rows_entry>(cmp, key);
         _rows.insert(i, *e);
         return e->row();
     }
@@ -580,6 +639,24 @@ void write_cell(RowWriter& w, const query::partition_slice& slice, ::atomic_cell
     }().end_qr_cell();
 }
 
+// Query results carry the value of a counter, not its shards.
+template<typename RowWriter>
+void write_counter_cell(RowWriter& w, const query::partition_slice& slice, ::atomic_cell_view c) {
+    assert(c.is_live());
+    auto total = counter_cell_view(c).total_value();
+    ser::writer_of_qr_cell wr = w.add().write();
+    [&, wr = std::move(wr)] () mutable {
+        if (slice.options.contains<query::partition_slice::option::send_timestamp>()) {
+            return std::move(wr).write_timestamp(c.timestamp());
+        } else {
+            return std::move(wr).skip_timestamp();
+        }
+    }().skip_expiry()
+        .write_value(long_type->decompose(total))
+        .skip_ttl()
+        .end_qr_cell();
+}
+
 template<typename RowWriter>
 void write_cell(RowWriter& w, const query::partition_slice& slice, const data_type& type, collection_mutation_view v) {
     auto ctype = static_pointer_cast<const collection_type_impl>(type);
@@ -594,7 +671,7 @@ void write_cell(RowWriter& w, const query::partition_slice& slice, const data_ty
 }
 
 // returns the timestamp of a latest update to the row
-static api::timestamp_type hash_row_slice(md5_hasher& hasher,
+static api::timestamp_type hash_row_slice(query::digester& hasher,
     const schema& s,
     column_kind kind,
     const row& cells,
@@ -621,6 +698,27 @@ static api::timestamp_type hash_row_slice(md5_hasher& hasher,
     return max;
 }
 
+// Lowers the point until which the result is valid to the earliest expiry
+// of the live cells of the row.
+static void add_row_expiry(query::result::partition_writer& pw, const schema& s, column_kind kind, const row& cells) {
+    cells.for_each_cell([&] (column_id id, const atomic_cell_or_collection& cell) {
+        auto&& def = s.column_at(kind, id);
+        if (def.is_atomic()) {
+            auto c = cell.as_atomic_cell();
+            if (c.is_live_and_has_ttl()) {
+                pw.add_expiry(c.expiry());
+            }
+        } else {
+            auto mv = collection_type_impl::deserialize_mutation_form(cell.as_collection_mutation());
+            for (auto&& c : mv.cells) {
+                if (c.second.is_live_and_has_ttl()) {
+                    pw.add_expiry(c.second.expiry());
+                }
+            }
+        }
+    });
+}
+
 template<typename RowWriter>
 static void get_compacted_row_slice(const schema& s,
     const query::partition_slice& slice,
@@ -639,6 +737,8 @@ static void get_compacted_row_slice(const schema& s,
                 auto c = cell->as_atomic_cell();
                 if (!c.is_live()) {
                     writer.add().skip();
+                } else if (def.is_counter()) {
+                    write_counter_cell(writer, slice, c);
                 } else {
                     write_cell(writer, slice, cell->as_atomic_cell());
                 }
@@ -655,6 +755,36 @@ static void get_compacted_row_slice(const schema& s,
     }
 }
 
+static bool matches_filter(const schema& s, const query::column_filter& f, const row& cells) {
+    const atomic_cell_or_collection* cell = cells.find_cell(f.column);
+    if (!cell) {
+        return false;
+    }
+    auto&& def = s.regular_column_at(f.column);
+    if (!def.is_atomic()) {
+        return false;
+    }
+    auto c = cell->as_atomic_cell();
+    if (!c.is_live()) {
+        return false;
+    }
+    auto r = def.type->compare(c.value(), f.value);
+    switch (f.type) {
+    case query::column_filter::op::eq: return r == 0;
+    case query::column_filter::op::lt: return r < 0;
+    case query::column_filter::op::lte: return r <= 0;
+    case query::column_filter::op::gt: return r > 0;
+    case query::column_filter::op::gte: return r >= 0;
+    }
+    abort();
+}
+
+bool matches_filters(const schema& s, const query::partition_slice& slice, const row& cells) {
+    return std::all_of(slice.filters().begin(), slice.filters().end(), [&] (const query::column_filter& f) {
+        return matches_filter(s, f, cells);
+    });
+}
+
 bool has_any_live_data(const schema& s, column_kind kind, const row& cells, tombstone tomb = tombstone(),
                        gc_clock::time_point now = gc_clock::time_point::min()) {
     bool any_live = false;
@@ -681,6 +811,7 @@ bool has_any_live_data(const schema& s, column_kind kind, const row& cells, tomb
 
 void
 mutation_partition::query_compacted(query::result::partition_writer& pw, const schema& s, uint32_t limit) const {
+    utils::alloc_scope alloc(utils::alloc_scope_id::partition_query);
     const query::partition_slice& slice = pw.slice();
 
     if (limit == 0) {
@@ -721,7 +852,7 @@ mutation_partition::query_compacted(query::result::partition_writer& pw, const s
             pw.last_modified() = std::max({pw.last_modified(), row_tombstone.timestamp, t});
         }
 
-        if (row.is_live(s)) {
+        if (row.is_live(s) && matches_filters(s, slice, row.cells())) {
             if (pw.requested_result()) {
                 auto cells_wr = [&] {
                     if (send_ck) {
@@ -747,7 +878,7 @@ mutation_partition::query_compacted(query::result::partition_writer& pw, const s
     // If ck:s exist, and we do a restriction on them, we either have maching
     // rows, or return nothing, since cql does not allow "is null".
     if (row_count == 0
-			&& (has_ck_selector(pw.ranges())
+			&& (has_ck_selector(pw.ranges()) || !slice.filters().empty()
 					|| !has_any_live_data(s, column_kind::static_column, static_row()))) {
 		pw.retract();
 	} else {
@@ -756,6 +887,87 @@ mutation_partition::query_compacted(query::result::partition_writer& pw, const s
 	}
 }
 
+// Columnar counterpart of get_compacted_row_slice(), adds an entry for each of
+// the columns to the corresponding blocks of the result.
+static void get_compacted_row_slice(const schema& s,
+    const query::partition_slice& slice,
+    column_kind kind,
+    const row& cells,
+    const std::vector<column_id>& columns,
+    query::columnar_result_builder& rb)
+{
+    for (size_t i = 0; i < columns.size(); ++i) {
+        auto& column = kind == column_kind::static_column ? rb.static_column(i) : rb.regular_column(i);
+        const atomic_cell_or_collection* cell = cells.find_cell(columns[i]);
+        if (!cell) {
+            column.add_null();
+            continue;
+        }
+        auto&& def = s.column_at(kind, columns[i]);
+        if (def.is_atomic()) {
+            auto c = cell->as_atomic_cell();
+            if (!c.is_live()) {
+                column.add_null();
+            } else if (def.is_counter()) {
+                column.add(long_type->decompose(counter_cell_view(c).total_value()), c.timestamp());
+            } else if (c.is_live_and_has_ttl()) {
+                column.add(c.value(), c.timestamp(), c.expiry(), c.ttl());
+            } else {
+                column.add(c.value(), c.timestamp());
+            }
+        } else {
+            auto&& mut = cell->as_collection_mutation();
+            auto ctype = static_pointer_cast<const collection_type_impl>(def.type);
+            if (!ctype->is_any_live(mut)) {
+                column.add_null();
+                continue;
+            }
+            if (slice.options.contains<query::partition_slice::option::collections_as_maps>()) {
+                ctype = map_type_impl::get_instance(ctype->name_comparator(), ctype->value_comparator(), true);
+            }
+            column.add(ctype->to_value(mut, slice.cql_format()));
+        }
+    }
+}
+
+void
+mutation_partition::query_compacted(query::columnar_result_builder& rb, const schema& s, uint32_t limit) const {
+    utils::alloc_scope alloc(utils::alloc_scope_id::partition_query);
+    const query::partition_slice& slice = rb.slice();
+
+    if (limit == 0) {
+        rb.retract_partition();
+        return;
+    }
+
+    get_compacted_row_slice(s, slice, column_kind::static_column, static_row(), slice.static_columns, rb);
+
+    uint32_t row_count = 0;
+
+    auto is_reversed = slice.options.contains(query::partition_slice::option::reversed);
+    for_each_row(s, query::clustering_range::make_open_ended_both_sides(), is_reversed, [&] (const rows_entry& e) {
+        auto& row = e.row();
+        if (row.is_live(s) && matches_filters(s, slice, row.cells())) {
+            rb.add_row(e.key());
+            get_compacted_row_slice(s, slice, column_kind::regular_column, row.cells(), slice.regular_columns, rb);
+            ++row_count;
+            if (--limit == 0) {
+                return stop_iteration::yes;
+            }
+        }
+        return stop_iteration::no;
+    });
+
+    // See the row-oriented version for why a partition with no rows is dropped.
+    if (row_count == 0
+            && (has_ck_selector(rb.ranges()) || !slice.filters().empty()
+                    || !has_any_live_data(s, column_kind::static_column, static_row()))) {
+        rb.retract_partition();
+    } else {
+        rb.end_partition(row_count ? : 1);
+    }
+}
+
 std::ostream&
 operator<<(std::ostream& os, const std::pair<column_id, const atomic_cell_or_collection&>& c) {
     return fprint(os, "{column: %s %s}", c.first, c.second);
@@ -771,6 +983,9 @@ operator<<(std::ostream& os, const row& r) {
     case row::storage_type::vector:
         cells = ::join(", ", r.get_range_vector());
         break;
+    case row::storage_type::packed:
+        cells = ::join(", ", r.get_range_packed());
+        break;
     }
     return fprint(os, "{row: %s}", cells);
 }
@@ -897,7 +1112,13 @@ void
 apply_reversibly(const column_definition& def, atomic_cell_or_collection& dst,  atomic_cell_or_collection& src) {
     // Must be run via with_linearized_managed_bytes() context, but assume it is
     // provided via an upper layer
-    if (def.is_atomic()) {
+    if (def.is_counter() && dst.as_atomic_cell().is_live() && src.as_atomic_cell().is_live()) {
+        // Like collections, merged counter cells are made of both, so they
+        // are reverted by swapping back.
+        src = counter_cell_view::merge(dst.as_atomic_cell(), src.as_atomic_cell());
+        std::swap(dst, src);
+        src.as_atomic_cell_ref().set_revert(true);
+    } else if (def.is_atomic()) {
         auto&& src_ac = src.as_atomic_cell_ref();
         if (compare_atomic_cell_for_merge(dst.as_atomic_cell(), src.as_atomic_cell()) < 0) {
             std::swap(dst, src);
@@ -961,6 +1182,23 @@ void row::for_each_cell(Func&& func, Rollback&& rollback) {
             }
             throw;
         }
+    } else if (_type == storage_type::packed) {
+        auto& p = _storage.packed;
+        size_type idx = 0;
+        column_id id = 0;
+        try {
+            for (; idx < p.cells.size(); ++idx, ++id) {
+                id = p.next_present(id);
+                func(id, p.cells[idx]);
+            }
+        } catch (...) {
+            while (idx) {
+                --idx;
+                id = p.prev_present(id);
+                rollback(id, p.cells[idx]);
+            }
+            throw;
+        }
     } else {
         auto i = _storage.set.begin();
         try {
@@ -984,6 +1222,13 @@ void row::for_each_cell(Func&& func) {
         for (auto i : bitsets::for_each_set(_storage.vector.present)) {
             func(i, _storage.vector.v[i]);
         }
+    } else if (_type == storage_type::packed) {
+        auto& p = _storage.packed;
+        column_id id = 0;
+        for (size_type idx = 0; idx < p.cells.size(); ++idx, ++id) {
+            id = p.next_present(id);
+            func(id, p.cells[idx]);
+        }
     } else {
         for (auto& cell : _storage.set) {
             func(cell.id(), cell.cell());
@@ -1012,9 +1257,20 @@ row::apply_reversibly(const column_definition& column, atomic_cell_or_collection
         } else {
             ::apply_reversibly(column, _storage.vector.v[id], value);
         }
-    } else {
+    } else if (_type != storage_type::set && id < max_packed_size) {
         if (_type == storage_type::vector) {
-            vector_to_set();
+            vector_to_packed();
+        }
+        auto& p = _storage.packed;
+        if (!p.test(id)) {
+            p.insert(id, std::move(value));
+            _size++;
+        } else {
+            ::apply_reversibly(column, p.cells[p.index_of(id)], value);
+        }
+    } else {
+        if (_type != storage_type::set) {
+            to_set();
         }
         auto i = _storage.set.lower_bound(id, cell_entry::compare());
         if (i == _storage.set.end() || i->id() != id) {
@@ -1040,6 +1296,17 @@ row::revert(const column_definition& column, atomic_cell_or_collection& src) noe
         } else {
             ::revert(column, dst, src);
         }
+    } else if (_type == storage_type::packed) {
+        auto& p = _storage.packed;
+        auto idx = p.index_of(id);
+        auto& dst = p.cells[idx];
+        if (!src) {
+            std::swap(dst, src);
+            p.erase(id, idx);
+            --_size;
+        } else {
+            ::revert(column, dst, src);
+        }
     } else {
         auto i = _storage.set.find(id, cell_entry::compare());
         auto& dst = i->cell();
@@ -1059,9 +1326,14 @@ row::append_cell(column_id id, atomic_cell_or_collection value) {
         _storage.vector.v.resize(id);
         _storage.vector.v.emplace_back(std::move(value));
         _storage.vector.present.set(id);
-    } else {
+    } else if (_type != storage_type::set && id < max_packed_size) {
         if (_type == storage_type::vector) {
-            vector_to_set();
+            vector_to_packed();
+        }
+        _storage.packed.insert(id, std::move(value));
+    } else {
+        if (_type != storage_type::set) {
+            to_set();
         }
         auto e = current_allocator().construct<cell_entry>(id, std::move(value));
         _storage.set.insert(_storage.set.end(), *e);
@@ -1076,6 +1348,11 @@ row::find_cell(column_id id) const {
             return nullptr;
         }
         return &_storage.vector.v[id];
+    } else if (_type == storage_type::packed) {
+        if (!_storage.packed.test(id)) {
+            return nullptr;
+        }
+        return &_storage.packed.cells[_storage.packed.index_of(id)];
     } else {
         auto i = _storage.set.find(id, cell_entry::compare());
         if (i == _storage.set.end()) {
@@ -1092,6 +1369,11 @@ size_t row::memory_usage() const {
         for (auto&& ac_o_c : _storage.vector.v) {
             mem += ac_o_c.memory_usage();
         }
+    } else if (_type == storage_type::packed) {
+        mem += _storage.packed.present.memory_usage() + _storage.packed.cells.memory_usage();
+        for (auto&& ac_o_c : _storage.packed.cells) {
+            mem += ac_o_c.memory_usage();
+        }
     } else {
         for (auto&& ce : _storage.set) {
             mem += sizeof(cell_entry) + ce.cell().memory_usage();
@@ -1137,6 +1419,8 @@ void mutation_partition::trim_rows(const schema& s,
 
             if (e.empty()) {
                 last = reversal_traits<reversed>::erase_and_dispose(_rows, last, std::next(last, 1), deleter);
+                // Erasing invalidates iterators into the same leaf.
+                end = reversal_traits<reversed>::maybe_reverse(_rows, range_end(row_range));
             } else {
                 ++last;
             }
@@ -1282,11 +1566,10 @@ mutation_partition::live_row_count(const schema& s, gc_clock::time_point query_t
 
 rows_entry::rows_entry(rows_entry&& o) noexcept
     : _key(std::move(o._key))
+    , _abbreviated_key(o._abbreviated_key)
     , _row(std::move(o._row))
 {
-    using container_type = mutation_partition::rows_type;
-    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
-    container_type::node_algorithms::init(o._link.this_ptr());
+    mutation_partition::rows_type::move_hook(o, *this);
 }
 
 row::row(const row& o)
@@ -1295,6 +1578,8 @@ row::row(const row& o)
 {
     if (_type == storage_type::vector) {
         new (&_storage.vector) vector_storage(o._storage.vector);
+    } else if (_type == storage_type::packed) {
+        new (&_storage.packed) packed_storage(o._storage.packed);
     } else {
         auto cloner = [] (const auto& x) {
             return current_allocator().construct<std::remove_const_t<std::remove_reference_t<decltype(x)>>>(x);
@@ -1312,6 +1597,8 @@ row::row(const row& o)
 row::~row() {
     if (_type == storage_type::vector) {
         _storage.vector.~vector_storage();
+    } else if (_type == storage_type::packed) {
+        _storage.packed.~packed_storage();
     } else {
         _storage.set.clear_and_dispose(current_deleter<cell_entry>());
         _storage.set.~map_type();
@@ -1341,54 +1628,101 @@ const atomic_cell_or_collection& row::cell_at(column_id id) const {
     return *cell;
 }
 
-void row::vector_to_set()
+void row::vector_to_packed()
 {
     assert(_type == storage_type::vector);
-    map_type set;
-    try {
+    packed_storage packed;
+    packed.cells.reserve(_size);
+    packed.present.resize(1);
+    packed.present[0] = _storage.vector.present.to_ullong();
     for (auto i : bitsets::for_each_set(_storage.vector.present)) {
-        auto& c = _storage.vector.v[i];
-        auto e = current_allocator().construct<cell_entry>(i, std::move(c));
-        set.insert(set.end(), *e);
+        packed.cells.emplace_back(std::move(_storage.vector.v[i]));
     }
+    _storage.vector.~vector_storage();
+    new (&_storage.packed) packed_storage(std::move(packed));
+    _type = storage_type::packed;
+}
+
+void row::to_set()
+{
+    assert(_type != storage_type::set);
+    map_type set;
+    try {
+        for_each_cell([&] (column_id id, atomic_cell_or_collection& c) {
+            auto e = current_allocator().construct<cell_entry>(id, std::move(c));
+            set.insert(set.end(), *e);
+        });
     } catch (...) {
         set.clear_and_dispose([this, del = current_deleter<cell_entry>()] (cell_entry* ce) noexcept {
-            _storage.vector.v[ce->id()] = std::move(ce->cell());
+            *const_cast<atomic_cell_or_collection*>(find_cell(ce->id())) = std::move(ce->cell());
             del(ce);
         });
         throw;
     }
-    _storage.vector.~vector_storage();
+    if (_type == storage_type::vector) {
+        _storage.vector.~vector_storage();
+    } else {
+        _storage.packed.~packed_storage();
+    }
     new (&_storage.set) map_type(std::move(set));
     _type = storage_type::set;
 }
 
+column_id row::last_column_id() const
+{
+    switch (_type) {
+    case storage_type::vector:
+        return _storage.vector.v.size() - 1;
+    case storage_type::packed: {
+        auto& p = _storage.packed;
+        return p.prev_present(p.present.size() * 64);
+    }
+    case storage_type::set:
+        break;
+    }
+    return _storage.set.rbegin()->id();
+}
+
 void row::reserve(column_id last_column)
 {
     if (_type == storage_type::vector && last_column >= internal_count) {
-        if (last_column >= max_vector_size) {
-            vector_to_set();
+        if (last_column >= max_packed_size) {
+            to_set();
+        } else if (last_column >= max_vector_size) {
+            vector_to_packed();
         } else {
             _storage.vector.v.reserve(last_column);
         }
     }
+    if (_type == storage_type::packed) {
+        if (last_column >= max_packed_size) {
+            to_set();
+        } else {
+            _storage.packed.reserve_column(last_column);
+        }
+    }
 }
 
 template<typename Func>
-auto row::with_both_ranges(const row& other, Func&& func) const {
-    if (_type == storage_type::vector) {
-        if (other._type == storage_type::vector) {
-            return func(get_range_vector(), other.get_range_vector());
-        } else {
-            return func(get_range_vector(), other.get_range_set());
-        }
-    } else {
-        if (other._type == storage_type::vector) {
-            return func(get_range_set(), other.get_range_vector());
-        } else {
-            return func(get_range_set(), other.get_range_set());
-        }
+auto row::with_range(Func&& func) const {
+    switch (_type) {
+    case storage_type::vector:
+        return func(get_range_vector());
+    case storage_type::packed:
+        return func(get_range_packed());
+    case storage_type::set:
+        break;
     }
+    return func(get_range_set());
+}
+
+template<typename Func>
+auto row::with_both_ranges(const row& other, Func&& func) const {
+    return with_range([&] (auto r1) {
+        return other.with_range([&] (auto r2) {
+            return func(r1, r2);
+        });
+    });
 }
 
 bool row::operator==(const row& other) const {
@@ -1429,6 +1763,8 @@ row::row(row&& other) noexcept
     : _type(other._type), _size(other._size) {
     if (_type == storage_type::vector) {
         new (&_storage.vector) vector_storage(std::move(other._storage.vector));
+    } else if (_type == storage_type::packed) {
+        new (&_storage.packed) packed_storage(std::move(other._storage.packed));
     } else {
         new (&_storage.set) map_type(std::move(other._storage.set));
     }
@@ -1446,11 +1782,7 @@ void row::apply_reversibly(const schema& s, column_kind kind, row& other) {
     if (other.empty()) {
         return;
     }
-    if (other._type == storage_type::vector) {
-        reserve(other._storage.vector.v.size() - 1);
-    } else {
-        reserve(other._storage.set.rbegin()->id());
-    }
+    reserve(other.last_column_id());
     other.for_each_cell([&] (column_id id, atomic_cell_or_collection& cell) {
         apply_reversibly(s.column_at(kind, id), cell);
     }, [&] (column_id id, atomic_cell_or_collection& cell) noexcept {
@@ -1462,11 +1794,7 @@ void row::apply(const schema& s, column_kind kind, const row& other) {
     if (other.empty()) {
         return;
     }
-    if (other._type == storage_type::vector) {
-        reserve(other._storage.vector.v.size() - 1);
-    } else {
-        reserve(other._storage.set.rbegin()->id());
-    }
+    reserve(other.last_column_id());
     other.for_each_cell([&] (column_id id, const atomic_cell_or_collection& cell) {
         apply(s.column_at(kind, id), cell);
     });
@@ -1476,11 +1804,7 @@ void row::apply(const schema& s, column_kind kind, row&& other) {
     if (other.empty()) {
         return;
     }
-    if (other._type == storage_type::vector) {
-        reserve(other._storage.vector.v.size() - 1);
-    } else {
-        reserve(other._storage.set.rbegin()->id());
-    }
+    reserve(other.last_column_id());
     other.for_each_cell([&] (column_id id, atomic_cell_or_collection& cell) {
         apply(s.column_at(kind, id), std::move(cell));
     });
@@ -1691,6 +2015,9 @@ void mutation_querier::query_static_row(const row& r, tombstone current_tombston
 }
 
 stop_iteration mutation_querier::consume(static_row&& sr, tombstone current_tombstone) {
+    if (_pw.tracks_expiry()) {
+        add_row_expiry(_pw, _schema, column_kind::static_column, sr.cells());
+    }
     query_static_row(sr.cells(), current_tombstone);
     _live_data_in_static_row = true;
     return stop_iteration::no;
@@ -1709,6 +2036,13 @@ stop_iteration mutation_querier::consume(clustering_row&& cr, tombstone current_
 
     const query::partition_slice& slice = _pw.slice();
 
+    if (_pw.tracks_expiry()) {
+        if (cr.marker().is_live() && cr.marker().is_expiring()) {
+            _pw.add_expiry(cr.marker().expiry());
+        }
+        add_row_expiry(_pw, _schema, column_kind::regular_column, cr.cells());
+    }
+
     if (_pw.requested_digest()) {
         cr.key().feed_hash(_pw.digest(), _schema);
         ::feed_hash(_pw.digest(), current_tombstone);
@@ -1741,7 +2075,7 @@ uint32_t mutation_querier::consume_end_of_stream() {
     // If ck:s exist, and we do a restriction on them, we either have maching
     // rows, or return nothing, since cql does not allow "is null".
     if (!_live_clustering_rows
-        && (has_ck_selector(_pw.ranges()) || !_live_data_in_static_row)) {
+        && (has_ck_selector(_pw.ranges()) || !_pw.slice().filters().empty() || !_live_data_in_static_row)) {
         _pw.retract();
         return 0;
     } else {
@@ -1772,17 +2106,19 @@ class query_result_builder {
     void consume(static_row&& sr, tombstone t, bool) {
         _mutation_consumer->consume(std::move(sr), t);
     }
-    void consume(clustering_row&& cr, tombstone t,  bool) {
+    stop_iteration consume(clustering_row&& cr, tombstone t,  bool) {
         _mutation_consumer->consume(std::move(cr), t);
+        return _rb.check_size_limit();
     }
     void consume(range_tombstone&& rt) {
         _mutation_consumer->consume(std::move(rt));
     }
 
-    void consume_end_of_partition() {
+    stop_iteration consume_end_of_partition() {
         auto live_rows_in_partition = _mutation_consumer->consume_end_of_stream();
         _live_rows += live_rows_in_partition;
         _partitions += live_rows_in_partition > 0;
+        return live_rows_in_partition ? _rb.check_size_limit() : stop_iteration::no;
     }
 
     data_query_result consume_end_of_stream() {
@@ -1790,9 +2126,84 @@ class query_result_builder {
     }
 };
 
+// Like do_consume_streamed_mutation_flattened(), but records the fragments
+// needed for continuing the read on the next page, and doesn't end the partition.
+template<typename Consumer>
+static future<stop_iteration> consume_and_record(suspended_read& r, Consumer& c) {
+    auto& sm = *r.sm;
+    do {
+        if (sm.is_buffer_empty()) {
+            if (sm.is_end_of_stream()) {
+                break;
+            }
+            auto f = sm.fill_buffer();
+            if (!f.available()) {
+                return f.then([&r, &c] { return consume_and_record(r, c); });
+            }
+            f.get();
+        } else {
+            auto mf = sm.pop_mutation_fragment();
+            r.record(mf);
+            if (std::move(mf).consume(c) == stop_iteration::yes) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+        }
+    } while (true);
+    return make_ready_future<stop_iteration>(stop_iteration::no);
+}
+
+// Single-partition data query which, when it stops on the row or size limit, leaves
+// its reader in the querier_cache for the query of the next page, and which
+// continues such a reader if the query is the next page of one.
+template<typename Consumer>
+static future<data_query_result> resumable_data_query(schema_ptr s, const mutation_source& source, const query::partition_range& range,
+                                                      const query::partition_slice& slice, Consumer&& consumer, querier_cache& cache)
+{
+    lw_shared_ptr<suspended_read> r;
+    if (slice.get_specific_ranges()) {
+        r = cache.lookup(*s, range, slice);
+    }
+    auto f = make_ready_future<>();
+    if (!r) {
+        r = make_lw_shared<suspended_read>(s, range, slice);
+        r->reader = source(s, r->range, query::clustering_key_filtering_context::create(s, r->slice).with_column_projection(*s, r->slice),
+                           service::get_local_request_scheduler().read_priority(s->ks_name()));
+        f = (*r->reader)().then([r] (streamed_mutation_opt smopt) {
+            if (smopt) {
+                r->sm = std::move(*smopt);
+            }
+        });
+    }
+    return f.then([r, &cache, consumer = std::move(consumer)] () mutable {
+        return do_with(std::move(consumer), [r, &cache] (Consumer& c) {
+            if (!r->sm) {
+                return make_ready_future<data_query_result>(c.consume_end_of_stream());
+            }
+            c.consume_new_partition(r->sm->decorated_key());
+            if (r->sm->partition_tombstone()) {
+                c.consume(r->sm->partition_tombstone());
+            }
+            if (r->srow) {
+                c.consume(static_row(*r->srow));
+            }
+            for (auto&& rt : r->range_tombstones) {
+                c.consume(range_tombstone(rt));
+            }
+            return consume_and_record(*r, c).then([r, &c, &cache] (stop_iteration stopped) {
+                c.consume_end_of_partition();
+                if (stopped && !(r->sm->is_buffer_empty() && r->sm->is_end_of_stream()) && r->prepare_for_next_page()) {
+                    cache.insert(r);
+                }
+                return c.consume_end_of_stream();
+            });
+        });
+    });
+}
+
 future<data_query_result> data_query(schema_ptr s, const mutation_source& source, const query::partition_range& range,
                             const query::partition_slice& slice, uint32_t row_limit, uint32_t partition_limit,
-                            gc_clock::time_point query_time, query::result::builder& builder)
+                            gc_clock::time_point query_time, query::result::builder& builder, querier_cache* cache,
+                            query::tombstone_counter* tombstones)
 {
     if (row_limit == 0 || slice.partition_row_limit() == 0 || partition_limit == 0) {
         return make_ready_future<data_query_result>();
@@ -1802,12 +2213,113 @@ future<data_query_result> data_query(schema_ptr s, const mutation_source& source
 
     auto qrb = query_result_builder(*s, builder);
     auto cfq = make_stable_flattened_mutations_consumer<compact_for_query<emit_only_live_rows::yes, query_result_builder>>(
-            *s, query_time, slice, row_limit, partition_limit, std::move(qrb));
+            *s, query_time, slice, row_limit, partition_limit, std::move(qrb), tombstones);
 
-    auto reader = source(s, range, query::clustering_key_filtering_context::create(s, slice), service::get_local_sstable_query_read_priority());
+    // Only paged reads of a single partition are worth continuing.
+    if (cache && !is_reversed && range.is_singular() && row_limit != query::max_rows) {
+        return resumable_data_query(std::move(s), source, range, slice, std::move(cfq), *cache);
+    }
+
+    auto reader = source(s, range, query::clustering_key_filtering_context::create(s, slice).with_column_projection(*s, slice),
+                         service::get_local_request_scheduler().read_priority(s->ks_name()));
     return consume_flattened(std::move(reader), std::move(cfq), is_reversed);
 }
 
+// Writes a partition of a distinct partition key listing, without reading it.
+static void write_listed_partition(query::result::builder& builder, const schema& s, const partition_key& key) {
+    auto pw = builder.add_partition(s, key);
+    pw.start().start_static_row().start_cells().end_cells().end_static_row()
+        .start_rows().end_rows().end_qr_partition();
+    pw.row_count() += 1;
+}
+
+namespace {
+
+struct partition_key_query_state {
+    key_reader live_keys;
+    key_reader other_keys;
+    dht::decorated_key_opt live;
+    dht::decorated_key_opt other;
+    stdx::optional<query::partition_range> other_range;
+    uint32_t row_limit;
+    uint32_t partition_limit;
+    bool short_read = false;
+    data_query_result result;
+
+    bool done() const {
+        return !row_limit || !partition_limit || short_read || (!live && !other);
+    }
+};
+
+}
+
+future<data_query_result> partition_key_query(schema_ptr s, key_reader live_keys, key_reader other_keys,
+                            const mutation_source& source, const query::partition_slice& slice, uint32_t row_limit,
+                            uint32_t partition_limit, gc_clock::time_point query_time, query::result::builder& builder,
+                            query::tombstone_counter* tombstones)
+{
+    if (row_limit == 0 || slice.partition_row_limit() == 0 || partition_limit == 0) {
+        return make_ready_future<data_query_result>();
+    }
+
+    auto st = std::make_unique<partition_key_query_state>();
+    st->live_keys = std::move(live_keys);
+    st->other_keys = std::move(other_keys);
+    st->row_limit = row_limit;
+    st->partition_limit = partition_limit;
+    auto& state = *st;
+    return state.live_keys().then([&state] (dht::decorated_key_opt dk) {
+        state.live = std::move(dk);
+        return state.other_keys();
+    }).then([&state] (dht::decorated_key_opt dk) {
+        state.other = std::move(dk);
+    }).then([s = std::move(s), &state, &source, &slice, query_time, &builder, tombstones] {
+        return repeat([s, &state, &source, &slice, query_time, &builder, tombstones] {
+            if (state.done()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            if (state.live && (!state.other || state.live->less_compare(*s, *state.other))) {
+                write_listed_partition(builder, *s, state.live->key());
+                ++state.result.live_rows;
+                ++state.result.partitions;
+                --state.row_limit;
+                --state.partition_limit;
+                state.short_read = bool(builder.check_size_limit());
+                return state.live_keys().then([&state] (dht::decorated_key_opt dk) {
+                    state.live = std::move(dk);
+                    return stop_iteration::no;
+                });
+            }
+            // The partition may be dead, or shadow the live one of the same
+            // key, so it has to be read.
+            auto same_as_live = state.live && state.live->equal(*s, *state.other);
+            state.other_range = query::partition_range::make_singular(*state.other);
+            return data_query(s, source, *state.other_range, slice, state.row_limit, state.partition_limit,
+                              query_time, builder, nullptr, tombstones).then([&state, &builder, same_as_live] (data_query_result r) {
+                state.result.live_rows += r.live_rows;
+                state.result.partitions += r.partitions;
+                state.row_limit -= r.live_rows;
+                state.partition_limit -= r.partitions;
+                state.short_read = builder.is_short_read();
+                auto f = make_ready_future<>();
+                if (same_as_live) {
+                    f = state.live_keys().then([&state] (dht::decorated_key_opt dk) {
+                        state.live = std::move(dk);
+                    });
+                }
+                return f.then([&state] {
+                    return state.other_keys();
+                }).then([&state] (dht::decorated_key_opt dk) {
+                    state.other = std::move(dk);
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }).then([&state] {
+        return state.result;
+    }).finally([st = std::move(st)] { });
+}
+
 class reconcilable_result_builder {
     const schema& _schema;
     const query::partition_slice& _slice;
@@ -1819,12 +2331,17 @@ class reconcilable_result_builder {
     bool _static_row_is_alive{};
     uint32_t _total_live_rows = 0;
     stdx::optional<streamed_mutation_freezer> _mutation_consumer;
+    // Results are only ended early between partitions, so that replica
+    // results are cut at partition boundaries when reconciled.
+    uint64_t _max_size;
+    uint64_t _size = 0;
+    bool _short_read = false;
 public:
-    reconcilable_result_builder(const schema& s, const query::partition_slice& slice)
-            : _schema(s), _slice(slice) { }
+    reconcilable_result_builder(const schema& s, const query::partition_slice& slice, uint64_t max_size)
+            : _schema(s), _slice(slice), _max_size(max_size) { }
 
     void consume_new_partition(const dht::decorated_key& dk) {
-        _has_ck_selector = has_ck_selector(_slice.row_ranges(_schema, dk.key()));
+        _has_ck_selector = has_ck_selector(_slice.row_ranges(_schema, dk.key())) || !_slice.filters().empty();
         _static_row_is_alive = false;
         _live_rows = 0;
         auto is_reversed = _slice.options.contains(query::partition_slice::option::reversed);
@@ -1838,24 +2355,30 @@ class reconcilable_result_builder {
         _static_row_is_alive = is_alive;
         _mutation_consumer->consume(std::move(sr));
     }
-    void consume(clustering_row&& cr, tombstone, bool is_alive) {
+    stop_iteration consume(clustering_row&& cr, tombstone, bool is_alive) {
         _live_rows += is_alive;
         _mutation_consumer->consume(std::move(cr));
+        return stop_iteration::no;
     }
     void consume(range_tombstone&& rt) {
         _mutation_consumer->consume(std::move(rt));
     }
 
-    void consume_end_of_partition() {
+    stop_iteration consume_end_of_partition() {
         if (_live_rows == 0 && _static_row_is_alive && !_has_ck_selector) {
             ++_live_rows;
         }
         _total_live_rows += _live_rows;
         _result.emplace_back(partition { _live_rows, _mutation_consumer->consume_end_of_stream() });
+        _size += _result.back().mut().representation().size();
+        if (_total_live_rows && _size >= _max_size) {
+            _short_read = true;
+        }
+        return stop_iteration(_short_read);
     }
 
     reconcilable_result consume_end_of_stream() {
-        return reconcilable_result(_total_live_rows, std::move(_result));
+        return reconcilable_result(_total_live_rows, std::move(_result), _short_read);
     }
 };
 
@@ -1866,7 +2389,9 @@ mutation_query(schema_ptr s,
                const query::partition_slice& slice,
                uint32_t row_limit,
                uint32_t partition_limit,
-               gc_clock::time_point query_time)
+               gc_clock::time_point query_time,
+               query::tombstone_counter* tombstones,
+               uint64_t max_size)
 {
     if (row_limit == 0 || slice.partition_row_limit() == 0 || partition_limit == 0) {
         return make_ready_future<reconcilable_result>(reconcilable_result());
@@ -1874,10 +2399,11 @@ mutation_query(schema_ptr s,
 
     auto is_reversed = slice.options.contains(query::partition_slice::option::reversed);
 
-    auto rrb = reconcilable_result_builder(*s, slice);
+    auto rrb = reconcilable_result_builder(*s, slice, max_size);
     auto cfq = make_stable_flattened_mutations_consumer<compact_for_query<emit_only_live_rows::no, reconcilable_result_builder>>(
-            *s, query_time, slice, row_limit, partition_limit, std::move(rrb));
+            *s, query_time, slice, row_limit, partition_limit, std::move(rrb), tombstones);
 
-    auto reader = source(s, range, query::clustering_key_filtering_context::create(s, slice), service::get_local_sstable_query_read_priority());
+    auto reader = source(s, range, query::clustering_key_filtering_context::create(s, slice),
+                         service::get_local_request_scheduler().read_priority(s->ks_name()));
     return consume_flattened(std::move(reader), std::move(cfq), is_reversed);
 }
@@ -27,8 +27,10 @@
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/adaptor/indexed.hpp>
 #include <boost/range/adaptor/filtered.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 
 #include <seastar/core/bitset-iter.hh>
+#include <seastar/core/bitops.hh>
 
 #include "schema.hh"
 #include "tombstone.hh"
@@ -38,6 +40,7 @@
 #include "mutation_partition_view.hh"
 #include "mutation_partition_visitor.hh"
 #include "utils/managed_vector.hh"
+#include "utils/bptree.hh"
 #include "hashing_partition_visitor.hh"
 #include "range_tombstone_list.hh"
 
@@ -86,8 +89,12 @@ class row {
 
     using size_type = std::make_unsigned_t<column_id>;
 
+    // Rows start with the vector storage, switch to the packed one once a
+    // column id doesn't fit in it, and to the set once it doesn't fit the
+    // packed storage either.
     enum class storage_type {
         vector,
+        packed,
         set,
     };
     storage_type _type = storage_type::vector;
@@ -98,6 +105,8 @@ class row {
         boost::intrusive::compare<cell_entry::compare>, boost::intrusive::constant_time_size<false>>;
 public:
     static constexpr size_t max_vector_size = 32;
+    // Bounds the size of the bitmap of the packed storage.
+    static constexpr size_t max_packed_size = 1024;
     static constexpr size_t internal_count = (sizeof(map_type) + sizeof(cell_entry)) / sizeof(atomic_cell_or_collection);
 private:
     using vector_type = managed_vector<atomic_cell_or_collection, internal_count, size_type>;
@@ -107,12 +116,104 @@ class row {
         vector_type v;
     };
 
+    // Bitmap of present columns and their cells, in column id order. Unlike
+    // the set, it doesn't allocate a node per cell, and unlike the vector, it
+    // doesn't keep a slot for every absent column, which matters for tables
+    // with many regular columns.
+    struct packed_storage {
+        managed_vector<uint64_t, 1, size_type> present;
+        managed_vector<atomic_cell_or_collection, internal_count - 1, size_type> cells;
+
+        static size_type word_of(column_id id) { return id / 64; }
+        static uint64_t bit_of(column_id id) { return uint64_t(1) << (id % 64); }
+
+        bool test(column_id id) const {
+            return word_of(id) < present.size() && (present[word_of(id)] & bit_of(id));
+        }
+        // Position in cells of the given column, or of the first present
+        // column after it.
+        size_type index_of(column_id id) const {
+            size_type idx = 0;
+            auto w = word_of(id);
+            for (size_type i = 0; i < std::min<size_type>(w, present.size()); ++i) {
+                idx += __builtin_popcountll(present[i]);
+            }
+            if (w < present.size()) {
+                idx += __builtin_popcountll(present[w] & (bit_of(id) - 1));
+            }
+            return idx;
+        }
+        // Id of the first present column not smaller than id, which must exist.
+        column_id next_present(column_id id) const {
+            auto w = word_of(id);
+            auto word = present[w] & ~(bit_of(id) - 1);
+            while (!word) {
+                word = present[++w];
+            }
+            return w * 64 + count_trailing_zeros(word);
+        }
+        // Id of the last present column smaller than id, which must exist.
+        column_id prev_present(column_id id) const {
+            auto w = word_of(id);
+            uint64_t word = w < present.size() ? present[w] & (bit_of(id) - 1) : 0;
+            while (!word) {
+                word = present[--w];
+            }
+            return w * 64 + 63 - count_leading_zeros(word);
+        }
+        void reserve_column(column_id id) {
+            if (word_of(id) >= present.size()) {
+                present.resize(word_of(id) + 1);
+            }
+        }
+        // Strong exception guarantee.
+        void insert(column_id id, atomic_cell_or_collection&& cell) {
+            reserve_column(id);
+            auto idx = index_of(id);
+            cells.emplace_back(std::move(cell));
+            std::rotate(cells.begin() + idx, cells.end() - 1, cells.end());
+            present[word_of(id)] |= bit_of(id);
+        }
+        void erase(column_id id, size_type idx) noexcept {
+            cells.erase(cells.begin() + idx);
+            present[word_of(id)] &= ~bit_of(id);
+        }
+    };
+
+    class packed_iterator : public boost::iterator_facade<packed_iterator,
+            std::pair<column_id, const atomic_cell_or_collection&>,
+            boost::forward_traversal_tag,
+            std::pair<column_id, const atomic_cell_or_collection&>> {
+        const packed_storage* _storage;
+        size_type _idx;
+        column_id _id;
+    public:
+        packed_iterator(const packed_storage& s, size_type idx)
+            : _storage(&s), _idx(idx), _id(idx < s.cells.size() ? s.next_present(0) : 0)
+        { }
+    private:
+        friend class boost::iterator_core_access;
+        std::pair<column_id, const atomic_cell_or_collection&> dereference() const {
+            return { _id, _storage->cells[_idx] };
+        }
+        void increment() {
+            if (++_idx < _storage->cells.size()) {
+                _id = _storage->next_present(_id + 1);
+            }
+        }
+        bool equal(const packed_iterator& o) const {
+            return _idx == o._idx;
+        }
+    };
+
     union storage {
         storage() { }
         ~storage() { }
         map_type set;
         vector_storage vector;
+        packed_storage packed;
     } _storage;
+    static_assert(sizeof(packed_storage) <= sizeof(vector_storage), "packed storage shouldn't make rows larger");
 public:
     row();
     ~row();
@@ -143,6 +244,20 @@ class row {
                     _size--;
                 }
             }
+        } else if (_type == storage_type::packed) {
+            auto& p = _storage.packed;
+            size_type idx = 0;
+            for (size_type w = 0; w < p.present.size(); ++w) {
+                for (auto word = p.present[w]; word; word &= word - 1) {
+                    column_id id = w * 64 + count_trailing_zeros(word);
+                    if (func(id, p.cells[idx])) {
+                        p.erase(id, idx);
+                        _size--;
+                    } else {
+                        ++idx;
+                    }
+                }
+            }
         } else {
             for (auto it = _storage.set.begin(); it != _storage.set.end();) {
                 if (func(it->id(), it->cell())) {
@@ -167,6 +282,10 @@ class row {
             return std::pair<column_id, const atomic_cell_or_collection&>(t.get<0>(), t.get<1>());
         });
     }
+    auto get_range_packed() const {
+        return boost::make_iterator_range(packed_iterator(_storage.packed, 0),
+            packed_iterator(_storage.packed, _storage.packed.cells.size()));
+    }
     auto get_range_set() const {
         auto range = boost::make_iterator_range(_storage.set.begin(), _storage.set.end());
         return range | boost::adaptors::transformed([] (const cell_entry& c) {
@@ -174,9 +293,14 @@ class row {
         });
     }
     template<typename Func>
+    auto with_range(Func&& func) const;
+    template<typename Func>
     auto with_both_ranges(const row& other, Func&& func) const;
 
-    void vector_to_set();
+    void vector_to_packed();
+    void to_set();
+    // Requires !empty().
+    column_id last_column_id() const;
 
     // Calls Func(column_id, atomic_cell_or_collection&) for each cell in this row.
     //
@@ -211,6 +335,12 @@ class row {
                     break;
                 }
             }
+        } else if (_type == storage_type::packed) {
+            for (auto&& c : get_range_packed()) {
+                if (func(c.first, c.second) == stop_iteration::yes) {
+                    break;
+                }
+            }
         } else {
             for (auto& cell : _storage.set) {
                 const auto& c = cell.cell();
@@ -272,6 +402,10 @@ class row {
 
 std::ostream& operator<<(std::ostream& os, const std::pair<column_id, const atomic_cell_or_collection&>& c);
 
+// Returns true iff the compacted cells of a clustering row satisfy all
+// filters of the slice.
+bool matches_filters(const schema& s, const query::partition_slice& slice, const row& cells);
+
 class row_marker;
 int compare_row_marker_for_merge(const row_marker& left, const row_marker& right) noexcept;
 
@@ -437,11 +571,16 @@ class deletable_row final {
 };
 
 class rows_entry {
-    boost::intrusive::set_member_hook<> _link;
+    bptree_member_hook _link;
     clustering_key _key;
+    // See compound_type::abbreviate(). 0 when not known, in which case
+    // comparisons fall back to comparing keys.
+    uint64_t _abbreviated_key = 0;
     deletable_row _row;
     friend class mutation_partition;
 public:
+    struct compare;
+
     rows_entry(clustering_key&& key)
         : _key(std::move(key))
     { }
@@ -454,9 +593,24 @@ class rows_entry {
     rows_entry(const clustering_key& key, const deletable_row& row)
         : _key(key), _row(row)
     { }
+    // The following constructors also abbreviate the key, so that
+    // comparisons with other abbreviated entries can avoid comparing keys.
+    rows_entry(const compare& c, clustering_key&& key)
+        : _key(std::move(key)), _abbreviated_key(c.abbreviate(_key))
+    { }
+    rows_entry(const compare& c, const clustering_key& key)
+        : _key(key), _abbreviated_key(c.abbreviate(_key))
+    { }
+    rows_entry(const compare& c, const clustering_key& key, deletable_row&& row)
+        : _key(key), _abbreviated_key(c.abbreviate(_key)), _row(std::move(row))
+    { }
+    rows_entry(const compare& c, const clustering_key& key, const deletable_row& row)
+        : _key(key), _abbreviated_key(c.abbreviate(_key)), _row(row)
+    { }
     rows_entry(rows_entry&& o) noexcept;
     rows_entry(const rows_entry& e)
         : _key(e._key)
+        , _abbreviated_key(e._abbreviated_key)
         , _row(e._row)
     { }
     clustering_key& key() {
@@ -465,6 +619,14 @@ class rows_entry {
     const clustering_key& key() const {
         return _key;
     }
+    uint64_t abbreviated_key() const {
+        return _abbreviated_key;
+    }
+    // True iff the order of keys with given abbreviations is determined by
+    // comparing the abbreviations.
+    static bool ordered_by_abbreviations(uint64_t a1, uint64_t a2) {
+        return a1 != a2 && a1 && a2;
+    }
     deletable_row& row() {
         return _row;
     }
@@ -485,12 +647,40 @@ class rows_entry {
     bool empty() const {
         return _row.empty();
     }
+    // Clustering key together with its abbreviation, for lookups which
+    // compare the key with many entries.
+    struct lookup_key {
+        clustering_key_view key;
+        uint64_t abbreviated_key;
+    };
     struct compare {
         clustering_key::less_compare _c;
         compare(const schema& s) : _c(s) {}
+        template<typename Key>
+        uint64_t abbreviate(const Key& key) const {
+            return _c._t->abbreviate(key.representation());
+        }
+        lookup_key make_lookup_key(clustering_key_view key) const {
+            return { key, abbreviate(key) };
+        }
         bool operator()(const rows_entry& e1, const rows_entry& e2) const {
+            if (ordered_by_abbreviations(e1._abbreviated_key, e2._abbreviated_key)) {
+                return e1._abbreviated_key < e2._abbreviated_key;
+            }
             return _c(e1._key, e2._key);
         }
+        bool operator()(const lookup_key& key, const rows_entry& e) const {
+            if (ordered_by_abbreviations(key.abbreviated_key, e._abbreviated_key)) {
+                return key.abbreviated_key < e._abbreviated_key;
+            }
+            return _c(key.key, e._key);
+        }
+        bool operator()(const rows_entry& e, const lookup_key& key) const {
+            if (ordered_by_abbreviations(e._abbreviated_key, key.abbreviated_key)) {
+                return e._abbreviated_key < key.abbreviated_key;
+            }
+            return _c(e._key, key.key);
+        }
         bool operator()(const clustering_key& key, const rows_entry& e) const {
             return _c(key, e._key);
         }
@@ -531,12 +721,13 @@ template<typename T>
 class serializer;
 }
 
+namespace query {
+class columnar_result_builder;
+}
+
 class mutation_partition final {
 public:
-    // FIXME: using boost::intrusive because gcc's std::set<> does not support heterogeneous lookup yet
-    using rows_type = boost::intrusive::set<rows_entry,
-        boost::intrusive::member_hook<rows_entry, boost::intrusive::set_member_hook<>, &rows_entry::_link>,
-        boost::intrusive::compare<rows_entry::compare>>;
+    using rows_type = bptree<rows_entry, bptree_member_hook, &rows_entry::_link, rows_entry::compare>;
     friend class rows_entry;
     friend class size_calculator;
 private:
@@ -609,8 +800,25 @@ class mutation_partition final {
     // Use in case this instance and p share the same schema.
     // Same guarantees as apply(const schema&, mutation_partition&&, const schema&);
     void apply(const schema& s, mutation_partition&& p);
+    // Moves up to max_rows clustered rows of p into this partition, and the
+    // rest of p along with the last of them. Allows applying a large partition
+    // in steps, with other work running in between; until the last step, the
+    // data of p is split between p and this object, with no row in both.
+    // Both must have schema s.
+    //
+    // If exception is thrown, the rows moved so far stay moved, the rest
+    // are left in p.
+    //
+    // Returns stop_iteration::yes once all of p has been applied.
+    stop_iteration apply_some(const schema& s, mutation_partition& p, size_t max_rows);
     // Same guarantees and constraints as for apply(const schema&, const mutation_partition&, const schema&).
     void apply(const schema& this_schema, mutation_partition_view p, const schema& p_schema);
+    // Applies p directly to this partition, so that each cell is copied only
+    // once, and not through an intermediate mutation_partition.
+    // Weak exception guarantees. If an exception is thrown, only a part of p
+    // may have been applied, but applying p again (possibly many times) until
+    // it succeeds gives the same result as if the first attempt didn't fail.
+    void apply_weak(const schema& this_schema, mutation_partition_view p, const schema& p_schema);
 
     // Converts partition to the new schema. When succeeds the partition should only be accessed
     // using the new schema.
@@ -699,6 +907,8 @@ class mutation_partition final {
     // results may include data which is deleted/expired.
     // At most row_limit CQL rows will be written and digested.
     void query_compacted(query::result::partition_writer& pw, const schema& s, uint32_t row_limit) const;
+    // Like above, but writes the partition started last in a columnar result.
+    void query_compacted(query::columnar_result_builder& rb, const schema& s, uint32_t row_limit) const;
     void accept(const schema&, mutation_partition_visitor&) const;
 
     // Returns the number of live CQL rows in this partition.
@@ -24,6 +24,7 @@
 #include "mutation_partition_serializer.hh"
 #include "service/priority_manager.hh"
 #include "query-result-writer.hh"
+#include "query-result-columnar.hh"
 
 reconcilable_result::~reconcilable_result() {}
 
@@ -31,9 +32,10 @@ reconcilable_result::reconcilable_result()
     : _row_count(0)
 { }
 
-reconcilable_result::reconcilable_result(uint32_t row_count, std::vector<partition> p)
+reconcilable_result::reconcilable_result(uint32_t row_count, std::vector<partition> p, bool short_read)
     : _row_count(row_count)
     , _partitions(std::move(p))
+    , _short_read(short_read)
 { }
 
 const std::vector<partition>& reconcilable_result::partitions() const {
@@ -55,14 +57,24 @@ bool reconcilable_result::operator!=(const reconcilable_result& other) const {
 
 query::result
 to_data_query_result(const reconcilable_result& r, schema_ptr s, const query::partition_slice& slice, uint32_t max_partitions) {
-    query::result::builder builder(slice, query::result_request::only_result);
-    for (const partition& p : r.partitions()) {
-        if (!max_partitions--) {
-            break;
+    auto build = [&] (auto& builder) {
+        for (const partition& p : r.partitions()) {
+            if (!max_partitions--) {
+                break;
+            }
+            p.mut().unfreeze(s).query(builder, slice, gc_clock::time_point::min(), query::max_rows);
+        }
+        if (r.is_short_read()) {
+            builder.mark_as_short_read();
         }
-        p.mut().unfreeze(s).query(builder, slice, gc_clock::time_point::min(), query::max_rows);
+        return builder.build();
+    };
+    if (slice.options.contains<query::partition_slice::option::columnar>()) {
+        query::columnar_result_builder builder(slice);
+        return build(builder);
     }
-    return builder.build();
+    query::result::builder builder(slice, query::result_request::only_result);
+    return build(builder);
 }
 
 std::ostream& operator<<(std::ostream& out, const reconcilable_result::printer& pr) {
@@ -25,6 +25,7 @@
 #include "query-result.hh"
 #include "mutation_reader.hh"
 #include "frozen_mutation.hh"
+#include "key_reader.hh"
 
 class reconcilable_result;
 class frozen_reconcilable_result;
@@ -68,12 +69,13 @@ struct partition {
 class reconcilable_result {
     uint32_t _row_count;
     std::vector<partition> _partitions;
+    bool _short_read = false;
 public:
     ~reconcilable_result();
     reconcilable_result();
     reconcilable_result(reconcilable_result&&) = default;
     reconcilable_result& operator=(reconcilable_result&&) = default;
-    reconcilable_result(uint32_t row_count, std::vector<partition> partitions);
+    reconcilable_result(uint32_t row_count, std::vector<partition> partitions, bool short_read = false);
 
     const std::vector<partition>& partitions() const;
     std::vector<partition>& partitions();
@@ -82,6 +84,12 @@ class reconcilable_result {
         return _row_count;
     }
 
+    // Like query::result::is_short_read(). Such results end with a whole
+    // partition.
+    bool is_short_read() const {
+        return _short_read;
+    }
+
     bool operator==(const reconcilable_result& other) const;
     bool operator!=(const reconcilable_result& other) const;
 
@@ -94,18 +102,25 @@ class reconcilable_result {
     printer pretty_printer(schema_ptr) const;
 };
 
+// The result is columnar if the slice has the columnar option.
 query::result to_data_query_result(const reconcilable_result&, schema_ptr, const query::partition_slice&, uint32_t partition_limit = query::max_partitions);
 
 // Performs a query on given data source returning data in reconcilable form.
 //
 // Reads at most row_limit rows. If less rows are returned, the data source
-// didn't have more live data satisfying the query.
+// didn't have more live data satisfying the query, unless the result is a
+// short read: once the frozen partitions reach max_size, the query ends after
+// the partition which was read last.
 //
 // Any cells which have expired according to query_time are returned as
 // deleted cells and do not count towards live data. The mutations are
 // compact, meaning that any cell which is covered by higher-level tombstone
 // is absent in the results.
 //
+// If tombstones is given, the tombstones scanned are counted in it, and the
+// query fails with tombstone_overwhelming_exception past its failure threshold.
+// It must survive until the returned future resolves.
+//
 // 'source' doesn't have to survive deferring.
 future<reconcilable_result> mutation_query(
     schema_ptr,
@@ -114,13 +129,37 @@ future<reconcilable_result> mutation_query(
     const query::partition_slice& slice,
     uint32_t row_limit,
     uint32_t partition_limit,
-    gc_clock::time_point query_time);
+    gc_clock::time_point query_time,
+    query::tombstone_counter* tombstones = nullptr,
+    uint64_t max_size = query::max_result_size);
 
 struct data_query_result {
     uint32_t live_rows{0};
     uint32_t partitions{0};
 };
 
+class querier_cache;
+
+// The result of builder is ended early, as a short read, after the row which
+// makes it reach the size limit of builder.
+//
+// If cache is given, paged reads of a single partition which stop on
+// row_limit or on the size limit leave their reader in it, and a read of the next page continues
+// from such a reader instead of reading the partition again.
+//
+// tombstones is used the same way as in mutation_query().
 future<data_query_result> data_query(schema_ptr s, const mutation_source& source, const query::partition_range& range,
                             const query::partition_slice& slice, uint32_t row_limit, uint32_t partition_limit,
-                            gc_clock::time_point query_time, query::result::builder& builder);
\ No newline at end of file
+                            gc_clock::time_point query_time, query::result::builder& builder,
+                            querier_cache* cache = nullptr, query::tombstone_counter* tombstones = nullptr);
+
+// Like data_query() of the range the key readers cover, for slices with the
+// distinct option which select no static nor regular columns, that is
+// listings of partition keys. Partitions whose key live_keys returns are
+// known to be live, and are listed without being read. Those whose key
+// other_keys returns are queried from source one by one, whether live_keys
+// returns it too or not. Both readers must return keys in ring order.
+future<data_query_result> partition_key_query(schema_ptr s, key_reader live_keys, key_reader other_keys,
+                            const mutation_source& source, const query::partition_slice& slice, uint32_t row_limit,
+                            uint32_t partition_limit, gc_clock::time_point query_time, query::result::builder& builder,
+                            query::tombstone_counter* tombstones = nullptr);
\ No newline at end of file
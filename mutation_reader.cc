@@ -19,12 +19,12 @@
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/algorithm/reverse.hpp>
 
 #include "mutation_reader.hh"
 #include "core/future-util.hh"
 #include "utils/move.hh"
+#include "utils/tournament_tree.hh"
 
 namespace stdx = std::experimental;
 
@@ -38,70 +38,71 @@ T move_and_clear(T& obj) {
 // Combines multiple mutation_readers into one.
 class combined_reader final : public mutation_reader::impl {
     std::vector<mutation_reader> _readers;
-    struct mutation_and_reader {
-        streamed_mutation m;
-        mutation_reader* read;
+    // Next partition of each reader, disengaged while it is taken or when
+    // the reader is exhausted.
+    std::vector<streamed_mutation_opt> _heads;
+    struct heads_less {
+        combined_reader* r;
+        bool operator()(size_t a, size_t b) const {
+            auto& ma = *r->_heads[a];
+            return ma.decorated_key().less_compare(*ma.schema(), r->_heads[b]->decorated_key());
+        }
     };
-    std::vector<mutation_and_reader> _ptables;
-    // comparison function for std::make_heap()/std::push_heap()
-    static bool heap_compare(const mutation_and_reader& a, const mutation_and_reader& b) {
-        auto&& s = a.m.schema();
-        // order of comparison is inverted, because heaps produce greatest value first
-        return b.m.decorated_key().less_compare(*s, a.m.decorated_key());
-    }
+    tournament_tree<heads_less> _tree;
     std::vector<streamed_mutation> _current;
-    std::vector<mutation_reader*> _next;
+    // Readers whose partitions were taken, to be advanced before the next one is produced.
+    std::vector<size_t> _next;
 private:
     future<> prepare_next() {
-        return parallel_for_each(_next, [this] (mutation_reader* mr) {
-            return (*mr)().then([this, mr] (streamed_mutation_opt next) {
-                if (next) {
-                    _ptables.emplace_back(mutation_and_reader { std::move(*next), mr });
-                    boost::range::push_heap(_ptables, &heap_compare);
-                }
+        return parallel_for_each(_next, [this] (size_t i) {
+            return _readers[i]().then([this, i] (streamed_mutation_opt next) {
+                _heads[i] = std::move(next);
             });
         }).then([this] {
+            for (auto i : _next) {
+                if (_heads[i]) {
+                    _tree.push(i);
+                }
+            }
             _next.clear();
         });
     }
     // Produces next mutation or disengaged optional if there are no more.
     future<streamed_mutation_opt> next() {
-        if (_current.empty() && !_next.empty()) {
+        if (!_next.empty()) {
             return prepare_next().then([this] { return next(); });
         }
-        if (_ptables.empty()) {
+        if (_tree.empty()) {
             return make_ready_future<streamed_mutation_opt>();
         };
 
-        while (!_ptables.empty()) {
-            boost::range::pop_heap(_ptables, &heap_compare);
-            auto& candidate = _ptables.back();
-            streamed_mutation& m = candidate.m;
-
-            if (!_current.empty() && !_current.back().decorated_key().equal(*m.schema(), m.decorated_key())) {
-                // key has changed, so emit accumulated mutation
-                boost::range::push_heap(_ptables, &heap_compare);
-                return make_ready_future<streamed_mutation_opt>(merge_mutations(move_and_clear(_current)));
-            }
-
-            _current.emplace_back(std::move(m));
-            _next.emplace_back(candidate.read);
-            _ptables.pop_back();
+        auto take = [this] (size_t i) {
+            _current.emplace_back(std::move(*_heads[i]));
+            _heads[i] = { };
+            _next.emplace_back(i);
+            _tree.pop();
+        };
+        take(_tree.top());
+        auto& s = *_current.back().schema();
+        while (!_tree.empty() && _heads[_tree.top()]->decorated_key().equal(s, _current.front().decorated_key())) {
+            take(_tree.top());
         }
         return make_ready_future<streamed_mutation_opt>(merge_mutations(move_and_clear(_current)));
     }
 public:
     combined_reader(std::vector<mutation_reader> readers)
         : _readers(std::move(readers))
+        , _heads(_readers.size())
+        , _tree(_readers.size(), heads_less{this})
     {
         _next.reserve(_readers.size());
         _current.reserve(_readers.size());
-        _ptables.reserve(_readers.size());
 
-        for (auto&& r : _readers) {
-            _next.emplace_back(&r);
+        for (size_t i = 0; i < _readers.size(); ++i) {
+            _next.emplace_back(i);
         }
     }
+    combined_reader(combined_reader&&) = delete; // _tree refers to this
 
     virtual future<streamed_mutation_opt> operator()() override {
         return next();
@@ -194,12 +195,24 @@ mutation_reader make_empty_reader() {
 class restricting_mutation_reader : public mutation_reader::impl {
     const restricted_mutation_reader_config& _config;
     unsigned _weight = 0;
+    size_t _memory = 0;
     bool _waited = false;
+    bool _memory_waited = false;
     mutation_reader _base;
+private:
+    future<> wait(semaphore& sem, size_t units) {
+        return _config.timeout.count() != 0
+                ? sem.wait(_config.timeout, units)
+                : sem.wait(units);
+    }
 public:
-    restricting_mutation_reader(const restricted_mutation_reader_config& config, unsigned weight, mutation_reader&& base)
-            : _config(config), _weight(weight), _base(std::move(base)) {
-        if (_config.sem->waiters() >= _config.max_queue_length) {
+    restricting_mutation_reader(const restricted_mutation_reader_config& config, reader_resources resources, mutation_reader&& base)
+            : _config(config)
+            , _weight(resources.count)
+            , _memory(config.memory_sem ? std::min(resources.memory, config.max_memory) : 0)
+            , _base(std::move(base)) {
+        if (_config.sem->waiters() >= _config.max_queue_length
+                || (_memory && _config.memory_sem->waiters() >= _config.max_queue_length)) {
             _config.raise_queue_overloaded_exception();
         }
     }
@@ -207,24 +220,35 @@ class restricting_mutation_reader : public mutation_reader::impl {
         if (_waited) {
             _config.sem->signal(_weight);
         }
+        if (_memory_waited) {
+            _config.memory_sem->signal(_memory);
+        }
     }
     future<streamed_mutation_opt> operator()() override {
         // FIXME: we should defer freeing until the mutation is freed, perhaps,
         //        rather than just returned
-        if (_waited) {
+        if (_waited && (_memory_waited || !_memory)) {
             return _base();
         }
-        auto waited = _config.timeout.count() != 0
-                ? _config.sem->wait(_config.timeout, _weight)
-                : _config.sem->wait(_weight);
-        return waited.then([this] {
+        // The count is taken before the memory by all readers, so the
+        // memory is only waited for by readers which are otherwise admitted.
+        auto waited = _waited ? make_ready_future<>() : wait(*_config.sem, _weight).then([this] {
             _waited = true;
+        });
+        return waited.then([this] {
+            if (!_memory) {
+                return make_ready_future<>();
+            }
+            return wait(*_config.memory_sem, _memory).then([this] {
+                _memory_waited = true;
+            });
+        }).then([this] {
             return _base();
         });
     }
 };
 
 mutation_reader
-make_restricted_reader(const restricted_mutation_reader_config& config, unsigned weight, mutation_reader&& base) {
-    return make_mutation_reader<restricting_mutation_reader>(config, weight, std::move(base));
+make_restricted_reader(const restricted_mutation_reader_config& config, reader_resources resources, mutation_reader&& base) {
+    return make_mutation_reader<restricting_mutation_reader>(config, resources, std::move(base));
 }
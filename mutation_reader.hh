@@ -93,6 +93,9 @@ mutation_reader make_empty_reader();
 
 struct restricted_mutation_reader_config {
     semaphore* sem = nullptr;
+    // Optional, counts bytes of buffer memory of the admitted readers.
+    semaphore* memory_sem = nullptr;
+    size_t max_memory = 0;
     std::chrono::nanoseconds timeout = {};
     size_t max_queue_length = std::numeric_limits<size_t>::max();
     std::function<void ()> raise_queue_overloaded_exception = default_raise_queue_overloaded_exception;
@@ -102,11 +105,25 @@ struct restricted_mutation_reader_config {
     }
 };
 
+// What a reader is charged for on admission: units of the concurrency
+// semaphore, and an estimate of the memory its buffers take.
+struct reader_resources {
+    unsigned count;
+    size_t memory;
+
+    reader_resources(unsigned count = 1, size_t memory = 0)
+        : count(count), memory(memory) { }
+};
+
 // Restricts a given `mutation_reader` to a concurrency limited according to settings in
 // a restricted_mutation_reader_config.  These settings include a semaphore for limiting the number
-// of active concurrent readers, a timeout for inactive readers, and a maximum queue size for
-// inactive readers.
-mutation_reader make_restricted_reader(const restricted_mutation_reader_config& config, unsigned weight, mutation_reader&& base);
+// of active concurrent readers, an optional one limiting the memory they take, a timeout for
+// inactive readers, and a maximum queue size for inactive readers.
+//
+// The reader is admitted once both the count and the memory of its resources are available.
+// Memory above config.max_memory is charged as max_memory, so that a single costly reader can
+// still be admitted, on its own.
+mutation_reader make_restricted_reader(const restricted_mutation_reader_config& config, reader_resources resources, mutation_reader&& base);
 
 /*
 template<typename T>
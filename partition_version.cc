@@ -22,6 +22,9 @@
 #include <boost/range/algorithm/heap_algorithm.hpp>
 
 #include "partition_version.hh"
+#include "cell_compression.hh"
+
+thread_local uint64_t partition_version_merge_steps = 0;
 
 static void remove_or_mark_as_unique_owner(partition_version* current)
 {
@@ -67,6 +70,8 @@ partition_snapshot::~partition_snapshot() {
         if (_version.is_unique_owner()) {
             _version = { };
             remove_or_mark_as_unique_owner(v);
+        } else if (!_merge_on_release) {
+            _version = { };
         } else {
             _version = { };
             auto first_used = v;
@@ -181,15 +186,30 @@ void partition_entry::apply(const schema& s, mutation_partition_view mpv, const
     if (!_snapshot) {
         _version->partition().apply(s, mpv, mp_schema);
     } else {
-        mutation_partition mp(s.shared_from_this());
-        mp.apply(s, mpv, mp_schema);
-        auto new_version = current_allocator().construct<partition_version>(std::move(mp));
-        new_version->insert_before(*_version);
+        apply_to_new_version(s, mpv, mp_schema);
+    }
+}
 
-        set_version(new_version);
+void partition_entry::apply_weak(const schema& s, mutation_partition_view mpv, const schema& mp_schema)
+{
+    if (!_snapshot) {
+        _version->partition().apply_weak(s, mpv, mp_schema);
+    } else {
+        apply_to_new_version(s, mpv, mp_schema);
     }
 }
 
+void partition_entry::apply_to_new_version(const schema& s, mutation_partition_view mpv, const schema& mp_schema)
+{
+    // mp is discarded if this throws, so this has strong exception guarantees.
+    mutation_partition mp(s.shared_from_this());
+    mp.apply_weak(s, mpv, mp_schema);
+    auto new_version = current_allocator().construct<partition_version>(std::move(mp));
+    new_version->insert_before(*_version);
+
+    set_version(new_version);
+}
+
 void partition_entry::apply(const schema& s, partition_entry&& pe, const schema& mp_schema)
 {
     auto begin = &*pe._version;
@@ -247,6 +267,42 @@ void partition_entry::apply(const schema& s, partition_entry&& pe, const schema&
     }
 }
 
+stop_iteration partition_entry::apply_some(const schema& s, partition_entry& pe, const schema& pe_schema, size_t max_rows)
+{
+    if (_snapshot || pe._snapshot || pe._version->next() || s.version() != pe_schema.version()) {
+        apply(s, std::move(pe), pe_schema);
+        return stop_iteration::yes;
+    }
+    return _version->partition().apply_some(s, pe._version->partition(), max_rows);
+}
+
+stop_iteration partition_entry::merge_versions_some(const schema& s, size_t max_rows)
+{
+    auto v = &*_version;
+    while (auto next = v->next()) {
+        if (next->is_referenced()) {
+            v = next;
+            continue;
+        }
+        ++partition_version_merge_steps;
+        if (v->partition().apply_some(s, next->partition(), max_rows) == stop_iteration::no) {
+            return stop_iteration::no;
+        }
+        current_allocator().destroy(next);
+        return stop_iteration(!v->next());
+    }
+    return stop_iteration::yes;
+}
+
+bool partition_entry::compact(const schema& s, can_gc_fn& can_gc, gc_clock::time_point now, size_t max_rows)
+{
+    if (_snapshot || !_version || _version->next() || _version->partition().clustered_rows().size() > max_rows) {
+        return false;
+    }
+    _version->partition().compact_for_compaction(s, can_gc, now);
+    return true;
+}
+
 mutation_partition partition_entry::squashed(schema_ptr from, schema_ptr to)
 {
     mutation_partition mp(to);
@@ -273,12 +329,12 @@ void partition_entry::upgrade(schema_ptr from, schema_ptr to)
     remove_or_mark_as_unique_owner(old_version);
 }
 
-lw_shared_ptr<partition_snapshot> partition_entry::read(schema_ptr entry_schema)
+lw_shared_ptr<partition_snapshot> partition_entry::read(schema_ptr entry_schema, bool merge_on_release)
 {
     if (_snapshot) {
         return _snapshot->shared_from_this();
     } else {
-        auto snp = make_lw_shared<partition_snapshot>(entry_schema, this);
+        auto snp = make_lw_shared<partition_snapshot>(entry_schema, this, merge_on_release);
         _snapshot = snp.get();
         return snp;
     }
@@ -336,6 +392,9 @@ mutation_fragment_opt partition_snapshot_reader::read_static_row()
             }
         }
     }
+    if (sr) {
+        cell_compression::decompress(*_schema, column_kind::static_column, sr->as_static_row().cells());
+    }
     return sr;
 }
 
@@ -387,13 +446,19 @@ mutation_fragment_opt partition_snapshot_reader::read_next()
 
         boost::range::pop_heap(_clustering_rows, heap_compare(_cmp));
         clustering_row result = *_clustering_rows.back()._position;
+        auto abbreviated_key = _clustering_rows.back()._position->abbreviated_key();
         pop_clustering_row();
-        while (!_clustering_rows.empty() && _eq(*_clustering_rows.front()._position, result)) {
+        auto same_row = [&] (const rows_entry& e) {
+            // Entries with different abbreviations can't have equal keys.
+            return !rows_entry::ordered_by_abbreviations(e.abbreviated_key(), abbreviated_key) && _eq(e, result);
+        };
+        while (!_clustering_rows.empty() && same_row(*_clustering_rows.front()._position)) {
             boost::range::pop_heap(_clustering_rows, heap_compare(_cmp));
             auto& current = _clustering_rows.back();
             result.apply(*_schema, *current._position);
             pop_clustering_row();
         }
+        cell_compression::decompress(*_schema, column_kind::regular_column, result.cells());
         _last_entry = result.position();
         return mutation_fragment(std::move(result));
     }
@@ -409,9 +474,11 @@ void partition_snapshot_reader::do_fill_buffer()
         }
     }
 
-    if (!_in_ck_range || _lsa_region.reclaim_counter() != _reclaim_counter || _snapshot->version_count() != _version_count) {
+    if (!_in_ck_range || _lsa_region.reclaim_counter() != _reclaim_counter || _snapshot->version_count() != _version_count
+            || partition_version_merge_steps != _merge_steps) {
         refresh_iterators();
         _reclaim_counter = _lsa_region.reclaim_counter();
+        _merge_steps = partition_version_merge_steps;
         _version_count = _snapshot->version_count();
     }
 
@@ -442,6 +509,39 @@ future<> partition_snapshot_reader::fill_buffer()
     });
 }
 
+future<> partition_snapshot_reader::fast_forward_to(position_range pr)
+{
+    _range_end = pr.end();
+    forward_buffer_to(pr.start());
+    if (!_buffer.empty() && !_cmp(_buffer.back(), pr.start())) {
+        return make_ready_future<>();
+    }
+    _range_tombstones.forward_to(pr.start());
+
+    while (_current_ck_range != _ck_range_end) {
+        auto r = position_range::from_range(*_current_ck_range);
+        if (_cmp(pr.start(), r.end())) {
+            if (_cmp(r.start(), pr.start())) {
+                _in_ck_range = true;
+                _last_entry = pr.start();
+            }
+            break;
+        }
+        _in_ck_range = false;
+        ++_current_ck_range;
+    }
+
+    return _read_section(_lsa_region, [&] {
+        return with_linearized_managed_bytes([&] {
+            refresh_iterators();
+            _reclaim_counter = _lsa_region.reclaim_counter();
+            _merge_steps = partition_version_merge_steps;
+            _version_count = _snapshot->version_count();
+            return make_ready_future<>();
+        });
+    });
+}
+
 streamed_mutation make_partition_snapshot_reader(schema_ptr s, dht::decorated_key dk,
     query::clustering_key_filtering_context fc, const query::clustering_row_ranges& crr,
     lw_shared_ptr<partition_snapshot> snp, logalloc::region& region,
@@ -177,16 +177,25 @@ class partition_version_ref {
 
 class partition_entry;
 
+// Incremented on every step of partition_entry::merge_versions_some(). Such
+// steps move rows between versions without changing their number, so readers
+// of snapshots check it to know when their iterators are to be refreshed.
+extern thread_local uint64_t partition_version_merge_steps;
+
 class partition_snapshot : public enable_lw_shared_from_this<partition_snapshot> {
     schema_ptr _schema;
     // Either _version or _entry is non-null.
     partition_version_ref _version;
     partition_entry* _entry;
+    // When false, versions which are no longer referenced after the snapshot
+    // goes away are left in place for the owner of the entry to merge with
+    // partition_entry::merge_versions_some().
+    bool _merge_on_release;
 
     friend class partition_entry;
 public:
-    explicit partition_snapshot(schema_ptr s, partition_entry* entry)
-        : _schema(std::move(s)), _entry(entry) { }
+    explicit partition_snapshot(schema_ptr s, partition_entry* entry, bool merge_on_release = true)
+        : _schema(std::move(s)), _entry(entry), _merge_on_release(merge_on_release) { }
     partition_snapshot(const partition_snapshot&) = delete;
     partition_snapshot(partition_snapshot&&) = delete;
     partition_snapshot& operator=(const partition_snapshot&) = delete;
@@ -212,6 +221,7 @@ class partition_entry {
     void set_version(partition_version*);
 
     void apply(const schema& s, partition_version* pv, const schema& pv_schema);
+    void apply_to_new_version(const schema& s, mutation_partition_view mpv, const schema& mp_schema);
 public:
     partition_entry() = default;
     explicit partition_entry(mutation_partition mp);
@@ -243,18 +253,54 @@ class partition_entry {
     // Strong exception guarantees.
     void apply(const schema& s, mutation_partition_view mpv, const schema& mp_schema);
 
+    // Same exception guarantees as:
+    // mutation_partition::apply_weak(const schema&, mutation_partition_view, const schema&)
+    void apply_weak(const schema& s, mutation_partition_view mpv, const schema& mp_schema);
+
     // Weak exception guarantees.
     // If an exception is thrown this and pe will be left in some valid states
     // such that if the operation is retried (possibly many times) and eventually
     // succeeds the result will be as if the first attempt didn't fail.
     void apply(const schema& s, partition_entry&& pe, const schema& pe_schema);
 
+    // Applies pe to this entry in steps of at most max_rows rows, so that
+    // large partitions can be merged with preemption in between. Returns
+    // stop_iteration::yes when done, after which pe is to be discarded.
+    // Until then, the data of pe is split between pe and this entry.
+    //
+    // Only a pe with a single version which no snapshot refers to, and an
+    // entry which has no snapshot, can be drained in place; otherwise all
+    // of pe is applied at once, as by apply(const schema&, partition_entry&&,
+    // const schema&), which is cheap for an entry with a snapshot.
+    //
+    // Same exception guarantees as
+    // apply(const schema&, partition_entry&&, const schema&).
+    stop_iteration apply_some(const schema& s, partition_entry& pe, const schema& pe_schema, size_t max_rows);
+
+    // Merges versions of this entry which no snapshot refers to into their
+    // newer neighbours, moving at most max_rows rows. Returns
+    // stop_iteration::yes when there is nothing more to merge.
+    //
+    // Weak exception guarantees, as apply_some() above.
+    stop_iteration merge_versions_some(const schema& s, size_t max_rows);
+
+    // Compacts the data of an entry which has a single version and no
+    // snapshot, see mutation_partition::compact_for_compaction(). Returns
+    // false, leaving the entry as it is, otherwise, or if it has more than
+    // max_rows rows, which would take too long to compact without preemption.
+    //
+    // Weak exception guarantees.
+    bool compact(const schema& s, can_gc_fn& can_gc, gc_clock::time_point now, size_t max_rows);
+
     mutation_partition squashed(schema_ptr from, schema_ptr to);
 
     // needs to be called with reclaiming disabled
     void upgrade(schema_ptr from, schema_ptr to);
 
-    lw_shared_ptr<partition_snapshot> read(schema_ptr entry_schema);
+    // If merge_on_release is false, versions left unreferenced by the
+    // snapshot are not merged when it goes away, see merge_versions_some().
+    // It only takes effect when no snapshot of the entry exists yet.
+    lw_shared_ptr<partition_snapshot> read(schema_ptr entry_schema, bool merge_on_release = true);
 };
 
 inline partition_version_ref& partition_snapshot::version()
@@ -275,8 +321,13 @@ class partition_snapshot_reader : public streamed_mutation::impl {
     class heap_compare {
         position_in_partition::less_compare& _cmp;
     public:
-        explicit heap_compare(position_in_partition::less_compare cmp) : _cmp(cmp) { }
+        explicit heap_compare(position_in_partition::less_compare& cmp) : _cmp(cmp) { }
         bool operator()(const rows_position& a, const rows_position& b) {
+            auto a1 = a._position->abbreviated_key();
+            auto a2 = b._position->abbreviated_key();
+            if (rows_entry::ordered_by_abbreviations(a1, a2)) {
+                return a2 < a1;
+            }
             return _cmp(*b._position, *a._position);
         }
     };
@@ -305,6 +356,7 @@ class partition_snapshot_reader : public streamed_mutation::impl {
     logalloc::allocating_section& _read_section;
 
     uint64_t _reclaim_counter;
+    uint64_t _merge_steps = 0;
     unsigned _version_count = 0;
 private:
     void refresh_iterators();
@@ -321,6 +373,7 @@ class partition_snapshot_reader : public streamed_mutation::impl {
         boost::any pointer_to_container);
     ~partition_snapshot_reader();
     virtual future<> fill_buffer() override;
+    virtual future<> fast_forward_to(position_range) override;
 };
 
 streamed_mutation make_partition_snapshot_reader(schema_ptr s, dht::decorated_key dk,
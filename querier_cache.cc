@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/range/algorithm/equal.hpp>
+#include <seastar/core/scollectd.hh>
+#include "querier_cache.hh"
+#include "schema.hh"
+
+constexpr size_t querier_cache::max_entries;
+constexpr std::chrono::seconds querier_cache::entry_ttl;
+
+void suspended_read::record(const mutation_fragment& mf) {
+    if (mf.is_static_row()) {
+        srow = mf.as_static_row();
+    } else if (mf.is_range_tombstone()) {
+        if (range_tombstones.size() < max_range_tombstones) {
+            range_tombstones.push_back(mf.as_range_tombstone());
+        } else {
+            too_many_range_tombstones = true;
+        }
+    } else if (mf.is_clustering_row()) {
+        last_ckey = mf.as_clustering_row().key();
+    }
+}
+
+bool suspended_read::prepare_for_next_page() {
+    if (!sm || !last_ckey || too_many_range_tombstones) {
+        return false;
+    }
+    // Same as the non-reversed case of modify_ranges() in query_pagers.cc,
+    // so that the ranges compare equal to what the next page asks for.
+    clustering_key_prefix::less_compare less(*schema);
+    auto cmp = [&less] (const clustering_key_prefix& k1, const clustering_key_prefix& k2) {
+        return less(k1, k2) ? -1 : less(k2, k1) ? 1 : 0;
+    };
+    next_ranges = slice.default_row_ranges();
+    bool found = false;
+    auto i = next_ranges.begin();
+    while (i != next_ranges.end()) {
+        bool contains = i->contains(*last_ckey, cmp);
+        found |= contains;
+        if (!found || (contains && i->is_singular())) {
+            i = next_ranges.erase(i);
+            continue;
+        }
+        if (contains) {
+            *i = query::clustering_range(query::clustering_range::bound(*last_ckey, false), i->end());
+        }
+        ++i;
+    }
+    return !next_ranges.empty();
+}
+
+bool suspended_read::continued_by(const query::partition_range& pr, const query::partition_slice& s) const {
+    if (!pr.is_singular() || !pr.start()->value().equal(*schema, dht::ring_position(sm->decorated_key()))) {
+        return false;
+    }
+    if (s.options.mask() != slice.options.mask()
+            || s.static_columns != slice.static_columns
+            || s.regular_columns != slice.regular_columns
+            || s.partition_row_limit() != slice.partition_row_limit()) {
+        return false;
+    }
+    clustering_key_prefix::equality eq(*schema);
+    auto cmp = [&eq] (const clustering_key_prefix& k1, const clustering_key_prefix& k2) {
+        return eq(k1, k2) ? 0 : 1;
+    };
+    auto range_equal = [&cmp] (const query::clustering_range& r1, const query::clustering_range& r2) {
+        return r1.equal(r2, cmp);
+    };
+    return boost::equal(s.default_row_ranges(), slice.default_row_ranges(), range_equal)
+        && boost::equal(s.row_ranges(*schema, sm->key()), next_ranges, range_equal);
+}
+
+querier_cache::querier_cache() {
+    setup_collectd();
+    _expiry_timer.set_callback([this] {
+        drop_expired();
+        if (!_entries.empty()) {
+            _expiry_timer.arm(entry_ttl);
+        }
+    });
+}
+
+querier_cache::~querier_cache() {
+    clear();
+}
+
+void querier_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "insertions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "entries")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _entries.size(); })
+        ),
+    }));
+}
+
+void querier_cache::drop_expired() {
+    auto now = lowres_clock::now();
+    while (!_entries.empty() && _entries.front().expiry <= now) {
+        _entries.pop_front();
+        ++_stats.evictions;
+    }
+}
+
+void querier_cache::insert(lw_shared_ptr<suspended_read> r) {
+    drop_expired();
+    while (_entries.size() >= max_entries) {
+        evict_one();
+    }
+    _entries.push_back(entry{std::move(r), lowres_clock::now() + entry_ttl});
+    ++_stats.insertions;
+    if (!_expiry_timer.armed()) {
+        _expiry_timer.arm(entry_ttl);
+    }
+}
+
+lw_shared_ptr<suspended_read> querier_cache::lookup(const schema& s, const query::partition_range& pr, const query::partition_slice& slice) {
+    drop_expired();
+    for (auto i = _entries.begin(); i != _entries.end(); ++i) {
+        auto& r = *i->read;
+        if (r.schema->version() == s.version() && r.continued_by(pr, slice)) {
+            auto ret = std::move(i->read);
+            _entries.erase(i);
+            ++_stats.hits;
+            return ret;
+        }
+    }
+    ++_stats.misses;
+    return { };
+}
+
+void querier_cache::evict_all_for_table(const utils::UUID& cf_id) {
+    auto i = _entries.begin();
+    while (i != _entries.end()) {
+        if (i->read->schema->id() == cf_id) {
+            i = _entries.erase(i);
+            ++_stats.removals;
+        } else {
+            ++i;
+        }
+    }
+}
+
+void querier_cache::evict_one() {
+    if (!_entries.empty()) {
+        _entries.pop_front();
+        ++_stats.evictions;
+    }
+}
+
+void querier_cache::clear() {
+    _stats.removals += _entries.size();
+    _entries.clear();
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <vector>
+#include <experimental/optional>
+#include <seastar/core/timer.hh>
+#include <seastar/core/shared_ptr.hh>
+#include "query-request.hh"
+#include "mutation_reader.hh"
+#include "streamed_mutation.hh"
+#include "range_tombstone.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+// Reader of a single-partition data query which stopped because it hit the
+// row limit, together with what the query of the next page needs to continue
+// from where it stopped: the partition header fragments which won't be read
+// again (partition tombstone, static row, range tombstones) and the clustering
+// ranges the next page is expected to ask for.
+//
+// The reader refers to range and slice, so the object must not be moved.
+struct suspended_read {
+    // Range tombstones are kept for replaying into the next page, don't keep
+    // readers of partitions with more of them than this.
+    static constexpr size_t max_range_tombstones = 64;
+
+    schema_ptr schema;
+    const query::partition_range range;
+    const query::partition_slice slice;
+    std::experimental::optional<mutation_reader> reader;
+    std::experimental::optional<streamed_mutation> sm;
+    std::experimental::optional<static_row> srow;
+    std::vector<range_tombstone> range_tombstones;
+    bool too_many_range_tombstones = false;
+    std::experimental::optional<clustering_key_prefix> last_ckey;
+    query::clustering_row_ranges next_ranges;
+
+    suspended_read(schema_ptr s, const query::partition_range& r, const query::partition_slice& sl)
+        : schema(std::move(s))
+        , range(r)
+        , slice(sl)
+    { }
+
+    // Records a fragment before it is passed to the query consumer.
+    void record(const mutation_fragment& mf);
+    // Computes next_ranges, mirroring what the pager asks for after
+    // a page ending on last_ckey. Returns false if the read
+    // can't be continued.
+    bool prepare_for_next_page();
+    // Checks if a query of pr and s continues this read.
+    bool continued_by(const query::partition_range& pr, const query::partition_slice& s) const;
+};
+
+// Shard-wide cache of suspended single-partition data queries, so that
+// paging through a large partition continues the reader of the previous page
+// instead of looking up the partition in all sstables and skipping to the
+// paging position again for every page.
+//
+// Entries are matched by position: an entry is used only if the query asks
+// for exactly the clustering ranges following the last row returned by the
+// suspended read, with the same schema version and columns. Entries are
+// dropped after entry_ttl, when the cache holds more than max_entries, and
+// when their table is truncated or dropped. Suspended readers hold their
+// sstables and memtables, and a unit of the read concurrency semaphore.
+class querier_cache {
+public:
+    static constexpr size_t max_entries = 25;
+    static constexpr std::chrono::seconds entry_ttl{10};
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t removals = 0;
+    };
+private:
+    struct entry {
+        lw_shared_ptr<suspended_read> read;
+        lowres_clock::time_point expiry;
+    };
+    std::list<entry> _entries;
+    stats _stats;
+    timer<lowres_clock> _expiry_timer;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    void setup_collectd();
+    void drop_expired();
+public:
+    querier_cache();
+    ~querier_cache();
+
+    void insert(lw_shared_ptr<suspended_read> r);
+    // Returns the suspended read which a query of given range and slice
+    // continues, removing it from the cache, or an empty pointer.
+    lw_shared_ptr<suspended_read> lookup(const schema& s, const query::partition_range& pr, const query::partition_slice& slice);
+    // Drops all entries of given table.
+    void evict_all_for_table(const utils::UUID& cf_id);
+    // Drops the oldest entry, if any.
+    void evict_one();
+    void clear();
+
+    size_t size() const { return _entries.size(); }
+    const stats& get_stats() const { return _stats; }
+};
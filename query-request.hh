@@ -95,12 +95,32 @@ class specific_ranges {
 
 constexpr auto max_rows = std::numeric_limits<uint32_t>::max();
 
+// Restriction of a regular column's value, which replicas evaluate on every
+// clustering row of the slice. Rows for which the column is missing or doesn't
+// satisfy the restriction are not returned, and don't count against limits.
+// The value is compared using the column's type.
+struct column_filter {
+    enum class op : uint8_t { eq, lt, lte, gt, gte };
+    column_id column;
+    op type;
+    bytes value;
+};
+
 // Specifies subset of rows, columns and cell attributes to be returned in a query.
 // Can be accessed across cores.
 // Schema-dependent.
 class partition_slice {
 public:
-    enum class option { send_clustering_key, send_partition_key, send_timestamp, send_expiry, reversed, distinct, collections_as_maps, send_ttl };
+    // count_rows: replicas return only the number of live rows matching the
+    // slice, in result::row_count(), and no partitions.
+    // bypass_cache makes replicas read from memtables and sstables only,
+    // neither populating row_cache nor changing its LRU order.
+    // columnar asks for a result in the columnar encoding, see
+    // query-result-columnar.hh. Only honoured where the result is built on the
+    // coordinator, replicas ignore it; result::is_columnar() tells which
+    // encoding a result has.
+    enum class option { send_clustering_key, send_partition_key, send_timestamp, send_expiry, reversed, distinct, collections_as_maps, send_ttl,
+        count_rows, bypass_cache, columnar };
     using option_set = enum_set<super_enum<option,
         option::send_clustering_key,
         option::send_partition_key,
@@ -109,7 +129,10 @@ class partition_slice {
         option::reversed,
         option::distinct,
         option::collections_as_maps,
-        option::send_ttl>>;
+        option::send_ttl,
+        option::count_rows,
+        option::bypass_cache,
+        option::columnar>>;
     clustering_row_ranges _row_ranges;
 public:
     std::vector<column_id> static_columns; // TODO: consider using bitmap
@@ -119,12 +142,14 @@ class partition_slice {
     std::unique_ptr<specific_ranges> _specific_ranges;
     cql_serialization_format _cql_format;
     uint32_t _partition_row_limit;
+    std::vector<column_filter> _filters;
 public:
     partition_slice(clustering_row_ranges row_ranges, std::vector<column_id> static_columns,
         std::vector<column_id> regular_columns, option_set options,
         std::unique_ptr<specific_ranges> specific_ranges = nullptr,
         cql_serialization_format = cql_serialization_format::internal(),
-        uint32_t partition_row_limit = max_rows);
+        uint32_t partition_row_limit = max_rows,
+        std::vector<column_filter> filters = {});
     partition_slice(const partition_slice&);
     partition_slice(partition_slice&&);
     ~partition_slice();
@@ -148,17 +173,31 @@ class partition_slice {
     void set_partition_row_limit(uint32_t limit) {
         _partition_row_limit = limit;
     }
+    // All of the filters have to be satisfied by a row for it to be returned.
+    const std::vector<column_filter>& filters() const {
+        return _filters;
+    }
 
     friend std::ostream& operator<<(std::ostream& out, const partition_slice& ps);
     friend std::ostream& operator<<(std::ostream& out, const specific_ranges& ps);
 };
 
 constexpr auto max_partitions = std::numeric_limits<uint32_t>::max();
+constexpr auto max_result_size = std::numeric_limits<uint64_t>::max();
 
 // This is a partition slice which a full clustering row range and maximum
 // per-partition row limit. No options or columns are set.
 extern const query::partition_slice full_slice;
 
+// Equality restriction on an indexed regular column. A read_command which
+// carries one is served from the column's local secondary index instead of
+// a scan of the table, and returns only rows for which the column has the
+// given value.
+struct index_restriction {
+    column_id column;
+    bytes value;
+};
+
 // Full specification of a query to the database.
 // Intended for passing across replicas.
 // Can be accessed across cores.
@@ -171,7 +210,14 @@ class read_command {
     gc_clock::time_point timestamp;
     std::experimental::optional<tracing::trace_info> trace_info;
     uint32_t partition_limit; // The maximum number of live partitions to return.
+    std::experimental::optional<index_restriction> index;
+    // The size, in bytes, past which replicas end the result early, as a
+    // short read with fewer rows than row_limit. See result::is_short_read().
+    uint64_t max_result_size = query::max_result_size;
     api::timestamp_type read_timestamp; // not serialized
+    // Time the coordinator stops waiting for the result, after which the
+    // replica drops the read. Not serialized, set from the request's deadline.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
 public:
     read_command(utils::UUID cf_id,
                  table_schema_version schema_version,
@@ -191,7 +237,61 @@ class read_command {
         , read_timestamp(rt)
     { }
 
+    // Used by the deserializer.
+    read_command(utils::UUID cf_id,
+                 table_schema_version schema_version,
+                 partition_slice slice,
+                 uint32_t row_limit,
+                 gc_clock::time_point now,
+                 std::experimental::optional<tracing::trace_info> ti,
+                 uint32_t partition_limit,
+                 std::experimental::optional<index_restriction> index,
+                 uint64_t max_result_size)
+        : read_command(std::move(cf_id), std::move(schema_version), std::move(slice), row_limit, now, std::move(ti), partition_limit)
+    {
+        this->index = std::move(index);
+        this->max_result_size = max_result_size;
+    }
+
     friend std::ostream& operator<<(std::ostream& out, const read_command& r);
 };
 
+// Thrown when a query scans more tombstones than tombstone_failure_threshold.
+class tombstone_overwhelming_exception : public std::runtime_error {
+public:
+    tombstone_overwhelming_exception(uint32_t tombstones, uint32_t threshold)
+        : std::runtime_error(sprint("Scanned over %d tombstones (tombstone_failure_threshold is %d), query aborted", tombstones, threshold))
+    { }
+};
+
+// Counts the tombstones scanned by a query: partition, range and row
+// tombstones, and rows which turned out to have no live data.
+// Aborts the query by throwing tombstone_overwhelming_exception once
+// there are more than the failure threshold.
+class tombstone_counter {
+    uint32_t _warn_threshold;
+    uint32_t _failure_threshold;
+    uint32_t _count = 0;
+public:
+    tombstone_counter(uint32_t warn_threshold = max_rows, uint32_t failure_threshold = max_rows)
+        : _warn_threshold(warn_threshold)
+        , _failure_threshold(failure_threshold)
+    { }
+
+    void scanned(uint32_t n = 1) {
+        _count += n;
+        if (_count > _failure_threshold) {
+            throw tombstone_overwhelming_exception(_count, _failure_threshold);
+        }
+    }
+
+    uint32_t count() const {
+        return _count;
+    }
+
+    bool over_warn_threshold() const {
+        return _count > _warn_threshold;
+    }
+};
+
 }
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "query-result-columnar.hh"
+#include "utils/data_output.hh"
+
+namespace query {
+
+columnar_column_builder::columnar_column_builder(uint8_t flags)
+    : _flags(flags & ~columnar_format::fixed_width)
+    , _offsets{0}
+{ }
+
+void columnar_column_builder::add_null() {
+    if (_entries % 8 == 0) {
+        _present.push_back(0);
+    }
+    ++_entries;
+}
+
+void columnar_column_builder::add(bytes_view value, api::timestamp_type timestamp, expiry_opt expiry, ttl_opt ttl) {
+    auto i = _entries;
+    add_null();
+    _present.back() |= 1 << (i % 8);
+    _data.insert(_data.end(), value.begin(), value.end());
+    _offsets.push_back(_data.size());
+    if (_flags & columnar_format::has_timestamps) {
+        _timestamps.push_back(timestamp);
+    }
+    if (_flags & columnar_format::has_expiries) {
+        _expiries.push_back(expiry ? expiry->time_since_epoch().count() : 0);
+    }
+    if (_flags & columnar_format::has_ttls) {
+        _ttls.push_back(ttl ? ttl->count() : 0);
+    }
+}
+
+void columnar_column_builder::truncate(uint32_t n) {
+    if (n >= _entries) {
+        return;
+    }
+    uint32_t dropped = 0;
+    for (auto i = n; i < _entries; ++i) {
+        dropped += has_value(i);
+    }
+    auto values = value_count() - dropped;
+    _offsets.resize(values + 1);
+    _data.resize(_offsets.back());
+    if (_flags & columnar_format::has_timestamps) {
+        _timestamps.resize(values);
+    }
+    if (_flags & columnar_format::has_expiries) {
+        _expiries.resize(values);
+    }
+    if (_flags & columnar_format::has_ttls) {
+        _ttls.resize(values);
+    }
+    _present.resize((n + 7) / 8);
+    if (n % 8) {
+        _present.back() &= (1 << (n % 8)) - 1;
+    }
+    _entries = n;
+}
+
+int64_t columnar_column_builder::fixed_width() const {
+    if (value_count() == 0) {
+        return 0;
+    }
+    auto width = _offsets[1] - _offsets[0];
+    for (size_t i = 1; i < value_count(); ++i) {
+        if (_offsets[i + 1] - _offsets[i] != width) {
+            return -1;
+        }
+    }
+    return width;
+}
+
+size_t columnar_column_builder::serialized_size() const {
+    size_t size = sizeof(uint8_t) + sizeof(uint32_t) + _present.size() + _data.size();
+    if (fixed_width() >= 0) {
+        size += sizeof(uint32_t);
+    } else {
+        size += _offsets.size() * sizeof(uint32_t);
+    }
+    size += _timestamps.size() * sizeof(int64_t);
+    size += _expiries.size() * sizeof(int32_t);
+    size += _ttls.size() * sizeof(int32_t);
+    return size;
+}
+
+void columnar_column_builder::serialize(data_output& out) const {
+    auto width = fixed_width();
+    out.write(uint8_t(_flags | (width >= 0 ? columnar_format::fixed_width : 0)));
+    out.write(value_count());
+    auto raw = [&out] (auto& v) {
+        auto p = reinterpret_cast<const char*>(v.data());
+        out.write(p, p + v.size());
+    };
+    raw(_present);
+    if (width >= 0) {
+        out.write(uint32_t(width));
+    } else {
+        out.write(_offsets.begin(), _offsets.end());
+    }
+    raw(_data);
+    out.write(_timestamps.begin(), _timestamps.end());
+    out.write(_expiries.begin(), _expiries.end());
+    out.write(_ttls.begin(), _ttls.end());
+}
+
+columnar_result_builder::columnar_result_builder(const partition_slice& slice)
+    : _slice(slice)
+{
+    uint8_t flags = 0;
+    if (slice.options.contains<partition_slice::option::send_timestamp>()) {
+        flags |= columnar_format::has_timestamps;
+    }
+    if (slice.options.contains<partition_slice::option::send_expiry>()) {
+        flags |= columnar_format::has_expiries;
+    }
+    if (slice.options.contains<partition_slice::option::send_ttl>()) {
+        flags |= columnar_format::has_ttls;
+    }
+    _static_columns.resize(slice.static_columns.size(), columnar_column_builder(flags));
+    _regular_columns.resize(slice.regular_columns.size(), columnar_column_builder(flags));
+}
+
+void columnar_result_builder::start_partition(const schema& s, const partition_key& key) {
+    _ranges = &_slice.row_ranges(s, key);
+    _row_start.push_back(_rows);
+    if (_slice.options.contains<partition_slice::option::send_partition_key>()) {
+        _partition_keys.add(bytes_view(key.representation()));
+    }
+}
+
+void columnar_result_builder::add_row(const clustering_key& key) {
+    ++_rows;
+    if (_slice.options.contains<partition_slice::option::send_clustering_key>()) {
+        _clustering_keys.add(bytes_view(key.representation()));
+    }
+}
+
+void columnar_result_builder::end_partition(uint32_t row_count) {
+    _row_count += row_count;
+}
+
+void columnar_result_builder::retract_partition() {
+    _rows = _row_start.back();
+    _row_start.pop_back();
+    uint32_t partitions = _row_start.size();
+    _partition_keys.truncate(partitions);
+    for (auto&& c : _static_columns) {
+        c.truncate(partitions);
+    }
+    _clustering_keys.truncate(_rows);
+    for (auto&& c : _regular_columns) {
+        c.truncate(_rows);
+    }
+}
+
+result columnar_result_builder::build() {
+    bytes_ostream out;
+    if (!_row_start.empty()) {
+        uint8_t flags = 0;
+        if (_slice.options.contains<partition_slice::option::send_partition_key>()) {
+            flags |= columnar_format::has_partition_keys;
+        }
+        if (_slice.options.contains<partition_slice::option::send_clustering_key>()) {
+            flags |= columnar_format::has_clustering_keys;
+        }
+        _row_start.push_back(_rows);
+
+        size_t size = 3 * sizeof(uint32_t) + _row_start.size() * sizeof(uint32_t) + sizeof(uint8_t) + 2 * sizeof(uint32_t);
+        if (flags & columnar_format::has_partition_keys) {
+            size += _partition_keys.serialized_size();
+        }
+        if (flags & columnar_format::has_clustering_keys) {
+            size += _clustering_keys.serialized_size();
+        }
+        for (auto&& c : _static_columns) {
+            size += c.serialized_size();
+        }
+        for (auto&& c : _regular_columns) {
+            size += c.serialized_size();
+        }
+
+        data_output page(reinterpret_cast<char*>(out.write_place_holder(size)), size);
+        page.write(uint32_t(size - sizeof(uint32_t)));
+        page.write(uint32_t(_row_start.size() - 1));
+        page.write(_rows);
+        page.write(_row_start.begin(), _row_start.end());
+        page.write(flags);
+        if (flags & columnar_format::has_partition_keys) {
+            _partition_keys.serialize(page);
+        }
+        if (flags & columnar_format::has_clustering_keys) {
+            _clustering_keys.serialize(page);
+        }
+        page.write(uint32_t(_static_columns.size()));
+        for (auto&& c : _static_columns) {
+            c.serialize(page);
+        }
+        page.write(uint32_t(_regular_columns.size()));
+        for (auto&& c : _regular_columns) {
+            c.serialize(page);
+        }
+    }
+    result r(std::move(out), stdx::nullopt, api::missing_timestamp, _row_count, _short_read);
+    r.mark_as_columnar();
+    return r;
+}
+
+columnar_column_view::columnar_column_view(data_input& in, uint32_t entries)
+    : _flags(in.read<uint8_t>())
+    , _value_count(in.read<uint32_t>())
+{
+    _present = in.read_view((entries + 7) / 8).data();
+    if (_flags & columnar_format::fixed_width) {
+        _width = in.read<uint32_t>();
+        _values = in.read_view(_value_count * _width).data();
+    } else {
+        _offsets = in.read_view((_value_count + 1) * sizeof(uint32_t)).data();
+        _values = in.read_view(read_at<uint32_t>(_offsets, _value_count)).data();
+    }
+    if (_flags & columnar_format::has_timestamps) {
+        _timestamps = in.read_view(_value_count * sizeof(int64_t)).data();
+    }
+    if (_flags & columnar_format::has_expiries) {
+        _expiries = in.read_view(_value_count * sizeof(int32_t)).data();
+    }
+    if (_flags & columnar_format::has_ttls) {
+        _ttls = in.read_view(_value_count * sizeof(int32_t)).data();
+    }
+}
+
+uint32_t columnar_column_view::count_values(uint32_t from, uint32_t to) const {
+    uint32_t n = 0;
+    for (; from < to && from % 8; ++from) {
+        n += has_value(from);
+    }
+    for (; from + 8 <= to; from += 8) {
+        n += __builtin_popcount(uint8_t(_present[from / 8]));
+    }
+    for (; from < to; ++from) {
+        n += has_value(from);
+    }
+    return n;
+}
+
+columnar_page_view::columnar_page_view(data_input& in) {
+    auto size = in.read<uint32_t>();
+    data_input page(in.read_view(size));
+    _partition_count = page.read<uint32_t>();
+    _row_count = page.read<uint32_t>();
+    _row_start = page.read_view((_partition_count + 1) * sizeof(uint32_t)).data();
+    _flags = page.read<uint8_t>();
+    if (has_partition_keys()) {
+        _partition_keys = columnar_column_view(page, _partition_count);
+    }
+    if (has_clustering_keys()) {
+        _clustering_keys = columnar_column_view(page, _row_count);
+    }
+    auto n = page.read<uint32_t>();
+    _static_columns.reserve(n);
+    while (n--) {
+        _static_columns.emplace_back(page, _partition_count);
+    }
+    n = page.read<uint32_t>();
+    _regular_columns.reserve(n);
+    while (n--) {
+        _regular_columns.emplace_back(page, _row_count);
+    }
+}
+
+}
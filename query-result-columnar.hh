@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <seastar/core/byteorder.hh>
+#include "bytes.hh"
+#include "bytes_ostream.hh"
+#include "gc_clock.hh"
+#include "keys.hh"
+#include "query-request.hh"
+#include "query-result.hh"
+#include "timestamp.hh"
+#include "utils/data_input.hh"
+
+class data_output;
+
+namespace query {
+
+//
+// Columnar encoding of query results.
+//
+// The row-oriented encoding frames every cell of every row, so reading a few
+// columns of many rows spends most of the time encoding and decoding frames.
+// In the columnar encoding the cells of a column are stored together: a bitmap
+// of which rows have a value, the values back to back, with a single width if
+// all of them have the same size, and the requested timestamps, expiries and
+// TTLs in arrays of their own.
+//
+// A columnar result is a sequence of pages. Each page is self-delimiting, so
+// results are merged by concatenating their pages. All integers are big endian.
+//
+//   page:
+//     uint32 size                   // of the rest of the page
+//     uint32 partition_count
+//     uint32 row_count              // clustering rows in the page
+//     uint32 row_start[partition_count + 1] // first row of each partition
+//     uint8  flags                  // page_flags
+//     block  partition_keys         // partition_count entries, if has_partition_keys
+//     block  clustering_keys        // row_count entries, if has_clustering_keys
+//     uint32 static_column_count
+//     block  static_columns[]       // partition_count entries each
+//     uint32 regular_column_count
+//     block  regular_columns[]      // row_count entries each
+//
+//   block:
+//     uint8  flags                  // column_flags
+//     uint32 value_count            // entries which have a value
+//     uint8  present[(entries + 7) / 8] // bit i % 8 of byte i / 8 is set if entry i has a value
+//     uint32 width, uint8 values[value_count * width]                // if fixed_width
+//     uint32 offsets[value_count + 1], uint8 values[offsets[value_count]] // otherwise
+//     int64  timestamps[value_count] // if has_timestamps, missing_timestamp for collections
+//     int32  expiries[value_count]   // if has_expiries, 0 if the cell doesn't expire
+//     int32  ttls[value_count]       // if has_ttls, 0 if the cell has no TTL
+//
+// Columns are in the order of the partition_slice. Only live cells have values.
+// A partition with live static cells but no rows has no entries in the row
+// blocks. Columnar results carry no digest.
+//
+
+struct columnar_format {
+    enum page_flags : uint8_t {
+        has_partition_keys = 1,
+        has_clustering_keys = 2,
+    };
+    enum column_flags : uint8_t {
+        fixed_width = 1,
+        has_timestamps = 2,
+        has_expiries = 4,
+        has_ttls = 8,
+    };
+};
+
+// Accumulates the entries of one block.
+class columnar_column_builder {
+    uint8_t _flags;
+    uint32_t _entries = 0;
+    std::vector<uint8_t> _present;
+    std::vector<uint32_t> _offsets;
+    std::vector<bytes::value_type> _data;
+    std::vector<api::timestamp_type> _timestamps;
+    std::vector<int32_t> _expiries;
+    std::vector<int32_t> _ttls;
+private:
+    uint32_t value_count() const {
+        return _offsets.size() - 1;
+    }
+    bool has_value(uint32_t i) const {
+        return _present[i / 8] & (1 << (i % 8));
+    }
+    // The common width of all values, or -1.
+    int64_t fixed_width() const;
+public:
+    // flags is a set of columnar_format::column_flags, fixed_width
+    // is determined by the values.
+    explicit columnar_column_builder(uint8_t flags = 0);
+
+    uint32_t size() const {
+        return _entries;
+    }
+    void add_null();
+    void add(bytes_view value, api::timestamp_type timestamp = api::missing_timestamp, expiry_opt expiry = {}, ttl_opt ttl = {});
+    // Drops all entries past the first n.
+    void truncate(uint32_t n);
+
+    size_t serialized_size() const;
+    void serialize(data_output&) const;
+};
+
+// Builds a columnar query::result, see to_data_query_result().
+//
+// Partitions are written with start_partition(), one entry in each static
+// column, then for each row add_row() followed by one entry in each regular
+// column, and end_partition().
+class columnar_result_builder {
+    const partition_slice& _slice;
+    const clustering_row_ranges* _ranges = nullptr;
+    std::vector<uint32_t> _row_start;
+    columnar_column_builder _partition_keys;
+    columnar_column_builder _clustering_keys;
+    std::vector<columnar_column_builder> _static_columns;
+    std::vector<columnar_column_builder> _regular_columns;
+    uint32_t _rows = 0;
+    uint32_t _row_count = 0;
+    bool _short_read = false;
+public:
+    explicit columnar_result_builder(const partition_slice& slice);
+    columnar_result_builder(columnar_result_builder&&) = delete; // _slice is captured by reference
+
+    const partition_slice& slice() const {
+        return _slice;
+    }
+
+    void start_partition(const schema& s, const partition_key& key);
+    // Row ranges of the partition started last.
+    const clustering_row_ranges& ranges() const {
+        return *_ranges;
+    }
+    columnar_column_builder& static_column(size_t i) {
+        return _static_columns[i];
+    }
+    void add_row(const clustering_key& key);
+    columnar_column_builder& regular_column(size_t i) {
+        return _regular_columns[i];
+    }
+    // row_count is added to the row count of the result.
+    void end_partition(uint32_t row_count);
+    // Cancels the partition started last, with all of its rows.
+    void retract_partition();
+
+    void mark_as_short_read() {
+        _short_read = true;
+    }
+
+    result build();
+};
+
+// View of a block, read from a page.
+class columnar_column_view {
+    uint8_t _flags = 0;
+    uint32_t _value_count = 0;
+    const bytes::value_type* _present = nullptr;
+    uint32_t _width = 0;
+    const bytes::value_type* _offsets = nullptr;
+    const bytes::value_type* _values = nullptr;
+    const bytes::value_type* _timestamps = nullptr;
+    const bytes::value_type* _expiries = nullptr;
+    const bytes::value_type* _ttls = nullptr;
+private:
+    template<typename T>
+    static T read_at(const bytes::value_type* p, uint32_t i) {
+        return read_be<T>(reinterpret_cast<const char*>(p) + i * sizeof(T));
+    }
+public:
+    columnar_column_view() = default;
+    // Reads a block of given number of entries.
+    columnar_column_view(data_input& in, uint32_t entries);
+
+    bool has_value(uint32_t i) const {
+        return _present[i / 8] & (1 << (i % 8));
+    }
+    // Entries [from, to) which have a value.
+    uint32_t count_values(uint32_t from, uint32_t to) const;
+
+    // Accessors of the n-th value, which is that of the n-th entry having one.
+    bytes_view value(uint32_t n) const {
+        if (_flags & columnar_format::fixed_width) {
+            return bytes_view(_values + n * _width, _width);
+        }
+        auto b = read_at<uint32_t>(_offsets, n);
+        return bytes_view(_values + b, read_at<uint32_t>(_offsets, n + 1) - b);
+    }
+    api::timestamp_type timestamp(uint32_t n) const {
+        return _timestamps ? read_at<int64_t>(_timestamps, n) : api::missing_timestamp;
+    }
+    expiry_opt expiry(uint32_t n) const {
+        auto e = _expiries ? read_at<int32_t>(_expiries, n) : 0;
+        return e ? expiry_opt(gc_clock::time_point(gc_clock::duration(e))) : expiry_opt();
+    }
+    ttl_opt ttl(uint32_t n) const {
+        auto t = _ttls ? read_at<int32_t>(_ttls, n) : 0;
+        return t ? ttl_opt(gc_clock::duration(t)) : ttl_opt();
+    }
+};
+
+// View of a single page of a columnar result.
+class columnar_page_view {
+    uint32_t _partition_count;
+    uint32_t _row_count;
+    const bytes::value_type* _row_start;
+    uint8_t _flags;
+    columnar_column_view _partition_keys;
+    columnar_column_view _clustering_keys;
+    std::vector<columnar_column_view> _static_columns;
+    std::vector<columnar_column_view> _regular_columns;
+public:
+    // Reads the page at the front of in, and skips past it.
+    explicit columnar_page_view(data_input& in);
+
+    uint32_t partition_count() const {
+        return _partition_count;
+    }
+    uint32_t row_count() const {
+        return _row_count;
+    }
+    // Rows of partition p are [row_start(p), row_start(p + 1)).
+    uint32_t row_start(uint32_t p) const {
+        return read_be<uint32_t>(reinterpret_cast<const char*>(_row_start) + p * sizeof(uint32_t));
+    }
+    bool has_partition_keys() const {
+        return _flags & columnar_format::has_partition_keys;
+    }
+    bool has_clustering_keys() const {
+        return _flags & columnar_format::has_clustering_keys;
+    }
+    partition_key partition_key_at(uint32_t p) const {
+        return partition_key::from_bytes(_partition_keys.value(p));
+    }
+    clustering_key clustering_key_at(uint32_t r) const {
+        return clustering_key::from_bytes(_clustering_keys.value(r));
+    }
+    const std::vector<columnar_column_view>& static_columns() const {
+        return _static_columns;
+    }
+    const std::vector<columnar_column_view>& regular_columns() const {
+        return _regular_columns;
+    }
+};
+
+// Calls func on a columnar_page_view of each page of a columnar result, in order.
+template <typename Func>
+inline void for_each_columnar_page(bytes_view buf, Func&& func) {
+    data_input in(buf);
+    while (in.has_next()) {
+        func(columnar_page_view(in));
+    }
+}
+
+}
@@ -23,6 +23,7 @@
 
 #include "query-request.hh"
 #include "query-result.hh"
+#include "query-result-columnar.hh"
 #include "utils/data_input.hh"
 
 #include "idl/uuid.dist.hh"
@@ -62,24 +63,78 @@ class result_atomic_cell_view {
     }
 };
 
+// Reads the entries of a block of a columnar page in increasing order, keeping
+// track of the number of values before the current one.
+class columnar_column_cursor {
+    const columnar_column_view* _v;
+    uint32_t _entry = 0;
+    uint32_t _value = 0;
+private:
+    // Returns the index of the value of given entry, which must not be before
+    // the one of the previous call.
+    stdx::optional<uint32_t> seek(uint32_t entry) {
+        _value += _v->count_values(_entry, entry);
+        _entry = entry;
+        if (!_v->has_value(entry)) {
+            return {};
+        }
+        return _value;
+    }
+public:
+    columnar_column_cursor(const columnar_column_view& v) : _v(&v) {}
+
+    std::experimental::optional<result_atomic_cell_view> atomic_cell(uint32_t entry) {
+        auto n = seek(entry);
+        if (!n) {
+            return {};
+        }
+        return {result_atomic_cell_view(_v->timestamp(*n), _v->expiry(*n), _v->ttl(*n), _v->value(*n))};
+    }
+    std::experimental::optional<bytes_view> collection_cell(uint32_t entry) {
+        auto n = seek(entry);
+        if (!n) {
+            return {};
+        }
+        return {_v->value(*n)};
+    }
+};
+
 // Contains cells in the same order as requested by partition_slice.
 // Contains only live cells.
 class result_row_view {
-    ser::qr_row_view _v;
+    stdx::optional<ser::qr_row_view> _v;
+    // Set instead of _v for a row of a columnar page.
+    columnar_column_cursor* _columns = nullptr;
+    uint32_t _entry = 0;
 public:
     result_row_view(ser::qr_row_view v) : _v(v) {}
+    result_row_view(std::vector<columnar_column_cursor>& columns, uint32_t entry)
+        : _columns(columns.data()), _entry(entry) {}
 
     class iterator_type {
         using cells_vec = std::vector<std::experimental::optional<ser::qr_cell_view>>;
         cells_vec _cells;
         cells_vec::iterator _i;
         bytes _tmp_value;
+        // Next column of a row of a columnar page, if _columnar.
+        bool _columnar = false;
+        columnar_column_cursor* _column = nullptr;
+        uint32_t _entry = 0;
     public:
         iterator_type(ser::qr_row_view v)
             : _cells(v.cells())
             , _i(_cells.begin())
         { }
+        iterator_type(columnar_column_cursor* columns, uint32_t entry)
+            : _i(_cells.begin())
+            , _columnar(true)
+            , _column(columns)
+            , _entry(entry)
+        { }
         std::experimental::optional<result_atomic_cell_view> next_atomic_cell() {
+            if (_columnar) {
+                return (_column++)->atomic_cell(_entry);
+            }
             auto cell_opt = *_i++;
             if (!cell_opt) {
                 return {};
@@ -92,6 +147,9 @@ class result_row_view {
             return {result_atomic_cell_view(timestamp, expiry, ttl, _tmp_value)};
         }
         std::experimental::optional<bytes_view> next_collection_cell() {
+            if (_columnar) {
+                return (_column++)->collection_cell(_entry);
+            }
             auto cell_opt = *_i++;
             if (!cell_opt) {
                 return {};
@@ -101,12 +159,19 @@ class result_row_view {
             return {bytes_view(_tmp_value)};
         };
         void skip(const column_definition& def) {
+            if (_columnar) {
+                ++_column;
+                return;
+            }
             ++_i;
         }
     };
 
     iterator_type iterator() const {
-        return iterator_type(_v);
+        if (!_v) {
+            return iterator_type(_columns, _entry);
+        }
+        return iterator_type(*_v);
     }
 };
 
@@ -144,10 +209,23 @@ struct result_visitor {
 class result_view {
     ser::query_result_view _v;
     friend class result_merger;
+    friend class streaming_result_merger;
 public:
     result_view(bytes_view v) : _v(ser::query_result_view{ser::as_input_stream(v)}) {}
     result_view(ser::query_result_view v) : _v(v) {}
 
+    // Calls func with a contiguous view of the buffer of a result.
+    template <typename Func>
+    static auto with_linearized(const query::result& res, Func&& func) {
+        const bytes_ostream& buf = res.buf();
+        if (buf.is_linearized()) {
+            return func(buf.view());
+        } else {
+            bytes_ostream w(buf);
+            return func(w.linearize());
+        }
+    }
+
     template <typename Func>
     static auto do_with(const query::result& res, Func&& func) {
         const bytes_ostream& buf = res.buf();
@@ -165,11 +243,51 @@ class result_view {
 
     template <typename ResultVisitor>
     static void consume(const query::result& res, const partition_slice& slice, ResultVisitor&& visitor) {
+        if (res.is_columnar()) {
+            with_linearized(res, [&] (bytes_view v) {
+                for_each_columnar_page(v, [&] (const columnar_page_view& page) {
+                    consume(page, slice, visitor);
+                });
+            });
+            return;
+        }
         do_with(res, [&] (result_view v) {
             v.consume(slice, visitor);
         });
     }
 
+    // Feeds a page of a columnar result to the visitor, which sees the same
+    // calls as for the row-oriented encoding of its partitions.
+    template <typename ResultVisitor>
+    static void consume(const columnar_page_view& page, const partition_slice& slice, ResultVisitor&& visitor) {
+        std::vector<columnar_column_cursor> static_columns(page.static_columns().begin(), page.static_columns().end());
+        std::vector<columnar_column_cursor> regular_columns(page.regular_columns().begin(), page.regular_columns().end());
+        auto send_partition_key = slice.options.contains<partition_slice::option::send_partition_key>() && page.has_partition_keys();
+        auto send_clustering_key = slice.options.contains<partition_slice::option::send_clustering_key>() && page.has_clustering_keys();
+        for (uint32_t p = 0; p < page.partition_count(); ++p) {
+            auto begin = page.row_start(p);
+            auto end = page.row_start(p + 1);
+            if (send_partition_key) {
+                visitor.accept_new_partition(page.partition_key_at(p), end - begin);
+            } else {
+                visitor.accept_new_partition(end - begin);
+            }
+
+            result_row_view static_row(static_columns, p);
+
+            for (auto r = begin; r != end; ++r) {
+                result_row_view row(regular_columns, r);
+                if (send_clustering_key) {
+                    visitor.accept_new_row(page.clustering_key_at(r), static_row, row);
+                } else {
+                    visitor.accept_new_row(static_row, row);
+                }
+            }
+
+            visitor.accept_partition_end(static_row);
+        }
+    }
+
     template <typename ResultVisitor>
     void consume(const partition_slice& slice, ResultVisitor&& visitor) {
         for (auto&& p : _v.partitions()) {
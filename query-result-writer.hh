@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include "core/future-util.hh"
 #include "types.hh"
 #include "atomic_cell.hh"
 #include "query-request.hh"
@@ -48,10 +49,11 @@ class result::partition_writer {
     ser::query_result__partitions& _pw;
     ser::vector_position _pos;
     bool _static_row_added = false;
-    md5_hasher& _digest;
-    md5_hasher _digest_pos;
+    digester& _digest;
+    digester _digest_pos;
     uint32_t& _row_count;
     api::timestamp_type& _last_modified;
+    stdx::optional<gc_clock::time_point>& _valid_until;
 public:
     partition_writer(
         result_request request,
@@ -60,9 +62,10 @@ class result::partition_writer {
         ser::query_result__partitions& pw,
         ser::vector_position pos,
         ser::after_qr_partition__key w,
-        md5_hasher& digest,
+        digester& digest,
         uint32_t& row_count,
-        api::timestamp_type& last_modified)
+        api::timestamp_type& last_modified,
+        stdx::optional<gc_clock::time_point>& valid_until)
         : _request(request)
         , _w(std::move(w))
         , _slice(slice)
@@ -73,6 +76,7 @@ class result::partition_writer {
         , _digest_pos(digest)
         , _row_count(row_count)
         , _last_modified(last_modified)
+        , _valid_until(valid_until)
     { }
 
     bool requested_digest() const {
@@ -101,7 +105,7 @@ class result::partition_writer {
     const partition_slice& slice() const {
         return _slice;
     }
-    md5_hasher& digest() {
+    digester& digest() {
         return _digest;
     }
     uint32_t& row_count() {
@@ -110,22 +114,35 @@ class result::partition_writer {
     api::timestamp_type& last_modified() {
         return _last_modified;
     }
+    bool tracks_expiry() const {
+        return bool(_valid_until);
+    }
+    // Lowers the point until which the result is valid to given expiry of
+    // some of its data. Requires tracks_expiry().
+    void add_expiry(gc_clock::time_point expiry) {
+        _valid_until = std::min(*_valid_until, expiry);
+    }
 
 };
 
 class result::builder {
     bytes_ostream _out;
-    md5_hasher _digest;
+    digester _digest;
     const partition_slice& _slice;
     ser::query_result__partitions _w;
     result_request _request;
     uint32_t _row_count = 0;
     api::timestamp_type _last_modified = api::missing_timestamp;
+    stdx::optional<gc_clock::time_point> _valid_until;
+    uint64_t _max_size;
+    bool _short_read = false;
 public:
-    builder(const partition_slice& slice, result_request request)
-        : _slice(slice)
+    builder(const partition_slice& slice, result_options opts, uint64_t max_size = max_result_size)
+        : _digest(opts.digest_algo)
+        , _slice(slice)
         , _w(ser::writer_of_query_result(_out).start_partitions())
-        , _request(request)
+        , _request(opts.request)
+        , _max_size(max_size)
     { }
     builder(builder&&) = delete; // _out is captured by reference
 
@@ -145,21 +162,51 @@ class result::builder {
         if (_request != result_request::only_result) {
             key.feed_hash(_digest, s);
         }
-        return partition_writer(_request, _slice, ranges, _w, std::move(pos), std::move(after_key), _digest, _row_count, _last_modified);
+        return partition_writer(_request, _slice, ranges, _w, std::move(pos), std::move(after_key), _digest, _row_count, _last_modified, _valid_until);
+    }
+
+    // Called after each row added to the result. Returns stop_iteration::yes,
+    // and marks the result as a short read, once it has reached the size
+    // limit, so that a result never stops before its first row.
+    stop_iteration check_size_limit() {
+        if (_out.size() >= _max_size) {
+            _short_read = true;
+        }
+        return stop_iteration(_short_read);
+    }
+
+    void mark_as_short_read() {
+        _short_read = true;
+    }
+
+    bool is_short_read() const {
+        return _short_read;
+    }
+
+    // Makes the builder find the earliest expiry of the live data added to
+    // the result, which is how long the same query at a later time returns
+    // the same result. Must be called before adding any partition.
+    void track_expiry() {
+        _valid_until = gc_clock::time_point::max();
+    }
+
+    // Requires track_expiry().
+    gc_clock::time_point valid_until() const {
+        return *_valid_until;
     }
 
     result build() {
         std::move(_w).end_partitions().end_query_result();
         switch (_request) {
         case result_request::only_result:
-            return result(std::move(_out), _row_count);
+            return result(std::move(_out), {}, api::missing_timestamp, _row_count, _short_read);
         case result_request::only_digest: {
             bytes_ostream buf;
             ser::writer_of_query_result(buf).start_partitions().end_partitions().end_query_result();
-            return result(std::move(buf), result_digest(_digest.finalize_array()), _last_modified);
+            return result(std::move(buf), _digest.finalize(), _last_modified, {}, _short_read);
         }
         case result_request::result_and_digest:
-            return result(std::move(_out), result_digest(_digest.finalize_array()), _last_modified, _row_count);
+            return result(std::move(_out), _digest.finalize(), _last_modified, _row_count, _short_read);
         }
         abort();
     }
@@ -26,6 +26,7 @@
 #include "bytes_ostream.hh"
 #include "query-request.hh"
 #include "md5_hasher.hh"
+#include "utils/murmur_hash.hh"
 #include <experimental/optional>
 
 namespace stdx = std::experimental;
@@ -38,6 +39,42 @@ enum class result_request {
     result_and_digest,
 };
 
+// Hash function of result digests. All replicas asked for a digest in a given
+// read have to use the same one, so the coordinator picks it and sends it
+// along with the request. murmur3 is many times cheaper than MD5 and is used
+// once the whole cluster supports it.
+enum class digest_algorithm : uint8_t {
+    none = 0,  // don't compute a digest, only sent with data requests
+    MD5 = 1,
+    murmur3 = 2,
+};
+
+struct result_options {
+    result_request request = result_request::only_result;
+    digest_algorithm digest_algo = digest_algorithm::none;
+
+    result_options() = default;
+    result_options(result_request r)
+        : request(r)
+        , digest_algo(r == result_request::only_result ? digest_algorithm::none : digest_algorithm::MD5)
+    { }
+    result_options(result_request r, digest_algorithm da)
+        : request(da == digest_algorithm::none ? result_request::only_result : r)
+        , digest_algo(request == result_request::only_result ? digest_algorithm::none : da)
+    { }
+
+    static result_options only_result() {
+        return result_options(result_request::only_result);
+    }
+    static result_options only_digest(digest_algorithm da) {
+        return result_options(result_request::only_digest, da);
+    }
+    // Data request, which also computes the digest unless da is none.
+    static result_options data(digest_algorithm da) {
+        return result_options(result_request::result_and_digest, da);
+    }
+};
+
 class result_digest {
 public:
     static_assert(16 == CryptoPP::Weak::MD5::DIGESTSIZE, "MD5 digest size is all wrong");
@@ -56,6 +93,62 @@ class result_digest {
     }
 };
 
+// Computes a result digest with the chosen algorithm. Copyable, so that the
+// digest can be rolled back to a saved state.
+class digester final {
+    digest_algorithm _algo;
+    stdx::optional<md5_hasher> _md5;
+    stdx::optional<utils::murmur_hash::hasher3_x64_128> _murmur3;
+public:
+    explicit digester(digest_algorithm algo)
+        : _algo(algo)
+    {
+        switch (_algo) {
+        case digest_algorithm::MD5:
+            _md5.emplace();
+            break;
+        case digest_algorithm::murmur3:
+            _murmur3.emplace();
+            break;
+        case digest_algorithm::none:
+            break;
+        }
+    }
+
+    void update(const char* ptr, size_t length) {
+        switch (_algo) {
+        case digest_algorithm::MD5:
+            _md5->update(ptr, length);
+            break;
+        case digest_algorithm::murmur3:
+            _murmur3->update(ptr, length);
+            break;
+        case digest_algorithm::none:
+            break;
+        }
+    }
+
+    result_digest finalize() {
+        switch (_algo) {
+        case digest_algorithm::MD5:
+            return result_digest(_md5->finalize_array());
+        case digest_algorithm::murmur3: {
+            std::array<uint64_t, 2> h;
+            _murmur3->finalize(h);
+            result_digest::type digest;
+            for (unsigned i = 0; i < 8; i++) {
+                digest[i] = h[0] >> (8 * i);
+                digest[8 + i] = h[1] >> (8 * i);
+            }
+            return result_digest(std::move(digest));
+        }
+        case digest_algorithm::none:
+            break;
+        }
+        return result_digest(result_digest::type{});
+    }
+};
+
 //
 // The query results are stored in a serialized form. This is in order to
 // address the following problems, which a structured format has:
@@ -91,6 +184,7 @@ class result_digest {
 // Related headers:
 //  - query-result-reader.hh
 //  - query-result-writer.hh
+//  - query-result-columnar.hh
 
 
 class result {
@@ -98,15 +192,25 @@ class result {
     stdx::optional<result_digest> _digest;
     stdx::optional<uint32_t> _row_count;
     api::timestamp_type _last_modified = api::missing_timestamp;
+    bool _short_read = false;
+    // Not serialized, only known on the replica which executed the query.
+    uint32_t _scanned_tombstones = 0;
+    // Not serialized either, columnar results are built by the coordinator
+    // and never leave it.
+    bool _columnar = false;
 
 public:
     class builder;
     class partition_writer;
     friend class result_merger;
+    friend class streaming_result_merger;
 
     result();
+    // Result with no partitions, of a query with the count_rows option.
+    explicit result(uint32_t row_count);
     result(bytes_ostream&& w, stdx::optional<uint32_t> c = {}) : _w(std::move(w)), _row_count(c) {}
-    result(bytes_ostream&& w, stdx::optional<result_digest> d, api::timestamp_type last_modified, stdx::optional<uint32_t> c = {}) : _w(std::move(w)), _digest(d), _row_count(c), _last_modified(last_modified) {}
+    result(bytes_ostream&& w, stdx::optional<result_digest> d, api::timestamp_type last_modified, stdx::optional<uint32_t> c = {}, bool short_read = false)
+        : _w(std::move(w)), _digest(d), _row_count(c), _last_modified(last_modified), _short_read(short_read) {}
     result(result&&) = default;
     result(const result&) = default;
     result& operator=(result&&) = default;
@@ -128,6 +232,32 @@ class result {
         return _last_modified;
     }
 
+    // True if the query ended early because the result reached the
+    // max_result_size of the read_command. Such a result may have fewer
+    // rows than asked for even though there are more, and continues with
+    // the rows following its last one.
+    bool is_short_read() const {
+        return _short_read;
+    }
+
+    uint32_t scanned_tombstones() const {
+        return _scanned_tombstones;
+    }
+
+    void set_scanned_tombstones(uint32_t n) {
+        _scanned_tombstones = n;
+    }
+
+    // True if buf() holds pages in the columnar encoding (see
+    // query-result-columnar.hh) rather than a serialized query_result.
+    bool is_columnar() const {
+        return _columnar;
+    }
+
+    void mark_as_columnar() {
+        _columnar = true;
+    }
+
     uint32_t calculate_row_count(const query::partition_slice&);
 
     struct printer {
@@ -50,6 +50,9 @@ std::ostream& operator<<(std::ostream& out, const partition_slice& ps) {
     out << ", options=" << sprint("%x", ps.options.mask()); // FIXME: pretty print options
     out << ", cql_format=" << ps.cql_format();
     out << ", partition_row_limit=" << ps._partition_row_limit;
+    if (!ps._filters.empty()) {
+        out << ", filters=" << ps._filters.size();
+    }
     return out << "}";
 }
 
@@ -60,7 +63,8 @@ std::ostream& operator<<(std::ostream& out, const read_command& r) {
         << ", slice=" << r.slice << ""
         << ", limit=" << r.row_limit
         << ", timestamp=" << r.timestamp.time_since_epoch().count() << "}"
-        << ", partition_limit=" << r.partition_limit << "}";
+        << ", partition_limit=" << r.partition_limit
+        << ", max_result_size=" << r.max_result_size << "}";
 }
 
 std::ostream& operator<<(std::ostream& out, const specific_ranges& s) {
@@ -73,7 +77,8 @@ partition_slice::partition_slice(clustering_row_ranges row_ranges,
     option_set options,
     std::unique_ptr<specific_ranges> specific_ranges,
     cql_serialization_format cql_format,
-    uint32_t partition_row_limit)
+    uint32_t partition_row_limit,
+    std::vector<column_filter> filters)
     : _row_ranges(std::move(row_ranges))
     , static_columns(std::move(static_columns))
     , regular_columns(std::move(regular_columns))
@@ -81,6 +86,7 @@ partition_slice::partition_slice(clustering_row_ranges row_ranges,
     , _specific_ranges(std::move(specific_ranges))
     , _cql_format(std::move(cql_format))
     , _partition_row_limit(partition_row_limit)
+    , _filters(std::move(filters))
 {}
 
 partition_slice::partition_slice(partition_slice&&) = default;
@@ -95,6 +101,7 @@ partition_slice::partition_slice(const partition_slice& s)
     , _specific_ranges(s._specific_ranges ? std::make_unique<specific_ranges>(*s._specific_ranges) : nullptr)
     , _cql_format(s._cql_format)
     , _partition_row_limit(s._partition_row_limit)
+    , _filters(s._filters)
 {}
 
 partition_slice::~partition_slice()
@@ -170,18 +177,8 @@ uint32_t result::calculate_row_count(const query::partition_slice& slice) {
         }
     } counter;
 
-    bytes_view v;
-
-    if (buf().is_linearized()) {
-        v = buf().view();
-    } else {
-        // FIXME: make result_view::consume() work on fragments to avoid linearization.
-        bytes_ostream w(buf());
-        v = w.linearize();
-    }
-
-    query::result_view view(v);
-    view.consume(slice, counter);
+    // FIXME: make result_view::consume() work on fragments to avoid linearization.
+    query::result_view::consume(*this, slice, counter);
     return counter.total_count;
 }
 
@@ -193,14 +190,40 @@ result::result()
     }())
 { }
 
+result::result(uint32_t row_count)
+    : result()
+{
+    _row_count = row_count;
+}
+
+// Results of both encodings can't be merged, but no query produces them
+// both.
+static void check_same_encoding(stdx::optional<bool>& columnar, const result& r) {
+    if (!columnar) {
+        columnar = r.is_columnar();
+    } else if (*columnar != r.is_columnar()) {
+        throw std::runtime_error("Cannot merge columnar and row-oriented query results");
+    }
+}
+
+static foreign_ptr<lw_shared_ptr<query::result>> make_columnar_result(bytes_ostream&& pages, stdx::optional<uint32_t> row_count, bool short_read) {
+    auto res = make_lw_shared<query::result>(std::move(pages), stdx::nullopt, api::missing_timestamp, row_count, short_read);
+    res->mark_as_columnar();
+    return make_foreign(std::move(res));
+}
+
 foreign_ptr<lw_shared_ptr<query::result>> result_merger::get() {
     if (_partial.size() == 1) {
         return std::move(_partial[0]);
     }
 
     bytes_ostream w;
+    bytes_ostream pages;
+    stdx::optional<bool> columnar;
     auto partitions = ser::writer_of_query_result(w).start_partitions();
     std::experimental::optional<uint32_t> row_count = 0;
+    uint64_t size = 0;
+    bool short_read = false;
 
     for (auto&& r : _partial) {
         if (row_count) {
@@ -210,16 +233,67 @@ foreign_ptr<lw_shared_ptr<query::result>> result_merger::get() {
                 row_count = std::experimental::nullopt;
             }
         }
+        check_same_encoding(columnar, *r);
+        if (*columnar) {
+            pages.append(r->buf());
+        } else {
+            result_view::do_with(*r, [&] (result_view rv) {
+                for (auto&& pv : rv._v.partitions()) {
+                    partitions.add(pv);
+                }
+            });
+        }
+        size += r->buf().size();
+        if (r->is_short_read() || size >= _max_size) {
+            short_read = &r != &_partial.back() || r->is_short_read();
+            break;
+        }
+    }
+
+    if (columnar && *columnar) {
+        return make_columnar_result(std::move(pages), row_count, short_read);
+    }
+
+    std::move(partitions).end_partitions().end_query_result();
+
+    return make_foreign(make_lw_shared<query::result>(std::move(w), stdx::nullopt, api::missing_timestamp, row_count, short_read));
+}
+
+streaming_result_merger::streaming_result_merger(const partition_slice& slice, uint32_t row_limit, uint64_t max_size)
+    : _slice(slice)
+    , _w(ser::writer_of_query_result(_out).start_partitions())
+    , _row_limit(row_limit)
+    , _max_size(max_size)
+{ }
+
+void streaming_result_merger::operator()(foreign_ptr<lw_shared_ptr<query::result>> r) {
+    if (done()) {
+        _dropped = true;
+        return;
+    }
+    _row_count += r->row_count() ? *r->row_count() : r->calculate_row_count(_slice);
+    check_same_encoding(_columnar, *r);
+    if (*_columnar) {
+        _pages.append(r->buf());
+    } else {
         result_view::do_with(*r, [&] (result_view rv) {
             for (auto&& pv : rv._v.partitions()) {
-                partitions.add(pv);
+                _w.add(pv);
             }
         });
     }
+    _size += r->buf().size();
+    _short_read = r->is_short_read();
+    _size_reached = _size >= _max_size;
+}
 
-    std::move(partitions).end_partitions().end_query_result();
-
-    return make_foreign(make_lw_shared<query::result>(std::move(w), row_count));
+foreign_ptr<lw_shared_ptr<query::result>> streaming_result_merger::get(bool more) {
+    auto short_read = _short_read || (_size_reached && (_dropped || more));
+    if (_columnar && *_columnar) {
+        return make_columnar_result(std::move(_pages), _row_count, short_read);
+    }
+    std::move(_w).end_partitions().end_query_result();
+    return make_foreign(make_lw_shared<query::result>(std::move(_out), stdx::nullopt, api::missing_timestamp, _row_count, short_read));
 }
 
 }
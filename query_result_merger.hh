@@ -23,14 +23,26 @@
 
 #include "core/distributed.hh"
 #include "query-result.hh"
+#include "query-request.hh"
+#include "query-result-writer.hh"
 
 namespace query {
 
 // Merges non-overlapping results into one
 // Implements @Reducer concept from distributed.hh
+//
+// Results have to be given in the order of their partitions. The merged
+// result ends after the first short one, since the results following it
+// don't continue where it ended, or once it reaches max_size, in which
+// case it is marked as a short read.
 class result_merger {
     std::vector<foreign_ptr<lw_shared_ptr<query::result>>> _partial;
+    uint64_t _max_size;
 public:
+    explicit result_merger(uint64_t max_size = max_result_size)
+        : _max_size(max_size)
+    { }
+
     void reserve(size_t size) {
         _partial.reserve(size);
     }
@@ -45,4 +57,46 @@ class result_merger {
     foreign_ptr<lw_shared_ptr<query::result>> get();
 };
 
+// Merges non-overlapping results into one as they are given, in the order
+// of their partitions, like result_merger. Each result is copied into the
+// merged one and released straight away, instead of being kept until
+// get(), and the merge is done once a result was short, or max_size or
+// row_limit was reached. Results given after that are dropped. The rows
+// of results which don't know their row count are counted using slice.
+// Columnar results are merged by appending their pages.
+class streaming_result_merger {
+    const partition_slice& _slice;
+    bytes_ostream _out;
+    ser::query_result__partitions _w;
+    // Used instead of _out if the results are columnar, which is known from
+    // the first one. All of them have to have the same encoding.
+    bytes_ostream _pages;
+    stdx::optional<bool> _columnar;
+    uint32_t _row_limit;
+    uint64_t _max_size;
+    uint32_t _row_count = 0;
+    uint64_t _size = 0;
+    bool _short_read = false;
+    bool _size_reached = false;
+    bool _dropped = false;
+public:
+    streaming_result_merger(const partition_slice& slice, uint32_t row_limit, uint64_t max_size = max_result_size);
+    streaming_result_merger(streaming_result_merger&&) = delete; // _out is captured by reference
+
+    void operator()(foreign_ptr<lw_shared_ptr<query::result>> r);
+
+    // No result given from now on would be part of the merged one.
+    bool done() const {
+        return _short_read || _size_reached || _row_count >= _row_limit;
+    }
+
+    uint32_t row_count() const {
+        return _row_count;
+    }
+
+    // Ends the merge. If more is set, there are results which weren't
+    // given, so reaching max_size makes the merged result a short read.
+    foreign_ptr<lw_shared_ptr<query::result>> get(bool more = false);
+};
+
 }
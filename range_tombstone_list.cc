@@ -131,12 +131,13 @@ void range_tombstone_list::insert_from(const schema& s,
                 return;
             }
 
-            // We overlap with the next tombstone.
+            // We overlap with the next tombstone. The current one is completely
+            // overwritten, so drop it rather than keep a fragment of the new
+            // tombstone in its place. Otherwise the list would grow with each
+            // tombstone overlapping many others, and so would the cost of the
+            // next apply.
 
-            rev.update(it, {std::move(start), start_kind, next->start, invert_kind(next->start_kind), tomb});
-            start = next->start;
-            start_kind = next->start_kind;
-            ++it;
+            it = rev.erase(it);
         } else {
             // We don't overwrite the current tombstone.
 
@@ -241,14 +242,56 @@ range_tombstone_list::reverter range_tombstone_list::apply_reversibly(const sche
 
 range_tombstone_list::range_tombstones_type::iterator
 range_tombstone_list::reverter::insert(range_tombstones_type::iterator it, range_tombstone& new_rt) {
-    _insert_undo_ops.emplace_back(new_rt);
+    _undo_ops.emplace_back(insert_undo_op(new_rt));
     return _dst._tombstones.insert_before(it, new_rt);
 }
 
 void range_tombstone_list::reverter::update(range_tombstones_type::iterator it, range_tombstone&& new_rt) {
-    _update_undo_ops.reserve(_update_undo_ops.size() + 1);
+    _undo_ops.reserve(_undo_ops.size() + 1);
     swap(*it, new_rt);
-    _update_undo_ops.emplace_back(std::move(new_rt), *it);
+    _undo_ops.emplace_back(update_undo_op(std::move(new_rt), *it));
+}
+
+range_tombstone_list::range_tombstones_type::iterator
+range_tombstone_list::reverter::erase(range_tombstones_type::iterator it) {
+    _undo_ops.reserve(_undo_ops.size() + 1);
+    auto& rt = *it;
+    it = _dst._tombstones.erase(it);
+    _undo_ops.emplace_back(erase_undo_op(rt));
+    return it;
+}
+
+namespace {
+
+struct undo_visitor : boost::static_visitor<> {
+    const schema& s;
+    range_tombstone_list& rt_list;
+
+    undo_visitor(const schema& s, range_tombstone_list& rt_list) : s(s), rt_list(rt_list) { }
+
+    template<typename Op>
+    void operator()(Op& op) const {
+        op.undo(s, rt_list);
+    }
+};
+
+}
+
+void range_tombstone_list::reverter::revert() noexcept {
+    undo_visitor visitor(_s, _dst);
+    for (auto rit = _undo_ops.rbegin(); rit != _undo_ops.rend(); ++rit) {
+        boost::apply_visitor(visitor, *rit);
+    }
+    _undo_ops.clear();
+}
+
+void range_tombstone_list::reverter::cancel() noexcept {
+    for (auto&& op : _undo_ops) {
+        if (auto erase_op = boost::get<erase_undo_op>(&op)) {
+            erase_op->dispose();
+        }
+    }
+    _undo_ops.clear();
 }
 
 range_tombstone_list::range_tombstones_type::iterator
@@ -260,6 +303,11 @@ void range_tombstone_list::nop_reverter::update(range_tombstones_type::iterator
     *it = std::move(new_rt);
 }
 
+range_tombstone_list::range_tombstones_type::iterator
+range_tombstone_list::nop_reverter::erase(range_tombstones_type::iterator it) {
+    return _dst._tombstones.erase_and_dispose(it, current_deleter<range_tombstone>());
+}
+
 void range_tombstone_list::insert_undo_op::undo(const schema& s, range_tombstone_list& rt_list) noexcept {
     auto it = rt_list.find(s, _new_rt);
     assert (it != rt_list.end());
@@ -271,3 +319,11 @@ void range_tombstone_list::update_undo_op::undo(const schema& s, range_tombstone
     assert (it != rt_list.end());
     *it = std::move(_old_rt);
 }
+
+void range_tombstone_list::erase_undo_op::undo(const schema& s, range_tombstone_list& rt_list) noexcept {
+    rt_list._tombstones.insert(_old_rt);
+}
+
+void range_tombstone_list::erase_undo_op::dispose() noexcept {
+    current_deleter<range_tombstone>()(&_old_rt);
+}
@@ -21,6 +21,8 @@
 
 #pragma once
 
+#include <boost/variant.hpp>
+
 #include "range_tombstone.hh"
 
 class range_tombstone_list final {
@@ -40,10 +42,21 @@ class range_tombstone_list final {
                 : _old_rt(std::move(old_rt)), _new_rt(new_rt) { }
         void undo(const schema& s, range_tombstone_list& rt_list) noexcept;
     };
+    class erase_undo_op {
+        // Unlinked from the list, owned by the reverter until it is reverted or cancelled.
+        range_tombstone& _old_rt;
+    public:
+        erase_undo_op(range_tombstone& old_rt)
+                : _old_rt(old_rt) { }
+        void undo(const schema& s, range_tombstone_list& rt_list) noexcept;
+        void dispose() noexcept;
+    };
+    using undo_op = boost::variant<insert_undo_op, update_undo_op, erase_undo_op>;
     class reverter {
     private:
-        std::vector<insert_undo_op> _insert_undo_ops;
-        std::vector<update_undo_op> _update_undo_ops;
+        // Undone in reverse order, so that each operation is undone on the
+        // state it left the list in.
+        std::vector<undo_op> _undo_ops;
         const schema& _s;
     protected:
         range_tombstone_list& _dst;
@@ -60,21 +73,10 @@ class range_tombstone_list final {
         reverter& operator=(reverter&) = delete;
         virtual range_tombstones_type::iterator insert(range_tombstones_type::iterator it, range_tombstone& new_rt);
         virtual void update(range_tombstones_type::iterator it, range_tombstone&& new_rt);
-        void revert() noexcept {
-            for (auto&& op : _insert_undo_ops) {
-                op.undo(_s, _dst);
-            }
-            auto rit = _update_undo_ops.rbegin();
-            while (rit != _update_undo_ops.rend()) {
-                rit->undo(_s, _dst);
-                ++rit;
-            }
-            cancel();
-        }
-        void cancel() noexcept {
-            _insert_undo_ops.clear();
-            _update_undo_ops.clear();
-        }
+        // Removes a tombstone which is completely covered by a newer one.
+        virtual range_tombstones_type::iterator erase(range_tombstones_type::iterator it);
+        void revert() noexcept;
+        void cancel() noexcept;
     };
     class nop_reverter : public reverter {
     public:
@@ -82,6 +84,7 @@ class range_tombstone_list final {
                 : reverter(s, rt_list) { }
         virtual range_tombstones_type::iterator insert(range_tombstones_type::iterator it, range_tombstone& new_rt) override;
         virtual void update(range_tombstones_type::iterator it, range_tombstone&& new_rt) override;
+        virtual range_tombstones_type::iterator erase(range_tombstones_type::iterator it) override;
     };
 private:
     range_tombstones_type _tombstones;
@@ -31,9 +31,11 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 
 #include <cryptopp/sha.h>
 #include <seastar/core/gate.hh>
+#include "utils/murmur_hash.hh"
 
 static logging::logger logger("repair");
 
@@ -241,11 +243,18 @@ static class {
     }
 } repair_tracker;
 
+// Set on all shards when repair is being shut down, so that the shards
+// working on ranges of a repair for cpu 0 stop too.
+static thread_local bool repair_stopping = false;
+
 static void check_in_shutdown() {
-    // Only call this from the single CPU managing the repair - the only CPU
-    // which is allowed to use repair_tracker.
-    assert(engine().cpu_id() == 0);
-    repair_tracker.check_in_shutdown();
+    // Only the single CPU managing the repair is allowed to use
+    // repair_tracker, the others just check whether shutdown was requested.
+    if (engine().cpu_id() == 0) {
+        repair_tracker.check_in_shutdown();
+    } else if (repair_stopping) {
+        throw repair_stopped_exception();
+    }
 }
 
 class sha256_hasher {
@@ -275,13 +284,35 @@ future<partition_checksum> partition_checksum::compute_legacy(streamed_mutation
     });
 }
 
+// 128-bit MurmurHash3, many times cheaper than SHA-256. Replicas aren't
+// adversaries, so a non-cryptographic hash is good enough to tell whether
+// they differ. The upper half of the digest is left zero.
+class murmur3_hasher {
+    utils::murmur_hash::hasher3_x64_128 hash;
+public:
+    void update(const char* ptr, size_t length) {
+        hash.update(ptr, length);
+    }
+
+    void finalize(std::array<uint8_t, 32>& digest) {
+        std::array<uint64_t, 2> result;
+        hash.finalize(result);
+        digest.fill(0);
+        for (unsigned i = 0; i < 8; i++) {
+            digest[i] = result[0] >> (8 * i);
+            digest[8 + i] = result[1] >> (8 * i);
+        }
+    }
+};
+
+template <typename Hasher>
 future<partition_checksum> partition_checksum::compute_streamed(streamed_mutation m)
 {
     auto& s = *m.schema();
-    auto h = make_lw_shared<sha256_hasher>();
+    auto h = make_lw_shared<Hasher>();
     m.key().feed_hash(*h, s);
     return do_with(std::move(m), [&s, h] (auto& sm) mutable {
-        mutation_hasher<sha256_hasher> mh(s, *h);
+        mutation_hasher<Hasher> mh(s, *h);
         return consume(sm, std::move(mh)).then([ h ] {
             std::array<uint8_t, 32> digest;
             h->finalize(digest);
@@ -294,7 +325,8 @@ future<partition_checksum> partition_checksum::compute(streamed_mutation m, repa
 {
     switch (hash_version) {
     case repair_checksum::legacy: return compute_legacy(std::move(m));
-    case repair_checksum::streamed: return compute_streamed(std::move(m));
+    case repair_checksum::streamed: return compute_streamed<sha256_hasher>(std::move(m));
+    case repair_checksum::murmur3: return compute_streamed<murmur3_hasher>(std::move(m));
     default: throw std::runtime_error(sprint("Unknown hash version: %d", static_cast<int>(hash_version)));
     }
 }
@@ -337,6 +369,18 @@ std::ostream& operator<<(std::ostream& out, const partition_checksum& c) {
     return out;
 }
 
+// Reads the data of a column family checksummed by repair: all of it for a
+// full repair, and only what isn't repaired yet for incremental repair
+// session repaired_at, which then starts on this shard if it didn't already.
+static mutation_reader make_repair_reader(column_family& cf, const query::partition_range& range, uint64_t repaired_at) {
+    if (!repaired_at) {
+        return cf.make_reader(cf.schema(), range, query::no_clustering_key_filtering,
+                service::get_local_repair_read_priority());
+    }
+    cf.start_repair_session(repaired_at);
+    return cf.make_unrepaired_reader(cf.schema(), range, service::get_local_repair_read_priority());
+}
+
 // Calculate the checksum of the data held *on this shard* of a column family,
 // in the given token range.
 // All parameters to this function are constant references, and the caller
@@ -353,13 +397,10 @@ std::ostream& operator<<(std::ostream& out, const partition_checksum& c) {
 // data is coming in).
 static future<partition_checksum> checksum_range_shard(database &db,
         const sstring& keyspace_name, const sstring& cf_name,
-        const ::range<dht::token>& range, repair_checksum hash_version) {
+        const ::range<dht::token>& range, repair_checksum hash_version, uint64_t repaired_at) {
     auto& cf = db.find_column_family(keyspace_name, cf_name);
-    return do_with(dht::to_partition_range(range), [&cf, hash_version] (const auto& partition_range) {
-        auto reader = cf.make_reader(cf.schema(),
-                                     partition_range,
-                                     query::no_clustering_key_filtering,
-                                     service::get_local_streaming_read_priority());
+    return do_with(dht::to_partition_range(range), [&cf, hash_version, repaired_at] (const auto& partition_range) {
+        auto reader = make_repair_reader(cf, partition_range, repaired_at);
         return do_with(std::move(reader), partition_checksum(),
             [hash_version] (auto& reader, auto& checksum) {
             return repeat([&reader, &checksum, hash_version] () {
@@ -393,17 +434,17 @@ static future<partition_checksum> checksum_range_shard(database &db,
 // function is not resolved.
 future<partition_checksum> checksum_range(seastar::sharded<database> &db,
         const sstring& keyspace, const sstring& cf,
-        const ::range<dht::token>& range, repair_checksum hash_version) {
+        const ::range<dht::token>& range, repair_checksum hash_version, uint64_t repaired_at) {
     unsigned shard_begin = range.start() ?
             dht::shard_of(range.start()->value()) : 0;
     unsigned shard_end = range.end() ?
             dht::shard_of(range.end()->value())+1 : smp::count;
-    return do_with(partition_checksum(), [shard_begin, shard_end, &db, &keyspace, &cf, &range, hash_version] (auto& result) {
+    return do_with(partition_checksum(), [shard_begin, shard_end, &db, &keyspace, &cf, &range, hash_version, repaired_at] (auto& result) {
         return parallel_for_each(boost::counting_iterator<int>(shard_begin),
                 boost::counting_iterator<int>(shard_end),
-                [&db, &keyspace, &cf, &range, &result, hash_version] (unsigned shard) {
-            return db.invoke_on(shard, [&keyspace, &cf, &range, hash_version] (database& db) {
-                return checksum_range_shard(db, keyspace, cf, range, hash_version);
+                [&db, &keyspace, &cf, &range, &result, hash_version, repaired_at] (unsigned shard) {
+            return db.invoke_on(shard, [&keyspace, &cf, &range, hash_version, repaired_at] (database& db) {
+                return checksum_range_shard(db, keyspace, cf, range, hash_version, repaired_at);
             }).then([&result] (partition_checksum sum) {
                 result.add(sum);
             });
@@ -413,17 +454,85 @@ future<partition_checksum> checksum_range(seastar::sharded<database> &db,
     });
 }
 
+// Like checksum_range_shard(), but calculates a separate checksum for each of
+// the given sorted, disjoint, non-wrapping token ranges in a single pass
+// over the data. Partitions falling between the ranges are skipped.
+static future<std::vector<partition_checksum>> checksum_ranges_shard(database &db,
+        const sstring& keyspace_name, const sstring& cf_name,
+        const std::vector<::range<dht::token>>& ranges, repair_checksum hash_version, uint64_t repaired_at) {
+    auto& cf = db.find_column_family(keyspace_name, cf_name);
+    auto span = ::range<dht::token>(ranges.front().start(), ranges.back().end());
+    return do_with(dht::to_partition_range(std::move(span)), [&cf, &ranges, hash_version, repaired_at] (const auto& partition_range) {
+        auto reader = make_repair_reader(cf, partition_range, repaired_at);
+        return do_with(std::move(reader), std::vector<partition_checksum>(ranges.size()), size_t(0),
+            [&ranges, hash_version] (auto& reader, auto& checksums, size_t& idx) {
+            return repeat([&reader, &ranges, &checksums, &idx, hash_version] () {
+                return reader().then([&ranges, &checksums, &idx, hash_version] (auto mopt) {
+                    if (!mopt) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    const auto& token = mopt->decorated_key().token();
+                    while (idx < ranges.size() && ranges[idx].after(token, dht::token_comparator())) {
+                        ++idx;
+                    }
+                    if (idx == ranges.size()) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    if (ranges[idx].before(token, dht::token_comparator())) {
+                        return make_ready_future<stop_iteration>(stop_iteration::no);
+                    }
+                    auto& checksum = checksums[idx];
+                    return partition_checksum::compute(std::move(*mopt), hash_version).then([&checksum] (auto pc) {
+                        checksum.add(pc);
+                        return stop_iteration::no;
+                    });
+                });
+            }).then([&checksums] {
+                return std::move(checksums);
+            });
+        });
+    });
+}
+
+future<std::vector<partition_checksum>> checksum_ranges(seastar::sharded<database> &db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<::range<dht::token>>& ranges, repair_checksum hash_version, uint64_t repaired_at) {
+    if (ranges.empty()) {
+        return make_ready_future<std::vector<partition_checksum>>();
+    }
+    unsigned shard_begin = ranges.front().start() ?
+            dht::shard_of(ranges.front().start()->value()) : 0;
+    unsigned shard_end = ranges.back().end() ?
+            dht::shard_of(ranges.back().end()->value())+1 : smp::count;
+    return do_with(std::vector<partition_checksum>(ranges.size()), [shard_begin, shard_end, &db, &keyspace, &cf, &ranges, hash_version, repaired_at] (auto& result) {
+        return parallel_for_each(boost::counting_iterator<int>(shard_begin),
+                boost::counting_iterator<int>(shard_end),
+                [&db, &keyspace, &cf, &ranges, &result, hash_version, repaired_at] (unsigned shard) {
+            return db.invoke_on(shard, [&keyspace, &cf, &ranges, hash_version, repaired_at] (database& db) {
+                return checksum_ranges_shard(db, keyspace, cf, ranges, hash_version, repaired_at);
+            }).then([&result] (std::vector<partition_checksum> sums) {
+                for (unsigned i = 0; i < sums.size(); i++) {
+                    result[i].add(sums[i]);
+                }
+            });
+        }).then([&result] {
+            return std::move(result);
+        });
+    });
+}
+
 static future<> sync_range(seastar::sharded<database>& db,
         const sstring& keyspace, const sstring& cf,
-        const ::range<dht::token>& range,
+        std::vector<::range<dht::token>> ranges,
         std::vector<gms::inet_address>& neighbors) {
     return do_with(streaming::stream_plan("repair-in"),
                    streaming::stream_plan("repair-out"),
-            [&db, &keyspace, &cf, &range, &neighbors]
-            (auto& sp_in, auto& sp_out) {
+                   std::move(ranges),
+            [&db, &keyspace, &cf, &neighbors]
+            (auto& sp_in, auto& sp_out, const auto& ranges) {
         for (const auto& peer : neighbors) {
-            sp_in.request_ranges(peer, keyspace, {range}, {cf});
-            sp_out.transfer_ranges(peer, keyspace, {range}, {cf});
+            sp_in.request_ranges(peer, keyspace, ranges, {cf});
+            sp_out.transfer_ranges(peer, keyspace, ranges, {cf});
         }
         return sp_in.execute().discard_result().then([&sp_out] {
                 return sp_out.execute().discard_result();
@@ -451,6 +560,109 @@ static void split_and_add(std::vector<::range<dht::token>>& ranges,
     ranges.push_back(halves.first);
     ranges.push_back(halves.second);
 }
+
+// When a range differs between replicas, and all nodes support it, rather
+// than streaming the whole range we split it into repair_tree_fanout
+// sub-ranges, compare their checksums, and descend into the sub-ranges which
+// still differ until they are estimated to hold no more than
+// repair_leaf_partitions partitions. Only those leaves are then streamed.
+static constexpr unsigned repair_tree_fanout = 16;
+static constexpr uint64_t repair_leaf_partitions = 16;
+
+// Splits a non-wrapping range into up to "parts" (rounded down to a power of
+// two) sub-ranges of about the same token span. Ranges whose midpoint falls on
+// one of their bounds are not split any further.
+static std::vector<::range<dht::token>> split_range(const ::range<dht::token>& range, unsigned parts) {
+    std::vector<::range<dht::token>> ranges{range};
+    while (ranges.size() * 2 <= parts) {
+        std::vector<::range<dht::token>> halves;
+        halves.reserve(ranges.size() * 2);
+        for (auto&& r : ranges) {
+            auto midpoint = dht::global_partitioner().midpoint(
+                    r.start() ? r.start()->value() : dht::minimum_token(),
+                    r.end() ? r.end()->value() : dht::minimum_token());
+            if (!r.contains(midpoint, dht::token_comparator())
+                    || (r.start() && r.start()->value() == midpoint)
+                    || (r.end() && r.end()->value() == midpoint)) {
+                halves.push_back(r);
+                continue;
+            }
+            auto h = r.split(midpoint, dht::token_comparator());
+            halves.push_back(std::move(h.first));
+            halves.push_back(std::move(h.second));
+        }
+        if (halves.size() == ranges.size()) {
+            break;
+        }
+        ranges = std::move(halves);
+    }
+    return ranges;
+}
+
+// Returns the sub-ranges of "range", which is known to differ between this
+// node and some of the neighbors, which still differ. If a checksum cannot
+// be obtained from some node, the whole range is returned.
+static future<std::vector<::range<dht::token>>> find_differing_ranges(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf, ::range<dht::token> range,
+        const std::vector<gms::inet_address>& neighbors, uint64_t estimated_partitions,
+        repair_checksum hash_version, uint64_t repaired_at) {
+    using ranges_type = std::vector<::range<dht::token>>;
+    if (estimated_partitions <= repair_leaf_partitions) {
+        return make_ready_future<ranges_type>(ranges_type{std::move(range)});
+    }
+    auto subranges = split_range(range, repair_tree_fanout);
+    if (subranges.size() == 1) {
+        return make_ready_future<ranges_type>(std::move(subranges));
+    }
+    estimated_partitions /= subranges.size();
+    return do_with(std::move(subranges), ranges_type(), [&db, &keyspace, &cf, &neighbors, range = std::move(range), estimated_partitions, hash_version, repaired_at]
+            (const auto& subranges, auto& differing) {
+        std::vector<future<std::vector<partition_checksum>>> checksums;
+        checksums.reserve(1 + neighbors.size());
+        checksums.push_back(checksum_ranges(db, keyspace, cf, subranges, hash_version, repaired_at));
+        for (auto&& neighbor : neighbors) {
+            checksums.push_back(net::get_local_messaging_service().send_repair_checksum_ranges(
+                    net::msg_addr{neighbor}, keyspace, cf, subranges, hash_version, repaired_at));
+        }
+        return when_all(checksums.begin(), checksums.end()).then([&db, &keyspace, &cf, &neighbors, &subranges, &differing, range, estimated_partitions, hash_version, repaired_at]
+                (std::vector<future<std::vector<partition_checksum>>> checksums) {
+            std::vector<std::vector<partition_checksum>> results;
+            bool failed = false;
+            for (auto&& f : checksums) {
+                if (f.failed()) {
+                    logger.warn("Checksum of sub-ranges of {} failed: {}", range, f.get_exception());
+                    failed = true;
+                } else {
+                    results.push_back(f.get0());
+                    failed |= results.back().size() != subranges.size();
+                }
+            }
+            if (failed) {
+                return make_ready_future<ranges_type>(ranges_type{range});
+            }
+            ranges_type to_check;
+            for (unsigned i = 0; i < subranges.size(); i++) {
+                for (unsigned n = 1; n < results.size(); n++) {
+                    if (results[n][i] != results[0][i]) {
+                        to_check.push_back(subranges[i]);
+                        break;
+                    }
+                }
+            }
+            // to_check may be empty if the difference was fixed meanwhile,
+            // e.g. by writes which arrived after the first checksum.
+            return do_with(std::move(to_check), [&db, &keyspace, &cf, &neighbors, &differing, estimated_partitions, hash_version, repaired_at] (const auto& to_check) {
+                return do_for_each(to_check, [&db, &keyspace, &cf, &neighbors, &differing, estimated_partitions, hash_version, repaired_at] (const auto& r) {
+                    return find_differing_ranges(db, keyspace, cf, r, neighbors, estimated_partitions, hash_version, repaired_at).then([&differing] (ranges_type leaves) {
+                        std::move(leaves.begin(), leaves.end(), std::back_inserter(differing));
+                    });
+                }).then([&differing] {
+                    return std::move(differing);
+                });
+            });
+        });
+    });
+}
 // We don't need to wait for one checksum to finish before we start the
 // next, but doing too many of these operations in parallel also doesn't
 // make sense, so we limit the number of concurrent ongoing checksum
@@ -460,18 +672,38 @@ static void split_and_add(std::vector<::range<dht::token>>& ranges,
 // some resource. Otherwise we'll be doing too little in some machines,
 // and too much in others.
 //
-// FIXME: This would be better of in a repair service, or even a per-shard
-// repair instance holding all repair state. However, since we are anyway
-// considering ditching those semaphores for a more fine grained resource-based
-// solution, let's do the simplest thing here and change it later
+// Ranges are repaired on the shard owning them, so the limits are per
+// shard. The number of checksum requests is split between the shards, to
+// not load the neighbors more than when a single shard drove the repair.
 constexpr int parallelism = 100;
-static thread_local semaphore parallelism_semaphore(parallelism);
+
+// Per-shard limits of a repair, see repair_ranges().
+struct repair_shard_limits {
+    // Ranges repaired concurrently.
+    semaphore ranges;
+    // Checksum requests in flight.
+    semaphore checksums;
+    // Stream plans syncing differing ranges. Holding a checksums unit while
+    // waiting for one stops checksumming when streaming falls behind.
+    semaphore syncs;
+
+    explicit repair_shard_limits(const db::config& cfg)
+        : ranges(std::max(cfg.repair_ranges_per_shard(), 1u))
+        , checksums(std::max(parallelism / int(smp::count), 1))
+        , syncs(std::max(cfg.repair_syncs_per_shard(), 1u))
+    { }
+};
+
+static repair_shard_limits& get_repair_shard_limits(const db::config& cfg) {
+    static thread_local repair_shard_limits limits(cfg);
+    return limits;
+}
 
 // Repair a single cf in a single local range.
 // Comparable to RepairJob in Origin.
 static future<> repair_cf_range(seastar::sharded<database>& db,
         sstring keyspace, sstring cf, ::range<dht::token> range,
-        std::vector<gms::inet_address>& neighbors) {
+        std::vector<gms::inet_address>& neighbors, uint64_t repaired_at) {
     if (neighbors.empty()) {
         // Nothing to do in this case...
         return make_ready_future<>();
@@ -511,32 +743,36 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
         // FIXME: this "100" needs to be a parameter.
         split_and_add(ranges, range, estimated_partitions, 100);
     }
+    auto range_partitions = estimated_partitions < 100 ? estimated_partitions : estimated_partitions / 2;
 
     return do_with(seastar::gate(), true, std::move(keyspace), std::move(cf), std::move(ranges),
-        [&db, &neighbors] (auto& completion, auto& success, const auto& keyspace, const auto& cf, const auto& ranges) {
-        return do_for_each(ranges, [&completion, &success, &db, &neighbors, &keyspace, &cf]
+        [&db, &neighbors, range_partitions, repaired_at] (auto& completion, auto& success, const auto& keyspace, const auto& cf, const auto& ranges) {
+        return do_for_each(ranges, [&completion, &success, &db, &neighbors, &keyspace, &cf, range_partitions, repaired_at]
                            (const auto& range) {
 
             check_in_shutdown();
-            return parallelism_semaphore.wait(1).then([&completion, &success, &db, &neighbors, &keyspace, &cf, &range] {
-                auto checksum_type = service::get_local_storage_service().cluster_supports_large_partitions()
-                                     ? repair_checksum::streamed : repair_checksum::legacy;
+            auto& limits = get_repair_shard_limits(db.local().get_config());
+            return limits.checksums.wait(1).then([&completion, &success, &db, &neighbors, &keyspace, &cf, &range, range_partitions, &limits, repaired_at] {
+                auto& ss = service::get_local_storage_service();
+                auto checksum_type = ss.cluster_supports_murmur3_repair_checksum() ? repair_checksum::murmur3
+                                     : ss.cluster_supports_large_partitions() ? repair_checksum::streamed
+                                     : repair_checksum::legacy;
 
                 // Ask this node, and all neighbors, to calculate checksums in
                 // this range. When all are done, compare the results, and if
                 // there are any differences, sync the content of this range.
                 std::vector<future<partition_checksum>> checksums;
                 checksums.reserve(1 + neighbors.size());
-                checksums.push_back(checksum_range(db, keyspace, cf, range, checksum_type));
+                checksums.push_back(checksum_range(db, keyspace, cf, range, checksum_type, repaired_at));
                 for (auto&& neighbor : neighbors) {
                     checksums.push_back(
                             net::get_local_messaging_service().send_repair_checksum_range(
-                                    net::msg_addr{neighbor},keyspace, cf, range, checksum_type));
+                                    net::msg_addr{neighbor},keyspace, cf, range, checksum_type, repaired_at));
                 }
 
                 completion.enter();
                 when_all(checksums.begin(), checksums.end()).then(
-                        [&db, &keyspace, &cf, &range, &neighbors, &success]
+                        [&db, &keyspace, &cf, &range, &neighbors, &success, range_partitions, checksum_type, &limits, repaired_at]
                         (std::vector<future<partition_checksum>> checksums) {
                     // If only some of the replicas of this range are alive,
                     // we set success=false so repair will fail, but we can
@@ -566,8 +802,20 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
                     for (unsigned i = 1; i < checksums.size(); i++) {
                         if (checksums[i].available() && checksum0 != checksums[i].get()) {
                             logger.info("Found differing range {} on nodes {}", range, live_neighbors);
-                            return do_with(std::move(live_neighbors), [&db, &keyspace, &cf, &range] (auto& live_neighbors) {
-                                return sync_range(db, keyspace, cf, range, live_neighbors);
+                            return do_with(std::move(live_neighbors), [&db, &keyspace, &cf, &range, range_partitions, checksum_type, &limits, repaired_at] (auto& live_neighbors) {
+                                auto differing = make_ready_future<std::vector<::range<dht::token>>>(std::vector<::range<dht::token>>{range});
+                                if (service::get_local_storage_service().cluster_supports_repair_checksum_ranges()) {
+                                    differing = find_differing_ranges(db, keyspace, cf, range, live_neighbors, range_partitions, checksum_type, repaired_at);
+                                }
+                                return differing.then([&db, &keyspace, &cf, &range, &live_neighbors, &limits] (std::vector<::range<dht::token>> differing) {
+                                    logger.info("Found {} differing sub-ranges of range {}", differing.size(), range);
+                                    if (differing.empty()) {
+                                        return make_ready_future<>();
+                                    }
+                                    return with_semaphore(limits.syncs, 1, [&db, &keyspace, &cf, &live_neighbors, differing = std::move(differing)] () mutable {
+                                        return sync_range(db, keyspace, cf, std::move(differing), live_neighbors);
+                                    });
+                                });
                             });
                         }
                     }
@@ -580,8 +828,8 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
                     // tell the caller.
                     success = false;
                     logger.warn("Failed sync of range {}: {}", range, eptr);
-                }).finally([&completion] {
-                    parallelism_semaphore.signal(1);
+                }).finally([&completion, &limits] {
+                    limits.checksums.signal(1);
                     completion.leave(); // notify do_for_each that we're done
                 });
             });
@@ -599,13 +847,13 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
 static future<> repair_range(seastar::sharded<database>& db, sstring keyspace,
         ::range<dht::token> range, std::vector<sstring>& cfs,
         const std::vector<sstring>& data_centers,
-        const std::vector<sstring>& hosts) {
+        const std::vector<sstring>& hosts, uint64_t repaired_at) {
     auto id = utils::UUID_gen::get_time_UUID();
-    return do_with(get_neighbors(db.local(), keyspace, range, data_centers, hosts), [&db, &cfs, keyspace, id, range] (auto& neighbors) {
+    return do_with(get_neighbors(db.local(), keyspace, range, data_centers, hosts), [&db, &cfs, keyspace, id, range, repaired_at] (auto& neighbors) {
         logger.info("[repair #{}] new session: will sync {} on range {} for {}.{}", id, neighbors, range, keyspace, cfs);
         return do_for_each(cfs.begin(), cfs.end(),
-                [&db, keyspace, &neighbors, id, range] (auto&& cf) {
-            return repair_cf_range(db, keyspace, cf, range, neighbors);
+                [&db, keyspace, &neighbors, id, range, repaired_at] (auto&& cf) {
+            return repair_cf_range(db, keyspace, cf, range, neighbors, repaired_at);
         });
     });
 }
@@ -633,6 +881,77 @@ static std::vector<query::range<dht::token>> get_primary_ranges(
             utils::fb_utilities::get_broadcast_address());
 }
 
+future<> mark_repaired(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<::range<dht::token>>& ranges, uint64_t repaired_at) {
+    return db.invoke_on_all([&keyspace, &cf, &ranges, repaired_at] (database& db) {
+        auto& table = db.find_column_family(keyspace, cf);
+        auto s = table.schema();
+        auto local_ranges = get_local_ranges(db, keyspace);
+        std::vector<sstables::shared_sstable> repaired;
+        for (auto&& sst : table.finish_repair_session(repaired_at)) {
+            // An sstable may hold data of ranges which weren't repaired. It
+            // can be marked only if none of them is still owned by this node,
+            // since we don't split sstables at the repaired ranges' bounds.
+            std::vector<::range<dht::token>> left{::range<dht::token>(
+                    ::range<dht::token>::bound(sst->get_first_decorated_key(*s).token(), true),
+                    ::range<dht::token>::bound(sst->get_last_decorated_key(*s).token(), true))};
+            for (auto&& r : ranges) {
+                std::vector<::range<dht::token>> next;
+                for (auto&& l : left) {
+                    auto rs = l.subtract(r, dht::token_comparator());
+                    next.insert(next.end(), rs.begin(), rs.end());
+                }
+                left = std::move(next);
+            }
+            auto owned = boost::algorithm::any_of(left, [&local_ranges] (const ::range<dht::token>& l) {
+                return boost::algorithm::any_of(local_ranges, [&l] (const ::range<dht::token>& lr) {
+                    return l.overlaps(lr, dht::token_comparator());
+                });
+            });
+            if (!owned) {
+                repaired.push_back(sst);
+            }
+        }
+        logger.debug("Marking {} sstables of {}.{} as repaired at {}", repaired.size(), keyspace, cf, repaired_at);
+        return do_with(std::move(repaired), [repaired_at] (auto& repaired) {
+            return parallel_for_each(repaired, [repaired_at] (const sstables::shared_sstable& sst) {
+                return sst->mutate_repaired_at(repaired_at);
+            });
+        });
+    });
+}
+
+// Last phase of a successful incremental repair: tell this node and every
+// neighbor which took part in it to mark the sstables read by the session as
+// repaired. Failing to mark some of them only makes the next incremental
+// repair compare their data again, so failures are logged and ignored.
+static future<> mark_ranges_repaired(seastar::sharded<database>& db, const sstring& keyspace,
+        const std::vector<query::range<dht::token>>& ranges, const std::vector<sstring>& cfs,
+        const std::vector<sstring>& data_centers, const std::vector<sstring>& hosts,
+        uint64_t repaired_at) {
+    std::unordered_map<gms::inet_address, std::vector<::range<dht::token>>> participants;
+    for (auto&& range : ranges) {
+        for (auto&& neighbor : get_neighbors(db.local(), keyspace, range, data_centers, hosts)) {
+            participants[neighbor].push_back(range);
+        }
+    }
+    return do_with(std::move(participants), [&db, &keyspace, &ranges, &cfs, repaired_at] (auto& participants) {
+        return parallel_for_each(cfs, [&db, &keyspace, &ranges, &participants, repaired_at] (const sstring& cf) {
+            auto local = mark_repaired(db, keyspace, cf, ranges, repaired_at).handle_exception([&keyspace, &cf] (std::exception_ptr ep) {
+                logger.warn("Failed to mark sstables of {}.{} as repaired: {}", keyspace, cf, ep);
+            });
+            auto remote = parallel_for_each(participants, [&keyspace, &cf, repaired_at] (auto& p) {
+                return net::get_local_messaging_service().send_repair_mark_repaired(net::msg_addr{p.first},
+                        keyspace, cf, p.second, repaired_at).handle_exception([&keyspace, &cf, ep = p.first] (std::exception_ptr e) {
+                    logger.warn("Failed to mark sstables of {}.{} on {} as repaired: {}", keyspace, cf, ep, e);
+                });
+            });
+            return when_all(std::move(local), std::move(remote)).discard_result();
+        });
+    });
+}
+
 
 struct repair_options {
     // If primary_range is true, we should perform repair only on this node's
@@ -662,6 +981,10 @@ struct repair_options {
     // The node starting the repair must be in the data center; Issuing a
     // repair to a data center other than the named one returns an error.
     std::vector<sstring> data_centers;
+    // If incremental is true, only the data which isn't repaired yet is
+    // compared, and the sstables holding it are marked as repaired once
+    // all of the ranges were repaired successfully.
+    bool incremental = false;
 
     repair_options(std::unordered_map<sstring, sstring> options) {
         bool_opt(primary_range, options, PRIMARY_RANGE_KEY);
@@ -669,14 +992,7 @@ struct repair_options {
         list_opt(column_families, options, COLUMNFAMILIES_KEY);
         list_opt(hosts, options, HOSTS_KEY);
         list_opt(data_centers, options, DATACENTERS_KEY);
-        // We currently do not support incremental repair. We could probably
-        // ignore this option as it is just an optimization, but for now,
-        // let's make it an error.
-        bool incremental = false;
         bool_opt(incremental, options, INCREMENTAL_KEY);
-        if (incremental) {
-            throw std::runtime_error("unsupported incremental repair");
-        }
         // We do not currently support the distinction between "parallel" and
         // "sequential" repair, and operate the same for both.
         // We don't currently support "dc parallel" parallelism.
@@ -799,22 +1115,34 @@ struct repair_options {
 // range for which this node holds a replica, and, importantly, each range
 // is assumed to be a indivisible in the sense that all the tokens in has the
 // same nodes as replicas.
+//
+// Each range is repaired on the shard owning its start, which is also where
+// most of its data is checksummed. A shard repairs at most
+// repair_ranges_per_shard ranges at a time, so all shards work in parallel
+// while the coordinating cpu 0 only dispatches ranges and collects results.
 static future<> repair_ranges(seastar::sharded<database>& db, sstring keyspace,
         std::vector<query::range<dht::token>> ranges,
         std::vector<sstring> cfs, int id,
-        std::vector<sstring> data_centers, std::vector<sstring> hosts) {
+        std::vector<sstring> data_centers, std::vector<sstring> hosts,
+        uint64_t repaired_at) {
     return do_with(std::move(ranges), std::move(keyspace), std::move(cfs),
             std::move(data_centers), std::move(hosts),
-            [&db, id] (auto& ranges, auto& keyspace, auto& cfs, auto& data_centers, auto& hosts) {
-#if 1
-        // repair all the ranges in parallel
-        return parallel_for_each(ranges.begin(), ranges.end(), [&db, keyspace, &cfs, &data_centers, &hosts, id] (auto&& range) {
-#else
-        // repair all the ranges in sequence
-        return do_for_each(ranges.begin(), ranges.end(), [&db, keyspace, &cfs, &data_centers, &hosts, id] (auto&& range) {
-#endif
+            [&db, id, repaired_at] (auto& ranges, auto& keyspace, auto& cfs, auto& data_centers, auto& hosts) {
+        return parallel_for_each(ranges.begin(), ranges.end(), [&db, keyspace, &cfs, &data_centers, &hosts, repaired_at] (auto&& range) {
             check_in_shutdown();
-            return repair_range(db, keyspace, range, cfs, data_centers, hosts);
+            auto shard = range.start() ? dht::shard_of(range.start()->value()) : 0;
+            return db.invoke_on(shard, [&db, keyspace, range, cfs, data_centers, hosts, repaired_at] (database& localdb) mutable {
+                auto& limits = get_repair_shard_limits(localdb.get_config());
+                return with_semaphore(limits.ranges, 1, [&db, &keyspace, &range, &cfs, &data_centers, &hosts, repaired_at] {
+                    check_in_shutdown();
+                    return repair_range(db, keyspace, range, cfs, data_centers, hosts, repaired_at);
+                });
+            });
+        }).then([&db, &ranges, &keyspace, &cfs, &data_centers, &hosts, repaired_at] {
+            if (!repaired_at) {
+                return make_ready_future<>();
+            }
+            return mark_ranges_repaired(db, keyspace, ranges, cfs, data_centers, hosts, repaired_at);
         }).then([id] {
             logger.info("repair {} completed sucessfully", id);
             repair_tracker.done(id, true);
@@ -836,6 +1164,16 @@ static int do_repair_start(seastar::sharded<database>& db, sstring keyspace,
 
     repair_options options(options_map);
 
+    // Incremental repair sessions are identified by the time they started at,
+    // which the repaired sstables are then marked with. 0 is a full repair.
+    uint64_t repaired_at = 0;
+    if (options.incremental) {
+        if (!service::get_local_storage_service().cluster_supports_incremental_repair()) {
+            throw std::runtime_error("cluster doesn't support incremental repair");
+        }
+        repaired_at = std::chrono::duration_cast<std::chrono::milliseconds>(db_clock::now().time_since_epoch()).count();
+    }
+
     // Note: Cassandra can, in some cases, decide immediately that there is
     // nothing to repair, and return 0. "nodetool repair" prints in this case
     // that "Nothing to repair for keyspace '...'". We don't have such a case
@@ -918,7 +1256,7 @@ static int do_repair_start(seastar::sharded<database>& db, sstring keyspace,
     }
 
     repair_ranges(db, std::move(keyspace), std::move(ranges), std::move(cfs),
-            id, options.data_centers, options.hosts);
+            id, options.data_centers, options.hosts, repaired_at);
 
     return id;
 }
@@ -938,9 +1276,13 @@ future<repair_status> repair_get_status(seastar::sharded<database>& db, int id)
 
 future<> repair_shutdown(seastar::sharded<database>& db) {
     logger.info("Starting shutdown of repair");
-    return db.invoke_on(0, [] (database& localdb) {
-        return repair_tracker.shutdown().then([] {
-            logger.info("Completed shutdown of repair");
+    return db.invoke_on_all([] (database& localdb) {
+        repair_stopping = true;
+    }).then([&db] {
+        return db.invoke_on(0, [] (database& localdb) {
+            return repair_tracker.shutdown().then([] {
+                logger.info("Completed shutdown of repair");
+            });
         });
     });
 }
@@ -73,6 +73,8 @@ future<> repair_shutdown(seastar::sharded<database>& db);
 enum class repair_checksum {
     legacy = 0,
     streamed = 1,
+    // Like streamed, but with a 128-bit MurmurHash3 instead of SHA-256.
+    murmur3 = 2,
 };
 
 // The class partition_checksum calculates a 256-bit cryptographically-secure
@@ -88,6 +90,7 @@ class partition_checksum {
     std::array<uint8_t, 32> _digest; // 256 bits
 private:
     static future<partition_checksum> compute_legacy(streamed_mutation m);
+    template <typename Hasher>
     static future<partition_checksum> compute_streamed(streamed_mutation m);
 public:
     constexpr partition_checksum() : _digest{} { }
@@ -101,10 +104,29 @@ class partition_checksum {
 };
 
 // Calculate the checksum of the data held on all shards of a column family,
-// in the given token range.
+// in the given token range. If repaired_at isn't 0, only the data which isn't
+// repaired yet is checksummed, for incremental repair session repaired_at.
 // All parameters to this function are constant references, and the caller
 // must ensure they live as long as the future returned by this function is
 // not resolved.
 future<partition_checksum> checksum_range(seastar::sharded<database> &db,
         const sstring& keyspace, const sstring& cf,
-        const ::range<dht::token>& range, repair_checksum rt);
+        const ::range<dht::token>& range, repair_checksum rt, uint64_t repaired_at);
+
+// Calculate a separate checksum for each of the given sorted, disjoint,
+// non-wrapping token ranges, of the data held on all shards of a column
+// family, reading the data only once. Used to narrow down which parts of a
+// range differing between replicas need to be synced.
+// The same lifetime requirements as for checksum_range() apply.
+future<std::vector<partition_checksum>> checksum_ranges(seastar::sharded<database> &db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<::range<dht::token>>& ranges, repair_checksum rt, uint64_t repaired_at);
+
+// Marks the sstables of a column family read by the successful incremental
+// repair session repaired_at of the given token ranges as repaired, on all
+// shards. Sstables which also hold data of other ranges of this node are
+// left unrepaired.
+// The same lifetime requirements as for checksum_range() apply.
+future<> mark_repaired(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<::range<dht::token>>& ranges, uint64_t repaired_at);
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Load of a replica shard, as sent back to the coordinator with the
+// responses to writes and reads, so that it can hold back on or avoid
+// replicas which are falling behind before they start timing out.
+struct replica_load {
+    // Memory taken by memtables, in percent of the amount at which
+    // writes start to be throttled.
+    uint8_t dirty_percent = 0;
+    // Reads waiting to be admitted.
+    uint32_t read_queue_length = 0;
+    uint32_t pending_compactions = 0;
+};
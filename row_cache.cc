@@ -28,6 +28,7 @@
 #include "memtable.hh"
 #include <chrono>
 #include "utils/move.hh"
+#include "utils/stall_detector.hh"
 #include <boost/version.hpp>
 
 using namespace std::chrono_literals;
@@ -55,31 +56,67 @@ try_to_read(uint64_t max_cached_partition_size_in_bytes, streamed_mutation_opt&&
         });
 }
 
+static bound_view start_bound(const query::clustering_range& r) {
+    if (!r.start()) {
+        return bound_view::bottom();
+    }
+    return bound_view(r.start()->value(), r.start()->is_inclusive() ? bound_kind::incl_start : bound_kind::excl_start);
+}
+
+static bound_view end_bound(const query::clustering_range& r) {
+    if (!r.end()) {
+        return bound_view::top();
+    }
+    return bound_view(r.end()->value(), r.end()->is_inclusive() ? bound_kind::incl_end : bound_kind::excl_end);
+}
+
+// Returns the part of r which falls into pr.
+static stdx::optional<query::clustering_range> intersection(const schema& s, const query::clustering_range& r, const position_range& pr) {
+    bound_view::compare less(s);
+    auto start = std::max(start_bound(r), pr.start().as_start_bound_view(), less);
+    auto end = std::min(end_bound(r), pr.end().as_end_bound_view(), less);
+    if (!less(start, end)) {
+        return { };
+    }
+    auto to_bound = [&s] (bound_view b, bool inclusive) -> stdx::optional<query::clustering_range::bound> {
+        if (!b.prefix.size(s)) {
+            return { };
+        }
+        return query::clustering_range::bound(b.prefix, inclusive);
+    };
+    return query::clustering_range(to_bound(start, start.kind == bound_kind::incl_start),
+                                   to_bound(end, end.kind == bound_kind::incl_end));
+}
+
 cache_tracker& global_cache_tracker() {
     static thread_local cache_tracker instance;
     return instance;
 }
 
-cache_tracker::cache_tracker() {
+constexpr double cache_tracker::max_protected_share;
+constexpr std::chrono::seconds cache_tracker::full_cache_window;
+constexpr unsigned cache_tracker::max_read_versions;
+constexpr size_t cache_tracker::rows_per_merge_step;
+constexpr unsigned cache_tracker::merge_steps_per_task;
+
+// Sized for about one distinct partition per 4kB of memory.
+cache_tracker::cache_tracker()
+    : _sketch(memory::stats().total_memory() / 4096)
+{
     setup_collectd();
 
+    _merge_timer.set_callback([this] { merge_versions(); });
+
     _region.make_evictable([this] {
         return with_allocator(_region.allocator(), [this] {
           // Removing a partition may require reading large keys when we rebalance
           // the rbtree, so linearize anything we read
           return with_linearized_managed_bytes([&] {
            try {
-            if (_lru.empty()) {
+            if (_lru.empty() && _probation.empty()) {
                 return memory::reclaiming_result::reclaimed_nothing;
             }
-            cache_entry& ce = _lru.back();
-            auto it = row_cache::partitions_type::s_iterator_to(ce);
-            --it;
-            clear_continuity(*it);
-            _lru.pop_back_and_dispose(current_deleter<cache_entry>());
-            --_partitions;
-            ++_evictions;
-            ++_modification_count;
+            evict_one();
             return memory::reclaiming_result::reclaimed_something;
            } catch (std::bad_alloc&) {
             // Bad luck, linearization during partition removal caused us to
@@ -96,6 +133,49 @@ cache_tracker::~cache_tracker() {
     clear();
 }
 
+void cache_tracker::evict_one() {
+    auto& lru = _probation.empty() ? _lru : _probation;
+    cache_entry& ce = lru.back();
+    auto it = row_cache::partitions_type::s_iterator_to(ce);
+    --it;
+    clear_continuity(*it);
+    unlink(ce);
+    current_deleter<cache_entry>()(&ce);
+    --_partitions;
+    ++_evictions;
+    ++_modification_count;
+    _last_eviction = std::chrono::steady_clock::now();
+}
+
+size_t cache_tracker::evict(size_t bytes) {
+    return with_allocator(_region.allocator(), [&] {
+        return with_linearized_managed_bytes([&] {
+            auto before = _region.occupancy().used_space();
+            auto target = before - std::min(before, bytes);
+            try {
+                while ((!_lru.empty() || !_probation.empty()) && _region.occupancy().used_space() > target) {
+                    evict_one();
+                }
+            } catch (std::bad_alloc&) {
+                // Linearization failed, leave the rest to the reclaimer.
+            }
+            return before - std::min(before, _region.occupancy().used_space());
+        });
+    });
+}
+
+void cache_tracker::unlink(cache_entry& e) {
+    if (e._protected) {
+        e._protected = false;
+        --_protected_partitions;
+    }
+    e._lru_link.unlink();
+}
+
+uint64_t cache_tracker::hash_of(const schema& s, const dht::token& t) {
+    return std::hash<dht::token>()(t) ^ (std::hash<utils::UUID>()(s.id()) * 0x9e3779b97f4a7c15ull);
+}
+
 void
 cache_tracker::setup_collectd() {
     _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
@@ -154,18 +234,65 @@ cache_tracker::setup_collectd() {
                 , "objects", "partitions")
                 , scollectd::make_typed(scollectd::data_type::GAUGE, _partitions)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "protected_partitions")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _protected_partitions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "admission_rejections")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _admission_rejections)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "bypasses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _bypasses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "version_merges")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _version_merges)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "partition_compactions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _partition_compactions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "compressed_cells")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.compressed_cells)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "compression_input")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.bytes_in)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "compression_output")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.bytes_out)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "ratio", "cell_compression")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                    return _compression_stats.bytes_in ? double(_compression_stats.bytes_out) / _compression_stats.bytes_in : 0.0;
+                })
+        ),
     }));
 }
 
 void cache_tracker::clear() {
     with_allocator(_region.allocator(), [this] {
-        while (!_lru.empty()) {
-            cache_entry& ce = _lru.back();
+        while (!_lru.empty() || !_probation.empty()) {
+            cache_entry& ce = _probation.empty() ? _lru.back() : _probation.back();
             auto it = row_cache::partitions_type::s_iterator_to(ce);
             while (it->is_evictable()) {
                 cache_entry& to_remove = *it;
                 --it;
-                _lru.erase(_lru.iterator_to(to_remove));
+                unlink(to_remove);
                 current_deleter<cache_entry>()(&to_remove);
             }
             clear_continuity(*it);
@@ -177,18 +304,53 @@ void cache_tracker::clear() {
 }
 
 void cache_tracker::touch(cache_entry& e) {
-    _lru.erase(_lru.iterator_to(e));
+    if (e._protected) {
+        _lru.erase(_lru.iterator_to(e));
+        _lru.push_front(e);
+        return;
+    }
+    e._lru_link.unlink();
+    e._protected = true;
+    ++_protected_partitions;
     _lru.push_front(e);
+    if (_protected_partitions > _partitions * max_protected_share) {
+        cache_entry& demoted = _lru.back();
+        unlink(demoted);
+        _probation.push_front(demoted);
+    }
 }
 
 void cache_tracker::insert(cache_entry& entry) {
     ++_insertions;
     ++_partitions;
     ++_modification_count;
-    _lru.push_front(entry);
+    _probation.push_front(entry);
+}
+
+void cache_tracker::on_access(const schema& s, const dht::decorated_key& dk) {
+    _sketch.record(hash_of(s, dk.token()));
 }
 
-void cache_tracker::on_erase() {
+bool cache_tracker::should_admit(const schema& s, const dht::decorated_key& dk) {
+    if (std::chrono::steady_clock::now() - _last_eviction > full_cache_window) {
+        return true;
+    }
+    auto& lru = _probation.empty() ? _lru : _probation;
+    if (lru.empty()) {
+        return true;
+    }
+    auto& victim = lru.back();
+    if (_sketch.estimate(hash_of(s, dk.token())) > _sketch.estimate(hash_of(*victim.schema(), victim.key().token()))) {
+        return true;
+    }
+    ++_admission_rejections;
+    return false;
+}
+
+void cache_tracker::on_erase(const cache_entry& e) {
+    if (e._protected) {
+        --_protected_partitions;
+    }
     --_partitions;
     ++_removals;
     ++_modification_count;
@@ -214,6 +376,47 @@ void cache_tracker::on_uncached_wide_partition() {
     ++_uncached_wide_partitions;
 }
 
+void cache_tracker::on_bypass() {
+    ++_bypasses;
+}
+
+void cache_tracker::on_partition_compaction() {
+    ++_partition_compactions;
+}
+
+void cache_tracker::request_version_merge(cache_entry& e) {
+    if (e._merge_link.is_linked()) {
+        return;
+    }
+    _merge_queue.push_back(e);
+    if (!_merge_timer.armed()) {
+        _merge_timer.arm(std::chrono::steady_clock::now());
+    }
+}
+
+// Does a bounded amount of merging and reschedules itself if some is left,
+// so that other tasks can run in between.
+void cache_tracker::merge_versions() {
+    auto steps = merge_steps_per_task;
+    _merge_section(_region, [&] {
+        with_allocator(_region.allocator(), [&] {
+            with_linearized_managed_bytes([&] {
+                while (!_merge_queue.empty() && steps) {
+                    --steps;
+                    cache_entry& e = _merge_queue.front();
+                    if (e.partition().merge_versions_some(*e.schema(), rows_per_merge_step) == stop_iteration::yes) {
+                        _merge_queue.pop_front();
+                        ++_version_merges;
+                    }
+                }
+            });
+        });
+    });
+    if (!_merge_queue.empty()) {
+        _merge_timer.arm(std::chrono::steady_clock::now());
+    }
+}
+
 void cache_tracker::on_continuity_flag_cleared() {
     ++_continuity_flags_cleared;
 }
@@ -263,7 +466,7 @@ class single_partition_populating_reader final : public mutation_reader::impl {
                 (is_wide_partition wide_partition, mutation_opt&& mo) {
                     if (wide_partition == is_wide_partition::no) {
                         if (mo) {
-                            _cache.populate(*mo);
+                            _cache.populate(*mo, row_cache::populate_source::point_read);
                             mo->upgrade(_schema);
                             auto& ck_ranges = _ck_filtering.get_ranges(mo->key());
                             auto filtered_partition = mutation_partition(std::move(mo->partition()), *(mo->schema()), ck_ranges);
@@ -283,6 +486,161 @@ class single_partition_populating_reader final : public mutation_reader::impl {
     }
 };
 
+// Passes through a slice of a wide partition read from the underlying source,
+// collecting a copy of it. Once the slice has been read to the end, the copy
+// is used to populate the partition's cache entry, unless it turned out to be
+// too large or cache was updated in the meantime. If the consumer stops early,
+// the part of the slice which was read so far is populated.
+class populating_streamed_mutation final : public streamed_mutation::impl {
+    row_cache& _cache;
+    streamed_mutation _sm;
+    query::clustering_row_ranges _requested_ranges;
+    // Parts of the requested ranges which are read, skipped parts excluded.
+    query::clustering_row_ranges _ck_ranges;
+    utils::phased_barrier::phase_type _populate_phase;
+    mutation_opt _m;
+    size_t _remaining_limit;
+    stdx::optional<clustering_key_prefix> _last_row_key;
+private:
+    void collect(const mutation_fragment& mf) {
+        auto size = mf.memory_usage();
+        if (size >= _remaining_limit) {
+            _m = { };
+            return;
+        }
+        _remaining_limit -= size;
+        auto& s = *_m->schema();
+        auto& p = _m->partition();
+        if (mf.is_static_row()) {
+            p.static_row().apply(s, column_kind::static_column, mf.as_static_row().cells());
+        } else if (mf.is_clustering_row()) {
+            auto& cr = mf.as_clustering_row();
+            auto& dr = p.clustered_row(cr.key());
+            dr.apply(cr.tomb());
+            dr.apply(cr.marker());
+            dr.cells().apply(s, column_kind::regular_column, cr.cells());
+            _last_row_key = cr.key();
+        } else {
+            p.apply_row_tombstone(s, range_tombstone(mf.as_range_tombstone()));
+        }
+    }
+    // Returns the parts of requested ranges which are not past the last
+    // clustering row read so far.
+    query::clustering_row_ranges read_ranges() const {
+        if (is_end_of_stream()) {
+            return _ck_ranges;
+        }
+        query::clustering_row_ranges ranges;
+        if (!_last_row_key) {
+            return ranges;
+        }
+        bound_view::compare less(*_schema);
+        auto last = bound_view(*_last_row_key, bound_kind::incl_end);
+        for (auto&& r : _ck_ranges) {
+            if (less(last, start_bound(r))) {
+                break;
+            }
+            if (!less(last, end_bound(r))) {
+                ranges.push_back(r);
+                continue;
+            }
+            ranges.emplace_back(r.start(), query::clustering_range::bound(*_last_row_key, true));
+            break;
+        }
+        return ranges;
+    }
+    void populate() noexcept {
+        if (!_m || _populate_phase != _cache._populate_phaser.phase()) {
+            return;
+        }
+        try {
+            auto ranges = read_ranges();
+            if (!ranges.empty()) {
+                _cache.populate_wide(*_m, ranges);
+            }
+        } catch (...) {
+            logger.warn("Failed to populate wide partition {}: {}", _m->decorated_key(), std::current_exception());
+        }
+        _m = { };
+    }
+public:
+    populating_streamed_mutation(row_cache& cache, streamed_mutation sm, query::clustering_row_ranges ck_ranges,
+                                 utils::phased_barrier::phase_type populate_phase)
+        : streamed_mutation::impl(sm.schema(), sm.decorated_key(), sm.partition_tombstone())
+        , _cache(cache)
+        , _sm(std::move(sm))
+        , _requested_ranges(ck_ranges)
+        , _ck_ranges(std::move(ck_ranges))
+        , _populate_phase(populate_phase)
+        , _m(mutation(_key, _schema))
+        , _remaining_limit(cache._max_cached_partition_size_in_bytes)
+    {
+        _m->partition().apply(_partition_tombstone);
+    }
+    ~populating_streamed_mutation() {
+        populate();
+    }
+    virtual future<> fill_buffer() override {
+        return do_until([this] { return is_end_of_stream() || is_buffer_full(); }, [this] {
+            return _sm().then([this] (mutation_fragment_opt mf) {
+                if (!mf) {
+                    _end_of_stream = true;
+                    populate();
+                    return;
+                }
+                if (_m) {
+                    collect(*mf);
+                }
+                push_mutation_fragment(std::move(*mf));
+            });
+        });
+    }
+    virtual future<> fast_forward_to(position_range pr) override {
+        _range_end = pr.end();
+        forward_buffer_to(pr.start());
+        if (_m) {
+            auto ranges = read_ranges();
+            for (auto&& r : _requested_ranges) {
+                auto i = intersection(*_schema, r, pr);
+                if (i) {
+                    ranges.emplace_back(std::move(*i));
+                }
+            }
+            _ck_ranges = std::move(ranges);
+        }
+        _end_of_stream = false;
+        return _sm.fast_forward_to(std::move(pr));
+    }
+};
+
+// Reader of a single wide partition which is not in cache for the requested
+// clustering ranges.
+class wide_partition_populating_reader final : public mutation_reader::impl {
+    schema_ptr _schema;
+    row_cache& _cache;
+    stdx::optional<dht::decorated_key> _key;
+    query::clustering_key_filtering_context _ck_filtering;
+    const io_priority_class& _pc;
+public:
+    wide_partition_populating_reader(schema_ptr s, row_cache& cache, dht::decorated_key key,
+                                     query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc)
+        : _schema(std::move(s))
+        , _cache(cache)
+        , _key(std::move(key))
+        , _ck_filtering(ck_filtering)
+        , _pc(pc)
+    { }
+
+    virtual future<streamed_mutation_opt> operator()() override {
+        if (!_key) {
+            return make_ready_future<streamed_mutation_opt>();
+        }
+        auto key = std::move(*_key);
+        _key = { };
+        return _cache.read_and_populate_wide(_schema, std::move(key), _ck_filtering, _pc);
+    }
+};
+
 void cache_tracker::clear_continuity(cache_entry& ce) {
     ce.set_continuous(false);
     on_continuity_flag_cleared();
@@ -298,6 +656,10 @@ void row_cache::on_miss() {
     _tracker.on_miss();
 }
 
+void row_cache::on_bypass() {
+    _tracker.on_bypass();
+}
+
 void row_cache::on_uncached_wide_partition() {
     _tracker.on_uncached_wide_partition();
 }
@@ -793,6 +1155,7 @@ row_cache::make_reader(schema_ptr s,
         return _read_section(_tracker.region(), [&] {
           return with_linearized_managed_bytes([&] {
             const dht::decorated_key& dk = pos.as_decorated_key();
+            _tracker.on_access(*_schema, dk);
             auto i = _partitions.find(dk, cache_entry::compare(_schema));
             if (i != _partitions.end() && i != _partitions.begin()) {
                 cache_entry& e = *i;
@@ -800,8 +1163,11 @@ row_cache::make_reader(schema_ptr s,
                 on_hit();
                 upgrade_entry(e);
                 if (e.wide_partition()) {
+                    if (e.continuity().contains(*_schema, ck_filtering.get_ranges(dk.key()))) {
+                        return make_reader_returning(e.read(*this, s, ck_filtering));
+                    }
                     _tracker.on_uncached_wide_partition();
-                    return _underlying(s, range, ck_filtering, pc);
+                    return make_mutation_reader<wide_partition_populating_reader>(s, *this, dk, ck_filtering, pc);
                 }
                 return make_reader_returning(e.read(*this, s, ck_filtering));
             } else {
@@ -820,7 +1186,7 @@ row_cache::make_reader(schema_ptr s,
 row_cache::~row_cache() {
     with_allocator(_tracker.allocator(), [this] {
         _partitions.clear_and_dispose([this, deleter = current_deleter<cache_entry>()] (auto&& p) mutable {
-            _tracker.on_erase();
+            _tracker.on_erase(*p);
             deleter(p);
         });
     });
@@ -832,7 +1198,7 @@ void row_cache::clear_now() noexcept {
         ++begin;
         if (begin != _partitions.end()) {
             _partitions.erase_and_dispose(begin, _partitions.end(), [this, deleter = current_deleter<cache_entry>()] (auto&& p) mutable {
-                _tracker.on_erase();
+                _tracker.on_erase(*p);
                 deleter(p);
             });
         }
@@ -850,7 +1216,7 @@ void row_cache::mark_partition_as_wide(const dht::decorated_key& key) {
                             _schema, key, cache_entry::wide_partition_tag{});
                     _tracker.insert(*entry);
                     _partitions.insert(i, *entry);
-                } else {
+                } else if (!i->wide_partition()) {
                     i->set_wide_partition();
                 }
             });
@@ -858,19 +1224,69 @@ void row_cache::mark_partition_as_wide(const dht::decorated_key& key) {
     });
 }
 
-void row_cache::populate(const mutation& m) {
-    with_allocator(_tracker.allocator(), [this, &m] {
+void row_cache::populate_wide(const mutation& m, const query::clustering_row_ranges& ranges) {
+    with_allocator(_tracker.allocator(), [this, &m, &ranges] {
+        _populate_section(_tracker.region(), [&] {
+          with_linearized_managed_bytes([&] {
+            auto i = _partitions.find(m.decorated_key(), cache_entry::compare(_schema));
+            if (i == _partitions.end() || !i->wide_partition()) {
+                return;
+            }
+            cache_entry& e = *i;
+            upgrade_entry(e);
+            auto size = m.partition().memory_usage();
+            if (e._partial_size + size > _max_cached_partition_size_in_bytes) {
+                // Don't let cached parts of the partition grow without limit,
+                // start over with the most recently requested ones.
+                e.set_wide_partition();
+                if (size > _max_cached_partition_size_in_bytes) {
+                    return;
+                }
+            }
+            if (e._continuity.empty()) {
+                e._pe = partition_entry(mutation_partition(_schema));
+            }
+            if (auto threshold = m.schema()->caching_options().cell_compression_threshold()) {
+                auto p = mutation_partition(m.partition());
+                cell_compression::compress(*m.schema(), p, threshold, _tracker.compression_stats());
+                e._pe.apply(*_schema, std::move(p), *m.schema());
+            } else {
+                e._pe.apply(*_schema, m.partition(), *m.schema());
+            }
+            e._continuity.add(*_schema, ranges);
+            e._partial_size += size;
+            _tracker.touch(e);
+          });
+        });
+    });
+}
+
+void row_cache::populate(const mutation& m, populate_source source) {
+    with_allocator(_tracker.allocator(), [this, &m, source] {
         _populate_section(_tracker.region(), [&] {
           with_linearized_managed_bytes([&] {
             auto i = _partitions.lower_bound(m.decorated_key(), cache_entry::compare(_schema));
             if (i == _partitions.end() || !i->key().equal(*_schema, m.decorated_key())) {
-                cache_entry* entry = current_allocator().construct<cache_entry>(
-                        m.schema(), m.decorated_key(), m.partition());
+                if (source == populate_source::point_read && !_tracker.should_admit(*_schema, m.decorated_key())) {
+                    return;
+                }
+                cache_entry* entry;
+                if (auto threshold = m.schema()->caching_options().cell_compression_threshold()) {
+                    auto p = mutation_partition(m.partition());
+                    cell_compression::compress(*m.schema(), p, threshold, _tracker.compression_stats());
+                    entry = current_allocator().construct<cache_entry>(
+                            m.schema(), dht::decorated_key(m.decorated_key()), std::move(p));
+                } else {
+                    entry = current_allocator().construct<cache_entry>(
+                            m.schema(), m.decorated_key(), m.partition());
+                }
                 upgrade_entry(*entry);
                 _tracker.insert(*entry);
                 _partitions.insert(i, *entry);
             } else {
-                _tracker.touch(*i);
+                if (source == populate_source::point_read) {
+                    _tracker.touch(*i);
+                }
                 // We cache whole partitions right now, so if cache already has this partition,
                 // it must be complete, so do nothing.
                 _tracker.on_miss_already_populated();  // #1534
@@ -885,12 +1301,16 @@ future<> row_cache::clear() {
 }
 
 future<> row_cache::update(memtable& m, partition_presence_checker presence_checker) {
+    // The memtable leaves its dirty memory region group below, with all of
+    // its memory, including what the flush already released.
+    m.revert_flushed_memory();
     _tracker.region().merge(m); // Now all data in memtable belongs to cache
     auto attr = seastar::thread_attributes();
     attr.scheduling_group = &_update_thread_scheduling_group;
     auto t = seastar::thread(attr, [this, &m, presence_checker = std::move(presence_checker)] {
         auto cleanup = defer([&] {
             with_allocator(_tracker.allocator(), [&m, this] () {
+                utils::stall_scope stall(utils::stall_subsystem::row_cache_update);
                 logalloc::reclaim_lock _(_tracker.region());
                 bool blow_cache = false;
                 // Note: clear_and_dispose() ought not to look up any keys, so it doesn't require
@@ -913,8 +1333,13 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
             });
         });
         _populate_phaser.advance_and_await().get();
+        // Set while the first memtable partition is merged into its cache
+        // entry only in part. Its remaining rows must not be inserted into
+        // cache as a complete partition.
+        bool merging = false;
         while (!m.partitions.empty()) {
-            with_allocator(_tracker.allocator(), [this, &m, &presence_checker] () {
+            with_allocator(_tracker.allocator(), [this, &m, &presence_checker, &merging] () {
+                utils::stall_scope stall(utils::stall_subsystem::row_cache_update);
                 unsigned quota = 30;
                 auto cmp = cache_entry::compare(_schema);
                 {
@@ -930,14 +1355,33 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
                             // FIXME: keep a bitmap indicating which sstables we do cover, so we don't have to
                             //        search it.
                             if (cache_i != _partitions.end() && cache_i->key().equal(*_schema, mem_e.key())) {
-                              if (!cache_i->wide_partition()) {
+                              // Wide partitions are kept up to date only if they have cached clustering ranges.
+                              if (!cache_i->wide_partition() || !cache_i->continuity().empty()) {
                                 cache_entry& entry = *cache_i;
                                 upgrade_entry(entry);
-                                entry.partition().apply(*_schema, std::move(mem_e.partition()), *mem_e.schema());
+                                if (entry.wide_partition()) {
+                                    auto size = mem_e.partition().memory_usage();
+                                    entry.partition().apply(*_schema, std::move(mem_e.partition()), *mem_e.schema());
+                                    entry._partial_size += size;
+                                    if (entry._partial_size > _max_cached_partition_size_in_bytes) {
+                                        entry.set_wide_partition();
+                                    }
+                                } else {
+                                    // Large partitions are merged a few rows at a time, so that
+                                    // the merge can be preempted. Readers see the rows through
+                                    // both the memtable and the cache entry in the meantime.
+                                    while (entry.partition().apply_some(*_schema, mem_e.partition(), *mem_e.schema(),
+                                            rows_per_update_step) == stop_iteration::no) {
+                                        if (seastar::thread::should_yield()) {
+                                            merging = true;
+                                            return;
+                                        }
+                                    }
+                                }
                                 _tracker.touch(entry);
                                 _tracker.on_merge();
                               }
-                            } else if (presence_checker(mem_e.key().key()) ==
+                            } else if (!merging && presence_checker(mem_e.key().key()) ==
                                     partition_presence_checker_result::definitely_doesnt_exist) {
                                 cache_entry* entry = current_allocator().construct<cache_entry>(
                                         mem_e.schema(), std::move(mem_e.key()), std::move(mem_e.partition()));
@@ -947,11 +1391,15 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
                                 --cache_i;
                                 _tracker.clear_continuity(*cache_i);
                             }
+                            merging = false;
                             i = m.partitions.erase(i);
                             current_allocator().destroy(&mem_e);
                             --quota;
                            }
                           });
+                          if (merging) {
+                              return;
+                          }
                         }
                     });
                     if (quota == 0 && seastar::thread::should_yield()) {
@@ -990,7 +1438,7 @@ void row_cache::invalidate_locked(const dht::decorated_key& dk) {
         ++end;
         auto it = _partitions.erase_and_dispose(pos, end,
             [this, &dk, deleter = current_deleter<cache_entry>()](auto&& p) mutable {
-                _tracker.on_erase();
+                _tracker.on_erase(*p);
                 deleter(p);
             });
         assert (it != _partitions.begin());
@@ -1012,20 +1460,38 @@ return _populate_phaser.advance_and_await().then([this, &dk] {
 }
 
 future<> row_cache::invalidate(const query::partition_range& range) {
-    return _populate_phaser.advance_and_await().then([this, &range] {
+    return invalidate(range, partition_filter());
+}
+
+future<> row_cache::invalidate(const query::partition_range& range, partition_filter filter) {
+    return _populate_phaser.advance_and_await().then([this, &range, filter = std::move(filter)] {
         with_linearized_managed_bytes([&] {
             if (range.is_wrap_around(dht::ring_position_comparator(*_schema))) {
                 auto unwrapped = range.unwrap();
-                invalidate_unwrapped(unwrapped.first);
-                invalidate_unwrapped(unwrapped.second);
+                invalidate_unwrapped(unwrapped.first, filter);
+                invalidate_unwrapped(unwrapped.second, filter);
             } else {
-                invalidate_unwrapped(range);
+                invalidate_unwrapped(range, filter);
             }
         });
     });
 }
 
-void row_cache::invalidate_unwrapped(const query::partition_range& range) {
+future<> row_cache::invalidate(const memtable& m) {
+    return _populate_phaser.advance_and_await().then([this, &m] {
+        return do_for_each(m.partitions, [this] (const memtable_entry& e) {
+            _read_section(_tracker.region(), [&] {
+                with_allocator(_tracker.allocator(), [&] {
+                    with_linearized_managed_bytes([&] {
+                        invalidate_locked(e.key());
+                    });
+                });
+            });
+        });
+    });
+}
+
+void row_cache::invalidate_unwrapped(const query::partition_range& range, const partition_filter& filter) {
     logalloc::reclaim_lock _(_tracker.region());
 
     auto cmp = cache_entry::compare(_schema);
@@ -1049,14 +1515,34 @@ void row_cache::invalidate_unwrapped(const query::partition_range& range) {
             end = _partitions.lower_bound(range.end()->value(), cmp);
         }
     }
-    with_allocator(_tracker.allocator(), [this, begin, end] {
-        auto it = _partitions.erase_and_dispose(begin, end, [this, deleter = current_deleter<cache_entry>()] (auto&& p) mutable {
-            _tracker.on_erase();
+    with_allocator(_tracker.allocator(), [this, begin, end, &filter] {
+        auto deleter = current_deleter<cache_entry>();
+        auto erase = [this, &deleter] (cache_entry* p) {
+            _tracker.on_erase(*p);
             deleter(p);
-        });
-        assert(it != _partitions.begin());
-        --it;
-        _tracker.clear_continuity(*it);
+        };
+        if (!filter) {
+            auto it = _partitions.erase_and_dispose(begin, end, erase);
+            assert(it != _partitions.begin());
+            --it;
+            _tracker.clear_continuity(*it);
+            return;
+        }
+        auto clear_continuity = [this] (cache_entry& e) {
+            if (e.continuous()) {
+                _tracker.clear_continuity(e);
+            }
+        };
+        clear_continuity(*std::prev(begin));
+        auto it = begin;
+        while (it != end) {
+            if (filter(it->key())) {
+                it = _partitions.erase_and_dispose(it, erase);
+            } else {
+                clear_continuity(*it);
+                ++it;
+            }
+        }
     });
 }
 
@@ -1089,14 +1575,97 @@ row_cache::row_cache(schema_ptr s, mutation_source fallback_factory, key_source
     });
 }
 
+bool clustering_continuity::contains(const schema& s, const query::clustering_row_ranges& ranges) const {
+    if (_intervals.empty()) {
+        return false;
+    }
+    bound_view::compare less(s);
+    return std::all_of(ranges.begin(), ranges.end(), [&] (const query::clustering_range& r) {
+        auto start = start_bound(r);
+        auto end = end_bound(r);
+        return std::any_of(_intervals.begin(), _intervals.end(), [&] (const interval& i) {
+            return !less(start, i.start_bound()) && !less(i.end_bound(), end);
+        });
+    });
+}
+
+void clustering_continuity::add(const schema& s, const query::clustering_row_ranges& ranges) {
+    struct bounds {
+        const clustering_key_prefix* start;
+        bound_kind start_kind;
+        const clustering_key_prefix* end;
+        bound_kind end_kind;
+
+        bounds(bound_view start, bound_view end)
+            : start(&start.prefix), start_kind(start.kind), end(&end.prefix), end_kind(end.kind) { }
+        bound_view start_bound() const { return bound_view(*start, start_kind); }
+        bound_view end_bound() const { return bound_view(*end, end_kind); }
+    };
+    bound_view::compare less(s);
+
+    auto merge = [&] (std::vector<bounds> all) {
+        std::sort(all.begin(), all.end(), [&] (const bounds& a, const bounds& b) {
+            return less(a.start_bound(), b.start_bound());
+        });
+        std::vector<bounds> merged;
+        for (auto&& b : all) {
+            if (!merged.empty()) {
+                auto& last = merged.back();
+                if (!less(last.end_bound(), b.start_bound()) || last.end_bound().adjacent(s, b.start_bound())) {
+                    if (less(last.end_bound(), b.end_bound())) {
+                        last.end = b.end;
+                        last.end_kind = b.end_kind;
+                    }
+                    continue;
+                }
+            }
+            merged.push_back(b);
+        }
+        return merged;
+    };
+
+    std::vector<bounds> new_ranges;
+    for (auto&& r : ranges) {
+        auto start = start_bound(r);
+        auto end = end_bound(r);
+        if (!less(end, start)) {
+            new_ranges.emplace_back(start, end);
+        }
+    }
+    std::vector<bounds> all = new_ranges;
+    for (auto&& i : _intervals) {
+        all.emplace_back(i.start_bound(), i.end_bound());
+    }
+    auto merged = merge(std::move(all));
+    if (merged.size() > max_intervals) {
+        // Forget about older ranges. Their data stays in the entry, which is fine,
+        // since it's kept up to date, but won't be used for serving reads.
+        merged = merge(std::move(new_ranges));
+        if (merged.size() > max_intervals) {
+            return;
+        }
+    }
+
+    intervals_type intervals;
+    intervals.reserve(merged.size());
+    for (auto&& b : merged) {
+        intervals.emplace_back(interval{*b.start, b.start_kind, *b.end, b.end_kind});
+    }
+    _intervals = std::move(intervals);
+}
+
 cache_entry::cache_entry(cache_entry&& o) noexcept
     : _schema(std::move(o._schema))
     , _key(std::move(o._key))
     , _pe(std::move(o._pe))
+    , _continuity(std::move(o._continuity))
+    , _partial_size(o._partial_size)
     , _continuous(o._continuous)
     , _wide_partition(o._wide_partition)
+    , _protected(o._protected)
     , _lru_link()
     , _cache_link()
+    , _merge_link()
 {
     if (o._lru_link.is_linked()) {
         auto prev = o._lru_link.prev_;
@@ -1104,6 +1673,12 @@ cache_entry::cache_entry(cache_entry&& o) noexcept
         cache_tracker::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
     }
 
+    if (o._merge_link.is_linked()) {
+        auto prev = o._merge_link.prev_;
+        o._merge_link.unlink();
+        cache_tracker::merge_queue_type::node_algorithms::link_after(prev, _merge_link.this_ptr());
+    }
+
     {
         using container_type = row_cache::partitions_type;
         container_type::node_algorithms::replace_node(o._cache_link.this_ptr(), _cache_link.this_ptr());
@@ -1115,38 +1690,66 @@ void row_cache::set_schema(schema_ptr new_schema) noexcept {
     _schema = std::move(new_schema);
 }
 
-future<streamed_mutation_opt> cache_entry::read_wide(row_cache& rc, schema_ptr s, query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc) {
+static future<streamed_mutation_opt> read_from_underlying(mutation_source& underlying, schema_ptr s, const dht::decorated_key& dk,
+        query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc) {
     struct range_and_underlyig_reader {
         query::partition_range _range;
         mutation_reader _reader;
-        range_and_underlyig_reader(row_cache& rc, schema_ptr s, query::partition_range pr,
+        range_and_underlyig_reader(mutation_source& underlying, schema_ptr s, query::partition_range pr,
                                    query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc)
                 : _range(std::move(pr))
-                  , _reader(rc._underlying(s, _range, ck_filtering, pc))
+                  , _reader(underlying(s, _range, ck_filtering, pc))
         { }
     };
-    rc._tracker.on_uncached_wide_partition();
-    auto pr = query::partition_range::make_singular(_key);
-    return do_with(range_and_underlyig_reader(rc, s, std::move(pr), std::move(ck_filtering), pc), [] (auto& r_a_ur) {
+    auto pr = query::partition_range::make_singular(dk);
+    return do_with(range_and_underlyig_reader(underlying, s, std::move(pr), std::move(ck_filtering), pc), [] (auto& r_a_ur) {
         return r_a_ur._reader();
     });
 }
 
+future<streamed_mutation_opt> row_cache::read_and_populate_wide(schema_ptr s, dht::decorated_key dk,
+        query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc) {
+    auto phase = _populate_phaser.phase();
+    auto ck_ranges = ck_filtering.get_ranges(dk.key());
+    // What is read ends up in the cache, so it has to be read whole.
+    return read_from_underlying(_underlying, std::move(s), dk, ck_filtering.without_column_projection(), pc).then(
+            [this, phase, ck_ranges = std::move(ck_ranges)] (streamed_mutation_opt sm) mutable {
+        if (!sm) {
+            return streamed_mutation_opt();
+        }
+        return streamed_mutation_opt(make_streamed_mutation<populating_streamed_mutation>(*this, std::move(*sm),
+                                                                                        std::move(ck_ranges), phase));
+    });
+}
+
+future<streamed_mutation_opt> cache_entry::read_wide(row_cache& rc, schema_ptr s, query::clustering_key_filtering_context ck_filtering, const io_priority_class& pc) {
+    auto dk = _key.as_decorated_key();
+    if (_continuity.contains(*_schema, ck_filtering.get_ranges(dk.key()))) {
+        return make_ready_future<streamed_mutation_opt>(read(rc, s, ck_filtering));
+    }
+    rc._tracker.on_uncached_wide_partition();
+    return rc.read_and_populate_wide(std::move(s), std::move(dk), ck_filtering, pc);
+}
+
 streamed_mutation cache_entry::read(row_cache& rc, const schema_ptr& s) {
     return read(rc, s, query::no_clustering_key_filtering);
 }
 
 streamed_mutation cache_entry::read(row_cache& rc, const schema_ptr& s, query::clustering_key_filtering_context ck_filtering) {
-    assert(!wide_partition());
+    assert(!wide_partition() || !_continuity.empty());
     auto dk = _key.as_decorated_key();
     if (_schema->version() != s->version()) {
         const query::clustering_row_ranges& ck_ranges = ck_filtering.get_ranges(dk.key());
         auto mp = mutation_partition(_pe.squashed(_schema, s), *s, ck_ranges);
+        cell_compression::decompress(*s, mp);
         auto m = mutation(s, dk, std::move(mp));
         return streamed_mutation_from_mutation(std::move(m));
     }
     auto& ckr = ck_filtering.get_ranges(dk.key());
-    auto snp = _pe.read(_schema);
+    auto snp = _pe.read(_schema, false);
+    if (snp->version_count() > cache_tracker::max_read_versions) {
+        rc._tracker.request_version_merge(*this);
+    }
     return make_partition_snapshot_reader(_schema, dk, ck_filtering, ckr, snp, rc._tracker.region(), rc._read_section, { });
 }
 
@@ -1154,9 +1757,38 @@ const schema_ptr& row_cache::schema() const {
     return _schema;
 }
 
+stop_iteration row_cache::compact_expired(std::experimental::optional<dht::ring_position>& last, gc_clock::time_point now,
+        size_t max_partitions, size_t max_rows) {
+    return with_allocator(_tracker.allocator(), [&] {
+        return _compact_section(_tracker.region(), [&] {
+          return with_linearized_managed_bytes([&] {
+            auto cmp = cache_entry::compare(_schema);
+            auto i = last ? _partitions.upper_bound(*last, cmp) : _partitions.begin();
+            auto visited = _partitions.end();
+            for (auto n = max_partitions; i != _partitions.end() && n; ++i, --n) {
+                // Tombstones of a wide partition may cover rows it doesn't have.
+                if (i->key().has_key() && !i->wide_partition()) {
+                    upgrade_entry(*i);
+                    if (i->partition().compact(*i->schema(), always_gc, now, max_rows)) {
+                        _tracker.on_partition_compaction();
+                    }
+                }
+                visited = i;
+            }
+            if (visited != _partitions.end()) {
+                with_allocator(standard_allocator(), [&] {
+                    last = visited->key();
+                });
+            }
+            return stop_iteration(i == _partitions.end());
+          });
+        });
+    });
+}
+
 void row_cache::upgrade_entry(cache_entry& e) {
     if (e._schema != _schema) {
-        if (e.wide_partition()) {
+        if (e.wide_partition() && e._continuity.empty()) {
             e._schema = _schema;
             return;
         }
@@ -25,6 +25,7 @@
 #include <boost/intrusive/set.hpp>
 
 #include "core/memory.hh"
+#include "core/timer.hh"
 #include <seastar/core/thread.hh>
 
 #include "mutation_reader.hh"
@@ -34,6 +35,10 @@
 #include "utils/phased_barrier.hh"
 #include "utils/histogram.hh"
 #include "partition_version.hh"
+#include "range_tombstone.hh"
+#include "utils/managed_vector.hh"
+#include "utils/frequency_sketch.hh"
+#include "cell_compression.hh"
 
 namespace scollectd {
 
@@ -45,6 +50,35 @@ namespace bi = boost::intrusive;
 
 class row_cache;
 
+// Set of clustering ranges of a partition for which cache_entry holds complete
+// information. Used for wide partitions, which can't be cached as a whole.
+//
+// Ranges are kept sorted and non-overlapping. Lives in the cache's LSA region.
+class clustering_continuity {
+public:
+    struct interval {
+        clustering_key_prefix start;
+        bound_kind start_kind;
+        clustering_key_prefix end;
+        bound_kind end_kind;
+
+        bound_view start_bound() const { return bound_view(start, start_kind); }
+        bound_view end_bound() const { return bound_view(end, end_kind); }
+    };
+    // Keeps the number of intervals, and so the cost of lookups, bounded.
+    static constexpr unsigned max_intervals = 16;
+private:
+    using intervals_type = managed_vector<interval, 0, uint32_t>;
+    intervals_type _intervals;
+public:
+    bool empty() const { return _intervals.empty(); }
+    void clear() noexcept { _intervals = intervals_type(); }
+    // Returns true iff all of the ranges are contained in this set.
+    bool contains(const schema&, const query::clustering_row_ranges&) const;
+    // Adds ranges to this set. Strong exception guarantees.
+    void add(const schema&, const query::clustering_row_ranges&);
+};
+
 // Intrusive set entry which holds partition data.
 //
 // TODO: Make memtables use this format too.
@@ -57,15 +91,25 @@ class cache_entry {
     // multiple eviction spaces in the future and thus multiple LRUs.
     using lru_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
     using cache_link_type = bi::set_member_hook<bi::link_mode<bi::auto_unlink>>;
+    using merge_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
 
     schema_ptr _schema;
     dht::ring_position _key;
     partition_entry _pe;
+    // For wide partitions, clustering ranges for which _pe is complete.
+    // When empty, _pe holds no data.
+    clustering_continuity _continuity;
+    // Approximate amount of memory used by _pe of a wide partition.
+    uint32_t _partial_size = 0;
     // True when we know that there is nothing between this entry and the next one in cache
     bool _continuous : 1;
     bool _wide_partition : 1;
+    // In the protected segment of the LRU, rather than the probationary one.
+    bool _protected : 1;
     lru_link_type _lru_link;
     cache_link_type _cache_link;
+    // Linked while the entry waits for its versions to be merged.
+    merge_link_type _merge_link;
     friend class size_calculator;
 public:
     friend class row_cache;
@@ -76,6 +120,7 @@ class cache_entry {
         , _key(dht::ring_position::starting_at(dht::minimum_token()))
         , _continuous(false)
         , _wide_partition(false)
+        , _protected(false)
     { }
 
     struct wide_partition_tag{};
@@ -85,6 +130,7 @@ class cache_entry {
         , _key(key)
         , _continuous(false)
         , _wide_partition(true)
+        , _protected(false)
     { }
 
     cache_entry(schema_ptr s, const dht::decorated_key& key, const mutation_partition& p, bool continuous = false)
@@ -93,6 +139,7 @@ class cache_entry {
         , _pe(p)
         , _continuous(continuous)
         , _wide_partition(false)
+        , _protected(false)
     { }
 
     cache_entry(schema_ptr s, dht::decorated_key&& key, mutation_partition&& p, bool continuous = false) noexcept
@@ -101,6 +148,7 @@ class cache_entry {
         , _pe(std::move(p))
         , _continuous(continuous)
         , _wide_partition(false)
+        , _protected(false)
     { }
 
     cache_entry(schema_ptr s, dht::decorated_key&& key, partition_entry&& pe, bool continuous = false) noexcept
@@ -109,6 +157,7 @@ class cache_entry {
         , _pe(std::move(pe))
         , _continuous(continuous)
         , _wide_partition(false)
+        , _protected(false)
     { }
 
     cache_entry(cache_entry&&) noexcept;
@@ -121,8 +170,10 @@ class cache_entry {
     schema_ptr& schema() { return _schema; }
     // Requires: !wide_partition()
     streamed_mutation read(row_cache&, const schema_ptr&);
-    // Requires: !wide_partition()
+    // Requires: !wide_partition() or all requested clustering ranges are in continuity()
     streamed_mutation read(row_cache&, const schema_ptr&, query::clustering_key_filtering_context);
+    // Serves the read from cache if all requested clustering ranges are cached,
+    // otherwise reads from the underlying source and populates the entry.
     // May return disengaged optional if the partition is empty.
     future<streamed_mutation_opt> read_wide(row_cache&, schema_ptr, query::clustering_key_filtering_context, const io_priority_class&);
     bool continuous() const { return _continuous; }
@@ -131,7 +182,10 @@ class cache_entry {
     void set_wide_partition() {
         _wide_partition = true;
         _pe = {};
+        _continuity.clear();
+        _partial_size = 0;
     }
+    const clustering_continuity& continuity() const { return _continuity; }
 
     struct compare {
         dht::ring_position_less_comparator _c;
@@ -163,11 +217,34 @@ class cache_entry {
 };
 
 // Tracks accesses and performs eviction of cache entries.
+// Entries are evicted in the order of a segmented LRU. New entries go to the
+// probationary segment, and move to the protected one when they are read
+// again; eviction takes the probationary tail first. A scan thus only pushes
+// out entries which were read once, not the hot set. The protected segment
+// holds at most max_protected_share of the partitions, its tail goes back
+// to probation beyond that.
+//
+// When the cache is full, i.e. it evicted recently, partitions missed by
+// point reads are admitted only if they were read more often than the entry
+// which is next to be evicted, as estimated by a frequency_sketch of recent
+// point reads (TinyLFU).
 class cache_tracker final {
 public:
     using lru_type = bi::list<cache_entry,
         bi::member_hook<cache_entry, cache_entry::lru_link_type, &cache_entry::_lru_link>,
         bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+    static constexpr double max_protected_share = 0.8;
+    // How recently the cache must have evicted to be considered full.
+    static constexpr std::chrono::seconds full_cache_window{1};
+    // Reads of entries with more versions than this request the versions to
+    // be merged, see request_version_merge().
+    static constexpr unsigned max_read_versions = 2;
+    using merge_queue_type = bi::list<cache_entry,
+        bi::member_hook<cache_entry, cache_entry::merge_link_type, &cache_entry::_merge_link>,
+        bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+private:
+    static constexpr size_t rows_per_merge_step = 64;
+    static constexpr unsigned merge_steps_per_task = 16;
 private:
     uint64_t _hits = 0;
     uint64_t _misses = 0;
@@ -180,32 +257,93 @@ class cache_tracker final {
     uint64_t _partitions = 0;
     uint64_t _modification_count = 0;
     uint64_t _continuity_flags_cleared = 0;
+    uint64_t _protected_partitions = 0;
+    uint64_t _admission_rejections = 0;
+    uint64_t _bypasses = 0;
+    uint64_t _version_merges = 0;
+    uint64_t _partition_compactions = 0;
+    cell_compression::stats _compression_stats;
+    std::chrono::steady_clock::time_point _last_eviction;
     std::unique_ptr<scollectd::registrations> _collectd_registrations;
     logalloc::region _region;
+    // The protected segment.
     lru_type _lru;
+    lru_type _probation;
+    utils::frequency_sketch _sketch;
+    merge_queue_type _merge_queue;
+    timer<> _merge_timer;
+    logalloc::allocating_section _merge_section;
 private:
     void setup_collectd();
+    void merge_versions();
+    void evict_one();
+    void unlink(cache_entry&);
+    static uint64_t hash_of(const schema& s, const dht::token& t);
 public:
     cache_tracker();
     ~cache_tracker();
     void clear();
+    // Evicts least recently used entries until their memory dropped by
+    // the given amount of bytes or the cache is empty. Returns the amount of
+    // memory evicted.
+    size_t evict(size_t bytes);
+    // Marks a use of an entry, which moves it to the protected segment.
     void touch(cache_entry&);
     void insert(cache_entry&);
     void clear_continuity(cache_entry& ce);
-    void on_erase();
+    // Records a point read of a partition, hit or miss.
+    void on_access(const schema&, const dht::decorated_key&);
+    // Whether a partition missed by a point read should be cached.
+    bool should_admit(const schema&, const dht::decorated_key&);
+    void on_erase(const cache_entry&);
     void on_merge();
     void on_hit();
     void on_miss();
     void on_miss_already_populated();
     void on_uncached_wide_partition();
     void on_continuity_flag_cleared();
+    void on_bypass();
+    void on_partition_compaction();
+    // Queues merging of the versions of the entry which no snapshot refers
+    // to. Merging is done in the background, in steps of bounded size, so
+    // reads of frequently updated partitions don't pay for the versions
+    // updates leave behind.
+    void request_version_merge(cache_entry&);
     allocation_strategy& allocator();
     logalloc::region& region();
     const logalloc::region& region() const;
     uint64_t modification_count() const { return _modification_count; }
     uint64_t partitions() const { return _partitions; }
+    uint64_t hits() const { return _hits; }
+    uint64_t misses() const { return _misses; }
+    uint64_t insertions() const { return _insertions; }
+    uint64_t evictions() const { return _evictions; }
     uint64_t uncached_wide_partitions() const { return _uncached_wide_partitions; }
     uint64_t continuity_flags_cleared() const { return _continuity_flags_cleared; }
+    uint64_t bypasses() const { return _bypasses; }
+    uint64_t version_merges() const { return _version_merges; }
+    uint64_t partition_compactions() const { return _partition_compactions; }
+    uint64_t protected_partitions() const { return _protected_partitions; }
+    uint64_t admission_rejections() const { return _admission_rejections; }
+    cell_compression::stats& compression_stats() { return _compression_stats; }
+    const cell_compression::stats& compression_stats() const { return _compression_stats; }
+
+    // Invokes func(const cache_entry&) for cached partitions, the protected
+    // ones first, most recently used first, until func returns
+    // stop_iteration::yes. The callback must not defer or modify the cache.
+    // Keys of visited entries are linearized.
+    template<typename Func>
+    void for_each_hot_entry(Func&& func) const {
+        with_linearized_managed_bytes([&] {
+            for (auto* lru : { &_lru, &_probation }) {
+                for (const cache_entry& e : *lru) {
+                    if (func(e) == stop_iteration::yes) {
+                        return;
+                    }
+                }
+            }
+        });
+    }
 };
 
 // Returns a reference to shard-wide cache_tracker.
@@ -229,6 +367,8 @@ class row_cache final {
         bi::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
         bi::compare<cache_entry::compare>>;
     friend class single_partition_populating_reader;
+    friend class wide_partition_populating_reader;
+    friend class populating_streamed_mutation;
     friend class cache_entry;
 public:
     struct stats {
@@ -257,6 +397,7 @@ class row_cache final {
     logalloc::allocating_section _update_section;
     logalloc::allocating_section _populate_section;
     logalloc::allocating_section _read_section;
+    logalloc::allocating_section _compact_section;
     mutation_reader make_scanning_reader(schema_ptr,
                                          const query::partition_range&,
                                          const io_priority_class& pc,
@@ -264,11 +405,17 @@ class row_cache final {
     void on_hit();
     void on_miss();
     void on_uncached_wide_partition();
+    // Reads given clustering ranges of a wide partition from the underlying
+    // source, populating the cache entry with them once they are fully read.
+    future<streamed_mutation_opt> read_and_populate_wide(schema_ptr, dht::decorated_key,
+        query::clustering_key_filtering_context, const io_priority_class&);
     void upgrade_entry(cache_entry&);
     void invalidate_locked(const dht::decorated_key&);
-    void invalidate_unwrapped(const query::partition_range&);
+    void invalidate_unwrapped(const query::partition_range&, const partition_filter& = {});
     void clear_now() noexcept;
     static thread_local seastar::thread_scheduling_group _update_thread_scheduling_group;
+    // How many rows of a partition update() merges between checks for preemption.
+    static constexpr size_t rows_per_update_step = 64;
 public:
     ~row_cache();
     row_cache(schema_ptr, mutation_source underlying, key_source, cache_tracker&, uint64_t _max_cached_partition_size_in_bytes = 10 * 1024 * 1024);
@@ -286,14 +433,26 @@ class row_cache final {
                                 const io_priority_class& = default_priority_class());
 
     const stats& stats() const { return _stats; }
+
+    // Records a read of the underlying data which skipped the cache.
+    void on_bypass();
 public:
     // Populate cache from given mutation. The mutation must contain all
     // information there is for its partition in the underlying data sources.
-    void populate(const mutation& m);
+    // Partitions read by point reads go through the admission policy of
+    // cache_tracker, those read by scans are always cached, as probationary.
+    enum class populate_source { point_read, scan };
+    void populate(const mutation& m, populate_source source = populate_source::scan);
 
     // Caches an information that a partition with a given key is wide.
     void mark_partition_as_wide(const dht::decorated_key& key);
 
+    // Populates a wide partition entry with data for given clustering ranges.
+    // The mutation must contain all information there is in the underlying
+    // data sources for those ranges. Does nothing if the entry is not present
+    // or is not wide.
+    void populate_wide(const mutation& m, const query::clustering_row_ranges& ranges);
+
     // Clears the cache.
     // Guarantees that cache will not be populated using readers created
     // before this method was invoked.
@@ -308,6 +467,15 @@ class row_cache final {
     // Moves given partition to the front of LRU if present in cache.
     void touch(const dht::decorated_key&);
 
+    // Compacts up to max_partitions cached partitions following last, and
+    // sets last to the last one visited. Expired cells become tombstones,
+    // which are dropped together with the data they cover once they are
+    // past gc_grace_seconds, as reads would. Partitions which are being read,
+    // are wide or have more than max_rows rows are skipped. Returns
+    // stop_iteration::yes when there are no partitions past last.
+    stop_iteration compact_expired(std::experimental::optional<dht::ring_position>& last, gc_clock::time_point now,
+        size_t max_partitions, size_t max_rows);
+
     // Removes given partition from cache.
     //
     // Guarantees that cache will not be populated with given key
@@ -325,6 +493,28 @@ class row_cache final {
     // The range must be kept alive until method resolves.
     future<> invalidate(const query::partition_range&);
 
+    // Removes from cache the partitions of given range for which filter
+    // returns true, and clears continuity in that range, as it may have
+    // gained partitions which aren't cached. For when the underlying source
+    // gains data for a known set of partitions, e.g. by new sstables.
+    // The range can be a wrap around.
+    //
+    // Same guarantees as invalidate(const query::partition_range&) for the
+    // partitions matched by filter.
+    //
+    // The range must be kept alive until method resolves.
+    using partition_filter = std::function<bool(const dht::decorated_key&)>;
+    future<> invalidate(const query::partition_range&, partition_filter filter);
+
+    // Removes the partitions present in given memtable from cache. For a
+    // memtable which was written to the underlying source without being
+    // merged into cache. Same guarantees as invalidate(const dht::decorated_key&)
+    // for each of them.
+    //
+    // The memtable must be kept alive and must not be written until method
+    // resolves.
+    future<> invalidate(const memtable&);
+
     bool has_continuous_entry(const dht::ring_position& key) const;
 
     auto num_entries() const {
@@ -117,6 +117,10 @@ void schema::rebuild() {
         _column_mapping = column_mapping(std::move(cm_columns), static_columns_count());
     }
 
+    _is_counter = boost::algorithm::any_of(boost::range::join(static_columns(), regular_columns()), [] (const column_definition& def) {
+        return def.is_counter();
+    });
+
     thrift()._compound = is_compound();
     thrift()._is_dynamic = clustering_key_size() > 0;
 }
@@ -322,7 +326,8 @@ bool operator==(const schema& x, const schema& y)
         && x._raw._compaction_strategy_options == y._raw._compaction_strategy_options
         && x._raw._caching_options == y._raw._caching_options
         && x._raw._dropped_columns == y._raw._dropped_columns
-        && x._raw._collections == y._raw._collections;
+        && x._raw._collections == y._raw._collections
+        && x._raw._view_info == y._raw._view_info;
 #if 0
         && Objects.equal(triggers, other.triggers)
 #endif
@@ -540,8 +545,8 @@ void schema_builder::add_default_index_names(database& db) {
 
     auto existing_names = db.existing_index_names();
     for (auto& sc : _raw._columns) {
-        if (sc.idx_info.index_type != index_type::none && sc.idx_info.index_name) {
-            sstring base_name = cf_name() + "_" + *sc.idx_info.index_name + "_idx";
+        if (sc.idx_info.index_type != index_type::none && !sc.idx_info.index_name) {
+            sstring base_name = cf_name() + "_" + sc.name_as_text() + "_idx";
             auto i = std::remove_if(base_name.begin(), base_name.end(), [](char c) {
                return ::isspace(c);
             });
@@ -627,6 +632,14 @@ schema_builder& schema_builder::with_altered_column_type(bytes name, data_type n
     return *this;
 }
 
+schema_builder& schema_builder::with_index(bytes name, index_info info)
+{
+    auto it = boost::find_if(_raw._columns, [&name] (auto& c) { return c.name() == name; });
+    assert(it != _raw._columns.end());
+    it->idx_info = std::move(info);
+    return *this;
+}
+
 schema_builder& schema_builder::with_collection(bytes name, data_type type)
 {
     _raw._collections.emplace(name, type);
@@ -232,6 +232,7 @@ class column_definition final {
     bool is_clustering_key() const { return kind == column_kind::clustering_key; }
     bool is_primary_key() const { return kind == column_kind::partition_key || kind == column_kind::clustering_key; }
     bool is_atomic() const { return _is_atomic; }
+    bool is_counter() const { return type->is_counter(); }
     bool is_compact_value() const { return kind == column_kind::compact_column; }
     const sstring& name_as_text() const;
     const bytes& name() const;
@@ -330,6 +331,19 @@ class column_mapping {
     }
 };
 
+// Definition of a materialized view, present in the schemas of view tables.
+// The base table is in the same keyspace as the view.
+struct view_info {
+    utils::UUID base_id;
+    sstring base_name;
+    // Whether the view was created with SELECT *.
+    bool include_all_columns;
+
+    bool operator==(const view_info& o) const {
+        return base_id == o.base_id && base_name == o.base_name && include_all_columns == o.include_all_columns;
+    }
+};
+
 /*
  * Effectively immutable.
  * Not safe to access across cores because of shared_ptr's.
@@ -373,6 +387,7 @@ class schema final : public enable_lw_shared_from_this<schema> {
         table_schema_version _version;
         std::unordered_map<sstring, api::timestamp_type> _dropped_columns;
         std::map<bytes, data_type> _collections;
+        std::experimental::optional<::view_info> _view_info;
     };
     raw_schema _raw;
     thrift_schema _thrift;
@@ -389,6 +404,9 @@ class schema final : public enable_lw_shared_from_this<schema> {
     lw_shared_ptr<compound_type<allow_prefixes::no>> _partition_key_type;
     lw_shared_ptr<compound_type<allow_prefixes::yes>> _clustering_key_type;
     column_mapping _column_mapping;
+    // Set if the table has counter columns, which then are all of its
+    // regular and static columns.
+    bool _is_counter = false;
     friend class schema_builder;
 public:
     using row_column_ids_are_ordered_by_name = std::true_type;
@@ -460,7 +478,16 @@ class schema final : public enable_lw_shared_from_this<schema> {
         return _raw._comment;
     }
     bool is_counter() const {
-        return false;
+        return _is_counter;
+    }
+
+    bool is_view() const {
+        return bool(_raw._view_info);
+    }
+
+    // Requires is_view().
+    const ::view_info& view_info() const {
+        return *_raw._view_info;
     }
 
     const cf_type type() const {
@@ -196,6 +196,11 @@ struct schema_builder {
         return *this;
     }
 
+    schema_builder& with_view_info(utils::UUID base_id, sstring base_name, bool include_all_columns) {
+        _raw._view_info = view_info{std::move(base_id), std::move(base_name), include_all_columns};
+        return *this;
+    }
+
     column_definition& find_column(const cql3::column_identifier&);
     schema_builder& with_column(const column_definition& c);
     schema_builder& with_column(bytes name, data_type type, column_kind kind = column_kind::regular_column);
@@ -205,6 +210,7 @@ struct schema_builder {
     schema_builder& without_column(sstring name, api::timestamp_type timestamp);
     schema_builder& with_column_rename(bytes from, bytes to);
     schema_builder& with_altered_column_type(bytes name, data_type new_type);
+    schema_builder& with_index(bytes name, index_info info);
 
     // Adds information about collection that existed in the past but the column
     // has since been removed. For adding colllections that are still alive
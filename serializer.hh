@@ -22,6 +22,7 @@
 
 #include <vector>
 #include <array>
+#include <type_traits>
 #include "core/sstring.hh"
 #include <unordered_map>
 #include <experimental/optional>
@@ -52,6 +53,12 @@ inline void serialize_integral(Output& output, T data) {
 template<typename T>
 struct serializer;
 
+// Types whose in-memory representation on a little endian machine is the same
+// as their serialized form, so that arrays of them can be copied in and out of
+// buffers as a whole. Classes are marked with [[trivially_serializable]] in the IDL.
+template<typename T>
+struct is_trivially_serializable : std::integral_constant<bool, !std::is_same<T, bool>::value && std::is_integral<T>::value> {};
+
 template<typename T>
 struct integral_serializer {
     template<typename Input>
@@ -50,7 +50,7 @@ void safe_serialize_as_uint32(Output& out, uint64_t data) {
 
 template<typename T>
 constexpr bool can_serialize_fast() {
-    return !std::is_same<T, bool>::value && std::is_integral<T>::value && (sizeof(T) == 1 || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+    return is_trivially_serializable<T>::value && (sizeof(T) == 1 || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
 }
 
 template<bool Fast, typename T>
@@ -302,8 +302,11 @@ struct serializer<bytes_ostream> {
     static bytes_ostream read(Input& in) {
         auto sz = deserialize(in, boost::type<uint32_t>());
         bytes_ostream v;
-        auto dst = v.write_place_holder(sz);
-        in.read(reinterpret_cast<char*>(dst), sz);
+        while (sz) {
+            auto n = std::min<uint32_t>(sz, uint32_t(bytes_ostream::max_chunk_size));
+            in.read(reinterpret_cast<char*>(v.write_place_holder(n)), n);
+            sz -= n;
+        }
         return v;
     }
     template<typename Output>
@@ -114,6 +114,12 @@ class client_state {
         }
     }
 
+    // Keeps track of the request for the slow query log only. The session ID
+    // isn't returned to the client, which didn't ask for tracing.
+    void create_slow_query_tracing_session(tracing::trace_type type) {
+        _trace_state_ptr = tracing::tracing::get_local_tracing_instance().create_slow_query_session(type);
+    }
+
     tracing::trace_state_ptr& get_trace_state() {
         return _trace_state_ptr;
     }
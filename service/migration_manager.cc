@@ -48,6 +48,7 @@
 #include "service/migration_task.hh"
 #include "utils/runtime.hh"
 #include "gms/gossiper.hh"
+#include <seastar/core/scollectd.hh>
 
 namespace service {
 
@@ -58,15 +59,46 @@ distributed<service::migration_manager> _the_migration_manager;
 using namespace std::chrono_literals;
 
 const std::chrono::milliseconds migration_manager::migration_delay = 60000ms;
+const std::chrono::milliseconds migration_manager::schema_pull_retry_delay = 1000ms;
+// Long enough for the pushing node's own definitions update to be applied.
+const std::chrono::seconds migration_manager::pushed_schema_expiry = 60s;
 
 migration_manager::migration_manager()
     : _listeners{}
+    , _pushed_schemas_timer([this] { expire_pushed_schemas(); })
 {
+    setup_collectd();
+}
+
+migration_manager::~migration_manager()
+{ }
+
+void migration_manager::setup_collectd()
+{
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("migration_manager"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "schema_learn_waits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.schema_learn_waits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("migration_manager"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "schema_fetches")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.schema_fetches)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("migration_manager"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "schema_pushes_received")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.schema_pushes_received)
+        ),
+    }));
 }
 
 future<> migration_manager::stop()
 {
     uninit_messaging_service();
+    _pushed_schemas_timer.cancel();
+    _pushed_schemas.clear();
     return make_ready_future<>();
 }
 
@@ -94,6 +126,19 @@ void migration_manager::init_messaging_service()
     ms.register_schema_check([] {
         return make_ready_future<utils::UUID>(service::get_local_storage_service().db().local().get_version());
     });
+    ms.register_schema_push([] (const rpc::client_info& cinfo, std::vector<frozen_schema> schemas) {
+        auto src = net::messaging_service::get_source(cinfo);
+        do_with(std::move(schemas), [] (const std::vector<frozen_schema>& schemas) {
+            return get_migration_manager().invoke_on_all([&schemas] (migration_manager& mm) {
+                mm.hold_pushed_schemas(schemas);
+            });
+        }).then_wrapped([src] (auto&& f) {
+            if (f.failed()) {
+                logger.warn("Failed to learn schemas pushed by {}: {}", src, f.get_exception());
+            }
+        });
+        return net::messaging_service::no_wait();
+    });
 }
 
 void migration_manager::uninit_messaging_service()
@@ -102,6 +147,47 @@ void migration_manager::uninit_messaging_service()
     ms.unregister_migration_request();
     ms.unregister_definitions_update();
     ms.unregister_schema_check();
+    ms.unregister_schema_push();
+}
+
+void migration_manager::hold_pushed_schemas(const std::vector<frozen_schema>& schemas)
+{
+    auto expiry = lowres_clock::now() + pushed_schema_expiry;
+    for (auto&& fs : schemas) {
+        schema_ptr s;
+        try {
+            s = fs.unfreeze();
+        } catch (...) {
+            // Requests with this version will fetch it instead.
+            logger.debug("Failed to unfreeze pushed schema: {}", std::current_exception());
+            continue;
+        }
+        logger.debug("Learning pushed version {} of {}.{}", s->version(), s->ks_name(), s->cf_name());
+        // Completes loading of the version if requests are already waiting for it.
+        s = local_schema_registry().get_or_load(s->version(), [&fs] (table_schema_version) {
+            return fs;
+        });
+        _pushed_schemas[s->version()] = std::make_pair(std::move(s), expiry);
+        ++_stats.schema_pushes_received;
+    }
+    if (!_pushed_schemas_timer.armed()) {
+        _pushed_schemas_timer.arm(pushed_schema_expiry);
+    }
+}
+
+void migration_manager::expire_pushed_schemas()
+{
+    auto now = lowres_clock::now();
+    for (auto i = _pushed_schemas.begin(); i != _pushed_schemas.end();) {
+        if (i->second.second <= now) {
+            i = _pushed_schemas.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    if (!_pushed_schemas.empty()) {
+        _pushed_schemas_timer.arm(pushed_schema_expiry);
+    }
 }
 
 void migration_manager::register_listener(migration_listener* listener)
@@ -150,6 +236,8 @@ bool migration_manager::is_ready_for_bootstrap() {
 /**
  * If versions differ this node sends request with local migration list to the endpoint
  * and expecting to receive a list of migrations to apply locally.
+ *
+ * Requests for a version which is already being pulled are merged into that pull.
  */
 future<> migration_manager::maybe_schedule_schema_pull(const utils::UUID& their_version, const gms::inet_address& endpoint)
 {
@@ -160,32 +248,95 @@ future<> migration_manager::maybe_schedule_schema_pull(const utils::UUID& their_
         return make_ready_future<>();
     }
 
+    auto i = _schema_pulls.find(their_version);
+    if (i != _schema_pulls.end()) {
+        auto& endpoints = i->second->endpoints;
+        if (std::find(endpoints.begin(), endpoints.end(), endpoint) == endpoints.end()) {
+            endpoints.push_back(endpoint);
+        }
+        logger.debug("Schema pull for version {} already scheduled, adding {} as a candidate", their_version, endpoint);
+        return i->second->done.get_shared_future();
+    }
+
+    auto pull = make_lw_shared<schema_pull>();
+    pull->endpoints.push_back(endpoint);
+    _schema_pulls.emplace(their_version, pull);
+
+    future<> f = make_ready_future<>();
     if (db.get_version() == database::empty_version || runtime::get_uptime() < migration_delay) {
         // If we think we may be bootstrapping or have recently started, submit MigrationTask immediately
         logger.debug("Submitting migration task for {}", endpoint);
-        return submit_migration_task(endpoint);
+        f = do_schema_pull(their_version, pull);
     } else {
         // Include a delay to make sure we have a chance to apply any changes being
         // pushed out simultaneously. See CASSANDRA-5025
-        return sleep(migration_delay).then([this, &proxy, endpoint] {
+        f = sleep(migration_delay).then([this, their_version, pull] {
+            return do_schema_pull(their_version, pull);
+        });
+    }
+    f.then_wrapped([this, their_version, pull] (future<> f) {
+        auto i = _schema_pulls.find(their_version);
+        if (i != _schema_pulls.end() && i->second == pull) {
+            _schema_pulls.erase(i);
+        }
+        if (f.failed()) {
+            pull->done.set_exception(f.get_exception());
+        } else {
+            pull->done.set_value();
+        }
+    });
+    return pull->done.get_shared_future();
+}
+
+// Pulls schema from the first candidate which still announces their_version,
+// moving on to the next one with a growing delay if the pull fails.
+future<> migration_manager::do_schema_pull(utils::UUID their_version, lw_shared_ptr<schema_pull> pull)
+{
+    return do_with(size_t(0), std::chrono::milliseconds(schema_pull_retry_delay), std::exception_ptr(),
+            [this, their_version, pull] (size_t& next, std::chrono::milliseconds& retry_delay, std::exception_ptr& error) {
+        return repeat([this, their_version, pull, &next, &retry_delay, &error] {
+            // Candidates may be added while we wait
+            if (next == pull->endpoints.size()) {
+                if (error) {
+                    return make_exception_future<stop_iteration>(error);
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto endpoint = pull->endpoints[next++];
             // grab the latest version of the schema since it may have changed again since the initial scheduling
-            auto& gossiper = gms::get_local_gossiper();
-            auto ep_state = gossiper.get_endpoint_state_for_endpoint(endpoint);
+            auto& db = get_local_storage_proxy().get_db().local();
+            if (db.get_version() == their_version) {
+                logger.debug("Not submitting migration task for {} because our versions match", endpoint);
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto ep_state = gms::get_local_gossiper().get_endpoint_state_for_endpoint(endpoint);
             if (!ep_state) {
                 logger.debug("epState vanished for {}, not submitting migration task", endpoint);
-                return make_ready_future<>();
+                return make_ready_future<stop_iteration>(stop_iteration::no);
             }
             const auto& value = ep_state->get_application_state(gms::application_state::SCHEMA);
-            utils::UUID current_version{value->value};
-            auto& db = proxy.get_db().local();
-            if (db.get_version() == current_version) {
-                logger.debug("not submitting migration task for {} because our versions match", endpoint);
-                return make_ready_future<>();
+            if (!value || utils::UUID{value->value} != their_version) {
+                // Its current version, if still different from ours, is pulled on its own
+                logger.debug("{} no longer has schema version {}, not submitting migration task", endpoint, their_version);
+                return make_ready_future<stop_iteration>(stop_iteration::no);
+            }
+            if (!ep_state->is_alive() || !should_pull_schema_from(endpoint)) {
+                return make_ready_future<stop_iteration>(stop_iteration::no);
             }
-            logger.debug("submitting migration task for {}", endpoint);
-            return submit_migration_task(endpoint);
+            logger.debug("Submitting migration task for {}", endpoint);
+            return submit_migration_task(endpoint).then([] {
+                return stop_iteration::yes;
+            }).handle_exception([endpoint, &retry_delay, &error] (std::exception_ptr ep) {
+                logger.warn("Failed to pull schema from {}: {}", endpoint, ep);
+                error = ep;
+                auto delay = retry_delay;
+                retry_delay = std::min(retry_delay * 2, migration_delay);
+                return sleep(delay).then([] {
+                    return stop_iteration::no;
+                });
+            });
         });
-    }
+    });
 }
 
 future<> migration_manager::submit_migration_task(const gms::inet_address& endpoint)
@@ -440,7 +591,9 @@ future<> migration_manager::announce_new_column_family(schema_ptr cfm, bool anno
         }
         logger.info("Create new ColumnFamily: {}", cfm);
         auto mutations = db::schema_tables::make_create_table_mutations(keyspace.metadata(), cfm, api::new_timestamp());
-        return announce(std::move(mutations), announce_locally);
+        return announce(std::move(mutations), announce_locally).then([id = cfm->id(), announce_locally] {
+            return announce_locally ? make_ready_future<>() : push_schema_versions({id});
+        });
     } catch (const no_such_keyspace& e) {
         throw exceptions::configuration_exception(sprint("Cannot add table '%s' to non existing keyspace '%s'.", cfm->cf_name(), cfm->ks_name()));
     }
@@ -460,7 +613,9 @@ future<> migration_manager::announce_column_family_update(schema_ptr cfm, bool f
         logger.info("Update table '{}.{}' From {} To {}", cfm->ks_name(), cfm->cf_name(), *old_schema, *cfm);
         auto&& keyspace = db.find_keyspace(cfm->ks_name());
         auto mutations = db::schema_tables::make_update_table_mutations(keyspace.metadata(), old_schema, cfm, api::new_timestamp(), from_thrift);
-        return announce(std::move(mutations), announce_locally);
+        return announce(std::move(mutations), announce_locally).then([id = old_schema->id(), announce_locally] {
+            return announce_locally ? make_ready_future<>() : push_schema_versions({id});
+        });
     } catch (const no_such_column_family& e) {
         throw exceptions::configuration_exception(sprint("Cannot update non existing table '%s' in keyspace '%s'.",
                                                          cfm->cf_name(), cfm->ks_name()));
@@ -617,17 +772,48 @@ future<> migration_manager::push_schema_mutation(const gms::inet_address& endpoi
     return net::get_local_messaging_service().send_definitions_update(id, std::move(fm));
 }
 
+// Only push schema to nodes with known and equal versions
+static bool should_push_schema_to(const gms::inet_address& endpoint) {
+    return endpoint != utils::fb_utilities::get_broadcast_address() &&
+        net::get_local_messaging_service().knows_version(endpoint) &&
+        net::get_local_messaging_service().get_raw_version(endpoint) ==
+        net::messaging_service::current_version;
+}
+
+future<> migration_manager::push_schema_versions(std::vector<utils::UUID> cf_ids)
+{
+    auto& db = get_local_storage_proxy().get_db().local();
+    std::vector<frozen_schema> schemas;
+    for (auto&& id : cf_ids) {
+        try {
+            schemas.emplace_back(db.find_schema(id));
+        } catch (const no_such_column_family&) {
+            // Dropped concurrently, nothing to push.
+        }
+    }
+    if (schemas.empty()) {
+        return make_ready_future<>();
+    }
+    return do_with(std::move(schemas), [live_members = gms::get_local_gossiper().get_live_members()] (auto& schemas) {
+        return parallel_for_each(live_members.begin(), live_members.end(), [&schemas] (auto& endpoint) {
+            if (!should_push_schema_to(endpoint)) {
+                return make_ready_future<>();
+            }
+            net::messaging_service::msg_addr id{endpoint, 0};
+            return net::get_local_messaging_service().send_schema_push(id, schemas).handle_exception([endpoint] (auto ep) {
+                logger.debug("Failed to push schema versions to {}: {}", endpoint, ep);
+            });
+        });
+    });
+}
+
 // Returns a future on the local application of the schema
 future<> migration_manager::announce(std::vector<mutation> schema) {
     auto f = db::schema_tables::merge_schema(get_storage_proxy(), schema);
 
     return do_with(std::move(schema), [live_members = gms::get_local_gossiper().get_live_members()](auto && schema) {
         return parallel_for_each(live_members.begin(), live_members.end(), [&schema](auto& endpoint) {
-            // only push schema to nodes with known and equal versions
-            if (endpoint != utils::fb_utilities::get_broadcast_address() &&
-                net::get_local_messaging_service().knows_version(endpoint) &&
-                net::get_local_messaging_service().get_raw_version(endpoint) ==
-                net::messaging_service::current_version) {
+            if (should_push_schema_to(endpoint)) {
                 return push_schema_mutation(endpoint, schema);
             } else {
                 return make_ready_future<>();
@@ -748,14 +934,33 @@ static future<> maybe_sync(const schema_ptr& s, net::messaging_service::msg_addr
     });
 }
 
-future<schema_ptr> get_schema_definition(table_schema_version v, net::messaging_service::msg_addr dst) {
-    return local_schema_registry().get_or_load(v, [dst] (table_schema_version v) {
+// Shards other than 0 learn unknown versions from shard 0, so that all
+// requests of a node which wait for a version share a single fetch of it.
+static future<schema_ptr> load_schema_definition(table_schema_version v, net::messaging_service::msg_addr dst) {
+    return local_schema_registry().get_or_load(v, [dst] (table_schema_version v) -> future<frozen_schema> {
+        if (engine().cpu_id() != 0) {
+            return smp::submit_to(0, [v, dst] {
+                return load_schema_definition(v, dst).then([] (schema_ptr s) {
+                    return frozen_schema(s);
+                });
+            });
+        }
         logger.debug("Requesting schema {} from {}", v, dst);
+        ++get_local_migration_manager().get_stats().schema_fetches;
         auto& ms = net::get_local_messaging_service();
         return ms.send_get_schema_version(dst, v);
     });
 }
 
+future<schema_ptr> get_schema_definition(table_schema_version v, net::messaging_service::msg_addr dst) {
+    auto s = local_schema_registry().get_or_null(v);
+    if (s) {
+        return make_ready_future<schema_ptr>(std::move(s));
+    }
+    ++get_local_migration_manager().get_stats().schema_learn_waits;
+    return load_schema_definition(v, dst);
+}
+
 future<schema_ptr> get_schema_for_read(table_schema_version v, net::messaging_service::msg_addr dst) {
     return get_schema_definition(v, dst);
 }
@@ -45,19 +45,63 @@
 #include "gms/endpoint_state.hh"
 #include "db/schema_tables.hh"
 #include "core/distributed.hh"
+#include "core/shared_future.hh"
+#include "core/timer.hh"
+#include "frozen_schema.hh"
 #include "gms/inet_address.hh"
 #include "utils/UUID.hh"
 
 #include <vector>
+#include <unordered_map>
+
+namespace scollectd {
+
+struct registrations;
+
+}
 
 namespace service {
 
 class migration_manager : public seastar::async_sharded_service<migration_manager> {
+public:
+    struct stats {
+        // Requests which had to wait for the schema of their version to be
+        // learnt, and requests for it sent to other nodes.
+        uint64_t schema_learn_waits = 0;
+        uint64_t schema_fetches = 0;
+        // Schema versions learnt from pushes of other nodes.
+        uint64_t schema_pushes_received = 0;
+    };
+private:
     std::vector<migration_listener*> _listeners;
+    stats _stats;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+
+    // Schemas pushed by other nodes, kept alive for a while so that the
+    // registry doesn't forget them before requests using them arrive, and
+    // dropped by _pushed_schemas_timer.
+    std::unordered_map<table_schema_version, std::pair<schema_ptr, lowres_clock::time_point>> _pushed_schemas;
+    timer<lowres_clock> _pushed_schemas_timer;
+
+    // A schema pull scheduled or in progress for a given remote version.
+    struct schema_pull {
+        // Nodes announcing the version, in the order they were noticed.
+        std::vector<gms::inet_address> endpoints;
+        shared_promise<> done;
+    };
+    // Nodes announcing a version which is being pulled already join that
+    // pull, so that one schema change results in one pull per node rather
+    // than one per pair of nodes.
+    std::unordered_map<utils::UUID, lw_shared_ptr<schema_pull>> _schema_pulls;
 
     static const std::chrono::milliseconds migration_delay;
+    // Delay before pulling from the next candidate after a failed pull,
+    // doubled after every failure.
+    static const std::chrono::milliseconds schema_pull_retry_delay;
+    static const std::chrono::seconds pushed_schema_expiry;
 public:
     migration_manager();
+    ~migration_manager();
 
     /// Register a migration listener on current shard.
     void register_listener(migration_listener* listener);
@@ -123,6 +167,17 @@ class migration_manager : public seastar::async_sharded_service<migration_manage
 
     static future<> push_schema_mutation(const gms::inet_address& endpoint, const std::vector<mutation>& schema);
 
+    // Pushes the current schemas of given tables to all live nodes, so that
+    // they don't have to fetch them to serve requests with the new versions.
+    // Best effort, doesn't fail.
+    static future<> push_schema_versions(std::vector<utils::UUID> cf_ids);
+
+    // Makes the schemas pushed by another node known to the registry of
+    // this shard. See _pushed_schemas.
+    void hold_pushed_schemas(const std::vector<frozen_schema>& schemas);
+
+    stats& get_stats() { return _stats; }
+
     // Returns a future on the local application of the schema
     static future<> announce(std::vector<mutation> schema);
 
@@ -135,6 +190,10 @@ class migration_manager : public seastar::async_sharded_service<migration_manage
     void init_messaging_service();
 private:
     void uninit_messaging_service();
+    void setup_collectd();
+    void expire_pushed_schemas();
+
+    future<> do_schema_pull(utils::UUID their_version, lw_shared_ptr<schema_pull> pull);
 };
 
 extern distributed<migration_manager> _the_migration_manager;
@@ -54,9 +54,11 @@ class paging_state final {
     partition_key _partition_key;
     std::experimental::optional<clustering_key> _clustering_key;
     uint32_t _remaining;
+    uint32_t _rows_fetched_for_last_partition;
 
 public:
-    paging_state(partition_key pk, std::experimental::optional<clustering_key> ck, uint32_t rem);
+    paging_state(partition_key pk, std::experimental::optional<clustering_key> ck, uint32_t rem,
+            uint32_t rows_fetched_for_last_partition = 0);
 
     /**
      * Last processed key, i.e. where to start from in next paging round
@@ -77,6 +79,13 @@ class paging_state final {
     uint32_t get_remaining() const {
         return _remaining;
     }
+    /**
+     * Number of rows of the last partition returned so far, for queries
+     * with a per partition limit.
+     */
+    uint32_t get_rows_fetched_for_last_partition() const {
+        return _rows_fetched_for_last_partition;
+    }
 
     static ::shared_ptr<paging_state> deserialize(bytes_opt bytes);
     bytes_opt serialize() const;
@@ -44,6 +44,8 @@
 #include "cql3/selection/selection.hh"
 #include "log.hh"
 #include "to_string.hh"
+#include "database.hh"
+#include "db/config.hh"
 
 static logging::logger logger("paging");
 
@@ -72,6 +74,7 @@ class service::pager::query_pagers::impl : public query_pager {
             _max = state->get_remaining();
             _last_pkey = state->get_partition_key();
             _last_ckey = state->get_clustering_key();
+            _rows_fetched_for_last_partition = state->get_rows_fetched_for_last_partition();
         }
 
         if (_last_pkey) {
@@ -127,7 +130,11 @@ class service::pager::query_pagers::impl : public query_pager {
             // last ck can be empty depending on whether we
             // deserialized state or not. This case means "last page ended on
             // something-not-bound-by-clustering" (i.e. a static row, alone)
-            const bool has_ck = _has_clustering_keys && _last_ckey;
+            //
+            // A partition which already returned its per partition limit of
+            // rows is skipped like one without clustering keys.
+            const bool has_ck = _has_clustering_keys && _last_ckey
+                    && _rows_fetched_for_last_partition < _cmd->slice.partition_row_limit();
 
             // If we have no clustering keys, it should mean we only have one row
             // per PK. Thus we can just bypass the last one.
@@ -160,6 +167,8 @@ class service::pager::query_pagers::impl : public query_pager {
                     query::partition_slice::option::send_clustering_key>();
         }
         _cmd->row_limit = max_rows;
+        auto max_page_size = get_local_storage_proxy().get_db().local().get_config().max_page_size_in_kb() * 1024;
+        _cmd->max_result_size = max_page_size ? max_page_size : query::max_result_size;
 
         logger.debug("Fetching {}, page size={}, max_rows={}",
                 _cmd->cf_id, page_size, max_rows
@@ -201,6 +210,15 @@ class service::pager::query_pagers::impl : public query_pager {
             std::experimental::optional<partition_key> last_pkey;
             std::experimental::optional<clustering_key> last_ckey;
 
+            // Replicas apply the per partition limit anew to the partition
+            // continued from the previous page, so the rows it returned on
+            // earlier pages count against the limit here.
+            uint32_t partition_row_limit;
+            uint32_t part_fetched_before = 0;
+            uint32_t part_included = 0;
+            uint32_t rows_fetched_for_last_partition = 0;
+            uint32_t partition_limited_rows = 0;
+
             // just for verbosity
             uint32_t part_ignored = 0;
 
@@ -209,11 +227,18 @@ class service::pager::query_pagers::impl : public query_pager {
             bool include_row() {
                 ++total_rows;
                 ++part_rows;
+                if (part_fetched_before + part_included >= partition_row_limit) {
+                    ++part_ignored;
+                    ++partition_limited_rows;
+                    return false;
+                }
                 if (included_rows >= page_size) {
                     ++part_ignored;
                     return false;
                 }
                 ++included_rows;
+                ++part_included;
+                rows_fetched_for_last_partition = part_fetched_before + part_included;
                 return true;
             }
 
@@ -221,16 +246,17 @@ class service::pager::query_pagers::impl : public query_pager {
                 if (!include_row()) {
                     return false;
                 }
-                if (included_rows == page_size) {
-                    last_ckey = key;
-                }
+                // Pages can end before filling up when rows are dropped for
+                // the per partition limit, so remember every included row.
+                last_ckey = key;
                 return true;
             }
             myvisitor(impl& i, uint32_t ps,
                     cql3::selection::result_set_builder& builder,
                     const schema& s,
                     const cql3::selection::selection& selection)
-                    : visitor(builder, s, selection), _impl(i), page_size(ps), _less(*_impl._schema) {
+                    : visitor(builder, s, selection), _impl(i), page_size(ps)
+                    , partition_row_limit(i._cmd->slice.partition_row_limit()), _less(*_impl._schema) {
             }
 
             void accept_new_partition(uint32_t) {
@@ -240,8 +266,13 @@ class service::pager::query_pagers::impl : public query_pager {
                 logger.trace("Begin partition: {} ({})", key, row_count);
                 part_rows = 0;
                 part_ignored = 0;
+                part_included = 0;
+                part_fetched_before = _impl._last_pkey && _impl._last_ckey && key.equal(*_impl._schema, *_impl._last_pkey)
+                        ? _impl._rows_fetched_for_last_partition : 0;
                 if (included_rows < page_size) {
                     last_pkey = key;
+                    last_ckey = { };
+                    rows_fetched_for_last_partition = part_fetched_before;
                 }
                 visitor::accept_new_partition(key, row_count);
             }
@@ -293,9 +324,13 @@ class service::pager::query_pagers::impl : public query_pager {
         }
 
         _max = _max - v.included_rows;
-        _exhausted = v.included_rows < page_size || _max == 0;
+        // Rows dropped for the per partition limit were still counted by
+        // replicas against the page. A page ended early by the size limit
+        // is short of rows without being the last one.
+        _exhausted = (v.included_rows + v.partition_limited_rows < page_size && !results->is_short_read()) || _max == 0;
         _last_pkey = v.last_pkey;
         _last_ckey = v.last_ckey;
+        _rows_fetched_for_last_partition = v.rows_fetched_for_last_partition;
 
         logger.debug("Fetched {}/{} rows, max_remain={} {}", v.included_rows, v.total_rows,
                 _max, _exhausted ? "(exh)" : "");
@@ -320,7 +355,7 @@ class service::pager::query_pagers::impl : public query_pager {
         return _exhausted ?
                         nullptr :
                         ::make_shared<const paging_state>(*_last_pkey,
-                                        _last_ckey, _max);
+                                        _last_ckey, _max, _rows_fetched_for_last_partition);
     }
 
 private:
@@ -329,6 +364,8 @@ class service::pager::query_pagers::impl : public query_pager {
     bool _exhausted = false;
     uint32_t _rem = 0;
     uint32_t _max;
+    // Rows of _last_pkey returned on previous pages.
+    uint32_t _rows_fetched_for_last_partition = 0;
 
     std::experimental::optional<partition_key> _last_pkey;
     std::experimental::optional<clustering_key> _last_ckey;
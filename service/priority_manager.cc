@@ -18,10 +18,49 @@
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "priority_manager.hh"
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <stdexcept>
 
 namespace service {
+
+static thread_local priority_class_shares configured_shares;
+
+const std::vector<sstring>& priority_manager::class_names() {
+    static const std::vector<sstring> names = {
+        "commitlog", "memtable_flush", "streaming_read", "streaming_write",
+        "query", "compaction", "cache_warmup", "repair_read", "bulk_export",
+    };
+    return names;
+}
+
+priority_class_shares parse_priority_class_shares(const std::unordered_map<sstring, sstring>& options) {
+    priority_class_shares shares;
+    auto& names = priority_manager::class_names();
+    for (auto&& o : options) {
+        if (std::find(names.begin(), names.end(), o.first) == names.end()) {
+            throw std::invalid_argument(sprint("unknown I/O priority class %s", o.first));
+        }
+        int64_t value;
+        try {
+            value = boost::lexical_cast<int64_t>(o.second);
+        } catch (const boost::bad_lexical_cast&) {
+            throw std::invalid_argument(sprint("invalid shares for I/O priority class %s: %s", o.first, o.second));
+        }
+        if (value < 1 || value > 1000) {
+            throw std::invalid_argument(sprint("shares for I/O priority class %s must be between 1 and 1000, but were %d", o.first, value));
+        }
+        shares.emplace(o.first, uint32_t(value));
+    }
+    return shares;
+}
+
+void set_priority_class_shares(priority_class_shares shares) {
+    configured_shares = std::move(shares);
+}
+
 priority_manager& get_local_priority_manager() {
-    static thread_local priority_manager pm = priority_manager();
+    static thread_local priority_manager pm = priority_manager(configured_shares);
     return pm;
 }
 }
@@ -21,8 +21,14 @@
 #include <seastar/core/future.hh>
 #include <seastar/core/distributed.hh>
 #include <seastar/core/reactor.hh>
+#include <unordered_map>
+#include <vector>
 
 namespace service {
+
+// Shares of I/O priority classes, by class name.
+using priority_class_shares = std::unordered_map<sstring, uint32_t>;
+
 class priority_manager {
     ::io_priority_class _commitlog_priority;
     ::io_priority_class _mt_flush_priority;
@@ -30,7 +36,15 @@ class priority_manager {
     ::io_priority_class _stream_write_priority;
     ::io_priority_class _sstable_query_read;
     ::io_priority_class _compaction_priority;
-
+    ::io_priority_class _cache_warmup_priority;
+    ::io_priority_class _repair_read_priority;
+    ::io_priority_class _bulk_export_priority;
+
+    // Classes not listed in shares get their built-in shares.
+    static ::io_priority_class register_class(const priority_class_shares& shares, sstring name, uint32_t default_shares) {
+        auto i = shares.find(name);
+        return engine().register_one_priority_class(name, i != shares.end() ? i->second : default_shares);
+    }
 public:
     const ::io_priority_class&
     commitlog_priority() {
@@ -62,17 +76,46 @@ class priority_manager {
         return _compaction_priority;
     }
 
-    priority_manager()
-        : _commitlog_priority(engine().register_one_priority_class("commitlog", 100))
-        , _mt_flush_priority(engine().register_one_priority_class("memtable_flush", 100))
-        , _stream_read_priority(engine().register_one_priority_class("streaming_read", 20))
-        , _stream_write_priority(engine().register_one_priority_class("streaming_write", 20))
-        , _sstable_query_read(engine().register_one_priority_class("query", 100))
-        , _compaction_priority(engine().register_one_priority_class("compaction", 100))
+    const ::io_priority_class&
+    cache_warmup_priority() {
+        return _cache_warmup_priority;
+    }
+
+    const ::io_priority_class&
+    repair_read_priority() {
+        return _repair_read_priority;
+    }
+
+    const ::io_priority_class&
+    bulk_export_priority() {
+        return _bulk_export_priority;
+    }
+
+    priority_manager(const priority_class_shares& shares = {})
+        : _commitlog_priority(register_class(shares, "commitlog", 100))
+        , _mt_flush_priority(register_class(shares, "memtable_flush", 100))
+        , _stream_read_priority(register_class(shares, "streaming_read", 20))
+        , _stream_write_priority(register_class(shares, "streaming_write", 20))
+        , _sstable_query_read(register_class(shares, "query", 100))
+        , _compaction_priority(register_class(shares, "compaction", 100))
+        , _cache_warmup_priority(register_class(shares, "cache_warmup", 10))
+        , _repair_read_priority(register_class(shares, "repair_read", 20))
+        , _bulk_export_priority(register_class(shares, "bulk_export", 10))
 
     {}
+
+    static const std::vector<sstring>& class_names();
 };
 
+// Parses the io_priority_class_shares option. Throws std::invalid_argument
+// on unknown class names and on shares outside [1, 1000].
+priority_class_shares parse_priority_class_shares(const std::unordered_map<sstring, sstring>& options);
+
+// Sets the shares the priority classes of this shard are registered with.
+// Must be called before the first use of get_local_priority_manager(),
+// because shares can't be changed once a class is registered.
+void set_priority_class_shares(priority_class_shares shares);
+
 priority_manager& get_local_priority_manager();
 const inline ::io_priority_class&
 get_local_commitlog_priority() {
@@ -103,4 +146,19 @@ const inline ::io_priority_class&
 get_local_compaction_priority() {
     return get_local_priority_manager().compaction_priority();
 }
+
+const inline ::io_priority_class&
+get_local_cache_warmup_priority() {
+    return get_local_priority_manager().cache_warmup_priority();
+}
+
+const inline ::io_priority_class&
+get_local_repair_read_priority() {
+    return get_local_priority_manager().repair_read_priority();
+}
+
+const inline ::io_priority_class&
+get_local_bulk_export_priority() {
+    return get_local_priority_manager().bulk_export_priority();
+}
 }
@@ -35,7 +35,7 @@ class query_state final {
 
 public:
     query_state(client_state client_state)
-        : _client_state(client_state)
+        : _client_state(std::move(client_state))
         , _trace_state_ptr(_client_state.get_trace_state())
     { }
 
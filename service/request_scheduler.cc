@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/lexical_cast.hpp>
+#include "request_scheduler.hh"
+#include "priority_manager.hh"
+
+namespace service {
+
+request_scheduler& get_local_request_scheduler() {
+    static thread_local request_scheduler rs;
+    return rs;
+}
+
+static unsigned parse_positive(const sstring& name, const sstring& value) {
+    unsigned v;
+    try {
+        v = boost::lexical_cast<unsigned>(value);
+    } catch (const boost::bad_lexical_cast&) {
+        throw std::invalid_argument(sprint("request_scheduler_options: %s must be a positive integer, not %s", name, value));
+    }
+    if (!v) {
+        throw std::invalid_argument(sprint("request_scheduler_options: %s must be a positive integer, not %s", name, value));
+    }
+    return v;
+}
+
+request_scheduler::config
+request_scheduler::make_config(const sstring& scheduler, const sstring& id, const std::unordered_map<sstring, sstring>& options) {
+    config cfg;
+    if (scheduler == "org.apache.cassandra.scheduler.NoScheduler") {
+        return cfg;
+    }
+    if (scheduler != "org.apache.cassandra.scheduler.RoundRobinScheduler") {
+        throw std::invalid_argument(sprint("request_scheduler: unsupported scheduler %s", scheduler));
+    }
+    cfg.enabled = true;
+    if (id.empty() || id == "keyspace") {
+        cfg.id = id_type::keyspace;
+    } else if (id == "user") {
+        cfg.id = id_type::user;
+    } else {
+        throw std::invalid_argument(sprint("request_scheduler_id: %s is not a valid scheduling id, use keyspace or user", id));
+    }
+
+    static const sstring weights_prefix = "weights.";
+    for (auto&& o : options) {
+        if (o.first == "throttle_limit") {
+            cfg.throttle_limit = parse_positive(o.first, o.second);
+        } else if (o.first == "default_weight") {
+            cfg.default_weight = parse_positive(o.first, o.second);
+        } else if (o.first.size() > weights_prefix.size() && o.first.compare(0, weights_prefix.size(), weights_prefix) == 0) {
+            cfg.weights[o.first.substr(weights_prefix.size())] = parse_positive(o.first, o.second);
+        } else {
+            throw std::invalid_argument(sprint("request_scheduler_options: unknown option %s", o.first));
+        }
+    }
+    return cfg;
+}
+
+void request_scheduler::configure(config cfg) {
+    _config = std::move(cfg);
+    _limit = std::max(1u, _config.throttle_limit / smp::count);
+    _read_priorities.clear();
+    _classes.clear();
+    if (!_config.enabled || _config.id != id_type::keyspace) {
+        return;
+    }
+    // Registered on every shard, seastar hands out the same class for the
+    // same name.
+    for (auto&& w : _config.weights) {
+        auto shares = std::min(1000u, std::max(1u, 100 * w.second / _config.default_weight));
+        _read_priorities.emplace(w.first, engine().register_one_priority_class("query_" + w.first, shares));
+    }
+}
+
+request_scheduler::scheduling_class& request_scheduler::get_class(const sstring& id) {
+    auto i = _classes.find(id);
+    if (i != _classes.end()) {
+        return i->second;
+    }
+    auto w = _config.weights.find(id);
+    scheduling_class c;
+    c.weight = w != _config.weights.end() ? w->second : _config.default_weight;
+    return _classes.emplace(id, std::move(c)).first->second;
+}
+
+future<> request_scheduler::admit(const sstring& id) {
+    auto& c = get_class(id);
+    // Requests don't overtake queued ones.
+    if (_running < _limit && _ready.empty()) {
+        ++_running;
+        ++c.st.admitted;
+        return make_ready_future<>();
+    }
+    ++c.st.queued;
+    c.waiters.emplace_back();
+    auto f = c.waiters.back().get_future();
+    if (!c.ready) {
+        c.ready = true;
+        _ready.push_back(&c);
+    }
+    return f;
+}
+
+void request_scheduler::release() {
+    --_running;
+    dispatch();
+}
+
+void request_scheduler::dispatch() {
+    while (_running < _limit && !_ready.empty()) {
+        auto& c = *_ready.front();
+        ++_running;
+        ++c.st.admitted;
+        c.waiters.front().set_value();
+        c.waiters.pop_front();
+        if (c.waiters.empty()) {
+            c.ready = false;
+            _ready.pop_front();
+            _turn = 0;
+        } else if (++_turn >= c.weight) {
+            _ready.pop_front();
+            _ready.push_back(&c);
+            _turn = 0;
+        }
+    }
+}
+
+const ::io_priority_class& request_scheduler::read_priority(const sstring& keyspace) {
+    auto i = _read_priorities.find(keyspace);
+    if (i != _read_priorities.end()) {
+        return i->second;
+    }
+    return get_local_sstable_query_read_priority();
+}
+
+request_scheduler::stats request_scheduler::get_stats(const sstring& id) const {
+    auto i = _classes.find(id);
+    return i != _classes.end() ? i->second.st : stats();
+}
+
+}
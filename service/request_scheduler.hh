@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <seastar/core/future.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/circular_buffer.hh>
+#include <seastar/core/reactor.hh>
+#include "core/sstring.hh"
+
+namespace service {
+
+// Schedules client requests by keyspace, or by user, like Cassandra's
+// RoundRobinScheduler: at most throttle_limit requests are executed at a
+// time on a node, and queued requests are admitted round robin, up to the
+// weight of their scheduling id in each turn. A keyspace or user with twice
+// the weight of another gets twice the share of the node once it's loaded,
+// so a burst of batch requests queues behind itself rather than in front of
+// everything else.
+//
+// Keyspaces with a weight of their own also get an I/O priority class of
+// their own for the sstable reads of their queries, with shares in the same
+// proportion to the general query class.
+class request_scheduler {
+public:
+    enum class id_type { keyspace, user };
+
+    struct config {
+        bool enabled = false;
+        id_type id = id_type::keyspace;
+        unsigned throttle_limit = 80;
+        unsigned default_weight = 1;
+        std::unordered_map<sstring, unsigned> weights;
+    };
+
+    // Builds the configuration from the request_scheduler* options. Throws
+    // std::invalid_argument if they don't make sense.
+    static config make_config(const sstring& scheduler, const sstring& id, const std::unordered_map<sstring, sstring>& options);
+
+    struct stats {
+        uint64_t admitted = 0;
+        uint64_t queued = 0;
+    };
+private:
+    struct scheduling_class {
+        unsigned weight;
+        circular_buffer<promise<>> waiters;
+        // Whether the class is in _ready.
+        bool ready = false;
+        stats st;
+    };
+
+    config _config;
+    // Share of throttle_limit of this shard.
+    unsigned _limit = 1;
+    unsigned _running = 0;
+    std::unordered_map<sstring, scheduling_class> _classes;
+    std::unordered_map<sstring, ::io_priority_class> _read_priorities;
+    // Classes with queued requests, the one whose turn it is first.
+    circular_buffer<scheduling_class*> _ready;
+    // Requests admitted in the current turn.
+    unsigned _turn = 0;
+private:
+    scheduling_class& get_class(const sstring& id);
+    future<> admit(const sstring& id);
+    void release();
+    void dispatch();
+public:
+    void configure(config cfg);
+
+    const config& get_config() const {
+        return _config;
+    }
+
+    // Whether requests are scheduled by keyspace or by user.
+    bool enabled(id_type id) const {
+        return _config.enabled && _config.id == id;
+    }
+
+    // Runs func once it's the turn of given scheduling id.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> schedule(const sstring& id, Func&& func) {
+        using futurator = futurize<std::result_of_t<Func()>>;
+        if (!_config.enabled) {
+            return futurator::apply(std::forward<Func>(func));
+        }
+        return admit(id).then([this, func = std::forward<Func>(func)] () mutable {
+            return futurator::apply(std::move(func)).finally([this] {
+                release();
+            });
+        });
+    }
+
+    // Priority class of the sstable reads of queries of given keyspace.
+    const ::io_priority_class& read_priority(const sstring& keyspace);
+
+    unsigned running() const {
+        return _running;
+    }
+
+    stats get_stats(const sstring& id) const;
+};
+
+request_scheduler& get_local_request_scheduler();
+
+}
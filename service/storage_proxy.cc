@@ -59,6 +59,7 @@
 #include <boost/iterator/counting_iterator.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/algorithm/cxx11/none_of.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 #include <boost/range/algorithm/count_if.hpp>
 #include <boost/range/algorithm/find.hpp>
 #include <boost/range/algorithm/find_if.hpp>
@@ -66,7 +67,10 @@
 #include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/numeric.hpp>
 #include <boost/range/algorithm/sort.hpp>
+#include <boost/range/irange.hpp>
 #include "utils/latency.hh"
+#include "locator/dynamic_snitch.hh"
+#include "db/hints_manager.hh"
 #include "schema.hh"
 #include "schema_registry.hh"
 #include "utils/joinpoint.hh"
@@ -170,9 +174,11 @@ class shared_mutation : public mutation_holder {
     }
 };
 
-class abstract_write_response_handler {
+class abstract_write_response_handler : public utils::timer_wheel::entry {
 protected:
     storage_proxy::response_id_type _id;
+    // Next handler in the same bucket of storage_proxy::_response_handlers.
+    abstract_write_response_handler* _next_in_bucket = nullptr;
     promise<> _ready; // available when cl is achieved
     shared_ptr<storage_proxy> _proxy;
     tracing::trace_state_ptr _trace_state;
@@ -230,6 +236,12 @@ class abstract_write_response_handler {
              if (_proxy->need_throttle_writes()) {
                  _throttled = true;
                  _proxy->_throttled_writes.push_back(_id);
+             } else if (boost::algorithm::any_of(_targets, [this] (gms::inet_address ep) { return _proxy->write_overloaded(ep); })) {
+                 // A replica we still wait for is falling behind. Hold the client
+                 // until it catches up with this write, or the write times out,
+                 // rather than let it pile more writes onto the replica.
+                 _throttled = true;
+                 _proxy->_stats.writes_throttled_by_replica_load++;
              } else {
                  unthrottle();
              }
@@ -237,10 +249,10 @@ class abstract_write_response_handler {
     }
     // return true on last ack
     bool response(gms::inet_address from) {
-        signal(from);
         auto it = _targets.find(from);
         assert(it != _targets.end());
         _targets.erase(it);
+        signal(from);
         return _targets.size() == 0;
     }
     future<> wait() {
@@ -330,69 +342,126 @@ bool storage_proxy::need_throttle_writes() const {
     return _stats.background_write_bytes > memory::stats().total_memory() / 10 || _stats.queued_write_bytes > 6*1024*1024;
 }
 
+void storage_proxy::update_replica_load(gms::inet_address ep, const replica_load& load) {
+    _replica_loads[ep] = reported_load{load, clock_type::now()};
+}
+
+const replica_load* storage_proxy::fresh_replica_load(gms::inet_address ep) const {
+    auto i = _replica_loads.find(ep);
+    if (i == _replica_loads.end() || clock_type::now() - i->second.at > replica_load_expiry) {
+        return nullptr;
+    }
+    return &i->second.load;
+}
+
+bool storage_proxy::write_overloaded(gms::inet_address ep) const {
+    auto load = fresh_replica_load(ep);
+    return load && load->dirty_percent >= overloaded_dirty_percent;
+}
+
+bool storage_proxy::read_overloaded(gms::inet_address ep) const {
+    auto load = fresh_replica_load(ep);
+    return load && (load->read_queue_length >= overloaded_read_queue_length || load->pending_compactions >= overloaded_pending_compactions);
+}
+
 void storage_proxy::unthrottle() {
    while(!need_throttle_writes() && !_throttled_writes.empty()) {
        auto id = _throttled_writes.front();
        _throttled_writes.pop_front();
-       auto it = _response_handlers.find(id);
-       if (it != _response_handlers.end()) {
-           it->second.handler->unthrottle();
+       if (auto h = find_response_handler(id)) {
+           h->unthrottle();
        }
    }
 }
 
+static constexpr size_t initial_response_handler_buckets = 1024;
+
+abstract_write_response_handler* storage_proxy::find_response_handler(storage_proxy::response_id_type id) {
+    auto h = _response_handlers[id & (_response_handlers.size() - 1)];
+    while (h && h->_id != id) {
+        h = h->_next_in_bucket;
+    }
+    return h;
+}
+
+void storage_proxy::on_write_timeout(abstract_write_response_handler& h) {
+    if (h._cl_achieved || h._cl == db::consistency_level::ANY) {
+        // we are here because either cl was achieved, but targets left in the handler are not
+        // responding, so a hint should be written for them, or cl == any in which case
+        // hints are counted towards consistency, so we need to write hints and count how much was written
+        auto hints = hint_to_dead_endpoints(h._mutation_holder, h.get_targets());
+        h.signal(hints);
+        if (h._cl == db::consistency_level::ANY && hints) {
+            logger.trace("Wrote hint to satisfy CL.ANY after no replicas acknowledged the write");
+        }
+    }
+
+    // _cl_achieved can be modified after previous check by call to signal() above if cl == ANY
+    if (!h._cl_achieved) {
+        // timeout happened before cl was achieved, throw exception
+        h._ready.set_exception(mutation_write_timeout_exception(h.get_schema()->ks_name(), h.get_schema()->cf_name(), h._cl, h._cl_acks, h.total_block_for(), h._type));
+    } else {
+        logger.trace("Write is not acknowledged by {} replicas after achieving CL", h.get_targets());
+    }
+    remove_response_handler(h.id());
+}
+
 storage_proxy::response_id_type storage_proxy::register_response_handler(std::unique_ptr<abstract_write_response_handler>&& h) {
     auto id = h->id();
-    auto e = _response_handlers.emplace(id, rh_entry(std::move(h), [this, id] {
-        auto& e = _response_handlers.find(id)->second;
-        if (e.handler->_cl_achieved || e.handler->_cl == db::consistency_level::ANY) {
-            // we are here because either cl was achieved, but targets left in the handler are not
-            // responding, so a hint should be written for them, or cl == any in which case
-            // hints are counted towards consistency, so we need to write hints and count how much was written
-            auto hints = hint_to_dead_endpoints(e.handler->_mutation_holder, e.handler->get_targets());
-            e.handler->signal(hints);
-            if (e.handler->_cl == db::consistency_level::ANY && hints) {
-                logger.trace("Wrote hint to satisfy CL.ANY after no replicas acknowledged the write");
-            }
-        }
-
-        // _cl_achieved can be modified after previous check by call to signal() above if cl == ANY
-        if (!e.handler->_cl_achieved) {
-            // timeout happened before cl was achieved, throw exception
-            e.handler->_ready.set_exception(mutation_write_timeout_exception(e.handler->get_schema()->ks_name(), e.handler->get_schema()->cf_name(), e.handler->_cl, e.handler->_cl_acks, e.handler->total_block_for(), e.handler->_type));
-        } else {
-            logger.trace("Write is not acknowledged by {} replicas after achieving CL", e.handler->get_targets());
+    if (_response_handlers_count >= _response_handlers.size()) {
+        // Ids are unique, so handlers can be relinked without comparing them.
+        std::vector<abstract_write_response_handler*> buckets(_response_handlers.size() * 2);
+        for (auto b : _response_handlers) {
+            while (b) {
+                auto next = b->_next_in_bucket;
+                auto& nb = buckets[b->_id & (buckets.size() - 1)];
+                b->_next_in_bucket = nb;
+                nb = b;
+                b = next;
+            }
         }
-        remove_response_handler(id);
-    }));
-    assert(e.second);
+        _response_handlers = std::move(buckets);
+    }
+    auto& b = _response_handlers[id & (_response_handlers.size() - 1)];
+    assert(!find_response_handler(id));
+    h->_next_in_bucket = b;
+    b = h.release();
+    ++_response_handlers_count;
     return id;
 }
 
 void storage_proxy::remove_response_handler(storage_proxy::response_id_type id) {
-    _response_handlers.erase(id);
+    auto p = &_response_handlers[id & (_response_handlers.size() - 1)];
+    while (*p && (*p)->_id != id) {
+        p = &(*p)->_next_in_bucket;
+    }
+    if (auto h = *p) {
+        *p = h->_next_in_bucket;
+        --_response_handlers_count;
+        delete h; // Cancels the write timeout too.
+    }
 }
 
 void storage_proxy::got_response(storage_proxy::response_id_type id, gms::inet_address from) {
-    auto it = _response_handlers.find(id);
-    if (it != _response_handlers.end()) {
-        tracing::trace(it->second.handler->get_trace_state(), "Got a response from /{}", from);
-        if (it->second.handler->response(from)) {
+    if (auto h = find_response_handler(id)) {
+        tracing::trace(h->get_trace_state(), "Got a response from /{}", from);
+        tracing::record_replica_response(h->get_trace_state(), from);
+        if (h->response(from)) {
             remove_response_handler(id); // last one, remove entry. Will cancel expiration timer too.
         }
     }
 }
 
 future<> storage_proxy::response_wait(storage_proxy::response_id_type id, clock_type::time_point timeout) {
-    auto& e = _response_handlers.find(id)->second;
+    auto& h = *find_response_handler(id);
 
-    e.expire_timer.arm(timeout);
+    _write_timeouts.arm(h, timeout);
 
-    return e.handler->wait();
+    return h.wait();
 }
 
 abstract_write_response_handler& storage_proxy::get_write_response_handler(storage_proxy::response_id_type id) {
-        return *_response_handlers.find(id)->second.handler;
+        return *find_response_handler(id);
 }
 
 storage_proxy::response_id_type storage_proxy::create_write_response_handler(keyspace& ks, db::consistency_level cl, db::write_type type, std::unique_ptr<mutation_holder> m,
@@ -455,13 +524,25 @@ inline uint64_t& storage_proxy::split_stats::get_ep_stat(gms::inet_address ep) {
     return _dc_stats[dc].val;
 }
 
-storage_proxy::~storage_proxy() {}
-storage_proxy::storage_proxy(distributed<database>& db) : _db(db) {
+storage_proxy::~storage_proxy() {
+    for (auto b : _response_handlers) {
+        while (b) {
+            delete std::exchange(b, b->_next_in_bucket);
+        }
+    }
+}
+storage_proxy::storage_proxy(distributed<database>& db)
+    : _db(db)
+    , _response_handlers(initial_response_handler_buckets)
+    , _write_timeouts(std::chrono::milliseconds(10), 1024, [this] (utils::timer_wheel::entry& e) {
+        on_write_timeout(static_cast<abstract_write_response_handler&>(e));
+    }) {
+    _repair_flush_timer.set_callback([this] { flush_repair_queue(); });
     _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
         scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
                 , scollectd::per_cpu_plugin_instance
                 , "queue_length", "foreground writes")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _response_handlers.size() - _stats.background_writes; })
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _response_handlers_count - _stats.background_writes; })
         ),
         scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
                 , scollectd::per_cpu_plugin_instance
@@ -498,6 +579,41 @@ storage_proxy::storage_proxy(distributed<database>& db) : _db(db) {
                 , "total_operations", "global_read_repairs_canceled_due_to_concurrent_write")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.global_read_repairs_canceled_due_to_concurrent_write)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "writes throttled by replica load")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.writes_throttled_by_replica_load)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "background read repairs")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.read_repair_queue_length)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "background read repairs queued")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.read_repair_queued)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "background read repairs merged")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.read_repair_queue_merged)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "background read repairs dropped")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.read_repair_queue_dropped)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "range slice ranges")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.range_slice_ranges)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "range slice subqueries")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.range_slice_subqueries)
+        ),
         scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
                 , scollectd::per_cpu_plugin_instance
                 , "total_operations", "write timeouts")
@@ -543,10 +659,31 @@ storage_proxy::storage_proxy(distributed<database>& db) : _db(db) {
                 , "total_operations", "forwarding errors")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.forwarding_errors)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "expired replica writes")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.expired_replica_writes)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "expired replica reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.expired_replica_reads)
+        ),
     }));
+    auto add_percentiles = [this] (sstring op, const utils::hdr_histogram_window& w) {
+        for (auto p : { 50.0, 95.0, 99.0, 99.9 }) {
+            _latency_collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                    , scollectd::per_cpu_plugin_instance
+                    , "latency", sprint("%s p%g", op, p))
+                    , scollectd::make_typed(scollectd::data_type::GAUGE, [&w, p] { return w.recent().percentile(p); })
+            ));
+        }
+    };
+    add_percentiles("read", _recent_read_latency);
+    add_percentiles("write", _recent_write_latency);
+    add_percentiles("range", _recent_range_latency);
 }
 
-storage_proxy::rh_entry::rh_entry(std::unique_ptr<abstract_write_response_handler>&& h, std::function<void()>&& cb) : handler(std::move(h)), expire_timer(std::move(cb)) {}
 
 storage_proxy::unique_response_handler::unique_response_handler(storage_proxy& p_, response_id_type id_) : id(id_), p(p_) {}
 storage_proxy::unique_response_handler::unique_response_handler(unique_response_handler&& x) : id(x.id), p(x.p) { x.id = 0; };
@@ -952,9 +1089,27 @@ storage_proxy::mutate_locally(const mutation& m) {
     });
 }
 
+future<>
+storage_proxy::mutate_locally_in_place(const mutation& m) {
+    // Mutations which stay on this shard are applied as they are, only the
+    // commitlog entry is serialized. Other shards can't share the mutation's
+    // schema_ptr and memory, so it crosses over as a frozen_mutation.
+    if (_db.local().shard_of(m) == engine().cpu_id()) {
+        return futurize<void>::apply([this, &m] {
+            return _db.local().apply(m);
+        });
+    }
+    return mutate_locally(m);
+}
+
 future<>
 storage_proxy::mutate_locally(const schema_ptr& s, const frozen_mutation& m) {
     auto shard = _db.local().shard_of(m);
+    if (shard == engine().cpu_id()) {
+        return futurize<void>::apply([this, &s, &m] {
+            return _db.local().apply(s, m);
+        });
+    }
     return _db.invoke_on(shard, [&m, gs = global_schema_ptr(s)] (database& db) -> future<> {
         return db.apply(gs, m);
     });
@@ -963,8 +1118,119 @@ storage_proxy::mutate_locally(const schema_ptr& s, const frozen_mutation& m) {
 future<>
 storage_proxy::mutate_locally(std::vector<mutation> mutations) {
     return do_with(std::move(mutations), [this] (std::vector<mutation>& pmut){
+        // pmut keeps the mutations alive until they are applied.
         return parallel_for_each(pmut.begin(), pmut.end(), [this] (const mutation& m) {
-            return mutate_locally(m);
+            return mutate_locally_in_place(m);
+        });
+    });
+}
+
+// Returns the replica of the view which is paired with this node for updates
+// of base rows at base_token: the view replica whose position among the view
+// replicas of its dc is the position of this node among the base replicas of
+// the dc. Every base replica thus sends its updates to a different view
+// replica. Nodes which are not natural replicas of the base (pending ones)
+// have no paired replica.
+static std::experimental::optional<gms::inet_address>
+get_paired_view_replica(keyspace& ks, const dht::token& base_token, const dht::token& view_token) {
+    auto my_address = utils::fb_utilities::get_broadcast_address();
+    auto my_dc = get_dc(my_address);
+    auto other_dc = [&my_dc] (gms::inet_address ep) {
+        return get_dc(ep) != my_dc;
+    };
+    auto& rs = ks.get_replication_strategy();
+    auto base_endpoints = rs.get_natural_endpoints(base_token);
+    auto view_endpoints = rs.get_natural_endpoints(view_token);
+    base_endpoints.erase(boost::remove_if(base_endpoints, other_dc), base_endpoints.end());
+    view_endpoints.erase(boost::remove_if(view_endpoints, other_dc), view_endpoints.end());
+    auto i = boost::find(base_endpoints, my_address);
+    if (i == base_endpoints.end()) {
+        return { };
+    }
+    auto pos = std::distance(base_endpoints.begin(), i);
+    if (size_t(pos) >= view_endpoints.size()) {
+        return { };
+    }
+    return view_endpoints[pos];
+}
+
+future<>
+storage_proxy::mutate_view_replicas(const dht::token& base_token, std::vector<mutation> updates) {
+    auto timeout = clock_type::now() + std::chrono::milliseconds(_db.local().get_config().write_request_timeout_in_ms());
+    return do_with(std::move(updates), [this, base_token, timeout] (std::vector<mutation>& updates) {
+        return parallel_for_each(updates, [this, base_token, timeout] (const mutation& m) {
+            auto& ks = _db.local().find_keyspace(m.schema()->ks_name());
+            auto target = get_paired_view_replica(ks, base_token, m.token());
+            if (!target) {
+                return make_ready_future<>();
+            }
+            if (is_me(*target)) {
+                return mutate_locally_in_place(m);
+            }
+            auto fm = make_lw_shared<const frozen_mutation>(freeze(m));
+            auto& ms = net::get_local_messaging_service();
+            ms.send_view_update(net::messaging_service::msg_addr{*target, 0}, timeout, *fm).then_wrapped(
+                    [this, target = *target, s = m.schema(), fm] (future<> f) mutable {
+                try {
+                    f.get();
+                    return make_ready_future<>();
+                } catch (...) {
+                    logger.debug("Failed to send view update to {}: {}", target, std::current_exception());
+                }
+                if (!should_hint(target)) {
+                    return make_ready_future<>();
+                }
+                // The paired replica only gets the update from this node, so
+                // it has to be hinted, whatever the consistency level.
+                return db::get_local_hints_manager().store_hint(target, std::move(s), std::move(fm));
+            }).handle_exception([target = *target] (std::exception_ptr ep) {
+                logger.warn("Failed to write view update hint for {}: {}", target, ep);
+            });
+            return make_ready_future<>();
+        });
+    });
+}
+
+future<std::vector<uint32_t>>
+storage_proxy::mutate_locally(const std::vector<frozen_mutation>& mutations, const std::vector<schema_ptr>& schemas) {
+    // Group the mutations by owning shard, so that every shard is reached
+    // with a single cross-core message rather than one per mutation.
+    std::vector<std::vector<uint32_t>> per_shard(smp::count);
+    for (uint32_t i = 0; i < mutations.size(); i++) {
+        if (schemas[i]) {
+            per_shard[_db.local().shard_of(mutations[i])].push_back(i);
+        }
+    }
+    return do_with(std::move(per_shard), std::vector<uint32_t>(), [this, &mutations, &schemas] (std::vector<std::vector<uint32_t>>& per_shard, std::vector<uint32_t>& failed) {
+        return parallel_for_each(boost::irange<unsigned>(0, smp::count), [this, &mutations, &schemas, &per_shard, &failed] (unsigned shard) {
+            auto& idx = per_shard[shard];
+            if (idx.empty()) {
+                return make_ready_future<>();
+            }
+            std::vector<global_schema_ptr> gs;
+            gs.reserve(idx.size());
+            for (auto i : idx) {
+                gs.emplace_back(schemas[i]);
+            }
+            return _db.invoke_on(shard, [&mutations, &idx, gs = std::move(gs)] (database& db) {
+                return do_with(std::vector<uint32_t>(), [&db, &mutations, &idx, &gs] (std::vector<uint32_t>& failed) {
+                    return parallel_for_each(boost::irange<size_t>(0, idx.size()), [&db, &mutations, &idx, &gs, &failed] (size_t j) {
+                        // database::apply() may throw, putting it into apply() converts exception to a future.
+                        return futurize<void>::apply([&db, &mutations, &idx, &gs, j] {
+                            return db.apply(gs[j], mutations[idx[j]]);
+                        }).handle_exception([&failed, &idx, j] (std::exception_ptr eptr) {
+                            logger.warn("Failed to apply mutation: {}", eptr);
+                            failed.push_back(idx[j]);
+                        });
+                    }).then([&failed] {
+                        return std::move(failed);
+                    });
+                });
+            }).then([&failed] (std::vector<uint32_t> shard_failed) {
+                boost::push_back(failed, shard_failed);
+            });
+        }).then([&failed] {
+            return std::move(failed);
         });
     });
 }
@@ -1078,7 +1344,15 @@ future<std::vector<storage_proxy::unique_response_handler>> storage_proxy::mutat
 }
 
 future<> storage_proxy::mutate_begin(std::vector<unique_response_handler> ids, db::consistency_level cl) {
-    return parallel_for_each(ids, [this, cl] (unique_response_handler& protected_response) {
+    auto timeout = clock_type::now() + std::chrono::milliseconds(_db.local().get_config().write_request_timeout_in_ms());
+    // Coalesce the remote writes of multi-mutation requests into one message per replica.
+    std::unique_ptr<batched_writes> batch;
+    if (ids.size() > 1 && get_local_storage_service().cluster_supports_mutation_batch()) {
+        batch = std::make_unique<batched_writes>();
+    }
+    // parallel_for_each() invokes the function for all elements before returning,
+    // so all writes are in the batch once it returns.
+    auto f = parallel_for_each(ids, [this, cl, timeout, batch = batch.get()] (unique_response_handler& protected_response) {
         auto response_id = protected_response.id;
         // it is better to send first and hint afterwards to reduce latency
         // but request may complete before hint_to_dead_endpoints() is called and
@@ -1086,12 +1360,74 @@ future<> storage_proxy::mutate_begin(std::vector<unique_response_handler> ids, d
         // frozen_mutation copy, or manage handler live time differently.
         hint_to_dead_endpoints(response_id, cl);
 
-        auto timeout = clock_type::now() + std::chrono::milliseconds(_db.local().get_config().write_request_timeout_in_ms());
         // call before send_to_live_endpoints() for the same reason as above
         auto f = response_wait(response_id, timeout);
-        send_to_live_endpoints(protected_response.release(), timeout); // response is now running and it will either complete or timeout
+        send_to_live_endpoints(protected_response.release(), timeout, batch); // response is now running and it will either complete or timeout
         return std::move(f);
     });
+    if (batch) {
+        send_batched_writes(*batch, timeout);
+    }
+    return f;
+}
+
+void storage_proxy::send_batched_writes(batched_writes& batch, clock_type::time_point timeout) {
+    for (auto&& dst : batch) {
+        auto ep = dst.first;
+        std::vector<frozen_mutation> mutations;
+        std::vector<response_id_type> ids;
+        size_t bytes = 0;
+        for (auto&& w : dst.second) {
+            if (!mutations.empty() && (mutations.size() >= max_mutation_batch_count || bytes >= max_mutation_batch_bytes)) {
+                send_mutation_batch(ep, timeout, std::move(mutations), std::move(ids), std::exchange(bytes, 0));
+                mutations.clear();
+                ids.clear();
+            }
+            bytes += w.second->representation().size();
+            mutations.push_back(*w.second);
+            ids.push_back(w.first);
+        }
+        send_mutation_batch(ep, timeout, std::move(mutations), std::move(ids), bytes);
+    }
+}
+
+void storage_proxy::send_mutation_batch(gms::inet_address ep, clock_type::time_point timeout, std::vector<frozen_mutation> mutations,
+        std::vector<response_id_type> ids, size_t bytes) {
+    auto& ms = net::get_local_messaging_service();
+    _stats.queued_write_bytes += bytes;
+    logger.trace("Sending a batch of {} mutations to {}", mutations.size(), ep);
+    ms.send_mutation_batch(net::messaging_service::msg_addr{ep, 0}, timeout, std::move(mutations)).then_wrapped([this, p = shared_from_this(), ep, ids = std::move(ids), bytes] (future<std::vector<uint32_t>> f) {
+        _stats.queued_write_bytes -= bytes;
+        unthrottle();
+        if (f.failed()) {
+            _stats.writes_errors.get_ep_stat(ep) += ids.size();
+            try {
+                f.get();
+            } catch(rpc::closed_error&) {
+                // ignore, disconnect will be logged by gossiper
+            } catch(seastar::gate_closed_exception&) {
+                // may happen during shutdown, ignore it
+            } catch(...) {
+                logger.error("exception during mutation batch write to {}: {}", ep, std::current_exception());
+            }
+            return;
+        }
+        // Replicas which failed to apply a mutation report its index, such
+        // writes are left to time out, as with MUTATION.
+        auto failed = f.get0();
+        _stats.writes_errors.get_ep_stat(ep) += failed.size();
+        std::vector<bool> ok(ids.size(), true);
+        for (auto i : failed) {
+            if (i < ok.size()) {
+                ok[i] = false;
+            }
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (ok[i]) {
+                got_response(ids[i], ep);
+            }
+        }
+    });
 }
 
 // this function should be called with a future that holds result of mutation attempt (usually
@@ -1101,6 +1437,7 @@ future<> storage_proxy::mutate_end(future<> mutate_result, utils::latency_counte
     _stats.write.mark(lc.stop().latency_in_nano());
     if (lc.is_start()) {
         _stats.estimated_write.add(lc.latency(), _stats.write.hist.count);
+        _stats.write_latency.add(lc.latency());
     }
     try {
         mutate_result.get();
@@ -1177,6 +1514,11 @@ storage_proxy::mutate_with_triggers(std::vector<mutation> mutations, db::consist
             return mutate_atomically(augmented, consistencyLevel);
         } else {
 #endif
+    if (!mutations.empty() && mutations.front().schema()->is_counter()) {
+        // Counter updates can't be replayed from the batchlog, and are
+        // never applied atomically.
+        return mutate_counters(std::move(mutations), cl, std::move(tr_state));
+    }
     if (should_mutate_atomically) {
         return mutate_atomically(std::move(mutations), cl, std::move(tr_state));
     }
@@ -1186,6 +1528,56 @@ storage_proxy::mutate_with_triggers(std::vector<mutation> mutations, db::consist
 #endif
 }
 
+future<> storage_proxy::mutate_counters(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr tr_state) {
+    std::unordered_map<gms::inet_address, std::pair<std::vector<frozen_mutation>, std::vector<schema_ptr>>> per_leader;
+    for (auto&& m : mutations) {
+        auto& ks = _db.local().find_keyspace(m.schema()->ks_name());
+        auto live_endpoints = get_live_sorted_endpoints(ks, m.token());
+        if (live_endpoints.empty()) {
+            _stats.write_unavailables.mark();
+            throw exceptions::unavailable_exception(cl, db::block_for(ks, cl), 0);
+        }
+        // The local node, if it is a live replica, is first.
+        auto& leader = per_leader[live_endpoints.front()];
+        leader.first.push_back(freeze(m));
+        leader.second.push_back(m.schema());
+    }
+    auto timeout = clock_type::now() + std::chrono::milliseconds(_db.local().get_config().counter_write_request_timeout_in_ms());
+    return do_with(std::move(per_leader), [this, cl, timeout, tr_state = std::move(tr_state)] (auto& per_leader) {
+        return parallel_for_each(per_leader, [this, cl, timeout, tr_state] (auto& leader) {
+            if (is_me(leader.first)) {
+                return this->mutate_counters_on_leader(std::move(leader.second.first), std::move(leader.second.second), cl, tr_state);
+            }
+            tracing::trace(tr_state, "Sending counter updates to leader /{}", leader.first);
+            auto& ms = net::get_local_messaging_service();
+            return ms.send_counter_mutation(net::messaging_service::msg_addr{leader.first, 0}, timeout,
+                    std::move(leader.second.first), int32_t(cl), tracing::make_trace_info(tr_state));
+        });
+    });
+}
+
+future<> storage_proxy::mutate_counters_on_leader(std::vector<frozen_mutation> mutations, std::vector<schema_ptr> schemas,
+        db::consistency_level cl, tracing::trace_state_ptr tr_state) {
+    auto counter_id = get_local_storage_service().get_token_metadata().get_host_id(utils::fb_utilities::get_broadcast_address());
+    return do_with(std::move(mutations), std::move(schemas), std::vector<mutation>(),
+            [this, cl, counter_id, tr_state = std::move(tr_state)] (auto& mutations, auto& schemas, auto& results) mutable {
+        return parallel_for_each(boost::irange<size_t>(0, mutations.size()), [this, &mutations, &schemas, &results, counter_id] (size_t i) {
+            auto shard = _db.local().shard_of(mutations[i]);
+            return _db.invoke_on(shard, [&m = mutations[i], gs = global_schema_ptr(schemas[i]), counter_id] (database& db) {
+                return db.apply_counter_update(gs, m, counter_id).then([] (mutation m) {
+                    return freeze(m);
+                });
+            }).then([&results, s = schemas[i]] (frozen_mutation fm) {
+                results.emplace_back(fm.unfreeze(s));
+            });
+        }).then([this, &results, cl, tr_state = std::move(tr_state)] () mutable {
+            // The updates are already applied here, replicating them applies
+            // them again, which doesn't change the merged shards.
+            return mutate_internal(std::move(results), cl, std::move(tr_state));
+        });
+    });
+}
+
 /**
  * See mutate. Adds additional steps before and after writing a batch.
  * Before writing the batch (but after doing availability check against the FD for the row replicas):
@@ -1309,7 +1701,7 @@ bool storage_proxy::cannot_hint(gms::inet_address target) {
  * @throws OverloadedException if the hints cannot be written/enqueued
  */
  // returned future is ready when sent is complete, not when mutation is executed on all (or any) targets!
-void storage_proxy::send_to_live_endpoints(storage_proxy::response_id_type response_id, clock_type::time_point timeout)
+void storage_proxy::send_to_live_endpoints(storage_proxy::response_id_type response_id, clock_type::time_point timeout, batched_writes* batch)
 {
     // extra-datacenter replicas, grouped by dc
     std::unordered_map<sstring, std::vector<gms::inet_address>> dc_groups;
@@ -1380,6 +1772,9 @@ void storage_proxy::send_to_live_endpoints(storage_proxy::response_id_type respo
 
             if (coordinator == my_address) {
                 f = futurize<void>::apply(lmutate, std::move(m));
+            } else if (batch && forward.empty()) {
+                tracing::trace(handler.get_trace_state(), "Queueing a mutation to /{} in a batch", coordinator);
+                (*batch)[coordinator].emplace_back(response_id, std::move(m));
             } else {
                 f = futurize<void>::apply(rmutate, coordinator, std::move(forward), *m);
             }
@@ -1420,32 +1815,28 @@ size_t storage_proxy::get_hints_in_progress_for(gms::inet_address target) {
 
 bool storage_proxy::submit_hint(std::unique_ptr<mutation_holder>& mh, gms::inet_address target)
 {
-    warn(unimplemented::cause::HINT);
-    // local write that time out should be handled by LocalMutationRunnable
-    assert(is_me(target));
-    return false;
-#if 0
-    HintRunnable runnable = new HintRunnable(target)
-    {
-        public void runMayThrow()
-        {
-            int ttl = HintedHandOffManager.calculateHintTTL(mutation);
-            if (ttl > 0)
-            {
-                logger.debug("Adding hint for {}", target);
-                writeHintForMutation(mutation, System.currentTimeMillis(), ttl, target);
-                // Notify the handler only for CL == ANY
-                if (responseHandler != null && responseHandler.consistencyLevel == ConsistencyLevel.ANY)
-                    responseHandler.response(null);
-            } else
-            {
-                logger.debug("Skipped writing hint for {} (ttl {})", target, ttl);
-            }
+    auto m = mh->get_mutation_for(target);
+    if (!m) {
+        return false;
+    }
+    if (mh->schema()->gc_grace_seconds().count() == 0) {
+        // A hint would outlive the tombstones of the write.
+        logger.debug("Skipped writing hint for {} (gc_grace_seconds is 0)", target);
+        return false;
+    }
+    logger.debug("Adding hint for {}", target);
+    ++_total_hints_in_progress;
+    ++_hints_in_progress[target];
+    db::get_local_hints_manager().store_hint(target, mh->schema(), std::move(m)).then_wrapped([p = shared_from_this(), target] (future<> f) {
+        try {
+            f.get();
+        } catch (...) {
+            logger.warn("Failed to write hint for {}: {}", target, std::current_exception());
         }
-    };
-
-    return submitHint(runnable);
-#endif
+        --p->_total_hints_in_progress;
+        --p->_hints_in_progress[target];
+    });
+    return true;
 }
 
 #if 0
@@ -1607,6 +1998,70 @@ future<> storage_proxy::schedule_repair(std::unordered_map<dht::token, std::unor
     return mutate_internal(diffs | boost::adaptors::map_values, cl, std::move(trace_state));
 }
 
+void storage_proxy::queue_repair(std::unordered_map<dht::token, std::unordered_map<gms::inet_address, std::experimental::optional<mutation>>> diffs) {
+    for (auto&& d : diffs) {
+        for (auto&& w : d.second) {
+            if (!w.second) {
+                continue;
+            }
+            auto& m = *w.second;
+            auto& queued = _repair_queue[w.first][d.first];
+            auto i = boost::range::find_if(queued, [&m] (const mutation& q) {
+                return q.schema()->version() == m.schema()->version() && q.key().equal(*m.schema(), m.key());
+            });
+            if (i != queued.end()) {
+                i->apply(std::move(m));
+                _stats.read_repair_queue_merged++;
+            } else if (_stats.read_repair_queue_length < max_repair_queue_length) {
+                queued.emplace_back(std::move(m));
+                _stats.read_repair_queue_length++;
+                _stats.read_repair_queued++;
+            } else {
+                // Background repair is best effort, a later read finds the difference again.
+                _stats.read_repair_queue_dropped++;
+            }
+        }
+    }
+    if (_stats.read_repair_queue_length && !_repair_flush_timer.armed() && !_repair_gate.is_closed()) {
+        _repair_flush_timer.arm(repair_flush_period);
+    }
+}
+
+void storage_proxy::flush_repair_queue() {
+    if (!_stats.read_repair_queue_length || _repair_gate.is_closed()) {
+        return;
+    }
+    // Repair writes give way to client writes, and no more than a few
+    // flushes are in flight at a time.
+    if (_repair_flushes_in_flight >= max_repair_flushes_in_flight || need_throttle_writes()) {
+        _repair_flush_timer.arm(repair_flush_period);
+        return;
+    }
+    std::vector<std::unordered_map<gms::inet_address, std::experimental::optional<mutation>>> writes;
+    writes.reserve(_stats.read_repair_queue_length);
+    for (auto&& replica : _repair_queue) {
+        for (auto&& t : replica.second) {
+            for (auto&& m : t.second) {
+                writes.emplace_back();
+                writes.back().emplace(replica.first, std::move(m));
+            }
+        }
+    }
+    _repair_queue.clear();
+    _stats.read_repair_queue_length = 0;
+    logger.trace("Flushing {} background read repair writes", writes.size());
+
+    // The writes of a replica go out as one MUTATION_BATCH message, see mutate_begin().
+    _repair_flushes_in_flight++;
+    with_gate(_repair_gate, [this, writes = std::move(writes)] () mutable {
+        return mutate_internal(std::move(writes), db::consistency_level::ONE, tracing::trace_state_ptr());
+    }).handle_exception([] (std::exception_ptr eptr) {
+        logger.debug("Background read repair writes failed: {}", eptr);
+    }).finally([this, p = shared_from_this()] {
+        _repair_flushes_in_flight--;
+    });
+}
+
 class abstract_read_resolver {
 protected:
     db::consistency_level _cl;
@@ -1985,6 +2440,30 @@ class data_read_resolver : public abstract_read_resolver {
             }
         };
 
+        // Replicas which ended early on the size limit have sent whole
+        // partitions up to some key, and nothing about those after it. Drop
+        // what the others sent past the smallest such key, so that no
+        // partition is reconciled from an incomplete set of versions.
+        bool short_read = false;
+        reply* shortest = nullptr;
+        for (reply& r : _data_results) {
+            if (r.result->is_short_read()) {
+                short_read = true;
+                if (!shortest || cmp(*shortest, r)) {
+                    shortest = &r;
+                }
+            }
+        }
+        if (shortest) {
+            auto end = shortest->result->partitions().back().mut().key(s);
+            for (reply& r : _data_results) {
+                auto& partitions = r.result->partitions();
+                while (!partitions.empty() && partitions.back().mut().key(s).ring_order_tri_compare(s, end) > 0) {
+                    partitions.pop_back();
+                }
+            }
+        }
+
         // this array will have an entry for each partition which will hold all available versions
         std::vector<std::vector<version>> versions;
         versions.reserve(_data_results.front().result->partitions().size());
@@ -2086,7 +2565,7 @@ class data_read_resolver : public abstract_read_resolver {
             return std::ref(a);
         });
 
-        return reconcilable_result(_total_live_count, std::move(r.get()));
+        return reconcilable_result(_total_live_count, std::move(r.get()), short_read);
     }
     auto total_live_count() const {
         return _total_live_count;
@@ -2096,6 +2575,107 @@ class data_read_resolver : public abstract_read_resolver {
     }
 };
 
+// Remote data and digest requests of the single partition reads of one query,
+// by replica, so that each replica gets one READ_DATA_BATCH message for all
+// the partitions it is asked about, instead of one message per partition.
+// Requests are collected until flush(), those made later (speculative
+// retries, for instance) are sent on their own.
+class batched_reads {
+    struct destination {
+        std::vector<query::partition_range> data_ranges;
+        std::vector<promise<query::result>> data;
+        std::vector<query::partition_range> digest_ranges;
+        std::vector<promise<query::result_digest, api::timestamp_type>> digests;
+    };
+    using clock_type = std::chrono::steady_clock;
+
+    lw_shared_ptr<query::read_command> _cmd;
+    query::digest_algorithm _digest_algorithm;
+    // By replica and whether data replies carry a digest.
+    std::map<std::pair<gms::inet_address, bool>, destination> _destinations;
+    bool _flushed = false;
+public:
+    static constexpr size_t max_ranges_per_message = 128;
+
+    batched_reads(lw_shared_ptr<query::read_command> cmd, query::digest_algorithm da)
+        : _cmd(std::move(cmd))
+        , _digest_algorithm(da)
+    { }
+
+    bool open() const {
+        return !_flushed;
+    }
+
+    future<query::result> add_data(gms::inet_address ep, const query::partition_range& pr, query::digest_algorithm da) {
+        auto& d = _destinations[std::make_pair(ep, da != query::digest_algorithm::none)];
+        d.data_ranges.push_back(pr);
+        d.data.emplace_back();
+        return d.data.back().get_future();
+    }
+
+    future<query::result_digest, api::timestamp_type> add_digest(gms::inet_address ep, const query::partition_range& pr) {
+        auto& d = _destinations[std::make_pair(ep, true)];
+        d.digest_ranges.push_back(pr);
+        d.digests.emplace_back();
+        return d.digests.back().get_future();
+    }
+
+    void flush(clock_type::time_point timeout) {
+        _flushed = true;
+        for (auto&& e : _destinations) {
+            auto& d = e.second;
+            auto n = std::max(d.data_ranges.size(), d.digest_ranges.size());
+            for (size_t i = 0; i < n; i += max_ranges_per_message) {
+                send(e.first.first, e.first.second, timeout, d, i, std::min(n, i + max_ranges_per_message));
+            }
+        }
+        _destinations.clear();
+    }
+private:
+    template<typename T>
+    static std::vector<T> slice(std::vector<T>& v, size_t begin, size_t end) {
+        begin = std::min(begin, v.size());
+        end = std::min(end, v.size());
+        return std::vector<T>(std::make_move_iterator(v.begin() + begin), std::make_move_iterator(v.begin() + end));
+    }
+
+    void send(gms::inet_address ep, bool data_digest, clock_type::time_point timeout, destination& d, size_t begin, size_t end) {
+        auto data_ranges = slice(d.data_ranges, begin, end);
+        auto digest_ranges = slice(d.digest_ranges, begin, end);
+        auto& ms = net::get_local_messaging_service();
+        ms.send_read_data_batch(net::messaging_service::msg_addr{ep, 0}, timeout, *_cmd, data_ranges, digest_ranges, _digest_algorithm, data_digest).then_wrapped(
+                [data = slice(d.data, begin, end), digests = slice(d.digests, begin, end)] (future<std::vector<query::result>> f) mutable {
+            try {
+                auto results = f.get0();
+                if (results.size() != data.size() + digests.size()) {
+                    throw std::runtime_error(sprint("read_data_batch: expected %d results, got %d", data.size() + digests.size(), results.size()));
+                }
+                auto r = results.begin();
+                for (auto& p : data) {
+                    p.set_value(std::move(*r++));
+                }
+                for (auto& p : digests) {
+                    auto& res = *r++;
+                    if (!res.digest()) {
+                        throw std::runtime_error("read_data_batch: digest missing from reply");
+                    }
+                    p.set_value(*res.digest(), res.last_modified());
+                }
+            } catch (...) {
+                auto ex = std::current_exception();
+                for (auto& p : data) {
+                    p.set_exception(ex);
+                }
+                for (auto& p : digests) {
+                    p.set_exception(ex);
+                }
+            }
+        });
+    }
+};
+
+constexpr size_t batched_reads::max_ranges_per_message;
+
 class abstract_read_executor : public enable_shared_from_this<abstract_read_executor> {
 protected:
     using targets_iterator = std::vector<gms::inet_address>::iterator;
@@ -2107,24 +2687,62 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     shared_ptr<storage_proxy> _proxy;
     lw_shared_ptr<query::read_command> _cmd;
     lw_shared_ptr<query::read_command> _retry_cmd;
+    // Command of the reconciliation page being read, before any retries.
+    lw_shared_ptr<query::read_command> _page_cmd;
     query::partition_range _partition_range;
     db::consistency_level _cl;
     size_t _block_for;
     std::vector<gms::inet_address> _targets;
     promise<foreign_ptr<lw_shared_ptr<query::result>>> _result_promise;
     tracing::trace_state_ptr _trace_state;
+    // Chosen once, so that every replica of this read hashes the same way.
+    query::digest_algorithm _digest_algorithm;
+
+    // State of a reconciliation done in pages, see read_repair_page_size_in_rows.
+    struct paged_reconcile_state {
+        uint32_t page_rows;
+        // Live rows the client asked for, and those reconciled so far.
+        uint32_t row_limit;
+        uint32_t live_rows = 0;
+        partition_key key;
+        // Clustering ranges not read yet.
+        query::clustering_row_ranges ranges;
+        // Reconciled pages merged together.
+        stdx::optional<mutation> result;
+    };
+    stdx::optional<paged_reconcile_state> _paged_reconcile;
+    // Set when reconciling after the client got its result, the repair
+    // writes are then queued instead of waited for.
+    bool _background_repair = false;
+    // Set if the remote requests of this read are batched with those of
+    // other partitions of the same query.
+    lw_shared_ptr<batched_reads> _batch;
 
 public:
     abstract_read_executor(schema_ptr s, shared_ptr<storage_proxy> proxy, lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl, size_t block_for,
             std::vector<gms::inet_address> targets, tracing::trace_state_ptr trace_state) :
-                           _schema(std::move(s)), _proxy(std::move(proxy)), _cmd(std::move(cmd)), _partition_range(std::move(pr)), _cl(cl), _block_for(block_for), _targets(std::move(targets)), _trace_state(std::move(trace_state)) {
+                           _schema(std::move(s)), _proxy(std::move(proxy)), _cmd(std::move(cmd)), _partition_range(std::move(pr)), _cl(cl), _block_for(block_for), _targets(std::move(targets)), _trace_state(std::move(trace_state)),
+                           _digest_algorithm(_proxy->digest_algorithm()) {
+        _page_cmd = _cmd;
         _proxy->_stats.reads++;
     }
     virtual ~abstract_read_executor() {
         _proxy->_stats.reads--;
     };
 
+    void set_batch(lw_shared_ptr<batched_reads> batch) {
+        _batch = std::move(batch);
+    }
+
 protected:
+    // Feeds the response time of a replica, including failed and timed out
+    // requests, to the dynamic snitch.
+    void record_latency(gms::inet_address ep, clock_type::time_point start) {
+        tracing::record_replica_response(_trace_state, ep);
+        if (_proxy->use_dynamic_snitch()) {
+            locator::get_local_dynamic_snitch().receive_timing(ep, clock_type::now() - start);
+        }
+    }
     future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> make_mutation_data_request(lw_shared_ptr<query::read_command> cmd, gms::inet_address ep, clock_type::time_point timeout) {
         ++_proxy->_stats.mutation_data_read_attempts.get_ep_stat(ep);
         if (is_me(ep)) {
@@ -2139,16 +2757,32 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
             });
         }
     }
+    // The digest of a data reply is only compared with the digests of other
+    // replicas, so don't bother computing it if there are none.
+    query::digest_algorithm data_digest_algorithm() const {
+        return _targets.size() > 1 ? _digest_algorithm : query::digest_algorithm::none;
+    }
     future<foreign_ptr<lw_shared_ptr<query::result>>> make_data_request(gms::inet_address ep, clock_type::time_point timeout) {
         ++_proxy->_stats.data_read_attempts.get_ep_stat(ep);
         if (is_me(ep)) {
             tracing::trace(_trace_state, "read_data: querying locally");
-            return _proxy->query_singular_local(_schema, _cmd, _partition_range);
+            return _proxy->query_singular_local(_schema, _cmd, _partition_range, query::result_options::data(data_digest_algorithm()), _trace_state);
         } else {
+            if (_batch && _batch->open()) {
+                tracing::trace(_trace_state, "read_data: adding to a batch for /{}", ep);
+                return _batch->add_data(ep, _partition_range, data_digest_algorithm()).then([this, ep](query::result&& result) {
+                    tracing::trace(_trace_state, "read_data: got response from /{}", ep);
+                    return make_foreign(::make_lw_shared<query::result>(std::move(result)));
+                });
+            }
             auto& ms = net::get_local_messaging_service();
             tracing::trace(_trace_state, "read_data: sending a message to /{}", ep);
-            return ms.send_read_data(net::messaging_service::msg_addr{ep, 0}, timeout, *_cmd, _partition_range).then([this, ep](query::result&& result) {
+            return ms.send_read_data(net::messaging_service::msg_addr{ep, 0}, timeout, *_cmd, _partition_range, data_digest_algorithm()).then([this, ep](query::result&& result,
+                    rpc::optional<replica_load> load) {
                 tracing::trace(_trace_state, "read_data: got response from /{}", ep);
+                if (load) {
+                    _proxy->update_replica_load(ep, *load);
+                }
                 return make_foreign(::make_lw_shared<query::result>(std::move(result)));
             });
         }
@@ -2157,19 +2791,32 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
         ++_proxy->_stats.digest_read_attempts.get_ep_stat(ep);
         if (is_me(ep)) {
             tracing::trace(_trace_state, "read_digest: querying locally");
-            return _proxy->query_singular_local_digest(_schema, _cmd, _partition_range);
+            return _proxy->query_singular_local_digest(_schema, _cmd, _partition_range, _digest_algorithm, _trace_state);
         } else {
+            if (_batch && _batch->open()) {
+                tracing::trace(_trace_state, "read_digest: adding to a batch for /{}", ep);
+                return _batch->add_digest(ep, _partition_range).then([this, ep] (query::result_digest d, api::timestamp_type t) {
+                    tracing::trace(_trace_state, "read_digest: got response from /{}", ep);
+                    return make_ready_future<query::result_digest, api::timestamp_type>(d, t);
+                });
+            }
             auto& ms = net::get_local_messaging_service();
             tracing::trace(_trace_state, "read_digest: sending a message to /{}", ep);
-            return ms.send_read_digest(net::messaging_service::msg_addr{ep, 0}, timeout, *_cmd, _partition_range).then([this, ep] (query::result_digest d, rpc::optional<api::timestamp_type> t) {
+            return ms.send_read_digest(net::messaging_service::msg_addr{ep, 0}, timeout, *_cmd, _partition_range, _digest_algorithm).then([this, ep] (query::result_digest d, rpc::optional<api::timestamp_type> t,
+                    rpc::optional<replica_load> load) {
                 tracing::trace(_trace_state, "read_digest: got response from /{}", ep);
+                if (load) {
+                    _proxy->update_replica_load(ep, *load);
+                }
                 return make_ready_future<query::result_digest, api::timestamp_type>(d, t ? t.value() : api::missing_timestamp);
             });
         }
     }
     future<> make_mutation_data_requests(lw_shared_ptr<query::read_command> cmd, data_resolver_ptr resolver, targets_iterator begin, targets_iterator end, clock_type::time_point timeout) {
         return parallel_for_each(begin, end, [this, &cmd, resolver = std::move(resolver), timeout] (gms::inet_address ep) {
-            return make_mutation_data_request(cmd, ep, timeout).then_wrapped([this, resolver, ep] (future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> f) {
+            auto start = clock_type::now();
+            return make_mutation_data_request(cmd, ep, timeout).then_wrapped([this, resolver, ep, start] (future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> f) {
+                record_latency(ep, start);
                 try {
                     resolver->add_mutate_data(ep, f.get0());
                     ++_proxy->_stats.mutation_data_read_completed.get_ep_stat(ep);
@@ -2182,9 +2829,13 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     }
     future<> make_data_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end, clock_type::time_point timeout) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver), timeout] (gms::inet_address ep) {
-            return make_data_request(ep, timeout).then_wrapped([this, resolver, ep] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+            auto start = clock_type::now();
+            return make_data_request(ep, timeout).then_wrapped([this, resolver, ep, start] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+                record_latency(ep, start);
                 try {
-                    resolver->add_data(ep, f.get0());
+                    auto result = f.get0();
+                    tracing::add_scanned_tombstones(_trace_state, result->scanned_tombstones());
+                    resolver->add_data(ep, std::move(result));
                     ++_proxy->_stats.data_read_completed.get_ep_stat(ep);
                 } catch(...) {
                     ++_proxy->_stats.data_read_errors.get_ep_stat(ep);
@@ -2195,7 +2846,9 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     }
     future<> make_digest_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end, clock_type::time_point timeout) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver), timeout] (gms::inet_address ep) {
-            return make_digest_request(ep, timeout).then_wrapped([this, resolver, ep] (future<query::result_digest, api::timestamp_type> f) {
+            auto start = clock_type::now();
+            return make_digest_request(ep, timeout).then_wrapped([this, resolver, ep, start] (future<query::result_digest, api::timestamp_type> f) {
+                record_latency(ep, start);
                 try {
                     auto v = f.get();
                     resolver->add_digest(ep, std::get<0>(v), std::get<1>(v));
@@ -2214,10 +2867,84 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     }
     virtual void got_cl() {}
     uint32_t original_row_limit() const {
-        return _cmd->row_limit;
+        return _page_cmd->row_limit;
     }
     uint32_t original_per_partition_row_limit() const {
-        return _cmd->slice.partition_row_limit();
+        return _page_cmd->slice.partition_row_limit();
+    }
+    // Wide partitions are reconciled in pages, so that we never hold every
+    // replica's version of the whole partition.
+    bool should_reconcile_in_pages(uint32_t page_rows) const {
+        return page_rows && _partition_range.is_singular() && _partition_range.start()->value().has_key()
+            && !_cmd->slice.options.contains(query::partition_slice::option::reversed)
+            && !_cmd->slice.options.contains(query::partition_slice::option::count_rows)
+            && std::min(_cmd->row_limit, _cmd->slice.partition_row_limit()) > page_rows;
+    }
+    lw_shared_ptr<query::read_command> make_reconcile_page_cmd() {
+        auto& st = *_paged_reconcile;
+        auto cmd = make_lw_shared<query::read_command>(*_cmd);
+        auto limit = std::min(st.page_rows, st.row_limit - st.live_rows);
+        cmd->row_limit = limit;
+        cmd->slice.set_partition_row_limit(limit);
+        cmd->slice.set_range(*_schema, st.key, st.ranges);
+        _page_cmd = cmd;
+        return cmd;
+    }
+    // Returns the part of ranges which sorts after ck.
+    static query::clustering_row_ranges ranges_after(const schema& s, const query::clustering_row_ranges& ranges, const clustering_key& ck) {
+        clustering_key_prefix::prefix_equal_tri_compare cmp(s);
+        query::clustering_row_ranges ret;
+        for (auto&& r : ranges) {
+            if (r.before(ck, cmp)) {
+                ret.push_back(r);
+            } else if (!r.after(ck, cmp) && !r.is_singular()) {
+                ret.emplace_back(query::clustering_range::bound(ck, false), r.end());
+            }
+        }
+        return ret;
+    }
+    // Merges a reconciled page into the result and returns the command
+    // reading the next page, or nullptr if this was the last one.
+    lw_shared_ptr<query::read_command> add_reconciled_page(const reconcilable_result& rr) {
+        auto& st = *_paged_reconcile;
+        auto& s = *_schema;
+        auto limit = original_row_limit();
+        uint32_t live_rows = 0;
+        stdx::optional<clustering_key> last;
+        for (auto&& p : rr.partitions()) {
+            auto m = p.mut().unfreeze(_schema);
+            auto mp = m.partition();
+            live_rows += mp.compact_for_query(s, _cmd->timestamp, st.ranges, false, limit);
+            if (!mp.clustered_rows().empty()) {
+                last = mp.clustered_rows().rbegin()->key();
+            }
+            if (st.result) {
+                st.result->apply(std::move(m));
+            } else {
+                st.result = std::move(m);
+            }
+        }
+        st.live_rows += std::min(live_rows, limit);
+        // Fewer rows than asked for means replicas have nothing more in the ranges.
+        if (live_rows < limit || !last || st.live_rows >= st.row_limit) {
+            return nullptr;
+        }
+        st.ranges = ranges_after(s, st.ranges, *last);
+        if (st.ranges.empty()) {
+            return nullptr;
+        }
+        logger.trace("Reconciled {} rows of {}, reading next page", st.live_rows, st.row_limit);
+        return make_reconcile_page_cmd();
+    }
+    query::result finish_paged_reconcile() {
+        auto& st = *_paged_reconcile;
+        std::vector<partition> partitions;
+        if (st.result) {
+            partitions.emplace_back(partition(st.live_rows, freeze(*st.result)));
+        }
+        // Pages may have brought rows beyond the limit, the slice of the
+        // original command drops them.
+        return to_data_query_result(reconcilable_result(st.live_rows, std::move(partitions)), _schema, _cmd->slice);
     }
     void reconcile(db::consistency_level cl, std::chrono::steady_clock::time_point timeout, lw_shared_ptr<query::read_command> cmd) {
         data_resolver_ptr data_resolver = ::make_shared<data_read_resolver>(_schema, cl, _targets.size(), timeout);
@@ -2233,14 +2960,40 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                 // We generate a retry if at least one node reply with count live columns but after merge we have less
                 // than the total number of column we are interested in (which may be < count on a retry).
                 // So in particular, if no host returned count live columns, we know it's not a short read.
-                if (rr_opt && (data_resolver->max_live_count() < cmd->row_limit || rr_opt->row_count() >= original_row_limit())
+                // A result cut short by the size limit is complete up to where
+                // it ends, so it needs no retry unless nothing there is live.
+                auto size_limited = rr_opt && rr_opt->is_short_read();
+                if (rr_opt && (size_limited ? rr_opt->row_count() > 0 : (data_resolver->max_live_count() < cmd->row_limit || rr_opt->row_count() >= original_row_limit()))
                         && !data_resolver->any_partition_short_read()) {
-                    auto result = ::make_foreign(::make_lw_shared(to_data_query_result(std::move(*rr_opt), _schema, _cmd->slice)));
+                    foreign_ptr<lw_shared_ptr<query::result>> result;
+                    lw_shared_ptr<query::read_command> next_page;
+                    if (_paged_reconcile) {
+                        next_page = add_reconciled_page(*rr_opt);
+                        if (!next_page) {
+                            result = ::make_foreign(::make_lw_shared(finish_paged_reconcile()));
+                        }
+                    } else {
+                        result = ::make_foreign(::make_lw_shared(to_data_query_result(std::move(*rr_opt), _schema, _cmd->slice)));
+                    }
+                    rr_opt = {};
                     // wait for write to complete before returning result to prevent multiple concurrent read requests to
                     // trigger repair multiple times and to prevent quorum read to return an old value, even after a quorum
                     // another read had returned a newer value (but the newer value had not yet been sent to the other replicas)
-                    _proxy->schedule_repair(data_resolver->get_diffs_for_repair(), _cl, _trace_state).then([this, result = std::move(result)] () mutable {
-                        _result_promise.set_value(std::move(result));
+                    // When reconciling in pages, this also keeps at most one page of repair mutations in flight.
+                    // Nobody waits for a background repair, so its writes are left to the repair queue.
+                    future<> repaired = make_ready_future<>();
+                    if (_background_repair) {
+                        _proxy->queue_repair(data_resolver->get_diffs_for_repair());
+                    } else {
+                        repaired = _proxy->schedule_repair(data_resolver->get_diffs_for_repair(), _cl, _trace_state);
+                    }
+                    repaired.then([this, exec, cl, timeout,
+                            result = std::move(result), next_page = std::move(next_page)] () mutable {
+                        if (next_page) {
+                            reconcile(cl, timeout, std::move(next_page));
+                        } else {
+                            _result_promise.set_value(std::move(result));
+                        }
                     }).handle_exception([this, exec] (std::exception_ptr eptr) {
                         try {
                             std::rethrow_exception(eptr);
@@ -2262,7 +3015,10 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                         auto ret = std::min(static_cast<uint64_t>(query::max_rows), l == 0 ? t + 1 : ((t * t) / l) + 1);
                         return static_cast<uint32_t>(ret);
                     };
-                    if (data_resolver->any_partition_short_read() || data_resolver->increase_per_partition_limit()) {
+                    if (size_limited && !rr_opt->row_count()) {
+                        // Everything the replicas sent within the limit is dead.
+                        _retry_cmd->max_result_size = cmd->max_result_size * 2;
+                    } else if (data_resolver->any_partition_short_read() || data_resolver->increase_per_partition_limit()) {
                         // The number of live rows was bounded by the per partition limit.
                         auto new_limit = x(cmd->slice.partition_row_limit(), data_resolver->max_partition_live_count());
                         _retry_cmd->slice.set_partition_row_limit(new_limit);
@@ -2280,7 +3036,17 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
         });
     }
     void reconcile(db::consistency_level cl, std::chrono::steady_clock::time_point timeout) {
-        reconcile(cl, timeout, _cmd);
+        _paged_reconcile = {};
+        _page_cmd = _cmd;
+        auto page_rows = _proxy->get_db().local().get_config().read_repair_page_size_in_rows();
+        if (should_reconcile_in_pages(page_rows)) {
+            auto& key = _partition_range.start()->value().key().value();
+            _paged_reconcile = paged_reconcile_state{page_rows, std::min(_cmd->row_limit, _cmd->slice.partition_row_limit()),
+                    0, key, _cmd->slice.row_ranges(*_schema, key), {}};
+            reconcile(cl, timeout, make_reconcile_page_cmd());
+        } else {
+            reconcile(cl, timeout, _cmd);
+        }
     }
 
 public:
@@ -2329,6 +3095,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                 if (background_repair_check && !digest_resolver->digests_match()) {
                     exec->_proxy->_stats.read_repair_repaired_background++;
                     exec->_result_promise = promise<foreign_ptr<lw_shared_ptr<query::result>>>();
+                    exec->_background_repair = true;
                     exec->reconcile(exec->_cl, timeout);
                     return exec->_result_promise.get_future().discard_result();
                 } else {
@@ -2364,6 +3131,28 @@ class always_speculating_read_executor : public abstract_read_executor {
 // this executor sends request to an additional replica after some time below timeout
 class speculating_read_executor : public abstract_read_executor {
     timer<> _speculate_timer;
+private:
+    // How long to wait for the first replicas before contacting the extra one:
+    // the table's read latency at the speculative_retry percentile, or the
+    // fixed delay of the "Yms" policy. Until the table has seen enough reads
+    // for the percentile to mean anything, half the read timeout.
+    std::chrono::microseconds speculation_delay() const {
+        auto& sr = _schema->speculative_retry();
+        if (sr.get_type() == speculative_retry::type::CUSTOM) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double, std::milli>(sr.get_value()));
+        }
+        auto& db = _proxy->get_db().local();
+        std::chrono::microseconds fallback = std::chrono::milliseconds(db.get_config().read_request_timeout_in_ms() / 2);
+        if (!db.column_family_exists(_schema->id())) {
+            return fallback;
+        }
+        auto& hist = db.find_column_family(_schema).get_stats().estimated_read;
+        if (hist.count() < min_reads_for_percentile) {
+            return fallback;
+        }
+        return std::min(std::chrono::microseconds(hist.percentile(sr.get_value())), fallback);
+    }
+    static constexpr int64_t min_reads_for_percentile = 100;
 public:
     using abstract_read_executor::abstract_read_executor;
     virtual future<> make_requests(digest_resolver_ptr resolver, std::chrono::steady_clock::time_point timeout) {
@@ -2376,12 +3165,7 @@ class speculating_read_executor : public abstract_read_executor {
                 f.finally([exec = shared_from_this()]{});
             }
         });
-        auto& sr = _schema->speculative_retry();
-        auto t = (sr.get_type() == speculative_retry::type::PERCENTILE) ?
-            // FIXME: the timeout should come from previous latency statistics for a partition
-            std::chrono::milliseconds(_proxy->get_db().local().get_config().read_request_timeout_in_ms()/2) :
-            std::chrono::milliseconds(unsigned(sr.get_value()));
-        _speculate_timer.arm(t);
+        _speculate_timer.arm(speculation_delay());
 
         // if CL + RR result in covering all replicas, getReadExecutor forces AlwaysSpeculating.  So we know
         // that the last replica in our list is "extra."
@@ -2409,6 +3193,11 @@ class range_slice_read_executor : public abstract_read_executor {
     range_slice_read_executor(schema_ptr s, shared_ptr<storage_proxy> proxy, lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl, std::vector<gms::inet_address> targets, tracing::trace_state_ptr trace_state) :
                                     abstract_read_executor(std::move(s), std::move(proxy), std::move(cmd), std::move(pr), cl, targets.size(), std::move(targets), std::move(trace_state)) {}
     virtual future<foreign_ptr<lw_shared_ptr<query::result>>> execute(std::chrono::steady_clock::time_point timeout) override {
+        if (_cmd->slice.options.contains<query::partition_slice::option::count_rows>()) {
+            // Only used with a single target, see select_statement; there
+            // is nothing to reconcile a row count with.
+            return make_data_request(_targets[0], timeout).finally([exec = shared_from_this()] {});
+        }
         reconcile(_cl, timeout);
         return _result_promise.get_future();
     }
@@ -2487,19 +3276,38 @@ ::shared_ptr<abstract_read_executor> storage_proxy::get_read_executor(lw_shared_
 }
 
 future<query::result_digest, api::timestamp_type>
-storage_proxy::query_singular_local_digest(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr) {
-    return query_singular_local(std::move(s), std::move(cmd), pr, query::result_request::only_digest).then([] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+storage_proxy::query_singular_local_digest(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, query::digest_algorithm da,
+                                           tracing::trace_state_ptr trace_state) {
+    return query_singular_local(std::move(s), std::move(cmd), pr, query::result_options::only_digest(da), std::move(trace_state)).then([] (foreign_ptr<lw_shared_ptr<query::result>> result) {
         return make_ready_future<query::result_digest, api::timestamp_type>(*result->digest(), result->last_modified());
     });
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
-storage_proxy::query_singular_local(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, query::result_request request) {
+storage_proxy::query_singular_local(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, query::result_options opts,
+                                    tracing::trace_state_ptr trace_state) {
+    if (!pr.is_singular() && cmd->slice.options.contains<query::partition_slice::option::count_rows>()) {
+        return count_rows_locally(std::move(s), std::move(cmd), pr);
+    }
     unsigned shard = _db.local().shard_of(pr.start()->value().token());
-    return _db.invoke_on(shard, [gs = global_schema_ptr(s), prv = std::vector<query::partition_range>({pr}) /* FIXME: pr is copied */, cmd, request] (database& db) {
-        return db.query(gs, *cmd, request, prv).then([](auto&& f) {
+    return _db.invoke_on(shard, [gs = global_schema_ptr(s), prv = std::vector<query::partition_range>({pr}) /* FIXME: pr is copied */, cmd, opts] (database& db) {
+        return db.query(gs, *cmd, opts, prv).then([](auto&& f) {
             return make_foreign(std::move(f));
         });
+    }).then([trace_state = std::move(trace_state)] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+        tracing::trace(trace_state, "Scanned {} tombstones", result->scanned_tombstones());
+        return result;
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<query::result>>>
+storage_proxy::count_rows_locally(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr) {
+    return _db.map_reduce0([cmd, prv = std::vector<query::partition_range>({pr}), gs = global_schema_ptr(s)] (database& db) {
+        return db.query(gs, *cmd, query::result_request::only_result, prv).then([] (lw_shared_ptr<query::result> r) {
+            return *r->row_count();
+        });
+    }, uint32_t(0), std::plus<uint32_t>()).then([] (uint32_t row_count) {
+        return make_foreign(make_lw_shared<query::result>(row_count));
     });
 }
 
@@ -2520,19 +3328,33 @@ storage_proxy::query_singular(lw_shared_ptr<query::read_command> cmd, std::vecto
     exec.reserve(partition_ranges.size());
     auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms());
 
+    // Coalesce the remote requests of multi-partition reads into one message per replica.
+    lw_shared_ptr<batched_reads> batch;
+    if (partition_ranges.size() > 1 && get_local_storage_service().cluster_supports_read_data_batch()) {
+        batch = make_lw_shared<batched_reads>(cmd, digest_algorithm());
+    }
+
     for (auto&& pr: partition_ranges) {
         if (!pr.is_singular()) {
             throw std::runtime_error("mixed singular and non singular range are not supported");
         }
         exec.push_back(get_read_executor(cmd, std::move(pr), cl, trace_state));
+        if (batch) {
+            exec.back()->set_batch(batch);
+        }
     }
 
-    query::result_merger merger;
+    query::result_merger merger(cmd->max_result_size);
     merger.reserve(exec.size());
 
+    // map_reduce() executes all reads before returning, so their first
+    // requests are all in the batch once it returns.
     auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
         return rex->execute(timeout);
     }, std::move(merger));
+    if (batch) {
+        batch->flush(timeout);
+    }
 
     return f.handle_exception([exec = std::move(exec), p = shared_from_this()] (std::exception_ptr eptr) {
         // hold onto exec until read is complete
@@ -2541,21 +3363,60 @@ storage_proxy::query_singular(lw_shared_ptr<query::read_command> cmd, std::vecto
     });
 }
 
-future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>
-storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout, std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results,
+// Gives the results of the sub-queries of a range scan, which are in ring
+// order, to merger in that order, each as soon as it and those before it
+// arrived. Once merger is done, the sub-queries which are still running
+// are no longer waited for, and their results are dropped when they come.
+static future<> merge_in_order(std::vector<future<foreign_ptr<lw_shared_ptr<query::result>>>> sub_results,
+        lw_shared_ptr<query::streaming_result_merger> merger) {
+    return do_with(std::move(sub_results), size_t(0), [merger] (auto& sub_results, size_t& next) {
+        auto drop_rest = [&sub_results, &next] {
+            for (; next < sub_results.size(); ++next) {
+                sub_results[next].discard_result().handle_exception([] (std::exception_ptr) { });
+            }
+        };
+        return repeat([&sub_results, &next, merger, drop_rest] {
+            if (next == sub_results.size()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            if (merger->done()) {
+                drop_rest();
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return sub_results[next++].then_wrapped([merger, drop_rest] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+                try {
+                    (*merger)(f.get0());
+                } catch (...) {
+                    drop_rest();
+                    throw;
+                }
+                return stop_iteration::no;
+            });
+        });
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<query::result>>>
+storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout, lw_shared_ptr<query::streaming_result_merger> merger,
         lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-        std::vector<query::partition_range>&& ranges, int concurrency_factor, tracing::trace_state_ptr trace_state, uint32_t total_row_count) {
+        std::vector<query::partition_range>&& ranges, int concurrency_factor, tracing::trace_state_ptr trace_state) {
     schema_ptr schema = local_schema_registry().get(cmd->schema_version);
     keyspace& ks = _db.local().find_keyspace(schema->ks_name());
     std::vector<::shared_ptr<abstract_read_executor>> exec;
     auto concurrent_fetch_starting_index = i;
     auto p = shared_from_this();
 
+    // Replicas of the range the previous sub-query stopped merging at, so
+    // that they aren't looked up again for the sub-query starting there.
+    std::vector<gms::inet_address> next_live_endpoints;
     while (i != ranges.end() && std::distance(concurrent_fetch_starting_index, i) < concurrency_factor) {
         query::partition_range& range = *i;
-        std::vector<gms::inet_address> live_endpoints = get_live_sorted_endpoints(ks, end_token(range));
+        std::vector<gms::inet_address> live_endpoints = next_live_endpoints.empty()
+                ? get_live_sorted_endpoints(ks, end_token(range)) : std::move(next_live_endpoints);
+        next_live_endpoints.clear();
         std::vector<gms::inet_address> filtered_endpoints = filter_for_query(cl, ks, live_endpoints);
         ++i;
+        _stats.range_slice_ranges++;
 
         // getRestrictedRange has broken the queried range into per-[vnode] token ranges, but this doesn't take
         // the replication factor into account. If the intersection of live endpoints for 2 consecutive ranges
@@ -2564,7 +3425,6 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
         {
             query::partition_range& next_range = *i;
             std::vector<gms::inet_address> next_endpoints = get_live_sorted_endpoints(ks, end_token(next_range));
-            std::vector<gms::inet_address> next_filtered_endpoints = filter_for_query(cl, ks, next_endpoints);
 
             // Origin has this to say here:
             // *  If the current range right is the min token, we should stop merging because CFS.getRangeSlice
@@ -2574,13 +3434,26 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
             // *  wire compatibility, so It's likely easier not to bother;
             // It obviously not apply for us(?), but lets follow origin for now
             if (end_token(range) == dht::maximum_token()) {
+                next_live_endpoints = std::move(next_endpoints);
                 break;
             }
 
+            // With vnodes, runs of ranges replicated by exactly the same
+            // nodes are common, and merging them needs none of the checks
+            // below: the sub-query goes to the same replicas either way.
+            if (next_endpoints == live_endpoints) {
+                range = query::partition_range(range.start(), next_range.end());
+                _stats.range_slice_ranges++;
+                ++i;
+                continue;
+            }
+
+            std::vector<gms::inet_address> next_filtered_endpoints = filter_for_query(cl, ks, next_endpoints);
             std::vector<gms::inet_address> merged = intersection(live_endpoints, next_endpoints);
 
             // Check if there is enough endpoint for the merge to be possible.
             if (!is_sufficient_live_nodes(cl, ks, merged)) {
+                next_live_endpoints = std::move(next_endpoints);
                 break;
             }
 
@@ -2588,6 +3461,7 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
 
             // Estimate whether merging will be a win or not
             if (!locator::i_endpoint_snitch::get_local_snitch_ptr()->is_worth_merging_for_range_query(filtered_merged, filtered_endpoints, next_filtered_endpoints)) {
+                next_live_endpoints = std::move(next_endpoints);
                 break;
             }
 
@@ -2595,33 +3469,46 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
             range = query::partition_range(range.start(), next_range.end());
             live_endpoints = std::move(merged);
             filtered_endpoints = std::move(filtered_merged);
+            _stats.range_slice_ranges++;
             ++i;
         }
+        _stats.range_slice_subqueries++;
         logger.trace("creating range read executor with targets {}", filtered_endpoints);
         db::assure_sufficient_live_nodes(cl, ks, filtered_endpoints);
         exec.push_back(::make_shared<range_slice_read_executor>(schema, p, cmd, std::move(range), cl, std::move(filtered_endpoints), trace_state));
     }
 
-    query::result_merger merger;
-    merger.reserve(exec.size());
-
-    auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
-        return rex->execute(timeout);
-    }, std::move(merger));
+    std::vector<future<foreign_ptr<lw_shared_ptr<query::result>>>> sub_results;
+    sub_results.reserve(exec.size());
+    for (auto& rex : exec) {
+        sub_results.push_back(rex->execute(timeout));
+    }
 
-    return f.then([p, exec = std::move(exec), results = std::move(results), i = std::move(i), ranges = std::move(ranges), cl, cmd, concurrency_factor, timeout, total_row_count, trace_state = std::move(trace_state)]
-                   (foreign_ptr<lw_shared_ptr<query::result>>&& result) mutable {
-        total_row_count += result->row_count() ? result->row_count().value() :
-                (logger.error("no row count in query result, should not happen here"), result->calculate_row_count(cmd->slice));
-        results.emplace_back(std::move(result));
-        if (i == ranges.end() || total_row_count >= cmd->row_limit) {
-            return make_ready_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(std::move(results));
+    return merge_in_order(std::move(sub_results), merger).then([p, exec = std::move(exec), merger, i = std::move(i), ranges = std::move(ranges), cl, cmd, concurrency_factor, timeout, trace_state = std::move(trace_state)] () mutable {
+        auto total_row_count = merger->row_count();
+        if (i == ranges.end() || merger->done()) {
+            return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>>(merger->get(i != ranges.end()));
         } else {
-            return p->query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, std::move(i), std::move(ranges), concurrency_factor, std::move(trace_state), total_row_count);
+            // Adjust the number of ranges to query in parallel to the rows
+            // per range seen so far, like origin does: ramp up while ranges
+            // come back under-filled, so that sparse scans don't become a
+            // long sequence of round trips.
+            size_t ranges_done = std::distance(ranges.begin(), i);
+            size_t ranges_left = std::distance(i, ranges.end());
+            if (total_row_count == 0) {
+                concurrency_factor = std::min(ranges_left, size_t(concurrency_factor) * 2);
+            } else {
+                float rows_per_range = float(total_row_count) / ranges_done;
+                rows_per_range -= rows_per_range * CONCURRENT_SUBREQUESTS_MARGIN;
+                auto needed = std::ceil((cmd->row_limit - total_row_count) / rows_per_range);
+                concurrency_factor = std::max(1, int(std::min(float(ranges_left), needed)));
+            }
+            logger.trace("query_partition_key_range: {} rows from {} ranges so far, querying {} ranges next", total_row_count, ranges_done, concurrency_factor);
+            return p->query_partition_key_range_concurrent(timeout, std::move(merger), cmd, cl, std::move(i), std::move(ranges), concurrency_factor, std::move(trace_state));
         }
     }).handle_exception([p] (std::exception_ptr eptr) {
         p->handle_read_error(eptr);
-        return make_exception_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(eptr);
+        return make_exception_future<foreign_ptr<lw_shared_ptr<query::result>>>(eptr);
     });
 }
 
@@ -2647,22 +3534,13 @@ storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd,
     result_rows_per_range -= result_rows_per_range * CONCURRENT_SUBREQUESTS_MARGIN;
     int concurrency_factor = result_rows_per_range == 0.0 ? 1 : std::max(1, std::min(int(ranges.size()), int(std::ceil(cmd->row_limit / result_rows_per_range))));
 
-    std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results;
-    results.reserve(ranges.size()/concurrency_factor + 1);
+    // Sub-query results are merged as they arrive, rather than kept until
+    // the scan is done, so that the coordinator holds about one page.
+    auto merger = make_lw_shared<query::streaming_result_merger>(cmd->slice, cmd->row_limit, cmd->max_result_size);
     logger.debug("Estimated result rows per range: {}; requested rows: {}, ranges.size(): {}; concurrent range requests: {}",
             result_rows_per_range, cmd->row_limit, ranges.size(), concurrency_factor);
 
-    return query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, ranges.begin(), std::move(ranges), concurrency_factor, std::move(trace_state))
-            .then([](std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results) {
-        query::result_merger merger;
-        merger.reserve(results.size());
-
-        for (auto&& r: results) {
-            merger(std::move(r));
-        }
-
-        return merger.get();
-    });
+    return query_partition_key_range_concurrent(timeout, std::move(merger), cmd, cl, ranges.begin(), std::move(ranges), concurrency_factor, std::move(trace_state));
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
@@ -2709,11 +3587,18 @@ storage_proxy::do_query(schema_ptr s,
     auto p = shared_from_this();
 
     if (query::is_single_partition(partition_ranges[0])) { // do not support mixed partitions (yet?)
+        if (cmd->slice.options.contains<query::partition_slice::option::columnar>()) {
+            // Partitions read from a single replica come in its encoding, those
+            // reconciled here would be columnar, and they can't be merged.
+            cmd = make_lw_shared<query::read_command>(*cmd);
+            cmd->slice.options.remove<query::partition_slice::option::columnar>();
+        }
         try {
             return query_singular(cmd, std::move(partition_ranges), cl, std::move(trace_state)).finally([lc, p] () mutable {
                     p->_stats.read.mark(lc.stop().latency_in_nano());
                     if (lc.is_start()) {
                         p->_stats.estimated_read.add(lc.latency(), p->_stats.read.hist.count);
+                        p->_stats.read_latency.add(lc.latency());
                     }
             });
         } catch (const no_such_column_family&) {
@@ -2730,6 +3615,7 @@ storage_proxy::do_query(schema_ptr s,
 
     return query_partition_key_range(cmd, std::move(partition_ranges[0]), cl, std::move(trace_state)).finally([lc, p] () mutable {
         p->_stats.read.mark(lc.stop().latency_in_nano());
+        p->_stats.range_latency.add(lc.latency());
     });
 }
 
@@ -2799,17 +3685,40 @@ storage_proxy::do_query(schema_ptr s,
     }
 #endif
 
+bool storage_proxy::use_dynamic_snitch() const {
+    return _db.local().get_config().dynamic_snitch() && locator::get_dynamic_snitch().local_is_initialized();
+}
+
+query::digest_algorithm storage_proxy::digest_algorithm() const {
+    return get_local_storage_service().cluster_supports_murmur3_digest() ? query::digest_algorithm::murmur3 : query::digest_algorithm::MD5;
+}
+
 std::vector<gms::inet_address> storage_proxy::get_live_sorted_endpoints(keyspace& ks, const dht::token& token) {
     auto& rs = ks.get_replication_strategy();
     std::vector<gms::inet_address> eps = rs.get_natural_endpoints(token);
     auto itend = boost::range::remove_if(eps, std::not1(std::bind1st(std::mem_fn(&gms::failure_detector::is_alive), &gms::get_local_failure_detector())));
     eps.erase(itend, eps.end());
-    locator::i_endpoint_snitch::get_local_snitch_ptr()->sort_by_proximity(utils::fb_utilities::get_broadcast_address(), eps);
-    // FIXME: before dynamic snitch is implement put local address (if present) at the beginning
-    auto it = boost::range::find(eps, utils::fb_utilities::get_broadcast_address());
-    if (it != eps.end() && it != eps.begin()) {
-        std::iter_swap(it, eps.begin());
+    if (use_dynamic_snitch()) {
+        locator::get_local_dynamic_snitch().sort_by_proximity(utils::fb_utilities::get_broadcast_address(), eps);
+    } else {
+        locator::i_endpoint_snitch::get_local_snitch_ptr()->sort_by_proximity(utils::fb_utilities::get_broadcast_address(), eps);
+        // Without the dynamic snitch put local address (if present) at the beginning
+        auto it = boost::range::find(eps, utils::fb_utilities::get_broadcast_address());
+        if (it != eps.end() && it != eps.begin()) {
+            std::iter_swap(it, eps.begin());
+        }
     }
+    // Endpoints which stopped answering failure detector heartbeats are likely
+    // dead, but not yet convicted by gossip. Keep them, as they may still be
+    // needed to reach the consistency level, but try them last. Replicas which
+    // report to be overloaded go right before them.
+    auto& fd = gms::get_local_failure_detector();
+    auto rank = [this, &fd] (gms::inet_address ep) {
+        return fd.is_suspect(ep) ? 2 : read_overloaded(ep) ? 1 : 0;
+    };
+    std::stable_sort(eps.begin(), eps.end(), [&rank] (gms::inet_address a, gms::inet_address b) {
+        return rank(a) < rank(b);
+    });
     return eps;
 }
 
@@ -2970,7 +3879,17 @@ bool storage_proxy::should_hint(gms::inet_address ep) noexcept {
         return false;
     }
 
-    return false;
+    auto& cfg = _db.local().get_config();
+    if (!cfg.hinted_handoff_enabled() || !db::get_hints_manager().local_is_initialized()) {
+        return false;
+    }
+    // get_endpoint_downtime() is in microseconds
+    bool hint_window_expired = gms::get_local_gossiper().get_endpoint_downtime(ep) > int64_t(cfg.max_hint_window_in_ms()) * 1000;
+    if (hint_window_expired) {
+        db::get_local_hints_manager().note_not_stored(ep);
+        logger.trace("Not hinting {} which has been down longer than max_hint_window_in_ms", ep);
+    }
+    return !hint_window_expired;
 #if 0
     if (DatabaseDescriptor.shouldHintByDC())
     {
@@ -3209,9 +4128,28 @@ future<> storage_proxy::truncate_blocking(sstring keyspace, sstring cfname) {
     }
 #endif
 
+storage_proxy::clock_type::time_point
+storage_proxy::replica_deadline(const net::messaging_service::deadline_type& deadline, std::chrono::milliseconds timeout) const {
+    if (deadline && _db.local().get_config().cross_node_timeout()) {
+        if (*deadline == db_clock::time_point::max()) {
+            return clock_type::time_point::max();
+        }
+        return clock_type::now() + std::chrono::duration_cast<clock_type::duration>(*deadline - db_clock::now());
+    }
+    return clock_type::now() + timeout;
+}
+
+void storage_proxy::check_replica_read_deadline(clock_type::time_point deadline) {
+    if (clock_type::now() > deadline) {
+        ++_stats.expired_replica_reads;
+        throw expired_request_exception();
+    }
+}
+
 void storage_proxy::init_messaging_service() {
     auto& ms = net::get_local_messaging_service();
-    ms.register_mutation([] (const rpc::client_info& cinfo, frozen_mutation in, std::vector<gms::inet_address> forward, gms::inet_address reply_to, unsigned shard, storage_proxy::response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info) {
+    ms.register_mutation([] (const rpc::client_info& cinfo, frozen_mutation in, std::vector<gms::inet_address> forward, gms::inet_address reply_to, unsigned shard, storage_proxy::response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>> trace_info,
+            net::messaging_service::deadline_type odeadline) {
         tracing::trace_state_ptr trace_state_ptr;
         auto src_addr = net::messaging_service::get_source(cinfo);
 
@@ -3222,16 +4160,25 @@ void storage_proxy::init_messaging_service() {
             tracing::trace(trace_state_ptr, "Message received from /{}", src_addr.addr);
         }
 
-        return do_with(std::move(in), get_local_shared_storage_proxy(), [src_addr = std::move(src_addr), &cinfo, forward = std::move(forward), reply_to, shard, response_id, trace_state_ptr] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) mutable {
+        return do_with(std::move(in), get_local_shared_storage_proxy(), [src_addr = std::move(src_addr), &cinfo, forward = std::move(forward), reply_to, shard, response_id, trace_state_ptr, odeadline] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) mutable {
             ++p->_stats.received_mutations;
             p->_stats.forwarded_mutations += forward.size();
+            auto deadline = p->replica_deadline(odeadline, std::chrono::milliseconds(p->_db.local().get_config().write_request_timeout_in_ms()));
             return when_all(
                 // mutate_locally() may throw, putting it into apply() converts exception to a future.
-                futurize<void>::apply([&p, &m, reply_to, src_addr = std::move(src_addr)] () mutable {
-                    return get_schema_for_write(m.schema_version(), std::move(src_addr)).then([&m, &p] (schema_ptr s) {
+                futurize<void>::apply([&p, &m, reply_to, src_addr = std::move(src_addr), deadline] () mutable {
+                    return get_schema_for_write(m.schema_version(), std::move(src_addr)).then([&m, &p, deadline] (schema_ptr s) {
+                        if (clock_type::now() > deadline) {
+                            return make_exception_future<>(expired_request_exception());
+                        }
                         return p->mutate_locally(std::move(s), m);
                     });
-                }).then([reply_to, shard, response_id, trace_state_ptr] () {
+                }).then([&p, reply_to, shard, response_id, trace_state_ptr, deadline] () {
+                    if (clock_type::now() > deadline) {
+                        // The coordinator has given up on the write, don't add to the load on it.
+                        tracing::trace(trace_state_ptr, "Mutation expired, not sending mutation_done to /{}", reply_to);
+                        return make_exception_future<>(expired_request_exception());
+                    }
                     auto& ms = net::get_local_messaging_service();
                     // We wait for send_mutation_done to complete, otherwise, if reply_to is busy, we will accumulate
                     // lots of unsent responses, which can OOM our shard.
@@ -3239,17 +4186,22 @@ void storage_proxy::init_messaging_service() {
                     // Usually we will return immediately, since this work only involves appending data to the connection
                     // send buffer.
                     tracing::trace(trace_state_ptr, "Sending mutation_done to /{}", reply_to);
-                    return ms.send_mutation_done(net::messaging_service::msg_addr{reply_to, shard}, shard, response_id).then_wrapped([] (future<> f) {
+                    return ms.send_mutation_done(net::messaging_service::msg_addr{reply_to, shard}, shard, response_id, p->_db.local().get_load()).then_wrapped([] (future<> f) {
                         f.ignore_ready_future();
                     });
-                }).handle_exception([reply_to, shard] (std::exception_ptr eptr) {
-                    logger.warn("Failed to apply mutation from {}#{}: {}", reply_to, shard, eptr);
+                }).handle_exception([&p, reply_to, shard] (std::exception_ptr eptr) {
+                    try {
+                        std::rethrow_exception(eptr);
+                    } catch (expired_request_exception&) {
+                        ++p->_stats.expired_replica_writes;
+                    } catch (...) {
+                        logger.warn("Failed to apply mutation from {}#{}: {}", reply_to, shard, eptr);
+                    }
                 }),
-                parallel_for_each(forward.begin(), forward.end(), [reply_to, shard, response_id, &m, &p, trace_state_ptr] (gms::inet_address forward) {
+                parallel_for_each(forward.begin(), forward.end(), [reply_to, shard, response_id, &m, &p, trace_state_ptr, deadline] (gms::inet_address forward) {
                     auto& ms = net::get_local_messaging_service();
-                    auto timeout = clock_type::now() + std::chrono::milliseconds(p->_db.local().get_config().write_request_timeout_in_ms());
                     tracing::trace(trace_state_ptr, "Forwarding a mutation to /{}", forward);
-                    return ms.send_mutation(net::messaging_service::msg_addr{forward, 0}, timeout, m, {}, reply_to, shard, response_id, tracing::make_trace_info(trace_state_ptr)).then_wrapped([&p] (future<> f) {
+                    return ms.send_mutation(net::messaging_service::msg_addr{forward, 0}, deadline, m, {}, reply_to, shard, response_id, tracing::make_trace_info(trace_state_ptr)).then_wrapped([&p] (future<> f) {
                         if (f.failed()) {
                             ++p->_stats.forwarding_errors;
                         };
@@ -3263,14 +4215,18 @@ void storage_proxy::init_messaging_service() {
             });
         });
     });
-    ms.register_mutation_done([] (const rpc::client_info& cinfo, unsigned shard, storage_proxy::response_id_type response_id) {
+    ms.register_mutation_done([] (const rpc::client_info& cinfo, unsigned shard, storage_proxy::response_id_type response_id, rpc::optional<replica_load> load) {
         auto& from = cinfo.retrieve_auxiliary<gms::inet_address>("baddr");
-        return get_storage_proxy().invoke_on(shard, [from, response_id] (storage_proxy& sp) {
+        return get_storage_proxy().invoke_on(shard, [from, response_id, load] (storage_proxy& sp) {
+            if (load) {
+                sp.update_replica_load(from, *load);
+            }
             sp.got_response(response_id, from);
             return net::messaging_service::no_wait();
         });
     });
-    ms.register_read_data([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr) {
+    ms.register_read_data([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> oda,
+            net::messaging_service::deadline_type deadline) {
         tracing::trace_state_ptr trace_state_ptr;
         auto src_addr = net::messaging_service::get_source(cinfo);
         if (cmd.trace_info) {
@@ -3279,16 +4235,55 @@ void storage_proxy::init_messaging_service() {
             tracing::trace(trace_state_ptr, "read_data: message received from /{}", src_addr.addr);
         }
 
-        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr)] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
+        // Older coordinators don't send the algorithm and always expect an MD5 digest.
+        auto da = oda ? *oda : query::digest_algorithm::MD5;
+        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr), da, deadline] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
             auto src_ip = src_addr.addr;
-            return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &pr, &p] (schema_ptr s) {
-                return p->query_singular_local(std::move(s), cmd, pr);
+            cmd->deadline = p->replica_deadline(deadline, std::chrono::milliseconds(p->_db.local().get_config().read_request_timeout_in_ms()));
+            return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &pr, &p, da, &trace_state_ptr] (schema_ptr s) {
+                return p->query_singular_local(std::move(s), cmd, pr, query::result_options::data(da), trace_state_ptr);
+            }).then([cmd, &p] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+                p->check_replica_read_deadline(cmd->deadline);
+                return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>, replica_load>(std::move(result), p->_db.local().get_load());
             }).finally([&trace_state_ptr, src_ip] () mutable {
                 tracing::trace(trace_state_ptr, "read_data handling is done, sending a response to /{}", src_ip);
             });
         });
     });
-    ms.register_read_mutation_data([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr) {
+    ms.register_read_data_batch([] (const rpc::client_info& cinfo, query::read_command cmd, std::vector<query::partition_range> data_ranges,
+            std::vector<query::partition_range> digest_ranges, query::digest_algorithm da, bool data_digest, net::messaging_service::deadline_type deadline) {
+        tracing::trace_state_ptr trace_state_ptr;
+        auto src_addr = net::messaging_service::get_source(cinfo);
+        if (cmd.trace_info) {
+            trace_state_ptr = tracing::tracing::get_local_tracing_instance().create_session(cmd.trace_info->type, cmd.trace_info->write_on_close, cmd.trace_info->session_id);
+            tracing::begin(trace_state_ptr);
+            tracing::trace(trace_state_ptr, "read_data_batch: message received from /{} for {} partitions", src_addr.addr, data_ranges.size() + digest_ranges.size());
+        }
+        return do_with(std::move(data_ranges), std::move(digest_ranges), std::vector<query::result>(), get_local_shared_storage_proxy(), std::move(trace_state_ptr),
+                [cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr), da, data_digest, deadline] (std::vector<query::partition_range>& data_ranges,
+                        std::vector<query::partition_range>& digest_ranges, std::vector<query::result>& results, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
+            auto src_ip = src_addr.addr;
+            cmd->deadline = p->replica_deadline(deadline, std::chrono::milliseconds(p->_db.local().get_config().read_request_timeout_in_ms()));
+            return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &data_ranges, &digest_ranges, &results, &p, da, data_digest, &trace_state_ptr] (schema_ptr s) {
+                auto n = data_ranges.size() + digest_ranges.size();
+                results.resize(n);
+                return parallel_for_each(boost::irange<size_t>(0, n), [s, cmd, &data_ranges, &digest_ranges, &results, &p, da, data_digest, &trace_state_ptr] (size_t i) {
+                    auto data = i < data_ranges.size();
+                    auto& pr = data ? data_ranges[i] : digest_ranges[i - data_ranges.size()];
+                    auto opts = data ? query::result_options::data(data_digest ? da : query::digest_algorithm::none) : query::result_options::only_digest(da);
+                    return p->query_singular_local(s, cmd, pr, opts, trace_state_ptr).then([&results, i] (foreign_ptr<lw_shared_ptr<query::result>> r) {
+                        results[i] = *r;
+                    });
+                });
+            }).then([cmd, &results, &p] {
+                p->check_replica_read_deadline(cmd->deadline);
+                return std::move(results);
+            }).finally([&trace_state_ptr, src_ip] () mutable {
+                tracing::trace(trace_state_ptr, "read_data_batch handling is done, sending a response to /{}", src_ip);
+            });
+        });
+    });
+    ms.register_read_mutation_data([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr, net::messaging_service::deadline_type deadline) {
         tracing::trace_state_ptr trace_state_ptr;
         auto src_addr = net::messaging_service::get_source(cinfo);
         if (cmd.trace_info) {
@@ -3296,16 +4291,21 @@ void storage_proxy::init_messaging_service() {
             tracing::begin(trace_state_ptr);
             tracing::trace(trace_state_ptr, "read_mutation_data: message received from /{}", src_addr.addr);
         }
-        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr)] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
+        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr), deadline] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
             auto src_ip = src_addr.addr;
+            cmd->deadline = p->replica_deadline(deadline, std::chrono::milliseconds(p->_db.local().get_config().read_request_timeout_in_ms()));
             return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &pr, &p] (schema_ptr s) {
                 return p->query_mutations_locally(std::move(s), cmd, pr);
+            }).then([cmd, &p] (foreign_ptr<lw_shared_ptr<reconcilable_result>> result) {
+                p->check_replica_read_deadline(cmd->deadline);
+                return std::move(result);
             }).finally([&trace_state_ptr, src_ip] () mutable {
                 tracing::trace(trace_state_ptr, "read_mutation_data handling is done, sending a response to /{}", src_ip);
             });
         });
     });
-    ms.register_read_digest([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr) {
+    ms.register_read_digest([] (const rpc::client_info& cinfo, query::read_command cmd, query::partition_range pr, rpc::optional<query::digest_algorithm> oda,
+            net::messaging_service::deadline_type deadline) {
         tracing::trace_state_ptr trace_state_ptr;
         auto src_addr = net::messaging_service::get_source(cinfo);
         if (cmd.trace_info) {
@@ -3313,10 +4313,15 @@ void storage_proxy::init_messaging_service() {
             tracing::begin(trace_state_ptr);
             tracing::trace(trace_state_ptr, "read_digest: message received from /{}", src_addr.addr);
         }
-        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr)] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
+        auto da = oda ? *oda : query::digest_algorithm::MD5;
+        return do_with(std::move(pr), get_local_shared_storage_proxy(), std::move(trace_state_ptr), [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd)), src_addr = std::move(src_addr), da, deadline] (const query::partition_range& pr, shared_ptr<storage_proxy>& p, tracing::trace_state_ptr& trace_state_ptr) mutable {
             auto src_ip = src_addr.addr;
-            return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &pr, &p] (schema_ptr s) {
-                return p->query_singular_local_digest(std::move(s), cmd, pr);
+            cmd->deadline = p->replica_deadline(deadline, std::chrono::milliseconds(p->_db.local().get_config().read_request_timeout_in_ms()));
+            return get_schema_for_read(cmd->schema_version, std::move(src_addr)).then([cmd, &pr, &p, da, &trace_state_ptr] (schema_ptr s) {
+                return p->query_singular_local_digest(std::move(s), cmd, pr, da, trace_state_ptr);
+            }).then([cmd, &p] (query::result_digest d, api::timestamp_type t) {
+                p->check_replica_read_deadline(cmd->deadline);
+                return make_ready_future<query::result_digest, api::timestamp_type, replica_load>(d, t, p->_db.local().get_load());
             }).finally([&trace_state_ptr, src_ip] () mutable {
                 tracing::trace(trace_state_ptr, "read_digest handling is done, sending a response to /{}", src_ip);
             });
@@ -3331,6 +4336,70 @@ void storage_proxy::init_messaging_service() {
         });
     });
 
+    ms.register_mutation_batch([] (const rpc::client_info& cinfo, std::vector<frozen_mutation> mutations) {
+        auto src_addr = net::messaging_service::get_source(cinfo);
+        auto n = mutations.size();
+        return do_with(std::move(mutations), std::vector<schema_ptr>(n), std::vector<uint32_t>(), get_local_shared_storage_proxy(),
+                [src_addr = std::move(src_addr)] (std::vector<frozen_mutation>& mutations, std::vector<schema_ptr>& schemas, std::vector<uint32_t>& failed, shared_ptr<storage_proxy>& p) {
+            p->_stats.received_mutations += mutations.size();
+            return parallel_for_each(boost::irange<uint32_t>(0, mutations.size()), [&mutations, &schemas, &failed, src_addr] (uint32_t i) {
+                return get_schema_for_write(mutations[i].schema_version(), src_addr).then([&schemas, i] (schema_ptr s) {
+                    schemas[i] = std::move(s);
+                }).handle_exception([&failed, i, src_addr] (std::exception_ptr eptr) {
+                    logger.warn("Failed to get schema of mutation from {}: {}", src_addr.addr, eptr);
+                    failed.push_back(i);
+                });
+            }).then([&mutations, &schemas, &failed, &p] {
+                return p->mutate_locally(mutations, schemas);
+            }).then([&failed] (std::vector<uint32_t> apply_failed) {
+                boost::push_back(failed, apply_failed);
+                return std::move(failed);
+            });
+        });
+    });
+    ms.register_hint_mutation([] (const rpc::client_info& cinfo, frozen_mutation in) {
+        auto src_addr = net::messaging_service::get_source(cinfo);
+        return do_with(std::move(in), get_local_shared_storage_proxy(), [src_addr = std::move(src_addr)] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) mutable {
+            ++p->_stats.received_mutations;
+            return get_schema_for_write(m.schema_version(), std::move(src_addr)).then([&m, &p] (schema_ptr s) {
+                return p->mutate_locally(std::move(s), m);
+            });
+        });
+    });
+
+    ms.register_view_update([] (const rpc::client_info& cinfo, frozen_mutation in) {
+        auto src_addr = net::messaging_service::get_source(cinfo);
+        return do_with(std::move(in), get_local_shared_storage_proxy(), [src_addr = std::move(src_addr)] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) mutable {
+            ++p->_stats.received_mutations;
+            return get_schema_for_write(m.schema_version(), std::move(src_addr)).then([&m, &p] (schema_ptr s) {
+                return p->mutate_locally(std::move(s), m);
+            });
+        });
+    });
+
+    ms.register_counter_mutation([] (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms, int32_t cl,
+            std::experimental::optional<tracing::trace_info> trace_info) {
+        auto src_addr = net::messaging_service::get_source(cinfo);
+        tracing::trace_state_ptr trace_state_ptr;
+        if (trace_info) {
+            trace_state_ptr = tracing::tracing::get_local_tracing_instance().create_session(trace_info->type, trace_info->write_on_close, trace_info->session_id);
+            tracing::begin(trace_state_ptr);
+            tracing::trace(trace_state_ptr, "Counter updates received from /{}", src_addr.addr);
+        }
+        return do_with(std::move(fms), std::vector<schema_ptr>(), get_local_shared_storage_proxy(),
+                [src_addr = std::move(src_addr), cl, trace_state_ptr = std::move(trace_state_ptr)]
+                (std::vector<frozen_mutation>& fms, std::vector<schema_ptr>& schemas, shared_ptr<storage_proxy>& p) mutable {
+            schemas.resize(fms.size());
+            return parallel_for_each(boost::irange<size_t>(0, fms.size()), [&fms, &schemas, src_addr] (size_t i) {
+                return get_schema_for_write(fms[i].schema_version(), src_addr).then([&schemas, i] (schema_ptr s) {
+                    schemas[i] = std::move(s);
+                });
+            }).then([&fms, &schemas, &p, cl, trace_state_ptr = std::move(trace_state_ptr)] () mutable {
+                return p->mutate_counters_on_leader(std::move(fms), std::move(schemas), db::consistency_level(cl), std::move(trace_state_ptr));
+            });
+        });
+    });
+
     ms.register_get_schema_version([] (unsigned shard, table_schema_version v) {
         return get_storage_proxy().invoke_on(shard, [v] (auto&& sp) {
             logger.debug("Schema version request for {}", v);
@@ -3343,14 +4412,20 @@ void storage_proxy::uninit_messaging_service() {
     auto& ms = net::get_local_messaging_service();
     ms.unregister_mutation();
     ms.unregister_mutation_done();
+    ms.unregister_hint_mutation();
+    ms.unregister_view_update();
+    ms.unregister_counter_mutation();
+    ms.unregister_mutation_batch();
     ms.unregister_read_data();
+    ms.unregister_read_data_batch();
     ms.unregister_read_mutation_data();
     ms.unregister_read_digest();
     ms.unregister_truncate();
 }
 
 // Merges reconcilable_result:s from different shards into one
-// Drops partitions which exceed the limit.
+// Drops partitions which exceed the limit, and those past the end of a short
+// read of any shard, which are after rows that shard didn't send.
 class mutation_result_merger {
     // Adapts reconcilable_result to a consumable sequence of partitions.
     struct partition_run {
@@ -3377,6 +4452,8 @@ class mutation_result_merger {
     lw_shared_ptr<query::read_command> _cmd;
     schema_ptr _schema;
     std::vector<partition_run> _runs;
+    // Last partition of the short read which ends first, if any.
+    const partition* _short_read_end = nullptr;
 public:
     mutation_result_merger(lw_shared_ptr<query::read_command> cmd, schema_ptr schema)
         : _cmd(std::move(cmd))
@@ -3388,6 +4465,12 @@ class mutation_result_merger {
     }
 
     void operator()(foreign_ptr<lw_shared_ptr<reconcilable_result>> result) {
+        if (result->is_short_read()) {
+            const partition& last = result->partitions().back();
+            if (!_short_read_end || last._m.key(*_schema).ring_order_tri_compare(*_schema, _short_read_end->_m.key(*_schema)) < 0) {
+                _short_read_end = &last;
+            }
+        }
         if (result->partitions().size() > 0) {
             _runs.emplace_back(partition_run(std::move(result)));
         }
@@ -3412,6 +4495,10 @@ class mutation_result_merger {
             boost::range::pop_heap(_runs, cmp);
             partition_run& next = _runs.back();
             const partition& p = next.current();
+            if (_short_read_end && p._m.key(*_schema).ring_order_tri_compare(*_schema, _short_read_end->_m.key(*_schema)) > 0) {
+                ret = reconcilable_result(row_count, std::move(partitions), true);
+                return make_ready_future<std::experimental::optional<reconcilable_result>>(std::move(ret));
+            }
             unsigned limit_left = _cmd->row_limit - row_count;
             if (p._row_count > limit_left) {
                 // no space for all rows in the mutation
@@ -3436,7 +4523,7 @@ class mutation_result_merger {
                 }
             }
             if (_runs.empty() || row_count >= _cmd->row_limit || partition_count >= _cmd->partition_limit) {
-                ret = reconcilable_result(row_count, std::move(partitions));
+                ret = reconcilable_result(row_count, std::move(partitions), _short_read_end != nullptr);
             }
             return make_ready_future<std::experimental::optional<reconcilable_result>>(std::move(ret));
         });
@@ -3466,7 +4553,8 @@ storage_proxy::query_mutations_locally(schema_ptr s, lw_shared_ptr<query::read_c
 future<>
 storage_proxy::stop() {
     uninit_messaging_service();
-    return make_ready_future<>();
+    _repair_flush_timer.cancel();
+    return _repair_gate.close();
 }
 
 }
@@ -46,12 +46,22 @@
 #include "query-result.hh"
 #include "query-result-set.hh"
 #include "core/distributed.hh"
+#include "core/gate.hh"
+#include "core/timer.hh"
 #include "db/consistency_level.hh"
 #include "db/write_type.hh"
 #include "utils/histogram.hh"
+#include "utils/hdr_histogram.hh"
+#include "utils/timer_wheel.hh"
 #include "sstables/estimated_histogram.hh"
 #include "tracing/trace_state.hh"
 
+namespace query {
+
+class streaming_result_merger;
+
+}
+
 namespace service {
 
 class abstract_write_response_handler;
@@ -60,12 +70,6 @@ class mutation_holder;
 
 class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*implements StorageProxyMBean*/ {
     using clock_type = std::chrono::steady_clock;
-    struct rh_entry {
-        std::unique_ptr<abstract_write_response_handler> handler;
-        timer<> expire_timer;
-        rh_entry(std::unique_ptr<abstract_write_response_handler>&& h, std::function<void()>&& cb);
-    };
-
     using response_id_type = uint64_t;
     struct unique_response_handler {
         response_id_type id;
@@ -131,6 +135,20 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
         uint64_t read_repair_repaired_blocking = 0;
         uint64_t read_repair_repaired_background = 0;
         uint64_t global_read_repairs_canceled_due_to_concurrent_write = 0;
+        // writes which reached the consistency level, but were held back
+        // because a replica still writing them reported to be overloaded
+        uint64_t writes_throttled_by_replica_load = 0;
+        // background read repair writes which were queued, merged into
+        // one already queued for the same replica and partition, or
+        // dropped because the queue was full
+        uint64_t read_repair_queued = 0;
+        uint64_t read_repair_queue_merged = 0;
+        uint64_t read_repair_queue_dropped = 0;
+        uint64_t read_repair_queue_length = 0;
+        // token ranges of range scans, and the sub-queries they were merged
+        // into, each sent to one set of replicas
+        uint64_t range_slice_ranges = 0;
+        uint64_t range_slice_subqueries = 0;
 
         // number of mutations received as a coordinator
         uint64_t received_mutations = 0;
@@ -139,12 +157,21 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
         uint64_t forwarded_mutations = 0;
         uint64_t forwarding_errors = 0;
 
+        // replica requests received past their deadline, or which passed it
+        // before their reply was sent, and were dropped
+        uint64_t expired_replica_writes = 0;
+        uint64_t expired_replica_reads = 0;
+
         utils::timed_rate_moving_average_and_histogram read;
         utils::timed_rate_moving_average_and_histogram write;
         utils::timed_rate_moving_average_and_histogram range;
         sstables::estimated_histogram estimated_read;
         sstables::estimated_histogram estimated_write;
         sstables::estimated_histogram estimated_range;
+        // Every operation, in microseconds, for accurate percentiles.
+        utils::hdr_histogram read_latency;
+        utils::hdr_histogram write_latency;
+        utils::hdr_histogram range_latency;
         uint64_t background_writes = 0; // client no longer waits for the write
         uint64_t background_write_bytes = 0;
         uint64_t queued_write_bytes = 0;
@@ -173,7 +200,12 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
 private:
     distributed<database>& _db;
     response_id_type _next_response_id = 1; // 0 is reserved for unique_response_handler
-    std::unordered_map<response_id_type, rh_entry> _response_handlers;
+    // Write response handlers by id: an intrusive hash table, chained through
+    // the handlers. Ids are sequential, so masking them spreads them evenly.
+    std::vector<abstract_write_response_handler*> _response_handlers;
+    size_t _response_handlers_count = 0;
+    // Write timeouts. Handlers are entries of the wheel.
+    utils::timer_wheel _write_timeouts;
     // This buffer hold ids of throttled writes in case resource consumption goes
     // below the threshold and we want to unthrottle some of them. Without this throttled
     // request with dead or slow replica may wait for up to timeout ms before replying
@@ -182,18 +214,47 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     // not remove request from the buffer), but this is fine since request ids are unique, so we
     // just skip an entry if request no longer exists.
     circular_buffer<response_id_type> _throttled_writes;
+    // Repair writes found by background read repair, by replica and token.
+    // Writes for the same partition are merged until the queue is flushed,
+    // which sends each replica its writes in one batch.
+    using repair_queue = std::unordered_map<gms::inet_address, std::unordered_map<dht::token, std::vector<mutation>>>;
+    static constexpr size_t max_repair_queue_length = 4096;
+    static constexpr size_t max_repair_flushes_in_flight = 4;
+    static constexpr std::chrono::milliseconds repair_flush_period = std::chrono::milliseconds(100);
+    repair_queue _repair_queue;
+    timer<> _repair_flush_timer;
+    size_t _repair_flushes_in_flight = 0;
+    seastar::gate _repair_gate;
     constexpr static size_t _max_hints_in_progress = 128; // origin multiplies by FBUtilities.getAvailableProcessors() but we already sharded
     size_t _total_hints_in_progress = 0;
     std::unordered_map<gms::inet_address, size_t> _hints_in_progress;
+    // Load last reported by the replicas, with their responses. Reports
+    // older than replica_load_expiry are ignored.
+    struct reported_load {
+        replica_load load;
+        clock_type::time_point at;
+    };
+    static constexpr std::chrono::seconds replica_load_expiry = std::chrono::seconds(2);
+    static constexpr uint8_t overloaded_dirty_percent = 90;
+    static constexpr uint32_t overloaded_read_queue_length = 50;
+    static constexpr uint32_t overloaded_pending_compactions = 100;
+    std::unordered_map<gms::inet_address, reported_load> _replica_loads;
     stats _stats;
+    // Latencies of the last collectd interval, for the percentile gauges.
+    utils::hdr_histogram_window _recent_read_latency{_stats.read_latency};
+    utils::hdr_histogram_window _recent_write_latency{_stats.write_latency};
+    utils::hdr_histogram_window _recent_range_latency{_stats.range_latency};
     static constexpr float CONCURRENT_SUBREQUESTS_MARGIN = 0.10;
     // for read repair chance calculation
     std::default_random_engine _urandom;
     std::uniform_real_distribution<> _read_repair_chance = std::uniform_real_distribution<>(0,1);
     std::unique_ptr<scollectd::registrations> _collectd_registrations;
+    std::vector<scollectd::registration> _latency_collectd_registrations;
 private:
     void uninit_messaging_service();
     future<foreign_ptr<lw_shared_ptr<query::result>>> query_singular(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl, tracing::trace_state_ptr trace_state);
+    abstract_write_response_handler* find_response_handler(response_id_type id);
+    void on_write_timeout(abstract_write_response_handler& h);
     response_id_type register_response_handler(std::unique_ptr<abstract_write_response_handler>&& h);
     void remove_response_handler(response_id_type id);
     void got_response(response_id_type id, gms::inet_address from);
@@ -203,7 +264,15 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
             const std::vector<gms::inet_address>& pending_endpoints, std::vector<gms::inet_address>, tracing::trace_state_ptr tr_state);
     response_id_type create_write_response_handler(const mutation&, db::consistency_level cl, db::write_type type, tracing::trace_state_ptr tr_state);
     response_id_type create_write_response_handler(const std::unordered_map<gms::inet_address, std::experimental::optional<mutation>>&, db::consistency_level cl, db::write_type type, tracing::trace_state_ptr tr_state);
-    void send_to_live_endpoints(response_id_type response_id, clock_type::time_point timeout);
+    // Writes of one mutate() call to replicas without forwarding, by destination,
+    // which are sent with one MUTATION_BATCH message per destination.
+    using batched_writes = std::unordered_map<gms::inet_address, std::vector<std::pair<response_id_type, lw_shared_ptr<const frozen_mutation>>>>;
+    static constexpr size_t max_mutation_batch_count = 128;
+    static constexpr size_t max_mutation_batch_bytes = 1024 * 1024;
+    void send_to_live_endpoints(response_id_type response_id, clock_type::time_point timeout, batched_writes* batch = nullptr);
+    void send_batched_writes(batched_writes& batch, clock_type::time_point timeout);
+    void send_mutation_batch(gms::inet_address ep, clock_type::time_point timeout, std::vector<frozen_mutation> mutations,
+            std::vector<response_id_type> ids, size_t bytes);
     template<typename Range>
     size_t hint_to_dead_endpoints(std::unique_ptr<mutation_holder>& mh, const Range& targets) noexcept;
     void hint_to_dead_endpoints(response_id_type, db::consistency_level);
@@ -212,18 +281,34 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     bool should_hint(gms::inet_address ep) noexcept;
     bool submit_hint(std::unique_ptr<mutation_holder>& mh, gms::inet_address target);
     std::vector<gms::inet_address> get_live_sorted_endpoints(keyspace& ks, const dht::token& token);
+    // Local time by which the replica work of a request received now is to be
+    // done. That is the coordinator's deadline with cross_node_timeout, which
+    // requires the clocks of the nodes to be in sync, or else timeout from now,
+    // as if the request had taken no time to get here.
+    clock_type::time_point replica_deadline(const net::messaging_service::deadline_type& deadline, std::chrono::milliseconds timeout) const;
+    // Throws expired_request_exception if deadline has passed, counting the read
+    // as dropped.
+    void check_replica_read_deadline(clock_type::time_point deadline);
+    // Whether replicas are ordered, and read latencies recorded, by the dynamic snitch.
+    bool use_dynamic_snitch() const;
+    // Digest algorithm the coordinator asks replicas to use.
+    query::digest_algorithm digest_algorithm() const;
     db::read_repair_decision new_read_repair_decision(const schema& s);
     ::shared_ptr<abstract_read_executor> get_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl, tracing::trace_state_ptr trace_state);
     future<foreign_ptr<lw_shared_ptr<query::result>>> query_singular_local(schema_ptr, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr,
-                                                                           query::result_request request = query::result_request::result_and_digest);
-    future<query::result_digest, api::timestamp_type> query_singular_local_digest(schema_ptr, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr);
+                                                                           query::result_options opts = query::result_request::result_and_digest,
+                                                                           tracing::trace_state_ptr trace_state = nullptr);
+    // Counts rows of a range on all shards, for a query with the count_rows option.
+    future<foreign_ptr<lw_shared_ptr<query::result>>> count_rows_locally(schema_ptr, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr);
+    future<query::result_digest, api::timestamp_type> query_singular_local_digest(schema_ptr, lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, query::digest_algorithm da,
+                                                                                  tracing::trace_state_ptr trace_state = nullptr);
     future<foreign_ptr<lw_shared_ptr<query::result>>> query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl, tracing::trace_state_ptr trace_state);
     std::vector<query::partition_range> get_restricted_ranges(keyspace& ks, const schema& s, query::partition_range range);
     float estimate_result_rows_per_range(lw_shared_ptr<query::read_command> cmd, keyspace& ks);
     static std::vector<gms::inet_address> intersection(const std::vector<gms::inet_address>& l1, const std::vector<gms::inet_address>& l2);
-    future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>> query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout,
-            std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results, lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-            std::vector<query::partition_range>&& ranges, int concurrency_factor, tracing::trace_state_ptr trace_state, uint32_t total_row_count = 0);
+    future<foreign_ptr<lw_shared_ptr<query::result>>> query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout,
+            lw_shared_ptr<query::streaming_result_merger> merger, lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
+            std::vector<query::partition_range>&& ranges, int concurrency_factor, tracing::trace_state_ptr trace_state);
 
     future<foreign_ptr<lw_shared_ptr<query::result>>> do_query(schema_ptr,
         lw_shared_ptr<query::read_command> cmd,
@@ -236,7 +321,13 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     future<> mutate_begin(std::vector<unique_response_handler> ids, db::consistency_level cl);
     future<> mutate_end(future<> mutate_result, utils::latency_counter, tracing::trace_state_ptr trace_state);
     future<> schedule_repair(std::unordered_map<dht::token, std::unordered_map<gms::inet_address, std::experimental::optional<mutation>>> diffs, db::consistency_level cl, tracing::trace_state_ptr trace_state);
+    void queue_repair(std::unordered_map<dht::token, std::unordered_map<gms::inet_address, std::experimental::optional<mutation>>> diffs);
+    void flush_repair_queue();
     bool need_throttle_writes() const;
+    void update_replica_load(gms::inet_address ep, const replica_load& load);
+    const replica_load* fresh_replica_load(gms::inet_address ep) const;
+    bool write_overloaded(gms::inet_address ep) const;
+    bool read_overloaded(gms::inet_address ep) const;
     void unthrottle();
     void handle_read_error(std::exception_ptr eptr);
     template<typename Range>
@@ -254,6 +345,20 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     future<> mutate_locally(const mutation& m);
     future<> mutate_locally(const schema_ptr&, const frozen_mutation& m);
     future<> mutate_locally(std::vector<mutation> mutations);
+    // Like mutate_locally(const mutation&), but doesn't copy a mutation
+    // which is owned by this shard. m must be kept alive until the returned
+    // future resolves.
+    future<> mutate_locally_in_place(const mutation& m);
+    // Applies mutations whose schema is not null, on the shards owning them.
+    // Returns indexes of the mutations which failed to apply.
+    future<std::vector<uint32_t>> mutate_locally(const std::vector<frozen_mutation>& mutations, const std::vector<schema_ptr>& schemas);
+
+    // Sends updates of materialized views, generated by this node for a write
+    // to the base table at base_token, to the view replicas paired with it.
+    // Resolves once the updates of views replicated on this node are applied;
+    // the others are sent in the background, and hinted if they can't be
+    // delivered.
+    future<> mutate_view_replicas(const dht::token& base_token, std::vector<mutation> updates);
 
     future<> mutate_streaming_mutation(const schema_ptr&, utils::UUID plan_id, const frozen_mutation& m, bool fragmented);
 
@@ -272,6 +377,14 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     future<> mutate_with_triggers(std::vector<mutation> mutations, db::consistency_level cl,
         bool should_mutate_atomically, tracing::trace_state_ptr tr_state);
 
+    // Applies counter updates. Each of them is sent to a live replica of its
+    // partition, preferably this node, which turns the deltas into new values
+    // of its own shards of the counters and replicates those as a regular write.
+    future<> mutate_counters(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr tr_state);
+    // Applies counter updates on this node, as their leader, and replicates the results.
+    future<> mutate_counters_on_leader(std::vector<frozen_mutation> mutations, std::vector<schema_ptr> schemas,
+        db::consistency_level cl, tracing::trace_state_ptr tr_state);
+
     /**
     * See mutate. Adds additional steps before and after writing a batch.
     * Before writing the batch (but after doing availability check against the FD for the row replicas):
@@ -49,6 +49,7 @@
 #include "gms/gossiper.hh"
 #include "gms/failure_detector.hh"
 #include <seastar/core/thread.hh>
+#include <seastar/util/defer.hh>
 #include <sstream>
 #include <algorithm>
 #include "locator/local_strategy.hh"
@@ -80,6 +81,18 @@ static logging::logger logger("storage_service");
 
 static const sstring RANGE_TOMBSTONES_FEATURE = "RANGE_TOMBSTONES";
 static const sstring LARGE_PARTITIONS_FEATURE = "LARGE_PARTITIONS";
+static const sstring REPAIR_CHECKSUM_RANGES_FEATURE = "REPAIR_CHECKSUM_RANGES";
+static const sstring MURMUR3_REPAIR_CHECKSUM_FEATURE = "MURMUR3_REPAIR_CHECKSUM";
+static const sstring HINTED_HANDOFF_FEATURE = "HINTED_HANDOFF";
+static const sstring MUTATION_BATCH_FEATURE = "MUTATION_BATCH";
+static const sstring COUNT_ROWS_FEATURE = "COUNT_ROWS";
+static const sstring SECONDARY_INDEXES_FEATURE = "SECONDARY_INDEXES";
+static const sstring ROW_FILTERING_FEATURE = "ROW_FILTERING";
+static const sstring MATERIALIZED_VIEWS_FEATURE = "MATERIALIZED_VIEWS";
+static const sstring MURMUR3_DIGEST_FEATURE = "MURMUR3_DIGEST";
+static const sstring READ_DATA_BATCH_FEATURE = "READ_DATA_BATCH";
+static const sstring COUNTERS_FEATURE = "COUNTERS";
+static const sstring INCREMENTAL_REPAIR_FEATURE = "INCREMENTAL_REPAIR";
 
 distributed<storage_service> _the_storage_service;
 
@@ -101,6 +114,18 @@ sstring storage_service::get_config_supported_features() {
     std::vector<sstring> features = {
         RANGE_TOMBSTONES_FEATURE,
         LARGE_PARTITIONS_FEATURE,
+        REPAIR_CHECKSUM_RANGES_FEATURE,
+        MURMUR3_REPAIR_CHECKSUM_FEATURE,
+        HINTED_HANDOFF_FEATURE,
+        MUTATION_BATCH_FEATURE,
+        COUNT_ROWS_FEATURE,
+        SECONDARY_INDEXES_FEATURE,
+        ROW_FILTERING_FEATURE,
+        MATERIALIZED_VIEWS_FEATURE,
+        MURMUR3_DIGEST_FEATURE,
+        READ_DATA_BATCH_FEATURE,
+        COUNTERS_FEATURE,
+        INCREMENTAL_REPAIR_FEATURE,
     };
     return join(",", features);
 }
@@ -317,6 +342,9 @@ void storage_service::join_token_ring(int delay) {
         if (db::system_keyspace::bootstrap_in_progress()) {
             logger.warn("Detected previous bootstrap failure; retrying");
         } else {
+            // Ranges left over from an earlier bootstrap of this node, which
+            // didn't get to finish, must not be skipped by this one.
+            db::system_keyspace::clear_streamed_ranges("Bootstrap").get();
             db::system_keyspace::set_bootstrap_state(db::system_keyspace::bootstrap_state::IN_PROGRESS).get();
         }
         set_mode(mode::JOINING, "waiting for ring information", true);
@@ -1083,7 +1111,7 @@ future<> storage_service::drain_on_shutdown() {
             logger.info("Drain on shutdown: flush column_families done");
 
             ss.db().invoke_on_all([] (auto& db) {
-                return db.commitlog()->shutdown();
+                return db.shutdown_commitlogs();
             }).get();
             logger.info("Drain on shutdown: shutdown commitlog done");
 
@@ -1241,6 +1269,18 @@ future<> storage_service::init_server(int delay) {
         get_storage_service().invoke_on_all([] (auto& ss) {
             ss._range_tombstones_feature = gms::feature(RANGE_TOMBSTONES_FEATURE);
             ss._large_partitions_feature = gms::feature(LARGE_PARTITIONS_FEATURE);
+            ss._repair_checksum_ranges_feature = gms::feature(REPAIR_CHECKSUM_RANGES_FEATURE);
+            ss._murmur3_repair_checksum_feature = gms::feature(MURMUR3_REPAIR_CHECKSUM_FEATURE);
+            ss._hinted_handoff_feature = gms::feature(HINTED_HANDOFF_FEATURE);
+            ss._mutation_batch_feature = gms::feature(MUTATION_BATCH_FEATURE);
+            ss._count_rows_feature = gms::feature(COUNT_ROWS_FEATURE);
+            ss._secondary_indexes_feature = gms::feature(SECONDARY_INDEXES_FEATURE);
+            ss._row_filtering_feature = gms::feature(ROW_FILTERING_FEATURE);
+            ss._materialized_views_feature = gms::feature(MATERIALIZED_VIEWS_FEATURE);
+            ss._murmur3_digest_feature = gms::feature(MURMUR3_DIGEST_FEATURE);
+            ss._read_data_batch_feature = gms::feature(READ_DATA_BATCH_FEATURE);
+            ss._counters_feature = gms::feature(COUNTERS_FEATURE);
+            ss._incremental_repair_feature = gms::feature(INCREMENTAL_REPAIR_FEATURE);
         }).get();
     });
 }
@@ -1677,7 +1717,7 @@ future<> check_snapshot_not_exist(database& db, sstring ks_name, sstring name) {
     });
 }
 
-future<> storage_service::take_snapshot(sstring tag, std::vector<sstring> keyspace_names) {
+future<> storage_service::take_snapshot(sstring tag, std::vector<sstring> keyspace_names, bool skip_flush) {
     if (tag.empty()) {
         throw std::runtime_error("You must supply a snapshot name.");
     }
@@ -1691,16 +1731,16 @@ future<> storage_service::take_snapshot(sstring tag, std::vector<sstring> keyspa
         if (mode == storage_service::mode::JOINING) {
             throw std::runtime_error("Cannot snapshot until bootstrap completes");
         }
-    }).then([tag = std::move(tag), keyspace_names = std::move(keyspace_names), this] {
+    }).then([tag = std::move(tag), keyspace_names = std::move(keyspace_names), skip_flush, this] {
         return parallel_for_each(keyspace_names, [tag, this] (auto& ks_name) {
             return check_snapshot_not_exist(_db.local(), ks_name, tag);
-        }).then([this, tag, keyspace_names] {
-            return _db.invoke_on_all([tag = std::move(tag), keyspace_names] (database& db) {
-                return parallel_for_each(keyspace_names, [&db, tag = std::move(tag)] (auto& ks_name) {
+        }).then([this, tag, keyspace_names, skip_flush] {
+            return _db.invoke_on_all([tag = std::move(tag), keyspace_names, skip_flush] (database& db) {
+                return parallel_for_each(keyspace_names, [&db, tag = std::move(tag), skip_flush] (auto& ks_name) {
                     auto& ks = db.find_keyspace(ks_name);
-                    return parallel_for_each(ks.metadata()->cf_meta_data(), [&db, tag = std::move(tag)] (auto& pair) {
+                    return parallel_for_each(ks.metadata()->cf_meta_data(), [&db, tag = std::move(tag), skip_flush] (auto& pair) {
                         auto& cf = db.find_column_family(pair.second);
-                        return cf.snapshot(tag);
+                        return cf.snapshot(tag, skip_flush);
                     });
                 });
             });
@@ -1708,7 +1748,7 @@ future<> storage_service::take_snapshot(sstring tag, std::vector<sstring> keyspa
     });
 }
 
-future<> storage_service::take_column_family_snapshot(sstring ks_name, sstring cf_name, sstring tag) {
+future<> storage_service::take_column_family_snapshot(sstring ks_name, sstring cf_name, sstring tag, bool skip_flush) {
     if (ks_name.empty()) {
         throw std::runtime_error("You must supply a keyspace name");
     }
@@ -1728,11 +1768,11 @@ future<> storage_service::take_column_family_snapshot(sstring ks_name, sstring c
         if (mode == storage_service::mode::JOINING) {
             throw std::runtime_error("Cannot snapshot until bootstrap completes");
         }
-    }).then([this, ks_name = std::move(ks_name), cf_name = std::move(cf_name), tag = std::move(tag)] {
-        return check_snapshot_not_exist(_db.local(), ks_name, tag).then([this, ks_name, cf_name, tag] {
-            return _db.invoke_on_all([ks_name, cf_name, tag] (database &db) {
+    }).then([this, ks_name = std::move(ks_name), cf_name = std::move(cf_name), tag = std::move(tag), skip_flush] {
+        return check_snapshot_not_exist(_db.local(), ks_name, tag).then([this, ks_name, cf_name, tag, skip_flush] {
+            return _db.invoke_on_all([ks_name, cf_name, tag, skip_flush] (database &db) {
                 auto& cf = db.find_column_family(ks_name, cf_name);
-                return cf.snapshot(tag);
+                return cf.snapshot(tag, skip_flush);
             });
         });
     });
@@ -2185,7 +2225,7 @@ future<> storage_service::drain() {
 #endif
 
             ss.db().invoke_on_all([] (auto& db) {
-                return db.commitlog()->shutdown();
+                return db.shutdown_commitlogs();
             }).get();
 
             ss.set_mode(mode::DRAINED, true);
@@ -3047,26 +3087,41 @@ std::chrono::milliseconds storage_service::get_ring_delay() {
     return std::chrono::milliseconds(ring_delay);
 }
 
+// Runs inside seastar::async context
 void storage_service::do_update_pending_ranges() {
     if (engine().cpu_id() != 0) {
         throw std::runtime_error("do_update_pending_ranges should be called on cpu zero");
     }
-    // long start = System.currentTimeMillis();
+    // calculate_pending_ranges() yields, don't let a calculation started
+    // earlier overwrite the result of a later one.
+    _update_pending_ranges_sem.wait().get();
+    auto release = defer([this] { _update_pending_ranges_sem.signal(); });
+    auto start = std::chrono::steady_clock::now();
     auto keyspaces = _db.local().get_non_system_keyspaces();
     for (auto& keyspace_name : keyspaces) {
-        auto& ks = _db.local().find_keyspace(keyspace_name);
-        auto& strategy = ks.get_replication_strategy();
-        get_local_storage_service().get_token_metadata().calculate_pending_ranges(strategy, keyspace_name);
+        if (!_db.local().has_keyspace(keyspace_name)) {
+            continue;
+        }
+        // The keyspace may be altered or dropped while the calculation
+        // yields, so it gets a strategy of its own.
+        auto ksm = _db.local().find_keyspace(keyspace_name).metadata();
+        auto strategy = locator::abstract_replication_strategy::create_replication_strategy(keyspace_name,
+                ksm->strategy_name(), _token_metadata, ksm->strategy_options());
+        _token_metadata.calculate_pending_ranges(*strategy, keyspace_name);
     }
-    // logger.debug("finished calculation for {} keyspaces in {}ms", keyspaces.size(), System.currentTimeMillis() - start);
+    logger.debug("finished calculation for {} keyspaces in {}ms", keyspaces.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
 }
 
 future<> storage_service::update_pending_ranges() {
     return get_storage_service().invoke_on(0, [] (auto& ss){
         ss._update_jobs++;
-        ss.do_update_pending_ranges();
-        // calculate_pending_ranges will modify token_metadata, we need to repliate to other cores
-        return ss.replicate_to_all_cores().finally([&ss, ss0 = ss.shared_from_this()] {
+        return seastar::async([&ss] {
+            ss.do_update_pending_ranges();
+        }).then([&ss] {
+            // calculate_pending_ranges will modify token_metadata, we need to repliate to other cores
+            return ss.replicate_to_all_cores();
+        }).finally([&ss, ss0 = ss.shared_from_this()] {
             ss._update_jobs--;
         });
     });
@@ -269,6 +269,18 @@ class storage_service : public service::migration_listener, public gms::i_endpoi
 
     gms::feature _range_tombstones_feature;
     gms::feature _large_partitions_feature;
+    gms::feature _repair_checksum_ranges_feature;
+    gms::feature _murmur3_repair_checksum_feature;
+    gms::feature _hinted_handoff_feature;
+    gms::feature _mutation_batch_feature;
+    gms::feature _count_rows_feature;
+    gms::feature _secondary_indexes_feature;
+    gms::feature _row_filtering_feature;
+    gms::feature _materialized_views_feature;
+    gms::feature _murmur3_digest_feature;
+    gms::feature _read_data_batch_feature;
+    gms::feature _counters_feature;
+    gms::feature _incremental_repair_feature;
 
 public:
     void finish_bootstrapping() {
@@ -756,6 +768,8 @@ class storage_service : public service::migration_listener, public gms::i_endpoi
     std::unordered_set<token> get_tokens_for(inet_address endpoint);
     future<> replicate_to_all_cores();
     semaphore _replicate_task{1};
+    // Serializes pending ranges calculations.
+    semaphore _update_pending_ranges_sem{1};
 private:
     /**
      * Replicates token_metadata contents on shard0 instance to other shards.
@@ -1024,8 +1038,9 @@ class storage_service : public service::migration_listener, public gms::i_endpoi
      *
      * @param tag the tag given to the snapshot; may not be null or empty
      * @param keyspaceNames the names of the keyspaces to snapshot; empty means "all."
+     * @param skip_flush snapshot the sstables only, without flushing memtables first
      */
-    future<> take_snapshot(sstring tag, std::vector<sstring> keyspace_names);
+    future<> take_snapshot(sstring tag, std::vector<sstring> keyspace_names, bool skip_flush = false);
 
     /**
      * Takes the snapshot of a specific column family. A snapshot name must be specified.
@@ -1033,8 +1048,9 @@ class storage_service : public service::migration_listener, public gms::i_endpoi
      * @param keyspaceName the keyspace which holds the specified column family
      * @param columnFamilyName the column family to snapshot
      * @param tag the tag given to the snapshot; may not be null or empty
+     * @param skip_flush snapshot the sstables only, without flushing memtables first
      */
-    future<> take_column_family_snapshot(sstring ks_name, sstring cf_name, sstring tag);
+    future<> take_column_family_snapshot(sstring ks_name, sstring cf_name, sstring tag, bool skip_flush = false);
 #if 0
 
     private Keyspace getValidKeyspace(String keyspaceName) throws IOException
@@ -2370,6 +2386,54 @@ class storage_service : public service::migration_listener, public gms::i_endpoi
     bool cluster_supports_large_partitions() const {
         return bool(_large_partitions_feature);
     }
+
+    bool cluster_supports_repair_checksum_ranges() const {
+        return bool(_repair_checksum_ranges_feature);
+    }
+
+    bool cluster_supports_murmur3_repair_checksum() const {
+        return bool(_murmur3_repair_checksum_feature);
+    }
+
+    bool cluster_supports_hinted_handoff() const {
+        return bool(_hinted_handoff_feature);
+    }
+
+    bool cluster_supports_mutation_batch() const {
+        return bool(_mutation_batch_feature);
+    }
+
+    bool cluster_supports_count_rows() const {
+        return bool(_count_rows_feature);
+    }
+
+    bool cluster_supports_secondary_indexes() const {
+        return bool(_secondary_indexes_feature);
+    }
+
+    bool cluster_supports_row_filtering() const {
+        return bool(_row_filtering_feature);
+    }
+
+    bool cluster_supports_materialized_views() const {
+        return bool(_materialized_views_feature);
+    }
+
+    bool cluster_supports_murmur3_digest() const {
+        return bool(_murmur3_digest_feature);
+    }
+
+    bool cluster_supports_read_data_batch() const {
+        return bool(_read_data_batch_feature);
+    }
+
+    bool cluster_supports_counters() const {
+        return bool(_counters_feature);
+    }
+
+    bool cluster_supports_incremental_repair() const {
+        return bool(_incremental_repair_feature);
+    }
 };
 
 inline future<> init_storage_service(distributed<database>& db) {
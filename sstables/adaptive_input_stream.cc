@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "adaptive_input_stream.hh"
+#include "io_buffer_pool.hh"
+#include <deque>
+#include <seastar/core/scollectd.hh>
+#include "core/future-util.hh"
+#include "core/align.hh"
+
+namespace sstables {
+
+namespace {
+
+class adaptive_read_metrics {
+    adaptive_read_stats _stats;
+    std::vector<scollectd::registration> _collectd_registrations;
+public:
+    adaptive_read_metrics() {
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "data_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.reads)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "data_read")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.bytes_read)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "data_used")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.bytes_used)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "ratio", "data_read_to_used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                    return _stats.bytes_used ? double(_stats.bytes_read) / _stats.bytes_used : 0.0;
+                })
+        ));
+    }
+    adaptive_read_stats& stats() {
+        return _stats;
+    }
+};
+
+}
+
+adaptive_read_stats& local_adaptive_read_stats() {
+    static thread_local adaptive_read_metrics metrics;
+    return metrics.stats();
+}
+
+class adaptive_file_data_source_impl : public data_source_impl {
+    // Reads end on this boundary when they can, so that the next ones
+    // start aligned.
+    static constexpr uint64_t alignment = 4096;
+
+    file _file;
+    uint64_t _pos;
+    uint64_t _end;
+    size_t _buffer_size;
+    unsigned _read_ahead = 0;
+    adaptive_read_options _options;
+    std::deque<future<temporary_buffer<char>>> _reads;
+private:
+    void issue_read() {
+        auto size = std::min<uint64_t>(_buffer_size, _end - _pos);
+        auto aligned_end = align_down(_pos + size, alignment);
+        if (aligned_end > _pos && _pos + size < _end) {
+            size = aligned_end - _pos;
+        }
+        auto& stats = local_adaptive_read_stats();
+        ++stats.reads;
+        _reads.push_back(pooled_dma_read(_file, _pos, size, _options.io_priority_class).then([&stats] (temporary_buffer<char> buf) {
+            stats.bytes_read += buf.size();
+            return buf;
+        }));
+        _pos += size;
+    }
+public:
+    adaptive_file_data_source_impl(file f, uint64_t pos, uint64_t len, adaptive_read_options options)
+        : _file(std::move(f))
+        , _pos(pos)
+        , _end(pos + len)
+        , _buffer_size(std::max<size_t>(std::min(options.initial_buffer_size, options.max_buffer_size), alignment))
+        , _options(std::move(options))
+    { }
+
+    virtual future<temporary_buffer<char>> get() override {
+        if (_reads.empty()) {
+            if (_pos >= _end) {
+                return make_ready_future<temporary_buffer<char>>();
+            }
+            issue_read();
+        }
+        auto f = std::move(_reads.front());
+        _reads.pop_front();
+
+        _buffer_size = std::min(_buffer_size * 2, _options.max_buffer_size);
+        _read_ahead = std::min(_read_ahead + 1, _options.max_read_ahead);
+        while (_reads.size() < _read_ahead && _pos < _end) {
+            issue_read();
+        }
+        return f.then([] (temporary_buffer<char> buf) {
+            local_adaptive_read_stats().bytes_used += buf.size();
+            return buf;
+        });
+    }
+
+    virtual future<> close() override {
+        auto reads = std::move(_reads);
+        return do_with(std::move(reads), [] (std::deque<future<temporary_buffer<char>>>& reads) {
+            return parallel_for_each(reads, [] (future<temporary_buffer<char>>& f) {
+                // Errors of reads nobody waits for are of no interest.
+                return f.then_wrapped([] (future<temporary_buffer<char>> f) {
+                    f.ignore_ready_future();
+                });
+            });
+        });
+    }
+};
+
+constexpr uint64_t adaptive_file_data_source_impl::alignment;
+
+class adaptive_file_data_source : public data_source {
+public:
+    adaptive_file_data_source(file f, uint64_t pos, uint64_t len, adaptive_read_options options)
+        : data_source(std::make_unique<adaptive_file_data_source_impl>(std::move(f), pos, len, std::move(options)))
+    { }
+};
+
+input_stream<char> make_adaptive_file_input_stream(file f, uint64_t pos, uint64_t len, adaptive_read_options options) {
+    return input_stream<char>(adaptive_file_data_source(std::move(f), pos, len, std::move(options)));
+}
+
+}
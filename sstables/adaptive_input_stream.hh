@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "core/file.hh"
+#include "core/iostream.hh"
+#include "core/reactor.hh"
+
+namespace sstables {
+
+// Read pattern of an adaptive file input stream.
+//
+// The stream issues its first read with initial_buffer_size bytes and no
+// read ahead, so that a point read which only needs the beginning of the
+// range doesn't pay for more. Every buffer taken by the consumer is taken as
+// a sign that the range is read sequentially: the size of the following
+// reads is doubled, up to max_buffer_size, and one more read is kept in
+// flight, up to max_read_ahead.
+struct adaptive_read_options {
+    size_t initial_buffer_size = 8192;
+    size_t max_buffer_size = 128 * 1024;
+    unsigned max_read_ahead = 4;
+    ::io_priority_class io_priority_class = default_priority_class();
+};
+
+// Shard-wide account of the adaptive streams' reads. bytes_used is what was
+// handed to the readers; the rest of bytes_read was read ahead and dropped
+// because the reader stopped before consuming it.
+struct adaptive_read_stats {
+    uint64_t reads = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_used = 0;
+};
+
+adaptive_read_stats& local_adaptive_read_stats();
+
+// Input stream over the [pos, pos + len) range of f, reading it as described
+// by adaptive_read_options.
+input_stream<char> make_adaptive_file_input_stream(file f, uint64_t pos, uint64_t len, adaptive_read_options options);
+
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_cache.hh"
+
+namespace sstables {
+
+chunk_cache& global_chunk_cache() {
+    static thread_local chunk_cache instance;
+    return instance;
+}
+
+std::experimental::optional<temporary_buffer<char>> chunk_cache::lookup(uint64_t owner, uint64_t chunk) {
+    return _cache.lookup(std::make_pair(owner, chunk), [] (const chunk_cache_entry& e) {
+        return e.data();
+    });
+}
+
+void chunk_cache::insert(uint64_t owner, uint64_t chunk, const temporary_buffer<char>& data) {
+    if (data.size() > capacity()) {
+        return;
+    }
+    // Chunks don't change, an entry which is there already is up to date.
+    _cache.insert(std::make_pair(owner, chunk), [] (chunk_cache_entry&) { },
+            owner, chunk, bytes_view(reinterpret_cast<const int8_t*>(data.get()), data.size()));
+}
+
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <seastar/core/temporary_buffer.hh>
+
+#include "utils/lsa_lru_cache.hh"
+
+namespace sstables {
+
+// Decompressed chunk of a compressed data file.
+class chunk_cache_entry : public utils::lsa_lru_cache_entry {
+    uint64_t _owner;
+    uint64_t _chunk;
+    managed_bytes _data;
+public:
+    chunk_cache_entry(uint64_t owner, uint64_t chunk, bytes_view data)
+        : _owner(owner)
+        , _chunk(chunk)
+        , _data(data)
+    { }
+
+    chunk_cache_entry(chunk_cache_entry&&) noexcept = default;
+
+    // Requires linearized managed_bytes.
+    temporary_buffer<char> data() const {
+        bytes_view data = _data;
+        return temporary_buffer<char>(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    struct compare {
+        using key_type = std::pair<uint64_t, uint64_t>;
+        static key_type key(const chunk_cache_entry& e) {
+            return { e._owner, e._chunk };
+        }
+        bool operator()(const chunk_cache_entry& e1, const chunk_cache_entry& e2) const {
+            return key(e1) < key(e2);
+        }
+        bool operator()(const key_type& k, const chunk_cache_entry& e) const {
+            return k < key(e);
+        }
+        bool operator()(const chunk_cache_entry& e, const key_type& k) const {
+            return key(e) < k;
+        }
+        bool operator()(uint64_t owner, const chunk_cache_entry& e) const {
+            return owner < e._owner;
+        }
+        bool operator()(const chunk_cache_entry& e, uint64_t owner) const {
+            return e._owner < owner;
+        }
+    };
+};
+
+// Shard-wide cache of decompressed chunks of compressed sstable data files.
+//
+// Maps (sstable, chunk index) to the uncompressed contents of the chunk, so
+// that reads of neighbouring rows don't decompress the same chunk again.
+// Entries of an sstable are identified by the id of its chunk_cache_owner.
+class chunk_cache final {
+    using cache_type = utils::lsa_lru_cache<chunk_cache_entry, chunk_cache_entry::compare>;
+public:
+    using stats = cache_type::stats;
+private:
+    cache_type _cache{"chunk_cache"};
+    uint64_t _next_owner_id = 1;
+public:
+    // Returns a copy of given chunk of given sstable's data file.
+    std::experimental::optional<temporary_buffer<char>> lookup(uint64_t owner, uint64_t chunk);
+    void insert(uint64_t owner, uint64_t chunk, const temporary_buffer<char>& data);
+    // Removes all entries of given owner.
+    void invalidate(uint64_t owner) { _cache.invalidate(owner); }
+    void clear() { _cache.clear(); }
+
+    void set_capacity(size_t bytes) { _cache.set_capacity(bytes); }
+    size_t capacity() const { return _cache.capacity(); }
+    bool enabled() const { return _cache.enabled(); }
+
+    uint64_t new_owner_id() { return _next_owner_id++; }
+
+    const stats& get_stats() const { return _cache.get_stats(); }
+    const logalloc::region& region() const { return _cache.region(); }
+};
+
+// Returns a reference to shard-wide chunk_cache.
+chunk_cache& global_chunk_cache();
+
+// Allocates a chunk cache owner id for an sstable and removes all entries
+// belonging to it on destruction.
+class chunk_cache_owner {
+    uint64_t _id;
+public:
+    chunk_cache_owner() : _id(global_chunk_cache().new_owner_id()) { }
+    chunk_cache_owner(chunk_cache_owner&& o) noexcept : _id(o._id) {
+        o._id = 0;
+    }
+    chunk_cache_owner& operator=(chunk_cache_owner&&) = delete;
+    ~chunk_cache_owner() {
+        if (_id) {
+            global_chunk_cache().invalidate(_id);
+        }
+    }
+    uint64_t id() const { return _id; }
+};
+
+}
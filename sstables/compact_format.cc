@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compact_format.hh"
+#include "exceptions.hh"
+
+namespace sstables {
+
+namespace compact {
+
+void write_unsigned_vint(bytes_ostream& out, uint64_t value) {
+    // At most 10 bytes for a 64-bit value.
+    int8_t buf[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = int8_t(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = int8_t(uint8_t(value));
+    out.write(bytes_view(buf, n));
+}
+
+void write_signed_vint(bytes_ostream& out, int64_t value) {
+    write_unsigned_vint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+void write_blob(bytes_ostream& out, bytes_view value) {
+    write_unsigned_vint(out, value.size());
+    out.write(value);
+}
+
+uint64_t read_unsigned_vint(bytes_view& in) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (in.empty()) {
+            throw malformed_sstable_exception("truncated varint in compact atom");
+        }
+        uint8_t b = in.front();
+        in.remove_prefix(1);
+        value |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+    throw malformed_sstable_exception("varint too long in compact atom");
+}
+
+int64_t read_signed_vint(bytes_view& in) {
+    auto v = read_unsigned_vint(in);
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+bytes_view read_blob(bytes_view& in) {
+    auto size = read_unsigned_vint(in);
+    if (size > in.size()) {
+        throw malformed_sstable_exception("truncated value in compact atom");
+    }
+    auto v = in.substr(0, size);
+    in.remove_prefix(size);
+    return v;
+}
+
+uint32_t atom_writer::column_index(bytes_view column) {
+    auto i = _column_index.find(bytes(column));
+    if (i != _column_index.end()) {
+        return i->second;
+    }
+    uint32_t idx = _header.columns.elements.size();
+    _header.columns.elements.push_back(disk_string<uint16_t>{bytes(column)});
+    _column_index.emplace(bytes(column), idx);
+    return idx;
+}
+
+// The first timestamp and deletion time written become the bases. Whatever
+// comes later in the same sstable tends to be close to them.
+void atom_writer::write_timestamp(int64_t timestamp) {
+    if (!_has_timestamp_base) {
+        _header.timestamp_base = timestamp;
+        _has_timestamp_base = true;
+    }
+    write_signed_vint(_atom, timestamp - _header.timestamp_base);
+}
+
+void atom_writer::write_deletion_time(int32_t deletion_time) {
+    if (!_has_deletion_time_base) {
+        _header.local_deletion_time_base = deletion_time;
+        _has_deletion_time_base = true;
+    }
+    write_signed_vint(_atom, int64_t(deletion_time) - _header.local_deletion_time_base);
+}
+
+void atom_writer::start_cells(bytes_view prefix) {
+    assert(_atom.empty());
+    _prefix = bytes(prefix);
+}
+
+void atom_writer::start_cell(cell_flags flags, bytes_view column, bytes_view extra) {
+    if (_atom.empty()) {
+        int8_t kind = int8_t(atom_kind::cells);
+        _atom.write(bytes_view(&kind, 1));
+        write_blob(_atom, _prefix);
+    }
+    if (!extra.empty()) {
+        flags = cell_flags(flags | cell_flags::has_extra);
+    }
+    int8_t f = flags;
+    _atom.write(bytes_view(&f, 1));
+    write_unsigned_vint(_atom, column_index(column));
+    if (!extra.empty()) {
+        write_blob(_atom, extra);
+    }
+}
+
+void atom_writer::add_live_cell(bytes_view column, bytes_view extra, int64_t timestamp, bytes_view value) {
+    start_cell(cell_flags(0), column, extra);
+    write_timestamp(timestamp);
+    write_blob(_atom, value);
+}
+
+void atom_writer::add_expiring_cell(bytes_view column, bytes_view extra, int64_t timestamp,
+        uint32_t ttl, int32_t expiration, bytes_view value) {
+    start_cell(cell_flags::expiring, column, extra);
+    write_timestamp(timestamp);
+    write_unsigned_vint(_atom, ttl);
+    write_deletion_time(expiration);
+    write_blob(_atom, value);
+}
+
+void atom_writer::add_dead_cell(bytes_view column, bytes_view extra, int64_t timestamp, int32_t deletion_time) {
+    start_cell(cell_flags::deleted, column, extra);
+    write_timestamp(timestamp);
+    write_deletion_time(deletion_time);
+}
+
+void atom_writer::add_range_tombstone(bytes_view start, bytes_view end, int64_t timestamp, int32_t deletion_time) {
+    assert(_atom.empty());
+    int8_t kind = int8_t(atom_kind::range_tombstone);
+    _atom.write(bytes_view(&kind, 1));
+    write_blob(_atom, start);
+    write_blob(_atom, end);
+    write_timestamp(timestamp);
+    write_deletion_time(deletion_time);
+}
+
+}
+
+}
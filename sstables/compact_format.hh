@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include "bytes.hh"
+#include "bytes_ostream.hh"
+#include "types.hh"
+
+namespace sstables {
+
+// The compact data file format, written by sstables of version "sa".
+//
+// Partitions are framed as in ka/la: the key, the partition deletion time,
+// then a sequence of atoms ended by an empty one. An atom is a 32-bit length
+// followed by that many bytes and holds either the cells of a row, which
+// share a clustering prefix written once, or a range tombstone. Inside an
+// atom integers are varints, timestamps and deletion times are deltas against
+// the bases kept in the serialization_header of the Statistics component,
+// and cells refer to their column by its index into the header's column list.
+//
+// The name of a cell, as handed to the row_consumer, is the atom's prefix,
+// the column and the cell's extra name bytes (a collection key) put back
+// together, which is exactly how ka spells it.
+namespace compact {
+
+enum class atom_kind : uint8_t {
+    cells = 0,
+    range_tombstone = 1,
+};
+
+enum cell_flags : uint8_t {
+    deleted = 0x01,
+    expiring = 0x02,
+    has_extra = 0x04,
+};
+
+// Unsigned values are written 7 bits at a time, least significant first,
+// signed ones are zigzag encoded first so that small deltas stay short.
+void write_unsigned_vint(bytes_ostream& out, uint64_t value);
+void write_signed_vint(bytes_ostream& out, int64_t value);
+void write_blob(bytes_ostream& out, bytes_view value);
+
+// Throw malformed_sstable_exception if the input ends prematurely.
+uint64_t read_unsigned_vint(bytes_view& in);
+int64_t read_signed_vint(bytes_view& in);
+bytes_view read_blob(bytes_view& in);
+
+// Builds the atoms of a data file, and the serialization_header describing
+// them, as the sstable is written.
+class atom_writer {
+    serialization_header _header;
+    std::unordered_map<bytes, uint32_t> _column_index;
+    bool _has_timestamp_base = false;
+    bool _has_deletion_time_base = false;
+    bytes _prefix;
+    bytes_ostream _atom;
+private:
+    uint32_t column_index(bytes_view column);
+    void write_timestamp(int64_t timestamp);
+    void write_deletion_time(int32_t deletion_time);
+    void start_cell(cell_flags flags, bytes_view column, bytes_view extra);
+public:
+    // Cells added after start_cells() share given prefix. They start a new
+    // atom whenever the previous one was taken with finish_atom().
+    void start_cells(bytes_view prefix);
+    void add_live_cell(bytes_view column, bytes_view extra, int64_t timestamp, bytes_view value);
+    void add_expiring_cell(bytes_view column, bytes_view extra, int64_t timestamp,
+            uint32_t ttl, int32_t expiration, bytes_view value);
+    void add_dead_cell(bytes_view column, bytes_view extra, int64_t timestamp, int32_t deletion_time);
+    // A range tombstone is an atom of its own, to be taken with finish_atom()
+    // before anything else is added.
+    void add_range_tombstone(bytes_view start, bytes_view end, int64_t timestamp, int32_t deletion_time);
+
+    bool has_atom() const {
+        return !_atom.empty();
+    }
+    // Returns the body of the atom being built and starts over.
+    bytes_ostream finish_atom() {
+        return std::exchange(_atom, bytes_ostream());
+    }
+
+    serialization_header& header() {
+        return _header;
+    }
+};
+
+}
+
+}
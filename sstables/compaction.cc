@@ -46,6 +46,7 @@
 
 #include <boost/range/algorithm.hpp>
 #include <boost/range/adaptors.hpp>
+#include <boost/algorithm/cxx11/none_of.hpp>
 
 #include "core/future-util.hh"
 #include "core/pipe.hh"
@@ -62,6 +63,7 @@
 #include "db_clock.hh"
 #include "mutation_compactor.hh"
 #include "leveled_manifest.hh"
+#include "utils/stall_detector.hh"
 
 namespace sstables {
 
@@ -69,11 +71,21 @@ logging::logger logger("compaction");
 
 class sstable_reader final : public ::mutation_reader::impl {
     shared_sstable _sst;
+    query::partition_range _range;
     mutation_reader _reader;
+private:
+    mutation_reader make_reader(schema_ptr schema) {
+        auto& pc = service::get_local_compaction_priority();
+        if (_range.is_full()) {
+            return _sst->read_rows(std::move(schema), pc);
+        }
+        return _sst->read_range_rows(std::move(schema), _range, query::no_clustering_key_filtering, pc);
+    }
 public:
-    sstable_reader(shared_sstable sst, schema_ptr schema)
+    sstable_reader(shared_sstable sst, schema_ptr schema, const query::partition_range& range)
             : _sst(std::move(sst))
-            , _reader(_sst->read_rows(schema, service::get_local_compaction_priority()))
+            , _range(range)
+            , _reader(make_reader(std::move(schema)))
             {}
     virtual future<streamed_mutation_opt> operator()() override {
         return _reader.read().handle_exception([sst = _sst] (auto ep) {
@@ -84,16 +96,66 @@ class sstable_reader final : public ::mutation_reader::impl {
     }
 };
 
-static api::timestamp_type get_max_purgeable_timestamp(schema_ptr schema,
-    const std::vector<shared_sstable>& not_compacted_sstables, const dht::decorated_key& dk)
+// Finds how old the tombstones of a compacted partition have to be to be
+// purged: older than any data the sstables which aren't compacted may have
+// for the partition. Only the sstables overlapping the compacted ones are
+// consulted, and for a given partition only those whose token range covers
+// it. They are tried from the one with the oldest data, so the first whose
+// filter has the key decides, and a false positive of a filter of an sstable
+// elsewhere in the ring can't keep tombstones alive.
+class purge_checker {
+    struct candidate {
+        shared_sstable sst;
+        dht::token first;
+        dht::token last;
+        api::timestamp_type min_timestamp;
+    };
+    schema_ptr _schema;
+    std::vector<candidate> _candidates;
+public:
+    purge_checker(schema_ptr schema, std::vector<shared_sstable>& compacting, std::vector<shared_sstable>& not_compacted)
+        : _schema(std::move(schema))
+    {
+        for (auto&& sst : leveled_manifest::overlapping(*_schema, compacting, not_compacted)) {
+            _candidates.push_back(candidate{sst, sst->get_first_decorated_key(*_schema)._token,
+                sst->get_last_decorated_key(*_schema)._token, sst->get_stats_metadata().min_timestamp});
+        }
+        boost::sort(_candidates, [] (const candidate& x, const candidate& y) {
+            return x.min_timestamp < y.min_timestamp;
+        });
+    }
+
+    api::timestamp_type max_purgeable(const dht::decorated_key& dk) const {
+        auto hk = utils::make_hashed_key(bytes_view(key::from_partition_key(*_schema, dk.key())));
+        for (auto&& c : _candidates) {
+            if (dk._token < c.first || c.last < dk._token) {
+                continue;
+            }
+            if (c.sst->filter_has_key(hk)) {
+                return c.min_timestamp;
+            }
+        }
+        return api::max_timestamp;
+    }
+};
+
+// Compacted sstables released while the compaction runs are deleted one
+// after the other, so after a crash some of them may be back without others.
+// A tombstone which was purged could no longer shadow the data of another
+// compacted sstable then, so tombstones of partitions which more than one of
+// them has are kept, to be purged by a later compaction.
+static api::timestamp_type get_max_purgeable_timestamp_of_released(schema_ptr schema,
+    const std::vector<shared_sstable>& compacting, const dht::decorated_key& dk)
 {
     auto timestamp = api::max_timestamp;
-    for (auto&& sst : not_compacted_sstables) {
+    unsigned having_key = 0;
+    for (auto&& sst : compacting) {
         if (sst->filter_has_key(*schema, dk.key())) {
+            ++having_key;
             timestamp = std::min(timestamp, sst->get_stats_metadata().min_timestamp);
         }
     }
-    return timestamp;
+    return having_key > 1 ? timestamp : api::max_timestamp;
 }
 
 static bool belongs_to_current_node(const dht::token& t, const std::vector<range<dht::token>>& sorted_owned_ranges) {
@@ -144,30 +206,63 @@ class compacting_sstable_writer {
     uint64_t _max_sstable_size;
     uint32_t _sstable_level;
     db::replay_position _rp;
+    uint64_t _repaired_at;
     std::vector<unsigned long> _ancestors;
     compaction_info& _info;
+    compaction_manager& _cm;
     shared_sstable _sst;
     stdx::optional<sstable_writer> _writer;
+    // Data written to the current sstable which throttle() accounted for.
+    uint64_t _throttled_bytes = 0;
+    uint64_t _early_open_interval;
+    std::function<void(std::vector<shared_sstable>)> _open_early;
+    // Finished sstables which weren't opened early yet, and their size.
+    std::vector<shared_sstable> _unopened;
+    uint64_t _unopened_bytes = 0;
 private:
-    void finish_sstable_write() {
+    // Holds compaction back if it goes faster than the compaction manager allows.
+    void throttle() {
+        auto written = _writer->bytes_written();
+        _cm.throttle(written - _throttled_bytes).get();
+        _throttled_bytes = written;
+    }
+
+    void finish_sstable_write(bool end_of_stream) {
         _writer->consume_end_of_stream();
         _writer = stdx::nullopt;
 
         _sst->open_data().get0();
         _info.end_size += _sst->data_size();
+
+        // There's no point in opening the last sstable early, the compaction
+        // is about to replace the compacted sstables with all of its output.
+        if (!_early_open_interval || end_of_stream) {
+            return;
+        }
+        _unopened.push_back(_sst);
+        _unopened_bytes += _sst->data_size();
+        if (_unopened_bytes >= _early_open_interval) {
+            _unopened_bytes = 0;
+            _open_early(std::exchange(_unopened, {}));
+        }
     }
 public:
     compacting_sstable_writer(const schema& s, std::function<shared_sstable()> creator, uint64_t partitions_per_sstable,
-                              uint64_t max_sstable_size, uint32_t sstable_level, db::replay_position rp,
-                              std::vector<unsigned long> ancestors, compaction_info& info)
+                              uint64_t max_sstable_size, uint32_t sstable_level, db::replay_position rp, uint64_t repaired_at,
+                              std::vector<unsigned long> ancestors, compaction_info& info, compaction_manager& cm,
+                              uint64_t early_open_interval, std::function<void(std::vector<shared_sstable>)> open_early)
         : _schema(s)
         , _creator(creator)
         , _partitions_per_sstable(partitions_per_sstable)
         , _max_sstable_size(max_sstable_size)
         , _sstable_level(sstable_level)
         , _rp(rp)
+        , _repaired_at(repaired_at)
         , _ancestors(std::move(ancestors))
         , _info(info)
+        , _cm(cm)
+        , _early_open_interval(early_open_interval)
+        , _open_early(std::move(open_early))
     { }
 
     void consume_new_partition(const dht::decorated_key& dk) {
@@ -180,12 +275,14 @@ class compacting_sstable_writer {
             _info.new_sstables.push_back(_sst);
             _sst->get_metadata_collector().set_replay_position(_rp);
             _sst->get_metadata_collector().sstable_level(_sstable_level);
+            _sst->get_metadata_collector().set_repaired_at(_repaired_at);
             for (auto ancestor : _ancestors) {
                 _sst->add_ancestor(ancestor);
             }
 
             auto&& priority = service::get_local_compaction_priority();
             _writer.emplace(_sst->get_writer(_schema, _partitions_per_sstable, _max_sstable_size, false, priority));
+            _throttled_bytes = 0;
         }
         _info.total_keys_written++;
         _writer->consume_new_partition(dk);
@@ -198,15 +295,16 @@ class compacting_sstable_writer {
 
     stop_iteration consume_end_of_partition() {
         auto ret = _writer->consume_end_of_partition();
+        throttle();
         if (ret == stop_iteration::yes) {
-            finish_sstable_write();
+            finish_sstable_write(false);
         }
         return ret;
     }
 
     void consume_end_of_stream() {
         if (_writer) {
-            finish_sstable_write();
+            finish_sstable_write(true);
         }
     }
 };
@@ -216,8 +314,10 @@ class compacting_sstable_writer {
 // are created using the "sstable_creator" object passed by the caller.
 future<std::vector<shared_sstable>>
 compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::function<shared_sstable()> creator,
-                 uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup) {
-    return seastar::async([sstables = std::move(sstables), &cf, creator = std::move(creator), max_sstable_size, sstable_level, cleanup] () mutable {
+                 uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup, query::partition_range range,
+                 uint64_t early_open_interval) {
+    return seastar::async([sstables = std::move(sstables), &cf, creator = std::move(creator), max_sstable_size, sstable_level, cleanup,
+            range = std::move(range), early_open_interval] () mutable {
         std::vector<::mutation_reader> readers;
         uint64_t estimated_partitions = 0;
         std::vector<unsigned long> ancestors;
@@ -232,17 +332,52 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         assert(sstables.size() > 0);
 
         db::replay_position rp;
+        // The output is repaired only if all of the input is.
+        uint64_t repaired_at = std::numeric_limits<uint64_t>::max();
+        std::experimental::optional<hll::HyperLogLog> keys;
+        bool all_sketched = true;
 
         std::vector<shared_sstable> not_compacted_sstables = get_uncompacting_sstables(cf, sstables);
 
         auto schema = cf.schema();
+
+        // Fully expired sstables have nothing which would survive the
+        // compaction, nor anything shadowing other sstables, so drop them
+        // without reading them.
+        std::unordered_set<shared_sstable> expired;
+        if (!cleanup) {
+            auto gc_before = gc_clock::now() - schema->gc_grace_seconds();
+            auto e = get_fully_expired_sstables(cf, sstables, gc_before.time_since_epoch().count());
+            expired.insert(e.begin(), e.end());
+        }
+        if (expired.size() == sstables.size()) {
+            // Nothing to read nor to write. The caller replaces the sstables
+            // with no new ones, which deletes them.
+            logger.info("Dropping {} fully expired sstables of {}.{}", sstables.size(), schema->ks_name(), schema->cf_name());
+            cm.deregister_compaction(info);
+            return std::vector<shared_sstable>();
+        }
+
         for (auto sst : sstables) {
-            // We also capture the sstable, so we keep it alive while the read isn't done
-            readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema));
-            // FIXME: If the sstables have cardinality estimation bitmaps, use that
-            // for a better estimate for the number of partitions in the merged
-            // sstable than just adding up the lengths of individual sstables.
+            if (expired.count(sst)) {
+                logger.debug("Dropping fully expired sstable {}", sst->get_filename());
+            } else {
+                // We also capture the sstable, so we keep it alive while the read isn't done
+                readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema, range));
+            }
             estimated_partitions += sst->get_estimated_key_count();
+            if (all_sketched) {
+                auto sketch = sst->get_cardinality();
+                if (sketch && (!keys || keys->registerSize() == sketch->registerSize())) {
+                    if (!keys) {
+                        keys = std::move(sketch);
+                    } else {
+                        keys->merge(*sketch);
+                    }
+                } else {
+                    all_sketched = false;
+                }
+            }
             info->total_partitions += sst->get_estimated_key_count();
             // Compacted sstable keeps track of its ancestors.
             ancestors.push_back(sst->generation());
@@ -256,8 +391,15 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
             // this is kind of ok, esp. since we will hopefully not be trying to recover based on
             // compacted sstables anyway (CL should be clean by then).
             rp = std::max(rp, sst->get_stats_metadata().position);
+            repaired_at = std::min(repaired_at, sst->get_repaired_at());
         }
 
+        // Keys present in several of the sstables are merged, so if all of them
+        // have sketches of their keys, estimate the number of partitions in the
+        // output by the cardinality of their union instead.
+        if (all_sketched && keys) {
+            estimated_partitions = std::min(estimated_partitions, uint64_t(keys->estimate()) + 1);
+        }
         uint64_t estimated_sstables = std::max(1UL, uint64_t(ceil(double(info->start_size) / max_sstable_size)));
         uint64_t partitions_per_sstable = ceil(double(estimated_partitions) / estimated_sstables);
 
@@ -276,14 +418,40 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
 
         auto start_time = db_clock::now();
 
-        auto get_max_purgeable = [schema, not_compacted_sstables] (const dht::decorated_key& dk) {
-            return get_max_purgeable_timestamp(schema, not_compacted_sstables, dk);
+        // Opening output early releases compacted sstables.
+        auto releases = early_open_interval != 0;
+        auto checker = make_lw_shared<purge_checker>(schema, sstables, not_compacted_sstables);
+        auto get_max_purgeable = [schema, checker, compacting = sstables, releases] (const dht::decorated_key& dk) {
+            auto timestamp = checker->max_purgeable(dk);
+            if (releases) {
+                timestamp = std::min(timestamp, get_max_purgeable_timestamp_of_released(schema, compacting, dk));
+            }
+            return timestamp;
         };
-        auto cr = compacting_sstable_writer(*schema, creator, partitions_per_sstable, max_sstable_size, sstable_level, rp, std::move(ancestors), *info);
+        // Output sstables which were opened early, and which have to be taken
+        // out of the column family's sstable set again if compaction fails,
+        // unless it released compacted sstables.
+        std::vector<shared_sstable> opened_early;
+        std::vector<shared_sstable> released;
+        auto open_early = [&cf, &sstables, &opened_early, &released] (std::vector<shared_sstable> ssts) {
+            auto r = cf.open_early(ssts, sstables);
+            released.insert(released.end(), r.begin(), r.end());
+            opened_early.insert(opened_early.end(), ssts.begin(), ssts.end());
+        };
+        auto cr = compacting_sstable_writer(*schema, creator, partitions_per_sstable, max_sstable_size, sstable_level, rp, repaired_at, std::move(ancestors), *info, cm,
+                early_open_interval, std::move(open_early));
+        tombstone_purge_stats purge_stats;
         auto cfc = make_stable_flattened_mutations_consumer<compact_for_compaction<compacting_sstable_writer>>(
-                *schema, gc_clock::now(), std::move(cr), get_max_purgeable);
+                *schema, gc_clock::now(), std::move(cr), get_max_purgeable, &purge_stats);
+        auto account_purges = [&] {
+            info->expired_tombstones = purge_stats.expired;
+            info->purged_tombstones = purge_stats.purged;
+        };
 
-        auto filter = [cleanup, sorted_owned_ranges = std::move(owned_ranges)] (const streamed_mutation& sm) {
+        auto filter = [cleanup, shard_local = cf.is_shard_local(), sorted_owned_ranges = std::move(owned_ranges)] (const streamed_mutation& sm) {
+            if (shard_local) {
+                return true;
+            }
             if (dht::shard_of(sm.decorated_key().token()) != engine().cpu_id()) {
                 return false;
             }
@@ -296,13 +464,32 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         try {
             consume_flattened_in_thread(reader, cfc, filter);
         } catch (...) {
+            account_purges();
             cm.deregister_compaction(info);
+            if (!released.empty()) {
+                // The released sstables are gone, what they had is only in
+                // the sstables opened early, which stay in place of them.
+                logger.info("Keeping {} sstables of interrupted compaction of {}.{}, which released {} compacted sstables",
+                        opened_early.size(), info->ks, info->cf, released.size());
+                cm.deregister_compacting_sstables(opened_early);
+                std::unordered_set<shared_sstable> kept(opened_early.begin(), opened_early.end());
+                auto e = boost::range::remove_if(info->new_sstables, [&kept] (const shared_sstable& sst) {
+                    return kept.count(sst);
+                });
+                info->new_sstables.erase(e, info->new_sstables.end());
+            } else if (!opened_early.empty()) {
+                cf.revert_early_open(opened_early, sstables);
+            }
             delete_sstables_for_interrupted_compaction(info->new_sstables, info->ks, info->cf);
             throw;
         }
 
         // deregister compaction_stats of finished compaction from compaction manager.
+        account_purges();
         cm.deregister_compaction(info);
+        if (!cleanup) {
+            cf.account_compaction(info->start_size, info->end_size);
+        }
 
         double ratio = double(info->end_size) / double(info->start_size);
         auto end_time = db_clock::now();
@@ -321,11 +508,11 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         // - there is no easy way, currently, to know the exact number of total partitions.
         // By the time being, using estimated key count.
         logger.info("{} {} sstables to [{}]. {} bytes to {} (~{}% of original) in {}ms = {}MB/s. " \
-            "~{} total partitions merged to {}.",
+            "~{} total partitions merged to {}. {} of {} expired tombstones purged.",
             (!cleanup) ? "Compacted" : "Cleaned",
             info->sstables, new_sstables_msg, info->start_size, info->end_size, (int) (ratio * 100),
             std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(), throughput,
-            info->total_partitions, info->total_keys_written);
+            info->total_partitions, info->total_keys_written, info->purged_tombstones, info->expired_tombstones);
 
         // If compaction is running for testing purposes, detect that there is
         // no query context and skip code that updates compaction history.
@@ -338,14 +525,25 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
             return std::move(info->new_sstables);
         }
 
-        auto compacted_at = std::chrono::duration_cast<std::chrono::milliseconds>(end_time.time_since_epoch()).count();
-
+        db::system_keyspace::compaction_history_entry entry;
+        entry.ks = info->ks;
+        entry.cf = info->cf;
+        entry.compacted_at = std::chrono::duration_cast<std::chrono::milliseconds>(end_time.time_since_epoch()).count();
+        entry.bytes_in = info->start_size;
+        entry.bytes_out = info->end_size;
         // FIXME: add support to merged_rows. merged_rows is a histogram that
         // shows how many sstables each row is merged from. This information
         // cannot be accessed until we make combined_reader more generic,
         // for example, by adding a reducer method.
-        db::system_keyspace::update_compaction_history(info->ks, info->cf, compacted_at,
-            info->start_size, info->end_size, std::unordered_map<int32_t, int64_t>{}).get0();
+        entry.sstables_in = info->sstables;
+        entry.sstables_out = info->new_sstables.size();
+        entry.partitions_in = info->total_partitions;
+        entry.partitions_out = info->total_keys_written;
+        entry.tombstones_expired = info->expired_tombstones;
+        entry.tombstones_purged = info->purged_tombstones;
+        entry.duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+        entry.compaction_strategy = cf.get_compaction_strategy().name();
+        db::system_keyspace::update_compaction_history(entry).get0();
 
         // Return vector with newly created sstable(s).
         return std::move(info->new_sstables);
@@ -354,9 +552,13 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
 
 std::vector<sstables::shared_sstable>
 get_fully_expired_sstables(column_family& cf, std::vector<sstables::shared_sstable>& compacting, int32_t gc_before) {
+    utils::stall_scope stall(utils::stall_subsystem::compaction);
     logger.debug("Checking droppable sstables in {}.{}", cf.schema()->ks_name(), cf.schema()->cf_name());
 
-    if (compacting.empty()) {
+    // Checking for overlapping sstables is costly, skip it if nothing could be expired.
+    if (boost::algorithm::none_of(compacting, [gc_before] (const shared_sstable& sst) {
+        return sst->get_stats_metadata().max_local_deletion_time < gc_before;
+    })) {
         return {};
     }
 
@@ -399,4 +601,46 @@ get_fully_expired_sstables(column_family& cf, std::vector<sstables::shared_sstab
     return std::vector<sstables::shared_sstable>(candidates.begin(), candidates.end());
 }
 
+std::vector<query::partition_range>
+split_for_compaction(const schema& s, const std::vector<shared_sstable>& sstables, unsigned count) {
+    if (count <= 1 || sstables.empty()) {
+        return { query::full_partition_range };
+    }
+    auto first = sstables.front()->get_first_decorated_key(s).token();
+    auto last = sstables.front()->get_last_decorated_key(s).token();
+    for (auto& sst : sstables) {
+        first = std::min(first, sst->get_first_decorated_key(s).token());
+        last = std::max(last, sst->get_last_decorated_key(s).token());
+    }
+
+    // Halve every piece of the span until there are enough of them.
+    std::vector<dht::token> points{first, last};
+    for (unsigned pieces = 1; pieces * 2 <= count; pieces *= 2) {
+        std::vector<dht::token> halved;
+        halved.reserve(points.size() * 2);
+        for (auto i = points.begin(); std::next(i) != points.end(); ++i) {
+            halved.push_back(*i);
+            auto mid = dht::global_partitioner().midpoint(*i, *std::next(i));
+            if (*i < mid && mid < *std::next(i)) {
+                halved.push_back(std::move(mid));
+            }
+        }
+        halved.push_back(points.back());
+        points = std::move(halved);
+    }
+
+    // ending_at() positions sort after all keys of their token, so the
+    // ranges split the ring between tokens without overlapping.
+    using bound = query::partition_range::bound;
+    std::vector<query::partition_range> ranges;
+    stdx::optional<bound> start;
+    for (auto i = std::next(points.begin()); std::next(i) != points.end(); ++i) {
+        auto end = bound(dht::ring_position::ending_at(*i), true);
+        ranges.emplace_back(start, end);
+        start = bound(dht::ring_position::ending_at(*i), false);
+    }
+    ranges.emplace_back(start, stdx::nullopt);
+    return ranges;
+}
+
 }
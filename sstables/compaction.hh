@@ -34,6 +34,13 @@ namespace sstables {
         int level;
         // Threshold size for sstable(s) to be created.
         uint64_t max_sstable_bytes;
+        // Number of disjoint token sub-ranges the sstables are compacted in,
+        // each by a compaction of its own running in parallel with the others.
+        unsigned sub_ranges = 1;
+        // Only partitions in this range are read and written. Used to split
+        // an sstable shared by several shards, each of which reads just the
+        // part it owns.
+        query::partition_range range = query::full_partition_range;
 
         compaction_descriptor() = default;
 
@@ -77,6 +84,10 @@ namespace sstables {
         uint64_t end_size = 0;
         uint64_t total_partitions = 0;
         uint64_t total_keys_written = 0;
+        // Tombstones past gc_grace_seconds the compaction came across, and
+        // how many of them it could purge.
+        uint64_t expired_tombstones = 0;
+        uint64_t purged_tombstones = 0;
         std::vector<shared_sstable> new_sstables;
         sstring stop_requested;
 
@@ -100,9 +111,22 @@ namespace sstables {
     // If cleanup is true, mutation that doesn't belong to current node will be
     // cleaned up, log messages will inform the user that compact_sstables runs for
     // cleaning operation, and compaction history will not be updated.
+    // Only partitions inside range are compacted, so compactions of the same
+    // sstables over disjoint ranges produce sstables which don't overlap.
+    // If early_open_interval isn't 0, the sstables written so far are handed
+    // to column_family::open_early() each time that many more bytes were
+    // written, making them readable before the compaction is done.
     future<std::vector<shared_sstable>> compact_sstables(std::vector<shared_sstable> sstables,
             column_family& cf, std::function<shared_sstable()> creator,
-            uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup = false);
+            uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup = false,
+            query::partition_range range = query::full_partition_range,
+            uint64_t early_open_interval = 0);
+
+    // Splits the ring into disjoint partition ranges which cut the token range
+    // spanned by given sstables into equal parts, for compacting them in
+    // parallel. The number of ranges is count rounded down to a power of two.
+    std::vector<query::partition_range>
+    split_for_compaction(const schema& s, const std::vector<shared_sstable>& sstables, unsigned count);
 
     // Return the most interesting bucket applying the size-tiered strategy.
     std::vector<sstables::shared_sstable>
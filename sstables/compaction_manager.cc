@@ -22,11 +22,27 @@
 #include "compaction_manager.hh"
 #include "database.hh"
 #include "core/scollectd.hh"
+#include "core/sleep.hh"
+#include "core/future-util.hh"
 #include "exceptions.hh"
+#include "utils/stall_detector.hh"
 #include <cmath>
 
 static logging::logger cmlog("compaction_manager");
 
+// Throughput controller tuning.
+static constexpr auto controller_period = std::chrono::seconds(1);
+// How much idle time compaction may make up for by going above the limit.
+static constexpr auto controller_burst = std::chrono::milliseconds(100);
+// Limits of the throughput limit, relative to the base throughput.
+static constexpr double controller_max_boost = 8;
+static constexpr double controller_min_fraction = 0.25;
+// Every this many pending compactions add the base throughput to the limit.
+static constexpr double controller_backlog_per_base = 4;
+// Past this backlog, read amplification hurts reads more than compaction
+// competing with them for the disk, so read latency no longer slows it down.
+static constexpr int64_t controller_urgent_backlog = 32;
+
 class compacting_sstable_registration {
     compaction_manager* _cm;
     std::vector<sstables::shared_sstable> _compacting;
@@ -133,10 +149,16 @@ static inline int calculate_weight(const std::vector<sstables::shared_sstable>&
 }
 
 int compaction_manager::trim_to_compact(column_family* cf, sstables::compaction_descriptor& descriptor) {
-    int weight = calculate_weight(descriptor.sstables);
     // NOTE: a compaction job with level > 0 cannot be trimmed because leveled
     // compaction relies on higher levels having no overlapping sstables.
-    if (descriptor.level != 0 || descriptor.sstables.empty()) {
+    // Its weight is the level it writes to, rather than its size, so that
+    // leveled compactions into different levels run in parallel, but not
+    // two into the same one. Size weights aren't negative.
+    if (descriptor.level != 0) {
+        return -int(descriptor.level);
+    }
+    int weight = calculate_weight(descriptor.sstables);
+    if (descriptor.sstables.empty()) {
         return weight;
     }
     auto it = _weight_tracker.find(cf);
@@ -226,7 +248,7 @@ void compaction_manager::deregister_compacting_sstables(const std::vector<sstabl
 // compacts just a single sstable, and writes one new sstable. This operation
 // is useful to split an sstable containing data belonging to multiple shards
 // into a separate sstable on each shard.
-void compaction_manager::submit_sstable_rewrite(column_family* cf, sstables::shared_sstable sst) {
+future<> compaction_manager::submit_sstable_rewrite(column_family* cf, sstables::shared_sstable sst) {
     // The semaphore ensures that the sstable rewrite operations submitted by
     // submit_sstable_rewrite are run in sequence, and not all of them in
     // parallel. Note that unlike general compaction which currently allows
@@ -236,7 +258,7 @@ void compaction_manager::submit_sstable_rewrite(column_family* cf, sstables::sha
     // We cannot, and don't need to, compact an sstable which is already
     // being compacted anyway.
     if (_stopped || _compacting_sstables.count(sst)) {
-        return;
+        return make_ready_future<>();
     }
     // Conversely, we don't want another compaction job to compact the
     // sstable we are planning to work on:
@@ -245,10 +267,15 @@ void compaction_manager::submit_sstable_rewrite(column_family* cf, sstables::sha
     _tasks.push_back(task);
     _stats.active_tasks++;
     task->compaction_done = with_semaphore(sem, 1, [cf, sst] {
-        return cf->compact_sstables(sstables::compaction_descriptor(
+        auto descriptor = sstables::compaction_descriptor(
                 std::vector<sstables::shared_sstable>{sst},
                 sst->get_sstable_level(),
-                std::numeric_limits<uint64_t>::max()), false);
+                std::numeric_limits<uint64_t>::max());
+        // Every shard sharing the sstable rewrites it at the same time, so
+        // instead of each of them reading all of it and dropping what other
+        // shards own, have each read only the token range of its own.
+        descriptor.range = dht::shard_range(engine().cpu_id());
+        return cf->compact_sstables(std::move(descriptor), false);
     }).then_wrapped([this, sst, task] (future<> f) {
         _compacting_sstables.erase(sst);
         _stats.active_tasks--;
@@ -264,6 +291,7 @@ void compaction_manager::submit_sstable_rewrite(column_family* cf, sstables::sha
             _stats.errors++;
         }
     });
+    return task->compaction_done.get_future();
 }
 
 future<> compaction_manager::task_stop(lw_shared_ptr<compaction_manager::task> task) {
@@ -293,6 +321,14 @@ void compaction_manager::register_collectd_metrics() {
     };
 
     add("objects", "compactions", scollectd::data_type::GAUGE, [&] { return _stats.active_tasks; });
+    add("bytes", "throughput_limit", scollectd::data_type::GAUGE, [&] { return _controller_stats.throughput_limit; });
+    add("objects", "backlog", scollectd::data_type::GAUGE, [&] { return _controller_stats.backlog; });
+    add("latency", "controller_read_latency", scollectd::data_type::GAUGE, [&] { return _controller_stats.read_latency.count(); });
+    add("total_operations", "throughput_increases", scollectd::data_type::DERIVE, [&] { return _controller_stats.increases; });
+    add("total_operations", "throughput_decreases", scollectd::data_type::DERIVE, [&] { return _controller_stats.decreases; });
+    add("total_operations", "throttled", scollectd::data_type::DERIVE, [&] { return _controller_stats.throttled; });
+    add("total_operations", "expired_tombstones", scollectd::data_type::DERIVE, [&] { return _stats.expired_tombstones; });
+    add("total_operations", "purged_tombstones", scollectd::data_type::DERIVE, [&] { return _stats.purged_tombstones; });
 }
 
 void compaction_manager::start() {
@@ -307,6 +343,7 @@ future<> compaction_manager::stop() {
     }
     _stopped = true;
     _registrations.clear();
+    _controller_timer.cancel();
     // Stop all ongoing compaction.
     for (auto& info : _compactions) {
         info->stop("shutdown");
@@ -362,7 +399,10 @@ void compaction_manager::submit(column_family* cf) {
         }
         column_family& cf = *task->compacting_cf;
         sstables::compaction_strategy cs = cf.get_compaction_strategy();
-        sstables::compaction_descriptor descriptor = cs.get_sstables_for_compaction(cf, get_candidates(cf));
+        sstables::compaction_descriptor descriptor = [&] {
+            utils::stall_scope stall(utils::stall_subsystem::compaction);
+            return cs.get_sstables_for_compaction(cf, get_candidates(cf));
+        }();
         int weight = trim_to_compact(&cf, descriptor);
 
         // Stop compaction task immediately if strategy is satisfied or job cannot run in parallel.
@@ -494,3 +534,76 @@ void compaction_manager::stop_compaction(sstring type) {
         }
     }
 }
+
+void compaction_manager::start_throughput_controller(uint64_t base_throughput, std::chrono::microseconds read_latency_target,
+        std::function<controller_input()> sample) {
+    _read_latency_target = read_latency_target;
+    _sample_controller_input = std::move(sample);
+    _last_input = _sample_controller_input();
+    set_base_throughput(base_throughput);
+    _controller_timer.set_callback([this] { adjust_throughput(); });
+    _controller_timer.arm_periodic(controller_period);
+}
+
+void compaction_manager::set_base_throughput(uint64_t base_throughput) {
+    _base_throughput = base_throughput;
+    _controller_stats.throughput_limit = base_throughput;
+}
+
+// Moves the throughput limit towards a target which grows with the backlog,
+// so that compaction keeps up with writes and read amplification stays
+// bounded, and which is lowered while foreground reads are slower than the
+// target latency, unless the backlog is large already.
+void compaction_manager::adjust_throughput() {
+    auto input = _sample_controller_input();
+    auto reads = input.reads - _last_input.reads;
+    auto latency = std::chrono::microseconds(0);
+    if (reads > 0) {
+        latency = std::chrono::microseconds((input.read_latency_sum - _last_input.read_latency_sum) / reads / 1000);
+    }
+    _last_input = input;
+    _controller_stats.backlog = input.backlog;
+    _controller_stats.read_latency = latency;
+    if (!_base_throughput) {
+        return;
+    }
+
+    double base = _base_throughput;
+    double target = base * std::min(controller_max_boost, 1 + input.backlog / controller_backlog_per_base);
+    if (latency > _read_latency_target && input.backlog < controller_urgent_backlog) {
+        target *= double(_read_latency_target.count()) / latency.count();
+    }
+    target = std::max(target, base * controller_min_fraction);
+
+    // Go half way each period, so that a single noisy sample doesn't swing it.
+    double old_limit = _controller_stats.throughput_limit;
+    auto limit = uint64_t(old_limit + (target - old_limit) / 2);
+    if (limit > _controller_stats.throughput_limit) {
+        _controller_stats.increases++;
+    } else if (limit < _controller_stats.throughput_limit) {
+        _controller_stats.decreases++;
+    }
+    cmlog.debug("Compaction throughput limit {} -> {} bytes/s (backlog {}, read latency {}us)",
+        _controller_stats.throughput_limit, limit, input.backlog, latency.count());
+    _controller_stats.throughput_limit = limit;
+}
+
+future<> compaction_manager::throttle(uint64_t bytes) {
+    auto limit = _controller_stats.throughput_limit;
+    if (!limit || !bytes) {
+        return make_ready_future<>();
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(double(bytes) / limit));
+    _throttled_until = std::max(_throttled_until, now - controller_burst) + duration;
+    if (_throttled_until <= now) {
+        return make_ready_future<>();
+    }
+    _controller_stats.throttled++;
+    // Sleep in slices, so that stop() doesn't wait for a long throttle.
+    auto until = _throttled_until;
+    return do_until([this, until] { return _stopped || std::chrono::steady_clock::now() >= until; }, [until] {
+        auto left = until - std::chrono::steady_clock::now();
+        return sleep(std::min<std::chrono::steady_clock::duration>(left, controller_burst));
+    });
+}
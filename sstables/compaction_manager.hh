@@ -26,11 +26,13 @@
 #include "core/shared_ptr.hh"
 #include "core/gate.hh"
 #include "core/shared_future.hh"
+#include "core/timer.hh"
 #include "log.hh"
 #include "utils/exponential_backoff_retry.hh"
 #include <vector>
 #include <list>
 #include <functional>
+#include <chrono>
 #include "sstables/compaction.hh"
 
 class column_family;
@@ -46,6 +48,30 @@ class compaction_manager {
         int64_t completed_tasks = 0;
         uint64_t active_tasks = 0; // Number of compaction going on.
         int64_t errors = 0;
+        // Of all compactions, see compaction_info.
+        uint64_t expired_tombstones = 0;
+        uint64_t purged_tombstones = 0;
+    };
+    // What the throughput controller acts on, sampled from the database.
+    struct controller_input {
+        // Compactions the strategies of all tables would like to run.
+        int64_t backlog = 0;
+        // Running totals of sampled foreground reads and of their latency,
+        // in nanoseconds.
+        int64_t reads = 0;
+        int64_t read_latency_sum = 0;
+    };
+    struct controller_stats {
+        // Current limit of the compaction throughput of this shard, in bytes
+        // per second. 0 if compaction isn't throttled.
+        uint64_t throughput_limit = 0;
+        int64_t backlog = 0;
+        // Mean latency of foreground reads in the last controller period.
+        std::chrono::microseconds read_latency{0};
+        uint64_t increases = 0;
+        uint64_t decreases = 0;
+        // Number of times a compaction waited for the limit.
+        uint64_t throttled = 0;
     };
 private:
     struct task {
@@ -74,6 +100,18 @@ class compaction_manager {
     // Keep track of weight of ongoing compaction for each column family.
     // That's used to allow parallel compaction on the same column family.
     std::unordered_map<column_family*, std::unordered_set<int>> _weight_tracker;
+
+    // Throughput controller: the limit starts at the base throughput and is
+    // adjusted every period from the compaction backlog and the latency of
+    // foreground reads, see adjust_throughput().
+    uint64_t _base_throughput = 0;
+    std::chrono::microseconds _read_latency_target{0};
+    std::function<controller_input()> _sample_controller_input;
+    controller_input _last_input;
+    timer<> _controller_timer;
+    controller_stats _controller_stats;
+    // Compactions may write until then without exceeding the limit.
+    std::chrono::steady_clock::time_point _throttled_until;
 private:
     future<> task_stop(lw_shared_ptr<task> task);
 
@@ -104,6 +142,8 @@ class compaction_manager {
     inline bool check_for_cleanup(column_family *cf);
 
     inline future<> put_task_to_sleep(lw_shared_ptr<task>& task);
+
+    void adjust_throughput();
 public:
     compaction_manager();
     ~compaction_manager();
@@ -125,8 +165,9 @@ class compaction_manager {
     // Submit a specific sstable to be rewritten, while dropping data which
     // does not belong to this shard. Meant to be used on startup when an
     // sstable is shared by multiple shards, and we want to split it to a
-    // separate sstable for each shard.
-    void submit_sstable_rewrite(column_family* cf,
+    // separate sstable for each shard. The returned future resolves when
+    // the rewrite is done, and never fails.
+    future<> submit_sstable_rewrite(column_family* cf,
             sstables::shared_sstable s);
 
     // Remove a column family from the compaction manager.
@@ -142,6 +183,8 @@ class compaction_manager {
     }
 
     void deregister_compaction(lw_shared_ptr<sstables::compaction_info> c) {
+        _stats.expired_tombstones += c->expired_tombstones;
+        _stats.purged_tombstones += c->purged_tombstones;
         _compactions.remove(c);
     }
 
@@ -152,6 +195,23 @@ class compaction_manager {
     // Stops ongoing compaction of a given type.
     void stop_compaction(sstring type);
 
+    // Starts limiting the compaction throughput of this shard to around
+    // base_throughput bytes per second, raised when the backlog grows and
+    // lowered when foreground reads get slower than read_latency_target.
+    // A base_throughput of 0 leaves compaction unthrottled.
+    void start_throughput_controller(uint64_t base_throughput, std::chrono::microseconds read_latency_target,
+            std::function<controller_input()> sample);
+    void set_base_throughput(uint64_t base_throughput);
+    uint64_t base_throughput() const {
+        return _base_throughput;
+    }
+    const controller_stats& get_controller_stats() const {
+        return _controller_stats;
+    }
+    // Waits until compaction may write given number of bytes more without
+    // exceeding the current throughput limit.
+    future<> throttle(uint64_t bytes);
+
     friend class compacting_sstable_registration;
     friend class compaction_weight_registration;
 };
@@ -37,8 +37,15 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <vector>
 #include <chrono>
+#include <map>
+#include <list>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "sstables.hh"
 #include "compaction.hh"
@@ -50,10 +57,12 @@
 #include "sstable_set.hh"
 #include "compatible_ring_position.hh"
 #include <boost/range/algorithm/find.hpp>
-#include <boost/icl/interval_map.hpp>
 #include "date_tiered_compaction_strategy.hh"
+#include "time_window_compaction_strategy.hh"
+#include <boost/range/adaptor/filtered.hpp>
 
 logging::logger date_tiered_manifest::logger = logging::logger("DateTieredCompactionStrategy");
+logging::logger time_window_manifest::logger = logging::logger("TimeWindowCompactionStrategy");
 
 namespace sstables {
 
@@ -64,8 +73,21 @@ class sstable_set_impl {
     virtual ~sstable_set_impl() {}
     virtual std::unique_ptr<sstable_set_impl> clone() const = 0;
     virtual std::vector<shared_sstable> select(const query::partition_range& range) const = 0;
+    virtual std::vector<shared_sstable> select(const query::partition_range& range,
+            api::timestamp_type min_timestamp, api::timestamp_type max_timestamp) const {
+        auto result = select(range);
+        result.erase(std::remove_if(result.begin(), result.end(), [&] (const shared_sstable& sst) {
+            return !overlaps(sst, min_timestamp, max_timestamp);
+        }), result.end());
+        return result;
+    }
     virtual void insert(shared_sstable sst) = 0;
     virtual void erase(shared_sstable sst) = 0;
+protected:
+    static bool overlaps(const shared_sstable& sst, api::timestamp_type min_timestamp, api::timestamp_type max_timestamp) {
+        auto& stats = sst->get_stats_metadata();
+        return stats.max_timestamp >= min_timestamp && stats.min_timestamp <= max_timestamp;
+    }
 };
 
 sstable_set::sstable_set(std::unique_ptr<sstable_set_impl> impl, lw_shared_ptr<sstable_list> all)
@@ -73,9 +95,12 @@ sstable_set::sstable_set(std::unique_ptr<sstable_set_impl> impl, lw_shared_ptr<s
         , _all(std::move(all)) {
 }
 
+// The list of all sstables is shared with the copy until either of them is
+// updated, see unshare_all().
 sstable_set::sstable_set(const sstable_set& x)
         : _impl(x._impl->clone())
-        , _all(make_lw_shared(sstable_list(*x._all))) {
+        , _all(x._all)
+        , _read_starts(x._read_starts) {
 }
 
 sstable_set::sstable_set(sstable_set&&) noexcept = default;
@@ -97,8 +122,57 @@ sstable_set::select(const query::partition_range& range) const {
     return _impl->select(range);
 }
 
+std::vector<shared_sstable>
+sstable_set::select(const query::partition_range& range, api::timestamp_type min_timestamp, api::timestamp_type max_timestamp) const {
+    return _impl->select(range, min_timestamp, max_timestamp);
+}
+
+std::vector<std::pair<shared_sstable, partition_lookup>>
+sstable_set::select_for_key(const schema& s, const dht::ring_position& rp, const key& k, key_selection_stats* stats) const {
+    auto hk = utils::make_hashed_key(bytes_view(k));
+    auto candidates = _impl->select(query::partition_range(rp));
+    auto checked = candidates.size();
+    auto end = std::remove_if(candidates.begin(), candidates.end(), [&] (const shared_sstable& sst) {
+        if (auto start = read_start(sst)) {
+            if (start->tri_compare(s, rp) >= 0) {
+                return true;
+            }
+        }
+        return !sst->filter_has_key(hk);
+    });
+    candidates.erase(end, candidates.end());
+    if (stats) {
+        stats->checked += checked;
+        stats->filter_passed += candidates.size();
+    }
+
+    std::vector<std::pair<shared_sstable, partition_lookup>> result;
+    result.reserve(candidates.size());
+    for (auto i = candidates.begin(); i != candidates.end(); ++i) {
+        // Overlap loading the next summary with searching this one.
+        if (std::next(i) != candidates.end()) {
+            (*std::next(i))->prefetch_summary();
+        }
+        auto lookup = (*i)->lookup_partition(s, k, rp.token());
+        if (lookup) {
+            result.emplace_back(*i, std::move(*lookup));
+        }
+    }
+    return result;
+}
+
+// Copies the list of all sstables if anyone else, a copy of the set or a
+// holder of all(), can see it, so it isn't changed under their feet.
+void
+sstable_set::unshare_all() {
+    if (_all.use_count() > 1) {
+        _all = make_lw_shared(sstable_list(*_all));
+    }
+}
+
 void
 sstable_set::insert(shared_sstable sst) {
+    unshare_all();
     _impl->insert(sst);
     try {
         _all->insert(sst);
@@ -110,8 +184,50 @@ sstable_set::insert(shared_sstable sst) {
 
 void
 sstable_set::erase(shared_sstable sst) {
+    unshare_all();
     _impl->erase(sst);
     _all->erase(sst);
+    if (read_start(sst)) {
+        clear_read_start(sst);
+    }
+}
+
+void
+sstable_set::unshare_read_starts() {
+    if (!_read_starts) {
+        _read_starts = make_lw_shared<read_starts>();
+    } else if (_read_starts.use_count() > 1) {
+        _read_starts = make_lw_shared(read_starts(*_read_starts));
+    }
+}
+
+void
+sstable_set::set_read_start(shared_sstable sst, dht::decorated_key dk) {
+    unshare_read_starts();
+    auto i = _read_starts->find(sst);
+    if (i != _read_starts->end()) {
+        i->second = std::move(dk);
+    } else {
+        _read_starts->emplace(std::move(sst), std::move(dk));
+    }
+}
+
+void
+sstable_set::clear_read_start(shared_sstable sst) {
+    if (!_read_starts) {
+        return;
+    }
+    unshare_read_starts();
+    _read_starts->erase(sst);
+}
+
+const dht::decorated_key*
+sstable_set::read_start(const shared_sstable& sst) const {
+    if (!_read_starts) {
+        return nullptr;
+    }
+    auto i = _read_starts->find(sst);
+    return i != _read_starts->end() ? &i->second : nullptr;
 }
 
 sstable_set::~sstable_set() = default;
@@ -137,76 +253,246 @@ class bag_sstable_set : public sstable_set_impl {
 
 // specialized when sstables are partitioned in the token range space
 // e.g. leveled compaction strategy
+//
+// SSTables are kept in runs, maps of sstables with disjoint token ranges keyed
+// by their first position. An sstable goes into the first run it doesn't
+// overlap with, so each level ends up in a run and only level 0 sstables get
+// runs of their own. select() does a single lookup in every run.
+//
+// The runs are shared by all copies of the set, so copying it to publish a
+// new sstable list after a flush or a compaction is O(1). Every entry carries
+// the versions it was inserted and erased in, and every copy only sees the
+// entries which are live in its own version. Updating the newest copy adds a
+// version in place; entries erased in a version older than any copy's are
+// dropped for good. Updating an older copy makes it a private set first.
 class partitioned_sstable_set : public sstable_set_impl {
-    using value_set = std::unordered_set<shared_sstable>;
-    using interval_map_type = boost::icl::interval_map<compatible_ring_position, value_set>;
-    using interval_type = interval_map_type::interval_type;
-    using map_iterator = interval_map_type::const_iterator;
+    static constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+    struct entry {
+        shared_sstable sst;
+        compatible_ring_position last;
+        uint64_t inserted;
+        uint64_t erased = never;
+        bool live_in(uint64_t version) const {
+            return inserted <= version && version < erased;
+        }
+    };
+    using run = std::map<compatible_ring_position, entry>;
+    using run_list = std::list<run>;
+    struct shared_runs {
+        run_list runs;
+        // Newest version.
+        uint64_t version = 0;
+        // Number of copies of the set in each version.
+        std::map<uint64_t, unsigned> users;
+        // Erased entries which some copy may still see, in the order they were erased in.
+        std::deque<std::pair<run_list::iterator, run::iterator>> erased;
+    };
 private:
     schema_ptr _schema;
-    interval_map_type _sstables;
+    lw_shared_ptr<shared_runs> _shared;
+    uint64_t _version = 0;
 private:
-    interval_type make_interval(const query::partition_range& range) const {
-        return interval_type::closed(
-                compatible_ring_position(*_schema, range.start()->value()),
-                compatible_ring_position(*_schema, range.end()->value()));
+    compatible_ring_position first_of(const shared_sstable& sst) const {
+        auto first = sst->get_first_decorated_key(*_schema).token();
+        return compatible_ring_position(*_schema, dht::ring_position::starting_at(first));
+    }
+    compatible_ring_position last_of(const shared_sstable& sst) const {
+        auto last = sst->get_last_decorated_key(*_schema).token();
+        return compatible_ring_position(*_schema, dht::ring_position::ending_at(last));
+    }
+    // Both entries which are live and entries only older or newer copies see
+    // count, so that runs stay disjoint in all versions.
+    static bool run_overlaps(const run& r, const compatible_ring_position& first, const compatible_ring_position& last) {
+        auto i = r.upper_bound(first);
+        if (i != r.end() && i->first <= last) {
+            return true;
+        }
+        return i != r.begin() && std::prev(i)->second.last >= first;
+    }
+    static void place(shared_runs& sh, compatible_ring_position first, entry e) {
+        for (auto& r : sh.runs) {
+            if (!run_overlaps(r, first, e.last)) {
+                r.emplace(std::move(first), std::move(e));
+                return;
+            }
+        }
+        run r;
+        r.emplace(std::move(first), std::move(e));
+        sh.runs.push_back(std::move(r));
+    }
+    static void use(shared_runs& sh, uint64_t version) {
+        ++sh.users[version];
+    }
+    static void release(shared_runs& sh, uint64_t version) {
+        auto i = sh.users.find(version);
+        if (--i->second == 0) {
+            sh.users.erase(i);
+            purge(sh);
+        }
+    }
+    // Drops the entries no copy of the set can see anymore.
+    static void purge(shared_runs& sh) {
+        if (sh.users.empty()) {
+            return;
+        }
+        auto oldest = sh.users.begin()->first;
+        while (!sh.erased.empty() && sh.erased.front().second->second.erased <= oldest) {
+            auto r = sh.erased.front().first;
+            r->erase(sh.erased.front().second);
+            sh.erased.pop_front();
+            if (r->empty()) {
+                sh.runs.erase(r);
+            }
+        }
     }
-    interval_type singular(const dht::ring_position& rp) const {
-        auto crp = compatible_ring_position(*_schema, rp);
-        return interval_type::closed(crp, crp);
+    // Moves this copy to runs of its own, holding only what it sees.
+    void unshare() {
+        auto sh = make_lw_shared<shared_runs>();
+        sh->version = _version;
+        for (auto& r : _shared->runs) {
+            for (auto& p : r) {
+                if (p.second.live_in(_version)) {
+                    place(*sh, p.first, entry{p.second.sst, p.second.last, 0});
+                }
+            }
+        }
+        use(*sh, _version);
+        release(*_shared, _version);
+        _shared = std::move(sh);
     }
-    std::pair<map_iterator, map_iterator> query(const query::partition_range& range) const {
-        if (range.start() && range.end()) {
-            return _sstables.equal_range(make_interval(range));
+    // Applies func to the runs in a new version, which other copies of the set don't see.
+    template <typename Func>
+    void update(Func&& func) {
+        if (_version != _shared->version) {
+            unshare();
         }
-        else if (range.start() && !range.end()) {
-            auto start = singular(range.start()->value());
-            return { _sstables.lower_bound(start), _sstables.end() };
-        } else if (!range.start() && range.end()) {
-            auto end = singular(range.end()->value());
-            return { _sstables.begin(), _sstables.upper_bound(end) };
-        } else {
-            return { _sstables.begin(), _sstables.end() };
+        auto version = _shared->version + 1;
+        use(*_shared, version);
+        try {
+            func(version);
+        } catch (...) {
+            release(*_shared, version);
+            throw;
         }
+        _shared->version = version;
+        release(*_shared, std::exchange(_version, version));
     }
 public:
     explicit partitioned_sstable_set(schema_ptr schema)
-            : _schema(std::move(schema)) {
+            : _schema(std::move(schema))
+            , _shared(make_lw_shared<shared_runs>()) {
+        use(*_shared, _version);
+    }
+    partitioned_sstable_set(const partitioned_sstable_set& x)
+            : _schema(x._schema)
+            , _shared(x._shared)
+            , _version(x._version) {
+        use(*_shared, _version);
+    }
+    partitioned_sstable_set& operator=(const partitioned_sstable_set&) = delete;
+    virtual ~partitioned_sstable_set() {
+        release(*_shared, _version);
     }
     virtual std::unique_ptr<sstable_set_impl> clone() const override {
         return std::make_unique<partitioned_sstable_set>(*this);
     }
     virtual std::vector<shared_sstable> select(const query::partition_range& range) const override {
-        auto ipair = query(range);
-        auto b = std::move(ipair.first);
-        auto e = std::move(ipair.second);
-        value_set result;
-        while (b != e) {
-            boost::copy(b++->second, std::inserter(result, result.end()));
+        std::experimental::optional<compatible_ring_position> start;
+        std::experimental::optional<compatible_ring_position> end;
+        if (range.start()) {
+            start = compatible_ring_position(*_schema, range.start()->value());
+        }
+        if (range.end()) {
+            end = compatible_ring_position(*_schema, range.end()->value());
+        }
+        std::vector<shared_sstable> result;
+        for (auto& r : _shared->runs) {
+            auto i = r.begin();
+            if (start) {
+                // Entries of a run are disjoint, so only the one before the
+                // first which starts after the range start can contain it.
+                i = r.upper_bound(*start);
+                if (i != r.begin()) {
+                    --i;
+                }
+            }
+            for (; i != r.end() && (!end || i->first <= *end); ++i) {
+                auto& e = i->second;
+                if (e.live_in(_version) && (!start || e.last >= *start)) {
+                    result.push_back(e.sst);
+                }
+            }
         }
-        return std::vector<shared_sstable>(result.begin(), result.end());
+        return result;
     }
     virtual void insert(shared_sstable sst) override {
-        auto first = sst->get_first_decorated_key(*_schema).token();
-        auto last = sst->get_last_decorated_key(*_schema).token();
-        using bound = query::partition_range::bound;
-        _sstables.add({
-                make_interval(
-                        query::partition_range(
-                                bound(dht::ring_position::starting_at(first)),
-                                bound(dht::ring_position::ending_at(last)))),
-                value_set({sst})});
+        update([&] (uint64_t version) {
+            place(*_shared, first_of(sst), entry{sst, last_of(sst), version});
+        });
     }
     virtual void erase(shared_sstable sst) override {
-        auto first = sst->get_first_decorated_key(*_schema).token();
-        auto last = sst->get_last_decorated_key(*_schema).token();
-        using bound = query::partition_range::bound;
-        _sstables.subtract({
-                make_interval(
-                        query::partition_range(
-                                bound(dht::ring_position::starting_at(first)),
-                                bound(dht::ring_position::ending_at(last)))),
-                value_set({sst})});
+        auto first = first_of(sst);
+        update([&] (uint64_t version) {
+            for (auto r = _shared->runs.begin(); r != _shared->runs.end(); ++r) {
+                auto i = r->find(first);
+                if (i != r->end() && i->second.sst == sst && i->second.live_in(_version)) {
+                    _shared->erased.emplace_back(r, i);
+                    i->second.erased = version;
+                    return;
+                }
+            }
+        });
+    }
+};
+
+// sstables grouped by the time window of their max timestamp, as done by the
+// time window compaction strategy. Selecting by timestamp only visits windows
+// which can hold data newer than the lower bound.
+class time_window_sstable_set : public sstable_set_impl {
+    time_window_compaction_strategy_options _options;
+    std::map<api::timestamp_type, std::vector<shared_sstable>> _windows;
+private:
+    api::timestamp_type window_of(const shared_sstable& sst) const {
+        return _options.window_of(sst->get_stats_metadata().max_timestamp);
+    }
+public:
+    explicit time_window_sstable_set(time_window_compaction_strategy_options options)
+            : _options(std::move(options)) {
+    }
+    virtual std::unique_ptr<sstable_set_impl> clone() const override {
+        return std::make_unique<time_window_sstable_set>(*this);
+    }
+    virtual std::vector<shared_sstable> select(const query::partition_range& range) const override {
+        std::vector<shared_sstable> result;
+        for (auto& w : _windows | boost::adaptors::map_values) {
+            boost::copy(w, std::back_inserter(result));
+        }
+        return result;
+    }
+    virtual std::vector<shared_sstable> select(const query::partition_range& range,
+            api::timestamp_type min_timestamp, api::timestamp_type max_timestamp) const override {
+        std::vector<shared_sstable> result;
+        // A window holds sstables whose max timestamp falls inside it, so
+        // windows below the one of min_timestamp have nothing newer than it.
+        for (auto i = _windows.lower_bound(_options.window_of(min_timestamp)); i != _windows.end(); ++i) {
+            boost::copy(i->second | boost::adaptors::filtered([&] (const shared_sstable& sst) {
+                return overlaps(sst, min_timestamp, max_timestamp);
+            }), std::back_inserter(result));
+        }
+        return result;
+    }
+    virtual void insert(shared_sstable sst) override {
+        _windows[window_of(sst)].push_back(std::move(sst));
+    }
+    virtual void erase(shared_sstable sst) override {
+        auto i = _windows.find(window_of(sst));
+        if (i == _windows.end()) {
+            return;
+        }
+        i->second.erase(boost::find(i->second, sst));
+        if (i->second.empty()) {
+            _windows.erase(i);
+        }
     }
 };
 
@@ -243,6 +529,58 @@ class null_compaction_strategy : public compaction_strategy_impl {
     }
 };
 
+// sstables written by the same compaction, which have the same ancestors,
+// make up a run: disjoint parts of what would otherwise have been a single
+// sstable. The size-tiered and major strategies compact runs as a whole, and
+// size them by the sum of their sstables, so that the output of a compaction
+// split by compaction_fragment_size isn't taken for small sstables to compact
+// again.
+class sstable_runs {
+    // Runs by their first sstable, which stands for the run.
+    std::unordered_map<shared_sstable, std::vector<shared_sstable>> _runs;
+    std::vector<shared_sstable> _representatives;
+public:
+    // If group is false, every sstable is a run of its own.
+    explicit sstable_runs(const std::vector<shared_sstable>& sstables, bool group = true) {
+        std::map<std::vector<uint32_t>, shared_sstable> by_ancestors;
+        for (auto& sst : sstables) {
+            auto representative = sst;
+            auto ancestors = group ? sst->ancestors() : std::vector<uint32_t>();
+            if (!ancestors.empty()) {
+                representative = by_ancestors.emplace(std::move(ancestors), sst).first->second;
+            }
+            auto& run = _runs[representative];
+            if (run.empty()) {
+                _representatives.push_back(representative);
+            }
+            run.push_back(sst);
+        }
+    }
+
+    // The first sstable of each run.
+    const std::vector<shared_sstable>& representatives() const {
+        return _representatives;
+    }
+
+    uint64_t data_size(const shared_sstable& representative) const {
+        uint64_t size = 0;
+        for (auto& sst : _runs.at(representative)) {
+            size += sst->data_size();
+        }
+        return size;
+    }
+
+    // All sstables of the runs of the given representatives.
+    std::vector<shared_sstable> expand(const std::vector<shared_sstable>& representatives) const {
+        std::vector<shared_sstable> ret;
+        for (auto& r : representatives) {
+            auto& run = _runs.at(r);
+            ret.insert(ret.end(), run.begin(), run.end());
+        }
+        return ret;
+    }
+};
+
 //
 // Major compaction strategy is about compacting all available sstables into one.
 //
@@ -250,15 +588,17 @@ class major_compaction_strategy : public compaction_strategy_impl {
     static constexpr size_t min_compact_threshold = 2;
 public:
     virtual compaction_descriptor get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) override {
-        // At least, two sstables must be available for compaction to take place.
-        if (cfs.sstables_count() < min_compact_threshold) {
+        // At least, two runs must be available for compaction to take place.
+        if (sstable_runs(candidates).representatives().size() < min_compact_threshold) {
             return sstables::compaction_descriptor();
         }
-        return sstables::compaction_descriptor(std::move(candidates));
+        return sstables::compaction_descriptor(std::move(candidates), 0, cfs.compaction_fragment_size());
     }
 
     virtual int64_t estimated_pending_compactions(column_family& cf) const override {
-        return (cf.sstables_count() < min_compact_threshold) ? 0 : 1;
+        auto all = cf.get_sstables();
+        std::vector<sstables::shared_sstable> sstables(all->begin(), all->end());
+        return (sstable_runs(sstables).representatives().size() < min_compact_threshold) ? 0 : 1;
     }
 
     virtual compaction_strategy_type type() const {
@@ -360,23 +700,26 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
     size_tiered_compaction_strategy_options _options;
 
     // Return a list of pair of shared_sstable and its respective size.
-    std::vector<std::pair<sstables::shared_sstable, uint64_t>> create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables) const;
+    // sstables are representatives of runs, sized as their whole run.
+    std::vector<std::pair<sstables::shared_sstable, uint64_t>> create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables,
+            const sstable_runs& runs) const;
 
     // Group files of similar size into buckets.
-    std::vector<std::vector<sstables::shared_sstable>> get_buckets(const std::vector<sstables::shared_sstable>& sstables, unsigned max_threshold) const;
+    std::vector<std::vector<sstables::shared_sstable>> get_buckets(const std::vector<sstables::shared_sstable>& sstables,
+            const sstable_runs& runs, unsigned max_threshold) const;
 
     // Maybe return a bucket of sstables to compact
     std::vector<sstables::shared_sstable>
-    most_interesting_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets, unsigned min_threshold, unsigned max_threshold);
+    most_interesting_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets, const sstable_runs& runs, unsigned min_threshold, unsigned max_threshold);
 
     // Return the average size of a given list of sstables.
-    uint64_t avg_size(std::vector<sstables::shared_sstable>& sstables) {
+    uint64_t avg_size(std::vector<sstables::shared_sstable>& sstables, const sstable_runs& runs) {
         assert(sstables.size() > 0); // this should never fail
         uint64_t n = 0;
 
         for (auto& sstable : sstables) {
             // FIXME: Switch to sstable->bytes_on_disk() afterwards. That's what C* uses.
-            n += sstable->data_size();
+            n += runs.data_size(sstable);
         }
 
         return n / sstables.size();
@@ -399,13 +742,14 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
 };
 
 std::vector<std::pair<sstables::shared_sstable, uint64_t>>
-size_tiered_compaction_strategy::create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables) const {
+size_tiered_compaction_strategy::create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables,
+        const sstable_runs& runs) const {
 
     std::vector<std::pair<sstables::shared_sstable, uint64_t>> sstable_length_pairs;
     sstable_length_pairs.reserve(sstables.size());
 
     for(auto& sstable : sstables) {
-        auto sstable_size = sstable->data_size();
+        auto sstable_size = runs.data_size(sstable);
         assert(sstable_size != 0);
 
         sstable_length_pairs.emplace_back(sstable, sstable_size);
@@ -415,9 +759,10 @@ size_tiered_compaction_strategy::create_sstable_and_length_pairs(const std::vect
 }
 
 std::vector<std::vector<sstables::shared_sstable>>
-size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_sstable>& sstables, unsigned max_threshold) const {
+size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_sstable>& sstables,
+        const sstable_runs& runs, unsigned max_threshold) const {
     // sstables sorted by size of its data file.
-    auto sorted_sstables = create_sstable_and_length_pairs(sstables);
+    auto sorted_sstables = create_sstable_and_length_pairs(sstables, runs);
 
     std::sort(sorted_sstables.begin(), sorted_sstables.end(), [] (auto& i, auto& j) {
         return i.second < j.second;
@@ -473,7 +818,7 @@ size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_
 
 std::vector<sstables::shared_sstable>
 size_tiered_compaction_strategy::most_interesting_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets,
-        unsigned min_threshold, unsigned max_threshold)
+        const sstable_runs& runs, unsigned min_threshold, unsigned max_threshold)
 {
     std::vector<std::pair<std::vector<sstables::shared_sstable>, uint64_t>> pruned_buckets_and_hotness;
     pruned_buckets_and_hotness.reserve(buckets.size());
@@ -485,7 +830,7 @@ size_tiered_compaction_strategy::most_interesting_bucket(std::vector<std::vector
         // by converting SizeTieredCompactionStrategy::trimToThresholdWithHotness.
         // By the time being, we will only compact buckets that meet the threshold.
         if (bucket.size() >= min_threshold && bucket.size() <= max_threshold) {
-            auto avg = avg_size(bucket);
+            auto avg = avg_size(bucket, runs);
             pruned_buckets_and_hotness.push_back({ std::move(bucket), avg });
         }
     }
@@ -505,22 +850,40 @@ size_tiered_compaction_strategy::most_interesting_bucket(std::vector<std::vector
     return hottest;
 }
 
+// Fully expired sstables, which don't shadow data in any other sstable, can
+// be dropped without being read or rewritten. Strategies which don't look for
+// them on their own ask for that before anything else.
+static compaction_descriptor fully_expired_sstables_descriptor(column_family& cf, std::vector<sstables::shared_sstable>& candidates) {
+    auto gc_before = gc_clock::now() - cf.schema()->gc_grace_seconds();
+    auto expired = get_fully_expired_sstables(cf, candidates, gc_before.time_since_epoch().count());
+    if (!expired.empty()) {
+        logger.debug("Compacting {} fully expired sstables of {}.{}", expired.size(), cf.schema()->ks_name(), cf.schema()->cf_name());
+    }
+    return compaction_descriptor(std::move(expired));
+}
+
 compaction_descriptor size_tiered_compaction_strategy::get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) {
     // make local copies so they can't be changed out from under us mid-method
     int min_threshold = cfs.schema()->min_compaction_threshold();
     int max_threshold = cfs.schema()->max_compaction_threshold();
 
+    auto expired = fully_expired_sstables_descriptor(cfs, candidates);
+    if (!expired.sstables.empty()) {
+        return expired;
+    }
+
     // TODO: Add support to filter cold sstables (for reference: SizeTieredCompactionStrategy::filterColdSSTables).
 
-    auto buckets = get_buckets(candidates, max_threshold);
+    sstable_runs runs(candidates);
+    auto buckets = get_buckets(runs.representatives(), runs, max_threshold);
 
-    std::vector<sstables::shared_sstable> most_interesting = most_interesting_bucket(std::move(buckets), min_threshold, max_threshold);
+    std::vector<sstables::shared_sstable> most_interesting = most_interesting_bucket(std::move(buckets), runs, min_threshold, max_threshold);
     if (most_interesting.empty()) {
         // nothing to do
         return sstables::compaction_descriptor();
     }
 
-    return sstables::compaction_descriptor(std::move(most_interesting));
+    return sstables::compaction_descriptor(runs.expand(most_interesting), 0, cfs.compaction_fragment_size());
 }
 
 int64_t size_tiered_compaction_strategy::estimated_pending_compactions(column_family& cf) const {
@@ -534,7 +897,8 @@ int64_t size_tiered_compaction_strategy::estimated_pending_compactions(column_fa
         sstables.push_back(entry);
     }
 
-    for (auto& bucket : get_buckets(sstables, max_threshold)) {
+    sstable_runs runs(sstables);
+    for (auto& bucket : get_buckets(runs.representatives(), runs, max_threshold)) {
         if (bucket.size() >= size_t(min_threshold)) {
             n += std::ceil(double(bucket.size()) / max_threshold);
         }
@@ -551,9 +915,11 @@ std::vector<sstables::shared_sstable> size_tiered_most_interesting_bucket(lw_sha
         sstables.push_back(entry);
     }
 
-    auto buckets = cs.get_buckets(sstables, DEFAULT_MAX_COMPACTION_THRESHOLD);
+    // Callers split their outputs by their own criteria, if at all, so every sstable is a run of its own.
+    sstable_runs runs(sstables, false);
+    auto buckets = cs.get_buckets(sstables, runs, DEFAULT_MAX_COMPACTION_THRESHOLD);
 
-    std::vector<sstables::shared_sstable> most_interesting = cs.most_interesting_bucket(std::move(buckets),
+    std::vector<sstables::shared_sstable> most_interesting = cs.most_interesting_bucket(std::move(buckets), runs,
         DEFAULT_MIN_COMPACTION_THRESHOLD, DEFAULT_MAX_COMPACTION_THRESHOLD);
 
     return most_interesting;
@@ -565,9 +931,11 @@ size_tiered_most_interesting_bucket(const std::list<sstables::shared_sstable>& c
 
     std::vector<sstables::shared_sstable> sstables(candidates.begin(), candidates.end());
 
-    auto buckets = cs.get_buckets(sstables, DEFAULT_MAX_COMPACTION_THRESHOLD);
+    // Callers split their outputs by their own criteria, if at all, so every sstable is a run of its own.
+    sstable_runs runs(sstables, false);
+    auto buckets = cs.get_buckets(sstables, runs, DEFAULT_MAX_COMPACTION_THRESHOLD);
 
-    std::vector<sstables::shared_sstable> most_interesting = cs.most_interesting_bucket(std::move(buckets),
+    std::vector<sstables::shared_sstable> most_interesting = cs.most_interesting_bucket(std::move(buckets), runs,
         DEFAULT_MIN_COMPACTION_THRESHOLD, DEFAULT_MAX_COMPACTION_THRESHOLD);
 
     return most_interesting;
@@ -597,8 +965,10 @@ class leveled_compaction_strategy : public compaction_strategy_impl {
 
     virtual int64_t estimated_pending_compactions(column_family& cf) const override;
 
+    // The manifest keeps parallel compactions from overlapping in the level
+    // they write to.
     virtual bool parallel_compaction() const override {
-        return false;
+        return true;
     }
 
     virtual compaction_strategy_type type() const {
@@ -615,7 +985,19 @@ compaction_descriptor leveled_compaction_strategy::get_sstables_for_compaction(c
     // lists managed by the manifest may become outdated. For example, one
     // sstable in it may be marked for deletion after compacted.
     // Currently, we create a new manifest whenever it's time for compaction.
-    leveled_manifest manifest = leveled_manifest::create(cfs, candidates, _max_sstable_size_in_mb);
+    auto expired = fully_expired_sstables_descriptor(cfs, candidates);
+    if (!expired.sstables.empty()) {
+        return expired;
+    }
+    // Candidates are all sstables but those being compacted.
+    std::unordered_set<sstables::shared_sstable> uncompacting(candidates.begin(), candidates.end());
+    std::vector<sstables::shared_sstable> compacting;
+    for (auto& sst : *cfs.get_sstables()) {
+        if (!uncompacting.count(sst)) {
+            compacting.push_back(sst);
+        }
+    }
+    leveled_manifest manifest = leveled_manifest::create(cfs, candidates, _max_sstable_size_in_mb, std::move(compacting));
     auto candidate = manifest.get_compaction_candidates();
 
     if (candidate.sstables.empty()) {
@@ -663,6 +1045,36 @@ class date_tiered_compaction_strategy : public compaction_strategy_impl {
     }
 };
 
+class time_window_compaction_strategy : public compaction_strategy_impl {
+    time_window_manifest _manifest;
+public:
+    time_window_compaction_strategy(const std::map<sstring, sstring>& options)
+        : _manifest(options)
+        {}
+
+    virtual compaction_descriptor get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) override {
+        auto gc_before = gc_clock::now() - cfs.schema()->gc_grace_seconds();
+        auto sstables = _manifest.get_next_sstables(cfs, candidates, gc_before);
+        logger.debug("timewindow: Compacting {} out of {} sstables", sstables.size(), candidates.size());
+        if (sstables.empty()) {
+            return sstables::compaction_descriptor();
+        }
+        return sstables::compaction_descriptor(std::move(sstables));
+    }
+
+    virtual int64_t estimated_pending_compactions(column_family& cf) const override {
+        return _manifest.get_estimated_tasks(cf);
+    }
+
+    virtual compaction_strategy_type type() const {
+        return compaction_strategy_type::time_window;
+    }
+
+    virtual std::unique_ptr<sstable_set_impl> make_sstable_set(schema_ptr schema) const override {
+        return std::make_unique<time_window_sstable_set>(_manifest.options());
+    }
+};
+
 compaction_strategy::compaction_strategy(::shared_ptr<compaction_strategy_impl> impl)
     : _compaction_strategy_impl(std::move(impl)) {}
 compaction_strategy::compaction_strategy() = default;
@@ -676,7 +1088,21 @@ compaction_strategy_type compaction_strategy::type() const {
 }
 
 compaction_descriptor compaction_strategy::get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) {
-    return _compaction_strategy_impl->get_sstables_for_compaction(cfs, std::move(candidates));
+    // Repaired and unrepaired sstables are compacted separately, so that
+    // incremental repair doesn't have to look at repaired data again.
+    auto repaired = std::stable_partition(candidates.begin(), candidates.end(), [] (const sstables::shared_sstable& sst) {
+        return !sst->is_repaired();
+    });
+    if (repaired == candidates.begin() || repaired == candidates.end()) {
+        return _compaction_strategy_impl->get_sstables_for_compaction(cfs, std::move(candidates));
+    }
+    std::vector<sstables::shared_sstable> repaired_candidates(repaired, candidates.end());
+    candidates.erase(repaired, candidates.end());
+    auto descriptor = _compaction_strategy_impl->get_sstables_for_compaction(cfs, std::move(candidates));
+    if (!descriptor.sstables.empty()) {
+        return descriptor;
+    }
+    return _compaction_strategy_impl->get_sstables_for_compaction(cfs, std::move(repaired_candidates));
 }
 
 bool compaction_strategy::parallel_compaction() const {
@@ -713,6 +1139,9 @@ compaction_strategy make_compaction_strategy(compaction_strategy_type strategy,
     case compaction_strategy_type::date_tiered:
         impl = make_shared<date_tiered_compaction_strategy>(date_tiered_compaction_strategy(options));
         break;
+    case compaction_strategy_type::time_window:
+        impl = make_shared<time_window_compaction_strategy>(time_window_compaction_strategy(options));
+        break;
     default:
         throw std::runtime_error("strategy not supported");
     }
@@ -27,10 +27,13 @@
 #include <seastar/core/fstream.hh>
 
 #include "compress.hh"
+#include "chunk_cache.hh"
+#include "adaptive_input_stream.hh"
 
 #include <lz4.h>
 #include <zlib.h>
 #include <snappy-c.h>
+#include <zdict.h>
 
 #include "unimplemented.hh"
 
@@ -46,6 +49,8 @@ void compression::update(uint64_t compressed_file_length) {
          _uncompress = uncompress_snappy;
      } else if (name.value == "DeflateCompressor") {
          _uncompress = uncompress_deflate;
+     } else if (name.value == "ZstdCompressor") {
+         _zstd = true;
      } else {
          throw std::runtime_error("unsupported compression type");
      }
@@ -66,11 +71,20 @@ void compression::set_compressor(compressor c) {
          _compress = compress_deflate;
          _compress_max_size = compress_max_size_deflate;
          name.value = "DeflateCompressor";
+     } else if (c == compressor::zstd) {
+         _zstd = true;
+         _compress_max_size = compress_max_size_zstd;
+         name.value = "ZstdCompressor";
      } else {
          throw std::runtime_error("unsupported compressor type");
      }
 }
 
+void compression::set_compression_level(int level) {
+    _zstd_level = level;
+    options.elements.push_back({"compression_level", to_sstring(level)});
+}
+
 compression::chunk_and_offset
 compression::locate(uint64_t position) const {
     auto ucl = uncompressed_chunk_length();
@@ -83,6 +97,50 @@ compression::locate(uint64_t position) const {
     return { chunk_start, chunk_end - chunk_start, chunk_offset };
 }
 
+zstd_dictionary::zstd_dictionary(bytes data)
+    : _data(std::move(data))
+    , _ddict(ZSTD_createDDict(_data.data(), _data.size()))
+{
+    if (!_ddict) {
+        throw std::bad_alloc();
+    }
+}
+
+zstd_dictionary::~zstd_dictionary() {
+    ZSTD_freeDDict(_ddict);
+    ZSTD_freeCDict(_cdict);
+}
+
+const ZSTD_CDict* zstd_dictionary::cdict(int level) const {
+    if (!_cdict || _cdict_level != level) {
+        auto cdict = ZSTD_createCDict(_data.data(), _data.size(), level);
+        if (!cdict) {
+            throw std::bad_alloc();
+        }
+        ZSTD_freeCDict(_cdict);
+        _cdict = cdict;
+        _cdict_level = level;
+    }
+    return _cdict;
+}
+
+bytes train_zstd_dictionary(const std::vector<temporary_buffer<char>>& chunks, size_t dictionary_size) {
+    std::vector<char> samples;
+    std::vector<size_t> sample_sizes;
+    sample_sizes.reserve(chunks.size());
+    for (auto&& c : chunks) {
+        samples.insert(samples.end(), c.get(), c.get() + c.size());
+        sample_sizes.push_back(c.size());
+    }
+    bytes dict(bytes::initialized_later(), dictionary_size);
+    auto size = ZDICT_trainFromBuffer(dict.begin(), dict.size(), samples.data(), sample_sizes.data(), sample_sizes.size());
+    if (ZDICT_isError(size)) {
+        return bytes();
+    }
+    dict.resize(size);
+    return dict;
+}
+
 }
 
 size_t uncompress_lz4(const char* input, size_t input_len,
@@ -220,15 +278,68 @@ size_t compress_max_size_snappy(size_t input_len) {
 }
 
 class compressed_file_data_source_impl : public data_source_impl {
+    file _file;
+    sstables::adaptive_read_options _options;
     stdx::optional<input_stream<char>> _input_stream;
     sstables::compression* _compression_metadata;
+    uint64_t _cache_owner;
+    lw_shared_ptr<sstables::table_read_sizes> _read_sizes;
+    uint64_t _bytes_decompressed = 0;
     uint64_t _pos;
     uint64_t _beg_pos;
     uint64_t _end_pos;
+    uint64_t _stream_end;
+private:
+    // Opens the stream at the first chunk which has to be read from disk,
+    // so that reads served entirely from the chunk cache don't do any I/O.
+    // The first read covers at least that whole chunk.
+    void open_stream(uint64_t chunk_start, uint64_t chunk_len) {
+        _options.initial_buffer_size = std::max<size_t>(_options.initial_buffer_size,
+                align_up(chunk_start % 4096 + chunk_len, uint64_t(4096)));
+        _options.max_buffer_size = std::max(_options.max_buffer_size, _options.initial_buffer_size);
+        _input_stream = sstables::make_adaptive_file_input_stream(std::move(_file),
+                chunk_start,
+                _stream_end - chunk_start,
+                std::move(_options));
+    }
+    temporary_buffer<char> uncompress_chunk(temporary_buffer<char> buf, uint64_t chunk_len) {
+        // The last 4 bytes of the chunk are the adler32 checksum
+        // of the rest of the (compressed) chunk.
+        auto compressed_len = chunk_len - 4;
+        // FIXME: Do not always calculate checksum - Cassandra has a
+        // probability (defaulting to 1.0, but still...)
+        auto checksum = read_be<uint32_t>(buf.get() + compressed_len);
+        if (checksum != checksum_adler32(buf.get(), compressed_len)) {
+            throw std::runtime_error("compressed chunk failed checksum");
+        }
+
+        // We know that the uncompressed data will take exactly
+        // chunk_length bytes (or less, if reading the last chunk).
+        temporary_buffer<char> out(
+                _compression_metadata->uncompressed_chunk_length());
+        // The compressed data is the whole chunk, minus the last 4
+        // bytes (which contain the checksum verified above).
+        auto len = _compression_metadata->uncompress(
+                buf.get(), compressed_len,
+                out.get_write(), out.size());
+        out.trim(len);
+        _bytes_decompressed += len;
+        return out;
+    }
+    temporary_buffer<char> consume_chunk(temporary_buffer<char> out, unsigned offset) {
+        out.trim_front(offset);
+        _pos += out.size();
+        return out;
+    }
 public:
     compressed_file_data_source_impl(file f, sstables::compression* cm,
-                uint64_t pos, size_t len, file_input_stream_options options)
-            : _compression_metadata(cm)
+                uint64_t pos, size_t len, sstables::adaptive_read_options options, uint64_t cache_owner,
+                lw_shared_ptr<sstables::table_read_sizes> read_sizes)
+            : _file(std::move(f))
+            , _options(std::move(options))
+            , _compression_metadata(cm)
+            , _cache_owner(cache_owner)
+            , _read_sizes(std::move(read_sizes))
     {
         _beg_pos = pos;
         if (pos > _compression_metadata->data_len) {
@@ -237,6 +348,7 @@ class compressed_file_data_source_impl : public data_source_impl {
         if (len == 0 || pos == _compression_metadata->data_len) {
             // Nothing to read
             _end_pos = _pos = _beg_pos;
+            _stream_end = 0;
             return;
         }
         if (len <= _compression_metadata->data_len - pos) {
@@ -245,15 +357,21 @@ class compressed_file_data_source_impl : public data_source_impl {
             _end_pos = _compression_metadata->data_len;
         }
         // _beg_pos and _end_pos specify positions in the compressed stream.
-        // We need to translate them into a range of uncompressed chunks,
-        // and open a file_input_stream to read that range.
-        auto start = _compression_metadata->locate(_beg_pos);
+        // We need to translate them into a range of uncompressed chunks.
+        // The file_input_stream for that range is opened on first read
+        // from disk.
         auto end = _compression_metadata->locate(_end_pos - 1);
-        _input_stream = make_file_input_stream(std::move(f),
-                start.chunk_start,
-                end.chunk_start + end.chunk_len - start.chunk_start,
-                std::move(options));
+        _stream_end = end.chunk_start + end.chunk_len;
         _pos = _beg_pos;
+        if (!_cache_owner || !sstables::global_chunk_cache().enabled()) {
+            auto beg = _compression_metadata->locate(_beg_pos);
+            open_stream(beg.chunk_start, beg.chunk_len);
+        }
+    }
+    ~compressed_file_data_source_impl() {
+        if (_read_sizes) {
+            _read_sizes->add_read(std::min(_pos, _end_pos) - _beg_pos, _bytes_decompressed);
+        }
     }
     virtual future<temporary_buffer<char>> get() override {
         if (_pos >= _end_pos) {
@@ -265,31 +383,31 @@ class compressed_file_data_source_impl : public data_source_impl {
         if (_pos != _beg_pos && addr.offset != 0) {
             throw std::runtime_error("compressed reader out of sync");
         }
+        auto chunk = _pos / _compression_metadata->uncompressed_chunk_length();
+        stdx::optional<temporary_buffer<char>> cached;
+        if (_cache_owner) {
+            cached = sstables::global_chunk_cache().lookup(_cache_owner, chunk);
+        }
+        if (cached) {
+            if (!_input_stream) {
+                return make_ready_future<temporary_buffer<char>>(consume_chunk(std::move(*cached), addr.offset));
+            }
+            // The stream is sequential, and its read-ahead has likely
+            // read the chunk already, so just drop it.
+            return _input_stream->read_exactly(addr.chunk_len).then([this, addr, cached = std::move(*cached)] (auto) mutable {
+                return consume_chunk(std::move(cached), addr.offset);
+            });
+        }
+        if (!_input_stream) {
+            open_stream(addr.chunk_start, addr.chunk_len);
+        }
         return _input_stream->read_exactly(addr.chunk_len).
-            then([this, addr](temporary_buffer<char> buf) {
-                // The last 4 bytes of the chunk are the adler32 checksum
-                // of the rest of the (compressed) chunk.
-                auto compressed_len = addr.chunk_len - 4;
-                // FIXME: Do not always calculate checksum - Cassandra has a
-                // probability (defaulting to 1.0, but still...)
-                auto checksum = read_be<uint32_t>(buf.get() + compressed_len);
-                if (checksum != checksum_adler32(buf.get(), compressed_len)) {
-                    throw std::runtime_error("compressed chunk failed checksum");
+            then([this, addr, chunk](temporary_buffer<char> buf) {
+                auto out = uncompress_chunk(std::move(buf), addr.chunk_len);
+                if (_cache_owner) {
+                    sstables::global_chunk_cache().insert(_cache_owner, chunk, out);
                 }
-
-                // We know that the uncompressed data will take exactly
-                // chunk_length bytes (or less, if reading the last chunk).
-                temporary_buffer<char> out(
-                        _compression_metadata->uncompressed_chunk_length());
-                // The compressed data is the whole chunk, minus the last 4
-                // bytes (which contain the checksum verified above).
-                auto len = _compression_metadata->uncompress(
-                        buf.get(), compressed_len,
-                        out.get_write(), out.size());
-                out.trim(len);
-                out.trim_front(addr.offset);
-                _pos += out.size();
-                return out;
+                return consume_chunk(std::move(out), addr.offset);
         });
     }
 
@@ -304,16 +422,55 @@ class compressed_file_data_source_impl : public data_source_impl {
 class compressed_file_data_source : public data_source {
 public:
     compressed_file_data_source(file f, sstables::compression* cm,
-            uint64_t offset, size_t len, file_input_stream_options options)
+            uint64_t offset, size_t len, sstables::adaptive_read_options options, uint64_t cache_owner,
+            lw_shared_ptr<sstables::table_read_sizes> read_sizes)
         : data_source(std::make_unique<compressed_file_data_source_impl>(
-                std::move(f), cm, offset, len, std::move(options)))
+                std::move(f), cm, offset, len, std::move(options), cache_owner, std::move(read_sizes)))
         {}
 };
 
 input_stream<char> make_compressed_file_input_stream(
         file f, sstables::compression* cm, uint64_t offset, size_t len,
-        file_input_stream_options options)
+        sstables::adaptive_read_options options, uint64_t cache_owner,
+        lw_shared_ptr<sstables::table_read_sizes> read_sizes)
 {
     return input_stream<char>(compressed_file_data_source(
-            std::move(f), cm, offset, len, std::move(options)));
+            std::move(f), cm, offset, len, std::move(options), cache_owner, std::move(read_sizes)));
+}
+
+// Reused by all compressions and decompressions of the shard.
+static ZSTD_CCtx* zstd_cctx() {
+    static thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return ctx.get();
+}
+
+static ZSTD_DCtx* zstd_dctx() {
+    static thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return ctx.get();
+}
+
+size_t uncompress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len, const sstables::zstd_dictionary* dict) {
+    auto ret = dict
+            ? ZSTD_decompress_usingDDict(zstd_dctx(), output, output_len, input, input_len, dict->ddict())
+            : ZSTD_decompressDCtx(zstd_dctx(), output, output_len, input, input_len);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd uncompression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len, int level, const sstables::zstd_dictionary* dict) {
+    auto ret = dict
+            ? ZSTD_compress_usingCDict(zstd_cctx(), output, output_len, input, input_len, dict->cdict(level))
+            : ZSTD_compressCCtx(zstd_cctx(), output, output_len, input, input_len, level);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd compression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_max_size_zstd(size_t input_len) {
+    return ZSTD_compressBound(input_len);
 }
@@ -37,6 +37,11 @@
 // LZ4, Snappy, and Deflate - the default (and therefore most important) is
 // LZ4. Each compressor is an implementation of the "compressor" class.
 //
+// We also support zstd, optionally with a dictionary trained on the first
+// chunks written to the sstable and stored in its CompressionDictionary
+// component. The dictionary lets small chunks, which are cheap to read at
+// random, compress nearly as well as large ones.
+//
 // Each compressed chunk is followed by a 4-byte checksum of the compressed
 // data, using the Adler32 algorithm. In Cassandra, there is a parameter
 // "crc_check_chance" (defaulting to 1.0) which determines the probability
@@ -49,11 +54,14 @@
 #include <vector>
 #include <cstdint>
 #include <zlib.h>
+#include <zstd.h>
 
 #include "core/file.hh"
 #include "core/reactor.hh"
 #include "core/shared_ptr.hh"
 #include "types.hh"
+#include "adaptive_input_stream.hh"
+#include "read_sizes.hh"
 #include "../compress.hh"
 
 // An "uncompress_func" is a function which uncompresses the given compressed
@@ -81,6 +89,39 @@ typedef size_t compress_max_size_func(size_t input_len);
 compress_max_size_func compress_max_size_lz4;
 compress_max_size_func compress_max_size_snappy;
 compress_max_size_func compress_max_size_deflate;
+compress_max_size_func compress_max_size_zstd;
+
+namespace sstables {
+
+// A zstd dictionary, in its serialized form and digested for use by zstd.
+class zstd_dictionary {
+    bytes _data;
+    ZSTD_DDict* _ddict;
+    mutable ZSTD_CDict* _cdict = nullptr;
+    mutable int _cdict_level = 0;
+public:
+    explicit zstd_dictionary(bytes data);
+    zstd_dictionary(const zstd_dictionary&) = delete;
+    ~zstd_dictionary();
+    const bytes& data() const { return _data; }
+    const ZSTD_DDict* ddict() const { return _ddict; }
+    // Digested for compression at given level on first use, since only
+    // writers need it.
+    const ZSTD_CDict* cdict(int level) const;
+};
+
+// Trains a dictionary of at most dictionary_size bytes on given chunks.
+// Returns an empty one if there isn't enough data to train on.
+bytes train_zstd_dictionary(const std::vector<temporary_buffer<char>>& chunks, size_t dictionary_size);
+
+}
+
+// Like uncompress_func and compress_func, but also take the dictionary to
+// use, which may be null.
+size_t uncompress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len, const sstables::zstd_dictionary* dict);
+size_t compress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len, int level, const sstables::zstd_dictionary* dict);
 
 inline uint32_t init_checksum_adler32() {
     return adler32(0, Z_NULL, 0);
@@ -123,14 +164,35 @@ struct compression {
     // Variables *not* found in the "Compression Info" file (added by update()):
     uint64_t _compressed_file_length = 0;
     uint32_t _full_checksum;
+    // zstd is called directly instead of through the pointers above, to pass
+    // it the level and the dictionary.
+    bool _zstd = false;
+    int _zstd_level = compression_parameters::DEFAULT_ZSTD_COMPRESSION_LEVEL;
+    // Size of the dictionary to train when writing, 0 for none.
+    uint32_t _zstd_dictionary_size = 0;
+    lw_shared_ptr<const zstd_dictionary> _zstd_dictionary;
 public:
     // Set the compressor algorithm, please check the definition of enum compressor.
     void set_compressor(compressor c);
+    // zstd only.
+    void set_compression_level(int level);
+    void set_dictionary_size(uint32_t size) {
+        _zstd_dictionary_size = size;
+    }
+    uint32_t dictionary_size() const {
+        return _zstd_dictionary_size;
+    }
+    void set_dictionary(lw_shared_ptr<const zstd_dictionary> dict) {
+        _zstd_dictionary = std::move(dict);
+    }
+    const zstd_dictionary* dictionary() const {
+        return _zstd_dictionary.get();
+    }
     // After changing _compression, update() must be called to update
     // additional variables depending on it.
     void update(uint64_t compressed_file_length);
     operator bool() const {
-        return _uncompress != nullptr;
+        return _uncompress != nullptr || _zstd;
     }
     // locate() locates in the compressed file the given byte position of
     // the uncompressed data:
@@ -174,6 +236,9 @@ struct compression {
     size_t uncompress(
             const char* input, size_t input_len,
             char* output, size_t output_len) const {
+        if (_zstd) {
+            return uncompress_zstd(input, input_len, output, output_len, _zstd_dictionary.get());
+        }
         if (!_uncompress) {
             throw std::runtime_error("uncompress is not supported");
         }
@@ -182,6 +247,9 @@ struct compression {
     size_t compress(
             const char* input, size_t input_len,
             char* output, size_t output_len) const {
+        if (_zstd) {
+            return compress_zstd(input, input_len, output, output_len, _zstd_level, _zstd_dictionary.get());
+        }
         if (!_compress) {
             throw std::runtime_error("compress is not supported");
         }
@@ -201,5 +269,10 @@ struct compression {
 // are open streams on it. This should happen naturally on a higher level -
 // as long as we have *sstables* work in progress, we need to keep the whole
 // sstable alive, and the compression metadata is only a part of it.
+//
+// Decompressed chunks are looked up in and added to the shard's chunk_cache
+// under cache_owner, unless it is 0. If read_sizes is set, the read is
+// accounted there when the stream goes away.
 input_stream<char> make_compressed_file_input_stream(
-        file f, sstables::compression *cm, uint64_t offset, size_t len, class file_input_stream_options options);
+        file f, sstables::compression *cm, uint64_t offset, size_t len, sstables::adaptive_read_options options,
+        uint64_t cache_owner = 0, lw_shared_ptr<sstables::table_read_sizes> read_sizes = {});
@@ -207,6 +207,28 @@ struct estimated_histogram {
 
     friend estimated_histogram merge(estimated_histogram a, const estimated_histogram& b);
 
+    /**
+     * @param percentile between 0 and 1
+     * @return estimated value at given percentile. If the histogram overflowed
+     * at that percentile, returns INT64_MAX.
+     */
+    int64_t percentile(double percentile) const {
+        assert(percentile >= 0 && percentile <= 1.0);
+        auto last_bucket = buckets.size() - 1;
+        int64_t pcount = std::floor(count() * percentile);
+        if (pcount == 0) {
+            return 0;
+        }
+        int64_t elements = 0;
+        for (size_t i = 0; i < last_bucket; i++) {
+            elements += buckets[i];
+            if (elements >= pcount) {
+                return bucket_offsets[i];
+            }
+        }
+        return INT64_MAX;
+    }
+
     // FIXME: convert Java code below.
 #if 0
     /**
@@ -267,31 +289,6 @@ struct estimated_histogram {
         return 0;
     }
 
-    /**
-     * @param percentile
-     * @return estimated value at given percentile
-     */
-    public long percentile(double percentile)
-    {
-        assert percentile >= 0 && percentile <= 1.0;
-        int lastBucket = buckets.length() - 1;
-        if (buckets.get(lastBucket) > 0)
-            throw new IllegalStateException("Unable to compute when histogram overflowed");
-
-        long pcount = (long) Math.floor(count() * percentile);
-        if (pcount == 0)
-            return 0;
-
-        long elements = 0;
-        for (int i = 0; i < lastBucket; i++)
-        {
-            elements += buckets.get(i);
-            if (elements >= pcount)
-                return bucketOffsets[i];
-        }
-        return 0;
-    }
-
 #endif
 
     /**
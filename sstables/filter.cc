@@ -35,7 +35,7 @@ namespace sstables {
 
 future<> sstable::read_filter(const io_priority_class& pc) {
     if (!has_component(sstable::component_type::Filter)) {
-        _filter = std::make_unique<utils::filter::always_present_filter>();
+        _filter.set(std::make_unique<utils::filter::always_present_filter>(), false);
         return make_ready_future<>();
     }
 
@@ -43,12 +43,24 @@ future<> sstable::read_filter(const io_priority_class& pc) {
         return this->read_simple<sstable::component_type::Filter>(filter, pc).then([this, &filter] {
             large_bitset bs(filter.buckets.elements.size() * 64);
             bs.load(filter.buckets.elements.begin(), filter.buckets.elements.end());
-            _filter = utils::filter::create_filter(filter.hashes, std::move(bs));
-        }).then([this] {
-            return io_check([&] {
-                return engine().file_size(this->filename(sstable::component_type::Filter));
-            });
+            if (filter.hashes & sstables::filter::blocked_layout_flag) {
+                auto hashes = filter.hashes & ~sstables::filter::blocked_layout_flag;
+                _filter.set(utils::filter::create_blocked_filter(hashes, std::move(bs)), true);
+            } else {
+                _filter.set(utils::filter::create_filter(filter.hashes, std::move(bs)), true);
+            }
         });
+    }).then([this] {
+        return read_filter_size();
+    });
+}
+
+future<> sstable::read_filter_size() {
+    if (!has_component(sstable::component_type::Filter)) {
+        return make_ready_future<>();
+    }
+    return io_check([&] {
+        return engine().file_size(this->filename(sstable::component_type::Filter));
     }).then([this] (auto size) {
         _filter_file_size = size;
     });
@@ -59,13 +71,29 @@ void sstable::write_filter(const io_priority_class& pc) {
         return;
     }
 
-    auto f = static_cast<utils::filter::murmur3_bloom_filter *>(_filter.get());
-
-    auto&& bs = f->bits();
-    std::deque<uint64_t> v(align_up(bs.size(), size_t(64)) / 64);
-    bs.save(v.begin());
-    auto filter = sstables::filter(f->num_hashes(), std::move(v));
+    auto make_filter = [] (auto* f, uint32_t flags) {
+        auto&& bs = f->bits();
+        std::deque<uint64_t> v(align_up(bs.size(), size_t(64)) / 64);
+        bs.save(v.begin());
+        return sstables::filter(f->num_hashes() | flags, std::move(v));
+    };
+    auto filter = [&] {
+        if (auto f = dynamic_cast<utils::filter::blocked_bloom_filter*>(_filter.get())) {
+            return make_filter(f, sstables::filter::blocked_layout_flag);
+        }
+        return make_filter(static_cast<utils::filter::murmur3_bloom_filter*>(_filter.get()), 0);
+    }();
     write_simple<sstable::component_type::Filter>(filter, pc);
 }
 
+static thread_local utils::filter_layout new_filter_layout = utils::filter_layout::classic;
+
+void set_filter_layout(utils::filter_layout layout) {
+    new_filter_layout = layout;
+}
+
+utils::filter_layout get_filter_layout() {
+    return new_filter_layout;
+}
+
 }
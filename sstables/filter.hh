@@ -22,8 +22,15 @@
  */
 #pragma once
 
+#include "utils/i_filter.hh"
+
 namespace sstables {
 class sstable;
+
+// Layout of bloom filters of sstables written by this shard from now on.
+// Filters of existing sstables are read in whatever layout they were written.
+void set_filter_layout(utils::filter_layout layout);
+utils::filter_layout get_filter_layout();
 }
 
 class filter_tracker {
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter_cache.hh"
+#include <seastar/core/scollectd.hh>
+
+namespace sstables {
+
+filter_cache& global_filter_cache() {
+    static thread_local filter_cache instance;
+    return instance;
+}
+
+cached_filter::cached_filter(cached_filter&& o) noexcept
+    : _filter(std::move(o._filter))
+    , _memory_size(o._memory_size)
+    , _lru_link()
+{
+    o._memory_size = 0;
+    if (o._lru_link.is_linked()) {
+        auto prev = o._lru_link.prev_;
+        o._lru_link.unlink();
+        filter_cache::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
+    }
+}
+
+cached_filter::~cached_filter() {
+    reset();
+}
+
+void cached_filter::set(utils::filter_ptr filter, bool evictable) {
+    reset();
+    _filter = std::move(filter);
+    _memory_size = _filter->memory_size();
+    global_filter_cache().add(*this, evictable);
+}
+
+void cached_filter::make_evictable() {
+    if (_filter && !_lru_link.is_linked()) {
+        global_filter_cache().make_evictable(*this);
+    }
+}
+
+void cached_filter::reset() {
+    if (_filter) {
+        global_filter_cache().remove(*this);
+        _filter = {};
+        _memory_size = 0;
+    }
+}
+
+utils::i_filter* cached_filter::get() {
+    if (_lru_link.is_linked()) {
+        global_filter_cache().touch(*this);
+    }
+    return _filter.get();
+}
+
+filter_cache::filter_cache() {
+    setup_collectd();
+}
+
+void filter_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("sstable_filters"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.bytes)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("sstable_filters"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "filters")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.filters)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("sstable_filters"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "loads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.loads)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("sstable_filters"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+    }));
+}
+
+void filter_cache::add(cached_filter& f, bool evictable) {
+    _stats.bytes += f._memory_size;
+    ++_stats.filters;
+    if (evictable) {
+        ++_stats.loads;
+        _lru.push_front(f);
+        shrink_to_capacity();
+    }
+}
+
+void filter_cache::make_evictable(cached_filter& f) {
+    _lru.push_front(f);
+    shrink_to_capacity();
+}
+
+void filter_cache::remove(cached_filter& f) {
+    _stats.bytes -= f._memory_size;
+    --_stats.filters;
+    if (f._lru_link.is_linked()) {
+        _lru.erase(_lru.iterator_to(f));
+    }
+}
+
+void filter_cache::touch(cached_filter& f) {
+    _lru.erase(_lru.iterator_to(f));
+    _lru.push_front(f);
+}
+
+void filter_cache::shrink_to_capacity() {
+    if (!_capacity) {
+        return;
+    }
+    // The most recently used filter is kept even if it alone exceeds the
+    // capacity, so that it can serve the read which loaded it.
+    while (_stats.bytes > _capacity && !_lru.empty() && &_lru.back() != &_lru.front()) {
+        auto& f = _lru.back();
+        f.reset();
+        ++_stats.evictions;
+    }
+}
+
+void filter_cache::set_capacity(size_t bytes) {
+    _capacity = bytes;
+    shrink_to_capacity();
+}
+
+}
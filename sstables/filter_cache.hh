@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+
+#include "utils/i_filter.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace sstables {
+
+namespace bi = boost::intrusive;
+
+// Bloom filter of an sstable, with its memory accounted for in the shard's
+// filter_cache.
+//
+// Filters read from disk are evictable: the cache may drop them under its
+// memory budget, they are then loaded again on demand by the sstable. Filters
+// built by a writer aren't on disk yet, and stay pinned.
+class cached_filter {
+    using lru_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
+
+    utils::filter_ptr _filter;
+    size_t _memory_size = 0;
+    lru_link_type _lru_link;
+public:
+    friend class filter_cache;
+
+    cached_filter() = default;
+    cached_filter(cached_filter&&) noexcept;
+    cached_filter& operator=(cached_filter&&) = delete;
+    ~cached_filter();
+
+    void set(utils::filter_ptr filter, bool evictable);
+    void make_evictable();
+    void reset();
+
+    // Returns nullptr if the filter isn't loaded.
+    utils::i_filter* get();
+    utils::i_filter* operator->() { return get(); }
+    explicit operator bool() const { return bool(_filter); }
+    size_t memory_size() const { return _memory_size; }
+};
+
+// Shard-wide accounting of the memory used by sstable bloom filters.
+//
+// With a capacity of 0, filters are loaded together with their sstables and
+// are never evicted. Otherwise sstables load their filters on first use, and
+// the least recently used evictable filters are dropped once the capacity is
+// exceeded.
+class filter_cache final {
+public:
+    using lru_type = bi::list<cached_filter,
+        bi::member_hook<cached_filter, cached_filter::lru_link_type, &cached_filter::_lru_link>,
+        bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+
+    struct stats {
+        uint64_t bytes = 0;
+        uint64_t filters = 0;
+        uint64_t loads = 0;
+        uint64_t evictions = 0;
+    };
+private:
+    stats _stats;
+    size_t _capacity = 0;
+    lru_type _lru;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    void setup_collectd();
+    void add(cached_filter&, bool evictable);
+    void make_evictable(cached_filter&);
+    void remove(cached_filter&);
+    void touch(cached_filter&);
+    void shrink_to_capacity();
+public:
+    friend class cached_filter;
+
+    filter_cache();
+
+    // Sets the amount of memory filters may occupy. 0 means no limit, and
+    // loading filters eagerly.
+    void set_capacity(size_t bytes);
+    size_t capacity() const { return _capacity; }
+    bool lazy() const { return _capacity != 0; }
+
+    const stats& get_stats() const { return _stats; }
+};
+
+// Returns a reference to shard-wide filter_cache.
+filter_cache& global_filter_cache();
+
+}
@@ -98,6 +98,18 @@ static inline size_t write_unsigned_var_int(unsigned int value, uint8_t* to) {
     return size;
 }
 
+static inline unsigned int read_unsigned_var_int(const uint8_t*& from, const uint8_t* end) {
+    unsigned int value = 0;
+    for (unsigned shift = 0; from != end && shift < 32; shift += 7) {
+        auto b = *from++;
+        value |= unsigned(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("malformed variable length integer in cardinality metadata");
+}
+
 /** @class HyperLogLog
  *  @brief Implement of 'HyperLogLog' estimate cardinality algorithm
  */
@@ -137,11 +149,33 @@ class HyperLogLog {
         alphaMM_ = alpha * m_ * m_;
     }
 
-    static HyperLogLog from_bytes(temporary_buffer<uint8_t> bytes) {
-        // FIXME: implement class that creates a HyperLogLog from an array of bytes.
-        // This will useful if we need to work with the cardinality data from the
-        // compaction metadata.
-        abort();
+    /**
+     * Reads back an estimator written by get_bytes(), e.g. from the cardinality
+     * of the compaction metadata.
+     *
+     * @exception std::runtime_error the bytes aren't in the format written by
+     *            get_bytes(), which is the case of the sparse and the bit
+     *            packed formats written by Cassandra.
+     */
+    static HyperLogLog from_bytes(const temporary_buffer<uint8_t>& bytes) {
+        static constexpr int version = 2;
+
+        auto p = bytes.get();
+        auto end = p + bytes.size();
+        if (bytes.size() < sizeof(int32_t) || read_be<int32_t>(reinterpret_cast<const char*>(p)) != -version) {
+            throw std::runtime_error("unsupported cardinality metadata version");
+        }
+        p += sizeof(int32_t);
+        auto b = read_unsigned_var_int(p, end);
+        auto sp = read_unsigned_var_int(p, end);
+        auto type = read_unsigned_var_int(p, end);
+        auto size = read_unsigned_var_int(p, end);
+        if (b < 4 || b > 16 || sp != 0 || type != 0 || size != (1u << b) || size_t(end - p) != size) {
+            throw std::runtime_error("unsupported cardinality metadata format");
+        }
+        HyperLogLog hll(b);
+        std::copy(p, end, hll.M_.begin());
+        return hll;
     }
 
     /**
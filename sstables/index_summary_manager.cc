@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "index_summary_manager.hh"
+#include "downsampling.hh"
+#include "log.hh"
+#include "service/priority_manager.hh"
+#include <boost/range/irange.hpp>
+#include <numeric>
+
+namespace sstables {
+
+static logging::logger logger("index_summary_manager");
+
+void index_summary_manager::start(size_t capacity, std::chrono::milliseconds interval, candidates_source candidates) {
+    _capacity = capacity;
+    _interval = interval;
+    _candidates = std::move(candidates);
+    if (!_capacity || !_interval.count()) {
+        return;
+    }
+    _timer.set_callback([this] {
+        redistribute().handle_exception([] (std::exception_ptr ep) {
+            logger.warn("Failed to redistribute index summaries: {}", ep);
+        }).finally([this] {
+            if (!_gate.is_closed()) {
+                _timer.arm(_interval);
+            }
+        });
+    });
+    _timer.arm(_interval);
+}
+
+future<> index_summary_manager::stop() {
+    _timer.cancel();
+    return _gate.close();
+}
+
+std::vector<int> index_summary_manager::compute_sampling_levels(size_t capacity, const std::vector<summary_stats>& summaries) {
+    constexpr int base = downsampling::BASE_SAMPLING_LEVEL;
+    auto n = summaries.size();
+    std::vector<double> bytes(n), room(n), weights(n);
+    double remaining = capacity;
+    for (size_t i = 0; i < n; ++i) {
+        auto& s = summaries[i];
+        bytes[i] = double(s.full_size) * s.min_sampling_level / base;
+        room[i] = double(s.full_size) * std::max(s.max_sampling_level - s.min_sampling_level, 0) / base;
+        // Unread summaries get a small share as well.
+        weights[i] = s.reads + 1;
+        remaining -= bytes[i];
+    }
+
+    if (remaining > 0) {
+        // Proportional allocation of what is left after every summary got
+        // its minimum, capped by the room each has to grow. The summaries
+        // which need the least to be capped go first, so that what they
+        // don't use is shared among the others.
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&] (size_t i, size_t j) {
+            return room[i] * weights[j] < room[j] * weights[i];
+        });
+        auto total_weight = std::accumulate(weights.begin(), weights.end(), 0.0);
+        for (auto i : order) {
+            auto share = std::min(remaining * weights[i] / total_weight, room[i]);
+            bytes[i] += share;
+            remaining -= share;
+            total_weight -= weights[i];
+        }
+    }
+
+    std::vector<int> levels(n);
+    for (size_t i = 0; i < n; ++i) {
+        auto& s = summaries[i];
+        int level = s.full_size ? int(bytes[i] * base / s.full_size) : s.max_sampling_level;
+        level = std::max(s.min_sampling_level, std::min(level, s.max_sampling_level));
+        if (level > s.current_sampling_level && level < s.current_sampling_level * upsample_threshold) {
+            level = s.current_sampling_level;
+        }
+        levels[i] = level;
+    }
+    return levels;
+}
+
+future<> index_summary_manager::redistribute() {
+    return with_gate(_gate, [this] {
+        constexpr int base = downsampling::BASE_SAMPLING_LEVEL;
+        std::vector<shared_sstable> sstables;
+        std::vector<summary_stats> summaries;
+        for (auto&& c : _candidates()) {
+            auto& summary = c.sst->get_summary();
+            if (!summary) {
+                continue;
+            }
+            summary_stats s;
+            s.current_sampling_level = c.sst->summary_sampling_level();
+            s.full_size = summary.memory_footprint() * base / s.current_sampling_level;
+            s.reads = c.sst->get_recent_index_reads();
+            // The lowest level at which the effective index interval stays
+            // within max_index_interval.
+            auto min_level = (int64_t(summary.header.min_index_interval) * base + c.max_index_interval - 1) / std::max(c.max_index_interval, 1);
+            s.min_sampling_level = std::min<int64_t>(std::max<int64_t>(min_level, 1), s.current_sampling_level);
+            s.max_sampling_level = std::max(c.sst->summary_disk_sampling_level(), s.current_sampling_level);
+            summaries.push_back(s);
+            sstables.push_back(std::move(c.sst));
+        }
+        auto levels = compute_sampling_levels(_capacity, summaries);
+        _stats.redistributions++;
+
+        return do_with(std::move(sstables), std::move(levels), [this] (std::vector<shared_sstable>& sstables, std::vector<int>& levels) {
+            return do_for_each(boost::irange<size_t>(0, sstables.size()), [this, &sstables, &levels] (size_t i) {
+                auto& sst = sstables[i];
+                auto level = levels[i];
+                auto current = sst->summary_sampling_level();
+                if (level == current || sst->summary_in_use() || _gate.is_closed()) {
+                    return make_ready_future<>();
+                }
+                if (level < current) {
+                    _stats.downsamplings++;
+                } else {
+                    _stats.upsamplings++;
+                }
+                return sst->resample_summary(level, service::get_local_compaction_priority()).handle_exception([sst] (std::exception_ptr ep) {
+                    logger.warn("Failed to resample index summary of {}: {}", sst->get_filename(), ep);
+                });
+            });
+        });
+    });
+}
+
+}
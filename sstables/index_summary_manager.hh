@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/gate.hh"
+#include "core/timer.hh"
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "sstables.hh"
+
+namespace sstables {
+
+// Keeps the memory used by the index summaries of a shard within a budget.
+//
+// Every resize interval, the budget is redistributed among the summaries of
+// all sstables of the shard, in proportion to their index reads since the
+// previous redistribution. Summaries of cold sstables are downsampled, down
+// to the sampling level at which their effective index interval reaches the
+// table's max_index_interval. Summaries of hot sstables get re-sampled up to
+// the sampling level they have on disk.
+//
+// Downsampling drops summary entries in memory. Upsampling reads the summary
+// back from disk, and only happens when the sampling level would grow by a
+// significant factor, to avoid churning on small changes of read rates.
+class index_summary_manager {
+public:
+    struct candidate {
+        shared_sstable sst;
+        int32_t max_index_interval;
+    };
+    using candidates_source = std::function<std::vector<candidate>()>;
+
+    struct summary_stats {
+        // Memory the summary would use at full sampling.
+        uint64_t full_size;
+        // Index reads since the last redistribution.
+        uint64_t reads;
+        int min_sampling_level;
+        int max_sampling_level;
+        int current_sampling_level;
+    };
+
+    struct stats {
+        uint64_t redistributions = 0;
+        uint64_t downsamplings = 0;
+        uint64_t upsamplings = 0;
+    };
+private:
+    // Upsampling needs the new level to be this many times the current one.
+    static constexpr double upsample_threshold = 1.5;
+
+    size_t _capacity = 0;
+    candidates_source _candidates;
+    timer<> _timer;
+    std::chrono::milliseconds _interval;
+    seastar::gate _gate;
+    stats _stats;
+public:
+    index_summary_manager() = default;
+
+    // Arms the periodic redistribution of capacity bytes among the summaries
+    // of the sstables returned by candidates. Does nothing if capacity or
+    // interval are zero.
+    void start(size_t capacity, std::chrono::milliseconds interval, candidates_source candidates);
+    future<> stop();
+
+    // Redistributes the budget once.
+    future<> redistribute();
+
+    // Computes the sampling level each summary should have for all of
+    // them to fit in capacity bytes, in proportion to their reads.
+    static std::vector<int> compute_sampling_levels(size_t capacity, const std::vector<summary_stats>& summaries);
+
+    const stats& get_stats() const { return _stats; }
+};
+
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "io_buffer_pool.hh"
+#include <seastar/core/scollectd.hh>
+#include "core/align.hh"
+
+namespace sstables {
+
+constexpr size_t io_buffer_pool::alignment;
+constexpr size_t io_buffer_pool::min_buffer_size;
+constexpr size_t io_buffer_pool::max_buffer_size;
+
+io_buffer_pool& local_io_buffer_pool() {
+    static thread_local io_buffer_pool pool;
+    return pool;
+}
+
+io_buffer_pool::io_buffer_pool()
+    : _capacity(memory::stats().total_memory() * default_capacity_share)
+    , _reclaimer([this] { return reclaim(); })
+{
+    setup_collectd();
+}
+
+io_buffer_pool::~io_buffer_pool() {
+    clear();
+}
+
+void io_buffer_pool::setup_collectd() {
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "io_buffer_pool_hits")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+    ));
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "io_buffer_pool_misses")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+    ));
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "io_buffer_pool_oversized")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.oversized)
+    ));
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "io_buffer_pool_dropped")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.dropped)
+    ));
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "bytes", "io_buffer_pool_free")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, _free_bytes)
+    ));
+    _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+            , scollectd::per_cpu_plugin_instance
+            , "ratio", "io_buffer_pool_hit_rate")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                auto total = _stats.hits + _stats.misses;
+                return total ? double(_stats.hits) / total : 0.0;
+            })
+    ));
+}
+
+unsigned io_buffer_pool::class_of(size_t size) {
+    unsigned cls = 0;
+    while (class_size(cls) < size) {
+        ++cls;
+    }
+    return cls;
+}
+
+temporary_buffer<char> io_buffer_pool::get(size_t size) {
+    if (size > max_buffer_size) {
+        ++_stats.oversized;
+        return temporary_buffer<char>::aligned(alignment, size);
+    }
+    auto cls = class_of(size);
+    char* buf;
+    if (!_free[cls].empty()) {
+        buf = _free[cls].back();
+        _free[cls].pop_back();
+        _free_bytes -= class_size(cls);
+        ++_stats.hits;
+    } else {
+        buf = static_cast<char*>(::aligned_alloc(alignment, class_size(cls)));
+        if (!buf) {
+            throw std::bad_alloc();
+        }
+        ++_stats.misses;
+    }
+    return temporary_buffer<char>(buf, size, make_deleter(deleter(), [this, buf, cls, shard = engine().cpu_id()] {
+        if (engine().cpu_id() == shard) {
+            release(buf, cls);
+        } else {
+            ::free(buf);
+        }
+    }));
+}
+
+void io_buffer_pool::release(char* buf, unsigned cls) {
+    if (_free_bytes + class_size(cls) > _capacity) {
+        ++_stats.dropped;
+        ::free(buf);
+        return;
+    }
+    try {
+        _free[cls].push_back(buf);
+    } catch (const std::bad_alloc&) {
+        ++_stats.dropped;
+        ::free(buf);
+        return;
+    }
+    _free_bytes += class_size(cls);
+}
+
+void io_buffer_pool::clear() {
+    for (auto&& free : _free) {
+        for (auto buf : free) {
+            ::free(buf);
+        }
+        free.clear();
+    }
+    _free_bytes = 0;
+}
+
+void io_buffer_pool::set_capacity(size_t bytes) {
+    _capacity = bytes;
+    if (_free_bytes > _capacity) {
+        clear();
+    }
+}
+
+memory::reclaiming_result io_buffer_pool::reclaim() {
+    if (!_free_bytes) {
+        return memory::reclaiming_result::reclaimed_nothing;
+    }
+    clear();
+    return memory::reclaiming_result::reclaimed_something;
+}
+
+future<temporary_buffer<char>> pooled_dma_read(file f, uint64_t pos, size_t len, const io_priority_class& pc) {
+    auto disk_alignment = f.disk_read_dma_alignment();
+    auto front = pos - align_down<uint64_t>(pos, disk_alignment);
+    auto aligned_len = align_up<uint64_t>(front + len, disk_alignment);
+    if (disk_alignment > io_buffer_pool::alignment || f.memory_dma_alignment() > io_buffer_pool::alignment) {
+        return f.dma_read_bulk<char>(pos, len, pc);
+    }
+    auto buf = local_io_buffer_pool().get(aligned_len);
+    auto data = buf.get_write();
+    return f.dma_read(pos - front, data, aligned_len, pc).then([f, pos, len, front, disk_alignment, pc, buf = std::move(buf)] (size_t n) mutable {
+        // A short read which ends on an aligned offset may not be the end of
+        // the file, let dma_read_bulk() deal with it.
+        if (n < front + len && n % disk_alignment == 0 && n) {
+            return f.dma_read_bulk<char>(pos, len, pc);
+        }
+        buf.trim(std::min<size_t>(n, front + len));
+        buf.trim_front(std::min<size_t>(front, buf.size()));
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
+    });
+}
+
+}
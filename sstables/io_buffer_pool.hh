@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include "core/file.hh"
+#include "core/memory.hh"
+#include "core/reactor.hh"
+#include "core/temporary_buffer.hh"
+
+namespace scollectd {
+
+struct registration;
+
+}
+
+namespace sstables {
+
+// Shard-wide pool of DMA-aligned buffers for sstable reads.
+//
+// Buffers are grouped in power of two size classes, from min_buffer_size to
+// max_buffer_size. When a buffer obtained from get() is released, it goes
+// back to the free list of its class, as long as the pool holds less than
+// its capacity, so that reads don't allocate and free large aligned chunks
+// of the seastar allocator all the time. All pooled buffers are freed when
+// the allocator is low on memory.
+class io_buffer_pool {
+public:
+    static constexpr size_t alignment = 4096;
+    static constexpr size_t min_buffer_size = 4096;
+    static constexpr size_t max_buffer_size = 256 * 1024;
+    // Share of the shard's memory the free buffers may take.
+    static constexpr double default_capacity_share = 0.01;
+
+    struct stats {
+        // Buffers handed out from a free list, and those which had to be
+        // allocated.
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        // Requests larger than max_buffer_size, which are not pooled.
+        uint64_t oversized = 0;
+        // Released buffers freed because the pool was full.
+        uint64_t dropped = 0;
+    };
+private:
+    static constexpr unsigned size_classes = 7;
+    static_assert(min_buffer_size << (size_classes - 1) == max_buffer_size, "size classes don't cover the pooled sizes");
+
+    std::array<std::vector<char*>, size_classes> _free;
+    size_t _capacity;
+    size_t _free_bytes = 0;
+    stats _stats;
+    memory::reclaimer _reclaimer;
+    std::vector<scollectd::registration> _collectd_registrations;
+private:
+    static unsigned class_of(size_t size);
+    static size_t class_size(unsigned cls) {
+        return min_buffer_size << cls;
+    }
+    void release(char* buf, unsigned cls);
+    memory::reclaiming_result reclaim();
+    void setup_collectd();
+public:
+    io_buffer_pool();
+    ~io_buffer_pool();
+
+    // Returns a buffer of the given size, aligned to alignment.
+    temporary_buffer<char> get(size_t size);
+    // Frees all buffers in the free lists.
+    void clear();
+
+    void set_capacity(size_t bytes);
+    size_t capacity() const { return _capacity; }
+    size_t free_bytes() const { return _free_bytes; }
+    const stats& get_stats() const { return _stats; }
+};
+
+io_buffer_pool& local_io_buffer_pool();
+
+// Like file::dma_read_bulk(), but reads into a buffer from the shard's
+// io_buffer_pool. Returns fewer than len bytes only at the end of the file.
+future<temporary_buffer<char>> pooled_dma_read(file f, uint64_t pos, size_t len, const io_priority_class& pc);
+
+}
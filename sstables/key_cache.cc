@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "key_cache.hh"
+
+namespace sstables {
+
+key_cache& global_key_cache() {
+    static thread_local key_cache instance;
+    return instance;
+}
+
+std::experimental::optional<key_cache_position> key_cache::lookup(uint64_t owner, bytes_view key) {
+    return _cache.lookup(std::make_pair(owner, key), [] (const key_cache_entry& e) {
+        return e.position();
+    });
+}
+
+void key_cache::insert(uint64_t owner, bytes_view key, const key_cache_position& pos) {
+    if (pos.promoted_index.size() > max_promoted_index_size) {
+        insert(owner, key, key_cache_position{pos.start, pos.end, bytes()});
+        return;
+    }
+    _cache.insert(std::make_pair(owner, key), [&pos] (key_cache_entry& e) {
+        e.set_position(pos);
+    }, owner, key, pos);
+}
+
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+
+#include "bytes.hh"
+#include "utils/lsa_lru_cache.hh"
+
+namespace sstables {
+
+// Location of a partition inside the data file of an sstable, as found
+// through the summary and the index.
+struct key_cache_position {
+    uint64_t start;
+    uint64_t end;
+    // Serialized promoted index of the partition. Empty if the partition has
+    // none, or if it was too large to be cached.
+    bytes promoted_index;
+};
+
+class key_cache_entry : public utils::lsa_lru_cache_entry {
+    uint64_t _owner;
+    managed_bytes _key;
+    uint64_t _start;
+    uint64_t _end;
+    managed_bytes _promoted_index;
+public:
+    key_cache_entry(uint64_t owner, bytes_view key, const key_cache_position& pos)
+        : _owner(owner)
+        , _key(key)
+        , _start(pos.start)
+        , _end(pos.end)
+        , _promoted_index(bytes_view(pos.promoted_index))
+    { }
+
+    key_cache_entry(key_cache_entry&&) noexcept = default;
+
+    uint64_t owner() const { return _owner; }
+    bytes_view key() const { return bytes_view(_key); }
+    // Requires linearized managed_bytes.
+    key_cache_position position() const {
+        return { _start, _end, bytes(bytes_view(_promoted_index)) };
+    }
+    // Must be called with the cache's allocator.
+    void set_position(const key_cache_position& pos) {
+        _start = pos.start;
+        _end = pos.end;
+        _promoted_index = managed_bytes(bytes_view(pos.promoted_index));
+    }
+
+    struct compare {
+        static int tri_compare(uint64_t o1, bytes_view k1, uint64_t o2, bytes_view k2) {
+            if (o1 != o2) {
+                return o1 < o2 ? -1 : 1;
+            }
+            return compare_unsigned(k1, k2);
+        }
+        bool operator()(const key_cache_entry& e1, const key_cache_entry& e2) const {
+            return tri_compare(e1._owner, e1.key(), e2._owner, e2.key()) < 0;
+        }
+        bool operator()(const std::pair<uint64_t, bytes_view>& k, const key_cache_entry& e) const {
+            return tri_compare(k.first, k.second, e._owner, e.key()) < 0;
+        }
+        bool operator()(const key_cache_entry& e, const std::pair<uint64_t, bytes_view>& k) const {
+            return tri_compare(e._owner, e.key(), k.first, k.second) < 0;
+        }
+        bool operator()(uint64_t owner, const key_cache_entry& e) const {
+            return owner < e._owner;
+        }
+        bool operator()(const key_cache_entry& e, uint64_t owner) const {
+            return e._owner < owner;
+        }
+    };
+};
+
+// Shard-wide cache of partition positions in sstable data files.
+//
+// Maps (sstable, partition key) to the data file range of that partition, so
+// that point reads of hot partitions which miss in row_cache don't have to read
+// and parse an index page.
+//
+// Entries belonging to a given sstable are identified by an owner id obtained
+// from key_cache_owner, which drops them when the sstable goes away.
+class key_cache final {
+    using cache_type = utils::lsa_lru_cache<key_cache_entry, key_cache_entry::compare>;
+public:
+    using stats = cache_type::stats;
+private:
+    // Promoted indexes larger than this are not cached, to keep a few
+    // huge partitions from taking over the cache.
+    static constexpr size_t max_promoted_index_size = 128 * 1024;
+private:
+    cache_type _cache{"key_cache"};
+    uint64_t _next_owner_id = 1;
+public:
+    // Looks up position of the partition with given key in given sstable.
+    std::experimental::optional<key_cache_position> lookup(uint64_t owner, bytes_view key);
+    void insert(uint64_t owner, bytes_view key, const key_cache_position& pos);
+    // Removes all entries of given owner.
+    void invalidate(uint64_t owner) { _cache.invalidate(owner); }
+    void clear() { _cache.clear(); }
+
+    void set_capacity(size_t bytes) { _cache.set_capacity(bytes); }
+    size_t capacity() const { return _cache.capacity(); }
+    bool enabled() const { return _cache.enabled(); }
+
+    uint64_t new_owner_id() { return _next_owner_id++; }
+
+    const stats& get_stats() const { return _cache.get_stats(); }
+    const logalloc::region& region() const { return _cache.region(); }
+};
+
+// Returns a reference to shard-wide key_cache.
+key_cache& global_key_cache();
+
+// Allocates a key cache owner id for an sstable and removes all entries
+// belonging to it on destruction.
+class key_cache_owner {
+    uint64_t _id;
+public:
+    key_cache_owner() : _id(global_key_cache().new_owner_id()) { }
+    key_cache_owner(key_cache_owner&& o) noexcept : _id(o._id) {
+        o._id = 0;
+    }
+    key_cache_owner& operator=(key_cache_owner&&) = delete;
+    ~key_cache_owner() {
+        if (_id) {
+            global_key_cache().invalidate(_id);
+        }
+    }
+    uint64_t id() const { return _id; }
+};
+
+}
@@ -64,6 +64,9 @@ class leveled_manifest {
 
     schema_ptr _schema;
     std::vector<std::list<sstables::shared_sstable>> _generations;
+    // sstables being compacted by compactions already running, which the
+    // manifest doesn't hold.
+    std::vector<sstables::shared_sstable> _compacting;
 #if 0
     private final RowPosition[] lastCompactedKeys;
 #endif
@@ -102,8 +105,12 @@ class leveled_manifest {
     }
 #endif
 
-    static leveled_manifest create(column_family& cfs, std::vector<sstables::shared_sstable>& sstables, int max_sstable_size_in_mb) {
+    // compacting are the sstables being compacted already, which compactions
+    // chosen by the manifest are kept from overlapping in their output level.
+    static leveled_manifest create(column_family& cfs, std::vector<sstables::shared_sstable>& sstables, int max_sstable_size_in_mb,
+            std::vector<sstables::shared_sstable> compacting = {}) {
         leveled_manifest manifest = leveled_manifest(cfs, max_sstable_size_in_mb);
+        manifest._compacting = std::move(compacting);
 
         // ensure all SSTables are in the manifest
         for (auto& sstable : sstables) {
@@ -314,6 +321,17 @@ class leveled_manifest {
         // This isn't a magic wand -- if you are consistently writing too fast for LCS to keep
         // up, you're still screwed.  But if instead you have intermittent bursts of activity,
         // it can help a lot.
+        //
+        // Compactions into different levels, or into disjoint ranges of the same level, may
+        // run in parallel, so a level whose candidates overlap a running compaction is passed
+        // over for the next one.
+        auto size_tier_l0 = [this] {
+            // TODO: we shouldn't proceed with size tiered strategy if cassandra.disable_stcs_in_l0 is true.
+            if (get_level_size(0) > MAX_COMPACTING_L0) {
+                return size_tiered_most_interesting_bucket(get_level(0));
+            }
+            return std::vector<sstables::shared_sstable>();
+        };
         for (auto i = _generations.size() - 1; i > 0; i--) {
             auto& sstables = get_level(i);
             if (sstables.empty()) {
@@ -330,13 +348,10 @@ class leveled_manifest {
 
             if (score > 1.001) {
                 // before proceeding with a higher level, let's see if L0 is far enough behind to warrant STCS
-                // TODO: we shouldn't proceed with size tiered strategy if cassandra.disable_stcs_in_l0 is true.
-                if (get_level_size(0) > MAX_COMPACTING_L0) {
-                    auto most_interesting = size_tiered_most_interesting_bucket(get_level(0));
-                    if (!most_interesting.empty()) {
-                        logger.debug("L0 is too far behind, performing size-tiering there first");
-                        return sstables::compaction_descriptor(std::move(most_interesting));
-                    }
+                auto most_interesting = size_tier_l0();
+                if (!most_interesting.empty()) {
+                    logger.debug("L0 is too far behind, performing size-tiering there first");
+                    return sstables::compaction_descriptor(std::move(most_interesting));
                 }
                 // L0 is fine, proceed with this level
                 auto candidates = get_candidates_for(i);
@@ -359,6 +374,13 @@ class leveled_manifest {
         if (get_level(0).empty()) {
             return sstables::compaction_descriptor();
         }
+        // Unless L0 is too far behind, where compacting batches of MAX_COMPACTING_L0 sstables
+        // with all of L1 would take long to bring the number of sstables a read has to look at down.
+        auto most_interesting = size_tier_l0();
+        if (!most_interesting.empty()) {
+            logger.debug("L0 is too far behind, performing size-tiering there first");
+            return sstables::compaction_descriptor(std::move(most_interesting));
+        }
         auto candidates = get_candidates_for(0);
         if (candidates.empty()) {
             return sstables::compaction_descriptor();
@@ -648,6 +670,10 @@ class leveled_manifest {
                     }
                     candidates.push_back(candidate);
                 }
+                if (overlaps_compacting(candidates, 1)) {
+                    logger.debug("L0 candidates overlap a running compaction into L1");
+                    return {};
+                }
             }
             if (candidates.size() < 2) {
                 return {};
@@ -686,16 +712,33 @@ class leveled_manifest {
 #if 0
             if (Iterables.any(candidates, suspectP))
                 continue;
-            if (Sets.intersection(candidates, compacting).isEmpty())
-                return candidates;
 #endif
-            return candidates;
+            if (!overlaps_compacting(candidates, level + 1)) {
+                return candidates;
+            }
         }
 
         // all the sstables were suspect or overlapped with something suspect
         return {};
     }
 
+    // Returns true if a compaction of sstables into given level would overlap
+    // a running compaction reading from, or writing to, the same level. Their
+    // outputs would overlap in the level. L0 may overlap itself.
+    bool overlaps_compacting(std::vector<sstables::shared_sstable>& sstables, uint32_t level) {
+        if (level == 0 || sstables.empty()) {
+            return false;
+        }
+        std::vector<sstables::shared_sstable> busy;
+        for (auto& sst : _compacting) {
+            auto sst_level = sst->get_sstable_level();
+            if (sst_level == level || sst_level + 1 == level) {
+                busy.push_back(sst);
+            }
+        }
+        return !busy.empty() && !overlapping(*_schema, sstables, busy).empty();
+    }
+
     std::list<sstables::shared_sstable> age_sorted_sstables(std::list<sstables::shared_sstable>& candidates) {
         auto age_sorted_candidates = candidates;
 
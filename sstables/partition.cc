@@ -27,7 +27,9 @@
 #include "core/do_with.hh"
 #include "unimplemented.hh"
 #include "utils/move.hh"
+#include "utils/data_input.hh"
 #include "dht/i_partitioner.hh"
+#include "compound_compat.hh"
 
 namespace sstables {
 
@@ -111,6 +113,10 @@ class mp_row_consumer : public row_consumer {
 
     bool _skip_partition;
     bool _skip_clustering_row;
+    // Set when reading a partition found through the partition index, which
+    // leads to some other partition for keys which aren't in the sstable.
+    bool _tolerate_key_mismatch = false;
+    bool _key_mismatch = false;
 
     // We don't have "end of clustering row" markers. So we know that the current
     // row has ended once we get something (e.g. a live cell) that belongs to another
@@ -309,6 +315,9 @@ class mp_row_consumer : public row_consumer {
             _skip_clustering_row = false;
             _filter = _ck_filtering.get_filter_for_sorted(_mutation->key);
             return proceed::no;
+        } else if (_tolerate_key_mismatch) {
+            _key_mismatch = true;
+            return proceed::no;
         } else {
             throw malformed_sstable_exception(sprint("Key mismatch. Got %s while processing %s", to_hex(bytes_view(key)).c_str(), to_hex(bytes_view(_key)).c_str()));
         }
@@ -372,6 +381,13 @@ class mp_row_consumer : public row_consumer {
         return flush_if_needed(false, position_in_partition(position_in_partition::clustering_row_tag_t(), std::move(ck)));
     }
 
+    // Cells of columns which aren't selected are kept, without their values,
+    // since they still decide whether the row is live.
+    bool is_selected(const column_definition& def) const {
+        auto columns = _ck_filtering.columns();
+        return !columns || columns->contains(def.kind, def.id);
+    }
+
     atomic_cell make_atomic_cell(uint64_t timestamp, bytes_view value, uint32_t ttl, uint32_t expiration) {
         if (ttl) {
             return atomic_cell::make_live(timestamp, value,
@@ -404,6 +420,9 @@ class mp_row_consumer : public row_consumer {
             return ret;
         }
 
+        if (!is_selected(*col.cdef)) {
+            value = bytes_view();
+        }
         auto ac = make_atomic_cell(timestamp, value, ttl, expiration);
 
         bool is_multi_cell = col.collection_extra_data.size();
@@ -562,6 +581,14 @@ class mp_row_consumer : public row_consumer {
         return std::exchange(_is_mutation_end, false);
     }
 
+    void tolerate_key_mismatch() {
+        _tolerate_key_mismatch = true;
+    }
+
+    bool key_mismatch() const {
+        return _key_mismatch;
+    }
+
     stdx::optional<new_mutation> get_mutation() {
         return move_and_disengage(_mutation);
     }
@@ -579,6 +606,97 @@ class mp_row_consumer : public row_consumer {
     }
 };
 
+// A block of the promoted index, which describes where in the partition
+// cells with given range of clustering prefixes are located.
+struct promoted_index_block {
+    clustering_key_prefix start;
+    clustering_key_prefix end;
+    // Relative to the beginning of the partition.
+    uint64_t offset;
+    uint64_t width;
+};
+
+struct promoted_index {
+    deletion_time del_time;
+    std::vector<promoted_index_block> blocks;
+};
+
+static clustering_key_prefix prefix_from_cell_name(const schema& s, bytes_view name) {
+    auto components = composite_view(name, s.is_compound()).explode();
+    if (components.size() > s.clustering_key_size()) {
+        components.resize(s.clustering_key_size());
+    }
+    return clustering_key_prefix::from_exploded(s, components);
+}
+
+static promoted_index parse_promoted_index(const schema& s, bytes_view data) {
+    data_input in(data);
+    promoted_index pi;
+    pi.del_time.local_deletion_time = in.read<int32_t>();
+    pi.del_time.marked_for_delete_at = in.read<int64_t>();
+    auto count = in.read<uint32_t>();
+    pi.blocks.reserve(count);
+    while (count--) {
+        auto start = prefix_from_cell_name(s, in.read_view(in.read<uint16_t>()));
+        auto end = prefix_from_cell_name(s, in.read_view(in.read<uint16_t>()));
+        auto offset = in.read<uint64_t>();
+        auto width = in.read<uint64_t>();
+        pi.blocks.push_back(promoted_index_block{std::move(start), std::move(end), offset, width});
+    }
+    return pi;
+}
+
+// Part of a partition, relative to its beginning, which needs to be read
+// in order to cover the requested clustering ranges.
+struct partition_blocks {
+    uint64_t start;
+    // Disengaged if the read needs to continue to the end of the partition.
+    stdx::optional<uint64_t> end;
+};
+
+static stdx::optional<partition_blocks> find_partition_blocks(const schema& s, const promoted_index& pi,
+                                                              const query::clustering_row_ranges& ranges) {
+    if (pi.blocks.empty() || ranges.empty()) {
+        return { };
+    }
+    bound_view::compare less(s);
+    auto& first = ranges.front();
+    auto& last = ranges.back();
+    auto lower = first.start()
+               ? bound_view(first.start()->value(), first.start()->is_inclusive() ? bound_kind::incl_start : bound_kind::excl_start)
+               : bound_view::bottom();
+    auto upper = last.end()
+               ? bound_view(last.end()->value(), last.end()->is_inclusive() ? bound_kind::incl_end : bound_kind::excl_end)
+               : bound_view::top();
+
+    // Block names may be prefixes, e.g. bounds of range tombstones, so treat
+    // them as the widest bounds they could stand for. Because range tombstones
+    // are repeated at the beginning of each block they span, block bounds are
+    // not monotonic, hence the linear scans.
+    auto b = std::find_if(pi.blocks.begin(), pi.blocks.end(), [&] (const promoted_index_block& blk) {
+        return !less(bound_view(blk.end, bound_kind::incl_end), lower);
+    });
+    auto re = std::find_if(pi.blocks.rbegin(), pi.blocks.rend(), [&] (const promoted_index_block& blk) {
+        return !less(upper, bound_view(blk.start, bound_kind::incl_start));
+    });
+    auto e = re.base();
+    if (b == pi.blocks.begin() && e == pi.blocks.end()) {
+        return { };
+    }
+    if (b >= e) {
+        // Nothing in the partition falls into the ranges, but we still need
+        // to produce the partition, so read a single block.
+        b = b == pi.blocks.end() ? std::prev(b) : b;
+        e = std::next(b);
+    }
+    partition_blocks pb;
+    pb.start = b->offset;
+    if (e != pi.blocks.end()) {
+        pb.end = std::prev(e)->offset + std::prev(e)->width;
+    }
+    return pb;
+}
+
 struct sstable_data_source {
     shared_sstable _sst;
     mp_row_consumer _consumer;
@@ -602,6 +720,29 @@ struct sstable_data_source {
         , _consumer(k, s, ck_filtering, pc)
         , _context(_sst->data_consume_rows(_consumer, start, end))
     { }
+
+    struct partition_blocks_tag { };
+    sstable_data_source(schema_ptr s, shared_sstable sst, const sstables::key& k, const io_priority_class& pc,
+            query::clustering_key_filtering_context ck_filtering, uint64_t start, uint64_t end, partition_blocks_tag)
+        : _sst(std::move(sst))
+        , _consumer(k, s, ck_filtering, pc)
+        , _context(_sst->data_consume_partition_blocks(_consumer, start, end))
+    { }
+};
+
+// What is needed to restart reading a partition at one of its promoted index blocks.
+struct promoted_index_skip_info {
+    shared_sstable sst;
+    sstables::key key;
+    query::clustering_key_filtering_context ck_filtering;
+    const io_priority_class* pc;
+    promoted_index pi;
+    // Position of the partition in the data file.
+    uint64_t partition_start;
+    // End of the part of the data file which is read.
+    uint64_t data_end;
+    // Block the current data source started at.
+    size_t first_block;
 };
 
 class sstable_streamed_mutation : public streamed_mutation::impl {
@@ -612,9 +753,63 @@ class sstable_streamed_mutation : public streamed_mutation::impl {
     mutation_fragment_opt _current_candidate;
     mutation_fragment_opt _next_candidate;
     stdx::optional<position_in_partition> _last_position;
+    // Set by fast_forward_to(), fragments read before it are dropped.
+    stdx::optional<position_in_partition> _skip_to;
+    stdx::optional<promoted_index_skip_info> _skip_info;
     position_in_partition::less_compare _cmp;
     position_in_partition::equal_compare _eq;
 private:
+    // Returns false if the fragment read from the sstable is before _skip_to.
+    // Range tombstones which overlap with it are trimmed.
+    bool skip(mutation_fragment& mf) {
+        if (!_skip_to) {
+            return true;
+        }
+        if (mf.is_range_tombstone()) {
+            auto& rt = mf.as_range_tombstone();
+            if (!_cmp(*_skip_to, rt.end_bound())) {
+                return false;
+            }
+            if (_cmp(rt.start_bound(), *_skip_to)) {
+                auto start = _skip_to->as_start_bound_view();
+                rt.start = start.prefix;
+                rt.start_kind = start.kind;
+            }
+            return true;
+        }
+        if (_cmp(mf, *_skip_to)) {
+            return false;
+        }
+        _skip_to = { };
+        return true;
+    }
+
+    // Index of the first promoted index block which may contain pos.
+    size_t block_of(const position_in_partition& pos) const {
+        auto& blocks = _skip_info->pi.blocks;
+        auto it = std::find_if(blocks.begin(), blocks.end(), [&] (const promoted_index_block& blk) {
+            return !_cmp(bound_view(blk.end, bound_kind::incl_end), pos);
+        });
+        return it - blocks.begin();
+    }
+
+    // Starts reading from the promoted index block containing pos if it is
+    // past the one which is being read now.
+    void skip_blocks_to(const position_in_partition& pos) {
+        auto& info = *_skip_info;
+        auto current = _last_position ? std::max(info.first_block, block_of(*_last_position)) : info.first_block;
+        auto target = block_of(pos);
+        if (target <= current || target == info.pi.blocks.size()
+                || info.partition_start + info.pi.blocks[target].offset >= info.data_end) {
+            return;
+        }
+        info.first_block = target;
+        _ds = make_lw_shared<sstable_data_source>(_schema, info.sst, info.key, *info.pc, info.ck_filtering,
+                info.partition_start + info.pi.blocks[target].offset, info.data_end, sstable_data_source::partition_blocks_tag());
+        _ds->_consumer.consume_row_start(key_view(info.key), info.pi.del_time);
+        _ds->_consumer.get_mutation();
+        _last_position = pos;
+    }
     future<stdx::optional<mutation_fragment_opt>> read_next() {
         // Because of #1203 we may encounter sstables with range tombstones
         // placed earler than expected.
@@ -634,7 +829,7 @@ class sstable_streamed_mutation : public streamed_mutation::impl {
         return _ds->_context.read().then([this] {
             _finished = _ds->_consumer.get_and_reset_is_mutation_end();
             auto mf = _ds->_consumer.get_mutation_fragment();
-            if (mf) {
+            if (mf && skip(*mf)) {
                 if (mf->is_range_tombstone()) {
                     // If sstable uses promoted index it will repeat relevant range tombstones in
                     // each block. Do not emit these duplicates as they will break the guarantee
@@ -661,8 +856,10 @@ class sstable_streamed_mutation : public streamed_mutation::impl {
         });
     }
 public:
-    sstable_streamed_mutation(schema_ptr s, dht::decorated_key dk, tombstone t, lw_shared_ptr<sstable_data_source> ds)
-        : streamed_mutation::impl(s, std::move(dk), t), _ds(std::move(ds)), _t(t), _range_tombstones(*s), _cmp(*s), _eq(*s) { }
+    sstable_streamed_mutation(schema_ptr s, dht::decorated_key dk, tombstone t, lw_shared_ptr<sstable_data_source> ds,
+                              stdx::optional<promoted_index_skip_info> skip_info = { })
+        : streamed_mutation::impl(s, std::move(dk), t), _ds(std::move(ds)), _t(t), _range_tombstones(*s)
+        , _skip_info(std::move(skip_info)), _cmp(*s), _eq(*s) { }
 
     virtual future<> fill_buffer() final override {
         return do_until([this] { return is_end_of_stream() || is_buffer_full(); }, [this] {
@@ -678,16 +875,86 @@ class sstable_streamed_mutation : public streamed_mutation::impl {
         });
     }
 
+    virtual future<> fast_forward_to(position_range pr) override {
+        _range_end = pr.end();
+        forward_buffer_to(pr.start());
+        if (!_buffer.empty() && !_cmp(_buffer.back(), pr.start())) {
+            return make_ready_future<>();
+        }
+        _range_tombstones.forward_to(pr.start());
+        if (_current_candidate && is_before(*_current_candidate, pr.start())) {
+            _current_candidate = move_and_disengage(_next_candidate);
+        }
+        if (_current_candidate && is_before(*_current_candidate, pr.start())) {
+            _current_candidate = { };
+        }
+        if (_current_candidate) {
+            return make_ready_future<>();
+        }
+        if (_skip_info && !_finished) {
+            skip_blocks_to(pr.start());
+        }
+        _skip_to = pr.start();
+        return make_ready_future<>();
+    }
+
+    // Creates a streamed_mutation reading the partition at [start, end) in the data file.
+    // If the partition has a promoted index and only some clustering ranges are
+    // requested, reads only the blocks which may contain them.
     static future<streamed_mutation> create(schema_ptr s, shared_sstable sst, const sstables::key& k,
                                             query::clustering_key_filtering_context ck_filtering,
-                                            const io_priority_class& pc, uint64_t start, uint64_t end)
+                                            const io_priority_class& pc, uint64_t start, uint64_t end,
+                                            bytes_view promoted_index_bytes)
+    {
+        // Static cells are stored in the first block, so we can't skip it if
+        // there are any.
+        stdx::optional<promoted_index_skip_info> skip_info;
+        if (!promoted_index_bytes.empty() && s->clustering_key_size() && !s->has_static_columns()) {
+            auto pi = parse_promoted_index(*s, promoted_index_bytes);
+            auto pk = partition_key::from_exploded(*s, k.explode(*s));
+            auto pb = find_partition_blocks(*s, pi, ck_filtering.get_ranges(pk));
+            if (pb) {
+                auto data_end = pb->end ? start + *pb->end : end;
+                auto first_block = std::find_if(pi.blocks.begin(), pi.blocks.end(), [&] (const promoted_index_block& blk) {
+                    return blk.offset == pb->start;
+                }) - pi.blocks.begin();
+                auto ds = make_lw_shared<sstable_data_source>(s, sst, k, pc, ck_filtering, start + pb->start,
+                        data_end, sstable_data_source::partition_blocks_tag());
+                ds->_consumer.consume_row_start(key_view(k), pi.del_time);
+                auto mut = ds->_consumer.get_mutation();
+                assert(mut);
+                auto dk = dht::global_partitioner().decorate_key(*s, std::move(mut->key));
+                skip_info = promoted_index_skip_info{sst, k, ck_filtering, &pc, std::move(pi), start, data_end, size_t(first_block)};
+                return make_ready_future<streamed_mutation>(
+                        make_streamed_mutation<sstable_streamed_mutation>(s, std::move(dk), mut->tomb, ds, std::move(skip_info)));
+            }
+            skip_info = promoted_index_skip_info{sst, k, ck_filtering, &pc, std::move(pi), start, end, 0};
+        }
+        auto ds = make_lw_shared<sstable_data_source>(s, sst, k, pc, ck_filtering, start, end);
+        return ds->_context.read().then([s, ds, skip_info = std::move(skip_info)] () mutable {
+            auto mut = ds->_consumer.get_mutation();
+            assert(mut);
+            auto dk = dht::global_partitioner().decorate_key(*s, std::move(mut->key));
+            return make_streamed_mutation<sstable_streamed_mutation>(s, std::move(dk), mut->tomb, ds, std::move(skip_info));
+        });
+    }
+
+    // Like create(), for a position which may hold another partition than
+    // the one asked for, in which case nothing is returned.
+    static future<streamed_mutation_opt> create_if_key_matches(schema_ptr s, shared_sstable sst, const sstables::key& k,
+                                                               query::clustering_key_filtering_context ck_filtering,
+                                                               const io_priority_class& pc, uint64_t start, uint64_t end)
     {
         auto ds = make_lw_shared<sstable_data_source>(s, sst, k, pc, ck_filtering, start, end);
-        return ds->_context.read().then([s, ds] {
+        ds->_consumer.tolerate_key_mismatch();
+        return ds->_context.read().then([s, ds] () mutable {
+            if (ds->_consumer.key_mismatch()) {
+                return streamed_mutation_opt();
+            }
             auto mut = ds->_consumer.get_mutation();
             assert(mut);
             auto dk = dht::global_partitioner().decorate_key(*s, std::move(mut->key));
-            return make_streamed_mutation<sstable_streamed_mutation>(s, std::move(dk), mut->tomb, ds);
+            return streamed_mutation_opt(make_streamed_mutation<sstable_streamed_mutation>(s, std::move(dk), mut->tomb, ds));
         });
     }
 };
@@ -724,6 +991,46 @@ future<uint64_t> sstables::sstable::data_end_position(uint64_t summary_idx, cons
     });
 }
 
+std::experimental::optional<partition_lookup>
+sstables::sstable::lookup_partition(const schema& s, const sstables::key& key, const dht::token& token) {
+    auto& partitioner = dht::global_partitioner();
+    auto& summary = _summary;
+
+    if (token < partitioner.get_token(key_view(summary.first_key.value))
+            || token > partitioner.get_token(key_view(summary.last_key.value))) {
+        _filter_tracker.add_false_positive();
+        return { };
+    }
+
+    if (s.caching_options().key_cache_enabled()) {
+        auto cached = global_key_cache().lookup(_key_cache_owner.id(), bytes_view(key_view(key)));
+        if (cached) {
+            return partition_lookup{std::move(cached), -1};
+        }
+    }
+
+    if (_partition_index) {
+        return partition_lookup{{ }, -1, true};
+    }
+
+    auto summary_idx = adjust_binary_search_index(binary_search(summary.entries, key, token));
+    if (summary_idx < 0) {
+        _filter_tracker.add_false_positive();
+        return { };
+    }
+    return partition_lookup{{ }, summary_idx};
+}
+
+void sstables::sstable::prefetch_summary() const {
+    // The binary search starts in the middle of the summary.
+    auto& entries = _summary.entries;
+    if (!entries.empty()) {
+        auto& mid = entries[(entries.size() - 1) / 2];
+        __builtin_prefetch(&mid);
+        __builtin_prefetch(mid.key.data());
+    }
+}
+
 future<streamed_mutation_opt>
 sstables::sstable::read_row(schema_ptr schema,
                             const sstables::key& key,
@@ -732,28 +1039,87 @@ sstables::sstable::read_row(schema_ptr schema,
 
     assert(schema);
 
+    auto lookup_and_read = [this, &key, ck_filtering, &pc] (schema_ptr schema) {
+        auto token = dht::global_partitioner().get_token(key_view(key));
+        auto lookup = lookup_partition(*schema, key, token);
+        if (!lookup) {
+            return make_ready_future<streamed_mutation_opt>();
+        }
+        return read_row(std::move(schema), key, std::move(*lookup), ck_filtering, pc);
+    };
+
+    if (!_filter) {
+        // First read of an sstable with a lazily loaded filter, or one whose
+        // filter was evicted. Fault it in before the lookup.
+        return load_filter().then([this, schema = std::move(schema), &key, lookup_and_read = std::move(lookup_and_read)] () mutable {
+            if (_filter && !filter_has_key(key)) {
+                return make_ready_future<streamed_mutation_opt>();
+            }
+            return lookup_and_read(std::move(schema));
+        });
+    }
+
     if (!filter_has_key(key)) {
         return make_ready_future<streamed_mutation_opt>();
     }
+    return lookup_and_read(std::move(schema));
+}
 
-    auto& partitioner = dht::global_partitioner();
-    auto token = partitioner.get_token(key_view(key));
-
-    auto& summary = _summary;
-
-    if (token < partitioner.get_token(key_view(summary.first_key.value))
-            || token > partitioner.get_token(key_view(summary.last_key.value))) {
-        _filter_tracker.add_false_positive();
-        return make_ready_future<streamed_mutation_opt>();
+future<streamed_mutation_opt>
+sstables::sstable::read_row(schema_ptr schema,
+                            const sstables::key& key,
+                            partition_lookup lookup,
+                            query::clustering_key_filtering_context ck_filtering,
+                            const io_priority_class& pc,
+                            uint64_t* data_bytes) {
+    auto account = [data_bytes] (uint64_t position, uint64_t end) {
+        if (data_bytes) {
+            *data_bytes += end - position;
+        }
+    };
+    if (lookup.cached) {
+        _filter_tracker.add_true_positive();
+        auto& cached = *lookup.cached;
+        account(cached.start, cached.end);
+        return sstable_streamed_mutation::create(schema, shared_from_this(), key, ck_filtering, pc,
+                                                 cached.start, cached.end, bytes_view(cached.promoted_index)).then([] (auto sm) {
+            return streamed_mutation_opt(std::move(sm));
+        });
     }
 
-    auto summary_idx = adjust_binary_search_index(binary_search(summary.entries, key, token));
-    if (summary_idx < 0) {
-        _filter_tracker.add_false_positive();
-        return make_ready_future<streamed_mutation_opt>();
+    auto token = dht::global_partitioner().get_token(key_view(key));
+    auto use_key_cache = schema->caching_options().key_cache_enabled();
+    if (lookup.use_partition_index) {
+        // Sstables with a partition index have no promoted indexes, so the
+        // data file range is all there is to know about the partition.
+        auto trie_key = partition_index_key(token, bytes_view(key_view(key)));
+        return _partition_index->lookup(std::move(*trie_key), pc).then([this, schema, ck_filtering, &key, &pc, use_key_cache, account,
+                index = _partition_index] (auto entry) {
+            if (!entry) {
+                _filter_tracker.add_false_positive();
+                return make_ready_future<streamed_mutation_opt>();
+            }
+            auto position = entry->position;
+            auto end = entry->end;
+            return sstable_streamed_mutation::create_if_key_matches(schema, this->shared_from_this(), key, ck_filtering, pc,
+                                                                    position, end).then([this, &key, use_key_cache, account, position, end] (streamed_mutation_opt sm) {
+                if (!sm) {
+                    _filter_tracker.add_false_positive();
+                    return sm;
+                }
+                _filter_tracker.add_true_positive();
+                account(position, end);
+                if (use_key_cache) {
+                    global_key_cache().insert(_key_cache_owner.id(), bytes_view(key_view(key)), key_cache_position{position, end, bytes()});
+                }
+                return sm;
+            });
+        });
     }
 
-    return read_indexes(summary_idx, pc).then([this, schema, ck_filtering, &key, token, summary_idx, &pc] (auto index_list) {
+    auto summary_idx = lookup.summary_idx;
+    return read_indexes(summary_idx, pc).then([this, schema, ck_filtering, &key, token, summary_idx, &pc, use_key_cache, account,
+            guard = summary_guard(*this)] (auto index_list) {
         auto index_idx = this->binary_search(index_list, key, token);
         if (index_idx < 0) {
             _filter_tracker.add_false_positive();
@@ -762,8 +1128,15 @@ sstables::sstable::read_row(schema_ptr schema,
         _filter_tracker.add_true_positive();
 
         auto position = index_list[index_idx].position();
-        return this->data_end_position(summary_idx, index_idx, index_list, pc).then([&key, schema, ck_filtering, this, position, &pc] (uint64_t end) {
-            return sstable_streamed_mutation::create(schema, this->shared_from_this(), key, ck_filtering, pc, position, end).then([] (auto sm) {
+        auto promoted_index = to_bytes(index_list[index_idx].get_promoted_index_bytes());
+        return this->data_end_position(summary_idx, index_idx, index_list, pc).then([&key, schema, ck_filtering, this, position, &pc, use_key_cache, account,
+                promoted_index = std::move(promoted_index)] (uint64_t end) {
+            account(position, end);
+            if (use_key_cache) {
+                global_key_cache().insert(_key_cache_owner.id(), bytes_view(key_view(key)), key_cache_position{position, end, promoted_index});
+            }
+            return sstable_streamed_mutation::create(schema, this->shared_from_this(), key, ck_filtering, pc,
+                                                     position, end, bytes_view(promoted_index)).then([] (auto sm) {
                 return streamed_mutation_opt(std::move(sm));
             });
         });
@@ -913,7 +1286,7 @@ future<uint64_t> sstable::lower_bound(schema_ptr s, const dht::ring_position& po
 
     --summary_idx;
 
-    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_list il) {
+    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc, guard = summary_guard(*this)] (index_list il) {
         auto i = std::lower_bound(il.begin(), il.end(), pos, index_comparator(*s));
         if (i == il.end()) {
             return this->data_end_position(summary_idx, pc);
@@ -932,7 +1305,7 @@ future<uint64_t> sstable::upper_bound(schema_ptr s, const dht::ring_position& po
 
     --summary_idx;
 
-    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_list il) {
+    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc, guard = summary_guard(*this)] (index_list il) {
         auto i = std::upper_bound(il.begin(), il.end(), pos, index_comparator(*s));
         if (i == il.end()) {
             return this->data_end_position(summary_idx, pc);
@@ -983,6 +1356,8 @@ sstable::read_range_rows(schema_ptr schema,
 class key_reader final : public ::key_reader::impl {
     schema_ptr _s;
     shared_sstable _sst;
+    // Bucket ids are summary indexes.
+    sstable::summary_guard _summary_guard;
     index_list _bucket;
     int64_t _current_bucket_id;
     int64_t _end_bucket_id;
@@ -998,7 +1373,7 @@ class key_reader final : public ::key_reader::impl {
     }
 public:
     key_reader(schema_ptr s, shared_sstable sst, const query::partition_range& range, const io_priority_class& pc)
-        : _s(s), _sst(std::move(sst)), _range(range), _pc(pc)
+        : _s(s), _sst(std::move(sst)), _summary_guard(*_sst), _range(range), _pc(pc)
     {
         auto& summary = _sst->_summary;
         using summary_entries_type = std::decay_t<decltype(summary.entries)>;
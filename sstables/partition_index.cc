@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "partition_index.hh"
+#include "compact_format.hh"
+#include "exceptions.hh"
+#include "io_buffer_pool.hh"
+#include "core/do_with.hh"
+#include "core/future-util.hh"
+
+namespace sstables {
+
+// Node flags.
+static constexpr uint8_t has_payload = 1;
+static constexpr uint8_t has_check_byte = 2;
+static constexpr uint8_t has_children = 4;
+static constexpr unsigned offset_width_shift = 3;
+
+static constexpr uint64_t no_root = ~uint64_t(0);
+static constexpr uint64_t partition_index_magic = 0x5343594c4c415452; // "SCYLLATR"
+static constexpr size_t footer_size = 2 * sizeof(uint64_t);
+
+static void write_be(bytes_ostream& out, uint64_t value, unsigned width) {
+    auto p = out.write_place_holder(width);
+    for (unsigned i = 0; i < width; ++i) {
+        p[i] = int8_t(value >> (8 * (width - 1 - i)));
+    }
+}
+
+static uint64_t read_be(bytes_view& in, unsigned width) {
+    if (in.size() < width) {
+        throw malformed_sstable_exception("truncated partition index node");
+    }
+    uint64_t value = 0;
+    for (unsigned i = 0; i < width; ++i) {
+        value = (value << 8) | uint8_t(in[i]);
+    }
+    in.remove_prefix(width);
+    return value;
+}
+
+bool partition_index_supported() {
+    return dht::global_partitioner().name() == "org.apache.cassandra.dht.Murmur3Partitioner";
+}
+
+std::experimental::optional<bytes> partition_index_key(const dht::token& t, bytes_view key) {
+    if (!partition_index_supported() || t._kind != dht::token::kind::key || t._data.size() != sizeof(int64_t)) {
+        return { };
+    }
+    bytes k(bytes::initialized_later(), sizeof(int64_t) + key.size());
+    std::copy_n(t._data.begin(), sizeof(int64_t), k.begin());
+    // Tokens are signed, flip the sign bit so that they sort as unsigned bytes.
+    k[0] ^= int8_t(0x80);
+    std::copy(key.begin(), key.end(), k.begin() + sizeof(int64_t));
+    return std::move(k);
+}
+
+partition_index_writer::partition_index_writer(file_writer out)
+    : _out(std::move(out))
+{
+    _stack.emplace_back();
+}
+
+// Serializes a node which is to be written at given position.
+static bytes serialize_node(uint8_t flags_base, const std::vector<std::pair<uint8_t, uint64_t>>& children,
+        const std::experimental::optional<bytes>& payload, uint64_t pos) {
+    bytes_ostream out;
+    uint8_t flags = flags_base;
+    unsigned width_code = 0;
+    if (!children.empty()) {
+        flags |= has_children;
+        // Children are written first, so the first one is the farthest.
+        auto max_offset = pos - children.front().second;
+        while (width_code < 3 && max_offset >= (uint64_t(1) << (8 << width_code))) {
+            ++width_code;
+        }
+        flags |= width_code << offset_width_shift;
+    }
+    write_be(out, flags, 1);
+    if (!children.empty()) {
+        write_be(out, children.size() - 1, 1);
+        for (auto&& c : children) {
+            write_be(out, c.first, 1);
+        }
+        for (auto&& c : children) {
+            write_be(out, pos - c.second, 1 << width_code);
+        }
+    }
+    if (payload) {
+        out.write(*payload);
+    }
+    return to_bytes(out.linearize());
+}
+
+uint64_t partition_index_writer::write_node(const pending_node& n) {
+    uint8_t flags = 0;
+    std::experimental::optional<bytes> value;
+    if (n.value) {
+        bytes_ostream out;
+        flags |= has_payload;
+        if (n.value->has_check) {
+            flags |= has_check_byte;
+            write_be(out, n.value->check, 1);
+        }
+        compact::write_unsigned_vint(out, n.value->position);
+        compact::write_unsigned_vint(out, n.value->end - n.value->position);
+        value = to_bytes(out.linearize());
+    }
+
+    auto pos = _out.offset();
+    auto node = serialize_node(flags, n.children, value, pos);
+    // Don't let a node straddle pages, so that reading it costs one page.
+    if (pos / partition_index::page_size != (pos + node.size() - 1) / partition_index::page_size) {
+        auto padding = partition_index::page_size - pos % partition_index::page_size;
+        _out.write(bytes(padding, 0)).get();
+        pos += padding;
+        node = serialize_node(flags, n.children, value, pos);
+    }
+    _out.write(node).get();
+    return pos;
+}
+
+void partition_index_writer::pop_node() {
+    auto pos = write_node(_stack.back());
+    auto transition = _stack.back().transition;
+    _stack.pop_back();
+    _path.pop_back();
+    _stack.back().children.emplace_back(transition, pos);
+}
+
+void partition_index_writer::add_prefix(bytes_view key, size_t prefix_size, uint64_t position, uint64_t end) {
+    auto prefix = key.substr(0, prefix_size);
+    auto common = std::mismatch(_path.begin(), _path.end(), prefix.begin(), prefix.end()).first - _path.begin();
+    while (_stack.size() > size_t(common) + 1) {
+        pop_node();
+    }
+    for (auto b : prefix.substr(common)) {
+        _path.push_back(b);
+        _stack.emplace_back();
+        _stack.back().transition = uint8_t(b);
+    }
+    payload p;
+    p.has_check = prefix_size < key.size();
+    p.check = p.has_check ? uint8_t(key[prefix_size]) : 0;
+    p.position = position;
+    p.end = end;
+    _stack.back().value = p;
+}
+
+void partition_index_writer::add(bytes key, uint64_t position, uint64_t end) {
+    if (!_usable) {
+        return;
+    }
+    if (_last_key) {
+        if (compare_unsigned(*_last_key, key) >= 0) {
+            _usable = false;
+            return;
+        }
+        size_t common = std::mismatch(_last_key->begin(), _last_key->end(), key.begin(), key.end()).first - _last_key->begin();
+        add_prefix(*_last_key, std::min(std::max(_last_common, common) + 1, _last_key->size()), _last_position, _last_end);
+        _last_common = common;
+    }
+    _last_key = std::move(key);
+    _last_position = position;
+    _last_end = end;
+}
+
+void partition_index_writer::finish() {
+    uint64_t root = no_root;
+    if (_usable) {
+        if (_last_key) {
+            add_prefix(*_last_key, std::min(_last_common + 1, _last_key->size()), _last_position, _last_end);
+        }
+        while (_stack.size() > 1) {
+            pop_node();
+        }
+        root = write_node(_stack.back());
+    }
+    bytes_ostream footer;
+    write_be(footer, root, sizeof(uint64_t));
+    write_be(footer, partition_index_magic, sizeof(uint64_t));
+    _out.write(to_bytes(footer.linearize())).get();
+    _out.close().get();
+}
+
+future<lw_shared_ptr<partition_index>> partition_index::open(file f, const io_priority_class& pc) {
+    return f.size().then([f, &pc] (uint64_t size) mutable {
+        if (size < footer_size) {
+            throw malformed_sstable_exception("partition index too short");
+        }
+        return f.dma_read_exactly<char>(size - footer_size, footer_size, pc).then([f, size, &pc] (temporary_buffer<char> buf) mutable {
+            bytes_view in(reinterpret_cast<const int8_t*>(buf.get()), buf.size());
+            auto root = read_be(in, sizeof(uint64_t));
+            if (read_be(in, sizeof(uint64_t)) != partition_index_magic) {
+                throw malformed_sstable_exception("bad partition index footer");
+            }
+            if (root == no_root) {
+                return make_ready_future<lw_shared_ptr<partition_index>>();
+            }
+            if (root >= size - footer_size) {
+                throw malformed_sstable_exception("partition index root out of bounds");
+            }
+            auto page_start = root - root % page_size;
+            auto len = std::min<uint64_t>(page_size, size - page_start);
+            return f.dma_read_exactly<char>(page_start, len, pc).then([f, root, page_start] (temporary_buffer<char> page) mutable {
+                return make_lw_shared<partition_index>(std::move(f), root, page_start, std::move(page));
+            });
+        });
+    });
+}
+
+namespace {
+
+struct trie_walk {
+    bytes key;
+    uint64_t pos;
+    size_t depth = 0;
+    uint64_t page_start = no_root;
+    temporary_buffer<char> page;
+    std::experimental::optional<partition_index::entry> result;
+
+    // Steps into the node at pos, which has to be in the current page.
+    stop_iteration step() {
+        auto offset = pos - page_start;
+        if (offset >= page.size()) {
+            throw malformed_sstable_exception("partition index node out of bounds");
+        }
+        bytes_view in(reinterpret_cast<const int8_t*>(page.get()) + offset, page.size() - offset);
+        auto flags = read_be(in, 1);
+        if (flags & has_children) {
+            size_t count = read_be(in, 1) + 1;
+            unsigned width = 1 << ((flags >> offset_width_shift) & 3);
+            if (in.size() < count) {
+                throw malformed_sstable_exception("truncated partition index node");
+            }
+            auto transitions = in.substr(0, count);
+            in.remove_prefix(count);
+            if (depth < key.size()) {
+                auto b = uint8_t(key[depth]);
+                auto i = std::lower_bound(transitions.begin(), transitions.end(), b, [] (int8_t t, uint8_t b) {
+                    return uint8_t(t) < b;
+                });
+                if (i != transitions.end() && uint8_t(*i) == b) {
+                    in.remove_prefix((i - transitions.begin()) * width);
+                    auto child_offset = read_be(in, width);
+                    if (child_offset == 0 || child_offset > pos) {
+                        throw malformed_sstable_exception("bad partition index child offset");
+                    }
+                    pos -= child_offset;
+                    ++depth;
+                    return stop_iteration::no;
+                }
+            }
+            in.remove_prefix(count * width);
+        }
+        if (flags & has_payload) {
+            bool match;
+            if (flags & has_check_byte) {
+                auto check = read_be(in, 1);
+                match = depth < key.size() && uint8_t(key[depth]) == check;
+            } else {
+                match = depth == key.size();
+            }
+            if (match) {
+                auto position = compact::read_unsigned_vint(in);
+                auto size = compact::read_unsigned_vint(in);
+                result = partition_index::entry{position, position + size};
+            }
+        }
+        return stop_iteration::yes;
+    }
+};
+
+}
+
+future<std::experimental::optional<partition_index::entry>> partition_index::lookup(bytes key, const io_priority_class& pc) {
+    trie_walk w;
+    w.key = std::move(key);
+    w.pos = _root;
+    return do_with(std::move(w), [this, &pc] (trie_walk& w) {
+        return repeat([this, &w, &pc] {
+            auto page_start = w.pos - w.pos % page_size;
+            auto step = [&w] { return w.step(); };
+            if (page_start == w.page_start) {
+                return futurize<stop_iteration>::apply(step);
+            }
+            w.page_start = page_start;
+            if (page_start == _root_page_start) {
+                w.page = _root_page.share();
+                return futurize<stop_iteration>::apply(step);
+            }
+            return pooled_dma_read(_file, page_start, page_size, pc).then([&w] (temporary_buffer<char> page) {
+                w.page = std::move(page);
+                return w.step();
+            });
+        }).then([&w] {
+            return w.result;
+        });
+    });
+}
+
+}
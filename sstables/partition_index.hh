@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <vector>
+#include "core/file.hh"
+#include "core/shared_ptr.hh"
+#include "core/temporary_buffer.hh"
+#include "bytes.hh"
+#include "dht/i_partitioner.hh"
+#include "writer.hh"
+
+namespace sstables {
+
+// The PartitionIndex component: a byte-ordered trie mapping the partitions
+// of an sstable to their place in the data file.
+//
+// The trie's keys are the partition's token, as 8 bytes which sort like the
+// token itself, followed by the partition key. Every partition is stored
+// under the shortest prefix of its trie key which isn't a prefix of its
+// neighbours' keys, so for random tokens there are about log256(partitions)
+// levels and the trie is a fraction of the size of the index and summary.
+// A lookup walks down the trie comparing single bytes and reaches at most
+// one candidate partition. A key which isn't in the sstable may lead to the
+// partition sharing its prefix, which is why leaves also hold the byte
+// following their prefix, and why the caller still has to check the key
+// found in the data file.
+//
+// Nodes are written in post-order, children before their parent, without
+// crossing a page boundary, so that a subtree lies in few pages. The root is
+// written last, followed by a footer with its position. The page holding the
+// root is kept in memory, so a lookup reads one or two pages.
+class partition_index {
+public:
+    static constexpr size_t page_size = 4096;
+
+    struct entry {
+        uint64_t position;
+        uint64_t end;
+    };
+private:
+    file _file;
+    uint64_t _root;
+    uint64_t _root_page_start;
+    temporary_buffer<char> _root_page;
+public:
+    partition_index(file f, uint64_t root, uint64_t root_page_start, temporary_buffer<char> root_page)
+        : _file(std::move(f))
+        , _root(root)
+        , _root_page_start(root_page_start)
+        , _root_page(std::move(root_page))
+    { }
+
+    // Returns nothing if the file has no usable trie, in which case lookups
+    // have to go through the summary and the index.
+    static future<lw_shared_ptr<partition_index>> open(file f, const io_priority_class& pc);
+
+    // Looks up the candidate partition for given trie key.
+    future<std::experimental::optional<entry>> lookup(bytes key, const io_priority_class& pc);
+
+    size_t memory_footprint() const {
+        return sizeof(*this) + _root_page.size();
+    }
+};
+
+// Whether the tokens of the partitioner in use can be put in byte order, which
+// is what the trie needs. Only true for murmur3.
+bool partition_index_supported();
+
+// Returns the trie key of a partition, or nothing if the partitioner isn't
+// supported.
+std::experimental::optional<bytes> partition_index_key(const dht::token& t, bytes_view key);
+
+// Builds the trie from partitions given in data file order.
+class partition_index_writer {
+    struct payload {
+        bool has_check;
+        uint8_t check;
+        uint64_t position;
+        uint64_t end;
+    };
+    struct pending_node {
+        uint8_t transition;
+        std::vector<std::pair<uint8_t, uint64_t>> children;
+        std::experimental::optional<payload> value;
+    };
+
+    file_writer _out;
+    // Nodes on the path to the last prefix added, starting with the root.
+    std::vector<pending_node> _stack;
+    std::vector<int8_t> _path;
+    // The last partition is only added once the next one tells how long
+    // its prefix has to be.
+    std::experimental::optional<bytes> _last_key;
+    uint64_t _last_position = 0;
+    uint64_t _last_end = 0;
+    size_t _last_common = 0;
+    // Cleared if the keys turn out not to be in byte order, which may only
+    // happen for a token collision; the trie isn't used then.
+    bool _usable = true;
+private:
+    void add_prefix(bytes_view key, size_t prefix_size, uint64_t position, uint64_t end);
+    uint64_t write_node(const pending_node& n);
+    void pop_node();
+public:
+    explicit partition_index_writer(file_writer out);
+
+    void add(bytes key, uint64_t position, uint64_t end);
+    // Partitions which have no trie key make the trie unusable.
+    void invalidate() {
+        _usable = false;
+    }
+    void finish();
+};
+
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "read_sizes.hh"
+#include <map>
+#include <seastar/core/scollectd.hh>
+
+namespace sstables {
+
+constexpr uint32_t table_read_sizes::min_chunk_length;
+constexpr uint32_t table_read_sizes::max_chunk_length;
+constexpr uint64_t table_read_sizes::min_reads;
+constexpr unsigned table_read_sizes::bucket_count;
+constexpr uint64_t table_read_sizes::decay_threshold;
+
+namespace {
+
+class read_sizes_registry {
+    std::map<std::pair<sstring, sstring>, lw_shared_ptr<table_read_sizes>> _tables;
+    std::vector<scollectd::registration> _collectd_registrations;
+public:
+    uint64_t bytes_decompressed = 0;
+    uint64_t bytes_returned = 0;
+
+    read_sizes_registry() {
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "chunks_decompressed")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, bytes_decompressed)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "total_bytes", "decompressed_returned")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, bytes_returned)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("sstables"
+                , scollectd::per_cpu_plugin_instance
+                , "ratio", "decompressed_to_returned")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                    return bytes_returned ? double(bytes_decompressed) / bytes_returned : 0.0;
+                })
+        ));
+    }
+
+    lw_shared_ptr<table_read_sizes> get(const sstring& ks_name, const sstring& cf_name) {
+        auto& sizes = _tables[std::make_pair(ks_name, cf_name)];
+        if (!sizes) {
+            sizes = make_lw_shared<table_read_sizes>();
+        }
+        return sizes;
+    }
+};
+
+read_sizes_registry& local_registry() {
+    static thread_local read_sizes_registry registry;
+    return registry;
+}
+
+}
+
+void table_read_sizes::add_read(uint64_t bytes_returned, uint64_t bytes_decompressed) {
+    if (!bytes_returned) {
+        return;
+    }
+    auto bucket = std::min<unsigned>(63 - __builtin_clzll(bytes_returned), bucket_count - 1);
+    ++_buckets[bucket];
+    if (++_reads == decay_threshold) {
+        _reads = 0;
+        for (auto& b : _buckets) {
+            b /= 2;
+            _reads += b;
+        }
+    }
+    _bytes_decompressed += bytes_decompressed;
+    _bytes_returned += bytes_returned;
+    auto& registry = local_registry();
+    registry.bytes_decompressed += bytes_decompressed;
+    registry.bytes_returned += bytes_returned;
+}
+
+uint32_t table_read_sizes::chunk_length(uint32_t default_chunk_length) const {
+    if (_reads < min_reads) {
+        return default_chunk_length;
+    }
+    uint64_t count = 0;
+    unsigned bucket = 0;
+    while (bucket < bucket_count - 1 && count + _buckets[bucket] < (_reads + 1) / 2) {
+        count += _buckets[bucket++];
+    }
+    // The smallest power of two which holds all reads of the median bucket.
+    auto length = uint64_t(1) << (bucket + 1);
+    return std::max<uint64_t>(min_chunk_length, std::min<uint64_t>(max_chunk_length, length));
+}
+
+lw_shared_ptr<table_read_sizes> local_table_read_sizes(const sstring& ks_name, const sstring& cf_name) {
+    return local_registry().get(ks_name, cf_name);
+}
+
+}
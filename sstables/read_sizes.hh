@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "core/shared_ptr.hh"
+#include "core/sstring.hh"
+
+namespace sstables {
+
+// Distribution of the sizes of reads from compressed data files of a table,
+// by the number of uncompressed bytes the reads returned.
+//
+// Used to choose the compression chunk length of new sstables of tables with
+// chunk_length_kb set to "auto": point reads of small partitions are best
+// served by small chunks, which keep decompression of bytes the read doesn't
+// need low, scans by large ones, which compress better.
+//
+// Only the reads of the table's shard are accounted, and only those done for
+// queries; compaction and streaming read everything once whatever the chunk
+// length is.
+class table_read_sizes {
+public:
+    static constexpr uint32_t min_chunk_length = 4 * 1024;
+    static constexpr uint32_t max_chunk_length = 64 * 1024;
+    // Tables with fewer reads accounted than that get the default chunk length.
+    static constexpr uint64_t min_reads = 128;
+private:
+    // Bucket i counts reads of [2^i, 2^(i+1)) bytes, the last one of larger.
+    static constexpr unsigned bucket_count = 32;
+    // Counts are halved each time their total reaches that, so they follow
+    // changes of the workload.
+    static constexpr uint64_t decay_threshold = 1 << 16;
+
+    std::array<uint64_t, bucket_count> _buckets{};
+    uint64_t _reads = 0;
+    uint64_t _bytes_decompressed = 0;
+    uint64_t _bytes_returned = 0;
+public:
+    // Accounts a read which returned given amount of uncompressed data, out of
+    // bytes_decompressed bytes of chunks it had to decompress.
+    void add_read(uint64_t bytes_returned, uint64_t bytes_decompressed);
+
+    // Returns the power of two between min_chunk_length and max_chunk_length
+    // which covers the median read, or default_chunk_length if there were
+    // too few reads to tell.
+    uint32_t chunk_length(uint32_t default_chunk_length) const;
+
+    uint64_t bytes_decompressed() const { return _bytes_decompressed; }
+    uint64_t bytes_returned() const { return _bytes_returned; }
+};
+
+// Returns the read size distribution of given table on this shard.
+lw_shared_ptr<table_read_sizes> local_table_read_sizes(const sstring& ks_name, const sstring& cf_name);
+
+}
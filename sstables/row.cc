@@ -21,6 +21,7 @@
 
 #include "sstables.hh"
 #include "consumer.hh"
+#include "compact_format.hh"
 
 namespace sstables {
 
@@ -51,6 +52,10 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
         RANGE_TOMBSTONE_3,
         RANGE_TOMBSTONE_4,
         RANGE_TOMBSTONE_5,
+        COMPACT_ATOM_START,
+        COMPACT_ATOM_START_2,
+        COMPACT_ATOM_BODY,
+        COMPACT_ATOM,
     } _state = state::ROW_START;
 
     row_consumer& _consumer;
@@ -62,6 +67,77 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
     bool _deleted;
     uint32_t _ttl, _expiration;
 
+    // True if the input starts inside of a partition, at a cell boundary,
+    // and may end before the end of it.
+    bool _inside_partition = false;
+
+    // Set for sstables of the compact format, whose atoms are decoded from
+    // _val once read whole.
+    const serialization_header* _header;
+    bytes_view _atom;
+    bytes_view _prefix;
+    bytes _name;
+private:
+    state atom_start_state() const {
+        return _header ? state::COMPACT_ATOM_START : state::ATOM_START;
+    }
+
+    // Decodes the atom in _val. Cells are handed to the consumer one at a
+    // time, until it asks to stop or the atom is exhausted.
+    row_consumer::proceed consume_compact_atom() {
+        while (!_atom.empty()) {
+            auto ret = consume_compact_cell();
+            if (ret == row_consumer::proceed::no) {
+                return ret;
+            }
+        }
+        return row_consumer::proceed::yes;
+    }
+
+    row_consumer::proceed consume_compact_cell() {
+        using namespace compact;
+        uint8_t flags = _atom.front();
+        _atom.remove_prefix(1);
+        auto idx = read_unsigned_vint(_atom);
+        if (idx >= _header->columns.elements.size()) {
+            throw malformed_sstable_exception(sprint("column index %d out of range of the serialization header", idx));
+        }
+        bytes_view column = _header->columns.elements[idx].value;
+        bytes_view extra;
+        if (flags & cell_flags::has_extra) {
+            extra = read_blob(_atom);
+        }
+        _name = bytes(bytes::initialized_later(), _prefix.size() + column.size() + extra.size());
+        auto out = std::copy(_prefix.begin(), _prefix.end(), _name.begin());
+        out = std::copy(column.begin(), column.end(), out);
+        std::copy(extra.begin(), extra.end(), out);
+
+        int64_t timestamp = _header->timestamp_base + read_signed_vint(_atom);
+        if (flags & cell_flags::deleted) {
+            deletion_time del;
+            del.local_deletion_time = _header->local_deletion_time_base + read_signed_vint(_atom);
+            del.marked_for_delete_at = timestamp;
+            return _consumer.consume_deleted_cell(bytes_view(_name), del);
+        }
+        uint32_t ttl = 0;
+        uint32_t expiration = 0;
+        if (flags & cell_flags::expiring) {
+            ttl = read_unsigned_vint(_atom);
+            expiration = _header->local_deletion_time_base + read_signed_vint(_atom);
+        }
+        auto value = read_blob(_atom);
+        return _consumer.consume_cell(bytes_view(_name), value, timestamp, ttl, expiration);
+    }
+
+    row_consumer::proceed consume_compact_range_tombstone() {
+        auto start = compact::read_blob(_atom);
+        auto end = compact::read_blob(_atom);
+        deletion_time del;
+        del.marked_for_delete_at = _header->timestamp_base + compact::read_signed_vint(_atom);
+        del.local_deletion_time = _header->local_deletion_time_base + compact::read_signed_vint(_atom);
+        _atom = bytes_view();
+        return _consumer.consume_range_tombstone(start, end, del);
+    }
 
 public:
     bool non_consuming() const {
@@ -69,7 +145,10 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
                 || (_state == state::CELL_VALUE_BYTES_2)
                 || (_state == state::ATOM_START_2)
                 || (_state == state::ATOM_MASK_2)
-                || (_state == state::EXPIRING_CELL_3)) && (_prestate == prestate::NONE));
+                || (_state == state::EXPIRING_CELL_3)
+                || (_state == state::COMPACT_ATOM_START_2)
+                || (_state == state::COMPACT_ATOM_BODY)
+                || (_state == state::COMPACT_ATOM)) && (_prestate == prestate::NONE));
     }
 
     // process() feeds the given data into the state machine.
@@ -128,10 +207,13 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
             // after calling the consume function, we can release the
             // buffers we held for it.
             _key.release();
-            _state = state::ATOM_START;
+            _state = atom_start_state();
             if (ret == row_consumer::proceed::no) {
                 return row_consumer::proceed::no;
             }
+            if (_header) {
+                break;
+            }
         }
         case state::ATOM_START:
             if (read_16(data) == read_status::ready) {
@@ -319,6 +401,57 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
             }
             break;
         }
+        case state::COMPACT_ATOM_START:
+            if (read_32(data) != read_status::ready) {
+                _state = state::COMPACT_ATOM_START_2;
+                break;
+            }
+        case state::COMPACT_ATOM_START_2:
+            if (_u32 == 0) {
+                // end of row marker
+                _state = state::ROW_START;
+                if (_consumer.consume_row_end() ==
+                        row_consumer::proceed::no) {
+                    return row_consumer::proceed::no;
+                }
+                break;
+            }
+            if (read_bytes(data, _u32, _val) != read_status::ready) {
+                _state = state::COMPACT_ATOM_BODY;
+                break;
+            }
+        case state::COMPACT_ATOM_BODY: {
+            _atom = to_bytes_view(_val);
+            if (_atom.empty()) {
+                throw malformed_sstable_exception("empty compact atom");
+            }
+            auto kind = compact::atom_kind(_atom.front());
+            _atom.remove_prefix(1);
+            if (kind == compact::atom_kind::range_tombstone) {
+                auto ret = consume_compact_range_tombstone();
+                _val.release();
+                _state = state::COMPACT_ATOM_START;
+                if (ret == row_consumer::proceed::no) {
+                    return row_consumer::proceed::no;
+                }
+                break;
+            } else if (kind != compact::atom_kind::cells) {
+                throw malformed_sstable_exception(sprint("unknown compact atom kind %d", int(kind)));
+            }
+            _prefix = compact::read_blob(_atom);
+            _state = state::COMPACT_ATOM;
+        }
+        case state::COMPACT_ATOM: {
+            auto ret = consume_compact_atom();
+            if (_atom.empty()) {
+                _val.release();
+                _state = state::COMPACT_ATOM_START;
+            }
+            if (ret == row_consumer::proceed::no) {
+                return row_consumer::proceed::no;
+            }
+            break;
+        }
         default:
             throw malformed_sstable_exception("unknown state");
         }
@@ -327,12 +460,28 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
     }
 
     data_consume_rows_context(row_consumer& consumer,
-            input_stream<char> && input, uint64_t maxlen) :
+            input_stream<char> && input, uint64_t maxlen, const serialization_header* header) :
+            continuous_data_consumer(std::move(input), maxlen)
+            , _consumer(consumer)
+            , _header(header) {
+    }
+
+    struct inside_partition_tag { };
+    data_consume_rows_context(row_consumer& consumer,
+            input_stream<char> && input, uint64_t maxlen, const serialization_header* header, inside_partition_tag) :
             continuous_data_consumer(std::move(input), maxlen)
-            , _consumer(consumer) {
+            , _consumer(consumer)
+            , _inside_partition(true)
+            , _header(header) {
+        _state = atom_start_state();
     }
 
     void verify_end_state() {
+        if (_inside_partition && _state == atom_start_state() && _prestate == prestate::NONE) {
+            // The input ended at a cell boundary before the end of partition.
+            _state = state::ROW_START;
+            _consumer.consume_row_end();
+        }
         if (_state != state::ROW_START || _prestate != prestate::NONE) {
             throw malformed_sstable_exception("end of input, but not end of row");
         }
@@ -351,7 +500,12 @@ class data_consume_context::impl {
 public:
     impl(shared_sstable sst, row_consumer& consumer, input_stream<char>&& input, uint64_t maxlen)
         : _sst(std::move(sst))
-        , _ctx(new data_consume_rows_context(consumer, std::move(input), maxlen))
+        , _ctx(new data_consume_rows_context(consumer, std::move(input), maxlen, _sst->get_serialization_header()))
+    { }
+    impl(shared_sstable sst, row_consumer& consumer, input_stream<char>&& input, uint64_t maxlen,
+         data_consume_rows_context::inside_partition_tag tag)
+        : _sst(std::move(sst))
+        , _ctx(new data_consume_rows_context(consumer, std::move(input), maxlen, _sst->get_serialization_header(), tag))
     { }
     ~impl() {
         if (_ctx) {
@@ -388,15 +542,22 @@ data_consume_context sstable::data_consume_rows(
             consumer, data_stream(start, end - start, consumer.io_priority()), end - start);
 }
 
+data_consume_context sstable::data_consume_partition_blocks(
+        row_consumer& consumer, uint64_t start, uint64_t end) {
+    return std::make_unique<data_consume_context::impl>(shared_from_this(),
+            consumer, data_stream(start, end - start, consumer.io_priority()), end - start,
+            data_consume_rows_context::inside_partition_tag());
+}
+
 data_consume_context sstable::data_consume_rows(row_consumer& consumer) {
     return data_consume_rows(consumer, 0, data_size());
 }
 
 future<> sstable::data_consume_rows_at_once(row_consumer& consumer,
         uint64_t start, uint64_t end) {
-    return data_read(start, end - start, consumer.io_priority()).then([&consumer]
+    return data_read(start, end - start, consumer.io_priority()).then([this, &consumer]
                                                (temporary_buffer<char> buf) {
-        data_consume_rows_context ctx(consumer, input_stream<char>(), -1);
+        data_consume_rows_context ctx(consumer, input_stream<char>(), -1, get_serialization_header());
         ctx.process(buf);
         ctx.verify_end_state();
     });
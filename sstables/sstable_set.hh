@@ -23,18 +23,36 @@
 
 #include "sstables.hh"
 #include "query-request.hh" // for partition_range; FIXME: move it out of there
+#include "timestamp.hh"
 #include <seastar/core/shared_ptr.hh>
+#include <unordered_map>
 #include <vector>
 
 namespace sstables {
 
 class sstable_set_impl;
 
+// What a select_for_key() call looked at.
+struct key_selection_stats {
+    // Sstables whose range covers the key.
+    unsigned checked = 0;
+    // Those of them whose filter passed.
+    unsigned filter_passed = 0;
+};
+
 class sstable_set {
     std::unique_ptr<sstable_set_impl> _impl;
     // used to support column_family::get_sstable(), which wants to return an sstable_list
     // that has a reference somewhere
     lw_shared_ptr<sstable_list> _all;
+    // Sstables which are being compacted and whose data up to, and including,
+    // some key is already readable from an early opened compaction output.
+    // Reads skip that part of them. Shared with copies, like _all.
+    using read_starts = std::unordered_map<shared_sstable, dht::decorated_key>;
+    lw_shared_ptr<read_starts> _read_starts;
+private:
+    void unshare_all();
+    void unshare_read_starts();
 public:
     ~sstable_set();
     sstable_set(std::unique_ptr<sstable_set_impl> impl, lw_shared_ptr<sstable_list> all);
@@ -43,9 +61,27 @@ class sstable_set {
     sstable_set& operator=(const sstable_set&);
     sstable_set& operator=(sstable_set&&) noexcept;
     std::vector<shared_sstable> select(const query::partition_range& range) const;
+    // Returns sstables which may hold data of the range written with a
+    // timestamp in [min_timestamp, max_timestamp].
+    std::vector<shared_sstable> select(const query::partition_range& range,
+            api::timestamp_type min_timestamp, api::timestamp_type max_timestamp) const;
+    // Returns sstables which may contain the partition with given key, each
+    // with the result of its lookup_partition(). The key is hashed once for
+    // the filters of all sstables, and the summaries are only searched in
+    // sstables whose filter passed.
+    // Sstables whose read start is at or past rp are not returned.
+    std::vector<std::pair<shared_sstable, partition_lookup>> select_for_key(const schema& s, const dht::ring_position& rp, const key& k,
+            key_selection_stats* stats = nullptr) const;
     lw_shared_ptr<sstable_list> all() const { return _all; }
     void insert(shared_sstable sst);
     void erase(shared_sstable sst);
+    // Only partitions past dk are to be read from sst, the ones up to dk
+    // having been written to an early opened compaction output.
+    void set_read_start(shared_sstable sst, dht::decorated_key dk);
+    void clear_read_start(shared_sstable sst);
+    // Returns the key partitions of sst have to be past to be read from
+    // it, or nullptr if all of it is to be read.
+    const dht::decorated_key* read_start(const shared_sstable& sst) const;
 };
 
 }
@@ -34,16 +34,20 @@
 #include <iterator>
 
 #include "types.hh"
+#include "service/priority_manager.hh"
 #include "sstables.hh"
 #include "compress.hh"
+#include "adaptive_input_stream.hh"
 #include "unimplemented.hh"
 #include "index_reader.hh"
 #include "remove.hh"
 #include "memtable.hh"
 #include "range.hh"
 #include "downsampling.hh"
+#include "trickle_fsync_file.hh"
 #include <boost/filesystem/operations.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/algorithm_ext/insert.hpp>
@@ -83,6 +87,14 @@ static utils::phased_barrier& background_jobs() {
     return gate;
 }
 
+static thread_local uint64_t large_partition_threshold = 0;
+static thread_local large_partition_handler large_partition_reporter;
+
+void set_large_partition_handler(uint64_t threshold, large_partition_handler handler) {
+    large_partition_threshold = threshold;
+    large_partition_reporter = std::move(handler);
+}
+
 future<> await_background_jobs() {
     sstlog.debug("Waiting for background jobs");
     return background_jobs().advance_and_await().finally([] {
@@ -142,7 +154,8 @@ class file_random_access_reader : public random_access_reader {
 
 std::unordered_map<sstable::version_types, sstring, enum_hash<sstable::version_types>> sstable::_version_string = {
     { sstable::version_types::ka , "ka" },
-    { sstable::version_types::la , "la" }
+    { sstable::version_types::la , "la" },
+    { sstable::version_types::sa , "sa" }
 };
 
 std::unordered_map<sstable::format_types, sstring, enum_hash<sstable::format_types>> sstable::_format_string = {
@@ -152,6 +165,12 @@ std::unordered_map<sstable::format_types, sstring, enum_hash<sstable::format_typ
 static const sstring TOC_SUFFIX = "TOC.txt";
 static const sstring TEMPORARY_TOC_SUFFIX = "TOC.txt.tmp";
 
+// Number of buffers of the data and index files which may be written to disk
+// concurrently. While they are, the writer goes on serializing, compressing
+// and checksumming the next ones, instead of waiting for each write before
+// producing more data.
+static constexpr unsigned sstable_write_behind = 4;
+
 // FIXME: this should be version-dependent
 std::unordered_map<sstable::component_type, sstring, enum_hash<sstable::component_type>> sstable::_component_map = {
     { component_type::Index, "Index.db"},
@@ -165,6 +184,9 @@ std::unordered_map<sstable::component_type, sstring, enum_hash<sstable::componen
     { component_type::Statistics, "Statistics.db" },
     { component_type::TemporaryTOC, TEMPORARY_TOC_SUFFIX },
     { component_type::TemporaryStatistics, "Statistics.db.tmp" },
+    { component_type::CompressionDictionary, "CompressionDictionary.db" },
+    { component_type::ClusteringBounds, "ClusteringBounds.db" },
+    { component_type::PartitionIndex, "Partitions.db" },
 };
 
 // This assumes that the mappings are small enough, and called unfrequent
@@ -605,6 +627,8 @@ future<> parse(random_access_reader& in, statistics& s) {
                     return parse<compaction_metadata>(in, s.contents[val.first]);
                 case metadata_type::Stats:
                     return parse<stats_metadata>(in, s.contents[val.first]);
+                case metadata_type::Serialization:
+                    return parse<serialization_header>(in, s.contents[val.first]);
                 default:
                     sstlog.warn("Invalid metadata type at Statistics file: {} ", int(val.first));
                     return make_ready_future<>();
@@ -639,6 +663,9 @@ inline void write(file_writer& out, statistics& s) {
             case metadata_type::Stats:
                 write<stats_metadata>(out, s.contents[val.key]);
                 break;
+            case metadata_type::Serialization:
+                write<serialization_header>(out, s.contents[val.key]);
+                break;
             default:
                 sstlog.warn("Invalid metadata type at Statistics file: {} ", int(val.key));
                 return; // FIXME: should throw
@@ -756,7 +783,7 @@ future<> sstable::read_toc() {
 
 }
 
-void sstable::generate_toc(compressor c, double filter_fp_chance) {
+void sstable::generate_toc(const compression_parameters& cp, double filter_fp_chance) {
     // Creating table of components.
     _components.insert(component_type::TOC);
     _components.insert(component_type::Statistics);
@@ -767,11 +794,18 @@ void sstable::generate_toc(compressor c, double filter_fp_chance) {
     if (filter_fp_chance != 1.0) {
         _components.insert(component_type::Filter);
     }
-    if (c == compressor::none) {
+    if (cp.get_compressor() == compressor::none) {
         _components.insert(component_type::CRC);
     } else {
         _components.insert(component_type::CompressionInfo);
     }
+    if (cp.get_compressor() == compressor::zstd && cp.dictionary_size()) {
+        _components.insert(component_type::CompressionDictionary);
+    }
+    _components.insert(component_type::ClusteringBounds);
+    if (_version == version_types::sa && partition_index_supported()) {
+        _components.insert(component_type::PartitionIndex);
+    }
 }
 
 void sstable::write_toc(const io_priority_class& pc) {
@@ -876,6 +910,7 @@ future<index_list> sstable::read_indexes(uint64_t summary_idx, const io_priority
         return make_ready_future<index_list>(index_list());
     }
 
+    ++_index_reads;
     uint64_t position = _summary.entries[summary_idx].position;
     uint64_t quantity = downsampling::get_effective_index_interval_after_index(summary_idx, _summary.header.sampling_level,
         _summary.header.min_index_interval);
@@ -888,10 +923,12 @@ future<index_list> sstable::read_indexes(uint64_t summary_idx, const io_priority
     }
 
     return do_with(index_consumer(quantity), [this, position, end, &pc] (index_consumer& ic) {
-        file_input_stream_options options;
-        options.buffer_size = sstable_buffer_size;
+        // The whole index page is needed, read it at once.
+        adaptive_read_options options;
+        options.initial_buffer_size = end - position;
+        options.max_buffer_size = std::max(sstable_buffer_size, size_t(end - position));
         options.io_priority_class = pc;
-        auto stream = make_file_input_stream(this->_index_file, position, end - position, std::move(options));
+        auto stream = make_adaptive_file_input_stream(this->_index_file, position, end - position, std::move(options));
         // TODO: it's redundant to constrain the consumer here to stop at
         // index_size()-position, the input stream is already constrained.
         auto ctx = make_lw_shared<index_consume_entry_context<index_consumer>>(ic, std::move(stream), this->index_size() - position);
@@ -910,11 +947,19 @@ future<> sstable::read_simple(T& component, const io_priority_class& pc) {
     sstlog.debug(("Reading " + _component_map[Type] + " file {} ").c_str(), file_path);
     return open_file_dma(file_path, open_flags::ro).then([this, &component] (file fi) {
         auto f = make_checked_file(sstable_read_error, fi);
-        auto r = make_lw_shared<file_random_access_reader>(std::move(f), sstable_buffer_size);
-        auto fut = parse(*r, component);
-        return fut.finally([r = std::move(r)] {
-            return r->close();
-        }).then([r] {});
+        return f.size().then([this, f, &component] (uint64_t size) mutable {
+            // Components small enough are read with a single large read
+            // instead of a series of sstable_buffer_size ones.
+            auto buffer_size = sstable_buffer_size;
+            if (size <= max_prefetched_component_size) {
+                buffer_size = std::max(buffer_size, align_up(size_t(size), size_t(4096)));
+            }
+            auto r = make_lw_shared<file_random_access_reader>(std::move(f), buffer_size);
+            auto fut = parse(*r, component);
+            return fut.finally([r = std::move(r)] {
+                return r->close();
+            }).then([r] {});
+        });
     }).then_wrapped([this, file_path] (future<> f) {
         try {
             f.get();
@@ -950,7 +995,18 @@ future<> sstable::read_compression(const io_priority_class& pc) {
         return make_ready_future<>();
     }
 
-    return read_simple<component_type::CompressionInfo>(_compression, pc);
+    return read_simple<component_type::CompressionInfo>(_compression, pc).then([this, &pc] {
+        if (!has_component(sstable::component_type::CompressionDictionary)) {
+            return make_ready_future<>();
+        }
+        return do_with(compression_dictionary(), [this, &pc] (auto& dict) {
+            return this->read_simple<component_type::CompressionDictionary>(dict, pc).then([this, &dict] {
+                if (!dict.data.value.empty()) {
+                    _compression.set_dictionary(make_lw_shared<const zstd_dictionary>(std::move(dict.data.value)));
+                }
+            });
+        });
+    });
 }
 
 void sstable::write_compression(const io_priority_class& pc) {
@@ -959,12 +1015,90 @@ void sstable::write_compression(const io_priority_class& pc) {
     }
 
     write_simple<component_type::CompressionInfo>(_compression, pc);
+    if (has_component(sstable::component_type::CompressionDictionary)) {
+        compression_dictionary dict;
+        if (_compression.dictionary()) {
+            dict.data.value = _compression.dictionary()->data();
+        }
+        write_simple<component_type::CompressionDictionary>(dict, pc);
+    }
 }
 
 future<> sstable::read_statistics(const io_priority_class& pc) {
     return read_simple<component_type::Statistics>(_statistics, pc);
 }
 
+future<> sstable::read_clustering_bounds(const io_priority_class& pc) {
+    if (!has_component(component_type::ClusteringBounds)) {
+        return make_ready_future<>();
+    }
+    return do_with(clustering_bounds(), [this, &pc] (auto& cb) {
+        return this->read_simple<component_type::ClusteringBounds>(cb, pc).then([this, &cb] {
+            auto to_prefix = [] (auto& components) {
+                std::vector<bytes> v;
+                for (auto&& c : components.elements) {
+                    v.emplace_back(std::move(c.value));
+                }
+                return clustering_key_prefix::from_exploded(std::move(v));
+            };
+            _clustering_flags = cb.flags;
+            if (_clustering_flags & clustering_bounds::has_clustered_content) {
+                _min_clustering = to_prefix(cb.min);
+                _max_clustering = to_prefix(cb.max);
+            }
+        });
+    });
+}
+
+void sstable::write_clustering_bounds(const io_priority_class& pc) {
+    if (!has_component(component_type::ClusteringBounds)) {
+        return;
+    }
+    clustering_bounds cb;
+    cb.flags = _clustering_flags;
+    auto from_prefix = [] (auto& components, const stdx::optional<clustering_key_prefix>& p) {
+        if (p) {
+            for (auto&& c : p->explode()) {
+                components.elements.push_back(disk_string<uint16_t>{std::move(c)});
+            }
+        }
+    };
+    from_prefix(cb.min, _min_clustering);
+    from_prefix(cb.max, _max_clustering);
+    write_simple<component_type::ClusteringBounds>(cb, pc);
+}
+
+// Widens the bounds so that they include everything between start and end.
+void sstable::update_clustering_bounds(const schema& s, const clustering_key_prefix& start, const clustering_key_prefix& end) {
+    bound_view::compare cmp(s);
+    _clustering_flags |= clustering_bounds::has_clustered_content;
+    if (!_min_clustering || cmp(start, weight(bound_kind::incl_start), *_min_clustering, weight(bound_kind::incl_start))) {
+        _min_clustering = start;
+    }
+    if (!_max_clustering || cmp(*_max_clustering, weight(bound_kind::incl_end), end, weight(bound_kind::incl_end))) {
+        _max_clustering = end;
+    }
+}
+
+bool sstable::may_contain_rows(const schema& s, const std::vector<query::clustering_range>& ranges) const {
+    if (!has_component(component_type::ClusteringBounds)
+            || (_clustering_flags & (clustering_bounds::has_partition_tombstones | clustering_bounds::has_static_rows))) {
+        return true;
+    }
+    if (!(_clustering_flags & clustering_bounds::has_clustered_content)) {
+        return false;
+    }
+    position_in_partition::less_compare less(s);
+    auto start = position_in_partition(position_in_partition::range_tombstone_tag_t(),
+            bound_view(*_min_clustering, bound_kind::incl_start));
+    auto end = position_in_partition(position_in_partition::range_tombstone_tag_t(),
+            bound_view(*_max_clustering, bound_kind::incl_end));
+    return boost::algorithm::any_of(ranges, [&] (const query::clustering_range& r) {
+        auto pr = position_range::from_range(r);
+        return less(pr.start(), end) && less(start, pr.end());
+    });
+}
+
 void sstable::write_statistics(const io_priority_class& pc) {
     write_simple<component_type::Statistics>(_statistics, pc);
 }
@@ -1001,6 +1135,62 @@ future<> sstable::read_summary(const io_priority_class& pc) {
         } else {
             return generate_summary(pc);
         }
+    }).then([this] {
+        _summary_disk_sampling_level = _summary.header.sampling_level;
+    });
+}
+
+void sstable::downsample_summary(int sampling_level) {
+    auto& s = _summary;
+    int current = s.header.sampling_level;
+    if (sampling_level >= current) {
+        return;
+    }
+    assert(!_summary_users);
+
+    // Every round of downsampling removes the entry at the round's start
+    // point from each run of `current` entries.
+    std::vector<bool> removed(current, false);
+    for (auto start : downsampling::get_start_points(current, sampling_level)) {
+        removed[start] = true;
+    }
+    std::deque<summary_entry> entries;
+    for (size_t i = 0; i < s.entries.size(); ++i) {
+        if (!removed[i % current]) {
+            entries.push_back(std::move(s.entries[i]));
+        }
+    }
+    sstlog.debug("Downsampling summary of {} from level {} to {}, {} entries to {}", get_filename(), current, sampling_level,
+            s.entries.size(), entries.size());
+    s.entries = std::move(entries);
+    s.header.sampling_level = sampling_level;
+    s.header.size = s.entries.size();
+    s.header.memory_size = s.header.size * sizeof(uint32_t);
+    s.positions.clear();
+    for (auto& e : s.entries) {
+        s.positions.push_back(s.header.memory_size);
+        s.header.memory_size += e.key.size() + sizeof(e.position);
+    }
+}
+
+future<> sstable::resample_summary(int sampling_level, const io_priority_class& pc) {
+    if (sampling_level <= summary_sampling_level()) {
+        if (!_summary_users) {
+            downsample_summary(sampling_level);
+        }
+        return make_ready_future<>();
+    }
+    if (!has_component(sstable::component_type::Summary)) {
+        return make_ready_future<>();
+    }
+    auto s = make_lw_shared<summary>();
+    return read_simple<component_type::Summary>(*s, pc).then([this, s, sampling_level] {
+        if (!*s || _summary_users || s->header.sampling_level <= _summary.header.sampling_level) {
+            return;
+        }
+        sstlog.debug("Upsampling summary of {} from level {} to {}", get_filename(), _summary.header.sampling_level, sampling_level);
+        _summary = std::move(*s);
+        downsample_summary(sampling_level);
     });
 }
 
@@ -1008,8 +1198,10 @@ future<> sstable::open_data() {
     return when_all(open_checked_file_dma(sstable_read_error, filename(component_type::Index), open_flags::ro),
                     open_checked_file_dma(sstable_read_error, filename(component_type::Data), open_flags::ro))
                     .then([this] (auto files) {
-        _index_file = std::get<file>(std::get<0>(files).get());
-        _data_file  = std::get<file>(std::get<1>(files).get());
+        // Data and index are written sequentially and can grow large, so
+        // they are the ones synced as they're written.
+        _index_file = make_trickle_fsync_file(std::get<file>(std::get<0>(files).get()));
+        _data_file  = make_trickle_fsync_file(std::get<file>(std::get<1>(files).get()));
         return _data_file.size().then([this] (auto size) {
             if (this->has_component(sstable::component_type::CompressionInfo)) {
                 _compression.update(size);
@@ -1020,6 +1212,16 @@ future<> sstable::open_data() {
             return _index_file.size().then([this] (auto size) {
               _index_file_size = size;
             });
+        }).then([this] {
+            if (!has_component(component_type::PartitionIndex)) {
+                return make_ready_future<>();
+            }
+            return open_checked_file_dma(sstable_read_error, filename(component_type::PartitionIndex), open_flags::ro).then([this] (file f) {
+                _partition_index_file = f;
+                return partition_index::open(std::move(f), default_priority_class());
+            }).then([this] (lw_shared_ptr<partition_index> index) {
+                _partition_index = std::move(index);
+            });
         }).then([this] {
             // Get disk usage for this sstable (includes all components).
             _bytes_on_disk = 0;
@@ -1047,6 +1249,13 @@ future<> sstable::create_data() {
         // without its exception being examined.
         _index_file = std::get<file>(std::get<0>(files).get());
         _data_file  = std::get<file>(std::get<1>(files).get());
+    }).then([this, oflags] {
+        if (!has_component(component_type::PartitionIndex)) {
+            return make_ready_future<>();
+        }
+        return new_sstable_component_file(sstable_write_error, filename(component_type::PartitionIndex), oflags).then([this] (file f) {
+            _partition_index_file = std::move(f);
+        });
     });
 }
 
@@ -1054,26 +1263,57 @@ future<> sstable::create_data() {
 // No need to set tunable priorities for it.
 future<> sstable::load() {
     return read_toc().then([this] {
-        return read_statistics(default_priority_class());
-    }).then([this] {
-        return read_compression(default_priority_class());
-    }).then([this] {
-        return read_filter(default_priority_class());
-    }).then([this] {;
-        return read_summary(default_priority_class());
+        // The metadata components don't depend on each other, so read them
+        // in parallel rather than paying the latency of each read in turn.
+        // With lazy filters, the filter is only loaded by the first read.
+        auto filter = global_filter_cache().lazy() ? read_filter_size() : read_filter(default_priority_class());
+        auto statistics = read_statistics(default_priority_class()).then([this] {
+            return read_clustering_bounds(default_priority_class());
+        });
+        return when_all(std::move(statistics),
+                        read_compression(default_priority_class()),
+                        std::move(filter),
+                        read_summary(default_priority_class()));
+    }).then([] (std::tuple<future<>, future<>, future<>, future<>> results) {
+        std::exception_ptr ep;
+        auto check = [&ep] (future<>& f) {
+            if (f.failed()) {
+                auto e = f.get_exception();
+                if (!ep) {
+                    ep = std::move(e);
+                }
+            }
+        };
+        check(std::get<0>(results));
+        check(std::get<1>(results));
+        check(std::get<2>(results));
+        check(std::get<3>(results));
+        if (ep) {
+            std::rethrow_exception(std::move(ep));
+        }
     }).then([this] {
         return open_data();
     });
 }
 
-// @clustering_key: it's expected that clustering key is already in its composite form.
-// NOTE: empty clustering key means that there is no clustering key.
-void sstable::write_column_name(file_writer& out, const composite& clustering_key, const std::vector<bytes_view>& column_names, composite::eoc marker) {
-    // FIXME: min_components and max_components also keep track of clustering
-    // prefix, so we must merge clustering_key and column_names somehow and
-    // pass the result to the functions below.
-    column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, column_names);
+future<> sstable::load_filter() {
+    if (_filter) {
+        return make_ready_future<>();
+    }
+    if (!_filter_load) {
+        _filter_load = shared_future<>(read_filter(default_priority_class()).handle_exception([this] (auto ep) {
+            sstlog.warn("Failed to load filter of {}: {}", this->get_filename(), ep);
+        }).finally([this, self = shared_from_this()] {
+            _filter_load = {};
+        }));
+    }
+    return _filter_load->get_future();
+}
 
+// Returns the two parts a column name is written in, the clustering key and
+// the composite of column names.
+static std::pair<bytes_view, composite> column_name_parts(const composite& clustering_key,
+        const std::vector<bytes_view>& column_names, composite::eoc marker) {
     // was defined in the schema, for example.
     auto c = composite::from_exploded(column_names, marker);
     auto ck_bview = bytes_view(clustering_key);
@@ -1086,12 +1326,37 @@ void sstable::write_column_name(file_writer& out, const composite& clustering_ke
     if (c.size() == 1) {
         ck_bview.remove_suffix(1);
     }
-    size_t sz = ck_bview.size() + c.size();
+    return { ck_bview, std::move(c) };
+}
+
+// Writes out the atom being built, if any, framed by its length.
+static void write_compact_atom(file_writer& out, compact::atom_writer& atoms) {
+    if (!atoms.has_atom()) {
+        return;
+    }
+    auto atom = atoms.finish_atom();
+    uint32_t size = atom.size();
+    write(out, size);
+    for (bytes_view fragment : atom.fragments()) {
+        write(out, fragment);
+    }
+}
+
+// @clustering_key: it's expected that clustering key is already in its composite form.
+// NOTE: empty clustering key means that there is no clustering key.
+void sstable::write_column_name(file_writer& out, const composite& clustering_key, const std::vector<bytes_view>& column_names, composite::eoc marker) {
+    // FIXME: min_components and max_components also keep track of clustering
+    // prefix, so we must merge clustering_key and column_names somehow and
+    // pass the result to the functions below.
+    column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, column_names);
+
+    auto name = column_name_parts(clustering_key, column_names, marker);
+    size_t sz = name.first.size() + name.second.size();
     if (sz > std::numeric_limits<uint16_t>::max()) {
         throw std::runtime_error(sprint("Column name too large (%d > %d)", sz, std::numeric_limits<uint16_t>::max()));
     }
     uint16_t sz16 = sz;
-    write(out, sz16, ck_bview, c);
+    write(out, sz16, name.first, name.second);
 }
 
 void sstable::write_column_name(file_writer& out, bytes_view column_names) {
@@ -1112,13 +1377,31 @@ static inline void update_cell_stats(column_stats& c_stats, uint64_t timestamp)
     c_stats.column_count++;
 }
 
+// Updates the statistics for a cell about to be written, in any format.
+void sstable::account_cell(atomic_cell_view cell) {
+    update_cell_stats(_c_stats, cell.timestamp());
+
+    if (cell.is_dead(_now)) {
+        uint32_t deletion_time = cell.deletion_time().time_since_epoch().count();
+        _c_stats.update_max_local_deletion_time(deletion_time);
+        _c_stats.tombstone_histogram.update(deletion_time);
+        _clustering_flags &= ~clustering_bounds::only_live_partitions;
+    } else if (cell.is_live_and_has_ttl()) {
+        _c_stats.update_max_local_deletion_time(cell.expiry().time_since_epoch().count());
+        _clustering_flags &= ~clustering_bounds::only_live_partitions;
+    } else {
+        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
+        _partition_is_live = true;
+    }
+}
+
 // Intended to write all cell components that follow column name.
 void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
     // FIXME: counter cell isn't supported yet.
 
     uint64_t timestamp = cell.timestamp();
 
-    update_cell_stats(_c_stats, timestamp);
+    account_cell(cell);
 
     if (cell.is_dead(_now)) {
         // tombstone cell
@@ -1127,9 +1410,6 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t deletion_time_size = sizeof(uint32_t);
         uint32_t deletion_time = cell.deletion_time().time_since_epoch().count();
 
-        _c_stats.update_max_local_deletion_time(deletion_time);
-        _c_stats.tombstone_histogram.update(deletion_time);
-
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (cell.is_live_and_has_ttl()) {
         // expiring cell
@@ -1139,8 +1419,6 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t expiration = cell.expiry().time_since_epoch().count();
         disk_string_view<uint32_t> cell_value { cell.value() };
 
-        _c_stats.update_max_local_deletion_time(expiration);
-
         write(out, mask, ttl, expiration, timestamp, cell_value);
     } else {
         // regular cell
@@ -1148,12 +1426,23 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         column_mask mask = column_mask::none;
         disk_string_view<uint32_t> cell_value { cell.value() };
 
-        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
-
         write(out, mask, timestamp, cell_value);
     }
 }
 
+void sstable::account_row_marker(const row_marker& marker) {
+    update_cell_stats(_c_stats, marker.timestamp());
+
+    if (marker.is_dead(_now)) {
+        _c_stats.tombstone_histogram.update(marker.deletion_time().time_since_epoch().count());
+        _clustering_flags &= ~clustering_bounds::only_live_partitions;
+    } else if (marker.is_expiring()) {
+        _clustering_flags &= ~clustering_bounds::only_live_partitions;
+    } else {
+        _partition_is_live = true;
+    }
+}
+
 void sstable::write_row_marker(file_writer& out, const row_marker& marker, const composite& clustering_key) {
     if (marker.is_missing()) {
         return;
@@ -1164,15 +1453,13 @@ void sstable::write_row_marker(file_writer& out, const row_marker& marker, const
     uint64_t timestamp = marker.timestamp();
     uint32_t value_length = 0;
 
-    update_cell_stats(_c_stats, timestamp);
+    account_row_marker(marker);
 
     if (marker.is_dead(_now)) {
         column_mask mask = column_mask::deletion;
         uint32_t deletion_time_size = sizeof(uint32_t);
         uint32_t deletion_time = marker.deletion_time().time_since_epoch().count();
 
-        _c_stats.tombstone_histogram.update(deletion_time);
-
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (marker.is_expiring()) {
         column_mask mask = column_mask::expiration;
@@ -1199,23 +1486,44 @@ void sstable::write_range_tombstone(file_writer& out,
     auto start_marker = start_kind == bound_kind::excl_start
                       ? composite::eoc::end
                       : composite::eoc::start;
-    write_column_name(out, start, suffix, start_marker);
-    column_mask mask = column_mask::range_tombstone;
-    write(out, mask);
     auto end_marker = end_kind == bound_kind::excl_end
                     ? composite::eoc::start
                     : composite::eoc::end;
-    write_column_name(out, end, suffix, end_marker);
     uint64_t timestamp = t.timestamp;
     uint32_t deletion_time = t.deletion_time.time_since_epoch().count();
 
-    update_cell_stats(_c_stats, timestamp);
-    _c_stats.update_max_local_deletion_time(deletion_time);
-    _c_stats.tombstone_histogram.update(deletion_time);
+    if (_atom_writer) {
+        column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, suffix);
+        account_range_tombstone(t);
+        // Cells written so far go before the tombstone.
+        write_compact_atom(out, *_atom_writer);
+        auto start_name = column_name_parts(start, suffix, start_marker);
+        auto end_name = column_name_parts(end, suffix, end_marker);
+        _atom_writer->add_range_tombstone(to_bytes(start_name.first) + to_bytes(bytes_view(start_name.second)),
+                to_bytes(end_name.first) + to_bytes(bytes_view(end_name.second)), timestamp, deletion_time);
+        write_compact_atom(out, *_atom_writer);
+        return;
+    }
+
+    write_column_name(out, start, suffix, start_marker);
+    column_mask mask = column_mask::range_tombstone;
+    write(out, mask);
+    write_column_name(out, end, suffix, end_marker);
+
+    account_range_tombstone(t);
 
     write(out, deletion_time, timestamp);
 }
 
+void sstable::account_range_tombstone(const tombstone& t) {
+    uint32_t deletion_time = t.deletion_time.time_since_epoch().count();
+
+    update_cell_stats(_c_stats, t.timestamp);
+    _c_stats.update_max_local_deletion_time(deletion_time);
+    _c_stats.tombstone_histogram.update(deletion_time);
+    _clustering_flags &= ~clustering_bounds::only_live_partitions;
+}
+
 void sstable::write_collection(file_writer& out, const composite& clustering_key, const column_definition& cdef, collection_mutation_view collection) {
 
     auto t = static_pointer_cast<const collection_type_impl>(cdef.type);
@@ -1231,6 +1539,10 @@ void sstable::write_collection(file_writer& out, const composite& clustering_key
 // write_datafile_clustered_row() is about writing a clustered_row to data file according to SSTables format.
 // clustered_row contains a set of cells sharing the same clustering key.
 void sstable::write_clustered_row(file_writer& out, const schema& schema, const clustering_row& clustered_row) {
+    if (_atom_writer) {
+        write_compact_clustered_row(out, schema, clustered_row);
+        return;
+    }
     auto clustering_key = composite::from_clustering_element(schema, clustered_row.key());
 
     if (schema.is_compound() && !schema.is_dense()) {
@@ -1272,6 +1584,10 @@ void sstable::write_clustered_row(file_writer& out, const schema& schema, const
 }
 
 void sstable::write_static_row(file_writer& out, const schema& schema, const row& static_row) {
+    if (_atom_writer) {
+        write_compact_static_row(out, schema, static_row);
+        return;
+    }
     static_row.for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
         auto&& column_definition = schema.static_column_at(id);
         if (!column_definition.is_atomic()) {
@@ -1287,6 +1603,119 @@ void sstable::write_static_row(file_writer& out, const schema& schema, const row
     });
 }
 
+void sstable::write_compact_cell(bytes_view column, bytes_view extra, atomic_cell_view cell) {
+    account_cell(cell);
+
+    if (cell.is_dead(_now)) {
+        _atom_writer->add_dead_cell(column, extra, cell.timestamp(), cell.deletion_time().time_since_epoch().count());
+    } else if (cell.is_live_and_has_ttl()) {
+        _atom_writer->add_expiring_cell(column, extra, cell.timestamp(), cell.ttl().count(),
+                cell.expiry().time_since_epoch().count(), cell.value());
+    } else {
+        _atom_writer->add_live_cell(column, extra, cell.timestamp(), cell.value());
+    }
+}
+
+// The row marker is a cell with an empty name component and no value, as in ka.
+void sstable::write_compact_row_marker(const row_marker& marker) {
+    if (marker.is_missing()) {
+        return;
+    }
+    column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { bytes_view() });
+    account_row_marker(marker);
+
+    auto column = composite::from_exploded({ bytes_view() });
+    if (marker.is_dead(_now)) {
+        _atom_writer->add_dead_cell(bytes_view(column), {}, marker.timestamp(), marker.deletion_time().time_since_epoch().count());
+    } else if (marker.is_expiring()) {
+        _atom_writer->add_expiring_cell(bytes_view(column), {}, marker.timestamp(), marker.ttl().count(),
+                marker.expiry().time_since_epoch().count(), {});
+    } else {
+        _atom_writer->add_live_cell(bytes_view(column), {}, marker.timestamp(), {});
+    }
+}
+
+void sstable::write_compact_collection(file_writer& out, const composite& clustering_key, const column_definition& cdef, collection_mutation_view collection) {
+    auto t = static_pointer_cast<const collection_type_impl>(cdef.type);
+    auto mview = t->deserialize_mutation_form(collection);
+    const bytes& column_name = cdef.name();
+    write_range_tombstone(out, clustering_key, clustering_key, { bytes_view(column_name) }, mview.tomb);
+    auto column = composite::from_exploded({ bytes_view(column_name) });
+    for (auto& cp: mview.cells) {
+        column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { column_name, cp.first });
+        write_compact_cell(bytes_view(column), bytes_view(composite::from_exploded({ cp.first })), cp.second);
+    }
+}
+
+// Same contents as write_clustered_row(), but the clustering key is written
+// once for the row, and the rest of each cell name is either the column's
+// entry in the serialization header or, for collections, that and the
+// serialized collection key.
+void sstable::write_compact_clustered_row(file_writer& out, const schema& schema, const clustering_row& clustered_row) {
+    auto clustering_key = composite::from_clustering_element(schema, clustered_row.key());
+
+    // Cells of the row can only come after the row tombstone, which is an
+    // atom of its own.
+    if (clustered_row.tomb()) {
+        write_range_tombstone(out, clustering_key, clustering_key, {}, clustered_row.tomb());
+    }
+
+    bytes_view prefix;
+    if (schema.is_compound()) {
+        prefix = bytes_view(clustering_key);
+    } else if (schema.is_dense()) {
+        prefix = bytes_view(clustered_row.key().get_component(schema, 0));
+    }
+    _atom_writer->start_cells(prefix);
+
+    if (schema.is_compound() && !schema.is_dense()) {
+        write_compact_row_marker(clustered_row.marker());
+    }
+
+    clustered_row.cells().for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+        auto&& column_definition = schema.regular_column_at(id);
+        if (!column_definition.is_atomic()) {
+            write_compact_collection(out, clustering_key, column_definition, c.as_collection_mutation());
+            return;
+        }
+        assert(column_definition.is_regular());
+        atomic_cell_view cell = c.as_atomic_cell();
+        const bytes& column_name = column_definition.name();
+
+        if (schema.is_dense()) {
+            // The whole name is the prefix.
+            column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { prefix });
+            write_compact_cell({}, {}, cell);
+        } else {
+            column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { bytes_view(column_name) });
+            if (schema.is_compound()) {
+                write_compact_cell(bytes_view(composite::from_exploded({ bytes_view(column_name) })), {}, cell);
+            } else {
+                write_compact_cell(bytes_view(column_name), {}, cell);
+            }
+        }
+    });
+
+    write_compact_atom(out, *_atom_writer);
+}
+
+void sstable::write_compact_static_row(file_writer& out, const schema& schema, const row& static_row) {
+    auto sp = composite::static_prefix(schema);
+    _atom_writer->start_cells(bytes_view(sp));
+    static_row.for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+        auto&& column_definition = schema.static_column_at(id);
+        if (!column_definition.is_atomic()) {
+            write_compact_collection(out, sp, column_definition, c.as_collection_mutation());
+            return;
+        }
+        assert(column_definition.is_static());
+        const bytes& column_name = column_definition.name();
+        column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { bytes_view(column_name) });
+        write_compact_cell(bytes_view(composite::from_exploded({ bytes_view(column_name) })), {}, c.as_atomic_cell());
+    });
+    write_compact_atom(out, *_atom_writer);
+}
+
 static void write_index_entry(file_writer& out, disk_string_view<uint16_t>& key, uint64_t pos) {
     // FIXME: support promoted indexes.
     uint32_t promoted_index_size = 0;
@@ -1337,11 +1766,19 @@ static void prepare_compression(compression& c, const schema& schema) {
     const auto& cp = schema.get_compressor_params();
     c.set_compressor(cp.get_compressor());
     c.chunk_len = cp.chunk_length();
+    if (cp.auto_chunk_length()) {
+        c.chunk_len = local_table_read_sizes(schema.ks_name(), schema.cf_name())->chunk_length(c.chunk_len);
+        sstlog.debug("Using chunk length of {} for new sstable of {}.{}", c.chunk_len, schema.ks_name(), schema.cf_name());
+    }
     c.data_len = 0;
     // FIXME: crc_check_chance can be configured by the user.
     // probability to verify the checksum of a compressed chunk we read.
     // defaults to 1.0.
     c.options.elements.push_back({"crc_check_chance", "1.0"});
+    if (cp.get_compressor() == compressor::zstd) {
+        c.set_compression_level(cp.compression_level());
+        c.set_dictionary_size(cp.dictionary_size());
+    }
     c.init_full_checksum();
 }
 
@@ -1354,9 +1791,10 @@ static void maybe_add_summary_entry(summary& s, bytes_view key, uint64_t offset)
 
 // In the beginning of the statistics file, there is a disk_hash used to
 // map each metadata type to its correspondent position in the file.
+// The serialization header is there only for sstables of the compact format.
 static void seal_statistics(statistics& s, metadata_collector& collector,
-        const sstring partitioner, double bloom_filter_fp_chance) {
-    static constexpr int METADATA_TYPE_COUNT = 3;
+        const sstring partitioner, double bloom_filter_fp_chance, std::unique_ptr<serialization_header> header) {
+    const int METADATA_TYPE_COUNT = header ? 4 : 3;
 
     size_t old_offset, offset = 0;
     // account disk_hash size.
@@ -1381,6 +1819,13 @@ static void seal_statistics(statistics& s, metadata_collector& collector,
     s.contents[metadata_type::Compaction] = std::make_unique<compaction_metadata>(std::move(compaction));
     s.hash.map[metadata_type::Compaction] = old_offset;
 
+    if (header) {
+        old_offset = offset;
+        offset += header->serialized_size();
+        s.contents[metadata_type::Serialization] = std::move(header);
+        s.hash.map[metadata_type::Serialization] = old_offset;
+    }
+
     collector.construct_stats(stats);
     // NOTE: method serialized_size of stats_metadata must be implemented for
     // a new type of compaction to get supported.
@@ -1402,9 +1847,18 @@ file_writer components_writer::index_file_writer(sstable& sst, const io_priority
     file_output_stream_options options;
     options.buffer_size = sst.sstable_buffer_size;
     options.io_priority_class = pc;
+    options.write_behind = sstable_write_behind;
     return file_writer(sst._index_file, std::move(options));
 }
 
+file_writer components_writer::partition_index_file_writer(sstable& sst, const io_priority_class& pc) {
+    file_output_stream_options options;
+    options.buffer_size = partition_index::page_size;
+    options.io_priority_class = pc;
+    options.write_behind = sstable_write_behind;
+    return file_writer(sst._partition_index_file, std::move(options));
+}
+
 components_writer::components_writer(sstable& sst, const schema& s, file_writer& out,
                                      uint64_t estimated_partitions, uint64_t max_sstable_size,
                                      const io_priority_class& pc)
@@ -1414,11 +1868,19 @@ components_writer::components_writer(sstable& sst, const schema& s, file_writer&
     , _index(index_file_writer(sst, pc))
     , _max_sstable_size(max_sstable_size)
 {
-    _sst._filter = utils::i_filter::get_filter(estimated_partitions, _schema.bloom_filter_fp_chance());
+    _sst._filter.set(utils::i_filter::get_filter(estimated_partitions, _schema.bloom_filter_fp_chance(), get_filter_layout()), false);
 
     prepare_summary(_sst._summary, estimated_partitions, _schema.min_index_interval());
 
-    // FIXME: we may need to set repaired_at stats at this point.
+    // Cleared by whatever is written which isn't live data.
+    _sst._clustering_flags = clustering_bounds::only_live_partitions;
+
+    if (_sst._version == sstable::version_types::sa) {
+        _sst._atom_writer = std::make_unique<compact::atom_writer>();
+    }
+    if (_sst._partition_index_file) {
+        _partition_index.emplace(partition_index_file_writer(sst, pc));
+    }
 }
 
 void components_writer::consume_new_partition(const dht::decorated_key& dk) {
@@ -1430,6 +1892,9 @@ void components_writer::consume_new_partition(const dht::decorated_key& dk) {
     maybe_add_summary_entry(_sst._summary, bytes_view(*_partition_key), _index.offset());
     _sst._filter->add(bytes_view(*_partition_key));
     _sst._collector.add_key(bytes_view(*_partition_key));
+    if (_partition_index) {
+        _partition_index_key = partition_index_key(dk.token(), bytes_view(*_partition_key));
+    }
 
     auto p_key = disk_string_view<uint16_t>();
     p_key.value = bytes_view(*_partition_key);
@@ -1441,6 +1906,8 @@ void components_writer::consume_new_partition(const dht::decorated_key& dk) {
     write(_out, p_key);
 
     _tombstone_written = false;
+    _partition_rows = 0;
+    _sst._partition_is_live = false;
 }
 
 void components_writer::consume(tombstone t) {
@@ -1454,6 +1921,8 @@ void components_writer::consume(tombstone t) {
         _sst._c_stats.update_max_local_deletion_time(d.local_deletion_time);
         _sst._c_stats.update_min_timestamp(d.marked_for_delete_at);
         _sst._c_stats.update_max_timestamp(d.marked_for_delete_at);
+        _sst._clustering_flags |= clustering_bounds::has_partition_tombstones;
+        _sst._clustering_flags &= ~clustering_bounds::only_live_partitions;
     } else {
         // Default values for live, undeleted rows.
         d.local_deletion_time = std::numeric_limits<int32_t>::max();
@@ -1465,18 +1934,22 @@ void components_writer::consume(tombstone t) {
 
 stop_iteration components_writer::consume(static_row&& sr) {
     ensure_tombstone_is_written();
+    _sst._clustering_flags |= clustering_bounds::has_static_rows;
     _sst.write_static_row(_out, _schema, sr.cells());
     return stop_iteration::no;
 }
 
 stop_iteration components_writer::consume(clustering_row&& cr) {
     ensure_tombstone_is_written();
+    ++_partition_rows;
+    _sst.update_clustering_bounds(_schema, cr.key(), cr.key());
     _sst.write_clustered_row(_out, _schema, cr);
     return stop_iteration::no;
 }
 
 stop_iteration components_writer::consume(range_tombstone&& rt) {
     ensure_tombstone_is_written();
+    _sst.update_clustering_bounds(_schema, rt.start, rt.end);
     auto start = composite::from_clustering_element(_schema, std::move(rt.start));
     auto end = composite::from_clustering_element(_schema, std::move(rt.end));
     _sst.write_range_tombstone(_out, std::move(start), rt.start_kind, std::move(end), rt.end_kind, {}, rt.tomb);
@@ -1485,11 +1958,31 @@ stop_iteration components_writer::consume(range_tombstone&& rt) {
 
 stop_iteration components_writer::consume_end_of_partition() {
     ensure_tombstone_is_written();
-    int16_t end_of_row = 0;
-    write(_out, end_of_row);
+    if (_sst._atom_writer) {
+        uint32_t end_of_row = 0;
+        write(_out, end_of_row);
+    } else {
+        int16_t end_of_row = 0;
+        write(_out, end_of_row);
+    }
+
+    if (!_sst._partition_is_live) {
+        _sst._clustering_flags &= ~clustering_bounds::only_live_partitions;
+    }
+
+    if (_partition_index) {
+        if (_partition_index_key) {
+            _partition_index->add(std::move(*_partition_index_key), _sst._c_stats.start_offset, _out.offset());
+        } else {
+            _partition_index->invalidate();
+        }
+    }
 
     // compute size of the current row.
     _sst._c_stats.row_size = _out.offset() - _sst._c_stats.start_offset;
+    if (large_partition_threshold && _sst._c_stats.row_size > large_partition_threshold && large_partition_reporter) {
+        large_partition_reporter(_sst, _schema, *_partition_key, _sst._c_stats.row_size, _partition_rows);
+    }
     // update is about merging column_stats with the data being stored by collector.
     _sst._collector.update(std::move(_sst._c_stats));
     _sst._c_stats.reset();
@@ -1508,18 +2001,29 @@ void components_writer::consume_end_of_stream() {
     _index.close().get();
     _sst._index_file = file(); // index->close() closed _index_file
 
+    if (_partition_index) {
+        _partition_index->finish();
+        _partition_index = stdx::nullopt;
+        _sst._partition_index_file = file();
+    }
+
     if (_sst.has_component(sstable::component_type::CompressionInfo)) {
         _sst._collector.add_compression_ratio(_sst._compression.compressed_file_length(), _sst._compression.uncompressed_file_length());
     }
 
     // NOTE: Cassandra gets partition name by calling getClass().getCanonicalName() on
     // partition class.
-    seal_statistics(_sst._statistics, _sst._collector, dht::global_partitioner().name(), _schema.bloom_filter_fp_chance());
+    std::unique_ptr<serialization_header> header;
+    if (_sst._atom_writer) {
+        header = std::make_unique<serialization_header>(std::move(_sst._atom_writer->header()));
+        _sst._atom_writer = {};
+    }
+    seal_statistics(_sst._statistics, _sst._collector, dht::global_partitioner().name(), _schema.bloom_filter_fp_chance(), std::move(header));
 }
 
 future<> sstable::write_components(memtable& mt, bool backup, const io_priority_class& pc, bool leave_unsealed) {
     _collector.set_replay_position(mt.replay_position());
-    return write_components(mt.make_reader(mt.schema()),
+    return write_components(mt.make_flush_reader(mt.schema(), pc),
             mt.partition_count(), mt.schema(), std::numeric_limits<uint64_t>::max(), backup, pc, leave_unsealed);
 }
 
@@ -1528,6 +2032,7 @@ void sstable_writer::prepare_file_writer()
     file_output_stream_options options;
     options.io_priority_class = _pc;
     options.buffer_size = _sst.sstable_buffer_size;
+    options.write_behind = sstable_write_behind;
 
     if (!_compression_enabled) {
         _writer = make_shared<checksummed_file_writer>(_sst._data_file, std::move(options), true);
@@ -1559,7 +2064,7 @@ sstable_writer::sstable_writer(sstable& sst, const schema& s, uint64_t estimated
     , _backup(backup)
     , _leave_unsealed(leave_unsealed)
 {
-    _sst.generate_toc(_schema.get_compressor_params().get_compressor(), _schema.bloom_filter_fp_chance());
+    _sst.generate_toc(_schema.get_compressor_params(), _schema.bloom_filter_fp_chance());
     _sst.write_toc(_pc);
     _sst.create_data().get();
     _compression_enabled = !_sst.has_component(sstable::component_type::CRC);
@@ -1574,7 +2079,10 @@ void sstable_writer::consume_end_of_stream()
     finish_file_writer();
     _sst.write_summary(_pc);
     _sst.write_filter(_pc);
+    // The filter can be read back from disk from now on.
+    _sst._filter.make_evictable();
     _sst.write_statistics(_pc);
+    _sst.write_clustering_bounds(_pc);
     // NOTE: write_compression means maybe_write_compression.
     _sst.write_compression(_pc);
 
@@ -1644,10 +2152,11 @@ future<> sstable::generate_summary(const io_priority_class& pc) {
                 // later.
                 prepare_summary(_summary, estimated_partitions, DEFAULT_MIN_INDEX_INTERVAL);
 
-                file_input_stream_options options;
-                options.buffer_size = sstable_buffer_size;
+                adaptive_read_options options;
+                options.initial_buffer_size = sstable_buffer_size;
+                options.max_buffer_size = sstable_buffer_size;
                 options.io_priority_class = pc;
-                auto stream = make_file_input_stream(index_file, 0, size, std::move(options));
+                auto stream = make_adaptive_file_input_stream(index_file, 0, size, std::move(options));
                 return do_with(summary_generator(_summary), [this, &pc, stream = std::move(stream), size] (summary_generator& s) mutable {
                     auto ctx = make_lw_shared<index_consume_entry_context<summary_generator>>(s, std::move(stream), size);
                     return ctx->consume_input(*ctx).finally([ctx] {
@@ -1709,6 +2218,9 @@ const sstring sstable::filename(sstring dir, sstring ks, sstring cf, version_typ
         },
         { sstable::version_types::la, [] (entry_descriptor d) {
             return _version_string.at(d.version) + "-" + to_sstring(d.generation) + "-" + _format_string.at(d.format) + "-" + _component_map.at(d.component); }
+        },
+        { sstable::version_types::sa, [] (entry_descriptor d) {
+            return _version_string.at(d.version) + "-" + to_sstring(d.generation) + "-" + _format_string.at(d.format) + "-" + _component_map.at(d.component); }
         }
     };
 
@@ -1742,6 +2254,31 @@ future<> sstable::create_links(sstring dir, int64_t generation) const {
     });
 }
 
+future<> sstable::create_snapshot_links(sstring dir) const {
+    auto link = [this, dir] (component_type comp) {
+        auto dst = sstable::filename(dir, _ks, _cf, _version, _generation, _format, comp);
+        return sstable_write_io_check(::link_file, filename(comp), dst).then_wrapped([] (future<> f) {
+            // If the SSTables are shared, the other CPUs link the same
+            // components concurrently. We only need one link.
+            try {
+                f.get();
+            } catch (std::system_error& e) {
+                if (e.code() != std::error_code(EEXIST, std::system_category())) {
+                    throw;
+                }
+            }
+        });
+    };
+    return parallel_for_each(_components, [link] (auto comp) {
+        if (comp == component_type::TOC) {
+            return make_ready_future<>();
+        }
+        return link(comp);
+    }).then([link] {
+        return link(component_type::TOC);
+    });
+}
+
 future<> sstable::set_generation(int64_t new_generation) {
     return create_links(_dir, new_generation).then([this] {
         return remove_file(filename(component_type::TOC)).then([this] {
@@ -1762,7 +2299,7 @@ future<> sstable::set_generation(int64_t new_generation) {
 }
 
 entry_descriptor entry_descriptor::make_descriptor(sstring fname) {
-    static std::regex la("la-(\\d+)-(\\w+)-(.*)");
+    static std::regex la("(la|sa)-(\\d+)-(\\w+)-(.*)");
     static std::regex ka("(\\w+)-(\\w+)-ka-(\\d+)-(.*)");
 
     std::smatch match;
@@ -1779,10 +2316,11 @@ entry_descriptor entry_descriptor::make_descriptor(sstring fname) {
     if (std::regex_match(s, match, la)) {
         sstring ks = "";
         sstring cf = "";
-        version = sstable::version_types::la;
-        generation = match[1].str();
-        format = sstring(match[2].str());
-        component = sstring(match[3].str());
+        sstring v = match[1].str();
+        version = sstable::version_from_sstring(v);
+        generation = match[2].str();
+        format = sstring(match[3].str());
+        component = sstring(match[4].str());
     } else if (std::regex_match(s, match, ka)) {
         ks = match[1].str();
         cf = match[2].str();
@@ -1808,21 +2346,36 @@ sstable::component_type sstable::component_from_sstring(sstring &s) {
     return reverse_map(s, _component_map);
 }
 
-input_stream<char> sstable::data_stream(uint64_t pos, size_t len, const io_priority_class& pc) {
-    file_input_stream_options options;
-    options.buffer_size = sstable_buffer_size;
+input_stream<char> sstable::data_stream(uint64_t pos, size_t len, const io_priority_class& pc, size_t initial_read_size) {
+    // Compaction and streaming read each chunk once, from start to end.
+    auto sequential = &pc == &service::get_local_compaction_priority()
+            || &pc == &service::get_local_streaming_read_priority();
+    adaptive_read_options options;
+    options.max_buffer_size = std::max(sstable_buffer_size, initial_read_size);
+    options.initial_buffer_size = initial_read_size ? initial_read_size
+            : sequential ? options.max_buffer_size : options.initial_buffer_size;
     options.io_priority_class = pc;
-    options.read_ahead = 4;
+    options.max_read_ahead = 4;
     if (_compression) {
+        // Don't let sequential readers take over the chunk cache, nor the
+        // choice of chunk length.
+        lw_shared_ptr<table_read_sizes> read_sizes;
+        if (!sequential) {
+            if (!_read_sizes) {
+                _read_sizes = local_table_read_sizes(_ks, _cf);
+            }
+            read_sizes = _read_sizes;
+        }
         return make_compressed_file_input_stream(_data_file, &_compression,
-                pos, len, std::move(options));
+                pos, len, std::move(options), sequential ? 0 : _chunk_cache_owner.id(), std::move(read_sizes));
     } else {
-        return make_file_input_stream(_data_file, pos, len, std::move(options));
+        return make_adaptive_file_input_stream(_data_file, pos, len, std::move(options));
     }
 }
 
 future<temporary_buffer<char>> sstable::data_read(uint64_t pos, size_t len, const io_priority_class& pc) {
-    return do_with(data_stream(pos, len, pc), [len] (auto& stream) {
+    // All of it is needed, read it at once.
+    return do_with(data_stream(pos, len, pc, len), [len] (auto& stream) {
         return stream.read_exactly(len).finally([&stream] {
             return stream.close();
         });
@@ -1916,6 +2469,76 @@ future<> sstable::mutate_sstable_level(uint32_t new_level) {
     });
 }
 
+future<> sstable::mutate_repaired_at(uint64_t repaired_at) {
+    if (!has_component(component_type::Statistics)) {
+        return make_ready_future<>();
+    }
+
+    auto entry = _statistics.contents.find(metadata_type::Stats);
+    if (entry == _statistics.contents.end()) {
+        return make_ready_future<>();
+    }
+
+    auto& p = entry->second;
+    if (!p) {
+        throw std::runtime_error("Statistics is malformed");
+    }
+    stats_metadata& s = *static_cast<stats_metadata *>(p.get());
+    if (s.repaired_at == repaired_at) {
+        return make_ready_future<>();
+    }
+
+    sstlog.debug("set repaired_at of {} from {} to {}", get_filename(), s.repaired_at, repaired_at);
+    s.repaired_at = repaired_at;
+    return seastar::async([this] {
+        rewrite_statistics(service::get_local_streaming_write_priority());
+    });
+}
+
+uint64_t sstable::estimated_keys_for_range(const range<dht::token>& range) const {
+    auto& entries = _summary.entries;
+    if (entries.empty()) {
+        return 0;
+    }
+    auto token_of = [] (const summary_entry& e) {
+        return dht::global_partitioner().get_token(e.get_key());
+    };
+    auto begin = entries.begin();
+    if (range.start()) {
+        begin = std::partition_point(entries.begin(), entries.end(), [&] (const summary_entry& e) {
+            auto t = token_of(e);
+            return range.start()->is_inclusive() ? t < range.start()->value() : t <= range.start()->value();
+        });
+    }
+    auto end = entries.end();
+    if (range.end()) {
+        end = std::partition_point(begin, entries.end(), [&] (const summary_entry& e) {
+            auto t = token_of(e);
+            return range.end()->is_inclusive() ? t <= range.end()->value() : t < range.end()->value();
+        });
+    }
+    // Each summary entry stands for the same number of keys. A range falling
+    // between two sampled keys may still hold some.
+    auto sampled = uint64_t(std::distance(begin, end));
+    return std::max<uint64_t>(1, sampled * get_estimated_key_count() / entries.size());
+}
+
+std::experimental::optional<hll::HyperLogLog> sstable::get_cardinality() const {
+    auto entry = _statistics.contents.find(metadata_type::Compaction);
+    if (entry == _statistics.contents.end() || !entry->second) {
+        return { };
+    }
+    auto& cardinality = static_cast<const compaction_metadata&>(*entry->second).cardinality.elements;
+    temporary_buffer<uint8_t> buf(cardinality.size());
+    std::copy(cardinality.begin(), cardinality.end(), buf.get_write());
+    try {
+        return hll::HyperLogLog::from_bytes(buf);
+    } catch (const std::runtime_error& e) {
+        sstlog.debug("Ignoring cardinality of {}: {}", get_filename(), e.what());
+        return { };
+    }
+}
+
 int sstable::compare_by_max_timestamp(const sstable& other) const {
     auto ts1 = get_stats_metadata().max_timestamp;
     auto ts2 = other.get_stats_metadata().max_timestamp;
@@ -1935,6 +2558,12 @@ sstable::~sstable() {
             general_disk_error();
         });
     }
+    if (_partition_index_file) {
+        _partition_index_file.close().handle_exception([save = _partition_index_file, op = background_jobs().start()] (auto ep) {
+            sstlog.warn("sstable close partition index file failed: {}", ep);
+            general_disk_error();
+        });
+    }
 
     if (_marked_for_deletion) {
         // We need to delete the on-disk files for this table. Since this is a
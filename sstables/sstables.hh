@@ -29,6 +29,7 @@
 #include "core/enum.hh"
 #include "core/shared_ptr.hh"
 #include "core/distributed.hh"
+#include <seastar/core/shared_future.hh>
 #include <unordered_set>
 #include <unordered_map>
 #include "types.hh"
@@ -39,6 +40,10 @@
 #include "schema.hh"
 #include "mutation.hh"
 #include "utils/i_filter.hh"
+#include "key_cache.hh"
+#include "chunk_cache.hh"
+#include "filter_cache.hh"
+#include "read_sizes.hh"
 #include "core/stream.hh"
 #include "writer.hh"
 #include "metadata_collector.hh"
@@ -48,6 +53,9 @@
 #include "query-request.hh"
 #include "key_reader.hh"
 #include "compound_compat.hh"
+#include "downsampling.hh"
+#include "compact_format.hh"
+#include "partition_index.hh"
 
 namespace sstables {
 
@@ -111,6 +119,16 @@ class mutation_reader {
 class key;
 class sstable_writer;
 
+// Where to look for a partition in an sstable, see sstable::lookup_partition().
+struct partition_lookup {
+    // Position of the partition, if the key cache knows it.
+    std::experimental::optional<key_cache_position> cached;
+    // Otherwise, the summary entry of the index page which may contain it.
+    int summary_idx;
+    // Or whether to look it up in the PartitionIndex component instead.
+    bool use_partition_index = false;
+};
+
 using index_list = std::vector<index_entry>;
 
 class sstable : public enable_lw_shared_from_this<sstable> {
@@ -127,8 +145,14 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         Statistics,
         TemporaryTOC,
         TemporaryStatistics,
+        CompressionDictionary,
+        ClusteringBounds,
+        PartitionIndex,
     };
-    enum class version_types { ka, la };
+    // sa is Scylla's own compact data format, see compact_format.hh. It is
+    // named like la, but data files of this version aren't readable by
+    // Cassandra.
+    enum class version_types { ka, la, sa };
     enum class format_types { big };
 public:
     sstable(sstring ks, sstring cf, sstring dir, int64_t generation, version_types v, format_types f, gc_clock::time_point now = gc_clock::now())
@@ -177,6 +201,13 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     // Like data_consume_rows() with bounds, but iterates over whole range
     data_consume_context data_consume_rows(row_consumer& consumer);
 
+    // Like data_consume_rows() with bounds, but the range starts inside a
+    // partition, at a cell boundary (e.g. at a promoted index block), and may
+    // end before the end of that partition. The caller is responsible for
+    // feeding the partition header to the consumer with consume_row_start().
+    // consume_row_end() is called when the end of range is reached.
+    data_consume_context data_consume_partition_blocks(row_consumer& consumer, uint64_t start, uint64_t end);
+
     static component_type component_from_sstring(sstring& s);
     static version_types version_from_sstring(sstring& s);
     static format_types format_from_sstring(sstring& s);
@@ -201,6 +232,27 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         const key& k,
         query::clustering_key_filtering_context ck_filtering = query::no_clustering_key_filtering,
         const io_priority_class& pc = default_priority_class());
+
+    // Reads a partition located by lookup_partition() for the same key.
+    // If data_bytes is given, the size of the partition in the data file is
+    // added to it when the partition is found.
+    future<streamed_mutation_opt> read_row(
+        schema_ptr schema,
+        const key& k,
+        partition_lookup lookup,
+        query::clustering_key_filtering_context ck_filtering = query::no_clustering_key_filtering,
+        const io_priority_class& pc = default_priority_class(),
+        uint64_t* data_bytes = nullptr);
+
+    // Locates a partition using only the in-memory components, i.e. the key
+    // cache and the summary. Sstables with a partition index are left for
+    // read_row() to look up in it. Doesn't check the filter. Returns a
+    // disengaged optional if the sstable can't contain the partition.
+    std::experimental::optional<partition_lookup> lookup_partition(const schema& s, const key& k, const dht::token& token);
+
+    // Starts loading the summary entries which lookup_partition() reads
+    // first into the CPU cache.
+    void prefetch_summary() const;
     /**
      * @param schema a schema_ptr object describing this table
      * @param min the minimum token we want to search for (inclusive)
@@ -251,6 +303,15 @@ class sstable : public enable_lw_shared_from_this<sstable> {
                 _summary.header.min_index_interval;
     }
 
+    // Estimates the number of partitions of this sstable in the given
+    // non-wrapping token range, from the keys sampled by the summary.
+    uint64_t estimated_keys_for_range(const range<dht::token>& range) const;
+
+    // The sketch of the partition keys of this sstable kept in its
+    // compaction metadata. Disengaged if the sstable has none, or has one
+    // in a format we can't read.
+    std::experimental::optional<hll::HyperLogLog> get_cardinality() const;
+
     // mark_for_deletion() specifies that a sstable isn't relevant to the
     // current shard, and thus can be deleted by the deletion manager, if
     // all shards sharing it agree. In case the sstable is unshared, it's
@@ -287,8 +348,14 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         return _filter_file_size;
     }
 
+    // Zero when the filter isn't loaded.
     uint64_t filter_memory_size() const {
-        return _filter->memory_size();
+        return _filter.memory_size();
+    }
+
+    // Memory used by the chunk offsets, zero if the sstable isn't compressed.
+    uint64_t compression_memory_size() const {
+        return _compression.offsets.elements.size() * sizeof(uint64_t);
     }
 
     // Returns the total bytes of all components.
@@ -326,6 +393,12 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         return create_links(dir, _generation);
     }
 
+    // Links all components into dir, the TOC last, without syncing dir.
+    // Unlike create_links(), a crash can leave a partial set of links behind,
+    // so this is only suitable for snapshots, which are complete only once
+    // their manifest has been written after the directory was synced.
+    future<> create_snapshot_links(sstring dir) const;
+
     /**
      * Note. This is using the Origin definition of
      * max_data_age, which is load time. This could maybe
@@ -349,6 +422,8 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     { }
 
     size_t sstable_buffer_size = 128*1024;
+    // Components up to this size are read in one go.
+    static constexpr size_t max_prefetched_component_size = 1 << 20;
 
     static std::unordered_map<version_types, sstring, enum_hash<version_types>> _version_string;
     static std::unordered_map<format_types, sstring, enum_hash<format_types>> _format_string;
@@ -358,15 +433,34 @@ class sstable : public enable_lw_shared_from_this<sstable> {
 
     bool _shared = true;  // across shards; safe default
     compression _compression;
-    utils::filter_ptr _filter;
+    cached_filter _filter;
+    // Set while the filter is being loaded on demand.
+    std::experimental::optional<shared_future<>> _filter_load;
     summary _summary;
+    int _summary_disk_sampling_level = downsampling::BASE_SAMPLING_LEVEL;
+    unsigned _summary_users = 0;
+    uint64_t _index_reads = 0;
+    uint64_t _last_index_reads = 0;
     statistics _statistics;
     // NOTE: _collector and _c_stats are used to generation of statistics file
     // when writing a new sstable.
     metadata_collector _collector;
     column_stats _c_stats;
+    // Bounds of the clustered content, collected when writing and read from
+    // the ClusteringBounds component otherwise. See clustering_bounds.
+    uint8_t _clustering_flags = 0;
+    // Whether the partition being written has live data so far.
+    bool _partition_is_live = false;
+    // Set while writing an sstable of the compact format.
+    std::unique_ptr<compact::atom_writer> _atom_writer;
+    std::experimental::optional<clustering_key_prefix> _min_clustering;
+    std::experimental::optional<clustering_key_prefix> _max_clustering;
     file _index_file;
     file _data_file;
+    file _partition_index_file;
+    // Loaded if the sstable has a PartitionIndex component, which then takes
+    // over point lookups from the summary and the index.
+    lw_shared_ptr<partition_index> _partition_index;
     uint64_t _data_file_size;
     uint64_t _index_file_size;
     uint64_t _filter_file_size = 0;
@@ -380,6 +474,10 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     format_types _format;
 
     filter_tracker _filter_tracker;
+    key_cache_owner _key_cache_owner;
+    chunk_cache_owner _chunk_cache_owner;
+    // Of the sstable's table, set on first read.
+    lw_shared_ptr<table_read_sizes> _read_sizes;
 
     bool _marked_for_deletion = false;
 
@@ -395,7 +493,7 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     template <sstable::component_type Type, typename T>
     void write_simple(T& comp, const io_priority_class& pc);
 
-    void generate_toc(compressor c, double filter_fp_chance);
+    void generate_toc(const compression_parameters& cp, double filter_fp_chance);
     void write_toc(const io_priority_class& pc);
     future<> seal_sstable();
 
@@ -403,6 +501,10 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     void write_compression(const io_priority_class& pc);
 
     future<> read_filter(const io_priority_class& pc);
+    future<> read_filter_size();
+    // Loads the filter if it isn't loaded. Failures are logged, and leave
+    // the filter unloaded.
+    future<> load_filter();
 
     void write_filter(const io_priority_class& pc);
 
@@ -418,6 +520,9 @@ class sstable : public enable_lw_shared_from_this<sstable> {
 
     future<> read_statistics(const io_priority_class& pc);
     void write_statistics(const io_priority_class& pc);
+    future<> read_clustering_bounds(const io_priority_class& pc);
+    void write_clustering_bounds(const io_priority_class& pc);
+    void update_clustering_bounds(const schema& s, const clustering_key_prefix& start, const clustering_key_prefix& end);
     // Rewrite statistics component by creating a temporary Statistics and
     // renaming it into place of existing one.
     void rewrite_statistics(const io_priority_class& pc);
@@ -434,7 +539,12 @@ class sstable : public enable_lw_shared_from_this<sstable> {
     // of bytes to be read using this stream, we can make better choices
     // about the buffer size to read, and where exactly to stop reading
     // (even when a large buffer size is used).
-    input_stream<char> data_stream(uint64_t pos, size_t len, const io_priority_class& pc);
+    //
+    // Reads start small and grow as the stream is consumed, see
+    // adaptive_read_options. initial_read_size, if given, overrides the size
+    // of the first read, which otherwise depends on whether pc is that of a
+    // sequential reader (compaction, streaming).
+    input_stream<char> data_stream(uint64_t pos, size_t len, const io_priority_class& pc, size_t initial_read_size = 0);
 
     // Read exactly the specific byte range from the data file (after
     // uncompression, if the file is compressed). This can be used to read
@@ -473,8 +583,16 @@ class sstable : public enable_lw_shared_from_this<sstable> {
 
     future<summary_entry&> read_summary_entry(size_t i);
 
-    // FIXME: pending on Bloom filter implementation
-    bool filter_has_key(const key& key) { return _filter->is_present(bytes_view(key)); }
+    // An sstable whose filter isn't loaded may have any key. The filter is
+    // then loaded in the background, for the reads to come.
+    bool filter_has_key(const key& key) {
+        auto f = _filter.get();
+        if (!f) {
+            load_filter();
+            return true;
+        }
+        return f->is_present(bytes_view(key));
+    }
     bool filter_has_key(const schema& s, const dht::decorated_key& dk) { return filter_has_key(key::from_partition_key(s, dk._key)); }
 
     // NOTE: functions used to generate sstable components.
@@ -489,12 +607,29 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         write_range_tombstone(out, start, bound_kind::incl_start, end, bound_kind::incl_end, std::move(suffix), std::move(t));
     }
     void write_collection(file_writer& out, const composite& clustering_key, const column_definition& cdef, collection_mutation_view collection);
+
+    void account_cell(atomic_cell_view cell);
+    void account_row_marker(const row_marker& marker);
+    void account_range_tombstone(const tombstone& t);
+    void write_compact_cell(bytes_view column, bytes_view extra, atomic_cell_view cell);
+    void write_compact_row_marker(const row_marker& marker);
+    void write_compact_clustered_row(file_writer& out, const schema& schema, const clustering_row& clustered_row);
+    void write_compact_static_row(file_writer& out, const schema& schema, const row& static_row);
+    void write_compact_collection(file_writer& out, const composite& clustering_key, const column_definition& cdef, collection_mutation_view collection);
 public:
     future<> read_toc();
 
     bool filter_has_key(const schema& s, partition_key_view key) {
         return filter_has_key(key::from_partition_key(s, key));
     }
+    bool filter_has_key(const utils::hashed_key& hk) {
+        auto f = _filter.get();
+        if (!f) {
+            load_filter();
+            return true;
+        }
+        return f->is_present(hk);
+    }
 
     uint64_t filter_get_false_positive() {
         return _filter_tracker.false_positive;
@@ -538,21 +673,117 @@ class sstable : public enable_lw_shared_from_this<sstable> {
         return s;
     }
 
+    // Only sstables of the compact format have a serialization header.
+    const serialization_header* get_serialization_header() const {
+        if (_version != version_types::sa) {
+            return nullptr;
+        }
+        auto entry = _statistics.contents.find(metadata_type::Serialization);
+        if (entry == _statistics.contents.end() || !entry->second) {
+            throw std::runtime_error("Serialization header not available");
+        }
+        return static_cast<const serialization_header*>(entry->second.get());
+    }
+
     uint32_t get_sstable_level() const {
         return get_stats_metadata().sstable_level;
     }
 
+    // When the data of this sstable was last repaired, in milliseconds since
+    // the epoch, or 0 if it wasn't.
+    uint64_t get_repaired_at() const {
+        return get_stats_metadata().repaired_at;
+    }
+
+    bool is_repaired() const {
+        return get_repaired_at() != 0;
+    }
+
+    // Generations of the sstables this one was compacted from, empty for
+    // sstables written by a flush. sstables written by the same compaction
+    // have the same ancestors.
+    std::vector<uint32_t> ancestors() const {
+        auto entry = _statistics.contents.find(metadata_type::Compaction);
+        if (entry == _statistics.contents.end() || !entry->second) {
+            return {};
+        }
+        auto& ancestors = static_cast<const compaction_metadata&>(*entry->second).ancestors.elements;
+        return std::vector<uint32_t>(ancestors.begin(), ancestors.end());
+    }
+
+    // Returns false if a read of given clustering ranges of any partition
+    // can ignore this sstable: the ranges miss all its rows and range
+    // tombstones, and it has no partition tombstones nor static rows. Always
+    // true for sstables without the ClusteringBounds component.
+    bool may_contain_rows(const schema& s, const std::vector<query::clustering_range>& ranges) const;
+
+    // Returns true if every partition in this sstable is live, and it has no
+    // tombstones nor expiring data, so that listing its partitions takes
+    // reading the index only. Always false for sstables without the
+    // ClusteringBounds component.
+    bool has_only_live_partitions() const {
+        return has_component(component_type::ClusteringBounds)
+            && (_clustering_flags & clustering_bounds::only_live_partitions);
+    }
+
     // This will change sstable level only in memory.
     void set_sstable_level(uint32_t);
 
     double get_compression_ratio() const;
 
     future<> mutate_sstable_level(uint32_t);
+    // Marks the sstable as repaired at the given time, see get_repaired_at().
+    future<> mutate_repaired_at(uint64_t);
 
     const summary& get_summary() const {
         return _summary;
     }
 
+    // Index summary resampling, driven by index_summary_manager.
+    //
+    // Summary entries are addressed by index across deferring points by
+    // readers, which hold a summary_guard meanwhile. The summary of an
+    // sstable is resampled only while no guard is held.
+    class summary_guard {
+        sstable* _sst;
+    public:
+        explicit summary_guard(sstable& sst) : _sst(&sst) {
+            ++_sst->_summary_users;
+        }
+        summary_guard(summary_guard&& o) noexcept : _sst(o._sst) {
+            o._sst = nullptr;
+        }
+        summary_guard& operator=(summary_guard&&) = delete;
+        ~summary_guard() {
+            if (_sst) {
+                --_sst->_summary_users;
+            }
+        }
+    };
+    bool summary_in_use() const {
+        return _summary_users;
+    }
+    int summary_sampling_level() const {
+        return _summary.header.sampling_level;
+    }
+    // Sampling level of the summary on disk, the highest one it can be
+    // resampled to.
+    int summary_disk_sampling_level() const {
+        return _summary_disk_sampling_level;
+    }
+    // Removes entries from the summary, down to given sampling level.
+    void downsample_summary(int sampling_level);
+    // Changes the sampling level of the summary, re-reading it from disk
+    // if the new level is higher than the current one. Does nothing if the
+    // summary is in use by the time it was read.
+    future<> resample_summary(int sampling_level, const io_priority_class& pc);
+    // Number of index page reads since the last call.
+    uint64_t get_recent_index_reads() {
+        auto t = _index_reads - _last_index_reads;
+        _last_index_reads = _index_reads;
+        return t;
+    }
+
     // Return sstable key range as range<partition_key> reading only the summary component.
     future<range<partition_key>>
     get_sstable_key_range(const schema& s);
@@ -601,6 +832,15 @@ struct entry_descriptor {
 // It is also waited for when seastar exits.
 future<> await_background_jobs();
 
+// Called for every partition written to an sstable whose size in the data
+// file is above the large partition threshold, with its size and number of
+// clustering rows. Mustn't defer.
+using large_partition_handler = std::function<void(const sstable& sst, const schema& s, const key& k, uint64_t size, uint64_t rows)>;
+
+// Sets the threshold and the handler of large partitions of the shard. A
+// threshold of 0 disables the reporting.
+void set_large_partition_handler(uint64_t threshold, large_partition_handler handler);
+
 // Invokes await_background_jobs() on all shards
 future<> await_background_jobs_on_all_shards();
 
@@ -653,14 +893,18 @@ class components_writer {
     const schema& _schema;
     file_writer& _out;
     file_writer _index;
+    stdx::optional<partition_index_writer> _partition_index;
+    // Trie key of the partition being written.
+    stdx::optional<bytes> _partition_index_key;
     uint64_t _max_sstable_size;
     bool _tombstone_written;
+    uint64_t _partition_rows;
     // Remember first and last keys, which we need for the summary file.
     stdx::optional<key> _first_key, _last_key;
     stdx::optional<key> _partition_key;
 private:
-    size_t get_offset();
     file_writer index_file_writer(sstable& sst, const io_priority_class& pc);
+    file_writer partition_index_file_writer(sstable& sst, const io_priority_class& pc);
     void ensure_tombstone_is_written() {
         if (!_tombstone_written) {
             consume(tombstone());
@@ -676,6 +920,9 @@ class components_writer {
     stop_iteration consume(range_tombstone&& rt);
     stop_iteration consume_end_of_partition();
     void consume_end_of_stream();
+
+    // Size of the data file written so far.
+    size_t get_offset();
 };
 
 class sstable_writer {
@@ -700,6 +947,8 @@ class sstable_writer {
     stop_iteration consume(range_tombstone&& rt) { return _components_writer->consume(std::move(rt)); }
     stop_iteration consume_end_of_partition() { return _components_writer->consume_end_of_partition(); }
     void consume_end_of_stream();
+    // Bytes written to the data file so far.
+    size_t bytes_written() { return _components_writer->get_offset(); }
 };
 
 }
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <list>
+#include <vector>
+#include "sstables.hh"
+#include "compaction.hh"
+#include "timestamp.hh"
+#include "date_tiered_compaction_strategy.hh"
+#include "cql3/statements/property_definitions.hh"
+
+class time_window_compaction_strategy_options {
+    const sstring DEFAULT_TIMESTAMP_RESOLUTION = "MICROSECONDS";
+    const sstring DEFAULT_COMPACTION_WINDOW_UNIT = "DAYS";
+    static constexpr int DEFAULT_COMPACTION_WINDOW_SIZE = 1;
+    static constexpr int64_t DEFAULT_EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS = 600;
+
+    const sstring TIMESTAMP_RESOLUTION_KEY = "timestamp_resolution";
+    const sstring COMPACTION_WINDOW_UNIT_KEY = "compaction_window_unit";
+    const sstring COMPACTION_WINDOW_SIZE_KEY = "compaction_window_size";
+    const sstring EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS_KEY = "expired_sstable_check_frequency_seconds";
+
+    // Size of a window, in units of timestamp_resolution.
+    api::timestamp_type window_size;
+    std::chrono::seconds expired_sstable_check_frequency;
+public:
+    time_window_compaction_strategy_options(const std::map<sstring, sstring>& options) {
+        using namespace cql3::statements;
+
+        auto tmp_value = get_value(options, TIMESTAMP_RESOLUTION_KEY);
+        auto target_unit = tmp_value ? tmp_value.value() : DEFAULT_TIMESTAMP_RESOLUTION;
+
+        tmp_value = get_value(options, COMPACTION_WINDOW_UNIT_KEY);
+        auto window_unit = tmp_value ? tmp_value.value() : DEFAULT_COMPACTION_WINDOW_UNIT;
+
+        tmp_value = get_value(options, COMPACTION_WINDOW_SIZE_KEY);
+        auto size = property_definitions::to_int(COMPACTION_WINDOW_SIZE_KEY, tmp_value, DEFAULT_COMPACTION_WINDOW_SIZE);
+        if (size <= 0) {
+            throw exceptions::configuration_exception(sprint("%s must be greater than 0, but was %d", COMPACTION_WINDOW_SIZE_KEY, size));
+        }
+        window_size = duration_conversor::convert(target_unit, window_duration(window_unit) * size);
+
+        tmp_value = get_value(options, EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS_KEY);
+        expired_sstable_check_frequency = std::chrono::seconds(property_definitions::to_long(EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS_KEY,
+                tmp_value, DEFAULT_EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS));
+    }
+
+    time_window_compaction_strategy_options()
+        : window_size(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::hours(24) * DEFAULT_COMPACTION_WINDOW_SIZE).count())
+        , expired_sstable_check_frequency(DEFAULT_EXPIRED_SSTABLE_CHECK_FREQUENCY_SECONDS)
+    { }
+
+    // Returns the lower bound of the window the given timestamp falls into.
+    api::timestamp_type window_of(api::timestamp_type ts) const {
+        auto r = ts % window_size;
+        return ts - (r < 0 ? r + window_size : r);
+    }
+private:
+    static std::chrono::seconds window_duration(const sstring& unit) {
+        if (unit == "MINUTES") {
+            return std::chrono::minutes(1);
+        } else if (unit == "HOURS") {
+            return std::chrono::hours(1);
+        } else if (unit == "DAYS") {
+            return std::chrono::hours(24);
+        }
+        throw exceptions::configuration_exception(sprint("compaction_window_unit %s is not valid, use MINUTES, HOURS or DAYS", unit));
+    }
+
+    static std::experimental::optional<sstring> get_value(const std::map<sstring, sstring>& options, const sstring& name) {
+        auto it = options.find(name);
+        if (it == options.end()) {
+            return std::experimental::nullopt;
+        }
+        return it->second;
+    }
+
+    friend class time_window_manifest;
+};
+
+/**
+ * Groups sstables into fixed size windows of write time, by the max timestamp
+ * of each sstable. The newest window, where writes still land, is compacted
+ * the size-tiered way. Every closed window is compacted down to a single
+ * sstable, which then isn't touched again until it expires; fully expired
+ * sstables are compacted on their own, which drops them without reading them.
+ */
+class time_window_manifest {
+    static logging::logger logger;
+
+    time_window_compaction_strategy_options _options;
+    std::chrono::steady_clock::time_point _last_expired_check;
+public:
+    time_window_manifest() = delete;
+
+    time_window_manifest(const std::map<sstring, sstring>& options)
+        : _options(options)
+    { }
+
+    const time_window_compaction_strategy_options& options() const {
+        return _options;
+    }
+
+    std::vector<sstables::shared_sstable>
+    get_next_sstables(column_family& cf, std::vector<sstables::shared_sstable>& uncompacting, gc_clock::time_point gc_before) {
+        if (cf.get_sstables()->empty()) {
+            return {};
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - _last_expired_check >= _options.expired_sstable_check_frequency) {
+            _last_expired_check = now;
+            auto expired = sstables::get_fully_expired_sstables(cf, uncompacting, gc_before.time_since_epoch().count());
+            if (!expired.empty()) {
+                logger.debug("Dropping {} fully expired sstables", expired.size());
+                return expired;
+            }
+        }
+
+        auto buckets = get_buckets(uncompacting);
+        return newest_bucket(buckets, cf.schema()->min_compaction_threshold(), cf.schema()->max_compaction_threshold());
+    }
+
+    int64_t get_estimated_tasks(column_family& cf) const {
+        int min_threshold = cf.schema()->min_compaction_threshold();
+        int max_threshold = cf.schema()->max_compaction_threshold();
+        auto all = cf.get_sstables();
+        std::vector<sstables::shared_sstable> sstables(all->begin(), all->end());
+        auto buckets = get_buckets(sstables);
+        int64_t n = 0;
+
+        for (auto it = buckets.rbegin(); it != buckets.rend(); ++it) {
+            auto& bucket = it->second;
+            if (bucket.size() >= size_t(it == buckets.rbegin() ? min_threshold : 2)) {
+                n += std::ceil(double(bucket.size()) / max_threshold);
+            }
+        }
+        return n;
+    }
+
+    /**
+     * Group files into windows by their max timestamp.
+     * @return map of window lower bound to the files in that window.
+     */
+    std::map<api::timestamp_type, std::vector<sstables::shared_sstable>>
+    get_buckets(const std::vector<sstables::shared_sstable>& files) const {
+        std::map<api::timestamp_type, std::vector<sstables::shared_sstable>> buckets;
+        for (auto& sst : files) {
+            buckets[_options.window_of(sst->get_stats_metadata().max_timestamp)].push_back(sst);
+        }
+        return buckets;
+    }
+private:
+    /**
+     * @param buckets files grouped by window, the newest window is taken to be the one still written to.
+     * @return the files to compact: a size-tiered bucket of the newest window if it has at least
+     * min_threshold files, otherwise (up to max_threshold of the smallest) files of the newest older
+     * window which still has more than one.
+     */
+    std::vector<sstables::shared_sstable>
+    newest_bucket(std::map<api::timestamp_type, std::vector<sstables::shared_sstable>>& buckets, int min_threshold, int max_threshold) const {
+        for (auto it = buckets.rbegin(); it != buckets.rend(); ++it) {
+            auto& bucket = it->second;
+            if (it == buckets.rbegin()) {
+                if (bucket.size() >= size_t(min_threshold)) {
+                    auto stcs = sstables::size_tiered_most_interesting_bucket(std::list<sstables::shared_sstable>(bucket.begin(), bucket.end()));
+                    if (!stcs.empty()) {
+                        trim_to_threshold(stcs, max_threshold);
+                        return stcs;
+                    }
+                }
+            } else if (bucket.size() >= 2) {
+                logger.debug("Compacting {} sstables of window {}", bucket.size(), it->first);
+                trim_to_threshold(bucket, max_threshold);
+                return bucket;
+            }
+        }
+        return {};
+    }
+
+    // Keeps the max_threshold smallest sstables of the bucket.
+    static void trim_to_threshold(std::vector<sstables::shared_sstable>& bucket, int max_threshold) {
+        std::sort(bucket.begin(), bucket.end(), [] (auto& i, auto& j) {
+            return i->data_size() < j->data_size();
+        });
+        bucket.resize(std::min(bucket.size(), size_t(max_threshold)));
+    }
+};
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trickle_fsync_file.hh"
+
+namespace sstables {
+
+static thread_local size_t trickle_fsync_interval = 0;
+
+void set_trickle_fsync_interval(size_t bytes) {
+    trickle_fsync_interval = bytes;
+}
+
+size_t get_trickle_fsync_interval() {
+    return trickle_fsync_interval;
+}
+
+file make_trickle_fsync_file(file f) {
+    if (!trickle_fsync_interval) {
+        return f;
+    }
+    return file(::make_shared<trickle_fsync_file_impl>(std::move(f), trickle_fsync_interval));
+}
+
+trickle_fsync_file_impl::trickle_fsync_file_impl(file f, size_t interval)
+        : _file(std::move(f))
+        , _interval(interval) {
+    _memory_dma_alignment = _file.memory_dma_alignment();
+    _disk_read_dma_alignment = _file.disk_read_dma_alignment();
+    _disk_write_dma_alignment = _file.disk_write_dma_alignment();
+}
+
+future<size_t> trickle_fsync_file_impl::maybe_sync(size_t written) {
+    _unsynced += written;
+    if (_unsynced < _interval) {
+        return make_ready_future<size_t>(written);
+    }
+    _unsynced = 0;
+    return with_semaphore(_sync_sem, 1, [this] {
+        return get_file_impl(_file)->flush();
+    }).then([written] {
+        return written;
+    });
+}
+
+future<size_t> trickle_fsync_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) {
+    return get_file_impl(_file)->write_dma(pos, buffer, len, pc).then([this] (size_t written) {
+        return maybe_sync(written);
+    });
+}
+
+future<size_t> trickle_fsync_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) {
+    return get_file_impl(_file)->write_dma(pos, std::move(iov), pc).then([this] (size_t written) {
+        return maybe_sync(written);
+    });
+}
+
+future<size_t> trickle_fsync_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) {
+    return get_file_impl(_file)->read_dma(pos, buffer, len, pc);
+}
+
+future<size_t> trickle_fsync_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) {
+    return get_file_impl(_file)->read_dma(pos, std::move(iov), pc);
+}
+
+future<> trickle_fsync_file_impl::flush(void) {
+    _unsynced = 0;
+    return get_file_impl(_file)->flush();
+}
+
+future<struct stat> trickle_fsync_file_impl::stat(void) {
+    return get_file_impl(_file)->stat();
+}
+
+future<> trickle_fsync_file_impl::truncate(uint64_t length) {
+    return get_file_impl(_file)->truncate(length);
+}
+
+future<> trickle_fsync_file_impl::discard(uint64_t offset, uint64_t length) {
+    return get_file_impl(_file)->discard(offset, length);
+}
+
+future<> trickle_fsync_file_impl::allocate(uint64_t position, uint64_t length) {
+    return get_file_impl(_file)->allocate(position, length);
+}
+
+future<uint64_t> trickle_fsync_file_impl::size(void) {
+    return get_file_impl(_file)->size();
+}
+
+future<> trickle_fsync_file_impl::close() {
+    // Wait for a sync a write triggered, which may still be running.
+    return with_semaphore(_sync_sem, 1, [this] {
+        return get_file_impl(_file)->close();
+    });
+}
+
+subscription<directory_entry> trickle_fsync_file_impl::list_directory(std::function<future<> (directory_entry de)> next) {
+    return get_file_impl(_file)->list_directory(std::move(next));
+}
+
+}
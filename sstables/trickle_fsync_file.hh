@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <seastar/core/file.hh>
+#include <seastar/core/semaphore.hh>
+
+namespace sstables {
+
+// Wraps a file being written sequentially, and syncs it each time a given
+// amount of data was written to it since the previous sync. This keeps the
+// amount of data the device and the filesystem have yet to make durable
+// bounded, so the final sync of a large file doesn't stall its writer, and
+// everyone else using the disk, for a long time. Writes wait for the syncs
+// they trigger, which throttles a writer going faster than the disk can
+// keep up with.
+class trickle_fsync_file_impl : public file_impl {
+    file _file;
+    size_t _interval;
+    size_t _unsynced = 0;
+    // Concurrent writes which cross the interval together sync once.
+    semaphore _sync_sem{1};
+private:
+    future<size_t> maybe_sync(size_t written);
+public:
+    trickle_fsync_file_impl(file f, size_t interval);
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override;
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override;
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override;
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override;
+    virtual future<> flush(void) override;
+    virtual future<struct stat> stat(void) override;
+    virtual future<> truncate(uint64_t length) override;
+    virtual future<> discard(uint64_t offset, uint64_t length) override;
+    virtual future<> allocate(uint64_t position, uint64_t length) override;
+    virtual future<uint64_t> size(void) override;
+    virtual future<> close() override;
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
+};
+
+// Number of bytes after which data and index files of sstables written by
+// this shard from now on are synced. 0 disables trickle syncing, leaving the
+// files to be synced only when the sstable is sealed.
+void set_trickle_fsync_interval(size_t bytes);
+size_t get_trickle_fsync_interval();
+
+// Returns f wrapped by trickle_fsync_file_impl if trickle syncing is
+// enabled, f itself otherwise.
+file make_trickle_fsync_file(file f);
+
+}
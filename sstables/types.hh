@@ -52,7 +52,46 @@ struct option {
     auto describe_type(Describer f) { return f(key, value); }
 };
 
+// Contents of the CompressionDictionary component: the zstd dictionary the
+// chunks of the data file were compressed with. Empty if none could be trained.
+struct compression_dictionary {
+    disk_string<uint32_t> data;
+
+    template <typename Describer>
+    auto describe_type(Describer f) { return f(data); }
+};
+
+// Contents of the ClusteringBounds component, which Cassandra doesn't have:
+// the components of the smallest and the largest clustering prefix among the
+// rows and range tombstone bounds of the sstable, and what else it holds that
+// a slice read has to see whatever its clustering ranges. The min and max
+// column names of Statistics can't serve this purpose, as they are collected
+// from cell names rather than from clustering keys.
+//
+// The component also tells whether every partition of the sstable is live by
+// itself: it holds live data, and no tombstones nor expiring data which could
+// make it, or a partition of another sstable, go away. The keys in the index
+// are then the keys of live partitions.
+struct clustering_bounds {
+    static constexpr uint8_t has_partition_tombstones = 1;
+    static constexpr uint8_t has_static_rows = 2;
+    static constexpr uint8_t has_clustered_content = 4;
+    static constexpr uint8_t only_live_partitions = 8;
+
+    uint8_t flags = 0;
+    disk_array<uint32_t, disk_string<uint16_t>> min;
+    disk_array<uint32_t, disk_string<uint16_t>> max;
+
+    template <typename Describer>
+    auto describe_type(Describer f) { return f(flags, min, max); }
+};
+
 struct filter {
+    // Set in the hash count of filters using the blocked layout, which
+    // Cassandra doesn't know about. Such a hash count is way above anything
+    // it would accept, so it refuses the filter rather than misreading it.
+    static constexpr uint32_t blocked_layout_flag = 1u << 30;
+
     uint32_t hashes;
     disk_array<uint32_t, uint64_t> buckets;
 
@@ -82,6 +121,10 @@ class index_entry {
         return _position;
     }
 
+    bytes_view get_promoted_index_bytes() const {
+        return to_bytes_view(_promoted_index);
+    }
+
     index_entry(temporary_buffer<char>&& key, uint64_t position, temporary_buffer<char>&& promoted_index)
         : _key(std::move(key)), _position(position), _promoted_index(std::move(promoted_index)) {}
 
@@ -223,6 +266,27 @@ struct ka_stats_metadata : public metadata {
 };
 using stats_metadata = ka_stats_metadata;
 
+// Scylla's own metadata, present only in sstables of the compact format
+// (see compact_format.hh). Timestamps and deletion times in the data file
+// are deltas against the bases, and cells name their column by its index
+// into columns.
+struct serialization_header : public metadata {
+    int64_t timestamp_base = 0;
+    int32_t local_deletion_time_base = 0;
+    disk_array<uint32_t, disk_string<uint16_t>> columns;
+
+    size_t serialized_size() {
+        size_t size = sizeof(timestamp_base) + sizeof(local_deletion_time_base) + sizeof(uint32_t);
+        for (auto& c : columns.elements) {
+            size += sizeof(uint16_t) + c.value.size();
+        }
+        return size;
+    }
+
+    template <typename Describer>
+    auto describe_type(Describer f) { return f(timestamp_base, local_deletion_time_base, columns); }
+};
+
 // Numbers are found on disk, so they do matter. Also, setting their sizes of
 // that of an uint32_t is a bit wasteful, but it simplifies the code a lot
 // since we can now still use a strongly typed enum without introducing a
@@ -231,6 +295,7 @@ enum class metadata_type : uint32_t {
     Validation = 0,
     Compaction = 1,
     Stats = 2,
+    Serialization = 3,
 };
 
 
@@ -23,6 +23,8 @@
 
 #include "core/iostream.hh"
 #include "core/fstream.hh"
+#include "core/do_with.hh"
+#include "core/future-util.hh"
 #include "types.hh"
 #include "compress.hh"
 #include <seastar/core/byteorder.hh>
@@ -141,17 +143,54 @@ output_stream<char> make_checksummed_file_output_stream(file f, struct checksum&
 // compressed_file_data_sink_impl works as a filter for a file output stream,
 // where the buffer flushed will be compressed and its checksum computed, then
 // the result passed to a regular output stream.
+//
+// If a zstd dictionary is to be trained, the first chunks are held back until
+// there are enough of them to train it on, or until the stream is closed.
 class compressed_file_data_sink_impl : public data_sink_impl {
+    static constexpr size_t max_dictionary_training_bytes = 8 << 20;
+
     output_stream<char> _out;
     sstables::compression* _compression_metadata;
     size_t _pos = 0;
+    bool _training;
+    std::vector<temporary_buffer<char>> _training_chunks;
+    size_t _training_bytes = 0;
+private:
+    size_t training_bytes_needed() const {
+        return std::min<size_t>(100 * _compression_metadata->dictionary_size(), max_dictionary_training_bytes);
+    }
+    future<> train_and_flush() {
+        _training = false;
+        auto dict = sstables::train_zstd_dictionary(_training_chunks, _compression_metadata->dictionary_size());
+        if (!dict.empty()) {
+            _compression_metadata->set_dictionary(make_lw_shared<const sstables::zstd_dictionary>(std::move(dict)));
+        }
+        return do_with(std::move(_training_chunks), [this] (std::vector<temporary_buffer<char>>& chunks) {
+            return do_for_each(chunks, [this] (temporary_buffer<char>& buf) {
+                return write_chunk(std::move(buf));
+            });
+        });
+    }
 public:
     compressed_file_data_sink_impl(file f, sstables::compression* cm, file_output_stream_options options)
             : _out(make_file_output_stream(std::move(f), options))
-            , _compression_metadata(cm) {}
+            , _compression_metadata(cm)
+            , _training(cm->dictionary_size() != 0) {}
 
     future<> put(net::packet data) { abort(); }
     virtual future<> put(temporary_buffer<char> buf) override {
+        if (_training) {
+            _training_bytes += buf.size();
+            _training_chunks.push_back(std::move(buf));
+            if (_training_bytes < training_bytes_needed()) {
+                return make_ready_future<>();
+            }
+            return train_and_flush();
+        }
+        return write_chunk(std::move(buf));
+    }
+private:
+    future<> write_chunk(temporary_buffer<char> buf) {
         auto output_len = _compression_metadata->compress_max_size(buf.size());
         // account space for checksum that goes after compressed data.
         temporary_buffer<char> compressed(output_len + 4);
@@ -181,8 +220,12 @@ class compressed_file_data_sink_impl : public data_sink_impl {
         auto f = _out.write(compressed.get(), compressed.size());
         return f.then([compressed = std::move(compressed)] {});
     }
+public:
     virtual future<> close() {
-        return _out.close();
+        auto f = _training ? train_and_flush() : make_ready_future<>();
+        return f.then([this] {
+            return _out.close();
+        });
     }
 };
 
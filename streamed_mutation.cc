@@ -21,6 +21,8 @@
 
 #include <stack>
 #include <boost/range/algorithm/heap_algorithm.hpp>
+#include <boost/range/algorithm/remove_if.hpp>
+#include <boost/algorithm/cxx11/none_of.hpp>
 
 #include "mutation.hh"
 #include "streamed_mutation.hh"
@@ -110,6 +112,52 @@ position_in_partition mutation_fragment::position() const
     return visit(get_position());
 }
 
+position_range position_range::from_range(const query::clustering_range& r) {
+    auto start = r.start()
+               ? bound_view(r.start()->value(), r.start()->is_inclusive() ? bound_kind::incl_start : bound_kind::excl_start)
+               : bound_view::bottom();
+    auto end = r.end()
+             ? bound_view(r.end()->value(), r.end()->is_inclusive() ? bound_kind::incl_end : bound_kind::excl_end)
+             : bound_view::top();
+    return {
+        position_in_partition(position_in_partition::range_tombstone_tag_t(), start),
+        position_in_partition(position_in_partition::range_tombstone_tag_t(), end)
+    };
+}
+
+void streamed_mutation::impl::forward_buffer_to(const position_in_partition& pos) {
+    while (!_buffer.empty() && is_before(_buffer.front(), pos)) {
+        _buffer.pop_front();
+    }
+    // The static row and range tombstones which overlap with pos may be
+    // followed by fragments which are before it.
+    if (_buffer.empty() || _buffer.front().is_clustering_row()) {
+        return;
+    }
+    circular_buffer<mutation_fragment> buffer;
+    buffer.reserve(buffer_size);
+    for (auto&& mf : _buffer) {
+        if (!is_before(mf, pos)) {
+            buffer.emplace_back(std::move(mf));
+        }
+    }
+    _buffer = std::move(buffer);
+}
+
+future<> streamed_mutation::impl::fast_forward_to(position_range pr) {
+    _range_end = pr.end();
+    forward_buffer_to(pr.start());
+    // The static row and range tombstones overlapping with the start of the
+    // range may be followed by fragments which still need to be skipped.
+    return do_until([this, start = pr.start()] {
+        return _end_of_stream || (!_buffer.empty() && !position_in_partition::less_compare(*_schema)(_buffer.back(), start));
+    }, [this, start = pr.start()] {
+        return fill_buffer().then([this, &start] {
+            forward_buffer_to(start);
+        });
+    });
+}
+
 std::ostream& operator<<(std::ostream& os, const streamed_mutation& sm) {
     auto& s = *sm.schema();
     fprint(os, "{%s.%s key %s streamed mutation}", s.ks_name(), s.cf_name(), sm.decorated_key());
@@ -208,10 +256,24 @@ class mutation_merger final : public streamed_mutation::impl {
     struct row_and_reader {
         mutation_fragment row;
         streamed_mutation* reader;
+        // Abbreviated key of the row, 0 if the fragment is not a clustering row.
+        uint64_t abbreviated_key;
     };
     std::vector<row_and_reader> _readers;
     range_tombstone_stream _deferred_tombstones;
 private:
+    uint64_t abbreviate(const mutation_fragment& mf) const {
+        return mf.is_clustering_row() ? mf.as_clustering_row().key().abbreviate(*_schema) : 0;
+    }
+    // Orders the heap so that the row with the smallest position is at the front.
+    static auto make_heap_compare(const position_in_partition::less_compare& cmp) {
+        return [&cmp] (const row_and_reader& a, const row_and_reader& b) {
+            if (rows_entry::ordered_by_abbreviations(a.abbreviated_key, b.abbreviated_key)) {
+                return b.abbreviated_key < a.abbreviated_key;
+            }
+            return cmp(b.row, a.row);
+        };
+    }
     void read_next() {
         if (_readers.empty()) {
             _end_of_stream = true;
@@ -219,8 +281,9 @@ class mutation_merger final : public streamed_mutation::impl {
         }
 
         position_in_partition::less_compare cmp(*_schema);
-        auto heap_compare = [&] (auto& a, auto& b) { return cmp(b.row, a.row); };
+        auto heap_compare = make_heap_compare(cmp);
 
+        uint64_t result_abbreviated_key = 0;
         auto result = [&] {
             auto rt = _deferred_tombstones.get_next(_readers.front().row);
             if (rt) {
@@ -228,13 +291,16 @@ class mutation_merger final : public streamed_mutation::impl {
             }
             boost::range::pop_heap(_readers, heap_compare);
             auto mf = std::move(_readers.back().row);
+            result_abbreviated_key = _readers.back().abbreviated_key;
             _next_readers.emplace_back(std::move(_readers.back().reader));
             _readers.pop_back();
             return std::move(mf);
         }();
 
         while (!_readers.empty()) {
-            if (cmp(result, _readers.front().row)) {
+            auto& next = _readers.front();
+            if (rows_entry::ordered_by_abbreviations(result_abbreviated_key, next.abbreviated_key)
+                    || cmp(result, next.row)) {
                 break;
             }
             boost::range::pop_heap(_readers, heap_compare);
@@ -255,14 +321,16 @@ class mutation_merger final : public streamed_mutation::impl {
 
     void do_fill_buffer() {
         position_in_partition::less_compare cmp(*_schema);
-        auto heap_compare = [&] (auto& a, auto& b) { return cmp(b.row, a.row); };
+        auto heap_compare = make_heap_compare(cmp);
 
         for (auto& rd : _next_readers) {
             if (rd->is_buffer_empty()) {
                 assert(rd->is_end_of_stream());
                 continue;
             }
-            _readers.emplace_back(row_and_reader { rd->pop_mutation_fragment(), std::move(rd) });
+            auto mf = rd->pop_mutation_fragment();
+            auto abbreviated_key = abbreviate(mf);
+            _readers.emplace_back(row_and_reader { std::move(mf), std::move(rd), abbreviated_key });
             boost::range::push_heap(_readers, heap_compare);
         }
         _next_readers.clear();
@@ -289,9 +357,6 @@ class mutation_merger final : public streamed_mutation::impl {
     }
 protected:
     virtual future<> fill_buffer() override  {
-        if (_next_readers.empty()) {
-            return make_ready_future<>();
-        }
         while (!is_end_of_stream() && !is_buffer_full()) {
             std::vector<future<>> more_data;
             for (auto& rd : _next_readers) {
@@ -306,6 +371,32 @@ class mutation_merger final : public streamed_mutation::impl {
         }
         return make_ready_future<>();
     }
+    virtual future<> fast_forward_to(position_range pr) override {
+        _range_end = pr.end();
+        forward_buffer_to(pr.start());
+        _deferred_tombstones.forward_to(pr.start());
+
+        // Readers whose current fragment is dropped, or which reached the end
+        // of the previous range, need to be read again.
+        _next_readers.clear();
+        position_in_partition::less_compare cmp(*_schema);
+        auto heap_compare = make_heap_compare(cmp);
+        auto it = boost::remove_if(_readers, [&] (const row_and_reader& rr) {
+            return is_before(rr.row, pr.start());
+        });
+        _readers.erase(it, _readers.end());
+        boost::range::make_heap(_readers, heap_compare);
+        for (auto& rd : _original_readers) {
+            if (boost::algorithm::none_of(_readers, [&] (const row_and_reader& rr) { return rr.reader == &rd; })) {
+                _next_readers.emplace_back(&rd);
+            }
+        }
+        _end_of_stream = false;
+
+        return parallel_for_each(_original_readers, [pr = std::move(pr)] (streamed_mutation& rd) {
+            return rd.fast_forward_to(pr);
+        });
+    }
 public:
     mutation_merger(schema_ptr s, dht::decorated_key dk, std::vector<streamed_mutation> readers)
         : streamed_mutation::impl(s, std::move(dk), merge_partition_tombstones(readers))
@@ -351,6 +442,21 @@ mutation_fragment_opt range_tombstone_stream::get_next(const mutation_fragment&
     return { };
 }
 
+void range_tombstone_stream::forward_to(const position_in_partition& pos)
+{
+    auto& rts = _list.tombstones();
+    auto it = rts.begin();
+    while (it != rts.end() && _cmp(it->start_bound(), pos)) {
+        if (!_cmp(pos, it->end_bound())) {
+            auto& rt = *it;
+            it = rts.erase(it);
+            current_deleter<range_tombstone>()(&rt);
+        } else {
+            ++it;
+        }
+    }
+}
+
 mutation_fragment_opt range_tombstone_stream::get_next()
 {
     if (!_list.empty()) {
@@ -390,6 +496,10 @@ streamed_mutation reverse_streamed_mutation(streamed_mutation sm) {
             , _source(std::move(sm))
         { }
 
+        virtual future<> fast_forward_to(position_range) override {
+            return make_exception_future<>(std::runtime_error("fast forwarding of reversed streamed_mutations is not supported"));
+        }
+
         virtual future<> fill_buffer() override {
             if (_source) {
                 return consume_source().then([this] { return fill_buffer(); });
@@ -276,6 +276,15 @@ class position_in_partition {
         return *_ck;
     }
 
+    // Positions created from bounds (see position_range) can be turned back
+    // into bounds. The position must not be the static row.
+    bound_view as_start_bound_view() const {
+        return bound_view(*_ck, _bound_weight < 0 ? bound_kind::incl_start : bound_kind::excl_start);
+    }
+    bound_view as_end_bound_view() const {
+        return bound_view(*_ck, _bound_weight < 0 ? bound_kind::excl_end : bound_kind::incl_end);
+    }
+
     class less_compare {
         bound_view::compare _cmp;
     private:
@@ -326,6 +335,12 @@ class position_in_partition {
         bool operator()(const bound_view& a, const mutation_fragment& b) const {
             return b.row_type_weight() && _cmp(a.prefix, weight(a.kind), b.key(), b.bound_kind_weight());
         }
+        bool operator()(const bound_view& a, const position_in_partition& b) const {
+            return b.row_type_weight() && _cmp(a.prefix, weight(a.kind), b.key(), b.bound_kind_weight());
+        }
+        bool operator()(const position_in_partition& a, const bound_view& b) const {
+            return !a.row_type_weight() || _cmp(a.key(), a.bound_kind_weight(), b.prefix, weight(b.kind));
+        }
     };
     class equal_compare {
         clustering_key_prefix::equality _equal;
@@ -371,6 +386,30 @@ inline position_in_partition clustering_row::position() const
     return position_in_partition(position_in_partition::clustering_row_tag_t(), _ck);
 }
 
+// Range of positions in a partition, [start, end). The bounds are never
+// positions of rows, so that it is unambiguous which rows are inside.
+class position_range {
+    position_in_partition _start;
+    position_in_partition _end;
+public:
+    static position_range from_range(const query::clustering_range&);
+
+    static position_range all_clustered_rows() {
+        return {
+            position_in_partition(position_in_partition::range_tombstone_tag_t(), bound_view::bottom()),
+            position_in_partition(position_in_partition::range_tombstone_tag_t(), bound_view::top())
+        };
+    }
+
+    position_range(position_in_partition start, position_in_partition end)
+        : _start(std::move(start))
+        , _end(std::move(end))
+    { }
+
+    const position_in_partition& start() const { return _start; }
+    const position_in_partition& end() const { return _end; }
+};
+
 template<>
 struct move_constructor_disengages<mutation_fragment> {
     enum { value = true };
@@ -393,6 +432,13 @@ using mutation_fragment_opt = optimized_optional<mutation_fragment>;
 //
 // Partition key and partition tombstone are not streamed and is part of the
 // streamed_mutation itself.
+//
+// fast_forward_to() skips to a given range of clustering positions. Once it
+// was called the stream produces only the fragments which fall into that
+// range, possibly preceded by range tombstones which start before it but
+// overlap with it, and then reports end of stream. It can be called again with
+// a range which doesn't start before the end of the previous one, also after
+// the end of stream was reached. The static row is never skipped.
 class streamed_mutation {
 public:
     // streamed_mutation uses batching. The mutation implementations are
@@ -409,6 +455,9 @@ class streamed_mutation {
 
         bool _end_of_stream = false;
         circular_buffer<mutation_fragment> _buffer;
+        // End of the range the stream was fast forwarded to. Fragments at or
+        // after it are held back until the next fast_forward_to().
+        stdx::optional<position_in_partition> _range_end;
 
         friend class streamed_mutation;
     protected:
@@ -416,6 +465,20 @@ class streamed_mutation {
         void push_mutation_fragment(Args&&... args) {
             _buffer.emplace_back(std::forward<Args>(args)...);
         }
+
+        bool is_past_range_end(const mutation_fragment& mf) const {
+            return _range_end && !position_in_partition::less_compare(*_schema)(mf, *_range_end);
+        }
+        // Returns true if mf is not needed by a consumer which skips to pos.
+        bool is_before(const mutation_fragment& mf, const position_in_partition& pos) const {
+            position_in_partition::less_compare less(*_schema);
+            if (mf.is_range_tombstone()) {
+                return !less(pos, mf.as_range_tombstone().end_bound());
+            }
+            return mf.is_clustering_row() && less(mf, pos);
+        }
+        // Drops buffered fragments which are before pos.
+        void forward_buffer_to(const position_in_partition& pos);
     public:
         explicit impl(schema_ptr s, dht::decorated_key dk, tombstone pt)
             : _schema(std::move(s)), _key(std::move(dk)), _partition_tombstone(pt)
@@ -425,9 +488,14 @@ class streamed_mutation {
 
         virtual ~impl() { }
         virtual future<> fill_buffer() = 0;
+        // The default implementation reads and drops fragments until it gets
+        // to the start of the range.
+        virtual future<> fast_forward_to(position_range pr);
 
-        bool is_end_of_stream() const { return _end_of_stream; }
-        bool is_buffer_empty() const { return _buffer.empty(); }
+        bool is_end_of_stream() const {
+            return _end_of_stream || (!_buffer.empty() && is_past_range_end(_buffer.front()));
+        }
+        bool is_buffer_empty() const { return _buffer.empty() || is_past_range_end(_buffer.front()); }
         bool is_buffer_full() const { return _buffer.size() >= buffer_size; }
 
         mutation_fragment pop_mutation_fragment() {
@@ -471,6 +539,8 @@ class streamed_mutation {
 
     future<> fill_buffer() { return _impl->fill_buffer(); }
 
+    future<> fast_forward_to(position_range pr) { return _impl->fast_forward_to(std::move(pr)); }
+
     future<mutation_fragment_opt> operator()() {
         return _impl->operator()();
     }
@@ -556,6 +626,8 @@ class range_tombstone_stream {
     mutation_fragment_opt get_next(const rows_entry&);
     mutation_fragment_opt get_next(const mutation_fragment&);
     mutation_fragment_opt get_next();
+    // Drops tombstones which end before pos.
+    void forward_to(const position_in_partition& pos);
 
     void apply(range_tombstone&& rt) {
         _list.apply(_schema, std::move(rt));
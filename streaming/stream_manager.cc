@@ -41,6 +41,9 @@
 #include "streaming/stream_result_future.hh"
 #include "log.hh"
 #include "streaming/stream_session_state.hh"
+#include "locator/snitch_base.hh"
+#include "utils/fb_utilities.hh"
+#include "core/sleep.hh"
 
 namespace streaming {
 
@@ -48,6 +51,46 @@ extern logging::logger sslog;
 
 distributed<stream_manager> _the_stream_manager;
 
+// Same as Cassandra's StreamRateLimiter.
+static constexpr uint64_t bytes_per_megabit = 1024 * 1024 / 8;
+
+constexpr std::chrono::steady_clock::duration stream_throughput_limiter::burst;
+
+std::chrono::steady_clock::duration stream_throughput_limiter::consume(uint64_t bytes) {
+    if (!_rate) {
+        return clock_type::duration::zero();
+    }
+    auto now = clock_type::now();
+    auto duration = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(double(bytes) / _rate));
+    _until = std::max(_until, now - burst) + duration;
+    return std::max(_until - now, clock_type::duration::zero());
+}
+
+void stream_manager::set_stream_throughput(uint32_t mbits_per_sec) {
+    _throughput_mbits = mbits_per_sec;
+    _throughput_limiter.set_rate(mbits_per_sec * bytes_per_megabit / smp::count);
+}
+
+void stream_manager::set_inter_dc_stream_throughput(uint32_t mbits_per_sec) {
+    _inter_dc_throughput_mbits = mbits_per_sec;
+    _inter_dc_throughput_limiter.set_rate(mbits_per_sec * bytes_per_megabit / smp::count);
+}
+
+future<> stream_manager::throttle(gms::inet_address peer, size_t bytes) {
+    auto wait = _throughput_limiter.consume(bytes);
+    if (_inter_dc_throughput_limiter.rate()) {
+        auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+        if (snitch->get_datacenter(peer) != snitch->get_datacenter(utils::fb_utilities::get_broadcast_address())) {
+            wait = std::max(wait, _inter_dc_throughput_limiter.consume(bytes));
+        }
+    }
+    if (wait == std::chrono::steady_clock::duration::zero()) {
+        return make_ready_future<>();
+    }
+    _throttled++;
+    return sleep(wait);
+}
+
 void stream_manager::register_sending(shared_ptr<stream_result_future> result) {
 #if 0
     result.addEventListener(notifier);
@@ -47,6 +47,7 @@
 #include "gms/application_state.hh"
 #include <seastar/core/semaphore.hh>
 #include <map>
+#include <chrono>
 
 namespace streaming {
 
@@ -73,6 +74,23 @@ struct stream_bytes {
     }
 };
 
+/**
+ * Token bucket limiting the rate of bytes sent, allowing a short burst after
+ * an idle period. A rate of 0 means unlimited.
+ */
+class stream_throughput_limiter {
+    using clock_type = std::chrono::steady_clock;
+    static constexpr clock_type::duration burst = std::chrono::milliseconds(100);
+    uint64_t _rate = 0;
+    clock_type::time_point _until = clock_type::time_point::min();
+public:
+    void set_rate(uint64_t bytes_per_second) { _rate = bytes_per_second; }
+    uint64_t rate() const { return _rate; }
+    // Accounts for bytes about to be sent and returns how long the sender
+    // has to wait before sending them.
+    clock_type::duration consume(uint64_t bytes);
+};
+
 /**
  * StreamManager manages currently running {@link StreamResultFuture}s and provides status of all operation invoked.
  *
@@ -94,9 +112,25 @@ class stream_manager : public gms::i_endpoint_state_change_subscriber, public en
     std::unordered_map<UUID, shared_ptr<stream_result_future>> _receiving_streams;
     std::unordered_map<UUID, std::unordered_map<gms::inet_address, stream_bytes>> _stream_bytes;
     semaphore _mutation_send_limiter{256};
+    // Outbound throughput limits of this shard, in megabits per second of
+    // the whole node. All peers count against _throughput_limiter, peers in
+    // other data centers against _inter_dc_throughput_limiter as well.
+    uint32_t _throughput_mbits = 0;
+    uint32_t _inter_dc_throughput_mbits = 0;
+    stream_throughput_limiter _throughput_limiter;
+    stream_throughput_limiter _inter_dc_throughput_limiter;
+    uint64_t _throttled = 0;
 public:
     semaphore& mutation_send_limiter() { return _mutation_send_limiter; }
 
+    // Waits until bytes may be sent to peer without exceeding the configured throughput.
+    future<> throttle(gms::inet_address peer, size_t bytes);
+    void set_stream_throughput(uint32_t mbits_per_sec);
+    void set_inter_dc_stream_throughput(uint32_t mbits_per_sec);
+    uint32_t get_stream_throughput() const { return _throughput_mbits; }
+    uint32_t get_inter_dc_stream_throughput() const { return _inter_dc_throughput_mbits; }
+    uint64_t throttled() const { return _throttled; }
+
     void register_sending(shared_ptr<stream_result_future> result);
 
     void register_receiving(shared_ptr<stream_result_future> result);
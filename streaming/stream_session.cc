@@ -58,6 +58,7 @@
 #include "service/priority_manager.hh"
 #include "query-request.hh"
 #include "schema_registry.hh"
+#include "db/config.hh"
 
 namespace streaming {
 
@@ -202,6 +203,14 @@ future<> stream_session::init_streaming_service(distributed<database>& db) {
     //     return get_stream_manager().stop();
     // });
     return get_stream_manager().start().then([] {
+        auto& cfg = _db->local().get_config();
+        auto throughput = cfg.stream_throughput_outbound_megabits_per_sec();
+        auto inter_dc_throughput = cfg.inter_dc_stream_throughput_outbound_megabits_per_sec();
+        return get_stream_manager().invoke_on_all([throughput, inter_dc_throughput] (stream_manager& sm) {
+            sm.set_stream_throughput(throughput);
+            sm.set_inter_dc_stream_throughput(inter_dc_throughput);
+        });
+    }).then([] {
         gms::get_local_gossiper().register_(get_local_stream_manager().shared_from_this());
         return _db->invoke_on_all([] (auto& db) {
             init_messaging_service_handler();
@@ -86,7 +86,10 @@ struct send_info {
 };
 
 future<> do_send_mutations(auto si, auto fm, bool fragmented) {
-    return get_local_stream_manager().mutation_send_limiter().wait().then([si, fragmented, fm = std::move(fm)] () mutable {
+    auto size = fm.representation().size();
+    return get_local_stream_manager().throttle(si->id.addr, size).then([] {
+        return get_local_stream_manager().mutation_send_limiter().wait();
+    }).then([si, fragmented, fm = std::move(fm)] () mutable {
         sslog.debug("[Stream #{}] SEND STREAM_MUTATION to {}, cf_id={}", si->plan_id, si->id, si->cf_id);
         auto fm_size = fm.representation().size();
         net::get_local_messaging_service().send_stream_mutation(si->id, si->plan_id, std::move(fm), si->dst_cpu_id, fragmented).then([si, fm_size] {
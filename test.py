@@ -72,7 +72,12 @@ boost_tests = [
     'range_tombstone_list_test',
     'streamed_mutation_test',
     'anchorless_list_test',
+    'tournament_tree_test',
+    'hdr_histogram_test',
+    'frequency_sketch_test',
+    'space_saving_test',
     'database_test',
+    'request_scheduler_test',
 ]
 
 other_tests = [
@@ -133,6 +138,8 @@ if __name__ == "__main__":
         test_to_run.append(('build/release/tests/lsa_sync_eviction_test -c1 -m100M --count 24000 --standard-object-size 2048','other'))
         test_to_run.append(('build/release/tests/lsa_sync_eviction_test -c1 -m1G --count 4000000 --standard-object-size 128','other'))
         test_to_run.append(('build/release/tests/row_cache_alloc_stress -c1 -m1G','other'))
+        for workload, partitions in [('narrow', 100000), ('wide', 100), ('many-columns', 10000), ('collections', 10000), ('blobs', 500)]:
+            test_to_run.append(('build/release/tests/memory_footprint -c1 -m1G --workload %s --partition-count %d' % (workload, partitions),'other'))
         test_to_run.append(('build/release/tests/sstable_test -c1','boost'))
     if 'debug' in modes_to_run:
         test_to_run.append(('build/debug/tests/sstable_test -c1','boost'))
@@ -196,6 +196,44 @@ SEASTAR_TEST_CASE(test_password_authenticator_operations) {
 }
 
 
+SEASTAR_TEST_CASE(test_password_authenticator_cached_credentials) {
+    db::config cfg;
+    cfg.authenticator = auth::password_authenticator::PASSWORD_AUTHENTICATOR_NAME;
+
+    return do_with_cql_env([](cql_test_env&) {
+        return seastar::async([] {
+            using namespace auth;
+            using option = authenticator::option;
+
+            sstring username("fisk");
+            auto login = [&] (sstring password) {
+                try {
+                    auto user = authenticator::get().authenticate({ { authenticator::USERNAME_KEY, username }, { authenticator::PASSWORD_KEY, password } }).get0();
+                    BOOST_REQUIRE_EQUAL(user->name(), username);
+                    return true;
+                } catch (exceptions::authentication_exception&) {
+                    return false;
+                }
+            };
+
+            authenticator::get().create(username, { { option::PASSWORD, sstring("notter") } }).get();
+            // The second login is served from the cache.
+            BOOST_REQUIRE(login("notter"));
+            BOOST_REQUIRE(login("notter"));
+            BOOST_REQUIRE(!login("hejkotte"));
+
+            // A cached login must not survive a password change...
+            authenticator::get().alter(username, { { option::PASSWORD, sstring("hejkotte") } }).get();
+            BOOST_REQUIRE(!login("notter"));
+            BOOST_REQUIRE(login("hejkotte"));
+
+            // ...nor the user being dropped.
+            authenticator::get().drop(username).get();
+            BOOST_REQUIRE(!login("hejkotte"));
+        });
+    }, cfg);
+}
+
 SEASTAR_TEST_CASE(test_cassandra_hash) {
     db::config cfg;
     cfg.authenticator = auth::password_authenticator::PASSWORD_AUTHENTICATOR_NAME;
@@ -278,3 +278,24 @@ BOOST_AUTO_TEST_CASE(test_append_big_and_small_chunks) {
     buf.append(big);
     buf.append(small);
 }
+
+BOOST_AUTO_TEST_CASE(test_large_blobs_are_fragmented) {
+    bytes_ostream buf;
+    ser::serialize(buf, 1);
+
+    bytes b(bytes::initialized_later(), 3 * bytes_ostream::max_chunk_size + 17);
+    for (size_t i = 0; i < b.size(); i++) {
+        b[i] = i % 251;
+    }
+    buf.write(b);
+
+    BOOST_REQUIRE_EQUAL(buf.size(), sizeof(int) + b.size());
+    for (bytes_view frag : buf.fragments()) {
+        BOOST_REQUIRE(frag.size() <= bytes_ostream::max_chunk_size);
+    }
+
+    auto view = buf.linearize();
+    auto in = ser::as_input_stream(view);
+    BOOST_REQUIRE_EQUAL(ser::deserialize(in, boost::type<int>()), 1);
+    BOOST_REQUIRE(view.substr(sizeof(int)) == bytes_view(b));
+}
@@ -27,6 +27,7 @@
 #include "compound_compat.hh"
 #include "tests/range_assert.hh"
 #include "schema_builder.hh"
+#include "utils/UUID_gen.hh"
 
 #include "disk-error-handler.hh"
 
@@ -307,3 +308,95 @@ BOOST_AUTO_TEST_CASE(test_composite_view_explode) {
                             std::vector<bytes>({bytes({'e', 'l', '1'})}));
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_abbreviation_is_consistent_with_ordering) {
+    compound_type<allow_prefixes::yes> t({int32_type, bytes_type, long_type});
+    BOOST_REQUIRE(t.is_abbreviable());
+
+    std::vector<bytes> values;
+    for (int32_t i : { std::numeric_limits<int32_t>::min(), -256, -1, 0, 1, 255, std::numeric_limits<int32_t>::max() }) {
+        values.push_back(t.serialize_value(std::vector<bytes>({int32_type->decompose(i)})));
+        for (auto&& b : { bytes(), bytes({'\x00'}), bytes({'\x00', '\x00'}), bytes({'\x01'}), bytes({'\xff'}), bytes("abcdefgh") }) {
+            values.push_back(t.serialize_value(std::vector<bytes>({int32_type->decompose(i), b})));
+            for (int64_t j : { int64_t(-1), int64_t(0), int64_t(1) }) {
+                values.push_back(t.serialize_value(std::vector<bytes>({int32_type->decompose(i), b, long_type->decompose(j)})));
+            }
+        }
+    }
+    values.push_back(t.serialize_value(std::vector<bytes>({bytes()})));
+    values.push_back(t.serialize_value(std::vector<bytes>()));
+
+    size_t decided = 0;
+    for (auto&& v1 : values) {
+        for (auto&& v2 : values) {
+            auto a1 = t.abbreviate(v1);
+            auto a2 = t.abbreviate(v2);
+            auto c = t.compare(v1, v2);
+            if (c == 0) {
+                BOOST_REQUIRE_EQUAL(a1, a2);
+            }
+            if (a1 && a2 && a1 != a2) {
+                BOOST_REQUIRE_EQUAL(a1 < a2, c < 0);
+                ++decided;
+            }
+        }
+    }
+    // Most pairs should differ in the first component.
+    BOOST_REQUIRE_GT(decided, values.size() * values.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_abbreviation_of_reversed_types) {
+    compound_type<allow_prefixes::yes> t({reversed_type_impl::get_instance(bytes_type)});
+    BOOST_REQUIRE(!t.is_abbreviable());
+    BOOST_REQUIRE_EQUAL(t.abbreviate(t.serialize_value(std::vector<bytes>({bytes("a")}))), 0);
+}
+
+template <allow_prefixes AllowPrefixes>
+static void test_specialized_compare(std::vector<data_type> types, std::vector<std::vector<bytes>> values) {
+    compound_type<AllowPrefixes> t(types);
+    auto generic_compare = [&] (bytes_view b1, bytes_view b2) {
+        return lexicographical_tri_compare(types.begin(), types.end(),
+            t.begin(b1), t.end(b1), t.begin(b2), t.end(b2), [] (auto&& type, auto&& v1, auto&& v2) {
+                return type->compare(v1, v2);
+            });
+    };
+    auto sign = [] (int c) { return c < 0 ? -1 : c > 0 ? 1 : 0; };
+    for (auto&& v1 : values) {
+        for (auto&& v2 : values) {
+            auto b1 = t.serialize_value(v1);
+            auto b2 = t.serialize_value(v2);
+            BOOST_REQUIRE_EQUAL(sign(t.compare(b1, b2)), sign(generic_compare(b1, b2)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_specialized_compare_matches_generic) {
+    std::vector<std::vector<bytes>> uuids = { {}, { bytes() } };
+    for (int i = 0; i < 10; ++i) {
+        uuids.push_back({ utils::UUID_gen::get_time_UUID().to_bytes() });
+    }
+    uuids.push_back({ utils::UUID_gen::get_time_UUID(0).to_bytes() });
+    test_specialized_compare<allow_prefixes::yes>({timeuuid_type}, uuids);
+    test_specialized_compare<allow_prefixes::yes>({reversed_type_impl::get_instance(timeuuid_type)}, uuids);
+
+    std::vector<std::vector<bytes>> longs = { {}, { bytes() } };
+    for (int64_t v : { std::numeric_limits<int64_t>::min(), int64_t(-257), int64_t(-1), int64_t(0), int64_t(1), int64_t(256),
+            std::numeric_limits<int64_t>::max() }) {
+        longs.push_back({ long_type->decompose(v) });
+    }
+    test_specialized_compare<allow_prefixes::yes>({long_type}, longs);
+    test_specialized_compare<allow_prefixes::no>({long_type}, { { long_type->decompose(int64_t(-1)) }, { long_type->decompose(int64_t(1)) } });
+    test_specialized_compare<allow_prefixes::yes>({reversed_type_impl::get_instance(long_type)}, longs);
+
+    std::vector<std::vector<bytes>> texts = { {}, { bytes() } };
+    for (auto&& s : { "", "a", "ab", "b" }) {
+        texts.push_back({ utf8_type->decompose(sstring(s)) });
+        for (auto&& l : longs) {
+            if (!l.empty()) {
+                texts.push_back({ utf8_type->decompose(sstring(s)), l[0] });
+            }
+        }
+    }
+    test_specialized_compare<allow_prefixes::yes>({utf8_type, timestamp_type}, texts);
+    test_specialized_compare<allow_prefixes::yes>({reversed_type_impl::get_instance(utf8_type)}, { {}, { bytes("a") }, { bytes("b") } });
+}
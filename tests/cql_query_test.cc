@@ -24,6 +24,7 @@
 #include <boost/range/irange.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 
@@ -35,6 +36,9 @@
 #include "core/sleep.hh"
 #include "transport/messages/result_message.hh"
 #include "utils/big_decimal.hh"
+#include "db/config.hh"
+#include "db/system_keyspace.hh"
+#include "row_cache.hh"
 
 #include "disk-error-handler.hh"
 
@@ -1771,6 +1775,55 @@ APPLY BATCH;)"
     });
 }
 
+SEASTAR_TEST_CASE(test_batch_same_partition) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tbsp (p1 varchar, c1 int, r1 int, r2 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
+            return e.execute_cql(R"(BEGIN UNLOGGED BATCH
+insert into tbsp (p1, c1, r1) values ('key1', 1, 100);
+insert into tbsp (p1, c1, r1) values ('key1', 2, 200);
+update tbsp set r2 = 7 where p1 = 'key1' and c1 = 1;
+insert into tbsp (p1, c1, r1) values ('key2', 1, 300);
+APPLY BATCH;)"
+            ).discard_result();
+        }).then([&e] {
+            return e.execute_cql("select c1, r1, r2 from tbsp where p1 = 'key1';");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(1), int32_type->decompose(100), int32_type->decompose(7)},
+                {int32_type->decompose(2), int32_type->decompose(200), {}},
+            });
+        }).then([&e] {
+            return e.require_column_has_value("tbsp", {sstring("key2")}, {1}, "r1", 300);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_count_rows_of_range) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tcr (p1 int, c1 int, r1 int, s1 int static, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
+            return e.execute_cql("insert into tcr (p1, c1, r1) values (0, 0, 0);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tcr (p1, c1, r1) values (0, 1, 1);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tcr (p1, c1, r1) values (1, 0, 2);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tcr (p1, s1) values (2, 3);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("delete from tcr where p1 = 1 and c1 = 0;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select count(*) from tcr;");
+        }).then([&e] (auto msg) {
+            // The static-only partition counts as one row.
+            assert_that(msg).is_rows().with_rows({
+                {long_type->decompose(int64_t(3))}
+            });
+            return e.execute_cql("select count(*) from tcr where token(p1) > token(0);");
+        }).then([] (auto msg) {
+            assert_that(msg).is_rows().with_size(1);
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_in_restriction) {
     return do_with_cql_env([] (auto& e) {
         return e.execute_cql("create table tir (p1 int, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
@@ -2225,3 +2278,338 @@ SEASTAR_TEST_CASE(test_pg_style_string_literal) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_secondary_index_query) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tsi (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("insert into tsi (p, c, v) values (1, 1, 10);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tsi (p, c, v) values (1, 2, 20);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select * from tsi where v = 10;");
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+            return e.execute_cql("create index on tsi (v);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tsi (p, c, v) values (1, 3, 10);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select p, c from tsi where v = 10;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                { int32_type->decompose(1), int32_type->decompose(1) },
+                { int32_type->decompose(1), int32_type->decompose(3) },
+            });
+            return e.execute_cql("update tsi set v = 30 where p = 1 and c = 3;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select p, c from tsi where v = 10;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                { int32_type->decompose(1), int32_type->decompose(1) },
+            });
+            return e.execute_cql("select p, c from tsi where v = 30;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                { int32_type->decompose(1), int32_type->decompose(3) },
+            });
+            return e.execute_cql("create index tsi_c_idx on tsi (c);").discard_result();
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_allow_filtering) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table taf (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("insert into taf (p, c, v) values (1, 1, 10);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into taf (p, c, v) values (1, 2, 20);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into taf (p, c, v) values (1, 3, 30);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into taf (p, c) values (1, 4);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select c from taf where p = 1 and v = 20;");
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+            return e.execute_cql("select c from taf where p = 1 and v = 20 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                { int32_type->decompose(2) },
+            });
+            return e.execute_cql("select c from taf where v >= 20 and v < 40 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                { int32_type->decompose(2) },
+                { int32_type->decompose(3) },
+            });
+            return e.execute_cql("select c from taf where p = 1 and v > 30 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().is_empty();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_materialized_view) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tmv (p int, c int, v int, w int, PRIMARY KEY (p, c));").get();
+            e.execute_cql("insert into tmv (p, c, v, w) values (1, 1, 10, 100);").get();
+            e.execute_cql("create materialized view tmv_by_v as select * from tmv "
+                    "where v is not null and p is not null and c is not null primary key (v, p, c);").get();
+            BOOST_REQUIRE_THROW(e.execute_cql("create materialized view tmv_bad as select * from tmv "
+                    "where v is not null and p is not null primary key (v, p);").get(), exceptions::invalid_request_exception);
+
+            // Wait for the view to be built from the existing row.
+            while (!db::system_keyspace::is_view_built("ks", "tmv_by_v").get0()) {
+                sleep(std::chrono::milliseconds(10)).get();
+            }
+            assert_that(e.execute_cql("select p, c, w from tmv_by_v where v = 10;").get0())
+                    .is_rows().with_rows({
+                        { int32_type->decompose(1), int32_type->decompose(1), int32_type->decompose(100) },
+                    });
+
+            e.execute_cql("insert into tmv (p, c, v, w) values (1, 2, 20, 200);").get();
+            e.execute_cql("update tmv set v = 30 where p = 1 and c = 1;").get();
+            assert_that(e.execute_cql("select p, c, w from tmv_by_v where v = 10;").get0())
+                    .is_rows().is_empty();
+            assert_that(e.execute_cql("select p, c, w from tmv_by_v where v = 30;").get0())
+                    .is_rows().with_rows({
+                        { int32_type->decompose(1), int32_type->decompose(1), int32_type->decompose(100) },
+                    });
+
+            e.execute_cql("update tmv set w = 300 where p = 1 and c = 1;").get();
+            e.execute_cql("delete from tmv where p = 1 and c = 2;").get();
+            assert_that(e.execute_cql("select v, w from tmv_by_v;").get0())
+                    .is_rows().with_rows({
+                        { int32_type->decompose(30), int32_type->decompose(300) },
+                    });
+
+            BOOST_REQUIRE_THROW(e.execute_cql("insert into tmv_by_v (v, p, c) values (1, 1, 1);").get(), exceptions::invalid_request_exception);
+            BOOST_REQUIRE_THROW(e.execute_cql("drop table tmv;").get(), exceptions::invalid_request_exception);
+            e.execute_cql("drop materialized view tmv_by_v;").get();
+            e.execute_cql("drop table tmv;").get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_select_bypass_cache) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            auto bypasses = [&e] {
+                return e.db().map_reduce0([] (database&) {
+                    return global_cache_tracker().bypasses();
+                }, uint64_t(0), std::plus<uint64_t>()).get0();
+            };
+            e.execute_cql("create table tbc (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            e.execute_cql("insert into tbc (p, c, v) values (1, 1, 10);").get();
+            e.execute_cql("insert into tbc (p, c, v) values (2, 1, 20);").get();
+            e.db().invoke_on_all([] (database& db) {
+                return db.flush_all_memtables();
+            }).get();
+
+            auto before = bypasses();
+            assert_that(e.execute_cql("select v from tbc where p = 1 bypass cache;").get0())
+                    .is_rows().with_rows({
+                        { int32_type->decompose(10) },
+                    });
+            assert_that(e.execute_cql("select v from tbc allow filtering bypass cache;").get0())
+                    .is_rows().with_size(2);
+            BOOST_REQUIRE(bypasses() > before);
+
+            // Both words stay usable as identifiers.
+            e.execute_cql("create table bypass (cache int primary key);").get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_per_partition_limit) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tppl (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            for (int p = 0; p < 3; ++p) {
+                for (int c = 0; c < 5; ++c) {
+                    e.execute_cql(sprint("insert into tppl (p, c, v) values (%d, %d, %d);", p, c, p * 10 + c)).get();
+                }
+            }
+
+            assert_that(e.execute_cql("select c from tppl where p = 1 per partition limit 2;").get0())
+                    .is_rows().with_rows({
+                        { int32_type->decompose(0) },
+                        { int32_type->decompose(1) },
+                    });
+            assert_that(e.execute_cql("select c from tppl where p in (0, 2) order by c desc per partition limit 1;").get0())
+                    .is_rows().with_size(2);
+            assert_that(e.execute_cql("select c from tppl per partition limit 2;").get0())
+                    .is_rows().with_size(6);
+            assert_that(e.execute_cql("select c from tppl per partition limit 2 limit 3;").get0())
+                    .is_rows().with_size(3);
+
+            // Pages ending in the middle of a partition must not restart its limit.
+            size_t rows = 0;
+            ::shared_ptr<service::pager::paging_state> state;
+            do {
+                auto qo = std::make_unique<cql3::query_options>(db::consistency_level::ONE, std::experimental::nullopt,
+                        std::vector<bytes_view_opt>{}, false,
+                        cql3::query_options::specific_options{3, state, {}, api::missing_timestamp},
+                        cql_serialization_format::latest());
+                auto msg = e.execute_cql("select c from tppl per partition limit 2;", std::move(qo)).get0();
+                auto rs = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+                BOOST_REQUIRE(rs);
+                rows += rs->rs().rows().size();
+                auto paging_state = rs->rs().get_metadata().paging_state();
+                state = paging_state ? ::make_shared<service::pager::paging_state>(*paging_state) : nullptr;
+            } while (state);
+            BOOST_REQUIRE_EQUAL(rows, 6);
+
+            BOOST_REQUIRE_THROW(e.execute_cql("select distinct p from tppl per partition limit 1;").get(),
+                    exceptions::invalid_request_exception);
+            BOOST_REQUIRE_THROW(e.execute_cql("select count(*) from tppl per partition limit 1;").get(),
+                    exceptions::invalid_request_exception);
+            BOOST_REQUIRE_THROW(e.execute_cql("select c from tppl per partition limit 0;").get(),
+                    exceptions::invalid_request_exception);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_select_distinct_from_sstable_indexes) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            auto flush = [&e] {
+                e.db().invoke_on_all([] (database& db) {
+                    return db.flush_all_memtables();
+                }).get();
+            };
+            auto only_live_partitions = [&e] {
+                return e.db().map_reduce0([] (database& db) {
+                    auto sstables = db.find_column_family("ks", "tdk").get_sstables();
+                    return boost::algorithm::all_of(*sstables, [] (auto& sst) {
+                        return sst->has_only_live_partitions();
+                    });
+                }, true, std::logical_and<bool>()).get0();
+            };
+            auto require_keys = [] (shared_ptr<transport::messages::result_message> msg) {
+                assert_that(msg).is_rows().with_size(4)
+                    .with_row({int32_type->decompose(0)})
+                    .with_row({int32_type->decompose(2)})
+                    .with_row({int32_type->decompose(3)})
+                    .with_row({int32_type->decompose(4)});
+            };
+
+            e.execute_cql("create table tdk (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            for (int p = 0; p < 4; ++p) {
+                e.execute_cql(sprint("insert into tdk (p, c, v) values (%d, 0, 0);", p)).get();
+                e.execute_cql(sprint("insert into tdk (p, c, v) values (%d, 1, 1);", p)).get();
+            }
+            flush();
+            BOOST_REQUIRE(only_live_partitions());
+
+            // Partitions in memtables are read, and can delete those listed
+            // from the sstable indexes.
+            e.execute_cql("insert into tdk (p, c, v) values (4, 0, 0);").get();
+            e.execute_cql("delete from tdk where p = 1;").get();
+            require_keys(e.execute_cql("select distinct p from tdk;").get0());
+            assert_that(e.execute_cql("select distinct p from tdk limit 2;").get0())
+                    .is_rows().with_size(2);
+
+            flush();
+            BOOST_REQUIRE(!only_live_partitions());
+            require_keys(e.execute_cql("select distinct p from tdk;").get0());
+
+            e.execute_cql("create table tdk_ttl (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            e.execute_cql("insert into tdk_ttl (p, c, v) values (0, 0, 0) using ttl 1000;").get();
+            flush();
+            BOOST_REQUIRE(!e.local_db().find_column_family("ks", "tdk_ttl").get_sstables()->begin()->get()->has_only_live_partitions());
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_pages_are_bounded_in_size) {
+    db::config cfg;
+    cfg.max_page_size_in_kb() = 1;
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tpbs (p int, c int, v blob, PRIMARY KEY (p, c));").get();
+            auto v = sstring(512, 'x');
+            for (int p = 0; p < 4; ++p) {
+                for (int c = 0; c < 8; ++c) {
+                    e.execute_cql(sprint("insert into tpbs (p, c, v) values (%d, %d, textAsBlob('%s'));", p, c, v)).get();
+                }
+            }
+
+            // Returns the number of rows and of pages.
+            auto fetch_all = [&e] (sstring query) {
+                size_t rows = 0;
+                size_t pages = 0;
+                ::shared_ptr<service::pager::paging_state> state;
+                do {
+                    auto qo = std::make_unique<cql3::query_options>(db::consistency_level::ONE, std::experimental::nullopt,
+                            std::vector<bytes_view_opt>{}, false,
+                            cql3::query_options::specific_options{100, state, {}, api::missing_timestamp},
+                            cql_serialization_format::latest());
+                    auto msg = e.execute_cql(query, std::move(qo)).get0();
+                    auto rs = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+                    BOOST_REQUIRE(rs);
+                    rows += rs->rs().rows().size();
+                    ++pages;
+                    auto paging_state = rs->rs().get_metadata().paging_state();
+                    state = paging_state ? ::make_shared<service::pager::paging_state>(*paging_state) : nullptr;
+                } while (state);
+                return std::make_pair(rows, pages);
+            };
+
+            // Replicas end a page after the row which makes it reach 1KB.
+            auto r = fetch_all("select * from tpbs where p = 1;");
+            BOOST_REQUIRE_EQUAL(r.first, 8);
+            BOOST_REQUIRE_GE(r.second, 4);
+            r = fetch_all("select * from tpbs;");
+            BOOST_REQUIRE_EQUAL(r.first, 32);
+            BOOST_REQUIRE_GT(r.second, 1);
+        });
+    }, cfg);
+}
+
+SEASTAR_TEST_CASE(test_functions_over_many_rows) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            // More rows than the selectors process in one batch, every other one without v.
+            e.execute_cql("create table tfmr (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            for (int c = 0; c < 600; ++c) {
+                if (c % 2) {
+                    e.execute_cql(sprint("insert into tfmr (p, c) values (0, %d) using timestamp %d;", c, c)).get();
+                } else {
+                    e.execute_cql(sprint("insert into tfmr (p, c, v) values (0, %d, %d) using timestamp %d;", c, c, c)).get();
+                }
+            }
+
+            assert_that(e.execute_cql("select sum(v), avg(v), max(v), min(v), count(v), count(*) from tfmr where p = 0;").get0())
+                .is_rows()
+                .with_size(1)
+                .with_row({
+                     {int32_type->decompose(89700)},
+                     {int32_type->decompose(299)},
+                     {int32_type->decompose(598)},
+                     {int32_type->decompose(0)},
+                     {long_type->decompose(300L)},
+                     {long_type->decompose(600L)},
+                 });
+
+            auto msg = e.execute_cql("select c, blobAsInt(intAsBlob(v)), writetime(v) from tfmr where p = 0;").get0();
+            auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+            BOOST_REQUIRE(rows);
+            auto&& rs = rows->rs().rows();
+            BOOST_REQUIRE_EQUAL(rs.size(), 600);
+            for (int c = 0; c < 600; ++c) {
+                BOOST_REQUIRE_EQUAL(rs[c].size(), 3);
+                BOOST_REQUIRE(rs[c][0] == int32_type->decompose(c));
+                if (c % 2) {
+                    BOOST_REQUIRE(!rs[c][1]);
+                    BOOST_REQUIRE(!rs[c][2]);
+                } else {
+                    BOOST_REQUIRE(rs[c][1] == int32_type->decompose(c));
+                    BOOST_REQUIRE(rs[c][2] == long_type->decompose(int64_t(c)));
+                }
+            }
+        });
+    });
+}
@@ -327,6 +327,11 @@ class single_node_cql_env : public cql_test_env {
             db::system_keyspace::init_local_cache().get();
             auto stop_local_cache = defer([] { db::system_keyspace::deinit_local_cache().get(); });
 
+            db->invoke_on_all([] (database& db) {
+                db.start_index_builds();
+                db.start_view_builds();
+            }).get();
+
             service::get_local_storage_service().init_server().get();
             auto deinit_storage_service_server = defer([] {
                 gms::get_local_gossiper().stop_gossiping().get();
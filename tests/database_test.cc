@@ -30,6 +30,7 @@
 #include "database.hh"
 #include "partition_slice_builder.hh"
 #include "frozen_mutation.hh"
+#include "db/query_result_cache.hh"
 
 #include "disk-error-handler.hh"
 
@@ -79,3 +80,102 @@ SEASTAR_TEST_CASE(test_querying_with_limits) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_apply_unfrozen_mutation) {
+    return do_with_cql_env([](cql_test_env& e) {
+        return seastar::async([&] {
+            e.execute_cql("create keyspace ks_nodurable with replication = { 'class' : 'SimpleStrategy', 'replication_factor' : 1 } and durable_writes = false;").get();
+            e.execute_cql("create table ks_nodurable.cf (k text, v int, primary key (k));").get();
+            auto& db = e.local_db();
+            auto s = db.find_schema("ks_nodurable", "cf");
+            BOOST_REQUIRE(db.find_column_family(s).commitlog() == nullptr);
+
+            auto pkey = partition_key::from_single_value(*s, to_bytes("key1"));
+            mutation m(pkey, s);
+            m.set_clustered_cell(clustering_key_prefix::make_empty(), "v", data_value(int32_t(1)), 1);
+            db.apply(m).get();
+
+            auto cmd = query::read_command(s->id(), s->version(), partition_slice_builder(*s).build(), query::max_rows);
+            auto pranges = std::vector<query::partition_range>{
+                query::partition_range::make_singular(dht::global_partitioner().decorate_key(*s, std::move(pkey)))};
+            auto result = db.query(s, cmd, query::result_request::only_result, pranges).get0();
+            assert_that(query::result_set::from_raw_result(s, cmd.slice, *result)).has_size(1);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_query_result_cache) {
+    return do_with_cql_env([](cql_test_env& e) {
+        return seastar::async([&] {
+            e.execute_cql("create table ks.cf (k text, v int, primary key (k));").get();
+            auto& db = e.local_db();
+            auto& cache = db::global_query_result_cache();
+            cache.set_capacity(1 << 20);
+            auto s = db.find_schema("ks", "cf");
+            auto& v_def = *s->get_column_definition("v");
+            auto pkey = partition_key::from_single_value(*s, to_bytes("key1"));
+            auto pranges = std::vector<query::partition_range>{
+                query::partition_range::make_singular(dht::global_partitioner().decorate_key(*s, pkey))};
+            auto now = gc_clock::now();
+
+            auto write = [&] (int32_t v, api::timestamp_type ts, gc_clock::duration ttl) {
+                mutation m(pkey, s);
+                m.set_clustered_cell(clustering_key_prefix::make_empty(), v_def,
+                        atomic_cell::make_live(ts, int32_type->decompose(v), now + ttl, ttl));
+                db.apply(s, freeze(m)).get();
+            };
+            auto query_at = [&] (gc_clock::time_point t) {
+                auto cmd = query::read_command(s->id(), s->version(), partition_slice_builder(*s).build(), query::max_rows, t);
+                auto result = db.query(s, cmd, query::result_request::only_result, pranges).get0();
+                return query::result_set::from_raw_result(s, cmd.slice, *result);
+            };
+
+            write(1, 1, std::chrono::seconds(10));
+            assert_that(query_at(now)).has_only(a_row().with_column("k", data_value(sstring("key1"))).with_column("v", data_value(1)));
+            auto hits = cache.get_stats().hits;
+            assert_that(query_at(now)).has_only(a_row().with_column("k", data_value(sstring("key1"))).with_column("v", data_value(1)));
+            BOOST_REQUIRE_EQUAL(cache.get_stats().hits, hits + 1);
+
+            // Writes to the partition invalidate its results.
+            write(2, 2, std::chrono::seconds(10));
+            assert_that(query_at(now)).has_only(a_row().with_column("k", data_value(sstring("key1"))).with_column("v", data_value(2)));
+
+            // Results are not served once some of their data expired.
+            assert_that(query_at(now + std::chrono::seconds(11))).is_empty();
+
+            cache.set_capacity(0);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_streamed_mutations_are_written_to_sstables) {
+    return do_with_cql_env([](cql_test_env& e) {
+        return seastar::async([&] {
+            e.execute_cql("create table ks.cf (k text, v int, primary key (k));").get();
+            auto& db = e.local_db();
+            auto s = db.find_schema("ks", "cf");
+            auto& cf = db.find_column_family(s);
+            auto plan_id = utils::make_random_uuid();
+            auto pkey = partition_key::from_single_value(*s, to_bytes("key1"));
+            auto pranges = std::vector<query::partition_range>{
+                query::partition_range::make_singular(dht::global_partitioner().decorate_key(*s, pkey))};
+            auto query = [&] {
+                auto cmd = query::read_command(s->id(), s->version(), partition_slice_builder(*s).build(), query::max_rows);
+                auto result = db.query(s, cmd, query::result_request::only_result, pranges).get0();
+                return query::result_set::from_raw_result(s, cmd.slice, *result);
+            };
+
+            // Partitions small enough to be sent unfragmented don't go through
+            // the streaming memtable, and stay invisible until the plan is done.
+            mutation m(pkey, s);
+            m.set_clustered_cell(clustering_key_prefix::make_empty(), "v", data_value(int32_t(1)), 1);
+            db.apply_streaming_mutation(s, plan_id, freeze(m), false).get();
+            BOOST_REQUIRE_EQUAL(cf.sstables_count(), 0);
+            assert_that(query()).is_empty();
+
+            cf.flush_streaming_mutations(plan_id, pranges).get();
+            BOOST_REQUIRE_EQUAL(cf.sstables_count(), 1);
+            assert_that(query()).has_only(a_row().with_column("k", data_value(sstring("key1"))).with_column("v", data_value(1)));
+        });
+    });
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+#include "utils/frequency_sketch.hh"
+
+// A cheap mixer, keys given to the sketch are expected to be hashes.
+static uint64_t hash_of(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    return k;
+}
+
+BOOST_AUTO_TEST_CASE(test_estimates_are_never_too_low) {
+    utils::frequency_sketch sketch(1024);
+    for (uint64_t k = 0; k < 512; ++k) {
+        for (uint64_t i = 0; i < k % 8; ++i) {
+            sketch.record(hash_of(k));
+        }
+    }
+    BOOST_REQUIRE_EQUAL(sketch.resets(), 0);
+    for (uint64_t k = 0; k < 512; ++k) {
+        BOOST_REQUIRE_GE(sketch.estimate(hash_of(k)), k % 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_hot_keys_beat_a_scan) {
+    utils::frequency_sketch sketch(1024);
+    for (int i = 0; i < 10; ++i) {
+        for (uint64_t k = 0; k < 16; ++k) {
+            sketch.record(hash_of(k));
+        }
+    }
+    for (uint64_t k = 1000; k < 2000; ++k) {
+        sketch.record(hash_of(k));
+    }
+    unsigned colder = 0;
+    for (uint64_t k = 1000; k < 2000; ++k) {
+        colder += sketch.estimate(hash_of(k)) < sketch.estimate(hash_of(k % 16));
+    }
+    BOOST_REQUIRE_GE(colder, 990);
+}
+
+BOOST_AUTO_TEST_CASE(test_counters_saturate_and_age) {
+    utils::frequency_sketch sketch(16);
+    for (int i = 0; i < 100; ++i) {
+        sketch.record(hash_of(1));
+    }
+    BOOST_REQUIRE_EQUAL(sketch.resets(), 0);
+    BOOST_REQUIRE_EQUAL(sketch.estimate(hash_of(1)), unsigned(utils::frequency_sketch::max_count));
+    // 160 samples make the sketch age.
+    for (uint64_t k = 100; k < 160; ++k) {
+        sketch.record(hash_of(k));
+    }
+    BOOST_REQUIRE_EQUAL(sketch.resets(), 1);
+    BOOST_REQUIRE_LE(sketch.estimate(hash_of(1)), unsigned(utils::frequency_sketch::max_count / 2 + 1));
+}
@@ -99,7 +99,17 @@ SEASTAR_TEST_CASE(test_application_of_partition_view_has_the_same_effect_as_appl
         m_refrozen.partition().apply(*s, freeze(m1).unfreeze(s).partition(), *s);
         m_refrozen.partition().apply(*s, freeze(m2).unfreeze(s).partition(), *s);
 
+        mutation m_weak(key, s);
+        m_weak.partition().apply_weak(*s, freeze(m1).partition(), *s);
+        m_weak.partition().apply_weak(*s, freeze(m2).partition(), *s);
+
+        // Applying again must not change the result.
+        mutation m_weak_twice(m_weak);
+        m_weak_twice.partition().apply_weak(*s, freeze(m2).partition(), *s);
+
         assert_that(m_unfrozen).is_equal_to(m_refrozen);
         assert_that(m_unfrozen).is_equal_to(m_frozen);
+        assert_that(m_unfrozen).is_equal_to(m_weak);
+        assert_that(m_unfrozen).is_equal_to(m_weak_twice);
     });
 }
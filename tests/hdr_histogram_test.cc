@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "utils/hdr_histogram.hh"
+
+// The value reported for a percentile may be rounded up to the top of its
+// bucket, which is at most 1/2^precision_bits away.
+static void check_close(uint64_t actual, uint64_t expected) {
+    auto tolerance = expected >> utils::hdr_histogram::precision_bits;
+    BOOST_REQUIRE_GE(actual, expected);
+    BOOST_REQUIRE_LE(actual, expected + tolerance);
+}
+
+BOOST_AUTO_TEST_CASE(test_empty) {
+    utils::hdr_histogram h;
+    BOOST_REQUIRE_EQUAL(h.count(), 0);
+    BOOST_REQUIRE_EQUAL(h.percentile(99), 0);
+    BOOST_REQUIRE_EQUAL(h.mean(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_small_values_are_exact) {
+    utils::hdr_histogram h;
+    for (uint64_t v = 1; v <= 50; ++v) {
+        h.record(v);
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 50);
+    BOOST_REQUIRE_EQUAL(h.min(), 1);
+    BOOST_REQUIRE_EQUAL(h.max(), 50);
+    BOOST_REQUIRE_EQUAL(h.percentile(50), 25);
+    BOOST_REQUIRE_EQUAL(h.percentile(100), 50);
+}
+
+BOOST_AUTO_TEST_CASE(test_percentiles) {
+    utils::hdr_histogram h;
+    std::vector<uint64_t> values;
+    std::mt19937 rnd(42);
+    std::uniform_int_distribution<uint64_t> dist(1, 10000000);
+    for (int i = 0; i < 100000; ++i) {
+        values.push_back(dist(rnd));
+        h.record(values.back());
+    }
+    std::sort(values.begin(), values.end());
+    for (auto p : { 50.0, 75.0, 95.0, 99.0, 99.9 }) {
+        auto expected = values[std::ceil(p / 100 * values.size()) - 1];
+        check_close(h.percentile(p), expected);
+    }
+    BOOST_REQUIRE_EQUAL(h.percentile(100), values.back());
+    BOOST_REQUIRE_EQUAL(h.min(), values.front());
+}
+
+BOOST_AUTO_TEST_CASE(test_large_values_are_clamped) {
+    utils::hdr_histogram h;
+    h.record(std::numeric_limits<uint64_t>::max());
+    BOOST_REQUIRE_EQUAL(h.max(), uint64_t(utils::hdr_histogram::max_value));
+    h.add(std::chrono::milliseconds(3));
+    BOOST_REQUIRE_EQUAL(h.min(), 3000);
+}
+
+BOOST_AUTO_TEST_CASE(test_merge_and_subtract) {
+    utils::hdr_histogram a, b;
+    for (uint64_t v = 1000; v < 2000; ++v) {
+        a.record(v);
+        b.record(v * 10);
+    }
+    auto sum = a + b;
+    BOOST_REQUIRE_EQUAL(sum.count(), 2000);
+    BOOST_REQUIRE_EQUAL(sum.min(), 1000);
+    BOOST_REQUIRE_EQUAL(sum.max(), 19990);
+    check_close(sum.percentile(25), 1499);
+    check_close(sum.percentile(75), 14990);
+
+    auto recent = sum;
+    recent -= a;
+    BOOST_REQUIRE_EQUAL(recent.count(), b.count());
+    BOOST_REQUIRE_EQUAL(recent.sum(), b.sum());
+    check_close(recent.percentile(50), b.percentile(50));
+    BOOST_REQUIRE_LE(recent.min(), 10000);
+    BOOST_REQUIRE_GE(recent.min(), 10000 - (10000 >> utils::hdr_histogram::precision_bits));
+    BOOST_REQUIRE_EQUAL(recent.max(), 19990);
+}
@@ -51,6 +51,21 @@ struct simple_compound {
     }
 };
 
+struct trivially_serializable_compound {
+    uint32_t foo;
+    uint32_t bar;
+    uint64_t baz;
+
+    bool operator==(const trivially_serializable_compound& other) const {
+        return foo == other.foo && bar == other.bar && baz == other.baz;
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, const trivially_serializable_compound& tsc)
+{
+    return os << " { foo: " << tsc.foo << ", bar: " << tsc.bar << ", baz: " << tsc.baz << " }";
+}
+
 class non_final_composite_test_object {
     simple_compound _x;
 public:
@@ -208,6 +223,41 @@ BOOST_AUTO_TEST_CASE(test_vector)
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_vector_of_trivially_serializable)
+{
+    static_assert(ser::is_trivially_serializable<trivially_serializable_compound>::value, "");
+    std::vector<trivially_serializable_compound> vec = {
+        { 1, 2, 3 },
+        { 4, 5, 6 },
+        { 7, 8, 0xdeadbeefbadc0ffe },
+    };
+
+    bytes_ostream buf1;
+    ser::serialize(buf1, vec);
+    BOOST_REQUIRE_EQUAL(buf1.size(), 4 + vec.size() * 16);
+
+    // Copying the vector as a whole must give the same encoding as writing it member by member.
+    bytes_ostream buf2;
+    ser::serialize(buf2, uint32_t(vec.size()));
+    for (auto& c : vec) {
+        ser::serialize(buf2, c);
+    }
+    BOOST_REQUIRE_EQUAL(buf1.linearize(), buf2.linearize());
+
+    auto bv = buf1.linearize();
+    auto in = ser::as_input_stream(bv);
+    auto deser_vec = ser::deserialize(in, boost::type<std::vector<trivially_serializable_compound>>());
+    BOOST_REQUIRE_EQUAL(vec, deser_vec);
+
+    bytes_ostream buf3;
+    ser::serialize(buf3, vec);
+    ser::serialize(buf3, uint32_t(0xbadc0ffe));
+    auto bv3 = buf3.linearize();
+    auto in3 = ser::as_input_stream(bv3);
+    ser::skip(in3, boost::type<std::vector<trivially_serializable_compound>>());
+    BOOST_REQUIRE_EQUAL(ser::deserialize(in3, boost::type<uint32_t>()), 0xbadc0ffe);
+}
+
 BOOST_AUTO_TEST_CASE(test_variant)
 {
     std::vector<simple_compound> vec = {
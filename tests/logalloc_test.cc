@@ -35,6 +35,7 @@
 #include "utils/logalloc.hh"
 #include "utils/managed_ref.hh"
 #include "utils/managed_bytes.hh"
+#include "utils/lsa_lru_cache.hh"
 #include "log.hh"
 
 #include "disk-error-handler.hh"
@@ -271,6 +272,39 @@ SEASTAR_TEST_CASE(test_blob) {
     });
 }
 
+SEASTAR_TEST_CASE(test_size_class_segregation) {
+    return seastar::async([] {
+        region reg;
+        with_allocator(reg.allocator(), [&] {
+            std::vector<managed_bytes> small;
+            std::vector<managed_bytes> large;
+            for (int i = 0; i < 1000; ++i) {
+                small.emplace_back(bytes(bytes::initialized_later(), 16));
+                large.emplace_back(bytes(16 * 1024, int8_t(i)));
+            }
+
+            auto occ = reg.occupancy_by_size_class();
+            BOOST_REQUIRE_GE(occ.small.used_space(), 1000 * 16);
+            BOOST_REQUIRE_GE(occ.large.used_space(), 1000 * 16 * 1024);
+            BOOST_REQUIRE_LT(occ.small.total_space(), occ.large.total_space());
+
+            // Freeing all large objects releases their segments without compaction.
+            large.clear();
+            occ = reg.occupancy_by_size_class();
+            BOOST_REQUIRE_EQUAL(occ.large.total_space(), 0);
+            BOOST_REQUIRE_GE(occ.small.used_space(), 1000 * 16);
+
+            for (int i = 0; i < 100; ++i) {
+                large.emplace_back(bytes(16 * 1024, int8_t(i)));
+            }
+            reg.full_compaction();
+            for (int i = 0; i < 100; ++i) {
+                BOOST_REQUIRE(bytes_view(large[i]) == bytes(16 * 1024, int8_t(i)));
+            }
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_merging) {
     return seastar::async([] {
         region reg1;
@@ -1038,3 +1072,80 @@ SEASTAR_TEST_CASE(test_region_groups_basic_throttling_active_reclaim_no_double_r
         BOOST_REQUIRE_EQUAL(root.reclaim_sizes()[0], logalloc::segment_size);
     });
 }
+
+struct test_cache_entry : public utils::lsa_lru_cache_entry {
+    int key;
+    managed_bytes value;
+
+    test_cache_entry(int k, bytes_view v) : key(k), value(v) { }
+    test_cache_entry(test_cache_entry&&) noexcept = default;
+
+    // Entries of keys with the same tens, for invalidation.
+    struct group {
+        int tens;
+    };
+
+    struct compare {
+        bool operator()(const test_cache_entry& e1, const test_cache_entry& e2) const { return e1.key < e2.key; }
+        bool operator()(int k, const test_cache_entry& e) const { return k < e.key; }
+        bool operator()(const test_cache_entry& e, int k) const { return e.key < k; }
+        bool operator()(group g, const test_cache_entry& e) const { return g.tens < e.key / 10; }
+        bool operator()(const test_cache_entry& e, group g) const { return e.key / 10 < g.tens; }
+    };
+};
+
+SEASTAR_TEST_CASE(test_lsa_lru_cache) {
+    return seastar::async([] {
+        utils::lsa_lru_cache<test_cache_entry, test_cache_entry::compare> cache("test_lsa_lru_cache");
+        auto value = bytes(bytes::initialized_later(), 1024);
+        std::fill(value.begin(), value.end(), 'v');
+        auto lookup = [&] (int k) {
+            return cache.lookup(k, [] (const test_cache_entry& e) { return e.key; });
+        };
+        auto insert = [&] (int k) {
+            cache.insert(k, [] (test_cache_entry&) { }, k, bytes_view(value));
+        };
+
+        // Disabled until given a capacity.
+        insert(0);
+        BOOST_REQUIRE(!lookup(0));
+        BOOST_REQUIRE_EQUAL(cache.get_stats().entries, 0);
+
+        cache.set_capacity(64 * 1024);
+        for (int i = 0; i < 100; ++i) {
+            insert(i);
+        }
+        BOOST_REQUIRE(cache.region().occupancy().used_space() <= cache.capacity());
+        BOOST_REQUIRE(cache.get_stats().evictions > 0);
+        BOOST_REQUIRE(!lookup(0));
+        BOOST_REQUIRE(lookup(99));
+
+        // The least recently used entry goes first, lookups make entries recent.
+        int oldest = 0;
+        while (!lookup(oldest)) {
+            ++oldest;
+        }
+        insert(100);
+        BOOST_REQUIRE(lookup(oldest));
+        BOOST_REQUIRE(!lookup(oldest + 1));
+
+        // Updates don't add entries.
+        auto entries = cache.get_stats().entries;
+        bool updated = false;
+        cache.insert(100, [&] (test_cache_entry& e) { updated = true; }, 100, bytes_view(value));
+        BOOST_REQUIRE(updated);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().entries, entries);
+
+        // Entries which aren't valid anymore are dropped by lookups.
+        BOOST_REQUIRE(!cache.lookup(100, [] (const test_cache_entry& e) { return e.key; }, [] (const test_cache_entry&) { return false; }));
+        BOOST_REQUIRE(!lookup(100));
+
+        cache.invalidate(test_cache_entry::group{9});
+        for (int i = 90; i < 100; ++i) {
+            BOOST_REQUIRE(!lookup(i));
+        }
+
+        cache.set_capacity(0);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().entries, 0);
+    });
+}
@@ -19,6 +19,8 @@
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <map>
+#include <chrono>
 #include <boost/range/irange.hpp>
 
 #include <seastar/util/defer.hh>
@@ -135,9 +137,31 @@ struct mutation_settings {
     size_t partition_key_size;
     size_t clustering_key_size;
     size_t data_size;
+    // Number of entries of the map column. The schema has no collection
+    // column when 0.
+    size_t collection_size;
+
+    size_t cells_per_row() const {
+        return column_count + collection_size;
+    }
 };
 
-static mutation make_mutation(mutation_settings settings) {
+// Named presets of mutation_settings, for the shapes of data whose footprint
+// we care about.
+static const std::map<sstring, mutation_settings> workloads = {
+    // A few small cells per partition, like cassandra-stress writes.
+    { "narrow",       { 5,   2, 1,    10, 10, 32,         0 } },
+    // Many small rows per partition.
+    { "wide",         { 1,   2, 1000, 10, 10, 32,         0 } },
+    // A single row with many small cells.
+    { "many-columns", { 300, 8, 1,    10, 10, 8,          0 } },
+    // A row with a large map.
+    { "collections",  { 1,   2, 1,    10, 10, 32,         100 } },
+    // A few rows holding large values.
+    { "blobs",        { 1,   2, 4,    10, 10, 64 * 1024,  0 } },
+};
+
+static schema_ptr make_schema(const mutation_settings& settings) {
     auto builder = schema_builder("ks", "cf")
         .with_column("pk", bytes_type, column_kind::partition_key)
         .with_column("ck", bytes_type, column_kind::clustering_key);
@@ -145,14 +169,29 @@ static mutation make_mutation(mutation_settings settings) {
     for (size_t i = 0; i < settings.column_count; ++i) {
         builder.with_column(to_bytes(random_string(settings.column_name_size)), bytes_type);
     }
+    if (settings.collection_size) {
+        builder.with_column("map", map_type_impl::get_instance(int32_type, bytes_type, true));
+    }
 
-    auto s = builder.build();
+    return builder.build();
+}
 
+static mutation make_mutation(schema_ptr s, const mutation_settings& settings) {
     mutation m(partition_key::from_single_value(*s, bytes_type->decompose(data_value(random_bytes(settings.partition_key_size)))), s);
 
     for (size_t i = 0; i < settings.row_count; ++i) {
         auto ck = clustering_key::from_single_value(*s, bytes_type->decompose(data_value(random_bytes(settings.clustering_key_size))));
         for (auto&& col : s->regular_columns()) {
+            if (col.type->is_collection()) {
+                auto ctype = static_pointer_cast<const collection_type_impl>(col.type);
+                collection_type_impl::mutation cm;
+                for (size_t j = 0; j < settings.collection_size; ++j) {
+                    cm.cells.emplace_back(int32_type->decompose(int32_t(j)),
+                        atomic_cell::make_live(1, bytes_type->decompose(data_value(random_bytes(settings.data_size)))));
+                }
+                m.set_clustered_cell(ck, col, ctype->serialize_mutation_form(cm));
+                continue;
+            }
             m.set_clustered_cell(ck, col,
                 atomic_cell::make_live(1,
                     bytes_type->decompose(data_value(random_bytes(settings.data_size)))));
@@ -161,6 +200,10 @@ static mutation make_mutation(mutation_settings settings) {
     return m;
 }
 
+static mutation make_mutation(const mutation_settings& settings) {
+    return make_mutation(make_schema(settings), settings);
+}
+
 struct sizes {
     size_t memtable;
     size_t cache;
@@ -203,27 +246,94 @@ static sizes calculate_sizes(const mutation& m) {
     return result;
 }
 
+static void print_occupancy(const char* name, logalloc::occupancy_stats occ, size_t partitions, const mutation_settings& settings) {
+    auto rows = partitions * settings.row_count;
+    auto cells = rows * settings.cells_per_row();
+    std::cout << " - " << name << ":\n";
+    std::cout << "   used:          " << occ.used_space() << "\n";
+    std::cout << "   total:         " << occ.total_space() << "\n";
+    std::cout << "   fragmentation: " << sprint("%.2f%%", 100 * (1 - occ.used_fraction())) << "\n";
+    std::cout << "   per partition: " << occ.used_space() / std::max<size_t>(partitions, 1) << "\n";
+    std::cout << "   per row:       " << occ.used_space() / std::max<size_t>(rows, 1) << "\n";
+    std::cout << "   per cell:      " << occ.used_space() / std::max<size_t>(cells, 1) << "\n";
+}
+
+// Fills a memtable and a cache with many partitions of given shape, so that
+// the footprint includes the containers indexing them and LSA segment
+// overhead, and then measures what evicting half of the cache costs.
+static void calculate_bulk_footprint(const mutation_settings& settings, size_t partition_count) {
+    auto s = make_schema(settings);
+    auto mt = make_lw_shared<memtable>(s);
+    cache_tracker tracker;
+    row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+
+    auto cache_initial = tracker.region().occupancy();
+    for (size_t i = 0; i < partition_count; ++i) {
+        auto m = make_mutation(s, settings);
+        mt->apply(m);
+        cache.populate(m);
+    }
+
+    std::cout << "bulk footprint of " << partition_count << " partitions:\n";
+    print_occupancy("in memtable", mt->occupancy(), partition_count, settings);
+    print_occupancy("in cache", tracker.region().occupancy() - cache_initial, partition_count, settings);
+
+    // Drop the memtable, so that the cache is the only thing left to reclaim
+    // from and what is reclaimed below comes from evicting it.
+    mt = {};
+    logalloc::shard_tracker().full_compaction();
+
+    auto before = tracker.partitions();
+    auto to_reclaim = tracker.region().occupancy().total_space() / 2;
+    auto start = std::chrono::steady_clock::now();
+    auto reclaimed = logalloc::shard_tracker().reclaim(to_reclaim);
+    auto duration = std::chrono::steady_clock::now() - start;
+    auto evicted = before - tracker.partitions();
+
+    std::cout << "eviction:\n";
+    std::cout << " - reclaimed:            " << reclaimed << " of " << to_reclaim << " requested\n";
+    std::cout << " - evicted partitions:   " << evicted << "\n";
+    std::cout << " - time per partition:   "
+        << sprint("%.3f", std::chrono::duration<double, std::micro>(duration).count() / std::max<size_t>(evicted, 1)) << " us\n";
+    std::cout << " - fragmentation after:  " << sprint("%.2f%%", 100 * (1 - tracker.region().occupancy().used_fraction())) << "\n";
+}
+
 int main(int argc, char** argv) {
     namespace bpo = boost::program_options;
     app_template app;
     app.add_options()
+        ("workload", bpo::value<sstring>(), "use settings of a named workload (narrow, wide, many-columns, collections, blobs) "
+            "instead of the ones below")
         ("column-count", bpo::value<size_t>()->default_value(5), "column count")
         ("column-name-size", bpo::value<size_t>()->default_value(2), "column name size")
         ("row-count", bpo::value<size_t>()->default_value(1), "row count")
         ("partition-key-size", bpo::value<size_t>()->default_value(10), "partition key size")
         ("clustering-key-size", bpo::value<size_t>()->default_value(10), "clustering key size")
-        ("data-size", bpo::value<size_t>()->default_value(32), "cell data size");
+        ("data-size", bpo::value<size_t>()->default_value(32), "cell data size")
+        ("collection-size", bpo::value<size_t>()->default_value(0), "number of entries of a map column, no map column if 0")
+        ("partition-count", bpo::value<size_t>()->default_value(0), "number of partitions to fill memtable and cache with, "
+            "also measures eviction if non-zero");
 
     return app.run(argc, argv, [&] {
       return do_with_cql_env([&] (auto&& env) {
         return seastar::async([&] {
             mutation_settings settings;
-            settings.column_count = app.configuration()["column-count"].as<size_t>();
-            settings.column_name_size = app.configuration()["column-name-size"].as<size_t>();
-            settings.row_count = app.configuration()["row-count"].as<size_t>();
-            settings.partition_key_size = app.configuration()["partition-key-size"].as<size_t>();
-            settings.clustering_key_size = app.configuration()["clustering-key-size"].as<size_t>();
-            settings.data_size = app.configuration()["data-size"].as<size_t>();
+            if (app.configuration().count("workload")) {
+                auto name = app.configuration()["workload"].as<sstring>();
+                auto i = workloads.find(name);
+                if (i == workloads.end()) {
+                    throw std::invalid_argument(sprint("unknown workload: %s", name));
+                }
+                settings = i->second;
+            } else {
+                settings.column_count = app.configuration()["column-count"].as<size_t>();
+                settings.column_name_size = app.configuration()["column-name-size"].as<size_t>();
+                settings.row_count = app.configuration()["row-count"].as<size_t>();
+                settings.partition_key_size = app.configuration()["partition-key-size"].as<size_t>();
+                settings.clustering_key_size = app.configuration()["clustering-key-size"].as<size_t>();
+                settings.data_size = app.configuration()["data-size"].as<size_t>();
+                settings.collection_size = app.configuration()["collection-size"].as<size_t>();
+            }
 
             auto m = make_mutation(settings);
             auto sizes = calculate_sizes(m);
@@ -238,6 +348,12 @@ int main(int argc, char** argv) {
 
             std::cout << "\n";
             size_calculator::print_cache_entry_size();
+
+            auto partition_count = app.configuration()["partition-count"].as<size_t>();
+            if (partition_count) {
+                std::cout << "\n";
+                calculate_bulk_footprint(settings, partition_count);
+            }
         });
       });
     });
@@ -130,3 +130,125 @@ SEASTAR_TEST_CASE(test_adding_a_column_during_reading_doesnt_affect_read_result)
             .produces_end_of_stream();
     });
 }
+
+SEASTAR_TEST_CASE(test_flush_reader_releases_dirty_memory_progressively) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("v", bytes_type, column_kind::regular_column)
+                .build();
+
+        logalloc::region_group dirty;
+        auto mt = make_lw_shared<memtable>(s, &dirty);
+
+        std::vector<mutation> ring = make_ring(s, 10);
+        for (auto&& m : ring) {
+            set_column(m, "v");
+            mt->apply(m);
+        }
+
+        auto total = dirty.memory_used();
+        BOOST_REQUIRE_EQUAL(total, mt->occupancy().total_space());
+
+        auto rd = mt->make_flush_reader(s);
+        auto last = total;
+        for (unsigned i = 0; i < ring.size(); ++i) {
+            auto sm = rd().get0();
+            BOOST_REQUIRE(sm);
+            BOOST_REQUIRE_LE(dirty.memory_used(), last);
+            last = dirty.memory_used();
+        }
+        BOOST_REQUIRE_LT(dirty.memory_used(), total);
+        BOOST_REQUIRE(!rd().get0());
+        BOOST_REQUIRE_EQUAL(dirty.memory_used(), 0);
+
+        mt->revert_flushed_memory();
+        BOOST_REQUIRE_EQUAL(dirty.memory_used(), mt->occupancy().total_space());
+
+        mt = {};
+        BOOST_REQUIRE_EQUAL(dirty.memory_used(), 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_point_lookups_after_index_growth_and_compaction) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("v", bytes_type, column_kind::regular_column)
+                .build();
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> ring = make_ring(s, 1000);
+        for (auto&& m : ring) {
+            set_column(m, "v");
+            mt->apply(m);
+        }
+
+        logalloc::shard_tracker().full_compaction();
+
+        // Applies to existing partitions must find them, not add new ones.
+        for (auto&& m : ring) {
+            auto m2 = mutation(m.decorated_key(), s);
+            set_column(m2, "v");
+            mt->apply(m2);
+            m.apply(m2);
+        }
+        BOOST_REQUIRE_EQUAL(mt->partition_count(), ring.size());
+
+        logalloc::shard_tracker().full_compaction();
+
+        for (auto&& m : ring) {
+            auto range = query::partition_range::make_singular(m.decorated_key());
+            assert_that(mt->make_reader(s, range))
+                .produces(m)
+                .produces_end_of_stream();
+        }
+
+        auto rd = assert_that(mt->make_reader(s));
+        for (auto&& m : ring) {
+            rd.produces(m);
+        }
+        rd.produces_end_of_stream();
+
+        auto missing = make_unique_mutation(s);
+        auto range = query::partition_range::make_singular(missing.decorated_key());
+        assert_that(mt->make_reader(s, range))
+            .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_compacting_expired_data_keeps_tombstones) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("v", bytes_type, column_kind::regular_column)
+                .build();
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> ring = make_ring(s, 300);
+        for (auto&& m : ring) {
+            m.set_clustered_cell(clustering_key::make_empty(), to_bytes("v"), data_value(make_unique_bytes()),
+                next_timestamp(), gc_clock::duration(std::chrono::seconds(1)));
+            mt->apply(m);
+        }
+
+        auto now = gc_clock::now() + std::chrono::seconds(10);
+        std::experimental::optional<dht::decorated_key> last;
+        unsigned steps = 0;
+        while (mt->compact_expired(last, now, 100, 1) == stop_iteration::no) {
+            ++steps;
+        }
+        BOOST_REQUIRE_EQUAL(steps, 2);
+
+        can_gc_fn never_gc = [] (tombstone) { return false; };
+        auto rd = assert_that(mt->make_reader(s));
+        for (auto&& m : ring) {
+            m.partition().compact_for_compaction(*s, never_gc, now);
+            BOOST_REQUIRE(!m.partition().clustered_row(clustering_key::make_empty()).cells().find_cell(0)->as_atomic_cell().is_live());
+            rd.produces(m);
+        }
+        rd.produces_end_of_stream();
+    });
+}
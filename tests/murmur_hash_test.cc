@@ -123,3 +123,26 @@ BOOST_AUTO_TEST_CASE(test_hash_output) {
         }
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_incremental_hash_output) {
+    for (size_t i = 0; i < full_sequence.size(); ++i) {
+        auto prefix = bytes_view(full_sequence.begin(), i);
+        auto&& expected = prefix_hashes[i];
+
+        // Feed the prefix in pieces of every size, so that all ways of
+        // crossing the block boundaries are exercised.
+        for (size_t piece = 1; piece <= i; ++piece) {
+            utils::murmur_hash::hasher3_x64_128 h(seed);
+            for (size_t pos = 0; pos < i; pos += piece) {
+                auto n = std::min(piece, i - pos);
+                h.update(reinterpret_cast<const char*>(prefix.begin() + pos), n);
+            }
+            std::array<uint64_t, 2> dst;
+            h.finalize(dst);
+            if (dst != expected) {
+                BOOST_FAIL(sprint("Hashes differ for %s in pieces of %d (got {0x%x, 0x%x} and {0x%x, 0x%x})", prefix, piece,
+                    dst[0], dst[1], expected[0], expected[1]));
+            }
+        }
+    }
+}
@@ -34,6 +34,8 @@
 #include "tests/result_set_assertions.hh"
 
 #include "mutation_query.hh"
+#include "query_result_merger.hh"
+#include "querier_cache.hh"
 #include "core/do_with.hh"
 #include "core/thread.hh"
 #include "schema_builder.hh"
@@ -484,6 +486,104 @@ SEASTAR_TEST_CASE(test_result_row_count) {
     });
 }
 
+SEASTAR_TEST_CASE(test_streaming_result_merger_stops_at_row_limit) {
+    return seastar::async([] {
+        storage_service_for_tests ssft;
+        auto s = make_schema();
+        auto now = gc_clock::now();
+        auto slice = make_full_slice(*s);
+
+        auto make_result = [&] (const char* key, std::vector<const char*> cks) {
+            mutation m(partition_key::from_single_value(*s, bytes(key)), s);
+            for (auto ck : cks) {
+                m.set_clustered_cell(clustering_key::from_single_value(*s, bytes(ck)), "v1", data_value(bytes("v")), 1);
+            }
+            auto r = to_data_query_result(mutation_query(s, make_source({m}), query::full_partition_range, slice, query::max_rows, query::max_partitions, now).get0(), s, slice);
+            return make_foreign(make_lw_shared<query::result>(std::move(r)));
+        };
+
+        query::streaming_result_merger merger(slice, 3);
+        merger(make_result("key1", {"A", "B"}));
+        BOOST_REQUIRE(!merger.done());
+        merger(make_result("key2", {"C"}));
+        BOOST_REQUIRE(merger.done());
+        merger(make_result("key3", {"D"}));
+
+        auto merged = merger.get(true);
+        BOOST_REQUIRE_EQUAL(merged->row_count().value(), 3);
+        BOOST_REQUIRE(!merged->is_short_read());
+        assert_that(query::result_set::from_raw_result(s, slice, *merged))
+            .has_size(3)
+            .has(a_row().with_column("pk", data_value(bytes("key2"))).with_column("ck", data_value(bytes("C"))));
+    });
+}
+
+SEASTAR_TEST_CASE(test_columnar_result_matches_row_oriented) {
+    return seastar::async([] {
+        storage_service_for_tests ssft;
+        auto s = make_schema();
+        auto now = gc_clock::now();
+
+        mutation m1(partition_key::from_single_value(*s, "key1"), s);
+        m1.set_static_cell("s1", data_value(bytes("S1")), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("A")), "v1", data_value(bytes("A:v")), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("A")), "v2", data_value(bytes("A:v2")), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("B")), "v1", data_value(bytes("B:v")), 1, gc_clock::duration(3600));
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("C")), "v2", data_value(bytes("C:longer")), 1);
+
+        mutation m2(partition_key::from_single_value(*s, "key2"), s);
+        m2.set_static_cell("s2", data_value(bytes("S2")), 1);
+
+        mutation m3(partition_key::from_single_value(*s, "key3"), s);
+        m3.set_clustered_cell(clustering_key::from_single_value(*s, bytes("D")), "v1", data_value(bytes("D:v")), 1);
+
+        std::vector<mutation> mutations{m1, m2, m3};
+        std::sort(mutations.begin(), mutations.end(), mutation_less_cmp());
+        auto src = make_source(mutations);
+
+        auto query_both = [&] (const query::partition_slice& slice) {
+            auto r = mutation_query(s, src, query::full_partition_range, slice, query::max_rows, query::max_partitions, now).get0();
+            auto columnar_slice = slice;
+            columnar_slice.options.set<query::partition_slice::option::columnar>();
+            auto rows = to_data_query_result(r, s, slice);
+            auto columnar = to_data_query_result(r, s, columnar_slice);
+            BOOST_REQUIRE(!rows.is_columnar());
+            BOOST_REQUIRE(columnar.is_columnar());
+            BOOST_REQUIRE_EQUAL(columnar.row_count().value(), rows.row_count().value());
+            BOOST_REQUIRE(query::result_set::from_raw_result(s, columnar_slice, columnar) == query::result_set::from_raw_result(s, slice, rows));
+            return columnar;
+        };
+
+        auto full = query_both(make_full_slice(*s));
+        BOOST_REQUIRE_EQUAL(full.row_count().value(), 5);
+
+        // key2 has no row in the range, so its static row is dropped.
+        auto sliced = query_both(partition_slice_builder(*s)
+            .with_range(query::clustering_range::make_singular(clustering_key_prefix::from_single_value(*s, bytes("B"))))
+            .build());
+        BOOST_REQUIRE_EQUAL(sliced.row_count().value(), 1);
+
+        query_both(partition_slice_builder(*s)
+            .with_regular_column("v2")
+            .with_no_static_columns()
+            .without_partition_key_columns()
+            .reversed()
+            .build());
+
+        // Columnar results are merged by appending their pages.
+        auto slice = make_full_slice(*s);
+        slice.options.set<query::partition_slice::option::columnar>();
+        query::result_merger merger;
+        merger(make_foreign(make_lw_shared<query::result>(full)));
+        merger(make_foreign(make_lw_shared<query::result>(sliced)));
+        auto merged = merger.get();
+        BOOST_REQUIRE(merged->is_columnar());
+        BOOST_REQUIRE_EQUAL(merged->row_count().value(), 6);
+        assert_that(query::result_set::from_raw_result(s, slice, *merged))
+            .has_size(6);
+    });
+}
+
 SEASTAR_TEST_CASE(test_partition_limit) {
     return seastar::async([] {
         storage_service_for_tests ssft;
@@ -529,3 +629,84 @@ SEASTAR_TEST_CASE(test_partition_limit) {
         }
     });
 }
+
+SEASTAR_TEST_CASE(test_paged_data_query_continues_suspended_read) {
+    return seastar::async([] {
+        storage_service_for_tests ssft;
+        auto s = make_schema();
+        auto now = gc_clock::now();
+
+        mutation m(partition_key::from_single_value(*s, "key1"), s);
+        m.set_static_cell("s1", data_value(bytes("S_v1")), 1);
+        for (auto&& ck : {"A", "B", "C", "D", "E"}) {
+            m.set_clustered_cell(clustering_key::from_single_value(*s, bytes(ck)), "v1", data_value(bytes(ck)), 1);
+        }
+
+        unsigned readers = 0;
+        auto src = mutation_source([&] (schema_ptr, const query::partition_range&, query::clustering_key_filtering_context ck_filtering) {
+            ++readers;
+            return make_reader_returning_many({m}, ck_filtering);
+        });
+
+        querier_cache cache;
+        auto range = query::partition_range::make_singular(m.decorated_key());
+        auto slice = make_full_slice(*s);
+        std::vector<bytes> cks;
+        while (true) {
+            query::result::builder builder(slice, query::result_request::only_result);
+            data_query(s, src, range, slice, 2, query::max_partitions, now, builder, &cache).get();
+            auto rs = query::result_set::from_raw_result(s, slice, builder.build());
+            if (rs.rows().empty()) {
+                break;
+            }
+            for (auto&& row : rs.rows()) {
+                BOOST_REQUIRE(row.get_nonnull<bytes>("s1") == bytes("S_v1"));
+                cks.push_back(row.get_nonnull<bytes>("ck"));
+            }
+            // Ask for the next page like the pager does.
+            auto last = clustering_key_prefix::from_single_value(*s, cks.back());
+            slice.set_range(*s, m.key(), { query::clustering_range(query::clustering_range::bound(last, false), { }) });
+        }
+
+        BOOST_REQUIRE(cks == std::vector<bytes>({bytes("A"), bytes("B"), bytes("C"), bytes("D"), bytes("E")}));
+        // The read of the first page is continued by the next two, the last
+        // (empty) page starts a new one.
+        BOOST_REQUIRE_EQUAL(readers, 2);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().hits, 2);
+        BOOST_REQUIRE_EQUAL(cache.size(), 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_query_counts_scanned_tombstones) {
+    return seastar::async([] {
+        storage_service_for_tests ssft;
+        auto s = make_schema();
+        auto now = gc_clock::now();
+
+        mutation m(partition_key::from_single_value(*s, "key1"), s);
+        for (int i = 0; i < 10; ++i) {
+            auto ck = clustering_key::from_single_value(*s, to_bytes(sprint("ck%02d", i)));
+            m.partition().apply_delete(*s, std::move(ck), tombstone(api::timestamp_type(1), now));
+        }
+        m.set_clustered_cell(clustering_key::from_single_value(*s, bytes("live")), "v1", data_value(bytes("v")), 1);
+
+        auto src = make_source({m});
+        auto slice = make_full_slice(*s);
+
+        {
+            query::tombstone_counter tombstones(3, 100);
+            reconcilable_result result = mutation_query(s, src,
+                query::full_partition_range, slice, query::max_rows, query::max_partitions, now, &tombstones).get0();
+            BOOST_REQUIRE_EQUAL(tombstones.count(), 10);
+            BOOST_REQUIRE(tombstones.over_warn_threshold());
+            assert_that(to_result_set(result, s, slice)).has_size(1);
+        }
+
+        {
+            query::tombstone_counter tombstones(3, 5);
+            BOOST_REQUIRE_THROW(mutation_query(s, src,
+                query::full_partition_range, slice, query::max_rows, query::max_partitions, now, &tombstones).get0(),
+                query::tombstone_overwhelming_exception);
+        }
+    });
+}
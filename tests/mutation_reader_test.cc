@@ -223,3 +223,30 @@ SEASTAR_TEST_CASE(test_combining_one_empty_reader) {
     });
 }
 
+
+SEASTAR_TEST_CASE(test_restricted_reader_waits_for_memory) {
+    return seastar::async([] {
+        semaphore sem(10);
+        semaphore memory_sem(100);
+        restricted_mutation_reader_config config;
+        config.sem = &sem;
+        config.memory_sem = &memory_sem;
+        config.max_memory = 100;
+
+        auto r1 = std::make_unique<mutation_reader>(make_restricted_reader(config, reader_resources(1, 60), make_empty_reader()));
+        (*r1)().get();
+        BOOST_REQUIRE_EQUAL(sem.current(), 9);
+        BOOST_REQUIRE_EQUAL(memory_sem.current(), 40);
+
+        // Charged as max_memory.
+        auto r2 = make_restricted_reader(config, reader_resources(1, 1000), make_empty_reader());
+        auto f = r2();
+        BOOST_REQUIRE(!f.available());
+        BOOST_REQUIRE_EQUAL(memory_sem.waiters(), 1);
+
+        r1 = {};
+        f.get();
+        BOOST_REQUIRE_EQUAL(sem.current(), 9);
+        BOOST_REQUIRE_EQUAL(memory_sem.current(), 0);
+    });
+}
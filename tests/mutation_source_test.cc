@@ -165,8 +165,79 @@ static void test_range_queries(populate_fn populate) {
     test_slice(inclusive_token_range(128, partitions.size() - 1));
 }
 
+static void test_streamed_mutation_forwarding(populate_fn populate) {
+    BOOST_TEST_MESSAGE("Testing streamed_mutation::fast_forward_to()");
+
+    auto s = schema_builder("ks", "cf")
+        .with_column("pk", int32_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", int32_type)
+        .build();
+
+    auto make_ck = [&] (int ck) {
+        return clustering_key::from_single_value(*s, int32_type->decompose(ck));
+    };
+
+    mutation m(partition_key::from_single_value(*s, int32_type->decompose(0)), s);
+    for (int i = 0; i < 100; ++i) {
+        m.set_clustered_cell(make_ck(i), "v", data_value(int32_t(i)), 1);
+    }
+    tombstone t(2, gc_clock::now());
+    m.partition().apply_row_tombstone(*s, range_tombstone(make_ck(40), bound_kind::incl_start, make_ck(60), bound_kind::incl_end, t));
+
+    auto ds = populate(s, {m});
+    auto pr = query::partition_range::make_singular(m.decorated_key());
+    auto rd = ds(s, pr);
+    auto sm = rd().get0();
+    BOOST_REQUIRE(sm);
+
+    struct range_contents {
+        std::vector<int> rows;
+        bool has_tombstone = false;
+    };
+    auto read_range = [&] (query::clustering_range r) {
+        sm->fast_forward_to(position_range::from_range(r)).get();
+        range_contents rc;
+        auto mf = (*sm)().get0();
+        while (mf) {
+            if (mf->is_clustering_row()) {
+                auto ck = mf->as_clustering_row().key().get_component(*s, 0);
+                rc.rows.push_back(value_cast<int32_t>(int32_type->deserialize(ck)));
+            } else if (mf->is_range_tombstone()) {
+                BOOST_REQUIRE(mf->as_range_tombstone().tomb == t);
+                rc.has_tombstone = true;
+            }
+            mf = (*sm)().get0();
+        }
+        return rc;
+    };
+    auto expected_rows = [] (int start, int end) {
+        std::vector<int> rows;
+        for (int i = start; i < end; ++i) {
+            rows.push_back(i);
+        }
+        return rows;
+    };
+
+    auto rc = read_range(query::clustering_range::make({make_ck(10), true}, {make_ck(20), true}));
+    BOOST_REQUIRE(rc.rows == expected_rows(10, 21));
+    BOOST_REQUIRE(!rc.has_tombstone);
+
+    rc = read_range(query::clustering_range::make({make_ck(50), true}, {make_ck(55), false}));
+    BOOST_REQUIRE(rc.rows == expected_rows(50, 55));
+    BOOST_REQUIRE(rc.has_tombstone);
+
+    rc = read_range(query::clustering_range::make_starting_with({make_ck(90), false}));
+    BOOST_REQUIRE(rc.rows == expected_rows(91, 100));
+    BOOST_REQUIRE(!rc.has_tombstone);
+
+    rc = read_range(query::clustering_range::make_starting_with({make_ck(200), true}));
+    BOOST_REQUIRE(rc.rows.empty());
+}
+
 void run_mutation_source_tests(populate_fn populate) {
     test_range_queries(populate);
+    test_streamed_mutation_forwarding(populate);
 }
 
 struct mutation_sets {
@@ -21,6 +21,7 @@
 
 #define BOOST_TEST_DYN_LINK
 
+#include <numeric>
 #include <random>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/algorithm/copy.hpp>
@@ -40,6 +41,7 @@
 #include "query-result-reader.hh"
 #include "partition_slice_builder.hh"
 #include "tmpdir.hh"
+#include "counters.hh"
 
 #include "tests/test-utils.hh"
 #include "tests/mutation_assertions.hh"
@@ -202,6 +204,37 @@ SEASTAR_TEST_CASE(test_map_mutations) {
     });
 }
 
+SEASTAR_TEST_CASE(test_map_merge) {
+    return seastar::async([] {
+        auto my_map_type = map_type_impl::get_instance(int32_type, utf8_type, true);
+        auto cell = [] (api::timestamp_type ts, sstring v) {
+            return atomic_cell::make_live(ts, utf8_type->decompose(v));
+        };
+        map_type_impl::mutation mmut1{{}, {
+            {int32_type->decompose(1), cell(1, "a1")},
+            {int32_type->decompose(2), cell(3, "a2")},
+            {int32_type->decompose(4), cell(1, "a4")},
+            {int32_type->decompose(5), cell(5, "a5")},
+        }};
+        map_type_impl::mutation mmut2{tombstone(2, gc_clock::now()), {
+            {int32_type->decompose(2), cell(2, "b2")},
+            {int32_type->decompose(3), cell(3, "b3")},
+            {int32_type->decompose(5), cell(6, "b5")},
+        }};
+        auto merged = my_map_type->merge(my_map_type->serialize_mutation_form(mmut1), my_map_type->serialize_mutation_form(mmut2));
+        auto muts = my_map_type->deserialize_mutation_form(merged);
+        BOOST_REQUIRE_EQUAL(muts.tomb, mmut2.tomb);
+        // Elements 1 and 4 of the first map are covered by the tombstone of the second.
+        BOOST_REQUIRE_EQUAL(muts.cells.size(), 3);
+        BOOST_REQUIRE(muts.cells[0].first == int32_type->decompose(2));
+        BOOST_REQUIRE(muts.cells[0].second.value() == utf8_type->decompose(sstring("a2")));
+        BOOST_REQUIRE(muts.cells[1].first == int32_type->decompose(3));
+        BOOST_REQUIRE(muts.cells[1].second.value() == utf8_type->decompose(sstring("b3")));
+        BOOST_REQUIRE(muts.cells[2].first == int32_type->decompose(5));
+        BOOST_REQUIRE(muts.cells[2].second.value() == utf8_type->decompose(sstring("b5")));
+    });
+}
+
 SEASTAR_TEST_CASE(test_set_mutations) {
     return seastar::async([] {
         auto my_set_type = set_type_impl::get_instance(int32_type, true);
@@ -723,6 +756,42 @@ SEASTAR_TEST_CASE(test_tombstone_apply) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_counter_cells_are_merged_by_shard) {
+    auto s = schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("c", counter_type, column_kind::regular_column)
+            .build();
+
+    auto pkey = partition_key::from_single_value(*s, "key1");
+    auto& col = *s->get_column_definition("c");
+    auto id1 = utils::UUID_gen::get_time_UUID();
+    auto id2 = utils::UUID_gen::get_time_UUID();
+
+    auto make = [&] (api::timestamp_type ts, std::vector<counter_shard> shards) {
+        counter_cell_builder ccb;
+        for (auto&& cs : shards) {
+            ccb.add_shard(cs);
+        }
+        mutation m(pkey, s);
+        m.set_clustered_cell(clustering_key::make_empty(), col, atomic_cell_or_collection(ccb.build(ts)));
+        return m;
+    };
+
+    auto m = make(1, { counter_shard(id1, 5, 1) });
+    m.apply(make(2, { counter_shard(id1, 3, 2), counter_shard(id2, 7, 1) }));
+    // An older version of a shard doesn't change it.
+    m.apply(make(3, { counter_shard(id1, 5, 1) }));
+
+    auto& c = *m.partition().clustered_row(clustering_key::make_empty()).cells().find_cell(col.id);
+    counter_cell_view ccv(c.as_atomic_cell());
+    BOOST_REQUIRE_EQUAL(ccv.shard_count(), 2);
+    BOOST_REQUIRE_EQUAL(ccv.total_value(), 10);
+    BOOST_REQUIRE_EQUAL(ccv.get_shard(id1)->logical_clock(), 2);
+    BOOST_REQUIRE_EQUAL(c.as_atomic_cell().timestamp(), 3);
+
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_marker_apply) {
     auto s = schema_builder("ks", "cf")
             .with_column("pk", bytes_type, column_kind::partition_key)
@@ -1054,10 +1123,12 @@ SEASTAR_TEST_CASE(test_query_digest) {
         auto check_digests_equal = [] (const mutation& m1, const mutation& m2) {
             auto ps1 = partition_slice_builder(*m1.schema()).build();
             auto ps2 = partition_slice_builder(*m2.schema()).build();
-            auto digest1 = *m1.query(ps1, query::result_request::only_digest).digest();
-            auto digest2 = *m2.query(ps2, query::result_request::only_digest).digest();
-            if (digest1 != digest2) {
-                BOOST_FAIL(sprint("Digest should be the same for %s and %s", m1, m2));
+            for (auto da : { query::digest_algorithm::MD5, query::digest_algorithm::murmur3 }) {
+                auto digest1 = *m1.query(ps1, query::result_options::only_digest(da)).digest();
+                auto digest2 = *m2.query(ps2, query::result_options::only_digest(da)).digest();
+                if (digest1 != digest2) {
+                    BOOST_FAIL(sprint("Digest should be the same for %s and %s", m1, m2));
+                }
             }
         };
 
@@ -1092,6 +1163,25 @@ SEASTAR_TEST_CASE(test_query_digest) {
     });
 }
 
+SEASTAR_TEST_CASE(test_query_digest_algorithms) {
+    return seastar::async([] {
+        for_each_mutation([] (const mutation& m) {
+            auto ps = partition_slice_builder(*m.schema()).build();
+
+            auto r = m.query(ps, query::result_options::data(query::digest_algorithm::none));
+            BOOST_REQUIRE(!r.digest());
+            auto r_with_digest = m.query(ps, query::result_options::data(query::digest_algorithm::murmur3));
+            BOOST_REQUIRE(bytes_ostream(r.buf()).linearize() == bytes_ostream(r_with_digest.buf()).linearize());
+
+            auto md5 = *m.query(ps, query::result_options::only_digest(query::digest_algorithm::MD5)).digest();
+            BOOST_REQUIRE(md5 == *m.query(ps, query::result_request::only_digest).digest());
+            auto murmur3 = *m.query(ps, query::result_options::only_digest(query::digest_algorithm::murmur3)).digest();
+            BOOST_REQUIRE(murmur3 == *m.query(ps, query::result_options::data(query::digest_algorithm::murmur3)).digest());
+            BOOST_REQUIRE(md5 != murmur3);
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_mutation_upgrade_of_equal_mutations) {
     return seastar::async([] {
         for_each_mutation_pair([](auto&& m1, auto&& m2, are_equal eq) {
@@ -1391,3 +1481,166 @@ SEASTAR_TEST_CASE(test_slicing_mutation) {
 
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(test_partition_with_many_rows) {
+    return seastar::async([] {
+        auto builder = schema_builder("ks", "cf")
+            .with_column("pk", int32_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key)
+            .with_column("v", int32_type);
+        builder.set_gc_grace_seconds(0);
+        auto s = builder.build();
+
+        auto pk = partition_key::from_exploded(*s, { int32_type->decompose(0) });
+        auto ck = [&] (int i) {
+            return clustering_key_prefix::from_single_value(*s, int32_type->decompose(i));
+        };
+
+        // Enough rows for the rows container to need inner nodes.
+        constexpr int row_count = 1000;
+        std::vector<int> order(row_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::default_random_engine(42));
+
+        mutation m1(pk, s);
+        mutation m2(pk, s);
+        for (auto i : order) {
+            m1.set_clustered_cell(ck(i), to_bytes("v"), data_value(i), 1);
+            if (i % 3 == 0) {
+                m2.set_clustered_cell(ck(i), to_bytes("v"), data_value(-i), 2);
+            }
+        }
+        for (int i = row_count; i < row_count + 100; ++i) {
+            m2.set_clustered_cell(ck(i), to_bytes("v"), data_value(i), 2);
+        }
+
+        auto m = m1;
+        m.apply(m2);
+        auto& rows = m.partition().clustered_rows();
+        BOOST_REQUIRE_EQUAL(rows.size(), row_count + 100);
+
+        auto& v_def = *s->get_column_definition(to_bytes("v"));
+        int expected = 0;
+        for (auto&& re : rows) {
+            BOOST_REQUIRE(re.key().equal(*s, ck(expected)));
+            auto v = value_cast<int32_t>(int32_type->deserialize(re.row().cells().cell_at(v_def.id).as_atomic_cell().value()));
+            BOOST_REQUIRE_EQUAL(v, expected % 3 == 0 && expected < row_count ? -expected : expected);
+            ++expected;
+        }
+        for (auto i = rows.rbegin(); i != rows.rend(); ++i) {
+            BOOST_REQUIRE(i->key().equal(*s, ck(--expected)));
+        }
+        BOOST_REQUIRE_EQUAL(expected, 0);
+
+        auto r = query::clustering_range::make({ck(250)}, {ck(750), false});
+        mutation_partition sliced(m.partition(), *s, query::clustering_row_ranges{r});
+        BOOST_REQUIRE_EQUAL(sliced.clustered_rows().size(), 500);
+        BOOST_REQUIRE(sliced.clustered_rows().begin()->key().equal(*s, ck(250)));
+
+        for (int i = 100; i <= 900; ++i) {
+            m.partition().apply_delete(*s, ck(i), tombstone(3, gc_clock::now() - std::chrono::seconds(1)));
+        }
+        m.partition().compact_for_compaction(*s, always_gc, gc_clock::now());
+        BOOST_REQUIRE_EQUAL(rows.size(), 100 + 99 + 100);
+        BOOST_REQUIRE(rows.find(ck(99), rows_entry::compare(*s)) != rows.end());
+        BOOST_REQUIRE(rows.find(ck(100), rows_entry::compare(*s)) == rows.end());
+        BOOST_REQUIRE(rows.find(ck(901), rows_entry::compare(*s)) != rows.end());
+    });
+}
+
+SEASTAR_TEST_CASE(test_apply_some_is_equivalent_to_apply) {
+    return seastar::async([] {
+        for_each_mutation_pair([] (auto&& m1, auto&& m2, are_equal) {
+            auto& s = *m1.schema();
+            if (s.version() != m2.schema()->version()) {
+                return;
+            }
+            auto expected = m1;
+            expected.apply(m2);
+
+            for (size_t step : { 1, 3, 1000 }) {
+                auto target = m1;
+                auto source = m2;
+                while (target.partition().apply_some(s, source.partition(), step) == stop_iteration::no) {
+                    // Nothing is lost or duplicated half way.
+                    auto m = target;
+                    m.apply(source);
+                    assert_that(m).is_equal_to(expected);
+                }
+                assert_that(target).is_equal_to(expected);
+            }
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_row_with_many_columns) {
+    return seastar::async([] {
+        constexpr int column_count = 300;
+        auto builder = schema_builder("ks", "cf")
+            .with_column("pk", int32_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key);
+        for (int i = 0; i < column_count; ++i) {
+            builder.with_column(to_bytes(sprint("v%03d", i)), int32_type);
+        }
+        auto s = builder.build();
+
+        auto pk = partition_key::from_exploded(*s, { int32_type->decompose(0) });
+        auto ck = clustering_key::from_single_value(*s, int32_type->decompose(0));
+        auto col = [&] (int i) -> const column_definition& {
+            return *s->get_column_definition(to_bytes(sprint("v%03d", i)));
+        };
+        auto cell = [&] (int v, api::timestamp_type ts) {
+            return atomic_cell::make_live(ts, int32_type->decompose(v));
+        };
+
+        // Every other column, in reverse order, so that cells land in the
+        // middle of the row.
+        mutation m1(pk, s);
+        for (int i = column_count - 2; i >= 0; i -= 2) {
+            m1.set_clustered_cell(ck, col(i), cell(i, 1));
+        }
+        mutation m2(pk, s);
+        for (int i = 0; i < column_count; i += 3) {
+            m2.set_clustered_cell(ck, col(i), cell(-i, 2));
+        }
+
+        auto m = m1;
+        m.apply(m2);
+        auto& cells = m.partition().clustered_row(ck).cells();
+        int expected = 0;
+        for (int i = 0; i < column_count; ++i) {
+            expected += i % 2 == 0 || i % 3 == 0;
+        }
+        BOOST_REQUIRE_EQUAL(cells.size(), expected);
+        for (int i = 0; i < column_count; ++i) {
+            auto c = cells.find_cell(col(i).id);
+            if (i % 3 == 0) {
+                BOOST_REQUIRE(c);
+                BOOST_REQUIRE_EQUAL(c->as_atomic_cell().timestamp(), 2);
+            } else if (i % 2 == 0) {
+                BOOST_REQUIRE(c);
+                BOOST_REQUIRE_EQUAL(c->as_atomic_cell().timestamp(), 1);
+            } else {
+                BOOST_REQUIRE(!c);
+            }
+        }
+
+        column_id last = 0;
+        bool first = true;
+        cells.for_each_cell([&] (column_id id, const atomic_cell_or_collection&) {
+            BOOST_REQUIRE(first || id > last);
+            first = false;
+            last = id;
+        });
+
+        auto m3 = m2;
+        m3.apply(m1);
+        assert_that(m3).is_equal_to(m);
+        auto diff = m.partition().difference(s, m1.partition());
+        BOOST_REQUIRE_EQUAL(diff.find_row(ck)->size(), (column_count + 2) / 3);
+
+        m.partition().apply(tombstone(1, gc_clock::now()));
+        m.partition().compact_for_query(*s, gc_clock::now(), { query::clustering_range::make_open_ended_both_sides() }, false, query::max_rows);
+        BOOST_REQUIRE_EQUAL(m.partition().clustered_row(ck).cells().size(), (column_count + 2) / 3);
+    });
+}
@@ -160,6 +160,29 @@ void full_ring_check(const std::vector<ring_point>& ring_points,
     }
 }
 
+/**
+ * Check that get_address_ranges() of a single endpoint returns the same
+ * ranges as the ones of the endpoint in the whole ring's address ranges.
+ */
+void address_ranges_check(const std::vector<ring_point>& ring_points,
+                          token_metadata& tm,
+                          abstract_replication_strategy* ars_ptr) {
+    auto all_ranges = ars_ptr->get_address_ranges(tm);
+
+    for (auto& rp : ring_points) {
+        std::unordered_set<range<token>> expected;
+        auto r = all_ranges.equal_range(rp.host);
+        for (auto it = r.first; it != r.second; ++it) {
+            expected.emplace(it->second);
+        }
+
+        auto ranges = ars_ptr->get_address_ranges(tm, rp.host);
+        std::unordered_set<range<token>> actual(ranges.begin(), ranges.end());
+        BOOST_CHECK(actual.size() == ranges.size());
+        BOOST_CHECK(actual == expected);
+    }
+}
+
 future<> simple_test() {
     utils::fb_utilities::set_broadcast_address(gms::inet_address("localhost"));
     utils::fb_utilities::set_broadcast_rpc_address(gms::inet_address("localhost"));
@@ -205,6 +228,7 @@ future<> simple_test() {
         auto ars_ptr = ars_uptr.get();
 
         full_ring_check(ring_points, options323, ars_ptr);
+        address_ranges_check(ring_points, *tm, ars_ptr);
 
         ///////////////
         // Create the replication strategy
@@ -220,6 +244,7 @@ future<> simple_test() {
         ars_ptr = ars_uptr.get();
 
         full_ring_check(ring_points, options320, ars_ptr);
+        address_ranges_check(ring_points, *tm, ars_ptr);
 
         //
         // Check cache invalidation: invalidate the cache and run a full ring
@@ -464,3 +464,29 @@ BOOST_AUTO_TEST_CASE(test_rp_describe_ownership) {
     BOOST_REQUIRE(std::fabs(own_map[t4] - 0.4) <= FLT_EPSILON);
     dht::set_global_partitioner(to_sstring("org.apache.cassandra.dht.Murmur3Partitioner"));
 }
+
+BOOST_AUTO_TEST_CASE(test_token_for_shard) {
+    auto saved_count = smp::count;
+    for (unsigned count : {1, 3, 7, 16}) {
+        smp::count = count;
+
+        dht::murmur3_partitioner m3;
+        BOOST_REQUIRE(m3.token_for_shard(0) == dht::minimum_token());
+        for (unsigned shard = 1; shard < count; ++shard) {
+            auto t = m3.token_for_shard(shard);
+            BOOST_REQUIRE_EQUAL(m3.shard_of(t), shard);
+            auto prev = token_from_long(uint64_t(std::stoll(m3.to_sstring(t)) - 1));
+            BOOST_REQUIRE_EQUAL(m3.shard_of(prev), shard - 1);
+        }
+
+        dht::byte_ordered_partitioner bop;
+        BOOST_REQUIRE(bop.token_for_shard(0) == dht::minimum_token());
+        for (unsigned shard = 1; shard < count; ++shard) {
+            auto t = bop.token_for_shard(shard);
+            BOOST_REQUIRE_EQUAL(bop.shard_of(t), shard);
+            auto prev = dht::token(dht::token::kind::key, managed_bytes({int8_t(t._data[0] - 1), int8_t(0xff)}));
+            BOOST_REQUIRE_EQUAL(bop.shard_of(prev), shard - 1);
+        }
+    }
+    smp::count = saved_count;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures commitlog throughput and the latency from adding an entry to it
+// being acknowledged, with every shard writing to its own commitlog like the
+// database does.
+//
+// The segments are written to a temporary directory created in the current
+// one, or in --directory, so run it on the disk to be measured.
+
+#include <core/app-template.hh>
+#include <core/distributed.hh>
+#include <core/thread.hh>
+#include <random>
+#include <boost/range/irange.hpp>
+
+#include "db/commitlog/commitlog.hh"
+#include "utils/UUID_gen.hh"
+#include "utils/hdr_histogram.hh"
+#include "tests/tmpdir.hh"
+#include "log.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using clk = std::chrono::steady_clock;
+
+struct bench_config {
+    db::commitlog::config log;
+    size_t entry_size;
+    unsigned concurrency;
+    std::chrono::seconds duration;
+    bool compressible;
+};
+
+struct bench_results {
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    utils::hdr_histogram latency;
+
+    bench_results& operator+=(const bench_results& o) {
+        entries += o.entries;
+        bytes += o.bytes;
+        errors += o.errors;
+        latency += o.latency;
+        return *this;
+    }
+};
+
+class commitlog_bench {
+    bench_config _cfg;
+    std::experimental::optional<db::commitlog> _log;
+    std::experimental::optional<db::commitlog::flush_handler_anchor> _flush_handler;
+    utils::UUID _cf_id = utils::UUID_gen::get_time_UUID();
+    sstring _payload;
+    bench_results _results;
+private:
+    future<> run_worker(clk::time_point end) {
+        return do_until([end] { return clk::now() >= end; }, [this] {
+            auto start = clk::now();
+            return _log->add_mutation(_cf_id, _payload.size(), [this] (db::commitlog::output& out) {
+                out.write(_payload.begin(), _payload.end());
+            }).then_wrapped([this, start] (future<db::replay_position> f) {
+                try {
+                    f.get();
+                    ++_results.entries;
+                    _results.bytes += _payload.size();
+                    _results.latency.add(clk::now() - start);
+                } catch (...) {
+                    ++_results.errors;
+                }
+            });
+        });
+    }
+public:
+    commitlog_bench(bench_config cfg)
+        : _cfg(std::move(cfg))
+        , _payload(sstring::initialized_later(), _cfg.entry_size)
+    {
+        std::default_random_engine rnd(engine().cpu_id());
+        std::uniform_int_distribution<int> dist('a', 'z');
+        // Compressible entries repeat a short random pattern, like the
+        // similar cells of a batch of mutations do.
+        size_t period = _cfg.compressible ? 16 : _payload.size();
+        for (size_t i = 0; i < _payload.size(); ++i) {
+            _payload[i] = i < period ? char(dist(rnd)) : _payload[i - period];
+        }
+    }
+
+    future<> start() {
+        return db::commitlog::create_commitlog(_cfg.log).then([this] (db::commitlog log) {
+            _log.emplace(std::move(log));
+            // Nothing is ever flushed, so drop the segments as soon as the
+            // commitlog is over its space limit instead of being blocked.
+            _flush_handler.emplace(_log->add_flush_handler([this] (db::cf_id_type id, db::replay_position pos) {
+                _log->discard_completed_segments(id, pos);
+            }));
+        });
+    }
+
+    future<> run() {
+        _results = bench_results();
+        auto end = clk::now() + _cfg.duration;
+        return parallel_for_each(boost::irange(0u, _cfg.concurrency), [this, end] (unsigned) {
+            return run_worker(end);
+        });
+    }
+
+    bench_results results() const {
+        return _results;
+    }
+
+    future<> stop() {
+        if (!_log) {
+            return make_ready_future<>();
+        }
+        _flush_handler = std::experimental::nullopt;
+        return _log->shutdown().then([this] {
+            return _log->clear();
+        });
+    }
+};
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("directory", bpo::value<std::string>(), "directory to write the segments to, instead of a temporary one")
+        ("entry-size", bpo::value<size_t>()->default_value(1024), "size of each entry, in bytes")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "entries in flight per shard")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds to measure")
+        ("mode", bpo::value<std::string>()->default_value("periodic"), "sync mode: periodic or batch")
+        ("sync-period", bpo::value<unsigned>()->default_value(10000), "sync period of the periodic mode, in milliseconds")
+        ("group-commit-window", bpo::value<unsigned>()->default_value(0), "group commit window of the batch mode, in microseconds")
+        ("segment-size", bpo::value<unsigned>()->default_value(32), "segment size, in MB")
+        ("total-space", bpo::value<unsigned>()->default_value(1024), "space the commitlog of each shard may take, in MB")
+        ("compression", "compress the segments")
+        ("compressible", "make entries compressible, instead of random")
+        ("debug", "enable debug logging");
+
+    return app.run(argc, argv, [&app] {
+        auto& config = app.configuration();
+        if (config.count("debug")) {
+            logging::logger_registry().set_all_loggers_level(logging::log_level::debug);
+        }
+
+        return seastar::async([&config] {
+            auto mode = config["mode"].as<std::string>();
+            if (mode != "periodic" && mode != "batch") {
+                std::cerr << "Unknown sync mode " << mode << "\n";
+                return 1;
+            }
+
+            std::experimental::optional<tmpdir> tmp;
+            bench_config cfg;
+            if (config.count("directory")) {
+                cfg.log.commit_log_location = config["directory"].as<std::string>();
+            } else {
+                tmp.emplace();
+                cfg.log.commit_log_location = tmp->path;
+            }
+            cfg.log.mode = mode == "batch" ? db::commitlog::sync_mode::BATCH : db::commitlog::sync_mode::PERIODIC;
+            cfg.log.commitlog_sync_period_in_ms = config["sync-period"].as<unsigned>();
+            cfg.log.group_commit_window_in_us = config["group-commit-window"].as<unsigned>();
+            cfg.log.commitlog_segment_size_in_mb = config["segment-size"].as<unsigned>();
+            cfg.log.commitlog_total_space_in_mb = config["total-space"].as<unsigned>();
+            cfg.log.compression = config.count("compression");
+            cfg.entry_size = config["entry-size"].as<size_t>();
+            cfg.concurrency = config["concurrency"].as<unsigned>();
+            cfg.duration = std::chrono::seconds(config["duration"].as<unsigned>());
+            cfg.compressible = config.count("compressible");
+
+            distributed<commitlog_bench> bench;
+            bench.start(cfg).get();
+            try {
+                bench.invoke_on_all(&commitlog_bench::start).get();
+                auto start = clk::now();
+                bench.invoke_on_all(&commitlog_bench::run).get();
+                auto elapsed = std::chrono::duration<double>(clk::now() - start).count();
+                auto r = bench.map_reduce0(std::mem_fn(&commitlog_bench::results), bench_results(), [] (bench_results a, const bench_results& b) {
+                    return a += b;
+                }).get0();
+                auto& l = r.latency;
+                std::cout << sprint("%s mode, %d byte entries, %d x %d in flight%s: %.2f MB/s, %.0f entries/s, %d errors\n",
+                        mode, cfg.entry_size, smp::count, cfg.concurrency, cfg.log.compression ? ", compressed" : "",
+                        r.bytes / elapsed / (1 << 20), r.entries / elapsed, r.errors);
+                std::cout << sprint("add to ack latency [us]: p50 %d, p90 %d, p99 %d, p999 %d, max %d\n",
+                        l.percentile(50), l.percentile(90), l.percentile(99), l.percentile(99.9), l.max());
+            } catch (...) {
+                bench.stop().get();
+                throw;
+            }
+            bench.stop().get();
+            return 0;
+        });
+    });
+}
@@ -20,10 +20,15 @@
  */
 
 #include "utils/murmur_hash.hh"
+#include "utils/crc.hh"
 #include "tests/perf/perf.hh"
 
 #include "disk-error-handler.hh"
 
+#include <cstring>
+#include <numeric>
+#include <vector>
+
 thread_local disk_error_signal_type commit_error;
 thread_local disk_error_signal_type general_disk_error;
 
@@ -53,5 +58,28 @@ int main(int argc, char* argv[]) {
         sink += dst[1];
     });
 
+    for (size_t size : {64, 1024, 16384}) {
+        std::vector<uint8_t> buf(size);
+        std::iota(buf.begin(), buf.end(), 0);
+
+        std::cout << sprint("Timing crc32 of %d bytes, one stream...\n", size);
+        time_it([&] {
+            crc32 c;
+            for (size_t i = 0; i + 8 <= buf.size(); i += 8) {
+                uint64_t v;
+                std::memcpy(&v, buf.data() + i, sizeof(v));
+                c.process(v);
+            }
+            sink += c.get();
+        }, 5, 100);
+
+        std::cout << sprint("Timing crc32 of %d bytes...\n", size);
+        time_it([&] {
+            crc32 c;
+            c.process(buf.data(), buf.size());
+            sink += c.get();
+        }, 5, 100);
+    }
+
     black_hole = sink;
 }
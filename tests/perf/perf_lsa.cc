@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures allocation, free, compaction and reclamation performance of LSA
+// under several object size mixes and fragmentation patterns.
+//
+// For each workload, the region is filled with objects up to --memory, a
+// part of them is freed according to the workload's pattern, the region is
+// compacted and then filled and fragmented again, after which memory is
+// reclaimed from it, step by step, like the seastar allocator would.
+
+#include <core/app-template.hh>
+#include <core/thread.hh>
+#include <deque>
+#include <random>
+
+#include "utils/logalloc.hh"
+#include "utils/managed_bytes.hh"
+#include "utils/hdr_histogram.hh"
+#include "log.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using clk = std::chrono::steady_clock;
+
+struct workload {
+    sstring name;
+    std::function<size_t(std::default_random_engine&)> object_size;
+    // Decides whether the i-th live object, in allocation order, is freed
+    // by the churn, out of n.
+    std::function<bool(std::default_random_engine&, size_t i, size_t n)> free;
+};
+
+static std::function<size_t(std::default_random_engine&)> fixed_size(size_t size) {
+    return [size] (std::default_random_engine&) { return size; };
+}
+
+// Sizes spread evenly across orders of magnitude, like cells, rows and
+// partition entries of a memtable are.
+static std::function<size_t(std::default_random_engine&)> log_uniform_size(size_t min, size_t max) {
+    return [dist = std::uniform_real_distribution<double>(std::log(min), std::log(max))] (std::default_random_engine& rnd) mutable {
+        return size_t(std::exp(dist(rnd)));
+    };
+}
+
+static std::function<bool(std::default_random_engine&, size_t, size_t)> free_random(double fraction) {
+    return [dist = std::bernoulli_distribution(fraction)] (std::default_random_engine& rnd, size_t, size_t) mutable {
+        return dist(rnd);
+    };
+}
+
+// Frees the oldest objects, like flushing a memtable or evicting cache in
+// LRU order does, which leaves whole segments empty.
+static std::function<bool(std::default_random_engine&, size_t, size_t)> free_oldest(double fraction) {
+    return [fraction] (std::default_random_engine&, size_t i, size_t n) {
+        return i < n * fraction;
+    };
+}
+
+static double seconds(clk::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+static sstring format_occupancy(const logalloc::occupancy_stats& o) {
+    return sprint("%.2f%% of %d MB", o.total_space() ? double(o.used_space()) * 100 / o.total_space() : 0.0, o.total_space() >> 20);
+}
+
+static void run(const workload& w, size_t memory, unsigned reclaims) {
+    std::default_random_engine rnd(42);
+    logalloc::region r;
+    std::deque<managed_bytes> objects;
+    size_t allocated = 0;
+
+    std::cout << w.name << ":\n";
+
+    with_allocator(r.allocator(), [&] {
+        auto fill = [&] {
+            size_t count = 0;
+            size_t bytes = 0;
+            auto start = clk::now();
+            while (allocated < memory) {
+                auto size = w.object_size(rnd);
+                objects.emplace_back(managed_bytes::initialized_later(), size);
+                allocated += size;
+                bytes += size;
+                ++count;
+            }
+            auto t = seconds(clk::now() - start);
+            std::cout << sprint("  alloc:   %d objects, %.0f allocs/s, %.2f MB/s\n", count, count / t, bytes / t / (1 << 20));
+        };
+
+        auto churn = [&] {
+            std::deque<managed_bytes> kept;
+            size_t count = 0;
+            auto n = objects.size();
+            auto start = clk::now();
+            for (size_t i = 0; i < n; ++i) {
+                if (w.free(rnd, i, n)) {
+                    allocated -= objects.front().size();
+                    objects.pop_front();
+                    ++count;
+                } else {
+                    kept.emplace_back(std::move(objects.front()));
+                    objects.pop_front();
+                }
+            }
+            auto t = seconds(clk::now() - start);
+            objects = std::move(kept);
+            std::cout << sprint("  free:    %d objects, %.0f frees/s, occupancy %s\n", count, count / t, format_occupancy(r.occupancy()));
+        };
+
+        fill();
+        churn();
+
+        // Full compaction moves every live object, so this is the copy
+        // bandwidth of compaction, not how fast it frees segments.
+        auto live = r.occupancy().used_space();
+        auto start = clk::now();
+        r.full_compaction();
+        auto t = seconds(clk::now() - start);
+        std::cout << sprint("  compact: %.2f ms, %.2f MB/s, occupancy %s\n", t * 1e3, live / t / (1 << 20), format_occupancy(r.occupancy()));
+
+        fill();
+        churn();
+
+        // Evicts in allocation order, which is not the order of the
+        // segments after the churn, so reclamation has to compact too.
+        r.make_evictable([&] {
+            return with_allocator(r.allocator(), [&] {
+                if (objects.empty()) {
+                    return memory::reclaiming_result::reclaimed_nothing;
+                }
+                allocated -= objects.front().size();
+                objects.pop_front();
+                return memory::reclaiming_result::reclaimed_something;
+            });
+        });
+
+        utils::hdr_histogram latency;
+        auto step = logalloc::shard_tracker().reclamation_step() * logalloc::segment_size;
+        size_t reclaimed = 0;
+        for (unsigned i = 0; i < reclaims && !objects.empty(); ++i) {
+            auto start = clk::now();
+            auto n = logalloc::shard_tracker().reclaim(step);
+            latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clk::now() - start).count());
+            if (!n) {
+                break;
+            }
+            reclaimed += n;
+        }
+        std::cout << sprint("  reclaim: %d MB in %d steps of %d kB, latency [us] p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+                reclaimed >> 20, latency.count(), step >> 10, latency.percentile(50) / 1e3, latency.percentile(90) / 1e3,
+                latency.percentile(99) / 1e3, latency.max() / 1e3);
+
+        objects.clear();
+    });
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("memory", bpo::value<unsigned>()->default_value(256), "amount of object data to allocate in each workload, in MB")
+        ("reclaims", bpo::value<unsigned>()->default_value(1000), "maximum number of reclamation steps to time")
+        ("debug", "enable debug logging");
+
+    return app.run(argc, argv, [&app] {
+        auto memory = size_t(app.configuration()["memory"].as<unsigned>()) << 20;
+        auto reclaims = app.configuration()["reclaims"].as<unsigned>();
+
+        if (app.configuration().count("debug")) {
+            logging::logger_registry().set_all_loggers_level(logging::log_level::debug);
+        }
+
+        return seastar::async([memory, reclaims] {
+            std::vector<workload> workloads = {
+                { "small objects, random free", fixed_size(64), free_random(0.5) },
+                { "mixed sizes, random free", log_uniform_size(16, 4096), free_random(0.5) },
+                { "mixed sizes, oldest freed", log_uniform_size(16, 4096), free_oldest(0.5) },
+                { "large objects, sparse", log_uniform_size(4096, 64 * 1024), free_random(0.9) },
+            };
+            for (auto&& w : workloads) {
+                run(w, memory, reclaims);
+            }
+            return 0;
+        });
+    });
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures throughput and latency of messaging_service RPCs.
+//
+// By default the benchmark sends to itself, over loopback. To measure
+// between two nodes, start it with --serve-only on one of them and with
+// --server pointing at that one on the other.
+//
+// Every shard runs --concurrency requests in parallel, spread over
+// --connections connections to the server. MUTATION requests complete when
+// the matching MUTATION_DONE arrives, like writes of storage_proxy do.
+
+#include <core/app-template.hh>
+#include <core/distributed.hh>
+#include <core/reactor.hh>
+#include <core/sleep.hh>
+#include <boost/range/irange.hpp>
+
+#include "message/messaging_service.hh"
+#include "frozen_mutation.hh"
+#include "query-request.hh"
+#include "query-result.hh"
+#include "schema_builder.hh"
+#include "utils/fb_utilities.hh"
+#include "utils/hdr_histogram.hh"
+#include "utils/UUID_gen.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using namespace std::chrono_literals;
+using clk = std::chrono::steady_clock;
+
+enum class verb {
+    mutation,
+    read_data,
+    stream_mutation,
+};
+
+static sstring verb_name(verb v) {
+    switch (v) {
+    case verb::mutation: return "MUTATION";
+    case verb::read_data: return "READ_DATA";
+    case verb::stream_mutation: return "STREAM_MUTATION";
+    }
+    abort();
+}
+
+struct bench_config {
+    gms::inet_address server;
+    unsigned concurrency;
+    unsigned connections;
+    std::chrono::seconds duration;
+    // Size of the value in mutations, and of the data in read replies.
+    size_t size;
+};
+
+struct bench_results {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    utils::hdr_histogram latency;
+
+    bench_results& operator+=(const bench_results& o) {
+        requests += o.requests;
+        errors += o.errors;
+        latency += o.latency;
+        return *this;
+    }
+};
+
+class rpc_bench {
+    distributed<rpc_bench>& _container;
+    net::messaging_service& _ms;
+    bench_config _cfg;
+    schema_ptr _schema;
+    frozen_mutation _mutation;
+    query::read_command _cmd;
+    utils::UUID _plan_id;
+    uint64_t _next_response_id = 0;
+    std::unordered_map<uint64_t, promise<>> _pending_writes;
+    bench_results _results;
+private:
+    static schema_ptr make_schema() {
+        return schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("v", bytes_type)
+            .build();
+    }
+
+    static frozen_mutation make_mutation(schema_ptr s, size_t size) {
+        mutation m(partition_key::from_single_value(*s, to_bytes("key")), s);
+        m.set_clustered_cell(clustering_key_prefix::make_empty(), "v", data_value(bytes(size, 'v')), api::new_timestamp());
+        return freeze(m);
+    }
+
+    future<> send(verb v, net::msg_addr id) {
+        auto timeout = net::messaging_service::clock_type::now() + 10s;
+        switch (v) {
+        case verb::mutation: {
+            auto response_id = _next_response_id++;
+            auto f = _pending_writes[response_id].get_future();
+            _ms.send_mutation(id, timeout, _mutation, {}, utils::fb_utilities::get_broadcast_address(), engine().cpu_id(), response_id).handle_exception([this, response_id] (auto ep) {
+                auto i = _pending_writes.find(response_id);
+                if (i != _pending_writes.end()) {
+                    i->second.set_exception(ep);
+                    _pending_writes.erase(i);
+                }
+            });
+            return f;
+        }
+        case verb::read_data:
+            return _ms.send_read_data(id, timeout, _cmd, query::full_partition_range, query::digest_algorithm::none).then([] (query::result, rpc::optional<replica_load>) { });
+        case verb::stream_mutation:
+            return _ms.send_stream_mutation(id, _plan_id, _mutation, id.cpu_id, false);
+        }
+        abort();
+    }
+
+    future<> run_worker(verb v, unsigned worker, clk::time_point end) {
+        auto id = net::msg_addr{_cfg.server, worker % _cfg.connections};
+        return do_until([end] { return clk::now() >= end; }, [this, v, id] {
+            auto start = clk::now();
+            return send(v, id).then_wrapped([this, start] (future<> f) {
+                try {
+                    f.get();
+                    ++_results.requests;
+                    _results.latency.add(clk::now() - start);
+                } catch (...) {
+                    ++_results.errors;
+                }
+            });
+        });
+    }
+public:
+    rpc_bench(distributed<rpc_bench>& container, bench_config cfg)
+        : _container(container)
+        , _ms(net::get_local_messaging_service())
+        , _cfg(cfg)
+        , _schema(make_schema())
+        , _mutation(make_mutation(_schema, cfg.size))
+        , _cmd(_schema->id(), _schema->version(), query::full_slice)
+        , _plan_id(utils::UUID_gen::get_time_UUID())
+    { }
+
+    void register_handlers() {
+        auto size = _cfg.size;
+        _ms.register_mutation([] (const rpc::client_info&, frozen_mutation, std::vector<gms::inet_address>, gms::inet_address reply_to, unsigned shard,
+                net::messaging_service::response_id_type response_id, rpc::optional<std::experimental::optional<tracing::trace_info>>, net::messaging_service::deadline_type) {
+            auto& ms = net::get_local_messaging_service();
+            ms.send_mutation_done(net::msg_addr{reply_to, shard}, shard, response_id, replica_load()).handle_exception([] (auto ep) { });
+            return net::messaging_service::no_wait();
+        });
+        _ms.register_mutation_done([this] (const rpc::client_info&, unsigned shard, net::messaging_service::response_id_type response_id, rpc::optional<replica_load>) {
+            return _container.invoke_on(shard, [response_id] (rpc_bench& b) {
+                b.complete_write(response_id);
+                return net::messaging_service::no_wait();
+            });
+        });
+        _ms.register_read_data([size] (const rpc::client_info&, query::read_command, query::partition_range, rpc::optional<query::digest_algorithm>, net::messaging_service::deadline_type) {
+            bytes_ostream data;
+            data.write(bytes(size, 'v'));
+            return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>, replica_load>(make_foreign(make_lw_shared<query::result>(std::move(data))), replica_load());
+        });
+        _ms.register_stream_mutation([] (const rpc::client_info&, utils::UUID, frozen_mutation, unsigned, rpc::optional<bool>) {
+            return make_ready_future<>();
+        });
+    }
+
+    void complete_write(uint64_t response_id) {
+        auto i = _pending_writes.find(response_id);
+        if (i != _pending_writes.end()) {
+            i->second.set_value();
+            _pending_writes.erase(i);
+        }
+    }
+
+    future<> run(verb v) {
+        _results = bench_results();
+        auto end = clk::now() + _cfg.duration;
+        return parallel_for_each(boost::irange(0u, _cfg.concurrency), [this, v, end] (unsigned worker) {
+            return run_worker(v, worker, end);
+        });
+    }
+
+    bench_results results() const {
+        return _results;
+    }
+
+    future<> stop() {
+        return make_ready_future<>();
+    }
+};
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("server", bpo::value<std::string>(), "address of a node running with --serve-only, instead of this one")
+        ("listen-address", bpo::value<std::string>()->default_value("127.0.0.1"), "address to listen on")
+        ("serve-only", "only serve requests of another node")
+        ("verb", bpo::value<std::string>()->default_value("all"), "verb to measure: mutation, read_data, stream_mutation or all")
+        ("size", bpo::value<size_t>()->default_value(1024), "size of the mutation value, and of the data in read replies, in bytes")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "requests in flight per shard")
+        ("connections", bpo::value<unsigned>()->default_value(1), "connections to the server per shard")
+        ("duration", bpo::value<unsigned>()->default_value(10), "duration of each measurement, in seconds")
+        ("compress", "compress internode traffic");
+
+    return app.run(ac, av, [&app] {
+        auto& config = app.configuration();
+        auto listen = gms::inet_address(config["listen-address"].as<std::string>());
+        bench_config cfg;
+        cfg.server = config.count("server") ? gms::inet_address(config["server"].as<std::string>()) : listen;
+        cfg.concurrency = config["concurrency"].as<unsigned>();
+        cfg.connections = std::max(1u, config["connections"].as<unsigned>());
+        cfg.duration = std::chrono::seconds(config["duration"].as<unsigned>());
+        cfg.size = config["size"].as<size_t>();
+        auto serve_only = config.count("serve-only");
+        auto compress = config.count("compress") ? net::messaging_service::compress_what::all : net::messaging_service::compress_what::none;
+
+        std::vector<verb> verbs;
+        auto v = config["verb"].as<std::string>();
+        if (v == "mutation" || v == "all") {
+            verbs.push_back(verb::mutation);
+        }
+        if (v == "read_data" || v == "all") {
+            verbs.push_back(verb::read_data);
+        }
+        if (v == "stream_mutation" || v == "all") {
+            verbs.push_back(verb::stream_mutation);
+        }
+        if (verbs.empty()) {
+            std::cerr << "Unknown verb " << v << "\n";
+            return make_ready_future<int>(1);
+        }
+
+        utils::fb_utilities::set_broadcast_address(listen);
+        return net::get_messaging_service().start(listen, 7000, net::messaging_service::encrypt_what::none, compress,
+                net::messaging_service::tcp_nodelay_what::all, 0, nullptr).then([cfg, serve_only, verbs] {
+            auto bench = make_lw_shared<distributed<rpc_bench>>();
+            return bench->start(std::ref(*bench), cfg).then([bench] {
+                return bench->invoke_on_all(&rpc_bench::register_handlers);
+            }).then([bench, cfg, serve_only, verbs] {
+                if (serve_only) {
+                    std::cout << "Serving on port " << net::get_local_messaging_service().port() << "\n";
+                    return repeat([] {
+                        return sleep(1h).then([] { return stop_iteration::no; });
+                    });
+                }
+                return do_for_each(verbs, [bench, cfg] (verb v) {
+                    return bench->invoke_on_all([v] (rpc_bench& b) {
+                        return b.run(v);
+                    }).then([bench] {
+                        return bench->map_reduce0(std::mem_fn(&rpc_bench::results), bench_results(), [] (bench_results a, const bench_results& b) {
+                            return a += b;
+                        });
+                    }).then([v, cfg] (bench_results r) {
+                        auto& l = r.latency;
+                        std::cout << sprint("%s (%d bytes, %d x %d in flight, %d connections): %.0f req/s, %d errors, latency [us] p50 %d, p90 %d, p99 %d, p999 %d, max %d\n",
+                                verb_name(v), cfg.size, smp::count, cfg.concurrency, cfg.connections, double(r.requests) / cfg.duration.count(), r.errors,
+                                l.percentile(50), l.percentile(90), l.percentile(99), l.percentile(99.9), l.max());
+                    });
+                });
+            }).then([bench] {
+                return bench->stop().finally([bench] { });
+            });
+        }).then([] {
+            return net::get_messaging_service().stop();
+        }).then([] {
+            return 0;
+        });
+    });
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "range_tombstone_list.hh"
+#include "schema_builder.hh"
+#include "tests/perf/perf.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+static schema_ptr s = schema_builder("ks", "cf")
+        .with_column("pk", int32_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", int32_type, column_kind::regular_column)
+        .build();
+
+static clustering_key_prefix key(int32_t k) {
+    return clustering_key_prefix::from_single_value(*s, int32_type->decompose(k));
+}
+
+static range_tombstone rt(int32_t start, int32_t end, api::timestamp_type timestamp) {
+    return range_tombstone(key(start), key(end), tombstone(timestamp, gc_clock::now()));
+}
+
+template <typename Func>
+static double time_once(Func func) {
+    using clk = std::chrono::steady_clock;
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+volatile uint64_t black_hole;
+
+int main(int argc, char* argv[]) {
+    uint64_t sink = 0;
+
+    for (int32_t n : { 1000, 10000, 100000 }) {
+        range_tombstone_list l(*s);
+
+        // Each tombstone overlaps the 100 applied before it, with
+        // alternating timestamps so that some of them win and some lose.
+        auto apply_time = time_once([&] {
+            for (int32_t i = 0; i < n; ++i) {
+                l.apply(*s, rt(i, i + 100, (i % 2) ? i : n - i));
+            }
+        });
+
+        auto query_time = time_once([&] {
+            for (int32_t i = 0; i < n; ++i) {
+                sink += l.search_tombstone_covering(*s, key(i)).timestamp;
+            }
+        });
+
+        std::cout << sprint("%d tombstones: %d in the list, apply: %.2f us/op, query: %.2f us/op\n",
+                n, l.size(), apply_time * 1e6 / n, query_time * 1e6 / n);
+    }
+
+    black_hole = sink;
+}
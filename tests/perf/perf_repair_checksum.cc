@@ -0,0 +1,85 @@
+
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "database.hh"
+#include "repair/repair.hh"
+#include "perf.hh"
+#include <seastar/core/app-template.hh>
+#include <seastar/core/thread.hh>
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+// Measures how fast repair hashes partitions with each of the checksum
+// variants, in MB/s of cell values.
+static void time_checksum(const mutation& m, size_t data_size, repair_checksum type, const char* name) {
+    using clk = std::chrono::steady_clock;
+
+    std::cout << "Timing " << name << " checksum...\n";
+    for (int i = 0; i < 5; i++) {
+        auto start = clk::now();
+        auto end_at = start + std::chrono::seconds(1);
+        uint64_t hashed = 0;
+
+        while (clk::now() < end_at) {
+            partition_checksum::compute(streamed_mutation_from_mutation(mutation(m)), type).get();
+            hashed += data_size;
+        }
+
+        auto duration = std::chrono::duration<double>(clk::now() - start).count();
+        std::cout << sprint("%.2f", hashed / duration / (1024 * 1024)) << " MB/s\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("rows", bpo::value<unsigned>()->default_value(1000), "number of rows in the partition")
+        ("value-size", bpo::value<unsigned>()->default_value(100), "size of the cell values, in bytes");
+
+    return app.run_deprecated(argc, argv, [&app] {
+        return seastar::async([&app] {
+            auto rows = app.configuration()["rows"].as<unsigned>();
+            auto value_size = app.configuration()["value-size"].as<unsigned>();
+
+            auto s = make_lw_shared(schema({}, "ks", "cf",
+                {{"p1", utf8_type}}, {{"c1", int32_type}}, {{"r1", bytes_type}}, {}, utf8_type));
+            const column_definition& col = *s->get_column_definition("r1");
+
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            for (unsigned i = 0; i < rows; i++) {
+                auto c_key = clustering_key::from_exploded(*s, {int32_type->decompose(int32_t(i))});
+                m.set_clustered_cell(c_key, col, atomic_cell::make_live(i, bytes(value_size, int8_t(i))));
+            }
+            size_t data_size = size_t(rows) * value_size;
+
+            time_checksum(m, data_size, repair_checksum::legacy, "legacy");
+            time_checksum(m, data_size, repair_checksum::streamed, "streamed (SHA-256)");
+            time_checksum(m, data_size, repair_checksum::murmur3, "murmur3");
+        }).then([] {
+            engine().exit(0);
+        });
+    });
+}
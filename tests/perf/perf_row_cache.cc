@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks row_cache under a mix of zipfian point reads, memtable updates
+// and occasional full scans.
+//
+// The underlying data source generates partitions on the fly, so that all
+// memory LSA can get goes to the cache. It ignores the updates, which only
+// matter for the work they cause in the cache. The size of the data set
+// relative to the memory given to the benchmark (-m) decides the hit rate
+// which the cache can achieve.
+
+#include <core/app-template.hh>
+#include <core/thread.hh>
+#include <numeric>
+#include <random>
+
+#include "row_cache.hh"
+#include "memtable.hh"
+#include "schema_builder.hh"
+#include "utils/hdr_histogram.hh"
+#include "log.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using clk = std::chrono::steady_clock;
+
+// Draws ranks in [0, n) with probability proportional to 1 / (rank + 1)^exponent.
+class zipf_distribution {
+    std::vector<double> _cdf;
+    std::uniform_real_distribution<double> _dist{0, 1};
+public:
+    zipf_distribution(size_t n, double exponent) : _cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1 / std::pow(i + 1, exponent);
+            _cdf[i] = sum;
+        }
+        for (auto&& c : _cdf) {
+            c /= sum;
+        }
+    }
+
+    template<typename Engine>
+    size_t operator()(Engine& rnd) {
+        auto i = std::lower_bound(_cdf.begin(), _cdf.end(), _dist(rnd)) - _cdf.begin();
+        return std::min<size_t>(i, _cdf.size() - 1);
+    }
+};
+
+class dataset {
+    schema_ptr _s;
+    // Sorted in ring order.
+    std::vector<dht::decorated_key> _keys;
+    size_t _rows;
+    size_t _cell_size;
+    clk::duration _time{};
+public:
+    dataset(schema_ptr s, size_t partitions, size_t rows, size_t cell_size)
+        : _s(std::move(s))
+        , _rows(rows)
+        , _cell_size(cell_size)
+    {
+        _keys.reserve(partitions);
+        for (size_t i = 0; i < partitions; ++i) {
+            _keys.push_back(dht::global_partitioner().decorate_key(*_s,
+                partition_key::from_single_value(*_s, to_bytes(sprint("key%d", i)))));
+        }
+        std::sort(_keys.begin(), _keys.end(), dht::decorated_key::less_comparator(_s));
+    }
+
+    size_t size() const { return _keys.size(); }
+    const dht::decorated_key& key(size_t i) const { return _keys[i]; }
+
+    // Time spent generating partitions, which the cache would spend on
+    // reading sstables otherwise.
+    clk::duration time() const { return _time; }
+
+    mutation make_partition(size_t i) {
+        auto start = clk::now();
+        std::minstd_rand rnd(i);
+        mutation m(_keys[i], _s);
+        for (size_t j = 0; j < _rows; ++j) {
+            bytes value(bytes::initialized_later(), _cell_size);
+            std::generate(value.begin(), value.end(), [&rnd] { return int8_t(rnd()); });
+            auto ck = clustering_key::from_single_value(*_s, int32_type->decompose(int32_t(j)));
+            m.set_clustered_cell(ck, "v", data_value(std::move(value)), 1);
+        }
+        _time += clk::now() - start;
+        return m;
+    }
+
+    // Returns the indexes [first, last) of the keys within the range.
+    std::pair<size_t, size_t> find(const query::partition_range& range) const {
+        dht::ring_position_comparator cmp(*_s);
+        auto first = std::partition_point(_keys.begin(), _keys.end(), [&] (const dht::decorated_key& k) {
+            return range.before(dht::ring_position(k), cmp);
+        });
+        auto last = std::partition_point(first, _keys.end(), [&] (const dht::decorated_key& k) {
+            return !range.after(dht::ring_position(k), cmp);
+        });
+        return { size_t(first - _keys.begin()), size_t(last - _keys.begin()) };
+    }
+};
+
+class dataset_reader final : public mutation_reader::impl {
+    dataset& _data;
+    size_t _next;
+    size_t _end;
+public:
+    dataset_reader(dataset& data, const query::partition_range& range)
+        : _data(data)
+    {
+        std::tie(_next, _end) = _data.find(range);
+    }
+
+    virtual future<streamed_mutation_opt> operator()() override {
+        if (_next == _end) {
+            return make_ready_future<streamed_mutation_opt>();
+        }
+        return make_ready_future<streamed_mutation_opt>(streamed_mutation_from_mutation(_data.make_partition(_next++)));
+    }
+};
+
+static void consume(mutation_reader& reader) {
+    while (auto m = mutation_from_streamed_mutation(reader().get0()).get0()) { }
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("partitions", bpo::value<unsigned>()->default_value(100000), "number of partitions in the data set")
+        ("rows", bpo::value<unsigned>()->default_value(10), "rows per partition")
+        ("cell-size", bpo::value<unsigned>()->default_value(100), "size of the value of each row, in bytes")
+        ("zipf", bpo::value<double>()->default_value(1.0), "exponent of the zipfian distribution of reads and updates, 0 for uniform")
+        ("update-every", bpo::value<unsigned>()->default_value(1000), "point reads between memtable updates, 0 to disable them")
+        ("update-partitions", bpo::value<unsigned>()->default_value(100), "partitions in each memtable update")
+        ("scan-every", bpo::value<unsigned>()->default_value(0), "point reads between full scans, 0 to disable them")
+        ("warmup", bpo::value<unsigned>()->default_value(5), "seconds of reads before measuring")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds to measure")
+        ("debug", "enable debug logging");
+
+    return app.run(argc, argv, [&app] {
+        auto& config = app.configuration();
+        if (config.count("debug")) {
+            logging::logger_registry().set_all_loggers_level(logging::log_level::debug);
+        }
+
+        return seastar::async([&config] {
+            auto partitions = config["partitions"].as<unsigned>();
+            auto update_every = config["update-every"].as<unsigned>();
+            auto update_partitions = config["update-partitions"].as<unsigned>();
+            auto scan_every = config["scan-every"].as<unsigned>();
+            auto warmup = std::chrono::seconds(config["warmup"].as<unsigned>());
+            auto duration = std::chrono::seconds(config["duration"].as<unsigned>());
+
+            auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("ck", int32_type, column_kind::clustering_key)
+                .with_column("v", bytes_type)
+                .build();
+
+            dataset data(s, partitions, config["rows"].as<unsigned>(), config["cell-size"].as<unsigned>());
+            cache_tracker tracker;
+            row_cache cache(s, mutation_source([&data] (schema_ptr, const query::partition_range& range) {
+                return make_mutation_reader<dataset_reader>(data, range);
+            }), key_source([] (auto&&) { return key_reader(); }), tracker);
+
+            // Hot keys are spread over the ring instead of being neighbours.
+            std::default_random_engine rnd(42);
+            std::vector<size_t> rank_to_key(partitions);
+            std::iota(rank_to_key.begin(), rank_to_key.end(), 0);
+            std::shuffle(rank_to_key.begin(), rank_to_key.end(), rnd);
+            zipf_distribution zipf(partitions, config["zipf"].as<double>());
+
+            utils::hdr_histogram read_latency;
+            uint64_t reads = 0;
+            uint64_t updates = 0;
+            uint64_t scans = 0;
+            clk::duration read_time{};
+            clk::duration read_underlying_time{};
+            clk::duration update_time{};
+            clk::duration scan_time{};
+
+            auto read = [&] {
+                auto& key = data.key(rank_to_key[zipf(rnd)]);
+                auto range = query::partition_range::make_singular(key);
+                auto underlying = data.time();
+                auto start = clk::now();
+                auto reader = cache.make_reader(s, range);
+                consume(reader);
+                auto t = clk::now() - start;
+                read_latency.add(t);
+                read_time += t;
+                read_underlying_time += data.time() - underlying;
+                ++reads;
+            };
+
+            auto update = [&] {
+                auto mt = make_lw_shared<memtable>(s);
+                for (unsigned i = 0; i < update_partitions; ++i) {
+                    mutation m(data.key(rank_to_key[zipf(rnd)]), s);
+                    auto ck = clustering_key::from_single_value(*s, int32_type->decompose(int32_t(0)));
+                    m.set_clustered_cell(ck, "v", data_value(bytes(bytes::initialized_later(), 8)), 2 + updates);
+                    mt->apply(m);
+                }
+                auto start = clk::now();
+                cache.update(*mt, make_default_partition_presence_checker()).get();
+                update_time += clk::now() - start;
+                ++updates;
+            };
+
+            auto scan = [&] {
+                auto start = clk::now();
+                auto reader = cache.make_reader(s);
+                consume(reader);
+                scan_time += clk::now() - start;
+                ++scans;
+            };
+
+            auto run_for = [&] (clk::duration d) {
+                auto end = clk::now() + d;
+                uint64_t n = 0;
+                while (clk::now() < end) {
+                    read();
+                    ++n;
+                    if (update_every && n % update_every == 0) {
+                        update();
+                    }
+                    if (scan_every && n % scan_every == 0) {
+                        scan();
+                    }
+                    if (n % 100 == 0) {
+                        seastar::thread::yield();
+                    }
+                }
+            };
+
+            std::cout << "Warming up for " << warmup.count() << "s...\n";
+            run_for(warmup);
+
+            read_latency = utils::hdr_histogram();
+            reads = updates = scans = 0;
+            read_time = read_underlying_time = update_time = scan_time = clk::duration();
+            auto hits = tracker.hits();
+            auto misses = tracker.misses();
+            auto evictions = tracker.evictions();
+
+            auto start = clk::now();
+            run_for(duration);
+            auto elapsed = std::chrono::duration<double>(clk::now() - start).count();
+
+            hits = tracker.hits() - hits;
+            misses = tracker.misses() - misses;
+            evictions = tracker.evictions() - evictions;
+            auto us = [] (clk::duration d) { return std::chrono::duration<double, std::micro>(d).count(); };
+
+            std::cout << sprint("reads:     %.0f/s, hit rate %.2f%%, latency [us] p50 %d, p90 %d, p99 %d, p999 %d, max %d\n",
+                    reads / elapsed, hits + misses ? double(hits) * 100 / (hits + misses) : 0.0,
+                    read_latency.percentile(50), read_latency.percentile(90), read_latency.percentile(99),
+                    read_latency.percentile(99.9), read_latency.max());
+            std::cout << sprint("cache CPU: %.2f us/read, excluding %.2f us/read populating from the underlying source\n",
+                    reads ? us(read_time - read_underlying_time) / reads : 0.0, reads ? us(read_underlying_time) / reads : 0.0);
+            std::cout << sprint("evictions: %.0f/s, %d cached partitions, %d MB of LSA memory\n",
+                    evictions / elapsed, tracker.partitions(), tracker.region().occupancy().total_space() >> 20);
+            if (updates) {
+                std::cout << sprint("updates:   %d of %d partitions, %.2f us/update\n", updates, update_partitions, us(update_time) / updates);
+            }
+            if (scans) {
+                std::cout << sprint("scans:     %d, %.2f ms/scan\n", scans, us(scan_time) / scans / 1000);
+            }
+        });
+    });
+}
@@ -52,11 +52,20 @@ future<> test_sequential_read(distributed<test_env>& dt) {
     return time_runs(iterations, parallelism, dt, &test_env::read_sequential_partitions);
 }
 
+future<> test_compaction(distributed<test_env>& dt) {
+    return dt.invoke_on_all([] (test_env &t) {
+        return t.create_compaction_inputs();
+    }).then([&dt] {
+        return time_compactions(iterations, dt, &test_env::compact_sstables);
+    });
+}
+
 enum class test_modes {
     sequential_read,
     index_read,
     write,
     index_write,
+    compaction,
 };
 
 static std::unordered_map<sstring, test_modes> test_mode = {
@@ -64,6 +73,7 @@ static std::unordered_map<sstring, test_modes> test_mode = {
     {"index_read", test_modes::index_read },
     {"write", test_modes::write },
     {"index_write", test_modes::index_write },
+    {"compaction", test_modes::compaction },
 };
 
 int main(int argc, char** argv) {
@@ -77,7 +87,13 @@ int main(int argc, char** argv) {
         ("key_size", bpo::value<unsigned>()->default_value(128), "size of partition key")
         ("num_columns", bpo::value<unsigned>()->default_value(5), "number of columns per row")
         ("column_size", bpo::value<unsigned>()->default_value(64), "size in bytes for each column")
-        ("mode", bpo::value<sstring>()->default_value("index_write"), "one of: random_read, sequential_read, index_read, write, index_write (default)")
+        ("mode", bpo::value<sstring>()->default_value("index_write"), "one of: random_read, sequential_read, index_read, write, index_write (default), compaction")
+        ("sstables", bpo::value<unsigned>()->default_value(4), "compaction: number of sstables to compact")
+        ("overlap", bpo::value<unsigned>()->default_value(50), "compaction: percentage of partitions present in all the sstables")
+        ("rows_per_partition", bpo::value<unsigned>()->default_value(0), "compaction: clustering rows per partition, 0 for no clustering key")
+        ("tombstones", bpo::value<unsigned>()->default_value(0), "compaction: percentage of cells which are tombstones")
+        ("expired", bpo::value<unsigned>()->default_value(0), "compaction: percentage of cells with an expired TTL")
+        ("compaction_strategy", bpo::value<sstring>()->default_value("stcs"), "compaction: stcs (single output sstable) or lcs (160MB output sstables)")
         ("testdir", bpo::value<sstring>()->default_value("/var/lib/scylla/perf-tests"), "directory in which to store the sstables");
 
     return app.run_deprecated(argc, argv, [&app] {
@@ -92,6 +108,18 @@ int main(int argc, char** argv) {
         sstring dir = app.configuration()["testdir"].as<sstring>();
         cfg.dir = dir;
         auto mode = test_mode[app.configuration()["mode"].as<sstring>()];
+        if (mode == test_modes::compaction) {
+            cfg.sstables = app.configuration()["sstables"].as<unsigned>();
+            cfg.overlap = app.configuration()["overlap"].as<unsigned>();
+            cfg.rows_per_partition = app.configuration()["rows_per_partition"].as<unsigned>();
+            cfg.tombstone_ratio = app.configuration()["tombstones"].as<unsigned>();
+            cfg.expired_ratio = app.configuration()["expired"].as<unsigned>();
+            cfg.compaction_strategy = app.configuration()["compaction_strategy"].as<sstring>();
+            if (!cfg.sstables || cfg.tombstone_ratio + cfg.expired_ratio > 100 || cfg.overlap > 100
+                    || (cfg.compaction_strategy != "stcs" && cfg.compaction_strategy != "lcs")) {
+                throw std::invalid_argument("Invalid compaction settings");
+            }
+        }
         if ((mode == test_modes::index_read) || (mode == test_modes::index_write)) {
             cfg.num_columns = 0;
             cfg.column_size = 0;
@@ -113,7 +141,7 @@ int main(int argc, char** argv) {
                         throw;
                     }
                 });
-            } else if ((mode == test_modes::index_write) || (mode == test_modes::write)) {
+            } else if ((mode == test_modes::index_write) || (mode == test_modes::write) || (mode == test_modes::compaction)) {
                 return test_setup::create_empty_test_dir(dir);
             } else {
                 throw std::invalid_argument("Invalid mode");
@@ -125,6 +153,8 @@ int main(int argc, char** argv) {
                 return test_sequential_read(*test).then([test] {});
             } else if ((mode == test_modes::index_write) || (mode == test_modes::write)) {
                 return test_write(*test).then([test] {});
+            } else if (mode == test_modes::compaction) {
+                return test_compaction(*test).then([test] {});
             } else {
                 throw std::invalid_argument("Invalid mode");
             }
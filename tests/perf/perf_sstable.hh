@@ -22,13 +22,41 @@
 #pragma once
 #include "../sstable_test.hh"
 #include "sstables/sstables.hh"
+#include "sstables/compaction.hh"
+#include "sstables/compaction_manager.hh"
+#include "database.hh"
 #include "mutation_reader.hh"
+#include "core/memory.hh"
+#include <time.h>
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
 #include <boost/range/irange.hpp>
 
 using namespace sstables;
 
+// Result of a single compaction, as measured on one shard.
+struct compaction_stats {
+    uint64_t bytes = 0;
+    uint64_t partitions = 0;
+    double duration = 0;
+    double cpu_time = 0;
+    uint64_t mallocs = 0;
+
+    compaction_stats& operator+=(const compaction_stats& o) {
+        bytes += o.bytes;
+        partitions += o.partitions;
+        // Shards compact in parallel, the run takes as long as the slowest one.
+        duration = std::max(duration, o.duration);
+        cpu_time += o.cpu_time;
+        mallocs += o.mallocs;
+        return *this;
+    }
+};
+
+inline compaction_stats operator+(compaction_stats a, const compaction_stats& b) {
+    return a += b;
+}
+
 class test_env {
 public:
     struct conf {
@@ -38,6 +66,18 @@ class test_env {
         unsigned column_size;
         size_t buffer_size;
         sstring dir;
+        // Compaction mode only.
+        unsigned sstables;
+        // Percentage of the partitions of each input sstable which are
+        // also present in all the other inputs.
+        unsigned overlap;
+        // Rows per partition, 0 for a schema without clustering key.
+        unsigned rows_per_partition;
+        // Percentage of the cells which are tombstones, and which have
+        // an already expired TTL, respectively.
+        unsigned tombstone_ratio;
+        unsigned expired_ratio;
+        sstring compaction_strategy;
     };
 
 private:
@@ -67,6 +107,9 @@ class test_env {
     std::uniform_int_distribution<char> _distribution;
     lw_shared_ptr<memtable> _mt;
     std::vector<lw_shared_ptr<sstable>> _sst;
+    std::vector<sstring> _shared_keys;
+    std::unique_ptr<compaction_manager> _cm;
+    unsigned long _generation = 0;
 
     schema_ptr create_schema() {
         std::vector<schema::column> columns;
@@ -79,7 +122,7 @@ class test_env {
             // partition key
             {{"name", utf8_type}},
             // clustering key
-            {},
+            _cfg.rows_per_partition ? std::vector<schema::column>{{"ck", int32_type}} : std::vector<schema::column>{},
             // regular columns
             { columns },
             // static columns
@@ -89,6 +132,10 @@ class test_env {
             // comment
             "Perf tests"
         )));
+        if (_cfg.sstables) {
+            // Let compaction purge the tombstones it merges.
+            builder.set_gc_grace_seconds(0);
+        }
         return builder.build(schema_builder::compact_storage::no);
     }
 
@@ -99,7 +146,12 @@ class test_env {
            , _mt(make_lw_shared<memtable>(s))
     {}
 
-    future<> stop() { return make_ready_future<>(); }
+    future<> stop() {
+        if (_cm) {
+            return _cm->stop();
+        }
+        return make_ready_future<>();
+    }
 
     void fill_memtable() {
         for (unsigned i = 0; i < _cfg.partitions; i++) {
@@ -117,12 +169,74 @@ class test_env {
         return _sst.back()->load();
     }
 
+    // Fills a memtable with the contents of the idx-th input of the compaction
+    // benchmark. Later inputs get higher timestamps, so overlapping partitions
+    // have to be reconciled by the merge rather than just concatenated.
+    lw_shared_ptr<memtable> make_compaction_input(unsigned idx) {
+        auto mt = make_lw_shared<memtable>(s);
+        auto ts = api::timestamp_type(idx + 1);
+        auto now = gc_clock::now();
+        std::uniform_int_distribution<unsigned> percent(0, 99);
+        auto rows = std::max(_cfg.rows_per_partition, 1u);
+        for (unsigned i = 0; i < _cfg.partitions; i++) {
+            auto k = percent(_generator) < _cfg.overlap ? _shared_keys[i] : random_key();
+            auto mut = mutation(partition_key::from_deeply_exploded(*s, { k }), s);
+            for (unsigned r = 0; r < rows; r++) {
+                auto ck = _cfg.rows_per_partition
+                        ? clustering_key::from_deeply_exploded(*s, { int32_t(r) })
+                        : clustering_key::make_empty();
+                for (auto& cdef: s->regular_columns()) {
+                    auto p = percent(_generator);
+                    if (p < _cfg.tombstone_ratio) {
+                        mut.set_clustered_cell(ck, cdef, atomic_cell::make_dead(ts, now - std::chrono::hours(1)));
+                    } else if (p < _cfg.tombstone_ratio + _cfg.expired_ratio) {
+                        mut.set_clustered_cell(ck, cdef, atomic_cell::make_live(ts, utf8_type->decompose(random_column()),
+                                now - std::chrono::hours(1), std::chrono::seconds(1)));
+                    } else {
+                        mut.set_clustered_cell(ck, cdef, atomic_cell::make_live(ts, utf8_type->decompose(random_column())));
+                    }
+                }
+            }
+            mt->apply(std::move(mut));
+        }
+        return mt;
+    }
+
+    // Writes the input sstables of the compaction benchmark. Not timed, the
+    // same inputs are compacted by every iteration.
+    future<> create_compaction_inputs() {
+        _cm = std::make_unique<compaction_manager>();
+        _shared_keys.clear();
+        for (unsigned i = 0; i < _cfg.partitions; i++) {
+            _shared_keys.push_back(random_key());
+        }
+        _generation = _cfg.sstables;
+        return test_setup::create_empty_test_dir(dir()).then([this] {
+            auto idx = boost::irange(0u, _cfg.sstables);
+            return do_for_each(idx.begin(), idx.end(), [this] (unsigned i) {
+                auto mt = make_compaction_input(i);
+                auto sst = make_lw_shared<sstable>("ks", "cf", dir(), i + 1, sstable::version_types::la, sstable::format_types::big);
+                return sst->write_components(*mt).then([sst] {
+                    return sst->load();
+                }).then([this, sst, mt] {
+                    _sst.push_back(sst);
+                });
+            });
+        });
+    }
+
     using clk = std::chrono::steady_clock;
     static auto now() {
         return clk::now();
     }
 
 
+    static double thread_cpu_time() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
     // Mappers below
     future<double> flush_memtable(int idx) {
         auto start = test_env::now();
@@ -183,6 +297,42 @@ class test_env {
             });
         });
     }
+
+    // Merges all input sstables into new ones, the way the configured
+    // strategy would: size-tiered into a single output, leveled into
+    // 160MB sstables of level 1.
+    future<compaction_stats> compact_sstables(int idx) {
+        auto cf = make_lw_shared<column_family>(s, column_family::config(), column_family::no_commitlog(), *_cm);
+        cf->mark_ready_for_writes();
+
+        auto leveled = _cfg.compaction_strategy == "lcs";
+        auto max_sstable_size = leveled ? uint64_t(160) << 20 : std::numeric_limits<uint64_t>::max();
+        auto creator = [this] {
+            return make_lw_shared<sstable>("ks", "cf", dir(), ++_generation, sstable::version_types::la, sstable::format_types::big);
+        };
+
+        compaction_stats stats;
+        for (auto& sst : _sst) {
+            stats.bytes += sst->data_size();
+        }
+        stats.partitions = uint64_t(_cfg.partitions) * _cfg.sstables;
+
+        auto start = test_env::now();
+        auto cpu_start = thread_cpu_time();
+        auto mallocs = memory::stats().mallocs();
+        return sstables::compact_sstables(_sst, *cf, creator, max_sstable_size, leveled ? 1 : 0).then(
+                [stats, start, cpu_start, mallocs] (std::vector<shared_sstable> created) mutable {
+            stats.duration = std::chrono::duration<double>(test_env::now() - start).count();
+            stats.cpu_time = thread_cpu_time() - cpu_start;
+            stats.mallocs = memory::stats().mallocs() - mallocs;
+            for (auto& sst : created) {
+                sst->mark_for_deletion();
+            }
+            return stats;
+        }).finally([cf] {
+            return cf->stop().finally([cf] {});
+        });
+    }
 };
 
 // The function func should carry on with the test, and return the number of partitions processed.
@@ -205,3 +355,30 @@ future<> time_runs(unsigned iterations, unsigned parallelism, distributed<test_e
         std::cout << sprint("%.2f", mean(*acc)) << " +- " << sprint("%.2f", error_of<tag::mean>(*acc)) << " partitions / sec (" << iterations << " runs, " << parallelism << " concurrent ops)\n";
     });
 }
+
+// Runs the compaction mapper iterations times on all shards, and reports the
+// aggregate throughput of the input data, together with the CPU time and the
+// number of allocations it took.
+template <typename Func>
+future<> time_compactions(unsigned iterations, distributed<test_env>& dt, Func func) {
+    using namespace boost::accumulators;
+    auto throughput = make_lw_shared<accumulator_set<double, features<tag::mean, tag::error_of<tag::mean>>>>();
+    auto total = make_lw_shared<compaction_stats>();
+    auto idx = boost::irange(0, int(iterations));
+    return do_for_each(idx.begin(), idx.end(), [throughput, total, &dt, func] (auto iter) {
+        return dt.map_reduce0([func, iter] (test_env& t) {
+            return (t.*func)(iter);
+        }, compaction_stats(), std::plus<compaction_stats>()).then([throughput, total] (compaction_stats result) {
+            (*throughput)(result.bytes / result.duration / (1 << 20));
+            *total += result;
+        });
+    }).then([throughput, total, iterations] {
+        auto& a = *throughput;
+        auto& t = *total;
+        std::cout << sprint("%.2f", mean(a)) << " +- " << sprint("%.2f", error_of<tag::mean>(a)) << " MB/s ("
+                  << t.bytes / iterations << " bytes, " << t.partitions / iterations << " input partitions, " << iterations << " runs)\n";
+        std::cout << sprint("%.2f", t.cpu_time * 1e9 / t.bytes) << " ns CPU / byte, "
+                  << sprint("%.2f", double(t.mallocs) * (1 << 20) / t.bytes) << " allocations / MB, "
+                  << sprint("%.2f", double(t.mallocs) / t.partitions) << " allocations / partition\n";
+    });
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "types.hh"
+#include "utils/utf8.hh"
+#include "tests/perf/perf.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+volatile uint64_t black_hole;
+
+static bytes make_json(size_t size) {
+    sstring s;
+    while (s.size() < size) {
+        s += "{\"name\": \"Zoë\", \"city\": \"Kraków\", \"id\": 12345, \"note\": \"mostly plain ASCII text\"}, ";
+    }
+    return bytes(reinterpret_cast<const int8_t*>(s.data()), s.size());
+}
+
+int main(int argc, char* argv[]) {
+    auto ascii = bytes(bytes::initialized_later(), 10240);
+    std::fill(ascii.begin(), ascii.end(), 'a');
+    auto json = make_json(10240);
+
+    uint64_t sink = 0;
+
+    std::cout << "Timing utils::ascii::validate() of 10 KB...\n";
+    time_it([&] {
+        sink += utils::ascii::validate(ascii);
+    }, 5, 100);
+
+    std::cout << "Timing utils::utf8::validate() of 10 KB of ASCII...\n";
+    time_it([&] {
+        sink += utils::utf8::validate(ascii);
+    }, 5, 100);
+
+    std::cout << "Timing utils::utf8::validate() of 10 KB of non-ASCII JSON...\n";
+    time_it([&] {
+        sink += utils::utf8::validate(json);
+    }, 5, 100);
+
+    std::cout << "Timing utf8_type->validate() of 10 KB of non-ASCII JSON...\n";
+    time_it([&] {
+        utf8_type->validate(json);
+        ++sink;
+    }, 5, 100);
+
+    black_hole = sink;
+}
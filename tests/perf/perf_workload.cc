@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Drives configurable CQL workloads through query_processor and
+// storage_proxy, on all shards, and reports throughput, latency
+// percentiles and allocations per operation. Memtables can be flushed
+// periodically during the run, which also brings compaction into play.
+
+#include <random>
+#include <boost/range/irange.hpp>
+#include "tests/cql_test_env.hh"
+#include "tests/perf/perf.hh"
+#include "core/app-template.hh"
+#include "core/thread.hh"
+#include "core/memory.hh"
+#include "core/timer.hh"
+#include "core/gate.hh"
+#include "database.hh"
+#include "utils/hdr_histogram.hh"
+#include "utils/alloc_tracker.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+enum class workload {
+    simple,      // single row partitions
+    wide,        // clustering rows of a few partitions, slices are read
+    scan,        // single row partitions, token range scans are read
+    batch,       // written in unlogged batches of rows of a partition
+    collections, // map cells
+    ttl,         // single row partitions, written with a TTL
+};
+
+static workload workload_from_string(const sstring& name) {
+    static const std::unordered_map<sstring, workload> workloads = {
+        { "simple", workload::simple },
+        { "wide", workload::wide },
+        { "scan", workload::scan },
+        { "batch", workload::batch },
+        { "collections", workload::collections },
+        { "ttl", workload::ttl },
+    };
+    auto it = workloads.find(name);
+    if (it == workloads.end()) {
+        throw std::invalid_argument(sprint("unknown workload: %s", name));
+    }
+    return it->second;
+}
+
+struct test_config {
+    workload kind;
+    sstring name;
+    unsigned partitions;
+    unsigned rows_per_partition;
+    unsigned value_size;
+    unsigned batch_size;
+    unsigned ttl;
+    unsigned scan_limit;
+    unsigned read_ratio;
+    unsigned concurrency;
+    unsigned duration_in_seconds;
+    unsigned flush_period_in_ms;
+};
+
+std::ostream& operator<<(std::ostream& os, const test_config& cfg) {
+    return os << "{workload=" << cfg.name
+           << ", partitions=" << cfg.partitions
+           << ", rows_per_partition=" << cfg.rows_per_partition
+           << ", value_size=" << cfg.value_size
+           << ", batch_size=" << cfg.batch_size
+           << ", read_ratio=" << cfg.read_ratio
+           << ", concurrency=" << cfg.concurrency
+           << ", flush_period_in_ms=" << cfg.flush_period_in_ms
+           << "}";
+}
+
+static bytes serialized(int64_t v) {
+    return long_type->decompose(v);
+}
+
+static bytes serialized(int32_t v) {
+    return int32_type->decompose(v);
+}
+
+// Prepared statements and value generators of a workload.
+class workload_statements {
+    const test_config& _cfg;
+    bytes _read;
+    bytes _write;
+    bytes _value;
+public:
+    explicit workload_statements(const test_config& cfg)
+        : _cfg(cfg)
+        , _value(bytes(cfg.value_size, int8_t(0x42)))
+    { }
+
+    static sstring table_ddl(workload w) {
+        switch (w) {
+        case workload::simple:
+        case workload::scan:
+        case workload::ttl:
+            return "create table t (pk bigint primary key, v blob);";
+        case workload::wide:
+        case workload::batch:
+            return "create table t (pk bigint, ck int, v blob, primary key (pk, ck));";
+        case workload::collections:
+            return "create table t (pk bigint primary key, m map<int, blob>);";
+        }
+        abort();
+    }
+
+    sstring write_query() const {
+        switch (_cfg.kind) {
+        case workload::simple:
+        case workload::scan:
+            return "insert into t (pk, v) values (?, ?);";
+        case workload::ttl:
+            return sprint("insert into t (pk, v) values (?, ?) using ttl %d;", _cfg.ttl);
+        case workload::wide:
+            return "insert into t (pk, ck, v) values (?, ?, ?);";
+        case workload::batch: {
+            sstring q = "begin unlogged batch ";
+            for (unsigned i = 0; i < _cfg.batch_size; ++i) {
+                q += "insert into t (pk, ck, v) values (?, ?, ?); ";
+            }
+            return q + "apply batch;";
+        }
+        case workload::collections:
+            return "update t set m[?] = ? where pk = ?;";
+        }
+        abort();
+    }
+
+    sstring read_query() const {
+        switch (_cfg.kind) {
+        case workload::simple:
+        case workload::ttl:
+            return "select v from t where pk = ?;";
+        case workload::scan:
+            return sprint("select pk, v from t where token(pk) >= ? limit %d;", _cfg.scan_limit);
+        case workload::wide:
+        case workload::batch:
+            return sprint("select ck, v from t where pk = ? and ck >= ? limit %d;", _cfg.scan_limit);
+        case workload::collections:
+            return "select m from t where pk = ?;";
+        }
+        abort();
+    }
+
+    future<> prepare(cql_test_env& env) {
+        return env.prepare(write_query()).then([this, &env] (bytes id) {
+            _write = std::move(id);
+            return env.prepare(read_query());
+        }).then([this] (bytes id) {
+            _read = std::move(id);
+        });
+    }
+
+    template <typename RandomEngine>
+    std::vector<bytes_opt> write_values(RandomEngine& rnd, int64_t pk) const {
+        std::uniform_int_distribution<int32_t> ck(0, _cfg.rows_per_partition - 1);
+        switch (_cfg.kind) {
+        case workload::simple:
+        case workload::scan:
+        case workload::ttl:
+            return { serialized(pk), _value };
+        case workload::wide:
+            return { serialized(pk), serialized(ck(rnd)), _value };
+        case workload::batch: {
+            std::vector<bytes_opt> values;
+            auto first = ck(rnd);
+            for (unsigned i = 0; i < _cfg.batch_size; ++i) {
+                values.emplace_back(serialized(pk));
+                values.emplace_back(serialized(int32_t((first + i) % _cfg.rows_per_partition)));
+                values.emplace_back(_value);
+            }
+            return values;
+        }
+        case workload::collections:
+            return { serialized(ck(rnd)), _value, serialized(pk) };
+        }
+        abort();
+    }
+
+    template <typename RandomEngine>
+    std::vector<bytes_opt> read_values(RandomEngine& rnd, int64_t pk) const {
+        switch (_cfg.kind) {
+        case workload::simple:
+        case workload::ttl:
+        case workload::collections:
+            return { serialized(pk) };
+        case workload::scan:
+            return { serialized(std::uniform_int_distribution<int64_t>()(rnd)) };
+        case workload::wide:
+        case workload::batch:
+            return { serialized(pk), serialized(std::uniform_int_distribution<int32_t>(0, _cfg.rows_per_partition - 1)(rnd)) };
+        }
+        abort();
+    }
+
+    const bytes& read_id() const { return _read; }
+    const bytes& write_id() const { return _write; }
+};
+
+struct shard_results {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t errors = 0;
+    uint64_t mallocs = 0;
+    // Per hot path break down, with --enable-alloc-tracking builds.
+    utils::alloc_tracker::stats_type scopes;
+    utils::hdr_histogram read_latency;
+    utils::hdr_histogram write_latency;
+
+    shard_results& operator+=(const shard_results& o) {
+        reads += o.reads;
+        writes += o.writes;
+        errors += o.errors;
+        mallocs += o.mallocs;
+        for (unsigned i = 0; i < utils::alloc_scope_count; ++i) {
+            scopes[i] += o.scopes[i];
+        }
+        read_latency += o.read_latency;
+        write_latency += o.write_latency;
+        return *this;
+    }
+};
+
+shard_results operator+(shard_results a, const shard_results& b) {
+    a += b;
+    return a;
+}
+
+// Runs the workload on one shard until the deadline, timing every operation.
+class workload_executor {
+    cql_test_env& _env;
+    const test_config& _cfg;
+    const workload_statements& _statements;
+    std::default_random_engine _rnd{std::random_device()()};
+    lowres_clock::time_point _end_at;
+    shard_results _results;
+private:
+    future<> do_op() {
+        auto pk = std::uniform_int_distribution<int64_t>(0, _cfg.partitions - 1)(_rnd);
+        bool read = std::uniform_int_distribution<unsigned>(0, 99)(_rnd) < _cfg.read_ratio;
+        auto start = std::chrono::steady_clock::now();
+        auto f = read ? _env.execute_prepared(_statements.read_id(), _statements.read_values(_rnd, pk))
+                      : _env.execute_prepared(_statements.write_id(), _statements.write_values(_rnd, pk));
+        return f.then_wrapped([this, read, start] (auto&& f) {
+            auto latency = std::chrono::steady_clock::now() - start;
+            try {
+                f.get();
+            } catch (...) {
+                ++_results.errors;
+                return;
+            }
+            if (read) {
+                ++_results.reads;
+                _results.read_latency.add(latency);
+            } else {
+                ++_results.writes;
+                _results.write_latency.add(latency);
+            }
+        });
+    }
+public:
+    workload_executor(cql_test_env& env, const test_config& cfg, const workload_statements& statements, lowres_clock::time_point end_at)
+        : _env(env), _cfg(cfg), _statements(statements), _end_at(end_at)
+    { }
+
+    future<shard_results> run() {
+        auto mallocs = memory::stats().mallocs();
+        auto scopes = utils::local_alloc_tracker().get_stats();
+        auto workers = boost::irange(0u, _cfg.concurrency);
+        return parallel_for_each(workers.begin(), workers.end(), [this] (unsigned) {
+            return do_until([this] { return lowres_clock::now() >= _end_at; }, [this] {
+                return do_op();
+            });
+        }).then([this, mallocs, scopes] {
+            _results.mallocs = memory::stats().mallocs() - mallocs;
+            auto& now = utils::local_alloc_tracker().get_stats();
+            for (unsigned i = 0; i < utils::alloc_scope_count; ++i) {
+                _results.scopes[i].operations = now[i].operations - scopes[i].operations;
+                _results.scopes[i].allocations = now[i].allocations - scopes[i].allocations;
+                _results.scopes[i].retained_bytes = now[i].retained_bytes - scopes[i].retained_bytes;
+            }
+            return _results;
+        });
+    }
+
+    future<> stop() {
+        return make_ready_future<>();
+    }
+};
+
+static void print_latency(const char* op, uint64_t count, const utils::hdr_histogram& h) {
+    if (!count) {
+        return;
+    }
+    std::cout << sprint("%-6s ops: %10d  latency [us]: mean %8.1f  p50 %6d  p90 %6d  p99 %6d  p999 %6d  max %6d\n",
+            op, count, h.mean(), h.percentile(50), h.percentile(90), h.percentile(99), h.percentile(99.9), h.max());
+}
+
+static future<> populate(cql_test_env& env, const test_config& cfg, const workload_statements& statements) {
+    std::cout << "Populating " << cfg.partitions << " partitions..." << std::endl;
+    return seastar::async([&env, &cfg, &statements] {
+        std::default_random_engine rnd;
+        auto partitions = boost::irange(0u, cfg.partitions);
+        // Wide partitions get all their rows, batches cover several at once.
+        auto writes_per_partition = cfg.kind == workload::wide ? cfg.rows_per_partition
+                : cfg.kind == workload::batch ? (cfg.rows_per_partition + cfg.batch_size - 1) / cfg.batch_size
+                : 1u;
+        for (auto pk : partitions) {
+            parallel_for_each(boost::irange(0u, writes_per_partition), [&] (unsigned) {
+                return env.execute_prepared(statements.write_id(), statements.write_values(rnd, pk)).discard_result();
+            }).get();
+        }
+    });
+}
+
+static future<> run_test(cql_test_env& env, test_config& cfg) {
+    std::cout << "Running test with config: " << cfg << std::endl;
+    return seastar::async([&env, &cfg] {
+        env.execute_cql(workload_statements::table_ddl(cfg.kind)).get();
+        auto statements = make_lw_shared<workload_statements>(cfg);
+        statements->prepare(env).get();
+        populate(env, cfg, *statements).get();
+        env.db().invoke_on_all([] (database& db) {
+            return db.flush_all_memtables();
+        }).get();
+
+        seastar::gate flushes;
+        timer<> flusher([&env, &flushes] {
+            with_gate(flushes, [&env] {
+                return env.db().invoke_on_all([] (database& db) {
+                    return db.flush_all_memtables();
+                });
+            }).handle_exception([] (auto ep) {
+                std::cout << "Flush failed: " << ep << std::endl;
+            });
+        });
+        if (cfg.flush_period_in_ms) {
+            flusher.arm_periodic(std::chrono::milliseconds(cfg.flush_period_in_ms));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto end_at = lowres_clock::now() + std::chrono::seconds(cfg.duration_in_seconds);
+        distributed<workload_executor> exec;
+        exec.start(std::ref(env), std::cref(cfg), std::cref(*statements), end_at).get();
+        auto results = exec.map_reduce0([] (workload_executor& e) { return e.run(); }, shard_results(), std::plus<shard_results>()).get0();
+        auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        flusher.cancel();
+        flushes.close().get();
+        exec.stop().get();
+
+        auto ops = results.reads + results.writes;
+        std::cout << sprint("throughput: %.2f ops/s, %d errors, %.1f allocations/op\n",
+                ops / duration, results.errors, ops ? double(results.mallocs) / ops : 0.0);
+        print_latency("read", results.reads, results.read_latency);
+        print_latency("write", results.writes, results.write_latency);
+        if (utils::alloc_tracker::enabled()) {
+            for (unsigned i = 0; i < utils::alloc_scope_count; ++i) {
+                auto& st = results.scopes[i];
+                if (st.operations) {
+                    std::cout << sprint("%-16s calls: %10d  allocations/call: %6.1f  retained bytes/call: %8.1f\n",
+                            utils::to_string(utils::alloc_scope_id(i)), st.operations,
+                            double(st.allocations) / st.operations, double(st.retained_bytes) / st.operations);
+                }
+            }
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("workload", bpo::value<std::string>()->default_value("simple"), "workload: simple, wide, scan, batch, collections or ttl")
+        ("partitions", bpo::value<unsigned>()->default_value(10000), "number of partitions")
+        ("rows-per-partition", bpo::value<unsigned>()->default_value(100), "clustering rows per partition, for the wide and batch workloads, and map cells for collections")
+        ("value-size", bpo::value<unsigned>()->default_value(64), "size of the written values, in bytes")
+        ("batch-size", bpo::value<unsigned>()->default_value(10), "rows per batch, for the batch workload")
+        ("ttl", bpo::value<unsigned>()->default_value(60), "TTL of written rows, in seconds, for the ttl workload")
+        ("scan-limit", bpo::value<unsigned>()->default_value(100), "rows read per scan or slice")
+        ("read-ratio", bpo::value<unsigned>()->default_value(50), "percentage of operations which are reads")
+        ("flush-period", bpo::value<unsigned>()->default_value(0), "flush memtables every that many milliseconds during the run, 0 to disable")
+        ("duration", bpo::value<unsigned>()->default_value(10), "test duration in seconds")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "workers per core");
+
+    return app.run(argc, argv, [&app] {
+        auto cfg = make_lw_shared<test_config>();
+        auto& opts = app.configuration();
+        cfg->name = opts["workload"].as<std::string>();
+        cfg->kind = workload_from_string(cfg->name);
+        cfg->partitions = std::max(1u, opts["partitions"].as<unsigned>());
+        cfg->rows_per_partition = std::max(1u, opts["rows-per-partition"].as<unsigned>());
+        cfg->value_size = opts["value-size"].as<unsigned>();
+        cfg->batch_size = std::max(1u, opts["batch-size"].as<unsigned>());
+        cfg->ttl = opts["ttl"].as<unsigned>();
+        cfg->scan_limit = std::max(1u, opts["scan-limit"].as<unsigned>());
+        cfg->read_ratio = std::min(100u, opts["read-ratio"].as<unsigned>());
+        cfg->flush_period_in_ms = opts["flush-period"].as<unsigned>();
+        cfg->duration_in_seconds = opts["duration"].as<unsigned>();
+        cfg->concurrency = opts["concurrency"].as<unsigned>();
+        return do_with_cql_env([cfg] (auto&& env) {
+            return run_test(env, *cfg);
+        }).finally([cfg] {});
+    });
+}
@@ -591,3 +591,57 @@ BOOST_AUTO_TEST_CASE(test_range_tombstone_to_prefix_tombstone_converter) {
         }
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_overwritten_tombstones_are_dropped) {
+    range_tombstone_list l(*s);
+
+    for (int32_t i = 0; i < 100; i += 2) {
+        l.apply(*s, rt(i, i, 1));
+    }
+    BOOST_REQUIRE_EQUAL(50, l.size());
+
+    l.apply(*s, rt(0, 200, 2));
+
+    auto it = l.begin();
+    assert_rt(rt(0, 200, 2), *it++);
+    BOOST_REQUIRE(it == l.end());
+
+    range_tombstone_list l2(*s);
+    for (int32_t i = 0; i < 1000; ++i) {
+        l2.apply(*s, rt(0, i, i + 1));
+        BOOST_REQUIRE_EQUAL(1, l2.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_reverting_dropped_tombstones) {
+    range_tombstone_list l(*s);
+    for (int32_t i = 0; i < 20; i += 2) {
+        l.apply(*s, rt(i, i, 1));
+    }
+    l.apply(*s, rt(40, 50, 3));
+
+    range_tombstone_list src(*s);
+    src.apply(*s, rt(5, 12, 2));
+    src.apply(*s, rt(30, 60, 2));
+    src.apply(*s, rt(70, 80, 2));
+
+    auto check_equal = [] (const range_tombstone_list& l1, const range_tombstone_list& l2) {
+        BOOST_REQUIRE(l1.difference(*s, l2).empty());
+        BOOST_REQUIRE(l2.difference(*s, l1).empty());
+    };
+
+    range_tombstone_list original(l);
+    {
+        auto rev = l.apply_reversibly(*s, src);
+        BOOST_REQUIRE(assert_valid(l));
+    }
+    check_equal(original, l);
+
+    range_tombstone_list expected(original);
+    expected.apply(*s, src);
+    {
+        auto rev = l.apply_reversibly(*s, src);
+        rev.cancel();
+    }
+    check_equal(expected, l);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <boost/range/irange.hpp>
+#include <seastar/core/thread.hh>
+
+#include "tests/test-utils.hh"
+#include "service/request_scheduler.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+static service::request_scheduler::config make_config(unsigned throttle_limit, std::unordered_map<sstring, sstring> options = {}) {
+    options["throttle_limit"] = to_sstring(throttle_limit * smp::count);
+    return service::request_scheduler::make_config("org.apache.cassandra.scheduler.RoundRobinScheduler", "keyspace", options);
+}
+
+SEASTAR_TEST_CASE(test_requests_run_unscheduled_by_default) {
+    return seastar::async([] {
+        service::request_scheduler rs;
+        rs.configure(service::request_scheduler::make_config("org.apache.cassandra.scheduler.NoScheduler", "", {}));
+        promise<> p;
+        auto f1 = rs.schedule("ks", [&p] { return p.get_future(); });
+        auto f2 = rs.schedule("ks", [] { return 1; });
+        BOOST_REQUIRE(f2.available());
+        BOOST_REQUIRE_EQUAL(f2.get0(), 1);
+        p.set_value();
+        f1.get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_requests_are_admitted_round_robin_by_weight) {
+    return seastar::async([] {
+        service::request_scheduler rs;
+        rs.configure(make_config(1, {{"weights.etl", "1"}, {"weights.oltp", "2"}}));
+
+        promise<> blocker;
+        auto first = rs.schedule("etl", [&blocker] { return blocker.get_future(); });
+        BOOST_REQUIRE_EQUAL(rs.running(), 1);
+
+        std::vector<sstring> order;
+        std::vector<future<>> queued;
+        for (auto i : boost::irange(0, 4)) {
+            (void)i;
+            queued.push_back(rs.schedule("etl", [&order] { order.push_back("etl"); }));
+        }
+        for (auto i : boost::irange(0, 4)) {
+            (void)i;
+            queued.push_back(rs.schedule("oltp", [&order] { order.push_back("oltp"); }));
+        }
+        BOOST_REQUIRE(order.empty());
+        BOOST_REQUIRE_EQUAL(rs.get_stats("etl").queued, 4);
+
+        blocker.set_value();
+        first.get();
+        for (auto&& f : queued) {
+            f.get();
+        }
+        BOOST_REQUIRE_EQUAL(rs.running(), 0);
+        std::vector<sstring> expected = {"etl", "oltp", "oltp", "etl", "oltp", "oltp", "etl", "etl"};
+        BOOST_REQUIRE(order == expected);
+        BOOST_REQUIRE_EQUAL(rs.get_stats("oltp").admitted, 4);
+    });
+}
+
+SEASTAR_TEST_CASE(test_failed_requests_release_their_slot) {
+    return seastar::async([] {
+        service::request_scheduler rs;
+        rs.configure(make_config(1));
+        auto f = rs.schedule("ks", [] {
+            return make_exception_future<>(std::runtime_error("failed"));
+        });
+        BOOST_REQUIRE_THROW(f.get(), std::runtime_error);
+        BOOST_REQUIRE_EQUAL(rs.running(), 0);
+        rs.schedule("ks", [] { }).get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_bad_scheduler_options_are_rejected) {
+    BOOST_REQUIRE_THROW(make_config(1, {{"weights.ks", "0"}}), std::invalid_argument);
+    BOOST_REQUIRE_THROW(make_config(1, {{"no_such_option", "1"}}), std::invalid_argument);
+    BOOST_REQUIRE_THROW(service::request_scheduler::make_config("org.apache.cassandra.scheduler.RoundRobinScheduler", "table", {}),
+                        std::invalid_argument);
+    return make_ready_future<>();
+}
@@ -31,6 +31,7 @@
 
 #include "schema_builder.hh"
 #include "row_cache.hh"
+#include "memory_balancer.hh"
 #include "core/thread.hh"
 #include "memtable.hh"
 #include "partition_slice_builder.hh"
@@ -561,6 +562,46 @@ SEASTAR_TEST_CASE(test_single_key_queries_after_population_in_reverse_order) {
     });
 }
 
+SEASTAR_TEST_CASE(test_only_point_read_hits_protect_entries) {
+    return seastar::async([] {
+        auto s = make_schema();
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> mutations = make_ring(s, 3);
+
+        for (auto&& m : mutations) {
+            mt->apply(m);
+        }
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+
+        auto get_partition_range = [] (const mutation& m) {
+            return query::partition_range::make_singular(query::ring_position(m.decorated_key()));
+        };
+
+        // Populates the cache, entries start on probation
+        for (int i = 0; i < 2; ++i) {
+            assert_that(cache.make_reader(s, query::full_partition_range))
+                .produces(mutations[0])
+                .produces(mutations[1])
+                .produces(mutations[2])
+                .produces_end_of_stream();
+        }
+        BOOST_REQUIRE_EQUAL(tracker.partitions(), 3);
+        BOOST_REQUIRE_EQUAL(tracker.protected_partitions(), 0);
+
+        assert_that(cache.make_reader(s, get_partition_range(mutations[1])))
+            .produces(mutations[1])
+            .produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(tracker.protected_partitions(), 1);
+
+        // Nothing was evicted, so nothing is rejected either
+        BOOST_REQUIRE_EQUAL(tracker.admission_rejections(), 0);
+    });
+}
+
 SEASTAR_TEST_CASE(test_row_cache_conforms_to_mutation_source) {
     return seastar::async([] {
         cache_tracker tracker;
@@ -1188,6 +1229,101 @@ SEASTAR_TEST_CASE(test_invalidate_works_with_wrap_arounds) {
     });
 }
 
+SEASTAR_TEST_CASE(test_invalidate_of_known_partitions) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> ring = make_ring(s, 6);
+        for (auto& m : ring) {
+            mt->apply(m);
+        }
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+
+        // Populates the cache and marks it continuous
+        assert_that(cache.make_reader(s))
+            .produces(ring[0])
+            .produces(ring[1])
+            .produces(ring[2])
+            .produces(ring[3])
+            .produces(ring[4])
+            .produces(ring[5])
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.has_continuous_entry(ring[3].ring_position()));
+
+        auto range = query::partition_range::make({ring[1].ring_position()}, {ring[4].ring_position()});
+        cache.invalidate(range, [&] (const dht::decorated_key& dk) {
+            return dk.equal(*s, ring[2].decorated_key());
+        }).get();
+
+        verify_has(cache, ring[1].decorated_key());
+        verify_does_not_have(cache, ring[2].decorated_key());
+        verify_has(cache, ring[3].decorated_key());
+        verify_has(cache, ring[4].decorated_key());
+        // The range may have gained partitions
+        BOOST_REQUIRE(!cache.has_continuous_entry(ring[3].ring_position()));
+
+        auto streamed = make_lw_shared<memtable>(s);
+        streamed->apply(ring[0]);
+        streamed->apply(ring[4]);
+        cache.invalidate(*streamed).get();
+
+        verify_does_not_have(cache, ring[0].decorated_key());
+        verify_has(cache, ring[1].decorated_key());
+        verify_has(cache, ring[3].decorated_key());
+        verify_does_not_have(cache, ring[4].decorated_key());
+        verify_has(cache, ring[5].decorated_key());
+    });
+}
+
+SEASTAR_TEST_CASE(test_versions_are_merged_after_reads_of_long_chains) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto mt = make_lw_shared<memtable>(s);
+        auto m = make_new_mutation(s);
+        mt->apply(m);
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+        auto range = query::partition_range::make_singular(m.decorated_key());
+        assert_that(cache.make_reader(s, range))
+            .produces(m)
+            .produces_end_of_stream();
+
+        // Each update applied while a reader holds a snapshot adds a version.
+        std::vector<streamed_mutation_opt> readers;
+        auto expected = m;
+        for (int i = 0; i < 4; i++) {
+            readers.push_back(cache.make_reader(s, range)().get0());
+            auto update = make_lw_shared<memtable>(s);
+            auto m2 = make_new_mutation(s, m.key());
+            update->apply(m2);
+            expected.apply(m2);
+            cache.update(*update, [] (auto&& key) {
+                return partition_presence_checker_result::maybe_exists;
+            }).get();
+        }
+        readers.clear();
+
+        BOOST_REQUIRE_EQUAL(tracker.version_merges(), 0);
+        assert_that(cache.make_reader(s, range))
+            .produces(expected)
+            .produces_end_of_stream();
+        while (!tracker.version_merges()) {
+            sleep(1ms).get();
+        }
+        BOOST_REQUIRE_EQUAL(tracker.version_merges(), 1);
+        assert_that(cache.make_reader(s, range))
+            .produces(expected)
+            .produces_end_of_stream();
+        // A single version is left, so the read has nothing to request.
+        sleep(10ms).get();
+        BOOST_REQUIRE_EQUAL(tracker.version_merges(), 1);
+    });
+}
+
 SEASTAR_TEST_CASE(test_mvcc) {
     return seastar::async([] {
         auto no_difference = [] (auto& m1, auto& m2) {
@@ -1381,3 +1517,176 @@ SEASTAR_TEST_CASE(test_slicing_mutation_reader) {
         }
     });
 }
+
+SEASTAR_TEST_CASE(test_clustering_ranges_of_wide_partition_are_cached) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+            .with_column("pk", int32_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key)
+            .with_column("v", int32_type)
+            .build();
+
+        auto ck = [&] (int i) {
+            return clustering_key_prefix::from_single_value(*s, int32_type->decompose(i));
+        };
+
+        auto pk = partition_key::from_exploded(*s, { int32_type->decompose(0) });
+        mutation m(pk, s);
+        constexpr auto row_count = 100;
+        for (auto i = 0; i < row_count; i++) {
+            m.set_clustered_cell(ck(i), to_bytes("v"), data_value(i), api::new_timestamp());
+        }
+
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m);
+
+        int secondary_calls_count = 0;
+        cache_tracker tracker;
+        row_cache cache(s, mutation_source([&] (schema_ptr s, const query::partition_range& range,
+                                                query::clustering_key_filtering_context ck_filtering) {
+            ++secondary_calls_count;
+            return mt->as_data_source()(s, range, ck_filtering);
+        }), mt->as_key_source(), tracker, 2048);
+
+        auto pr = query::partition_range::make_singular(m.decorated_key());
+
+        assert_that(cache.make_reader(s, pr))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(tracker.uncached_wide_partitions(), 1);
+
+        auto ps = partition_slice_builder(*s)
+            .with_range(query::clustering_range(query::clustering_range::bound(ck(1)), query::clustering_range::bound(ck(2))))
+            .build();
+        auto ck_filtering = query::clustering_key_filtering_context::create(s, ps);
+
+        test_sliced_read_row_presence(cache.make_reader(s, pr, ck_filtering), s, ps, { 1, 2 });
+        BOOST_REQUIRE_EQUAL(tracker.uncached_wide_partitions(), 2);
+        auto calls = secondary_calls_count;
+
+        test_sliced_read_row_presence(cache.make_reader(s, pr, ck_filtering), s, ps, { 1, 2 });
+
+        auto sub_ps = partition_slice_builder(*s)
+            .with_range(query::clustering_range::make_singular(ck(2)))
+            .build();
+        test_sliced_read_row_presence(cache.make_reader(s, pr, query::clustering_key_filtering_context::create(s, sub_ps)),
+                                      s, sub_ps, { 2 });
+
+        BOOST_REQUIRE_EQUAL(secondary_calls_count, calls);
+        BOOST_REQUIRE_EQUAL(tracker.uncached_wide_partitions(), 2);
+
+        auto other_ps = partition_slice_builder(*s)
+            .with_range(query::clustering_range::make_singular(ck(3)))
+            .build();
+        test_sliced_read_row_presence(cache.make_reader(s, pr, query::clustering_key_filtering_context::create(s, other_ps)),
+                                      s, other_ps, { 3 });
+        BOOST_REQUIRE_EQUAL(tracker.uncached_wide_partitions(), 3);
+    });
+}
+
+SEASTAR_TEST_CASE(test_large_cell_values_are_compressed_in_cache) {
+    return seastar::async([] {
+        auto s = schema_builder(make_schema())
+            .set_caching_options(caching_options::from_map({{ "cell_compression_threshold", "1024" }}))
+            .build();
+        auto m = make_new_large_mutation(s, 1);
+
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m);
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+
+        assert_that(cache.make_reader(s, query::full_partition_range))
+            .produces(m)
+            .produces_end_of_stream();
+
+        auto& stats = tracker.compression_stats();
+        BOOST_REQUIRE_EQUAL(stats.compressed_cells, 1);
+        BOOST_REQUIRE_LT(stats.bytes_out, stats.bytes_in);
+
+        // Served from cache, decompressed.
+        auto pr = query::partition_range::make_singular(m.decorated_key());
+        assert_that(cache.make_reader(s, pr))
+            .produces(m)
+            .produces_end_of_stream();
+
+        // Merging with a newer write of the partition.
+        auto m2 = make_new_large_mutation(s, 1);
+        auto mt2 = make_lw_shared<memtable>(s);
+        mt2->apply(m2);
+        cache.update(*mt2, [] (auto&& key) {
+            return partition_presence_checker_result::maybe_exists;
+        }).get();
+
+        auto expected = m;
+        expected.apply(m2);
+        assert_that(cache.make_reader(s, pr))
+            .produces(expected)
+            .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_compressed_cells_reconcile_by_uncompressed_value) {
+    return seastar::async([] {
+        auto v1 = bytes(4096, int8_t(1));
+        auto v2 = bytes(2048, int8_t(2));
+        auto c1 = atomic_cell::make_live(1, v1);
+        auto c2 = atomic_cell::make_live(1, v2);
+        auto cc1 = cell_compression::compress(c1, 1024);
+        auto cc2 = cell_compression::compress(c2, 1024);
+        BOOST_REQUIRE(cc1 && cc1->is_value_compressed());
+        BOOST_REQUIRE(cc2 && cc2->is_value_compressed());
+        BOOST_REQUIRE(!cell_compression::compress(c1, 8192));
+
+        BOOST_REQUIRE_EQUAL(cell_compression::uncompressed_value(*cc1), v1);
+        BOOST_REQUIRE(cell_compression::decompress(*cc2).value() == bytes_view(v2));
+
+        auto expected = compare_atomic_cell_for_merge(c1, c2);
+        BOOST_REQUIRE_EQUAL(compare_atomic_cell_for_merge(*cc1, *cc2), expected);
+        BOOST_REQUIRE_EQUAL(compare_atomic_cell_for_merge(*cc1, c2), expected);
+        BOOST_REQUIRE_EQUAL(compare_atomic_cell_for_merge(c1, *cc2), expected);
+        BOOST_REQUIRE_EQUAL(compare_atomic_cell_for_merge(*cc1, c1), 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_memory_balancer_targets) {
+    memory_balancer::config cfg;
+    cfg.interval = std::chrono::seconds(1);
+    cfg.cache_reserve_share = 0.5;
+    cfg.flush_window = std::chrono::seconds(10);
+    cfg.min_dirty = 100;
+    cfg.max_dirty = 500;
+    size_t lsa = 1000;
+
+    // Idle: memtables get their minimum, the cache the rest.
+    auto t = memory_balancer::compute_targets(cfg, 0, 0, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 100);
+    BOOST_REQUIRE_EQUAL(t.cache, 900);
+
+    // Writes without cache hits may take memtables up to their maximum.
+    t = memory_balancer::compute_targets(cfg, 0, 1000, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 500);
+    BOOST_REQUIRE_EQUAL(t.cache, 500);
+
+    // A hitting cache keeps its reserve through write bursts.
+    t = memory_balancer::compute_targets(cfg, 0.8, 1000, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 500);
+    t = memory_balancer::compute_targets(cfg, 1, 1000, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 500);
+    cfg.cache_reserve_share = 0.8;
+    t = memory_balancer::compute_targets(cfg, 1, 1000, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 200);
+    BOOST_REQUIRE_EQUAL(t.cache, 800);
+
+    // Moderate writes need only what a flush window takes.
+    t = memory_balancer::compute_targets(cfg, 0, 30, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 300);
+
+    // The minimum is kept even when the cache reserve says otherwise.
+    cfg.cache_reserve_share = 1;
+    t = memory_balancer::compute_targets(cfg, 1, 1000, lsa);
+    BOOST_REQUIRE_EQUAL(t.dirty, 100);
+    BOOST_REQUIRE_EQUAL(t.cache, 900);
+    return make_ready_future<>();
+}
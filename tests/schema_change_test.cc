@@ -31,6 +31,7 @@
 #include "tests/result_set_assertions.hh"
 #include "service/migration_manager.hh"
 #include "schema_builder.hh"
+#include "db/schema_tables.hh"
 
 #include "disk-error-handler.hh"
 
@@ -130,6 +131,39 @@ SEASTAR_TEST_CASE(test_tombstones_are_ignored_in_version_calculation) {
     });
 }
 
+SEASTAR_TEST_CASE(test_cached_schema_digest_matches_full_calculation) {
+    return do_with_cql_env([](cql_test_env& e) {
+        return seastar::async([&] {
+            auto& proxy = service::get_storage_proxy();
+            auto check = [&] {
+                auto cached = db::schema_tables::calculate_schema_digest(proxy).get0();
+                BOOST_REQUIRE_EQUAL(cached, e.db().local().get_version());
+                db::schema_tables::clear_schema_digest_cache().get();
+                BOOST_REQUIRE_EQUAL(db::schema_tables::calculate_schema_digest(proxy).get0(), cached);
+            };
+
+            e.execute_cql("create keyspace tests with replication = { 'class' : 'SimpleStrategy', 'replication_factor' : 1 };").get();
+            check();
+            e.execute_cql("create keyspace tests2 with replication = { 'class' : 'SimpleStrategy', 'replication_factor' : 1 };").get();
+            e.execute_cql("create table tests.table1 (pk int primary key, c1 int);").get();
+            e.execute_cql("create table tests.table2 (pk int primary key, c1 int);").get();
+            e.execute_cql("create table tests2.table1 (pk int primary key, c1 int);").get();
+            check();
+            e.execute_cql("alter table tests.table1 add c2 int;").get();
+            check();
+            e.execute_cql("alter table tests.table2 drop c1;").get();
+            check();
+            e.execute_cql("drop table tests.table1;").get();
+            check();
+            BOOST_REQUIRE(!e.local_db().has_schema("tests", "table1"));
+            BOOST_REQUIRE(e.local_db().has_schema("tests", "table2"));
+            e.execute_cql("drop keyspace tests2;").get();
+            check();
+            BOOST_REQUIRE(!e.local_db().has_schema("tests2", "table1"));
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_column_is_dropped) {
     return do_with_cql_env([](cql_test_env& e) {
         return seastar::async([&] {
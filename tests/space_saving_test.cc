@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+#include "utils/space_saving.hh"
+
+BOOST_AUTO_TEST_CASE(test_counts_are_exact_below_capacity) {
+    utils::space_saving<int> summary(16);
+    for (int k = 0; k < 10; ++k) {
+        for (int i = 0; i <= k; ++i) {
+            summary.offer(k, 100);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(summary.size(), 10);
+    auto top = summary.top(3);
+    BOOST_REQUIRE_EQUAL(top.size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        BOOST_REQUIRE_EQUAL(top[i].key, 9 - i);
+        BOOST_REQUIRE_EQUAL(top[i].count, 10 - i);
+        BOOST_REQUIRE_EQUAL(top[i].error, 0);
+        BOOST_REQUIRE_EQUAL(top[i].weight, 100 * (10 - i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_hot_keys_survive_a_scan) {
+    utils::space_saving<int> summary(8);
+    // Two keys making up a fifth of the stream each, between keys seen once.
+    for (int i = 0; i < 10000; ++i) {
+        summary.offer(i % 5 == 0 ? -1 : i % 5 == 1 ? -2 : i);
+    }
+    BOOST_REQUIRE_EQUAL(summary.size(), 8);
+    auto top = summary.top(2);
+    BOOST_REQUIRE_EQUAL(top.size(), 2);
+    for (auto&& c : top) {
+        BOOST_REQUIRE(c.key == -1 || c.key == -2);
+        // Counts are never too low, and at most error too high.
+        BOOST_REQUIRE_GE(c.count, 2000);
+        BOOST_REQUIRE_LE(c.count - c.error, 2000);
+    }
+}
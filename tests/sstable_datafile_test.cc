@@ -41,12 +41,19 @@
 #include "range.hh"
 #include "partition_slice_builder.hh"
 #include "sstables/date_tiered_compaction_strategy.hh"
+#include "sstables/time_window_compaction_strategy.hh"
+#include "sstables/sstable_set.hh"
+#include "sstables/index_summary_manager.hh"
+#include "compaction_strategy.hh"
 #include "mutation_assertions.hh"
 
 #include <stdio.h>
 #include <ftw.h>
 #include <unistd.h>
 #include <boost/range/algorithm/find_if.hpp>
+#include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/count_if.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
 
 using namespace sstables;
 
@@ -919,6 +926,98 @@ SEASTAR_TEST_CASE(datafile_generation_15) {
     return sstable_compression_test(compressor::deflate, 15);
 }
 
+SEASTAR_TEST_CASE(datafile_generation_57) {
+    return sstable_compression_test(compressor::zstd, 57);
+}
+
+SEASTAR_TEST_CASE(test_zstd_dictionary_compression) {
+    return seastar::async([] {
+        auto s = schema_builder(some_keyspace, some_column_family)
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("r1", utf8_type)
+                .set_compressor_params(compression_parameters({
+                    { compression_parameters::SSTABLE_COMPRESSION, "ZstdCompressor" },
+                    { compression_parameters::CHUNK_LENGTH_KB, "4" },
+                    { compression_parameters::DICTIONARY_SIZE_KB, "4" },
+                }))
+                .build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto mt = make_lw_shared<memtable>(s);
+        std::vector<mutation> mutations;
+        for (auto i = 0; i < 2000; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            mutation m(key, s);
+            auto value = sprint("{\"id\": %d, \"name\": \"user%d\", \"tags\": [\"a\", \"b\"]}", i, i * 7);
+            m.set_clustered_cell(clustering_key::make_empty(), r1_col, make_atomic_cell(utf8_type->decompose(sstring(value))));
+            mt->apply(m);
+            mutations.push_back(std::move(m));
+        }
+
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+
+        auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        loaded->load().get();
+        auto dict_file = sstable::filename(tmp->path, "ks", "cf", la, 1, big, sstable::component_type::CompressionDictionary);
+        BOOST_REQUIRE(engine().file_exists(dict_file).get0());
+        for (auto&& m : mutations) {
+            auto key = sstables::key::from_partition_key(*s, m.key());
+            auto mopt = mutation_from_streamed_mutation(loaded->read_row(s, key).get0()).get0();
+            BOOST_REQUIRE(mopt);
+            BOOST_REQUIRE(*mopt == m);
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_clustering_bounds_filter_slices) {
+    return seastar::async([] {
+        auto s = schema_builder(some_keyspace, some_column_family)
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("c1", int32_type, column_kind::clustering_key)
+                .with_column("r1", int32_type)
+                .build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto ck = [&] (int32_t v) {
+            return clustering_key_prefix::from_exploded(*s, {int32_type->decompose(v)});
+        };
+        auto range = [&] (int32_t start, int32_t end) {
+            return std::vector<query::clustering_range>{query::clustering_range::make({ck(start)}, {ck(end)})};
+        };
+
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        auto tmp = make_lw_shared<tmpdir>();
+        auto write_and_load = [&] (const mutation& m, int64_t generation) {
+            auto mt = make_lw_shared<memtable>(s);
+            mt->apply(m);
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            loaded->load().get();
+            return loaded;
+        };
+
+        mutation m(key, s);
+        for (int32_t i = 10; i <= 20; i++) {
+            m.set_clustered_cell(ck(i), r1_col, make_atomic_cell(int32_type->decompose(i)));
+        }
+        auto sst = write_and_load(m, 1);
+        BOOST_REQUIRE(!sst->may_contain_rows(*s, range(0, 5)));
+        BOOST_REQUIRE(!sst->may_contain_rows(*s, range(21, 30)));
+        BOOST_REQUIRE(sst->may_contain_rows(*s, range(15, 30)));
+        BOOST_REQUIRE(sst->may_contain_rows(*s, range(20, 20)));
+        BOOST_REQUIRE(sst->may_contain_rows(*s, { query::clustering_range::make_open_ended_both_sides() }));
+
+        // A partition tombstone shadows rows of other sstables in any range.
+        mutation deleted(key, s);
+        deleted.partition().apply(tombstone(api::new_timestamp(), gc_clock::now()));
+        deleted.set_clustered_cell(ck(15), r1_col, make_atomic_cell(int32_type->decompose(15)));
+        sst = write_and_load(deleted, 2);
+        BOOST_REQUIRE(sst->may_contain_rows(*s, range(0, 5)));
+    });
+}
+
 SEASTAR_TEST_CASE(datafile_generation_16) {
     return test_setup::do_with_test_directory([] {
         auto s = uncompressed_schema();
@@ -1088,6 +1187,9 @@ SEASTAR_TEST_CASE(compact) {
                         generation, sstables::sstable::version_types::la, sstables::sstable::format_types::big);
             };
             return sstables::compact_sstables(std::move(sstables), *cf, new_sstable, std::numeric_limits<uint64_t>::max(), 0).then([s, generation, cf, cm] (auto) {
+                BOOST_REQUIRE(cf->get_stats().compactions_completed == 1);
+                BOOST_REQUIRE(cf->get_stats().compaction_bytes_read > 0);
+                BOOST_REQUIRE(cf->get_stats().compaction_bytes_written > 0);
                 // Verify that the compacted sstable has the right content. We expect to see:
                 //  name  | age | height
                 // -------+-----+--------
@@ -2024,6 +2126,50 @@ SEASTAR_TEST_CASE(leveled_07) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(leveled_08) {
+    // Check that compactions into a level may run in parallel only if they don't overlap.
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    column_family::config cfg;
+    compaction_manager cm;
+    cfg.enable_disk_writes = false;
+    cfg.enable_commitlog = false;
+    auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+    cf->mark_ready_for_writes();
+
+    auto key_and_token_pair = token_generation_for_current_shard(50);
+    auto max_sstable_size_in_mb = 1;
+    auto one_mb = 1024 * 1024;
+
+    // Generations 1 and 3 are being compacted from L1 into L2. L1 is too
+    // big, so generation 2 has to be compacted into L2 along with 4.
+    add_sstable_for_leveled_test(cf, /*gen*/1, one_mb, /*level*/1, key_and_token_pair[0].first, key_and_token_pair[10].first);
+    add_sstable_for_leveled_test(cf, /*gen*/2, 12 * one_mb, /*level*/1, key_and_token_pair[20].first, key_and_token_pair[30].first);
+    add_sstable_for_leveled_test(cf, /*gen*/3, one_mb, /*level*/2, key_and_token_pair[0].first, key_and_token_pair[10].first);
+    add_sstable_for_leveled_test(cf, /*gen*/4, one_mb, /*level*/2, key_and_token_pair[20].first, key_and_token_pair[30].first);
+
+    std::vector<sstables::shared_sstable> compacting = { get_sstable(cf, 1), get_sstable(cf, 3) };
+    std::vector<sstables::shared_sstable> candidates = { get_sstable(cf, 2), get_sstable(cf, 4) };
+    {
+        leveled_manifest manifest = leveled_manifest::create(*cf, candidates, max_sstable_size_in_mb, compacting);
+        auto candidate = manifest.get_compaction_candidates();
+        BOOST_REQUIRE(candidate.sstables.size() == 2);
+        BOOST_REQUIRE(candidate.level == 2);
+    }
+
+    // Generation 5, which overlaps generation 2, is being compacted from L2 into L3.
+    add_sstable_for_leveled_test(cf, /*gen*/5, one_mb, /*level*/2, key_and_token_pair[25].first, key_and_token_pair[40].first);
+    compacting.push_back(get_sstable(cf, 5));
+    {
+        leveled_manifest manifest = leveled_manifest::create(*cf, candidates, max_sstable_size_in_mb, compacting);
+        auto candidate = manifest.get_compaction_candidates();
+        BOOST_REQUIRE(candidate.sstables.empty());
+    }
+
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(check_overlapping) {
     auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
         {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
@@ -2313,6 +2459,9 @@ SEASTAR_TEST_CASE(tombstone_purge_test) {
         };
 
         return sstables::compact_sstables(*sstables, *cf, create, std::numeric_limits<uint64_t>::max(), 0).then([s, tmp, sstables, cf, cm] (auto) {
+            // Nothing else has data of alpha, so its tombstone can go.
+            BOOST_REQUIRE(cm->get_stats().expired_tombstones >= 1);
+            BOOST_REQUIRE(cm->get_stats().purged_tombstones == cm->get_stats().expired_tombstones);
             return open_sstable(tmp->path, 3).then([s] (shared_sstable sst) {
                 auto reader = make_lw_shared(sstable_reader(sst, s)); // reader holds sst and s alive.
                 return (*reader)().then([s, reader] (streamed_mutation_opt m) {
@@ -2735,6 +2884,63 @@ SEASTAR_TEST_CASE(get_fully_expired_sstables_test) {
         BOOST_REQUIRE(expired.front()->generation() == 1);
     }
 
+    {
+        // Size-tiered and leveled strategies drop a fully expired sstable on
+        // its own instead of waiting for it to be picked up in a bucket.
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+        auto sst1 = add_sstable_for_overlapping_test(cf, /*gen*/1, min_key, key_and_token_pair[1].first, build_stats(0, 10, 10));
+        auto sst2 = add_sstable_for_overlapping_test(cf, /*gen*/2, min_key, max_key, build_stats(15, 20, std::numeric_limits<int32_t>::max()));
+        for (auto type : { compaction_strategy_type::size_tiered, compaction_strategy_type::leveled }) {
+            auto cs = make_compaction_strategy(type, s->compaction_strategy_options());
+            auto descriptor = cs.get_sstables_for_compaction(*cf, { sst1, sst2 });
+            BOOST_REQUIRE(descriptor.sstables.size() == 1);
+            BOOST_REQUIRE(descriptor.sstables.front()->generation() == 1);
+        }
+    }
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(compaction_of_sstable_runs_test) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+    compaction_manager cm;
+    column_family::config cfg;
+    auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+    auto key_and_token_pair = token_generation_for_current_shard(8);
+    auto stats = build_stats(0, 10, std::numeric_limits<int32_t>::max());
+    int min_threshold = cf->schema()->min_compaction_threshold();
+
+    // Fragments of the output of a single compaction.
+    std::vector<sstables::shared_sstable> run;
+    for (auto i = 0; i < min_threshold; i++) {
+        auto sst = add_sstable_for_overlapping_test(cf, /*gen*/i + 1, key_and_token_pair[i].first, key_and_token_pair[i].first, stats);
+        sstables::test(sst).set_ancestors({ 100, 101 });
+        sstables::test(sst).set_data_file_size(1 << 20);
+        run.push_back(sst);
+    }
+
+    // A single run is already what a compaction would produce.
+    for (auto type : { compaction_strategy_type::size_tiered, compaction_strategy_type::major }) {
+        auto cs = make_compaction_strategy(type, s->compaction_strategy_options());
+        BOOST_REQUIRE(cs.get_sstables_for_compaction(*cf, run).sstables.empty());
+    }
+
+    // Together with sstables of the size of the whole run, the run is compacted as a whole.
+    auto candidates = run;
+    for (auto i = 1; i < min_threshold; i++) {
+        auto sst = add_sstable_for_overlapping_test(cf, /*gen*/100 + i, key_and_token_pair[0].first, key_and_token_pair[7].first, stats);
+        sstables::test(sst).set_data_file_size(min_threshold << 20);
+        candidates.push_back(sst);
+    }
+    auto cs = make_compaction_strategy(compaction_strategy_type::size_tiered, s->compaction_strategy_options());
+    auto descriptor = cs.get_sstables_for_compaction(*cf, candidates);
+    BOOST_REQUIRE(descriptor.sstables.size() == candidates.size());
+    for (auto& sst : run) {
+        BOOST_REQUIRE(boost::range::find(descriptor.sstables, sst) != descriptor.sstables.end());
+    }
+
     return make_ready_future<>();
 }
 
@@ -2826,6 +3032,195 @@ SEASTAR_TEST_CASE(date_tiered_strategy_test_2) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(time_window_strategy_test) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+    compaction_manager cm;
+    column_family::config cfg;
+    auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+    // deterministic timestamp for Fri, 01 Jan 2016 00:00:00 GMT.
+    auto tp = db_clock::from_time_t(1451606400);
+    auto timestamp_of = [tp] (std::chrono::seconds offset) {
+        return int64_t((tp + offset).time_since_epoch().count() * 1000); // in microseconds.
+    };
+
+    std::vector<sstables::shared_sstable> candidates;
+    auto add = [&] (int64_t gen, std::chrono::seconds offset) {
+        auto ts = timestamp_of(offset);
+        candidates.push_back(add_sstable_for_overlapping_test(cf, gen, "a", "a",
+            build_stats(ts, ts, std::numeric_limits<int32_t>::max())));
+    };
+    // A closed window with three sstables...
+    add(1, std::chrono::seconds(0));
+    add(2, std::chrono::seconds(600));
+    add(3, std::chrono::seconds(1200));
+    // ...and the current window, with less than min_threshold of them.
+    add(4, std::chrono::seconds(7200));
+    add(5, std::chrono::seconds(7260));
+
+    std::map<sstring, sstring> options;
+    options.emplace(sstring("compaction_window_unit"), sstring("HOURS"));
+    options.emplace(sstring("compaction_window_size"), sstring("1"));
+
+    time_window_manifest manifest(options);
+    auto gc_before = gc_clock::time_point(std::chrono::seconds(0)); // disable gc before.
+    auto sstables = manifest.get_next_sstables(*cf, candidates, gc_before);
+    std::unordered_set<int64_t> gens;
+    for (auto sst : sstables) {
+        gens.insert(sst->generation());
+    }
+    BOOST_REQUIRE_EQUAL(sstables.size(), 3u);
+    BOOST_REQUIRE(gens.count(1) && gens.count(2) && gens.count(3));
+
+    auto set = make_compaction_strategy(compaction_strategy_type::time_window, options).make_sstable_set(s);
+    for (auto& sst : candidates) {
+        set.insert(sst);
+    }
+    auto select = [&] (api::timestamp_type min, api::timestamp_type max) {
+        std::unordered_set<int64_t> gens;
+        for (auto& sst : set.select(query::full_partition_range, min, max)) {
+            gens.insert(sst->generation());
+        }
+        return gens;
+    };
+    BOOST_REQUIRE(select(timestamp_of(std::chrono::seconds(7200)), api::max_timestamp) == std::unordered_set<int64_t>({4, 5}));
+    BOOST_REQUIRE(select(timestamp_of(std::chrono::seconds(300)), timestamp_of(std::chrono::seconds(900))) == std::unordered_set<int64_t>({2}));
+    BOOST_REQUIRE_EQUAL(set.select(query::full_partition_range).size(), candidates.size());
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(partitioned_sstable_set_test) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    auto keys = token_generation_for_current_shard(8);
+    auto make_sst = [&] (int64_t gen, unsigned first, unsigned last) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+        sstables::test(sst).set_values(keys[first].first, keys[last].first, {});
+        return sst;
+    };
+    auto select = [&] (const sstables::sstable_set& set, unsigned key) {
+        std::set<int64_t> gens;
+        for (auto& sst : set.select(query::partition_range::make_singular(dht::ring_position::starting_at(keys[key].second)))) {
+            gens.insert(sst->generation());
+        }
+        return gens;
+    };
+
+    auto set = make_compaction_strategy(compaction_strategy_type::leveled, s->compaction_strategy_options()).make_sstable_set(s);
+    // A level of disjoint sstables, and an overlapping one.
+    auto sst1 = make_sst(1, 0, 1);
+    auto sst2 = make_sst(2, 2, 3);
+    auto sst3 = make_sst(3, 4, 7);
+    set.insert(sst1);
+    set.insert(sst2);
+    set.insert(sst3);
+    set.insert(make_sst(4, 1, 5));
+    BOOST_REQUIRE(select(set, 0) == std::set<int64_t>({1}));
+    BOOST_REQUIRE(select(set, 3) == std::set<int64_t>({2, 4}));
+    BOOST_REQUIRE(select(set, 6) == std::set<int64_t>({3}));
+    BOOST_REQUIRE_EQUAL(set.select(query::full_partition_range).size(), 4u);
+
+    // Replace sst2 and sst3 in a copy, as compaction does; the original
+    // set must not see it.
+    auto copy = set;
+    copy.insert(make_sst(5, 2, 7));
+    copy.erase(sst2);
+    copy.erase(sst3);
+    BOOST_REQUIRE(select(copy, 3) == std::set<int64_t>({4, 5}));
+    BOOST_REQUIRE(select(copy, 6) == std::set<int64_t>({5}));
+    BOOST_REQUIRE_EQUAL(copy.all()->size(), 3u);
+    BOOST_REQUIRE(select(set, 3) == std::set<int64_t>({2, 4}));
+    BOOST_REQUIRE(select(set, 6) == std::set<int64_t>({3}));
+    BOOST_REQUIRE_EQUAL(set.all()->size(), 4u);
+
+    // Updating the old set doesn't affect the newer copy either.
+    set.erase(sst1);
+    BOOST_REQUIRE(select(set, 0).empty());
+    BOOST_REQUIRE(select(copy, 0) == std::set<int64_t>({1}));
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(sstable_set_read_start_test) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    auto keys = token_generation_for_current_shard(4);
+    auto dk = [&] (unsigned i) {
+        return dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, to_bytes(keys[i].first)));
+    };
+    auto make_sst = [&] (int64_t gen, unsigned first, unsigned last) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+        sstables::test(sst).set_values(keys[first].first, keys[last].first, {});
+        return sst;
+    };
+
+    auto set = make_compaction_strategy(compaction_strategy_type::leveled, s->compaction_strategy_options()).make_sstable_set(s);
+    auto sst1 = make_sst(1, 0, 3);
+    auto sst2 = make_sst(2, 0, 3);
+    set.insert(sst1);
+    set.insert(sst2);
+    BOOST_REQUIRE(!set.read_start(sst1));
+
+    // Open a compaction output early in a copy, as column_family does;
+    // readers of the original set keep reading all of sst1.
+    auto copy = set;
+    copy.insert(make_sst(3, 0, 1));
+    copy.set_read_start(sst1, dk(1));
+    BOOST_REQUIRE(copy.read_start(sst1));
+    BOOST_REQUIRE(copy.read_start(sst1)->equal(*s, dk(1)));
+    BOOST_REQUIRE(!copy.read_start(sst2));
+    BOOST_REQUIRE(!set.read_start(sst1));
+
+    // Moving the start forward in a further copy leaves the previous one alone.
+    auto copy2 = copy;
+    copy2.set_read_start(sst1, dk(2));
+    BOOST_REQUIRE(copy2.read_start(sst1)->equal(*s, dk(2)));
+    BOOST_REQUIRE(copy.read_start(sst1)->equal(*s, dk(1)));
+
+    // Removing the sstable drops its start.
+    copy2.erase(sst1);
+    BOOST_REQUIRE(!copy2.read_start(sst1));
+    BOOST_REQUIRE(copy.read_start(sst1));
+
+    copy.clear_read_start(sst1);
+    BOOST_REQUIRE(!copy.read_start(sst1));
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(split_for_compaction_test) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    auto keys = token_generation_for_current_shard(16);
+    std::vector<shared_sstable> sstables;
+    for (auto i : { 0, 5, 10 }) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", i + 1, la, big);
+        sstables::test(sst).set_values(keys[i].first, keys[i + 5].first, {});
+        sstables.push_back(sst);
+    }
+
+    BOOST_REQUIRE_EQUAL(sstables::split_for_compaction(*s, sstables, 1).size(), 1u);
+    auto ranges = sstables::split_for_compaction(*s, sstables, 6);
+    BOOST_REQUIRE_EQUAL(ranges.size(), 4u);
+    BOOST_REQUIRE(!ranges.front().start());
+    BOOST_REQUIRE(!ranges.back().end());
+    // Every key falls into exactly one of the ranges.
+    for (auto& k : keys) {
+        auto rp = dht::ring_position::starting_at(k.second);
+        auto n = boost::count_if(ranges, [&] (const query::partition_range& r) {
+            return r.contains(rp, dht::ring_position_comparator(*s));
+        });
+        BOOST_REQUIRE_EQUAL(n, 1);
+    }
+
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_promoted_index_read) {
     // create table promoted_index_read (
     //        pk int,
@@ -2878,3 +3273,291 @@ SEASTAR_TEST_CASE(test_promoted_index_read) {
                 .produces_end_of_stream();
     });
 }
+
+SEASTAR_TEST_CASE(test_promoted_index_sliced_read) {
+    // Same sstable as in test_promoted_index_read. Slices should be read
+    // starting from the promoted index block which may contain them.
+    return seastar::async([] {
+        auto s = schema_builder("ks", "promoted_index_read")
+                .with_column("pk", int32_type, column_kind::partition_key)
+                .with_column("ck1", int32_type, column_kind::clustering_key)
+                .with_column("ck2", int32_type, column_kind::clustering_key)
+                .with_column("v", int32_type)
+                .build();
+
+        auto sst = make_lw_shared<sstable>("ks", "promoted_index_read", "tests/sstables/promoted_index_read", 1, sstables::sstable::version_types::ka, big);
+        sst->load().get0();
+
+        auto pk = partition_key::from_single_value(*s, int32_type->decompose(0));
+        auto key = sstables::key::from_partition_key(*s, pk);
+        auto ck = clustering_key_prefix::from_exploded(*s, { int32_type->decompose(0), int32_type->decompose(1) });
+        auto ps = partition_slice_builder(*s)
+                .with_range(query::clustering_range::make_singular(ck))
+                .build();
+        auto ck_filtering = query::clustering_key_filtering_context::create(s, ps);
+
+        auto smopt = sst->read_row(s, key, ck_filtering).get0();
+        BOOST_REQUIRE(smopt);
+
+        using kind = mutation_fragment::kind;
+        assert_that_stream(std::move(*smopt))
+                .produces(kind::range_tombstone, { 0 })
+                .produces(kind::clustering_row, { 0, 1 })
+                .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_blocked_bloom_filter_round_trip) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+        auto mt = make_lw_shared<memtable>(s);
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        std::vector<partition_key> keys;
+        for (auto i = 0; i < 100; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            mutation m(key, s);
+            m.set_clustered_cell(clustering_key::from_exploded(*s, {to_bytes("c")}), r1_col, make_atomic_cell(int32_type->decompose(i)));
+            mt->apply(std::move(m));
+            keys.push_back(std::move(key));
+        }
+
+        auto tmp = make_lw_shared<tmpdir>();
+        sstables::set_filter_layout(utils::filter_layout::blocked);
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        sstables::set_filter_layout(utils::filter_layout::classic);
+
+        auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        loaded->load().get();
+        for (auto&& key : keys) {
+            BOOST_REQUIRE(loaded->filter_has_key(*s, key));
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_chunk_cache_hit_on_repeated_read) {
+    return seastar::async([] {
+        auto& cc = sstables::global_chunk_cache();
+        cc.set_capacity(1 << 20);
+        auto s = schema_builder(some_keyspace, some_column_family)
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("r1", int32_type)
+                .set_compressor_params(compressor::lz4)
+                .build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto mt = make_lw_shared<memtable>(s);
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m(key, s);
+        m.set_clustered_cell(clustering_key::make_empty(), r1_col, make_atomic_cell(int32_type->decompose(1)));
+        mt->apply(m);
+
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        loaded->load().get();
+
+        auto read = [&] {
+            auto mopt = mutation_from_streamed_mutation(loaded->read_row(s, sstables::key::from_partition_key(*s, key)).get0()).get0();
+            BOOST_REQUIRE(mopt);
+            BOOST_REQUIRE_EQUAL(*mopt, m);
+        };
+
+        auto hits = cc.get_stats().hits;
+        read();
+        BOOST_REQUIRE_EQUAL(cc.get_stats().hits, hits);
+        read();
+        BOOST_REQUIRE(cc.get_stats().hits > hits);
+
+        // Entries go away together with the sstable.
+        auto entries = cc.get_stats().entries;
+        BOOST_REQUIRE(entries > 0);
+        loaded = {};
+        BOOST_REQUIRE(cc.get_stats().entries < entries);
+    });
+}
+
+SEASTAR_TEST_CASE(test_auto_chunk_length_follows_read_sizes) {
+    return seastar::async([] {
+        compression_parameters cp({
+            { compression_parameters::SSTABLE_COMPRESSION, "LZ4Compressor" },
+            { compression_parameters::CHUNK_LENGTH_KB, compression_parameters::AUTO_CHUNK_LENGTH },
+        });
+        BOOST_REQUIRE(cp.auto_chunk_length());
+        BOOST_REQUIRE(compression_parameters(cp.get_options()) == cp);
+
+        sstables::table_read_sizes sizes;
+        BOOST_REQUIRE_EQUAL(sizes.chunk_length(16 * 1024), 16 * 1024);
+        for (unsigned i = 0; i < sstables::table_read_sizes::min_reads; i++) {
+            sizes.add_read(200, 16 * 1024);
+        }
+        BOOST_REQUIRE_EQUAL(sizes.chunk_length(16 * 1024), sstables::table_read_sizes::min_chunk_length);
+        for (unsigned i = 0; i < 2 * sstables::table_read_sizes::min_reads; i++) {
+            sizes.add_read(10000, 16 * 1024);
+        }
+        BOOST_REQUIRE_EQUAL(sizes.chunk_length(4 * 1024), 16 * 1024);
+        for (unsigned i = 0; i < 4 * sstables::table_read_sizes::min_reads; i++) {
+            sizes.add_read(10 << 20, 10 << 20);
+        }
+        BOOST_REQUIRE_EQUAL(sizes.chunk_length(4 * 1024), sstables::table_read_sizes::max_chunk_length);
+
+        // Reads done for queries are accounted to the table.
+        auto s = schema_builder("ks", "auto_chunk_length")
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("r1", int32_type)
+                .set_compressor_params(cp)
+                .build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto mt = make_lw_shared<memtable>(s);
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m(key, s);
+        m.set_clustered_cell(clustering_key::make_empty(), r1_col, make_atomic_cell(int32_type->decompose(1)));
+        mt->apply(m);
+
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "auto_chunk_length", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        auto loaded = make_lw_shared<sstable>("ks", "auto_chunk_length", tmp->path, 1, la, big);
+        loaded->load().get();
+
+        auto table_sizes = sstables::local_table_read_sizes("ks", "auto_chunk_length");
+        auto returned = table_sizes->bytes_returned();
+        auto mopt = mutation_from_streamed_mutation(loaded->read_row(s, sstables::key::from_partition_key(*s, key)).get0()).get0();
+        BOOST_REQUIRE(mopt);
+        BOOST_REQUIRE_EQUAL(*mopt, m);
+        BOOST_REQUIRE(table_sizes->bytes_returned() > returned);
+        BOOST_REQUIRE(table_sizes->bytes_decompressed() >= table_sizes->bytes_returned());
+    });
+}
+
+SEASTAR_TEST_CASE(test_summary_downsampling_and_upsampling) {
+    return seastar::async([] {
+        auto builder = schema_builder(some_keyspace, some_column_family)
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("r1", int32_type);
+        builder.set_min_index_interval(1);
+        auto s = builder.build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto mt = make_lw_shared<memtable>(s);
+        std::vector<mutation> mutations;
+        for (auto i = 0; i < 1000; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            mutation m(key, s);
+            m.set_clustered_cell(clustering_key::make_empty(), r1_col, make_atomic_cell(int32_type->decompose(i)));
+            mt->apply(m);
+            mutations.push_back(std::move(m));
+        }
+
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        loaded->load().get();
+
+        auto verify_reads = [&] {
+            for (auto&& m : mutations) {
+                auto mopt = mutation_from_streamed_mutation(loaded->read_row(s, sstables::key::from_partition_key(*s, m.key())).get0()).get0();
+                BOOST_REQUIRE(mopt);
+                BOOST_REQUIRE_EQUAL(*mopt, m);
+            }
+        };
+
+        auto full_entries = loaded->get_summary().entries.size();
+        auto full_footprint = loaded->get_summary().memory_footprint();
+        BOOST_REQUIRE_EQUAL(loaded->summary_sampling_level(), downsampling::BASE_SAMPLING_LEVEL);
+        BOOST_REQUIRE_EQUAL(full_entries, 1000);
+
+        loaded->resample_summary(downsampling::BASE_SAMPLING_LEVEL / 4, default_priority_class()).get();
+        BOOST_REQUIRE_EQUAL(loaded->summary_sampling_level(), downsampling::BASE_SAMPLING_LEVEL / 4);
+        BOOST_REQUIRE_EQUAL(loaded->get_summary().header.size, loaded->get_summary().entries.size());
+        BOOST_REQUIRE(loaded->get_summary().entries.size() <= full_entries / 4 + 1);
+        BOOST_REQUIRE(loaded->get_summary().memory_footprint() < full_footprint);
+        verify_reads();
+
+        loaded->resample_summary(downsampling::BASE_SAMPLING_LEVEL, default_priority_class()).get();
+        BOOST_REQUIRE_EQUAL(loaded->summary_sampling_level(), downsampling::BASE_SAMPLING_LEVEL);
+        BOOST_REQUIRE_EQUAL(loaded->get_summary().entries.size(), full_entries);
+        verify_reads();
+    });
+}
+
+SEASTAR_TEST_CASE(test_index_summary_redistribution_follows_reads) {
+    using summary_stats = sstables::index_summary_manager::summary_stats;
+    constexpr int base = downsampling::BASE_SAMPLING_LEVEL;
+    auto size_at = [] (const summary_stats& s, int level) {
+        return s.full_size * level / base;
+    };
+
+    std::vector<summary_stats> summaries = {
+        { 128 * 1024, 1000, 16, base, base },
+        { 128 * 1024, 0, 16, base, base },
+        { 128 * 1024, 10, 16, base, base },
+    };
+    size_t capacity = 192 * 1024;
+    auto levels = sstables::index_summary_manager::compute_sampling_levels(capacity, summaries);
+    BOOST_REQUIRE_EQUAL(levels.size(), summaries.size());
+    BOOST_REQUIRE(levels[0] > levels[2]);
+    BOOST_REQUIRE(levels[2] > levels[1]);
+    size_t used = 0;
+    for (size_t i = 0; i < summaries.size(); ++i) {
+        BOOST_REQUIRE(levels[i] >= summaries[i].min_sampling_level);
+        BOOST_REQUIRE(levels[i] <= summaries[i].max_sampling_level);
+        used += size_at(summaries[i], levels[i]);
+    }
+    BOOST_REQUIRE(used <= capacity);
+
+    // With enough memory, everything stays at full sampling.
+    levels = sstables::index_summary_manager::compute_sampling_levels(3 * 128 * 1024, summaries);
+    BOOST_REQUIRE(boost::algorithm::all_of(levels, [] (int l) { return l == base; }));
+
+    // Never below the minimum, even if it doesn't fit.
+    levels = sstables::index_summary_manager::compute_sampling_levels(0, summaries);
+    BOOST_REQUIRE(boost::algorithm::all_of(levels, [] (int l) { return l == 16; }));
+
+    // Small increases of the sampling level don't trigger upsampling.
+    summaries = { { 128 * 1024, 1000, 16, base, 100 } };
+    levels = sstables::index_summary_manager::compute_sampling_levels(128 * 1024, summaries);
+    BOOST_REQUIRE_EQUAL(levels[0], 100);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_large_partitions_are_reported) {
+    return seastar::async([] {
+        auto s = schema_builder(some_keyspace, some_column_family)
+                .with_column("p1", utf8_type, column_kind::partition_key)
+                .with_column("c1", int32_type, column_kind::clustering_key)
+                .with_column("r1", bytes_type)
+                .build();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto mt = make_lw_shared<memtable>(s);
+        auto add = [&] (sstring key, int rows) {
+            mutation m(partition_key::from_exploded(*s, {to_bytes(key)}), s);
+            for (auto i = 0; i < rows; i++) {
+                m.set_clustered_cell(clustering_key::from_exploded(*s, {int32_type->decompose(i)}), r1_col,
+                        make_atomic_cell(bytes(1024, int8_t(i))));
+            }
+            mt->apply(std::move(m));
+        };
+        add("small", 1);
+        add("large", 100);
+
+        std::vector<std::pair<partition_key, uint64_t>> reported;
+        sstables::set_large_partition_handler(64 * 1024, [&] (const sstable&, const schema& s, const sstables::key& k, uint64_t size, uint64_t rows) {
+            BOOST_REQUIRE(size > 100 * 1024);
+            reported.emplace_back(k.to_partition_key(s), rows);
+        });
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        sstables::set_large_partition_handler(0, {});
+
+        BOOST_REQUIRE_EQUAL(reported.size(), 1);
+        BOOST_REQUIRE(reported[0].first.equal(*s, partition_key::from_exploded(*s, {to_bytes("large")})));
+        BOOST_REQUIRE_EQUAL(reported[0].second, 100);
+    });
+}
@@ -27,6 +27,9 @@
 #include "sstables/key.hh"
 #include "core/do_with.hh"
 #include "core/thread.hh"
+#include <boost/range/irange.hpp>
+#include <boost/range/algorithm/sort.hpp>
+#include <seastar/util/defer.hh>
 #include "database.hh"
 #include "timestamp.hh"
 #include "schema_builder.hh"
@@ -34,6 +37,7 @@
 #include "mutation_reader_assertions.hh"
 #include "mutation_source_test.hh"
 #include "tmpdir.hh"
+#include "partition_slice_builder.hh"
 
 #include "disk-error-handler.hh"
 
@@ -94,6 +98,74 @@ SEASTAR_TEST_CASE(uncompressed_4) {
     return test_no_clustered("finna", {{ "col1", to_sstring("daughter") }, { "col2", 2 }});
 }
 
+SEASTAR_TEST_CASE(test_key_cache_hit_on_repeated_read) {
+    return seastar::async([] {
+        auto& kc = sstables::global_key_cache();
+        kc.set_capacity(1 << 20);
+        auto sstp = reusable_sst("tests/sstables/uncompressed", 1).get0();
+        auto s = uncompressed_schema();
+        auto key = sstables::key(to_bytes("vinna"));
+
+        auto read = [&] {
+            auto mutation = mutation_from_streamed_mutation(sstp->read_row(s, key).get0()).get0();
+            BOOST_REQUIRE(mutation);
+            return std::move(*mutation);
+        };
+
+        auto hits = kc.get_stats().hits;
+        auto m1 = read();
+        BOOST_REQUIRE_EQUAL(kc.get_stats().hits, hits);
+        auto m2 = read();
+        BOOST_REQUIRE_EQUAL(kc.get_stats().hits, hits + 1);
+        BOOST_REQUIRE_EQUAL(m1, m2);
+
+        // Entries go away together with the sstable.
+        auto entries = kc.get_stats().entries;
+        BOOST_REQUIRE(entries > 0);
+        sstp = {};
+        BOOST_REQUIRE(kc.get_stats().entries < entries);
+    });
+}
+
+SEASTAR_TEST_CASE(test_lazy_filter_loading_and_eviction) {
+    return seastar::async([] {
+        auto& fc = sstables::global_filter_cache();
+        fc.set_capacity(1);
+        auto restore = defer([&fc] { fc.set_capacity(0); });
+        auto s = uncompressed_schema();
+        auto key = sstables::key(to_bytes("vinna"));
+
+        auto sst1 = reusable_sst("tests/sstables/uncompressed", 1).get0();
+        auto sst2 = reusable_sst("tests/sstables/uncompressed", 1).get0();
+        BOOST_REQUIRE_EQUAL(sst1->filter_memory_size(), 0);
+        BOOST_REQUIRE_EQUAL(sst2->filter_memory_size(), 0);
+
+        auto read = [&] (sstables::shared_sstable sst) {
+            auto mutation = mutation_from_streamed_mutation(sst->read_row(s, key).get0()).get0();
+            BOOST_REQUIRE(mutation);
+        };
+
+        auto loads = fc.get_stats().loads;
+        read(sst1);
+        BOOST_REQUIRE(sst1->filter_memory_size() > 0);
+        BOOST_REQUIRE_EQUAL(fc.get_stats().loads, loads + 1);
+        read(sst1);
+        BOOST_REQUIRE_EQUAL(fc.get_stats().loads, loads + 1);
+
+        // Both filters don't fit, the least recently used one goes.
+        auto evictions = fc.get_stats().evictions;
+        read(sst2);
+        BOOST_REQUIRE(sst2->filter_memory_size() > 0);
+        BOOST_REQUIRE_EQUAL(sst1->filter_memory_size(), 0);
+        BOOST_REQUIRE_EQUAL(fc.get_stats().evictions, evictions + 1);
+
+        // An evicted filter is loaded again by the next read.
+        read(sst1);
+        BOOST_REQUIRE(sst1->filter_memory_size() > 0);
+        BOOST_REQUIRE_EQUAL(sst2->filter_memory_size(), 0);
+    });
+}
+
 /*
  *
  * insert into todata.complex_schema (key, clust1, clust2, reg_set, reg, static_obj) values ('key1', 'cl1.1', 'cl2.1', { '1', '2' }, 'v1', 'static_value');
@@ -387,6 +459,151 @@ SEASTAR_TEST_CASE(test_sstable_conforms_to_mutation_source) {
     });
 }
 
+SEASTAR_TEST_CASE(test_compact_sstable_conforms_to_mutation_source) {
+    return seastar::async([] {
+        std::vector<tmpdir> dirs;
+
+        run_mutation_source_tests([&dirs] (schema_ptr s, const std::vector<mutation>& partitions) -> mutation_source {
+            tmpdir sstable_dir;
+            auto sst = make_lw_shared<sstables::sstable>("ks", "cf",
+                sstable_dir.path,
+                1 /* generation */,
+                sstables::sstable::version_types::sa,
+                sstables::sstable::format_types::big);
+            dirs.emplace_back(std::move(sstable_dir));
+
+            auto mt = make_lw_shared<memtable>(s);
+
+            for (auto&& m : partitions) {
+                mt->apply(m);
+            }
+
+            sst->write_components(*mt).get();
+            sst->load().get();
+
+            return as_mutation_source(sst);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_compact_sstable_is_smaller) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, "ks", "cf",
+            {{"p1", utf8_type}}, {{"c1", int32_type}, {"c2", int32_type}}, {{"r1", int32_type}, {"r2", utf8_type}}, {}, utf8_type));
+
+        auto mt = make_lw_shared<memtable>(s);
+        std::vector<mutation> muts;
+        api::timestamp_type ts = api::new_timestamp();
+        for (auto i : boost::irange(0, 10)) {
+            mutation m(partition_key::from_exploded(*s, {to_bytes(sprint("key%d", i))}), s);
+            for (auto j : boost::irange(0, 100)) {
+                auto ck = clustering_key::from_exploded(*s, {int32_type->decompose(i), int32_type->decompose(j)});
+                m.set_clustered_cell(ck, "r1", data_value(j), ts + j);
+                m.set_clustered_cell(ck, "r2", data_value(sstring("value")), ts + j);
+            }
+            mt->apply(m);
+            muts.push_back(std::move(m));
+        }
+        boost::sort(muts, mutation_decorated_key_less_comparator());
+
+        auto write = [&] (sstables::sstable::version_types version, tmpdir& dir) {
+            auto sst = make_lw_shared<sstables::sstable>("ks", "cf", dir.path, 1, version, sstables::sstable::format_types::big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            return sst;
+        };
+        tmpdir la_dir, sa_dir;
+        auto la_sst = write(sstables::sstable::version_types::la, la_dir);
+        auto sa_sst = write(sstables::sstable::version_types::sa, sa_dir);
+        BOOST_REQUIRE_LT(sa_sst->data_size() * 3, la_sst->data_size() * 2);
+
+        assert_that(as_mutation_reader(sa_sst, sa_sst->read_rows(s)))
+            .produces(muts)
+            .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_partition_index_finds_partitions) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, "ks", "cf",
+            {{"p1", utf8_type}}, {{"c1", int32_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        // Enough partitions for the trie to span several pages.
+        auto mt = make_lw_shared<memtable>(s);
+        std::vector<mutation> muts;
+        for (auto i : boost::irange(0, 3000)) {
+            mutation m(partition_key::from_exploded(*s, {to_bytes(sprint("key%d", i))}), s);
+            auto ck = clustering_key::from_exploded(*s, {int32_type->decompose(i)});
+            m.set_clustered_cell(ck, "r1", data_value(i), api::new_timestamp());
+            mt->apply(m);
+            muts.push_back(std::move(m));
+        }
+
+        tmpdir dir;
+        auto sst = make_lw_shared<sstables::sstable>("ks", "cf", dir.path, 1,
+                sstables::sstable::version_types::sa, sstables::sstable::format_types::big);
+        sst->write_components(*mt).get();
+        sst->load().get();
+        auto index_name = sstables::sstable::filename(dir.path, "ks", "cf", sstables::sstable::version_types::sa, 1,
+                sstables::sstable::format_types::big, sstables::sstable::component_type::PartitionIndex);
+        BOOST_REQUIRE(engine().file_exists(index_name).get0());
+
+        for (auto&& m : muts) {
+            auto key = sstables::key::from_partition_key(*s, m.key());
+            auto mut = mutation_from_streamed_mutation(sst->read_row(s, key).get0()).get0();
+            BOOST_REQUIRE(mut);
+            BOOST_REQUIRE_EQUAL(*mut, m);
+        }
+        for (auto i : boost::irange(3000, 4000)) {
+            auto key = sstables::key::from_partition_key(*s, partition_key::from_exploded(*s, {to_bytes(sprint("key%d", i))}));
+            BOOST_REQUIRE(!sst->read_row(s, key).get0());
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_column_projection_drops_unselected_values) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, "ks", "cf",
+            {{"p1", utf8_type}}, {{"c1", int32_type}}, {{"r1", int32_type}, {"r2", utf8_type}}, {}, utf8_type));
+
+        auto pk = partition_key::from_exploded(*s, {to_bytes("key1")});
+        auto ck = clustering_key::from_exploded(*s, {int32_type->decompose(1)});
+        mutation m(pk, s);
+        m.set_clustered_cell(ck, "r1", data_value(1), 1);
+        m.set_clustered_cell(ck, "r2", data_value(sstring("a long value which isn't selected")), 2);
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m);
+
+        tmpdir dir;
+        auto sst = make_lw_shared<sstables::sstable>("ks", "cf", dir.path, 1,
+                sstables::sstable::version_types::la, sstables::sstable::format_types::big);
+        sst->write_components(*mt).get();
+        sst->load().get();
+
+        auto ps = partition_slice_builder(*s).with_regular_column("r1").build();
+        auto ck_filtering = query::clustering_key_filtering_context::create(s, ps).with_column_projection(*s, ps);
+        auto key = sstables::key::from_partition_key(*s, pk);
+        auto mut = mutation_from_streamed_mutation(sst->read_row(s, key, ck_filtering).get0()).get0();
+        BOOST_REQUIRE(mut);
+
+        auto& row = mut->partition().clustered_row(ck).cells();
+        auto r1 = row.find_cell(s->get_column_definition("r1")->id);
+        BOOST_REQUIRE(r1);
+        BOOST_REQUIRE(r1->as_atomic_cell().value() == bytes_view(int32_type->decompose(1)));
+        // The unselected cell is still there, for liveness, but without its value.
+        auto r2 = row.find_cell(s->get_column_definition("r2")->id);
+        BOOST_REQUIRE(r2);
+        BOOST_REQUIRE(r2->as_atomic_cell().is_live());
+        BOOST_REQUIRE_EQUAL(r2->as_atomic_cell().timestamp(), 2);
+        BOOST_REQUIRE(r2->as_atomic_cell().value().empty());
+
+        // Without the projection, everything is read.
+        mut = mutation_from_streamed_mutation(sst->read_row(s, key).get0()).get0();
+        BOOST_REQUIRE(mut);
+        BOOST_REQUIRE_EQUAL(*mut, m);
+    });
+}
+
 SEASTAR_TEST_CASE(test_sstable_can_write_and_read_range_tombstone) {
     return seastar::async([] {
         auto dir = make_lw_shared<tmpdir>();
@@ -28,8 +28,11 @@
 #include "core/align.hh"
 #include "core/do_with.hh"
 #include "core/sleep.hh"
+#include "core/thread.hh"
 #include "sstables/sstables.hh"
 #include "sstables/key.hh"
+#include "sstables/adaptive_input_stream.hh"
+#include "sstables/io_buffer_pool.hh"
 #include "tests/test-utils.hh"
 #include "schema.hh"
 #include "compress.hh"
@@ -947,3 +950,110 @@ SEASTAR_TEST_CASE(statistics_rewrite) {
         });
     }, "tests/sstables/generation");
 }
+
+SEASTAR_TEST_CASE(adaptive_input_stream_reads_exact_range) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto name = tmp.path + "/data";
+        constexpr size_t file_size = 1 << 20;
+        auto f = open_file_dma(name, open_flags::rw | open_flags::create).get0();
+        auto buf = temporary_buffer<char>::aligned(4096, file_size);
+        for (size_t i = 0; i < file_size; ++i) {
+            buf.get_write()[i] = char(i * 7 + i / 4096);
+        }
+        f.dma_write(0, buf.get(), buf.size()).get();
+        f.flush().get();
+
+        struct range {
+            uint64_t pos;
+            uint64_t len;
+        };
+        for (auto r : { range{0, file_size}, range{0, 1}, range{4095, 2}, range{1000, 300000}, range{file_size - 5000, 5000} }) {
+            for (size_t initial : { size_t(1), size_t(4096), size_t(10000), size_t(128 * 1024) }) {
+                sstables::adaptive_read_options options;
+                options.initial_buffer_size = initial;
+                options.max_buffer_size = 64 * 1024;
+                options.max_read_ahead = 3;
+                auto in = sstables::make_adaptive_file_input_stream(f, r.pos, r.len, options);
+                auto data = in.read_exactly(r.len).get0();
+                BOOST_REQUIRE_EQUAL(data.size(), r.len);
+                BOOST_REQUIRE(std::equal(data.begin(), data.end(), buf.get() + r.pos));
+                BOOST_REQUIRE(in.read().get0().empty());
+                in.close().get();
+            }
+        }
+
+        // A reader which stops early leaves reads in flight behind.
+        auto before = sstables::local_adaptive_read_stats();
+        auto in = sstables::make_adaptive_file_input_stream(f, 0, file_size, sstables::adaptive_read_options());
+        for (int i = 0; i < 3; ++i) {
+            in.read().get();
+        }
+        in.close().get();
+        auto& after = sstables::local_adaptive_read_stats();
+        BOOST_REQUIRE_GT(after.bytes_read - before.bytes_read, after.bytes_used - before.bytes_used);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(pooled_dma_read_reads_exact_range) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto name = tmp.path + "/data";
+        constexpr size_t file_size = 100000;
+        auto f = open_file_dma(name, open_flags::rw | open_flags::create).get0();
+        auto buf = temporary_buffer<char>::aligned(4096, align_up<size_t>(file_size, 4096));
+        for (size_t i = 0; i < buf.size(); ++i) {
+            buf.get_write()[i] = char(i * 7 + i / 4096);
+        }
+        f.dma_write(0, buf.get(), buf.size()).get();
+        f.truncate(file_size).get();
+        f.flush().get();
+
+        auto& pool = sstables::local_io_buffer_pool();
+        struct range {
+            uint64_t pos;
+            uint64_t len;
+        };
+        for (auto r : { range{0, 4096}, range{1, 1}, range{4095, 2}, range{1000, 70000}, range{file_size - 5000, 10000}, range{file_size, 100} }) {
+            auto data = sstables::pooled_dma_read(f, r.pos, r.len, default_priority_class()).get0();
+            auto expected = std::min<uint64_t>(r.len, file_size - r.pos);
+            BOOST_REQUIRE_EQUAL(data.size(), expected);
+            BOOST_REQUIRE(std::equal(data.begin(), data.end(), buf.get() + r.pos));
+        }
+
+        // Released buffers are reused.
+        auto hits = pool.get_stats().hits;
+        sstables::pooled_dma_read(f, 0, 4096, default_priority_class()).get();
+        BOOST_REQUIRE_EQUAL(pool.get_stats().hits, hits + 1);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(cardinality_round_trip) {
+    return seastar::async([] {
+        auto make_sketch = [] (uint64_t first, uint64_t count) {
+            sstables::metadata_collector c;
+            for (auto i = first; i < first + count; ++i) {
+                auto key = to_bytes(sprint("key%d", i));
+                c.add_key(bytes_view(key));
+            }
+            sstables::compaction_metadata m;
+            c.construct_compaction(m);
+            temporary_buffer<uint8_t> buf(m.cardinality.elements.size());
+            std::copy(m.cardinality.elements.begin(), m.cardinality.elements.end(), buf.get_write());
+            return hll::HyperLogLog::from_bytes(buf);
+        };
+        auto a = make_sketch(0, 100000);
+        auto b = make_sketch(50000, 100000);
+        BOOST_REQUIRE_EQUAL(a.registerSize(), 1u << sstables::metadata_collector::cardinality_precision);
+        a.merge(b);
+        // 150000 distinct keys, 2^13 registers have a standard error of ~1.2%.
+        BOOST_REQUIRE_GT(a.estimate(), 150000 * 0.95);
+        BOOST_REQUIRE_LT(a.estimate(), 150000 * 1.05);
+
+        temporary_buffer<uint8_t> garbage(10);
+        std::fill_n(garbage.get_write(), garbage.size(), 0);
+        BOOST_REQUIRE_THROW(hll::HyperLogLog::from_bytes(garbage), std::runtime_error);
+    });
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "utils/tournament_tree.hh"
+
+struct sources {
+    std::vector<std::deque<int>> lists;
+    size_t comparisons = 0;
+
+    struct less {
+        sources* s;
+        bool operator()(size_t a, size_t b) const {
+            ++s->comparisons;
+            return s->lists[a].front() < s->lists[b].front();
+        }
+    };
+};
+
+static std::vector<int> merge(sources& src) {
+    tournament_tree<sources::less> tree(src.lists.size(), sources::less{&src});
+    for (size_t i = 0; i < src.lists.size(); i++) {
+        if (!src.lists[i].empty()) {
+            tree.push(i);
+        }
+    }
+    std::vector<int> out;
+    while (!tree.empty()) {
+        auto i = tree.top();
+        out.push_back(src.lists[i].front());
+        src.lists[i].pop_front();
+        tree.pop();
+        if (!src.lists[i].empty()) {
+            tree.push(i);
+        }
+    }
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(test_merge_is_sorted) {
+    std::mt19937 rnd(1234);
+    for (size_t n : { 0, 1, 2, 3, 5, 8, 13, 32 }) {
+        sources src;
+        std::vector<int> expected;
+        src.lists.resize(n);
+        for (auto& l : src.lists) {
+            std::vector<int> v(std::uniform_int_distribution<int>(0, 50)(rnd));
+            for (auto& e : v) {
+                e = std::uniform_int_distribution<int>(0, 100)(rnd);
+            }
+            std::sort(v.begin(), v.end());
+            l.assign(v.begin(), v.end());
+            expected.insert(expected.end(), v.begin(), v.end());
+        }
+        std::sort(expected.begin(), expected.end());
+        BOOST_REQUIRE(merge(src) == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_leading_source_costs_one_comparison) {
+    sources src;
+    src.lists.resize(32);
+    for (int i = 0; i < 32; i++) {
+        src.lists[i].push_back(1000 + i);
+    }
+    for (int i = 0; i < 100; i++) {
+        src.lists[7].push_front(99 - i);
+    }
+    auto out = merge(src);
+    BOOST_REQUIRE(std::is_sorted(out.begin(), out.end()));
+    BOOST_REQUIRE_EQUAL(out.size(), 132);
+    // Building the tree takes n * log(n) comparisons at most, then each of
+    // the 100 leading elements takes one, then the remaining 32 log(n) each.
+    BOOST_REQUIRE_LE(src.comparisons, 32 * 5 + 100 + 32 * 5 + 1);
+}
+
+// Takes all sources with the smallest head at once and puts them back
+// together afterwards, like combined_reader does.
+BOOST_AUTO_TEST_CASE(test_merge_in_groups_of_equal_heads) {
+    std::mt19937 rnd(4321);
+    for (size_t n : { 1, 2, 4, 7, 16 }) {
+        sources src;
+        src.lists.resize(n);
+        for (auto& l : src.lists) {
+            for (int e = 0; e < 100; e++) {
+                if (std::uniform_int_distribution<int>(0, 2)(rnd) == 0) {
+                    l.push_back(e);
+                }
+            }
+        }
+        auto copy = src.lists;
+        std::vector<int> expected;
+        for (auto& l : copy) {
+            expected.insert(expected.end(), l.begin(), l.end());
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+        tournament_tree<sources::less> tree(n, sources::less{&src});
+        for (size_t i = 0; i < n; i++) {
+            if (!src.lists[i].empty()) {
+                tree.push(i);
+            }
+        }
+        std::vector<int> out;
+        std::vector<size_t> taken;
+        while (!tree.empty()) {
+            auto v = src.lists[tree.top()].front();
+            out.push_back(v);
+            while (!tree.empty() && src.lists[tree.top()].front() == v) {
+                taken.push_back(tree.top());
+                tree.pop();
+            }
+            for (auto i : taken) {
+                src.lists[i].pop_front();
+                if (!src.lists[i].empty()) {
+                    tree.push(i);
+                }
+            }
+            taken.clear();
+        }
+        BOOST_REQUIRE(out == expected);
+    }
+}
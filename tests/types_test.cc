@@ -413,6 +413,33 @@ BOOST_AUTO_TEST_CASE(test_utf8_type_validation) {
     test_validation_fails(utf8_type, bytes("test") + from_hex("fe"));
 }
 
+BOOST_AUTO_TEST_CASE(test_utf8_validation_of_long_values) {
+    // Long enough to span several blocks of the vectorised validator.
+    bytes prefix(bytes::initialized_later(), 100);
+    std::fill(prefix.begin(), prefix.end(), 'a');
+    std::vector<sstring> valid = {
+        "7f", "c280", "dfbf", "e0a080", "ed9fbf", "ee8080", "efbfbf", "f0908080", "f48fbfbf",
+    };
+    std::vector<sstring> invalid = {
+        "80", "bf", "c0af", "c1bf", "c2", "c27f", "e080af", "eda080", "edbfbf", "e0a0", "e0a07f",
+        "f08f8080", "f4908080", "f5808080", "f8888080", "ff", "f09080", "f0908080bf",
+    };
+    for (size_t pos = 0; pos < 70; pos++) {
+        auto head = bytes(prefix.begin(), prefix.begin() + pos);
+        auto tail = bytes(prefix.begin(), prefix.begin() + 20);
+        for (auto&& seq : valid) {
+            utf8_type->validate(head + from_hex(seq));
+            utf8_type->validate(head + from_hex(seq) + tail);
+        }
+        for (auto&& seq : invalid) {
+            test_validation_fails(utf8_type, head + from_hex(seq));
+            test_validation_fails(utf8_type, head + from_hex(seq) + tail);
+        }
+        ascii_type->validate(head + tail);
+        test_validation_fails(ascii_type, head + from_hex("80") + tail);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_int32_type_validation) {
     int32_type->validate(bytes());
     int32_type->validate(from_hex("deadbeef"));
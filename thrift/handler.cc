@@ -185,6 +185,32 @@ class thrift_handler : public CassandraCobSvIf {
             return func(std::move(schema));
         });
     }
+    // Reads the columns selected by the predicate from the given partitions,
+    // in the order of the results.
+    future<std::vector<std::pair<std::string, std::vector<ColumnOrSuperColumn>>>>
+    read_slices(schema_ptr schema, const std::vector<std::string>& keys, const ColumnParent& column_parent, const SlicePredicate& predicate, ConsistencyLevel::type consistency_level) {
+        if (!column_parent.super_column.empty()) {
+            fail(unimplemented::cause::SUPER);
+        }
+        auto cmd = slice_pred_to_read_cmd(*schema, predicate);
+        auto cell_limit = predicate.__isset.slice_range ? static_cast<uint32_t>(predicate.slice_range.count) : std::numeric_limits<uint32_t>::max();
+        auto pranges = make_partition_ranges(*schema, keys);
+        auto f = _query_state.get_client_state().has_schema_access(*schema, auth::permission::SELECT);
+        return f.then([schema, cmd, pranges = std::move(pranges), cell_limit, consistency_level]() mutable {
+            return service::get_local_storage_proxy().query(
+                    schema,
+                    cmd,
+                    std::move(pranges),
+                    cl_from_thrift(consistency_level),
+                    nullptr).then([schema, cmd, cell_limit](auto result) {
+                return query::result_view::do_with(*result, [schema, cmd, cell_limit](query::result_view v) {
+                    column_aggregator aggregator(*schema, cmd->slice, cell_limit);
+                    v.consume(cmd->slice, aggregator);
+                    return std::move(aggregator.release());
+                });
+            });
+        });
+    }
 public:
     explicit thrift_handler(distributed<database>& db, distributed<cql3::query_processor>& qp)
         : _db(db)
@@ -225,12 +251,14 @@ class thrift_handler : public CassandraCobSvIf {
     }
 
     void get_slice(tcxx::function<void(std::vector<ColumnOrSuperColumn>  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::string& key, const ColumnParent& column_parent, const SlicePredicate& predicate, const ConsistencyLevel::type consistency_level) {
-        return multiget_slice([cob = std::move(cob)](auto&& results) {
-            if (!results.empty()) {
-                return cob(std::move(results.begin()->second));
-            }
-            return cob({ });
-        }, exn_cob, {key}, column_parent, predicate, consistency_level);
+        with_schema(std::move(cob), std::move(exn_cob), column_parent.column_family, [&](schema_ptr schema) {
+            return read_slices(std::move(schema), {key}, column_parent, predicate, consistency_level).then([](auto&& slices) {
+                if (slices.empty()) {
+                    return std::vector<ColumnOrSuperColumn>();
+                }
+                return std::move(slices.front().second);
+            });
+        });
     }
 
     void get_count(tcxx::function<void(int32_t const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::string& key, const ColumnParent& column_parent, const SlicePredicate& predicate, const ConsistencyLevel::type consistency_level) {
@@ -244,26 +272,10 @@ class thrift_handler : public CassandraCobSvIf {
 
     void multiget_slice(tcxx::function<void(std::map<std::string, std::vector<ColumnOrSuperColumn> >  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::vector<std::string> & keys, const ColumnParent& column_parent, const SlicePredicate& predicate, const ConsistencyLevel::type consistency_level) {
         with_schema(std::move(cob), std::move(exn_cob), column_parent.column_family, [&](schema_ptr schema) {
-            if (!column_parent.super_column.empty()) {
-                fail(unimplemented::cause::SUPER);
-            }
-            auto cmd = slice_pred_to_read_cmd(*schema, predicate);
-            auto cell_limit = predicate.__isset.slice_range ? static_cast<uint32_t>(predicate.slice_range.count) : std::numeric_limits<uint32_t>::max();
-            auto pranges = make_partition_ranges(*schema, keys);
-            auto f = _query_state.get_client_state().has_schema_access(*schema, auth::permission::SELECT);
-            return f.then([schema, cmd, pranges = std::move(pranges), cell_limit, consistency_level]() mutable {
-                return service::get_local_storage_proxy().query(
-                        schema,
-                        cmd,
-                        std::move(pranges),
-                        cl_from_thrift(consistency_level),
-                        nullptr).then([schema, cmd, cell_limit](auto result) {
-                    return query::result_view::do_with(*result, [schema, cmd, cell_limit](query::result_view v) {
-                        column_aggregator aggregator(*schema, cmd->slice, cell_limit);
-                        v.consume(cmd->slice, aggregator);
-                        return aggregator.release_as_map();
-                    });
-                });
+            return read_slices(std::move(schema), keys, column_parent, predicate, consistency_level).then([](auto&& slices) {
+                return std::map<std::string, std::vector<ColumnOrSuperColumn>>(
+                        std::make_move_iterator(slices.begin()),
+                        std::make_move_iterator(slices.end()));
             });
         });
     }
@@ -1417,10 +1429,14 @@ class thrift_handler : public CassandraCobSvIf {
         return ranges;
     }
     static Column make_column(const bytes& col, const query::result_atomic_cell_view& cell) {
+        // The generated setters take their argument by reference and
+        // copy it, assign the fields directly instead.
         Column ret;
-        ret.__set_name(bytes_to_string(col));
-        ret.__set_value(bytes_to_string(cell.value()));
-        ret.__set_timestamp(cell.timestamp());
+        ret.name = bytes_to_string(col);
+        ret.value = bytes_to_string(cell.value());
+        ret.timestamp = cell.timestamp();
+        ret.__isset.value = true;
+        ret.__isset.timestamp = true;
         if (cell.ttl()) {
             ret.__set_ttl(cell.ttl()->count());
         }
@@ -1428,7 +1444,8 @@ class thrift_handler : public CassandraCobSvIf {
     }
     static ColumnOrSuperColumn column_to_column_or_supercolumn(Column&& col) {
         ColumnOrSuperColumn ret;
-        ret.__set_column(std::move(col));
+        ret.column = std::move(col);
+        ret.__isset.column = true;
         return ret;
     }
     static ColumnOrSuperColumn make_column_or_supercolumn(const bytes& col, const query::result_atomic_cell_view& cell) {
@@ -1575,16 +1592,12 @@ class thrift_handler : public CassandraCobSvIf {
         v.consume(slice, aggregator);
         auto&& cols = aggregator.release();
         std::vector<KeySlice> ret;
-        std::transform(
-                std::make_move_iterator(cols.begin()),
-                std::make_move_iterator(cols.end()),
-                boost::back_move_inserter(ret),
-                [](auto&& p) {
-            KeySlice ks;
-            ks.__set_key(std::move(p.first));
-            ks.__set_columns(std::move(p.second));
-            return ks;
-        });
+        ret.reserve(cols.size());
+        for (auto&& p : cols) {
+            ret.emplace_back();
+            ret.back().key = std::move(p.first);
+            ret.back().columns = std::move(p.second);
+        }
         return ret;
     }
     template<typename RangeType, typename Comparator>
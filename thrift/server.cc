@@ -26,6 +26,8 @@
 #include "core/scollectd.hh"
 #include "net/byteorder.hh"
 #include "core/scattered_message.hh"
+#include "core/semaphore.hh"
+#include "core/gate.hh"
 #include "log.hh"
 #include <thrift/server/TServer.h>
 #include <thrift/transport/TBufferTransports.h>
@@ -87,18 +89,41 @@ class thrift_server::connection {
         fake_transport(connection* c) : conn(c) {}
         connection* conn;
     };
+    // Buffers and protocols a single request is read from and its response
+    // is written to. They are recycled through the connection's pool, so
+    // that the output buffer keeps the capacity it grew to for earlier
+    // responses.
+    struct request {
+        boost::shared_ptr<TMemoryBuffer> input = boost::make_shared<TMemoryBuffer>();
+        boost::shared_ptr<TMemoryBuffer> output = boost::make_shared<TMemoryBuffer>();
+        boost::shared_ptr<TProtocol> in_proto;
+        boost::shared_ptr<TProtocol> out_proto;
+        temporary_buffer<char> in_tmp;
+        promise<> processed;
+        explicit request(TProtocolFactory& pf)
+            : in_proto(pf.getProtocol(input)), out_proto(pf.getProtocol(output)) {
+        }
+    };
+    using request_pool = std::vector<std::unique_ptr<request>>;
+    static constexpr uint32_t frame_header_size = 4;
+    static constexpr size_t max_pipelined_requests = 128;
+    static constexpr size_t max_pooled_requests = 16;
+    // Buffers of larger responses are released rather than kept around.
+    static constexpr uint32_t max_pooled_response_size = 1 << 20;
+
     thrift_server& _server;
     connected_socket _fd;
     input_stream<char> _read_buf;
     output_stream<char> _write_buf;
-    temporary_buffer<char> _in_tmp;
     boost::shared_ptr<fake_transport> _transport = boost::make_shared<fake_transport>(this);
-    boost::shared_ptr<TMemoryBuffer> _input = boost::make_shared<TMemoryBuffer>();
-    boost::shared_ptr<TMemoryBuffer> _output = boost::make_shared<TMemoryBuffer>();
-    boost::shared_ptr<TProtocol> _in_proto = _server._protocol_factory->getProtocol(_input);
-    boost::shared_ptr<TProtocol> _out_proto = _server._protocol_factory->getProtocol(_output);
+    // Shared with the deleters of the responses being sent, which may
+    // outlive the connection.
+    lw_shared_ptr<request_pool> _pool = make_lw_shared<request_pool>();
     boost::shared_ptr<TAsyncProcessor> _processor;
-    promise<> _processor_promise;
+    semaphore _pipeline_sem{max_pipelined_requests};
+    seastar::gate _pending_requests_gate;
+    future<> _ready_to_respond = make_ready_future<>();
+    unsigned _pending_responses = 0;
 public:
     connection(thrift_server& server, connected_socket&& fd, socket_address addr)
         : _server(server), _fd(std::move(fd)), _read_buf(_fd.input())
@@ -111,32 +136,83 @@ class thrift_server::connection {
         --_server._current_connections;
     }
     TConnectionInfo get_conn_info() {
-        return { _in_proto, _out_proto, _transport };
+        _pool->push_back(std::make_unique<request>(*_server._protocol_factory));
+        auto& r = *_pool->back();
+        return { r.in_proto, r.out_proto, _transport };
     }
     future<> process() {
-        return do_until([this] { return _read_buf.eof(); },
-                [this] { return process_one_request(); });
+        return do_until([this] { return _read_buf.eof(); }, [this] {
+            return with_gate(_pending_requests_gate, [this] {
+                return process_one_request();
+            });
+        }).finally([this] {
+            return _pending_requests_gate.close().then([this] {
+                return _ready_to_respond.finally([this] {
+                    return _write_buf.close();
+                });
+            });
+        });
     }
+    // Reads a request and starts processing it, without waiting for it to
+    // complete, so that a client may pipeline requests on a connection.
     future<> process_one_request() {
-        _input->resetBuffer();
-        _output->resetBuffer();
-        return read().then([this] {
+        return _pipeline_sem.wait().then([this] {
+            return read();
+        }).then([this] (std::unique_ptr<request> req) {
+            if (!req) {
+                _pipeline_sem.signal();
+                return;
+            }
             ++_server._requests_served;
-            auto ret = _processor_promise.get_future();
+            auto& r = *req;
+            // Leave room for the frame header, filled in by write() once the
+            // size of the response is known.
+            static const uint8_t header_placeholder[frame_header_size] = {};
+            r.output->write(header_placeholder, frame_header_size);
             // adapt from "continuation object style" to future/promise
-            auto complete = [this] (bool success) mutable {
+            auto complete = [&r] (bool success) {
                 // FIXME: look at success?
-                write().forward_to(std::move(_processor_promise));
-                _processor_promise = promise<>();
+                r.processed.set_value();
             };
-            _processor->process(complete, _in_proto, _out_proto);
-            return ret;
+            _processor->process(complete, r.in_proto, r.out_proto);
+            respond(std::move(req));
+        });
+    }
+    // Thrift has no way of matching responses to requests other than their
+    // order, so responses are queued behind those of earlier requests, even
+    // if they complete first.
+    void respond(std::unique_ptr<request> req) {
+        ++_pending_responses;
+        _ready_to_respond = _ready_to_respond.then_wrapped([this, req = std::move(req)] (future<> prev) mutable {
+            // The request must complete even if an earlier response failed,
+            // as the processor refers to it.
+            auto processed = req->processed.get_future();
+            return processed.then([this, prev = std::move(prev), req = std::move(req)] () mutable {
+                _pipeline_sem.signal();
+                prev.get();
+                return write(std::move(req));
+            });
         });
     }
-    future<> read() {
+    std::unique_ptr<request> get_request() {
+        if (_pool->empty()) {
+            return std::make_unique<request>(*_server._protocol_factory);
+        }
+        auto r = std::move(_pool->back());
+        _pool->pop_back();
+        return r;
+    }
+    static void recycle(request_pool& pool, std::unique_ptr<request> r) {
+        if (pool.size() < max_pooled_requests) {
+            r->in_tmp = temporary_buffer<char>();
+            r->processed = promise<>();
+            pool.push_back(std::move(r));
+        }
+    }
+    future<std::unique_ptr<request>> read() {
         return _read_buf.read_exactly(4).then([this] (temporary_buffer<char> size_buf) {
             if (size_buf.size() != 4) {
-                return make_ready_future<>();
+                return make_ready_future<std::unique_ptr<request>>();
             }
             union {
                 uint32_t n;
@@ -147,23 +223,40 @@ class thrift_server::connection {
             return _read_buf.read_exactly(n).then([this, n] (temporary_buffer<char> buf) {
                 if (buf.size() != n) {
                     // FIXME: exception perhaps?
-                    return;
+                    return std::unique_ptr<request>();
                 }
-                _in_tmp = std::move(buf); // keep ownership of the data
-                auto b = reinterpret_cast<uint8_t*>(_in_tmp.get_write());
-                _input->resetBuffer(b, _in_tmp.size());
+                auto req = get_request();
+                req->in_tmp = std::move(buf); // keep ownership of the data
+                auto b = reinterpret_cast<uint8_t*>(req->in_tmp.get_write());
+                req->input->resetBuffer(b, req->in_tmp.size());
+                req->output->resetBuffer();
+                return req;
             });
         });
     }
-    future<> write() {
+    // Sends the response straight from the request's output buffer, which
+    // goes back to the pool once the network stack is done with it.
+    future<> write(std::unique_ptr<request> req) {
         uint8_t* data;
         uint32_t len;
-        _output->getBuffer(&data, &len);
-        net::packed<uint32_t> plen = { net::hton(len) };
-        return _write_buf.write(reinterpret_cast<char*>(&plen), 4).then([this, data, len] {
-            // FIXME: zero-copy
-            return _write_buf.write(reinterpret_cast<char*>(data), len);
-        }).then([this] {
+        req->output->getBuffer(&data, &len);
+        net::packed<uint32_t> plen = { net::hton(len - frame_header_size) };
+        std::copy_n(reinterpret_cast<const uint8_t*>(&plen), frame_header_size, data);
+        scattered_message<char> msg;
+        msg.append_static(reinterpret_cast<char*>(data), len);
+        if (len <= max_pooled_response_size) {
+            msg.on_delete([pool = _pool, req = std::move(req)] () mutable {
+                recycle(*pool, std::move(req));
+            });
+        } else {
+            msg.on_delete([req = std::move(req)] { });
+        }
+        return _write_buf.write(std::move(msg)).then([this] {
+            // Responses which completed while earlier ones were being written
+            // are queued behind them, flush once after the last one.
+            if (--_pending_responses) {
+                return make_ready_future<>();
+            }
             return _write_buf.flush();
         });
     }
@@ -43,6 +43,7 @@
 #include "tracing/trace_keyspace_helper.hh"
 #include "service/migration_manager.hh"
 #include "cql3/statements/create_table_statement.hh"
+#include <boost/algorithm/cxx11/any_of.hpp>
 
 namespace tracing {
 
@@ -51,6 +52,7 @@ static logging::logger logger("trace_keyspace_helper");
 const sstring trace_keyspace_helper::KEYSPACE_NAME("system_traces");
 const sstring trace_keyspace_helper::SESSIONS("sessions");
 const sstring trace_keyspace_helper::EVENTS("events");
+const sstring trace_keyspace_helper::NODE_SLOW_LOG("node_slow_log");
 
 trace_keyspace_helper::trace_keyspace_helper(tracing& tr)
             : i_tracing_backend_helper(tr)
@@ -85,6 +87,20 @@ trace_keyspace_helper::trace_keyspace_helper(tracing& tr)
                                     "thread text,"
                                     "PRIMARY KEY ((session_id), event_id)) "
                                     "WITH default_time_to_live = 86400", KEYSPACE_NAME, EVENTS);
+
+        _node_slow_log_create_cql = sprint("CREATE TABLE %s.%s ("
+                                           "start_time timeuuid,"
+                                           "node_ip inet,"
+                                           "shard int,"
+                                           "session_id uuid,"
+                                           "date timestamp,"
+                                           "command text,"
+                                           "duration int,"
+                                           "parameters map<text, text>,"
+                                           "request text,"
+                                           "source_ip inet,"
+                                           "PRIMARY KEY (start_time, node_ip, shard)) "
+                                           "WITH default_time_to_live = 86400", KEYSPACE_NAME, NODE_SLOW_LOG);
 }
 
 future<> trace_keyspace_helper::setup_table(const sstring& name, const sstring& cql) const {
@@ -152,6 +168,37 @@ bool trace_keyspace_helper::cache_events_table_handles(const schema_ptr& schema)
     }
 }
 
+bool trace_keyspace_helper::cache_slow_log_table_handles(const schema_ptr& schema) {
+    auto start_time_column = schema->get_column_definition("start_time");
+    auto node_ip_column = schema->get_column_definition("node_ip");
+    auto shard_column = schema->get_column_definition("shard");
+    _slow_session_id_column = schema->get_column_definition("session_id");
+    _slow_date_column = schema->get_column_definition("date");
+    _slow_command_column = schema->get_column_definition("command");
+    _slow_duration_column = schema->get_column_definition("duration");
+    _slow_parameters_column = schema->get_column_definition("parameters");
+    _slow_request_column = schema->get_column_definition("request");
+    _slow_source_ip_column = schema->get_column_definition("source_ip");
+
+    if (start_time_column && start_time_column->type == timeuuid_type &&
+        node_ip_column && node_ip_column->type == inet_addr_type &&
+        shard_column && shard_column->type == int32_type &&
+        _slow_session_id_column && _slow_session_id_column->type == uuid_type &&
+        _slow_date_column && _slow_date_column->type == timestamp_type &&
+        _slow_command_column && _slow_command_column->type == utf8_type &&
+        _slow_duration_column && _slow_duration_column->type == int32_type &&
+        _slow_parameters_column && _slow_parameters_column->type == map_type_impl::get_instance(utf8_type, utf8_type, true) &&
+        _slow_request_column && _slow_request_column->type == utf8_type &&
+        _slow_source_ip_column && _slow_source_ip_column->type == inet_addr_type) {
+        // store a table ID only if its format meets our demands
+        _slow_log_id = schema->id();
+        return true;
+    } else {
+        _slow_log_id = utils::UUID();
+        return false;
+    }
+}
+
 future<> trace_keyspace_helper::start() {
     if (engine().cpu_id() == 0) {
         return seastar::async([this] {
@@ -168,6 +215,7 @@ future<> trace_keyspace_helper::start() {
             // Create tables
             setup_table(SESSIONS, _sessions_create_cql).get();
             setup_table(EVENTS, _events_create_cql).get();
+            setup_table(NODE_SLOW_LOG, _node_slow_log_create_cql).get();
         });
     } else {
         return make_ready_future<>();
@@ -183,9 +231,7 @@ void trace_keyspace_helper::write_session_record(const utils::UUID& session_id,
                                                  int elapsed,
                                                  gc_clock::duration ttl) {
     try {
-        _mutation_makers[session_id].first = [request = std::move(request), client, parameters = std::move(parameters), started_at, command, elapsed, ttl, this] (const utils::UUID& session_id) {
-            return make_session_mutation(session_id, client, parameters, request, started_at, type_to_string(command), elapsed, ttl);
-        };
+        _records[session_id].session = session_record{client, std::move(parameters), std::move(request), started_at, command, elapsed, ttl};
     } catch (...) {
         // OOM: ignore
     }
@@ -197,40 +243,43 @@ void trace_keyspace_helper::write_event_record(const utils::UUID& session_id,
                                                gc_clock::duration ttl,
                                                wall_clock::time_point event_time_point) {
     try {
-        _mutation_makers[session_id].second.makers.emplace_back([message = std::move(message), elapsed, ttl, event_time_point, this] (const utils::UUID& session_id) mutable {
-            return make_event_mutation(session_id, message, elapsed, _local_tracing.get_thread_name(), ttl, event_time_point);
-        });
+        _records[session_id].events.emplace_back(event_record{std::move(message), elapsed, ttl, event_time_point});
     } catch (...) {
         // OOM: ignore
     }
 }
 
-mutation trace_keyspace_helper::make_session_mutation(
-        const utils::UUID& session_id,
-        gms::inet_address client,
-        const std::unordered_map<sstring, sstring>& parameters,
-        const sstring& request,
-        long started_at,
-        const sstring& command,
-        int elapsed,
-        gc_clock::duration ttl) {
-    schema_ptr schema = get_schema_ptr_or_create(_sessions_id, SESSIONS, _sessions_create_cql,
-                                                 [this] (const schema_ptr& s) { return cache_sessions_table_handles(s); });
+void trace_keyspace_helper::write_slow_query_record(const utils::UUID& session_id,
+                                                    gms::inet_address client,
+                                                    std::unordered_map<sstring, sstring> parameters,
+                                                    sstring request,
+                                                    long started_at,
+                                                    trace_type command,
+                                                    int elapsed,
+                                                    gc_clock::duration ttl) {
+    try {
+        _records[session_id].slow_query = session_record{client, std::move(parameters), std::move(request), started_at, command, elapsed, ttl};
+    } catch (...) {
+        // OOM: ignore
+    }
+}
 
+mutation trace_keyspace_helper::make_session_mutation(const schema_ptr& schema, const utils::UUID& session_id, const session_record& record) {
     auto key = partition_key::from_singular(*schema, session_id);
     auto timestamp = api::new_timestamp();
+    auto ttl = record.ttl;
     mutation m(key, schema);
     auto& cells = m.partition().clustered_row(clustering_key::make_empty(*schema)).cells();
 
-    cells.apply(*_client_column, atomic_cell::make_live(timestamp, inet_addr_type->decompose(client.addr()), ttl));
+    cells.apply(*_client_column, atomic_cell::make_live(timestamp, inet_addr_type->decompose(record.client.addr()), ttl));
     cells.apply(*_coordinator_column, atomic_cell::make_live(timestamp, inet_addr_type->decompose(utils::fb_utilities::get_broadcast_address().addr()), ttl));
-    cells.apply(*_request_column, atomic_cell::make_live(timestamp, utf8_type->decompose(request), ttl));
-    cells.apply(*_started_at_column, atomic_cell::make_live(timestamp, timestamp_type->decompose(started_at), ttl));
-    cells.apply(*_command_column, atomic_cell::make_live(timestamp, utf8_type->decompose(command), ttl));
-    cells.apply(*_duration_column, atomic_cell::make_live(timestamp, int32_type->decompose((int32_t)elapsed), ttl));
+    cells.apply(*_request_column, atomic_cell::make_live(timestamp, utf8_type->decompose(record.request), ttl));
+    cells.apply(*_started_at_column, atomic_cell::make_live(timestamp, timestamp_type->decompose(record.started_at), ttl));
+    cells.apply(*_command_column, atomic_cell::make_live(timestamp, utf8_type->decompose(type_to_string(record.command)), ttl));
+    cells.apply(*_duration_column, atomic_cell::make_live(timestamp, int32_type->decompose((int32_t)record.elapsed), ttl));
 
     std::vector<std::pair<bytes, atomic_cell>> map_cell;
-    for (auto& param_pair : parameters) {
+    for (auto& param_pair : record.parameters) {
         map_cell.emplace_back(utf8_type->decompose(param_pair.first), atomic_cell::make_live(timestamp, utf8_type->decompose(param_pair.second), ttl));
     }
 
@@ -241,80 +290,147 @@ mutation trace_keyspace_helper::make_session_mutation(
     return m;
 }
 
-mutation trace_keyspace_helper::make_event_mutation(const utils::UUID& session_id,
-                                                    const sstring& message,
-                                                    int elapsed,
-                                                    const sstring& thread_name,
-                                                    gc_clock::duration ttl,
-                                                    wall_clock::time_point event_time_point) {
-    schema_ptr schema = get_schema_ptr_or_create(_events_id, EVENTS, _events_create_cql,
-                                                 [this] (const schema_ptr& s) { return cache_events_table_handles(s); });
+mutation trace_keyspace_helper::make_events_mutation(const schema_ptr& schema, const utils::UUID& session_id, const std::vector<event_record>& events) {
+    // Reset the "monotinic time point" state machine since it's relevant in
+    // a context of a single tracing session only. The events from different
+    // sessions will differ by a session UUID.
+    reset_monotonic_tp();
 
     auto key = partition_key::from_singular(*schema, session_id);
     auto timestamp = api::new_timestamp();
+    auto source = inet_addr_type->decompose(utils::fb_utilities::get_broadcast_address().addr());
+    auto thread_name = utf8_type->decompose(_local_tracing.get_thread_name());
     mutation m(key, schema);
-    auto& cells = m.partition().clustered_row(clustering_key::from_singular(*schema, utils::UUID_gen::get_time_UUID(make_monotonic_UUID_tp(event_time_point)))).cells();
 
-    cells.apply(*_activity_column, atomic_cell::make_live(timestamp, utf8_type->decompose(message), ttl));
-    cells.apply(*_source_column, atomic_cell::make_live(timestamp, inet_addr_type->decompose(utils::fb_utilities::get_broadcast_address().addr()), ttl));
-    cells.apply(*_thread_column, atomic_cell::make_live(timestamp, utf8_type->decompose(thread_name), ttl));
+    for (auto& e : events) {
+        auto& cells = m.partition().clustered_row(clustering_key::from_singular(*schema, utils::UUID_gen::get_time_UUID(make_monotonic_UUID_tp(e.event_time_point)))).cells();
 
-    assert(elapsed >= 0);
-    cells.apply(*_source_elapsed_column, atomic_cell::make_live(timestamp, int32_type->decompose(elapsed), ttl));
+        cells.apply(*_activity_column, atomic_cell::make_live(timestamp, utf8_type->decompose(e.message), e.ttl));
+        cells.apply(*_source_column, atomic_cell::make_live(timestamp, source, e.ttl));
+        cells.apply(*_thread_column, atomic_cell::make_live(timestamp, thread_name, e.ttl));
+
+        assert(e.elapsed >= 0);
+        cells.apply(*_source_elapsed_column, atomic_cell::make_live(timestamp, int32_type->decompose(e.elapsed), e.ttl));
+    }
 
     return m;
 }
 
-future<> trace_keyspace_helper::flush_one_session_mutations(utils::UUID session_id, std::pair<mutation_maker, events_mutation_makers>& mutation_makers) {
-    return make_ready_future<>().then([this, session_id, events_makers = std::move(mutation_makers.second.makers)] {
-        if (events_makers.size()) {
-            // Reset the "monotinic time point" state machine since it's
-            // relevant in a context of a single tracing session only. The
-            // events from different sessions will differ by a session UUID.
-            reset_monotonic_tp();
-            logger.trace("{}: events number is {}", session_id, events_makers.size());
-            mutation m((*events_makers.begin())(session_id));
-            std::for_each(std::next(events_makers.begin()), events_makers.end(), [&m, &session_id] (const mutation_maker& maker) mutable { m.apply(maker(session_id)); });
-            return service::get_local_storage_proxy().mutate({std::move(m)}, db::consistency_level::ANY, nullptr);
-        } else {
-            return make_ready_future<>();
+mutation trace_keyspace_helper::make_slow_query_mutation(const schema_ptr& schema, const utils::UUID& session_id, const session_record& record) {
+    auto started_at = wall_clock::time_point(std::chrono::milliseconds(record.started_at));
+    auto start_time = utils::UUID_gen::get_time_UUID(started_at);
+    auto key = partition_key::from_singular(*schema, start_time);
+    auto ck = clustering_key::from_exploded(*schema, {
+        inet_addr_type->decompose(utils::fb_utilities::get_broadcast_address().addr()),
+        int32_type->decompose(int32_t(engine().cpu_id()))
+    });
+    auto timestamp = api::new_timestamp();
+    auto ttl = record.ttl;
+    mutation m(key, schema);
+    auto& cells = m.partition().clustered_row(ck).cells();
+
+    cells.apply(*_slow_session_id_column, atomic_cell::make_live(timestamp, uuid_type->decompose(session_id), ttl));
+    cells.apply(*_slow_date_column, atomic_cell::make_live(timestamp, timestamp_type->decompose(record.started_at), ttl));
+    cells.apply(*_slow_command_column, atomic_cell::make_live(timestamp, utf8_type->decompose(type_to_string(record.command)), ttl));
+    cells.apply(*_slow_duration_column, atomic_cell::make_live(timestamp, int32_type->decompose((int32_t)record.elapsed), ttl));
+    cells.apply(*_slow_request_column, atomic_cell::make_live(timestamp, utf8_type->decompose(record.request), ttl));
+    cells.apply(*_slow_source_ip_column, atomic_cell::make_live(timestamp, inet_addr_type->decompose(record.client.addr()), ttl));
+
+    std::vector<std::pair<bytes, atomic_cell>> map_cell;
+    for (auto& param_pair : record.parameters) {
+        map_cell.emplace_back(utf8_type->decompose(param_pair.first), atomic_cell::make_live(timestamp, utf8_type->decompose(param_pair.second), ttl));
+    }
+
+    map_type_impl::mutation map_mutation{{}, map_cell};
+    auto my_map_type = map_type_impl::get_instance(utf8_type, utf8_type, true);
+    cells.apply(*_slow_parameters_column, my_map_type->serialize_mutation_form(map_mutation));
+
+    return m;
+}
+
+future<> trace_keyspace_helper::flush_sessions(std::unordered_map<utils::UUID, session_records> records) {
+    // The mutations are built before any asynchronous call, so that the
+    // records don't have to outlive this call.
+    std::vector<mutation> events_mutations;
+    std::vector<mutation> sessions_mutations;
+
+    if (boost::algorithm::any_of(records, [] (auto& r) { return !r.second.events.empty(); })) {
+        auto schema = get_schema_ptr_or_create(_events_id, EVENTS, _events_create_cql,
+                                               [this] (const schema_ptr& s) { return cache_events_table_handles(s); });
+        events_mutations.reserve(records.size());
+        for (auto& r : records) {
+            if (!r.second.events.empty()) {
+                logger.trace("{}: events number is {}", r.first, r.second.events.size());
+                events_mutations.emplace_back(make_events_mutation(schema, r.first, r.second.events));
+            }
+        }
+    }
+
+    if (boost::algorithm::any_of(records, [] (auto& r) { return bool(r.second.session); })) {
+        auto schema = get_schema_ptr_or_create(_sessions_id, SESSIONS, _sessions_create_cql,
+                                               [this] (const schema_ptr& s) { return cache_sessions_table_handles(s); });
+        sessions_mutations.reserve(records.size());
+        for (auto& r : records) {
+            if (r.second.session) {
+                logger.trace("{}: storing a session event", r.first);
+                sessions_mutations.emplace_back(make_session_mutation(schema, r.first, *r.second.session));
+            }
         }
-    }).then([session_id = std::move(session_id), session_maker = std::move(mutation_makers.first)] {
-        if (session_maker) {
-            logger.trace("{}: storing a session event", session_id);
-            return service::get_local_storage_proxy().mutate({session_maker(session_id)}, db::consistency_level::ANY, nullptr);
-        } else {
+    }
+
+    if (boost::algorithm::any_of(records, [] (auto& r) { return bool(r.second.slow_query); })) {
+        auto schema = get_schema_ptr_or_create(_slow_log_id, NODE_SLOW_LOG, _node_slow_log_create_cql,
+                                               [this] (const schema_ptr& s) { return cache_slow_log_table_handles(s); });
+        for (auto& r : records) {
+            if (r.second.slow_query) {
+                logger.trace("{}: storing a slow query record", r.first);
+                sessions_mutations.emplace_back(make_slow_query_mutation(schema, r.first, *r.second.slow_query));
+            }
+        }
+    }
+
+    auto f = events_mutations.empty() ? make_ready_future<>()
+            : service::get_local_storage_proxy().mutate(std::move(events_mutations), db::consistency_level::ANY, nullptr);
+    return f.then([sessions_mutations = std::move(sessions_mutations)] () mutable {
+        if (sessions_mutations.empty()) {
             return make_ready_future<>();
         }
+        return service::get_local_storage_proxy().mutate(std::move(sessions_mutations), db::consistency_level::ANY, nullptr);
     });
 }
 
 void trace_keyspace_helper::kick() {
-    logger.trace("flushing {} sessions", _mutation_makers.size());
-    parallel_for_each(_mutation_makers,[this](decltype(_mutation_makers)::value_type& uuid_mutation_makers) {
-        return with_gate(_pending_writes, [this, &uuid_mutation_makers]  {
-            logger.trace("{}: flushing traces", uuid_mutation_makers.first);
-            return this->flush_one_session_mutations(uuid_mutation_makers.first, uuid_mutation_makers.second).finally([this] { _local_tracing.write_complete(); });
-        }).handle_exception([this] (auto ep) {
-            try {
-                ++_stats.tracing_errors;
-                std::rethrow_exception(ep);
-            } catch (exceptions::overloaded_exception&) {
-                logger.warn("Too many nodes are overloaded to save trace events");
-            } catch (bad_column_family& e) {
-                if (_stats.bad_column_family_errors++ % bad_column_family_message_period == 0) {
-                    logger.warn("Tracing is enabled but {}", e.what());
-                }
-            } catch (...) {
-                // TODO: Handle some more exceptions maybe?
-            }
+    if (_records.empty()) {
+        return;
+    }
+
+    auto nr = _records.size();
+    logger.trace("flushing {} sessions", nr);
+    // The records of all pending sessions are written together, so that a
+    // write cycle costs two storage_proxy::mutate() calls however many
+    // sessions there are.
+    futurize<void>::apply([this, records = std::move(_records)] () mutable {
+        return with_gate(_pending_writes, [this, &records] {
+            return this->flush_sessions(std::move(records));
         });
-    }).discard_result();
+    }).handle_exception([this] (auto ep) {
+        try {
+            ++_stats.tracing_errors;
+            std::rethrow_exception(ep);
+        } catch (exceptions::overloaded_exception&) {
+            logger.warn("Too many nodes are overloaded to save trace events");
+        } catch (bad_column_family& e) {
+            if (_stats.bad_column_family_errors++ % bad_column_family_message_period == 0) {
+                logger.warn("Tracing is enabled but {}", e.what());
+            }
+        } catch (...) {
+            // TODO: Handle some more exceptions maybe?
+        }
+    }).finally([this, nr] {
+        _local_tracing.write_complete(nr);
+    });
 
-    // We can clear the hash table here because we cared to capture all relevant
-    // data from it in lambdas' capture-lists inside
-    // flush_one_session_mutations() before any asynchronous call.
-    _mutation_makers.clear();
+    _records.clear();
 }
 
 using registry = class_registrator<i_tracing_backend_helper, trace_keyspace_helper, tracing&>;
@@ -52,27 +52,47 @@ class trace_keyspace_helper : public i_tracing_backend_helper {
     static const sstring KEYSPACE_NAME;
     static const sstring SESSIONS;
     static const sstring EVENTS;
+    static const sstring NODE_SLOW_LOG;
 
 private:
-    using mutation_maker = std::function<mutation (const utils::UUID& session_id)>;
-
     static constexpr int bad_column_family_message_period = 10000;
 
-    struct events_mutation_makers {
-        std::vector<mutation_maker> makers;
+    struct event_record {
+        sstring message;
+        int elapsed;
+        gc_clock::duration ttl;
+        wall_clock::time_point event_time_point;
+    };
+
+    struct session_record {
+        gms::inet_address client;
+        std::unordered_map<sstring, sstring> parameters;
+        sstring request;
+        long started_at;
+        trace_type command;
+        int elapsed;
+        gc_clock::duration ttl;
+    };
+
+    // Records of one session, which are buffered until the next write cycle.
+    struct session_records {
+        std::experimental::optional<session_record> session;
+        std::experimental::optional<session_record> slow_query;
+        std::vector<event_record> events;
     public:
-        events_mutation_makers() {
-            makers.reserve(tracing::max_trace_events_per_session);
+        session_records() {
+            events.reserve(tracing::max_trace_events_per_session);
         }
     };
 
-    // a hash table of session ID to one session mutation and a vector of events mutations
-    std::unordered_map<utils::UUID, std::pair<mutation_maker, events_mutation_makers>> _mutation_makers;
+    // a hash table of session ID to the records of that session
+    std::unordered_map<utils::UUID, session_records> _records;
 
     seastar::gate _pending_writes;
 
     sstring _sessions_create_cql;
     sstring _events_create_cql;
+    sstring _node_slow_log_create_cql;
 
     utils::UUID _sessions_id;
     const column_definition* _client_column;
@@ -89,6 +109,15 @@ class trace_keyspace_helper : public i_tracing_backend_helper {
     const column_definition* _thread_column;
     const column_definition* _source_elapsed_column;
 
+    utils::UUID _slow_log_id;
+    const column_definition* _slow_session_id_column;
+    const column_definition* _slow_date_column;
+    const column_definition* _slow_command_column;
+    const column_definition* _slow_duration_column;
+    const column_definition* _slow_parameters_column;
+    const column_definition* _slow_request_column;
+    const column_definition* _slow_source_ip_column;
+
     struct stats {
         uint64_t tracing_errors = 0;
         uint64_t bad_column_family_errors = 0;
@@ -129,6 +158,15 @@ class trace_keyspace_helper : public i_tracing_backend_helper {
                                     gc_clock::duration ttl,
                                     wall_clock::time_point event_time_point) override;
 
+    virtual void write_slow_query_record(const utils::UUID& session_id,
+                                         gms::inet_address client,
+                                         std::unordered_map<sstring, sstring> parameters,
+                                         sstring request,
+                                         long started_at,
+                                         trace_type command,
+                                         int elapsed,
+                                         gc_clock::duration ttl) override;
+
 private:
     /**
      * Makes a monotonically increasing value in 100ns based on the given time stamp.
@@ -176,17 +214,17 @@ class trace_keyspace_helper : public i_tracing_backend_helper {
     future<> setup_table(const sstring& name, const sstring& cql) const;
 
     /**
-     * Flush mutations of one particular tracing session. First "events"
-     * mutations and then, when they are complete, a "sessions" mutation.
+     * Write the records of all given sessions. First a mutation with all
+     * events of each session is applied, one storage_proxy::mutate() call for
+     * all the sessions together, and then, when they are complete, the
+     * "sessions" and the slow query log mutations, again all in one call.
      *
-     * @param session_id ID of a tracing session
-     * @param mutation_makers a pair of a "sessions" mutation maker and an array
-     *                        of "events" mutations makers.
+     * @param records records of the sessions to write
      *
      * @return A future that resolves when applying of above mutations is
      *         complete.
      */
-    future<> flush_one_session_mutations(utils::UUID session_id, std::pair<mutation_maker, events_mutation_makers>& mutation_makers);
+    future<> flush_sessions(std::unordered_map<utils::UUID, session_records> records);
 
     /**
      * Get a schema_ptr by a table (UU)ID. If not found will try to get it by
@@ -230,33 +268,31 @@ class trace_keyspace_helper : public i_tracing_backend_helper {
      */
     bool cache_events_table_handles(const schema_ptr& s);
 
-    mutation make_session_mutation(const utils::UUID& session_id,
-                                   gms::inet_address client,
-                                   const std::unordered_map<sstring, sstring>& parameters,
-                                   const sstring& request,
-                                   long started_at,
-                                   const sstring& command,
-                                   int elapsed,
-                                   gc_clock::duration ttl);
+    /**
+     * Cache definitions of a system_traces.node_slow_log table: table ID and
+     * column definitions.
+     *
+     * @param s schema handle
+     * @return TRUE if succeeded to cache all relevant information. FALSE will
+     *         be returned if something is wrong with the table: it was dropped
+     *         or its columns definitions are not as expected.
+     */
+    bool cache_slow_log_table_handles(const schema_ptr& s);
+
+    mutation make_session_mutation(const schema_ptr& schema, const utils::UUID& session_id, const session_record& record);
 
     /**
-     * Create a mutation for a new trace point record
+     * Create a mutation with all trace point records of a session
      *
+     * @param schema system_traces.events schema
      * @param session_id tracing session ID
-     * @param message trace record message
-     * @param elapsed time elapsed since begin() till this trace point
-     * @param thread_name
-     * @param ttl
-     * @param event_time_stamp wall clock time point of this trace event
+     * @param events trace point records of the session
      *
      * @return the relevant mutation
      */
-    mutation make_event_mutation(const utils::UUID& session_id,
-                                 const sstring& message,
-                                 int elapsed,
-                                 const sstring& thread_name,
-                                 gc_clock::duration ttl,
-                                 wall_clock::time_point event_time_stamp);
+    mutation make_events_mutation(const schema_ptr& schema, const utils::UUID& session_id, const std::vector<event_record>& events);
+
+    mutation make_slow_query_mutation(const schema_ptr& schema, const utils::UUID& session_id, const session_record& record);
 };
 
 struct bad_column_family : public std::exception {
@@ -81,42 +81,69 @@ std::unordered_map<sstring, sstring> trace_state::get_params() {
         params_map.emplace("user_timestamp", seastar::format("{:d}", *vals.user_timestamp));
     }
 
+    if (!vals.replica_responses.empty()) {
+        params_map.emplace("replica_responses", join(sstring(","), vals.replica_responses | boost::adaptors::transformed([] (auto& r) {
+            return seastar::format("/{}:{:d}us", r.first, r.second);
+        })));
+    }
+
+    if (vals.scanned_tombstones) {
+        params_map.emplace("scanned_tombstones", seastar::format("{:d}", vals.scanned_tombstones));
+    }
+
     return params_map;
 }
 
 trace_state::~trace_state() {
-    if (_tracing_began) {
-        if (_primary) {
-            // We don't account the session_record event when checking a limit
-            // of maximum events per session because there may be only one such
-            // event and we don't want to cripple the primary session by
-            // "stealing" one trace() event from it.
-            //
-            // We do want to report it in statistics however. If for instance
-            // there are a lot of tracing sessions that only open itself and
-            // then do nothing - they will create a lot of session_record events
-            // and we do want to know about it.
-            ++_pending_trace_events;
-            _local_backend.write_session_record(_session_id, _client, get_params(), std::move(_request), _started_at, _type, elapsed(), _ttl);
-        }
+    if (!_tracing_began) {
+        return;
+    }
 
-        _local_tracing_ptr->end_session();
+    auto elapsed_us = elapsed();
+    bool slow = _primary && _local_tracing_ptr->is_slow_query(elapsed_us) && _local_tracing_ptr->may_write_slow_query_record();
 
-        if (_write_on_close) {
-            _local_tracing_ptr->write_pending_records();
+    if (!_full_tracing) {
+        if (slow) {
+            _local_backend.write_slow_query_record(_session_id, _client, get_params(), std::move(_request), _started_at, _type, elapsed_us, _ttl);
+            _local_tracing_ptr->end_slow_query_session();
         }
+        return;
+    }
+
+    if (_primary) {
+        // We don't account the session_record event when checking a limit
+        // of maximum events per session because there may be only one such
+        // event and we don't want to cripple the primary session by
+        // "stealing" one trace() event from it.
+        //
+        // We do want to report it in statistics however. If for instance
+        // there are a lot of tracing sessions that only open itself and
+        // then do nothing - they will create a lot of session_record events
+        // and we do want to know about it.
+        ++_pending_trace_events;
+        auto params = get_params();
+        if (slow) {
+            _local_backend.write_slow_query_record(_session_id, _client, params, _request, _started_at, _type, elapsed_us, _ttl);
+        }
+        _local_backend.write_session_record(_session_id, _client, std::move(params), std::move(_request), _started_at, _type, elapsed_us, _ttl);
+    }
+
+    _local_tracing_ptr->end_session();
+
+    if (_write_on_close) {
+        _local_tracing_ptr->write_pending_records();
+    }
 
-        // update some stats and get out...
-        auto& tracing_stats = _local_tracing_ptr->stats;
+    // update some stats and get out...
+    auto& tracing_stats = _local_tracing_ptr->stats;
 
-        tracing_stats.trace_events_count += _pending_trace_events;
+    tracing_stats.trace_events_count += _pending_trace_events;
 
-        if (_pending_trace_events >= tracing::max_trace_events_per_session) {
-            logger.trace("{}: Maximum number of traces is reached. Some traces are going to be dropped", _session_id);
+    if (_pending_trace_events >= tracing::max_trace_events_per_session) {
+        logger.trace("{}: Maximum number of traces is reached. Some traces are going to be dropped", _session_id);
 
-            if (++tracing_stats.max_traces_threshold_hits % tracing::max_threshold_hits_warning_period == 1) {
-                logger.warn("Maximum traces per session limit is hit {} times", tracing_stats.max_traces_threshold_hits);
-            }
+        if (++tracing_stats.max_traces_threshold_hits % tracing::max_threshold_hits_warning_period == 1) {
+            logger.warn("Maximum traces per session limit is hit {} times", tracing_stats.max_traces_threshold_hits);
         }
     }
 }
@@ -63,6 +63,8 @@ class trace_state final {
     gc_clock::duration _ttl;
     // TRUE for a primary trace_state object
     bool _primary;
+    // FALSE for a session which is only kept for the slow query log
+    bool _full_tracing;
     bool _tracing_began = false;
     std::chrono::system_clock::rep _started_at;
     gms::inet_address _client;
@@ -78,6 +80,10 @@ class trace_state final {
         std::experimental::optional<db::consistency_level> cl;
         std::experimental::optional<db::consistency_level> serial_cl;
         std::experimental::optional<int32_t> page_size;
+        // Replicas which responded, each with the number of microseconds
+        // since the beginning of the session till its response came.
+        std::vector<std::pair<gms::inet_address, int>> replica_responses;
+        uint64_t scanned_tombstones = 0;
     };
 
     class params_ptr {
@@ -106,12 +112,13 @@ class trace_state final {
     } _params_ptr;
 
 public:
-    trace_state(trace_type type, bool write_on_close, const std::experimental::optional<utils::UUID>& session_id = std::experimental::nullopt)
+    trace_state(trace_type type, bool write_on_close, const std::experimental::optional<utils::UUID>& session_id = std::experimental::nullopt, bool full_tracing = true)
         : _session_id(session_id ? *session_id : utils::UUID_gen::get_time_UUID())
         , _type(type)
         , _write_on_close(write_on_close)
         , _ttl(ttl_by_type(_type))
         , _primary(!session_id)
+        , _full_tracing(full_tracing)
         , _local_tracing_ptr(tracing::get_local_tracing_instance().shared_from_this())
         , _local_backend(_local_tracing_ptr->backend_helper())
     { }
@@ -130,6 +137,10 @@ class trace_state final {
         return _write_on_close;
     }
 
+    bool full_tracing() const {
+        return _full_tracing;
+    }
+
 private:
     /**
      * Returns the number of microseconds passed since the beginning of this
@@ -249,6 +260,31 @@ class trace_state final {
         _params_ptr->user_timestamp.emplace(val);
     }
 
+    /**
+     * Records that a replica responded.
+     *
+     * The time of the response, relative to the beginning of this session, of
+     * every replica will eventually be stored in a params<string, string> map
+     * of a tracing session with a 'replica_responses' key.
+     *
+     * @param ep the replica
+     */
+    void record_replica_response(gms::inet_address ep) {
+        _params_ptr->replica_responses.emplace_back(ep, elapsed());
+    }
+
+    /**
+     * Adds to the number of tombstones the query scanned.
+     *
+     * The total will eventually be stored in a params<string, string> map of
+     * a tracing session with a 'scanned_tombstones' key.
+     *
+     * @param n number of tombstones scanned by a replica
+     */
+    void add_scanned_tombstones(uint64_t n) {
+        _params_ptr->scanned_tombstones += n;
+    }
+
     std::unordered_map<sstring, sstring> get_params();
 
     /**
@@ -291,9 +327,15 @@ class trace_state final {
     friend void set_optional_serial_consistency_level(const trace_state_ptr& p, const std::experimental::optional<db::consistency_level>&val);
     friend void set_query(const trace_state_ptr& p, const sstring& val);
     friend void set_user_timestamp(const trace_state_ptr& p, api::timestamp_type val);
+    friend void record_replica_response(const trace_state_ptr& p, gms::inet_address ep);
+    friend void add_scanned_tombstones(const trace_state_ptr& p, uint64_t n);
 };
 
 inline void trace_state::trace(sstring message) {
+    if (!_full_tracing) {
+        return;
+    }
+
     if (!_tracing_began) {
         throw std::logic_error("trying to use a trace() before begin() for \"" + message + "\" tracepoint");
     }
@@ -308,6 +350,10 @@ inline void trace_state::trace(sstring message) {
 
 template <typename... A>
 void trace_state::trace(const char* fmt, A&&... a) {
+    if (!_full_tracing) {
+        return;
+    }
+
     try {
         trace(seastar::format(fmt, std::forward<A>(a)...));
     } catch (...) {
@@ -365,6 +411,18 @@ inline void set_user_timestamp(const trace_state_ptr& p, api::timestamp_type val
     }
 }
 
+inline void record_replica_response(const trace_state_ptr& p, gms::inet_address ep) {
+    if (p) {
+        p->record_replica_response(ep);
+    }
+}
+
+inline void add_scanned_tombstones(const trace_state_ptr& p, uint64_t n) {
+    if (p) {
+        p->add_scanned_tombstones(n);
+    }
+}
+
 /**
  * A helper for conditional invoking trace_state::begin() functions.
  *
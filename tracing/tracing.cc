@@ -74,6 +74,14 @@ tracing::tracing(const sstring& tracing_backend_helper_class_name)
                     , scollectd::per_cpu_plugin_instance
                     , "total_operations", "trace_errors")
                     , scollectd::make_typed(scollectd::data_type::DERIVE, stats.trace_errors)),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tracing"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "slow_query_records")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, stats.slow_query_records)),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tracing"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "slow_query_records_dropped")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, stats.slow_query_records_dropped)),
             scollectd::add_polled_metric(scollectd::type_instance_id("tracing"
                     , scollectd::per_cpu_plugin_instance
                     , "queue_length", "active_sessions")
@@ -131,6 +139,15 @@ trace_state_ptr tracing::create_session(trace_type type, bool write_on_close, co
     }
 }
 
+trace_state_ptr tracing::create_slow_query_session(trace_type type) {
+    try {
+        return make_lw_shared<trace_state>(type, false, std::experimental::nullopt, false);
+    } catch (...) {
+        // return an uninitialized state in case of any error (OOM?)
+        return trace_state_ptr();
+    }
+}
+
 future<> tracing::start() {
     return _tracing_backend_helper_ptr->start().then([this] {
         _write_timer.arm(write_period);
@@ -143,6 +160,7 @@ void tracing::write_timer_callback() {
     }
 
     logger.trace("Timer kicks in: {}", _pending_for_write_sessions ? "writing" : "not writing");
+    _slow_query_records_in_period = 0;
     write_pending_records();
     _write_timer.arm(write_period);
 }
@@ -165,15 +183,39 @@ future<> tracing::stop() {
     return make_ready_future<>();
 }
 
-void tracing::set_trace_probability(double p) {
+uint64_t tracing::normalize_probability(double p) const {
     if (p < 0 || p > 1) {
         throw std::invalid_argument("trace probability must be in a [0,1] range");
     }
 
+    return std::llround(p * (_gen.max() + 1));
+}
+
+void tracing::set_trace_probability(double p) {
+    _normalized_trace_probability = normalize_probability(p);
     _trace_probability = p;
-    _normalized_trace_probability = std::llround(_trace_probability * (_gen.max() + 1));
 
     logger.info("Setting tracing probability to {} (normalized {})", _trace_probability, _normalized_trace_probability);
 }
+
+void tracing::set_table_trace_probability(const sstring& ks, const sstring& cf, double p) {
+    auto normalized = normalize_probability(p);
+    auto key = std::make_pair(ks, cf);
+    if (normalized) {
+        _table_trace_probabilities[key] = normalized;
+    } else {
+        _table_trace_probabilities.erase(key);
+    }
+
+    logger.info("Setting tracing probability of {}.{} to {} (normalized {})", ks, cf, p, normalized);
+}
+
+double tracing::get_table_trace_probability(const sstring& ks, const sstring& cf) const {
+    auto i = _table_trace_probabilities.find(std::make_pair(ks, cf));
+    if (i == _table_trace_probabilities.end()) {
+        return 0;
+    }
+    return double(i->second) / (double(_gen.max()) + 1);
+}
 }
 
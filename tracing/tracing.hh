@@ -41,6 +41,7 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <atomic>
 #include <random>
 #include <seastar/core/sharded.hh>
@@ -148,6 +149,29 @@ struct i_tracing_backend_helper {
                                     gc_clock::duration ttl,
                                     wall_clock::time_point event_time_point) = 0;
 
+    /**
+     * Write a new slow query log record
+     *
+     * @param session_id ID of the session which traced the query
+     * @param client client IP
+     * @param parameters parameters of the query and the timing breakdown of
+     *                   its execution
+     * @param request request the query was
+     * @param started_at amount of milliseconds passed since Epoch before the
+     *                   query was started
+     * @param command a type of the trace
+     * @param elapsed number of microseconds the query took
+     * @param ttl TTL of the record
+     */
+    virtual void write_slow_query_record(const utils::UUID& session_id,
+                                         gms::inet_address client,
+                                         std::unordered_map<sstring, sstring> parameters,
+                                         sstring request,
+                                         long started_at,
+                                         trace_type command,
+                                         int elapsed,
+                                         gc_clock::duration ttl) = 0;
+
 private:
     /**
      * Commit all pending tracing records to the underlying storage.
@@ -166,6 +190,8 @@ class tracing : public seastar::async_sharded_service<tracing> {
     static const gc_clock::duration write_period;
     static constexpr int max_pending_for_write_sessions = 1000;
     static constexpr int max_trace_events_per_session = 30;
+    // Slow query log records each shard writes per write_period at most
+    static constexpr int max_slow_query_records_per_period = 100;
     // Number of max threshold XXX hits when an info message is printed
     static constexpr int max_threshold_hits_warning_period = 10000;
 
@@ -174,6 +200,8 @@ class tracing : public seastar::async_sharded_service<tracing> {
         uint64_t max_traces_threshold_hits = 0;
         uint64_t trace_events_count = 0;
         uint64_t trace_errors = 0;
+        uint64_t slow_query_records = 0;
+        uint64_t slow_query_records_dropped = 0;
     } stats;
 
 private:
@@ -188,6 +216,13 @@ class tracing : public seastar::async_sharded_service<tracing> {
     double _trace_probability = 0.0; // keep this one for querying purposes
     uint64_t _normalized_trace_probability = 0;
     std::ranlux48_base _gen;
+    // Tables whose queries are traced with a probability of their own, on
+    // top of the global one. Normalized like _normalized_trace_probability.
+    std::map<std::pair<sstring, sstring>, uint64_t> _table_trace_probabilities;
+    // Requests taking longer than this are written to the slow query log,
+    // if it isn't 0.
+    std::chrono::microseconds _slow_query_threshold{0};
+    int _slow_query_records_in_period = 0;
 
 public:
     i_tracing_backend_helper& backend_helper() {
@@ -256,12 +291,62 @@ class tracing : public seastar::async_sharded_service<tracing> {
      */
     trace_state_ptr create_session(trace_type type, bool write_on_close, const std::experimental::optional<utils::UUID>& session_id = std::experimental::nullopt);
 
+    /**
+     * Create a session which only records what's needed for a slow query log
+     * record, which is written if the request turns out to be slow. Such
+     * sessions don't write trace events, and don't count towards the limit
+     * of open sessions.
+     *
+     * @param type a tracing session type
+     *
+     * @return tracing state handle
+     */
+    trace_state_ptr create_slow_query_session(trace_type type);
+
     void end_session() {
         --_active_sessions;
-        ++_pending_for_write_sessions;
-        if (_pending_for_write_sessions >= max_pending_for_write_sessions) {
-            write_pending_records();
+        add_pending_for_write_session();
+    }
+
+    /**
+     * Called when a session created by create_slow_query_session() which has
+     * something to write ends.
+     */
+    void end_slow_query_session() {
+        add_pending_for_write_session();
+    }
+
+    /**
+     * Sets the latency from which on requests are written to the slow query
+     * log. 0 disables the slow query log.
+     */
+    void set_slow_query_threshold(std::chrono::microseconds threshold) {
+        _slow_query_threshold = threshold;
+    }
+    std::chrono::microseconds get_slow_query_threshold() const {
+        return _slow_query_threshold;
+    }
+    bool slow_query_log_enabled() const {
+        return _slow_query_threshold.count() != 0;
+    }
+    bool is_slow_query(int elapsed_us) const {
+        return slow_query_log_enabled() && elapsed_us >= _slow_query_threshold.count();
+    }
+
+    /**
+     * Accounts for a new slow query log record, unless too many of them were
+     * written during the current write period already.
+     *
+     * @return TRUE if the record may be written
+     */
+    bool may_write_slow_query_record() {
+        if (_slow_query_records_in_period >= max_slow_query_records_per_period) {
+            ++stats.slow_query_records_dropped;
+            return false;
         }
+        ++_slow_query_records_in_period;
+        ++stats.slow_query_records;
+        return true;
     }
 
     /**
@@ -281,7 +366,37 @@ class tracing : public seastar::async_sharded_service<tracing> {
         return _normalized_trace_probability != 0 && _gen() < _normalized_trace_probability;
     }
 
+    /**
+     * Sets a probability for tracing a CQL request to a given table, which
+     * wasn't picked for tracing by the global probability.
+     *
+     * @param ks keyspace name
+     * @param cf table name
+     * @param p a new tracing probability in a [0,1] range, 0 stops sampling
+     *          requests to the table separately
+     * @throw std::invalid_argument if @ref p is out of range
+     */
+    void set_table_trace_probability(const sstring& ks, const sstring& cf, double p);
+    double get_table_trace_probability(const sstring& ks, const sstring& cf) const;
+
+    bool trace_next_query(const sstring& ks, const sstring& cf) {
+        if (_table_trace_probabilities.empty()) {
+            return false;
+        }
+        auto i = _table_trace_probabilities.find(std::make_pair(ks, cf));
+        return i != _table_trace_probabilities.end() && _gen() < i->second;
+    }
+
 private:
+    uint64_t normalize_probability(double p) const;
+
+    void add_pending_for_write_session() {
+        ++_pending_for_write_sessions;
+        if (_pending_for_write_sessions >= max_pending_for_write_sessions) {
+            write_pending_records();
+        }
+    }
+
     void write_timer_callback();
 };
 }
@@ -22,10 +22,14 @@
 
 #pragma once
 
+#include <vector>
+#include "core/sstring.hh"
+
 namespace transport {
 namespace messages {
 
 class result_message {
+    std::vector<sstring> _warnings;
 public:
     class visitor;
     class visitor_base;
@@ -34,6 +38,15 @@ class result_message {
 
     virtual void accept(visitor&) = 0;
 
+    // Warnings returned to the client along with the result (native protocol v4).
+    void add_warning(sstring w) {
+        _warnings.push_back(std::move(w));
+    }
+
+    const std::vector<sstring>& warnings() const {
+        return _warnings;
+    }
+
     //
     // Message types:
     //
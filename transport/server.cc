@@ -25,7 +25,6 @@
 #include <boost/range/irange.hpp>
 #include <boost/bimap.hpp>
 #include <boost/assign.hpp>
-#include <boost/locale/encoding_utf.hpp>
 #include <boost/range/adaptor/sliced.hpp>
 
 #include "cql3/statements/batch_statement.hh"
@@ -36,13 +35,17 @@
 #include "core/future-util.hh"
 #include "core/reactor.hh"
 #include "utils/UUID.hh"
+#include "utils/alloc_tracker.hh"
+#include "utils/utf8.hh"
 #include "database.hh"
+#include "dht/i_partitioner.hh"
 #include "net/byteorder.hh"
 #include <seastar/core/scollectd.hh>
 #include <seastar/net/byteorder.hh>
 #include <seastar/util/lazy.hh>
 
 #include "enum_set.hh"
+#include "bytes_ostream.hh"
 #include "service/query_state.hh"
 #include "service/client_state.hh"
 #include "exceptions/exceptions.hh"
@@ -185,7 +188,10 @@ class cql_server::response {
     int16_t           _stream;
     cql_binary_opcode _opcode;
     std::experimental::optional<utils::UUID> _tracing_id;
-    std::vector<char> _body;
+    std::vector<sstring> _warnings;
+    // Body is built in CQL wire format in a fragmented buffer, so that large
+    // results don't have to be reallocated and copied as they grow.
+    bytes_ostream _body;
 public:
     response(int16_t stream, cql_binary_opcode opcode)
         : _stream{stream}
@@ -196,7 +202,11 @@ class cql_server::response {
         _tracing_id = id;
     }
 
-    scattered_message<char> make_message(uint8_t version);
+    void add_warning(sstring w) {
+        _warnings.push_back(std::move(w));
+    }
+
+    scattered_message<char> make_message(uint8_t version, bool compression);
     void serialize(const event::schema_change& event, uint8_t version);
     void write_byte(uint8_t b);
     void write_int(int32_t n);
@@ -215,16 +225,15 @@ class cql_server::response {
     void write_consistency(db::consistency_level c);
     void write_string_map(std::map<sstring, sstring> string_map);
     void write_string_multimap(std::multimap<sstring, sstring> string_map);
-    void write_value(bytes_opt value);
+    void write_value(const bytes_opt& value);
     void write(const cql3::metadata& m);
     void write(const cql3::prepared_metadata& m, uint8_t version);
-    future<> output(output_stream<char>& out, uint8_t version, bool compression);
 
     cql_binary_opcode opcode() const {
         return _opcode;
     }
 private:
-    std::vector<char> compress(const std::vector<char>& body);
+    bytes_ostream compress(bytes_view body);
 
     template <typename CqlFrameHeaderType>
     sstring make_frame_one(uint8_t version, uint8_t flags, size_t length) {
@@ -237,6 +246,17 @@ class cql_server::response {
             flags |= cql_frame_flags::tracing;
         }
 
+        // Warnings (v4) are a [string list] following the tracing session ID.
+        size_t warnings_len = 0;
+        if (!_warnings.empty()) {
+            warnings_len = sizeof(uint16_t);
+            for (auto&& w : _warnings) {
+                warnings_len += sizeof(uint16_t) + w.size();
+            }
+            extra_len += warnings_len;
+            flags |= cql_frame_flags::warning;
+        }
+
         sstring frame_buf(sstring::initialized_later(), sizeof(CqlFrameHeaderType) + extra_len);
         auto* frame = reinterpret_cast<CqlFrameHeaderType*>(frame_buf.begin());
         frame->version = version | 0x80;
@@ -250,6 +270,20 @@ class cql_server::response {
             std::memcpy(frame_buf.data() + sizeof(CqlFrameHeaderType), _tracing_id->to_bytes().data(), 16);
         }
 
+        if (warnings_len) {
+            auto p = frame_buf.data() + frame_buf.size() - warnings_len;
+            auto put_short = [&p] (uint16_t n) {
+                auto u = htons(n);
+                std::memcpy(p, &u, sizeof(u));
+                p += sizeof(u);
+            };
+            put_short(_warnings.size());
+            for (auto&& w : _warnings) {
+                put_short(w.size());
+                p = std::copy(w.begin(), w.end(), p);
+            }
+        }
+
         return frame_buf;
     }
 
@@ -461,7 +495,7 @@ cql_server::connection::read_frame() {
 }
 
 future<response_type>
-    cql_server::connection::process_request_one(bytes_view buf, uint8_t op, uint16_t stream, service::client_state client_state, tracing_request_type tracing_request) {
+    cql_server::connection::process_request_one(bytes_view buf, uint8_t op, uint8_t flags, uint16_t stream, service::client_state client_state, tracing_request_type tracing_request) {
     auto cqlop = static_cast<cql_binary_opcode>(op);
 
     if (tracing_request != tracing_request_type::not_requested) {
@@ -469,11 +503,21 @@ future<response_type>
             cqlop == cql_binary_opcode::PREPARE ||
             cqlop == cql_binary_opcode::EXECUTE ||
             cqlop == cql_binary_opcode::BATCH) {
-            client_state.create_tracing_session(tracing::trace_type::QUERY, tracing_request == tracing_request_type::write_on_close);
+            if (tracing_request == tracing_request_type::slow_query_log_only) {
+                client_state.create_slow_query_tracing_session(tracing::trace_type::QUERY);
+            } else {
+                client_state.create_tracing_session(tracing::trace_type::QUERY, tracing_request == tracing_request_type::write_on_close);
+            }
         }
     }
 
-    return make_ready_future<>().then([this, cqlop, stream, buf = std::move(buf), client_state] () mutable {
+    auto q_state = get_query_state(std::move(client_state));
+    auto& qs = *q_state;
+    return futurize_apply([this, cqlop, flags, stream, buf = std::move(buf), &qs] () mutable {
+        if (_version >= 4 && (flags & cql_frame_flags::custom_payload)) {
+            // No request handler makes use of custom payloads.
+            skip_bytes_map(buf);
+        }
         // When using authentication, we need to ensure we are doing proper state transitions,
         // i.e. we cannot simply accept any query/exec ops unless auth is complete
         switch (_state) {
@@ -495,72 +539,86 @@ future<response_type>
                 break;
         }
         switch (cqlop) {
-        case cql_binary_opcode::STARTUP:       return process_startup(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::AUTH_RESPONSE: return process_auth_response(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::OPTIONS:       return process_options(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::QUERY:         return process_query(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::PREPARE:       return process_prepare(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::EXECUTE:       return process_execute(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::BATCH:         return process_batch(stream, std::move(buf), std::move(client_state));
-        case cql_binary_opcode::REGISTER:      return process_register(stream, std::move(buf), std::move(client_state));
+        case cql_binary_opcode::STARTUP:       return process_startup(stream, std::move(buf), qs);
+        case cql_binary_opcode::AUTH_RESPONSE: return process_auth_response(stream, std::move(buf), qs);
+        case cql_binary_opcode::OPTIONS:       return process_options(stream, std::move(buf), qs);
+        case cql_binary_opcode::QUERY:         return process_query(stream, std::move(buf), qs);
+        case cql_binary_opcode::PREPARE:       return process_prepare(stream, std::move(buf), qs);
+        case cql_binary_opcode::EXECUTE:       return process_execute(stream, std::move(buf), qs);
+        case cql_binary_opcode::BATCH:         return process_batch(stream, std::move(buf), qs);
+        case cql_binary_opcode::REGISTER:      return process_register(stream, std::move(buf), qs);
         default:                               throw exceptions::protocol_exception(sprint("Unknown opcode %d", int(cqlop)));
         }
-    }).then_wrapped([this, cqlop, stream, client_state] (future<response_type> f) {
+    }).then_wrapped([this, cqlop, stream, q_state = std::move(q_state)] (future<shared_ptr<cql_server::response>> f) mutable {
         --_server._requests_serving;
-        try {
-            response_type response = f.get0();
-            auto res_op = response.first->opcode();
-            // and modify state now that we've generated a response.
-            switch (_state) {
-                case state::UNINITIALIZED:
-                    if (cqlop == cql_binary_opcode::STARTUP) {
-                        if (res_op == cql_binary_opcode::AUTHENTICATE) {
-                            _state = state::AUTHENTICATION;
-                        } else if (res_op == cql_binary_opcode::READY) {
-                            _state = state::READY;
-                        }
-                    }
-                    break;
-                case state::AUTHENTICATION:
-                    // Support both SASL auth from protocol v2 and the older style Credentials auth from v1
-                    assert(cqlop == cql_binary_opcode::AUTH_RESPONSE || cqlop == cql_binary_opcode::CREDENTIALS);
-                    if (res_op == cql_binary_opcode::READY || res_op == cql_binary_opcode::AUTH_SUCCESS) {
-                        _state = state::READY;
-                        // we won't use the authenticator again, null it
-                        _sasl_challenge = nullptr;
-                    }
-                    break;
-                default:
-                case state::READY:
-                    break;
+        auto response = [&] {
+            try {
+                auto response = f.get0();
+                update_state(cqlop, *response);
+                return response;
+            } catch (const exceptions::unavailable_exception& ex) {
+                return make_unavailable_error(stream, ex.code(), ex.what(), ex.consistency, ex.required, ex.alive);
+            } catch (const exceptions::read_timeout_exception& ex) {
+                return make_read_timeout_error(stream, ex.code(), ex.what(), ex.consistency, ex.received, ex.block_for, ex.data_present);
+            } catch (const exceptions::mutation_write_timeout_exception& ex) {
+                return make_mutation_write_timeout_error(stream, ex.code(), ex.what(), ex.consistency, ex.received, ex.block_for, ex.type);
+            } catch (const exceptions::already_exists_exception& ex) {
+                return make_already_exists_error(stream, ex.code(), ex.what(), ex.ks_name, ex.cf_name);
+            } catch (const exceptions::prepared_query_not_found_exception& ex) {
+                return make_unprepared_error(stream, ex.code(), ex.what(), ex.id);
+            } catch (const exceptions::cassandra_exception& ex) {
+                return make_error(stream, ex.code(), ex.what());
+            } catch (std::exception& ex) {
+                return make_error(stream, exceptions::exception_code::SERVER_ERROR, ex.what());
+            } catch (...) {
+                return make_error(stream, exceptions::exception_code::SERVER_ERROR, "unknown error");
             }
-            return make_ready_future<response_type>(response);
-        } catch (const exceptions::unavailable_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_unavailable_error(stream, ex.code(), ex.what(), ex.consistency, ex.required, ex.alive), client_state));
-        } catch (const exceptions::read_timeout_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_read_timeout_error(stream, ex.code(), ex.what(), ex.consistency, ex.received, ex.block_for, ex.data_present), client_state));
-        } catch (const exceptions::mutation_write_timeout_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_mutation_write_timeout_error(stream, ex.code(), ex.what(), ex.consistency, ex.received, ex.block_for, ex.type), client_state));
-        } catch (const exceptions::already_exists_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_already_exists_error(stream, ex.code(), ex.what(), ex.ks_name, ex.cf_name), client_state));
-        } catch (const exceptions::prepared_query_not_found_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_unprepared_error(stream, ex.code(), ex.what(), ex.id), client_state));
-        } catch (const exceptions::cassandra_exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_error(stream, ex.code(), ex.what()), client_state));
-        } catch (std::exception& ex) {
-            return make_ready_future<response_type>(std::make_pair(make_error(stream, exceptions::exception_code::SERVER_ERROR, ex.what()), client_state));
-        } catch (...) {
-            return make_ready_future<response_type>(std::make_pair(make_error(stream, exceptions::exception_code::SERVER_ERROR, "unknown error"), client_state));
+        }();
+        auto client_state = std::move(q_state->client_state());
+        put_query_state(std::move(q_state));
+        auto& tracing_session_id_ptr = client_state.tracing_session_id_ptr();
+        if (tracing_session_id_ptr) {
+            response->set_tracing_id(*tracing_session_id_ptr);
         }
+        return make_ready_future<response_type>(std::make_pair(make_foreign(std::move(response)), std::move(client_state)));
     });
 }
 
+// Modifies the connection state now that we've generated a response.
+void cql_server::connection::update_state(cql_binary_opcode cqlop, const cql_server::response& response) {
+    auto res_op = response.opcode();
+    switch (_state) {
+        case state::UNINITIALIZED:
+            if (cqlop == cql_binary_opcode::STARTUP) {
+                if (res_op == cql_binary_opcode::AUTHENTICATE) {
+                    _state = state::AUTHENTICATION;
+                } else if (res_op == cql_binary_opcode::READY) {
+                    _state = state::READY;
+                }
+            }
+            break;
+        case state::AUTHENTICATION:
+            // Support both SASL auth from protocol v2 and the older style Credentials auth from v1
+            assert(cqlop == cql_binary_opcode::AUTH_RESPONSE || cqlop == cql_binary_opcode::CREDENTIALS);
+            if (res_op == cql_binary_opcode::READY || res_op == cql_binary_opcode::AUTH_SUCCESS) {
+                _state = state::READY;
+                // we won't use the authenticator again, null it
+                _sasl_challenge = nullptr;
+            }
+            break;
+        default:
+        case state::READY:
+            break;
+    }
+}
+
 cql_server::connection::connection(cql_server& server, connected_socket&& fd, socket_address addr)
     : _server(server)
     , _fd(std::move(fd))
     , _read_buf(_fd.input())
     , _write_buf(_fd.output())
-    , _client_state(service::client_state::external_tag{}, addr) {
+    , _client_state(service::client_state::external_tag{}, addr)
+    , _cpu(engine().cpu_id()) {
     ++_server._total_connections;
     ++_server._current_connections;
     _server._connections_list.push_back(*this);
@@ -627,6 +685,8 @@ future<> cql_server::connection::process_request() {
             tracing_requested = tracing_request_type::write_on_close;
         } else if (tracing::tracing::get_local_tracing_instance().trace_next_query()) {
             tracing_requested = tracing_request_type::no_write_on_close;
+        } else if (tracing::tracing::get_local_tracing_instance().slow_query_log_enabled()) {
+            tracing_requested = tracing_request_type::slow_query_log_only;
         }
 
         auto op = f.opcode;
@@ -648,14 +708,8 @@ future<> cql_server::connection::process_request() {
             with_gate(_pending_requests_gate, [this, flags, op, stream, buf = std::move(buf), tracing_requested] () mutable {
                 auto bv = bytes_view{reinterpret_cast<const int8_t*>(buf.begin()), buf.size()};
                 auto cpu = pick_request_cpu();
-                return smp::submit_to(cpu, [this, bv = std::move(bv), op, stream, client_state = _client_state, tracing_requested] () mutable {
-                    return this->process_request_one(bv, op, stream, std::move(client_state), tracing_requested).then([](auto&& response) {
-                        auto& tracing_session_id_ptr = response.second.tracing_session_id_ptr();
-                        if (tracing_session_id_ptr) {
-                            response.first->set_tracing_id(*tracing_session_id_ptr);
-                        }
-                        return std::make_pair(make_foreign(response.first), response.second);
-                    });
+                return smp::submit_to(cpu, [this, bv = std::move(bv), op, flags, stream, client_state = _client_state, tracing_requested] () mutable {
+                    return this->process_request_one(bv, op, flags, stream, std::move(client_state), tracing_requested);
                 }).then([this, flags] (auto&& response) {
                     _client_state.merge(response.second);
                     bool compression = flags & cql_frame_flags::compression;
@@ -715,17 +769,37 @@ unsigned cql_server::connection::pick_request_cpu()
     return engine().cpu_id();
 }
 
-future<response_type> cql_server::connection::process_startup(uint16_t stream, bytes_view buf, service::client_state client_state)
+std::unique_ptr<cql_query_state> cql_server::connection::get_query_state(service::client_state&& client_state) {
+    std::unique_ptr<cql_query_state> q_state;
+    if (engine().cpu_id() == _cpu && !_free_query_states.empty()) {
+        q_state = std::move(_free_query_states.back());
+        _free_query_states.pop_back();
+    } else {
+        q_state = std::make_unique<cql_query_state>();
+    }
+    q_state->query_state.emplace(std::move(client_state));
+    return q_state;
+}
+
+// Requests processed on other shards free their states there.
+void cql_server::connection::put_query_state(std::unique_ptr<cql_query_state> q_state) {
+    q_state->reset();
+    if (engine().cpu_id() == _cpu && _free_query_states.size() < max_free_query_states) {
+        _free_query_states.push_back(std::move(q_state));
+    }
+}
+
+future<shared_ptr<cql_server::response>> cql_server::connection::process_startup(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     /*auto string_map =*/ read_string_map(buf);
     auto& a = auth::authenticator::get();
     if (a.require_authentication()) {
-        return make_ready_future<response_type>(std::make_pair(make_autheticate(stream, a.class_name()), client_state));
+        return make_ready_future<shared_ptr<cql_server::response>>(make_autheticate(stream, a.class_name()));
     }
-    return make_ready_future<response_type>(std::make_pair(make_ready(stream), client_state));
+    return make_ready_future<shared_ptr<cql_server::response>>(make_ready(stream));
 }
 
-future<response_type> cql_server::connection::process_auth_response(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>> cql_server::connection::process_auth_response(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     if (_sasl_challenge == nullptr) {
         _sasl_challenge = auth::authenticator::get().new_sasl_challenge();
@@ -733,20 +807,23 @@ future<response_type> cql_server::connection::process_auth_response(uint16_t str
 
     auto challenge = _sasl_challenge->evaluate_response(buf);
     if (_sasl_challenge->is_complete()) {
-        return _sasl_challenge->get_authenticated_user().then([this, stream, client_state = std::move(client_state), challenge = std::move(challenge)](::shared_ptr<auth::authenticated_user> user) mutable {
-            client_state.set_login(std::move(user));
-            auto f = client_state.check_user_exists();
-            return f.then([this, stream, client_state = std::move(client_state), challenge = std::move(challenge)]() mutable {
-                return make_ready_future<response_type>(std::make_pair(make_auth_success(stream, std::move(challenge)), std::move(client_state)));
+        return _sasl_challenge->get_authenticated_user().then([this, stream, &q_state, challenge = std::move(challenge)](::shared_ptr<auth::authenticated_user> user) mutable {
+            // The login is kept only once the user is known to exist.
+            auto client_state = make_lw_shared<service::client_state>(q_state.client_state());
+            client_state->set_login(std::move(user));
+            auto f = client_state->check_user_exists();
+            return f.then([this, stream, &q_state, client_state, challenge = std::move(challenge)]() mutable {
+                q_state.client_state() = std::move(*client_state);
+                return make_auth_success(stream, std::move(challenge));
             });
         });
     }
-    return make_ready_future<response_type>(std::make_pair(make_auth_challenge(stream, std::move(challenge)), std::move(client_state)));
+    return make_ready_future<shared_ptr<cql_server::response>>(make_auth_challenge(stream, std::move(challenge)));
 }
 
-future<response_type> cql_server::connection::process_options(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>> cql_server::connection::process_options(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
-    return make_ready_future<response_type>(std::make_pair(make_supported(stream), client_state));
+    return make_ready_future<shared_ptr<cql_server::response>>(make_supported(stream));
 }
 
 void
@@ -754,13 +831,12 @@ cql_server::connection::init_cql_serialization_format() {
     _cql_serialization_format = cql_serialization_format(_version);
 }
 
-future<response_type> cql_server::connection::process_query(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>> cql_server::connection::process_query(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     auto query = read_long_string_view(buf);
-    auto q_state = std::make_unique<cql_query_state>(client_state);
-    auto& query_state = q_state->query_state;
-    q_state->options = read_options(buf);
-    auto& options = *q_state->options;
+    auto& query_state = *q_state.query_state;
+    q_state.options.emplace(read_options(buf));
+    auto& options = *q_state.options;
 
     tracing::set_page_size(query_state.get_trace_state(), options.get_page_size());
     tracing::set_consistency_level(query_state.get_trace_state(), options.get_consistency());
@@ -770,26 +846,22 @@ future<response_type> cql_server::connection::process_query(uint16_t stream, byt
 
     tracing::begin(query_state.get_trace_state(), "Execute CQL3 query", query_state.get_client_state().get_client_address());
 
-    return _server._query_processor.local().process(query, query_state, options).then([this, stream, buf = std::move(buf), &query_state] (auto msg) {
+    return _server._query_processor.local().process(query, query_state, options).then([this, stream, &query_state] (auto msg) {
          tracing::trace(query_state.get_trace_state(), "Done processing - preparing a result");
          return this->make_result(stream, msg);
-    }).then([&query_state, q_state = std::move(q_state), this] (auto&& response) {
-        /* Keep q_state alive. */
-        return make_ready_future<response_type>(std::make_pair(response, query_state.get_client_state()));
     });
 }
 
-future<response_type> cql_server::connection::process_prepare(uint16_t stream, bytes_view buf, service::client_state client_state_)
+future<shared_ptr<cql_server::response>> cql_server::connection::process_prepare(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     auto query = read_long_string_view(buf).to_string();
+    const auto& cs = q_state.client_state();
 
-    tracing::set_query(client_state_.get_trace_state(), query);
-    tracing::begin(client_state_.get_trace_state(), "Preparing CQL3 query", client_state_.get_client_address());
+    tracing::set_query(cs.get_trace_state(), query);
+    tracing::begin(cs.get_trace_state(), "Preparing CQL3 query", cs.get_client_address());
 
     auto cpu_id = engine().cpu_id();
     auto cpus = boost::irange(0u, smp::count);
-    auto client_state = std::make_unique<service::client_state>(client_state_);
-    const auto& cs = *client_state;
     return parallel_for_each(cpus.begin(), cpus.end(), [this, query, cpu_id, &cs] (unsigned int c) mutable {
         if (c != cpu_id) {
             return smp::submit_to(c, [this, query, &cs] () mutable {
@@ -807,13 +879,10 @@ future<response_type> cql_server::connection::process_prepare(uint16_t stream, b
             }));
             return this->make_result(stream, msg);
         });
-    }).then([client_state = std::move(client_state)] (auto&& response) {
-        /* keep client_state alive */
-        return make_ready_future<response_type>(std::make_pair(response, *client_state));
     });
 }
 
-future<response_type> cql_server::connection::process_execute(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>> cql_server::connection::process_execute(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     auto id = read_short_bytes(buf);
     auto prepared = _server._query_processor.local().get_prepared(id);
@@ -821,19 +890,18 @@ future<response_type> cql_server::connection::process_execute(uint16_t stream, b
         throw exceptions::prepared_query_not_found_exception(id);
     }
 
-    auto q_state = std::make_unique<cql_query_state>(client_state);
-    auto& query_state = q_state->query_state;
-    q_state->options = read_options(buf);
-    auto& options = *q_state->options;
+    auto& query_state = *q_state.query_state;
+    q_state.options.emplace(read_options(buf));
+    auto& options = *q_state.options;
     options.prepare(prepared->bound_names);
 
-    tracing::set_page_size(client_state.get_trace_state(), options.get_page_size());
-    tracing::set_consistency_level(client_state.get_trace_state(), options.get_consistency());
-    tracing::set_optional_serial_consistency_level(client_state.get_trace_state(), options.get_serial_consistency());
-    tracing::set_query(client_state.get_trace_state(), prepared->raw_cql_statement);
+    tracing::set_page_size(query_state.get_trace_state(), options.get_page_size());
+    tracing::set_consistency_level(query_state.get_trace_state(), options.get_consistency());
+    tracing::set_optional_serial_consistency_level(query_state.get_trace_state(), options.get_serial_consistency());
+    tracing::set_query(query_state.get_trace_state(), prepared->raw_cql_statement);
 
-    tracing::begin(client_state.get_trace_state(), seastar::value_of([&id] { return seastar::format("Execute CQL3 prepared query [{}]", id); }),
-                   client_state.get_client_address());
+    tracing::begin(query_state.get_trace_state(), seastar::value_of([&id] { return seastar::format("Execute CQL3 prepared query [{}]", id); }),
+                   query_state.get_client_state().get_client_address());
 
     auto stmt = prepared->statement;
     tracing::trace(query_state.get_trace_state(), "Checking bounds");
@@ -842,17 +910,14 @@ future<response_type> cql_server::connection::process_execute(uint16_t stream, b
         throw exceptions::invalid_request_exception("Invalid amount of bind variables");
     }
     tracing::trace(query_state.get_trace_state(), "Processing a statement");
-    return _server._query_processor.local().process_statement(stmt, query_state, options).then([this, stream, buf = std::move(buf), &query_state] (auto msg) {
+    return _server._query_processor.local().process_statement(stmt, query_state, options).then([this, stream, &query_state] (auto msg) {
         tracing::trace(query_state.get_trace_state(), "Done processing - preparing a result");
         return this->make_result(stream, msg);
-    }).then([&query_state, q_state = std::move(q_state), this] (auto&& response) {
-        /* Keep q_state alive. */
-        return make_ready_future<response_type>(std::make_pair(response, query_state.get_client_state()));
     });
 }
 
-future<response_type>
-cql_server::connection::process_batch(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>>
+cql_server::connection::process_batch(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     if (_version == 1) {
         throw exceptions::protocol_exception("BATCH messages are not support in version 1 of the protocol");
@@ -867,7 +932,9 @@ cql_server::connection::process_batch(uint16_t stream, bytes_view buf, service::
     modifications.reserve(n);
     values.reserve(n);
 
-    tracing::begin(client_state.get_trace_state(), "Execute batch of CQL3 queries", client_state.get_client_address());
+    auto& query_state = *q_state.query_state;
+    auto& client_state = query_state.get_client_state();
+    tracing::begin(query_state.get_trace_state(), "Execute batch of CQL3 queries", client_state.get_client_address());
 
     for ([[gnu::unused]] auto i : boost::irange(0u, n)) {
         const auto kind = read_byte(buf);
@@ -877,7 +944,7 @@ cql_server::connection::process_batch(uint16_t stream, bytes_view buf, service::
         switch (kind) {
         case 0: {
             auto query = read_long_string_view(buf).to_string();
-            ps = _server._query_processor.local().get_statement(query, client_state);
+            ps = _server._query_processor.local().get_unprepared_statement(query, client_state);
             break;
         }
         case 1: {
@@ -911,27 +978,22 @@ cql_server::connection::process_batch(uint16_t stream, bytes_view buf, service::
         values.emplace_back(std::move(tmp));
     }
 
-    auto q_state = std::make_unique<cql_query_state>(client_state);
-    auto& query_state = q_state->query_state;
     // #563. CQL v2 encodes query_options in v1 format for batch requests.
-    q_state->options = std::make_unique<cql3::query_options>(std::move(*read_options(buf, _version < 3 ? 1 : _version)), std::move(values));
-    auto& options = *q_state->options;
+    q_state.options.emplace(read_options(buf, _version < 3 ? 1 : _version), std::move(values));
+    auto& options = *q_state.options;
 
-    tracing::set_consistency_level(client_state.get_trace_state(), options.get_consistency());
-    tracing::set_optional_serial_consistency_level(client_state.get_trace_state(), options.get_serial_consistency());
-    tracing::trace(client_state.get_trace_state(), "Creating a batch statement");
+    tracing::set_consistency_level(query_state.get_trace_state(), options.get_consistency());
+    tracing::set_optional_serial_consistency_level(query_state.get_trace_state(), options.get_serial_consistency());
+    tracing::trace(query_state.get_trace_state(), "Creating a batch statement");
 
     auto batch = ::make_shared<cql3::statements::batch_statement>(-1, cql3::statements::batch_statement::type(type), std::move(modifications), cql3::attributes::none());
     return _server._query_processor.local().process_batch(batch, query_state, options).then([this, stream, batch] (auto msg) {
         return this->make_result(stream, msg);
-    }).then([&query_state, q_state = std::move(q_state), this] (auto&& response) {
-        /* Keep q_state alive. */
-        return make_ready_future<response_type>(std::make_pair(response, query_state.get_client_state()));
     });
 }
 
-future<response_type>
-cql_server::connection::process_register(uint16_t stream, bytes_view buf, service::client_state client_state)
+future<shared_ptr<cql_server::response>>
+cql_server::connection::process_register(uint16_t stream, bytes_view buf, cql_query_state& q_state)
 {
     std::vector<sstring> event_types;
     read_string_list(buf, event_types);
@@ -939,7 +1001,7 @@ cql_server::connection::process_register(uint16_t stream, bytes_view buf, servic
         auto et = parse_event_type(event_type);
         _server._notifier->register_event(et, this);
     }
-    return make_ready_future<response_type>(std::make_pair(make_ready(stream), client_state));
+    return make_ready_future<shared_ptr<cql_server::response>>(make_ready(stream));
 }
 
 shared_ptr<cql_server::response> cql_server::connection::make_unavailable_error(int16_t stream, exceptions::exception_code err, sstring msg, db::consistency_level cl, int32_t required, int32_t alive)
@@ -1033,6 +1095,18 @@ shared_ptr<cql_server::response> cql_server::connection::make_supported(int16_t
     std::multimap<sstring, sstring> opts;
     opts.insert({"CQL_VERSION", cql3::query_processor::CQL_VERSION});
     opts.insert({"COMPRESSION", "lz4"});
+    // Tell shard-aware drivers which shard serves this connection and how
+    // tokens map to shards, so that they can keep a connection per shard and
+    // send every request to the shard owning its token. Requests are only
+    // executed on the connection's shard without load balancing.
+    if (_server._lb == cql_load_balance::none) {
+        opts.insert({"SCYLLA_SHARD", sprint("%d", engine().cpu_id())});
+        opts.insert({"SCYLLA_NR_SHARDS", sprint("%d", smp::count)});
+        opts.insert({"SCYLLA_PARTITIONER", dht::global_partitioner().name()});
+        // The token range is split evenly into smp::count contiguous ranges,
+        // see i_partitioner::shard_of().
+        opts.insert({"SCYLLA_SHARDING_ALGORITHM", "contiguous-token-ranges"});
+    }
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::SUPPORTED);
     response->write_string_multimap(opts);
     return response;
@@ -1097,9 +1171,15 @@ class cql_server::fmt_visitor : public messages::result_message::visitor_base {
 shared_ptr<cql_server::response>
 cql_server::connection::make_result(int16_t stream, shared_ptr<messages::result_message> msg)
 {
+    utils::alloc_scope alloc(utils::alloc_scope_id::cql_response);
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::RESULT);
     fmt_visitor fmt{_version, response};
     msg->accept(fmt);
+    if (_version >= 4) {
+        for (auto&& w : msg->warnings()) {
+            response->add_warning(w);
+        }
+    }
     return response;
 }
 
@@ -1134,11 +1214,19 @@ cql_server::connection::make_schema_change_event(const event::schema_change& eve
 
 future<> cql_server::connection::write_response(foreign_ptr<shared_ptr<cql_server::response>>&& response, bool compression)
 {
+    ++_pending_responses;
     _ready_to_respond = _ready_to_respond.then([this, compression, response = std::move(response)] () mutable {
-        return do_with(std::move(response), [this, compression] (auto& response) {
-            return response->output(_write_buf, _version, compression).then([this] {
-                return _write_buf.flush();
-            });
+        auto msg = response->make_message(_version, compression);
+        // The body is sent from its own fragments, the response goes away
+        // once the stream is done with them.
+        msg.on_delete([response = std::move(response)] { });
+        return _write_buf.write(std::move(msg)).then([this] {
+            // Responses which completed while earlier ones were being written
+            // are queued behind them, flush once after the last one.
+            if (--_pending_responses) {
+                return make_ready_future<>();
+            }
+            return _write_buf.flush();
         });
     });
     return make_ready_future<>();
@@ -1153,9 +1241,7 @@ void cql_server::connection::check_room(bytes_view& buf, size_t n)
 
 void cql_server::connection::validate_utf8(sstring_view s)
 {
-    try {
-        boost::locale::conv::utf_to_utf<char>(s.begin(), s.end(), boost::locale::conv::stop);
-    } catch (const boost::locale::conv::conversion_error& ex) {
+    if (!utils::utf8::validate(reinterpret_cast<const uint8_t*>(s.data()), s.size())) {
         throw exceptions::protocol_exception("Cannot decode string as UTF8");
     }
 }
@@ -1253,6 +1339,15 @@ db::consistency_level cql_server::connection::read_consistency(bytes_view& buf)
     return wire_to_consistency(read_short(buf));
 }
 
+void cql_server::connection::skip_bytes_map(bytes_view& buf)
+{
+    auto n = read_short(buf);
+    for (auto i = 0; i < n; i++) {
+        read_string_view(buf);
+        read_value_view(buf);
+    }
+}
+
 std::unordered_map<sstring, sstring> cql_server::connection::read_string_map(bytes_view& buf)
 {
     std::unordered_map<sstring, sstring> string_map;
@@ -1287,16 +1382,16 @@ using options_flag_enum = super_enum<options_flag,
     options_flag::NAMES_FOR_VALUES
 >;
 
-std::unique_ptr<cql3::query_options> cql_server::connection::read_options(bytes_view& buf)
+cql3::query_options cql_server::connection::read_options(bytes_view& buf)
 {
     return read_options(buf, _version);
 }
 
-std::unique_ptr<cql3::query_options> cql_server::connection::read_options(bytes_view& buf, uint8_t version)
+cql3::query_options cql_server::connection::read_options(bytes_view& buf, uint8_t version)
 {
     auto consistency = read_consistency(buf);
     if (version == 1) {
-        return std::make_unique<cql3::query_options>(consistency, std::experimental::nullopt, std::vector<bytes_view_opt>{},
+        return cql3::query_options(consistency, std::experimental::nullopt, std::vector<bytes_view_opt>{},
             false, cql3::query_options::specific_options::DEFAULT, _cql_serialization_format);
     }
 
@@ -1318,7 +1413,6 @@ std::unique_ptr<cql3::query_options> cql_server::connection::read_options(bytes_
     flags.remove<options_flag::VALUES>();
     flags.remove<options_flag::SKIP_METADATA>();
 
-    std::unique_ptr<cql3::query_options> options;
     if (flags) {
         ::shared_ptr<service::pager::paging_state> paging_state;
         int32_t page_size = flags.contains<options_flag::PAGE_SIZE>() ? read_int(buf) : -1;
@@ -1344,15 +1438,12 @@ std::unique_ptr<cql3::query_options> cql_server::connection::read_options(bytes_
         if (!names.empty()) {
             onames = std::move(names);
         }
-        options = std::make_unique<cql3::query_options>(consistency, std::move(onames), std::move(values), skip_metadata,
+        return cql3::query_options(consistency, std::move(onames), std::move(values), skip_metadata,
             cql3::query_options::specific_options{page_size, std::move(paging_state), serial_consistency, ts},
             _cql_serialization_format);
-    } else {
-        options = std::make_unique<cql3::query_options>(consistency, std::experimental::nullopt, std::move(values), skip_metadata,
-            cql3::query_options::specific_options::DEFAULT, _cql_serialization_format);
     }
-
-    return std::move(options);
+    return cql3::query_options(consistency, std::experimental::nullopt, std::move(values), skip_metadata,
+        cql3::query_options::specific_options::DEFAULT, _cql_serialization_format);
 }
 
 void cql_server::connection::read_name_and_value_list(bytes_view& buf, std::vector<sstring_view>& names, std::vector<bytes_view_opt>& values) {
@@ -1394,6 +1485,9 @@ bytes_opt cql_server::connection::read_value(bytes_view& buf) {
 
 bytes_view_opt cql_server::connection::read_value_view(bytes_view& buf) {
     auto len = read_int(buf);
+    if (len == -2 && _version >= 4) {
+        return cql3::unset_value();
+    }
     if (len < 0) {
         return {};
     }
@@ -1403,38 +1497,28 @@ bytes_view_opt cql_server::connection::read_value_view(bytes_view& buf) {
     return {std::move(bv)};
 }
 
-scattered_message<char> cql_server::response::make_message(uint8_t version) {
-    scattered_message<char> msg;
-    sstring body{_body.data(), _body.size()};
-    sstring frame = make_frame(version, 0x00, body.size());
-    msg.append(std::move(frame));
-    msg.append(std::move(body));
-    return msg;
-}
-
-future<>
-cql_server::response::output(output_stream<char>& out, uint8_t version, bool compression) {
+scattered_message<char> cql_server::response::make_message(uint8_t version, bool compression) {
     uint8_t flags = 0;
     if (compression) {
         flags |= cql_frame_flags::compression;
-        _body = compress(_body);
-    }
-    auto frame = make_frame(version, flags, _body.size());
-    auto tmp = temporary_buffer<char>(frame.size());
-    std::copy_n(frame.begin(), frame.size(), tmp.get_write());
-    auto f = out.write(tmp.get(), tmp.size());
-    return f.then([this, &out, tmp = std::move(tmp)] {
-        return out.write(_body.data(), _body.size());
-    });
+        _body = compress(_body.linearize());
+    }
+    scattered_message<char> msg;
+    msg.append(make_frame(version, flags, _body.size()));
+    // The message refers to the fragments of the body, the caller has to keep
+    // the response alive until the message is deleted.
+    for (bytes_view fragment : _body.fragments()) {
+        msg.append_static(reinterpret_cast<const char*>(fragment.data()), fragment.size());
+    }
+    return msg;
 }
 
-std::vector<char> cql_server::response::compress(const std::vector<char>& body)
+bytes_ostream cql_server::response::compress(bytes_view body)
 {
-    const char* input = body.data();
+    const char* input = reinterpret_cast<const char*>(body.data());
     size_t input_len = body.size();
-    std::vector<char> comp;
-    comp.resize(LZ4_COMPRESSBOUND(input_len) + 4);
-    char *output = comp.data();
+    std::unique_ptr<char[]> buf(new char[LZ4_COMPRESSBOUND(input_len) + 4]);
+    char *output = buf.get();
     output[0] = (input_len >> 24) & 0xFF;
     output[1] = (input_len >> 16) & 0xFF;
     output[2] = (input_len >> 8) & 0xFF;
@@ -1444,7 +1528,8 @@ std::vector<char> cql_server::response::compress(const std::vector<char>& body)
         throw std::runtime_error("CQL frame LZ4 compression failure");
     }
     size_t output_len = ret + 4;
-    comp.resize(output_len);
+    bytes_ostream comp;
+    comp.write(output, output_len);
     return comp;
 }
 
@@ -1478,28 +1563,28 @@ void cql_server::response::serialize(const event::schema_change& event, uint8_t
 
 void cql_server::response::write_byte(uint8_t b)
 {
-    _body.insert(_body.end(), b);
+    _body.write(reinterpret_cast<const char*>(&b), sizeof(b));
 }
 
 void cql_server::response::write_int(int32_t n)
 {
     auto u = htonl(n);
     auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(s, sizeof(u));
 }
 
 void cql_server::response::write_long(int64_t n)
 {
     auto u = htonq(n);
     auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(s, sizeof(u));
 }
 
 void cql_server::response::write_short(uint16_t n)
 {
     auto u = htons(n);
     auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(s, sizeof(u));
 }
 
 template<typename T>
@@ -1515,19 +1600,19 @@ T cast_if_fits(size_t v) {
 void cql_server::response::write_string(const sstring& s)
 {
     write_short(cast_if_fits<uint16_t>(s.size()));
-    _body.insert(_body.end(), s.begin(), s.end());
+    _body.write(reinterpret_cast<const char*>(s.begin()), s.size());
 }
 
 void cql_server::response::write_bytes_as_string(bytes_view s)
 {
     write_short(cast_if_fits<uint16_t>(s.size()));
-    _body.insert(_body.end(), s.begin(), s.end());
+    _body.write(s);
 }
 
 void cql_server::response::write_long_string(const sstring& s)
 {
     write_int(cast_if_fits<int32_t>(s.size()));
-    _body.insert(_body.end(), s.begin(), s.end());
+    _body.write(reinterpret_cast<const char*>(s.begin()), s.size());
 }
 
 void cql_server::response::write_uuid(utils::UUID uuid)
@@ -1547,13 +1632,13 @@ void cql_server::response::write_string_list(std::vector<sstring> string_list)
 void cql_server::response::write_bytes(bytes b)
 {
     write_int(cast_if_fits<int32_t>(b.size()));
-    _body.insert(_body.end(), b.begin(), b.end());
+    _body.write(b);
 }
 
 void cql_server::response::write_short_bytes(bytes b)
 {
     write_short(cast_if_fits<uint16_t>(b.size()));
-    _body.insert(_body.end(), b.begin(), b.end());
+    _body.write(b);
 }
 
 void cql_server::response::write_option(std::pair<int16_t, data_value> opt)
@@ -1610,7 +1695,7 @@ void cql_server::response::write_string_multimap(std::multimap<sstring, sstring>
     }
 }
 
-void cql_server::response::write_value(bytes_opt value)
+void cql_server::response::write_value(const bytes_opt& value)
 {
     if (!value) {
         write_int(-1);
@@ -1618,7 +1703,7 @@ void cql_server::response::write_value(bytes_opt value)
     }
 
     write_int(value->size());
-    _body.insert(_body.end(), value->begin(), value->end());
+    _body.write(*value);
 }
 
 class type_codec {
@@ -44,8 +44,10 @@ class database;
 namespace transport {
 
 enum cql_frame_flags {
-    compression = 0x01,
-    tracing     = 0x02,
+    compression    = 0x01,
+    tracing        = 0x02,
+    custom_payload = 0x04,
+    warning        = 0x08,
 };
 
 struct [[gnu::packed]] cql_binary_frame_v1 {
@@ -81,13 +83,21 @@ enum class cql_load_balance {
 
 cql_load_balance parse_load_balance(sstring value);
 
+enum class cql_binary_opcode : uint8_t;
+
+// State of a request. Connections keep a few of them around for reuse, so
+// both members are set only while a request is processed.
 struct cql_query_state {
-    service::query_state query_state;
-    std::unique_ptr<cql3::query_options> options;
+    stdx::optional<service::query_state> query_state;
+    stdx::optional<cql3::query_options> options;
 
-    cql_query_state(service::client_state& client_state)
-        : query_state(client_state)
-    { }
+    service::client_state& client_state() {
+        return query_state->get_client_state();
+    }
+    void reset() {
+        options = stdx::nullopt;
+        query_state = stdx::nullopt;
+    }
 };
 
 class cql_server {
@@ -117,7 +127,7 @@ class cql_server {
     future<> stop();
 public:
     class response;
-    using response_type = std::pair<shared_ptr<cql_server::response>, service::client_state>;
+    using response_type = std::pair<foreign_ptr<shared_ptr<cql_server::response>>, service::client_state>;
 private:
     class fmt_visitor;
     class connection : public boost::intrusive::list_base_hook<> {
@@ -127,11 +137,16 @@ class cql_server {
         output_stream<char> _write_buf;
         seastar::gate _pending_requests_gate;
         future<> _ready_to_respond = make_ready_future<>();
+        // Number of responses queued on _ready_to_respond and not written yet.
+        unsigned _pending_responses = 0;
         cql_protocol_version_type _version = 0;
         cql_serialization_format _cql_serialization_format = cql_serialization_format::latest();
         service::client_state _client_state;
-        std::unordered_map<uint16_t, cql_query_state> _query_states;
+        // Request states which are not in use, see get_query_state().
+        std::vector<std::unique_ptr<cql_query_state>> _free_query_states;
         unsigned _request_cpu = 0;
+        // The shard the connection belongs to.
+        const unsigned _cpu;
 
         enum class state : uint8_t {
             UNINITIALIZED, AUTHENTICATION, READY
@@ -140,7 +155,8 @@ class cql_server {
         enum class tracing_request_type : uint8_t {
             not_requested,
             no_write_on_close,
-            write_on_close
+            write_on_close,
+            slow_query_log_only
         };
 
         state _state = state::UNINITIALIZED;
@@ -152,20 +168,27 @@ class cql_server {
         future<> process_request();
         future<> shutdown();
     private:
-        future<response_type> process_request_one(bytes_view buf, uint8_t op, uint16_t stream, service::client_state client_state, tracing_request_type tracing_request);
+        static constexpr size_t max_free_query_states = 16;
+        std::unique_ptr<cql_query_state> get_query_state(service::client_state&& client_state);
+        void put_query_state(std::unique_ptr<cql_query_state> q_state);
+
+        void update_state(cql_binary_opcode cqlop, const cql_server::response& response);
+        future<response_type> process_request_one(bytes_view buf, uint8_t op, uint8_t flags, uint16_t stream, service::client_state client_state, tracing_request_type tracing_request);
         unsigned frame_size() const;
         unsigned pick_request_cpu();
         cql_binary_frame_v3 parse_frame(temporary_buffer<char> buf);
         future<temporary_buffer<char>> read_and_decompress_frame(size_t length, uint8_t flags);
         future<std::experimental::optional<cql_binary_frame_v3>> read_frame();
-        future<response_type> process_startup(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_auth_response(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_options(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_query(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_prepare(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_execute(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_batch(uint16_t stream, bytes_view buf, service::client_state client_state);
-        future<response_type> process_register(uint16_t stream, bytes_view buf, service::client_state client_state);
+        // The handlers work on the state of their request, which stays alive
+        // until the returned future resolves.
+        future<shared_ptr<cql_server::response>> process_startup(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_auth_response(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_options(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_query(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_prepare(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_execute(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_batch(uint16_t stream, bytes_view buf, cql_query_state& q_state);
+        future<shared_ptr<cql_server::response>> process_register(uint16_t stream, bytes_view buf, cql_query_state& q_state);
 
         shared_ptr<cql_server::response> make_unavailable_error(int16_t stream, exceptions::exception_code err, sstring msg, db::consistency_level cl, int32_t required, int32_t alive);
         shared_ptr<cql_server::response> make_read_timeout_error(int16_t stream, exceptions::exception_code err, sstring msg, db::consistency_level cl, int32_t received, int32_t blockfor, bool data_present);
@@ -202,8 +225,9 @@ class cql_server {
         void read_value_view_list(bytes_view& buf, std::vector<bytes_view_opt>& values);
         db::consistency_level read_consistency(bytes_view& buf);
         std::unordered_map<sstring, sstring> read_string_map(bytes_view& buf);
-        std::unique_ptr<cql3::query_options> read_options(bytes_view& buf);
-        std::unique_ptr<cql3::query_options> read_options(bytes_view& buf, uint8_t);
+        void skip_bytes_map(bytes_view& buf);
+        cql3::query_options read_options(bytes_view& buf);
+        cql3::query_options read_options(bytes_view& buf, uint8_t);
 
         void init_cql_serialization_format();
 
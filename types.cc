@@ -39,9 +39,9 @@
 #include <boost/range/numeric.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
-#include <boost/locale/encoding_utf.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 #include "utils/big_decimal.hh"
+#include "utils/utf8.hh"
 
 template<typename T>
 sstring time_point_to_string(const T& tp)
@@ -124,6 +124,9 @@ struct simple_type_impl : concrete_type<T> {
 template<typename T>
 struct integer_type_impl : simple_type_impl<T> {
     integer_type_impl(sstring name) : simple_type_impl<T>(name) {}
+    virtual abstract_type::comparable_encoding get_comparable_encoding() const override {
+        return abstract_type::comparable_encoding::signed_integer;
+    }
     virtual void serialize(const void* value, bytes::iterator& out) const override {
         if (!value) {
             return;
@@ -239,19 +242,20 @@ struct string_type_impl : public concrete_type<sstring> {
     virtual bool is_byte_order_comparable() const override {
         return true;
     }
+    virtual comparable_encoding get_comparable_encoding() const override {
+        return comparable_encoding::unsigned_bytes;
+    }
     virtual size_t hash(bytes_view v) const override {
         return std::hash<bytes_view>()(v);
     }
     virtual void validate(bytes_view v) const override {
         if (as_cql3_type() == cql3::cql3_type::ascii) {
-            if (std::any_of(v.begin(), v.end(), [] (int8_t b) { return b < 0; })) {
-                throw marshal_exception();
+            if (!utils::ascii::validate(v)) {
+                throw marshal_exception("Validation failed - non-ASCII character in an ASCII string");
             }
         } else {
-            try {
-                boost::locale::conv::utf_to_utf<char>(v.data(), v.end(), boost::locale::conv::stop);
-            } catch (const boost::locale::conv::conversion_error& ex) {
-                throw marshal_exception(ex.what());
+            if (!utils::utf8::validate(v)) {
+                throw marshal_exception("Validation failed - invalid UTF-8 string");
             }
         }
     }
@@ -312,6 +316,9 @@ struct bytes_type_impl final : public concrete_type<bytes> {
     virtual bool is_byte_order_comparable() const override {
         return true;
     }
+    virtual comparable_encoding get_comparable_encoding() const override {
+        return comparable_encoding::unsigned_bytes;
+    }
     virtual size_t hash(bytes_view v) const override {
         return std::hash<bytes_view>()(v);
     }
@@ -433,6 +440,9 @@ class date_type_impl : public concrete_type<db_clock::time_point> {
     virtual bool is_byte_order_comparable() const override {
         return true;
     }
+    virtual comparable_encoding get_comparable_encoding() const override {
+        return comparable_encoding::unsigned_bytes;
+    }
     virtual size_t hash(bytes_view v) const override {
         return std::hash<bytes_view>()(v);
     }
@@ -498,18 +508,10 @@ struct timeuuid_type_impl : public concrete_type<utils::UUID> {
         return make_value(utils::UUID(msb, lsb));
     }
     virtual bool less(bytes_view b1, bytes_view b2) const override {
-        if (b1.empty()) {
-            return b2.empty() ? false : true;
-        }
-        if (b2.empty()) {
-            return false;
-        }
-        auto r = compare_bytes(b1, b2);
-        if (r != 0) {
-            return r < 0;
-        } else {
-            return std::lexicographical_compare(b1.begin(), b1.end(), b2.begin(), b2.end());
-        }
+        return timeuuid_tri_compare(b1, b2) < 0;
+    }
+    virtual int32_t compare(bytes_view b1, bytes_view b2) const override {
+        return timeuuid_tri_compare(b1, b2);
     }
     virtual bool is_byte_order_equal() const override {
         return true;
@@ -568,12 +570,32 @@ struct timeuuid_type_impl : public concrete_type<utils::UUID> {
                                     compare_pos(3, 0xff, 0))))))));
     }
     friend class uuid_type_impl;
+    friend int32_t timeuuid_tri_compare(bytes_view, bytes_view);
 };
 
+int32_t timeuuid_tri_compare(bytes_view b1, bytes_view b2) {
+    if (b1.empty()) {
+        return b2.empty() ? 0 : -1;
+    }
+    if (b2.empty()) {
+        return 1;
+    }
+    auto r = timeuuid_type_impl::compare_bytes(b1, b2);
+    if (r != 0) {
+        return r;
+    }
+    return lexicographical_tri_compare(b1.begin(), b1.end(), b2.begin(), b2.end(), [] (int8_t a, int8_t b) {
+        return int32_t(a) - int32_t(b);
+    });
+}
+
 class timestamp_type_impl : public simple_type_impl<db_clock::time_point> {
     static logging::logger _logger;
 public:
     timestamp_type_impl() : simple_type_impl(timestamp_type_name) {}
+    virtual comparable_encoding get_comparable_encoding() const override {
+        return comparable_encoding::signed_integer;
+    }
     virtual void serialize(const void* value, bytes::iterator& out) const override {
         if (!value) {
             return;
@@ -863,6 +885,9 @@ struct inet_addr_type_impl : concrete_type<net::ipv4_address> {
     virtual bool is_byte_order_comparable() const override {
         return true;
     }
+    virtual comparable_encoding get_comparable_encoding() const override {
+        return comparable_encoding::unsigned_bytes;
+    }
     virtual size_t hash(bytes_view v) const override {
         return std::hash<bytes_view>()(v);
     }
@@ -1246,68 +1271,18 @@ class decimal_type_impl : public concrete_type<big_decimal> {
     }
 };
 
-class counter_type_impl : public abstract_type {
-public:
-    counter_type_impl() : abstract_type{counter_type_name} { }
-    virtual void serialize(const void* value, bytes::iterator& out) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t serialized_size(const void* value) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual int32_t compare(bytes_view v1, bytes_view v2) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual bool less(bytes_view v1, bytes_view v2) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t hash(bytes_view v) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual data_value deserialize(bytes_view v) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual sstring to_string(const bytes& b) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual bytes from_string(sstring_view text) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
+// Counter cells hold the shards of the counter (see counters.hh), but values
+// of counter columns are exchanged with clients and in query results as the
+// int64_t total.
+struct counter_type_impl : integer_type_impl<int64_t> {
+    counter_type_impl() : integer_type_impl{counter_type_name}
+    { }
+
     virtual bool is_counter() const override {
         return true;
     }
     virtual ::shared_ptr<cql3::cql3_type> as_cql3_type() const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t native_value_size() const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t native_value_alignment() const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual void native_value_copy(const void* from, void* to) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual void native_value_move(void* from, void* to) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual void native_value_destroy(void* object) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual void native_value_delete(void* object) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual void* native_value_clone(const void* object) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual const std::type_info& native_typeid() const {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual bool references_user_type(const sstring& keyspace, const bytes& name) const override {
-        return false;
-    }
-    virtual std::experimental::optional<data_type> update_user_type(const shared_ptr<const user_type_impl> updated) const {
-        return std::experimental::nullopt;
+        return cql3::cql3_type::counter;
     }
 };
 
@@ -1960,43 +1935,133 @@ collection_type_impl::serialize_mutation_form_only_live(mutation_view mut, gc_cl
     }));
 }
 
+// Reads the tombstone and the number of elements of a serialized collection
+// mutation, leaving the input at the first element.
+static tombstone read_collection_mutation_header(bytes_view& in, uint32_t& count) {
+    tombstone tomb;
+    auto has_tomb = read_simple<bool>(in);
+    if (has_tomb) {
+        auto ts = read_simple<api::timestamp_type>(in);
+        auto ttl = read_simple<gc_clock::duration::rep>(in);
+        tomb = tombstone{ts, gc_clock::time_point(gc_clock::duration(ttl))};
+    }
+    count = read_simple<uint32_t>(in);
+    return tomb;
+}
+
+// Walks the elements of a serialized collection mutation in place, exposing
+// each one both parsed and as the bytes it occupies in the serialized form.
+class collection_mutation_element_reader {
+    bytes_view _in;
+    uint32_t _left;
+    bool _valid = false;
+    bytes_view _element;
+    bytes_view _key;
+    bytes_view _value;
+public:
+    collection_mutation_element_reader(bytes_view in, uint32_t count)
+        : _in(in), _left(count) {
+        advance();
+    }
+    explicit operator bool() const { return _valid; }
+    void advance() {
+        _valid = _left != 0;
+        if (!_valid) {
+            return;
+        }
+        --_left;
+        auto start = _in.begin();
+        auto ksize = read_simple<uint32_t>(_in);
+        _key = read_simple_bytes(_in, ksize);
+        auto vsize = read_simple<uint32_t>(_in);
+        _value = read_simple_bytes(_in, vsize);
+        _element = bytes_view(start, _in.begin() - start);
+    }
+    bytes_view element() const { return _element; }
+    bytes_view key() const { return _key; }
+    atomic_cell_view cell() const { return atomic_cell_view::from_bytes(_value); }
+};
+
+// Merges the serialized forms directly. Elements are copied verbatim, and
+// runs of consecutive elements which survive from the same input are copied
+// as a single range, so that applying a few elements to a large collection
+// doesn't have to take every element of it apart and put it back together.
 collection_mutation
 collection_type_impl::merge(collection_mutation_view a, collection_mutation_view b) const {
-    auto aa = deserialize_mutation_form(a);
-    auto bb = deserialize_mutation_form(b);
-    mutation_view merged;
-    merged.cells.reserve(aa.cells.size() + bb.cells.size());
-    using element_type = std::pair<bytes_view, atomic_cell_view>;
-    auto key_type = name_comparator();
-    auto compare = [key_type] (const element_type& e1, const element_type& e2) {
-        return key_type->less(e1.first, e2.first);
+    auto in_a = a.data;
+    auto in_b = b.data;
+    uint32_t count_a, count_b;
+    auto tomb_a = read_collection_mutation_header(in_a, count_a);
+    auto tomb_b = read_collection_mutation_header(in_b, count_b);
+
+    // tombstone wins if timestamps equal here, unlike row tombstones
+    // FIXME: should we consider TTLs too?
+    auto killed_by = [] (const tombstone& t, atomic_cell_view c) {
+        return t && t.timestamp >= c.timestamp();
     };
-    auto merge = [this] (const element_type& e1, const element_type& e2) {
-        // FIXME: use std::max()?
-        return std::make_pair(e1.first, compare_atomic_cell_for_merge(e1.second, e2.second) > 0 ? e1.second : e2.second);
+
+    std::vector<bytes_view> ranges;
+    uint32_t count = 0;
+    size_t size = 0;
+    auto emit = [&] (bytes_view e) {
+        if (!ranges.empty() && ranges.back().end() == e.begin()) {
+            ranges.back() = bytes_view(ranges.back().begin(), ranges.back().size() + e.size());
+        } else {
+            ranges.push_back(e);
+        }
+        ++count;
+        size += e.size();
     };
-    // applied to a tombstone, returns a predicate checking whether a cell is killed by
-    // the tombstone
-    auto cell_killed = [] (const std::experimental::optional<tombstone>& t) {
-        return [&t] (const element_type& e) {
-            if (!t) {
-                return false;
+
+    auto key_type = name_comparator();
+    collection_mutation_element_reader ra(in_a, count_a);
+    collection_mutation_element_reader rb(in_b, count_b);
+    while (ra || rb) {
+        auto cmp = !rb ? -1 : !ra ? 1 : key_type->compare(ra.key(), rb.key());
+        if (cmp < 0) {
+            if (!killed_by(tomb_b, ra.cell())) {
+                emit(ra.element());
             }
-            // tombstone wins if timestamps equal here, unlike row tombstones
-            if (t->timestamp < e.second.timestamp()) {
-                return false;
+            ra.advance();
+        } else if (cmp > 0) {
+            if (!killed_by(tomb_a, rb.cell())) {
+                emit(rb.element());
             }
-            return true;
-            // FIXME: should we consider TTLs too?
-        };
-    };
-    combine(aa.cells.begin(), std::remove_if(aa.cells.begin(), aa.cells.end(), cell_killed(bb.tomb)),
-            bb.cells.begin(), std::remove_if(bb.cells.begin(), bb.cells.end(), cell_killed(aa.tomb)),
-            std::back_inserter(merged.cells),
-            compare,
-            merge);
-    merged.tomb = std::max(aa.tomb, bb.tomb);
-    return serialize_mutation_form(merged);
+            rb.advance();
+        } else {
+            auto ca = ra.cell();
+            auto cb = rb.cell();
+            bool a_killed = killed_by(tomb_b, ca);
+            bool b_killed = killed_by(tomb_a, cb);
+            if (!a_killed && !b_killed) {
+                emit(compare_atomic_cell_for_merge(ca, cb) > 0 ? ra.element() : rb.element());
+            } else if (!a_killed) {
+                emit(ra.element());
+            } else if (!b_killed) {
+                emit(rb.element());
+            }
+            ra.advance();
+            rb.advance();
+        }
+    }
+
+    auto tomb = std::max(tomb_a, tomb_b);
+    size += 1 + 4;
+    if (tomb) {
+        size += sizeof(tomb.timestamp) + sizeof(tomb.deletion_time);
+    }
+    bytes ret(bytes::initialized_later(), size);
+    bytes::iterator out = ret.begin();
+    *out++ = bool(tomb);
+    if (tomb) {
+        write(out, tomb.timestamp);
+        write(out, tomb.deletion_time.time_since_epoch().count());
+    }
+    serialize_int32(out, count);
+    for (auto&& r : ranges) {
+        out = std::copy_n(r.begin(), r.size(), out);
+    }
+    return collection_mutation{std::move(ret)};
 }
 
 collection_mutation
@@ -189,6 +189,9 @@ inline int32_t compare_unsigned(bytes_view v1, bytes_view v2) {
     return (int32_t) (v1.size() - v2.size());
 }
 
+// Compares serialized timeuuids, the same as timeuuid_type->compare().
+int32_t timeuuid_tri_compare(bytes_view v1, bytes_view v2);
+
 struct empty_t {};
 
 class empty_value_exception : public std::exception {
@@ -457,6 +460,21 @@ class abstract_type : public enable_shared_from_this<abstract_type> {
         return false;
     }
 
+    // How a value of this type can be transformed into bytes whose unsigned
+    // lexicographical order is the order defined by compare().
+    enum class comparable_encoding {
+        // Not possible.
+        none,
+        // The serialized form is already ordered that way.
+        unsigned_bytes,
+        // The serialized form is a big-endian two's complement integer; it
+        // is ordered that way once the sign bit is flipped.
+        signed_integer,
+    };
+    virtual comparable_encoding get_comparable_encoding() const {
+        return comparable_encoding::none;
+    }
+
     /**
      * When returns true then equal values have the same byte representation and if byte
      * representation is different, the values are not equal.
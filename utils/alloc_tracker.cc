@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utils/alloc_tracker.hh"
+#include <cstdlib>
+#include "core/print.hh"
+#include "core/sstring.hh"
+
+namespace utils {
+
+const char* to_string(alloc_scope_id id) {
+    switch (id) {
+    case alloc_scope_id::memtable_apply: return "memtable_apply";
+    case alloc_scope_id::partition_query: return "partition_query";
+    case alloc_scope_id::cql_response: return "cql_response";
+    }
+    abort();
+}
+
+alloc_tracker& local_alloc_tracker() {
+    static thread_local alloc_tracker instance;
+    return instance;
+}
+
+alloc_tracker::alloc_tracker() {
+    if (enabled()) {
+        setup_collectd();
+    }
+}
+
+void alloc_tracker::setup_collectd() {
+    for (unsigned i = 0; i < alloc_scope_count; ++i) {
+        auto name = to_string(alloc_scope_id(i));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("alloc_tracker"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", name)
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats[i].operations)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("alloc_tracker"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", sprint("%s_allocations", name))
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats[i].allocations)
+        ));
+    }
+}
+
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <seastar/core/memory.hh>
+#include <seastar/core/scollectd.hh>
+
+namespace utils {
+
+// Hot paths whose heap allocations are accounted.
+enum class alloc_scope_id : unsigned {
+    memtable_apply,
+    partition_query,
+    cql_response,
+};
+
+constexpr unsigned alloc_scope_count = 3;
+
+const char* to_string(alloc_scope_id id);
+
+struct alloc_stats {
+    // Number of times the scope was entered.
+    uint64_t operations = 0;
+    uint64_t allocations = 0;
+    // Memory taken from the allocator and not given back before the scope
+    // was left. The seastar allocator counts free memory, not allocated
+    // bytes, so short lived allocations don't show up here.
+    int64_t retained_bytes = 0;
+
+    alloc_stats& operator+=(const alloc_stats& o) {
+        operations += o.operations;
+        allocations += o.allocations;
+        retained_bytes += o.retained_bytes;
+        return *this;
+    }
+};
+
+// Per-shard account of the allocations done by the hot paths, by scope.
+//
+// Scopes are only measured when built with --enable-alloc-tracking
+// (SCYLLA_ALLOC_TRACKING), which costs two reads of the allocator's
+// statistics per scope; otherwise alloc_scope compiles to nothing and the
+// counters stay at zero.
+class alloc_tracker {
+public:
+    using stats_type = std::array<alloc_stats, alloc_scope_count>;
+private:
+    stats_type _stats;
+    std::vector<scollectd::registration> _collectd_registrations;
+private:
+    void setup_collectd();
+public:
+    alloc_tracker();
+
+    static constexpr bool enabled() {
+#ifdef SCYLLA_ALLOC_TRACKING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void account(alloc_scope_id id, uint64_t allocations, int64_t retained_bytes) {
+        auto& st = _stats[unsigned(id)];
+        ++st.operations;
+        st.allocations += allocations;
+        st.retained_bytes += retained_bytes;
+    }
+
+    const stats_type& get_stats() const {
+        return _stats;
+    }
+};
+
+// Returns a reference to the shard-wide alloc_tracker.
+alloc_tracker& local_alloc_tracker();
+
+// Accounts the allocations done between its construction and destruction to
+// the given scope. Only the synchronous part is seen, so the scope must not
+// span a deferring point. Nested scopes are accounted independently, each
+// one includes the allocations of the scopes it encloses.
+class alloc_scope {
+#ifdef SCYLLA_ALLOC_TRACKING
+    alloc_scope_id _id;
+    uint64_t _mallocs;
+    size_t _free_memory;
+public:
+    explicit alloc_scope(alloc_scope_id id)
+        : _id(id)
+    {
+        auto st = memory::stats();
+        _mallocs = st.mallocs();
+        _free_memory = st.free_memory();
+    }
+    ~alloc_scope() {
+        auto st = memory::stats();
+        local_alloc_tracker().account(_id, st.mallocs() - _mallocs, int64_t(_free_memory) - int64_t(st.free_memory()));
+    }
+#else
+public:
+    explicit alloc_scope(alloc_scope_id) { }
+#endif
+    alloc_scope(const alloc_scope&) = delete;
+    alloc_scope& operator=(const alloc_scope&) = delete;
+};
+
+}
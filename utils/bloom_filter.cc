@@ -72,17 +72,68 @@ std::vector<int64_t> bloom_filter::get_hash_buckets(const bytes_view& key, int h
 }
 
 std::vector<int64_t> bloom_filter::indexes(const bytes_view& key) {
-    // we use the same array both for storing the hash result, and for storing the indexes we return,
-    // so that we do not need to allocate two arrays.
-    auto& idx = reusable_indexes;
     std::array<uint64_t, 2> h;
     hash(key, 0, h);
+    return indexes(h);
+}
 
+std::vector<int64_t> bloom_filter::indexes(const std::array<uint64_t, 2>& h) {
+    // we use the same array both for storing the hash result, and for storing the indexes we return,
+    // so that we do not need to allocate two arrays.
+    auto& idx = reusable_indexes;
     idx.resize(_hash_count);
     set_indexes(h[0], h[1], _hash_count, _bitset.size(), idx);
     return idx;
 }
 
+static_assert(large_bitset::block_size() % (blocked_bloom_filter::block_bits / 8) == 0,
+              "blocks of blocked_bloom_filter must not cross large_bitset's storage chunks");
+
+blocked_bloom_filter::blocked_bloom_filter(int hashes, bitmap&& bs)
+    : _bitset(std::move(bs))
+    , _hash_count(hashes)
+    , _nr_blocks(std::max<size_t>(_bitset.size() / block_bits, 1))
+{
+    assert(_bitset.size() >= block_bits);
+}
+
+size_t blocked_bloom_filter::get_block(const std::array<uint64_t, 2>& h, block_mask& mask) const {
+    // First half of the hash selects the block, the second one is split to
+    // generate bit positions inside of it by double hashing.
+    auto base = uint32_t(h[1]);
+    auto inc = uint32_t(h[1] >> 32);
+    mask.fill(0);
+    for (int i = 0; i < _hash_count; i++) {
+        auto bit = base & (block_bits - 1);
+        mask[bit / 64] |= uint64_t(1) << (bit % 64);
+        base += inc;
+    }
+    return h[0] % _nr_blocks;
+}
+
+void blocked_bloom_filter::add(const bytes_view& key) {
+    block_mask mask;
+    auto words = _bitset.word(get_block(make_hashed_key(key).hash, mask) * words_per_block);
+    for (size_t i = 0; i < words_per_block; i++) {
+        words[i] |= mask[i];
+    }
+}
+
+bool blocked_bloom_filter::is_present(const bytes_view& key) {
+    return is_present(make_hashed_key(key));
+}
+
+bool blocked_bloom_filter::is_present(const hashed_key& key) {
+    block_mask mask;
+    auto words = _bitset.word(get_block(key.hash, mask) * words_per_block);
+    // Branch-free over the whole block, which lets the compiler vectorize it.
+    uint64_t missing = 0;
+    for (size_t i = 0; i < words_per_block; i++) {
+        missing |= mask[i] & ~words[i];
+    }
+    return !missing;
+}
+
 filter_ptr create_filter(int hash, large_bitset&& bitset) {
     return std::make_unique<murmur3_bloom_filter>(hash, std::move(bitset));
 }
@@ -93,5 +144,16 @@ filter_ptr create_filter(int hash, int64_t num_elements, int buckets_per) {
     large_bitset bitset(num_bits);
     return std::make_unique<murmur3_bloom_filter>(hash, std::move(bitset));
 }
+
+filter_ptr create_blocked_filter(int hash, large_bitset&& bitset) {
+    return std::make_unique<blocked_bloom_filter>(hash, std::move(bitset));
+}
+
+filter_ptr create_blocked_filter(int hash, int64_t num_elements, int buckets_per) {
+    int64_t num_bits = (num_elements * buckets_per) + bloom_calculations::EXCESS;
+    num_bits = align_up<int64_t>(num_bits, blocked_bloom_filter::block_bits);
+    large_bitset bitset(num_bits);
+    return std::make_unique<blocked_bloom_filter>(hash, std::move(bitset));
+}
 }
 }
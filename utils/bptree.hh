@@ -0,0 +1,809 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <iterator>
+#include <type_traits>
+#include "utils/allocation_strategy.hh"
+
+template<typename T, typename Hook, Hook T::*HookPtr, typename Compare, size_t LeafCapacity, size_t Fanout>
+class bptree;
+
+// Member hook of elements linked into a bptree<>. Points back at the leaf
+// holding the element so that the element can be moved by the allocator.
+class bptree_member_hook {
+    void* _leaf = nullptr;
+
+    template<typename T, typename Hook, Hook T::*HookPtr, typename Compare, size_t LeafCapacity, size_t Fanout>
+    friend class bptree;
+public:
+    bptree_member_hook() = default;
+    bptree_member_hook(const bptree_member_hook&) = delete;
+    bptree_member_hook& operator=(const bptree_member_hook&) = delete;
+    bool is_linked() const { return _leaf; }
+};
+
+//
+// Ordered set of externally allocated elements, kept in a B+tree, with the
+// interface of boost::intrusive::set<> used by the code which switched to it.
+//
+// Leaves hold sorted arrays of element pointers and are chained into a list,
+// and inner nodes hold child pointers next to a pointer to the smallest
+// element of every child, which is what lookups compare against. Compared to
+// a red-black tree, this takes a handful of cache lines per level instead of
+// one per comparison, and walks in order through contiguous arrays.
+//
+// All nodes are allocated with current_allocator() and can be moved by it,
+// this includes elements, whose move constructor has to call move_hook().
+// Hence the tree may be used inside LSA regions. As with any other container
+// of LSA memory, iterators are invalidated when the allocator moves objects.
+//
+// Unlike with intrusive containers, inserting and erasing elements
+// invalidates iterators pointing into the same leaf, and insertion may throw
+// std::bad_alloc. Erasure never allocates; it doesn't rebalance the tree
+// either, leaves are released only when they become empty.
+//
+// Leaves start small and grow up to LeafCapacity elements, so that small
+// partitions, which dominate most workloads, don't pay for a full leaf.
+//
+template<typename T, typename Hook, Hook T::*HookPtr, typename Compare, size_t LeafCapacity = 16, size_t Fanout = 16>
+class bptree {
+    static_assert(std::is_same<Hook, bptree_member_hook>::value, "bptree requires bptree_member_hook");
+    static_assert(LeafCapacity >= 2 && Fanout >= 3, "Nodes too small");
+
+    // Enough for Fanout^max_height elements.
+    static constexpr unsigned max_height = 16;
+
+    struct inner_node;
+
+    struct node_base {
+        union {
+            inner_node* _parent;
+            bptree* _tree; // if _is_root
+        };
+        uint16_t _size = 0;
+        uint16_t _capacity;
+        bool _is_leaf;
+        bool _is_root = false;
+
+        node_base(bool is_leaf, uint16_t capacity) noexcept
+            : _parent(nullptr), _capacity(capacity), _is_leaf(is_leaf)
+        { }
+        node_base(const node_base&) = default;
+
+        // Points whoever referred to the node at old location to this one.
+        void replace_in_owner(node_base* old) noexcept {
+            if (_is_root) {
+                _tree->_root = this;
+            } else {
+                _parent->_children[_parent->index_of(old)] = this;
+            }
+        }
+    };
+
+    struct leaf_node : public node_base {
+        leaf_node* _prev = nullptr;
+        leaf_node* _next = nullptr;
+        T* _values[];
+
+        explicit leaf_node(uint16_t capacity) noexcept : node_base(true, capacity) { }
+        leaf_node(leaf_node&& o, uint16_t capacity) noexcept
+            : node_base(o)
+            , _prev(o._prev)
+            , _next(o._next)
+        {
+            this->_capacity = capacity;
+            for (uint16_t i = 0; i < this->_size; ++i) {
+                _values[i] = o._values[i];
+                hook(*_values[i])._leaf = this;
+            }
+            this->replace_in_owner(&o);
+            if (_prev) {
+                _prev->_next = this;
+            }
+            if (_next) {
+                _next->_prev = this;
+            }
+        }
+        leaf_node(leaf_node&& o) noexcept : leaf_node(std::move(o), o._capacity) { }
+
+        static size_t storage_size(uint16_t capacity) {
+            return sizeof(leaf_node) + capacity * sizeof(T*);
+        }
+        bool full() const { return this->_size == this->_capacity; }
+    };
+
+    struct inner_node : public node_base {
+        node_base* _children[Fanout];
+        // _keys[i] is the smallest element under _children[i].
+        T* _keys[Fanout];
+
+        inner_node() noexcept : node_base(false, Fanout) { }
+        inner_node(inner_node&& o) noexcept : node_base(o) {
+            for (uint16_t i = 0; i < this->_size; ++i) {
+                _children[i] = o._children[i];
+                _keys[i] = o._keys[i];
+                _children[i]->_parent = this;
+            }
+            this->replace_in_owner(&o);
+        }
+
+        uint16_t index_of(const node_base* child) const noexcept {
+            uint16_t i = 0;
+            while (_children[i] != child) {
+                ++i;
+            }
+            return i;
+        }
+        bool full() const { return this->_size == Fanout; }
+    };
+
+    Compare _cmp;
+    node_base* _root = nullptr;
+    size_t _size = 0;
+private:
+    static bptree_member_hook& hook(T& v) noexcept {
+        return v.*HookPtr;
+    }
+    static leaf_node* leaf_of(const T& v) noexcept {
+        return static_cast<leaf_node*>((const_cast<T&>(v).*HookPtr)._leaf);
+    }
+
+    template<bool Const>
+    class iterator_base : public std::iterator<std::bidirectional_iterator_tag, std::conditional_t<Const, const T, T>> {
+        using value_ref = std::conditional_t<Const, const T&, T&>;
+        using value_ptr = std::conditional_t<Const, const T*, T*>;
+        const bptree* _tree = nullptr;
+        leaf_node* _leaf = nullptr; // nullptr for end()
+        uint16_t _idx = 0;
+
+        iterator_base(const bptree* tree, leaf_node* leaf, uint16_t idx) noexcept
+            : _tree(tree), _leaf(leaf), _idx(idx) {
+            if (_leaf && _idx == _leaf->_size) {
+                _leaf = _leaf->_next;
+                _idx = 0;
+            }
+        }
+        friend class bptree;
+        template<bool> friend class iterator_base;
+    public:
+        iterator_base() = default;
+        template<bool C = Const, typename = std::enable_if_t<C>>
+        iterator_base(const iterator_base<false>& o) noexcept : _tree(o._tree), _leaf(o._leaf), _idx(o._idx) { }
+
+        value_ref operator*() const { return *_leaf->_values[_idx]; }
+        value_ptr operator->() const { return _leaf->_values[_idx]; }
+
+        iterator_base& operator++() {
+            if (++_idx == _leaf->_size) {
+                _leaf = _leaf->_next;
+                _idx = 0;
+            }
+            return *this;
+        }
+        iterator_base operator++(int) {
+            auto it = *this;
+            operator++();
+            return it;
+        }
+        iterator_base& operator--() {
+            if (!_leaf) {
+                _leaf = _tree->last_leaf();
+                _idx = _leaf->_size - 1;
+            } else if (_idx == 0) {
+                _leaf = _leaf->_prev;
+                _idx = _leaf->_size - 1;
+            } else {
+                --_idx;
+            }
+            return *this;
+        }
+        iterator_base operator--(int) {
+            auto it = *this;
+            operator--();
+            return it;
+        }
+        bool operator==(const iterator_base& o) const {
+            return _leaf == o._leaf && _idx == o._idx;
+        }
+        bool operator!=(const iterator_base& o) const {
+            return !(*this == o);
+        }
+    };
+public:
+    using value_type = T;
+    using key_compare = Compare;
+    using value_compare = Compare;
+    using size_type = size_t;
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+public:
+    explicit bptree(Compare cmp) : _cmp(std::move(cmp)) { }
+    bptree(bptree&& o) noexcept
+        : _cmp(std::move(o._cmp))
+        , _root(std::exchange(o._root, nullptr))
+        , _size(std::exchange(o._size, 0))
+    {
+        if (_root) {
+            _root->_tree = this;
+        }
+    }
+    bptree& operator=(bptree&& o) noexcept {
+        if (this != &o) {
+            clear();
+            _cmp = std::move(o._cmp);
+            _root = std::exchange(o._root, nullptr);
+            _size = std::exchange(o._size, 0);
+            if (_root) {
+                _root->_tree = this;
+            }
+        }
+        return *this;
+    }
+    bptree(const bptree&) = delete;
+    bptree& operator=(const bptree&) = delete;
+    // Unlinks elements without disposing them.
+    ~bptree() {
+        clear();
+    }
+
+    const key_compare& key_comp() const { return _cmp; }
+    const value_compare& value_comp() const { return _cmp; }
+
+    bool empty() const { return !_size; }
+    size_t size() const { return _size; }
+
+    iterator begin() { return iterator(this, first_leaf(), 0); }
+    const_iterator begin() const { return const_iterator(this, first_leaf(), 0); }
+    const_iterator cbegin() const { return begin(); }
+    iterator end() { return iterator(this, nullptr, 0); }
+    const_iterator end() const { return const_iterator(this, nullptr, 0); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    // Returns an iterator to v, which must be linked into this tree.
+    iterator iterator_to(T& v) {
+        auto leaf = leaf_of(v);
+        return iterator(this, leaf, index_in(leaf, &v));
+    }
+
+    template<typename Key, typename Cmp>
+    iterator lower_bound(const Key& key, Cmp&& cmp) {
+        return unconst(const_cast<const bptree*>(this)->lower_bound(key, cmp));
+    }
+    template<typename Key, typename Cmp>
+    const_iterator lower_bound(const Key& key, Cmp&& cmp) const {
+        auto leaf = find_leaf([&] (const T* const* b, const T* const* e) {
+            return std::lower_bound(b, e, key, [&] (const T* v, const Key& k) { return cmp(*v, k); });
+        });
+        if (!leaf) {
+            return end();
+        }
+        auto values = const_cast<const T* const*>(leaf->_values);
+        auto i = std::lower_bound(values, values + leaf->_size, key, [&] (const T* v, const Key& k) { return cmp(*v, k); });
+        return const_iterator(this, leaf, i - values);
+    }
+    template<typename Key>
+    iterator lower_bound(const Key& key) { return lower_bound(key, _cmp); }
+    template<typename Key>
+    const_iterator lower_bound(const Key& key) const { return lower_bound(key, _cmp); }
+
+    template<typename Key, typename Cmp>
+    iterator upper_bound(const Key& key, Cmp&& cmp) {
+        return unconst(const_cast<const bptree*>(this)->upper_bound(key, cmp));
+    }
+    template<typename Key, typename Cmp>
+    const_iterator upper_bound(const Key& key, Cmp&& cmp) const {
+        auto leaf = find_leaf([&] (const T* const* b, const T* const* e) {
+            return std::upper_bound(b, e, key, [&] (const Key& k, const T* v) { return cmp(k, *v); });
+        });
+        if (!leaf) {
+            return end();
+        }
+        auto values = const_cast<const T* const*>(leaf->_values);
+        auto i = std::upper_bound(values, values + leaf->_size, key, [&] (const Key& k, const T* v) { return cmp(k, *v); });
+        return const_iterator(this, leaf, i - values);
+    }
+    template<typename Key>
+    iterator upper_bound(const Key& key) { return upper_bound(key, _cmp); }
+    template<typename Key>
+    const_iterator upper_bound(const Key& key) const { return upper_bound(key, _cmp); }
+
+    template<typename Key, typename Cmp>
+    iterator find(const Key& key, Cmp&& cmp) {
+        return unconst(const_cast<const bptree*>(this)->find(key, cmp));
+    }
+    template<typename Key, typename Cmp>
+    const_iterator find(const Key& key, Cmp&& cmp) const {
+        auto i = lower_bound(key, cmp);
+        if (i != end() && cmp(key, *i)) {
+            return end();
+        }
+        return i;
+    }
+    template<typename Key>
+    iterator find(const Key& key) { return find(key, _cmp); }
+    template<typename Key>
+    const_iterator find(const Key& key) const { return find(key, _cmp); }
+
+    // Links v into the tree unless an equivalent element is already there.
+    // Returns an iterator to v or to the equivalent element. The hint is used
+    // only to make appending in order cheap.
+    // Strong exception guarantee.
+    iterator insert(const_iterator hint, T& v) {
+        if (hint == end() && (empty() || _cmp(*std::prev(end()), v))) {
+            return insert_before(end(), v);
+        }
+        auto i = lower_bound(v);
+        if (i != end() && !_cmp(v, *i)) {
+            return i;
+        }
+        return insert_before(i, v);
+    }
+
+    // Links v into the tree in front of pos, which must be the right position for it.
+    // Strong exception guarantee.
+    iterator insert_before(const_iterator pos, T& v) {
+        assert(!hook(v).is_linked());
+        if (!_root) {
+            auto leaf = alloc_leaf(1);
+            leaf->_is_root = true;
+            leaf->_tree = this;
+            _root = leaf;
+            return insert_into_leaf(leaf, 0, v);
+        }
+        leaf_node* leaf = pos._leaf;
+        uint16_t idx = pos._idx;
+        if (!leaf) {
+            leaf = last_leaf();
+            idx = leaf->_size;
+        } else if (idx == 0 && leaf->_prev && !leaf->_prev->full()) {
+            leaf = leaf->_prev;
+            idx = leaf->_size;
+        }
+        if (!leaf->full()) {
+            return insert_into_leaf(leaf, idx, v);
+        }
+        if (leaf->_capacity < LeafCapacity) {
+            leaf = grow_leaf(leaf);
+            return insert_into_leaf(leaf, idx, v);
+        }
+        return split_and_insert(leaf, idx, v);
+    }
+
+    // Puts v in place of the element pointed to by pos, which is unlinked.
+    // v must be ordered the same as the element it replaces.
+    void replace_node(const_iterator pos, T& v) noexcept {
+        auto leaf = pos._leaf;
+        hook(*leaf->_values[pos._idx])._leaf = nullptr;
+        leaf->_values[pos._idx] = &v;
+        hook(v)._leaf = leaf;
+        if (pos._idx == 0) {
+            propagate_min(leaf);
+        }
+    }
+
+    // To be called by the move constructor of an element, with to
+    // constructed and not linked.
+    static void move_hook(T& from, T& to) noexcept {
+        auto leaf = leaf_of(from);
+        if (!leaf) {
+            return;
+        }
+        auto idx = index_in(leaf, &from);
+        leaf->_values[idx] = &to;
+        hook(to)._leaf = leaf;
+        hook(from)._leaf = nullptr;
+        if (idx == 0) {
+            propagate_min(leaf);
+        }
+    }
+
+    template<typename Disposer>
+    iterator erase_and_dispose(const_iterator pos, Disposer&& disposer) noexcept {
+        auto leaf = pos._leaf;
+        auto idx = pos._idx;
+        T* v = leaf->_values[idx];
+        std::copy(leaf->_values + idx + 1, leaf->_values + leaf->_size, leaf->_values + idx);
+        --leaf->_size;
+        --_size;
+        hook(*v)._leaf = nullptr;
+        disposer(v);
+        if (!leaf->_size) {
+            auto next = leaf->_next;
+            remove_node(leaf);
+            collapse_root();
+            return iterator(this, next, 0);
+        }
+        if (idx == 0) {
+            propagate_min(leaf);
+        }
+        collapse_root();
+        return iterator(this, leaf, idx);
+    }
+
+    // Erasing invalidates iterators past the erased element within its leaf,
+    // so count the elements instead of comparing with last.
+    template<typename Disposer>
+    iterator erase_and_dispose(const_iterator first, const_iterator last, Disposer&& disposer) noexcept {
+        auto n = std::distance(first, last);
+        auto i = unconst(first);
+        while (n--) {
+            i = erase_and_dispose(i, disposer);
+        }
+        return i;
+    }
+
+    iterator erase(const_iterator pos) noexcept {
+        return erase_and_dispose(pos, [] (T*) { });
+    }
+    iterator erase(const_iterator first, const_iterator last) noexcept {
+        return erase_and_dispose(first, last, [] (T*) { });
+    }
+
+    // Unlinks and returns the first element, nullptr if the tree is empty.
+    T* unlink_leftmost_without_rebalance() noexcept {
+        if (empty()) {
+            return nullptr;
+        }
+        T* v = &*begin();
+        erase(begin());
+        return v;
+    }
+
+    template<typename Disposer>
+    void clear_and_dispose(Disposer&& disposer) noexcept {
+        if (_root) {
+            destroy_subtree(_root, disposer);
+            _root = nullptr;
+            _size = 0;
+        }
+    }
+    void clear() noexcept {
+        clear_and_dispose([] (T*) { });
+    }
+
+    // Replaces contents of this tree with copies of elements of o.
+    // On failure, the tree is left empty.
+    template<typename Cloner, typename Disposer>
+    void clone_from(const bptree& o, Cloner&& cloner, Disposer&& disposer) {
+        clear_and_dispose(disposer);
+        try {
+            for (const T& v : o) {
+                T* copy = cloner(v);
+                try {
+                    insert_before(end(), *copy);
+                } catch (...) {
+                    disposer(copy);
+                    throw;
+                }
+            }
+        } catch (...) {
+            clear_and_dispose(disposer);
+            throw;
+        }
+    }
+
+    // Memory taken by the nodes of the tree, without the elements.
+    size_t external_memory_usage() const {
+        return _root ? subtree_memory_usage(_root) : 0;
+    }
+private:
+    iterator unconst(const_iterator i) const noexcept {
+        return iterator(i._tree, i._leaf, i._idx);
+    }
+
+    static uint16_t index_in(const leaf_node* leaf, const T* v) noexcept {
+        uint16_t i = 0;
+        while (leaf->_values[i] != v) {
+            ++i;
+        }
+        return i;
+    }
+
+    leaf_node* first_leaf() const noexcept {
+        auto n = _root;
+        if (!n) {
+            return nullptr;
+        }
+        while (!n->_is_leaf) {
+            n = static_cast<inner_node*>(n)->_children[0];
+        }
+        return static_cast<leaf_node*>(n);
+    }
+
+    leaf_node* last_leaf() const noexcept {
+        auto n = _root;
+        while (!n->_is_leaf) {
+            auto inner = static_cast<inner_node*>(n);
+            n = inner->_children[inner->_size - 1];
+        }
+        return static_cast<leaf_node*>(n);
+    }
+
+    // Descends to the leaf in which the searched position lies or after which
+    // it directly follows. Search returns the first separator past the child
+    // which is to be visited.
+    template<typename Search>
+    leaf_node* find_leaf(Search&& search) const {
+        auto n = _root;
+        if (!n) {
+            return nullptr;
+        }
+        while (!n->_is_leaf) {
+            auto inner = static_cast<inner_node*>(n);
+            auto keys = const_cast<const T* const*>(inner->_keys);
+            auto i = search(keys + 1, keys + inner->_size);
+            n = inner->_children[i - (keys + 1)];
+        }
+        return static_cast<leaf_node*>(n);
+    }
+
+    static T* min_of(node_base* n) noexcept {
+        if (n->_is_leaf) {
+            return static_cast<leaf_node*>(n)->_values[0];
+        }
+        return static_cast<inner_node*>(n)->_keys[0];
+    }
+
+    // Updates separators referring to the smallest element of n.
+    static void propagate_min(node_base* n) noexcept {
+        T* min = min_of(n);
+        while (!n->_is_root) {
+            auto parent = n->_parent;
+            auto i = parent->index_of(n);
+            parent->_keys[i] = min;
+            if (i) {
+                break;
+            }
+            n = parent;
+        }
+    }
+
+    static leaf_node* alloc_leaf(uint16_t capacity) {
+        auto& alctr = current_allocator();
+        void* p = alctr.alloc(&standard_migrator<leaf_node>::object, leaf_node::storage_size(capacity), alignof(leaf_node));
+        return new (p) leaf_node(capacity);
+    }
+
+    static void free_node(node_base* n) noexcept {
+        if (n->_is_leaf) {
+            current_allocator().destroy(static_cast<leaf_node*>(n));
+        } else {
+            current_allocator().destroy(static_cast<inner_node*>(n));
+        }
+    }
+
+    leaf_node* grow_leaf(leaf_node* leaf) {
+        auto capacity = std::min<uint16_t>(leaf->_capacity * 2, LeafCapacity);
+        auto& alctr = current_allocator();
+        void* p = alctr.alloc(&standard_migrator<leaf_node>::object, leaf_node::storage_size(capacity), alignof(leaf_node));
+        auto grown = new (p) leaf_node(std::move(*leaf), capacity);
+        alctr.destroy(leaf);
+        return grown;
+    }
+
+    // Doesn't update separators, for leaves which are not linked yet.
+    iterator place_in_leaf(leaf_node* leaf, uint16_t idx, T& v) noexcept {
+        std::copy_backward(leaf->_values + idx, leaf->_values + leaf->_size, leaf->_values + leaf->_size + 1);
+        leaf->_values[idx] = &v;
+        ++leaf->_size;
+        ++_size;
+        hook(v)._leaf = leaf;
+        return iterator(this, leaf, idx);
+    }
+
+    iterator insert_into_leaf(leaf_node* leaf, uint16_t idx, T& v) noexcept {
+        auto i = place_in_leaf(leaf, idx, v);
+        if (idx == 0) {
+            propagate_min(leaf);
+        }
+        return i;
+    }
+
+    // Preallocated nodes for a split, so that once it starts it can't fail.
+    class node_reserve {
+        std::array<node_base*, max_height + 1> _nodes;
+        unsigned _count = 0;
+    public:
+        node_reserve() = default;
+        node_reserve(const node_reserve&) = delete;
+        ~node_reserve() {
+            while (_count) {
+                free_node(_nodes[--_count]);
+            }
+        }
+        unsigned size() const { return _count; }
+        void add(node_base* n) {
+            _nodes[_count++] = n;
+        }
+        template<typename Node>
+        Node* take() noexcept {
+            return static_cast<Node*>(_nodes[--_count]);
+        }
+    };
+
+    iterator split_and_insert(leaf_node* leaf, uint16_t idx, T& v) {
+        node_reserve reserve;
+        node_base* n = leaf;
+        while (!n->_is_root && n->_parent->full()) {
+            assert(reserve.size() < max_height);
+            reserve.add(current_allocator().construct<inner_node>());
+            n = n->_parent;
+        }
+        if (n->_is_root) {
+            reserve.add(current_allocator().construct<inner_node>());
+        }
+        reserve.add(alloc_leaf(LeafCapacity));
+
+        // Nothing below throws.
+        auto new_leaf = reserve.template take<leaf_node>();
+        new_leaf->_prev = leaf;
+        new_leaf->_next = leaf->_next;
+        if (leaf->_next) {
+            leaf->_next->_prev = new_leaf;
+        }
+        leaf->_next = new_leaf;
+
+        iterator ret;
+        if (!new_leaf->_next && idx == leaf->_size) {
+            // Appending at the end of the tree, keep the left leaf full.
+            ret = place_in_leaf(new_leaf, 0, v);
+        } else {
+            uint16_t half = leaf->_size / 2;
+            for (uint16_t i = half; i < leaf->_size; ++i) {
+                new_leaf->_values[i - half] = leaf->_values[i];
+                hook(*leaf->_values[i])._leaf = new_leaf;
+            }
+            new_leaf->_size = leaf->_size - half;
+            leaf->_size = half;
+            if (idx <= half) {
+                ret = insert_into_leaf(leaf, idx, v);
+            } else {
+                ret = place_in_leaf(new_leaf, idx - half, v);
+            }
+        }
+        insert_child_after(leaf, new_leaf, reserve);
+        return ret;
+    }
+
+    static void link_child(inner_node* parent, uint16_t i, node_base* child) noexcept {
+        std::copy_backward(parent->_children + i, parent->_children + parent->_size, parent->_children + parent->_size + 1);
+        std::copy_backward(parent->_keys + i, parent->_keys + parent->_size, parent->_keys + parent->_size + 1);
+        parent->_children[i] = child;
+        parent->_keys[i] = min_of(child);
+        child->_parent = parent;
+        ++parent->_size;
+    }
+
+    // Links new_node into the parent of n, right after it, splitting
+    // ancestors as needed.
+    void insert_child_after(node_base* n, node_base* new_node, node_reserve& reserve) noexcept {
+        if (n->_is_root) {
+            auto root = reserve.template take<inner_node>();
+            n->_is_root = false;
+            link_child(root, 0, n);
+            link_child(root, 1, new_node);
+            root->_is_root = true;
+            root->_tree = this;
+            _root = root;
+            return;
+        }
+        auto parent = n->_parent;
+        auto i = parent->index_of(n) + 1;
+        if (!parent->full()) {
+            link_child(parent, i, new_node);
+            return;
+        }
+        auto new_inner = reserve.template take<inner_node>();
+        // When appending, leave the left node full, as leaves do.
+        uint16_t half = i == parent->_size ? i : parent->_size / 2;
+        for (uint16_t j = half; j < parent->_size; ++j) {
+            link_child(new_inner, j - half, parent->_children[j]);
+        }
+        parent->_size = half;
+        if (i <= half && !parent->full()) {
+            link_child(parent, i, new_node);
+        } else {
+            link_child(new_inner, i - half, new_node);
+        }
+        insert_child_after(parent, new_inner, reserve);
+    }
+
+    // Unlinks an empty node from the tree and frees it, along with ancestors
+    // which become empty.
+    void remove_node(node_base* n) noexcept {
+        if (n->_is_leaf) {
+            auto leaf = static_cast<leaf_node*>(n);
+            if (leaf->_prev) {
+                leaf->_prev->_next = leaf->_next;
+            }
+            if (leaf->_next) {
+                leaf->_next->_prev = leaf->_prev;
+            }
+        }
+        if (n->_is_root) {
+            _root = nullptr;
+            free_node(n);
+            return;
+        }
+        auto parent = n->_parent;
+        auto i = parent->index_of(n);
+        free_node(n);
+        std::copy(parent->_children + i + 1, parent->_children + parent->_size, parent->_children + i);
+        std::copy(parent->_keys + i + 1, parent->_keys + parent->_size, parent->_keys + i);
+        --parent->_size;
+        if (!parent->_size) {
+            remove_node(parent);
+        } else if (i == 0) {
+            propagate_min(parent);
+        }
+    }
+
+    void collapse_root() noexcept {
+        while (_root && !_root->_is_leaf && _root->_size == 1) {
+            auto old = static_cast<inner_node*>(_root);
+            _root = old->_children[0];
+            _root->_is_root = true;
+            _root->_tree = this;
+            current_allocator().destroy(old);
+        }
+    }
+
+    template<typename Disposer>
+    static void destroy_subtree(node_base* n, Disposer& disposer) noexcept {
+        if (n->_is_leaf) {
+            auto leaf = static_cast<leaf_node*>(n);
+            for (uint16_t i = 0; i < leaf->_size; ++i) {
+                T* v = leaf->_values[i];
+                hook(*v)._leaf = nullptr;
+                disposer(v);
+            }
+        } else {
+            auto inner = static_cast<inner_node*>(n);
+            for (uint16_t i = 0; i < inner->_size; ++i) {
+                destroy_subtree(inner->_children[i], disposer);
+            }
+        }
+        free_node(n);
+    }
+
+    static size_t subtree_memory_usage(const node_base* n) {
+        if (n->_is_leaf) {
+            return leaf_node::storage_size(n->_capacity);
+        }
+        auto inner = static_cast<const inner_node*>(n);
+        size_t mem = sizeof(inner_node);
+        for (uint16_t i = 0; i < inner->_size; ++i) {
+            mem += subtree_memory_usage(inner->_children[i]);
+        }
+        return mem;
+    }
+};
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crc.hh"
+#include <cstring>
+
+// Three-way interleaved CRC32C, after Mark Adler's crc32c.c.
+//
+// The buffer is cut into three consecutive blocks which are checksummed at
+// the same time, the second and third starting from a zero register. The
+// register after the first block is then carried over the second one,
+// which amounts to appending as many zero bytes, and combined with the
+// register of the second block, and the same again for the third. Carrying
+// a register over a fixed number of zero bytes is a linear map, applied
+// a byte at a time through four precomputed tables.
+
+namespace utils {
+
+namespace {
+
+constexpr uint32_t crc32c_polynomial = 0x82f63b78; // reflected
+constexpr size_t long_block = 8192;
+constexpr size_t short_block = 256;
+
+using shift_tables = uint32_t[4][256];
+
+uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+// Builds the operator carrying a register over len zero bytes. len must be
+// a power of two.
+void zeros_operator(uint32_t* even, size_t len) {
+    uint32_t odd[32];
+
+    // One zero bit.
+    odd[0] = crc32c_polynomial;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    // Two, then four zero bits.
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+    // Each further squaring doubles the number of zero bytes, starting
+    // from one.
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0) {
+            return;
+        }
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+    std::memcpy(even, odd, sizeof(odd));
+}
+
+void make_shift_tables(shift_tables& tables, size_t len) {
+    uint32_t op[32];
+    zeros_operator(op, len);
+    for (uint32_t n = 0; n < 256; n++) {
+        tables[0][n] = gf2_matrix_times(op, n);
+        tables[1][n] = gf2_matrix_times(op, n << 8);
+        tables[2][n] = gf2_matrix_times(op, n << 16);
+        tables[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+struct crc32c_shift_tables {
+    shift_tables long_shift;
+    shift_tables short_shift;
+
+    crc32c_shift_tables() {
+        make_shift_tables(long_shift, long_block);
+        make_shift_tables(short_shift, short_block);
+    }
+};
+
+const crc32c_shift_tables& get_shift_tables() {
+    static const crc32c_shift_tables tables;
+    return tables;
+}
+
+inline uint32_t shift(const shift_tables& tables, uint32_t crc) {
+    return tables[0][crc & 0xff] ^ tables[1][(crc >> 8) & 0xff]
+            ^ tables[2][(crc >> 16) & 0xff] ^ tables[3][crc >> 24];
+}
+
+inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Checksums as many runs of three blocks of the given size as fit.
+inline void process_blocks(uint64_t& crc0, const uint8_t*& in, size_t& size, size_t block, const shift_tables& tables) {
+    while (size >= 3 * block) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        auto end = in + block;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(in));
+            crc1 = _mm_crc32_u64(crc1, load64(in + block));
+            crc2 = _mm_crc32_u64(crc2, load64(in + 2 * block));
+            in += 8;
+        } while (in < end);
+        crc0 = shift(tables, crc0) ^ crc1;
+        crc0 = shift(tables, crc0) ^ crc2;
+        in += 2 * block;
+        size -= 3 * block;
+    }
+}
+
+}
+
+uint32_t crc32c_interleaved(uint32_t crc, const uint8_t* in, size_t size) {
+    auto& tables = get_shift_tables();
+    uint64_t crc0 = crc;
+
+    while (size && (reinterpret_cast<uintptr_t>(in) & 7)) {
+        crc0 = _mm_crc32_u8(crc0, *in++);
+        --size;
+    }
+    process_blocks(crc0, in, size, long_block, tables.long_shift);
+    process_blocks(crc0, in, size, short_block, tables.short_shift);
+    for (; size >= 8; in += 8, size -= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(in));
+    }
+    while (size--) {
+        crc0 = _mm_crc32_u8(crc0, *in++);
+    }
+    return crc0;
+}
+
+}
@@ -22,10 +22,23 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <smmintrin.h>
 
+namespace utils {
+
+// CRC32C of size bytes at in, starting from the register value crc, with
+// three independent streams of crc32 instructions in flight; the
+// instruction has a latency of three cycles but a throughput of one per
+// cycle. Used by crc32::process() for large buffers.
+uint32_t crc32c_interleaved(uint32_t crc, const uint8_t* in, size_t size);
+
+}
+
 class crc32 {
     uint32_t _r = 0;
+    // Below this, setting up the three streams costs more than it saves.
+    static constexpr size_t interleave_threshold = 768;
 public:
     // All process() functions assume input is in
     // host byte order (i.e. equivalent to storing
@@ -70,7 +83,10 @@ class crc32 {
             in += 4;
             size -= 4;
         }
-        // FIXME: do in three parallel loops
+        if (size >= interleave_threshold) {
+            _r = utils::crc32c_interleaved(_r, in, size);
+            return;
+        }
         while (size >= 8) {
             process(*reinterpret_cast<const uint64_t*>(in));
             in += 8;
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+// Approximate access frequency of a large set of keys in little memory, as
+// used by the TinyLFU cache admission policy.
+//
+// A count-min sketch of depth 4: each key is counted in one 4-bit counter of
+// each row, picked by a different part of its 64-bit hash, and its frequency
+// is estimated as the smallest of them. Collisions can only make estimates
+// too high. Counters saturate at 15, and once sample_size keys were recorded all
+// of them are halved, so that the estimate follows recent popularity rather
+// than the all-time one.
+//
+// Keys must be given as well mixed 64-bit hashes.
+class frequency_sketch {
+public:
+    static constexpr unsigned depth = 4;
+    static constexpr uint8_t max_count = 15;
+private:
+    // Two 4-bit counters per byte.
+    std::vector<uint8_t> _table;
+    uint64_t _row_mask;
+    uint64_t _sample_size;
+    uint64_t _samples = 0;
+    uint64_t _resets = 0;
+private:
+    // Index of the counter of hash in given row. Rows are laid out one after the other.
+    size_t index(uint64_t hash, unsigned row) const {
+        auto h = hash + row * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 31;
+        h *= 0x7fb5d329728ea185ull;
+        h ^= h >> 27;
+        return row * (_row_mask + 1) + (h & _row_mask);
+    }
+    uint8_t get(size_t i) const {
+        return (_table[i / 2] >> ((i % 2) * 4)) & 0xf;
+    }
+    void increment(size_t i) {
+        if (get(i) < max_count) {
+            _table[i / 2] += uint8_t(1) << ((i % 2) * 4);
+        }
+    }
+    void halve() {
+        for (auto& b : _table) {
+            b = (b >> 1) & 0x77;
+        }
+        _samples /= 2;
+        ++_resets;
+    }
+public:
+    // Sized for about capacity distinct keys, with capacity rounded up to a
+    // power of two; frequencies are aged every 10 * capacity samples.
+    explicit frequency_sketch(size_t capacity) {
+        size_t width = 16;
+        while (width < capacity) {
+            width *= 2;
+        }
+        _row_mask = width - 1;
+        _sample_size = 10 * width;
+        _table.resize(depth * width / 2);
+    }
+
+    void record(uint64_t hash) {
+        for (unsigned row = 0; row < depth; ++row) {
+            increment(index(hash, row));
+        }
+        if (++_samples >= _sample_size) {
+            halve();
+        }
+    }
+
+    uint8_t estimate(uint64_t hash) const {
+        uint8_t f = max_count;
+        for (unsigned row = 0; row < depth; ++row) {
+            f = std::min(f, get(index(hash, row)));
+        }
+        return f;
+    }
+
+    uint64_t resets() const {
+        return _resets;
+    }
+
+    size_t memory_usage() const {
+        return _table.size();
+    }
+};
+
+}
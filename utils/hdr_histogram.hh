@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include "core/timer.hh"
+
+namespace utils {
+
+/**
+ * A latency histogram in the spirit of HdrHistogram.
+ *
+ * Values (microseconds) below 2^(precision_bits + 1) get a bucket each, above
+ * that every power of two range is split into 2^precision_bits linear buckets,
+ * so the value reported for a percentile is within 1/2^precision_bits of the
+ * recorded one. Memory use is fixed and recording is a couple of arithmetic
+ * operations and an increment, so every event can be recorded instead of
+ * sampling like ihistogram does.
+ *
+ * The histogram is not thread safe, every shard keeps its own and the API
+ * merges them.
+ */
+class hdr_histogram {
+public:
+    static constexpr unsigned precision_bits = 5;
+    static constexpr unsigned value_bits = 32;
+    static constexpr uint64_t max_value = (uint64_t(1) << value_bits) - 1;
+private:
+    static constexpr unsigned sub_buckets = 1u << precision_bits;
+    static constexpr unsigned linear_buckets = 2 * sub_buckets;
+public:
+    static constexpr unsigned bucket_count = linear_buckets + (value_bits - precision_bits - 1) * sub_buckets;
+private:
+    std::array<uint64_t, bucket_count> _buckets{};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = 0;
+    uint64_t _max = 0;
+private:
+    static unsigned index_of(uint64_t v) {
+        if (v < linear_buckets) {
+            return v;
+        }
+        unsigned msb = 63 - __builtin_clzll(v);
+        unsigned shift = msb - precision_bits;
+        return linear_buckets + (msb - precision_bits - 1) * sub_buckets + ((v >> shift) - sub_buckets);
+    }
+    static uint64_t lowest_equivalent(unsigned idx) {
+        if (idx < linear_buckets) {
+            return idx;
+        }
+        idx -= linear_buckets;
+        unsigned shift = idx / sub_buckets + 1;
+        return uint64_t(idx % sub_buckets + sub_buckets) << shift;
+    }
+    static uint64_t highest_equivalent(unsigned idx) {
+        if (idx < linear_buckets) {
+            return idx;
+        }
+        unsigned shift = (idx - linear_buckets) / sub_buckets + 1;
+        return lowest_equivalent(idx) + (uint64_t(1) << shift) - 1;
+    }
+    void recompute_min_max() {
+        auto first = std::find_if(_buckets.begin(), _buckets.end(), [] (uint64_t c) { return c != 0; });
+        if (first == _buckets.end()) {
+            _min = _max = 0;
+            return;
+        }
+        auto last = std::find_if(_buckets.rbegin(), _buckets.rend(), [] (uint64_t c) { return c != 0; });
+        _min = std::max(_min, lowest_equivalent(first - _buckets.begin()));
+        _max = std::min(_max, highest_equivalent(bucket_count - 1 - (last - _buckets.rbegin())));
+    }
+public:
+    void record(uint64_t v) {
+        if (v > max_value) {
+            v = max_value;
+        }
+        if (!_count || v < _min) {
+            _min = v;
+        }
+        if (v > _max) {
+            _max = v;
+        }
+        ++_buckets[index_of(v)];
+        ++_count;
+        _sum += v;
+    }
+
+    template <typename Rep, typename Period>
+    void add(std::chrono::duration<Rep, Period> d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        record(us > 0 ? us : 0);
+    }
+
+    uint64_t count() const {
+        return _count;
+    }
+    uint64_t sum() const {
+        return _sum;
+    }
+    uint64_t min() const {
+        return _min;
+    }
+    uint64_t max() const {
+        return _max;
+    }
+    double mean() const {
+        return _count ? double(_sum) / _count : 0;
+    }
+
+    // Returns the value below which p percent of the recorded values fall,
+    // rounded up to the top of the bucket it's in. 0 if nothing was recorded.
+    uint64_t percentile(double p) const {
+        if (!_count) {
+            return 0;
+        }
+        uint64_t target = std::max<uint64_t>(1, std::ceil(std::min(p, 100.0) / 100 * _count));
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            seen += _buckets[i];
+            if (seen >= target) {
+                return std::max(_min, std::min(highest_equivalent(i), _max));
+            }
+        }
+        return _max;
+    }
+
+    hdr_histogram& operator+=(const hdr_histogram& o) {
+        if (!o._count) {
+            return *this;
+        }
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            _buckets[i] += o._buckets[i];
+        }
+        _min = _count ? std::min(_min, o._min) : o._min;
+        _max = std::max(_max, o._max);
+        _count += o._count;
+        _sum += o._sum;
+        return *this;
+    }
+
+    // Removes an earlier snapshot of the same histogram, leaving what was
+    // recorded since. min and max are narrowed to the remaining buckets.
+    hdr_histogram& operator-=(const hdr_histogram& o) {
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            _buckets[i] -= o._buckets[i];
+        }
+        _count -= o._count;
+        _sum -= o._sum;
+        recompute_min_max();
+        return *this;
+    }
+};
+
+inline hdr_histogram operator+(hdr_histogram a, const hdr_histogram& b) {
+    a += b;
+    return a;
+}
+
+/**
+ * Keeps the part of a cumulative hdr_histogram recorded during the last
+ * interval, so that percentiles of recent events can be polled by collectd.
+ */
+class hdr_histogram_window {
+    const hdr_histogram& _hist;
+    hdr_histogram _last;
+    hdr_histogram _recent;
+    timer<> _timer;
+public:
+    explicit hdr_histogram_window(const hdr_histogram& hist, std::chrono::seconds interval = std::chrono::seconds(10))
+        : _hist(hist)
+        , _timer([this] { update(); })
+    {
+        _timer.arm_periodic(interval);
+    }
+
+    void update() {
+        _recent = _hist;
+        _recent -= _last;
+        _last = _hist;
+    }
+
+    const hdr_histogram& recent() const {
+        return _recent;
+    }
+};
+
+}
@@ -27,7 +27,20 @@
 namespace utils {
 static logging::logger filterlog("bloom_filter");
 
-filter_ptr i_filter::get_filter(int64_t num_elements, double max_false_pos_probability) {
+hashed_key make_hashed_key(bytes_view key) {
+    hashed_key h;
+    utils::murmur_hash::hash3_x64_128(key, 0, h.hash);
+    return h;
+}
+
+static filter_ptr create_filter(filter_layout layout, int hash, int64_t num_elements, int buckets_per) {
+    if (layout == filter_layout::blocked) {
+        return filter::create_blocked_filter(hash, num_elements, buckets_per);
+    }
+    return filter::create_filter(hash, num_elements, buckets_per);
+}
+
+filter_ptr i_filter::get_filter(int64_t num_elements, double max_false_pos_probability, filter_layout layout) {
     if (max_false_pos_probability > 1.0) {
         throw std::invalid_argument(sprint("Invalid probability %f: must be lower than 1.0", max_false_pos_probability));
     }
@@ -38,10 +51,10 @@ filter_ptr i_filter::get_filter(int64_t num_elements, double max_false_pos_proba
 
     int buckets_per_element = bloom_calculations::max_buckets_per_element(num_elements);
     auto spec = bloom_calculations::compute_bloom_spec(buckets_per_element, max_false_pos_probability);
-    return filter::create_filter(spec.K, num_elements, spec.buckets_per_element);
+    return create_filter(layout, spec.K, num_elements, spec.buckets_per_element);
 }
 
-filter_ptr i_filter::get_filter(int64_t num_elements, int target_buckets_per_elem) {
+filter_ptr i_filter::get_filter(int64_t num_elements, int target_buckets_per_elem, filter_layout layout) {
     int max_buckets_per_element = std::max(1, bloom_calculations::max_buckets_per_element(num_elements));
     int buckets_per_element = std::min(target_buckets_per_elem, max_buckets_per_element);
 
@@ -49,6 +62,6 @@ filter_ptr i_filter::get_filter(int64_t num_elements, int target_buckets_per_ele
         filterlog.warn("Cannot provide an optimal bloom_filter for {} elements ({}/{} buckets per element).", num_elements, buckets_per_element, target_buckets_per_elem);
     }
     auto spec = bloom_calculations::compute_bloom_spec(buckets_per_element);
-    return filter::create_filter(spec.K, num_elements, spec.buckets_per_element);
+    return create_filter(layout, spec.K, num_elements, spec.buckets_per_element);
 }
 }
@@ -40,6 +40,7 @@
  */
 #pragma once
 
+#include <array>
 #include "bytes.hh"
 #include "bloom_calculations.hh"
 
@@ -48,6 +49,21 @@ namespace utils {
 struct i_filter;
 using filter_ptr = std::unique_ptr<i_filter>;
 
+enum class filter_layout {
+    // Classic bloom filter, compatible with Cassandra's Filter.db.
+    classic,
+    // All bits of a key in a single cache line, see blocked_bloom_filter.
+    blocked,
+};
+
+// Hash of a key, for probing many filters with the same key while hashing it
+// only once. All filters hash keys with murmur3 (x64, 128 bits, seed 0).
+struct hashed_key {
+    std::array<uint64_t, 2> hash;
+};
+
+hashed_key make_hashed_key(bytes_view key);
+
 // FIXME: serialize() and serialized_size() not implemented. We should only be serializing to
 // disk, not in the wire.
 struct i_filter {
@@ -55,6 +71,7 @@ struct i_filter {
 
     virtual void add(const bytes_view& key) = 0;
     virtual bool is_present(const bytes_view& key) = 0;
+    virtual bool is_present(const hashed_key& key) = 0;
     virtual void clear() = 0;
     virtual void close() = 0;
 
@@ -67,11 +84,13 @@ struct i_filter {
      *         Asserts that the given probability can be satisfied using this
      *         filter.
      */
-    static filter_ptr get_filter(int64_t num_elements, double max_false_pos_prob);
+    static filter_ptr get_filter(int64_t num_elements, double max_false_pos_prob,
+                                 filter_layout layout = filter_layout::classic);
     /**
      * @return A bloom_filter with the lowest practical false positive
      *         probability for the given number of elements.
      */
-    static filter_ptr get_filter(int64_t num_elements, int target_buckets_per_elem);
+    static filter_ptr get_filter(int64_t num_elements, int target_buckets_per_elem,
+                                 filter_layout layout = filter_layout::classic);
 };
 }
@@ -31,8 +31,10 @@
 #include <algorithm>
 
 class large_bitset {
+public:
     static constexpr size_t block_size() { return 128 * 1024; }
     using int_type = unsigned long;
+private:
     static constexpr size_t bits_per_int() {
         return std::numeric_limits<int_type>::digits;
     }
@@ -82,6 +84,14 @@ class large_bitset {
         _storage[idx1][idx2] &= ~(int_type(1) << idx3);
     }
     void clear();
+    // Returns a pointer to the idx-th word of the bitmap. Words are stored
+    // contiguously in chunks of ints_per_block() words.
+    int_type* word(size_t idx) {
+        return &_storage[idx / ints_per_block()][idx % ints_per_block()];
+    }
+    const int_type* word(size_t idx) const {
+        return &_storage[idx / ints_per_block()][idx % ints_per_block()];
+    }
     // load data from host bitmap (in host byte order); returns end bit position
     template <typename IntegerIterator>
     size_t load(IntegerIterator start, IntegerIterator finish, size_t position = 0);
@@ -25,9 +25,18 @@
 #include <unordered_map>
 
 #include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/scollectd.hh>
 
 namespace utils {
 // Simple variant of the "LoadingCache" used for permissions in origin.
+//
+// An entry is served from the cache for `expiry` after it was loaded. Once it
+// is older than `refresh` (if that's shorter than `expiry`) it is still
+// served, but a reload is started in the background, so that hot entries are
+// never waited for after they were first loaded. Concurrent loads of the same
+// key are coalesced into one. A zero `expiry` disables caching.
 
 typedef steady_clock_type loading_cache_clock_type;
 
@@ -37,6 +46,16 @@ struct timestamped_val {
     typename loading_cache_clock_type::time_point loaded;
 };
 
+struct loading_cache_stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Stale entries which were returned while being reloaded.
+    uint64_t stale_hits = 0;
+    uint64_t background_reloads = 0;
+    uint64_t load_failures = 0;
+    uint64_t evictions = 0;
+};
+
 template<typename _Key, typename _Tp, typename _Hash = std::hash<_Key>,
                 typename _Pred = std::equal_to<_Key>,
                 typename _Alloc = std::allocator<std::pair<const _Key, timestamped_val<_Tp>> > >
@@ -44,6 +63,7 @@ class loading_cache {
 private:
     typedef timestamped_val<_Tp> ts_value_type;
     typedef std::unordered_map<_Key, ts_value_type, _Hash, _Pred, _Alloc> map_type;
+    typedef std::unordered_map<_Key, lw_shared_ptr<shared_promise<_Tp>>, _Hash, _Pred> loading_map_type;
     typedef loading_cache<_Key, _Tp, _Hash, _Pred, _Alloc> _MyType;
 public:
     typedef _Tp value_type;
@@ -58,36 +78,117 @@ class loading_cache {
                     const hasher& hf = hasher(), const key_equal& eql =
                                     key_equal(), const allocator_type& a =
                                     allocator_type())
-                    : _map(10, hf, eql, a), _max_size(max_size), _expiry(
-                                    expiry), _refresh(refresh), _load(
+                    : _map(10, hf, eql, a), _loading(10, hf, eql), _max_size(max_size), _expiry(
+                                    expiry), _refresh(std::min(refresh, expiry)), _load(
                                     std::forward<Func>(load)) {
 
-        auto period = _expiry;
-
-        if (expiry == std::chrono::milliseconds() && _max_size != 0) {
-            period = std::chrono::milliseconds(5000);
-        }
-        if (period != std::chrono::milliseconds()) {
+        if (_expiry != std::chrono::milliseconds()) {
             _timer.set_callback(std::bind(&_MyType::on_timer, this));
-            _timer.arm_periodic(period);
+            _timer.arm_periodic(std::min(_expiry, std::chrono::milliseconds(5000)));
         }
     }
 
     future<_Tp> get(const _Key & k) {
+        if (_expiry == std::chrono::milliseconds()) {
+            ++_stats.misses;
+            return _load(k);
+        }
+
+        auto now = loading_cache_clock_type::now();
         auto i = _map.find(k);
 
-        if (i == _map.end()
-                        || (i->second.loaded + _refresh)
-                                        < loading_cache_clock_type::now()) {
-            return _load(k).then([this, k](_Tp t) {
-                _map[k] = ts_value_type{t, loading_cache_clock_type::now()};
-                return make_ready_future<_Tp>(std::move(t));
-            });
+        if (i == _map.end() || i->second.loaded + _expiry < now) {
+            ++_stats.misses;
+            return load(k);
+        }
+        if (i->second.loaded + _refresh < now) {
+            ++_stats.stale_hits;
+            reload_in_background(k);
+        } else {
+            ++_stats.hits;
         }
         return make_ready_future<_Tp>(i->second.value);
     }
 
+    // Drops the entry, so that the next get() loads it again.
+    void remove(const _Key& k) {
+        _map.erase(k);
+    }
+
+    void clear() {
+        _map.clear();
+    }
+
+    size_t size() const {
+        return _map.size();
+    }
+
+    const loading_cache_stats& stats() const {
+        return _stats;
+    }
+
+    // Exports the cache statistics as per-shard metrics of given plugin.
+    void setup_collectd(const sstring& plugin) {
+        auto metric = [&plugin] (const char* type, const char* name, scollectd::data_type dt, auto&& value) {
+            return scollectd::add_polled_metric(scollectd::type_instance_id(plugin
+                    , scollectd::per_cpu_plugin_instance
+                    , type, name)
+                    , scollectd::make_typed(dt, std::forward<decltype(value)>(value)));
+        };
+        _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+            metric("total_operations", "hits", scollectd::data_type::DERIVE, _stats.hits),
+            metric("total_operations", "misses", scollectd::data_type::DERIVE, _stats.misses),
+            metric("total_operations", "stale_hits", scollectd::data_type::DERIVE, _stats.stale_hits),
+            metric("total_operations", "background_reloads", scollectd::data_type::DERIVE, _stats.background_reloads),
+            metric("total_operations", "load_failures", scollectd::data_type::DERIVE, _stats.load_failures),
+            metric("total_operations", "evictions", scollectd::data_type::DERIVE, _stats.evictions),
+            metric("objects", "entries", scollectd::data_type::GAUGE, [this] { return _map.size(); }),
+        }));
+    }
+
+    // Waits for background reloads to finish. No get() may be called after.
+    future<> stop() {
+        _timer.cancel();
+        return _gate.close();
+    }
 private:
+    // Loads the value, or joins a load of the same key which is in progress.
+    future<_Tp> load(const _Key& k) {
+        auto l = _loading.find(k);
+        if (l != _loading.end()) {
+            return l->second->get_shared_future();
+        }
+        if (_gate.is_closed()) {
+            return make_exception_future<_Tp>(seastar::gate_closed_exception());
+        }
+        auto p = make_lw_shared<shared_promise<_Tp>>();
+        _loading.emplace(k, p);
+        auto f = p->get_shared_future();
+        with_gate(_gate, [this, k, p] {
+            return futurize<_Tp>::apply(_load, k).then_wrapped([this, k, p] (future<_Tp> f) {
+                _loading.erase(k);
+                try {
+                    auto t = f.get0();
+                    _map[k] = ts_value_type{t, loading_cache_clock_type::now()};
+                    p->set_value(std::move(t));
+                } catch (...) {
+                    ++_stats.load_failures;
+                    p->set_exception(std::current_exception());
+                }
+            });
+        });
+        return f;
+    }
+
+    void reload_in_background(const _Key& k) {
+        if (_loading.count(k) || _gate.is_closed()) {
+            return;
+        }
+        ++_stats.background_reloads;
+        // A failed reload leaves the stale value in place until it expires.
+        load(k).handle_exception([] (std::exception_ptr) { });
+    }
+
     void on_timer() {
         auto i = _map.begin();
         auto e = _map.end();
@@ -97,6 +198,7 @@ class loading_cache {
         while (i != e) {
             if ((i->second.loaded + _expiry) < now) {
                 i = _map.erase(i);
+                ++_stats.evictions;
                 continue;
             }
             ++i;
@@ -114,6 +216,7 @@ class loading_cache {
 
             for (auto& e : tmp) {
                 _map.erase(e);
+                ++_stats.evictions;
                 if (_map.size() < _max_size) {
                     break;
                 }
@@ -121,13 +224,16 @@ class loading_cache {
         }
     }
 
-    std::unordered_map<_Key, ts_value_type, _Hash, _Pred, _Alloc> _map;
+    map_type _map;
+    loading_map_type _loading;
     size_t _max_size;
     std::chrono::milliseconds _expiry;
     std::chrono::milliseconds _refresh;
     std::function<future<_Tp>(_Key)> _load;
+    loading_cache_stats _stats;
+    seastar::gate _gate;
     timer<> _timer;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
 };
 
 }
-
@@ -28,6 +28,7 @@
 #include <boost/intrusive/slist.hpp>
 #include <boost/range/adaptors.hpp>
 #include <stack>
+#include <sys/mman.h>
 
 #include <seastar/core/memory.hh>
 #include <seastar/core/align.hh>
@@ -89,6 +90,7 @@ class tracker::impl {
     void full_compaction();
     void reclaim_all_free_segments();
     occupancy_stats region_occupancy();
+    size_class_occupancy region_occupancy_by_size_class();
     occupancy_stats occupancy();
     void set_reclamation_step(size_t step_in_segments) { _reclamation_step = step_in_segments; }
     size_t reclamation_step() const { return _reclamation_step; }
@@ -122,6 +124,10 @@ occupancy_stats tracker::region_occupancy() {
     return _impl->region_occupancy();
 }
 
+size_class_occupancy tracker::region_occupancy_by_size_class() {
+    return _impl->region_occupancy_by_size_class();
+}
+
 occupancy_stats tracker::occupancy() {
     return _impl->occupancy();
 }
@@ -237,6 +243,8 @@ class segment_zone;
 
 struct segment_descriptor {
     bool _lsa_managed;
+    // Size class of the objects in the segment, see region_impl.
+    uint8_t _size_class = 0;
     segment::size_type _free_space;
     segment_heap::handle_type _heap_handle;
     region::impl* _region;
@@ -326,12 +334,21 @@ static inline bool can_allocate_more_memory(size_t size)
 // 2) moving segments inside a zone to its beginning and shrinking that zone
 //
 // Zones can be shrunk but cannot grow.
+//
+// When huge page zones are enabled, zones are aligned to huge page boundaries
+// and sized and shrunk in multiples of huge pages, so that the kernel can back
+// them with transparent huge pages, which are then never split by shrinking.
 class segment_zone : public bi::set_base_hook<>, public bi::slist_base_hook<> {
     struct free_segment : public bi::slist_base_hook<> { };
 
     static constexpr size_t initial_size = 64 * 1024;
     static constexpr size_t minimum_size = 16;
     static thread_local size_t next_attempt_size;
+public:
+    static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+    static constexpr size_t segments_per_huge_page = huge_page_size / segment::size;
+    static thread_local bool huge_page_zones;
+private:
 
     // Bitset of all segments belonging to this zone. Used segments have their
     // corresponding bit clear, free segments - set.
@@ -349,8 +366,20 @@ class segment_zone : public bi::set_base_hook<>, public bi::slist_base_hook<> {
     }
     bool migrate_segment(size_t from, size_t to);
     size_t shrink_by(size_t delta);
+    // Rounds a shrink request down so that the zone stays a whole number
+    // of huge pages.
+    size_t shrink_granularity(size_t delta) const {
+        if (huge_page_zones && delta < segment_count()) {
+            return align_down(delta, segments_per_huge_page);
+        }
+        return delta;
+    }
 public:
     segment_zone();
+    // Sets the size of the next zone to be created.
+    static void set_next_attempt_size(size_t segments) {
+        next_attempt_size = std::max(segments, minimum_size);
+    }
     ~segment_zone() {
         assert(empty());
         if (_segments.size()) {
@@ -399,10 +428,15 @@ class segment_zone : public bi::set_base_hook<>, public bi::slist_base_hook<> {
     size_t free_segment_count() const { return _segments.size() - _used_segment_count; }
 
     segment* base() const { return _base; }
+    bool huge_page_aligned() const {
+        return !(reinterpret_cast<uintptr_t>(_base) & (huge_page_size - 1));
+    }
 };
 
 thread_local size_t segment_zone::next_attempt_size = segment_zone::initial_size;
+thread_local bool segment_zone::huge_page_zones = false;
 constexpr size_t segment_zone::minimum_size;
+constexpr size_t segment_zone::segments_per_huge_page;
 
 segment_zone::segment_zone()
 {
@@ -411,13 +445,22 @@ segment_zone::segment_zone()
         auto size = next_size;
         next_size >>= 1;
 
+        if (huge_page_zones) {
+            size = align_up(size, segments_per_huge_page);
+        }
         if (!can_allocate_more_memory(size << segment::size_shift)) {
             continue;
         }
-        auto ptr = aligned_alloc(segment::size, size << segment::size_shift);
+        auto ptr = aligned_alloc(huge_page_zones ? huge_page_size : segment::size, size << segment::size_shift);
         if (!ptr) {
             continue;
         }
+        if (huge_page_zones) {
+            // Seastar's memory is anonymous unless it comes from hugetlbfs, in
+            // which case it is already backed by huge pages and this fails
+            // harmlessly.
+            ::madvise(ptr, size << segment::size_shift, MADV_HUGEPAGE);
+        }
         _base = static_cast<segment*>(ptr);
         try {
             _segments.resize(size, true);
@@ -447,7 +490,7 @@ size_t segment_zone::defragment_and_shrink_by(size_t delta)
 {
     _free_segments.clear_and_dispose([] (auto* fseg) { fseg->~free_segment(); });
 
-    delta = std::min(delta, free_segment_count());
+    delta = shrink_granularity(std::min(delta, free_segment_count()));
     auto new_size = segment_count() - delta;
     auto used_pos = _segments.find_last_clear();
     auto free_pos = _segments.find_first_set();
@@ -470,7 +513,10 @@ size_t segment_zone::shrink_by(size_t delta)
 {
     _free_segments.clear_and_dispose([] (auto* fseg) { fseg->~free_segment(); });
 
-    delta = std::min(delta, free_segment_count());
+    delta = shrink_granularity(std::min(delta, free_segment_count()));
+    if (!delta) {
+        return 0;
+    }
     auto new_size = segment_count() - delta;
     logger.debug("Shrinking zone @{} by {} segments (total: {})", this, delta, new_size);
     _segments.resize(new_size);
@@ -499,6 +545,8 @@ class segment_pool {
     all_zones_type _all_zones;
     bi::slist<segment_zone> _not_full_zones;
     size_t _free_segments_in_zones = 0;
+    // Zones are not shrunk below this many segments in total.
+    size_t _reserved_segments = 0;
 private:
     segment* allocate_segment();
     void deallocate_segment(segment* seg);
@@ -562,15 +610,59 @@ class segment_pool {
     void on_segment_compaction() { _stats.segments_compacted++; }
     size_t free_segments_in_zones() const { return _free_segments_in_zones; }
     size_t free_segments() const { return _free_segments_in_zones + _emergency_reserve.size(); }
+    size_t segments_in_zones() const {
+        size_t n = 0;
+        for (auto& zone : _all_zones) {
+            n += zone.segment_count();
+        }
+        return n;
+    }
+    // Returns the number of used segments in huge page aligned zones.
+    size_t huge_page_backed_segments() const {
+        size_t n = 0;
+        for (auto& zone : _all_zones) {
+            if (zone.huge_page_aligned()) {
+                n += zone.used_segment_count();
+            }
+        }
+        return n;
+    }
+    void enable_huge_page_zones() {
+        segment_zone::huge_page_zones = true;
+    }
+    void reserve_segments(size_t n);
 };
 
+void segment_pool::reserve_segments(size_t n) {
+    _reserved_segments = n;
+    auto in_zones = segments_in_zones();
+    while (in_zones < n) {
+        tracker_reclaimer_lock rl;
+        segment_zone::set_next_attempt_size(n - in_zones);
+        segment_zone* zone;
+        try {
+            zone = new segment_zone;
+        } catch (const std::bad_alloc&) {
+            logger.warn("Could only reserve {} of {} segments", in_zones, n);
+            return;
+        }
+        _all_zones.insert(*zone);
+        _free_segments_in_zones += zone->free_segment_count();
+        _not_full_zones.push_front(*zone);
+        in_zones += zone->segment_count();
+    }
+    logger.debug("Reserved {} segments in {} zones", in_zones, _all_zones.size());
+}
+
 size_t segment_pool::reclaim_segments(size_t target) {
     // Reclaimer tries to release segments occupying higher parts of the address
     // space. A tree of zones is traversed starting from the zone based at
     // the highest address: segments are migrated to the zones in the lower
     // parts of the address space and the zones are shrunk.
 
-    if (!_free_segments_in_zones) {
+    auto in_zones = segments_in_zones();
+    target = std::min(target, in_zones - std::min(in_zones, _reserved_segments));
+    if (!_free_segments_in_zones || !target) {
         return 0;
     }
 
@@ -862,6 +954,9 @@ class segment_pool {
     }
     size_t reclaim_segments(size_t target) { return 0; }
     void reclaim_all_free_segments() { }
+    size_t huge_page_backed_segments() const { return 0; }
+    void enable_huge_page_zones() { }
+    void reserve_segments(size_t n) { }
 
     struct stats {
         size_t segments_migrated;
@@ -969,6 +1064,16 @@ region_group_binomial_group_sanity_check(auto& bh) {
 // sparser and are eventually released. Objects which are too large are
 // allocated using standard allocator.
 //
+// Size classes.
+//
+// Objects larger than large_object_threshold are allocated in other segments
+// than the smaller ones: each size class has its own active segment and heap
+// of closed segments. Large objects, like cell values, tend to be freed
+// together, so their segments empty out without compaction. Keeping them out
+// of the segments of small objects also means that compacting the latter
+// doesn't copy them. Segments of large objects are compacted only when they
+// are fairly sparse, see max_occupancy_for_large_compaction.
+//
 // Segment layout.
 //
 // Objects in a segment are laid out sequentially. Each object is preceded by
@@ -984,6 +1089,16 @@ class region_impl : public allocation_strategy {
     static constexpr float max_occupancy_for_compaction = 0.85; // FIXME: make configurable
     static constexpr float max_occupancy_for_compaction_on_idle = 0.93; // FIXME: make configurable
     static constexpr size_t max_managed_object_size = segment::size * 0.1;
+    static constexpr size_t large_object_threshold = segment::size / 64;
+    // Large objects are more costly to move for the space they free, so
+    // their segments are compacted only when they are at most this full.
+    static constexpr float max_occupancy_for_large_compaction = 0.5;
+
+    enum size_class : uint8_t {
+        small_objects,
+        large_objects,
+        size_class_count
+    };
 
     // single-byte flags
     struct obj_flags {
@@ -1092,13 +1207,18 @@ class region_impl : public allocation_strategy {
                 (int)desc._flags._value, (void*)desc._migrator, unsigned(desc._alignment), desc._size);
         }
     } __attribute__((packed));
+
+    // Segments holding the objects of a size class.
+    struct size_class_segments {
+        segment* active = nullptr;
+        size_t active_offset = 0;
+        segment_heap segments; // Contains only closed segments
+        occupancy_stats closed_occupancy;
+    };
 private:
     region* _region = nullptr;
     region_group* _group = nullptr;
-    segment* _active = nullptr;
-    size_t _active_offset;
-    segment_heap _segments; // Contains only closed segments
-    occupancy_stats _closed_occupancy;
+    size_class_segments _classes[size_class_count];
     occupancy_stats _non_lsa_occupancy;
     // This helps us keeping track of the region_group* heap. That's because we call update before
     // we have a chance to update the occupancy stats - mainly because at this point we don't know
@@ -1128,29 +1248,38 @@ class region_impl : public allocation_strategy {
             _region._reclaiming_enabled = _prev;
         }
     };
-    void* alloc_small(allocation_strategy::migrate_fn migrator, segment::size_type size, size_t alignment) {
+    static size_class size_class_of(size_t size) {
+        return size > large_object_threshold ? large_objects : small_objects;
+    }
+
+    static size_class size_class_of(segment* seg) {
+        return size_class(shard_segment_pool.descriptor(seg)._size_class);
+    }
+
+    void* alloc_small(size_class cls, allocation_strategy::migrate_fn migrator, segment::size_type size, size_t alignment) {
         assert(alignment < obj_flags::max_alignment);
 
-        if (!_active) {
-            _active = new_segment();
-            _active_offset = 0;
+        auto& c = _classes[cls];
+        if (!c.active) {
+            c.active = new_segment(cls);
+            c.active_offset = 0;
         }
 
-        size_t obj_offset = align_up(_active_offset + sizeof(object_descriptor), alignment);
+        size_t obj_offset = align_up(c.active_offset + sizeof(object_descriptor), alignment);
         if (obj_offset + size > segment::size) {
-            close_and_open();
-            return alloc_small(migrator, size, alignment);
+            close_and_open(cls);
+            return alloc_small(cls, migrator, size, alignment);
         }
 
         auto descriptor_offset = obj_offset - sizeof(object_descriptor);
-        auto padding = descriptor_offset - _active_offset;
+        auto padding = descriptor_offset - c.active_offset;
 
-        new (_active->at(_active_offset)) obj_flags(obj_flags::make_padding(padding));
-        new (_active->at(descriptor_offset)) object_descriptor(migrator, size, alignment, padding);
+        new (c.active->at(c.active_offset)) obj_flags(obj_flags::make_padding(padding));
+        new (c.active->at(descriptor_offset)) object_descriptor(migrator, size, alignment, padding);
 
-        void* obj = _active->at(obj_offset);
-        _active_offset = obj_offset + size;
-        _active->record_alloc(size + sizeof(object_descriptor) + padding);
+        void* obj = c.active->at(obj_offset);
+        c.active_offset = obj_offset + size;
+        c.active->record_alloc(size + sizeof(object_descriptor) + padding);
         return obj;
     }
 
@@ -1174,21 +1303,22 @@ class region_impl : public allocation_strategy {
         }
     }
 
-    void close_active() {
-        if (!_active) {
+    void close_active(size_class cls) {
+        auto& c = _classes[cls];
+        if (!c.active) {
             return;
         }
-        if (_active_offset < segment::size) {
-            new (_active->at(_active_offset)) obj_flags(obj_flags::make_end_of_segment());
+        if (c.active_offset < segment::size) {
+            new (c.active->at(c.active_offset)) obj_flags(obj_flags::make_end_of_segment());
         }
-        logger.trace("Closing segment {}, used={}, waste={} [B]", _active, _active->occupancy(), segment::size - _active_offset);
-        _closed_occupancy += _active->occupancy();
+        logger.trace("Closing segment {}, used={}, waste={} [B]", c.active, c.active->occupancy(), segment::size - c.active_offset);
+        c.closed_occupancy += c.active->occupancy();
 
-        auto heap_node = &shard_segment_pool.descriptor(_active)._heap_node._node;
+        auto heap_node = &shard_segment_pool.descriptor(c.active)._heap_node._node;
         segment_heap_allocator::prepare(heap_node);
-        auto handle = _segments.push(_active);
-        _active->set_heap_handle(handle);
-        _active = nullptr;
+        auto handle = c.segments.push(c.active);
+        c.active->set_heap_handle(handle);
+        c.active = nullptr;
     }
 
     void free_segment(segment* seg) noexcept {
@@ -1199,8 +1329,9 @@ class region_impl : public allocation_strategy {
         }
     }
 
-    segment* new_segment() {
+    segment* new_segment(size_class cls) {
         segment* seg = shard_segment_pool.new_segment(this);
+        shard_segment_pool.descriptor(seg)._size_class = cls;
         if (_group) {
             _evictable_space += segment_size;
             _group->increase_usage(_heap_handle, segment::size);
@@ -1211,19 +1342,46 @@ class region_impl : public allocation_strategy {
     void compact(segment* seg) {
         ++_reclaim_counter;
 
-        for_each_live(seg, [this] (object_descriptor* desc, void* obj) {
-            auto dst = alloc_small(desc->migrator(), desc->size(), desc->alignment());
+        auto cls = size_class_of(seg);
+        for_each_live(seg, [this, cls] (object_descriptor* desc, void* obj) {
+            auto dst = alloc_small(cls, desc->migrator(), desc->size(), desc->alignment());
             desc->migrator()->migrate(obj, dst, desc->size());
         });
 
         free_segment(seg);
     }
 
-    void close_and_open() {
-        segment* new_active = new_segment();
-        close_active();
-        _active = new_active;
-        _active_offset = 0;
+    void close_and_open(size_class cls) {
+        segment* new_active = new_segment(cls);
+        close_active(cls);
+        _classes[cls].active = new_active;
+        _classes[cls].active_offset = 0;
+    }
+
+    // Returns true if compacting the sparsest closed segment of the size
+    // class would free memory, given the maximum occupancy of the closed
+    // segments at which it's worth it.
+    bool is_compactible(const size_class_segments& c, float max_occupancy) const {
+        return (c.closed_occupancy.free_space() >= 2 * segment::size)
+            && (c.closed_occupancy.used_fraction() < max_occupancy)
+            && (c.segments.top()->occupancy().free_space() >= max_managed_object_size)
+            && (&c != &_classes[large_objects] || c.segments.top()->occupancy().used_fraction() <= max_occupancy_for_large_compaction);
+    }
+
+    // Returns the size class whose sparsest segment should be compacted
+    // next, or size_class_count if none is worth compacting.
+    size_class compaction_candidate(float max_occupancy) const {
+        auto best = size_class_count;
+        for (unsigned i = 0; i < size_class_count; ++i) {
+            auto& c = _classes[i];
+            if (!is_compactible(c, max_occupancy)) {
+                continue;
+            }
+            if (best == size_class_count || c.segments.top()->occupancy() < _classes[best].segments.top()->occupancy()) {
+                best = size_class(i);
+            }
+        }
+        return best;
     }
 
     static uint64_t next_id() {
@@ -1260,17 +1418,19 @@ class region_impl : public allocation_strategy {
     virtual ~region_impl() {
         tracker_instance._impl->unregister_region(this);
 
-        while (!_segments.empty()) {
-            segment* seg = _segments.top();
-            _segments.pop();
-            assert(seg->is_empty());
-            free_segment(seg);
-        }
-        _closed_occupancy = {};
-        if (_active) {
-            assert(_active->is_empty());
-            free_segment(_active);
-            _active = nullptr;
+        for (auto& c : _classes) {
+            while (!c.segments.empty()) {
+                segment* seg = c.segments.top();
+                c.segments.pop();
+                assert(seg->is_empty());
+                free_segment(seg);
+            }
+            c.closed_occupancy = {};
+            if (c.active) {
+                assert(c.active->is_empty());
+                free_segment(c.active);
+                c.active = nullptr;
+            }
         }
         if (_group) {
             _group->del(this);
@@ -1284,17 +1444,33 @@ class region_impl : public allocation_strategy {
         return occupancy().used_space() == 0;
     }
 
+    occupancy_stats occupancy(size_class cls) const {
+        auto& c = _classes[cls];
+        occupancy_stats total = c.closed_occupancy;
+        if (c.active) {
+            total += c.active->occupancy();
+        }
+        return total;
+    }
+
     occupancy_stats occupancy() const {
         occupancy_stats total = _non_lsa_occupancy;
-        total += _closed_occupancy;
-        if (_active) {
-            total += _active->occupancy();
+        for (unsigned i = 0; i < size_class_count; ++i) {
+            total += occupancy(size_class(i));
         }
         return total;
     }
 
+    size_class_occupancy occupancy_by_size_class() const {
+        return { occupancy(small_objects), occupancy(large_objects), _non_lsa_occupancy };
+    }
+
     occupancy_stats compactible_occupancy() const {
-        return _closed_occupancy;
+        occupancy_stats total;
+        for (auto& c : _classes) {
+            total += c.closed_occupancy;
+        }
+        return total;
     }
 
     occupancy_stats evictable_occupancy() const {
@@ -1307,17 +1483,11 @@ class region_impl : public allocation_strategy {
     //    while (is_compactible()) { compact(); }
     //
     bool is_compactible() const {
-        return _reclaiming_enabled
-            && (_closed_occupancy.free_space() >= 2 * segment::size)
-            && (_closed_occupancy.used_fraction() < max_occupancy_for_compaction)
-            && (_segments.top()->occupancy().free_space() >= max_managed_object_size);
+        return _reclaiming_enabled && compaction_candidate(max_occupancy_for_compaction) != size_class_count;
     }
 
     bool is_idle_compactible() {
-        return _reclaiming_enabled
-            && (_closed_occupancy.free_space() >= 2 * segment::size)
-            && (_closed_occupancy.used_fraction() < max_occupancy_for_compaction_on_idle)
-            && (_segments.top()->occupancy().free_space() >= max_managed_object_size);
+        return _reclaiming_enabled && compaction_candidate(max_occupancy_for_compaction_on_idle) != size_class_count;
     }
 
     virtual void* alloc(allocation_strategy::migrate_fn migrator, size_t size, size_t alignment) override {
@@ -1336,7 +1506,7 @@ class region_impl : public allocation_strategy {
             shard_segment_pool.update_non_lsa_memory_in_use(allocated_size);
             return ptr;
         } else {
-            return alloc_small(migrator, (segment::size_type) size, alignment);
+            return alloc_small(size_class_of(size), migrator, (segment::size_type) size, alignment);
         }
     }
 
@@ -1357,23 +1527,24 @@ class region_impl : public allocation_strategy {
         }
 
         segment_descriptor& seg_desc = shard_segment_pool.descriptor(seg);
+        auto& c = _classes[seg_desc._size_class];
 
         auto desc = reinterpret_cast<object_descriptor*>(reinterpret_cast<uintptr_t>(obj) - sizeof(object_descriptor));
         desc->mark_dead();
 
-        if (seg != _active) {
-            _closed_occupancy -= seg->occupancy();
+        if (seg != c.active) {
+            c.closed_occupancy -= seg->occupancy();
         }
 
         seg_desc.record_free(desc->size() + sizeof(object_descriptor) + desc->padding());
 
-        if (seg != _active) {
-            _segments.increase(seg_desc.heap_handle());
+        if (seg != c.active) {
+            c.segments.increase(seg_desc.heap_handle());
             if (seg_desc.is_empty()) {
-                _segments.erase(seg_desc.heap_handle());
+                c.segments.erase(seg_desc.heap_handle());
                 free_segment(seg);
             } else {
-                _closed_occupancy += seg_desc.occupancy();
+                c.closed_occupancy += seg_desc.occupancy();
             }
         }
     }
@@ -1387,29 +1558,33 @@ class region_impl : public allocation_strategy {
         degroup_temporarily dgt1(this);
         degroup_temporarily dgt2(&other);
 
-        if (_active && _active->is_empty()) {
-            shard_segment_pool.free_segment(_active);
-            _active = nullptr;
-        }
-        if (!_active) {
-            _active = other._active;
-            other._active = nullptr;
-            _active_offset = other._active_offset;
-            if (_active) {
-                shard_segment_pool.set_region(_active, this);
+        for (unsigned i = 0; i < size_class_count; ++i) {
+            auto& c = _classes[i];
+            auto& oc = other._classes[i];
+            if (c.active && c.active->is_empty()) {
+                shard_segment_pool.free_segment(c.active);
+                c.active = nullptr;
+            }
+            if (!c.active) {
+                c.active = oc.active;
+                oc.active = nullptr;
+                c.active_offset = oc.active_offset;
+                if (c.active) {
+                    shard_segment_pool.set_region(c.active, this);
+                }
+            } else {
+                other.close_active(size_class(i));
             }
-        } else {
-            other.close_active();
-        }
 
-        for (auto& seg : other._segments) {
-            shard_segment_pool.set_region(seg, this);
-        }
-        _segments.merge(other._segments);
+            for (auto& seg : oc.segments) {
+                shard_segment_pool.set_region(seg, this);
+            }
+            c.segments.merge(oc.segments);
 
-        _closed_occupancy += other._closed_occupancy;
+            c.closed_occupancy += oc.closed_occupancy;
+            oc.closed_occupancy = {};
+        }
         _non_lsa_occupancy += other._non_lsa_occupancy;
-        other._closed_occupancy = {};
         other._non_lsa_occupancy = {};
 
         // Make sure both regions will notice a future increment
@@ -1419,10 +1594,11 @@ class region_impl : public allocation_strategy {
 
     // Returns occupancy of the sparsest compactible segment.
     occupancy_stats min_occupancy() const {
-        if (_segments.empty()) {
+        auto cls = compaction_candidate(max_occupancy_for_compaction);
+        if (cls == size_class_count) {
             return {};
         }
-        return _segments.top()->occupancy();
+        return _classes[cls].segments.top()->occupancy();
     }
 
     // Tries to release one full segment back to the segment pool.
@@ -1436,15 +1612,20 @@ class region_impl : public allocation_strategy {
         auto in_use = shard_segment_pool.segments_in_use();
 
         while (shard_segment_pool.segments_in_use() >= in_use) {
-            compact_single_segment_locked();
+            auto cls = compaction_candidate(max_occupancy_for_compaction);
+            if (cls == size_class_count) {
+                break;
+            }
+            compact_single_segment_locked(cls);
         }
     }
 
-    void compact_single_segment_locked() {
-        segment* seg = _segments.top();
+    void compact_single_segment_locked(size_class cls) {
+        auto& c = _classes[cls];
+        segment* seg = c.segments.top();
         logger.debug("Compacting segment {} from region {}, {}", seg, id(), seg->occupancy());
-        _segments.pop();
-        _closed_occupancy -= seg->occupancy();
+        c.segments.pop();
+        c.closed_occupancy -= seg->occupancy();
         compact(seg);
         shard_segment_pool.on_segment_compaction();
     }
@@ -1452,21 +1633,25 @@ class region_impl : public allocation_strategy {
     // Compacts only a single segment
     void compact_on_idle() {
         compaction_lock _(*this);
-        compact_single_segment_locked();
+        auto cls = compaction_candidate(max_occupancy_for_compaction_on_idle);
+        if (cls != size_class_count) {
+            compact_single_segment_locked(cls);
+        }
     }
 
     void migrate_segment(segment* src, segment* dst) {
         ++_reclaim_counter;
+        auto& c = _classes[size_class_of(src)];
         size_t segment_size;
-        if (src != _active) {
-            _segments.erase(src->heap_handle());
+        if (src != c.active) {
+            c.segments.erase(src->heap_handle());
             auto heap_node = &shard_segment_pool.descriptor(dst)._heap_node._node;
             segment_heap_allocator::prepare(heap_node);
-            dst->set_heap_handle(_segments.push(dst));
+            dst->set_heap_handle(c.segments.push(dst));
             segment_size = segment::size;
         } else {
-            _active = dst;
-            segment_size = _active_offset;
+            c.active = dst;
+            segment_size = c.active_offset;
         }
 
         size_t offset = 0;
@@ -1499,14 +1684,17 @@ class region_impl : public allocation_strategy {
     void full_compaction() {
         compaction_lock _(*this);
         logger.debug("Full compaction, {}", occupancy());
-        close_and_open();
-        segment_heap all;
-        std::swap(all, _segments);
-        _closed_occupancy = {};
-        while (!all.empty()) {
-            segment* seg = all.top();
-            all.pop();
-            compact(seg);
+        for (unsigned i = 0; i < size_class_count; ++i) {
+            auto& c = _classes[i];
+            close_and_open(size_class(i));
+            segment_heap all;
+            std::swap(all, c.segments);
+            c.closed_occupancy = {};
+            while (!all.empty()) {
+                segment* seg = all.top();
+                all.pop();
+                compact(seg);
+            }
         }
         logger.debug("Done, {}", occupancy());
     }
@@ -1609,6 +1797,10 @@ occupancy_stats region::occupancy() const {
     return _impl->occupancy();
 }
 
+size_class_occupancy region::occupancy_by_size_class() const {
+    return _impl->occupancy_by_size_class();
+}
+
 void region::merge(region& other) {
     if (_impl != other._impl) {
         _impl->merge(*other._impl);
@@ -1654,6 +1846,15 @@ occupancy_stats tracker::impl::region_occupancy() {
     return total;
 }
 
+size_class_occupancy tracker::impl::region_occupancy_by_size_class() {
+    reclaiming_lock _(*this);
+    size_class_occupancy total;
+    for (auto&& r: _regions) {
+        total += r->occupancy_by_size_class();
+    }
+    return total;
+}
+
 occupancy_stats tracker::impl::occupancy() {
     reclaiming_lock _(*this);
     auto occ = region_occupancy();
@@ -1672,6 +1873,14 @@ void tracker::impl::reclaim_all_free_segments()
     logger.debug("Reclamation done");
 }
 
+void tracker::enable_huge_page_zones() {
+    shard_segment_pool.enable_huge_page_zones();
+}
+
+void tracker::reserve_memory(size_t bytes) {
+    shard_segment_pool.reserve_segments(bytes >> segment::size_shift);
+}
+
 void tracker::impl::full_compaction() {
     reclaiming_lock _(*this);
 
@@ -1920,6 +2129,7 @@ bool segment_pool::migrate_segment(segment* src, segment_zone& src_zone,
         }
         dst_desc._lsa_managed = true;
         dst_desc._free_space = src_desc._free_space;
+        dst_desc._size_class = src_desc._size_class;
         src_desc._region->migrate_segment(src, dst);
     } else {
         _emergency_reserve.replace(src, dst);
@@ -2007,6 +2217,10 @@ void tracker::impl::register_collectd_metrics() {
             scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "bytes", "free_space_in_zones"),
             scollectd::make_typed(scollectd::data_type::GAUGE, [] { return shard_segment_pool.free_segments_in_zones() * segment_size; })
         ),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "bytes", "huge_page_backed_space"),
+            scollectd::make_typed(scollectd::data_type::GAUGE, [] { return shard_segment_pool.huge_page_backed_segments() * segment_size; })
+        ),
         scollectd::add_polled_metric(
             scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "percent", "occupancy"),
             scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return region_occupancy().used_fraction() * 100; })
@@ -36,6 +36,7 @@
 namespace logalloc {
 
 struct occupancy_stats;
+struct size_class_occupancy;
 class region;
 class region_impl;
 class allocating_section;
@@ -460,9 +461,21 @@ class tracker {
 
     void reclaim_all_free_segments();
 
+    // Makes zones of segments created from now on huge page aligned and
+    // sized, and advises the kernel to back them with transparent huge pages.
+    void enable_huge_page_zones();
+
+    // Allocates zones for at least the given amount of segment memory up
+    // front. Zones are not shrunk below that amount when the standard
+    // allocator reclaims memory.
+    void reserve_memory(size_t bytes);
+
     // Returns aggregate statistics for all pools.
     occupancy_stats region_occupancy();
 
+    // Like region_occupancy(), but split by object size class.
+    size_class_occupancy region_occupancy_by_size_class();
+
     // Returns statistics for all segments allocated by LSA on this shard.
     occupancy_stats occupancy();
 
@@ -541,6 +554,24 @@ class occupancy_stats {
     friend std::ostream& operator<<(std::ostream&, const occupancy_stats&);
 };
 
+// Occupancy of a region split by the size class of the objects.
+//
+// Objects larger than a few kilobytes are allocated in their own segments,
+// which are accounted in "large". Objects which are too large to be managed
+// by LSA at all are accounted in "non_lsa".
+struct size_class_occupancy {
+    occupancy_stats small;
+    occupancy_stats large;
+    occupancy_stats non_lsa;
+
+    size_class_occupancy& operator+=(const size_class_occupancy& other) {
+        small += other.small;
+        large += other.large;
+        non_lsa += other.non_lsa;
+        return *this;
+    }
+};
+
 //
 // Log-structured allocator region.
 //
@@ -571,6 +602,9 @@ class region {
 
     occupancy_stats occupancy() const;
 
+    // Returns occupancy split by object size class.
+    size_class_occupancy occupancy_by_size_class() const;
+
     allocation_strategy& allocator();
 
     // Merges another region into this region. The other region is left empty.
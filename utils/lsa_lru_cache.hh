@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <seastar/core/scollectd.hh>
+#include <seastar/core/sstring.hh>
+
+#include "core/memory.hh"
+#include "utils/logalloc.hh"
+#include "utils/managed_bytes.hh"
+
+namespace utils {
+
+namespace bi = boost::intrusive;
+
+using lsa_lru_cache_lru_hook = bi::list_base_hook<bi::link_mode<bi::auto_unlink>>;
+using lsa_lru_cache_set_hook = bi::set_base_hook<bi::link_mode<bi::auto_unlink>>;
+
+// Base class of the entries of lsa_lru_cache. Entries live in the region of
+// the cache, so they must be movable by the region compactor, the move
+// constructor takes the place of the moved-from entry in the cache.
+class lsa_lru_cache_entry : public lsa_lru_cache_lru_hook, public lsa_lru_cache_set_hook {
+public:
+    lsa_lru_cache_entry() = default;
+    lsa_lru_cache_entry(lsa_lru_cache_entry&& o) noexcept {
+        lsa_lru_cache_lru_hook::swap_nodes(o);
+        lsa_lru_cache_set_hook::swap_nodes(o);
+    }
+};
+
+// Bounded cache, which keeps its entries in an evictable LSA region.
+//
+// Entries are of type Entry, derived from lsa_lru_cache_entry, and ordered by
+// Compare, which also orders the keys they are looked up by against them, as
+// well as the partial keys groups of entries are invalidated by. They are
+// evicted in LRU order when the configured capacity is exceeded, or when the
+// LSA reclaimer asks for memory, which balances them against row_cache and
+// memtables.
+//
+// Functions given entries are called with linearized managed_bytes. The ones
+// which may change entries are also called with the region's allocator.
+template <typename Entry, typename Compare>
+class lsa_lru_cache final {
+public:
+    using lru_type = bi::list<Entry,
+        bi::base_hook<lsa_lru_cache_lru_hook>,
+        bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+    using entries_type = bi::set<Entry,
+        bi::base_hook<lsa_lru_cache_set_hook>,
+        bi::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
+        bi::compare<Compare>>;
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t removals = 0;
+        uint64_t entries = 0;
+    };
+private:
+    stats _stats;
+    size_t _capacity = 0;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+    logalloc::region _region;
+    lru_type _lru;
+    entries_type _entries;
+private:
+    void setup_collectd(const sstring& name) {
+        auto id = [&name] (const sstring& type, const sstring& instance) {
+            return scollectd::type_instance_id(name, scollectd::per_cpu_plugin_instance, type, instance);
+        };
+        _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+            scollectd::add_polled_metric(id("bytes", "used")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _region.occupancy().used_space(); })
+            ),
+            scollectd::add_polled_metric(id("total_operations", "hits")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+            ),
+            scollectd::add_polled_metric(id("total_operations", "misses")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+            ),
+            scollectd::add_polled_metric(id("total_operations", "insertions")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+            ),
+            scollectd::add_polled_metric(id("total_operations", "evictions")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+            ),
+            scollectd::add_polled_metric(id("total_operations", "removals")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.removals)
+            ),
+            scollectd::add_polled_metric(id("objects", "entries")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.entries)
+            ),
+        }));
+    }
+
+    // Must be called with the region's allocator and linearized managed_bytes.
+    void evict_one() {
+        _lru.pop_back_and_dispose(current_deleter<Entry>());
+        --_stats.entries;
+        ++_stats.evictions;
+    }
+
+    void shrink_to_capacity() {
+        while (!_lru.empty() && _region.occupancy().used_space() > _capacity) {
+            evict_one();
+        }
+    }
+
+    void touch(Entry& e) {
+        _lru.erase(_lru.iterator_to(e));
+        _lru.push_front(e);
+    }
+
+    template <typename Iterator>
+    void erase(Iterator b, Iterator e) {
+        _entries.erase_and_dispose(b, e, [this] (Entry* entry) {
+            current_deleter<Entry>()(entry);
+            --_stats.entries;
+            ++_stats.removals;
+        });
+    }
+public:
+    // Metrics of the cache are registered under the plugin of given name.
+    explicit lsa_lru_cache(const sstring& name) {
+        setup_collectd(name);
+
+        _region.make_evictable([this] {
+            return with_allocator(_region.allocator(), [this] {
+                return with_linearized_managed_bytes([&] {
+                    if (_lru.empty()) {
+                        return memory::reclaiming_result::reclaimed_nothing;
+                    }
+                    evict_one();
+                    return memory::reclaiming_result::reclaimed_something;
+                });
+            });
+        });
+    }
+
+    lsa_lru_cache(lsa_lru_cache&&) = delete;
+
+    ~lsa_lru_cache() {
+        clear();
+    }
+
+    // Returns what func returns for the entry of given key, which becomes the
+    // most recently used one, or nothing if there is no such entry. Entries
+    // for which valid() returns false are removed, and not found.
+    template <typename Key, typename Func, typename Valid>
+    auto lookup(const Key& key, Func&& func, Valid&& valid) -> std::experimental::optional<std::result_of_t<Func(const Entry&)>> {
+        if (!enabled()) {
+            return { };
+        }
+        return with_linearized_managed_bytes([&] () -> std::experimental::optional<std::result_of_t<Func(const Entry&)>> {
+            auto i = _entries.find(key, Compare());
+            if (i == _entries.end()) {
+                ++_stats.misses;
+                return { };
+            }
+            if (!valid(*i)) {
+                with_allocator(_region.allocator(), [&] {
+                    erase(i, std::next(i));
+                });
+                ++_stats.misses;
+                return { };
+            }
+            ++_stats.hits;
+            touch(*i);
+            return func(*i);
+        });
+    }
+
+    template <typename Key, typename Func>
+    auto lookup(const Key& key, Func&& func) {
+        return lookup(key, std::forward<Func>(func), [] (const Entry&) { return true; });
+    }
+
+    // Inserts the entry constructed from args, unless there is an entry of
+    // given key already, which is passed to update() instead. Either way, the
+    // entry becomes the most recently used one.
+    template <typename Key, typename Update, typename... Args>
+    void insert(const Key& key, Update&& update, Args&&... args) {
+        if (!enabled()) {
+            return;
+        }
+        with_allocator(_region.allocator(), [&] {
+            with_linearized_managed_bytes([&] {
+                logalloc::reclaim_lock _(_region);
+                auto i = _entries.lower_bound(key, Compare());
+                // The cache is an optimization only, failing to allocate an
+                // entry mustn't fail the operation which fills it.
+                if (i != _entries.end() && !Compare()(key, *i)) {
+                    try {
+                        update(*i);
+                    } catch (const std::bad_alloc&) {
+                        erase(i, std::next(i));
+                        return;
+                    }
+                    touch(*i);
+                } else {
+                    Entry* e;
+                    try {
+                        e = current_allocator().construct<Entry>(std::forward<Args>(args)...);
+                    } catch (const std::bad_alloc&) {
+                        return;
+                    }
+                    _entries.insert(i, *e);
+                    _lru.push_front(*e);
+                    ++_stats.entries;
+                    ++_stats.insertions;
+                }
+                shrink_to_capacity();
+            });
+        });
+    }
+
+    // Removes all entries matching given partial key.
+    template <typename Key>
+    void invalidate(const Key& key) {
+        if (_entries.empty()) {
+            return;
+        }
+        with_allocator(_region.allocator(), [&] {
+            with_linearized_managed_bytes([&] {
+                erase(_entries.lower_bound(key, Compare()), _entries.upper_bound(key, Compare()));
+            });
+        });
+    }
+
+    void clear() {
+        with_allocator(_region.allocator(), [this] {
+            with_linearized_managed_bytes([this] {
+                _stats.removals += _stats.entries;
+                _stats.entries = 0;
+                _entries.clear_and_dispose(current_deleter<Entry>());
+            });
+        });
+    }
+
+    // Sets the amount of memory the cache may occupy. 0 disables the cache.
+    void set_capacity(size_t bytes) {
+        _capacity = bytes;
+        if (!_capacity) {
+            clear();
+            return;
+        }
+        with_allocator(_region.allocator(), [this] {
+            with_linearized_managed_bytes([this] {
+                shrink_to_capacity();
+            });
+        });
+    }
+
+    size_t capacity() const { return _capacity; }
+    bool enabled() const { return _capacity != 0; }
+
+    const stats& get_stats() const { return _stats; }
+    const logalloc::region& region() const { return _region; }
+};
+
+}
@@ -40,6 +40,7 @@
 
 #include <cstdint>
 #include <array>
+#include <algorithm>
 
 #include "bytes.hh"
 
@@ -167,6 +168,101 @@ void hash3_x64_128(InputIterator in, uint32_t length, uint64_t seed, std::array<
 
 void hash3_x64_128(bytes_view key, uint64_t seed, std::array<uint64_t, 2>& result);
 
+// Incremental version of hash3_x64_128(). Data fed through any sequence of
+// update() calls hashes the same as if it were passed to hash3_x64_128() in
+// one piece, except for tail bytes with the highest bit set, which aren't
+// sign-extended here.
+class hasher3_x64_128 {
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t _h1;
+    uint64_t _h2;
+    uint64_t _length = 0;
+    std::array<uint8_t, 16> _buf;
+    size_t _buf_size = 0;
+private:
+    static uint64_t load(const uint8_t* p) {
+        return uint64_t(p[0])
+                | (uint64_t(p[1]) << 8)
+                | (uint64_t(p[2]) << 16)
+                | (uint64_t(p[3]) << 24)
+                | (uint64_t(p[4]) << 32)
+                | (uint64_t(p[5]) << 40)
+                | (uint64_t(p[6]) << 48)
+                | (uint64_t(p[7]) << 56);
+    }
+    void block(const uint8_t* p) {
+        uint64_t k1 = load(p);
+        uint64_t k2 = load(p + 8);
+
+        k1 *= c1; k1 = rotl64(k1,31); k1 *= c2; _h1 ^= k1;
+
+        _h1 = rotl64(_h1,27); _h1 += _h2; _h1 = _h1*5+0x52dce729;
+
+        k2 *= c2; k2  = rotl64(k2,33); k2 *= c1; _h2 ^= k2;
+
+        _h2 = rotl64(_h2,31); _h2 += _h1; _h2 = _h2*5+0x38495ab5;
+    }
+public:
+    explicit hasher3_x64_128(uint64_t seed = 0) : _h1(seed), _h2(seed) { }
+
+    void update(const char* ptr, size_t length) {
+        auto p = reinterpret_cast<const uint8_t*>(ptr);
+        _length += length;
+        if (_buf_size) {
+            auto n = std::min(length, _buf.size() - _buf_size);
+            std::copy_n(p, n, _buf.begin() + _buf_size);
+            _buf_size += n;
+            p += n;
+            length -= n;
+            if (_buf_size < _buf.size()) {
+                return;
+            }
+            block(_buf.data());
+            _buf_size = 0;
+        }
+        for (; length >= 16; p += 16, length -= 16) {
+            block(p);
+        }
+        std::copy_n(p, length, _buf.begin());
+        _buf_size = length;
+    }
+
+    void finalize(std::array<uint64_t, 2>& result) {
+        uint64_t h1 = _h1;
+        uint64_t h2 = _h2;
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+        for (size_t i = _buf_size; i > 8; --i) {
+            k2 ^= uint64_t(_buf[i - 1]) << (8 * (i - 9));
+        }
+        if (_buf_size > 8) {
+            k2 *= c2; k2  = rotl64(k2,33); k2 *= c1; h2 ^= k2;
+        }
+        for (size_t i = std::min<size_t>(_buf_size, 8); i > 0; --i) {
+            k1 ^= uint64_t(_buf[i - 1]) << (8 * (i - 1));
+        }
+        if (_buf_size) {
+            k1 *= c1; k1  = rotl64(k1,31); k1 *= c2; h1 ^= k1;
+        }
+
+        h1 ^= uint32_t(_length);
+        h2 ^= uint32_t(_length);
+
+        h1 += h2;
+        h2 += h1;
+
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+
+        h1 += h2;
+        h2 += h1;
+
+        result[0] = h1;
+        result[1] = h2;
+    }
+};
+
 } // namespace murmur_hash
 
 } // namespace utils
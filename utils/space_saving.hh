@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace utils {
+
+// Finds the most frequent keys of a stream in bounded memory, using the
+// Space-Saving algorithm of Metwally et al.
+//
+// At most capacity keys are monitored. A key which isn't monitored when the
+// summary is full takes the place of the least frequent monitored one, and
+// inherits its count as the error bound. A key's count is never lower than
+// its true frequency and at most error higher, and every key more frequent
+// than 1/capacity of the stream is guaranteed to be monitored.
+//
+// Along with the count, every key accumulates the weights it was offered
+// with since it was last admitted, e.g. the bytes read or written.
+template<typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class space_saving {
+public:
+    struct counter {
+        Key key;
+        uint64_t count;
+        uint64_t error;
+        uint64_t weight;
+    };
+private:
+    struct entry {
+        uint64_t count = 0;
+        uint64_t error = 0;
+        uint64_t weight = 0;
+        size_t heap_index = 0;
+    };
+    using map_type = std::unordered_map<Key, entry, Hash, KeyEqual>;
+    using node = typename map_type::value_type;
+
+    size_t _capacity;
+    map_type _entries;
+    // Min-heap of monitored keys by count.
+    std::vector<node*> _heap;
+private:
+    void swap_nodes(size_t i, size_t j) {
+        std::swap(_heap[i], _heap[j]);
+        _heap[i]->second.heap_index = i;
+        _heap[j]->second.heap_index = j;
+    }
+    // Counts only ever grow, so a node can only move down the heap.
+    void sift_down(size_t i) {
+        for (;;) {
+            auto smallest = i;
+            auto l = 2 * i + 1;
+            auto r = l + 1;
+            if (l < _heap.size() && _heap[l]->second.count < _heap[smallest]->second.count) {
+                smallest = l;
+            }
+            if (r < _heap.size() && _heap[r]->second.count < _heap[smallest]->second.count) {
+                smallest = r;
+            }
+            if (smallest == i) {
+                return;
+            }
+            swap_nodes(i, smallest);
+            i = smallest;
+        }
+    }
+public:
+    explicit space_saving(size_t capacity, const Hash& hash = Hash(), const KeyEqual& equal = KeyEqual())
+        : _capacity(std::max<size_t>(capacity, 1))
+        , _entries(_capacity, hash, equal)
+    {
+        _heap.reserve(_capacity);
+    }
+
+    space_saving(const space_saving&) = delete;
+    space_saving(space_saving&&) = default;
+
+    void offer(const Key& key, uint64_t weight = 0) {
+        auto i = _entries.find(key);
+        if (i == _entries.end()) {
+            if (_heap.size() < _capacity) {
+                i = _entries.emplace(key, entry()).first;
+                i->second.heap_index = _heap.size();
+                _heap.push_back(&*i);
+            } else {
+                auto victim = _heap.front();
+                auto min = victim->second.count;
+                _entries.erase(_entries.find(victim->first));
+                i = _entries.emplace(key, entry()).first;
+                i->second.count = min;
+                i->second.error = min;
+                _heap.front() = &*i;
+            }
+        }
+        auto& e = i->second;
+        ++e.count;
+        e.weight += weight;
+        sift_down(e.heap_index);
+    }
+
+    size_t size() const {
+        return _heap.size();
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    // Returns the k monitored keys with the highest counts, most frequent first.
+    std::vector<counter> top(size_t k) const {
+        std::vector<counter> res;
+        res.reserve(_heap.size());
+        for (auto&& n : _heap) {
+            res.push_back(counter{n->first, n->second.count, n->second.error, n->second.weight});
+        }
+        std::sort(res.begin(), res.end(), [] (const counter& a, const counter& b) {
+            return a.count > b.count;
+        });
+        res.resize(std::min(res.size(), k));
+        return res;
+    }
+};
+
+}
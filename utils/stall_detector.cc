@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utils/stall_detector.hh"
+#include <execinfo.h>
+#include <seastar/util/log.hh>
+#include "core/print.hh"
+#include "core/sstring.hh"
+
+static seastar::logger logger("stall_detector");
+
+namespace utils {
+
+constexpr std::chrono::seconds stall_detector::backtrace_interval;
+
+const char* to_string(stall_subsystem s) {
+    switch (s) {
+    case stall_subsystem::row_cache_update: return "row_cache_update";
+    case stall_subsystem::compaction: return "compaction";
+    case stall_subsystem::token_metadata: return "token_metadata";
+    case stall_subsystem::schema_merge: return "schema_merge";
+    }
+    abort();
+}
+
+stall_detector& local_stall_detector() {
+    static thread_local stall_detector instance;
+    return instance;
+}
+
+stall_detector::stall_detector() {
+    setup_collectd();
+}
+
+void stall_detector::setup_collectd() {
+    for (unsigned i = 0; i < stall_subsystem_count; ++i) {
+        auto name = to_string(stall_subsystem(i));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("stall_detector"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", name)
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats[i].count)
+        ));
+        _collectd_registrations.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("stall_detector"
+                , scollectd::per_cpu_plugin_instance
+                , "total_time_in_ms", name)
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this, i] {
+                    return std::chrono::duration_cast<std::chrono::milliseconds>(_stats[i].total).count();
+                })
+        ));
+    }
+}
+
+void stall_detector::report(stall_subsystem s, clock::duration elapsed) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+    auto& st = _stats[unsigned(s)];
+    ++st.count;
+    st.total += us;
+    st.max = std::max(st.max, us);
+
+    auto now = clock::now();
+    auto& last = _last_backtrace[unsigned(s)];
+    if (now - last < backtrace_interval) {
+        return;
+    }
+    last = now;
+    void* addrs[32];
+    auto n = ::backtrace(addrs, 32);
+    sstring bt;
+    for (int i = 0; i < n; ++i) {
+        bt += sprint(" %p", addrs[i]);
+    }
+    logger.warn("Reactor stalled for {} us in {}, backtrace:{}", us.count(), to_string(s), bt);
+}
+
+}
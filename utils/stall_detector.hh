@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <seastar/core/scollectd.hh>
+
+namespace utils {
+
+// Subsystems whose long running synchronous sections are tracked.
+enum class stall_subsystem : unsigned {
+    row_cache_update,
+    compaction,
+    token_metadata,
+    schema_merge,
+};
+
+constexpr unsigned stall_subsystem_count = 4;
+
+const char* to_string(stall_subsystem s);
+
+struct stall_stats {
+    uint64_t count = 0;
+    std::chrono::microseconds total{0};
+    std::chrono::microseconds max{0};
+
+    stall_stats& operator+=(const stall_stats& o) {
+        count += o.count;
+        total += o.total;
+        max = std::max(max, o.max);
+        return *this;
+    }
+};
+
+// Per-shard account of synchronous sections which kept the reactor busy for
+// longer than the threshold (the task quota by default), by subsystem.
+//
+// The sections are marked with stall_scope. For each stall the backtrace of
+// the code which ends the section is logged, at most once per subsystem
+// every backtrace_interval, so that the caller can be found with addr2line.
+class stall_detector {
+public:
+    using clock = std::chrono::steady_clock;
+    using stats_type = std::array<stall_stats, stall_subsystem_count>;
+    static constexpr std::chrono::seconds backtrace_interval{10};
+private:
+    clock::duration _threshold = std::chrono::milliseconds(2);
+    stats_type _stats;
+    std::array<clock::time_point, stall_subsystem_count> _last_backtrace;
+    std::vector<scollectd::registration> _collectd_registrations;
+    unsigned _running_scopes = 0;
+private:
+    void setup_collectd();
+public:
+    stall_detector();
+
+    void set_threshold(clock::duration threshold) {
+        _threshold = threshold;
+    }
+    clock::duration threshold() const {
+        return _threshold;
+    }
+
+    void report(stall_subsystem s, clock::duration elapsed);
+
+    const stats_type& get_stats() const {
+        return _stats;
+    }
+
+    friend class stall_scope;
+};
+
+// Returns a reference to the shard-wide stall_detector.
+stall_detector& local_stall_detector();
+
+// Measures the time until it is destroyed and reports it to the shard's
+// stall_detector if it exceeds the threshold. The section must not defer;
+// if it yields, wrap the yield in pause() and resume() so that the time
+// spent by other tasks is not counted. Scopes nested in a running one are
+// not measured separately, the outer one accounts for them.
+class stall_scope {
+    stall_subsystem _subsystem;
+    stall_detector::clock::time_point _start;
+    bool _running = false;
+    bool _outermost = false;
+public:
+    explicit stall_scope(stall_subsystem s)
+        : _subsystem(s)
+    {
+        resume();
+    }
+    stall_scope(const stall_scope&) = delete;
+    stall_scope& operator=(const stall_scope&) = delete;
+    ~stall_scope() {
+        pause();
+    }
+
+    void pause() {
+        if (_running) {
+            _running = false;
+            auto& detector = local_stall_detector();
+            --detector._running_scopes;
+            if (_outermost) {
+                auto elapsed = stall_detector::clock::now() - _start;
+                if (elapsed >= detector.threshold()) {
+                    detector.report(_subsystem, elapsed);
+                }
+            }
+        }
+    }
+
+    void resume() {
+        if (!_running) {
+            _running = true;
+            _outermost = local_stall_detector()._running_scopes++ == 0;
+            if (_outermost) {
+                _start = stall_detector::clock::now();
+            }
+        }
+    }
+};
+
+}
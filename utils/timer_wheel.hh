@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <boost/intrusive/list.hpp>
+#include "core/timer.hh"
+
+namespace utils {
+
+// Hashed timer wheel, for large numbers of coarse timers which are usually
+// cancelled before they fire, like request timeouts.
+//
+// Timers are intrusive entries embedded in the objects they time out, so
+// arming and cancelling one is O(1) and doesn't allocate. Deadlines are
+// rounded up to the granularity of the wheel. A single seastar timer
+// advances the wheel, and only while some entry is armed.
+class timer_wheel {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    class entry : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+        timer_wheel* _wheel = nullptr;
+        clock_type::time_point _deadline;
+        friend class timer_wheel;
+    public:
+        entry() = default;
+        entry(const entry&) = delete;
+        entry& operator=(const entry&) = delete;
+        ~entry() {
+            cancel();
+        }
+        bool armed() const {
+            return is_linked();
+        }
+        // Returns true if the entry was armed.
+        bool cancel() {
+            if (!is_linked()) {
+                return false;
+            }
+            unlink();
+            --_wheel->_armed;
+            return true;
+        }
+    };
+private:
+    using list_type = boost::intrusive::list<entry, boost::intrusive::constant_time_size<false>>;
+
+    clock_type::duration _granularity;
+    std::vector<list_type> _slots;
+    uint64_t _current_tick;
+    size_t _armed = 0;
+    std::function<void (entry&)> _on_expiry;
+    timer<> _timer;
+private:
+    uint64_t floor_tick(clock_type::time_point tp) const {
+        return tp.time_since_epoch() / _granularity;
+    }
+    uint64_t ceil_tick(clock_type::time_point tp) const {
+        return (tp.time_since_epoch() + _granularity - clock_type::duration(1)) / _granularity;
+    }
+    clock_type::time_point time_of(uint64_t tick) const {
+        return clock_type::time_point(_granularity * static_cast<clock_type::rep>(tick));
+    }
+    void advance() {
+        auto now = clock_type::now();
+        auto target = floor_tick(now);
+        // After a long stall, going around the wheel once visits every entry.
+        auto n = std::min<uint64_t>(target - _current_tick, _slots.size());
+        list_type expired;
+        for (uint64_t i = 1; i <= n; ++i) {
+            auto& slot = _slots[(_current_tick + i) % _slots.size()];
+            // Entries are left in place if their deadline is further than
+            // a revolution of the wheel away.
+            for (auto it = slot.begin(); it != slot.end();) {
+                auto& e = *it++;
+                if (e._deadline <= now) {
+                    e.unlink();
+                    expired.push_back(e);
+                }
+            }
+        }
+        _current_tick = target;
+        // The callbacks may arm and cancel entries, including expired ones.
+        while (!expired.empty()) {
+            auto& e = expired.front();
+            expired.pop_front();
+            --_armed;
+            _on_expiry(e);
+        }
+        if (_armed && !_timer.armed()) {
+            _timer.arm(time_of(_current_tick + 1));
+        }
+    }
+public:
+    timer_wheel(clock_type::duration granularity, size_t nr_slots, std::function<void (entry&)> on_expiry)
+        : _granularity(granularity)
+        , _slots(nr_slots)
+        , _current_tick(floor_tick(clock_type::now()))
+        , _on_expiry(std::move(on_expiry))
+        , _timer([this] { advance(); }) {
+    }
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+    ~timer_wheel() {
+        for (auto& slot : _slots) {
+            slot.clear();
+        }
+    }
+
+    // (Re)arms the entry to expire at the given time.
+    void arm(entry& e, clock_type::time_point deadline) {
+        e.cancel();
+        if (!_timer.armed()) {
+            // The wheel doesn't advance while idle.
+            _current_tick = floor_tick(clock_type::now());
+        }
+        e._wheel = this;
+        e._deadline = deadline;
+        auto tick = std::max(ceil_tick(deadline), _current_tick + 1);
+        _slots[tick % _slots.size()].push_back(e);
+        ++_armed;
+        if (!_timer.armed()) {
+            _timer.arm(time_of(_current_tick + 1));
+        }
+    }
+
+    size_t armed() const {
+        return _armed;
+    }
+};
+
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <limits>
+#include <vector>
+
+// Tournament tree for n-way merges of sorted sources.
+//
+// Keeps track of which of n sources has the smallest head element, using
+// a comparator of source indexes, Less(i, j), which tells if the head of i
+// is smaller than the head of j. The user owns the heads and tells the tree
+// when a source leaves, after its head was taken, and when it comes back
+// with a new head.
+//
+// Each internal node holds the winner of its subtree, so unlike a loser tree
+// any source can be (re)inserted, not only the last winner. Inserting or
+// removing a source replays the matches on its path to the root only, at
+// most one comparison per level, and stops as soon as a match result
+// doesn't change. Compared with a binary heap, which needs about 2*log(n)
+// comparisons to pop and moves elements around, sources are never moved.
+//
+// If a source comes back with a head which is still smaller than all the
+// others, it is kept aside as the "champion" and doesn't enter the tree at
+// all. So when one source is far ahead of the others, each step costs a
+// single comparison, regardless of n.
+template<typename Less>
+class tournament_tree {
+public:
+    static constexpr size_t none = std::numeric_limits<size_t>::max();
+private:
+    // Leaf of source i is at _nodes[_size + i], internal node p has children
+    // 2p and 2p + 1, and the root is at _nodes[1]. none marks absence.
+    std::vector<size_t> _nodes;
+    size_t _size;
+    size_t _champion = none;
+    Less _less;
+private:
+    size_t winner_of(size_t a, size_t b) const {
+        if (a == none) {
+            return b;
+        }
+        if (b == none) {
+            return a;
+        }
+        return _less(b, a) ? b : a;
+    }
+    void replay(size_t i) {
+        for (auto p = (_size + i) / 2; p >= 1; p /= 2) {
+            auto w = winner_of(_nodes[2 * p], _nodes[2 * p + 1]);
+            if (w == _nodes[p] && w != i) {
+                // Nothing above depends on source i.
+                break;
+            }
+            _nodes[p] = w;
+        }
+    }
+    size_t tree_top() const {
+        return _size ? _nodes[1] : none;
+    }
+    void insert(size_t i) {
+        _nodes[_size + i] = i;
+        replay(i);
+    }
+public:
+    // All sources start out absent.
+    explicit tournament_tree(size_t size, Less less = Less())
+        : _nodes(2 * size, none)
+        , _size(size)
+        , _less(std::move(less))
+    { }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _champion == none && tree_top() == none;
+    }
+
+    // Returns the source with the smallest head. Among sources with equal
+    // heads, any of them.
+    // Requires !empty().
+    size_t top() const {
+        return _champion != none ? _champion : tree_top();
+    }
+
+    // Removes the source returned by top().
+    void pop() {
+        if (_champion != none) {
+            _champion = none;
+            return;
+        }
+        auto i = tree_top();
+        _nodes[_size + i] = none;
+        replay(i);
+    }
+
+    // Inserts source i, which must be absent, with its new head.
+    void push(size_t i) {
+        if (_champion != none) {
+            insert(_champion);
+            _champion = none;
+        }
+        auto t = tree_top();
+        if (t == none || _less(i, t)) {
+            _champion = i;
+        } else {
+            insert(i);
+        }
+    }
+};
+
+template<typename Less>
+constexpr size_t tournament_tree<Less>::none;
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utf8.hh"
+#include <cstring>
+#include <immintrin.h>
+
+// UTF-8 validation after "Validating UTF-8 In Less Than One Instruction Per
+// Byte" by Keiser and Lemire.
+//
+// A byte and the byte before it determine almost every kind of error: each
+// of the high nibble of the previous byte, its low nibble and the high
+// nibble of the current byte is mapped through a 16-entry table to the set
+// of errors it can be part of, and the pair is in error when all three
+// sets share a bit. The remaining case, the third and fourth bytes of
+// three and four byte sequences, is checked by looking two and three bytes
+// back for a lead byte which expects them to be continuations.
+//
+// The SSE4 kernel is always available, the build targets Nehalem. The AVX2
+// kernel is picked at startup if the CPU supports it.
+
+namespace utils {
+
+namespace {
+
+constexpr uint8_t too_short = 1 << 0;      // 11______ 0_______, 11______ 11______
+constexpr uint8_t too_long = 1 << 1;       // 0_______ 10______
+constexpr uint8_t overlong_3 = 1 << 2;     // 11100000 100_____
+constexpr uint8_t too_large = 1 << 3;      // 11110100 1001____, 11110100 101_____, 111101__ 10______ ...
+constexpr uint8_t surrogate = 1 << 4;      // 11101101 101_____
+constexpr uint8_t overlong_2 = 1 << 5;     // 1100000_ 10______
+constexpr uint8_t too_large_1000 = 1 << 6; // 11110101 1000____, 1111011_ 1000____, 11111___ 1000____
+constexpr uint8_t overlong_4 = 1 << 6;     // 11110000 1000____
+constexpr uint8_t two_conts = 1 << 7;      // 10______ 10______
+constexpr uint8_t carry = too_short | too_long | two_conts;
+
+#define UTF8_BYTE_1_HIGH \
+    too_long, too_long, too_long, too_long, \
+    too_long, too_long, too_long, too_long, \
+    two_conts, two_conts, two_conts, two_conts, \
+    too_short | overlong_2, \
+    too_short, \
+    too_short | overlong_3 | surrogate, \
+    too_short | too_large | too_large_1000 | overlong_4
+
+#define UTF8_BYTE_1_LOW \
+    carry | overlong_3 | overlong_2 | overlong_4, \
+    carry | overlong_2, \
+    carry, \
+    carry, \
+    carry | too_large, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000 | surrogate, \
+    carry | too_large | too_large_1000, \
+    carry | too_large | too_large_1000
+
+#define UTF8_BYTE_2_HIGH \
+    too_short, too_short, too_short, too_short, \
+    too_short, too_short, too_short, too_short, \
+    too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4, \
+    too_long | overlong_2 | two_conts | overlong_3 | too_large, \
+    too_long | overlong_2 | two_conts | surrogate | too_large, \
+    too_long | overlong_2 | two_conts | surrogate | too_large, \
+    too_short, too_short, too_short, too_short
+
+// Subtracted with saturation from the last bytes of a block, leaves a non
+// zero byte where a sequence is cut short by the end of the block.
+#define UTF8_INCOMPLETE_TAIL 0xef, 0xdf, 0xbf
+
+class sse_utf8_checker {
+    __m128i _error = _mm_setzero_si128();
+    __m128i _prev_input = _mm_setzero_si128();
+    __m128i _prev_incomplete = _mm_setzero_si128();
+private:
+    static __m128i high_nibbles(__m128i v) {
+        return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+    }
+    static __m128i lookup(__m128i table, __m128i nibbles) {
+        return _mm_shuffle_epi8(table, nibbles);
+    }
+    void check_multibyte(__m128i input) {
+        const __m128i byte_1_high_table = _mm_setr_epi8(UTF8_BYTE_1_HIGH);
+        const __m128i byte_1_low_table = _mm_setr_epi8(UTF8_BYTE_1_LOW);
+        const __m128i byte_2_high_table = _mm_setr_epi8(UTF8_BYTE_2_HIGH);
+        const __m128i incomplete_max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, UTF8_INCOMPLETE_TAIL);
+
+        auto prev1 = _mm_alignr_epi8(input, _prev_input, 15);
+        auto special_cases = _mm_and_si128(_mm_and_si128(
+                lookup(byte_1_high_table, high_nibbles(prev1)),
+                lookup(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0f)))),
+                lookup(byte_2_high_table, high_nibbles(input)));
+
+        auto prev2 = _mm_alignr_epi8(input, _prev_input, 14);
+        auto prev3 = _mm_alignr_epi8(input, _prev_input, 13);
+        auto is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80));
+        auto is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80));
+        auto must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8(0x80));
+
+        _error = _mm_or_si128(_error, _mm_xor_si128(must_be_continuation, special_cases));
+        _prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+    }
+public:
+    void check(__m128i input) {
+        if (_mm_movemask_epi8(input) == 0) {
+            _error = _mm_or_si128(_error, _prev_incomplete);
+            _prev_incomplete = _mm_setzero_si128();
+        } else {
+            check_multibyte(input);
+        }
+        _prev_input = input;
+    }
+    bool valid() const {
+        auto error = _mm_or_si128(_error, _prev_incomplete);
+        return _mm_testz_si128(error, error);
+    }
+};
+
+class avx2_utf8_checker {
+    __m256i _error = _mm256_setzero_si256();
+    __m256i _prev_input = _mm256_setzero_si256();
+    __m256i _prev_incomplete = _mm256_setzero_si256();
+private:
+    __attribute__((target("avx2")))
+    static __m256i high_nibbles(__m256i v) {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+    }
+    // vpshufb looks up each 128-bit lane separately, so the table is
+    // repeated in both.
+    __attribute__((target("avx2")))
+    static __m256i lookup(__m256i table, __m256i nibbles) {
+        return _mm256_shuffle_epi8(table, nibbles);
+    }
+    // Shifts the bytes of input up by n, bringing in the last n bytes of
+    // prev.
+    template <int N>
+    __attribute__((target("avx2")))
+    static __m256i shift_in(__m256i input, __m256i prev) {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+    }
+    __attribute__((target("avx2")))
+    void check_multibyte(__m256i input) {
+        const __m256i byte_1_high_table = _mm256_setr_epi8(UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH);
+        const __m256i byte_1_low_table = _mm256_setr_epi8(UTF8_BYTE_1_LOW, UTF8_BYTE_1_LOW);
+        const __m256i byte_2_high_table = _mm256_setr_epi8(UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH);
+        const __m256i incomplete_max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, UTF8_INCOMPLETE_TAIL);
+
+        auto prev1 = shift_in<1>(input, _prev_input);
+        auto special_cases = _mm256_and_si256(_mm256_and_si256(
+                lookup(byte_1_high_table, high_nibbles(prev1)),
+                lookup(byte_1_low_table, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)))),
+                lookup(byte_2_high_table, high_nibbles(input)));
+
+        auto prev2 = shift_in<2>(input, _prev_input);
+        auto prev3 = shift_in<3>(input, _prev_input);
+        auto is_third_byte = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80));
+        auto is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80));
+        auto must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8(0x80));
+
+        _error = _mm256_or_si256(_error, _mm256_xor_si256(must_be_continuation, special_cases));
+        _prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+    }
+public:
+    __attribute__((target("avx2")))
+    avx2_utf8_checker() = default;
+
+    __attribute__((target("avx2")))
+    void check(__m256i input) {
+        if (_mm256_movemask_epi8(input) == 0) {
+            _error = _mm256_or_si256(_error, _prev_incomplete);
+            _prev_incomplete = _mm256_setzero_si256();
+        } else {
+            check_multibyte(input);
+        }
+        _prev_input = input;
+    }
+    __attribute__((target("avx2")))
+    bool valid() const {
+        auto error = _mm256_or_si256(_error, _prev_incomplete);
+        return _mm256_testz_si256(error, error);
+    }
+};
+
+#undef UTF8_BYTE_1_HIGH
+#undef UTF8_BYTE_1_LOW
+#undef UTF8_BYTE_2_HIGH
+#undef UTF8_INCOMPLETE_TAIL
+
+// The tail of the input is validated as a zero padded block. Zeros are
+// ASCII, so a sequence cut short by the end of the input is still caught.
+
+bool validate_utf8_sse(const uint8_t* data, size_t len) {
+    sse_utf8_checker checker;
+    for (; len >= 16; data += 16, len -= 16) {
+        checker.check(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    }
+    if (len) {
+        uint8_t block[16] = {};
+        std::memcpy(block, data, len);
+        checker.check(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)));
+    }
+    return checker.valid();
+}
+
+__attribute__((target("avx2")))
+bool validate_utf8_avx2(const uint8_t* data, size_t len) {
+    avx2_utf8_checker checker;
+    for (; len >= 32; data += 32, len -= 32) {
+        checker.check(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)));
+    }
+    if (len) {
+        uint8_t block[32] = {};
+        std::memcpy(block, data, len);
+        checker.check(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)));
+    }
+    return checker.valid();
+}
+
+bool validate_ascii_sse(const uint8_t* data, size_t len) {
+    auto acc = _mm_setzero_si128();
+    for (; len >= 16; data += 16, len -= 16) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    }
+    uint8_t tail = 0;
+    while (len--) {
+        tail |= *data++;
+    }
+    return _mm_movemask_epi8(acc) == 0 && !(tail & 0x80);
+}
+
+__attribute__((target("avx2")))
+bool validate_ascii_avx2(const uint8_t* data, size_t len) {
+    auto acc = _mm256_setzero_si256();
+    for (; len >= 32; data += 32, len -= 32) {
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)));
+    }
+    return _mm256_movemask_epi8(acc) == 0 && validate_ascii_sse(data, len);
+}
+
+bool have_avx2() {
+    // May run before the constructors which initialize the CPU model.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+}
+
+namespace utf8 {
+
+bool validate(const uint8_t* data, size_t len) {
+    static const auto impl = have_avx2() ? validate_utf8_avx2 : validate_utf8_sse;
+    return impl(data, len);
+}
+
+}
+
+namespace ascii {
+
+bool validate(const uint8_t* data, size_t len) {
+    static const auto impl = have_avx2() ? validate_ascii_avx2 : validate_ascii_sse;
+    return impl(data, len);
+}
+
+}
+
+}
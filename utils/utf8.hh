@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "bytes.hh"
+
+namespace utils {
+
+namespace utf8 {
+
+// Returns true if data is well-formed UTF-8: no stray or missing
+// continuation bytes, no overlong encodings, no surrogates and no code
+// points above U+10FFFF.
+//
+// Validates 16 bytes at a time with SSE4, or 32 at a time with AVX2
+// where the CPU has it.
+bool validate(const uint8_t* data, size_t len);
+
+inline bool validate(bytes_view v) {
+    return validate(reinterpret_cast<const uint8_t*>(v.data()), v.size());
+}
+
+}
+
+namespace ascii {
+
+// Returns true if no byte of data has the high bit set.
+bool validate(const uint8_t* data, size_t len);
+
+inline bool validate(bytes_view v) {
+    return validate(reinterpret_cast<const uint8_t*>(v.data()), v.size());
+}
+
+}
+
+}